@@ -0,0 +1,102 @@
+// Benchmarks of the hyperspectral stages: converting images to and from the
+// PCA space, and loading ENVI files.
+
+#include <string>
+#include <vector>
+
+#include "hyperspectral/hyperspectral_data_loader.h"
+#include "hyperspectral/spectral_pca.h"
+#include "image/image_data.h"
+#include "util/util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "benchmark/benchmark.h"
+
+#include "benchmark_util.h"
+
+namespace super_resolution {
+namespace {
+
+using benchmark_util::CreateRandomImage;
+using benchmark_util::GetImageBytes;
+
+// Arguments: image size, number of bands, number of PCA bands, number of
+// threads.
+void SpectralPCAArguments(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"size", "bands", "pca_bands", "threads"});
+  for (const int image_size : {64, 256}) {
+    for (const int num_bands : {32, 128}) {
+      for (const int num_pca_bands : {4, 16}) {
+        for (const int num_threads : {1, 4}) {
+          benchmark->Args({image_size, num_bands, num_pca_bands, num_threads});
+        }
+      }
+    }
+  }
+}
+
+// Projects an image into the PCA space and reconstructs it.
+void BM_SpectralPCAProjection(benchmark::State& state) {
+  const ImageData image = CreateRandomImage(
+      cv::Size(state.range(0), state.range(0)), state.range(1));
+  SpectralPCAOptions options;
+  options.num_threads = state.range(3);
+  const SpectralPCA spectral_pca(
+      {image}, static_cast<int>(state.range(2)), options);
+  for (auto _ : state) {
+    const ImageData pca_image = spectral_pca.GetPCAImage(image);
+    const ImageData reconstructed_image =
+        spectral_pca.ReconstructImage(pca_image);
+    benchmark::DoNotOptimize(reconstructed_image.GetChannelData(0));
+  }
+  state.SetBytesProcessed(state.iterations() * 2 * GetImageBytes(image));
+}
+BENCHMARK(BM_SpectralPCAProjection)
+    ->Apply(SpectralPCAArguments)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Arguments: image size, number of bands, interleave format.
+void ENVILoaderArguments(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"size", "bands", "interleave"});
+  for (const int image_size : {64, 256}) {
+    for (const int num_bands : {32, 128}) {
+      for (const int interleave : {
+          HSI_BINARY_INTERLEAVE_BSQ,
+          HSI_BINARY_INTERLEAVE_BIL,
+          HSI_BINARY_INTERLEAVE_BIP}) {
+        benchmark->Args({image_size, num_bands, interleave});
+      }
+    }
+  }
+}
+
+// Loads a float ENVI file that was written before the benchmark. Repeated
+// loads are likely served from the page cache, so this measures parsing and
+// conversion rather than disk speed.
+void BM_ENVILoader(benchmark::State& state) {
+  const std::string file_path = util::GetAbsoluteCodePath(
+      "test_data/test_tmp_dir/benchmark_envi_data");
+  const std::string config_file_path = file_path + ".config";
+  const ImageData image = CreateRandomImage(
+      cv::Size(state.range(0), state.range(0)), state.range(1));
+  HSIBinaryDataFormat data_format;
+  data_format.interleave =
+      static_cast<HSIDataInterleaveFormat>(state.range(2));
+  const HyperspectralDataLoader writer(file_path);
+  writer.SaveImage(image, data_format);
+
+  for (auto _ : state) {
+    HyperspectralDataLoader loader(config_file_path);
+    loader.LoadImageFromENVIFile();
+    benchmark::DoNotOptimize(loader.GetImage().GetNumChannels());
+  }
+  state.SetBytesProcessed(state.iterations() * GetImageBytes(image));
+}
+BENCHMARK(BM_ENVILoader)
+    ->Apply(ENVILoaderArguments)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace super_resolution
@@ -0,0 +1,131 @@
+// Benchmarks of the forward image model, its transpose, and image resizing,
+// which dominate the cost of every data term evaluation and of the initial
+// estimates.
+
+#include <cstdint>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "benchmark/benchmark.h"
+
+#include "benchmark_util.h"
+
+namespace super_resolution {
+namespace {
+
+using benchmark_util::CreateBenchmarkImageModel;
+using benchmark_util::CreateRandomImage;
+using benchmark_util::GetImageBytes;
+using benchmark_util::kNumFrames;
+
+// Arguments: HR image size, number of channels, scale, blur radius.
+void ImageModelArguments(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"size", "channels", "scale", "blur"});
+  for (const int image_size : {128, 512}) {
+    for (const int num_channels : {1, 3, 32}) {
+      for (const int scale : {2, 4}) {
+        for (const int blur_radius : {0, 3}) {
+          benchmark->Args({image_size, num_channels, scale, blur_radius});
+        }
+      }
+    }
+  }
+}
+
+// Applies the forward model of every frame to the HR image.
+void BM_ImageModelApplyToImage(benchmark::State& state) {
+  const cv::Size image_size(state.range(0), state.range(0));
+  const ImageData high_res_image = CreateRandomImage(
+      image_size, state.range(1));
+  const int num_channels = high_res_image.GetNumChannels();
+  const ImageModel image_model = CreateBenchmarkImageModel(
+      state.range(2), state.range(3));
+
+  // The degraded images are written into a reused buffer, like in the data
+  // term.
+  std::vector<double> degraded_image_buffer(
+      high_res_image.GetNumPixels() * num_channels);
+  for (auto _ : state) {
+    for (int frame = 0; frame < kNumFrames; ++frame) {
+      ImageData degraded_image(
+          degraded_image_buffer.data(), image_size, num_channels,
+          WRAP_PIXEL_DATA);
+      image_model.ApplyToImage(high_res_image, frame, &degraded_image);
+      benchmark::DoNotOptimize(degraded_image.GetChannelData(0));
+    }
+  }
+  state.SetBytesProcessed(
+      state.iterations() * kNumFrames * GetImageBytes(high_res_image));
+}
+BENCHMARK(BM_ImageModelApplyToImage)
+    ->Apply(ImageModelArguments)
+    ->Unit(benchmark::kMillisecond);
+
+// Applies the transpose model of every frame to an LR image. The LR image is
+// copied before every application, since the transpose works in place, and
+// the copy is included in the time like it is in the data term.
+void BM_ImageModelApplyTransposeToImage(benchmark::State& state) {
+  const int scale = state.range(2);
+  const cv::Size low_res_size(state.range(0) / scale, state.range(0) / scale);
+  const ImageData low_res_image = CreateRandomImage(
+      low_res_size, state.range(1));
+  const ImageModel image_model = CreateBenchmarkImageModel(
+      scale, state.range(3));
+  for (auto _ : state) {
+    for (int frame = 0; frame < kNumFrames; ++frame) {
+      ImageData image = low_res_image;
+      image_model.ApplyTransposeToImage(&image, frame);
+      benchmark::DoNotOptimize(image.GetChannelData(0));
+    }
+  }
+  state.SetBytesProcessed(
+      state.iterations() * kNumFrames * GetImageBytes(low_res_image) *
+      scale * scale);
+}
+BENCHMARK(BM_ImageModelApplyTransposeToImage)
+    ->Apply(ImageModelArguments)
+    ->Unit(benchmark::kMillisecond);
+
+// Arguments: LR image size, number of channels, scale, interpolation method.
+void ResizeArguments(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"size", "channels", "scale", "method"});
+  for (const int image_size : {128, 512}) {
+    for (const int num_channels : {1, 32}) {
+      for (const int method : {
+          INTERPOLATE_LINEAR,
+          INTERPOLATE_CUBIC,
+          INTERPOLATE_NEAREST,
+          INTERPOLATE_ADDITIVE}) {
+        benchmark->Args({image_size, num_channels, 2, method});
+      }
+    }
+  }
+}
+
+// Upsamples and then downsamples an image with the same interpolation
+// method, so both directions of each method are covered.
+void BM_ResizeImage(benchmark::State& state) {
+  const ImageData image = CreateRandomImage(
+      cv::Size(state.range(0), state.range(0)), state.range(1));
+  const int scale = state.range(2);
+  const ResizeInterpolationMethod method =
+      static_cast<ResizeInterpolationMethod>(state.range(3));
+  for (auto _ : state) {
+    ImageData resized_image = image;
+    resized_image.ResizeImage(scale, method);
+    resized_image.ResizeImage(1.0 / scale, method);
+    benchmark::DoNotOptimize(resized_image.GetChannelData(0));
+  }
+  state.SetBytesProcessed(
+      state.iterations() * GetImageBytes(image) * (1 + scale * scale));
+}
+BENCHMARK(BM_ResizeImage)
+    ->Apply(ResizeArguments)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace super_resolution
@@ -0,0 +1,327 @@
+// Benchmarks of the objective terms evaluated in every solver iteration: the
+// data term (cost and gradient over all frames) and the TV and BTV
+// regularizers with their gradients.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "optimization/btv_regularizer.h"
+#include "optimization/objective_data_term.h"
+#include "optimization/tv_regularizer.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "benchmark/benchmark.h"
+
+#include "benchmark_util.h"
+
+namespace super_resolution {
+namespace {
+
+using benchmark_util::CreateBenchmarkImageModel;
+using benchmark_util::CreateRandomImage;
+using benchmark_util::GetImageBytes;
+using benchmark_util::kNumFrames;
+
+// Returns the estimate as one flat vector of all channels, which is how the
+// solvers pass it to the objective terms.
+std::vector<double> GetFlatImageData(const ImageData& image) {
+  const int64_t num_pixels = image.GetNumPixels();
+  std::vector<double> data(num_pixels * image.GetNumChannels());
+  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+    const double* channel_data = image.GetChannelData(channel);
+    std::copy(
+        channel_data, channel_data + num_pixels,
+        data.begin() + channel * num_pixels);
+  }
+  return data;
+}
+
+// Arguments: HR image size, number of channels, scale, blur radius, number of
+// threads.
+void DataTermArguments(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"size", "channels", "scale", "blur", "threads"});
+  for (const int image_size : {128, 512}) {
+    for (const int num_channels : {1, 8}) {
+      for (const int scale : {2, 4}) {
+        for (const int blur_radius : {0, 3}) {
+          for (const int num_threads : {1, 4}) {
+            benchmark->Args(
+                {image_size, num_channels, scale, blur_radius, num_threads});
+          }
+        }
+      }
+    }
+  }
+}
+
+// Computes the cost and gradient of the data term over all frames.
+void BM_ObjectiveDataTermCompute(benchmark::State& state) {
+  const cv::Size image_size(state.range(0), state.range(0));
+  const int num_channels = state.range(1);
+  const int num_threads = state.range(4);
+  const ImageData high_res_image = CreateRandomImage(image_size, num_channels);
+  const ImageModel image_model = CreateBenchmarkImageModel(
+      state.range(2), state.range(3), num_threads);
+
+  // The data term compares against the observations upsampled to the HR
+  // size, as set up by the MapSolver.
+  std::vector<ImageData> observations;
+  for (int frame = 0; frame < kNumFrames; ++frame) {
+    ImageData observation = image_model.ApplyToImage(high_res_image, frame);
+    observation.ResizeImage(image_size, INTERPOLATE_NEAREST);
+    observations.push_back(observation);
+  }
+  const ObjectiveDataTerm data_term(
+      image_model, observations, 0, num_channels, image_size, num_threads);
+
+  const ImageData estimate = CreateRandomImage(image_size, num_channels);
+  const std::vector<double> estimate_data = GetFlatImageData(estimate);
+  std::vector<double> gradient(estimate_data.size());
+  for (auto _ : state) {
+    std::fill(gradient.begin(), gradient.end(), 0.0);
+    benchmark::DoNotOptimize(
+        data_term.Compute(estimate_data.data(), gradient.data()));
+  }
+  state.SetBytesProcessed(
+      state.iterations() * kNumFrames * GetImageBytes(estimate));
+}
+BENCHMARK(BM_ObjectiveDataTermCompute)
+    ->Apply(DataTermArguments)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Arguments: image size, number of channels.
+void TotalVariationArguments(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"size", "channels"});
+  for (const int image_size : {128, 512, 1024}) {
+    for (const int num_channels : {1, 3, 32}) {
+      benchmark->Args({image_size, num_channels});
+    }
+  }
+}
+
+// Computes the TV regularizer values and gradient of the whole image.
+void BM_TotalVariationWithDifferentiation(benchmark::State& state) {
+  const cv::Size image_size(state.range(0), state.range(0));
+  const int num_channels = state.range(1);
+  const ImageData image = CreateRandomImage(image_size, num_channels);
+  const std::vector<double> image_data = GetFlatImageData(image);
+  const std::vector<double> gradient_constants(image_data.size(), 1.0);
+  const TotalVariationRegularizer regularizer(image_size);
+  std::vector<double> residuals;
+  std::vector<double> gradient;
+  for (auto _ : state) {
+    regularizer.ApplyToImageWithDifferentiation(
+        image_data.data(), gradient_constants, num_channels,
+        &residuals, &gradient);
+    benchmark::DoNotOptimize(gradient.data());
+  }
+  state.SetBytesProcessed(state.iterations() * GetImageBytes(image));
+}
+BENCHMARK(BM_TotalVariationWithDifferentiation)
+    ->Apply(TotalVariationArguments)
+    ->Unit(benchmark::kMillisecond);
+
+// Arguments: image size, number of channels, 3D TV (0 or 1).
+void ChannelLayoutArguments(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"size", "channels", "3d"});
+  for (const int image_size : {512, 1024}) {
+    for (const int num_channels : {2, 3, 4}) {
+      for (const int use_3d_total_variation : {0, 1}) {
+        benchmark->Args({image_size, num_channels, use_3d_total_variation});
+      }
+    }
+  }
+}
+
+// Returns -1, 0 or 1, as the stencil kernels do.
+inline double Sign(const double value) {
+  return static_cast<double>((value > 0.0) - (value < 0.0));
+}
+
+// A prototype of the weighted TV cost and gradient (see
+// Regularizer::AccumulateWeightedGradient) evaluated on an interleaved
+// (pixel-major) copy of the image, in which the channels of every pixel are
+// adjacent. The solvers keep the estimate planar, so the image and weights
+// are interleaved on every call and the residuals and gradient are scattered
+// back, as an interleaved path in the regularizer would have to do. The
+// interleaved buffers are reused between calls.
+double AccumulateInterleavedTotalVariation(
+    const double* image_data,
+    const cv::Size& image_size,
+    const int num_channels,
+    const bool use_3d_total_variation,
+    const double regularization_parameter,
+    const double* weights,
+    std::vector<double>* interleaved_image,
+    std::vector<double>* interleaved_weights,
+    std::vector<double>* interleaved_gradient,
+    double* gradient,
+    double* residuals) {
+
+  const int width = image_size.width;
+  const int height = image_size.height;
+  const int num_pixels = image_size.area();
+  const int num_values = num_pixels * num_channels;
+  interleaved_image->resize(num_values);
+  interleaved_weights->resize(num_values);
+  interleaved_gradient->assign(num_values, 0.0);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const int channel_start = channel * num_pixels;
+    for (int pixel = 0; pixel < num_pixels; ++pixel) {
+      const int index = pixel * num_channels + channel;
+      (*interleaved_image)[index] = image_data[channel_start + pixel];
+      (*interleaved_weights)[index] = weights[channel_start + pixel];
+    }
+  }
+
+  const int row_stride = width * num_channels;
+  double cost = 0.0;
+  for (int row = 0; row < height; ++row) {
+    const bool has_next_row = (row + 1 < height);
+    for (int col = 0; col < width; ++col) {
+      const bool has_next_col = (col + 1 < width);
+      const int pixel = row * width + col;
+      const double* x = interleaved_image->data() + pixel * num_channels;
+      const double* w = interleaved_weights->data() + pixel * num_channels;
+      double* g = interleaved_gradient->data() + pixel * num_channels;
+      for (int channel = 0; channel < num_channels; ++channel) {
+        const double dx =
+            has_next_col ? x[num_channels + channel] - x[channel] : 0.0;
+        const double dy =
+            has_next_row ? x[row_stride + channel] - x[channel] : 0.0;
+        const double dz =
+            (use_3d_total_variation && channel + 1 < num_channels) ?
+            x[channel + 1] - x[channel] : 0.0;
+        const double value = std::abs(dx) + std::abs(dy) + std::abs(dz);
+        residuals[channel * num_pixels + pixel] = value;
+        const double weighted_value = w[channel] * value;
+        cost += weighted_value * value;
+
+        // Each difference x_n - x_p adds s to the gradient at the neighbor
+        // n and subtracts it at the pixel p.
+        const double scale = 2.0 * regularization_parameter * weighted_value;
+        const double sx = scale * Sign(dx);
+        const double sy = scale * Sign(dy);
+        const double sz = scale * Sign(dz);
+        g[num_channels * has_next_col + channel] += sx;
+        g[row_stride * has_next_row + channel] += sy;
+        g[channel + (channel + 1 < num_channels)] += sz;
+        g[channel] -= sx + sy + sz;
+      }
+    }
+  }
+
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const int channel_start = channel * num_pixels;
+    for (int pixel = 0; pixel < num_pixels; ++pixel) {
+      gradient[channel_start + pixel] +=
+          (*interleaved_gradient)[pixel * num_channels + channel];
+    }
+  }
+  return regularization_parameter * cost;
+}
+
+// Computes the weighted TV cost and gradient of a planar image, as the IRLS
+// regularization term does. Compare with
+// BM_TotalVariationInterleavedLayout.
+void BM_TotalVariationPlanarLayout(benchmark::State& state) {
+  const cv::Size image_size(state.range(0), state.range(0));
+  const int num_channels = state.range(1);
+  const ImageData image = CreateRandomImage(image_size, num_channels);
+  const std::vector<double> image_data = GetFlatImageData(image);
+  const std::vector<double> weights(image_data.size(), 0.5);
+  TotalVariationRegularizer regularizer(image_size);
+  regularizer.SetUse3dTotalVariation(state.range(2) != 0);
+  std::vector<double> residuals(image_data.size());
+  std::vector<double> gradient(image_data.size());
+  for (auto _ : state) {
+    std::fill(gradient.begin(), gradient.end(), 0.0);
+    benchmark::DoNotOptimize(regularizer.AccumulateWeightedGradient(
+        image_data.data(), num_channels, 0.01, weights.data(),
+        gradient.data(), residuals.data()));
+  }
+  state.SetBytesProcessed(state.iterations() * GetImageBytes(image));
+}
+BENCHMARK(BM_TotalVariationPlanarLayout)
+    ->Apply(ChannelLayoutArguments)
+    ->Unit(benchmark::kMillisecond);
+
+// The same evaluation as BM_TotalVariationPlanarLayout with the interleaved
+// prototype, which processes the channels of each pixel together. When this
+// was added, the prototype was 2-3x slower for every argument, so the
+// regularizers keep the planar layout.
+void BM_TotalVariationInterleavedLayout(benchmark::State& state) {
+  const cv::Size image_size(state.range(0), state.range(0));
+  const int num_channels = state.range(1);
+  const bool use_3d_total_variation = (state.range(2) != 0);
+  const ImageData image = CreateRandomImage(image_size, num_channels);
+  const std::vector<double> image_data = GetFlatImageData(image);
+  const std::vector<double> weights(image_data.size(), 0.5);
+  std::vector<double> interleaved_image;
+  std::vector<double> interleaved_weights;
+  std::vector<double> interleaved_gradient;
+  std::vector<double> residuals(image_data.size());
+  std::vector<double> gradient(image_data.size());
+  for (auto _ : state) {
+    std::fill(gradient.begin(), gradient.end(), 0.0);
+    benchmark::DoNotOptimize(AccumulateInterleavedTotalVariation(
+        image_data.data(), image_size, num_channels, use_3d_total_variation,
+        0.01, weights.data(), &interleaved_image, &interleaved_weights,
+        &interleaved_gradient, gradient.data(), residuals.data()));
+  }
+  state.SetBytesProcessed(state.iterations() * GetImageBytes(image));
+}
+BENCHMARK(BM_TotalVariationInterleavedLayout)
+    ->Apply(ChannelLayoutArguments)
+    ->Unit(benchmark::kMillisecond);
+
+// Arguments: image size, number of channels, BTV scale range, number of
+// threads.
+void BilateralTotalVariationArguments(
+    benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"size", "channels", "range", "threads"});
+  for (const int image_size : {128, 512}) {
+    for (const int num_channels : {1, 8}) {
+      for (const int scale_range : {1, 2, 3}) {
+        for (const int num_threads : {1, 4}) {
+          benchmark->Args({image_size, num_channels, scale_range, num_threads});
+        }
+      }
+    }
+  }
+}
+
+// Computes the BTV regularizer values and gradient of the whole image.
+void BM_BilateralTotalVariationWithDifferentiation(benchmark::State& state) {
+  const cv::Size image_size(state.range(0), state.range(0));
+  const int num_channels = state.range(1);
+  const ImageData image = CreateRandomImage(image_size, num_channels);
+  const std::vector<double> image_data = GetFlatImageData(image);
+  const std::vector<double> gradient_constants(image_data.size(), 1.0);
+  BilateralTotalVariationRegularizer regularizer(
+      image_size, state.range(2), 0.5);
+  regularizer.SetNumThreads(state.range(3));
+  std::vector<double> residuals;
+  std::vector<double> gradient;
+  for (auto _ : state) {
+    regularizer.ApplyToImageWithDifferentiation(
+        image_data.data(), gradient_constants, num_channels,
+        &residuals, &gradient);
+    benchmark::DoNotOptimize(gradient.data());
+  }
+  state.SetBytesProcessed(state.iterations() * GetImageBytes(image));
+}
+BENCHMARK(BM_BilateralTotalVariationWithDifferentiation)
+    ->Apply(BilateralTotalVariationArguments)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace super_resolution
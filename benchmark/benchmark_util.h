@@ -0,0 +1,68 @@
+// Shared inputs for the microbenchmarks. Every benchmark runs on synthetic
+// random data of a parameterized size, so that no test data is needed and the
+// numbers are comparable between machines and commits.
+
+#ifndef BENCHMARK_BENCHMARK_UTIL_H_
+#define BENCHMARK_BENCHMARK_UTIL_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "benchmark/benchmark.h"
+
+namespace super_resolution {
+namespace benchmark_util {
+
+// The number of low-resolution frames of the benchmarked image models.
+constexpr int kNumFrames = 4;
+
+// Returns an image of the given size and number of channels with uniformly
+// random pixel values in [0, 1]. The values are the same for every call.
+inline ImageData CreateRandomImage(
+    const cv::Size& image_size, const int num_channels) {
+
+  cv::setRNGSeed(0);
+  ImageData image;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    cv::Mat channel_image(image_size, CV_64FC1);
+    cv::randu(channel_image, cv::Scalar(0.0), cv::Scalar(1.0));
+    image.AddChannel(channel_image, DO_NOT_NORMALIZE_IMAGE);
+  }
+  return image;
+}
+
+// Returns an image model with the given scale and blur radius, and a
+// sub-pixel motion shift for each of the kNumFrames frames.
+inline ImageModel CreateBenchmarkImageModel(
+    const int scale, const int blur_radius, const int num_threads = 1) {
+
+  ImageModelParameters parameters;
+  parameters.scale = scale;
+  parameters.blur_radius = blur_radius;
+  parameters.blur_sigma = (blur_radius > 0) ? 1.0 : 0.0;
+  std::vector<MotionShift> motion_shifts;
+  for (int i = 0; i < kNumFrames; ++i) {
+    motion_shifts.push_back(MotionShift(0.5 * i, 0.25 * i));
+  }
+  parameters.motion_sequence = MotionShiftSequence(motion_shifts);
+  parameters.num_threads = num_threads;
+  return ImageModel::CreateImageModel(parameters);
+}
+
+// Returns the number of bytes of a double precision image, for computing the
+// memory throughput of operators that read (or write) every pixel once.
+inline int64_t GetImageBytes(const ImageData& image) {
+  return image.GetNumPixels() * image.GetNumChannels() *
+      static_cast<int64_t>(sizeof(double));
+}
+
+}  // namespace benchmark_util
+}  // namespace super_resolution
+
+#endif  // BENCHMARK_BENCHMARK_UTIL_H_
@@ -0,0 +1,367 @@
+// Python bindings of the image data, the image model, the IRLS MAP solver and
+// the evaluators, so that experiments (e.g. parameter sweeps in a notebook)
+// can keep the observations in memory across solves instead of running the
+// SuperResolution binary for every configuration.
+//
+// ImageData supports the buffer protocol: numpy.asarray(image) is a
+// (channels, rows, cols) view of the pixels without a copy, and
+// ImageData(array) wraps a C-contiguous float64 array of that shape (or of
+// shape (rows, cols) for one channel) without a copy. Wrapped images and the
+// arrays share their pixels, and the arrays are kept alive by the images.
+// Operations that produce new pixels (e.g. ImageModel.apply()) return new
+// images instead of modifying their inputs, so existing array views never
+// refer to freed pixels. Every image is stored contiguously before it is
+// returned to Python, so exposing its buffer never moves the pixels either.
+//
+// Errors in the arguments raise Python exceptions instead of failing a
+// CHECK, which would terminate the interpreter.
+
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "evaluation/peak_signal_to_noise_ratio.h"
+#include "evaluation/structural_similarity.h"
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
+#include "optimization/btv_regularizer.h"
+#include "optimization/irls_map_solver.h"
+#include "optimization/map_solver.h"
+#include "optimization/regularizer.h"
+#include "optimization/tv_regularizer.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "pybind11/numpy.h"
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+namespace py = pybind11;
+
+namespace super_resolution {
+namespace {
+
+// Returns the image with its channels moved into one planar allocation.
+// Every image that is returned to Python goes through this, so that its
+// buffer can be exposed without moving the pixels of earlier array views.
+ImageData MakeContiguousImage(ImageData image) {
+  image.MakeContiguous();
+  return image;
+}
+
+// Returns an image that wraps the given (channels, rows, cols) or
+// (rows, cols) array, or a copy of it if copy_pixels is true.
+ImageData CreateImageFromArray(
+    py::array_t<double, py::array::c_style> array, const bool copy_pixels) {
+
+  if (array.ndim() != 2 && array.ndim() != 3) {
+    throw std::invalid_argument(
+        "The array must have the shape (rows, cols) or "
+        "(channels, rows, cols).");
+  }
+  const int num_channels = (array.ndim() == 3) ? array.shape(0) : 1;
+  const cv::Size image_size(
+      array.shape(array.ndim() - 1), array.shape(array.ndim() - 2));
+  if (num_channels == 0 || image_size.area() == 0) {
+    throw std::invalid_argument("The array is empty.");
+  }
+  if (copy_pixels) {
+    return MakeContiguousImage(
+        ImageData(array.data(), image_size, num_channels));
+  }
+  return ImageData(
+      array.mutable_data(), image_size, num_channels, WRAP_PIXEL_DATA);
+}
+
+// Returns the buffer of the (visible) channels of the image. The channels
+// must be stored one after the other in one allocation, as they are for all
+// images created by this module (see MakeContiguousImage()). The image is
+// never modified here, since that would invalidate the existing views.
+py::buffer_info GetImageBuffer(const ImageData& image) {
+  if (image.GetNumChannels() == 0) {
+    throw py::buffer_error("The image is empty.");
+  }
+  const cv::Mat first_channel = image.GetChannelImage(0);
+  const bool is_single_precision = image.GetPrecision() == SINGLE_PRECISION;
+  const py::ssize_t item_size = first_channel.elemSize();
+  const py::ssize_t num_rows = first_channel.rows;
+  const py::ssize_t num_cols = first_channel.cols;
+  const py::ssize_t channel_bytes = num_rows * num_cols * item_size;
+  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+    const cv::Mat channel_image = image.GetChannelImage(channel);
+    if (!channel_image.isContinuous() ||
+        channel_image.data != first_channel.data + channel * channel_bytes) {
+      throw py::buffer_error("The image channels are not contiguous.");
+    }
+  }
+  return py::buffer_info(
+      first_channel.data,
+      item_size,
+      is_single_precision ?
+          py::format_descriptor<float>::format() :
+          py::format_descriptor<double>::format(),
+      3,
+      {static_cast<py::ssize_t>(image.GetNumChannels()), num_rows, num_cols},
+      {channel_bytes, num_cols * item_size, item_size});
+}
+
+// Returns solver inputs over the given observations. Contiguous double
+// precision observations are wrapped instead of copied, so the observations
+// must outlive the inputs.
+std::shared_ptr<SharedSolverInputs> CreateSolverInputs(
+    const std::vector<const ImageData*>& observations) {
+
+  if (observations.empty()) {
+    throw std::invalid_argument("There are no observations.");
+  }
+  std::vector<ImageData> observation_views;
+  observation_views.reserve(observations.size());
+  for (const ImageData* observation : observations) {
+    if (observation->IsContiguous() &&
+        observation->GetPrecision() == DOUBLE_PRECISION) {
+      observation_views.emplace_back(
+          observation->GetContiguousData(),
+          observation->GetImageSize(),
+          observation->GetNumChannels(),
+          WRAP_PIXEL_DATA);
+    } else {
+      observation_views.push_back(*observation);
+    }
+  }
+  return std::make_shared<SharedSolverInputs>(std::move(observation_views));
+}
+
+std::vector<std::tuple<double, double>> GetMotionShifts(
+    const ImageModelParameters& parameters) {
+
+  std::vector<std::tuple<double, double>> motion_shifts;
+  const MotionShiftSequence& motion_sequence = parameters.motion_sequence;
+  for (int i = 0; i < motion_sequence.GetNumMotionShifts(); ++i) {
+    motion_shifts.emplace_back(motion_sequence[i].dx, motion_sequence[i].dy);
+  }
+  return motion_shifts;
+}
+
+void SetMotionShifts(
+    ImageModelParameters* parameters,
+    const std::vector<std::tuple<double, double>>& motion_shifts) {
+
+  std::vector<MotionShift> shifts;
+  for (const std::tuple<double, double>& motion_shift : motion_shifts) {
+    shifts.emplace_back(std::get<0>(motion_shift), std::get<1>(motion_shift));
+  }
+  parameters->motion_sequence = MotionShiftSequence(shifts);
+}
+
+}  // namespace
+}  // namespace super_resolution
+
+PYBIND11_MODULE(super_resolution, module) {
+  using namespace super_resolution;  // NOLINT
+
+  module.doc() = "Multiframe super-resolution.";
+
+  py::enum_<ImagePrecision>(module, "ImagePrecision")
+      .value("DOUBLE_PRECISION", DOUBLE_PRECISION)
+      .value("SINGLE_PRECISION", SINGLE_PRECISION);
+
+  py::class_<ImageData>(module, "ImageData", py::buffer_protocol())
+      .def(py::init(&CreateImageFromArray),
+           py::arg("array").noconvert(),
+           py::arg("copy") = false,
+           py::keep_alive<1, 2>())
+      .def_buffer(&GetImageBuffer)
+      .def("copy", [](const ImageData& image) {
+        return MakeContiguousImage(image);
+      })
+      .def_property_readonly("num_channels", &ImageData::GetNumChannels)
+      .def_property_readonly("width", [](const ImageData& image) {
+        return image.GetImageSize().width;
+      })
+      .def_property_readonly("height", [](const ImageData& image) {
+        return image.GetImageSize().height;
+      })
+      .def_property_readonly("precision", &ImageData::GetPrecision);
+
+  py::class_<ImageModelParameters>(module, "ImageModelParameters")
+      .def(py::init<>())
+      .def_readwrite("scale", &ImageModelParameters::scale)
+      .def_readwrite(
+          "use_area_downsampling",
+          &ImageModelParameters::use_area_downsampling)
+      .def_readwrite("blur_radius", &ImageModelParameters::blur_radius)
+      .def_readwrite("blur_sigma", &ImageModelParameters::blur_sigma)
+      .def_readwrite(
+          "motion_sequence_path",
+          &ImageModelParameters::motion_sequence_path)
+      .def_property("motion_shifts", &GetMotionShifts, &SetMotionShifts)
+      .def_readwrite(
+          "warp_sequence_path", &ImageModelParameters::warp_sequence_path)
+      .def_readwrite("noise_sigma", &ImageModelParameters::noise_sigma)
+      .def_readwrite("noise_seed", &ImageModelParameters::noise_seed)
+      .def_readwrite(
+          "use_fourier_blur", &ImageModelParameters::use_fourier_blur)
+      .def_readwrite("num_threads", &ImageModelParameters::num_threads);
+
+  py::class_<ImageModel>(module, "ImageModel")
+      .def_static("create", &ImageModel::CreateImageModel)
+      .def_property_readonly("scale", &ImageModel::GetDownsamplingScale)
+      .def("apply",
+           [](const ImageModel& image_model,
+              const ImageData& image,
+              const int index) {
+             return MakeContiguousImage(
+                 image_model.ApplyToImage(image, index));
+           },
+           py::arg("image"), py::arg("index"),
+           py::call_guard<py::gil_scoped_release>())
+      .def("apply_transpose",
+           [](const ImageModel& image_model,
+              const ImageData& image,
+              const int index) {
+             ImageData result = image;
+             image_model.ApplyTransposeToImage(&result, index);
+             return MakeContiguousImage(std::move(result));
+           },
+           py::arg("image"), py::arg("index"),
+           py::call_guard<py::gil_scoped_release>());
+
+  py::class_<Regularizer, std::shared_ptr<Regularizer>>(
+      module, "Regularizer");
+
+  py::class_<TotalVariationRegularizer, Regularizer,
+             std::shared_ptr<TotalVariationRegularizer>>(
+      module, "TotalVariationRegularizer")
+      .def(py::init([](const int width, const int height, const bool use_3d) {
+             std::shared_ptr<TotalVariationRegularizer> regularizer(
+                 new TotalVariationRegularizer(cv::Size(width, height)));
+             regularizer->SetUse3dTotalVariation(use_3d);
+             return regularizer;
+           }),
+           py::arg("width"), py::arg("height"), py::arg("use_3d") = false);
+
+  py::class_<BilateralTotalVariationRegularizer, Regularizer,
+             std::shared_ptr<BilateralTotalVariationRegularizer>>(
+      module, "BilateralTotalVariationRegularizer")
+      .def(py::init([](const int width,
+                       const int height,
+                       const int scale_range,
+                       const double spatial_decay) {
+             return std::make_shared<BilateralTotalVariationRegularizer>(
+                 cv::Size(width, height), scale_range, spatial_decay);
+           }),
+           py::arg("width"), py::arg("height"),
+           py::arg("scale_range") = 3, py::arg("spatial_decay") = 0.5);
+
+  py::enum_<LeastSquaresSolver>(module, "LeastSquaresSolver")
+      .value("CG_SOLVER", CG_SOLVER)
+      .value("LBFGS_SOLVER", LBFGS_SOLVER)
+      .value("NATIVE_CG_SOLVER", NATIVE_CG_SOLVER)
+      .value("NATIVE_LBFGS_SOLVER", NATIVE_LBFGS_SOLVER);
+
+  py::class_<IRLSMapSolverOptions>(module, "IRLSMapSolverOptions")
+      .def(py::init<>())
+      .def_readwrite(
+          "least_squares_solver", &IRLSMapSolverOptions::least_squares_solver)
+      .def_readwrite(
+          "max_num_solver_iterations",
+          &IRLSMapSolverOptions::max_num_solver_iterations)
+      .def_readwrite(
+          "max_num_irls_iterations",
+          &IRLSMapSolverOptions::max_num_irls_iterations)
+      .def_readwrite(
+          "irls_cost_difference_threshold",
+          &IRLSMapSolverOptions::irls_cost_difference_threshold)
+      .def_readwrite(
+          "irls_norm_exponent", &IRLSMapSolverOptions::irls_norm_exponent)
+      .def_readwrite(
+          "gradient_norm_threshold",
+          &IRLSMapSolverOptions::gradient_norm_threshold)
+      .def_readwrite(
+          "cost_decrease_threshold",
+          &IRLSMapSolverOptions::cost_decrease_threshold)
+      .def_readwrite(
+          "parameter_variation_threshold",
+          &IRLSMapSolverOptions::parameter_variation_threshold)
+      .def_readwrite(
+          "split_channels", &IRLSMapSolverOptions::split_channels)
+      .def_readwrite(
+          "num_channels_per_split",
+          &IRLSMapSolverOptions::num_channels_per_split)
+      .def_readwrite("num_threads", &IRLSMapSolverOptions::num_threads)
+      .def_readwrite(
+          "use_single_precision", &IRLSMapSolverOptions::use_single_precision)
+      .def_readwrite(
+          "use_mixed_precision", &IRLSMapSolverOptions::use_mixed_precision)
+      .def_readwrite(
+          "use_compiled_image_model",
+          &IRLSMapSolverOptions::use_compiled_image_model)
+      .def_readwrite(
+          "use_normal_equations", &IRLSMapSolverOptions::use_normal_equations)
+      .def_readwrite(
+          "use_diagonal_preconditioner",
+          &IRLSMapSolverOptions::use_diagonal_preconditioner)
+      .def_readwrite(
+          "continuation_parameter_scales",
+          &IRLSMapSolverOptions::continuation_parameter_scales);
+
+  // The inputs hold views of the observations, which are kept alive with
+  // the list that holds them.
+  py::class_<SharedSolverInputs, std::shared_ptr<SharedSolverInputs>>(
+      module, "SolverInputs")
+      .def(py::init(&CreateSolverInputs),
+           py::arg("observations"),
+           py::keep_alive<1, 2>())
+      .def_property_readonly("num_observations",
+                             [](const SharedSolverInputs& inputs) {
+        return inputs.GetObservations().size();
+      });
+
+  // The solver refers to the image model and the inputs, so both are kept
+  // alive with it.
+  py::class_<IRLSMapSolver>(module, "IRLSMapSolver")
+      .def(py::init([](const IRLSMapSolverOptions& options,
+                       const ImageModel& image_model,
+                       const std::shared_ptr<SharedSolverInputs>& inputs,
+                       const bool print_solver_output) {
+             return std::unique_ptr<IRLSMapSolver>(new IRLSMapSolver(
+                 options, image_model, inputs, print_solver_output));
+           }),
+           py::arg("options"),
+           py::arg("image_model"),
+           py::arg("inputs"),
+           py::arg("print_solver_output") = false,
+           py::keep_alive<1, 3>(),
+           py::keep_alive<1, 4>())
+      .def("add_regularizer", &IRLSMapSolver::AddRegularizer,
+           py::arg("regularizer"), py::arg("regularization_parameter"))
+      .def("solve",
+           [](IRLSMapSolver& solver, const ImageData& initial_estimate) {
+             return MakeContiguousImage(solver.Solve(initial_estimate));
+           },
+           py::arg("initial_estimate"),
+           py::call_guard<py::gil_scoped_release>());
+
+  // The evaluators refer to the ground truth, which is kept alive with them.
+  py::class_<PeakSignalToNoiseRatioEvaluator>(
+      module, "PeakSignalToNoiseRatioEvaluator")
+      .def(py::init<const ImageData&>(),
+           py::arg("ground_truth"),
+           py::keep_alive<1, 2>())
+      .def("evaluate", &PeakSignalToNoiseRatioEvaluator::Evaluate,
+           py::arg("image"));
+
+  py::class_<StructuralSimilarityEvaluator>(
+      module, "StructuralSimilarityEvaluator")
+      .def(py::init<const ImageData&, double, double, double>(),
+           py::arg("ground_truth"),
+           py::arg("k1") = 0.01,
+           py::arg("k2") = 0.03,
+           py::arg("image_scale") = 1.0,
+           py::keep_alive<1, 2>())
+      .def("evaluate", &StructuralSimilarityEvaluator::Evaluate,
+           py::arg("image"));
+}
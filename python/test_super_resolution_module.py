@@ -0,0 +1,63 @@
+# Tests of the Python bindings (see super_resolution_module.cpp). The first
+# test runs the example of the README, so that it keeps working. Run with the
+# directory of the built module in PYTHONPATH, which ctest does.
+
+from __future__ import print_function
+
+import unittest
+
+import numpy as np
+import super_resolution as sr
+
+
+class SuperResolutionModuleTest(unittest.TestCase):
+
+  def test_readme_example(self):
+    parameters = sr.ImageModelParameters()
+    parameters.scale = 2
+    parameters.motion_shifts = [(0, 0), (1, 0), (0, 1), (1, 1)]
+    model = sr.ImageModel.create(parameters)
+    hr_array = np.random.RandomState(0).rand(1, 128, 128)
+    ground_truth = sr.ImageData(hr_array)
+    observations = [model.apply(ground_truth, i) for i in range(4)]
+    inputs = sr.SolverInputs(observations)
+    lr_array = np.asarray(observations[0])
+    initial_estimate = sr.ImageData(
+        lr_array.repeat(2, axis=1).repeat(2, axis=2))
+    psnr = sr.PeakSignalToNoiseRatioEvaluator(ground_truth)
+    initial_psnr = psnr.evaluate(initial_estimate)
+    for weight in [0.001, 0.01, 0.1]:
+      solver = sr.IRLSMapSolver(sr.IRLSMapSolverOptions(), model, inputs)
+      solver.add_regularizer(
+          sr.TotalVariationRegularizer(
+              ground_truth.width, ground_truth.height),
+          weight)
+      result = solver.solve(initial_estimate)
+      self.assertEqual(result.num_channels, 1)
+      self.assertEqual((result.width, result.height), (128, 128))
+      self.assertGreater(psnr.evaluate(result), initial_psnr)
+
+  def test_array_views_share_pixels(self):
+    array = np.zeros((2, 4, 3))
+    image = sr.ImageData(array)
+    view = np.asarray(image)
+    self.assertEqual(view.shape, (2, 4, 3))
+    array[1, 2, 0] = 0.5
+    self.assertEqual(view[1, 2, 0], 0.5)
+
+    # Copies and results own their pixels, and their views stay valid.
+    copy = image.copy()
+    copy_view = np.asarray(copy)
+    array[1, 2, 0] = 0.25
+    self.assertEqual(copy_view[1, 2, 0], 0.5)
+    self.assertEqual(np.asarray(copy).ctypes.data, copy_view.ctypes.data)
+
+  def test_rejects_invalid_arrays(self):
+    with self.assertRaises(ValueError):
+      sr.ImageData(np.zeros((0, 4, 4)))
+    with self.assertRaises(TypeError):
+      sr.ImageData(np.zeros((4, 4), dtype=np.float32))
+
+
+if __name__ == '__main__':
+  unittest.main()
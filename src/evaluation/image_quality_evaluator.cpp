@@ -0,0 +1,234 @@
+#include "evaluation/image_quality_evaluator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "image/image_data.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// The per-pixel spectrum products accumulated by one group of channels, which
+// are summed over the groups to get the spectral angles.
+struct SpectrumProducts {
+  std::vector<double> dot_products;
+  std::vector<double> image_squared_norms;
+  std::vector<double> ground_truth_squared_norms;
+};
+
+// Returns the mean of the SSIM map of the two channels, given the Gaussian
+// window kernel. The local statistics are the window-weighted means of x, y,
+// x^2, y^2 and xy, each computed with one separable filter pass. The channels
+// may be views of a planar image, so the filter border is isolated from the
+// neighboring channels.
+double ComputeWindowedStructuralSimilarity(
+    const cv::Mat& ground_truth_channel,
+    const cv::Mat& image_channel,
+    const cv::Mat& window_kernel,
+    const double c1,
+    const double c2) {
+
+  const auto window_mean = [&window_kernel](const cv::Mat& values) {
+    cv::Mat mean;
+    cv::sepFilter2D(
+        values, mean, CV_64F, window_kernel, window_kernel,
+        cv::Point(-1, -1), 0, cv::BORDER_REFLECT | cv::BORDER_ISOLATED);
+    return mean;
+  };
+  const cv::Mat mean_x = window_mean(ground_truth_channel);
+  const cv::Mat mean_y = window_mean(image_channel);
+  const cv::Mat mean_xx = window_mean(
+      ground_truth_channel.mul(ground_truth_channel));
+  const cv::Mat mean_yy = window_mean(image_channel.mul(image_channel));
+  const cv::Mat mean_xy = window_mean(ground_truth_channel.mul(image_channel));
+
+  const int num_rows = ground_truth_channel.rows;
+  const int num_cols = ground_truth_channel.cols;
+  double ssim_sum = 0.0;
+  for (int row = 0; row < num_rows; ++row) {
+    const double* mu_x = mean_x.ptr<double>(row);
+    const double* mu_y = mean_y.ptr<double>(row);
+    const double* xx = mean_xx.ptr<double>(row);
+    const double* yy = mean_yy.ptr<double>(row);
+    const double* xy = mean_xy.ptr<double>(row);
+    for (int col = 0; col < num_cols; ++col) {
+      const double mu_x_squared = mu_x[col] * mu_x[col];
+      const double mu_y_squared = mu_y[col] * mu_y[col];
+      const double mu_xy = mu_x[col] * mu_y[col];
+      const double variance_x = xx[col] - mu_x_squared;
+      const double variance_y = yy[col] - mu_y_squared;
+      const double covariance = xy[col] - mu_xy;
+      ssim_sum +=
+          ((2.0 * mu_xy + c1) * (2.0 * covariance + c2)) /
+          ((mu_x_squared + mu_y_squared + c1) * (variance_x + variance_y + c2));
+    }
+  }
+  return ssim_sum / static_cast<double>(num_rows * num_cols);
+}
+
+}  // namespace
+
+ImageQualityEvaluator::ImageQualityEvaluator(
+    const ImageData& ground_truth,
+    const ImageQualityEvaluatorOptions& options)
+    : ground_truth_(ground_truth), options_(options) {
+
+  CHECK_GT(options_.max_pixel_value, 0.0)
+      << "The maximum pixel value must be positive.";
+  CHECK(options_.ssim_window_size > 0 && options_.ssim_window_size % 2 == 1)
+      << "The SSIM window size must be a positive odd number.";
+  CHECK_GT(options_.ssim_window_sigma, 0.0)
+      << "The SSIM window sigma must be positive.";
+}
+
+ImageQualityMetrics ImageQualityEvaluator::Evaluate(
+    const ImageData& image) const {
+
+  const int num_channels = image.GetNumChannels();
+  CHECK_EQ(num_channels, ground_truth_.GetNumChannels())
+      << "Images must have the same number of channels to be compared.";
+  CHECK_GT(num_channels, 0) << "Cannot evaluate an empty image.";
+
+  // If images are different sizes, resize the given image to match the ground
+  // truth so per-pixel comparison can be done. The image is only copied if it
+  // has to be resized.
+  const ImageData* evaluation_image = &image;
+  ImageData resized_image;
+  if (image.GetImageSize() != ground_truth_.GetImageSize()) {
+    LOG(WARNING) << "Image size is different from ground truth: "
+                 << image.GetImageSize() << " vs. "
+                 << ground_truth_.GetImageSize() << ". "
+                 << "Resizing image to run evaluation.";
+    resized_image = image;
+    resized_image.ResizeImage(
+        ground_truth_.GetImageSize(), INTERPOLATE_LINEAR);
+    evaluation_image = &resized_image;
+  }
+
+  const cv::Size image_size = ground_truth_.GetImageSize();
+  const int64_t num_pixels = ground_truth_.GetNumPixels();
+  const cv::Mat window_kernel = cv::getGaussianKernel(
+      options_.ssim_window_size, options_.ssim_window_sigma, CV_64F);
+  const double c1 = std::pow(options_.ssim_k1 * options_.max_pixel_value, 2);
+  const double c2 = std::pow(options_.ssim_k2 * options_.max_pixel_value, 2);
+
+  ImageQualityMetrics metrics;
+  metrics.channel_mean_squared_errors.resize(num_channels);
+  metrics.channel_structural_similarities.resize(num_channels);
+
+  // Every group of consecutive channels accumulates its own spectrum
+  // products, which are added up in group order so that the result does not
+  // depend on the scheduling.
+  const int num_groups =
+      std::min(util::GetNumThreadsToUse(options_.num_threads), num_channels);
+  std::vector<SpectrumProducts> group_products(num_groups);
+  const auto evaluate_group = [&](const int group) {
+    SpectrumProducts& products = group_products[group];
+    products.dot_products.assign(num_pixels, 0.0);
+    products.image_squared_norms.assign(num_pixels, 0.0);
+    products.ground_truth_squared_norms.assign(num_pixels, 0.0);
+
+    const int first_channel =
+        static_cast<int64_t>(group) * num_channels / num_groups;
+    const int end_channel =
+        static_cast<int64_t>(group + 1) * num_channels / num_groups;
+    for (int channel = first_channel; channel < end_channel; ++channel) {
+      // Single precision images are converted one channel at a time.
+      cv::Mat ground_truth_channel;
+      cv::Mat image_channel;
+      ground_truth_.GetChannelImage(channel).convertTo(
+          ground_truth_channel, CV_64F);
+      evaluation_image->GetChannelImage(channel).convertTo(
+          image_channel, CV_64F);
+
+      // The squared error and the spectrum products in one pass.
+      double sum_of_squared_differences = 0.0;
+      int64_t pixel_index = 0;
+      for (int row = 0; row < image_size.height; ++row) {
+        const double* x = ground_truth_channel.ptr<double>(row);
+        const double* y = image_channel.ptr<double>(row);
+        for (int col = 0; col < image_size.width; ++col, ++pixel_index) {
+          const double difference = x[col] - y[col];
+          sum_of_squared_differences += difference * difference;
+          products.dot_products[pixel_index] += x[col] * y[col];
+          products.image_squared_norms[pixel_index] += y[col] * y[col];
+          products.ground_truth_squared_norms[pixel_index] += x[col] * x[col];
+        }
+      }
+      metrics.channel_mean_squared_errors[channel] =
+          sum_of_squared_differences / static_cast<double>(num_pixels);
+      metrics.channel_structural_similarities[channel] =
+          ComputeWindowedStructuralSimilarity(
+              ground_truth_channel, image_channel, window_kernel, c1, c2);
+    }
+  };
+  if (num_groups > 1) {
+    // The calling thread also evaluates a group.
+    util::ThreadPool thread_pool(num_groups - 1);
+    thread_pool.ParallelFor(num_groups, evaluate_group);
+  } else {
+    evaluate_group(0);
+  }
+
+  for (int channel = 0; channel < num_channels; ++channel) {
+    metrics.mean_squared_error += metrics.channel_mean_squared_errors[channel];
+    metrics.structural_similarity +=
+        metrics.channel_structural_similarities[channel];
+  }
+  metrics.mean_squared_error /= static_cast<double>(num_channels);
+  metrics.structural_similarity /= static_cast<double>(num_channels);
+
+  // PSNR = 20 * log_10(MAX) - 10 * log_10(MSE), as in the
+  // PeakSignalToNoiseRatioEvaluator.
+  if (metrics.mean_squared_error > 0.0) {
+    metrics.peak_signal_to_noise_ratio =
+        20.0 * std::log10(options_.max_pixel_value) -
+        10.0 * std::log10(metrics.mean_squared_error);
+  } else {
+    metrics.peak_signal_to_noise_ratio =
+        std::numeric_limits<double>::infinity();
+  }
+
+  for (int group = 1; group < num_groups; ++group) {
+    SpectrumProducts& total = group_products[0];
+    const SpectrumProducts& products = group_products[group];
+    for (int64_t i = 0; i < num_pixels; ++i) {
+      total.dot_products[i] += products.dot_products[i];
+      total.image_squared_norms[i] += products.image_squared_norms[i];
+      total.ground_truth_squared_norms[i] +=
+          products.ground_truth_squared_norms[i];
+    }
+  }
+  const SpectrumProducts& products = group_products[0];
+  double spectral_angle_sum = 0.0;
+  int64_t num_spectra = 0;
+  for (int64_t i = 0; i < num_pixels; ++i) {
+    const double norm_product = std::sqrt(
+        products.image_squared_norms[i] *
+        products.ground_truth_squared_norms[i]);
+    if (norm_product <= 0.0) {
+      continue;
+    }
+    // Rounding can push the cosine slightly outside of [-1, 1].
+    const double cosine = std::max(
+        -1.0, std::min(1.0, products.dot_products[i] / norm_product));
+    spectral_angle_sum += std::acos(cosine);
+    num_spectra++;
+  }
+  if (num_spectra > 0) {
+    metrics.spectral_angle =
+        spectral_angle_sum / static_cast<double>(num_spectra);
+  }
+  return metrics;
+}
+
+}  // namespace super_resolution
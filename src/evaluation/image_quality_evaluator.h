@@ -0,0 +1,82 @@
+// The ImageQualityEvaluator computes several quality metrics of an image
+// against the ground truth in a single pass over the data: the mean squared
+// error, PSNR, the mean structural similarity (SSIM) over Gaussian windows,
+// and the mean spectral angle. Each channel is visited once for all metrics,
+// and the channels are processed in parallel, which matters for hyperspectral
+// images with hundreds of bands.
+//
+// Unlike the StructuralSimilarityEvaluator, which compares global image
+// statistics, the SSIM here follows Wang et al., "Image quality assessment:
+// from error visibility to structural similarity" (2004): the statistics are
+// computed in a Gaussian window around every pixel and the SSIM map is
+// averaged over the pixels and channels.
+
+#ifndef SRC_EVALUATION_IMAGE_QUALITY_EVALUATOR_H_
+#define SRC_EVALUATION_IMAGE_QUALITY_EVALUATOR_H_
+
+#include <vector>
+
+#include "image/image_data.h"
+
+namespace super_resolution {
+
+struct ImageQualityEvaluatorOptions {
+  // The maximum possible pixel value, which is 1.0 for normalized images.
+  double max_pixel_value = 1.0;
+
+  // The Gaussian SSIM window. The window size must be odd.
+  int ssim_window_size = 11;
+  double ssim_window_sigma = 1.5;
+
+  // The SSIM stabilization constants, which are scaled by max_pixel_value.
+  double ssim_k1 = 0.01;
+  double ssim_k2 = 0.03;
+
+  // The number of threads that evaluate channels concurrently (0 = all
+  // hardware threads).
+  int num_threads = 1;
+};
+
+// All metrics of one evaluation.
+struct ImageQualityMetrics {
+  // Over all pixels of all channels. The PSNR is infinite for identical
+  // images.
+  double mean_squared_error = 0.0;
+  double peak_signal_to_noise_ratio = 0.0;
+
+  // The mean of the per-channel SSIM values below.
+  double structural_similarity = 0.0;
+
+  // The mean angle (in radians) between the spectra (the vectors of all
+  // channel values) of the image and the ground truth at each pixel. Pixels
+  // where either spectrum is zero are skipped. It is 0 for single channel
+  // images with positive values.
+  double spectral_angle = 0.0;
+
+  // The mean squared error and mean SSIM of every channel.
+  std::vector<double> channel_mean_squared_errors;
+  std::vector<double> channel_structural_similarities;
+};
+
+class ImageQualityEvaluator {
+ public:
+  // The ground truth is referenced, not copied, so it must outlive the
+  // evaluator.
+  explicit ImageQualityEvaluator(
+      const ImageData& ground_truth,
+      const ImageQualityEvaluatorOptions& options =
+          ImageQualityEvaluatorOptions());
+
+  // Computes all metrics of the given image, which must have the same number
+  // of channels as the ground truth. It is resized to the ground truth size
+  // if the sizes differ.
+  ImageQualityMetrics Evaluate(const ImageData& image) const;
+
+ private:
+  const ImageData& ground_truth_;
+  const ImageQualityEvaluatorOptions options_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_EVALUATION_IMAGE_QUALITY_EVALUATOR_H_
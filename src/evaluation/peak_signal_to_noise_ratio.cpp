@@ -1,6 +1,7 @@
 #include "evaluation/peak_signal_to_noise_ratio.h"
 
 #include <cmath>
+#include <cstdint>
 
 #include "image/image_data.h"
 
@@ -9,21 +10,26 @@
 namespace super_resolution {
 
 double PeakSignalToNoiseRatioEvaluator::Evaluate(const ImageData& image) const {
-  const int num_pixels = image.GetNumPixels();
+  const int64_t num_pixels = ground_truth_.GetNumPixels();
   const int num_channels = image.GetNumChannels();
 
   CHECK_EQ(num_channels, ground_truth_.GetNumChannels())
       << "Images must have the same number of channels to be compared.";
 
   // If images are different sizes, resize the given image to match the ground
-  // truth so per-pixel comparison can be done.
-  ImageData evaluation_image = image;
+  // truth so per-pixel comparison can be done. The image is only copied if it
+  // has to be resized.
+  const ImageData* evaluation_image = &image;
+  ImageData resized_image;
   if (image.GetImageSize() != ground_truth_.GetImageSize()) {
     LOG(WARNING) << "Image size is different from ground truth: "
                  << image.GetImageSize() << " vs. "
                  << ground_truth_.GetImageSize() << ". "
                  << "Resizing image to run evaluation.";
-    evaluation_image.ResizeImage(image.GetImageSize(), INTERPOLATE_LINEAR);
+    resized_image = image;
+    resized_image.ResizeImage(
+        ground_truth_.GetImageSize(), INTERPOLATE_LINEAR);
+    evaluation_image = &resized_image;
   }
 
   double sum_of_squared_differences = 0.0;
@@ -31,15 +37,15 @@ double PeakSignalToNoiseRatioEvaluator::Evaluate(const ImageData& image) const {
     const double* ground_truth_channel_data =
         ground_truth_.GetChannelData(channel_index);
     const double* image_channel_data =
-        evaluation_image.GetChannelData(channel_index);
-    for (int pixel_index = 0; pixel_index < num_pixels; ++pixel_index) {
+        evaluation_image->GetChannelData(channel_index);
+    for (int64_t pixel_index = 0; pixel_index < num_pixels; ++pixel_index) {
       const double difference =
           ground_truth_channel_data[pixel_index] -
           image_channel_data[pixel_index];
       sum_of_squared_differences += (difference * difference);
     }
   }
-  const int total_num_pixels = num_pixels * num_channels;
+  const int64_t total_num_pixels = num_pixels * num_channels;
   const double mean_squared_error =
       sum_of_squared_differences / static_cast<double>(total_num_pixels);
 
@@ -1,5 +1,7 @@
 #include "evaluation/structural_similarity.h"
 
+#include <cstdint>
+
 #include "glog/logging.h"
 
 namespace super_resolution {
@@ -8,10 +10,10 @@ namespace {
 // Computes the average pixel intensity of an image.
 double ComputeAveragePixelIntensity(const ImageData& image) {
   const int num_channels = image.GetNumChannels();
-  const int num_pixels = image.GetNumPixels();
+  const int64_t num_pixels = image.GetNumPixels();
   double intensity_sum = 0.0;
   for (int channel = 0; channel < num_channels; ++channel) {
-    for (int pixel = 0; pixel < num_pixels; ++pixel) {
+    for (int64_t pixel = 0; pixel < num_pixels; ++pixel) {
       intensity_sum += image.GetPixelValue(channel, pixel);
     }
   }
@@ -27,10 +29,10 @@ double ComputePixelIntensityCovariance(
     const double mean2) {
 
   const int num_channels = image1.GetNumChannels();
-  const int num_pixels = image1.GetNumPixels();
+  const int64_t num_pixels = image1.GetNumPixels();
   double covariance = 0.0;
   for (int channel = 0; channel < num_channels; ++channel) {
-    for (int pixel = 0; pixel < num_pixels; ++pixel) {
+    for (int64_t pixel = 0; pixel < num_pixels; ++pixel) {
       const double diff1 = image1.GetPixelValue(channel, pixel) - mean1;
       const double diff2 = image2.GetPixelValue(channel, pixel) - mean2;
       covariance += diff1 * diff2;
@@ -68,20 +70,25 @@ StructuralSimilarityEvaluator::StructuralSimilarityEvaluator(
 
 double StructuralSimilarityEvaluator::Evaluate(const ImageData& image) const {
   CHECK_EQ(image.GetNumChannels(), ground_truth_.GetNumChannels());
-  ImageData evaluation_image = image;
+  // The image is only copied if it has to be resized.
+  const ImageData* evaluation_image = &image;
+  ImageData resized_image;
   if (image.GetImageSize() != ground_truth_.GetImageSize()) {
     LOG(WARNING) << "Image size is different from ground truth: "
                  << image.GetImageSize() << " vs. "
                  << ground_truth_.GetImageSize() << ". "
                  << "Resizing image to run evaluation.";
-    evaluation_image.ResizeImage(image.GetImageSize(), INTERPOLATE_LINEAR);
+    resized_image = image;
+    resized_image.ResizeImage(
+        ground_truth_.GetImageSize(), INTERPOLATE_LINEAR);
+    evaluation_image = &resized_image;
   }
 
-  const double image_mean = ComputeAveragePixelIntensity(evaluation_image);
+  const double image_mean = ComputeAveragePixelIntensity(*evaluation_image);
   const double image_variance =
-      ComputePixelIntensityVariance(evaluation_image, image_mean);
+      ComputePixelIntensityVariance(*evaluation_image, image_mean);
   const double covariance = ComputePixelIntensityCovariance(
-      evaluation_image, image_mean, ground_truth_, ground_truth_mean_);
+      *evaluation_image, image_mean, ground_truth_, ground_truth_mean_);
 
   const double numerator_1 = 2 * ground_truth_mean_ * image_mean + c1_;
   const double numerator_2 = 2 * covariance + c2_;
@@ -5,6 +5,7 @@
 // TODO: This currently only supports RGB or Grayscale images. Extend this to
 // support hyperspectral data as well.
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -18,6 +19,7 @@
 #include "util/data_loader.h"
 #include "util/macros.h"
 #include "util/string_util.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 #include "opencv2/core/core.hpp"
@@ -59,6 +61,12 @@ DEFINE_int32(downsampling_scale, 2,
     "The scale by which the HR image will be downsampled.");
 DEFINE_int32(number_of_frames, 4,
     "The number of LR images that will be generated.");
+DEFINE_uint64(noise_seed, 0,
+    "Seed of the noise. Each frame's noise only depends on it and the frame.");
+
+// Performance options.
+DEFINE_int32(num_threads, 1,
+    "Number of frames generated and saved at once (0 = all hardware threads).");
 
 // Returns the extension of the output file based on the user's arguments.
 std::string GetOutputFileExtension() {
@@ -108,19 +116,36 @@ int main(int argc, char** argv) {
   model_parameters.blur_sigma = FLAGS_blur_sigma;
   model_parameters.motion_sequence_path = FLAGS_motion_sequence_path;
   model_parameters.noise_sigma = FLAGS_noise_sigma;
+  model_parameters.noise_seed = FLAGS_noise_seed;
 
   super_resolution::ImageModel image_model =
       super_resolution::ImageModel::CreateImageModel(model_parameters);
 
-  // Save the generated images as files.
+  // Generate the images and save them as files. Every frame is generated and
+  // saved by its own task, so the frames are encoded and written while other
+  // frames are still being generated. The noise of each frame only depends on
+  // its index (see AdditiveNoiseModule), so the output does not depend on the
+  // number of threads.
   const std::string extension = GetOutputFileExtension();
-  for (int i = 0; i < FLAGS_number_of_frames; ++i) {
+  const auto generate_frame = [&](const int i) {
     const ImageData low_res_frame = image_model.ApplyToImage(image_data, i);
     // Write the file.
     std::string image_path =
         FLAGS_output_image_dir + "/low_res_" + std::to_string(i) + extension;
     super_resolution::util::SaveImage(low_res_frame, image_path);
     LOG(INFO) << "Generated output image " << image_path;
+  };
+  const int num_threads = std::min(
+      super_resolution::util::GetNumThreadsToUse(FLAGS_num_threads),
+      FLAGS_number_of_frames);
+  if (num_threads > 1) {
+    // The calling thread also generates frames, so it is not included.
+    super_resolution::util::ThreadPool thread_pool(num_threads - 1);
+    thread_pool.ParallelFor(FLAGS_number_of_frames, generate_frame);
+  } else {
+    for (int i = 0; i < FLAGS_number_of_frames; ++i) {
+      generate_frame(i);
+    }
   }
 
   return EXIT_SUCCESS;
@@ -0,0 +1,534 @@
+#include "hyperspectral/chunked_hsi_file.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "hyperspectral/hyperspectral_data_loader.h"
+#include "image/image_data.h"
+#include "util/profiler.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+#ifdef SUPER_RESOLUTION_ZSTD
+#include "zstd.h"
+#endif
+
+namespace super_resolution {
+namespace {
+
+constexpr char kChunkedHSIFileMagic[] = "SRHSICHK";
+constexpr int kChunkedHSIFileMagicSize = 8;
+constexpr uint32_t kChunkedHSIFileVersion = 1;
+
+// The header at the start of every chunked file. As in image data files, the
+// version doubles as a byte order mark.
+struct ChunkedHSIFileHeader {
+  char magic[kChunkedHSIFileMagicSize];
+  uint32_t version;
+  uint32_t header_size;  // The offset of the first chunk.
+  int32_t width;
+  int32_t height;
+  int32_t num_bands;
+  int32_t tile_width;
+  int32_t tile_height;
+  int32_t band_block_size;
+  int32_t precision;    // An ImagePrecision.
+  int32_t compression;  // A ChunkCompression.
+  int64_t index_offset;  // The offset of the chunk index.
+  uint8_t reserved[8];
+};
+static_assert(
+    sizeof(ChunkedHSIFileHeader) == 64, "The header must be 64 bytes.");
+
+// The entry of a chunk in the index at the end of the file.
+struct ChunkIndexEntry {
+  int64_t offset;
+  int64_t size;  // The compressed size in bytes.
+};
+
+// Returns the size of a pixel value of the given precision in bytes.
+int64_t GetValueSize(const ImagePrecision precision) {
+  return (precision == SINGLE_PRECISION) ? sizeof(float) : sizeof(double);
+}
+
+// The layout of the chunks of a file.
+class ChunkGrid {
+ public:
+  explicit ChunkGrid(const ChunkedHSIFileInfo& info)
+      : info_(info),
+        num_tile_rows_(
+            (info.image_size.height + info.tile_size.height - 1) /
+            info.tile_size.height),
+        num_tile_cols_(
+            (info.image_size.width + info.tile_size.width - 1) /
+            info.tile_size.width),
+        num_band_blocks_(
+            (info.num_bands + info.band_block_size - 1) /
+            info.band_block_size) {}
+
+  int GetNumTilesPerBlock() const {
+    return num_tile_rows_ * num_tile_cols_;
+  }
+
+  int GetNumChunks() const {
+    return num_band_blocks_ * GetNumTilesPerBlock();
+  }
+
+  int GetNumBandBlocks() const {
+    return num_band_blocks_;
+  }
+
+  // Returns the index of the chunk of the given tile (in row-major tile
+  // order) in the given band block.
+  int GetChunkIndex(const int band_block, const int tile_index) const {
+    return band_block * GetNumTilesPerBlock() + tile_index;
+  }
+
+  // Returns the region of the image covered by the given tile.
+  cv::Rect GetTileRegion(const int tile_index) const {
+    const cv::Rect tile(
+        (tile_index % num_tile_cols_) * info_.tile_size.width,
+        (tile_index / num_tile_cols_) * info_.tile_size.height,
+        info_.tile_size.width,
+        info_.tile_size.height);
+    return tile & cv::Rect(cv::Point(0, 0), info_.image_size);
+  }
+
+  int GetFirstBand(const int band_block) const {
+    return band_block * info_.band_block_size;
+  }
+
+  int GetNumBlockBands(const int band_block) const {
+    return std::min(
+        info_.band_block_size, info_.num_bands - GetFirstBand(band_block));
+  }
+
+  // Returns the size of the given chunk before compression.
+  int64_t GetChunkSize(const int band_block, const int tile_index) const {
+    return GetNumBlockBands(band_block) * GetValueSize(info_.precision) *
+        static_cast<int64_t>(GetTileRegion(tile_index).area());
+  }
+
+ private:
+  const ChunkedHSIFileInfo info_;
+  const int num_tile_rows_;
+  const int num_tile_cols_;
+  const int num_band_blocks_;
+};
+
+// Checks that the header describes a valid image in a file of the given size,
+// and returns the information it stores.
+ChunkedHSIFileInfo GetValidatedInfo(
+    const ChunkedHSIFileHeader& header,
+    const int64_t file_size,
+    const std::string& file_path) {
+
+  CHECK_EQ(header.version, kChunkedHSIFileVersion)
+      << "Chunked file '" << file_path << "' has an unsupported version or "
+      << "was written on a machine of a different byte order.";
+  CHECK_EQ(header.header_size, sizeof(ChunkedHSIFileHeader))
+      << "Chunked file '" << file_path << "' has an invalid header.";
+  CHECK_GT(header.width, 0) << "Invalid image width in '" << file_path << "'.";
+  CHECK_GT(header.height, 0)
+      << "Invalid image height in '" << file_path << "'.";
+  CHECK_GT(header.num_bands, 0)
+      << "Invalid number of bands in '" << file_path << "'.";
+  CHECK_GT(header.tile_width, 0)
+      << "Invalid tile width in '" << file_path << "'.";
+  CHECK_GT(header.tile_height, 0)
+      << "Invalid tile height in '" << file_path << "'.";
+  CHECK_GT(header.band_block_size, 0)
+      << "Invalid band block size in '" << file_path << "'.";
+  CHECK(header.precision == DOUBLE_PRECISION ||
+        header.precision == SINGLE_PRECISION)
+      << "Invalid precision in '" << file_path << "'.";
+  CHECK(header.compression == CHUNK_COMPRESSION_NONE ||
+        header.compression == CHUNK_COMPRESSION_ZSTD)
+      << "Invalid compression in '" << file_path << "'.";
+
+  ChunkedHSIFileInfo info;
+  info.image_size = cv::Size(header.width, header.height);
+  info.num_bands = header.num_bands;
+  info.precision = static_cast<ImagePrecision>(header.precision);
+  info.tile_size = cv::Size(header.tile_width, header.tile_height);
+  info.band_block_size = header.band_block_size;
+  info.compression = static_cast<ChunkCompression>(header.compression);
+  const int64_t index_size =
+      ChunkGrid(info).GetNumChunks() * sizeof(ChunkIndexEntry);
+  CHECK_GE(header.index_offset, header.header_size)
+      << "Chunked file '" << file_path << "' has an invalid index offset.";
+  CHECK_LE(header.index_offset + index_size, file_size)
+      << "Chunked file '" << file_path << "' is truncated.";
+  return info;
+}
+
+// Reads num_bytes bytes at the given byte offset of the file into the buffer
+// with positional reads, so that several threads can read the same file.
+void ReadFileRange(
+    const int file_descriptor,
+    const int64_t offset,
+    const int64_t num_bytes,
+    char* buffer,
+    const std::string& file_path) {
+
+  int64_t num_bytes_read = 0;
+  while (num_bytes_read < num_bytes) {
+    const ssize_t result = pread(
+        file_descriptor,
+        buffer + num_bytes_read,
+        num_bytes - num_bytes_read,
+        offset + num_bytes_read);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(result, 0)
+        << "Could not read " << num_bytes << " bytes at offset " << offset
+        << " of file '" << file_path << "'.";
+    num_bytes_read += result;
+  }
+}
+
+// Compresses the chunk bytes into compressed_bytes.
+void CompressChunk(
+    const std::vector<char>& bytes,
+    const ChunkCompression compression,
+    const int compression_level,
+    std::vector<char>* compressed_bytes) {
+
+  switch (compression) {
+    case CHUNK_COMPRESSION_NONE:
+      *compressed_bytes = bytes;
+      return;
+#ifdef SUPER_RESOLUTION_ZSTD
+    case CHUNK_COMPRESSION_ZSTD: {
+      compressed_bytes->resize(ZSTD_compressBound(bytes.size()));
+      const size_t compressed_size = ZSTD_compress(
+          compressed_bytes->data(),
+          compressed_bytes->size(),
+          bytes.data(),
+          bytes.size(),
+          compression_level);
+      CHECK(!ZSTD_isError(compressed_size))
+          << "Chunk compression failed: "
+          << ZSTD_getErrorName(compressed_size);
+      compressed_bytes->resize(compressed_size);
+      return;
+    }
+#endif
+    default:
+      LOG(FATAL) << "Unsupported chunk compression.";
+  }
+}
+
+// Decompresses the compressed chunk into bytes, which must have the size of
+// the uncompressed chunk.
+void DecompressChunk(
+    const std::vector<char>& compressed_bytes,
+    const ChunkCompression compression,
+    const std::string& file_path,
+    std::vector<char>* bytes) {
+
+  switch (compression) {
+    case CHUNK_COMPRESSION_NONE:
+      CHECK_EQ(compressed_bytes.size(), bytes->size())
+          << "Chunked file '" << file_path << "' has an invalid chunk.";
+      *bytes = compressed_bytes;
+      return;
+#ifdef SUPER_RESOLUTION_ZSTD
+    case CHUNK_COMPRESSION_ZSTD: {
+      const size_t size = ZSTD_decompress(
+          bytes->data(),
+          bytes->size(),
+          compressed_bytes.data(),
+          compressed_bytes.size());
+      CHECK(!ZSTD_isError(size))
+          << "Chunked file '" << file_path << "' has an invalid chunk: "
+          << ZSTD_getErrorName(size);
+      CHECK_EQ(size, bytes->size())
+          << "Chunked file '" << file_path << "' has an invalid chunk.";
+      return;
+    }
+#endif
+    default:
+      LOG(FATAL) << "Unsupported chunk compression.";
+  }
+}
+
+}  // namespace
+
+bool IsChunkCompressionSupported(const ChunkCompression compression) {
+#ifdef SUPER_RESOLUTION_ZSTD
+  if (compression == CHUNK_COMPRESSION_ZSTD) {
+    return true;
+  }
+#endif
+  return compression == CHUNK_COMPRESSION_NONE;
+}
+
+ChunkCompression GetDefaultChunkCompression() {
+  if (IsChunkCompressionSupported(CHUNK_COMPRESSION_ZSTD)) {
+    return CHUNK_COMPRESSION_ZSTD;
+  }
+  return CHUNK_COMPRESSION_NONE;
+}
+
+bool ReadChunkedHSIFileInfo(
+    const std::string& file_path, ChunkedHSIFileInfo* info) {
+
+  CHECK_NOTNULL(info);
+  std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+  const int64_t file_size = file.tellg();
+  file.seekg(0);
+  ChunkedHSIFileHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file.good() || std::memcmp(
+          header.magic, kChunkedHSIFileMagic, kChunkedHSIFileMagicSize) != 0) {
+    return false;
+  }
+  *info = GetValidatedInfo(header, file_size, file_path);
+  return true;
+}
+
+void SaveChunkedHSIFile(
+    const ImageData& image,
+    const std::string& file_path,
+    const ChunkedHSIFileOptions& options) {
+
+  PROFILE_SCOPE("SaveChunkedHSIFile");
+
+  CHECK_GT(image.GetNumChannels(), 0) << "Cannot save an empty image.";
+  CHECK_GT(options.tile_size.width, 0) << "The tile width must be positive.";
+  CHECK_GT(options.tile_size.height, 0)
+      << "The tile height must be positive.";
+  CHECK_GT(options.band_block_size, 0)
+      << "The band block size must be positive.";
+  CHECK(IsChunkCompressionSupported(options.compression))
+      << "The chunk compression is not supported by this build.";
+
+  ChunkedHSIFileInfo info;
+  info.image_size = image.GetImageSize();
+  info.num_bands = image.GetNumChannels();
+  info.precision = image.GetPrecision();
+  info.tile_size = options.tile_size;
+  info.band_block_size = options.band_block_size;
+  info.compression = options.compression;
+  const ChunkGrid grid(info);
+  const int64_t value_size = GetValueSize(info.precision);
+
+  ChunkedHSIFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kChunkedHSIFileMagic, kChunkedHSIFileMagicSize);
+  header.version = kChunkedHSIFileVersion;
+  header.header_size = sizeof(header);
+  header.width = info.image_size.width;
+  header.height = info.image_size.height;
+  header.num_bands = info.num_bands;
+  header.tile_width = info.tile_size.width;
+  header.tile_height = info.tile_size.height;
+  header.band_block_size = info.band_block_size;
+  header.precision = info.precision;
+  header.compression = info.compression;
+
+  const std::string temporary_file_path = file_path + ".tmp";
+  std::ofstream file(temporary_file_path, std::ios::binary | std::ios::trunc);
+  CHECK(file.is_open())
+      << "Chunked file '" << temporary_file_path << "' could not be opened "
+      << "for writing.";
+  // The header is written again with the index offset at the end.
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  // The chunks of each band block are compressed in parallel and then written
+  // in order, so only one block of compressed chunks is held at a time.
+  const int num_tiles = grid.GetNumTilesPerBlock();
+  const int num_threads =
+      std::min(util::GetNumThreadsToUse(options.num_threads), num_tiles);
+  std::vector<ChunkIndexEntry> index(grid.GetNumChunks());
+  int64_t offset = sizeof(header);
+  for (int band_block = 0; band_block < grid.GetNumBandBlocks();
+       ++band_block) {
+    const int first_band = grid.GetFirstBand(band_block);
+    std::vector<std::vector<char>> compressed_chunks(num_tiles);
+    util::RunParallelFor(num_threads, num_tiles, [&](const int tile_index) {
+      const cv::Rect tile = grid.GetTileRegion(tile_index);
+      const int64_t row_size = tile.width * value_size;
+      std::vector<char> chunk(grid.GetChunkSize(band_block, tile_index));
+      char* chunk_data = chunk.data();
+      for (int band = 0; band < grid.GetNumBlockBands(band_block); ++band) {
+        const cv::Mat channel_image =
+            image.GetChannelImage(first_band + band);
+        for (int row = tile.y; row < tile.y + tile.height; ++row) {
+          std::memcpy(
+              chunk_data, channel_image.ptr<char>(row) + tile.x * value_size,
+              row_size);
+          chunk_data += row_size;
+        }
+      }
+      CompressChunk(
+          chunk,
+          options.compression,
+          options.compression_level,
+          &compressed_chunks[tile_index]);
+    });
+    for (int tile_index = 0; tile_index < num_tiles; ++tile_index) {
+      const std::vector<char>& compressed_chunk = compressed_chunks[tile_index];
+      ChunkIndexEntry& entry =
+          index[grid.GetChunkIndex(band_block, tile_index)];
+      entry.offset = offset;
+      entry.size = compressed_chunk.size();
+      file.write(compressed_chunk.data(), compressed_chunk.size());
+      offset += entry.size;
+    }
+  }
+  file.write(
+      reinterpret_cast<const char*>(index.data()),
+      index.size() * sizeof(ChunkIndexEntry));
+  header.index_offset = offset;
+  file.seekp(0);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.close();
+  CHECK(file.good())
+      << "Chunked file '" << file_path << "' could not be written.";
+  CHECK_EQ(std::rename(temporary_file_path.c_str(), file_path.c_str()), 0)
+      << "Chunked file '" << file_path << "' could not be replaced.";
+}
+
+ImageData LoadChunkedHSIFile(
+    const std::string& file_path,
+    const HSIDataRange& data_range,
+    const int num_threads) {
+
+  PROFILE_SCOPE("LoadChunkedHSIFile");
+
+  const int file_descriptor = open(file_path.c_str(), O_RDONLY);
+  CHECK_GE(file_descriptor, 0)
+      << "File '" << file_path << "' could not be opened for reading.";
+  struct stat file_status;
+  CHECK_EQ(fstat(file_descriptor, &file_status), 0)
+      << "Could not get the size of file '" << file_path << "'.";
+  const int64_t file_size = file_status.st_size;
+  CHECK_GE(file_size, static_cast<int64_t>(sizeof(ChunkedHSIFileHeader)))
+      << "File '" << file_path << "' is not a chunked file.";
+  ChunkedHSIFileHeader header;
+  ReadFileRange(
+      file_descriptor,
+      0,
+      sizeof(header),
+      reinterpret_cast<char*>(&header),
+      file_path);
+  CHECK_EQ(std::memcmp(
+      header.magic, kChunkedHSIFileMagic, kChunkedHSIFileMagicSize), 0)
+      << "File '" << file_path << "' is not a chunked file.";
+  const ChunkedHSIFileInfo info =
+      GetValidatedInfo(header, file_size, file_path);
+  CHECK(IsChunkCompressionSupported(info.compression))
+      << "Chunked file '" << file_path << "' is compressed with zstd, but "
+      << "this build does not support zstd.";
+
+  const cv::Rect region(
+      data_range.start_col,
+      data_range.start_row,
+      data_range.end_col - data_range.start_col,
+      data_range.end_row - data_range.start_row);
+  CHECK(region.area() > 0 &&
+        (region & cv::Rect(cv::Point(0, 0), info.image_size)) == region)
+      << "The range is outside of the image in '" << file_path << "'.";
+  CHECK(data_range.start_band >= 0 &&
+        data_range.start_band < data_range.end_band &&
+        data_range.end_band <= info.num_bands)
+      << "The band range is outside of the bands in '" << file_path << "'.";
+
+  const ChunkGrid grid(info);
+  std::vector<ChunkIndexEntry> index(grid.GetNumChunks());
+  ReadFileRange(
+      file_descriptor,
+      header.index_offset,
+      index.size() * sizeof(ChunkIndexEntry),
+      reinterpret_cast<char*>(index.data()),
+      file_path);
+
+  // The chunks that overlap the range, as (band block, tile index) pairs.
+  std::vector<std::pair<int, int>> chunks;
+  const int first_band_block = data_range.start_band / info.band_block_size;
+  const int last_band_block = (data_range.end_band - 1) / info.band_block_size;
+  for (int band_block = first_band_block; band_block <= last_band_block;
+       ++band_block) {
+    for (int tile_index = 0; tile_index < grid.GetNumTilesPerBlock();
+         ++tile_index) {
+      if ((grid.GetTileRegion(tile_index) & region).area() > 0) {
+        chunks.push_back(std::make_pair(band_block, tile_index));
+      }
+    }
+  }
+
+  // Every chunk is read, decompressed and copied into its part of the image
+  // by its own task. The parts of different chunks never overlap.
+  const int num_bands = data_range.end_band - data_range.start_band;
+  ImageData image(region.size(), num_bands, info.precision);
+  const int64_t value_size = GetValueSize(info.precision);
+  const int num_chunks = chunks.size();
+  const int num_chunk_threads =
+      std::min(util::GetNumThreadsToUse(num_threads), num_chunks);
+  util::RunParallelFor(num_chunk_threads, num_chunks, [&](
+      const int chunk_number) {
+    const int band_block = chunks[chunk_number].first;
+    const int tile_index = chunks[chunk_number].second;
+    const ChunkIndexEntry& entry =
+        index[grid.GetChunkIndex(band_block, tile_index)];
+    CHECK(entry.offset >= header.header_size && entry.size >= 0 &&
+          entry.offset + entry.size <= header.index_offset)
+        << "Chunked file '" << file_path << "' has an invalid index.";
+    std::vector<char> compressed_chunk(entry.size);
+    ReadFileRange(
+        file_descriptor,
+        entry.offset,
+        entry.size,
+        compressed_chunk.data(),
+        file_path);
+    std::vector<char> chunk(grid.GetChunkSize(band_block, tile_index));
+    DecompressChunk(compressed_chunk, info.compression, file_path, &chunk);
+
+    const cv::Rect tile = grid.GetTileRegion(tile_index);
+    const cv::Rect overlap = tile & region;
+    const int first_band = std::max(
+        grid.GetFirstBand(band_block), data_range.start_band);
+    const int end_band = std::min(
+        grid.GetFirstBand(band_block) + grid.GetNumBlockBands(band_block),
+        data_range.end_band);
+    for (int band = first_band; band < end_band; ++band) {
+      const char* band_data = chunk.data() +
+          (band - grid.GetFirstBand(band_block)) * value_size * tile.area();
+      cv::Mat channel_image =
+          image.GetChannelImage(band - data_range.start_band);
+      for (int row = overlap.y; row < overlap.y + overlap.height; ++row) {
+        const int64_t tile_offset =
+            (row - tile.y) * tile.width + (overlap.x - tile.x);
+        std::memcpy(
+            channel_image.ptr<char>(row - region.y) +
+                (overlap.x - region.x) * value_size,
+            band_data + tile_offset * value_size,
+            overlap.width * value_size);
+      }
+    }
+  });
+  close(file_descriptor);
+  return image;
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,101 @@
+// A chunked, compressed container for large hyperspectral images, used to
+// stage cubes whose transfer time is dominated by disk or network bandwidth.
+// The image is split into chunks of one spatial tile and a block of
+// consecutive bands, and each chunk is compressed independently (with zstd if
+// the library was found at build time, see CMakeLists.txt). Neighboring bands
+// are very similar, so a block of bands compresses much better than a single
+// band does.
+//
+// The file is a fixed 64-byte header, followed by the compressed chunks and an
+// index that stores the offset and size of every chunk. The chunks are ordered
+// by band block, then by tile row and tile column. An uncompressed chunk
+// stores the tile of each band of its block as row-major pixel values in the
+// image's precision and the machine's byte order.
+//
+// Loading a range of the image only reads and decompresses the chunks that
+// overlap it, and decompresses them in parallel. Chunked files are read by
+// HyperspectralDataLoader, either directly or through a configuration file
+// whose "file" is a chunked file (which then only needs the range keys), so
+// they work with cropped reads and with the band blocks of the streaming
+// pipeline.
+
+#ifndef SRC_HYPERSPECTRAL_CHUNKED_HSI_FILE_H_
+#define SRC_HYPERSPECTRAL_CHUNKED_HSI_FILE_H_
+
+#include <string>
+
+#include "hyperspectral/hyperspectral_data_loader.h"
+#include "image/image_data.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+// The file extension of chunked files (without the dot).
+constexpr char kChunkedHSIFileExtension[] = "srhsc";
+
+// How the chunks of a file are compressed. The values are stored in files.
+enum ChunkCompression {
+  CHUNK_COMPRESSION_NONE = 0,
+  CHUNK_COMPRESSION_ZSTD = 1
+};
+
+// Returns true if this build can read and write chunks with the given
+// compression. Uncompressed chunks are always supported.
+bool IsChunkCompressionSupported(const ChunkCompression compression);
+
+// Returns zstd if it is supported, and no compression otherwise.
+ChunkCompression GetDefaultChunkCompression();
+
+struct ChunkedHSIFileOptions {
+  // The spatial size of the chunks. Tiles at the right and bottom edges of
+  // the image are cropped to the image.
+  cv::Size tile_size = cv::Size(256, 256);
+
+  // The number of bands in each chunk. The last block may have fewer bands.
+  int band_block_size = 16;
+
+  ChunkCompression compression = GetDefaultChunkCompression();
+
+  // The zstd compression level (1 to 19). Higher levels compress better but
+  // more slowly. Decompression speed does not depend on the level.
+  int compression_level = 3;
+
+  // The number of threads that compress chunks (0 = all hardware threads).
+  int num_threads = 0;
+};
+
+// The information stored in the header of a chunked file.
+struct ChunkedHSIFileInfo {
+  cv::Size image_size;
+  int num_bands = 0;
+  ImagePrecision precision = DOUBLE_PRECISION;
+  cv::Size tile_size;
+  int band_block_size = 0;
+  ChunkCompression compression = CHUNK_COMPRESSION_NONE;
+};
+
+// Reads the header of the given file into info. Returns false if the file is
+// not a chunked file (or cannot be read), and causes an error if it is a
+// chunked file with an invalid or unsupported header.
+bool ReadChunkedHSIFileInfo(
+    const std::string& file_path, ChunkedHSIFileInfo* info);
+
+// Saves all channels of the image to the given file in the image's precision.
+// The file is written under a temporary name and then renamed.
+void SaveChunkedHSIFile(
+    const ImageData& image,
+    const std::string& file_path,
+    const ChunkedHSIFileOptions& options = ChunkedHSIFileOptions());
+
+// Loads the given range of the image stored in the chunked file (see above)
+// with up to num_threads threads (0 = all hardware threads). The file must be
+// a valid chunked file whose compression is supported by this build.
+ImageData LoadChunkedHSIFile(
+    const std::string& file_path,
+    const HSIDataRange& data_range,
+    const int num_threads = 0);
+
+}  // namespace super_resolution
+
+#endif  // SRC_HYPERSPECTRAL_CHUNKED_HSI_FILE_H_
@@ -1,16 +1,31 @@
 #include "hyperspectral/hyperspectral_data_loader.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <future>
 #include <limits>
+#include <locale>
 #include <sstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "hyperspectral/chunked_hsi_file.h"
 #include "image/image_data.h"
+#include "image/image_data_file.h"
 #include "util/config_reader.h"
 #include "util/data_loader.h"
 #include "util/matrix_util.h"
+#include "util/profiler.h"
+#include "util/thread_pool.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -19,17 +34,28 @@
 namespace super_resolution {
 namespace {
 
+// The delimiter between the values of a line of MATLAB text files.
 constexpr char kMatlabTextDataDelimiter = ',';
 
-struct HSIDataRange {
-  int start_row = 0;
-  int start_col = 0;
-  int end_row = 0;
-  int end_col = 0;
-  int start_band = 0;
-  int end_band = 0;
-};
+// The approximate size in bytes of the chunks in which binary files are
+// written (see WriteBinaryFile()).
+constexpr int64_t kWriteChunkSize = 8 * 1024 * 1024;
+
 
+// Returns true if the given path has the given extension (without the dot),
+// ignoring case.
+bool HasFileExtension(
+    const std::string& file_path, const std::string& file_extension) {
+
+  const size_t extension_index = file_path.find_last_of(".");
+  if (extension_index == std::string::npos) {
+    return false;
+  }
+  std::string extension = file_path.substr(extension_index + 1);
+  std::transform(
+      extension.begin(), extension.end(), extension.begin(), tolower);
+  return extension == file_extension;
+}
 
 // Reverses the bytes of the given value (e.g. float). This is used to convert
 // from the data's endian form into the machine's endian form when they are not
@@ -65,87 +91,693 @@ bool IsMachineBigEndian() {
   return machine_big_endian;
 }
 
-template <typename T>
+// A read-only memory mapping of a byte range of a file. Only the pages that
+// are actually accessed are read from disk, so reading a cropped region of a
+// large file does not load the rest of it. The mapping is released when the
+// object is destroyed.
+class MappedFileRange {
+ public:
+  // Maps num_bytes bytes of the file starting at the given byte offset. The
+  // range must be inside the file. An empty range (num_bytes == 0, e.g. for
+  // an empty data range) is not mapped, since mmap rejects zero-length
+  // mappings, and GetData() then returns nullptr.
+  MappedFileRange(
+      const std::string& file_path,
+      const int64_t offset,
+      const int64_t num_bytes)
+      : mapping_(nullptr), mapping_size_(0), data_(nullptr) {
+
+    CHECK_GE(offset, 0) << "The mapped range cannot start before the file.";
+    CHECK_GE(num_bytes, 0) << "The mapped range cannot have a negative size.";
+    if (num_bytes == 0) {
+      return;
+    }
+    const int file_descriptor = open(file_path.c_str(), O_RDONLY);
+    CHECK_GE(file_descriptor, 0)
+        << "File '" << file_path << "' could not be opened for reading.";
+    struct stat file_status;
+    CHECK_EQ(fstat(file_descriptor, &file_status), 0)
+        << "Could not get the size of file '" << file_path << "'.";
+    CHECK_LE(offset + num_bytes, static_cast<int64_t>(file_status.st_size))
+        << "File '" << file_path << "' is smaller than the data size given "
+        << "in its configuration.";
+
+    // The mapping must start at a page boundary.
+    const int64_t page_size = sysconf(_SC_PAGESIZE);
+    const int64_t page_offset = (offset / page_size) * page_size;
+    mapping_size_ = num_bytes + (offset - page_offset);
+    mapping_ = mmap(
+        nullptr,
+        mapping_size_,
+        PROT_READ,
+        MAP_PRIVATE,
+        file_descriptor,
+        page_offset);
+    // The mapping stays valid after the file is closed.
+    close(file_descriptor);
+    CHECK(mapping_ != MAP_FAILED)
+        << "File '" << file_path << "' could not be memory mapped.";
+    data_ = static_cast<const char*>(mapping_) + (offset - page_offset);
+  }
+
+  ~MappedFileRange() {
+    if (mapping_ != nullptr) {
+      munmap(mapping_, mapping_size_);
+    }
+  }
+
+  MappedFileRange(const MappedFileRange&) = delete;
+  MappedFileRange& operator = (const MappedFileRange&) = delete;
+
+  // Returns a pointer to the first byte of the mapped range.
+  const char* GetData() const {
+    return data_;
+  }
+
+ private:
+  void* mapping_;
+  size_t mapping_size_;
+  const char* data_;
+};
+
+// A file that is read with positional reads (pread), which do not share a
+// file position, so any number of threads can read different byte ranges of
+// the file at the same time. Each read is a single system call that copies
+// the range straight into the caller's buffer, without faulting in the
+// surrounding pages. The file is closed when the object is destroyed.
+class PositionalFileReader {
+ public:
+  // Opens the file and checks that it holds at least num_bytes bytes.
+  PositionalFileReader(const std::string& file_path, const int64_t num_bytes)
+      : file_path_(file_path) {
+
+    file_descriptor_ = open(file_path.c_str(), O_RDONLY);
+    CHECK_GE(file_descriptor_, 0)
+        << "File '" << file_path << "' could not be opened for reading.";
+    struct stat file_status;
+    CHECK_EQ(fstat(file_descriptor_, &file_status), 0)
+        << "Could not get the size of file '" << file_path << "'.";
+    CHECK_LE(num_bytes, static_cast<int64_t>(file_status.st_size))
+        << "File '" << file_path << "' is smaller than the data size given "
+        << "in its configuration.";
+  }
+
+  ~PositionalFileReader() {
+    close(file_descriptor_);
+  }
+
+  PositionalFileReader(const PositionalFileReader&) = delete;
+  PositionalFileReader& operator = (const PositionalFileReader&) = delete;
+
+  // Reads num_bytes bytes starting at the given byte offset into the buffer.
+  // The read is only split if the system returns fewer bytes than requested
+  // (e.g. for reads of more than 2 GB).
+  void Read(const int64_t offset, const int64_t num_bytes, void* buffer) const {
+    char* destination = static_cast<char*>(buffer);
+    int64_t num_bytes_read = 0;
+    while (num_bytes_read < num_bytes) {
+      const ssize_t result = pread(
+          file_descriptor_,
+          destination + num_bytes_read,
+          num_bytes - num_bytes_read,
+          offset + num_bytes_read);
+      if (result < 0 && errno == EINTR) {
+        continue;
+      }
+      CHECK_GT(result, 0)
+          << "Could not read " << num_bytes << " bytes at offset " << offset
+          << " of file '" << file_path_ << "'.";
+      num_bytes_read += result;
+    }
+  }
+
+ private:
+  const std::string file_path_;
+  int file_descriptor_;
+};
+
+// Returns the ImagePrecision of images that store pixels of type PixelT.
+template <typename PixelT>
+ImagePrecision GetImagePrecision();
+
+template <>
+ImagePrecision GetImagePrecision<float>() {
+  return SINGLE_PRECISION;
+}
+
+template <>
+ImagePrecision GetImagePrecision<double>() {
+  return DOUBLE_PRECISION;
+}
+
+// Returns the pixels of the given channel of a contiguous image that stores
+// pixels of type PixelT (see GetImagePrecision()).
+template <typename PixelT>
+PixelT* GetChannelPixels(const ImageData& image, const int channel) {
+  return image.GetChannelImage(channel).ptr<PixelT>(0);
+}
+
+// Converts num_values values of type T that were read from the file into
+// pixels of type PixelT, reversing their bytes if needed. Whole rows are
+// converted in one loop so that the compiler can vectorize the byte swaps and
+// conversions.
+template <typename T, typename PixelT>
+void ConvertValues(
+    const T* values,
+    const int num_values,
+    const bool reverse_bytes,
+    PixelT* destination) {
+
+  if (reverse_bytes) {
+    for (int i = 0; i < num_values; ++i) {
+      destination[i] = static_cast<PixelT>(ReverseBytes<T>(values[i]));
+    }
+  } else {
+    for (int i = 0; i < num_values; ++i) {
+      destination[i] = static_cast<PixelT>(values[i]);
+    }
+  }
+}
+
+// Same as ConvertValues(), but for values that may be unaligned in the
+// source (e.g. in a memory mapped file). The values are first copied into the
+// given buffer, which must hold at least num_values values.
+template <typename T, typename PixelT>
+void ConvertBinaryValues(
+    const char* source,
+    const int num_values,
+    const bool reverse_bytes,
+    T* values,
+    PixelT* destination) {
+
+  std::memcpy(values, source, num_values * sizeof(T));
+  ConvertValues<T, PixelT>(values, num_values, reverse_bytes, destination);
+}
+
+// Reads the given range of a BSQ file. Each band is read by its own task, and
+// each row segment of the range is read with a single positional read (or the
+// whole band range at once if the range spans the full width, since its rows
+// are then contiguous in the file) and converted directly into the
+// (contiguous) image. Only the bytes in the range are read from disk, and the
+// reads of different bands are issued on up to num_threads threads (0 = all
+// hardware threads), so cropped regions and band subsets of very large cubes
+// load without scanning the file. The header offset is given in bytes, as in
+// ENVI headers.
+template <typename T, typename PixelT>
 ImageData ReadBinaryFileBSQ(
     const std::string& hsi_file_path,
     const int num_data_rows,
     const int num_data_cols,
     const int num_data_bands,
-    const long start_index,
+    const int64_t header_offset,
     const bool reverse_bytes,
-    const HSIDataRange& data_range) {
+    const HSIDataRange& data_range,
+    const int num_threads) {
 
-  std::ifstream input_file(hsi_file_path);
-  CHECK(input_file.is_open())
-      << "File '" << hsi_file_path << "' could not be opened for reading.";
+  CHECK_LE(data_range.end_band, num_data_bands)
+      << "End band index is out of bounds.";
 
-  const int data_point_size = sizeof(T);
-  long current_index = start_index;
-  input_file.seekg(current_index * data_point_size);
+  // The flattened file indices are 64-bit, since large cubes (e.g. 2048 x 2048
+  // x 256) have more values than an int can index.
+  const int64_t data_point_size = sizeof(T);
+  const int64_t num_pixels =
+      static_cast<int64_t>(num_data_rows) * num_data_cols;
+  const int num_range_bands = data_range.end_band - data_range.start_band;
+  const PositionalFileReader file_reader(
+      hsi_file_path,
+      header_offset + data_range.end_band * num_pixels * data_point_size);
 
-  ImageData hsi_image;
   const cv::Size image_size(
       data_range.end_col - data_range.start_col,
       data_range.end_row - data_range.start_row);
-  const long num_pixels = num_data_rows * num_data_cols;
-  for (int band = data_range.start_band; band < data_range.end_band; ++band) {
-    const long band_index = band * num_pixels;
-    cv::Mat channel_image(image_size, util::kOpenCvMatrixType);
+  ImageData hsi_image(
+      image_size, num_range_bands, GetImagePrecision<PixelT>());
+  const bool read_whole_bands = (image_size.width == num_data_cols);
+  const int num_read_values = read_whole_bands ?
+      image_size.area() : image_size.width;
+
+  const int num_band_threads =
+      std::min(util::GetNumThreadsToUse(num_threads), num_range_bands);
+  util::RunParallelFor(num_band_threads, num_range_bands, [&](
+      const int channel) {
+    std::vector<T> values(num_read_values);
+    const int64_t band_offset = header_offset +
+        (data_range.start_band + channel) * num_pixels * data_point_size;
+    PixelT* channel_data = GetChannelPixels<PixelT>(hsi_image, channel);
+    if (read_whole_bands) {
+      file_reader.Read(
+          band_offset + static_cast<int64_t>(data_range.start_row) *
+              num_data_cols * data_point_size,
+          num_read_values * data_point_size,
+          values.data());
+      ConvertValues<T, PixelT>(
+          values.data(), num_read_values, reverse_bytes, channel_data);
+      return;
+    }
     for (int row = data_range.start_row; row < data_range.end_row; ++row) {
+      const int64_t pixel_index =
+          static_cast<int64_t>(row) * num_data_cols + data_range.start_col;
       const int channel_row = row - data_range.start_row;
-      for (int col = data_range.start_col; col < data_range.end_col; ++col) {
-        const int channel_col = col - data_range.start_col;
-        const long pixel_index = row * num_data_cols + col;
-        const long next_index = band_index + pixel_index;
-        // Skip to next position if necessary.
-        if (next_index > (current_index + 1)) {
-          input_file.seekg(next_index * data_point_size);
-        }
-        T value;
-        input_file.read(reinterpret_cast<char*>(&value), data_point_size);
-        if (reverse_bytes) {
-          value = ReverseBytes<T>(value);
-        }
-        channel_image.at<double>(channel_row, channel_col) =
-            static_cast<double>(value);
-        current_index = next_index;
+      file_reader.Read(
+          band_offset + pixel_index * data_point_size,
+          num_read_values * data_point_size,
+          values.data());
+      ConvertValues<T, PixelT>(
+          values.data(),
+          num_read_values,
+          reverse_bytes,
+          channel_data + channel_row * image_size.width);
+    }
+  });
+  return hsi_image;
+}
+
+// Reads the given range of a BIL file, in which every row stores each band's
+// columns one after the other. Only the rows in the range are mapped, and
+// each band's run of columns is converted directly into its channel.
+template <typename T, typename PixelT>
+ImageData ReadBinaryFileBIL(
+    const std::string& hsi_file_path,
+    const int num_data_rows,
+    const int num_data_cols,
+    const int num_data_bands,
+    const int64_t header_offset,
+    const bool reverse_bytes,
+    const HSIDataRange& data_range) {
+
+  CHECK_LE(data_range.end_row, num_data_rows)
+      << "End row index is out of bounds.";
+
+  const int64_t data_point_size = sizeof(T);
+  const int64_t row_size =
+      static_cast<int64_t>(num_data_bands) * num_data_cols * data_point_size;
+  const int num_range_bands = data_range.end_band - data_range.start_band;
+  const cv::Size image_size(
+      data_range.end_col - data_range.start_col,
+      data_range.end_row - data_range.start_row);
+  const MappedFileRange mapped_rows(
+      hsi_file_path,
+      header_offset + data_range.start_row * row_size,
+      image_size.height * row_size);
+
+  ImageData hsi_image(
+      image_size, num_range_bands, GetImagePrecision<PixelT>());
+  std::vector<T> row_values(image_size.width);
+  for (int channel_row = 0; channel_row < image_size.height; ++channel_row) {
+    const char* row_data = mapped_rows.GetData() + channel_row * row_size;
+    for (int channel = 0; channel < num_range_bands; ++channel) {
+      const int64_t band_offset =
+          static_cast<int64_t>(data_range.start_band + channel) *
+          num_data_cols + data_range.start_col;
+      PixelT* channel_data = GetChannelPixels<PixelT>(hsi_image, channel);
+      ConvertBinaryValues<T, PixelT>(
+          row_data + band_offset * data_point_size,
+          image_size.width,
+          reverse_bytes,
+          row_values.data(),
+          channel_data + channel_row * image_size.width);
+    }
+  }
+  return hsi_image;
+}
+
+// Reads the given range of a BIP file, in which every pixel stores all of its
+// bands one after the other. Only the rows in the range are mapped. Each row
+// segment of the range is converted in one pass, including the bands outside
+// of the range since they are interleaved with the ones that are needed, and
+// then scattered into the channels one band at a time so that the writes
+// into the image are sequential.
+template <typename T, typename PixelT>
+ImageData ReadBinaryFileBIP(
+    const std::string& hsi_file_path,
+    const int num_data_rows,
+    const int num_data_cols,
+    const int num_data_bands,
+    const int64_t header_offset,
+    const bool reverse_bytes,
+    const HSIDataRange& data_range) {
+
+  CHECK_LE(data_range.end_row, num_data_rows)
+      << "End row index is out of bounds.";
+
+  const int64_t data_point_size = sizeof(T);
+  const int64_t row_size =
+      static_cast<int64_t>(num_data_bands) * num_data_cols * data_point_size;
+  const int num_range_bands = data_range.end_band - data_range.start_band;
+  const cv::Size image_size(
+      data_range.end_col - data_range.start_col,
+      data_range.end_row - data_range.start_row);
+  const MappedFileRange mapped_rows(
+      hsi_file_path,
+      header_offset + data_range.start_row * row_size,
+      image_size.height * row_size);
+
+  ImageData hsi_image(
+      image_size, num_range_bands, GetImagePrecision<PixelT>());
+  const int num_segment_values = image_size.width * num_data_bands;
+  std::vector<T> segment_values(num_segment_values);
+  std::vector<PixelT> converted_values(num_segment_values);
+  const int64_t segment_offset =
+      static_cast<int64_t>(data_range.start_col) * num_data_bands *
+      data_point_size;
+  for (int channel_row = 0; channel_row < image_size.height; ++channel_row) {
+    ConvertBinaryValues<T, PixelT>(
+        mapped_rows.GetData() + channel_row * row_size + segment_offset,
+        num_segment_values,
+        reverse_bytes,
+        segment_values.data(),
+        converted_values.data());
+    for (int channel = 0; channel < num_range_bands; ++channel) {
+      const PixelT* band_values =
+          converted_values.data() + data_range.start_band + channel;
+      PixelT* channel_row_data = GetChannelPixels<PixelT>(hsi_image, channel) +
+          channel_row * image_size.width;
+      for (int col = 0; col < image_size.width; ++col) {
+        channel_row_data[col] = band_values[col * num_data_bands];
       }
     }
-    hsi_image.AddChannel(channel_image, DO_NOT_NORMALIZE_IMAGE);
   }
-  input_file.close();
   return hsi_image;
 }
 
+// Returns the name of the given interleave format as used in ENVI headers and
+// configuration files.
+std::string GetInterleaveName(const HSIDataInterleaveFormat interleave) {
+  switch (interleave) {
+    case HSI_BINARY_INTERLEAVE_BSQ:
+      return "bsq";
+    case HSI_BINARY_INTERLEAVE_BIL:
+      return "bil";
+    case HSI_BINARY_INTERLEAVE_BIP:
+      return "bip";
+    default:
+      LOG(FATAL) << "Unknown interleave format.";
+  }
+  return "";
+}
+
+// Returns the interleave format with the given name (see GetInterleaveName()).
+// Returns false if the name is not a supported interleave format.
+bool GetInterleaveFromName(
+    const std::string& name, HSIDataInterleaveFormat* interleave) {
+
+  CHECK_NOTNULL(interleave);
+  if (name == "bsq") {
+    *interleave = HSI_BINARY_INTERLEAVE_BSQ;
+  } else if (name == "bil") {
+    *interleave = HSI_BINARY_INTERLEAVE_BIL;
+  } else if (name == "bip") {
+    *interleave = HSI_BINARY_INTERLEAVE_BIP;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Returns the name of the given data type as used in configuration files.
+std::string GetDataTypeName(const HSIBinaryDataType data_type) {
+  switch (data_type) {
+    case HSI_DATA_TYPE_BYTE:
+      return "uint8";
+    case HSI_DATA_TYPE_INT16:
+      return "int16";
+    case HSI_DATA_TYPE_INT32:
+      return "int32";
+    case HSI_DATA_TYPE_FLOAT:
+      return "float";
+    case HSI_DATA_TYPE_DOUBLE:
+      return "double";
+    case HSI_DATA_TYPE_UINT16:
+      return "uint16";
+    default:
+      LOG(FATAL) << "Unknown data type.";
+  }
+  return "";
+}
+
+// Returns the data type with the given name (see GetDataTypeName()). Returns
+// false if the name is not a supported data type.
+bool GetDataTypeFromName(
+    const std::string& name, HSIBinaryDataType* data_type) {
+
+  CHECK_NOTNULL(data_type);
+  for (const HSIBinaryDataType supported_data_type : {
+      HSI_DATA_TYPE_BYTE,
+      HSI_DATA_TYPE_INT16,
+      HSI_DATA_TYPE_INT32,
+      HSI_DATA_TYPE_FLOAT,
+      HSI_DATA_TYPE_DOUBLE,
+      HSI_DATA_TYPE_UINT16}) {
+    if (name == GetDataTypeName(supported_data_type)) {
+      *data_type = supported_data_type;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the data type with the given ENVI header code. Returns false if the
+// code is not a supported data type.
+bool GetDataTypeFromCode(const int code, HSIBinaryDataType* data_type) {
+  CHECK_NOTNULL(data_type);
+  switch (code) {
+    case HSI_DATA_TYPE_BYTE:
+    case HSI_DATA_TYPE_INT16:
+    case HSI_DATA_TYPE_INT32:
+    case HSI_DATA_TYPE_FLOAT:
+    case HSI_DATA_TYPE_DOUBLE:
+    case HSI_DATA_TYPE_UINT16:
+      *data_type = static_cast<HSIBinaryDataType>(code);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns true if every value of the given data type is represented exactly
+// by a float, so that it can be stored in single precision without loss.
+bool IsExactInSinglePrecision(const HSIBinaryDataType data_type) {
+  return data_type == HSI_DATA_TYPE_BYTE ||
+         data_type == HSI_DATA_TYPE_INT16 ||
+         data_type == HSI_DATA_TYPE_UINT16 ||
+         data_type == HSI_DATA_TYPE_FLOAT;
+}
+
+// Writes num_bytes bytes of the buffer at the given byte offset of the file,
+// retrying if the system writes fewer bytes than requested.
+void WriteToFile(
+    const int file_descriptor,
+    const int64_t offset,
+    const char* buffer,
+    const int64_t num_bytes,
+    const std::string& file_path) {
+
+  int64_t num_bytes_written = 0;
+  while (num_bytes_written < num_bytes) {
+    const ssize_t result = pwrite(
+        file_descriptor,
+        buffer + num_bytes_written,
+        num_bytes - num_bytes_written,
+        offset + num_bytes_written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(result, 0)
+        << "Could not write " << num_bytes << " bytes at offset " << offset
+        << " of file '" << file_path << "'.";
+    num_bytes_written += result;
+  }
+}
+
+// Writes the image as a binary file in the given format, where T is the type
+// of the format's data type. Values outside of the range of T are saturated.
+// The file is written in chunks of whole file rows (a row of one band for
+// BSQ, or a row of all bands for BIL and BIP) of about kWriteChunkSize bytes.
+// Each chunk is converted into one of two (aligned) buffers, with the byte
+// swaps done in a separate pass over the whole chunk, and is then written
+// with a single large write on a background thread while the next chunk is
+// converted. The output is sequential for every interleave format.
+//
+// If the image has fewer bands than the file (num_file_bands), the image bands
+// are written into the BSQ file starting at band_offset, and the rest of the
+// file is not modified. The file is created if needed and is always sized for
+// all of its bands, so the blocks of bands can be written in any order, also
+// by several processes at once. Otherwise, the file is replaced.
 template <typename T>
-void WriteBinaryFileBSQ(
+void WriteBinaryFile(
     const ImageData& image,
     const std::string& hsi_file_path,
-    const bool reverse_bytes) {
+    const HSIBinaryDataFormat& data_format,
+    const int band_offset,
+    const int num_file_bands) {
 
-  // Write the binary file.
-  std::ofstream output_envi_file(hsi_file_path);
-  CHECK(output_envi_file.is_open())
-      << "ENVI file '" << hsi_file_path << "' could not be opened for writing.";
+  // If endians don't match, the bytes written to the file have to be reversed.
+  const bool reverse_bytes = (data_format.big_endian != IsMachineBigEndian());
+  const HSIDataInterleaveFormat interleave = data_format.interleave;
   const cv::Size image_size = image.GetImageSize();
   const int num_rows = image_size.height;
   const int num_cols = image_size.width;
   const int num_bands = image.GetNumChannels();
-  const int data_point_size = sizeof(T);
-  for (int band = 0; band < num_bands; ++band) {
-    for (int row = 0; row < num_rows; ++row) {
-      for (int col = 0; col < num_cols; ++col) {
-        const double pixel_value = image.GetPixelValue(band, row, col);
-        T output_value = static_cast<T>(pixel_value);
-        if (reverse_bytes) {
-          output_value = ReverseBytes<T>(output_value);
-        }
-        output_envi_file.write(
-            reinterpret_cast<char*>(&output_value), data_point_size);
+
+  const bool is_band_block = (num_bands < num_file_bands);
+  if (is_band_block) {
+    CHECK_EQ(interleave, HSI_BINARY_INTERLEAVE_BSQ)
+        << "Blocks of bands can only be written into BSQ files.";
+  }
+  const int file_flags = is_band_block ?
+      (O_WRONLY | O_CREAT) : (O_WRONLY | O_CREAT | O_TRUNC);
+  const int file_descriptor = open(hsi_file_path.c_str(), file_flags, 0644);
+  CHECK_GE(file_descriptor, 0)
+      << "ENVI file '" << hsi_file_path << "' could not be opened for writing.";
+
+  const int64_t band_num_bytes =
+      static_cast<int64_t>(num_rows) * num_cols * sizeof(T);
+  int64_t file_offset = 0;
+  if (is_band_block) {
+    // Every block sets the same final size, so blocks never cut off others
+    // that were written before them.
+    file_offset = band_offset * band_num_bytes;
+    CHECK_EQ(ftruncate(file_descriptor, num_file_bands * band_num_bytes), 0)
+        << "ENVI file '" << hsi_file_path << "' could not be resized.";
+  }
+
+  // The file rows in file order. BSQ files store each row of each band, and
+  // BIL and BIP files store each row of all bands.
+  const bool is_bsq = (interleave == HSI_BINARY_INTERLEAVE_BSQ);
+  const int num_file_rows = is_bsq ? num_bands * num_rows : num_rows;
+  const int num_file_row_values = is_bsq ? num_cols : num_cols * num_bands;
+  const int num_chunk_rows = std::max(
+      1, static_cast<int>(kWriteChunkSize / (num_file_row_values * sizeof(T))));
+
+  // Converts a row of one band into the output type (with saturation) and
+  // writes it into the file row. BSQ and BIL rows are contiguous and are
+  // converted directly into the buffer. BIP rows are converted into a
+  // temporary row first, and written with a stride of the number of bands.
+  const int file_type = cv::DataType<T>::type;
+  cv::Mat band_row_values(1, num_cols, file_type);
+  const auto convert_band_row = [&](
+      const int band, const int row, T* file_row_values) {
+    const cv::Mat band_row = image.GetChannelImage(band).row(row);
+    if (interleave != HSI_BINARY_INTERLEAVE_BIP) {
+      cv::Mat file_row(1, num_cols, file_type, file_row_values);
+      band_row.convertTo(file_row, file_type);
+      return;
+    }
+    band_row.convertTo(band_row_values, file_type);
+    const T* band_row_data = band_row_values.ptr<T>(0);
+    for (int col = 0; col < num_cols; ++col) {
+      file_row_values[col * num_bands] = band_row_data[col];
+    }
+  };
+
+  std::vector<cv::Mat> chunk_buffers = {
+    cv::Mat(1, num_chunk_rows * num_file_row_values, file_type),
+    cv::Mat(1, num_chunk_rows * num_file_row_values, file_type)
+  };
+  std::future<void> pending_write;
+  for (int first_row = 0, chunk_index = 0;
+       first_row < num_file_rows;
+       first_row += num_chunk_rows, ++chunk_index) {
+    // The buffer of this chunk was last used by the write before the pending
+    // one, which has finished.
+    T* chunk_values = chunk_buffers[chunk_index % 2].ptr<T>(0);
+    const int end_row = std::min(first_row + num_chunk_rows, num_file_rows);
+    for (int file_row = first_row; file_row < end_row; ++file_row) {
+      T* file_row_values =
+          chunk_values + (file_row - first_row) * num_file_row_values;
+      if (is_bsq) {
+        convert_band_row(
+            file_row / num_rows, file_row % num_rows, file_row_values);
+        continue;
+      }
+      for (int band = 0; band < num_bands; ++band) {
+        convert_band_row(
+            band,
+            file_row,
+            file_row_values + (interleave == HSI_BINARY_INTERLEAVE_BIL ?
+                band * num_cols : band));
+      }
+    }
+    const int num_chunk_values = (end_row - first_row) * num_file_row_values;
+    if (reverse_bytes) {
+      for (int i = 0; i < num_chunk_values; ++i) {
+        chunk_values[i] = ReverseBytes<T>(chunk_values[i]);
       }
     }
+
+    if (pending_write.valid()) {
+      pending_write.get();
+    }
+    const int64_t num_chunk_bytes = num_chunk_values * sizeof(T);
+    pending_write = std::async(
+        std::launch::async,
+        [file_descriptor, file_offset, chunk_values, num_chunk_bytes,
+         &hsi_file_path]() {
+          WriteToFile(
+              file_descriptor,
+              file_offset,
+              reinterpret_cast<const char*>(chunk_values),
+              num_chunk_bytes,
+              hsi_file_path);
+        });
+    file_offset += num_chunk_bytes;
+  }
+  if (pending_write.valid()) {
+    pending_write.get();
   }
-  output_envi_file.close();
+  close(file_descriptor);
+}
+
+// Writes the image bands into the file with the writer for the data type of
+// the given format. See WriteBinaryFile().
+void WriteBinaryFileOfType(
+    const ImageData& image,
+    const std::string& hsi_file_path,
+    const HSIBinaryDataFormat& data_format,
+    const int band_offset,
+    const int num_file_bands) {
+
+  switch (data_format.data_type) {
+    case HSI_DATA_TYPE_BYTE:
+      WriteBinaryFile<uint8_t>(
+          image, hsi_file_path, data_format, band_offset, num_file_bands);
+      break;
+    case HSI_DATA_TYPE_INT16:
+      WriteBinaryFile<int16_t>(
+          image, hsi_file_path, data_format, band_offset, num_file_bands);
+      break;
+    case HSI_DATA_TYPE_INT32:
+      WriteBinaryFile<int32_t>(
+          image, hsi_file_path, data_format, band_offset, num_file_bands);
+      break;
+    case HSI_DATA_TYPE_FLOAT:
+      WriteBinaryFile<float>(
+          image, hsi_file_path, data_format, band_offset, num_file_bands);
+      break;
+    case HSI_DATA_TYPE_DOUBLE:
+      WriteBinaryFile<double>(
+          image, hsi_file_path, data_format, band_offset, num_file_bands);
+      break;
+    case HSI_DATA_TYPE_UINT16:
+      WriteBinaryFile<uint16_t>(
+          image, hsi_file_path, data_format, band_offset, num_file_bands);
+      break;
+    default:
+      LOG(FATAL) << "Unsupported data type.";
+  }
+}
+
+// Writes the ENVI header (.hdr) and configuration (.config) files for a binary
+// file of the given size and format.
+void WriteHeaderFiles(
+    const std::string& hsi_file_path,
+    const HSIBinaryDataFormat& data_format,
+    const cv::Size& image_size,
+    const int num_bands) {
+
+  const HSIDataInterleaveFormat interleave = data_format.interleave;
+  const int num_rows = image_size.height;
+  const int num_cols = image_size.width;
 
   // Write the header file.
   const std::string header_file_path = hsi_file_path + ".hdr";
@@ -161,9 +793,11 @@ void WriteBinaryFileBSQ(
   output_header_file << "bands = " << num_bands << "\n";
   output_header_file << "header offset = 0\n";
   output_header_file << "file type = ENVI Standard\n";
-  output_header_file << "data type = 4\n";  // TODO: 4 = float, might change.
-  output_header_file << "interleave = bsq\n";
-  output_header_file << "byte order = 0\n";  // TODO: This might also change.
+  output_header_file << "data type = " << data_format.data_type << "\n";
+  output_header_file << "interleave = " << GetInterleaveName(interleave)
+                     << "\n";
+  output_header_file << "byte order = " << (data_format.big_endian ? 1 : 0)
+                     << "\n";
   // TODO: Verify that we don't need to generate the other "unknown" options.
   output_header_file.close();
 
@@ -177,9 +811,12 @@ void WriteBinaryFileBSQ(
       << "# Configuration file for reading '" << hsi_file_path
       << "', generated by HyperspectralDataLoader.\n";
   output_config_file << "file " << hsi_file_path << "\n";
-  output_config_file << "interleave bsq\n";
-  output_config_file << "data_type float\n";  // TODO: Might not be float.
-  output_config_file << "big_endian false\n";  // TODO: Might not be false.
+  output_config_file << "interleave " << GetInterleaveName(interleave)
+                     << "\n";
+  output_config_file << "data_type " << GetDataTypeName(data_format.data_type)
+                     << "\n";
+  output_config_file << "big_endian "
+                     << (data_format.big_endian ? "true" : "false") << "\n";
   output_config_file << "header_offset 0\n";
   output_config_file << "num_data_rows " << num_rows << "\n";
   output_config_file << "num_data_cols " << num_cols << "\n";
@@ -193,25 +830,711 @@ void WriteBinaryFileBSQ(
   output_config_file.close();
 }
 
+// Reads the given range of the file with the reader for its interleave
+// format, where T is the type of the file's data type and PixelT is the pixel
+// type of the returned image. BSQ files are read with up to num_threads
+// threads.
+template <typename T, typename PixelT>
+ImageData ReadBinaryFileOfType(
+    const std::string& hsi_file_path,
+    const HSIBinaryDataParameters& parameters,
+    const bool reverse_bytes,
+    const HSIDataRange& data_range,
+    const int num_threads) {
+
+  switch (parameters.data_format.interleave) {
+    case HSI_BINARY_INTERLEAVE_BSQ:
+      return ReadBinaryFileBSQ<T, PixelT>(
+          hsi_file_path,
+          parameters.num_data_rows,
+          parameters.num_data_cols,
+          parameters.num_data_bands,
+          parameters.header_offset,
+          reverse_bytes,
+          data_range,
+          num_threads);
+    case HSI_BINARY_INTERLEAVE_BIL:
+      return ReadBinaryFileBIL<T, PixelT>(
+          hsi_file_path,
+          parameters.num_data_rows,
+          parameters.num_data_cols,
+          parameters.num_data_bands,
+          parameters.header_offset,
+          reverse_bytes,
+          data_range);
+    case HSI_BINARY_INTERLEAVE_BIP:
+      return ReadBinaryFileBIP<T, PixelT>(
+          hsi_file_path,
+          parameters.num_data_rows,
+          parameters.num_data_cols,
+          parameters.num_data_bands,
+          parameters.header_offset,
+          reverse_bytes,
+          data_range);
+    default:
+      LOG(FATAL) << "Unsupported interleave format.";
+  }
+  return ImageData();
+}
+
+// Same as above, but picks the pixel type from the requested precision.
+template <typename T>
+ImageData ReadBinaryFileOfType(
+    const std::string& hsi_file_path,
+    const HSIBinaryDataParameters& parameters,
+    const bool reverse_bytes,
+    const HSIDataRange& data_range,
+    const int num_threads) {
+
+  if (parameters.precision == SINGLE_PRECISION) {
+    return ReadBinaryFileOfType<T, float>(
+        hsi_file_path, parameters, reverse_bytes, data_range, num_threads);
+  }
+  return ReadBinaryFileOfType<T, double>(
+      hsi_file_path, parameters, reverse_bytes, data_range, num_threads);
+}
+
 ImageData ReadBinaryFile(
     const std::string& hsi_file_path,
     const HSIBinaryDataParameters& parameters,
-    const HSIDataRange& data_range) {
+    const HSIDataRange& data_range,
+    const int num_threads) {
 
   // If endians don't match, the bytes from the file have to be reversed.
   const bool machine_big_endian = IsMachineBigEndian();
   const bool reverse_bytes =
       (parameters.data_format.big_endian != machine_big_endian);
 
-  // TODO: This may change, depending on interleave format and data type.
-  return ReadBinaryFileBSQ<float>(
-      hsi_file_path,
+  switch (parameters.data_format.data_type) {
+    case HSI_DATA_TYPE_BYTE:
+      return ReadBinaryFileOfType<uint8_t>(
+          hsi_file_path, parameters, reverse_bytes, data_range,
+          num_threads);
+    case HSI_DATA_TYPE_INT16:
+      return ReadBinaryFileOfType<int16_t>(
+          hsi_file_path, parameters, reverse_bytes, data_range,
+          num_threads);
+    case HSI_DATA_TYPE_INT32:
+      return ReadBinaryFileOfType<int32_t>(
+          hsi_file_path, parameters, reverse_bytes, data_range,
+          num_threads);
+    case HSI_DATA_TYPE_FLOAT:
+      return ReadBinaryFileOfType<float>(
+          hsi_file_path, parameters, reverse_bytes, data_range,
+          num_threads);
+    case HSI_DATA_TYPE_DOUBLE:
+      return ReadBinaryFileOfType<double>(
+          hsi_file_path, parameters, reverse_bytes, data_range,
+          num_threads);
+    case HSI_DATA_TYPE_UINT16:
+      return ReadBinaryFileOfType<uint16_t>(
+          hsi_file_path, parameters, reverse_bytes, data_range,
+          num_threads);
+    default:
+      LOG(FATAL) << "Unsupported data type.";
+  }
+  return ImageData();
+}
+
+// Returns true if the given data file is a MATLAB text file, which is given
+// by its .txt or .csv extension.
+bool IsMatlabTextFile(const std::string& file_path) {
+  return HasFileExtension(file_path, "txt") ||
+      HasFileExtension(file_path, "csv");
+}
+
+// Returns the size in bytes of the given file.
+int64_t GetFileSize(const std::string& file_path) {
+  struct stat file_status;
+  CHECK_EQ(stat(file_path.c_str(), &file_status), 0)
+      << "Could not get the size of file '" << file_path << "'.";
+  return file_status.st_size;
+}
+
+// Returns true if the character is a decimal digit. Unlike isdigit(), this
+// does not depend on the locale.
+inline bool IsDecimalDigit(const char character) {
+  return static_cast<unsigned char>(character - '0') < 10;
+}
+
+// Returns true if the character is a space or tab, or the carriage return of
+// a file with Windows line endings.
+inline bool IsTextBlank(const char character) {
+  return character == ' ' || character == '\t' || character == '\r';
+}
+
+// Returns true if the text starting at position (and ending before end)
+// starts with the given lowercase word, ignoring case.
+bool StartsWithWord(
+    const char* position, const char* end, const char* lowercase_word) {
+
+  const int word_length = std::strlen(lowercase_word);
+  if (end - position < word_length) {
+    return false;
+  }
+  for (int i = 0; i < word_length; ++i) {
+    if ((position[i] | 0x20) != lowercase_word[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Parses the decimal number (e.g. "-1.25e-3", "42", "NaN" or "-Inf", as
+// written by MATLAB) that starts at *cursor and ends before end, and moves
+// the cursor past it. Returns false if there is no number at the cursor.
+//
+// The number is parsed without the C library or iostreams, so the result does
+// not depend on the locale and no memory is allocated. The digits are
+// accumulated into an integer mantissa, which is exactly converted into a
+// double if it has at most 53 bits and the decimal exponent is small enough
+// for an exact power of ten. The result is then correctly rounded. Only
+// numbers with more significant digits or a larger exponent fall back to the
+// (slow) classic locale stream parser, so that they are also rounded
+// correctly.
+bool ParseDecimalNumber(
+    const char** cursor, const char* end, double* value) {
+
+  // The powers of ten that are exactly representable as doubles.
+  static constexpr double kExactPowersOfTen[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+      1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  constexpr int kMaxExactPowerOfTen = 22;
+  constexpr uint64_t kMaxExactMantissa = uint64_t(1) << 53;
+  // The number of decimal digits that always fit into the 64-bit mantissa.
+  constexpr int kMaxMantissaDigits = 19;
+
+  const char* number_start = *cursor;
+  const char* position = number_start;
+  bool is_negative = false;
+  if (position < end && (*position == '-' || *position == '+')) {
+    is_negative = (*position == '-');
+    ++position;
+  }
+
+  if (StartsWithWord(position, end, "nan")) {
+    *value = std::numeric_limits<double>::quiet_NaN();
+    *cursor = position + 3;
+    return true;
+  }
+  if (StartsWithWord(position, end, "inf")) {
+    *value = is_negative ?
+        -std::numeric_limits<double>::infinity() :
+        std::numeric_limits<double>::infinity();
+    *cursor = position + 3;
+    return true;
+  }
+
+  uint64_t mantissa = 0;
+  int num_mantissa_digits = 0;
+  int num_digits = 0;
+  int exponent = 0;
+  bool is_truncated = false;
+  // Adds a digit to the mantissa. Leading zeros are not significant, and
+  // digits that do not fit into the mantissa are dropped.
+  const auto add_digit = [&](const int digit, const bool is_fraction) {
+    ++num_digits;
+    if (num_mantissa_digits < kMaxMantissaDigits) {
+      mantissa = mantissa * 10 + digit;
+      if (mantissa > 0) {
+        ++num_mantissa_digits;
+      }
+      if (is_fraction) {
+        --exponent;
+      }
+    } else {
+      is_truncated |= (digit != 0);
+      if (!is_fraction) {
+        ++exponent;
+      }
+    }
+  };
+  while (position < end && IsDecimalDigit(*position)) {
+    add_digit(*position - '0', false);
+    ++position;
+  }
+  if (position < end && *position == '.') {
+    ++position;
+    while (position < end && IsDecimalDigit(*position)) {
+      add_digit(*position - '0', true);
+      ++position;
+    }
+  }
+  if (num_digits == 0) {
+    return false;
+  }
+
+  if (position < end && (*position == 'e' || *position == 'E')) {
+    ++position;
+    bool is_exponent_negative = false;
+    if (position < end && (*position == '-' || *position == '+')) {
+      is_exponent_negative = (*position == '-');
+      ++position;
+    }
+    if (position == end || !IsDecimalDigit(*position)) {
+      return false;
+    }
+    // Larger exponents overflow or underflow any double anyway.
+    int exponent_value = 0;
+    while (position < end && IsDecimalDigit(*position)) {
+      if (exponent_value < 100000) {
+        exponent_value = exponent_value * 10 + (*position - '0');
+      }
+      ++position;
+    }
+    exponent += is_exponent_negative ? -exponent_value : exponent_value;
+  }
+  *cursor = position;
+
+  if (mantissa == 0) {
+    *value = is_negative ? -0.0 : 0.0;
+    return true;
+  }
+  if (!is_truncated && mantissa <= kMaxExactMantissa &&
+      exponent >= -kMaxExactPowerOfTen && exponent <= kMaxExactPowerOfTen) {
+    const double exact_mantissa = static_cast<double>(mantissa);
+    *value = (exponent < 0) ?
+        exact_mantissa / kExactPowersOfTen[-exponent] :
+        exact_mantissa * kExactPowersOfTen[exponent];
+    if (is_negative) {
+      *value = -*value;
+    }
+    return true;
+  }
+  // Out of range numbers are saturated to the largest double by the stream.
+  std::istringstream number_stream(std::string(number_start, position));
+  number_stream.imbue(std::locale::classic());
+  number_stream >> *value;
+  return true;
+}
+
+// Parses the values of a line of a MATLAB text file (from line to line_end,
+// without the line break), which are separated by kMatlabTextDataDelimiter
+// and optionally blanks, and calls store(value_index, value) for each of
+// them in order. Returns the number of values, which is 0 for a blank line.
+// The line may not have more than max_num_values values. The line number is
+// only used in error messages.
+template <typename StoreFunction>
+int ParseMatlabTextLine(
+    const char* line,
+    const char* line_end,
+    const int max_num_values,
+    const int64_t line_number,
+    const std::string& file_path,
+    const StoreFunction& store) {
+
+  const char* position = line;
+  while (position < line_end && IsTextBlank(*position)) {
+    ++position;
+  }
+  int num_values = 0;
+  while (position < line_end) {
+    CHECK_LT(num_values, max_num_values)
+        << "Line " << line_number << " of '" << file_path << "' has more "
+        << "than " << max_num_values << " values.";
+    double value = 0.0;
+    const bool is_number = ParseDecimalNumber(&position, line_end, &value);
+    CHECK(is_number)
+        << "Value " << (num_values + 1) << " in line " << line_number
+        << " of '" << file_path << "' is not a number.";
+    store(num_values, value);
+    ++num_values;
+    while (position < line_end && IsTextBlank(*position)) {
+      ++position;
+    }
+    if (position == line_end) {
+      break;
+    }
+    CHECK_EQ(*position, kMatlabTextDataDelimiter)
+        << "Unexpected character after value " << num_values << " in line "
+        << line_number << " of '" << file_path << "'.";
+    ++position;
+    while (position < line_end && IsTextBlank(*position)) {
+      ++position;
+    }
+    CHECK(position < line_end)
+        << "Line " << line_number << " of '" << file_path << "' ends with a "
+        << "delimiter.";
+  }
+  return num_values;
+}
+
+// The position of a value in a MATLAB text file, given by its index along
+// the three dimensions of the data in the order of the interleave format,
+// from the outermost (slowest changing) to the innermost. Advancing to the
+// next value in the file only increments the indices, so no divisions are
+// needed per value.
+struct TextDataPosition {
+  // The dimension (0 to 2) of the band, row and column indices.
+  int band_dimension;
+  int row_dimension;
+  int col_dimension;
+
+  // The sizes of the dimensions and the current indices.
+  int sizes[3];
+  int indices[3];
+
+  // Sets the sizes of the data with the given interleave format.
+  TextDataPosition(
+      const HSIDataInterleaveFormat interleave,
+      const int num_data_rows,
+      const int num_data_cols,
+      const int num_data_bands) {
+
+    switch (interleave) {
+      case HSI_BINARY_INTERLEAVE_BSQ:
+        band_dimension = 0;
+        row_dimension = 1;
+        col_dimension = 2;
+        break;
+      case HSI_BINARY_INTERLEAVE_BIL:
+        row_dimension = 0;
+        band_dimension = 1;
+        col_dimension = 2;
+        break;
+      case HSI_BINARY_INTERLEAVE_BIP:
+        row_dimension = 0;
+        col_dimension = 1;
+        band_dimension = 2;
+        break;
+      default:
+        LOG(FATAL) << "Unsupported interleave format.";
+    }
+    sizes[band_dimension] = num_data_bands;
+    sizes[row_dimension] = num_data_rows;
+    sizes[col_dimension] = num_data_cols;
+    indices[0] = indices[1] = indices[2] = 0;
+  }
+
+  // Returns the index of the outermost dimension of the value with the given
+  // index in the file.
+  int GetOuterIndex(const int64_t value_index) const {
+    return value_index / (static_cast<int64_t>(sizes[1]) * sizes[2]);
+  }
+
+  // Moves to the value with the given index in the file.
+  void SetValueIndex(const int64_t value_index) {
+    indices[2] = value_index % sizes[2];
+    indices[1] = (value_index / sizes[2]) % sizes[1];
+    indices[0] = GetOuterIndex(value_index);
+  }
+
+  // Moves to the next value in the file.
+  void Advance() {
+    if (++indices[2] == sizes[2]) {
+      indices[2] = 0;
+      if (++indices[1] == sizes[1]) {
+        indices[1] = 0;
+        ++indices[0];
+      }
+    }
+  }
+};
+
+// Reads the given range of a MATLAB text file into an image with pixels of
+// type PixelT. The file stores the values of the whole cube in the order of
+// its interleave format (see HSIDataInterleaveFormat), as decimal numbers
+// that are separated by kMatlabTextDataDelimiter, with the same number of
+// values on every line (e.g. a matrix written with writematrix(), csvwrite()
+// or dlmwrite()). For example, a BIP file has one line of band values per
+// pixel if it is written as
+//   writematrix(reshape(permute(cube, [3 2 1]), bands, [])', 'cube.csv')
+// where the cube has the size rows x cols x bands.
+//
+// The file is memory mapped and split at line breaks into a few chunks per
+// thread (up to num_threads threads, 0 = all hardware threads). First, the
+// lines of each chunk are counted in parallel, which gives
+// the index of the first value of every chunk. Then the chunks are parsed in
+// parallel, and every value in the range is written directly into its
+// channel of the image. The lines that only hold values outside of the range
+// of the outermost dimension (e.g. bands for BSQ) are skipped without parsing
+// them.
+template <typename PixelT>
+ImageData ReadMatlabTextFileOfType(
+    const std::string& text_file_path,
+    const HSIBinaryDataParameters& parameters,
+    const HSIDataRange& data_range,
+    const int num_threads) {
+
+  CHECK_LE(data_range.end_row, parameters.num_data_rows)
+      << "End row index is out of bounds.";
+  CHECK_LE(data_range.end_col, parameters.num_data_cols)
+      << "End column index is out of bounds.";
+  CHECK_LE(data_range.end_band, parameters.num_data_bands)
+      << "End band index is out of bounds.";
+
+  const int64_t file_size = GetFileSize(text_file_path);
+  CHECK_GT(file_size, 0) << "File '" << text_file_path << "' is empty.";
+  const MappedFileRange mapped_file(text_file_path, 0, file_size);
+  const char* text = mapped_file.GetData();
+  const char* text_end = text + file_size;
+
+  // Returns the end of the line that starts at the given position, which is
+  // the position of the line break or the end of the file.
+  const auto get_line_end = [text_end](const char* line) {
+    const char* line_end =
+        static_cast<const char*>(std::memchr(line, '\n', text_end - line));
+    return (line_end != nullptr) ? line_end : text_end;
+  };
+
+  // The number of values per line is given by the first line.
+  const int num_values_per_line = ParseMatlabTextLine(
+      text,
+      get_line_end(text),
+      std::numeric_limits<int>::max(),
+      1,
+      text_file_path,
+      [](const int value_index, const double value) {});
+  CHECK_GT(num_values_per_line, 0)
+      << "The first line of '" << text_file_path << "' is empty.";
+  const int64_t num_data_values =
+      static_cast<int64_t>(parameters.num_data_rows) *
+      parameters.num_data_cols * parameters.num_data_bands;
+  CHECK_EQ(num_data_values % num_values_per_line, 0)
+      << "The " << num_values_per_line << " values in each line of '"
+      << text_file_path << "' do not evenly divide the "
+      << num_data_values << " values of the data.";
+  const int64_t num_data_lines = num_data_values / num_values_per_line;
+
+  // Split the file into chunks that start at the beginning of a line. The
+  // chunks are at least kMinChunkSize bytes, since small files are read
+  // faster by a single thread.
+  constexpr int64_t kMinChunkSize = 1024 * 1024;
+  constexpr int kNumChunksPerThread = 4;
+  const int num_chunk_threads = util::GetNumThreadsToUse(num_threads);
+  const int num_chunks = std::max<int64_t>(1, std::min<int64_t>(
+      num_chunk_threads * kNumChunksPerThread, file_size / kMinChunkSize));
+  std::vector<const char*> chunk_starts(num_chunks + 1, text_end);
+  chunk_starts[0] = text;
+  for (int chunk = 1; chunk < num_chunks; ++chunk) {
+    const char* split_position = std::max(
+        chunk_starts[chunk - 1], text + file_size * chunk / num_chunks);
+    const char* line_break = get_line_end(split_position);
+    chunk_starts[chunk] =
+        (line_break < text_end) ? line_break + 1 : text_end;
+  }
+
+  // Count the lines of every chunk. A final line without a line break is
+  // also counted.
+  std::vector<int64_t> chunk_first_lines(num_chunks + 1, 0);
+  util::RunParallelFor(num_chunk_threads, num_chunks, [&](const int chunk) {
+    const char* chunk_start = chunk_starts[chunk];
+    const char* chunk_end = chunk_starts[chunk + 1];
+    int64_t num_lines = std::count(chunk_start, chunk_end, '\n');
+    if (chunk_end == text_end && chunk_end > chunk_start &&
+        chunk_end[-1] != '\n') {
+      ++num_lines;
+    }
+    chunk_first_lines[chunk + 1] = num_lines;
+  });
+  for (int chunk = 0; chunk < num_chunks; ++chunk) {
+    chunk_first_lines[chunk + 1] += chunk_first_lines[chunk];
+  }
+  CHECK_GE(chunk_first_lines[num_chunks], num_data_lines)
+      << "File '" << text_file_path << "' has "
+      << chunk_first_lines[num_chunks] << " lines, but "
+      << num_data_lines << " lines of " << num_values_per_line
+      << " values are needed for the data size given in its configuration.";
+
+  const int num_range_bands = data_range.end_band - data_range.start_band;
+  const cv::Size image_size(
+      data_range.end_col - data_range.start_col,
+      data_range.end_row - data_range.start_row);
+  ImageData hsi_image(
+      image_size, num_range_bands, GetImagePrecision<PixelT>());
+  std::vector<PixelT*> channel_pixels(num_range_bands);
+  for (int channel = 0; channel < num_range_bands; ++channel) {
+    channel_pixels[channel] = GetChannelPixels<PixelT>(hsi_image, channel);
+  }
+
+  // The range of each dimension in the order of the interleave format.
+  const TextDataPosition layout(
+      parameters.data_format.interleave,
       parameters.num_data_rows,
       parameters.num_data_cols,
-      parameters.num_data_bands,
-      parameters.header_offset,
-      reverse_bytes,
-      data_range);
+      parameters.num_data_bands);
+  int range_start[3];
+  int range_end[3];
+  range_start[layout.band_dimension] = data_range.start_band;
+  range_end[layout.band_dimension] = data_range.end_band;
+  range_start[layout.row_dimension] = data_range.start_row;
+  range_end[layout.row_dimension] = data_range.end_row;
+  range_start[layout.col_dimension] = data_range.start_col;
+  range_end[layout.col_dimension] = data_range.end_col;
+
+  util::RunParallelFor(num_chunk_threads, num_chunks, [&](const int chunk) {
+    TextDataPosition position = layout;
+    const auto store_value = [&](const int value_index, const double value) {
+      const int* indices = position.indices;
+      if (indices[0] >= range_start[0] && indices[0] < range_end[0] &&
+          indices[1] >= range_start[1] && indices[1] < range_end[1] &&
+          indices[2] >= range_start[2] && indices[2] < range_end[2]) {
+        const int channel =
+            indices[position.band_dimension] - data_range.start_band;
+        const int pixel_index =
+            (indices[position.row_dimension] - data_range.start_row) *
+            image_size.width +
+            (indices[position.col_dimension] - data_range.start_col);
+        channel_pixels[channel][pixel_index] = static_cast<PixelT>(value);
+      }
+      position.Advance();
+    };
+
+    const char* chunk_end = chunk_starts[chunk + 1];
+    int64_t line_index = chunk_first_lines[chunk];
+    for (const char* line = chunk_starts[chunk]; line < chunk_end;
+         ++line_index) {
+      const char* line_end = get_line_end(line);
+      // Line numbers in error messages start at 1.
+      const int64_t line_number = line_index + 1;
+      if (line_index >= num_data_lines) {
+        // Only blank lines may follow the data.
+        CHECK(std::all_of(line, line_end, IsTextBlank))
+            << "Line " << line_number << " of '" << text_file_path
+            << "' has more values than the data size given in its "
+            << "configuration.";
+      } else {
+        const int64_t first_value_index = line_index * num_values_per_line;
+        const int64_t last_value_index =
+            first_value_index + num_values_per_line - 1;
+        if (position.GetOuterIndex(last_value_index) >= range_start[0] &&
+            position.GetOuterIndex(first_value_index) < range_end[0]) {
+          position.SetValueIndex(first_value_index);
+          const int num_values = ParseMatlabTextLine(
+              line,
+              line_end,
+              num_values_per_line,
+              line_number,
+              text_file_path,
+              store_value);
+          CHECK_EQ(num_values, num_values_per_line)
+              << "Line " << line_number << " of '" << text_file_path
+              << "' has fewer values than the first line.";
+        }
+      }
+      line = (line_end < chunk_end) ? line_end + 1 : chunk_end;
+    }
+  });
+  return hsi_image;
+}
+
+// Reads the given range of a MATLAB text file into an image of the
+// configured precision. See ReadMatlabTextFileOfType().
+ImageData ReadMatlabTextFile(
+    const std::string& text_file_path,
+    const HSIBinaryDataParameters& parameters,
+    const HSIDataRange& data_range,
+    const int num_threads) {
+
+  if (parameters.precision == SINGLE_PRECISION) {
+    return ReadMatlabTextFileOfType<float>(
+        text_file_path, parameters, data_range, num_threads);
+  }
+  return ReadMatlabTextFileOfType<double>(
+      text_file_path, parameters, data_range, num_threads);
+}
+
+// Reads the optional storage precision of the data from its configuration
+// file into parameters.
+void ReadPrecisionParameter(
+    const util::ConfigurationFileReader& config_reader,
+    HSIBinaryDataParameters* parameters) {
+
+  CHECK_NOTNULL(parameters);
+  if (!config_reader.HasValue("precision")) {
+    return;
+  }
+  const std::string precision = config_reader.GetValue("precision");
+  if (precision == "single") {
+    parameters->precision = SINGLE_PRECISION;
+  } else if (precision == "double") {
+    parameters->precision = DOUBLE_PRECISION;
+  } else {
+    LOG(FATAL) << "Unsupported precision: '" << precision << "'.";
+  }
+}
+
+// Reads the size of the data from its configuration file into parameters.
+void ReadDataSizeParameters(
+    const util::ConfigurationFileReader& config_reader,
+    HSIBinaryDataParameters* parameters) {
+
+  CHECK_NOTNULL(parameters);
+  // Number of rows:
+  const std::string num_data_rows =
+      config_reader.GetValueOrDie("num_data_rows");
+  parameters->num_data_rows = std::atoi(num_data_rows.c_str());
+  CHECK_GT(parameters->num_data_rows, 0)
+      << "Number of data rows must be positive.";
+  // Number of columns:
+  const std::string num_data_cols =
+      config_reader.GetValueOrDie("num_data_cols");
+  parameters->num_data_cols = std::atoi(num_data_cols.c_str());
+  CHECK_GT(parameters->num_data_cols, 0)
+      << "Number of data cols must be positive.";
+  // Number of spectral bands:
+  const std::string num_data_bands =
+      config_reader.GetValueOrDie("num_data_bands");
+  parameters->num_data_bands = std::atoi(num_data_bands.c_str());
+  CHECK_GT(parameters->num_data_bands, 0)
+      << "Number of data bands must be positive.";
+}
+
+// Reads the format and size of a MATLAB text file from its configuration
+// file into parameters. Text files only need the interleave format (the order
+// of their values) and the data size, and can be loaded in either precision.
+void ReadMatlabTextDataParameters(
+    const util::ConfigurationFileReader& config_reader,
+    HSIBinaryDataParameters* parameters) {
+
+  CHECK_NOTNULL(parameters);
+  const std::string interleave = config_reader.GetValueOrDie("interleave");
+  if (!GetInterleaveFromName(interleave, &parameters->data_format.interleave)) {
+    LOG(FATAL) << "Unsupported interleave format: '" << interleave << "'.";
+  }
+  ReadPrecisionParameter(config_reader, parameters);
+  ReadDataSizeParameters(config_reader, parameters);
+}
+
+// Reads the format and size of a binary data file from its configuration
+// file into parameters.
+void ReadBinaryDataParameters(
+    const util::ConfigurationFileReader& config_reader,
+    HSIBinaryDataParameters* parameters) {
+
+  CHECK_NOTNULL(parameters);
+  // Interleave format:
+  const std::string interleave = config_reader.GetValueOrDie("interleave");
+  if (!GetInterleaveFromName(interleave, &parameters->data_format.interleave)) {
+    LOG(FATAL) << "Unsupported interleave format: '" << interleave << "'.";
+  }
+  // Data type:
+  const std::string data_type = config_reader.GetValueOrDie("data_type");
+  if (!GetDataTypeFromName(data_type, &parameters->data_format.data_type)) {
+    LOG(FATAL) << "Unsupported data type: '" << data_type << "'.";
+  }
+  // Endian:
+  const std::string big_endian = config_reader.GetValueOrDie("big_endian");
+  if (big_endian == "true") {
+    parameters->data_format.big_endian = true;
+  } else {
+    parameters->data_format.big_endian = false;
+  }
+  // Storage precision (optional). Single precision keeps narrow data types in
+  // half the memory of double precision until the solver converts them.
+  ReadPrecisionParameter(config_reader, parameters);
+  if (parameters->precision == SINGLE_PRECISION &&
+      !IsExactInSinglePrecision(parameters->data_format.data_type)) {
+    LOG(WARNING) << "Data type '" << data_type << "' cannot be stored "
+                 << "exactly in single precision.";
+  }
+  // Header offset:
+  const std::string header_offset =
+      config_reader.GetValueOrDie("header_offset");
+  parameters->header_offset = std::atoi(header_offset.c_str());
+  CHECK_GE(parameters->header_offset, 0)
+      << "Header offset must be non-negative.";
+  ReadDataSizeParameters(config_reader, parameters);
 }
 
 }  // namespace
@@ -224,18 +1547,15 @@ void HSIBinaryDataParameters::ReadHeaderFromFile(
   config_reader.ReadFromFile(header_file_path);
   if (config_reader.HasValue("interleave")) {
     const std::string interleave = config_reader.GetValue("interleave");
-    if (interleave == "bsq") {
-      data_format.interleave = HSI_BINARY_INTERLEAVE_BSQ;
-    } else {
+    if (!GetInterleaveFromName(interleave, &data_format.interleave)) {
       LOG(WARNING) << "Unknown/unsupported interleave format: "
                    << interleave << ". Using BSQ by default.";
     }
   }
   if (config_reader.HasValue("data type")) {
     const std::string data_type = config_reader.GetValue("data type");
-    if (data_type == "4") {
-      data_format.data_type = HSI_DATA_TYPE_FLOAT;
-    } else {
+    if (!GetDataTypeFromCode(
+            std::atoi(data_type.c_str()), &data_format.data_type)) {
       LOG(WARNING) << "Unknown/unsupported data type: "
                    << data_type << ". Using float by default.";
     }
@@ -262,11 +1582,76 @@ void HSIBinaryDataParameters::ReadHeaderFromFile(
   }
 }
 
-// TODO: Support for different interleaves and data types.
+void HyperspectralDataLoader::LoadImageFromENVIFile() {
+  LoadBandsFromENVIFile(0, GetNumBands());
+}
+
+int HyperspectralDataLoader::GetNumBands() {
+  ReadConfigurationFile();
+  return data_range_.end_band - data_range_.start_band;
+}
+
+void HyperspectralDataLoader::LoadBandsFromENVIFile(
+    const int first_band, const int num_bands) {
+
+  PROFILE_SCOPE("HyperspectralDataLoader::LoadBandsFromENVIFile");
+  PROFILE_COUNT("HyperspectralDataLoader bands loaded", num_bands);
+
+  ReadConfigurationFile();
+  CHECK_GE(first_band, 0) << "The first band cannot be negative.";
+  CHECK_GT(num_bands, 0) << "At least one band must be loaded.";
+  HSIDataRange band_range = data_range_;
+  band_range.start_band += first_band;
+  band_range.end_band = band_range.start_band + num_bands;
+  CHECK_LE(band_range.end_band, data_range_.end_band)
+      << "The bands are outside of the band range of '" << file_path_ << "'.";
+  if (is_image_data_file_) {
+    hyperspectral_image_ =
+        LoadImageDataFile(file_path_, band_range.start_band, num_bands);
+    return;
+  }
+  if (is_chunked_file_) {
+    hyperspectral_image_ =
+        LoadChunkedHSIFile(hsi_file_path_, band_range, num_threads_);
+    return;
+  }
+  if (is_matlab_text_file_) {
+    hyperspectral_image_ = ReadMatlabTextFile(
+        hsi_file_path_, parameters_, band_range, num_threads_);
+    return;
+  }
+  hyperspectral_image_ =
+      ReadBinaryFile(hsi_file_path_, parameters_, band_range, num_threads_);
+}
+
 // TODO: Allow a header to take place of some of the config file values (i.e.
 //       data size and format parameters) if the "header" key is given. Right
 //       now config file has to contain all of the information directly.
-void HyperspectralDataLoader::LoadImageFromENVIFile() {
+void HyperspectralDataLoader::ReadConfigurationFile() {
+  if (is_configuration_read_) {
+    return;
+  }
+
+  // Image data files and chunked files describe themselves, so they are read
+  // without a configuration file.
+  ImageDataFileInfo image_data_file_info;
+  if (ReadImageDataFileInfo(file_path_, &image_data_file_info)) {
+    data_range_.end_band = image_data_file_info.num_channels;
+    is_image_data_file_ = true;
+    is_configuration_read_ = true;
+    return;
+  }
+  ChunkedHSIFileInfo chunked_file_info;
+  if (ReadChunkedHSIFileInfo(file_path_, &chunked_file_info)) {
+    hsi_file_path_ = file_path_;
+    data_range_.end_row = chunked_file_info.image_size.height;
+    data_range_.end_col = chunked_file_info.image_size.width;
+    data_range_.end_band = chunked_file_info.num_bands;
+    is_chunked_file_ = true;
+    is_configuration_read_ = true;
+    return;
+  }
+
   util::ConfigurationFileReader config_reader;
   config_reader.SetDelimiter(' ');
   config_reader.ReadFromFile(file_path_);
@@ -278,53 +1663,24 @@ void HyperspectralDataLoader::LoadImageFromENVIFile() {
       << "' specified in configuration file '" << file_path_
       << "' is not a valid ENVI file.";
 
-  // Get all of the necessary HSI file metadata.
+  // Get all of the necessary HSI file metadata. Chunked files store it in
+  // their header, so their configuration files only need the range.
   HSIBinaryDataParameters parameters;
-  // Interleave format:
-  const std::string interleave = config_reader.GetValueOrDie("interleave");
-  if (interleave == "bsq") {
-    parameters.data_format.interleave = HSI_BINARY_INTERLEAVE_BSQ;
-  } else {
-    LOG(FATAL) << "Unsupported interleave format: '" << interleave << "'.";
-  }
-  // Data type:
-  const std::string data_type = config_reader.GetValueOrDie("data_type");
-  if (data_type == "float") {
-    parameters.data_format.data_type = HSI_DATA_TYPE_FLOAT;
-  } else {
-    LOG(FATAL) << "Unsupported data type: '" << data_type << "'.";
-  }
-  // Endian:
-  const std::string big_endian = config_reader.GetValueOrDie("big_endian");
-  if (big_endian == "true") {
-    parameters.data_format.big_endian = true;
+  ChunkedHSIFileInfo chunked_file_info;
+  const bool is_chunked_file =
+      ReadChunkedHSIFileInfo(hsi_file_path, &chunked_file_info);
+  const bool is_matlab_text_file =
+      !is_chunked_file && IsMatlabTextFile(hsi_file_path);
+  if (is_chunked_file) {
+    parameters.precision = chunked_file_info.precision;
+    parameters.num_data_rows = chunked_file_info.image_size.height;
+    parameters.num_data_cols = chunked_file_info.image_size.width;
+    parameters.num_data_bands = chunked_file_info.num_bands;
+  } else if (is_matlab_text_file) {
+    ReadMatlabTextDataParameters(config_reader, &parameters);
   } else {
-    parameters.data_format.big_endian = false;
+    ReadBinaryDataParameters(config_reader, &parameters);
   }
-  // Header offset:
-  const std::string header_offset =
-      config_reader.GetValueOrDie("header_offset");
-  parameters.header_offset = std::atoi(header_offset.c_str());
-  CHECK_GE(parameters.header_offset, 0)
-      << "Header offset must be non-negative.";
-  // Number of rows:
-  const std::string num_data_rows =
-      config_reader.GetValueOrDie("num_data_rows");
-  parameters.num_data_rows = std::atoi(num_data_rows.c_str());
-  CHECK_GT(parameters.num_data_rows, 0)
-      << "Number of data rows must be positive.";
-  // Number of columns:
-  const std::string num_data_cols =
-      config_reader.GetValueOrDie("num_data_cols");
-  parameters.num_data_cols = std::atoi(num_data_cols.c_str());
-  CHECK_GT(parameters.num_data_cols, 0)
-      << "Number of data cols must be positive.";
-  // Number of spectral bands:
-  const std::string num_data_bands =
-      config_reader.GetValueOrDie("num_data_bands");
-  parameters.num_data_bands = std::atoi(num_data_bands.c_str());
-  CHECK_GT(parameters.num_data_bands, 0)
-      << "Number of data bands must be positive.";
 
   // Now get the data range parameters.
   HSIDataRange data_range;
@@ -372,8 +1728,12 @@ void HyperspectralDataLoader::LoadImageFromENVIFile() {
   CHECK_GT(data_range.end_band - data_range.start_band, 0)
       << "Band range must be positive.";
 
-  // And finally, read the data according to the parameters and range.
-  hyperspectral_image_ = ReadBinaryFile(hsi_file_path, parameters, data_range);
+  hsi_file_path_ = hsi_file_path;
+  parameters_ = parameters;
+  data_range_ = data_range;
+  is_chunked_file_ = is_chunked_file;
+  is_matlab_text_file_ = is_matlab_text_file;
+  is_configuration_read_ = true;
 }
 
 ImageData HyperspectralDataLoader::GetImage() const {
@@ -387,13 +1747,47 @@ void HyperspectralDataLoader::SaveImage(
     const ImageData& image,
     const HSIBinaryDataFormat& binary_data_format) const {
 
-  // If endians don't match, the bytes from the file have to be reversed.
-  const bool machine_big_endian = IsMachineBigEndian();
-  const bool reverse_bytes =
-      (binary_data_format.big_endian != machine_big_endian);
+  if (HasFileExtension(file_path_, kImageDataFileExtension)) {
+    SaveImageDataFile(image, file_path_);
+    return;
+  }
+  if (HasFileExtension(file_path_, kChunkedHSIFileExtension)) {
+    SaveChunkedHSIFile(image, file_path_);
+    return;
+  }
+  WriteBinaryFileOfType(
+      image, file_path_, binary_data_format, 0, image.GetNumChannels());
+  WriteHeaderFiles(
+      file_path_,
+      binary_data_format,
+      image.GetImageSize(),
+      image.GetNumChannels());
+}
 
-  // TODO: This may change, depending on interleave format and data type.
-  WriteBinaryFileBSQ<float>(image, file_path_, reverse_bytes);
+void HyperspectralDataLoader::SaveImageBands(
+    const ImageData& image,
+    const HSIBinaryDataFormat& binary_data_format,
+    const int first_band,
+    const int num_total_bands) const {
+
+  const int num_bands = image.GetNumChannels();
+  CHECK_GE(first_band, 0) << "The first band cannot be negative.";
+  CHECK_LE(first_band + num_bands, num_total_bands)
+      << "The bands do not fit into the total number of bands.";
+  CHECK(binary_data_format.interleave == HSI_BINARY_INTERLEAVE_BSQ ||
+        num_bands == num_total_bands)
+      << "Bands can only be saved incrementally in the BSQ format.";
+  CHECK(!HasFileExtension(file_path_, kImageDataFileExtension))
+      << "Bands cannot be saved incrementally into image data files.";
+  CHECK(!HasFileExtension(file_path_, kChunkedHSIFileExtension))
+      << "Bands cannot be saved incrementally into chunked files.";
+
+  WriteBinaryFileOfType(
+      image, file_path_, binary_data_format, first_band, num_total_bands);
+  if (first_band == 0) {
+    WriteHeaderFiles(
+        file_path_, binary_data_format, image.GetImageSize(), num_total_bands);
+  }
 }
 
 }  // namespace super_resolution
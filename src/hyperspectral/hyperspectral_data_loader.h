@@ -13,8 +13,6 @@ namespace super_resolution {
 // The possible formats of the hyperspectral image data to be loaded. Binary
 // formats do not specify any information other than the data itself, so header
 // information must be provided separately.
-//
-// TODO: Add support for BIP and BIL binary formats.
 enum HSIDataInterleaveFormat {
   // BSQ (band sequential) is a binary data format organized in order of
   // bands(rows(cols)). For example, for a file with 2 bands, 2 rows, and 2
@@ -27,15 +25,40 @@ enum HSIDataInterleaveFormat {
   //   b1,r0,c1
   //   b1,r1,c0
   //   b1,r1,c1
-  HSI_BINARY_INTERLEAVE_BSQ
+  HSI_BINARY_INTERLEAVE_BSQ,
+
+  // BIL (band interleaved by line) is organized in order of rows(bands(cols)).
+  // For the same example, the order would be as follows:
+  //   r0,b0,c0
+  //   r0,b0,c1
+  //   r0,b1,c0
+  //   r0,b1,c1
+  //   r1,b0,c0
+  //   ...
+  HSI_BINARY_INTERLEAVE_BIL,
+
+  // BIP (band interleaved by pixel) is organized in order of rows(cols(bands)).
+  // For the same example, the order would be as follows:
+  //   r0,c0,b0
+  //   r0,c0,b1
+  //   r0,c1,b0
+  //   r0,c1,b1
+  //   r1,c0,b0
+  //   ...
+  HSI_BINARY_INTERLEAVE_BIP
 };
 
 // The data type dictates how the binary HSI data is stored (e.g. as doubles,
-// floats, unsigned ints, etc.).
-//
-// TODO: Add support for other data types.
+// floats, unsigned ints, etc.). The values are the "data type" codes used in
+// ENVI headers. In configuration files, the data types are given by name
+// (uint8, int16, int32, float, double, and uint16).
 enum HSIBinaryDataType {
-  HSI_DATA_TYPE_FLOAT
+  HSI_DATA_TYPE_BYTE = 1,     // 8-bit unsigned integer.
+  HSI_DATA_TYPE_INT16 = 2,    // 16-bit signed integer.
+  HSI_DATA_TYPE_INT32 = 3,    // 32-bit signed integer.
+  HSI_DATA_TYPE_FLOAT = 4,    // 32-bit floating point.
+  HSI_DATA_TYPE_DOUBLE = 5,   // 64-bit floating point.
+  HSI_DATA_TYPE_UINT16 = 12   // 16-bit unsigned integer.
 };
 
 // Defines the formatting of the binary data file. This is used for reading and
@@ -62,7 +85,16 @@ struct HSIBinaryDataParameters {
   // The format and type of the data.
   HSIBinaryDataFormat data_format;
 
-  // Offset of the header (if there is a header directly attached to the data).
+  // The precision of the loaded image. Single precision uses half of the
+  // memory of double precision and represents the 8- and 16-bit integer data
+  // types and floats exactly, so they can be kept at (close to) their source
+  // width until the solver converts them. This is not stored in the file, but
+  // can be given with the "precision" key (single or double) of a
+  // configuration file.
+  ImagePrecision precision = DOUBLE_PRECISION;
+
+  // Offset of the header in bytes (if there is a header directly attached to
+  // the data).
   int header_offset = 0;
 
   // The size of the data. This is NOT the size of the chunk of data you want
@@ -73,6 +105,17 @@ struct HSIBinaryDataParameters {
   int num_data_bands = 0;
 };
 
+// The range of the data to be read from a binary HSI file. The end indices are
+// exclusive.
+struct HSIDataRange {
+  int start_row = 0;
+  int start_col = 0;
+  int end_row = 0;
+  int end_col = 0;
+  int start_band = 0;
+  int end_band = 0;
+};
+
 class HyperspectralDataLoader {
  public:
   // The given file path can serve two potential purposes:
@@ -84,14 +127,49 @@ class HyperspectralDataLoader {
   // 2. If the data is to be written to a file, then the given file_path will
   //    be the produced output file. A header file (with an appended .hdr to
   //    the given file_path) will also be generated.
+  //
+  // Image data files (with the .srimg extension, see image/image_data_file.h)
+  // store their own header, so they are loaded and saved directly through
+  // file_path, without a configuration file. Loading them maps the file
+  // instead of copying it. Chunked files (with the .srhsc extension, see
+  // hyperspectral/chunked_hsi_file.h) are also loaded and saved directly, or
+  // loaded through a configuration file that gives a range of the image and
+  // refers to the chunked file.
+  //
+  // The data file of a configuration file can also be a comma-delimited
+  // MATLAB text file (with the .txt or .csv extension), whose values are in
+  // the order of the configured interleave format. Its configuration file
+  // only needs the interleave format, the data size and the range (the data
+  // type, byte order and header offset are not used). Text files can only be
+  // loaded.
   explicit HyperspectralDataLoader(const std::string& file_path)
       : file_path_(file_path) {}
 
   // Attempts to load binary data. This assumes the file given to the
   // constructor is a configuration file which specifies all the necessary data
-  // parameters.
+  // parameters. The memory of the image is recorded under the memory tag of the
+  // calling thread (see util::ScopedMemoryTag).
   void LoadImageFromENVIFile();
 
+  // Returns the number of bands in the range given by the configuration file.
+  // The configuration file is only read once and is reused by the Load
+  // methods.
+  int GetNumBands();
+
+  // Same as LoadImageFromENVIFile(), but only loads num_bands bands starting
+  // at first_band, where band 0 is the first band of the configured range.
+  // Only the loaded bands are read from the file, so large images can be
+  // processed in blocks of bands that each fit into memory.
+  void LoadBandsFromENVIFile(const int first_band, const int num_bands);
+
+  // Sets the number of threads that read the file (0 = all hardware threads).
+  // Only BSQ files, chunked files and text files are read in parallel. The
+  // default is a single thread, since loaders often run next to other loaders
+  // or a solve.
+  void SetNumThreads(const int num_threads) {
+    num_threads_ = num_threads;
+  }
+
   // Returns the ImageData object containing the hyperspectral image data. The
   // image will be empty if one of the LoadData methods was never called.
   ImageData GetImage() const;
@@ -106,15 +184,49 @@ class HyperspectralDataLoader {
   // The configuration file may need to be modified with an absolute path if
   // the given file_path_ is a relative path.
   //
-  // The file formatting is dictated by the given HSIBinaryDataFormat.
+  // The file formatting is dictated by the given HSIBinaryDataFormat. If
+  // file_path_ is an image data file (.srimg) or a chunked file (.srhsc), the
+  // image is saved in that format in its own precision instead, and no other
+  // files are generated.
   void SaveImage(
       const ImageData& image,
       const HSIBinaryDataFormat& binary_data_format) const;
 
+  // Saves the image as the bands starting at first_band of a file with
+  // num_total_bands bands, so that a large image can be written incrementally
+  // in blocks of bands. Blocks are written in place and can be saved in any
+  // order, also by several processes at once, since every block creates the
+  // file if needed and sizes it for all bands. The header and configuration
+  // files are written with the first block (first_band = 0).
+  // Only the BSQ format stores bands contiguously, so blocks that do not
+  // cover all bands must be saved with the BSQ interleave. Image data files
+  // and chunked files cannot be saved in blocks.
+  void SaveImageBands(
+      const ImageData& image,
+      const HSIBinaryDataFormat& binary_data_format,
+      const int first_band,
+      const int num_total_bands) const;
+
  private:
+  // Reads the configuration file given by file_path_, if it was not read
+  // already.
+  void ReadConfigurationFile();
+
   // The name of the data file to be loaded.
   const std::string& file_path_;
 
+  // The binary data parameters and range given by the configuration file.
+  bool is_configuration_read_ = false;
+  bool is_image_data_file_ = false;
+  bool is_chunked_file_ = false;
+  bool is_matlab_text_file_ = false;
+  std::string hsi_file_path_;
+  HSIBinaryDataParameters parameters_;
+  HSIDataRange data_range_;
+
+  // The number of threads that read the file.
+  int num_threads_ = 1;
+
   // The data is stored in an ImageData container.
   ImageData hyperspectral_image_;
 };
@@ -1,10 +1,13 @@
 #include "hyperspectral/spectral_pca.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <vector>
 
 #include "image/image_data.h"
 #include "util/matrix_util.h"
+#include "util/memory_accounting.h"
+#include "util/thread_pool.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -22,14 +25,119 @@ constexpr bool kBackProjectionFlag = false;
 // samples, or as many as are available.
 constexpr int kPCASamplesMultiplicationFactor = 10;
 
-// Returns the data from the given images (one or more required) in
-// pixel-vector form. That is, instead of the images being organized by
-// channel, each row of the returned matrix will be a pixel, and the columns
-// span the different channels. The number of rows is the total number of
-// pixels across all images.
-cv::Mat GetPCAInputData(const std::vector<ImageData>& hyperspectral_images) {
+// The number of pixels in each block of pixel vectors that is gathered from
+// an image and added to the covariance sums at once.
+constexpr int64_t kPCAPixelBlockSize = 4096;
+
+// Sums of the (shifted) pixel vectors and of their outer products, from which
+// the mean and covariance of the spectra are computed. The pixel vectors are
+// shifted by a reference spectrum, which should be close to the mean, so that
+// the covariance does not lose precision to cancellation.
+struct SpectralMomentSums {
+  explicit SpectralMomentSums(const int num_bands)
+      : num_samples(0),
+        sums(cv::Mat::zeros(1, num_bands, util::kOpenCvMatrixType)),
+        products(cv::Mat::zeros(
+            num_bands, num_bands, util::kOpenCvMatrixType)) {}
+
+  void Add(const SpectralMomentSums& other) {
+    num_samples += other.num_samples;
+    sums += other.sums;
+    products += other.products;
+  }
+
+  int64_t num_samples;
+  cv::Mat sums;      // 1 x b
+  cv::Mat products;  // b x b
+};
+
+// Returns the value of the given pixel of a single or double precision
+// channel.
+double GetChannelValue(const cv::Mat& channel, const int64_t pixel_index) {
+  if (channel.depth() == CV_32F) {
+    return channel.ptr<float>()[pixel_index];
+  }
+  return channel.ptr<double>()[pixel_index];
+}
+
+// A block of pixels [first_pixel, end_pixel) of one image.
+struct PixelBlock {
+  int image_index;
+  int64_t first_pixel;
+  int64_t end_pixel;
+};
+
+// Returns an orthonormal basis (as columns) of the column space of the given
+// matrix, which must have at least as many rows as columns.
+cv::Mat GetOrthonormalBasis(const cv::Mat& matrix) {
+  cv::Mat singular_values;
+  cv::Mat basis;
+  cv::Mat right_singular_vectors;
+  cv::SVD::compute(matrix, singular_values, basis, right_singular_vectors);
+  return basis;
+}
+
+// Finds the top num_bands eigenvalues and eigenvectors (as rows) of the
+// symmetric covariance matrix with a randomized range finder: the covariance
+// is applied (power_iterations + 1) times to a random Gaussian sketch of
+// (num_bands + oversampling) vectors, and only the small projection onto the
+// resulting basis Q is decomposed, Q^T * Cx * Q = V * D * V^T. The
+// eigenvectors of Cx are then approximately Q * V. This costs
+// O(b^2 * (num_bands + oversampling)) per iteration rather than the O(b^3) of
+// the full decomposition.
+void GetRandomizedEigenDecomposition(
+    const cv::Mat& covariance,
+    const int num_bands,
+    const SpectralPCAOptions& options,
+    cv::Mat* eigenvalues,
+    cv::Mat* eigenvectors) {
+
+  const int sketch_size = num_bands + options.randomized_oversampling;
+  cv::Mat sketch(covariance.rows, sketch_size, util::kOpenCvMatrixType);
+  cv::RNG random_generator(options.random_seed);
+  random_generator.fill(sketch, cv::RNG::NORMAL, 0.0, 1.0);
+
+  // Orthonormalizing between the power iterations keeps the smaller
+  // components from being lost to round-off.
+  cv::Mat basis = GetOrthonormalBasis(covariance * sketch);
+  for (int i = 0; i < options.randomized_power_iterations; ++i) {
+    basis = GetOrthonormalBasis(covariance * basis);
+  }
+
+  const cv::Mat projected_covariance = basis.t() * covariance * basis;
+  cv::Mat projected_eigenvalues;
+  cv::Mat projected_eigenvectors;
+  cv::eigen(
+      projected_covariance, projected_eigenvalues, projected_eigenvectors);
+  *eigenvalues = projected_eigenvalues.rowRange(0, num_bands).clone();
+  *eigenvectors =
+      projected_eigenvectors.rowRange(0, num_bands) * basis.t();
+}
+
+// Accumulates the spectral covariance of the given images in one pass over
+// blocks of pixels, and returns the PCA basis with num_pca_bands bands (all
+// bands if 0), or, if retained_variance is positive, with the fewest bands
+// that retain that fraction of the variance. The total variance of the pixels
+// (the trace of their covariance) is also returned. Only the covariance sums
+// (b x b) and one block of pixel vectors per thread are held in memory.
+cv::PCA FitPCA(
+    const std::vector<ImageData>& hyperspectral_images,
+    const SpectralPCAOptions& options,
+    const int num_pca_bands,
+    const double retained_variance,
+    double* total_variance) {
+
+  const util::ScopedMemoryTag memory_tag(util::MEMORY_TAG_PCA);
   CHECK(!hyperspectral_images.empty())
       << "At least one image is required to compute the PCA basis.";
+  CHECK_GE(options.pixel_sampling_ratio, 0.0)
+      << "The pixel sampling ratio cannot be negative.";
+  CHECK_LE(options.pixel_sampling_ratio, 1.0)
+      << "The pixel sampling ratio cannot be larger than 1.";
+  CHECK_GE(options.randomized_oversampling, 0)
+      << "The randomized oversampling cannot be negative.";
+  CHECK_GE(options.randomized_power_iterations, 0)
+      << "The number of power iterations cannot be negative.";
 
   // Make sure we have the right number of channels. Also it does not make
   // sense to do this on non-hyperspectral images, so warn the user if that's
@@ -43,61 +151,210 @@ cv::Mat GetPCAInputData(const std::vector<ImageData>& hyperspectral_images) {
         << "useful or applicable here.";
   }
   const int num_images = hyperspectral_images.size();
-  const int num_pixels = hyperspectral_images[0].GetNumPixels();
+  const int64_t num_pixels = hyperspectral_images[0].GetNumPixels();
+  for (const ImageData& image : hyperspectral_images) {
+    CHECK_EQ(image.GetNumChannels(), num_channels)
+        << "Inconsistent number of channels between the given images. "
+        << "Cannot perform PCA.";
+    CHECK_EQ(image.GetNumPixels(), num_pixels)
+        << "Inconsistent image sizes. Cannot perform PCA.";
+  }
+
+  // Without random sampling, compute the number of samples (data points) to
+  // use per image. They are evenly spaced in each image, and cannot exceed
+  // the number of pixels available.
+  const bool use_random_sampling = options.pixel_sampling_ratio > 0.0;
+  const int64_t num_samples = num_channels * kPCASamplesMultiplicationFactor;
+  const int64_t num_samples_per_image =
+      std::max<int64_t>(1, std::min(num_samples / num_images, num_pixels));
+  const int64_t num_pixels_to_skip = num_pixels / num_samples_per_image;
+  if (use_random_sampling) {
+    LOG(INFO) << "Randomly sampling " << (options.pixel_sampling_ratio * 100.0)
+              << "% of the pixels for PCA training.";
+  } else if (num_pixels_to_skip > 1) {
+    LOG(INFO) << "Subsampling every " << num_pixels_to_skip
+              << " pixels per image for PCA training.";
+  }
+
+  std::vector<PixelBlock> pixel_blocks;
+  for (int image_index = 0; image_index < num_images; ++image_index) {
+    for (int64_t first_pixel = 0; first_pixel < num_pixels;
+         first_pixel += kPCAPixelBlockSize) {
+      PixelBlock block;
+      block.image_index = image_index;
+      block.first_pixel = first_pixel;
+      block.end_pixel =
+          std::min(first_pixel + kPCAPixelBlockSize, num_pixels);
+      pixel_blocks.push_back(block);
+    }
+  }
+  const int num_blocks = pixel_blocks.size();
+
+  // The first pixel of the first image is the reference spectrum.
+  cv::Mat reference_spectrum(1, num_channels, util::kOpenCvMatrixType);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    reference_spectrum.at<double>(channel) = GetChannelValue(
+        hyperspectral_images[0].GetChannelImage(channel), 0);
+  }
+
+  // Adds the sampled pixels of the given block to the sums. The random
+  // samples of each block only depend on the seed and the block index, so the
+  // selection does not depend on the number of threads.
+  const auto add_block = [&](
+      const int block_index, SpectralMomentSums* moment_sums) {
+    const PixelBlock& block = pixel_blocks[block_index];
+    std::vector<int64_t> sampled_pixels;
+    cv::RNG random_generator(options.random_seed + block_index);
+    for (int64_t pixel = block.first_pixel; pixel < block.end_pixel; ++pixel) {
+      bool is_sampled;
+      if (use_random_sampling) {
+        is_sampled =
+            random_generator.uniform(0.0, 1.0) < options.pixel_sampling_ratio;
+      } else {
+        is_sampled = (pixel % num_pixels_to_skip == 0) &&
+            (pixel / num_pixels_to_skip < num_samples_per_image);
+      }
+      if (is_sampled) {
+        sampled_pixels.push_back(pixel);
+      }
+    }
+    if (sampled_pixels.empty()) {
+      return;
+    }
+
+    const ImageData& image = hyperspectral_images[block.image_index];
+    const int num_block_samples = sampled_pixels.size();
+    cv::Mat block_data(
+        num_block_samples, num_channels, util::kOpenCvMatrixType);
+    for (int channel = 0; channel < num_channels; ++channel) {
+      const cv::Mat channel_image = image.GetChannelImage(channel);
+      const double reference_value = reference_spectrum.at<double>(channel);
+      for (int sample = 0; sample < num_block_samples; ++sample) {
+        block_data.at<double>(sample, channel) =
+            GetChannelValue(channel_image, sampled_pixels[sample]) -
+            reference_value;
+      }
+    }
+    cv::Mat block_sums;
+    cv::reduce(block_data, block_sums, 0, cv::REDUCE_SUM);
+    cv::Mat block_products;
+    cv::mulTransposed(block_data, block_products, true);
+    moment_sums->num_samples += num_block_samples;
+    moment_sums->sums += block_sums;
+    moment_sums->products += block_products;
+  };
 
-  // Compute the number of samples (data points) to use per image. This is for
-  // subsampling the data, and cannot exceed the number of pixels available.
-  const int num_samples = num_channels * kPCASamplesMultiplicationFactor;
-  int num_samples_per_image = num_samples / num_images;
-  if (num_samples_per_image > num_pixels) {
-    num_samples_per_image = num_pixels;
+  // Each thread sums a contiguous range of blocks, and the partial sums are
+  // added in order so that the result does not depend on thread timing.
+  const int num_threads =
+      std::min(util::GetNumThreadsToUse(options.num_threads), num_blocks);
+  std::vector<SpectralMomentSums> partial_sums(
+      num_threads, SpectralMomentSums(num_channels));
+  const auto sum_block_range = [&](const int thread_index) {
+    SpectralMomentSums thread_sums(num_channels);
+    const int first_block =
+        static_cast<int64_t>(thread_index) * num_blocks / num_threads;
+    const int end_block =
+        static_cast<int64_t>(thread_index + 1) * num_blocks / num_threads;
+    for (int block_index = first_block; block_index < end_block;
+         ++block_index) {
+      add_block(block_index, &thread_sums);
+    }
+    partial_sums[thread_index] = thread_sums;
+  };
+  if (num_threads > 1) {
+    // The calling thread also sums a range, so one fewer worker is needed.
+    util::ThreadPool thread_pool(num_threads - 1);
+    thread_pool.ParallelFor(num_threads, sum_block_range);
+  } else {
+    sum_block_range(0);
+  }
+  SpectralMomentSums moment_sums(num_channels);
+  for (const SpectralMomentSums& thread_sums : partial_sums) {
+    moment_sums.Add(thread_sums);
   }
-  const int num_data_points = num_images * num_samples_per_image;
+
+  const int64_t num_data_points = moment_sums.num_samples;
+  CHECK_GT(num_data_points, 0) << "No pixels were sampled for PCA training.";
   if (num_data_points < num_channels) {
     LOG(WARNING)
         << "The number of channels exceeds the number of data points (pixels). "
         << "PCA reconstruction quality will be limited. Use more data points.";
   }
 
-  // For subsampling, this will be the number of pixels we skip to draw samples
-  // from each image.
-  const int num_pixels_to_skip = num_pixels / num_samples_per_image;
-  if (num_pixels_to_skip > 1) {
-    LOG(INFO) << "Subsampling every " << num_pixels_to_skip
-              << " pixels per image for PCA training.";
+  // Cx = (1/m) sum(x_i * x_i^T) - mx * mx^T for the shifted pixel vectors.
+  const cv::Mat shifted_mean = moment_sums.sums / num_data_points;
+  const cv::Mat covariance = moment_sums.products / num_data_points -
+      shifted_mean.t() * shifted_mean;
+  *total_variance = cv::trace(covariance)[0];
+
+  // The randomized decomposition needs to know the number of bands up front,
+  // and is only cheaper if the sketch is smaller than the number of channels.
+  const bool use_randomized_decomposition =
+      options.use_randomized_decomposition && retained_variance <= 0.0 &&
+      num_pca_bands > 0 &&
+      num_pca_bands + options.randomized_oversampling < num_channels;
+  if (options.use_randomized_decomposition && !use_randomized_decomposition) {
+    LOG(WARNING) << "The randomized PCA decomposition requires a fixed number "
+                 << "of PCA bands (plus oversampling) below the number of "
+                 << "channels. Using the full decomposition instead.";
   }
 
-  // Format the input data as pixel vectors for PCA.
-  cv::Mat input_data(num_data_points, num_channels, util::kOpenCvMatrixType);
-  for (int image_index = 0; image_index < num_images; ++image_index) {
-    const ImageData& image = hyperspectral_images[image_index];
-    CHECK_EQ(image.GetNumChannels(), num_channels)
-        << "Inconsistent number of channels between the given images. "
-        << "Cannot perform PCA.";
-    // TODO: Faster to use cv::ROI and unfold the channel matrices that way.
-    for (int channel_index = 0; channel_index < num_channels; ++channel_index) {
-      for (int sample = 0; sample < num_samples_per_image; ++sample) {
-        const int data_row = image_index * num_samples_per_image + sample;
-        const int pixel_index = sample * num_pixels_to_skip;
-        input_data.at<double>(data_row, channel_index) =
-            image.GetPixelValue(channel_index, pixel_index);
+  cv::Mat eigenvalues;
+  cv::Mat eigenvectors;
+  if (use_randomized_decomposition) {
+    GetRandomizedEigenDecomposition(
+        covariance, num_pca_bands, options, &eigenvalues, &eigenvectors);
+  } else {
+    cv::eigen(covariance, eigenvalues, eigenvectors);
+  }
+
+  // The eigenvalues are sorted in descending order.
+  int num_bands = num_channels;
+  if (retained_variance > 0.0) {
+    const double total_variance = cv::sum(eigenvalues)[0];
+    double variance = 0.0;
+    for (num_bands = 0; num_bands < num_channels; ++num_bands) {
+      if (variance >= retained_variance * total_variance) {
+        break;
       }
+      variance += eigenvalues.at<double>(num_bands);
     }
+    num_bands = std::max(num_bands, 1);
+  } else if (num_pca_bands > 0) {
+    num_bands = std::min(num_pca_bands, num_channels);
   }
-  return input_data;
+
+  cv::PCA pca;
+  pca.mean = shifted_mean + reference_spectrum;
+  pca.eigenvalues = eigenvalues.rowRange(0, num_bands).clone();
+  pca.eigenvectors = eigenvectors.rowRange(0, num_bands).clone();
+  return pca;
 }
 
+// The number of pixels that are projected by each matrix product in
+// ConvertImage().
+constexpr int64_t kPCAProjectionBlockSize = 16384;
+
 // This function will either convert images from hyperspectral space to PCA
 // space or vice versa. Use the forward_projection flag to control the
 // projection direction (true = hyperspectral to PCA projection, false = PCA to
 // hyperspectral backprojection).
+//
+// The planar image layout is a [bands x pixels] matrix, so each block of
+// pixels is projected with a single matrix product, with no per-pixel copies:
+//   PCA = A^T * (X - mx)    and    X = A * PCA + mx,
+// where the rows of pca.eigenvectors are the columns of A. The blocks are
+// split between num_threads threads.
 ImageData ConvertImage(
     const ImageData& input_image,
     const cv::PCA& pca,
     const int num_spectral_bands,
     const int num_pca_bands,
-    const bool forward_projection) {
+    const bool forward_projection,
+    const int num_threads) {
 
+  const util::ScopedMemoryTag memory_tag(util::MEMORY_TAG_PCA);
   const cv::Size pca_eigenvectors_size = pca.eigenvectors.size();
   CHECK_EQ(pca_eigenvectors_size.width, num_spectral_bands);
   CHECK_EQ(pca_eigenvectors_size.height, num_pca_bands);
@@ -115,43 +372,82 @@ ImageData ConvertImage(
   CHECK_EQ(input_image.GetNumChannels(), num_input_bands)
       << "The input image does not have the correct number of channels.";
 
-  // Create empty OpenCV images for the output image channels.
-  std::vector<cv::Mat> output_image_channels;
-  output_image_channels.reserve(num_output_bands);
-  for (int i = 0; i < num_output_bands; ++i) {
-    cv::Mat channel_image =
-        cv::Mat::zeros(input_image.GetImageSize(), util::kOpenCvMatrixType);
-    output_image_channels.push_back(channel_image);
-  }
-
-  // Project the input image into the ouput space pixel by pixel.
-  const int num_pixels = input_image.GetNumPixels();
-  for (int pixel_index = 0; pixel_index < num_pixels; ++pixel_index) {
-    // Extract the pixel vector from the input image.
-    cv::Mat input_pixel_vector(1, num_input_bands, util::kOpenCvMatrixType);
-    for (int i = 0; i < num_input_bands; ++i) {
-      input_pixel_vector.at<double>(i) =
-          input_image.GetPixelValue(i, pixel_index);
-    }
-    // Project the input pixel vector into the other space and set the output
-    // channel values.
-    cv::Mat output_pixel_vector;
-    if (forward_projection) {
-      output_pixel_vector = pca.project(input_pixel_vector);
-    } else {
-      output_pixel_vector = pca.backProject(input_pixel_vector);
+  // The matrix products read the planar double precision layout directly, so
+  // other images are copied into that layout first.
+  const ImageData* planar_input_image = &input_image;
+  ImageData contiguous_input_image;
+  if (!input_image.IsContiguous() ||
+      input_image.GetPrecision() != DOUBLE_PRECISION) {
+    contiguous_input_image = input_image;
+    contiguous_input_image.SetPrecision(DOUBLE_PRECISION);
+    contiguous_input_image.MakeContiguous();
+    planar_input_image = &contiguous_input_image;
+  }
+  const double* input_data = planar_input_image->GetContiguousData();
+
+  // The projected pixels are written directly into the output image, so the
+  // channels are not copied again when it is returned.
+  ImageData output_image(input_image.GetImageSize(), num_output_bands);
+  double* output_data = output_image.GetMutableChannelData(0);
+
+  // The offset added to every projected pixel vector: -A^T * mx for the
+  // forward projection, and mx for the backprojection.
+  cv::Mat output_offset;
+  if (forward_projection) {
+    output_offset = -(pca.eigenvectors * pca.mean.t());
+  } else {
+    output_offset = pca.mean.t();
+  }
+
+  const int64_t num_pixels = input_image.GetNumPixels();
+  const size_t row_step = num_pixels * sizeof(double);
+  const int num_blocks = (num_pixels + kPCAProjectionBlockSize - 1) /
+      kPCAProjectionBlockSize;
+  const auto project_block = [&](const int block_index) {
+    const int64_t first_pixel = block_index * kPCAProjectionBlockSize;
+    const int block_size = static_cast<int>(
+        std::min(kPCAProjectionBlockSize, num_pixels - first_pixel));
+    const cv::Mat input_block(
+        num_input_bands,
+        block_size,
+        util::kOpenCvMatrixType,
+        const_cast<double*>(input_data + first_pixel),
+        row_step);
+    cv::Mat output_block(
+        num_output_bands,
+        block_size,
+        util::kOpenCvMatrixType,
+        output_data + first_pixel,
+        row_step);
+    cv::gemm(
+        pca.eigenvectors,
+        input_block,
+        1.0,
+        cv::Mat(),
+        0.0,
+        output_block,
+        forward_projection ? 0 : cv::GEMM_1_T);
+    for (int band = 0; band < num_output_bands; ++band) {
+      double* output_row = output_block.ptr<double>(band);
+      const double offset = output_offset.at<double>(band);
+      for (int i = 0; i < block_size; ++i) {
+        output_row[i] += offset;
+      }
     }
-    for (int i = 0; i < num_output_bands; ++i) {
-      output_image_channels[i].at<double>(pixel_index) =
-          output_pixel_vector.at<double>(i);
+  };
+
+  const int num_workers =
+      std::min(util::GetNumThreadsToUse(num_threads), num_blocks);
+  if (num_workers > 1) {
+    // The calling thread also projects blocks, so one fewer worker is needed.
+    util::ThreadPool thread_pool(num_workers - 1);
+    thread_pool.ParallelFor(num_blocks, project_block);
+  } else {
+    for (int block_index = 0; block_index < num_blocks; ++block_index) {
+      project_block(block_index);
     }
   }
 
-  // Return the projected image.
-  ImageData output_image;
-  for (const cv::Mat& channel_image : output_image_channels) {
-    output_image.AddChannel(channel_image, DO_NOT_NORMALIZE_IMAGE);
-  }
   if (forward_projection) {
     output_image.SetSpectralMode(SPECTRAL_MODE_HYPERSPECTRAL_PCA);
   } else {
@@ -164,10 +460,12 @@ ImageData ConvertImage(
 
 SpectralPCA::SpectralPCA(
     const std::vector<ImageData>& hyperspectral_images,
-    const int num_pca_bands) {
+    const int num_pca_bands,
+    const SpectralPCAOptions& options)
+    : num_threads_(options.num_threads) {
 
-  const cv::Mat input_data = GetPCAInputData(hyperspectral_images);
-  pca_ = cv::PCA(input_data, cv::Mat(), CV_PCA_DATA_AS_ROW, num_pca_bands);
+  pca_ = FitPCA(
+      hyperspectral_images, options, num_pca_bands, 0.0, &total_variance_);
 
   // Set the number of spectral in the original and PCA spaces.
   const cv::Size eigenvector_matrix_size = pca_.eigenvectors.size();
@@ -177,10 +475,14 @@ SpectralPCA::SpectralPCA(
 
 SpectralPCA::SpectralPCA(
     const std::vector<ImageData>& hyperspectral_images,
-    const double retained_variance) {
+    const double retained_variance,
+    const SpectralPCAOptions& options)
+    : num_threads_(options.num_threads) {
 
-  const cv::Mat input_data = GetPCAInputData(hyperspectral_images);
-  pca_ = cv::PCA(input_data, cv::Mat(), CV_PCA_DATA_AS_ROW, retained_variance);
+  CHECK_GT(retained_variance, 0.0) << "Retained variance must be positive.";
+  CHECK_LE(retained_variance, 1.0) << "Retained variance cannot exceed 1.";
+  pca_ = FitPCA(
+      hyperspectral_images, options, 0, retained_variance, &total_variance_);
 
   // Set the number of spectral in the original and PCA spaces.
   const cv::Size eigenvector_matrix_size = pca_.eigenvectors.size();
@@ -188,6 +490,45 @@ SpectralPCA::SpectralPCA(
   num_pca_bands_ = eigenvector_matrix_size.height;
 }
 
+SpectralPCA::SpectralPCA(
+    const cv::Mat& eigenvectors,
+    const cv::Mat& mean,
+    const SpectralPCAOptions& options,
+    const cv::Mat& eigenvalues,
+    const double total_variance)
+    : total_variance_(total_variance),
+      num_threads_(options.num_threads) {
+
+  CHECK_EQ(eigenvectors.type(), util::kOpenCvMatrixType)
+      << "The eigenvectors must be stored in double precision.";
+  CHECK_EQ(mean.type(), util::kOpenCvMatrixType)
+      << "The mean must be stored in double precision.";
+  CHECK_EQ(mean.rows, 1) << "The mean must be a row vector.";
+  CHECK_EQ(mean.cols, eigenvectors.cols)
+      << "The mean does not match the eigenvectors.";
+  pca_.eigenvectors = eigenvectors.clone();
+  pca_.mean = mean.clone();
+  num_spectral_bands_ = eigenvectors.cols;
+  num_pca_bands_ = eigenvectors.rows;
+  if (!eigenvalues.empty()) {
+    CHECK_EQ(eigenvalues.total(), num_pca_bands_)
+        << "There must be one eigenvalue per PCA band.";
+    pca_.eigenvalues = eigenvalues.reshape(1, num_pca_bands_).clone();
+  }
+}
+
+std::vector<double> SpectralPCA::GetExplainedVarianceRatios() const {
+  std::vector<double> explained_variance_ratios;
+  if (pca_.eigenvalues.empty() || total_variance_ <= 0.0) {
+    return explained_variance_ratios;
+  }
+  for (int band = 0; band < num_pca_bands_; ++band) {
+    explained_variance_ratios.push_back(
+        pca_.eigenvalues.at<double>(band) / total_variance_);
+  }
+  return explained_variance_ratios;
+}
+
 ImageData SpectralPCA::GetPCAImage(const ImageData& image_data) const {
   // Forward projection (hyperspectral to PCA).
   return ConvertImage(
@@ -195,7 +536,8 @@ ImageData SpectralPCA::GetPCAImage(const ImageData& image_data) const {
       pca_,
       num_spectral_bands_,
       num_pca_bands_,
-      kForwardProjectionFlag);
+      kForwardProjectionFlag,
+      num_threads_);
 }
 
 ImageData SpectralPCA::ReconstructImage(const ImageData& pca_image_data) const {
@@ -205,7 +547,8 @@ ImageData SpectralPCA::ReconstructImage(const ImageData& pca_image_data) const {
       pca_,
       num_spectral_bands_,
       num_pca_bands_,
-      kBackProjectionFlag);
+      kBackProjectionFlag,
+      num_threads_);
 }
 
 }  // namespace super_resolution
@@ -43,6 +43,39 @@
 
 namespace super_resolution {
 
+// Options for fitting the PCA basis. The spectral covariance is accumulated in
+// one pass over blocks of pixels, so fitting does not copy the images.
+struct SpectralPCAOptions {
+  // The fraction (0 < ratio <= 1) of the pixels of every image that are
+  // randomly sampled to fit the basis, where 1 uses every pixel. If this is 0,
+  // a fixed number of evenly spaced pixels (10 per spectral band, split
+  // between the images) are used instead.
+  double pixel_sampling_ratio = 0.0;
+
+  // The seed of the random pixel sampling. The sampled pixels only depend on
+  // the seed, not on the number of threads.
+  unsigned int random_seed = 0;
+
+  // The number of threads used to accumulate the covariance and to convert
+  // images to and from the PCA space (0 = all hardware threads).
+  int num_threads = 1;
+
+  // If set, and a fixed number of PCA bands is requested, the top bands are
+  // found with a randomized decomposition of the covariance instead of a full
+  // eigendecomposition. This is much faster for many spectral bands (e.g. 400)
+  // and few PCA bands (e.g. 10-20), and slightly less accurate. The random
+  // sketch uses random_seed.
+  bool use_randomized_decomposition = false;
+
+  // The number of extra random vectors in the randomized sketch beyond the
+  // number of PCA bands. More oversampling improves the accuracy.
+  int randomized_oversampling = 10;
+
+  // The number of power iterations of the randomized decomposition. Each one
+  // separates the top bands better from the rest of the spectrum.
+  int randomized_power_iterations = 2;
+};
+
 class SpectralPCA {
  public:
   // Uses the given set of images to generate the PCA decomposition and finds
@@ -54,7 +87,8 @@ class SpectralPCA {
   // less than the total number of spectral bands (see the description above).
   SpectralPCA(
       const std::vector<ImageData>& hyperspectral_images,
-      const int num_pca_bands = 0);
+      const int num_pca_bands = 0,
+      const SpectralPCAOptions& options = SpectralPCAOptions());
 
   // Same as the first constructor, but the given variance amount (where 0 <
   // retained_variance <= 1) will be used to find the top k eigenvalues such
@@ -64,7 +98,21 @@ class SpectralPCA {
   // decomposition will be the same as SpectralPCA(image_data, k).
   SpectralPCA(
       const std::vector<ImageData>& hyperspectral_images,
-      const double retained_variance);
+      const double retained_variance,
+      const SpectralPCAOptions& options = SpectralPCAOptions());
+
+  // Restores a decomposition from its basis, as returned by GetEigenvectors()
+  // and GetMean() (e.g. of a decomposition that was fitted by an earlier run),
+  // without fitting it again. Only the number of threads of the options is
+  // used. The eigenvalues and the total variance (see GetEigenvalues() and
+  // GetTotalVariance()) are optional, and only needed for
+  // GetExplainedVarianceRatios().
+  SpectralPCA(
+      const cv::Mat& eigenvectors,
+      const cv::Mat& mean,
+      const SpectralPCAOptions& options = SpectralPCAOptions(),
+      const cv::Mat& eigenvalues = cv::Mat(),
+      const double total_variance = 0.0);
 
   // Returns an image with PCA spectral channels (each pixel is converted into
   // the precomputed PCA space).
@@ -75,6 +123,31 @@ class SpectralPCA {
   // SpectralPCA object using GetPCAImage() for a valid reconstruction.
   ImageData ReconstructImage(const ImageData& pca_image_data) const;
 
+  // Returns the basis of the decomposition: the PCA bands as rows of a
+  // (PCA bands x spectral bands) matrix, and the mean spectrum as a row.
+  const cv::Mat& GetEigenvectors() const {
+    return pca_.eigenvectors;
+  }
+  const cv::Mat& GetMean() const {
+    return pca_.mean;
+  }
+
+  // Returns the variance of the fitted pixels along every PCA band (as a
+  // column), and the total variance of the fitted pixels over all spectral
+  // bands.
+  const cv::Mat& GetEigenvalues() const {
+    return pca_.eigenvalues;
+  }
+  double GetTotalVariance() const {
+    return total_variance_;
+  }
+
+  // Returns the fraction of the total variance that every PCA band explains,
+  // in decreasing order. The fractions add up to less than 1 if bands were
+  // left out. Returns an empty list for a restored decomposition without its
+  // eigenvalues.
+  std::vector<double> GetExplainedVarianceRatios() const;
+
  private:
   // The OpenCV PCA object that is used to compute the decomposition and
   // convert to and from PCA space.
@@ -87,6 +160,13 @@ class SpectralPCA {
   // equals the original number of channels, then the image can be
   // reconstructed exactly.
   int num_pca_bands_;
+
+  // The total variance of the fitted pixels (the trace of their covariance).
+  // It is 0 if it is not known.
+  double total_variance_ = 0.0;
+
+  // The number of threads used to convert images (see SpectralPCAOptions).
+  const int num_threads_;
 };
 
 }  // namespace super_resolution
@@ -0,0 +1,226 @@
+#include "image/edge_directed_upsampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "image/image_data.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// A direction is taken as the edge direction if one plus the gradient across
+// it is this many times one plus the gradient along it.
+constexpr double kEdgeGradientRatio = 1.15;
+
+// The exponent of the gradient weights that mix both directions in smooth
+// regions.
+constexpr int kGradientWeightExponent = 5;
+
+// Gradients are measured in units of 1/255 of the value range of the channel,
+// the range that the two constants above are chosen for.
+constexpr double kGradientRange = 255.0;
+
+// The number of pixels by which the image is extended (by replicating its
+// border) before doubling, so that every window of the two passes is inside
+// the extended image.
+constexpr int kBorderSize = 3;
+
+// The rows of each pass are interpolated in blocks of this many rows.
+constexpr int kRowsPerTask = 16;
+
+// Returns the cubic convolution interpolation halfway between p1 and p2, the
+// middle two of four equally spaced samples.
+double InterpolateCubic(
+    const double p0, const double p1, const double p2, const double p3) {
+  return (-p0 + 9.0 * (p1 + p2) - p3) / 16.0;
+}
+
+// Returns the interpolation from the two directions, where the gradients are
+// the summed gradients along each direction, and the values are the cubic
+// interpolations along each direction.
+double CombineDirections(
+    const double gradient_1,
+    const double value_1,
+    const double gradient_2,
+    const double value_2) {
+
+  if ((1.0 + gradient_2) > kEdgeGradientRatio * (1.0 + gradient_1)) {
+    return value_1;
+  }
+  if ((1.0 + gradient_1) > kEdgeGradientRatio * (1.0 + gradient_2)) {
+    return value_2;
+  }
+  double weighted_gradient_1 = 1.0;
+  double weighted_gradient_2 = 1.0;
+  for (int i = 0; i < kGradientWeightExponent; ++i) {
+    weighted_gradient_1 *= gradient_1;
+    weighted_gradient_2 *= gradient_2;
+  }
+  const double weight_1 = 1.0 / (1.0 + weighted_gradient_1);
+  const double weight_2 = 1.0 / (1.0 + weighted_gradient_2);
+  return (weight_1 * value_1 + weight_2 * value_2) / (weight_1 + weight_2);
+}
+
+}  // namespace
+
+cv::Mat DoubleImageEdgeDirected(const cv::Mat& image, const int num_threads) {
+  CHECK_EQ(image.type(), CV_64FC1)
+      << "Only single-channel double precision images can be doubled.";
+  CHECK(!image.empty()) << "Cannot double an empty image.";
+
+  cv::Mat extended_image;
+  cv::copyMakeBorder(
+      image, extended_image,
+      kBorderSize, kBorderSize, kBorderSize, kBorderSize,
+      cv::BORDER_REPLICATE);
+  double min_value;
+  double max_value;
+  cv::minMaxLoc(extended_image, &min_value, &max_value);
+  const double gradient_scale = (max_value > min_value) ?
+      kGradientRange / (max_value - min_value) : 1.0;
+
+  // The extended image goes to the even pixels of the doubled image, and the
+  // odd pixels are interpolated by the two passes.
+  const int num_rows = extended_image.rows;
+  const int num_cols = extended_image.cols;
+  cv::Mat doubled_image = cv::Mat::zeros(2 * num_rows, 2 * num_cols, CV_64FC1);
+  for (int row = 0; row < num_rows; ++row) {
+    const double* image_row = extended_image.ptr<double>(row);
+    double* doubled_row = doubled_image.ptr<double>(2 * row);
+    for (int col = 0; col < num_cols; ++col) {
+      doubled_row[2 * col] = image_row[col];
+    }
+  }
+  const auto run_on_rows = [num_threads](
+      const int start_row,
+      const int end_row,
+      const std::function<void(const int)>& interpolate_row) {
+    const int num_tasks = (end_row - start_row + kRowsPerTask - 1) /
+        kRowsPerTask;
+    util::RunParallelFor(num_threads, num_tasks, [&](const int task_index) {
+      const int task_start_row = start_row + task_index * kRowsPerTask;
+      const int task_end_row = std::min(task_start_row + kRowsPerTask, end_row);
+      for (int row = task_start_row; row < task_end_row; ++row) {
+        interpolate_row(row);
+      }
+    });
+  };
+
+  // The first pass fills the centers of the 2x2 pixel squares from the
+  // down-right and up-right diagonals of the 4x4 window around them.
+  const cv::Mat& source = extended_image;
+  run_on_rows(1, num_rows - 2, [&](const int row) {
+    double* doubled_row = doubled_image.ptr<double>(2 * row + 1);
+    for (int col = 1; col < num_cols - 2; ++col) {
+      double down_right_gradient = 0.0;
+      double up_right_gradient = 0.0;
+      for (int y = row - 1; y <= row + 1; ++y) {
+        for (int x = col - 1; x <= col + 1; ++x) {
+          down_right_gradient +=
+              std::abs(source.at<double>(y, x) -
+                       source.at<double>(y + 1, x + 1));
+          up_right_gradient +=
+              std::abs(source.at<double>(y + 1, x) -
+                       source.at<double>(y, x + 1));
+        }
+      }
+      const double down_right_value = InterpolateCubic(
+          source.at<double>(row - 1, col - 1),
+          source.at<double>(row, col),
+          source.at<double>(row + 1, col + 1),
+          source.at<double>(row + 2, col + 2));
+      const double up_right_value = InterpolateCubic(
+          source.at<double>(row + 2, col - 1),
+          source.at<double>(row + 1, col),
+          source.at<double>(row, col + 1),
+          source.at<double>(row - 1, col + 2));
+      doubled_row[2 * col + 1] = CombineDirections(
+          gradient_scale * down_right_gradient, down_right_value,
+          gradient_scale * up_right_gradient, up_right_value);
+    }
+  });
+
+  // The second pass fills the other pixels of the (cropped) result from their
+  // horizontal and vertical neighbours, which are all known now. Only these
+  // pixels are needed.
+  const int start = 2 * kBorderSize;
+  const int end_row = start + 2 * image.rows;
+  const int end_col = start + 2 * image.cols;
+  const cv::Mat& known = doubled_image;
+  run_on_rows(start, end_row, [&](const int row) {
+    double* doubled_row = doubled_image.ptr<double>(row);
+    for (int col = start + 1 - row % 2; col < end_col; col += 2) {
+      double horizontal_gradient = 0.0;
+      double vertical_gradient = 0.0;
+      for (int offset = -2; offset <= 2; ++offset) {
+        // The known pixels are the ones at an odd offset sum.
+        const int first_step = (offset % 2 == 0) ? -3 : -2;
+        for (int step = first_step; step <= 1; step += 2) {
+          horizontal_gradient +=
+              std::abs(known.at<double>(row + offset, col + step) -
+                       known.at<double>(row + offset, col + step + 2));
+          vertical_gradient +=
+              std::abs(known.at<double>(row + step, col + offset) -
+                       known.at<double>(row + step + 2, col + offset));
+        }
+      }
+      const double horizontal_value = InterpolateCubic(
+          doubled_row[col - 3], doubled_row[col - 1],
+          doubled_row[col + 1], doubled_row[col + 3]);
+      const double vertical_value = InterpolateCubic(
+          known.at<double>(row - 3, col), known.at<double>(row - 1, col),
+          known.at<double>(row + 1, col), known.at<double>(row + 3, col));
+      doubled_row[col] = CombineDirections(
+          gradient_scale * horizontal_gradient, horizontal_value,
+          gradient_scale * vertical_gradient, vertical_value);
+    }
+  });
+  return doubled_image(
+      cv::Rect(start, start, 2 * image.cols, 2 * image.rows)).clone();
+}
+
+ImageData EdgeDirectedUpsample(
+    const ImageData& image, const int scale, const int num_threads) {
+
+  CHECK_GE(scale, 1) << "The scale must be at least 1.";
+  ImageData double_precision_image = image;
+  double_precision_image.SetPrecision(DOUBLE_PRECISION);
+  const cv::Size image_size = image.GetImageSize();
+
+  ImageData upsampled_image;
+  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+    cv::Mat channel_image = double_precision_image.GetChannelImage(channel);
+    int doubled_scale = 1;
+    while (2 * doubled_scale <= scale) {
+      channel_image = DoubleImageEdgeDirected(channel_image, num_threads);
+      doubled_scale *= 2;
+    }
+    if (doubled_scale < scale) {
+      // Pixel (row, col) of the result is at (row, col) * doubled_scale / scale
+      // of the doubled image.
+      const double resampling_scale =
+          static_cast<double>(doubled_scale) / scale;
+      const cv::Mat transform = (cv::Mat_<double>(2, 3) <<
+          resampling_scale, 0.0, 0.0,
+          0.0, resampling_scale, 0.0);
+      cv::Mat resampled_image;
+      cv::warpAffine(
+          channel_image, resampled_image, transform, image_size * scale,
+          cv::INTER_CUBIC | cv::WARP_INVERSE_MAP, cv::BORDER_REPLICATE);
+      channel_image = resampled_image;
+    }
+    upsampled_image.AddChannel(channel_image, DO_NOT_NORMALIZE_IMAGE);
+  }
+  upsampled_image.SetPrecision(image.GetPrecision());
+  return upsampled_image;
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,44 @@
+// Edge-directed upsampling for the initial estimate of the MAP solvers. Plain
+// bilinear upsampling blurs every edge across the interpolated pixels, and the
+// solver then spends many IRLS iterations sharpening them again. This instead
+// interpolates along edges with directional cubic convolution interpolation
+// (DCCI), as described in "Image zooming using directional cubic convolution
+// interpolation" (Zhou et al., 2012).
+//
+// Each step doubles the image in two passes. The first pass fills the pixels
+// at the centers of the original 2x2 pixel squares from one of the two
+// diagonals, and the second fills the remaining pixels from the horizontal or
+// vertical neighbours. In both passes, the pixel is interpolated with a cubic
+// along the direction whose summed gradient in the surrounding 4x4 window is
+// clearly the smaller one (the edge direction), or with a gradient-weighted
+// mix of both directions in smooth regions.
+//
+// The original pixels are kept at the top-left of every scale x scale patch,
+// which is the pixel that the DownsamplingModule keeps, so the upsampled image
+// is consistent with the image model. Scales that are not powers of 2 are
+// reached with a final cubic resampling of the largest doubled image.
+
+#ifndef SRC_IMAGE_EDGE_DIRECTED_UPSAMPLING_H_
+#define SRC_IMAGE_EDGE_DIRECTED_UPSAMPLING_H_
+
+#include "image/image_data.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+// Returns the single-channel double precision image upsampled to twice its
+// size with DCCI. Pixel (2 * row, 2 * col) of the result is pixel (row, col)
+// of the given image. Rows are interpolated with up to num_threads threads
+// (0 = all hardware threads).
+cv::Mat DoubleImageEdgeDirected(const cv::Mat& image, const int num_threads);
+
+// Returns the image upsampled by the given scale (at least 1) with
+// edge-directed interpolation (see above), in the precision of the image.
+// Hidden channels are not upsampled.
+ImageData EdgeDirectedUpsample(
+    const ImageData& image, const int scale, const int num_threads = 1);
+
+}  // namespace super_resolution
+
+#endif  // SRC_IMAGE_EDGE_DIRECTED_UPSAMPLING_H_
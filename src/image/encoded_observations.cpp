@@ -0,0 +1,234 @@
+#include "image/encoded_observations.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "image/image_data.h"
+#include "util/memory_accounting.h"
+#include "util/vector_kernels.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// The largest unsigned 16-bit code.
+constexpr double kMaxCode = std::numeric_limits<uint16_t>::max();
+
+// Returns the given channel of the observation in double precision.
+cv::Mat GetDoubleChannel(const ImageData& observation, const int channel) {
+  cv::Mat double_channel;
+  observation.GetChannelImage(channel).convertTo(double_channel, CV_64F);
+  return double_channel;
+}
+
+}  // namespace
+
+bool ParseObservationEncoding(
+    const std::string& name, ObservationEncoding* encoding) {
+
+  CHECK_NOTNULL(encoding);
+  if (name == "none") {
+    *encoding = OBSERVATION_ENCODING_NONE;
+  } else if (name == "half") {
+    *encoding = OBSERVATION_ENCODING_HALF;
+  } else if (name == "uint16") {
+    *encoding = OBSERVATION_ENCODING_UINT16;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+EncodedObservations::EncodedObservations(
+    const std::vector<ImageData>& observations,
+    const int channel_start,
+    const int channel_end,
+    const ObservationEncoding encoding)
+    : encoding_(encoding),
+      channel_start_(channel_start),
+      num_observations_(observations.size()),
+      num_channels_(channel_end - channel_start),
+      memory_(util::MEMORY_TAG_OBSERVATIONS) {
+
+  CHECK_NE(encoding_, OBSERVATION_ENCODING_NONE)
+      << "The observations must be encoded.";
+  CHECK_GT(num_observations_, 0) << "There are no observations to encode.";
+  CHECK_GE(channel_start, 0) << "First channel in range is out of bounds.";
+  CHECK_LE(channel_end, observations[0].GetNumChannels())
+      << "Last channel in range is out of bounds (non-inclusive).";
+  CHECK_GT(num_channels_, 0) << "Invalid channel range.";
+  image_size_ = observations[0].GetImageSize();
+  num_pixels_ = observations[0].GetNumPixels();
+  for (const ImageData& observation : observations) {
+    CHECK(observation.GetImageSize() == image_size_)
+        << "All observations must have the same size.";
+  }
+
+  // Each channel of the uint16 encoding spans the range of its values in all
+  // observations.
+  if (encoding_ == OBSERVATION_ENCODING_UINT16) {
+    channel_scales_.resize(num_channels_);
+    channel_offsets_.resize(num_channels_);
+    for (int channel = 0; channel < num_channels_; ++channel) {
+      double min_value = std::numeric_limits<double>::max();
+      double max_value = std::numeric_limits<double>::lowest();
+      for (const ImageData& observation : observations) {
+        double observation_min_value;
+        double observation_max_value;
+        cv::minMaxLoc(
+            observation.GetChannelImage(channel_start + channel),
+            &observation_min_value,
+            &observation_max_value);
+        min_value = std::min(min_value, observation_min_value);
+        max_value = std::max(max_value, observation_max_value);
+      }
+      channel_offsets_[channel] = min_value;
+      channel_scales_[channel] = (max_value - min_value) / kMaxCode;
+    }
+  }
+
+  codes_.resize(static_cast<int64_t>(num_observations_) * num_channels_ *
+                num_pixels_);
+  memory_.SetBytes(util::GetBufferBytes(codes_));
+  for (int image_index = 0; image_index < num_observations_; ++image_index) {
+    EncodeObservation(observations[image_index], image_index);
+  }
+}
+
+bool EncodedObservations::AddObservation(const ImageData& observation) {
+  CHECK(observation.GetImageSize() == image_size_)
+      << "All observations must have the same size.";
+  CHECK_LE(channel_start_ + num_channels_, observation.GetNumChannels())
+      << "Last channel in range is out of bounds (non-inclusive).";
+  if (encoding_ == OBSERVATION_ENCODING_UINT16) {
+    for (int channel = 0; channel < num_channels_; ++channel) {
+      double min_value;
+      double max_value;
+      cv::minMaxLoc(
+          observation.GetChannelImage(channel_start_ + channel),
+          &min_value,
+          &max_value);
+      const double max_encoded_value =
+          channel_offsets_[channel] + kMaxCode * channel_scales_[channel];
+      if (min_value < channel_offsets_[channel] ||
+          max_value > max_encoded_value) {
+        return false;
+      }
+    }
+  }
+  codes_.resize(static_cast<int64_t>(num_observations_ + 1) * num_channels_ *
+                num_pixels_);
+  memory_.SetBytes(util::GetBufferBytes(codes_));
+  EncodeObservation(observation, num_observations_);
+  num_observations_++;
+  return true;
+}
+
+double EncodedObservations::GetPixelValue(
+    const int image_index,
+    const int channel_index,
+    const int64_t pixel_index) const {
+
+  CHECK_GE(pixel_index, 0) << "Pixel index is out of bounds.";
+  CHECK_LT(pixel_index, num_pixels_) << "Pixel index is out of bounds.";
+  const uint16_t code =
+      GetChannelCodes(image_index, channel_index)[pixel_index];
+  if (encoding_ == OBSERVATION_ENCODING_HALF) {
+    return util::DecodeHalf(code);
+  }
+  return channel_scales_[channel_index] * code +
+      channel_offsets_[channel_index];
+}
+
+double EncodedObservations::ComputeWeightedResiduals(
+    const int image_index,
+    const int channel_index,
+    const double weight,
+    double* degraded) const {
+
+  const uint16_t* channel_codes = GetChannelCodes(image_index, channel_index);
+  if (encoding_ == OBSERVATION_ENCODING_HALF) {
+    return util::ComputeWeightedResidualsHalf(
+        num_pixels_, channel_codes, weight, degraded);
+  }
+  return util::ComputeWeightedResidualsQuantized(
+      num_pixels_,
+      channel_codes,
+      channel_scales_[channel_index],
+      channel_offsets_[channel_index],
+      weight,
+      degraded);
+}
+
+double EncodedObservations::ComputeWeightedResiduals(
+    const int image_index,
+    const int channel_index,
+    const double weight,
+    float* degraded) const {
+
+  const uint16_t* channel_codes = GetChannelCodes(image_index, channel_index);
+  if (encoding_ == OBSERVATION_ENCODING_HALF) {
+    return util::ComputeWeightedResidualsHalf(
+        num_pixels_, channel_codes, weight, degraded);
+  }
+  return util::ComputeWeightedResidualsQuantized(
+      num_pixels_,
+      channel_codes,
+      channel_scales_[channel_index],
+      channel_offsets_[channel_index],
+      weight,
+      degraded);
+}
+
+void EncodedObservations::EncodeObservation(
+    const ImageData& observation, const int image_index) {
+
+  for (int channel = 0; channel < num_channels_; ++channel) {
+    const cv::Mat values =
+        GetDoubleChannel(observation, channel_start_ + channel);
+    const double* value_data = values.ptr<double>();
+    uint16_t* channel_codes = codes_.data() +
+        (static_cast<int64_t>(image_index) * num_channels_ + channel) *
+        num_pixels_;
+    if (encoding_ == OBSERVATION_ENCODING_HALF) {
+      for (int64_t pixel_index = 0; pixel_index < num_pixels_;
+           ++pixel_index) {
+        channel_codes[pixel_index] =
+            util::EncodeHalf(static_cast<float>(value_data[pixel_index]));
+      }
+    } else {
+      const double scale = channel_scales_[channel];
+      const double offset = channel_offsets_[channel];
+      const double inverse_scale = (scale > 0.0) ? 1.0 / scale : 0.0;
+      for (int64_t pixel_index = 0; pixel_index < num_pixels_;
+           ++pixel_index) {
+        const double code =
+            std::round((value_data[pixel_index] - offset) * inverse_scale);
+        channel_codes[pixel_index] =
+            static_cast<uint16_t>(std::min(std::max(code, 0.0), kMaxCode));
+      }
+    }
+  }
+}
+
+const uint16_t* EncodedObservations::GetChannelCodes(
+    const int image_index, const int channel_index) const {
+
+  CHECK_GE(image_index, 0) << "Observation index is out of bounds.";
+  CHECK_LT(image_index, num_observations_)
+      << "Observation index is out of bounds.";
+  CHECK_GE(channel_index, 0) << "Channel index is out of bounds.";
+  CHECK_LT(channel_index, num_channels_) << "Channel index is out of bounds.";
+  return codes_.data() +
+      (static_cast<int64_t>(image_index) * num_channels_ + channel_index) *
+      num_pixels_;
+}
+
+}  // namespace super_resolution
@@ -1,12 +1,17 @@
 #include "image/image_data.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "util/matrix_util.h"
+#include "util/thread_pool.h"
+#include "util/vector_kernels.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -15,6 +20,10 @@
 namespace super_resolution {
 namespace {
 
+// The maximum number of evenly spaced pixels used to fit the principal
+// component of STRUCTURE_IMAGE_FIRST_PRINCIPAL_COMPONENT structure images.
+constexpr int64_t kNumStructurePCASamples = 4096;
+
 // Returns true if the given ImageSpectralMode represents a 3-channel color
 // image.
 bool IsColorImage(const ImageSpectralMode& spectral_mode) {
@@ -43,13 +52,42 @@ ImageSpectralMode GetDefaultSpectralMode(const int num_channels) {
   }
 }
 
+// Returns the OpenCV matrix type used to store channels of the given
+// precision.
+int GetOpenCvMatrixType(const ImagePrecision precision) {
+  if (precision == SINGLE_PRECISION) {
+    return util::kOpenCvSinglePrecisionMatrixType;
+  }
+  return util::kOpenCvMatrixType;
+}
+
+// Returns the channels of a planar allocation, which stores num_channels
+// channels one after the other as consecutive blocks of rows. The returned
+// channel images are views into the plane, so no data is copied.
+std::vector<cv::Mat> GetPlanarChannelViews(
+    const cv::Mat& plane, const int num_channels) {
+
+  CHECK_EQ(plane.rows % num_channels, 0)
+      << "The plane does not contain a whole number of channels.";
+  const int channel_height = plane.rows / num_channels;
+  std::vector<cv::Mat> channels;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    channels.push_back(plane.rowRange(
+        channel * channel_height, (channel + 1) * channel_height));
+  }
+  return channels;
+}
+
 // The actual implementation used by constructors ImageData(const cv::Mat&),
 // ImageData(const cv::Mat&, const bool), and
 // ImageData(const double*, const cv::Size&). The channels parameter should be
 // the channels_ class variable.
 //
 // This method makes a copy of the given image data, so the original data or
-// image is not modified when this ImageData is modified.
+// image is not modified when this ImageData is modified. The channels are
+// separated, converted and normalized in a single pass over the image, one
+// row at a time, directly into a planar allocation (see
+// GetPlanarChannelViews()).
 void InitializeFromImage(
     const cv::Mat& image,
     const ImageNormalizeMode normalize_mode,
@@ -60,31 +98,319 @@ void InitializeFromImage(
   CHECK_NOTNULL(channels);
 
   *image_size = image.size();
-  cv::split(image, *channels);  // makes a copy, even if just one channel
-  for (int i = 0; i < channels->size(); ++i) {
-    if (normalize_mode == NORMALIZE_IMAGE) {
-      (*channels)[i].convertTo(
-          (*channels)[i],
-          util::kOpenCvMatrixType,
-          1.0 / 255.0);
+  const int num_channels = image.channels();
+  const double scale = (normalize_mode == NORMALIZE_IMAGE) ? 1.0 / 255.0 : 1.0;
+  const cv::Mat plane(
+      image.rows * num_channels, image.cols, util::kOpenCvMatrixType);
+  *channels = GetPlanarChannelViews(plane, num_channels);
+  if (num_channels == 1) {
+    // The view already has the right size and type, so this converts the
+    // pixels into the plane instead of reallocating the view.
+    image.convertTo((*channels)[0], util::kOpenCvMatrixType, scale);
+    return;
+  }
+
+  // Each row is converted while it is in the cache, and then split into the
+  // channels.
+  cv::Mat converted_row(
+      1, image.cols, CV_MAKETYPE(util::kOpenCvMatrixType, num_channels));
+  const double* converted_values = converted_row.ptr<double>(0);
+  for (int row = 0; row < image.rows; ++row) {
+    image.row(row).convertTo(converted_row, converted_row.type(), scale);
+    for (int channel = 0; channel < num_channels; ++channel) {
+      double* channel_row = (*channels)[channel].ptr<double>(row);
+      for (int col = 0; col < image.cols; ++col) {
+        channel_row[col] = converted_values[col * num_channels + channel];
+      }
+    }
+  }
+}
+
+// Returns uninitialized channels of the same sizes and types as the given
+// channels, as views into a single planar allocation (see
+// GetPlanarChannelViews()). Hidden color channels of luminance-only images may
+// not match the size of the luminance channel, in which case every channel is
+// allocated separately instead.
+std::vector<cv::Mat> AllocatePlanarStorageLike(
+    const std::vector<cv::Mat>& channels) {
+
+  std::vector<cv::Mat> allocated_channels;
+  if (channels.empty()) {
+    return allocated_channels;
+  }
+  const cv::Size channel_size = channels[0].size();
+  const int matrix_type = channels[0].type();
+  for (const cv::Mat& channel_image : channels) {
+    if (channel_image.size() != channel_size ||
+        channel_image.type() != matrix_type) {
+      for (const cv::Mat& channel_image_to_match : channels) {
+        allocated_channels.push_back(cv::Mat(
+            channel_image_to_match.size(), channel_image_to_match.type()));
+      }
+      return allocated_channels;
+    }
+  }
+
+  const int num_channels = channels.size();
+  const cv::Mat plane(
+      channel_size.height * num_channels, channel_size.width, matrix_type);
+  return GetPlanarChannelViews(plane, num_channels);
+}
+
+// Copies the given channels into a single planar allocation if possible (see
+// AllocatePlanarStorageLike()).
+std::vector<cv::Mat> CopyToPlanarStorage(const std::vector<cv::Mat>& channels) {
+  std::vector<cv::Mat> copied_channels = AllocatePlanarStorageLike(channels);
+  const int num_channels = channels.size();
+  for (int channel = 0; channel < num_channels; ++channel) {
+    // The view already has the right size and type, so this copies the
+    // pixels into the plane instead of reallocating the view.
+    channels[channel].copyTo(copied_channels[channel]);
+  }
+  return copied_channels;
+}
+
+// The element-wise operations and the report work on blocks of this many rows
+// of a channel. Images with fewer values than kMinParallelImageValues are
+// processed on the calling thread, since their blocks are too small to be
+// worth distributing.
+constexpr int kRowsPerChannelBlock = 64;
+constexpr int64_t kMinParallelImageValues = 1 << 16;
+
+// The number of threads of the whole-image operations. See
+// ImageData::SetNumThreads().
+std::atomic<int> image_num_threads(1);
+
+// Returns the number of row blocks of the channel.
+int GetNumChannelBlocks(const cv::Mat& channel_image) {
+  return (channel_image.rows + kRowsPerChannelBlock - 1) /
+      kRowsPerChannelBlock;
+}
+
+// Runs function(channel, start_row, end_row) over the row blocks of every
+// channel, in parallel for large images. Each block is run by exactly one
+// task, so the function may write to its rows and to a per-block output.
+void ForEachChannelBlock(
+    const std::vector<cv::Mat>& channels,
+    const std::function<void(const int, const int, const int)>& function) {
+
+  // The task index of the first block of every channel, and the total.
+  std::vector<int> first_tasks;
+  int num_tasks = 0;
+  int64_t num_values = 0;
+  for (const cv::Mat& channel_image : channels) {
+    first_tasks.push_back(num_tasks);
+    num_tasks += GetNumChannelBlocks(channel_image);
+    num_values += channel_image.total();
+  }
+  const auto run_task = [&](const int task_index) {
+    const int channel = std::upper_bound(
+        first_tasks.begin(), first_tasks.end(), task_index) -
+        first_tasks.begin() - 1;
+    const int start_row =
+        (task_index - first_tasks[channel]) * kRowsPerChannelBlock;
+    const int end_row = std::min(
+        start_row + kRowsPerChannelBlock, channels[channel].rows);
+    function(channel, start_row, end_row);
+  };
+  if (num_values < kMinParallelImageValues) {
+    for (int task_index = 0; task_index < num_tasks; ++task_index) {
+      run_task(task_index);
+    }
+    return;
+  }
+  util::RunParallelFor(ImageData::GetNumThreads(), num_tasks, run_task);
+}
+
+// Returns true if the channels have the same number, sizes and types as the
+// other channels.
+bool HaveSameLayout(
+    const std::vector<cv::Mat>& channels,
+    const std::vector<cv::Mat>& other_channels) {
+
+  if (channels.size() != other_channels.size()) {
+    return false;
+  }
+  for (int i = 0; i < channels.size(); ++i) {
+    if (channels[i].size() != other_channels[i].size() ||
+        channels[i].type() != other_channels[i].type()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Writes the weighted sum of the given rows of the channel of every term into
+// the same rows of the sum channel. Each sum value is computed from all terms
+// at once, so the sum channel may also be the channel of one of the terms.
+template <typename PixelType>
+void SumWeightedChannelRows(
+    const std::vector<std::vector<cv::Mat>>& term_channels,
+    const std::vector<double>& weights,
+    const int channel,
+    const int start_row,
+    const int end_row,
+    cv::Mat* sum_channel) {
+
+  const int num_terms = term_channels.size();
+  const int width = sum_channel->cols;
+  std::vector<const PixelType*> term_rows(num_terms);
+  for (int row = start_row; row < end_row; ++row) {
+    for (int term = 0; term < num_terms; ++term) {
+      term_rows[term] = term_channels[term][channel].ptr<PixelType>(row);
+    }
+    PixelType* sum_row = sum_channel->ptr<PixelType>(row);
+    for (int col = 0; col < width; ++col) {
+      double value = 0.0;
+      for (int term = 0; term < num_terms; ++term) {
+        value += weights[term] * term_rows[term][col];
+      }
+      sum_row[col] = static_cast<PixelType>(value);
+    }
+  }
+}
+
+// Adds the values of the given rows of a channel to the summary.
+void SummarizeChannelRows(
+    const cv::Mat& channel_image,
+    const int start_row,
+    const int end_row,
+    util::ValueSummary* summary) {
+
+  for (int row = start_row; row < end_row; ++row) {
+    if (channel_image.depth() == CV_32F) {
+      util::SummarizeValues(
+          channel_image.cols, channel_image.ptr<float>(row), summary);
     } else {
-      (*channels)[i].convertTo((*channels)[i], util::kOpenCvMatrixType);
+      util::SummarizeValues(
+          channel_image.cols, channel_image.ptr<double>(row), summary);
     }
   }
 }
 
-// Resize each of the given image channels using additive interpolation (see
-// the description of INTERPOLATE_ADDITIVE in image_data.h). If upsample is
-// true, the scale will be used as an upsampling scale, otherwise it will be
-// the downsampling scale. The new image size will be returned.
-cv::Size ResizeAdditiveInterpolation(
-    const cv::Size& new_size, std::vector<cv::Mat>* channels) {
+// The pixel loops of ResizeAdditiveInterpolation() for either precision. The
+// resized image must already have the new size, and every one of its pixels
+// is overwritten, so it does not need to be initialized.
+//
+// If upsample is true, each pixel is copied to the top-left pixel of its
+// patch in the resized image and the rest of the patch is set to zero.
+// Otherwise, each pixel of the resized image is the sum of its patch in the
+// original image. The loops run over rows with strided pointers so that the
+// inner loops can be vectorized.
+//
+// If kScale is not 0, it replaces both given scales so that the strides and
+// patch loops are constant and can be unrolled.
+template <typename PixelType, int kScale>
+void ResizeChannelAdditiveInterpolation(
+    const cv::Mat& channel_image,
+    const bool upsample,
+    const int runtime_y_scale,
+    const int runtime_x_scale,
+    cv::Mat* resized_image) {
+
+  const int y_scale = (kScale > 0) ? kScale : runtime_y_scale;
+  const int x_scale = (kScale > 0) ? kScale : runtime_x_scale;
+  const int resized_width = resized_image->cols;
+  if (upsample) {
+    const int original_width = std::min(
+        channel_image.cols, (resized_width + x_scale - 1) / x_scale);
+    for (int row = 0; row < resized_image->rows; ++row) {
+      PixelType* resized_row = resized_image->ptr<PixelType>(row);
+      std::fill(resized_row, resized_row + resized_width, PixelType(0));
+      if (row % y_scale != 0 || row / y_scale >= channel_image.rows) {
+        continue;
+      }
+      const PixelType* original_row =
+          channel_image.ptr<PixelType>(row / y_scale);
+      for (int col = 0; col < original_width; ++col) {
+        resized_row[col * x_scale] = original_row[col];
+      }
+    }
+    return;
+  }
 
-  const int num_image_channels = channels->size();
+  // Only whole patches that fit into both images are summed.
+  const int num_patch_rows =
+      std::min(resized_image->rows, channel_image.rows / y_scale);
+  const int num_patch_cols =
+      std::min(resized_width, channel_image.cols / x_scale);
+  for (int row = 0; row < resized_image->rows; ++row) {
+    PixelType* resized_row = resized_image->ptr<PixelType>(row);
+    std::fill(resized_row, resized_row + resized_width, PixelType(0));
+    if (row >= num_patch_rows) {
+      continue;
+    }
+    for (int patch_row = 0; patch_row < y_scale; ++patch_row) {
+      const PixelType* original_row =
+          channel_image.ptr<PixelType>(row * y_scale + patch_row);
+      for (int col = 0; col < num_patch_cols; ++col) {
+        const PixelType* patch = original_row + col * x_scale;
+        PixelType patch_sum = 0;
+        for (int patch_col = 0; patch_col < x_scale; ++patch_col) {
+          patch_sum += patch[patch_col];
+        }
+        resized_row[col] += patch_sum;
+      }
+    }
+  }
+}
+
+// Dispatches ResizeChannelAdditiveInterpolation() to the version specialized
+// for the scale. The scales 2, 3 and 4 (equal in both directions) have their
+// own instantiations, and every other scale uses the generic version.
+template <typename PixelType>
+void ResizeChannelAdditiveInterpolation(
+    const cv::Mat& channel_image,
+    const bool upsample,
+    const int y_scale,
+    const int x_scale,
+    cv::Mat* resized_image) {
+
+  const int scale = (y_scale == x_scale) ? x_scale : 0;
+  switch (scale) {
+    case 2:
+      ResizeChannelAdditiveInterpolation<PixelType, 2>(
+          channel_image, upsample, y_scale, x_scale, resized_image);
+      break;
+    case 3:
+      ResizeChannelAdditiveInterpolation<PixelType, 3>(
+          channel_image, upsample, y_scale, x_scale, resized_image);
+      break;
+    case 4:
+      ResizeChannelAdditiveInterpolation<PixelType, 4>(
+          channel_image, upsample, y_scale, x_scale, resized_image);
+      break;
+    default:
+      ResizeChannelAdditiveInterpolation<PixelType, 0>(
+          channel_image, upsample, y_scale, x_scale, resized_image);
+      break;
+  }
+}
+
+// Resizes each of the given image channels into resized_channels using
+// additive interpolation (see the description of INTERPOLATE_ADDITIVE in
+// image_data.h). If the new size is at least the size of the channels, the
+// scale will be used as an upsampling scale, otherwise it will be the
+// downsampling scale.
+//
+// If resized_channels already holds a channel of the new size and type for
+// every channel (e.g. from a previous call), they are overwritten in place,
+// so a destination can be reused without allocating. Otherwise, the resized
+// channels are written directly into a single planar allocation (see
+// GetPlanarChannelViews()), so the resized image stays contiguous. Either
+// way, the channels are not cleared before they are written. The resized
+// channels must not share data with the given channels.
+void ResizeAdditiveInterpolation(
+    const std::vector<cv::Mat>& channels,
+    const cv::Size& new_size,
+    std::vector<cv::Mat>* resized_channels) {
+
+  CHECK_NOTNULL(resized_channels);
+  const int num_image_channels = channels.size();
   CHECK_GT(num_image_channels, 0)
       << "Cannot upsample an image with no channels.";
 
-  const cv::Size original_size = channels->at(0).size();
+  const cv::Size original_size = channels.at(0).size();
   const bool upsample =
       original_size.width <= new_size.width &&
       original_size.height <= new_size.height;
@@ -94,45 +420,138 @@ cv::Size ResizeAdditiveInterpolation(
   CHECK(upsample || downsample)
       << "Axis-independent up/downsampling is not supported.";
 
-  // TODO: do the more efficient implementation? Also clean up, it's messy
-  // repetitive code.
-  if (upsample) {
-    const int y_scale = new_size.height / original_size.height;
-    const int x_scale = new_size.width / original_size.width;
-    for (int i = 0; i < num_image_channels; ++i) {
-      const cv::Mat channel_image = channels->at(i);
-      cv::Mat resized_image = cv::Mat::zeros(new_size, channel_image.type());
-      for (int row = 0; row < original_size.height; ++row) {
-        for (int col = 0; col < original_size.width; ++col) {
-          const int new_row = row * y_scale;
-          const int new_col = col * x_scale;
-          resized_image.at<double>(new_row, new_col) =
-              channel_image.at<double>(row, col);
-        }
+  const int y_scale = upsample ?
+      (new_size.height / original_size.height) :
+      (original_size.height / new_size.height);
+  const int x_scale = upsample ?
+      (new_size.width / original_size.width) :
+      (original_size.width / new_size.width);
+
+  bool can_reuse_channels = resized_channels->size() == num_image_channels;
+  for (int i = 0; can_reuse_channels && i < num_image_channels; ++i) {
+    const cv::Mat& resized_channel = (*resized_channels)[i];
+    can_reuse_channels = resized_channel.size() == new_size &&
+        resized_channel.type() == channels[i].type();
+  }
+  if (!can_reuse_channels) {
+    // Hidden color channels of luminance-only images may not match the first
+    // channel, in which case each channel gets its own allocation instead.
+    const int matrix_type = channels.at(0).type();
+    bool channels_match = true;
+    for (const cv::Mat& channel_image : channels) {
+      channels_match = channels_match &&
+          channel_image.size() == original_size &&
+          channel_image.type() == matrix_type;
+    }
+    resized_channels->clear();
+    if (channels_match) {
+      const cv::Mat plane(
+          new_size.height * num_image_channels, new_size.width, matrix_type);
+      *resized_channels = GetPlanarChannelViews(plane, num_image_channels);
+    } else {
+      for (const cv::Mat& channel_image : channels) {
+        resized_channels->push_back(cv::Mat(new_size, channel_image.type()));
       }
-      (*channels)[i] = resized_image;
     }
-    return new_size;
-  } else {
-    const int y_scale = original_size.height / new_size.height;
-    const int x_scale = original_size.width / new_size.width;
-    for (int i = 0; i < num_image_channels; ++i) {
-      const cv::Mat channel_image = channels->at(i);
-      cv::Mat resized_image = cv::Mat::zeros(new_size, channel_image.type());
-      for (int row = 0; row < original_size.height; ++row) {
-        for (int col = 0; col < original_size.width; ++col) {
-          const int new_row = row / y_scale;
-          const int new_col = col / x_scale;
-          resized_image.at<double>(new_row, new_col) +=
-              channel_image.at<double>(row, col);
+  }
+  for (int i = 0; i < num_image_channels; ++i) {
+    cv::Mat* resized_channel = &(*resized_channels)[i];
+    if (resized_channel->type() == util::kOpenCvSinglePrecisionMatrixType) {
+      ResizeChannelAdditiveInterpolation<float>(
+          channels[i], upsample, y_scale, x_scale, resized_channel);
+    } else {
+      ResizeChannelAdditiveInterpolation<double>(
+          channels[i], upsample, y_scale, x_scale, resized_channel);
+    }
+  }
+}
+
+// The coefficients of OpenCV's floating point BGR <=> YCrCb conversion, in
+// which the chroma channels are centered at 0.5.
+constexpr double kLuminanceWeightB = 0.114;
+constexpr double kLuminanceWeightG = 0.587;
+constexpr double kLuminanceWeightR = 0.299;
+constexpr double kChromaScaleCr = 0.713;
+constexpr double kChromaScaleCb = 0.564;
+constexpr double kChromaOffset = 0.5;
+constexpr double kCrToR = 1.403;
+constexpr double kCrToG = -0.714;
+constexpr double kCbToG = -0.344;
+constexpr double kCbToB = 1.773;
+
+// The pixel loop of ConvertColorChannels() for either precision. The three
+// output channels are computed from the input pixel before any of them is
+// written, so the outputs may be the input channels.
+template <typename PixelType>
+void ConvertColorRows(
+    const std::vector<cv::Mat>& input_channels,
+    const bool to_ycrcb,
+    const std::vector<cv::Mat*>& output_channels,
+    const int start_row,
+    const int end_row) {
+
+  const int num_cols = input_channels[0].cols;
+  for (int row = start_row; row < end_row; ++row) {
+    const PixelType* input_row_0 = input_channels[0].ptr<PixelType>(row);
+    const PixelType* input_row_1 = input_channels[1].ptr<PixelType>(row);
+    const PixelType* input_row_2 = input_channels[2].ptr<PixelType>(row);
+    PixelType* output_rows[3];
+    for (int channel = 0; channel < 3; ++channel) {
+      output_rows[channel] = (output_channels[channel] != nullptr) ?
+          output_channels[channel]->ptr<PixelType>(row) : nullptr;
+    }
+    for (int col = 0; col < num_cols; ++col) {
+      double output_values[3];
+      if (to_ycrcb) {
+        const double blue = input_row_0[col];
+        const double red = input_row_2[col];
+        const double luminance = kLuminanceWeightB * blue +
+            kLuminanceWeightG * input_row_1[col] + kLuminanceWeightR * red;
+        output_values[0] = luminance;
+        output_values[1] = (red - luminance) * kChromaScaleCr + kChromaOffset;
+        output_values[2] = (blue - luminance) * kChromaScaleCb + kChromaOffset;
+      } else {
+        const double luminance = input_row_0[col];
+        const double cr = input_row_1[col] - kChromaOffset;
+        const double cb = input_row_2[col] - kChromaOffset;
+        output_values[0] = luminance + kCbToB * cb;
+        output_values[1] = luminance + kCrToG * cr + kCbToG * cb;
+        output_values[2] = luminance + kCrToR * cr;
+      }
+      for (int channel = 0; channel < 3; ++channel) {
+        if (output_rows[channel] != nullptr) {
+          output_rows[channel][col] = output_values[channel];
         }
       }
-      (*channels)[i] = resized_image;
     }
-    return new_size;
   }
 }
 
+// Converts three color channels from BGR to YCrCb (or back if to_ycrcb is
+// false) in a single pass over the pixels, in parallel over blocks of rows.
+// This replaces merging the channels, converting them to single precision for
+// cv::cvtColor() and back, and splitting them again. Each output channel must
+// already have the size and type of the inputs, and outputs that are null are
+// not computed (e.g. only the luminance of a luminance-only image).
+void ConvertColorChannels(
+    const std::vector<cv::Mat>& input_channels,
+    const bool to_ycrcb,
+    const std::vector<cv::Mat*>& output_channels) {
+
+  CHECK_EQ(input_channels.size(), 3) << "Invalid number of input channels.";
+  CHECK_EQ(output_channels.size(), 3) << "Invalid number of output channels.";
+  ForEachChannelBlock({input_channels[0]}, [&](
+      const int channel, const int start_row, const int end_row) {
+    if (input_channels[0].depth() == CV_32F) {
+      ConvertColorRows<float>(
+          input_channels, to_ycrcb, output_channels, start_row, end_row);
+    } else {
+      ConvertColorRows<double>(
+          input_channels, to_ycrcb, output_channels, start_row, end_row);
+    }
+  });
+}
+
 // Given two vectors, each with exactly 3 cv::Mat channels, interpolates the
 // color components (channel 2 and 3) of the input into the output channels.
 // The size of the channels will be made to match the size of the first (and
@@ -148,8 +567,11 @@ void InterpolateColor(
   CHECK_EQ(input_channels.size(), 3) << "Invalid number of input channels.";
   CHECK_EQ(output_channels->size(), 3) << "Invalid number of output channels.";
 
+  // The two color channels are interpolated in parallel.
   const cv::Size target_size = output_channels->at(0).size();
-  for (int i = 1; i < 3; ++i) {
+  util::RunParallelFor(ImageData::GetNumThreads(), 2, [&](
+      const int task_index) {
+    const int i = task_index + 1;
     cv::Mat color_channel;
     // Only resize if the sizes are different.
     if (input_channels[i].size() != target_size) {
@@ -164,14 +586,15 @@ void InterpolateColor(
       color_channel = input_channels[i].clone();
     }
     (*output_channels)[i] = color_channel;
-  }
+  });
 }
 
 }  // namespace
 
 // ImageDataReport Print() method.
 void ImageDataReport::Print() const {
-  const int num_pixels = image_size.width * image_size.height * num_channels;
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size.width) * image_size.height * num_channels;
   const double percent_negative =
       (static_cast<double>(num_negative_pixels) /
       static_cast<double>(num_pixels)) * 100.0;
@@ -207,11 +630,64 @@ ImageData::ImageData() {
 ImageData::ImageData(const ImageData& other)
     : spectral_mode_(other.spectral_mode_),
       luminance_channel_only_(other.luminance_channel_only_),
-      image_size_(other.image_size_) {
+      image_size_(other.image_size_),
+      hidden_chroma_channels_(other.hidden_chroma_channels_),
+      precision_(other.precision_) {
 
-  for (const cv::Mat& channel_image : other.channels_) {
-    channels_.push_back(channel_image.clone());
+  channels_ = CopyToPlanarStorage(other.channels_);
+}
+
+// Move constructor.
+ImageData::ImageData(ImageData&& other) noexcept
+    : spectral_mode_(other.spectral_mode_),
+      luminance_channel_only_(other.luminance_channel_only_),
+      image_size_(other.image_size_),
+      channels_(std::move(other.channels_)),
+      hidden_chroma_channels_(std::move(other.hidden_chroma_channels_)),
+      precision_(other.precision_) {
+
+  other.channels_.clear();
+  other.hidden_chroma_channels_.clear();
+  other.image_size_ = cv::Size(0, 0);
+}
+
+ImageData& ImageData::operator = (const ImageData& other) {
+  if (this != &other) {
+    *this = ImageData(other);
+  }
+  return *this;
+}
+
+ImageData& ImageData::operator = (ImageData&& other) noexcept {
+  if (this != &other) {
+    spectral_mode_ = other.spectral_mode_;
+    luminance_channel_only_ = other.luminance_channel_only_;
+    image_size_ = other.image_size_;
+    channels_ = std::move(other.channels_);
+    hidden_chroma_channels_ = std::move(other.hidden_chroma_channels_);
+    precision_ = other.precision_;
+    other.channels_.clear();
+    other.hidden_chroma_channels_.clear();
+    other.image_size_ = cv::Size(0, 0);
   }
+  return *this;
+}
+
+ImageData::ImageData(
+    const cv::Size& size,
+    const int num_channels,
+    const ImagePrecision precision)
+    : spectral_mode_(GetDefaultSpectralMode(num_channels)),
+      luminance_channel_only_(false),
+      image_size_(size),
+      precision_(precision) {
+
+  CHECK_GE(num_channels, 1) << "The image must have at least one channel.";
+  CHECK_GE(GetNumPixels(), 1) << "Number of pixels must be positive.";
+
+  const cv::Mat plane = cv::Mat::zeros(
+      size.height * num_channels, size.width, GetOpenCvMatrixType(precision));
+  channels_ = GetPlanarChannelViews(plane, num_channels);
 }
 
 // Constructor from OpenCV image.
@@ -242,31 +718,93 @@ ImageData::ImageData(
 }
 
 ImageData::ImageData(
-    const double* pixel_values, const cv::Size& size, const int num_channels) {
+    const double* pixel_values,
+    const cv::Size& size,
+    const int num_channels,
+    const ImagePrecision precision) : precision_(precision) {
 
   CHECK_NOTNULL(pixel_values);
   CHECK_GE(num_channels, 1) << "The image must have at least one channel.";
 
   // Set image size and make sure the number of pixels is accurate.
   image_size_ = size;
-  const int num_pixels = GetNumPixels();
+  const int64_t num_pixels = GetNumPixels();
   CHECK_GE(num_pixels, 1) << "Number of pixels must be positive.";
 
-  // Add each channel to the ImageData.
-  for (int channel_index = 0; channel_index < num_channels; ++channel_index) {
-    const double* channel_pixels = &pixel_values[channel_index * num_pixels];
-    const cv::Mat channel_image(
-        size,
-        util::kOpenCvMatrixType,
-        const_cast<void*>(reinterpret_cast<const void*>(channel_pixels)));
-    channels_.push_back(channel_image.clone());  // copy data
-  }
+  // Copy all channels at once into a single plane, converting them to single
+  // precision if needed.
+  const cv::Mat pixel_plane(
+      size.height * num_channels,
+      size.width,
+      util::kOpenCvMatrixType,
+      const_cast<void*>(reinterpret_cast<const void*>(pixel_values)));
+  cv::Mat plane;
+  pixel_plane.convertTo(plane, GetOpenCvMatrixType(precision_));
+  channels_ = GetPlanarChannelViews(plane, num_channels);
   spectral_mode_ = GetDefaultSpectralMode(channels_.size());
 }
 
+ImageData::ImageData(
+    double* pixel_values,
+    const cv::Size& size,
+    const int num_channels,
+    const ImagePixelDataMode pixel_data_mode)
+    : spectral_mode_(GetDefaultSpectralMode(num_channels)),
+      luminance_channel_only_(false),
+      image_size_(size) {
+
+  CHECK_NOTNULL(pixel_values);
+  CHECK_GE(num_channels, 1) << "The image must have at least one channel.";
+  CHECK_GE(GetNumPixels(), 1) << "Number of pixels must be positive.";
+
+  const cv::Mat pixel_plane(
+      size.height * num_channels,
+      size.width,
+      util::kOpenCvMatrixType,
+      pixel_values);
+  if (pixel_data_mode == WRAP_PIXEL_DATA) {
+    channels_ = GetPlanarChannelViews(pixel_plane, num_channels);
+  } else {
+    channels_ = GetPlanarChannelViews(pixel_plane.clone(), num_channels);
+  }
+}
+
+ImageData::ImageData(
+    const double* pixel_values,
+    const cv::Size& size,
+    const int num_channels,
+    const ImagePixelDataMode pixel_data_mode)
+    : ImageData(
+          const_cast<double*>(pixel_values),
+          size,
+          num_channels,
+          pixel_data_mode) {}
+
+ImageData::ImageData(
+    const std::vector<cv::Mat>& channel_images,
+    const ImagePrecision precision)
+    : spectral_mode_(GetDefaultSpectralMode(channel_images.size())),
+      luminance_channel_only_(false),
+      channels_(channel_images),
+      precision_(precision) {
+
+  CHECK(!channels_.empty()) << "The image must have at least one channel.";
+  image_size_ = channels_[0].size();
+  CHECK_GE(GetNumPixels(), 1) << "Number of pixels must be positive.";
+  const int matrix_type = GetOpenCvMatrixType(precision_);
+  for (const cv::Mat& channel_image : channels_) {
+    CHECK(channel_image.size() == image_size_)
+        << "All channels must have the same size.";
+    CHECK_EQ(channel_image.type(), matrix_type)
+        << "The channels do not match the image precision.";
+  }
+}
+
 void ImageData::AddChannel(
     const cv::Mat& channel_image, const ImageNormalizeMode normalize_mode) {
 
+  MaterializeHiddenChannels();
+
   // Set or check size for consistency.
   if (channels_.empty()) {
     image_size_ = channel_image.size();
@@ -280,14 +818,14 @@ void ImageData::AddChannel(
 
   cv::Mat converted_image = channel_image.clone();
   // Scale pixels between 0 and 1 if they are in the 0-255 range instead. Always
-  // convert to the standard Matrix type in any case.
+  // convert to the Matrix type of this image's precision in any case.
+  const int matrix_type = GetOpenCvMatrixType(precision_);
   double min_pixel_value, max_pixel_value;
   cv::minMaxLoc(channel_image, &min_pixel_value, &max_pixel_value);
   if ((normalize_mode == NORMALIZE_IMAGE) && (max_pixel_value > 1.0)) {
-    converted_image.convertTo(
-        converted_image, util::kOpenCvMatrixType, 1.0 / 255.0);
-  } else if (converted_image.type() != util::kOpenCvMatrixType) {
-    converted_image.convertTo(converted_image, util::kOpenCvMatrixType);
+    converted_image.convertTo(converted_image, matrix_type, 1.0 / 255.0);
+  } else if (converted_image.type() != matrix_type) {
+    converted_image.convertTo(converted_image, matrix_type);
   }
   channels_.push_back(converted_image);
 
@@ -319,8 +857,14 @@ void ImageData::ResizeImage(
   int opencv_interpolation_method = 0;
   switch (interpolation_method) {
     case INTERPOLATE_ADDITIVE:
-      // Custom implementation (not in OpenCV).
-      image_size_ = ResizeAdditiveInterpolation(new_size, &channels_);
+      // Custom implementation (not in OpenCV), which resizes all channels.
+      MaterializeHiddenChannels();
+      {
+        std::vector<cv::Mat> resized_channels;
+        ResizeAdditiveInterpolation(channels_, new_size, &resized_channels);
+        channels_ = std::move(resized_channels);
+      }
+      image_size_ = new_size;
       return;
       break;
     case INTERPOLATE_LINEAR:
@@ -350,6 +894,25 @@ void ImageData::ResizeImage(
   image_size_ = new_size;
 }
 
+void ImageData::ResizeImageAdditive(
+    const cv::Size& new_size, ImageData* resized_image) const {
+
+  CHECK_NOTNULL(resized_image);
+  CHECK(resized_image != this)
+      << "Use ResizeImage() to resize an image in place.";
+  CHECK(!channels_.empty()) << "Cannot resize an empty image.";
+  CHECK_GT(new_size.width, 0) << "Images must have a positive width.";
+  CHECK_GT(new_size.height, 0) << "Images must have a positive height.";
+
+  ResizeAdditiveInterpolation(
+      GetAllChannels(), new_size, &resized_image->channels_);
+  resized_image->spectral_mode_ = spectral_mode_;
+  resized_image->luminance_channel_only_ = luminance_channel_only_;
+  resized_image->image_size_ = new_size;
+  resized_image->hidden_chroma_channels_.clear();
+  resized_image->precision_ = precision_;
+}
+
 void ImageData::ResizeImage(
     const double scale_factor,
     const ResizeInterpolationMethod interpolation_method) {
@@ -381,17 +944,16 @@ void ImageData::ChangeColorSpace(
     return;
   }
 
-  // Set the OpenCV conversion mode value.
-  int opencv_color_conversion_mode = 0;
+  bool to_ycrcb = false;
   if (spectral_mode_ == SPECTRAL_MODE_COLOR_BGR &&
       new_color_mode == SPECTRAL_MODE_COLOR_YCRCB) {
     // BGR => YCrCb.
-    opencv_color_conversion_mode = CV_BGR2YCrCb;
+    to_ycrcb = true;
     luminance_channel_only_ = luminance_only;
   } else if (spectral_mode_ == SPECTRAL_MODE_COLOR_YCRCB &&
              new_color_mode == SPECTRAL_MODE_COLOR_BGR) {
     // YCrCb => BGR.
-    opencv_color_conversion_mode = CV_YCrCb2BGR;
+    to_ycrcb = false;
   } else {
     LOG(WARNING)
         << "Unsupported color mode: " << new_color_mode << ". "
@@ -399,27 +961,45 @@ void ImageData::ChangeColorSpace(
     return;
   }
 
+  CHECK_EQ(GetNumStoredChannels(), 3)
+      << "Only 3-channel images can be converted to a different color space.";
+  if (to_ycrcb && luminance_only) {
+    // The hidden chroma channels are computed in the same pass as the
+    // luminance, and the original channels are released.
+    const cv::Size size = channels_[0].size();
+    const int type = channels_[0].type();
+    cv::Mat luminance_channel(size, type);
+    hidden_chroma_channels_ = {cv::Mat(size, type), cv::Mat(size, type)};
+    ConvertColorChannels(
+        channels_,
+        true,
+        {&luminance_channel,
+         &hidden_chroma_channels_[0],
+         &hidden_chroma_channels_[1]});
+    channels_ = {luminance_channel};
+    spectral_mode_ = new_color_mode;
+    return;
+  }
+
   // If going to BGR and luminance_channels_only_ is enabled, interpolate color
   // channels first to the appropriate size.
-  if (new_color_mode == SPECTRAL_MODE_COLOR_BGR && luminance_channel_only_) {
-    InterpolateColor(channels_, &channels_);
-  }
-
-  // Perform the conversion. Conversion is only supported in CV_32F mode, so we
-  // need to convert to CV_32F and then back again.
-  // Merge the 3 channels into a single cv::Mat image.
-  cv::Mat converted_image;
-  cv::merge(channels_, converted_image);
-  // Convert to CV_32F format.
-  const int original_type = converted_image.type();
-  converted_image.convertTo(converted_image, CV_32F);
-  // Convert to new color space.
-  cv::cvtColor(converted_image, converted_image, opencv_color_conversion_mode);
-  // Convert back to original format (double precision).
-  converted_image.convertTo(converted_image, original_type);
-  // Split the image back into individual ImageData channels.
-  channels_.clear();
-  cv::split(converted_image, channels_);
+  if (!to_ycrcb && luminance_channel_only_) {
+    // The hidden channels are shared, but InterpolateColor() writes new ones.
+    const std::vector<cv::Mat> all_channels = GetAllChannels();
+    hidden_chroma_channels_.clear();
+    channels_.resize(3);
+    InterpolateColor(all_channels, &channels_);
+  }
+
+  // The channels may be shared with the Mats that the image was built from,
+  // so the converted channels are written into new planar storage.
+  std::vector<cv::Mat> converted_channels =
+      AllocatePlanarStorageLike(channels_);
+  ConvertColorChannels(
+      channels_,
+      to_ycrcb,
+      {&converted_channels[0], &converted_channels[1], &converted_channels[2]});
+  channels_ = converted_channels;
 
   spectral_mode_ = new_color_mode;
 }
@@ -453,38 +1033,151 @@ void ImageData::SetSpectralMode(const ImageSpectralMode& spectral_mode) {
 void ImageData::InterpolateColorFrom(const ImageData& color_image) {
   CHECK_EQ(GetNumChannels(), 1)  // If other 2 channels are hidden, ignore them.
       << "Color can only be interpolated for single-channel images.";
-  CHECK_EQ(color_image.channels_.size(), 3)  // Consider hidden channels.
+  const std::vector<cv::Mat> color_channels = color_image.GetAllChannels();
+  CHECK_EQ(color_channels.size(), 3)  // Consider hidden channels.
       << "The given image must have color information for interpolation.";
 
+  // Only the hidden chroma channels of the color image are needed, and they
+  // are resized straight to the size of this image.
+  hidden_chroma_channels_.clear();
   channels_.resize(3);
-  InterpolateColor(color_image.channels_, &channels_);
+  InterpolateColor(color_channels, &channels_);
   spectral_mode_ = color_image.spectral_mode_;
   luminance_channel_only_ = false;
 }
 
 void ImageData::MultiplyByScalar(const double scalar) {
-  for (int i = 0; i < channels_.size(); ++i) {
-    channels_[i] *= scalar;
-  }
+  MaterializeHiddenChannels();
+  ForEachChannelBlock(channels_, [&](
+      const int channel, const int start_row, const int end_row) {
+    // The block already has the right size and type, so convertTo() scales
+    // the pixels in place.
+    cv::Mat block = channels_[channel].rowRange(start_row, end_row);
+    block.convertTo(block, -1, scalar);
+  });
 }
 
 ImageData ImageData::MultiplyByScalarCopy(const double scalar) const {
-  ImageData copy = *this;
-  copy.MultiplyByScalar(scalar);
-  return copy;
+  // The product is written straight into the new channels instead of copying
+  // this image first and scaling the copy.
+  ImageData product;
+  product.spectral_mode_ = spectral_mode_;
+  product.luminance_channel_only_ = luminance_channel_only_;
+  product.image_size_ = image_size_;
+  product.precision_ = precision_;
+  const std::vector<cv::Mat> channels = GetAllChannels();
+  product.channels_ = AllocatePlanarStorageLike(channels);
+  ForEachChannelBlock(channels, [&](
+      const int channel, const int start_row, const int end_row) {
+    cv::Mat product_block =
+        product.channels_[channel].rowRange(start_row, end_row);
+    channels[channel].rowRange(start_row, end_row).convertTo(
+        product_block, -1, scalar);
+  });
+  return product;
 }
 
 ImageData ImageData::AddImages(const ImageData& other) const {
-  CHECK_EQ(other.channels_.size(), channels_.size())
-      << "Images must have the same number of channels to be added.";
-  CHECK_EQ(other.GetImageSize(), GetImageSize())
-      << "Images of different sizes cannot be added together.";
+  CheckCanAdd(other);
+  // The sum is written straight into the new channels instead of copying this
+  // image first and adding to the copy.
+  ImageData sum;
+  sum.spectral_mode_ = spectral_mode_;
+  sum.luminance_channel_only_ = luminance_channel_only_;
+  sum.image_size_ = image_size_;
+  sum.precision_ = precision_;
+  const std::vector<cv::Mat> channels = GetAllChannels();
+  const std::vector<cv::Mat> other_channels = other.GetAllChannels();
+  sum.channels_ = AllocatePlanarStorageLike(channels);
+  ForEachChannelBlock(channels, [&](
+      const int channel, const int start_row, const int end_row) {
+    cv::Mat sum_block = sum.channels_[channel].rowRange(start_row, end_row);
+    cv::add(
+        channels[channel].rowRange(start_row, end_row),
+        other_channels[channel].rowRange(start_row, end_row),
+        sum_block);
+  });
+  return sum;
+}
+
+void ImageData::AddScaled(const ImageData& other, const double scale) {
+  CheckCanAdd(other);
+  MaterializeHiddenChannels();
+  const std::vector<cv::Mat> other_channels = other.GetAllChannels();
+  ForEachChannelBlock(channels_, [&](
+      const int channel, const int start_row, const int end_row) {
+    // The destination already has the right size and type, so scaleAdd()
+    // writes the result into the existing channel.
+    cv::Mat block = channels_[channel].rowRange(start_row, end_row);
+    cv::scaleAdd(
+        other_channels[channel].rowRange(start_row, end_row),
+        scale,
+        block,
+        block);
+  });
+}
 
-  ImageData sum = *this;
-  for (int i = 0; i < channels_.size(); ++i) {
-    sum.channels_[i] += other.channels_[i];
+void ImageData::AssignWeightedSum(
+    const ImageData* const* images,
+    const double* weights,
+    const int num_terms,
+    const bool accumulate) {
+
+  CHECK_GT(num_terms, 0) << "A weighted sum needs at least one image.";
+  const ImageData& first_image = *images[0];
+  for (int term = 1; term < num_terms; ++term) {
+    first_image.CheckCanAdd(*images[term]);
   }
-  return sum;
+
+  // The channels of every term, starting with this image if the sum is added
+  // to it. The hidden channels of this image are computed first, in case it
+  // is also one of the terms.
+  std::vector<std::vector<cv::Mat>> term_channels;
+  std::vector<double> term_weights;
+  if (accumulate) {
+    CheckCanAdd(first_image);
+    MaterializeHiddenChannels();
+    term_channels.push_back(channels_);
+    term_weights.push_back(1.0);
+  }
+  for (int term = 0; term < num_terms; ++term) {
+    term_channels.push_back(images[term]->GetAllChannels());
+    term_weights.push_back(weights[term]);
+  }
+
+  // The sum is written into the channels of this image if they have the
+  // right layout, and into a new planar allocation otherwise.
+  const std::vector<cv::Mat>& first_channels =
+      term_channels[accumulate ? 1 : 0];
+  std::vector<cv::Mat> sum_channels;
+  if (accumulate || (hidden_chroma_channels_.empty() &&
+                     HaveSameLayout(channels_, first_channels))) {
+    sum_channels = channels_;
+  } else {
+    sum_channels = AllocatePlanarStorageLike(first_channels);
+  }
+  ForEachChannelBlock(sum_channels, [&](
+      const int channel, const int start_row, const int end_row) {
+    cv::Mat& sum_channel = sum_channels[channel];
+    if (sum_channel.depth() == CV_32F) {
+      SumWeightedChannelRows<float>(
+          term_channels, term_weights, channel, start_row, end_row,
+          &sum_channel);
+    } else {
+      SumWeightedChannelRows<double>(
+          term_channels, term_weights, channel, start_row, end_row,
+          &sum_channel);
+    }
+  });
+  if (accumulate) {
+    return;
+  }
+  spectral_mode_ = first_image.spectral_mode_;
+  luminance_channel_only_ = first_image.luminance_channel_only_;
+  image_size_ = first_image.image_size_;
+  precision_ = first_image.precision_;
+  hidden_chroma_channels_.clear();
+  channels_ = sum_channels;
 }
 
 int ImageData::GetNumChannels() const {
@@ -494,8 +1187,9 @@ int ImageData::GetNumChannels() const {
   return channels_.size();
 }
 
-int ImageData::GetNumPixels() const {
-  return image_size_.width * image_size_.height;  // (0, 0) if image is empty.
+int64_t ImageData::GetNumPixels() const {
+  // The size is (0, 0) if the image is empty.
+  return static_cast<int64_t>(image_size_.width) * image_size_.height;
 }
 
 cv::Mat ImageData::GetChannelImage(const int index) const {
@@ -505,7 +1199,7 @@ cv::Mat ImageData::GetChannelImage(const int index) const {
 }
 
 double ImageData::GetPixelValue(
-    const int channel_index, const int pixel_index) const {
+    const int channel_index, const int64_t pixel_index) const {
 
   const cv::Point image_coordinates =
       GetPixelCoordinatesFromIndex(pixel_index);  // Checks pixel index range.
@@ -520,9 +1214,30 @@ double ImageData::GetPixelValue(
   CHECK(0 <= row && row < image_size_.height) << "Row index is out of bounds.";
   CHECK(0 <= col && col < image_size_.width) << "Col index is out of bounds.";
 
+  if (precision_ == SINGLE_PRECISION) {
+    return channels_[channel_index].at<float>(row, col);
+  }
   return channels_[channel_index].at<double>(row, col);
 }
 
+void ImageData::SetPrecision(const ImagePrecision precision) {
+  if (precision == precision_) {
+    return;
+  }
+  precision_ = precision;
+  const int matrix_type = GetOpenCvMatrixType(precision_);
+  for (cv::Mat& channel_image : channels_) {
+    channel_image.convertTo(channel_image, matrix_type);
+  }
+  // The hidden channels may be shared with copies of this image, so they are
+  // converted into new Mats.
+  for (cv::Mat& channel_image : hidden_chroma_channels_) {
+    cv::Mat converted_channel;
+    channel_image.convertTo(converted_channel, matrix_type);
+    channel_image = converted_channel;
+  }
+}
+
 const double* ImageData::GetChannelData(const int channel_index) const {
   return GetMutableChannelData(channel_index);
 }
@@ -530,12 +1245,120 @@ const double* ImageData::GetChannelData(const int channel_index) const {
 double* ImageData::GetMutableChannelData(const int channel_index) const {
   CHECK_GE(channel_index, 0) << "Channel index must be at least 0.";
   CHECK_LT(channel_index, GetNumChannels()) << "Channel index out of bounds.";
+  CHECK_EQ(precision_, DOUBLE_PRECISION)
+      << "Raw pixel data is only available for double precision images.";
 
   // TODO: verify that this is the correct approach of getting the data array.
   // static_cast doesn't work here because the data is apparently uchar*.
   return (double*)(channels_[channel_index].data);  // NOLINT
 }
 
+bool ImageData::IsContiguous() const {
+  if (channels_.empty()) {
+    return false;
+  }
+  const int matrix_type = channels_[0].type();
+  const size_t channel_num_bytes =
+      channels_[0].total() * channels_[0].elemSize();
+  const uchar* expected_channel_data = channels_[0].data;
+  for (const cv::Mat& channel_image : channels_) {
+    if (!channel_image.isContinuous() ||
+        channel_image.size() != channels_[0].size() ||
+        channel_image.type() != matrix_type ||
+        channel_image.data != expected_channel_data) {
+      return false;
+    }
+    expected_channel_data += channel_num_bytes;
+  }
+  return true;
+}
+
+void ImageData::MakeContiguous() {
+  if (!channels_.empty() && !IsContiguous()) {
+    channels_ = CopyToPlanarStorage(channels_);
+  }
+}
+
+const double* ImageData::GetContiguousData() const {
+  CHECK(IsContiguous()) << "The image channels are not stored contiguously.";
+  CHECK_EQ(precision_, DOUBLE_PRECISION)
+      << "Raw pixel data is only available for double precision images.";
+  return reinterpret_cast<const double*>(channels_[0].data);
+}
+
+cv::Mat ImageData::GetStructureImage(
+    const ImageStructureMode structure_mode) const {
+
+  const int num_channels = GetNumChannels();
+  CHECK_GT(num_channels, 0) << "Cannot get the structure of an empty image.";
+
+  // The principal component loading of every band, and the offset that
+  // centers the projection on the mean spectrum.
+  cv::Mat band_weights;
+  double projection_offset = 0.0;
+  if (structure_mode == STRUCTURE_IMAGE_FIRST_PRINCIPAL_COMPONENT) {
+    const int64_t num_pixels = GetNumPixels();
+    const int64_t pixel_step =
+        std::max<int64_t>(1, num_pixels / kNumStructurePCASamples);
+    const int num_samples = (num_pixels + pixel_step - 1) / pixel_step;
+    cv::Mat samples(num_samples, num_channels, util::kOpenCvMatrixType);
+    for (int channel = 0; channel < num_channels; ++channel) {
+      for (int sample = 0; sample < num_samples; ++sample) {
+        samples.at<double>(sample, channel) =
+            GetPixelValue(channel, sample * pixel_step);
+      }
+    }
+    const cv::PCA pca(samples, cv::Mat(), cv::PCA::DATA_AS_ROW, 1);
+    band_weights = pca.eigenvectors.row(0).clone();
+    if (cv::sum(band_weights)[0] < 0.0) {
+      band_weights *= -1.0;
+    }
+    projection_offset = -band_weights.dot(pca.mean);
+  }
+
+  cv::Mat structure_image;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    // Single precision channels are widened first; double precision channels
+    // are used as they are.
+    cv::Mat channel_image = channels_[channel];
+    if (channel_image.type() != util::kOpenCvMatrixType) {
+      channels_[channel].convertTo(channel_image, util::kOpenCvMatrixType);
+    }
+    if (channel == 0) {
+      if (structure_mode == STRUCTURE_IMAGE_FIRST_PRINCIPAL_COMPONENT) {
+        structure_image = channel_image * band_weights.at<double>(0);
+      } else {
+        structure_image = channel_image.clone();
+      }
+      continue;
+    }
+    switch (structure_mode) {
+      case STRUCTURE_IMAGE_MEAN:
+        structure_image += channel_image;
+        break;
+      case STRUCTURE_IMAGE_MAX:
+        cv::max(structure_image, channel_image, structure_image);
+        break;
+      case STRUCTURE_IMAGE_FIRST_PRINCIPAL_COMPONENT:
+        cv::scaleAdd(
+            channel_image,
+            band_weights.at<double>(channel),
+            structure_image,
+            structure_image);
+        break;
+      default:
+        LOG(FATAL) << "Unknown structure image mode.";
+    }
+  }
+
+  if (structure_mode == STRUCTURE_IMAGE_MEAN) {
+    structure_image /= num_channels;
+  } else if (structure_mode == STRUCTURE_IMAGE_FIRST_PRINCIPAL_COMPONENT) {
+    structure_image += cv::Scalar(projection_offset);
+  }
+  return structure_image;
+}
+
 cv::Mat ImageData::GetVisualizationImage() const {
   cv::Mat visualization_image;
   if (channels_.empty()) {
@@ -543,11 +1366,12 @@ cv::Mat ImageData::GetVisualizationImage() const {
     return visualization_image;
   }
 
-  const int num_channels = channels_.size();  // Consider all channels.
+  const std::vector<cv::Mat> channels = GetAllChannels();
+  const int num_channels = channels.size();  // Consider all channels.
   if (num_channels < 3) {
     // For a monochrome image (or if it has two channels for some reason), just
     // return the first (and likely only) channel.
-    visualization_image = channels_[0].clone();
+    visualization_image = channels[0].clone();
     util::ThresholdImage(visualization_image, 0.0, 1.0);
     visualization_image.convertTo(visualization_image, CV_8UC1, 255);
   } else {
@@ -563,7 +1387,7 @@ cv::Mat ImageData::GetVisualizationImage() const {
     // For 3 or more channels, return an RGB image of the first, middle, and
     // last channel. The middle channel is just the average index.
     std::vector<cv::Mat> bgr_channels = {
-      channels_[0], channels_[num_channels / 2], channels_[num_channels - 1]
+      channels[0], channels[num_channels / 2], channels[num_channels - 1]
     };
     cv::merge(bgr_channels, visualization_image);
     util::ThresholdImage(visualization_image, 0.0, 1.0);
@@ -573,19 +1397,57 @@ cv::Mat ImageData::GetVisualizationImage() const {
   return visualization_image;
 }
 
+void ImageData::SetNumThreads(const int num_threads) {
+  CHECK_GE(num_threads, 0) << "The number of threads cannot be negative.";
+  image_num_threads = num_threads;
+}
+
+int ImageData::GetNumThreads() {
+  return image_num_threads;
+}
+
 ImageDataReport ImageData::GetImageDataReport() const {
   ImageDataReport report;
   report.image_size = image_size_;
-  report.num_channels = channels_.size();
+  const std::vector<cv::Mat> channels = GetAllChannels();
+  report.num_channels = channels.size();
 
   // Initialize these to the opposite extreme values so they can be adjusted.
   report.smallest_pixel_value = 1.0;
   report.largest_pixel_value = 0.0;
 
-  for (int channel = 0; channel < channels_.size(); ++channel) {
-    const cv::Mat& channel_image = channels_[channel];
-    const int num_negative_pixels = cv::countNonZero(channel_image < 0.0);
-    const int num_over_one_pixels = cv::countNonZero(channel_image > 1.0);
+  // All statistics are gathered in a single pass over the pixels. Every block
+  // of rows is summarized separately, and the blocks are then combined in
+  // order, so the report does not depend on the number of threads.
+  std::vector<int> first_blocks;
+  int num_blocks = 0;
+  for (const cv::Mat& channel_image : channels) {
+    first_blocks.push_back(num_blocks);
+    num_blocks += GetNumChannelBlocks(channel_image);
+  }
+  std::vector<util::ValueSummary> block_summaries(num_blocks);
+  ForEachChannelBlock(channels, [&](
+      const int channel, const int start_row, const int end_row) {
+    const int block = first_blocks[channel] + start_row / kRowsPerChannelBlock;
+    SummarizeChannelRows(
+        channels[channel], start_row, end_row, &block_summaries[block]);
+  });
+
+  for (int channel = 0; channel < channels.size(); ++channel) {
+    util::ValueSummary channel_summary;
+    const int end_block = first_blocks[channel] +
+        GetNumChannelBlocks(channels[channel]);
+    for (int block = first_blocks[channel]; block < end_block; ++block) {
+      const util::ValueSummary& block_summary = block_summaries[block];
+      channel_summary.num_negative_values += block_summary.num_negative_values;
+      channel_summary.num_over_one_values += block_summary.num_over_one_values;
+      channel_summary.min_value =
+          std::min(channel_summary.min_value, block_summary.min_value);
+      channel_summary.max_value =
+          std::max(channel_summary.max_value, block_summary.max_value);
+    }
+    const int num_negative_pixels = channel_summary.num_negative_values;
+    const int num_over_one_pixels = channel_summary.num_over_one_values;
     if (num_negative_pixels > report.max_num_negative_pixels_in_one_channel) {
       report.channel_with_most_negative_pixels = channel;
       report.max_num_negative_pixels_in_one_channel = num_negative_pixels;
@@ -597,18 +1459,51 @@ ImageDataReport ImageData::GetImageDataReport() const {
     report.num_negative_pixels += num_negative_pixels;
     report.num_over_one_pixels += num_over_one_pixels;
 
-    double min_channel_value, max_channel_value;
-    cv::minMaxLoc(channel_image, &min_channel_value, &max_channel_value);
     report.smallest_pixel_value =
-        std::min(min_channel_value, report.smallest_pixel_value);
+        std::min(channel_summary.min_value, report.smallest_pixel_value);
     report.largest_pixel_value =
-        std::max(max_channel_value, report.largest_pixel_value);
+        std::max(channel_summary.max_value, report.largest_pixel_value);
   }
   return report;
 }
 
 // private
-cv::Point ImageData::GetPixelCoordinatesFromIndex(const int index) const {
+void ImageData::CheckCanAdd(const ImageData& other) const {
+  CHECK_EQ(other.GetNumStoredChannels(), GetNumStoredChannels())
+      << "Images must have the same number of channels to be added.";
+  CHECK_EQ(other.GetImageSize(), GetImageSize())
+      << "Images of different sizes cannot be added together.";
+  CHECK_EQ(other.GetPrecision(), GetPrecision())
+      << "Images of different precisions cannot be added together.";
+}
+
+// private
+int ImageData::GetNumStoredChannels() const {
+  return channels_.size() + hidden_chroma_channels_.size();
+}
+
+// private
+std::vector<cv::Mat> ImageData::GetAllChannels() const {
+  std::vector<cv::Mat> channels = channels_;
+  channels.insert(
+      channels.end(),
+      hidden_chroma_channels_.begin(),
+      hidden_chroma_channels_.end());
+  return channels;
+}
+
+// private
+void ImageData::MaterializeHiddenChannels() {
+  // The hidden channels may be shared with copies of this image, and are
+  // about to be modified, so they are copied.
+  for (const cv::Mat& channel_image : hidden_chroma_channels_) {
+    channels_.push_back(channel_image.clone());
+  }
+  hidden_chroma_channels_.clear();
+}
+
+// private
+cv::Point ImageData::GetPixelCoordinatesFromIndex(const int64_t index) const {
   CHECK_GE(index, 0) << "Pixel index must be at least 0.";
   CHECK_LT(index, GetNumPixels()) << "Pixel index was out of bounds.";
 
@@ -2,10 +2,17 @@
 // container splits the image into independent channels (bands) of the image,
 // each stored as an OpenCV Mat. This allows processing of hyperspectral images
 // as well as RGB or monochrome images without modifying the code.
+//
+// Copies of an image (and images built from a pixel array) store all of their
+// channels in a single planar [channel][row][col] allocation, where each
+// channel Mat is a view into that allocation. See IsContiguous().
 
 #ifndef SRC_IMAGE_IMAGE_DATA_H_
 #define SRC_IMAGE_IMAGE_DATA_H_
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <utility>
 #include <vector>
 
@@ -23,6 +30,23 @@ enum ImageNormalizeMode {
   DO_NOT_NORMALIZE_IMAGE
 };
 
+// Determines whether an ImageData built from a pixel array makes its own copy
+// of the pixels or uses the given array directly.
+enum ImagePixelDataMode {
+  COPY_PIXEL_DATA,
+  WRAP_PIXEL_DATA
+};
+
+// The floating point precision of the pixel values stored in an ImageData.
+// Double precision is the default and is required by the methods that expose
+// raw pixel arrays (e.g. GetChannelData()). Single precision halves the memory
+// and memory bandwidth used by the image, and is supported by the image model
+// operations since they work on the OpenCV channel images directly.
+enum ImagePrecision {
+  DOUBLE_PRECISION,
+  SINGLE_PRECISION
+};
+
 enum ResizeInterpolationMethod {
   // Standard interpolation modes:
   INTERPOLATE_LINEAR,  // Bilinear interpolation. Uses cv::INTER_LINEAR.
@@ -82,6 +106,20 @@ enum ImageSpectralMode {
   SPECTRAL_MODE_COLOR_YCRCB         // Luminance-dominant color.
 };
 
+// The ways of reducing all channels of an image to a single "structure" image
+// (see ImageData::GetStructureImage()), e.g. for registration. In
+// hyperspectral images, any single band (such as the first one) may be mostly
+// noise, while the structure image combines the information of every band.
+enum ImageStructureMode {
+  STRUCTURE_IMAGE_MEAN,  // Average of the channels at each pixel.
+  STRUCTURE_IMAGE_MAX,   // Largest channel value at each pixel.
+
+  // Projection of each pixel vector onto the first principal component of the
+  // spectra, which is the single image with the most variance. The sign is
+  // chosen so that the structure image grows with the overall intensity.
+  STRUCTURE_IMAGE_FIRST_PRINCIPAL_COMPONENT
+};
+
 // Contains information and statistics about an image. This can be useful for
 // evaluation, testing of new optimization methods, and debugging.
 struct ImageDataReport {
@@ -89,9 +127,9 @@ struct ImageDataReport {
   cv::Size image_size;
   int num_channels = 0;
 
-  // Number of invalid pixels.
-  int num_negative_pixels = 0;  // Negative pixels are not valid values.
-  int num_over_one_pixels = 0;  // Pixels that exceed maximum valid value (1.0).
+  // Number of invalid pixels, counted over all channels.
+  int64_t num_negative_pixels = 0;  // Negative pixels are not valid values.
+  int64_t num_over_one_pixels = 0;  // Pixels that exceed max valid value (1.0).
 
   // Negative and over-one pixels per channel.
   int channel_with_most_negative_pixels = 0;
@@ -106,6 +144,11 @@ struct ImageDataReport {
   void Print() const;
 };
 
+// A weighted sum of images that is only computed when it is assigned to an
+// image (see below).
+template <int NumTerms>
+class ImageExpression;
+
 class ImageData {
  public:
   // Default constructor to make an empty image.
@@ -115,6 +158,27 @@ class ImageData {
   // effectively smart pointers and are not copied by default.
   ImageData(const ImageData& other);
 
+  // Move constructor takes over the channels of the other image without
+  // copying any pixels. The other image is left empty. The moves do not
+  // throw, so containers of images move them instead of copying on growth.
+  ImageData(ImageData&& other) noexcept;
+
+  // Copy assignment clones the channels like the copy constructor, so the two
+  // images never share pixel data.
+  ImageData& operator = (const ImageData& other);
+
+  // Move assignment takes over the channels of the other image without
+  // copying any pixels. The other image is left empty.
+  ImageData& operator = (ImageData&& other) noexcept;
+
+  // Creates an image of the given size with num_channels channels of zeros,
+  // stored contiguously (see IsContiguous()). Useful for building output
+  // images that are written pixel by pixel without an extra copy.
+  ImageData(
+      const cv::Size& size,
+      const int num_channels,
+      const ImagePrecision precision = DOUBLE_PRECISION);
+
   // Pass in an OpenCV Mat to create an ImageData object out of that. If the
   // given image has multiple channels, they will all be added independently.
   // If the image is given in a non-normalized range (0-255 pixel values), it
@@ -138,11 +202,47 @@ class ImageData {
   // pixels must match the given size width * height at each image channel.
   //
   // This constructor does not adjust the given pixel values in any way, so no
-  // normalization happens.
+  // normalization happens. If the precision is SINGLE_PRECISION, the values
+  // are converted to single precision as they are copied.
+  ImageData(
+      const double* pixel_values,
+      const cv::Size& size,
+      const int num_channels = 1,
+      const ImagePrecision precision = DOUBLE_PRECISION);
+
+  // Same as ImageData(const double*, ...) in double precision, but with
+  // WRAP_PIXEL_DATA the channels are views into the given array instead of a
+  // copy, so no memory is allocated or copied. The array must contain
+  // num_channels planes of size width * height and must outlive this image.
+  // Modifying the image pixels in place (e.g. with GetMutableChannelData() or
+  // in-place OpenCV operations on the channel images) modifies the array.
+  // Operations that change the image size or add channels allocate new
+  // channels, which are no longer backed by the array.
+  ImageData(
+      double* pixel_values,
+      const cv::Size& size,
+      const int num_channels,
+      const ImagePixelDataMode pixel_data_mode);
+
+  // Same as above for read-only pixel arrays. With WRAP_PIXEL_DATA, the image
+  // is a borrowed view of the array and must not be modified: declare it
+  // const, and only pass it to operations that write their results into a
+  // separate image, such as ImageModel::ApplyToImage(const ImageData&, int,
+  // ImageData*).
   ImageData(
       const double* pixel_values,
       const cv::Size& size,
-      const int num_channels = 1);
+      const int num_channels,
+      const ImagePixelDataMode pixel_data_mode);
+
+  // Builds the image from the given single-channel matrices without copying
+  // them, so the channels share the pixels (and the reference counts) of the
+  // matrices. This wraps buffers managed by OpenCV, such as the memory-mapped
+  // channels of an image data file (see LoadImageDataFile()). All matrices
+  // must have the same size and the matrix type of the given precision.
+  ImageData(
+      const std::vector<cv::Mat>& channel_images,
+      const ImagePrecision precision);
 
   // Appends a channel (band) to the image. Each new channel will be added as
   // the last index. Channel images should be single-band OpenCV images. The
@@ -175,6 +275,15 @@ class ImageData {
       const ResizeInterpolationMethod interpolation_method
           = INTERPOLATE_NEAREST);
 
+  // Same as ResizeImage(new_size, INTERPOLATE_ADDITIVE), but writes the
+  // resized image into resized_image and leaves this image unchanged. If
+  // resized_image already has a channel of the new size and precision for
+  // every channel (e.g. from a previous call), its channels are overwritten
+  // without allocating new ones, so one destination can be reused across
+  // calls. The resized image must not share pixel data with this image.
+  void ResizeImageAdditive(
+      const cv::Size& new_size, ImageData* resized_image) const;
+
   // Resizes this image by the given scale factor, in the same manner as
   // ResizeImage(size). The new dimensions will be (width * scale_factor,
   // height * scale_factor). The given scale factor must be larger than 0.
@@ -190,11 +299,20 @@ class ImageData {
   // Set luminance_only = true to make this image only use the luminance
   // channel for super-resolution. This is only applicable to color spaces such
   // as YCrCb which have a luminance channel. If this is set, the image will be
-  // treated as a single-channel image for the purposes of the solver.
+  // treated as a single-channel image for the purposes of the solver. The
+  // hidden chroma channels are computed in the same pass as the luminance and
+  // replace the original channels, so the image keeps three planes, and its
+  // copies share the chroma planes (see InterpolateColorFrom() and converting
+  // back to BGR).
   void ChangeColorSpace(
       const ImageSpectralMode& new_color_mode,
       const bool luminance_only = false);
 
+  // Returns the spectral mode of the image.
+  ImageSpectralMode GetSpectralMode() const {
+    return spectral_mode_;
+  }
+
   // Allows manually setting the spectral mode. This method will log warnings
   // for potentially invalid settings.
   void SetSpectralMode(const ImageSpectralMode& spectral_mode);
@@ -228,22 +346,59 @@ class ImageData {
   // this image. All channels will be added, including hidden channels.
   ImageData AddImages(const ImageData& other) const;
 
-  // Returns an image multipled by the given scalar. E.g.:
-  //   ImageData image2 = image * 2.0;
-  ImageData operator * (const double scalar) const {
-    return MultiplyByScalarCopy(scalar);
+  // Adds the other image multiplied by the given scale to this image in place
+  // (this = this + scale * other), without allocating any new channels. The
+  // images must have the same size, number of channels and precision. All
+  // channels will be modified, including hidden channels.
+  void AddScaled(const ImageData& other, const double scale);
+
+  // In-place versions of the arithmetic operators below, which modify this
+  // image instead of returning a new one. E.g.:
+  //   image += other_image;  // Same as image.AddScaled(other_image, 1.0).
+  //   image *= 2.0;          // Same as image.MultiplyByScalar(2.0).
+  ImageData& operator += (const ImageData& other) {
+    AddScaled(other, 1.0);
+    return *this;
   }
-
-  // Returns an image divided by the given scalar. E.g.:
-  //   ImageData image2 = image / 255.0;
-  ImageData operator / (const double scalar) const {
-    return MultiplyByScalarCopy(1.0 / scalar);
+  ImageData& operator *= (const double scalar) {
+    MultiplyByScalar(scalar);
+    return *this;
   }
 
+  // The arithmetic operators below return an ImageExpression instead of an
+  // image. Expressions are combined without computing anything, and the whole
+  // expression is computed in a single pass over the pixels when it is
+  // assigned to an image, so no temporary images are made. E.g.:
+  //   ImageData image2 = image * 2.0;
+  //   ImageData image3 = image / 255.0;
+  //   blended_image = image * 0.5 + other_image * 0.5;
+  //   estimate += direction * step_size;
+  // The operands must have the same number of channels, sizes and precision.
+
+  // Returns an image multipled by the given scalar.
+  ImageExpression<1> operator * (const double scalar) const;
+
+  // Returns an image divided by the given scalar.
+  ImageExpression<1> operator / (const double scalar) const;
+
   // Returns the sum of this image and the other image.
-  ImageData operator + (const ImageData& other) const {
-    return AddImages(other);
-  }
+  ImageExpression<2> operator + (const ImageData& other) const;
+
+  // Returns the sum of this image and the expression.
+  template <int NumTerms>
+  ImageExpression<NumTerms + 1> operator + (
+      const ImageExpression<NumTerms>& expression) const;
+
+  // Computes the expression into this image. The channels of this image are
+  // reused if they have the right sizes, so assigning to an image of the same
+  // shape does not allocate. The image may itself be a term of the
+  // expression (e.g. image = image * 0.5 + other_image).
+  template <int NumTerms>
+  ImageData& operator = (const ImageExpression<NumTerms>& expression);
+
+  // Adds the expression to this image in place, in a single pass.
+  template <int NumTerms>
+  ImageData& operator += (const ImageExpression<NumTerms>& expression);
 
   // Returns the total number of channels (bands) in this image. Note that this
   // value may be 0.
@@ -262,7 +417,9 @@ class ImageData {
 
   // Returns the number of pixels in the image at each channel. Each channel
   // has the same number of pixels. If the image is empty, 0 will be returned.
-  int GetNumPixels() const;
+  // The count is 64-bit so that it can be multiplied by a channel index to get
+  // flattened indices into large multi-channel images without overflow.
+  int64_t GetNumPixels() const;
 
   // Returns the channel image (OpenCV Mat) at the given index. Error if index
   // is out of bounds. Use GetNumChannels() to get a valid range. Note that the
@@ -272,22 +429,61 @@ class ImageData {
   // Returns the pixel value at the given channel and pixel indices. This will
   // be just a single intensity value for that specific pixel. The given
   // channel and pixel indices must be valid.
-  double GetPixelValue(const int channel_index, const int pixel_index) const;
+  double GetPixelValue(
+      const int channel_index, const int64_t pixel_index) const;
 
   // Same as GetPixelValue(channel_index, pixel_index) but allows the user to
   // specify the row, col coordinates instead of a pre-computed pixel index.
   double GetPixelValue(
       const int channel_index, const int row, const int col) const;
 
+  // Converts all channels to the given precision. Channels that are added to
+  // the image after this are converted to the same precision.
+  void SetPrecision(const ImagePrecision precision);
+
+  // Returns the precision of the stored pixel values.
+  ImagePrecision GetPrecision() const {
+    return precision_;
+  }
+
   // Returns a data pointer for the pixel values at the given channel index.
   // The size of the array will be the number of pixels in this image (use
-  // GetNumPixels()).
+  // GetNumPixels()). The image must be stored in double precision; use
+  // GetChannelImage() to access single precision pixel values.
   const double* GetChannelData(const int channel_index) const;
 
   // Same as GetChannelData(), but allows the image to be modified by changing
   // the values of the returned array.
   double* GetMutableChannelData(const int channel_index) const;
 
+  // Returns true if all channels (including hidden channels) are stored in one
+  // planar allocation, one channel after the other, so that
+  // GetContiguousData() can be used. This is true for copies and for images
+  // built from pixel arrays, but may become false after resizing the image,
+  // adding channels, or changing its color space or precision.
+  bool IsContiguous() const;
+
+  // Moves the channels into a single planar allocation, if they are not
+  // already stored that way. OpenCV aligns the allocation, so the first channel
+  // is aligned for vector instructions. Channels of different sizes (e.g. the
+  // hidden channels of a resized luminance-only image) cannot be merged, and
+  // are left as independent allocations.
+  void MakeContiguous();
+
+  // Returns a data pointer to all pixel values in [channel][row][col] order,
+  // which is the layout used by the solvers. The image must be contiguous (see
+  // IsContiguous()) and stored in double precision.
+  const double* GetContiguousData() const;
+
+  // Returns a single-channel, double precision OpenCV Mat of the image size
+  // that combines all (visible) channels as given by the structure mode. Each
+  // band is visited once with whole-channel OpenCV operations.
+  // STRUCTURE_IMAGE_FIRST_PRINCIPAL_COMPONENT additionally fits the principal
+  // component on a bounded number of evenly spaced pixels. The image must not
+  // be empty.
+  cv::Mat GetStructureImage(
+      const ImageStructureMode structure_mode = STRUCTURE_IMAGE_MEAN) const;
+
   // Returns an OpenCV Mat image which is a naively-constructed monochrome or
   // RGB image combined from the channels in this image for visualization
   // purposes. An empty OpenCV Mat will be returned (and a warning will be
@@ -306,7 +502,45 @@ class ImageData {
   // values (negative or larger than 1.0).
   ImageDataReport GetImageDataReport() const;
 
+  // Sets the number of threads used by the whole-image operations (arithmetic,
+  // reports and color interpolation) of every ImageData in the process. A
+  // value of 0 uses all available threads. The default is 1, so images are
+  // processed on the calling thread unless the application opts in (e.g. with
+  // --num_threads).
+  static void SetNumThreads(const int num_threads);
+  static int GetNumThreads();
+
  private:
+  template <int NumTerms>
+  friend class ImageExpression;
+
+  // Checks that the other image can be added to this one (same number of
+  // channels, sizes and precision).
+  void CheckCanAdd(const ImageData& other) const;
+
+  // Sets this image to the sum of the given images multiplied by their
+  // weights, or adds that sum to this image if accumulate is true. Every
+  // channel is computed in a single pass over the pixels of all terms. The
+  // result has the properties (e.g. spectral mode) of the first image. Used
+  // to evaluate ImageExpressions.
+  void AssignWeightedSum(
+      const ImageData* const* images,
+      const double* weights,
+      const int num_terms,
+      const bool accumulate);
+
+  // Returns the number of channels including hidden channels.
+  int GetNumStoredChannels() const;
+
+  // Returns all channels of the image, including hidden chroma channels. The
+  // channels are shared, not copied.
+  std::vector<cv::Mat> GetAllChannels() const;
+
+  // Moves copies of the hidden chroma channels of a luminance-only image into
+  // channels_, if there are any. Called before operations that modify every
+  // channel.
+  void MaterializeHiddenChannels();
+
   // Returns a 2D pixel coordinate given the pixel index. This is used for
   // consistent indexing given a particular image size. The index range should
   // be (0 <= index < image_width * image_height) and will be verified.
@@ -314,7 +548,7 @@ class ImageData {
   // Pixels are accessed row-by-row: all pixels in the first row of the image,
   // followed by all pixels in the second row, etc. The returned coordinates
   // are (x [col], y [row]).
-  cv::Point GetPixelCoordinatesFromIndex(const int index) const;
+  cv::Point GetPixelCoordinatesFromIndex(const int64_t index) const;
 
   // The spectral mode of this image. SPECTRAL_MODE_COLOR_* is for 3-channel
   // color images. By default, it is assumed that all 3-channel images are
@@ -350,8 +584,135 @@ class ImageData {
   // The data is stored as OpenCV Mat images, one for each channel to support
   // an arbitrary number of channels.
   std::vector<cv::Mat> channels_;
+
+  // The hidden chroma channels (Cr and Cb) of a luminance-only image, which
+  // are computed in the same pass as the luminance channel. Copies of the
+  // image share them, since they are never modified in place: operations
+  // that modify every channel first move copies of them into channels_ (see
+  // MaterializeHiddenChannels()). Empty if all channels are in channels_.
+  std::vector<cv::Mat> hidden_chroma_channels_;
+
+  // The precision of all channels. This is double precision unless it is
+  // explicitly changed.
+  ImagePrecision precision_ = DOUBLE_PRECISION;
+};
+
+// The weighted sum of NumTerms images, built by the arithmetic operators of
+// ImageData. It only refers to its images, which must outlive it, so it should
+// be assigned to an image in the same statement that creates it rather than
+// stored (e.g. with auto).
+template <int NumTerms>
+class ImageExpression {
+ public:
+  ImageExpression(
+      const std::array<const ImageData*, NumTerms>& images,
+      const std::array<double, NumTerms>& weights)
+      : images_(images), weights_(weights) {}
+
+  // Returns this expression with every term multiplied by the scalar.
+  ImageExpression operator * (const double scalar) const {
+    std::array<double, NumTerms> weights = weights_;
+    for (double& weight : weights) {
+      weight *= scalar;
+    }
+    return ImageExpression(images_, weights);
+  }
+
+  // Returns this expression with every term divided by the scalar.
+  ImageExpression operator / (const double scalar) const {
+    return *this * (1.0 / scalar);
+  }
+
+  // Returns the sum of this expression and the image.
+  ImageExpression<NumTerms + 1> operator + (const ImageData& image) const {
+    return *this + ImageExpression<1>({{&image}}, {{1.0}});
+  }
+
+  // Returns the sum of this expression and the other expression.
+  template <int OtherNumTerms>
+  ImageExpression<NumTerms + OtherNumTerms> operator + (
+      const ImageExpression<OtherNumTerms>& other) const {
+
+    std::array<const ImageData*, NumTerms + OtherNumTerms> images;
+    std::array<double, NumTerms + OtherNumTerms> weights;
+    std::copy(images_.begin(), images_.end(), images.begin());
+    std::copy(other.images_.begin(), other.images_.end(),
+              images.begin() + NumTerms);
+    std::copy(weights_.begin(), weights_.end(), weights.begin());
+    std::copy(other.weights_.begin(), other.weights_.end(),
+              weights.begin() + NumTerms);
+    return ImageExpression<NumTerms + OtherNumTerms>(images, weights);
+  }
+
+  // Computes the expression into a new image.
+  operator ImageData() const {
+    ImageData result;
+    EvaluateInto(&result, false);
+    return result;
+  }
+
+ private:
+  template <int OtherNumTerms>
+  friend class ImageExpression;
+  friend class ImageData;
+
+  // Computes the expression into the given image, or adds it to the image if
+  // accumulate is true.
+  void EvaluateInto(ImageData* image, const bool accumulate) const {
+    image->AssignWeightedSum(
+        images_.data(), weights_.data(), NumTerms, accumulate);
+  }
+
+  const std::array<const ImageData*, NumTerms> images_;
+  const std::array<double, NumTerms> weights_;
 };
 
+// Returns the expression multiplied by the scalar, e.g. 0.5 * (a + b).
+template <int NumTerms>
+ImageExpression<NumTerms> operator * (
+    const double scalar, const ImageExpression<NumTerms>& expression) {
+  return expression * scalar;
+}
+
+// Returns the image multiplied by the scalar, e.g. 0.5 * a + 0.5 * b.
+inline ImageExpression<1> operator * (
+    const double scalar, const ImageData& image) {
+  return image * scalar;
+}
+
+inline ImageExpression<1> ImageData::operator * (const double scalar) const {
+  return ImageExpression<1>({{this}}, {{scalar}});
+}
+
+inline ImageExpression<1> ImageData::operator / (const double scalar) const {
+  return ImageExpression<1>({{this}}, {{1.0 / scalar}});
+}
+
+inline ImageExpression<2> ImageData::operator + (
+    const ImageData& other) const {
+  return ImageExpression<2>({{this, &other}}, {{1.0, 1.0}});
+}
+
+template <int NumTerms>
+ImageExpression<NumTerms + 1> ImageData::operator + (
+    const ImageExpression<NumTerms>& expression) const {
+  return ImageExpression<1>({{this}}, {{1.0}}) + expression;
+}
+
+template <int NumTerms>
+ImageData& ImageData::operator = (
+    const ImageExpression<NumTerms>& expression) {
+  expression.EvaluateInto(this, false);
+  return *this;
+}
+
+template <int NumTerms>
+ImageData& ImageData::operator += (
+    const ImageExpression<NumTerms>& expression) {
+  expression.EvaluateInto(this, true);
+  return *this;
+}
+
 }  // namespace super_resolution
 
 #endif  // SRC_IMAGE_IMAGE_DATA_H_
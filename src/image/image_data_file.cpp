@@ -0,0 +1,319 @@
+#include "image/image_data_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "image/image_data.h"
+#include "util/matrix_util.h"
+#include "util/profiler.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+constexpr char kImageDataFileMagic[] = "SRIMGDAT";
+constexpr int kImageDataFileMagicSize = 8;
+constexpr uint32_t kImageDataFileVersion = 1;
+
+// The alignment of every channel plane in the file, in bytes.
+constexpr int64_t kPlaneAlignment = 64;
+
+// The header at the start of every image data file. The version doubles as a
+// byte order mark, since it cannot be read back from a file written on a
+// machine of the other byte order.
+struct ImageDataFileHeader {
+  char magic[kImageDataFileMagicSize];
+  uint32_t version;
+  uint32_t header_size;  // The offset of the first plane.
+  int32_t width;
+  int32_t height;
+  int32_t num_channels;
+  int32_t precision;      // An ImagePrecision.
+  int32_t spectral_mode;  // An ImageSpectralMode.
+  uint32_t reserved_flags;
+  int64_t plane_stride;  // The distance between planes in bytes.
+  uint8_t reserved[16];
+};
+static_assert(
+    sizeof(ImageDataFileHeader) == kPlaneAlignment,
+    "The header must keep the first plane aligned.");
+
+// Returns the size of a pixel value of the given precision in bytes.
+int64_t GetValueSize(const ImagePrecision precision) {
+  return (precision == SINGLE_PRECISION) ? sizeof(float) : sizeof(double);
+}
+
+// Returns the distance between the planes of an image with the given number
+// of pixels per channel, which is the size of a plane rounded up to the
+// alignment.
+int64_t GetPlaneStride(
+    const int64_t num_pixels, const ImagePrecision precision) {
+
+  const int64_t plane_size = num_pixels * GetValueSize(precision);
+  return (plane_size + kPlaneAlignment - 1) / kPlaneAlignment *
+      kPlaneAlignment;
+}
+
+// Checks that the header describes a valid image in a file of the given size,
+// and returns the information it stores.
+ImageDataFileInfo GetValidatedInfo(
+    const ImageDataFileHeader& header,
+    const int64_t file_size,
+    const std::string& file_path) {
+
+  CHECK_EQ(header.version, kImageDataFileVersion)
+      << "Image data file '" << file_path << "' has an unsupported version "
+      << "or was written on a machine of a different byte order.";
+  CHECK_EQ(header.header_size, sizeof(ImageDataFileHeader))
+      << "Image data file '" << file_path << "' has an invalid header.";
+  CHECK_GT(header.width, 0) << "Invalid image width in '" << file_path << "'.";
+  CHECK_GT(header.height, 0)
+      << "Invalid image height in '" << file_path << "'.";
+  CHECK_GT(header.num_channels, 0)
+      << "Invalid number of channels in '" << file_path << "'.";
+  CHECK(header.precision == DOUBLE_PRECISION ||
+        header.precision == SINGLE_PRECISION)
+      << "Invalid precision in '" << file_path << "'.";
+  CHECK(header.spectral_mode >= SPECTRAL_MODE_NONE &&
+        header.spectral_mode <= SPECTRAL_MODE_COLOR_YCRCB)
+      << "Invalid spectral mode in '" << file_path << "'.";
+
+  ImageDataFileInfo info;
+  info.image_size = cv::Size(header.width, header.height);
+  info.num_channels = header.num_channels;
+  info.precision = static_cast<ImagePrecision>(header.precision);
+  info.spectral_mode = static_cast<ImageSpectralMode>(header.spectral_mode);
+  const int64_t num_pixels =
+      static_cast<int64_t>(header.width) * header.height;
+  CHECK_EQ(header.plane_stride, GetPlaneStride(num_pixels, info.precision))
+      << "Image data file '" << file_path << "' has an invalid plane stride.";
+  CHECK_LE(header.header_size + header.num_channels * header.plane_stride,
+           file_size)
+      << "Image data file '" << file_path << "' is truncated.";
+  return info;
+}
+
+// An OpenCV matrix allocator that releases memory-mapped files. It only owns
+// the mappings created by LoadImageDataFile() and never allocates matrices
+// itself: the loaded channels do not use it as their allocator, so new
+// buffers of those matrices come from the default allocator.
+class MappedFileAllocator : public cv::MatAllocator {
+ public:
+  virtual cv::UMatData* allocate(
+      int dims,
+      const int* sizes,
+      int type,
+      void* data,
+      size_t* step,
+#if CV_VERSION_MAJOR >= 4
+      cv::AccessFlag flags,
+#else
+      int flags,
+#endif
+      cv::UMatUsageFlags usage_flags) const {
+
+    LOG(FATAL) << "Memory-mapped files cannot allocate new matrices.";
+    return nullptr;
+  }
+
+  virtual bool allocate(
+      cv::UMatData* data,
+#if CV_VERSION_MAJOR >= 4
+      cv::AccessFlag access_flags,
+#else
+      int access_flags,
+#endif
+      cv::UMatUsageFlags usage_flags) const {
+
+    // Host memory is always accessible.
+    return data != nullptr;
+  }
+
+  virtual void deallocate(cv::UMatData* data) const {
+    if (data == nullptr) {
+      return;
+    }
+    CV_Assert(data->urefcount == 0);
+    CV_Assert(data->refcount == 0);
+    munmap(data->origdata, data->size);
+    data->origdata = nullptr;
+    delete data;
+  }
+};
+
+// Returns the allocator that owns all mappings. It is never destroyed, since
+// the loaded images may live until exit.
+const MappedFileAllocator* GetMappedFileAllocator() {
+  static const MappedFileAllocator* allocator = new MappedFileAllocator();
+  return allocator;
+}
+
+}  // namespace
+
+bool ReadImageDataFileInfo(
+    const std::string& file_path, ImageDataFileInfo* info) {
+
+  CHECK_NOTNULL(info);
+  std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+  const int64_t file_size = file.tellg();
+  file.seekg(0);
+  ImageDataFileHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file.good() || std::memcmp(
+          header.magic, kImageDataFileMagic, kImageDataFileMagicSize) != 0) {
+    return false;
+  }
+  *info = GetValidatedInfo(header, file_size, file_path);
+  return true;
+}
+
+void SaveImageDataFile(const ImageData& image, const std::string& file_path) {
+  PROFILE_SCOPE("SaveImageDataFile");
+
+  const int num_channels = image.GetNumChannels();
+  CHECK_GT(num_channels, 0) << "Cannot save an empty image.";
+  const cv::Size image_size = image.GetImageSize();
+  const ImagePrecision precision = image.GetPrecision();
+
+  ImageDataFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kImageDataFileMagic, kImageDataFileMagicSize);
+  header.version = kImageDataFileVersion;
+  header.header_size = sizeof(header);
+  header.width = image_size.width;
+  header.height = image_size.height;
+  header.num_channels = num_channels;
+  header.precision = precision;
+  header.spectral_mode = image.GetSpectralMode();
+  if (image.GetSpectralMode() == SPECTRAL_MODE_COLOR_YCRCB &&
+      num_channels != 3) {
+    // Only the luminance channel of a luminance-only image is visible.
+    header.spectral_mode = SPECTRAL_MODE_NONE;
+  }
+  header.plane_stride = GetPlaneStride(image.GetNumPixels(), precision);
+
+  // The file is replaced by renaming a new file over it, since truncating it
+  // would invalidate the mappings of images that were loaded from it.
+  const std::string temporary_file_path = file_path + ".tmp";
+  std::ofstream file(temporary_file_path, std::ios::binary | std::ios::trunc);
+  CHECK(file.is_open())
+      << "Image data file '" << temporary_file_path << "' could not be opened "
+      << "for writing.";
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  // The channels are written row by row, since they may be views that are
+  // not stored continuously.
+  const int64_t row_size = image_size.width * GetValueSize(precision);
+  const std::vector<char> padding(
+      header.plane_stride - image_size.height * row_size, 0);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const cv::Mat channel_image = image.GetChannelImage(channel);
+    for (int row = 0; row < image_size.height; ++row) {
+      file.write(channel_image.ptr<char>(row), row_size);
+    }
+    file.write(padding.data(), padding.size());
+  }
+  file.close();
+  CHECK(file.good())
+      << "Image data file '" << file_path << "' could not be written.";
+  CHECK_EQ(std::rename(temporary_file_path.c_str(), file_path.c_str()), 0)
+      << "Image data file '" << file_path << "' could not be replaced.";
+}
+
+ImageData LoadImageDataFile(const std::string& file_path) {
+  ImageDataFileInfo info;
+  CHECK(ReadImageDataFileInfo(file_path, &info))
+      << "File '" << file_path << "' is not an image data file.";
+  return LoadImageDataFile(file_path, 0, info.num_channels);
+}
+
+ImageData LoadImageDataFile(
+    const std::string& file_path,
+    const int first_channel,
+    const int num_channels) {
+
+  PROFILE_SCOPE("LoadImageDataFile");
+
+  const int file_descriptor = open(file_path.c_str(), O_RDONLY);
+  CHECK_GE(file_descriptor, 0)
+      << "File '" << file_path << "' could not be opened for reading.";
+  struct stat file_status;
+  CHECK_EQ(fstat(file_descriptor, &file_status), 0)
+      << "Could not get the size of file '" << file_path << "'.";
+  const int64_t file_size = file_status.st_size;
+  CHECK_GE(file_size, static_cast<int64_t>(sizeof(ImageDataFileHeader)))
+      << "File '" << file_path << "' is not an image data file.";
+
+  // The mapping is writable but private, so that the image can be modified
+  // in place without changing the file.
+  void* mapping = mmap(
+      nullptr,
+      file_size,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE,
+      file_descriptor,
+      0);
+  // The mapping stays valid after the file is closed.
+  close(file_descriptor);
+  CHECK(mapping != MAP_FAILED)
+      << "File '" << file_path << "' could not be memory mapped.";
+
+  const ImageDataFileHeader& header =
+      *static_cast<const ImageDataFileHeader*>(mapping);
+  CHECK_EQ(std::memcmp(
+      header.magic, kImageDataFileMagic, kImageDataFileMagicSize), 0)
+      << "File '" << file_path << "' is not an image data file.";
+  const ImageDataFileInfo info =
+      GetValidatedInfo(header, file_size, file_path);
+  CHECK_GE(first_channel, 0) << "The first channel cannot be negative.";
+  CHECK_GT(num_channels, 0) << "At least one channel must be loaded.";
+  CHECK_LE(first_channel + num_channels, info.num_channels)
+      << "The channels are outside of the channels of '" << file_path << "'.";
+
+  // All planes are wrapped in one matrix with a row per plane, which owns the
+  // mapping through its reference count. Each channel is a view of the start
+  // of its row, reshaped to the image size.
+  const int matrix_type = (info.precision == SINGLE_PRECISION) ?
+      util::kOpenCvSinglePrecisionMatrixType : util::kOpenCvMatrixType;
+  const int num_pixels = info.image_size.width * info.image_size.height;
+  cv::Mat planes(
+      info.num_channels,
+      static_cast<int>(header.plane_stride / GetValueSize(info.precision)),
+      matrix_type,
+      static_cast<uchar*>(mapping) + header.header_size);
+  cv::UMatData* mapping_data = new cv::UMatData(GetMappedFileAllocator());
+  mapping_data->data = mapping_data->origdata = static_cast<uchar*>(mapping);
+  mapping_data->size = file_size;
+  mapping_data->refcount = 1;
+  planes.u = mapping_data;
+
+  std::vector<cv::Mat> channel_images;
+  for (int channel = first_channel; channel < first_channel + num_channels;
+       ++channel) {
+    channel_images.push_back(planes.row(channel).colRange(0, num_pixels)
+        .reshape(1, info.image_size.height));
+  }
+  ImageData image(channel_images, info.precision);
+  if (num_channels == info.num_channels &&
+      info.spectral_mode != image.GetSpectralMode()) {
+    image.SetSpectralMode(info.spectral_mode);
+  }
+  return image;
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,64 @@
+// A native binary file format for ImageData, used for intermediate products
+// (e.g. generated LR images, PCA-transformed images and solver results) that
+// must be stored without loss of precision and reloaded quickly. The file is a
+// fixed 64-byte header, which stores the image size, number of channels,
+// precision and spectral mode, followed by the channels as planes of
+// row-major pixel values in the machine's byte order. Every plane starts at a
+// multiple of 64 bytes from the start of the file (padded with zeros), so the
+// planes are aligned like the buffers of util::AlignedMatAllocator.
+//
+// Loading memory maps the file and wraps the planes in the image channels, so
+// no pixels are copied or converted, and only the pages that are actually
+// accessed are read from disk. The mapping is private: modifying the loaded
+// image copies the modified pages and never changes the file. The mapping is
+// released when the last channel (or view of a channel) is destroyed. Saving
+// an image data file replaces the file instead of overwriting it, so images
+// loaded from the previous file stay valid.
+
+#ifndef SRC_IMAGE_IMAGE_DATA_FILE_H_
+#define SRC_IMAGE_IMAGE_DATA_FILE_H_
+
+#include <string>
+
+#include "image/image_data.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+// The file extension of image data files (without the dot).
+constexpr char kImageDataFileExtension[] = "srimg";
+
+// The information stored in the header of an image data file.
+struct ImageDataFileInfo {
+  cv::Size image_size;
+  int num_channels = 0;
+  ImagePrecision precision = DOUBLE_PRECISION;
+  ImageSpectralMode spectral_mode = SPECTRAL_MODE_NONE;
+};
+
+// Reads the header of the given file into info. Returns false if the file is
+// not an image data file (or cannot be read), and causes an error if it is an
+// image data file with an invalid or unsupported header.
+bool ReadImageDataFileInfo(
+    const std::string& file_path, ImageDataFileInfo* info);
+
+// Saves the (visible) channels of the image to the given file in the image's
+// precision. Luminance-only images are saved as their luminance channel, and
+// their color mode is not stored.
+void SaveImageDataFile(const ImageData& image, const std::string& file_path);
+
+// Loads the image stored in the given image data file without copying its
+// pixels (see above). The file must be a valid image data file.
+ImageData LoadImageDataFile(const std::string& file_path);
+
+// Same as above, but only loads num_channels channels starting at
+// first_channel. The pages of the other channels are never read.
+ImageData LoadImageDataFile(
+    const std::string& file_path,
+    const int first_channel,
+    const int num_channels);
+
+}  // namespace super_resolution
+
+#endif  // SRC_IMAGE_IMAGE_DATA_FILE_H_
@@ -1,9 +1,12 @@
 #include "image_model/additive_noise_module.h"
 
+#include <cstdint>
 #include <vector>
 
 #include "image/image_data.h"
 #include "util/matrix_util.h"
+#include "util/profiler.h"
+#include "util/sparse_matrix.h"
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
@@ -11,14 +14,38 @@
 #include "glog/logging.h"
 
 namespace super_resolution {
+namespace {
+
+// Returns the SplitMix64 hash of the value, which maps consecutive counters
+// to uncorrelated seeds.
+uint64_t MixBits(uint64_t value) {
+  value += 0x9e3779b97f4a7c15ULL;
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+// Returns the seed of the random stream of the given image index and channel.
+uint64_t GetStreamSeed(
+    const uint64_t seed, const int index, const int channel) {
+
+  return MixBits(MixBits(MixBits(seed) ^ static_cast<uint32_t>(index)) ^
+                 static_cast<uint32_t>(channel));
+}
+
+}  // namespace
+
+AdditiveNoiseModule::AdditiveNoiseModule(
+    const double sigma, const uint64_t seed) : sigma_(sigma), seed_(seed) {
 
-AdditiveNoiseModule::AdditiveNoiseModule(const double sigma) : sigma_(sigma) {
   CHECK_GT(sigma_, 0.0);
 }
 
 void AdditiveNoiseModule::ApplyToImage(
     ImageData* image_data, const int index) const {
 
+  PROFILE_SCOPE("AdditiveNoiseModule::ApplyToImage");
+
   CHECK_NOTNULL(image_data);
 
   // The image pixels are scaled between 0 and 1, so scale the sigma also.
@@ -28,9 +55,12 @@ void AdditiveNoiseModule::ApplyToImage(
   const cv::Size image_size = image_data->GetImageSize();
   const int num_image_channels = image_data->GetNumChannels();
   for (int i = 0; i < num_image_channels; ++i) {
-    cv::Mat noise = cv::Mat(image_size, util::kOpenCvMatrixType);
-    cv::randn(noise, 0, scaled_sigma);
+    // A local generator instead of OpenCV's global one, so that concurrent
+    // calls neither contend for nor perturb each other's streams.
+    cv::RNG random_generator(GetStreamSeed(seed_, index, i));
     cv::Mat channel_image = image_data->GetChannelImage(i);
+    cv::Mat noise = cv::Mat(image_size, channel_image.type());
+    random_generator.fill(noise, cv::RNG::NORMAL, 0.0, scaled_sigma);
     channel_image += noise;
   }
 }
@@ -43,4 +73,11 @@ void AdditiveNoiseModule::ApplyTransposeToImage(
   // TODO: implement.
 }
 
+util::SparseMatrix AdditiveNoiseModule::GetSparseOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  return util::SparseMatrix::Identity(
+      static_cast<int64_t>(image_size.width) * image_size.height);
+}
+
 }  // namespace super_resolution
@@ -4,8 +4,11 @@
 #ifndef SRC_IMAGE_MODEL_ADDITIVE_NOISE_MODULE_H_
 #define SRC_IMAGE_MODEL_ADDITIVE_NOISE_MODULE_H_
 
+#include <cstdint>
+
 #include "image/image_data.h"
 #include "image_model/degradation_operator.h"
+#include "util/sparse_matrix.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -16,15 +19,27 @@ class AdditiveNoiseModule : public DegradationOperator {
   // The additive noise is sampled from a zero-mean standard deviation with the
   // given sigma value (for pixel values between 0 to 255). Sigma must be
   // greater than 0.
-  explicit AdditiveNoiseModule(const double sigma);
+  //
+  // The noise of each image index and channel comes from a counter-based
+  // random stream: its generator is seeded with a hash of the seed, the index
+  // and the channel. The noise of an image therefore only depends on these,
+  // not on the order in which images are generated or on other threads, and
+  // images can be generated concurrently.
+  explicit AdditiveNoiseModule(const double sigma, const uint64_t seed = 0);
 
   virtual void ApplyToImage(ImageData* image_data, const int index) const;
 
   virtual void ApplyTransposeToImage(
       ImageData* image_data, const int index) const;
 
+  // Noise does not change the expected image, so the operator matrix is the
+  // identity (the default GetOperatorMatrix()).
+  virtual util::SparseMatrix GetSparseOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
  private:
   const double sigma_;
+  const uint64_t seed_;
 };
 
 }  // namespace super_resolution
@@ -0,0 +1,202 @@
+#include "image_model/area_downsampling_module.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "image/image_data.h"
+#include "util/matrix_util.h"
+#include "util/profiler.h"
+#include "util/sparse_matrix.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// Writes the mean of every scale x scale patch of the HR channel into the
+// corresponding pixel of the LR channel. The patch rows are summed into the
+// LR row one after the other, so each HR pixel is read once. HR pixels past
+// the last whole patch are ignored.
+template <typename PixelType>
+void AverageChannelPatches(
+    const cv::Mat& channel_image, const int scale, cv::Mat* low_res_image) {
+
+  const double patch_weight = 1.0 / (static_cast<double>(scale) * scale);
+  const int low_res_width = low_res_image->cols;
+  for (int row = 0; row < low_res_image->rows; ++row) {
+    PixelType* low_res_row = low_res_image->ptr<PixelType>(row);
+    std::fill(low_res_row, low_res_row + low_res_width, PixelType(0));
+    for (int patch_row = 0; patch_row < scale; ++patch_row) {
+      const PixelType* high_res_row =
+          channel_image.ptr<PixelType>(row * scale + patch_row);
+      for (int col = 0; col < low_res_width; ++col) {
+        const PixelType* patch = high_res_row + col * scale;
+        PixelType patch_sum = 0;
+        for (int patch_col = 0; patch_col < scale; ++patch_col) {
+          patch_sum += patch[patch_col];
+        }
+        low_res_row[col] += patch_sum;
+      }
+    }
+    for (int col = 0; col < low_res_width; ++col) {
+      low_res_row[col] = static_cast<PixelType>(
+          low_res_row[col] * patch_weight);
+    }
+  }
+}
+
+// Fills every scale x scale patch of the HR channel with the corresponding
+// LR pixel divided by the patch area. The first row of each patch is
+// written and then copied to the other rows of the patch.
+template <typename PixelType>
+void SpreadChannelPixels(
+    const cv::Mat& low_res_image, const int scale, cv::Mat* channel_image) {
+
+  const double patch_weight = 1.0 / (static_cast<double>(scale) * scale);
+  const int high_res_width = channel_image->cols;
+  for (int row = 0; row < low_res_image.rows; ++row) {
+    const PixelType* low_res_row = low_res_image.ptr<PixelType>(row);
+    PixelType* first_patch_row = channel_image->ptr<PixelType>(row * scale);
+    for (int col = 0; col < low_res_image.cols; ++col) {
+      const PixelType value =
+          static_cast<PixelType>(low_res_row[col] * patch_weight);
+      std::fill(
+          first_patch_row + col * scale,
+          first_patch_row + (col + 1) * scale,
+          value);
+    }
+    for (int patch_row = 1; patch_row < scale; ++patch_row) {
+      std::copy(
+          first_patch_row,
+          first_patch_row + high_res_width,
+          channel_image->ptr<PixelType>(row * scale + patch_row));
+    }
+  }
+}
+
+}  // namespace
+
+AreaDownsamplingModule::AreaDownsamplingModule(const int scale)
+    : scale_(scale) {
+  CHECK_GE(scale_, 1);
+}
+
+std::shared_ptr<DegradationOperator>
+AreaDownsamplingModule::CreateCoarseOperator() const {
+  if (scale_ % 2 != 0) {
+    return nullptr;
+  }
+  return std::make_shared<AreaDownsamplingModule>(scale_ / 2);
+}
+
+void AreaDownsamplingModule::ApplyToImage(
+    ImageData* image_data, const int index) const {
+
+  PROFILE_SCOPE("AreaDownsamplingModule::ApplyToImage");
+
+  CHECK_NOTNULL(image_data);
+
+  const cv::Size image_size = image_data->GetImageSize();
+  const cv::Size low_res_size(
+      image_size.width / scale_, image_size.height / scale_);
+  CHECK_GT(low_res_size.area(), 0)
+      << "The image is smaller than a downsampling patch.";
+  const int num_image_channels = image_data->GetNumChannels();
+  ImageData result(
+      low_res_size, num_image_channels, image_data->GetPrecision());
+  for (int i = 0; i < num_image_channels; ++i) {
+    const cv::Mat channel = image_data->GetChannelImage(i);
+    cv::Mat low_res_channel = result.GetChannelImage(i);
+    if (image_data->GetPrecision() == SINGLE_PRECISION) {
+      AverageChannelPatches<float>(channel, scale_, &low_res_channel);
+    } else {
+      AverageChannelPatches<double>(channel, scale_, &low_res_channel);
+    }
+  }
+  *image_data = std::move(result);
+}
+
+void AreaDownsamplingModule::ApplyTransposeToImage(
+    ImageData* image_data, const int index) const {
+
+  PROFILE_SCOPE("AreaDownsamplingModule::ApplyTransposeToImage");
+
+  CHECK_NOTNULL(image_data);
+
+  const cv::Size image_size = image_data->GetImageSize();
+  const int num_image_channels = image_data->GetNumChannels();
+  ImageData result(
+      cv::Size(image_size.width * scale_, image_size.height * scale_),
+      num_image_channels,
+      image_data->GetPrecision());
+  for (int i = 0; i < num_image_channels; ++i) {
+    const cv::Mat channel = image_data->GetChannelImage(i);
+    cv::Mat high_res_channel = result.GetChannelImage(i);
+    if (image_data->GetPrecision() == SINGLE_PRECISION) {
+      SpreadChannelPixels<float>(channel, scale_, &high_res_channel);
+    } else {
+      SpreadChannelPixels<double>(channel, scale_, &high_res_channel);
+    }
+  }
+  *image_data = std::move(result);
+}
+
+cv::Mat AreaDownsamplingModule::GetOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  const int low_res_width = image_size.width / scale_;
+  const int low_res_height = image_size.height / scale_;
+  const double patch_weight = 1.0 / (scale_ * scale_);
+  cv::Mat downsampling_matrix = cv::Mat::zeros(
+      low_res_width * low_res_height,
+      image_size.width * image_size.height,
+      util::kOpenCvMatrixType);
+  for (int row = 0; row < low_res_height * scale_; ++row) {
+    for (int col = 0; col < low_res_width * scale_; ++col) {
+      const int low_res_index =
+          (row / scale_) * low_res_width + col / scale_;
+      downsampling_matrix.at<double>(
+          low_res_index, row * image_size.width + col) = patch_weight;
+    }
+  }
+  return downsampling_matrix;
+}
+
+util::SparseMatrix AreaDownsamplingModule::GetSparseOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  // Each LR pixel is the mean of its scale x scale patch.
+  const int low_res_width = image_size.width / scale_;
+  const int low_res_height = image_size.height / scale_;
+  const double patch_weight = 1.0 / (scale_ * scale_);
+  std::vector<util::SparseMatrixEntry> entries;
+  entries.reserve(
+      static_cast<int64_t>(low_res_width) * low_res_height * scale_ * scale_);
+  for (int row = 0; row < low_res_height; ++row) {
+    for (int col = 0; col < low_res_width; ++col) {
+      const int64_t low_res_index =
+          static_cast<int64_t>(row) * low_res_width + col;
+      for (int patch_row = 0; patch_row < scale_; ++patch_row) {
+        const int64_t high_res_row_start =
+            static_cast<int64_t>(row * scale_ + patch_row) * image_size.width;
+        for (int patch_col = 0; patch_col < scale_; ++patch_col) {
+          entries.emplace_back(
+              low_res_index,
+              high_res_row_start + col * scale_ + patch_col,
+              patch_weight);
+        }
+      }
+    }
+  }
+  return util::SparseMatrix(
+      static_cast<int64_t>(low_res_width) * low_res_height,
+      static_cast<int64_t>(image_size.width) * image_size.height,
+      entries);
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,56 @@
+// A downsampling operator that models the integration of the HR image over
+// the area of each LR sensor pixel: every LR pixel is the mean of its
+// scale x scale patch of the HR image. This is the same as a box blur of
+// radius scale followed by the DownsamplingModule, but the patches do not
+// overlap, so each HR pixel is read once and the cost does not depend on the
+// scale. Use it instead of a BlurModule with a large blur radius at large
+// scales (e.g. 4x or 8x), where the sensor integration dominates the PSF.
+//
+// The transpose spreads each LR pixel, divided by the patch area, evenly over
+// its patch.
+
+#ifndef SRC_IMAGE_MODEL_AREA_DOWNSAMPLING_MODULE_H_
+#define SRC_IMAGE_MODEL_AREA_DOWNSAMPLING_MODULE_H_
+
+#include <memory>
+
+#include "image_model/degradation_operator.h"
+#include "util/sparse_matrix.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+class AreaDownsamplingModule : public DegradationOperator {
+ public:
+  // The given scale is the width and height of the patch of HR pixels that
+  // is averaged into one LR pixel. The scale should be greater than or equal
+  // to 1.
+  explicit AreaDownsamplingModule(const int scale);
+
+  virtual void ApplyToImage(ImageData* image_data, const int index) const;
+
+  virtual void ApplyTransposeToImage(
+      ImageData* image_data, const int index) const;
+
+  virtual cv::Mat GetOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  virtual util::SparseMatrix GetSparseOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  virtual bool HasSparseOperatorMatrix() const {
+    return true;
+  }
+
+  // An even scale is halved on the coarse grid. Odd scales cannot be.
+  virtual std::shared_ptr<DegradationOperator> CreateCoarseOperator() const;
+
+ private:
+  // The downsampling scale.
+  const int scale_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_IMAGE_MODEL_AREA_DOWNSAMPLING_MODULE_H_
@@ -1,7 +1,12 @@
 #include "image_model/blur_module.h"
 
+#include <memory>
+
 #include "image/image_data.h"
 #include "util/matrix_util.h"
+#include "util/profiler.h"
+#include "util/sparse_matrix.h"
+#include "util/thread_pool.h"
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
@@ -9,9 +14,18 @@
 #include "glog/logging.h"
 
 namespace super_resolution {
+namespace {
+
+// The border mode of the blur convolution. Pixels outside of the image are
+// treated as zeros. The channels are views of one planar allocation, so the
+// border is isolated, since the filters would otherwise read the rows of the
+// neighboring channels as the border.
+constexpr int kBlurBorderMode = cv::BORDER_CONSTANT | cv::BORDER_ISOLATED;
+
+}  // namespace
 
 BlurModule::BlurModule(const int blur_radius, const double sigma)
-    : blur_radius_(blur_radius) {
+    : blur_radius_(blur_radius), sigma_(sigma) {
 
   CHECK_GE(blur_radius, 1);
   CHECK_GT(sigma, 0.0);
@@ -20,19 +34,35 @@ BlurModule::BlurModule(const int blur_radius, const double sigma)
   const cv::Mat kernel_x = cv::getGaussianKernel(blur_radius, sigma);
   const cv::Mat kernel_y = cv::getGaussianKernel(blur_radius, sigma);
   blur_kernel_ = kernel_x * kernel_y.t();
+  is_separable_ = util::GetSeparableKernelFactors(
+      blur_kernel_, &kernel_column_, &kernel_row_);
 }
 
 void BlurModule::ApplyToImage(ImageData* image_data, const int index) const {
+  PROFILE_SCOPE("BlurModule::ApplyToImage");
   CHECK_NOTNULL(image_data);
-  util::ApplyConvolutionToImage(image_data, blur_kernel_);
+  ApplyKernel(*image_data, false, image_data);
+}
+
+void BlurModule::ApplyToImageOutOfPlace(
+    const ImageData& image_data,
+    const int index,
+    ImageData* degraded_image) const {
+
+  PROFILE_SCOPE("BlurModule::ApplyToImage");
+
+  CHECK_NOTNULL(degraded_image);
+  CheckOutOfPlaceImages(image_data, *degraded_image);
+  ApplyKernel(image_data, false, degraded_image);
 }
 
 void BlurModule::ApplyTransposeToImage(
     ImageData* image_data, const int index) const {
 
-  CHECK_NOTNULL(image_data);
+  PROFILE_SCOPE("BlurModule::ApplyTransposeToImage");
 
-  util::ApplyConvolutionToImage(image_data, blur_kernel_.t());
+  CHECK_NOTNULL(image_data);
+  ApplyKernel(*image_data, true, image_data);
 }
 
 cv::Mat BlurModule::GetOperatorMatrix(
@@ -41,4 +71,72 @@ cv::Mat BlurModule::GetOperatorMatrix(
   return ConvertKernelToOperatorMatrix(blur_kernel_, image_size);
 }
 
+util::SparseMatrix BlurModule::GetSparseOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  return ConvertKernelToSparseOperatorMatrix(blur_kernel_, image_size);
+}
+
+std::shared_ptr<DegradationOperator> BlurModule::CreateCoarseOperator() const {
+  std::shared_ptr<BlurModule> coarse_operator(
+      new BlurModule((blur_radius_ / 2) | 1, sigma_ / 2.0));
+  coarse_operator->SetNumThreads(num_threads_);
+  return coarse_operator;
+}
+
+void BlurModule::SetNumThreads(const int num_threads) {
+  num_threads_ = util::GetNumThreadsToUse(num_threads);
+  thread_pool_.reset();
+  if (num_threads_ > 1) {
+    // The calling thread also blurs channels, so it is not included.
+    thread_pool_.reset(new util::ThreadPool(num_threads_ - 1));
+  }
+}
+
+void BlurModule::ApplyKernel(
+    const ImageData& image_data,
+    const bool transpose,
+    ImageData* blurred_image) const {
+
+  const int num_channels = image_data.GetNumChannels();
+  const auto blur_channel = [&](const int channel) {
+    // The blurred channel header shares its data with the blurred image. The
+    // filters write into it without reallocating, and can run in place.
+    const cv::Mat channel_image = image_data.GetChannelImage(channel);
+    cv::Mat blurred_channel = blurred_image->GetChannelImage(channel);
+    if (is_separable_) {
+      // The transposed kernel swaps the row and column factors. For the
+      // symmetric Gaussian, the factors are the same.
+      const cv::Mat& kernel_row = transpose ? kernel_column_ : kernel_row_;
+      const cv::Mat& kernel_column = transpose ? kernel_row_ : kernel_column_;
+      cv::sepFilter2D(
+          channel_image,
+          blurred_channel,
+          -1,                  // depth of output (-1 = same as input)
+          kernel_row,          // kernel applied along each row (x)
+          kernel_column,       // kernel applied along each column (y)
+          cv::Point(-1, -1),   // anchor kernel at its center
+          0,                   // addition to all values (none)
+          kBlurBorderMode);
+    } else {
+      cv::filter2D(
+          channel_image,
+          blurred_channel,
+          -1,
+          transpose ? cv::Mat(blur_kernel_.t()) : blur_kernel_,
+          cv::Point(-1, -1),
+          0,
+          kBlurBorderMode);
+    }
+  };
+
+  if (thread_pool_ != nullptr && num_channels > 1) {
+    thread_pool_->ParallelFor(num_channels, blur_channel);
+  } else {
+    for (int channel = 0; channel < num_channels; ++channel) {
+      blur_channel(channel);
+    }
+  }
+}
+
 }  // namespace super_resolution
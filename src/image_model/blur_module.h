@@ -1,11 +1,20 @@
 // A standard blurring kernel that applies a Gaussian blur, emulating a point
 // spread function (PSF). The PSF is assumed to be the same in both the x and y
 // directions.
+//
+// Because a Gaussian kernel is separable, the blur is applied as two 1D passes
+// (one along the rows and one along the columns) when the kernel has rank 1,
+// which costs O(2r) instead of O(r^2) operations per pixel for a kernel of
+// radius r.
 
 #ifndef SRC_IMAGE_MODEL_BLUR_MODULE_H_
 #define SRC_IMAGE_MODEL_BLUR_MODULE_H_
 
+#include <memory>
+
 #include "image_model/degradation_operator.h"
+#include "util/sparse_matrix.h"
+#include "util/thread_pool.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -20,18 +29,65 @@ class BlurModule : public DegradationOperator {
 
   virtual void ApplyToImage(ImageData* image_data, const int index) const;
 
+  virtual void ApplyToImageOutOfPlace(
+      const ImageData& image_data,
+      const int index,
+      ImageData* degraded_image) const;
+
   virtual void ApplyTransposeToImage(
       ImageData* image_data, const int index) const;
 
   virtual cv::Mat GetOperatorMatrix(
       const cv::Size& image_size, const int index) const;
 
+  virtual util::SparseMatrix GetSparseOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  virtual bool HasSparseOperatorMatrix() const {
+    return true;
+  }
+
+  // The coarse blur has half the sigma, and half the radius rounded to the
+  // next odd number.
+  virtual std::shared_ptr<DegradationOperator> CreateCoarseOperator() const;
+
+  // Sets the number of threads used to blur the channels of an image in
+  // parallel. Set to 0 to use all available hardware threads. By default, all
+  // channels are blurred serially.
+  void SetNumThreads(const int num_threads);
+
+  // Returns true if the blur is applied as two 1D passes. This is detected
+  // from the rank of the kernel.
+  bool IsSeparable() const {
+    return is_separable_;
+  }
+
  private:
+  // Blurs every channel of the given image into the channels of the blurred
+  // image, which may be the same image. If transpose is true, the transposed
+  // kernel is used instead.
+  void ApplyKernel(
+      const ImageData& image_data,
+      const bool transpose,
+      ImageData* blurred_image) const;
+
   const int blur_radius_;
+  const double sigma_;
 
   // This kernel is created in the constructor and is used for the blurring
   // convolution and for getting the operator matrix.
   cv::Mat blur_kernel_;
+
+  // If the kernel has rank 1, it is the product of these column (y) and row
+  // (x) factors, which are used for separable filtering.
+  bool is_separable_ = false;
+  cv::Mat kernel_column_;
+  cv::Mat kernel_row_;
+
+  // The number of threads used and the pool of additional threads. The pool
+  // is null if the channels are blurred serially.
+  int num_threads_ = 1;
+  std::shared_ptr<util::ThreadPool> thread_pool_;
 };
 
 }  // namespace super_resolution
@@ -0,0 +1,170 @@
+#include "image_model/compiled_image_model.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "util/sparse_matrix.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+
+CompiledImageModel::CompiledImageModel(
+    const cv::Size& image_size,
+    const cv::Size& low_res_image_size,
+    std::vector<util::SparseMatrix> frame_matrices)
+    : image_size_(image_size),
+      low_res_image_size_(low_res_image_size),
+      has_normal_matrix_(false) {
+
+  CHECK_GT(frame_matrices.size(), 0) << "Cannot compile 0 frames.";
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size.width) * image_size.height;
+  const int64_t num_low_res_pixels =
+      static_cast<int64_t>(low_res_image_size.width) *
+      low_res_image_size.height;
+  frame_matrices_.reserve(frame_matrices.size());
+  for (util::SparseMatrix& frame_matrix : frame_matrices) {
+    CHECK_EQ(frame_matrix.GetNumRows(), num_low_res_pixels)
+        << "Frame matrix does not match the low-res image size.";
+    CHECK_EQ(frame_matrix.GetNumCols(), num_pixels)
+        << "Frame matrix does not match the image size.";
+    frame_matrices_.push_back(std::make_shared<const util::SparseMatrix>(
+        std::move(frame_matrix)));
+  }
+}
+
+void CompiledImageModel::ApplyToChannel(
+    const double* channel_data,
+    const int index,
+    double* degraded_channel_data) const {
+
+  GetFrameMatrix(index).MultiplyVector(channel_data, degraded_channel_data);
+}
+
+void CompiledImageModel::AddTransposeToChannel(
+    const double* low_res_channel_data,
+    const int index,
+    double* output_channel_data) const {
+
+  GetFrameMatrix(index).AddMultiplyTransposeVector(
+      low_res_channel_data, output_channel_data);
+}
+
+void CompiledImageModel::ApplyToChannelBatch(
+    const double* channel_data,
+    const int first_index,
+    const std::vector<double*>& degraded_channel_data) const {
+
+  CHECK_NOTNULL(channel_data);
+  const int num_batch_frames = degraded_channel_data.size();
+  CHECK_GE(first_index, 0) << "Frame index is out of bounds.";
+  CHECK_LE(first_index + num_batch_frames, GetNumFrames())
+      << "Frame index is out of bounds.";
+
+  const int64_t width = low_res_image_size_.width;
+  for (int row = 0; row < low_res_image_size_.height; ++row) {
+    const int64_t row_start = row * width;
+    for (int i = 0; i < num_batch_frames; ++i) {
+      const util::SparseMatrix& frame_matrix =
+          *frame_matrices_[first_index + i];
+      const int64_t* row_offsets = frame_matrix.GetRowOffsets().data();
+      const int64_t* column_indices = frame_matrix.GetColumnIndices().data();
+      const double* values = frame_matrix.GetValues().data();
+      double* degraded_data = CHECK_NOTNULL(degraded_channel_data[i]);
+      for (int64_t pixel = row_start; pixel < row_start + width; ++pixel) {
+        double sum = 0.0;
+        for (int64_t j = row_offsets[pixel]; j < row_offsets[pixel + 1]; ++j) {
+          sum += values[j] * channel_data[column_indices[j]];
+        }
+        degraded_data[pixel] = sum;
+      }
+    }
+  }
+}
+
+void CompiledImageModel::AddTransposeToChannelBatch(
+    const std::vector<const double*>& low_res_channel_data,
+    const int first_index,
+    double* output_channel_data) const {
+
+  CHECK_NOTNULL(output_channel_data);
+  const int num_batch_frames = low_res_channel_data.size();
+  CHECK_GE(first_index, 0) << "Frame index is out of bounds.";
+  CHECK_LE(first_index + num_batch_frames, GetNumFrames())
+      << "Frame index is out of bounds.";
+
+  const int64_t width = low_res_image_size_.width;
+  for (int row = 0; row < low_res_image_size_.height; ++row) {
+    const int64_t row_start = row * width;
+    for (int i = 0; i < num_batch_frames; ++i) {
+      const util::SparseMatrix& frame_matrix =
+          *frame_matrices_[first_index + i];
+      const int64_t* row_offsets = frame_matrix.GetRowOffsets().data();
+      const int64_t* column_indices = frame_matrix.GetColumnIndices().data();
+      const double* values = frame_matrix.GetValues().data();
+      const double* low_res_data = CHECK_NOTNULL(low_res_channel_data[i]);
+      for (int64_t pixel = row_start; pixel < row_start + width; ++pixel) {
+        const double low_res_value = low_res_data[pixel];
+        for (int64_t j = row_offsets[pixel]; j < row_offsets[pixel + 1]; ++j) {
+          output_channel_data[column_indices[j]] += values[j] * low_res_value;
+        }
+      }
+    }
+  }
+}
+
+void CompiledImageModel::ComputeNormalMatrix() {
+  util::SparseMatrix normal_matrix;
+  for (const auto& frame_matrix : frame_matrices_) {
+    const util::SparseMatrix frame_normal_matrix =
+        frame_matrix->Transpose().Multiply(*frame_matrix);
+    if (normal_matrix.GetNumRows() == 0) {
+      normal_matrix = frame_normal_matrix;
+    } else {
+      normal_matrix = normal_matrix.Add(frame_normal_matrix);
+    }
+  }
+  normal_matrix_ = std::move(normal_matrix);
+  has_normal_matrix_ = true;
+}
+
+void CompiledImageModel::AddFrame(util::SparseMatrix frame_matrix) {
+  CHECK_EQ(frame_matrix.GetNumRows(), frame_matrices_[0]->GetNumRows())
+      << "Frame matrix does not match the low-res image size.";
+  CHECK_EQ(frame_matrix.GetNumCols(), frame_matrices_[0]->GetNumCols())
+      << "Frame matrix does not match the image size.";
+  if (has_normal_matrix_) {
+    normal_matrix_ = normal_matrix_.Add(
+        frame_matrix.Transpose().Multiply(frame_matrix));
+  }
+  frame_matrices_.push_back(
+      std::make_shared<const util::SparseMatrix>(std::move(frame_matrix)));
+}
+
+const util::SparseMatrix& CompiledImageModel::GetNormalMatrix() const {
+  CHECK(has_normal_matrix_) << "The normal matrix has not been computed.";
+  return normal_matrix_;
+}
+
+const util::SparseMatrix& CompiledImageModel::GetFrameMatrix(
+    const int index) const {
+
+  CHECK_GE(index, 0) << "Frame index is out of bounds.";
+  CHECK_LT(index, frame_matrices_.size()) << "Frame index is out of bounds.";
+  return *frame_matrices_[index];
+}
+
+int64_t CompiledImageModel::GetNumNonZeros() const {
+  int64_t num_non_zeros = 0;
+  for (const auto& frame_matrix : frame_matrices_) {
+    num_non_zeros += frame_matrix->GetNumNonZeros();
+  }
+  return num_non_zeros;
+}
+
+}  // namespace super_resolution
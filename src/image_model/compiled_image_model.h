@@ -0,0 +1,128 @@
+// A CompiledImageModel is a precomputed, per-frame form of an ImageModel for a
+// fixed HR image size (see ImageModel::Compile()). Each frame's chain of
+// operators (e.g. motion, blur and downsampling) is composed into a single
+// sparse matrix A_k, so applying the model is one pass over the LR pixels
+// that fuses the warp, blur and decimation: only the HR pixels that reach a
+// kept LR pixel are ever read, and no intermediate HR images are produced.
+// The warp interpolation weights, blur taps, sampling offsets and border
+// handling are all baked into the matrix entries.
+//
+// This trades memory for speed. Every frame stores roughly one matrix entry
+// per blur tap and interpolation neighbor of each LR pixel.
+
+#ifndef SRC_IMAGE_MODEL_COMPILED_IMAGE_MODEL_H_
+#define SRC_IMAGE_MODEL_COMPILED_IMAGE_MODEL_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "util/sparse_matrix.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+class CompiledImageModel {
+ public:
+  // The frame matrices map a vectorized single channel of an HR image of the
+  // given size to a vectorized LR channel of the given low-res size. There
+  // is one matrix for every frame index. The matrices are moved into the
+  // compiled model.
+  CompiledImageModel(
+      const cv::Size& image_size,
+      const cv::Size& low_res_image_size,
+      std::vector<util::SparseMatrix> frame_matrices);
+
+  // Degrades a single HR channel for the frame at the given index, writing
+  // the LR channel into degraded_channel_data. This is the same as applying
+  // the ImageModel to that channel.
+  void ApplyToChannel(
+      const double* channel_data,
+      const int index,
+      double* degraded_channel_data) const;
+
+  // Applies the transpose of the frame's model to a single LR channel and
+  // adds the HR result to output_channel_data. Unlike
+  // ImageModel::ApplyTransposeToImage(), this is the exact adjoint of
+  // ApplyToChannel().
+  void AddTransposeToChannel(
+      const double* low_res_channel_data,
+      const int index,
+      double* output_channel_data) const;
+
+  // Same as ApplyToChannel() for the frames first_index, first_index + 1, ...
+  // with one output per frame, where degraded_channel_data[i] receives the LR
+  // channel of frame first_index + i. The frames are evaluated together, one
+  // LR row at a time, so the HR rows that a LR row reads are brought into
+  // cache once for all of the frames instead of once per frame.
+  void ApplyToChannelBatch(
+      const double* channel_data,
+      const int first_index,
+      const std::vector<double*>& degraded_channel_data) const;
+
+  // The batched version of AddTransposeToChannel(), which adds the transpose
+  // of every frame's model applied to its LR channel
+  // (low_res_channel_data[i] for frame first_index + i) to the output.
+  // Like ApplyToChannelBatch(), the frames are interleaved by LR row so that
+  // the HR rows being accumulated stay in cache.
+  void AddTransposeToChannelBatch(
+      const std::vector<const double*>& low_res_channel_data,
+      const int first_index,
+      double* output_channel_data) const;
+
+  // Computes and stores the normal matrix sum_k A_k' A_k over all frames (see
+  // GetNormalMatrix()). For translational motion with a shift-invariant blur
+  // and decimation, this is a small stencil per HR pixel regardless of the
+  // number of frames, so the data term can be evaluated in a single pass
+  // over the HR pixels (see ObjectiveDataTerm).
+  void ComputeNormalMatrix();
+
+  // Appends the model matrix of a new frame (at the next frame index), e.g.
+  // for frames that arrive after the model was compiled. If the normal
+  // matrix was computed, the A'A of the new frame is added to it, so the
+  // cost of adding a frame does not grow with the number of frames. Copies
+  // of the model share the matrices of their frames, so a copy can be
+  // extended without copying the frames it already has.
+  void AddFrame(util::SparseMatrix frame_matrix);
+
+  // Returns true if ComputeNormalMatrix() has been called.
+  bool HasNormalMatrix() const {
+    return has_normal_matrix_;
+  }
+
+  // Returns the normal matrix. ComputeNormalMatrix() must have been called.
+  const util::SparseMatrix& GetNormalMatrix() const;
+
+  // Returns the combined model matrix A_k of the frame at the given index.
+  const util::SparseMatrix& GetFrameMatrix(const int index) const;
+
+  int GetNumFrames() const {
+    return frame_matrices_.size();
+  }
+
+  cv::Size GetImageSize() const {
+    return image_size_;
+  }
+
+  cv::Size GetLowResImageSize() const {
+    return low_res_image_size_;
+  }
+
+  // Returns the total number of stored matrix entries over all frames.
+  int64_t GetNumNonZeros() const;
+
+ private:
+  const cv::Size image_size_;
+  const cv::Size low_res_image_size_;
+  // The matrices are never changed once added, so copies share them.
+  std::vector<std::shared_ptr<const util::SparseMatrix>> frame_matrices_;
+
+  // The sum of A_k' A_k over all frames, if it has been computed.
+  util::SparseMatrix normal_matrix_;
+  bool has_normal_matrix_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_IMAGE_MODEL_COMPILED_IMAGE_MODEL_H_
@@ -1,9 +1,11 @@
 #include "image_model/degradation_operator.h"
 
+#include <cstdint>
 #include <utility>
 #include <vector>
 
 #include "util/matrix_util.h"
+#include "util/sparse_matrix.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -18,6 +20,36 @@ constexpr int kMaxConvolutionKernelSize = 10;
 
 }  // namespace
 
+void DegradationOperator::ApplyToImageOutOfPlace(
+    const ImageData& image_data,
+    const int index,
+    ImageData* degraded_image) const {
+
+  CHECK_NOTNULL(degraded_image);
+  CheckOutOfPlaceImages(image_data, *degraded_image);
+
+  // Copy into the existing channels, which share their data with the
+  // degraded image.
+  for (int i = 0; i < image_data.GetNumChannels(); ++i) {
+    cv::Mat degraded_channel = degraded_image->GetChannelImage(i);
+    image_data.GetChannelImage(i).copyTo(degraded_channel);
+  }
+  ApplyToImage(degraded_image, index);
+}
+
+void DegradationOperator::CheckOutOfPlaceImages(
+    const ImageData& image_data, const ImageData& degraded_image) {
+
+  CHECK(&image_data != &degraded_image)
+      << "The input and output images must be different images.";
+  CHECK(degraded_image.GetImageSize() == image_data.GetImageSize())
+      << "The output image size does not match the input image size.";
+  CHECK_EQ(degraded_image.GetNumChannels(), image_data.GetNumChannels())
+      << "The output image does not have the same number of channels.";
+  CHECK_EQ(degraded_image.GetPrecision(), image_data.GetPrecision())
+      << "The output image does not have the same precision.";
+}
+
 cv::Mat DegradationOperator::ConvertKernelToOperatorMatrix(
     const cv::Mat& kernel, const cv::Size& image_size) {
 
@@ -73,6 +105,55 @@ cv::Mat DegradationOperator::ConvertKernelToOperatorMatrix(
   return operator_matrix;
 }
 
+util::SparseMatrix DegradationOperator::ConvertKernelToSparseOperatorMatrix(
+    const cv::Mat& kernel, const cv::Size& image_size) {
+
+  cv::Mat kernel_matrix;
+  kernel.convertTo(kernel_matrix, util::kOpenCvMatrixType);
+  const int kernel_mid_row = kernel_matrix.rows / 2;
+  const int kernel_mid_col = kernel_matrix.cols / 2;
+
+  // Every output pixel is the kernel-weighted sum of the pixels around it, so
+  // each row of the matrix has (at most) one entry per kernel value.
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size.width) * image_size.height;
+  std::vector<util::SparseMatrixEntry> entries;
+  entries.reserve(num_pixels * kernel_matrix.total());
+  for (int row = 0; row < image_size.height; ++row) {
+    for (int col = 0; col < image_size.width; ++col) {
+      const int64_t pixel_index =
+          static_cast<int64_t>(row) * image_size.width + col;
+      for (int kernel_row = 0; kernel_row < kernel_matrix.rows; ++kernel_row) {
+        const int image_row = row + kernel_row - kernel_mid_row;
+        if (image_row < 0 || image_row >= image_size.height) {
+          continue;
+        }
+        for (int kernel_col = 0; kernel_col < kernel_matrix.cols;
+             ++kernel_col) {
+          const int image_col = col + kernel_col - kernel_mid_col;
+          const double value =
+              kernel_matrix.at<double>(kernel_row, kernel_col);
+          if (image_col < 0 || image_col >= image_size.width ||
+              value == 0.0) {
+            continue;
+          }
+          entries.emplace_back(
+              pixel_index,
+              static_cast<int64_t>(image_row) * image_size.width + image_col,
+              value);
+        }
+      }
+    }
+  }
+  return util::SparseMatrix(num_pixels, num_pixels, entries);
+}
+
+util::SparseMatrix DegradationOperator::GetSparseOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  return util::SparseMatrix::FromDense(GetOperatorMatrix(image_size, index));
+}
+
 cv::Mat DegradationOperator::GetOperatorMatrix(
     const cv::Size& image_size, const int index) const {
 
@@ -8,7 +8,11 @@
 #ifndef SRC_IMAGE_MODEL_DEGRADATION_OPERATOR_H_
 #define SRC_IMAGE_MODEL_DEGRADATION_OPERATOR_H_
 
+#include <memory>
+
 #include "image/image_data.h"
+#include "motion/motion_shift.h"
+#include "util/sparse_matrix.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -31,16 +35,101 @@ class DegradationOperator {
   static cv::Mat ConvertKernelToOperatorMatrix(
       const cv::Mat& kernel, const cv::Size& image_size);
 
+  // Same as ConvertKernelToOperatorMatrix(), but assembles a sparse matrix
+  // directly from the kernel stencil, so there is no limit on the image or
+  // kernel size.
+  static util::SparseMatrix ConvertKernelToSparseOperatorMatrix(
+      const cv::Mat& kernel, const cv::Size& image_size);
+
   // Apply this degradation operator to the given image. The index is passed in
   // for cases where the degradation is dependent on the specific frame (e.g.
   // in the case of motion).
   virtual void ApplyToImage(ImageData* image_data, const int index) const = 0;
 
+  // Same as ApplyToImage(ImageData*, ...), but reads the given image and
+  // writes the degraded image into degraded_image, leaving the input image
+  // unchanged. The degraded image must already have the same size, number of
+  // channels and precision as the input image, so that its channels can be
+  // overwritten without allocating new ones (operators that change the image
+  // size still reallocate them).
+  //
+  // The default implementation copies the input into the degraded image and
+  // then applies the operator in place. Operators that can read and write
+  // separate images should override this to avoid the copy.
+  virtual void ApplyToImageOutOfPlace(
+      const ImageData& image_data,
+      const int index,
+      ImageData* degraded_image) const;
+
+  // Applies this operator followed by a nearest-neighbor decimation by the
+  // given scale, which keeps the top-left pixel of every scale x scale patch
+  // (see GetDecimationScale()), and writes the LR result into
+  // decimated_image. The input image is unchanged unless it is also the
+  // output. Fusing the two lets an operator evaluate only the pixels that
+  // survive the decimation.
+  //
+  // Returns false, without modifying the output, if this operator cannot be
+  // fused with the decimation for the given frame index, in which case the
+  // two operators have to be applied one after the other. The default
+  // implementation never fuses.
+  virtual bool ApplyToImageAndDecimate(
+      const ImageData& image_data,
+      const int index,
+      const int scale,
+      ImageData* decimated_image) const {
+    return false;
+  }
+
+  // Returns the scale if this operator is a nearest-neighbor decimation that
+  // the preceding operator can be fused with (see ApplyToImageAndDecimate()),
+  // or 0 otherwise.
+  virtual int GetDecimationScale() const {
+    return 0;
+  }
+
   // Apply the transpose of this degradation operator to the given image. This
   // must be implemented to compute the derivatives of the objective function.
   virtual void ApplyTransposeToImage(
       ImageData* image_data, const int index) const = 0;
 
+  // Returns a copy of an operator that applies the motion of every frame,
+  // with the motion of a new frame appended at the next frame index, e.g.
+  // for frames that arrive one at a time during a live capture (see
+  // ImageModel::CreateWithMotionShift()). This operator is not changed, since
+  // other models may share it. Returns null if this operator does not apply
+  // the motion, which is the default.
+  virtual std::shared_ptr<DegradationOperator> CreateWithMotionShift(
+      const MotionShift& motion_shift) const {
+    return nullptr;
+  }
+
+  // Returns false if this operator is given for a fixed set of frames that
+  // cannot be extended by new frames (e.g. per-frame warps or weights). The
+  // default is true.
+  virtual bool CanAddFrames() const {
+    return true;
+  }
+
+  // Returns an operator that approximates this one on images of half the
+  // resolution (both sides halved and rounded up), or null if this operator
+  // cannot be scaled down, which is the default. The multigrid solver uses
+  // these to rediscretize the image model on its coarse grids (see
+  // ImageModel::CreateCoarseImageModel()).
+  virtual std::shared_ptr<DegradationOperator> CreateCoarseOperator() const {
+    return nullptr;
+  }
+
+  // Returns an operator for images whose channel c is the band
+  // band_offset + c of the images that this operator applies to, e.g. for a
+  // channel split or a block of bands solved on its own. Returns null if this
+  // operator treats every channel the same, which is the default, in which
+  // case this operator can be used as it is (see
+  // ImageModel::CreateBandOffsetImageModel()).
+  virtual std::shared_ptr<DegradationOperator> CreateBandOffsetOperator(
+      const int band_offset) const {
+    return nullptr;
+  }
+
   // Returns a Matrix representation of this operator. The matrix is intended
   // to be applied onto a vectorized version of the image, assuming it is a
   // column vector of stacked rows. The image_size parameter is required for
@@ -54,6 +143,28 @@ class DegradationOperator {
   // small data sets.
   virtual cv::Mat GetOperatorMatrix(
       const cv::Size& image_size, const int index) const;
+
+  // Returns the same matrix as GetOperatorMatrix() in sparse (CSR) form, which
+  // can be built for realistic image sizes.
+  //
+  // By default, this converts the dense GetOperatorMatrix(), so it is limited
+  // to small images. Operators should override this with a direct sparse
+  // assembly.
+  virtual util::SparseMatrix GetSparseOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  // Returns true if this operator overrides GetSparseOperatorMatrix() with a
+  // direct sparse assembly that works for any image size. Only models made
+  // of such operators can be compiled (see ImageModel::Compile()).
+  virtual bool HasSparseOperatorMatrix() const {
+    return false;
+  }
+
+ protected:
+  // Checks that the output image given to ApplyToImageOutOfPlace() matches
+  // the size, number of channels and precision of the input image.
+  static void CheckOutOfPlaceImages(
+      const ImageData& image_data, const ImageData& degraded_image);
 };
 
 }  // namespace super_resolution
@@ -1,9 +1,14 @@
 #include "image_model/downsampling_module.h"
 
 #include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 #include "image/image_data.h"
 #include "util/matrix_util.h"
+#include "util/profiler.h"
+#include "util/sparse_matrix.h"
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
@@ -16,9 +21,19 @@ DownsamplingModule::DownsamplingModule(const int scale) : scale_(scale) {
   CHECK_GE(scale_, 1);
 }
 
+std::shared_ptr<DegradationOperator>
+DownsamplingModule::CreateCoarseOperator() const {
+  if (scale_ % 2 != 0) {
+    return nullptr;
+  }
+  return std::make_shared<DownsamplingModule>(scale_ / 2);
+}
+
 void DownsamplingModule::ApplyToImage(
     ImageData* image_data, const int index) const {
 
+  PROFILE_SCOPE("DownsamplingModule::ApplyToImage");
+
   CHECK_NOTNULL(image_data);
 
   const double scale_factor = 1.0 / static_cast<double>(scale_);
@@ -29,6 +44,8 @@ void DownsamplingModule::ApplyToImage(
 void DownsamplingModule::ApplyTransposeToImage(
     ImageData* image_data, const int index) const {
 
+  PROFILE_SCOPE("DownsamplingModule::ApplyTransposeToImage");
+
   CHECK_NOTNULL(image_data);
 
   // The transpose of downsampling is trivial upsampling to size * scale_. We
@@ -63,4 +80,26 @@ cv::Mat DownsamplingModule::GetOperatorMatrix(
   return downsampling_matrix;
 }
 
+util::SparseMatrix DownsamplingModule::GetSparseOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  // Each LR pixel is the top-left HR pixel of its scale x scale patch.
+  const int low_res_width = image_size.width / scale_;
+  const int low_res_height = image_size.height / scale_;
+  std::vector<util::SparseMatrixEntry> entries;
+  entries.reserve(static_cast<int64_t>(low_res_width) * low_res_height);
+  for (int row = 0; row < low_res_height; ++row) {
+    for (int col = 0; col < low_res_width; ++col) {
+      entries.emplace_back(
+          static_cast<int64_t>(row) * low_res_width + col,
+          static_cast<int64_t>(row * scale_) * image_size.width + col * scale_,
+          1.0);
+    }
+  }
+  return util::SparseMatrix(
+      static_cast<int64_t>(low_res_width) * low_res_height,
+      static_cast<int64_t>(image_size.width) * image_size.height,
+      entries);
+}
+
 }  // namespace super_resolution
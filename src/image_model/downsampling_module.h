@@ -7,7 +7,10 @@
 #ifndef SRC_IMAGE_MODEL_DOWNSAMPLING_MODULE_H_
 #define SRC_IMAGE_MODEL_DOWNSAMPLING_MODULE_H_
 
+#include <memory>
+
 #include "image_model/degradation_operator.h"
+#include "util/sparse_matrix.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -27,6 +30,22 @@ class DownsamplingModule : public DegradationOperator {
   virtual cv::Mat GetOperatorMatrix(
       const cv::Size& image_size, const int index) const;
 
+  virtual util::SparseMatrix GetSparseOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  virtual bool HasSparseOperatorMatrix() const {
+    return true;
+  }
+
+  // Downsampling keeps the top-left pixel of each scale x scale patch, so the
+  // preceding operator can be fused with it.
+  virtual int GetDecimationScale() const {
+    return scale_;
+  }
+
+  // An even scale is halved on the coarse grid. Odd scales cannot be.
+  virtual std::shared_ptr<DegradationOperator> CreateCoarseOperator() const;
+
  private:
   // The downsampling scale.
   const int scale_;
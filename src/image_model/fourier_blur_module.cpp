@@ -0,0 +1,245 @@
+#include "image_model/fourier_blur_module.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <tuple>
+
+#include "image/image_data.h"
+#include "motion/motion_shift.h"
+#include "util/matrix_util.h"
+#include "util/profiler.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// Size limitation for the GetOperatorMatrix method.
+constexpr int kMaxOperatorMatrixImageSize = 30;
+
+// Returns the signed frequency (in cycles per pixel) of the given DFT index
+// for a signal of the given size.
+double GetSignedFrequency(const int index, const int size) {
+  const int signed_index = (index <= size / 2) ? index : index - size;
+  return static_cast<double>(signed_index) / size;
+}
+
+// Checks that the kernel is valid and returns it in the standard matrix type.
+cv::Mat GetValidatedKernel(const cv::Mat& kernel) {
+  CHECK(!kernel.empty()) << "The blur kernel cannot be empty.";
+  CHECK_EQ(kernel.channels(), 1) << "The blur kernel must be single-channel.";
+  CHECK(kernel.rows % 2 == 1 && kernel.cols % 2 == 1)
+      << "The blur kernel must have odd dimensions.";
+  cv::Mat converted_kernel;
+  kernel.convertTo(converted_kernel, util::kOpenCvMatrixType);
+  return converted_kernel;
+}
+
+}  // namespace
+
+FourierBlurModule::FourierBlurModule(
+    const cv::Mat& kernel, const MotionShiftSequence& motion_shift_sequence)
+    : kernel_(GetValidatedKernel(kernel)),
+      motion_shift_sequence_(motion_shift_sequence),
+      transfer_function_cache_(new TransferFunctionCache()) {
+
+  double max_shift = 0.0;
+  for (int i = 0; i < motion_shift_sequence_.GetNumMotionShifts(); ++i) {
+    const MotionShift& motion_shift = motion_shift_sequence_[i];
+    max_shift = std::max(max_shift, std::abs(motion_shift.dx));
+    max_shift = std::max(max_shift, std::abs(motion_shift.dy));
+  }
+  motion_padding_ = static_cast<int>(std::ceil(max_shift));
+}
+
+std::shared_ptr<DegradationOperator> FourierBlurModule::CreateWithMotionShift(
+    const MotionShift& motion_shift) const {
+
+  // Without motion, the operator is the same for every frame.
+  if (motion_shift_sequence_.GetNumMotionShifts() == 0) {
+    return nullptr;
+  }
+  std::shared_ptr<FourierBlurModule> extended_operator(
+      new FourierBlurModule(*this));
+  extended_operator->motion_shift_sequence_.AddMotionShift(motion_shift);
+  const double max_shift =
+      std::max(std::abs(motion_shift.dx), std::abs(motion_shift.dy));
+  const int motion_padding = std::max(
+      motion_padding_, static_cast<int>(std::ceil(max_shift)));
+  if (motion_padding != motion_padding_) {
+    // The transfer functions of the old padded sizes are not used by the
+    // copy.
+    extended_operator->motion_padding_ = motion_padding;
+    extended_operator->transfer_function_cache_.reset(
+        new TransferFunctionCache());
+  }
+  return extended_operator;
+}
+
+void FourierBlurModule::ApplyToImage(
+    ImageData* image_data, const int index) const {
+
+  PROFILE_SCOPE("FourierBlurModule::ApplyToImage");
+
+  CHECK_NOTNULL(image_data);
+  ApplyTransferFunction(*image_data, index, false, image_data);
+}
+
+void FourierBlurModule::ApplyToImageOutOfPlace(
+    const ImageData& image_data,
+    const int index,
+    ImageData* degraded_image) const {
+
+  PROFILE_SCOPE("FourierBlurModule::ApplyToImage");
+
+  CHECK_NOTNULL(degraded_image);
+  CheckOutOfPlaceImages(image_data, *degraded_image);
+  ApplyTransferFunction(image_data, index, false, degraded_image);
+}
+
+void FourierBlurModule::ApplyTransposeToImage(
+    ImageData* image_data, const int index) const {
+
+  PROFILE_SCOPE("FourierBlurModule::ApplyTransposeToImage");
+
+  CHECK_NOTNULL(image_data);
+  ApplyTransferFunction(*image_data, index, true, image_data);
+}
+
+cv::Mat FourierBlurModule::GetOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  CHECK_LE(image_size.width, kMaxOperatorMatrixImageSize)
+      << "Image is too big to compute an operator matrix.";
+  CHECK_LE(image_size.height, kMaxOperatorMatrixImageSize)
+      << "Image is too big to compute an operator matrix.";
+
+  // Column i of the matrix is the response to an image that is 1 at pixel i
+  // and 0 everywhere else.
+  const int num_pixels = image_size.width * image_size.height;
+  cv::Mat operator_matrix(num_pixels, num_pixels, util::kOpenCvMatrixType);
+  for (int pixel_index = 0; pixel_index < num_pixels; ++pixel_index) {
+    ImageData impulse_image(image_size, 1);
+    impulse_image.GetMutableChannelData(0)[pixel_index] = 1.0;
+    ApplyToImage(&impulse_image, index);
+    const cv::Mat response =
+        impulse_image.GetChannelImage(0).reshape(1, num_pixels);
+    cv::Mat operator_column = operator_matrix.col(pixel_index);
+    response.copyTo(operator_column);
+  }
+  return operator_matrix;
+}
+
+cv::Size FourierBlurModule::GetPaddedSize(const cv::Size& image_size) const {
+  // The kernel and the motion reach up to half of the padding outside of the
+  // image on each side, so nothing wraps around into the image.
+  const int padded_width =
+      image_size.width + (kernel_.cols - 1) + 2 * motion_padding_;
+  const int padded_height =
+      image_size.height + (kernel_.rows - 1) + 2 * motion_padding_;
+  return cv::Size(
+      cv::getOptimalDFTSize(padded_width),
+      cv::getOptimalDFTSize(padded_height));
+}
+
+cv::Mat FourierBlurModule::GetTransferFunction(
+    const cv::Size& padded_size, const int index) const {
+
+  const int motion_index =
+      (motion_shift_sequence_.GetNumMotionShifts() > 0) ? index : -1;
+  const std::tuple<int, int, int> key =
+      std::make_tuple(padded_size.width, padded_size.height, motion_index);
+
+  std::lock_guard<std::mutex> lock(transfer_function_cache_->mutex);
+  std::map<std::tuple<int, int, int>, cv::Mat>& transfer_functions =
+      transfer_function_cache_->transfer_functions;
+  const auto cached_transfer_function = transfer_functions.find(key);
+  if (cached_transfer_function != transfer_functions.end()) {
+    return cached_transfer_function->second;
+  }
+
+  // The kernel is applied as a correlation (as with cv::filter2D), which is a
+  // convolution with the flipped kernel. The flipped kernel is placed with
+  // its center at the origin, wrapping around the padded image.
+  cv::Mat kernel_image = cv::Mat::zeros(padded_size, util::kOpenCvMatrixType);
+  const int kernel_mid_row = kernel_.rows / 2;
+  const int kernel_mid_col = kernel_.cols / 2;
+  for (int row = 0; row < kernel_.rows; ++row) {
+    for (int col = 0; col < kernel_.cols; ++col) {
+      const int image_row =
+          (kernel_mid_row - row + padded_size.height) % padded_size.height;
+      const int image_col =
+          (kernel_mid_col - col + padded_size.width) % padded_size.width;
+      kernel_image.at<double>(image_row, image_col) +=
+          kernel_.at<double>(row, col);
+    }
+  }
+  cv::Mat transfer_function;
+  cv::dft(kernel_image, transfer_function, cv::DFT_COMPLEX_OUTPUT);
+
+  // Shifting an image by (dx, dy) multiplies its transform by the phase ramp
+  // exp(-2 pi i (u * dx + v * dy)).
+  if (motion_index >= 0) {
+    const MotionShift& motion_shift = motion_shift_sequence_[motion_index];
+    for (int v = 0; v < padded_size.height; ++v) {
+      const double frequency_y = GetSignedFrequency(v, padded_size.height);
+      for (int u = 0; u < padded_size.width; ++u) {
+        const double frequency_x = GetSignedFrequency(u, padded_size.width);
+        const double phase = -2.0 * M_PI *
+            (frequency_x * motion_shift.dx + frequency_y * motion_shift.dy);
+        cv::Vec2d& value = transfer_function.at<cv::Vec2d>(v, u);
+        const double real = value[0];
+        const double imaginary = value[1];
+        value[0] = real * std::cos(phase) - imaginary * std::sin(phase);
+        value[1] = real * std::sin(phase) + imaginary * std::cos(phase);
+      }
+    }
+  }
+
+  transfer_functions[key] = transfer_function;
+  return transfer_function;
+}
+
+void FourierBlurModule::ApplyTransferFunction(
+    const ImageData& image_data,
+    const int index,
+    const bool transpose,
+    ImageData* output_image) const {
+
+  const cv::Size image_size = image_data.GetImageSize();
+  const cv::Size padded_size = GetPaddedSize(image_size);
+  const cv::Mat transfer_function = GetTransferFunction(padded_size, index);
+  const cv::Rect image_region(0, 0, image_size.width, image_size.height);
+
+  const int num_channels = image_data.GetNumChannels();
+  for (int channel = 0; channel < num_channels; ++channel) {
+    // The padded region header shares its data with the padded image, so
+    // the channel is converted directly into it.
+    cv::Mat padded_image =
+        cv::Mat::zeros(padded_size, util::kOpenCvMatrixType);
+    cv::Mat padded_image_region = padded_image(image_region);
+    image_data.GetChannelImage(channel).convertTo(
+        padded_image_region, util::kOpenCvMatrixType);
+
+    cv::Mat spectrum;
+    cv::dft(padded_image, spectrum, cv::DFT_COMPLEX_OUTPUT);
+    cv::Mat filtered_spectrum;
+    cv::mulSpectrums(
+        spectrum, transfer_function, filtered_spectrum, 0, transpose);
+    cv::Mat filtered_image;
+    cv::dft(
+        filtered_spectrum,
+        filtered_image,
+        cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+
+    // Write the result into the existing output channel, keeping its type.
+    cv::Mat output_channel = output_image->GetChannelImage(channel);
+    filtered_image(image_region).convertTo(
+        output_channel, output_channel.type());
+  }
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,106 @@
+// A blur operator that convolves the image with an arbitrary point spread
+// function (PSF) in the Fourier domain. The cost of the blur is independent of
+// the kernel size, so large PSFs of real optics can be modeled efficiently.
+// The transform of the kernel is computed once for every image size and
+// cached.
+//
+// Motion can optionally be fused into the same operator: a shift by (dx, dy)
+// is a phase ramp in the Fourier domain, which is multiplied into the kernel
+// transform, so blur and motion cost a single forward and inverse FFT per
+// channel. Integer shifts are equivalent to the MotionModule. Sub-pixel shifts
+// use band-limited (sinc) interpolation instead of the bilinear interpolation
+// of the MotionModule.
+//
+// The image is zero-padded by the kernel size and the largest motion shift
+// before the transform, so the result matches a spatial convolution with zero
+// borders (as in the BlurModule) instead of wrapping around the image.
+
+#ifndef SRC_IMAGE_MODEL_FOURIER_BLUR_MODULE_H_
+#define SRC_IMAGE_MODEL_FOURIER_BLUR_MODULE_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+#include "image/image_data.h"
+#include "image_model/degradation_operator.h"
+#include "motion/motion_shift.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+class FourierBlurModule : public DegradationOperator {
+ public:
+  // The kernel is applied like the BlurModule kernel (centered on each pixel)
+  // and must have odd dimensions. If a motion sequence is given, the motion
+  // of each image index is applied along with the blur, in which case the
+  // operator replaces the MotionModule in the image model.
+  explicit FourierBlurModule(
+      const cv::Mat& kernel,
+      const MotionShiftSequence& motion_shift_sequence = MotionShiftSequence());
+
+  virtual void ApplyToImage(ImageData* image_data, const int index) const;
+
+  virtual void ApplyToImageOutOfPlace(
+      const ImageData& image_data,
+      const int index,
+      ImageData* degraded_image) const;
+
+  // The transpose multiplies by the complex conjugate of the transfer
+  // function, which is the exact adjoint of the forward operator.
+  virtual void ApplyTransposeToImage(
+      ImageData* image_data, const int index) const;
+
+  // Returns a copy with the shift of a new frame if the motion is fused into
+  // the blur. The copy shares the cached transfer functions of this operator
+  // unless the new shift grows the padding.
+  virtual std::shared_ptr<DegradationOperator> CreateWithMotionShift(
+      const MotionShift& motion_shift) const;
+
+  // Builds the matrix by applying the operator to every unit impulse image,
+  // so it is limited to small images.
+  virtual cv::Mat GetOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+ private:
+  // Returns the size that images of the given size are padded to before the
+  // transform. The padding covers the kernel and the largest motion shift and
+  // is rounded up to a size that is efficient for the DFT.
+  cv::Size GetPaddedSize(const cv::Size& image_size) const;
+
+  // Returns the (cached) complex transfer function of the blur and the motion
+  // of the given image index for the given padded size.
+  cv::Mat GetTransferFunction(
+      const cv::Size& padded_size, const int index) const;
+
+  // Filters every channel of the given image into the channels of the output
+  // image, which may be the same image. If transpose is true, the conjugate
+  // transfer function is used.
+  void ApplyTransferFunction(
+      const ImageData& image_data,
+      const int index,
+      const bool transpose,
+      ImageData* output_image) const;
+
+  const cv::Mat kernel_;
+  MotionShiftSequence motion_shift_sequence_;
+
+  // The largest absolute motion shift in pixels (rounded up), which is added
+  // to the padding on every side.
+  int motion_padding_ = 0;
+
+  // Transfer functions for each (padded width, padded height, motion index).
+  // The motion index is -1 if there is no motion. The cache is shared by all
+  // threads that apply the operator, and by its copies for new frames.
+  struct TransferFunctionCache {
+    std::map<std::tuple<int, int, int>, cv::Mat> transfer_functions;
+    std::mutex mutex;
+  };
+  std::shared_ptr<TransferFunctionCache> transfer_function_cache_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_IMAGE_MODEL_FOURIER_BLUR_MODULE_H_
@@ -2,13 +2,27 @@
 
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "image/image_data.h"
 #include "image_model/additive_noise_module.h"
+#include "image_model/area_downsampling_module.h"
 #include "image_model/blur_module.h"
+#include "image_model/compiled_image_model.h"
 #include "image_model/degradation_operator.h"
 #include "image_model/downsampling_module.h"
+#include "image_model/fourier_blur_module.h"
 #include "image_model/motion_module.h"
+#include "image_model/observation_weight_module.h"
+#include "image_model/spectral_blur_module.h"
+#include "image_model/warp_module.h"
+#include "motion/motion_shift.h"
+#include "motion/warp_field.h"
+#include "util/profiler.h"
+#include "util/sparse_matrix.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
 
 #include "glog/logging.h"
 
@@ -19,41 +33,98 @@ ImageModel ImageModel::CreateImageModel(
 
   ImageModel image_model(parameters.scale);
 
-  // Add motion if a motion sequence or file is provided.
-  if (!parameters.motion_sequence_path.empty() ||
-       parameters.motion_sequence.GetNumMotionShifts() > 0) {
-    std::shared_ptr<MotionModule> motion_module;
-    if (parameters.motion_sequence.GetNumMotionShifts() > 0) {
-      // If motion sequence was provided:
-      motion_module = std::shared_ptr<MotionModule>(
-          new MotionModule(parameters.motion_sequence));
-    } else {
-      // If file name was provided:
-      MotionShiftSequence motion_shift_sequence;
-      motion_shift_sequence.LoadSequenceFromFile(
-          parameters.motion_sequence_path);
-      motion_module = std::shared_ptr<MotionModule>(
-          new MotionModule(motion_shift_sequence));
-    }
-    image_model.AddDegradationOperator(motion_module);
+  // Load the motion if a motion sequence or file is provided.
+  const bool add_motion =
+      !parameters.motion_sequence_path.empty() ||
+      parameters.motion_sequence.GetNumMotionShifts() > 0;
+  MotionShiftSequence motion_shift_sequence = parameters.motion_sequence;
+  if (add_motion && motion_shift_sequence.GetNumMotionShifts() == 0) {
+    // If file name was provided:
+    motion_shift_sequence.LoadSequenceFromFile(
+        parameters.motion_sequence_path);
+  }
+
+  // Load the general warps if a warp sequence or file is provided.
+  const bool add_warp =
+      !parameters.warp_sequence_path.empty() ||
+      parameters.warp_sequence.GetNumWarpFields() > 0;
+  WarpFieldSequence warp_sequence = parameters.warp_sequence;
+  if (add_warp && warp_sequence.GetNumWarpFields() == 0) {
+    warp_sequence.LoadHomographiesFromFile(parameters.warp_sequence_path);
+  }
+  CHECK(!add_warp || !add_motion)
+      << "A warp sequence cannot be combined with a motion sequence.";
+
+  // The observation weights are a per-frame scaling, which commutes with the
+  // other operators, so they are applied first.
+  if (!parameters.observation_weights.empty()) {
+    std::shared_ptr<ObservationWeightModule> observation_weight_module(
+        new ObservationWeightModule(parameters.observation_weights));
+    image_model.AddDegradationOperator(observation_weight_module);
   }
 
   // Add blur if the blur parameters are non-zero.
-  if (parameters.blur_radius > 0 && parameters.blur_sigma > 0.0) {
-    std::shared_ptr<BlurModule> blur_module(
-        new BlurModule(parameters.blur_radius, parameters.blur_sigma));
-    image_model.AddDegradationOperator(blur_module);
+  const bool add_blur =
+      parameters.blur_radius > 0 && parameters.blur_sigma > 0.0;
+
+  CHECK(!add_warp || !parameters.use_fourier_blur)
+      << "Warps cannot be fused into the Fourier blur.";
+  CHECK(parameters.blur_sigma_per_band == 0.0 || !parameters.use_fourier_blur)
+      << "The Fourier blur cannot have a band-dependent PSF.";
+
+  if (add_blur && parameters.use_fourier_blur) {
+    // The motion is applied by the same operator as the blur.
+    const cv::Mat kernel_1d =
+        cv::getGaussianKernel(parameters.blur_radius, parameters.blur_sigma);
+    std::shared_ptr<FourierBlurModule> fourier_blur_module(
+        new FourierBlurModule(
+            kernel_1d * kernel_1d.t(), motion_shift_sequence));
+    image_model.AddDegradationOperator(fourier_blur_module);
+  } else {
+    if (add_motion) {
+      std::shared_ptr<MotionModule> motion_module(
+          new MotionModule(motion_shift_sequence));
+      motion_module->SetNumThreads(parameters.num_threads);
+      image_model.AddDegradationOperator(motion_module);
+    }
+    if (add_warp) {
+      std::shared_ptr<WarpModule> warp_module(new WarpModule(warp_sequence));
+      warp_module->SetNumThreads(parameters.num_threads);
+      image_model.AddDegradationOperator(warp_module);
+    }
+    if (add_blur && parameters.blur_sigma_per_band != 0.0) {
+      std::shared_ptr<SpectralBlurModule> spectral_blur_module(
+          new SpectralBlurModule(
+              parameters.blur_radius,
+              parameters.blur_sigma,
+              parameters.blur_sigma_per_band,
+              parameters.blur_band_group_size));
+      spectral_blur_module->SetNumThreads(parameters.num_threads);
+      image_model.AddDegradationOperator(spectral_blur_module);
+    } else if (add_blur) {
+      std::shared_ptr<BlurModule> blur_module(
+          new BlurModule(parameters.blur_radius, parameters.blur_sigma));
+      blur_module->SetNumThreads(parameters.num_threads);
+      image_model.AddDegradationOperator(blur_module);
+    }
   }
 
   // Add the downsampling operator.
-  std::shared_ptr<DownsamplingModule> downsampling_module(
-      new DownsamplingModule(parameters.scale));
-  image_model.AddDegradationOperator(downsampling_module);
+  if (parameters.use_area_downsampling) {
+    std::shared_ptr<AreaDownsamplingModule> area_downsampling_module(
+        new AreaDownsamplingModule(parameters.scale));
+    image_model.AddDegradationOperator(area_downsampling_module);
+  } else {
+    std::shared_ptr<DownsamplingModule> downsampling_module(
+        new DownsamplingModule(parameters.scale));
+    image_model.AddDegradationOperator(downsampling_module);
+  }
 
   // Add noise if the noise sigma is positive.
   if (parameters.noise_sigma > 0.0) {
     std::shared_ptr<AdditiveNoiseModule> noise_module(
-        new AdditiveNoiseModule(parameters.noise_sigma));
+        new AdditiveNoiseModule(
+            parameters.noise_sigma, parameters.noise_seed));
     image_model.AddDegradationOperator(noise_module);
   }
 
@@ -73,9 +144,78 @@ void ImageModel::AddDegradationOperator(
   degradation_operators_.push_back(degradation_operator);
 }
 
+ImageModel ImageModel::CreateWithMotionShift(
+    const MotionShift& motion_shift) const {
+
+  CHECK(CanAddFrames())
+      << "The image model has per-frame operators (warps or observation "
+      << "weights) that cannot be extended by a new frame.";
+  ImageModel extended_model(downsampling_scale_);
+  extended_model.band_offset_ = band_offset_;
+  bool has_motion_operator = false;
+  for (const auto& degradation_operator : degradation_operators_) {
+    const std::shared_ptr<DegradationOperator> extended_operator =
+        degradation_operator->CreateWithMotionShift(motion_shift);
+    if (extended_operator != nullptr) {
+      has_motion_operator = true;
+    }
+    extended_model.AddDegradationOperator(
+        (extended_operator != nullptr) ?
+            extended_operator : degradation_operator);
+  }
+  CHECK(has_motion_operator ||
+        (motion_shift.dx == 0.0 && motion_shift.dy == 0.0))
+      << "The image model has no motion operator for the shift of the new "
+      << "frame.";
+  return extended_model;
+}
+
+bool ImageModel::CanAddFrames() const {
+  for (const auto& degradation_operator : degradation_operators_) {
+    if (!degradation_operator->CanAddFrames()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::unique_ptr<ImageModel> ImageModel::CreateCoarseImageModel() const {
+  if (downsampling_scale_ % 2 != 0) {
+    return nullptr;
+  }
+  std::unique_ptr<ImageModel> coarse_model(
+      new ImageModel(downsampling_scale_ / 2));
+  coarse_model->band_offset_ = band_offset_;
+  for (const auto& degradation_operator : degradation_operators_) {
+    const std::shared_ptr<DegradationOperator> coarse_operator =
+        degradation_operator->CreateCoarseOperator();
+    if (coarse_operator == nullptr) {
+      return nullptr;
+    }
+    coarse_model->AddDegradationOperator(coarse_operator);
+  }
+  return coarse_model;
+}
+
+ImageModel ImageModel::CreateBandOffsetImageModel(
+    const int band_offset) const {
+
+  ImageModel offset_model(downsampling_scale_);
+  offset_model.band_offset_ = band_offset_ + band_offset;
+  for (const auto& degradation_operator : degradation_operators_) {
+    const std::shared_ptr<DegradationOperator> offset_operator =
+        degradation_operator->CreateBandOffsetOperator(band_offset);
+    offset_model.AddDegradationOperator(
+        (offset_operator != nullptr) ? offset_operator : degradation_operator);
+  }
+  return offset_model;
+}
+
 ImageData ImageModel::ApplyToImage(
     const ImageData& image_data, const int index) const {
 
+  PROFILE_SCOPE("ImageModel::ApplyToImage");
+
   ImageData degraded_image = image_data;
   for (const auto& degradation_operator : degradation_operators_) {
     degradation_operator->ApplyToImage(&degraded_image, index);
@@ -84,15 +224,38 @@ ImageData ImageModel::ApplyToImage(
 }
 
 void ImageModel::ApplyToImage(ImageData* image_data, const int index) const {
+  PROFILE_SCOPE("ImageModel::ApplyToImage");
   CHECK_NOTNULL(image_data);
-  for (const auto& degradation_operator : degradation_operators_) {
-    degradation_operator->ApplyToImage(image_data, index);
+  const int num_degradation_operators = degradation_operators_.size();
+  for (int i = 0; i < num_degradation_operators;) {
+    i += ApplyOperatorToImage(i, *image_data, index, image_data);
+  }
+}
+
+void ImageModel::ApplyToImage(
+    const ImageData& image_data,
+    const int index,
+    ImageData* degraded_image) const {
+
+  PROFILE_SCOPE("ImageModel::ApplyToImage");
+
+  CHECK_NOTNULL(degraded_image);
+  if (degradation_operators_.empty()) {
+    *degraded_image = ImageData(image_data);
+    return;
+  }
+  int i = ApplyOperatorToImage(0, image_data, index, degraded_image);
+  const int num_degradation_operators = degradation_operators_.size();
+  while (i < num_degradation_operators) {
+    i += ApplyOperatorToImage(i, *degraded_image, index, degraded_image);
   }
 }
 
 void ImageModel::ApplyTransposeToImage(
     ImageData* image_data, const int index) const {
 
+  PROFILE_SCOPE("ImageModel::ApplyTransposeToImage");
+
   CHECK_NOTNULL(image_data);
   const int num_degradation_operators = degradation_operators_.size();
   for (int i = num_degradation_operators - 1; i >= 0; --i) {
@@ -117,4 +280,84 @@ cv::Mat ImageModel::GetModelMatrix(
   return model_matrix;
 }
 
+util::SparseMatrix ImageModel::GetSparseModelMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  const int num_operators = degradation_operators_.size();
+  CHECK_GT(num_operators, 0)
+      << "Cannot build a model matrix with no degradation operators.";
+
+  util::SparseMatrix model_matrix =
+      degradation_operators_[0]->GetSparseOperatorMatrix(image_size, index);
+  for (int i = 1; i < num_operators; ++i) {
+    const util::SparseMatrix next_matrix =
+        degradation_operators_[i]->GetSparseOperatorMatrix(image_size, index);
+    model_matrix = next_matrix.Multiply(model_matrix);
+  }
+  return model_matrix;
+}
+
+int ImageModel::ApplyOperatorToImage(
+    const int operator_index,
+    const ImageData& image_data,
+    const int index,
+    ImageData* degraded_image) const {
+
+  const DegradationOperator& degradation_operator =
+      *degradation_operators_[operator_index];
+  const int next_index = operator_index + 1;
+  if (next_index < degradation_operators_.size()) {
+    const int decimation_scale =
+        degradation_operators_[next_index]->GetDecimationScale();
+    if (decimation_scale > 0 && degradation_operator.ApplyToImageAndDecimate(
+        image_data, index, decimation_scale, degraded_image)) {
+      return 2;
+    }
+  }
+  if (&image_data == degraded_image) {
+    degradation_operator.ApplyToImage(degraded_image, index);
+  } else {
+    degradation_operator.ApplyToImageOutOfPlace(
+        image_data, index, degraded_image);
+  }
+  return 1;
+}
+
+bool ImageModel::IsCompilable() const {
+  if (degradation_operators_.empty()) {
+    return false;
+  }
+  for (const auto& degradation_operator : degradation_operators_) {
+    if (!degradation_operator->HasSparseOperatorMatrix()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+CompiledImageModel ImageModel::Compile(
+    const cv::Size& image_size,
+    const int num_images,
+    const bool compute_normal_matrix) const {
+
+  CHECK(IsCompilable())
+      << "Every operator must have a sparse matrix to compile the model.";
+  CHECK_GT(num_images, 0) << "Cannot compile the model for 0 images.";
+
+  std::vector<util::SparseMatrix> frame_matrices;
+  frame_matrices.reserve(num_images);
+  for (int index = 0; index < num_images; ++index) {
+    frame_matrices.push_back(GetSparseModelMatrix(image_size, index));
+  }
+  const cv::Size low_res_image_size(
+      image_size.width / downsampling_scale_,
+      image_size.height / downsampling_scale_);
+  CompiledImageModel compiled_image_model(
+      image_size, low_res_image_size, std::move(frame_matrices));
+  if (compute_normal_matrix) {
+    compiled_image_model.ComputeNormalMatrix();
+  }
+  return compiled_image_model;
+}
+
 }  // namespace super_resolution
@@ -9,13 +9,17 @@
 #ifndef SRC_IMAGE_MODEL_IMAGE_MODEL_H_
 #define SRC_IMAGE_MODEL_IMAGE_MODEL_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "image/image_data.h"
+#include "image_model/compiled_image_model.h"
 #include "image_model/degradation_operator.h"
 #include "motion/motion_shift.h"
+#include "motion/warp_field.h"
+#include "util/sparse_matrix.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -27,20 +31,67 @@ struct ImageModelParameters {
   // Downsampling (D).
   int scale = 2;
 
+  // If true, each LR pixel is the mean of its scale x scale patch of HR
+  // pixels (see AreaDownsamplingModule) instead of the top-left pixel of the
+  // patch. This models the integration over the sensor pixel area (a box
+  // PSF) at a cost that does not depend on the scale, and can be combined
+  // with the blur for the optics.
+  bool use_area_downsampling = false;
+
   // Blur (B). Keep either values at 0 to not include blur.
   int blur_radius = 0;
   double blur_sigma = 0.0;
 
+  // Band-dependent blur. If not 0, the blur sigma of band b is
+  // blur_sigma + blur_sigma_per_band * b, and the blur is applied by a
+  // SpectralBlurModule that shares one kernel between every group of
+  // blur_band_group_size consecutive bands. This cannot be combined with the
+  // Fourier blur.
+  double blur_sigma_per_band = 0.0;
+  int blur_band_group_size = 1;
+
   // Motion (M). Set the file path of a motion sequence path to load it from a
   // file, or set the motion shift sequence. Either can be used to make a
   // motion operator.
   std::string motion_sequence_path = "";
   MotionShiftSequence motion_sequence;
 
+  // General motion (M) that is not a translation, e.g. homographies or dense
+  // flow fields (see WarpField). Set the file path of a homography sequence
+  // to load it from a file (see WarpFieldSequence::LoadHomographiesFromFile()),
+  // or set the warp sequence. The warp is applied by a WarpModule instead of
+  // the MotionModule, so it cannot be combined with a motion sequence or with
+  // the Fourier blur.
+  std::string warp_sequence_path = "";
+  WarpFieldSequence warp_sequence;
+
+  // Observation weights (W). If not empty, the residual of frame k is
+  // weighted by observation_weights[k] (see ObservationWeightModule), and the
+  // observations must be scaled by the square roots of their weights. This is
+  // set for merged observations (see GroupObservationsByPhase()).
+  std::vector<double> observation_weights;
+
   // Noise. Set to a positive value to include noise. This is just for
   // generating artificial data. Do not add noise for modeling a forward image
   // model in super-resolution.
   double noise_sigma = 0.0;
+
+  // The seed of the noise. The noise of every frame (and channel) is drawn
+  // from its own random stream derived from the seed and the frame index, so
+  // the frames are reproducible and can be generated in any order.
+  uint64_t noise_seed = 0;
+
+  // If true, the blur is applied in the Fourier domain with the
+  // FourierBlurModule, and the motion is fused into it as a phase ramp
+  // instead of being applied by a separate MotionModule. This is faster for
+  // large blur kernels. Sub-pixel motion is then interpolated with sinc
+  // instead of bilinear interpolation.
+  bool use_fourier_blur = false;
+
+  // The number of threads used by operators that process an image in
+  // parallel (the blur and the motion). Set to 0 to use all available
+  // hardware threads.
+  int num_threads = 1;
 };
 
 class ImageModel {
@@ -69,6 +120,45 @@ class ImageModel {
   void AddDegradationOperator(
       const std::shared_ptr<DegradationOperator> degradation_operator);
 
+  // Returns the model with the motion of a new frame, which gets the next
+  // frame index, appended to the operators that apply the motion (see
+  // DegradationOperator::CreateWithMotionShift()). All other operators are
+  // shared with this model, which is not changed. This extends the model for
+  // frames that arrive after it was created, e.g. during a live capture. A
+  // model without a motion operator only accepts zero shifts, and the model
+  // must be able to add frames (see CanAddFrames()).
+  ImageModel CreateWithMotionShift(const MotionShift& motion_shift) const;
+
+  // Returns false if any operator is given for a fixed set of frames (e.g.
+  // warps or observation weights), so the model cannot be extended by new
+  // frames (see DegradationOperator::CanAddFrames()).
+  bool CanAddFrames() const;
+
+  // Returns the model that degrades HR images of half the resolution (both
+  // sides halved and rounded up) to the same LR observations, built from the
+  // coarse versions of the operators (see
+  // DegradationOperator::CreateCoarseOperator()). This approximates applying
+  // this model to the bilinear interpolation of the coarse image, and is
+  // used to rediscretize the data term on the coarse grids of the multigrid
+  // solver. Returns null if the downsampling scale is odd or if any operator
+  // cannot be scaled down.
+  std::unique_ptr<ImageModel> CreateCoarseImageModel() const;
+
+  // Returns the model for images whose channel c is the band band_offset + c
+  // of the images that this model applies to, e.g. for a channel split or a
+  // block of bands solved on its own. Operators that depend on the band are
+  // replaced by their offset versions (see
+  // DegradationOperator::CreateBandOffsetOperator()), and all others are
+  // shared with this model.
+  ImageModel CreateBandOffsetImageModel(const int band_offset) const;
+
+  // Returns the band of the first channel of the images that this model
+  // applies to (see CreateBandOffsetImageModel()). This is 0 unless the model
+  // was offset.
+  int GetBandOffset() const {
+    return band_offset_;
+  }
+
   // Apply this forward model to the given image at the given index in the
   // multiframe sequence. The degraded image is returned as a new image, with
   // the original ImageData being unaffected.
@@ -78,6 +168,18 @@ class ImageModel {
   // ImageData instead of returning a modified copy.
   void ApplyToImage(ImageData* image_data, const int index) const;
 
+  // Same as the above ApplyToImage, but writes the degraded image into the
+  // given degraded_image, which must already have the same size, number of
+  // channels and precision as the input image. The first operator reads the
+  // input directly (see DegradationOperator::ApplyToImageOutOfPlace()), so
+  // the input is never copied. This allows the input to be a read-only view
+  // of external data (see the ImageData wrapping constructors), and the
+  // degraded image to be a reused buffer.
+  void ApplyToImage(
+      const ImageData& image_data,
+      const int index,
+      ImageData* degraded_image) const;
+
   // Applies the transpose of the operators. For example, if the image model is
   // defined on as DBM, then the transpose is defined as M'B'D'. Operator
   // transpose implementations must be defined in every DegradationOperator.
@@ -104,18 +206,58 @@ class ImageModel {
   cv::Mat GetModelMatrix(
       const cv::Size& image_size, const int index) const;
 
+  // Same as GetModelMatrix(), but composes the sparse (CSR) operator matrices
+  // (see DegradationOperator::GetSparseOperatorMatrix()). This scales to
+  // realistic image sizes, e.g. for validating solvers against the exact
+  // normal equations A'Ax = A'y.
+  util::SparseMatrix GetSparseModelMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  // Returns true if every operator of the model has a direct sparse matrix
+  // form (see DegradationOperator::HasSparseOperatorMatrix()), so that the
+  // model can be compiled.
+  bool IsCompilable() const;
+
+  // Precomputes the per-frame model matrices (see GetSparseModelMatrix())
+  // for HR images of the given size and frame indices 0 to num_images - 1.
+  // The compiled model replays the whole operator chain of a frame in a
+  // single sparse pass, which is faster than applying the operators one by
+  // one when the same model is applied many times, e.g. in every iteration
+  // of a solver. The model must be compilable (see IsCompilable()).
+  //
+  // If compute_normal_matrix is true, the sum of A_k' A_k over all frames is
+  // also precomputed (see CompiledImageModel::ComputeNormalMatrix()).
+  CompiledImageModel Compile(
+      const cv::Size& image_size,
+      const int num_images,
+      const bool compute_normal_matrix = false) const;
+
   // Returns the downsampling scale.
   int GetDownsamplingScale() const {
     return downsampling_scale_;
   }
 
  private:
+  // Applies the operator at operator_index to the given image and writes the
+  // result into degraded_image, which may be the same image. If the next
+  // operator is a decimation that the operator can be fused with (see
+  // DegradationOperator::ApplyToImageAndDecimate()), both are applied at once.
+  // Returns the number of operators that were applied (1 or 2).
+  int ApplyOperatorToImage(
+      const int operator_index,
+      const ImageData& image_data,
+      const int index,
+      ImageData* degraded_image) const;
+
   // An ordered list of degradation operators, to be applied in this order. We
   // keep pointers because the DegradationOperator class is abstract.
   std::vector<std::shared_ptr<DegradationOperator>> degradation_operators_;
 
   // The ImageModel keeps track of the downsampling scale factor.
   const int downsampling_scale_;
+
+  // The band of the first image channel.
+  int band_offset_ = 0;
 };
 
 }  // namespace super_resolution
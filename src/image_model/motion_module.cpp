@@ -2,52 +2,323 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "image/image_data.h"
 #include "motion/motion_shift.h"
 #include "util/matrix_util.h"
+#include "util/profiler.h"
+#include "util/sparse_matrix.h"
+#include "util/thread_pool.h"
 
 #include "opencv2/core/core.hpp"
-#include "opencv2/imgproc/imgproc.hpp"
 
 #include "glog/logging.h"
 
 namespace super_resolution {
 namespace {
 
-void ApplyWarpKernel(const cv::Mat& warp_kernel, ImageData* image_data) {
-  const cv::Size image_size = image_data->GetImageSize();
-  int num_image_channels = image_data->GetNumChannels();
-  for (int i = 0; i < num_image_channels; ++i) {
-    cv::Mat channel_image = image_data->GetChannelImage(i);
-    cv::warpAffine(channel_image, channel_image, warp_kernel, image_size);
+// Returns true if the motion shift moves the image by a whole number of
+// pixels in both directions, in which case no interpolation is needed.
+bool IsIntegralShift(const double dx, const double dy) {
+  return dx == std::floor(dx) && dy == std::floor(dy);
+}
+
+// Shifts the source channel by the integral offset (dx, dy) into the shifted
+// channel, i.e. shifted(y, x) = source(y - dy, x - dx), with zeros where the
+// source is outside of the image. This is exactly what the bilinear
+// interpolation computes for integral shifts, but only moves memory. The
+// channels may be the same Mat, in which case the rows are visited in an order
+// that never overwrites a source row before it has been moved.
+template <typename PixelType>
+void ShiftChannel(
+    const cv::Mat& source, const int dx, const int dy, cv::Mat* shifted) {
+
+  const int width = source.cols;
+  const int height = source.rows;
+  // The shifted columns [col_start, col_end) come from inside the source.
+  const int col_start = std::min(std::max(dx, 0), width);
+  const int col_end = std::max(std::min(width + dx, width), col_start);
+  const auto shift_row = [&](const int row) {
+    PixelType* shifted_row = shifted->ptr<PixelType>(row);
+    const int source_row = row - dy;
+    if (source_row < 0 || source_row >= height || col_start == col_end) {
+      std::fill(shifted_row, shifted_row + width, PixelType(0));
+      return;
+    }
+    std::memmove(
+        shifted_row + col_start,
+        source.ptr<PixelType>(source_row) + (col_start - dx),
+        (col_end - col_start) * sizeof(PixelType));
+    std::fill(shifted_row, shifted_row + col_start, PixelType(0));
+    std::fill(shifted_row + col_end, shifted_row + width, PixelType(0));
+  };
+  if (dy > 0) {
+    for (int row = height - 1; row >= 0; --row) {
+      shift_row(row);
+    }
+  } else {
+    for (int row = 0; row < height; ++row) {
+      shift_row(row);
+    }
+  }
+}
+
+// Same as ShiftChannel() followed by keeping the top-left pixel of every
+// scale x scale patch, but only reads the source pixels that are kept. The
+// decimated channel must already have the LR size.
+template <typename PixelType>
+void ShiftAndDecimateChannel(
+    const cv::Mat& source,
+    const int dx,
+    const int dy,
+    const int scale,
+    cv::Mat* decimated) {
+
+  for (int row = 0; row < decimated->rows; ++row) {
+    PixelType* decimated_row = decimated->ptr<PixelType>(row);
+    const int source_row = row * scale - dy;
+    if (source_row < 0 || source_row >= source.rows) {
+      std::fill(decimated_row, decimated_row + decimated->cols, PixelType(0));
+      continue;
+    }
+    const PixelType* source_row_data = source.ptr<PixelType>(source_row);
+    for (int col = 0; col < decimated->cols; ++col) {
+      const int source_col = col * scale - dx;
+      decimated_row[col] = (source_col >= 0 && source_col < source.cols) ?
+          source_row_data[source_col] : PixelType(0);
+    }
+  }
+}
+
+// Computes the rows [row_begin, row_end) of the interpolated channel from the
+// bilinear taps of a shift: pixel (row, col) is the sum of
+// weights[i][j] * source(row + row_offset + i, col + col_offset + j) with
+// zeros outside of the image. If transpose is true, the exact adjoint is
+// computed instead, which scatters every source pixel back to the pixels that
+// sampled it. It is evaluated as the equivalent gather with the negated
+// offsets, so each output row only depends on the source and disjoint row
+// ranges can be computed in parallel. The channels must not be the same Mat.
+template <typename PixelType>
+void InterpolateChannelRows(
+    const cv::Mat& source,
+    const int row_offset,
+    const int col_offset,
+    const double weights[2][2],
+    const bool transpose,
+    const int row_begin,
+    const int row_end,
+    cv::Mat* interpolated) {
+
+  const int width = source.cols;
+  const int height = source.rows;
+  for (int row = row_begin; row < row_end; ++row) {
+    PixelType* interpolated_row = interpolated->ptr<PixelType>(row);
+    std::fill(interpolated_row, interpolated_row + width, PixelType(0));
+    for (int i = 0; i < 2; ++i) {
+      const int sample_row =
+          transpose ? row - row_offset - i : row + row_offset + i;
+      if (sample_row < 0 || sample_row >= height) {
+        continue;
+      }
+      const PixelType* source_row = source.ptr<PixelType>(sample_row);
+      for (int j = 0; j < 2; ++j) {
+        const PixelType weight = static_cast<PixelType>(weights[i][j]);
+        if (weight == PixelType(0)) {
+          continue;
+        }
+        // Columns [col_start, col_end) sample inside the source.
+        const int col_step = transpose ? -col_offset - j : col_offset + j;
+        const int col_start = std::min(std::max(-col_step, 0), width);
+        const int col_end = std::max(std::min(width - col_step, width), 0);
+        for (int col = col_start; col < col_end; ++col) {
+          interpolated_row[col] += weight * source_row[col + col_step];
+        }
+      }
+    }
   }
 }
 
 }  // namespace
 
+MotionModule::MotionModule(const MotionShiftSequence motion_shift_sequence)
+    : motion_shift_sequence_(motion_shift_sequence) {
+
+  const int num_motion_shifts = motion_shift_sequence_.GetNumMotionShifts();
+  frame_taps_.reserve(num_motion_shifts);
+  for (int index = 0; index < num_motion_shifts; ++index) {
+    frame_taps_.push_back(GetBilinearTaps(motion_shift_sequence_[index]));
+  }
+}
+
+std::shared_ptr<DegradationOperator> MotionModule::CreateWithMotionShift(
+    const MotionShift& motion_shift) const {
+
+  std::shared_ptr<MotionModule> extended_operator(new MotionModule(*this));
+  extended_operator->motion_shift_sequence_.AddMotionShift(motion_shift);
+  extended_operator->frame_taps_.push_back(GetBilinearTaps(motion_shift));
+  return extended_operator;
+}
+
+std::shared_ptr<DegradationOperator> MotionModule::CreateCoarseOperator()
+    const {
+
+  MotionShiftSequence coarse_motion_shift_sequence;
+  const int num_motion_shifts = motion_shift_sequence_.GetNumMotionShifts();
+  for (int index = 0; index < num_motion_shifts; ++index) {
+    const MotionShift& motion_shift = motion_shift_sequence_[index];
+    coarse_motion_shift_sequence.AddMotionShift(
+        MotionShift(motion_shift.dx / 2.0, motion_shift.dy / 2.0));
+  }
+  std::shared_ptr<MotionModule> coarse_operator(
+      new MotionModule(coarse_motion_shift_sequence));
+  coarse_operator->SetNumThreads(num_threads_);
+  return coarse_operator;
+}
+
+void MotionModule::SetNumThreads(const int num_threads) {
+  num_threads_ = util::GetNumThreadsToUse(num_threads);
+  thread_pool_.reset();
+  if (num_threads_ > 1) {
+    // The calling thread also interpolates rows, so it is not included.
+    thread_pool_.reset(new util::ThreadPool(num_threads_ - 1));
+  }
+}
+
+void MotionModule::ApplyShift(
+    const ImageData& image_data,
+    const int index,
+    const bool transpose,
+    ImageData* shifted_image) const {
+
+  // Checks that the frame index is in range.
+  motion_shift_sequence_.GetMotionShift(index);
+  const BilinearTaps& taps = frame_taps_[index];
+  const bool is_single_precision =
+      image_data.GetPrecision() == SINGLE_PRECISION;
+  const int num_image_channels = image_data.GetNumChannels();
+  if (taps.is_integral) {
+    // The transpose of an integral shift is the opposite shift.
+    const int dx = transpose ? taps.col_offset : -taps.col_offset;
+    const int dy = transpose ? taps.row_offset : -taps.row_offset;
+    for (int i = 0; i < num_image_channels; ++i) {
+      const cv::Mat channel = image_data.GetChannelImage(i);
+      cv::Mat shifted_channel = shifted_image->GetChannelImage(i);
+      if (is_single_precision) {
+        ShiftChannel<float>(channel, dx, dy, &shifted_channel);
+      } else {
+        ShiftChannel<double>(channel, dx, dy, &shifted_channel);
+      }
+    }
+    return;
+  }
+
+  const bool in_place = (&image_data == shifted_image);
+  const int height = image_data.GetImageSize().height;
+  const int num_row_blocks =
+      (thread_pool_ != nullptr) ? std::min(num_threads_, height) : 1;
+  for (int i = 0; i < num_image_channels; ++i) {
+    // Interpolation reads neighboring rows, so in-place shifts read a copy.
+    const cv::Mat channel = in_place ?
+        image_data.GetChannelImage(i).clone() : image_data.GetChannelImage(i);
+    cv::Mat shifted_channel = shifted_image->GetChannelImage(i);
+    const auto interpolate_rows = [&](const int block) {
+      const int row_begin = block * height / num_row_blocks;
+      const int row_end = (block + 1) * height / num_row_blocks;
+      if (is_single_precision) {
+        InterpolateChannelRows<float>(
+            channel, taps.row_offset, taps.col_offset, taps.weights,
+            transpose, row_begin, row_end, &shifted_channel);
+      } else {
+        InterpolateChannelRows<double>(
+            channel, taps.row_offset, taps.col_offset, taps.weights,
+            transpose, row_begin, row_end, &shifted_channel);
+      }
+    };
+    if (num_row_blocks > 1) {
+      thread_pool_->ParallelFor(num_row_blocks, interpolate_rows);
+    } else {
+      interpolate_rows(0);
+    }
+  }
+}
+
 void MotionModule::ApplyToImage(ImageData* image_data, const int index) const {
+  PROFILE_SCOPE("MotionModule::ApplyToImage");
   CHECK_NOTNULL(image_data);
 
+  ApplyShift(*image_data, index, false, image_data);
+}
+
+void MotionModule::ApplyToImageOutOfPlace(
+    const ImageData& image_data,
+    const int index,
+    ImageData* degraded_image) const {
+
+  PROFILE_SCOPE("MotionModule::ApplyToImage");
+
+  CHECK_NOTNULL(degraded_image);
+  CheckOutOfPlaceImages(image_data, *degraded_image);
+
+  ApplyShift(image_data, index, false, degraded_image);
+}
+
+bool MotionModule::ApplyToImageAndDecimate(
+    const ImageData& image_data,
+    const int index,
+    const int scale,
+    ImageData* decimated_image) const {
+
+  PROFILE_SCOPE("MotionModule::ApplyToImageAndDecimate");
+
+  CHECK_NOTNULL(decimated_image);
+  CHECK_GE(scale, 1);
+
+  // Only integral shifts keep the decimated pixels on the HR grid, and the
+  // decimation only keeps the top-left pixel of every patch if the image
+  // divides evenly into patches.
   const MotionShift motion_shift =
       motion_shift_sequence_.GetMotionShift(index);
-  const cv::Mat shift_kernel = (cv::Mat_<double>(2, 3)
-      << 1, 0, motion_shift.dx,
-         0, 1, motion_shift.dy);
-  ApplyWarpKernel(shift_kernel, image_data);
+  const cv::Size image_size = image_data.GetImageSize();
+  if (!IsIntegralShift(motion_shift.dx, motion_shift.dy) ||
+      image_size.width % scale != 0 || image_size.height % scale != 0) {
+    return false;
+  }
+
+  const int dx = static_cast<int>(motion_shift.dx);
+  const int dy = static_cast<int>(motion_shift.dy);
+  const int num_image_channels = image_data.GetNumChannels();
+  ImageData result(
+      cv::Size(image_size.width / scale, image_size.height / scale),
+      num_image_channels,
+      image_data.GetPrecision());
+  for (int i = 0; i < num_image_channels; ++i) {
+    const cv::Mat channel = image_data.GetChannelImage(i);
+    cv::Mat decimated_channel = result.GetChannelImage(i);
+    if (image_data.GetPrecision() == SINGLE_PRECISION) {
+      ShiftAndDecimateChannel<float>(
+          channel, dx, dy, scale, &decimated_channel);
+    } else {
+      ShiftAndDecimateChannel<double>(
+          channel, dx, dy, scale, &decimated_channel);
+    }
+  }
+  *decimated_image = std::move(result);
+  return true;
 }
 
 void MotionModule::ApplyTransposeToImage(
     ImageData* image_data, const int index) const {
 
+  PROFILE_SCOPE("MotionModule::ApplyTransposeToImage");
+
   CHECK_NOTNULL(image_data);
 
-  const MotionShift motion_shift =
-      motion_shift_sequence_.GetMotionShift(index);
-  const cv::Mat reverse_shift_kernel = (cv::Mat_<double>(2, 3)
-      << 1, 0, -motion_shift.dx,
-         0, 1, -motion_shift.dy);
-  ApplyWarpKernel(reverse_shift_kernel, image_data);
+  ApplyShift(*image_data, index, true, image_data);
 }
 
 cv::Mat MotionModule::GetOperatorMatrix(
@@ -72,4 +343,71 @@ cv::Mat MotionModule::GetOperatorMatrix(
   return motion_matrix;
 }
 
+util::SparseMatrix MotionModule::GetSparseOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  // A shift by (dx, dy) samples the image at (x - dx, y - dy) with bilinear
+  // interpolation and zeros outside of the image, as in ApplyToImage().
+  // Integer shifts have a single entry per row.
+  const MotionShift motion_shift = motion_shift_sequence_[index];
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size.width) * image_size.height;
+  std::vector<util::SparseMatrixEntry> entries;
+  entries.reserve(num_pixels * 4);
+  for (int row = 0; row < image_size.height; ++row) {
+    const double source_row = row - motion_shift.dy;
+    const int top_row = static_cast<int>(std::floor(source_row));
+    const double row_weight = source_row - top_row;
+    for (int col = 0; col < image_size.width; ++col) {
+      const double source_col = col - motion_shift.dx;
+      const int left_col = static_cast<int>(std::floor(source_col));
+      const double col_weight = source_col - left_col;
+      const int64_t pixel_index =
+          static_cast<int64_t>(row) * image_size.width + col;
+      for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 2; ++j) {
+          const int sample_row = top_row + i;
+          const int sample_col = left_col + j;
+          const double weight =
+              (i == 0 ? 1.0 - row_weight : row_weight) *
+              (j == 0 ? 1.0 - col_weight : col_weight);
+          if (weight == 0.0 ||
+              sample_row < 0 || sample_row >= image_size.height ||
+              sample_col < 0 || sample_col >= image_size.width) {
+            continue;
+          }
+          entries.emplace_back(
+              pixel_index,
+              static_cast<int64_t>(sample_row) * image_size.width + sample_col,
+              weight);
+        }
+      }
+    }
+  }
+  return util::SparseMatrix(num_pixels, num_pixels, entries);
+}
+
+MotionModule::BilinearTaps MotionModule::GetBilinearTaps(
+    const MotionShift& motion_shift) {
+
+  BilinearTaps taps;
+  taps.is_integral = IsIntegralShift(motion_shift.dx, motion_shift.dy);
+  // Same sampling as GetSparseOperatorMatrix(): pixel (row, col) samples
+  // (row - dy, col - dx), which is the same fraction for every pixel.
+  const double source_row = -motion_shift.dy;
+  const double source_col = -motion_shift.dx;
+  taps.row_offset = static_cast<int>(std::floor(source_row));
+  taps.col_offset = static_cast<int>(std::floor(source_col));
+  const double row_weight = source_row - taps.row_offset;
+  const double col_weight = source_col - taps.col_offset;
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < 2; ++j) {
+      taps.weights[i][j] =
+          (i == 0 ? 1.0 - row_weight : row_weight) *
+          (j == 0 ? 1.0 - col_weight : col_weight);
+    }
+  }
+  return taps;
+}
+
 }  // namespace super_resolution
@@ -1,12 +1,21 @@
 // This motion degradation module simply applies a translational transformation
 // on each image in the frame sequence based on the given MotionShiftSequence.
+// Integral shifts are applied by moving memory instead of interpolating.
+// Sub-pixel shifts are interpolated bilinearly from taps that are precomputed
+// for every frame, and the transpose is the exact adjoint of that
+// interpolation (the same operator as GetSparseOperatorMatrix()).
 
 #ifndef SRC_IMAGE_MODEL_MOTION_MODULE_H_
 #define SRC_IMAGE_MODEL_MOTION_MODULE_H_
 
+#include <memory>
+#include <vector>
+
 #include "image/image_data.h"
 #include "image_model/degradation_operator.h"
 #include "motion/motion_shift.h"
+#include "util/sparse_matrix.h"
+#include "util/thread_pool.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -16,19 +25,80 @@ class MotionModule : public DegradationOperator {
  public:
   // The given MotionShiftSequence should provide motion information for each
   // image in the frame sequence.
-  explicit MotionModule(const MotionShiftSequence motion_shift_sequence)
-      : motion_shift_sequence_(motion_shift_sequence) {}
+  explicit MotionModule(const MotionShiftSequence motion_shift_sequence);
 
   virtual void ApplyToImage(ImageData* image_data, const int index) const;
 
+  virtual void ApplyToImageOutOfPlace(
+      const ImageData& image_data,
+      const int index,
+      ImageData* degraded_image) const;
+
+  // Integral shifts are fused with a following decimation, so that only the
+  // kept pixels are shifted.
+  virtual bool ApplyToImageAndDecimate(
+      const ImageData& image_data,
+      const int index,
+      const int scale,
+      ImageData* decimated_image) const;
+
   virtual void ApplyTransposeToImage(
       ImageData* image_data, const int index) const;
 
   virtual cv::Mat GetOperatorMatrix(
       const cv::Size& image_size, const int index) const;
 
+  virtual util::SparseMatrix GetSparseOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  virtual bool HasSparseOperatorMatrix() const {
+    return true;
+  }
+
+  // The copy shares the threads of this operator.
+  virtual std::shared_ptr<DegradationOperator> CreateWithMotionShift(
+      const MotionShift& motion_shift) const;
+
+  // The coarse operator shifts every frame by half the distance.
+  virtual std::shared_ptr<DegradationOperator> CreateCoarseOperator() const;
+
+  // Sets the number of threads used to interpolate sub-pixel shifts. The rows
+  // of every channel are split into one block per thread. Set to 0 to use all
+  // available hardware threads. By default, the rows are shifted serially.
+  void SetNumThreads(const int num_threads);
+
  private:
-  const MotionShiftSequence motion_shift_sequence_;
+  // The bilinear taps of the shift of a single frame. A translation samples
+  // every pixel at the same fractional offset, so pixel (row, col) is the sum
+  // of weights[i][j] * source(row + row_offset + i, col + col_offset + j).
+  struct BilinearTaps {
+    bool is_integral = true;
+    int row_offset = 0;
+    int col_offset = 0;
+    double weights[2][2] = {{1.0, 0.0}, {0.0, 0.0}};
+  };
+
+  // Returns the taps of the given motion shift.
+  static BilinearTaps GetBilinearTaps(const MotionShift& motion_shift);
+
+  // Shifts every channel of the given image by the motion of the given frame
+  // (or by its exact transpose) into the channels of the shifted image, which
+  // may be the same image.
+  void ApplyShift(
+      const ImageData& image_data,
+      const int index,
+      const bool transpose,
+      ImageData* shifted_image) const;
+
+  MotionShiftSequence motion_shift_sequence_;
+
+  // The taps of every frame, computed once when the frame's shift is given.
+  std::vector<BilinearTaps> frame_taps_;
+
+  // The number of threads used and the pool of additional threads. The pool
+  // is null if the rows are shifted serially.
+  int num_threads_ = 1;
+  std::shared_ptr<util::ThreadPool> thread_pool_;
 };
 
 }  // namespace super_resolution
@@ -0,0 +1,98 @@
+#include "image_model/observation_weight_module.h"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "image/image_data.h"
+#include "util/matrix_util.h"
+#include "util/profiler.h"
+#include "util/sparse_matrix.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+
+ObservationWeightModule::ObservationWeightModule(
+    const std::vector<double>& weights) {
+
+  scales_.reserve(weights.size());
+  for (const double weight : weights) {
+    CHECK_GT(weight, 0.0) << "Observation weights must be positive.";
+    scales_.push_back(std::sqrt(weight));
+  }
+}
+
+std::shared_ptr<DegradationOperator>
+ObservationWeightModule::CreateCoarseOperator() const {
+  return std::make_shared<ObservationWeightModule>(*this);
+}
+
+void ObservationWeightModule::ApplyToImage(
+    ImageData* image_data, const int index) const {
+
+  PROFILE_SCOPE("ObservationWeightModule::ApplyToImage");
+
+  CHECK_NOTNULL(image_data);
+  const double scale = GetScale(index);
+  if (scale != 1.0) {
+    image_data->MultiplyByScalar(scale);
+  }
+}
+
+void ObservationWeightModule::ApplyToImageOutOfPlace(
+    const ImageData& image_data,
+    const int index,
+    ImageData* degraded_image) const {
+
+  PROFILE_SCOPE("ObservationWeightModule::ApplyToImage");
+
+  CHECK_NOTNULL(degraded_image);
+  CheckOutOfPlaceImages(image_data, *degraded_image);
+  const double scale = GetScale(index);
+  for (int i = 0; i < image_data.GetNumChannels(); ++i) {
+    cv::Mat degraded_channel = degraded_image->GetChannelImage(i);
+    image_data.GetChannelImage(i).convertTo(
+        degraded_channel, degraded_channel.type(), scale);
+  }
+}
+
+void ObservationWeightModule::ApplyTransposeToImage(
+    ImageData* image_data, const int index) const {
+
+  ApplyToImage(image_data, index);
+}
+
+cv::Mat ObservationWeightModule::GetOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  const int num_pixels = image_size.width * image_size.height;
+  return cv::Mat::eye(num_pixels, num_pixels, util::kOpenCvMatrixType) *
+      GetScale(index);
+}
+
+util::SparseMatrix ObservationWeightModule::GetSparseOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size.width) * image_size.height;
+  const double scale = GetScale(index);
+  std::vector<util::SparseMatrixEntry> entries;
+  entries.reserve(num_pixels);
+  for (int64_t i = 0; i < num_pixels; ++i) {
+    entries.emplace_back(i, i, scale);
+  }
+  return util::SparseMatrix(num_pixels, num_pixels, entries);
+}
+
+double ObservationWeightModule::GetScale(const int index) const {
+  CHECK_GE(index, 0) << "Frame index is out of bounds.";
+  CHECK_LT(index, scales_.size())
+      << "No observation weight for frame " << index << ".";
+  return scales_[index];
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,68 @@
+// This module scales each frame by the square root of its observation weight,
+// so that the squared residual of frame k in the data term is weighted by
+// w_k (if its observation is scaled the same way). This is used for merged
+// observations that stand in for several frames (see
+// GroupObservationsByPhase()). The scaling commutes with the other
+// operators, so the module is applied first, on the HR image.
+
+#ifndef SRC_IMAGE_MODEL_OBSERVATION_WEIGHT_MODULE_H_
+#define SRC_IMAGE_MODEL_OBSERVATION_WEIGHT_MODULE_H_
+
+#include <memory>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/degradation_operator.h"
+#include "util/sparse_matrix.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+class ObservationWeightModule : public DegradationOperator {
+ public:
+  // The weights are given per frame index and must all be positive.
+  explicit ObservationWeightModule(const std::vector<double>& weights);
+
+  virtual void ApplyToImage(ImageData* image_data, const int index) const;
+
+  // Scales the image while copying it.
+  virtual void ApplyToImageOutOfPlace(
+      const ImageData& image_data,
+      const int index,
+      ImageData* degraded_image) const;
+
+  // The operator is a scaled identity, so it is its own transpose.
+  virtual void ApplyTransposeToImage(
+      ImageData* image_data, const int index) const;
+
+  virtual cv::Mat GetOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  virtual util::SparseMatrix GetSparseOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  virtual bool HasSparseOperatorMatrix() const {
+    return true;
+  }
+
+  // The weights are given for a fixed set of frames.
+  virtual bool CanAddFrames() const {
+    return false;
+  }
+
+  // The weights do not depend on the resolution, so the coarse operator is a
+  // copy of this one.
+  virtual std::shared_ptr<DegradationOperator> CreateCoarseOperator() const;
+
+ private:
+  // Returns the square root of the weight of the given frame.
+  double GetScale(const int index) const;
+
+  // The square roots of the weights.
+  std::vector<double> scales_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_IMAGE_MODEL_OBSERVATION_WEIGHT_MODULE_H_
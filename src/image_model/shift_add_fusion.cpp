@@ -0,0 +1,365 @@
+#include "image_model/shift_add_fusion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/motion_module.h"
+#include "motion/motion_shift.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// High-resolution pixels with a smaller total weight than this did not get
+// any samples (up to rounding), and are filled in from the upsampled image.
+constexpr double kMinFusionWeight = 1.0e-6;
+
+// Returns ceil(numerator / denominator) for a positive denominator.
+int CeilDivide(const int numerator, const int denominator) {
+  if (numerator >= 0) {
+    return (numerator + denominator - 1) / denominator;
+  }
+  return -((-numerator) / denominator);
+}
+
+// Splits the samples of the given double precision image, which is shifted by
+// the given motion, onto the high-resolution grid. For every high-resolution
+// pixel that a sample lands on, add_weight(pixel_index, weight) is called
+// once, and add_sample(channel, pixel_index, weight, value) is called for
+// every channel.
+template <typename AddWeightFunction, typename AddSampleFunction>
+void SplatFrame(
+    const ImageData& low_res_image,
+    const MotionShift& motion_shift,
+    const int scale,
+    const cv::Size& high_res_size,
+    const AddWeightFunction& add_weight,
+    const AddSampleFunction& add_sample) {
+
+  // The image model samples LR pixel (x, y) from HR position
+  // (scale * x - dx, scale * y - dy). The shift is the same for every pixel,
+  // so is its split into an integral offset and the bilinear weights of the
+  // four HR pixels around the position.
+  const double offset_x = std::floor(-motion_shift.dx);
+  const double offset_y = std::floor(-motion_shift.dy);
+  const double fraction_x = -motion_shift.dx - offset_x;
+  const double fraction_y = -motion_shift.dy - offset_y;
+  const double corner_weights[2][2] = {
+    {(1.0 - fraction_y) * (1.0 - fraction_x), (1.0 - fraction_y) * fraction_x},
+    {fraction_y * (1.0 - fraction_x), fraction_y * fraction_x}
+  };
+
+  const cv::Size low_res_size = low_res_image.GetImageSize();
+  const int num_channels = low_res_image.GetNumChannels();
+  for (int corner_y = 0; corner_y < 2; ++corner_y) {
+    for (int corner_x = 0; corner_x < 2; ++corner_x) {
+      const double weight = corner_weights[corner_y][corner_x];
+      // Integral shifts only have one corner.
+      if (weight == 0.0) {
+        continue;
+      }
+      // The LR pixels whose corner lands inside of the HR image.
+      const int col_offset = static_cast<int>(offset_x) + corner_x;
+      const int row_offset = static_cast<int>(offset_y) + corner_y;
+      const int first_col = std::max(0, CeilDivide(-col_offset, scale));
+      const int end_col = std::min(
+          low_res_size.width,
+          CeilDivide(high_res_size.width - col_offset, scale));
+      const int first_row = std::max(0, CeilDivide(-row_offset, scale));
+      const int end_row = std::min(
+          low_res_size.height,
+          CeilDivide(high_res_size.height - row_offset, scale));
+      if (first_col >= end_col || first_row >= end_row) {
+        continue;
+      }
+
+      for (int row = first_row; row < end_row; ++row) {
+        const int64_t high_res_row_start =
+            static_cast<int64_t>(scale * row + row_offset) *
+            high_res_size.width + col_offset;
+        for (int col = first_col; col < end_col; ++col) {
+          add_weight(high_res_row_start + scale * col, weight);
+        }
+      }
+      for (int channel = 0; channel < num_channels; ++channel) {
+        const double* channel_data = low_res_image.GetChannelData(channel);
+        for (int row = first_row; row < end_row; ++row) {
+          const double* low_res_row = channel_data + row * low_res_size.width;
+          const int64_t high_res_row_start =
+              static_cast<int64_t>(scale * row + row_offset) *
+              high_res_size.width + col_offset;
+          for (int col = first_col; col < end_col; ++col) {
+            add_sample(
+                channel, high_res_row_start + scale * col, weight,
+                low_res_row[col]);
+          }
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+
+StreamingShiftAddFusion::StreamingShiftAddFusion(
+    const cv::Size& low_res_size,
+    const int num_channels,
+    const ShiftAddFusionOptions& options)
+    : low_res_size_(low_res_size),
+      high_res_size_(
+          low_res_size.width * options.scale,
+          low_res_size.height * options.scale),
+      num_channels_(num_channels),
+      options_(options),
+      num_frames_(0) {
+
+  CHECK_GE(options_.scale, 1) << "The scale must be at least 1.";
+  CHECK_GT(num_channels_, 0) << "Cannot fuse empty images.";
+
+  const int64_t num_high_res_pixels =
+      static_cast<int64_t>(high_res_size_.width) * high_res_size_.height;
+  weights_.assign(num_high_res_pixels, 0.0);
+  if (options_.mode == SHIFT_ADD_MEAN) {
+    weighted_sums_.assign(num_channels_ * num_high_res_pixels, 0.0);
+  } else {
+    CHECK_GE(options_.num_histogram_bins, 1)
+        << "At least one histogram bin is required.";
+    CHECK_GT(options_.histogram_max_value, options_.histogram_min_value)
+        << "The histogram value range is empty.";
+    CHECK(options_.trim_fraction >= 0.0 && options_.trim_fraction < 0.5)
+        << "The trim fraction must be in [0, 0.5).";
+    const int64_t num_bins =
+        num_channels_ * num_high_res_pixels * options_.num_histogram_bins;
+    bin_weights_.assign(num_bins, 0.0f);
+    bin_weighted_sums_.assign(num_bins, 0.0f);
+  }
+}
+
+void StreamingShiftAddFusion::AddFrame(
+    const ImageData& low_res_image, const MotionShift& motion) {
+
+  CHECK_EQ(low_res_image.GetImageSize(), low_res_size_)
+      << "All frames must have the same size.";
+  CHECK_EQ(low_res_image.GetNumChannels(), num_channels_)
+      << "All frames must have the same number of channels.";
+
+  ImageData double_precision_image;
+  const ImageData* frame = &low_res_image;
+  if (low_res_image.GetPrecision() != DOUBLE_PRECISION) {
+    double_precision_image = low_res_image;
+    double_precision_image.SetPrecision(DOUBLE_PRECISION);
+    frame = &double_precision_image;
+  }
+
+  if (num_frames_ == 0) {
+    fallback_image_ = *frame;
+    fallback_image_.ResizeImage(high_res_size_, INTERPOLATE_LINEAR);
+    const MotionModule motion_module(MotionShiftSequence({motion}));
+    motion_module.ApplyToImage(&fallback_image_, 0);
+  }
+
+  const int64_t num_high_res_pixels = weights_.size();
+  double* weights = weights_.data();
+  const auto add_weight = [weights](
+      const int64_t pixel_index, const double weight) {
+    weights[pixel_index] += weight;
+  };
+  if (options_.mode == SHIFT_ADD_MEAN) {
+    double* weighted_sums = weighted_sums_.data();
+    SplatFrame(
+        *frame, motion, options_.scale, high_res_size_, add_weight,
+        [weighted_sums, num_high_res_pixels](
+            const int channel,
+            const int64_t pixel_index,
+            const double weight,
+            const double value) {
+          weighted_sums[channel * num_high_res_pixels + pixel_index] +=
+              weight * value;
+        });
+  } else {
+    const int num_bins = options_.num_histogram_bins;
+    const double min_value = options_.histogram_min_value;
+    const double bins_per_value =
+        num_bins / (options_.histogram_max_value - min_value);
+    float* bin_weights = bin_weights_.data();
+    float* bin_weighted_sums = bin_weighted_sums_.data();
+    SplatFrame(
+        *frame, motion, options_.scale, high_res_size_, add_weight,
+        [=](const int channel,
+            const int64_t pixel_index,
+            const double weight,
+            const double value) {
+          const int bin = std::min(
+              num_bins - 1,
+              std::max(0, static_cast<int>(
+                  std::floor((value - min_value) * bins_per_value))));
+          const int64_t bin_index =
+              (channel * num_high_res_pixels + pixel_index) * num_bins + bin;
+          bin_weights[bin_index] += weight;
+          bin_weighted_sums[bin_index] += weight * value;
+        });
+  }
+  num_frames_++;
+}
+
+void StreamingShiftAddFusion::Merge(const StreamingShiftAddFusion& other) {
+  CHECK_EQ(other.low_res_size_, low_res_size_)
+      << "Only fusions of the same size can be merged.";
+  CHECK_EQ(other.num_channels_, num_channels_)
+      << "Only fusions with the same number of channels can be merged.";
+  CHECK_EQ(other.options_.scale, options_.scale);
+  CHECK_EQ(other.options_.mode, options_.mode);
+  CHECK_EQ(other.bin_weights_.size(), bin_weights_.size());
+
+  if (num_frames_ == 0) {
+    fallback_image_ = other.fallback_image_;
+  }
+  for (int64_t i = 0; i < weights_.size(); ++i) {
+    weights_[i] += other.weights_[i];
+  }
+  for (int64_t i = 0; i < weighted_sums_.size(); ++i) {
+    weighted_sums_[i] += other.weighted_sums_[i];
+  }
+  for (int64_t i = 0; i < bin_weights_.size(); ++i) {
+    bin_weights_[i] += other.bin_weights_[i];
+    bin_weighted_sums_[i] += other.bin_weighted_sums_[i];
+  }
+  num_frames_ += other.num_frames_;
+}
+
+ImageData StreamingShiftAddFusion::GetFusedImage() const {
+  CHECK_GT(num_frames_, 0) << "No frames were added.";
+
+  const int64_t num_high_res_pixels = weights_.size();
+  ImageData fused_image(high_res_size_, num_channels_);
+  for (int channel = 0; channel < num_channels_; ++channel) {
+    const double* fallback_data = fallback_image_.GetChannelData(channel);
+    double* fused_data = fused_image.GetMutableChannelData(channel);
+    for (int64_t i = 0; i < num_high_res_pixels; ++i) {
+      if (weights_[i] < kMinFusionWeight) {
+        fused_data[i] = fallback_data[i];
+      } else if (options_.mode == SHIFT_ADD_MEAN) {
+        fused_data[i] =
+            weighted_sums_[channel * num_high_res_pixels + i] / weights_[i];
+      } else {
+        fused_data[i] = GetHistogramValue(channel, i);
+      }
+    }
+  }
+  return fused_image;
+}
+
+double StreamingShiftAddFusion::GetHistogramValue(
+    const int channel, const int64_t pixel_index) const {
+
+  const int num_bins = options_.num_histogram_bins;
+  const int64_t first_bin =
+      (channel * static_cast<int64_t>(weights_.size()) + pixel_index) *
+      num_bins;
+  const float* bin_weights = bin_weights_.data() + first_bin;
+  const float* bin_weighted_sums = bin_weighted_sums_.data() + first_bin;
+
+  // The quantiles are taken from the total of the (single precision) bins so
+  // that they are always reached.
+  double total_weight = 0.0;
+  for (int bin = 0; bin < num_bins; ++bin) {
+    total_weight += bin_weights[bin];
+  }
+
+  // The median is the mean of the bin where the cumulative weight reaches
+  // half of the total, and the trimmed mean is the mean of the weight between
+  // the two trim quantiles, where each bin contributes its mean.
+  const bool is_median = (options_.mode == SHIFT_ADD_MEDIAN);
+  const double lower_weight =
+      is_median ? 0.5 * total_weight : options_.trim_fraction * total_weight;
+  const double upper_weight = (1.0 - options_.trim_fraction) * total_weight;
+  double cumulative_weight = 0.0;
+  double kept_weighted_sum = 0.0;
+  double kept_weight = 0.0;
+  double last_bin_mean = 0.0;
+  for (int bin = 0; bin < num_bins; ++bin) {
+    const double bin_weight = bin_weights[bin];
+    if (bin_weight <= 0.0) {
+      continue;
+    }
+    const double bin_mean = bin_weighted_sums[bin] / bin_weight;
+    last_bin_mean = bin_mean;
+    const double bin_start = cumulative_weight;
+    cumulative_weight += bin_weight;
+    if (is_median) {
+      if (cumulative_weight >= lower_weight) {
+        return bin_mean;
+      }
+      continue;
+    }
+    const double overlap = std::min(cumulative_weight, upper_weight) -
+        std::max(bin_start, lower_weight);
+    if (overlap > 0.0) {
+      kept_weighted_sum += overlap * bin_mean;
+      kept_weight += overlap;
+    }
+  }
+  if (kept_weight > 0.0) {
+    return kept_weighted_sum / kept_weight;
+  }
+  return last_bin_mean;
+}
+
+ImageData ShiftAddFusion(
+    const std::vector<ImageData>& low_res_images,
+    const MotionShiftSequence& motion_shift_sequence,
+    const ShiftAddFusionOptions& options) {
+
+  CHECK(!low_res_images.empty()) << "At least one image is required.";
+  const int num_images = low_res_images.size();
+  const bool has_motion = motion_shift_sequence.GetNumMotionShifts() > 0;
+  if (has_motion) {
+    CHECK_GE(motion_shift_sequence.GetNumMotionShifts(), num_images)
+        << "Every image needs a motion shift.";
+  }
+  const cv::Size low_res_size = low_res_images[0].GetImageSize();
+  const int num_channels = low_res_images[0].GetNumChannels();
+
+  // Each group of consecutive frames is accumulated on its own, so the frames
+  // are always summed in the same order.
+  const int num_groups =
+      std::min(util::GetNumThreadsToUse(options.num_threads), num_images);
+  std::vector<std::unique_ptr<StreamingShiftAddFusion>> group_fusions(
+      num_groups);
+  const auto accumulate_group = [&](const int group) {
+    group_fusions[group].reset(new StreamingShiftAddFusion(
+        low_res_size, num_channels, options));
+    const int first_image =
+        static_cast<int64_t>(group) * num_images / num_groups;
+    const int end_image =
+        static_cast<int64_t>(group + 1) * num_images / num_groups;
+    for (int i = first_image; i < end_image; ++i) {
+      group_fusions[group]->AddFrame(
+          low_res_images[i],
+          has_motion ? motion_shift_sequence[i] : MotionShift(0, 0));
+    }
+  };
+  if (num_groups > 1) {
+    // The calling thread also accumulates a group.
+    util::ThreadPool thread_pool(num_groups - 1);
+    thread_pool.ParallelFor(num_groups, accumulate_group);
+  } else {
+    accumulate_group(0);
+  }
+
+  for (int group = 1; group < num_groups; ++group) {
+    group_fusions[0]->Merge(*group_fusions[group]);
+    group_fusions[group].reset();
+  }
+  return group_fusions[0]->GetFusedImage();
+}
+
+}  // namespace super_resolution
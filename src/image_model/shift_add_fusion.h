@@ -0,0 +1,138 @@
+// Shift-and-add fusion places the pixels of every low-resolution frame at
+// their motion-compensated positions on the high-resolution grid and combines
+// the samples that land on each high-resolution pixel, as explained in "An
+// Introduction to Super-Resolution Imaging (2012)". It inverts the motion and
+// downsampling of the ImageModel (but not the blur), which makes it a cheap
+// and much sharper initial estimate for the MAP solvers than upsampling a
+// single frame.
+//
+// The samples are averaged by default. For bursts with outliers (e.g. moving
+// objects or hot pixels), the median or a trimmed mean of the samples is much
+// more robust. These are estimated from a fixed number of histogram bins per
+// pixel, so frames can be streamed through a StreamingShiftAddFusion one at a
+// time with memory that does not depend on the number of frames.
+
+#ifndef SRC_IMAGE_MODEL_SHIFT_ADD_FUSION_H_
+#define SRC_IMAGE_MODEL_SHIFT_ADD_FUSION_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "image/image_data.h"
+#include "motion/motion_shift.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+// How the samples that land on each high-resolution pixel are combined.
+enum ShiftAddFusionMode {
+  SHIFT_ADD_MEAN,         // The weighted mean (exact).
+  SHIFT_ADD_MEDIAN,       // The weighted median (from the histogram).
+  SHIFT_ADD_TRIMMED_MEAN  // The weighted trimmed mean (from the histogram).
+};
+
+struct ShiftAddFusionOptions {
+  // The upsampling scale of the fused image.
+  int scale = 2;
+
+  // The number of threads used to accumulate the frames in ShiftAddFusion()
+  // (0 = all hardware threads). Each thread accumulates its own group of
+  // consecutive frames, and the groups are added up in order, so the result
+  // is deterministic and only differs by rounding between thread counts.
+  // Every thread needs its own accumulator, which is large for the histogram
+  // modes.
+  int num_threads = 1;
+
+  ShiftAddFusionMode mode = SHIFT_ADD_MEAN;
+
+  // The histogram of the median and trimmed mean modes, which splits the
+  // value range [histogram_min_value, histogram_max_value] into
+  // num_histogram_bins bins for every pixel of every channel. Each bin keeps
+  // the weight and the weighted sum of its samples, and the result is taken
+  // from the means of the bins, so the error is at most one bin width (and
+  // zero if the samples in a bin are equal). Values outside of the range are
+  // counted in the first or last bin.
+  int num_histogram_bins = 64;
+  double histogram_min_value = 0.0;
+  double histogram_max_value = 1.0;
+
+  // The fraction of the sample weight discarded at each end of the
+  // distribution by the trimmed mean mode. Must be in [0, 0.5).
+  double trim_fraction = 0.2;
+};
+
+// Accumulates the samples of low-resolution frames one at a time. The memory
+// used is fixed by the image size and the options.
+class StreamingShiftAddFusion {
+ public:
+  // All frames must have the given size and number of channels.
+  StreamingShiftAddFusion(
+      const cv::Size& low_res_size,
+      const int num_channels,
+      const ShiftAddFusionOptions& options = ShiftAddFusionOptions());
+
+  // Adds the samples of the given frame, which is shifted by the given
+  // motion of the image model (in high-resolution pixels). Every
+  // low-resolution pixel lands at a sub-pixel position and is split onto its
+  // four nearest high-resolution pixels with bilinear weights.
+  void AddFrame(const ImageData& low_res_image, const MotionShift& motion);
+
+  // Adds the samples accumulated by the other fusion, which must have the
+  // same size and options. The frames of this fusion are treated as the
+  // earlier ones.
+  void Merge(const StreamingShiftAddFusion& other);
+
+  // Returns the number of frames added so far (including merged frames).
+  int GetNumFrames() const {
+    return num_frames_;
+  }
+
+  // Returns the fused high-resolution image of scale times the frame size in
+  // double precision. Pixels that received no samples take the value of the
+  // bilinearly upsampled (and shifted) first frame. At least one frame must
+  // have been added.
+  ImageData GetFusedImage() const;
+
+ private:
+  // Returns the median or trimmed mean of the samples of the given pixel and
+  // channel from its histogram.
+  double GetHistogramValue(
+      const int channel, const int64_t pixel_index) const;
+
+  const cv::Size low_res_size_;
+  const cv::Size high_res_size_;
+  const int num_channels_;
+  const ShiftAddFusionOptions options_;
+
+  int num_frames_;
+
+  // The sum of the sample weights of every high-resolution pixel.
+  std::vector<double> weights_;
+
+  // The weighted sums of the samples in the mean mode, in
+  // [channel][row][col] order.
+  std::vector<double> weighted_sums_;
+
+  // The histograms in the median and trimmed mean modes, in
+  // [channel][row][col][bin] order. Single precision halves their size.
+  std::vector<float> bin_weights_;
+  std::vector<float> bin_weighted_sums_;
+
+  // The upsampled and shifted first frame, for the pixels without samples.
+  ImageData fallback_image_;
+};
+
+// Fuses the given low-resolution images into a high-resolution image of
+// scale times their size with a StreamingShiftAddFusion. The motion sequence
+// is the motion of the ImageModel (in high-resolution pixels), and may be
+// empty if the frames are not shifted. All images must have the same size and
+// number of channels. The result is in double precision.
+ImageData ShiftAddFusion(
+    const std::vector<ImageData>& low_res_images,
+    const MotionShiftSequence& motion_shift_sequence,
+    const ShiftAddFusionOptions& options = ShiftAddFusionOptions());
+
+}  // namespace super_resolution
+
+#endif  // SRC_IMAGE_MODEL_SHIFT_ADD_FUSION_H_
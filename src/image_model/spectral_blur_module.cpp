@@ -0,0 +1,215 @@
+#include "image_model/spectral_blur_module.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "image/image_data.h"
+#include "util/matrix_util.h"
+#include "util/profiler.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// The border mode of the blur convolution, which treats pixels outside of the
+// image as zeros and isolates the channels like the BlurModule.
+constexpr int kBlurBorderMode = cv::BORDER_CONSTANT | cv::BORDER_ISOLATED;
+
+}  // namespace
+
+SpectralBlurModule::SpectralBlurModule(
+    const int blur_radius,
+    const double sigma,
+    const double sigma_per_band,
+    const int bands_per_group)
+    : blur_radius_(blur_radius),
+      sigma_(sigma),
+      sigma_per_band_(sigma_per_band),
+      bands_per_group_(bands_per_group),
+      psf_cache_(new PSFCache()) {
+
+  CHECK_GE(blur_radius, 1);
+  CHECK(blur_radius % 2 == 1) << "Blur radius must be an odd number.";
+  CHECK_GT(sigma, 0.0);
+  CHECK_GE(bands_per_group, 1);
+}
+
+SpectralBlurModule::SpectralBlurModule(
+    const std::vector<cv::Mat>& group_kernels, const int bands_per_group)
+    : blur_radius_(0),
+      sigma_(0.0),
+      sigma_per_band_(0.0),
+      bands_per_group_(bands_per_group),
+      num_groups_(group_kernels.size()),
+      psf_cache_(new PSFCache()) {
+
+  CHECK(!group_kernels.empty()) << "The PSF table has no kernels.";
+  CHECK_GE(bands_per_group, 1);
+  for (int group = 0; group < num_groups_; ++group) {
+    const cv::Mat& kernel = group_kernels[group];
+    CHECK(kernel.rows % 2 == 1 && kernel.cols % 2 == 1)
+        << "The PSF kernels must have odd dimensions.";
+    cv::Mat double_kernel;
+    kernel.convertTo(double_kernel, util::kOpenCvMatrixType);
+    psf_cache_->group_psfs[group] = CreateGroupPSF(double_kernel);
+  }
+}
+
+void SpectralBlurModule::ApplyToImage(
+    ImageData* image_data, const int index) const {
+
+  PROFILE_SCOPE("SpectralBlurModule::ApplyToImage");
+  CHECK_NOTNULL(image_data);
+  ApplyKernels(*image_data, false, image_data);
+}
+
+void SpectralBlurModule::ApplyToImageOutOfPlace(
+    const ImageData& image_data,
+    const int index,
+    ImageData* degraded_image) const {
+
+  PROFILE_SCOPE("SpectralBlurModule::ApplyToImage");
+
+  CHECK_NOTNULL(degraded_image);
+  CheckOutOfPlaceImages(image_data, *degraded_image);
+  ApplyKernels(image_data, false, degraded_image);
+}
+
+void SpectralBlurModule::ApplyTransposeToImage(
+    ImageData* image_data, const int index) const {
+
+  PROFILE_SCOPE("SpectralBlurModule::ApplyTransposeToImage");
+
+  CHECK_NOTNULL(image_data);
+  ApplyKernels(*image_data, true, image_data);
+}
+
+cv::Mat SpectralBlurModule::GetOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  CHECK(IsBandIndependent())
+      << "The PSF depends on the band, so there is no single channel "
+      << "operator matrix.";
+  return ConvertKernelToOperatorMatrix(GetBandKernel(first_band_), image_size);
+}
+
+std::shared_ptr<DegradationOperator>
+SpectralBlurModule::CreateBandOffsetOperator(const int band_offset) const {
+  CHECK_GE(first_band_ + band_offset, 0)
+      << "The first band of the offset operator cannot be negative.";
+  std::shared_ptr<SpectralBlurModule> offset_module(
+      new SpectralBlurModule(*this));
+  offset_module->first_band_ = first_band_ + band_offset;
+  return offset_module;
+}
+
+void SpectralBlurModule::SetNumThreads(const int num_threads) {
+  num_threads_ = util::GetNumThreadsToUse(num_threads);
+  thread_pool_.reset();
+  if (num_threads_ > 1) {
+    // The calling thread also blurs channels, so it is not included.
+    thread_pool_.reset(new util::ThreadPool(num_threads_ - 1));
+  }
+}
+
+int SpectralBlurModule::GetBandGroup(const int band) const {
+  CHECK_GE(band, 0);
+  const int group = band / bands_per_group_;
+  return (num_groups_ > 0) ? std::min(group, num_groups_ - 1) : group;
+}
+
+cv::Mat SpectralBlurModule::GetBandKernel(const int band) const {
+  return GetGroupPSF(GetBandGroup(band))->kernel;
+}
+
+std::shared_ptr<const SpectralBlurModule::GroupPSF>
+SpectralBlurModule::CreateGroupPSF(const cv::Mat& kernel) {
+  std::shared_ptr<GroupPSF> psf(new GroupPSF());
+  psf->kernel = kernel;
+  psf->is_separable = util::GetSeparableKernelFactors(
+      kernel, &psf->kernel_column, &psf->kernel_row);
+  return psf;
+}
+
+std::shared_ptr<const SpectralBlurModule::GroupPSF>
+SpectralBlurModule::GetGroupPSF(const int group) const {
+  std::lock_guard<std::mutex> lock(psf_cache_->mutex);
+  const auto cached_psf = psf_cache_->group_psfs.find(group);
+  if (cached_psf != psf_cache_->group_psfs.end()) {
+    return cached_psf->second;
+  }
+
+  // Only the Gaussian PSFs are created on demand. The sigma of the center
+  // band of the group is used for all of its bands.
+  CHECK_EQ(num_groups_, 0) << "Group " << group << " is not in the PSF table.";
+  const double center_band =
+      group * bands_per_group_ + 0.5 * (bands_per_group_ - 1);
+  const double sigma = sigma_ + sigma_per_band_ * center_band;
+  CHECK_GT(sigma, 0.0)
+      << "The blur sigma of band group " << group << " is not positive.";
+  const cv::Mat kernel_1d = cv::getGaussianKernel(blur_radius_, sigma);
+  std::shared_ptr<const GroupPSF> psf =
+      CreateGroupPSF(kernel_1d * kernel_1d.t());
+  psf_cache_->group_psfs[group] = psf;
+  return psf;
+}
+
+void SpectralBlurModule::ApplyKernels(
+    const ImageData& image_data,
+    const bool transpose,
+    ImageData* blurred_image) const {
+
+  // The PSFs are looked up before blurring, so the parallel channels do not
+  // contend for the cache.
+  const int num_channels = image_data.GetNumChannels();
+  std::vector<std::shared_ptr<const GroupPSF>> channel_psfs(num_channels);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    channel_psfs[channel] = GetGroupPSF(GetBandGroup(first_band_ + channel));
+  }
+
+  const auto blur_channel = [&](const int channel) {
+    const GroupPSF& psf = *channel_psfs[channel];
+    const cv::Mat channel_image = image_data.GetChannelImage(channel);
+    cv::Mat blurred_channel = blurred_image->GetChannelImage(channel);
+    if (psf.is_separable) {
+      // The transposed kernel swaps the row and column factors.
+      cv::sepFilter2D(
+          channel_image,
+          blurred_channel,
+          -1,
+          transpose ? psf.kernel_column : psf.kernel_row,
+          transpose ? psf.kernel_row : psf.kernel_column,
+          cv::Point(-1, -1),
+          0,
+          kBlurBorderMode);
+    } else {
+      // OpenCV switches to a DFT based convolution for large kernels.
+      cv::filter2D(
+          channel_image,
+          blurred_channel,
+          -1,
+          transpose ? cv::Mat(psf.kernel.t()) : psf.kernel,
+          cv::Point(-1, -1),
+          0,
+          kBlurBorderMode);
+    }
+  };
+
+  if (thread_pool_ != nullptr && num_channels > 1) {
+    thread_pool_->ParallelFor(num_channels, blur_channel);
+  } else {
+    for (int channel = 0; channel < num_channels; ++channel) {
+      blur_channel(channel);
+    }
+  }
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,157 @@
+// A blur operator whose point spread function (PSF) depends on the spectral
+// band, e.g. for FT-IR or other hyperspectral optics where the diffraction
+// limited blur grows with the wavelength. The BlurModule applies the same
+// kernel to every channel, so a band-dependent blur would otherwise need one
+// image model per band.
+//
+// The bands are split into groups of consecutive bands that share a PSF. The
+// PSF of each group is prepared once (including its separable row and column
+// factors if the kernel has rank 1) and cached, so applying the operator only
+// selects the prepared kernel of every channel. The channels are blurred in
+// parallel like in the BlurModule.
+//
+// Channel c of the blurred images is band c, unless the images only hold a
+// range of the bands, e.g. for a channel split. The solvers blur those with
+// an operator whose first band is the start of the range (see
+// CreateBandOffsetOperator()). The bands can therefore only be blurred in
+// the spectral domain, and not as PCA components.
+
+#ifndef SRC_IMAGE_MODEL_SPECTRAL_BLUR_MODULE_H_
+#define SRC_IMAGE_MODEL_SPECTRAL_BLUR_MODULE_H_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/degradation_operator.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+class SpectralBlurModule : public DegradationOperator {
+ public:
+  // Gaussian PSFs whose sigma (in pixels) changes linearly with the band:
+  //   sigma(band) = sigma + sigma_per_band * band
+  // Every group of bands_per_group consecutive bands uses the sigma of the
+  // center band of the group. The blur radius must be an odd number and
+  // the sigma of every band that is blurred must be greater than 0. The
+  // kernel of a group is built the first time one of its bands is blurred.
+  SpectralBlurModule(
+      const int blur_radius,
+      const double sigma,
+      const double sigma_per_band,
+      const int bands_per_group);
+
+  // A table of PSFs, e.g. measured for the optics of an instrument. The
+  // kernel group_kernels[g] is applied to the bands g * bands_per_group to
+  // (g + 1) * bands_per_group - 1, and the last kernel also to all bands
+  // after its group. The kernels are applied like the BlurModule kernel
+  // (centered on each pixel) and must have odd dimensions.
+  SpectralBlurModule(
+      const std::vector<cv::Mat>& group_kernels, const int bands_per_group);
+
+  virtual void ApplyToImage(ImageData* image_data, const int index) const;
+
+  virtual void ApplyToImageOutOfPlace(
+      const ImageData& image_data,
+      const int index,
+      ImageData* degraded_image) const;
+
+  virtual void ApplyTransposeToImage(
+      ImageData* image_data, const int index) const;
+
+  // The operator matrix applies to a single channel, so it only exists if
+  // every band has the same PSF (see IsBandIndependent()).
+  virtual cv::Mat GetOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  // Returns the same operator for images whose first channel is band
+  // GetFirstBand() + band_offset. The PSF cache and the threads are shared
+  // with this operator.
+  virtual std::shared_ptr<DegradationOperator> CreateBandOffsetOperator(
+      const int band_offset) const;
+
+  // Returns the band of the first channel of the blurred images.
+  int GetFirstBand() const {
+    return first_band_;
+  }
+
+  // Sets the number of threads used to blur the channels of an image in
+  // parallel. Set to 0 to use all available hardware threads. By default, all
+  // channels are blurred serially.
+  void SetNumThreads(const int num_threads);
+
+  // Returns the index of the PSF group of the given band (not channel).
+  int GetBandGroup(const int band) const;
+
+  // Returns the PSF kernel that is applied to the given band (not channel).
+  cv::Mat GetBandKernel(const int band) const;
+
+  // Returns true if all bands have the same PSF.
+  bool IsBandIndependent() const {
+    return num_groups_ == 1 || (num_groups_ == 0 && sigma_per_band_ == 0.0);
+  }
+
+ private:
+  // A prepared PSF of a group of bands.
+  struct GroupPSF {
+    cv::Mat kernel;
+
+    // If the kernel has rank 1, it is the product of these column (y) and
+    // row (x) factors, which are used for separable filtering.
+    bool is_separable = false;
+    cv::Mat kernel_column;
+    cv::Mat kernel_row;
+  };
+
+  // Prepares the PSF of the given kernel.
+  static std::shared_ptr<const GroupPSF> CreateGroupPSF(const cv::Mat& kernel);
+
+  // Returns the (cached) PSF of the given group.
+  std::shared_ptr<const GroupPSF> GetGroupPSF(const int group) const;
+
+  // The prepared PSF of each group index. The cache is shared by all threads
+  // that apply the operator, and by its band offset copies.
+  struct PSFCache {
+    std::map<int, std::shared_ptr<const GroupPSF>> group_psfs;
+    std::mutex mutex;
+  };
+
+  // Blurs every channel of the given image with the PSF of its band into the
+  // channels of the blurred image, which may be the same image. If transpose
+  // is true, the transposed kernels are used instead.
+  void ApplyKernels(
+      const ImageData& image_data,
+      const bool transpose,
+      ImageData* blurred_image) const;
+
+  // The parameters of the Gaussian PSFs. The blur radius is 0 for a PSF
+  // table.
+  const int blur_radius_;
+  const double sigma_;
+  const double sigma_per_band_;
+
+  const int bands_per_group_;
+
+  // The number of groups of a PSF table, or 0 for the Gaussian PSFs, which
+  // have a group for any number of bands.
+  int num_groups_ = 0;
+
+  // The band of the first channel of the blurred images.
+  int first_band_ = 0;
+
+  const std::shared_ptr<PSFCache> psf_cache_;
+
+  // The number of threads used and the pool of additional threads. The pool
+  // is null if the channels are blurred serially.
+  int num_threads_ = 1;
+  std::shared_ptr<util::ThreadPool> thread_pool_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_IMAGE_MODEL_SPECTRAL_BLUR_MODULE_H_
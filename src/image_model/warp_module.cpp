@@ -0,0 +1,232 @@
+#include "image_model/warp_module.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "image/image_data.h"
+#include "motion/warp_field.h"
+#include "util/profiler.h"
+#include "util/sparse_matrix.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// Returns the bilinear tap table of the warp for images of the given size.
+// Row i holds the taps of pixel i, and samples outside of the image are zero.
+util::SparseMatrix BuildTapTable(
+    const WarpField& warp_field, const cv::Size& image_size) {
+
+  cv::Mat map_x, map_y;
+  warp_field.ComputeSampleMaps(image_size, &map_x, &map_y);
+
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size.width) * image_size.height;
+  std::vector<util::SparseMatrixEntry> entries;
+  entries.reserve(num_pixels * 4);
+  for (int row = 0; row < image_size.height; ++row) {
+    const double* map_x_row = map_x.ptr<double>(row);
+    const double* map_y_row = map_y.ptr<double>(row);
+    for (int col = 0; col < image_size.width; ++col) {
+      const double source_col = map_x_row[col];
+      const double source_row = map_y_row[col];
+      // Samples farther than a pixel outside of the image (or that are not
+      // finite) have no taps.
+      if (!(source_col > -1.0 && source_col < image_size.width &&
+            source_row > -1.0 && source_row < image_size.height)) {
+        continue;
+      }
+      const int left_col = static_cast<int>(std::floor(source_col));
+      const int top_row = static_cast<int>(std::floor(source_row));
+      const double col_weight = source_col - left_col;
+      const double row_weight = source_row - top_row;
+      const int64_t pixel_index =
+          static_cast<int64_t>(row) * image_size.width + col;
+      for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 2; ++j) {
+          const int sample_row = top_row + i;
+          const int sample_col = left_col + j;
+          const double weight =
+              (i == 0 ? 1.0 - row_weight : row_weight) *
+              (j == 0 ? 1.0 - col_weight : col_weight);
+          if (weight == 0.0 ||
+              sample_row < 0 || sample_row >= image_size.height ||
+              sample_col < 0 || sample_col >= image_size.width) {
+            continue;
+          }
+          entries.emplace_back(
+              pixel_index,
+              static_cast<int64_t>(sample_row) * image_size.width + sample_col,
+              weight);
+        }
+      }
+    }
+  }
+  return util::SparseMatrix(num_pixels, num_pixels, entries);
+}
+
+// Computes the pixels [pixel_begin, pixel_end) of the warped channel as the
+// weighted sums of the source pixels given by the rows of the tap table. The
+// channels must be continuous and must not be the same Mat.
+template <typename PixelType>
+void ApplyTapTable(
+    const util::SparseMatrix& taps,
+    const cv::Mat& source,
+    const int64_t pixel_begin,
+    const int64_t pixel_end,
+    cv::Mat* warped) {
+
+  const std::vector<int64_t>& row_offsets = taps.GetRowOffsets();
+  const std::vector<int64_t>& column_indices = taps.GetColumnIndices();
+  const std::vector<double>& values = taps.GetValues();
+  const PixelType* source_data = source.ptr<PixelType>();
+  PixelType* warped_data = warped->ptr<PixelType>();
+  for (int64_t pixel = pixel_begin; pixel < pixel_end; ++pixel) {
+    double sum = 0.0;
+    for (int64_t k = row_offsets[pixel]; k < row_offsets[pixel + 1]; ++k) {
+      sum += values[k] * source_data[column_indices[k]];
+    }
+    warped_data[pixel] = static_cast<PixelType>(sum);
+  }
+}
+
+}  // namespace
+
+WarpModule::WarpModule(const WarpFieldSequence& warp_sequence)
+    : warp_sequence_(warp_sequence) {}
+
+void WarpModule::ApplyToImage(ImageData* image_data, const int index) const {
+  PROFILE_SCOPE("WarpModule::ApplyToImage");
+  CHECK_NOTNULL(image_data);
+
+  ApplyWarp(*image_data, index, false, image_data);
+}
+
+void WarpModule::ApplyToImageOutOfPlace(
+    const ImageData& image_data,
+    const int index,
+    ImageData* degraded_image) const {
+
+  PROFILE_SCOPE("WarpModule::ApplyToImage");
+
+  CHECK_NOTNULL(degraded_image);
+  CheckOutOfPlaceImages(image_data, *degraded_image);
+
+  ApplyWarp(image_data, index, false, degraded_image);
+}
+
+void WarpModule::ApplyTransposeToImage(
+    ImageData* image_data, const int index) const {
+
+  PROFILE_SCOPE("WarpModule::ApplyTransposeToImage");
+
+  CHECK_NOTNULL(image_data);
+
+  ApplyWarp(*image_data, index, true, image_data);
+}
+
+cv::Mat WarpModule::GetOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  return GetSparseOperatorMatrix(image_size, index).ToDense();
+}
+
+util::SparseMatrix WarpModule::GetSparseOperatorMatrix(
+    const cv::Size& image_size, const int index) const {
+
+  return GetCompiledWarp(image_size, index)->taps;
+}
+
+void WarpModule::SetNumThreads(const int num_threads) {
+  num_threads_ = util::GetNumThreadsToUse(num_threads);
+  thread_pool_.reset();
+  if (num_threads_ > 1) {
+    // The calling thread also warps rows, so it is not included.
+    thread_pool_.reset(new util::ThreadPool(num_threads_ - 1));
+  }
+}
+
+std::shared_ptr<const WarpModule::CompiledWarp> WarpModule::GetCompiledWarp(
+    const cv::Size& image_size, const int index) const {
+
+  const WarpField& warp_field = warp_sequence_.GetWarpField(index);
+  {
+    std::lock_guard<std::mutex> lock(compile_mutex_);
+    if (compiled_image_size_ != image_size) {
+      compiled_image_size_ = image_size;
+      compiled_warps_.assign(warp_sequence_.GetNumWarpFields(), nullptr);
+    }
+    if (compiled_warps_[index] != nullptr) {
+      return compiled_warps_[index];
+    }
+  }
+
+  // Compiling is expensive, so other frames are not blocked while it runs.
+  // If two threads compile the same frame, both results are the same.
+  std::shared_ptr<CompiledWarp> compiled_warp(new CompiledWarp());
+  compiled_warp->taps = BuildTapTable(warp_field, image_size);
+  compiled_warp->transposed_taps = compiled_warp->taps.Transpose();
+
+  std::lock_guard<std::mutex> lock(compile_mutex_);
+  if (compiled_image_size_ == image_size) {
+    compiled_warps_[index] = compiled_warp;
+  }
+  return compiled_warp;
+}
+
+void WarpModule::ApplyWarp(
+    const ImageData& image_data,
+    const int index,
+    const bool transpose,
+    ImageData* warped_image) const {
+
+  const cv::Size image_size = image_data.GetImageSize();
+  const std::shared_ptr<const CompiledWarp> compiled_warp =
+      GetCompiledWarp(image_size, index);
+  const util::SparseMatrix& taps =
+      transpose ? compiled_warp->transposed_taps : compiled_warp->taps;
+
+  const bool is_single_precision =
+      image_data.GetPrecision() == SINGLE_PRECISION;
+  const bool in_place = (&image_data == warped_image);
+  const int64_t num_pixels = taps.GetNumRows();
+  const int num_pixel_blocks =
+      (thread_pool_ != nullptr) ? num_threads_ : 1;
+  for (int i = 0; i < image_data.GetNumChannels(); ++i) {
+    // The taps read arbitrary source pixels, so in-place warps read a copy.
+    // Channels that are views of external data are copied to be continuous.
+    cv::Mat channel = image_data.GetChannelImage(i);
+    if (in_place || !channel.isContinuous()) {
+      channel = channel.clone();
+    }
+    cv::Mat warped_channel = warped_image->GetChannelImage(i);
+    CHECK(warped_channel.isContinuous())
+        << "The warped image channels must be continuous.";
+    const auto warp_pixels = [&](const int block) {
+      const int64_t pixel_begin = block * num_pixels / num_pixel_blocks;
+      const int64_t pixel_end = (block + 1) * num_pixels / num_pixel_blocks;
+      if (is_single_precision) {
+        ApplyTapTable<float>(
+            taps, channel, pixel_begin, pixel_end, &warped_channel);
+      } else {
+        ApplyTapTable<double>(
+            taps, channel, pixel_begin, pixel_end, &warped_channel);
+      }
+    };
+    if (num_pixel_blocks > 1) {
+      thread_pool_->ParallelFor(num_pixel_blocks, warp_pixels);
+    } else {
+      warp_pixels(0);
+    }
+  }
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,103 @@
+// This motion degradation module warps each image in the frame sequence by a
+// general motion model (a homography or a dense flow field, see WarpField)
+// with bilinear interpolation and zeros outside of the image. Computing the
+// sample positions of a general warp is much more expensive than applying
+// it, so the bilinear taps of every frame are compiled once into a sparse
+// tap table for the image size they are applied to, and each application only
+// replays the table. The transposed table is compiled along with it, so the
+// transpose is the exact adjoint of the interpolation.
+
+#ifndef SRC_IMAGE_MODEL_WARP_MODULE_H_
+#define SRC_IMAGE_MODEL_WARP_MODULE_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/degradation_operator.h"
+#include "motion/warp_field.h"
+#include "util/sparse_matrix.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+class WarpModule : public DegradationOperator {
+ public:
+  // The given WarpFieldSequence should provide a warp for each image in the
+  // frame sequence.
+  explicit WarpModule(const WarpFieldSequence& warp_sequence);
+
+  virtual void ApplyToImage(ImageData* image_data, const int index) const;
+
+  virtual void ApplyToImageOutOfPlace(
+      const ImageData& image_data,
+      const int index,
+      ImageData* degraded_image) const;
+
+  virtual void ApplyTransposeToImage(
+      ImageData* image_data, const int index) const;
+
+  virtual cv::Mat GetOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  // Returns the compiled tap table of the frame.
+  virtual util::SparseMatrix GetSparseOperatorMatrix(
+      const cv::Size& image_size, const int index) const;
+
+  virtual bool HasSparseOperatorMatrix() const {
+    return true;
+  }
+
+  // The warps are given for a fixed set of frames.
+  virtual bool CanAddFrames() const {
+    return false;
+  }
+
+  // Sets the number of threads used to apply the tap tables. The rows of
+  // every channel are split into one block per thread. Set to 0 to use all
+  // available hardware threads. By default, the rows are warped serially.
+  void SetNumThreads(const int num_threads);
+
+ private:
+  // The tap table of a single frame and its transpose, both stored by rows so
+  // that the forward warp and its adjoint are gathers over the output pixels.
+  struct CompiledWarp {
+    util::SparseMatrix taps;
+    util::SparseMatrix transposed_taps;
+  };
+
+  // Returns the compiled warp of the given frame for images of the given size,
+  // compiling it on first use. If the image size changes, all frames are
+  // compiled again for the new size. This is thread-safe.
+  std::shared_ptr<const CompiledWarp> GetCompiledWarp(
+      const cv::Size& image_size, const int index) const;
+
+  // Warps every channel of the given image into the channels of the warped
+  // image, which may be the same image. If transpose is true, the adjoint is
+  // applied instead.
+  void ApplyWarp(
+      const ImageData& image_data,
+      const int index,
+      const bool transpose,
+      ImageData* warped_image) const;
+
+  const WarpFieldSequence warp_sequence_;
+
+  // The compiled warps of every frame for compiled_image_size_. Frames that
+  // were not used yet are null.
+  mutable std::mutex compile_mutex_;
+  mutable cv::Size compiled_image_size_;
+  mutable std::vector<std::shared_ptr<const CompiledWarp>> compiled_warps_;
+
+  // The number of threads used and the pool of additional threads. The pool
+  // is null if the rows are warped serially.
+  int num_threads_ = 1;
+  std::shared_ptr<util::ThreadPool> thread_pool_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_IMAGE_MODEL_WARP_MODULE_H_
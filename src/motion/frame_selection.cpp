@@ -0,0 +1,196 @@
+#include "motion/frame_selection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "image/image_data.h"
+#include "motion/motion_shift.h"
+#include "util/matrix_util.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// The selection score of a frame whose phase is already covered is its
+// quality times this gain, so that such frames are still ranked by quality.
+constexpr double kMinCoverageGain = 0.05;
+
+// Returns the given shift modulo the scale, in [0, scale).
+double GetPhase(const double shift, const int scale) {
+  const double phase = std::fmod(shift, static_cast<double>(scale));
+  return (phase < 0.0) ? phase + scale : phase;
+}
+
+// Returns the distance between two phases on the [0, scale) x [0, scale)
+// torus, since phases that differ by almost the scale are close.
+double GetPhaseDistance(
+    const double phase_x1,
+    const double phase_y1,
+    const double phase_x2,
+    const double phase_y2,
+    const int scale) {
+
+  double distance_x = std::abs(phase_x1 - phase_x2);
+  double distance_y = std::abs(phase_y1 - phase_y2);
+  distance_x = std::min(distance_x, scale - distance_x);
+  distance_y = std::min(distance_y, scale - distance_y);
+  return std::sqrt(distance_x * distance_x + distance_y * distance_y);
+}
+
+// Returns the mean squared difference between the frame and the reference
+// moved by the given LR shift, over the pixels that the shifted reference
+// covers.
+double GetRegistrationError(
+    const cv::Mat& reference,
+    const cv::Mat& frame,
+    const double shift_x,
+    const double shift_y) {
+
+  // The motion module maps HR pixel (row - dy, col - dx) to (row, col), so
+  // the frame sees the reference moved by the shift.
+  const cv::Mat transform = (cv::Mat_<double>(2, 3) <<
+      1.0, 0.0, shift_x,
+      0.0, 1.0, shift_y);
+  cv::Mat predicted_frame;
+  cv::warpAffine(
+      reference, predicted_frame, transform, reference.size(),
+      cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+
+  // The border pixels are extrapolated, so they are left out.
+  const int margin_x = static_cast<int>(std::ceil(std::abs(shift_x))) + 1;
+  const int margin_y = static_cast<int>(std::ceil(std::abs(shift_y))) + 1;
+  const cv::Rect interior(
+      margin_x, margin_y,
+      frame.cols - 2 * margin_x, frame.rows - 2 * margin_y);
+  if (interior.width <= 0 || interior.height <= 0) {
+    return 0.0;
+  }
+  const double difference_norm =
+      cv::norm(frame(interior), predicted_frame(interior), cv::NORM_L2);
+  return difference_norm * difference_norm / interior.area();
+}
+
+// Returns the mean squared Laplacian of the image.
+double GetSharpness(const cv::Mat& image) {
+  cv::Mat laplacian;
+  cv::Laplacian(image, laplacian, util::kOpenCvMatrixType);
+  const double laplacian_norm = cv::norm(laplacian, cv::NORM_L2);
+  return laplacian_norm * laplacian_norm / image.total();
+}
+
+}  // namespace
+
+std::vector<FrameScore> ScoreFrames(
+    const std::vector<ImageData>& low_res_images,
+    const MotionShiftSequence& motion_sequence,
+    const int scale,
+    const ImageStructureMode structure_mode) {
+
+  const int num_frames = low_res_images.size();
+  CHECK_GT(num_frames, 0) << "There are no frames to score.";
+  CHECK_EQ(motion_sequence.GetNumMotionShifts(), num_frames)
+      << "Every frame needs a motion shift.";
+  CHECK_GE(scale, 1) << "The scale must be positive.";
+
+  const cv::Mat reference =
+      low_res_images[0].GetStructureImage(structure_mode);
+  std::vector<FrameScore> scores(num_frames);
+  double max_sharpness = 0.0;
+  double registration_error_sum = 0.0;
+  for (int i = 0; i < num_frames; ++i) {
+    CHECK_EQ(low_res_images[i].GetImageSize(), reference.size())
+        << "All frames must have the same size.";
+    const cv::Mat frame = (i == 0) ?
+        reference : low_res_images[i].GetStructureImage(structure_mode);
+    if (i > 0) {
+      scores[i].registration_error = GetRegistrationError(
+          reference,
+          frame,
+          motion_sequence[i].dx / scale,
+          motion_sequence[i].dy / scale);
+      registration_error_sum += scores[i].registration_error;
+    }
+    scores[i].sharpness = GetSharpness(frame);
+    max_sharpness = std::max(max_sharpness, scores[i].sharpness);
+  }
+
+  const double mean_registration_error =
+      (num_frames > 1) ? registration_error_sum / (num_frames - 1) : 0.0;
+  for (FrameScore& score : scores) {
+    const double relative_sharpness =
+        (max_sharpness > 0.0) ? score.sharpness / max_sharpness : 1.0;
+    const double registration_quality = (mean_registration_error > 0.0) ?
+        1.0 / (1.0 + score.registration_error / mean_registration_error) :
+        1.0;
+    score.quality = relative_sharpness * registration_quality;
+  }
+  return scores;
+}
+
+std::vector<int> SelectFrames(
+    const std::vector<ImageData>& low_res_images,
+    const MotionShiftSequence& motion_sequence,
+    const int scale,
+    const int num_selected_frames,
+    const ImageStructureMode structure_mode) {
+
+  const int num_frames = low_res_images.size();
+  std::vector<int> selected_frames;
+  if (num_selected_frames <= 0 || num_selected_frames >= num_frames) {
+    for (int i = 0; i < num_frames; ++i) {
+      selected_frames.push_back(i);
+    }
+    return selected_frames;
+  }
+
+  const std::vector<FrameScore> scores = ScoreFrames(
+      low_res_images, motion_sequence, scale, structure_mode);
+  std::vector<double> phases_x(num_frames);
+  std::vector<double> phases_y(num_frames);
+  for (int i = 0; i < num_frames; ++i) {
+    phases_x[i] = GetPhase(motion_sequence[i].dx, scale);
+    phases_y[i] = GetPhase(motion_sequence[i].dy, scale);
+  }
+
+  // The distance of every frame's phase to the closest selected phase,
+  // relative to the largest possible distance on the torus.
+  const double max_phase_distance = scale / std::sqrt(2.0);
+  std::vector<double> coverage_gains(num_frames, 1.0);
+  std::vector<bool> is_selected(num_frames, false);
+  int next_frame = 0;  // The reference frame is always selected.
+  for (int num_selected = 0; num_selected < num_selected_frames;
+       ++num_selected) {
+    is_selected[next_frame] = true;
+    selected_frames.push_back(next_frame);
+    double best_score = -1.0;
+    for (int i = 0; i < num_frames; ++i) {
+      if (is_selected[i]) {
+        continue;
+      }
+      coverage_gains[i] = std::min(
+          coverage_gains[i],
+          GetPhaseDistance(
+              phases_x[i], phases_y[i],
+              phases_x[next_frame], phases_y[next_frame],
+              scale) / max_phase_distance);
+      const double score =
+          scores[i].quality * (kMinCoverageGain + coverage_gains[i]);
+      if (score > best_score) {
+        best_score = score;
+        next_frame = i;
+      }
+    }
+  }
+
+  std::sort(selected_frames.begin(), selected_frames.end());
+  LOG(INFO) << "Selected " << selected_frames.size() << " of " << num_frames
+            << " frames.";
+  return selected_frames;
+}
+
+}  // namespace super_resolution
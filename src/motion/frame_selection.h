@@ -0,0 +1,63 @@
+// Selects the most informative frames of a long burst before solving. Every
+// frame adds a full pass of the image model and its transpose to each
+// evaluation of the data term, but frames that are blurry, poorly registered,
+// or that sample the HR grid at the same sub-pixel phase as other frames add
+// little information. Keeping only the best K frames caps the cost of the
+// data term at K frames.
+//
+// Each frame gets a quality score from its sharpness (the mean squared
+// Laplacian of its structure image) and its registration error (the mean
+// squared difference to the reference frame moved by its motion shift). The
+// frames are then chosen greedily, starting with the reference frame: the
+// next frame is the one with the best product of its quality and the distance
+// of its sub-pixel phase (its shift modulo the scale) to the phases already
+// chosen. Frames at new phases are therefore preferred, and frames at covered
+// phases are only added, best first, once every phase is covered.
+
+#ifndef SRC_MOTION_FRAME_SELECTION_H_
+#define SRC_MOTION_FRAME_SELECTION_H_
+
+#include <vector>
+
+#include "image/image_data.h"
+#include "motion/motion_shift.h"
+
+namespace super_resolution {
+
+struct FrameScore {
+  // The mean squared difference between the frame and the reference frame
+  // shifted by the motion of the frame, over the pixels that both see. This
+  // is 0 for the reference frame.
+  double registration_error = 0.0;
+
+  // The mean squared Laplacian of the frame's structure image.
+  double sharpness = 0.0;
+
+  // The combined score in (0, 1]. It is the product of the sharpness relative
+  // to the sharpest frame and 1 / (1 + e / m), where e is the registration
+  // error and m the mean error of the other frames.
+  double quality = 1.0;
+};
+
+// Returns the score of every frame. The first frame is the reference frame,
+// and the motion sequence (in HR pixels) must have a shift for every frame.
+std::vector<FrameScore> ScoreFrames(
+    const std::vector<ImageData>& low_res_images,
+    const MotionShiftSequence& motion_sequence,
+    const int scale,
+    const ImageStructureMode structure_mode = STRUCTURE_IMAGE_MEAN);
+
+// Returns the indices of the (at most) num_selected_frames most informative
+// frames (see above) in increasing order. The reference frame (index 0) is
+// always selected. All frames are selected if num_selected_frames is not
+// positive or at least the number of frames.
+std::vector<int> SelectFrames(
+    const std::vector<ImageData>& low_res_images,
+    const MotionShiftSequence& motion_sequence,
+    const int scale,
+    const int num_selected_frames,
+    const ImageStructureMode structure_mode = STRUCTURE_IMAGE_MEAN);
+
+}  // namespace super_resolution
+
+#endif  // SRC_MOTION_FRAME_SELECTION_H_
@@ -32,6 +32,11 @@ class MotionShiftSequence {
   // Set the motion sequence to the given list.
   void SetMotionSequence(const std::vector<MotionShift>& motion_shifts);
 
+  // Appends the motion shift of a new frame to the end of the sequence.
+  void AddMotionShift(const MotionShift& motion_shift) {
+    motion_shifts_.push_back(motion_shift);
+  }
+
   // Load the motion sequence from a previously-saved file.
   void LoadSequenceFromFile(const std::string& file_path);
 
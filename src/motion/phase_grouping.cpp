@@ -0,0 +1,149 @@
+#include "motion/phase_grouping.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "image/image_data.h"
+#include "motion/motion_shift.h"
+#include "util/matrix_util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// A frame of a phase group and its integral LR offset relative to the first
+// frame of the group.
+struct GroupMember {
+  int frame_index;
+  int offset_x;
+  int offset_y;
+};
+
+// Splits the shift, quantized to 1 / num_phase_steps HR pixels, into its
+// phase index in [0, scale * num_phase_steps) and its integral LR offset.
+void SplitShift(
+    const double shift,
+    const int scale,
+    const int num_phase_steps,
+    int* phase_index,
+    int* offset) {
+
+  const int period = scale * num_phase_steps;
+  const long quantized_shift = std::lround(shift * num_phase_steps);
+  *phase_index = static_cast<int>(
+      ((quantized_shift % period) + period) % period);
+  *offset = static_cast<int>((quantized_shift - *phase_index) / period);
+}
+
+// Adds source(row + offset_y, col + offset_x) to the sum and increments the
+// count for every pixel where the source is inside of the image.
+void AddShiftedChannel(
+    const cv::Mat& source,
+    const int offset_x,
+    const int offset_y,
+    cv::Mat* sum,
+    cv::Mat* count) {
+
+  const int width = source.cols;
+  const int height = source.rows;
+  const int col_start = std::max(-offset_x, 0);
+  const int col_end = std::min(width - offset_x, width);
+  for (int row = 0; row < height; ++row) {
+    const int source_row = row + offset_y;
+    if (source_row < 0 || source_row >= height) {
+      continue;
+    }
+    const double* source_data = source.ptr<double>(source_row);
+    double* sum_data = sum->ptr<double>(row);
+    double* count_data = count->ptr<double>(row);
+    for (int col = col_start; col < col_end; ++col) {
+      sum_data[col] += source_data[col + offset_x];
+      count_data[col] += 1.0;
+    }
+  }
+}
+
+}  // namespace
+
+PhaseGroupedObservations GroupObservationsByPhase(
+    const std::vector<ImageData>& low_res_images,
+    const MotionShiftSequence& motion_sequence,
+    const int scale,
+    const int num_phase_steps) {
+
+  CHECK_GT(low_res_images.size(), 0) << "No frames to group.";
+  CHECK_GE(motion_sequence.GetNumMotionShifts(), low_res_images.size())
+      << "Every frame needs a motion shift to be grouped by phase.";
+  CHECK_GE(scale, 1) << "The scale must be at least 1.";
+  CHECK_GE(num_phase_steps, 1) << "At least one phase step is required.";
+
+  // Group the frames by their phase in x and y.
+  PhaseGroupedObservations grouped;
+  std::map<std::pair<int, int>, int> group_indices;
+  std::vector<std::vector<GroupMember>> groups;
+  std::vector<std::pair<int, int>> group_offsets;
+  std::vector<MotionShift> group_shifts;
+  const int num_frames = low_res_images.size();
+  for (int frame_index = 0; frame_index < num_frames; ++frame_index) {
+    const MotionShift& motion_shift = motion_sequence[frame_index];
+    int phase_x, phase_y, offset_x, offset_y;
+    SplitShift(motion_shift.dx, scale, num_phase_steps, &phase_x, &offset_x);
+    SplitShift(motion_shift.dy, scale, num_phase_steps, &phase_y, &offset_y);
+    const auto inserted = group_indices.emplace(
+        std::make_pair(phase_x, phase_y), groups.size());
+    const int group_index = inserted.first->second;
+    if (inserted.second) {
+      groups.emplace_back();
+      group_offsets.emplace_back(offset_x, offset_y);
+      group_shifts.push_back(motion_shift);
+    }
+    groups[group_index].push_back({
+        frame_index,
+        offset_x - group_offsets[group_index].first,
+        offset_y - group_offsets[group_index].second});
+    grouped.frame_groups.push_back(group_index);
+  }
+
+  // Average the aligned frames of every group. The first frame covers every
+  // pixel, so every pixel has at least one value.
+  for (const std::vector<GroupMember>& group : groups) {
+    const ImageData& first_frame = low_res_images[group[0].frame_index];
+    const int num_channels = first_frame.GetNumChannels();
+    const double weight = group.size();
+    ImageData observation;
+    for (int channel = 0; channel < num_channels; ++channel) {
+      cv::Mat sum = cv::Mat::zeros(
+          first_frame.GetImageSize(), util::kOpenCvMatrixType);
+      cv::Mat count = cv::Mat::zeros(
+          first_frame.GetImageSize(), util::kOpenCvMatrixType);
+      for (const GroupMember& member : group) {
+        const ImageData& frame = low_res_images[member.frame_index];
+        CHECK(frame.GetImageSize() == first_frame.GetImageSize())
+            << "The frames must all have the same size.";
+        cv::Mat frame_channel;
+        frame.GetChannelImage(channel).convertTo(
+            frame_channel, util::kOpenCvMatrixType);
+        AddShiftedChannel(
+            frame_channel, member.offset_x, member.offset_y, &sum, &count);
+      }
+      cv::Mat average = sum / count;
+      average *= std::sqrt(weight);
+      observation.AddChannel(average, DO_NOT_NORMALIZE_IMAGE);
+    }
+    grouped.observations.push_back(observation);
+    grouped.weights.push_back(weight);
+  }
+  grouped.motion_sequence.SetMotionSequence(group_shifts);
+
+  LOG(INFO) << "Merged " << num_frames << " frames into "
+            << groups.size() << " sub-pixel phase groups.";
+  return grouped;
+}
+
+}  // namespace super_resolution
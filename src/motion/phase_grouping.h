@@ -0,0 +1,54 @@
+// Merges frames with purely translational motion that sample the HR grid at
+// the same sub-pixel phase. With decimation by the scale, a frame shifted by
+// s + scale * o (for an integral offset o) is the frame shifted by s, moved by
+// o LR pixels, so both constrain the same HR pixels. The frames of each phase
+// are aligned by their integral LR offsets and averaged into one observation
+// that is weighted by the number of merged frames, which leaves the data term
+// unchanged up to a constant. The data term then costs O(unique phases)
+// instead of O(frames).
+//
+// The phases are quantized to 1 / num_phase_steps HR pixels, so the merged
+// frames may differ by up to half of that. Near the image border, each LR
+// pixel is averaged over the frames that cover it, and the border pixels of
+// the merged observation are only approximately weighted.
+
+#ifndef SRC_MOTION_PHASE_GROUPING_H_
+#define SRC_MOTION_PHASE_GROUPING_H_
+
+#include <vector>
+
+#include "image/image_data.h"
+#include "motion/motion_shift.h"
+
+namespace super_resolution {
+
+struct PhaseGroupedObservations {
+  // The merged observations, scaled by the square roots of their weights so
+  // that they can be solved with an image model using these weights (see
+  // ImageModelParameters::observation_weights).
+  std::vector<ImageData> observations;
+
+  // The motion shift of every merged observation, which is the shift of the
+  // first frame of its group.
+  MotionShiftSequence motion_sequence;
+
+  // The number of frames merged into every observation.
+  std::vector<double> weights;
+
+  // The index of the merged observation that every frame was merged into.
+  std::vector<int> frame_groups;
+};
+
+// Groups the given LR frames by the sub-pixel phase of their motion shifts
+// modulo the scale, quantized to 1 / num_phase_steps HR pixels, and merges
+// the frames of every group. The motion sequence must have a shift for every
+// frame.
+PhaseGroupedObservations GroupObservationsByPhase(
+    const std::vector<ImageData>& low_res_images,
+    const MotionShiftSequence& motion_sequence,
+    const int scale,
+    const int num_phase_steps);
+
+}  // namespace super_resolution
+
+#endif  // SRC_MOTION_PHASE_GROUPING_H_
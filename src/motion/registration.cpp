@@ -1,15 +1,21 @@
 #include "motion/registration.h"
 
 #include <algorithm>
+#include <cmath>
+#include <functional>
 #include <utility>
 #include <vector>
 
 #include "image/image_data.h"
 #include "motion/motion_shift.h"
+#include "util/matrix_util.h"
+#include "util/thread_pool.h"
 
 #include "opencv2/calib3d/calib3d.hpp"
 #include "opencv2/core/core.hpp"
 #include "opencv2/features2d/features2d.hpp"
+#include "opencv2/flann/flann.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/video/tracking.hpp"
 
 #include "glog/logging.h"
@@ -25,34 +31,83 @@ constexpr double kFlannDistanceScalingFactor = 5.0;
 constexpr double kFlannDistanceThreshold = 0.04;
 constexpr double kRansacReprojectionThreshold = 0.1;
 
+// The FLANN index and search parameters, which are the defaults of the
+// cv::FlannBasedMatcher.
+constexpr int kFlannNumKDTrees = 4;
+constexpr int kFlannNumSearchChecks = 32;
+
+// With a coarse shift estimate, each keypoint is matched to the best of this
+// many nearest reference descriptors whose position agrees with the estimate
+// within this many coarse pixels.
+constexpr int kNumLocalSearchCandidates = 4;
+constexpr double kLocalSearchRadiusInCoarsePixels = 2.0;
+
+// Cross-power spectrum magnitudes below this value are left unnormalized, so
+// that frequencies without signal do not amplify noise, and parabolas flatter
+// than this do not move the correlation peak.
+constexpr double kPhaseCorrelationEpsilon = 1.0e-12;
+
 // A parallel array (two vectors) for storing keypoint match pairs.
 using KeypointPairing =
     std::pair<std::vector<cv::Point2f>, std::vector<cv::Point2f>>;
 
-// Stores OpenCV keypoints and their associated feature descriptors.
+// Stores OpenCV keypoints and their associated feature descriptors. The
+// descriptors are stored as CV_32F, which is what FLANN needs.
 struct KeypointsAndDescriptors {
   cv::Mat descriptors;
   std::vector<cv::KeyPoint> keypoints;
 };
 
-// Returns a list of keypoints, and their associated feature descriptors,
-// detected in the given image.
-// TODO: Add a parameter for choosing the feature detection algorithm.
-KeypointsAndDescriptors DetectKeypoints(const ImageData& image) {
-  // TODO: Don't use channel 0. Instead implement a method in ImageData that
-  // returns a "structure" image (perhaps the average, max, or median pixel
-  // intensities across all channels). It should work for hyperspectral images
-  // as well.
+// The keypoints of a reference image with a FLANN index of their descriptors.
+// The index is built once per sequence and then only searched, which FLANN
+// allows from multiple threads at once.
+struct ReferenceFeatures {
+  KeypointsAndDescriptors keypoints_and_descriptors;
+  cv::Ptr<cv::flann::Index> descriptor_index;  // Null without keypoints.
+};
+
+// Returns the 8-bit image in which keypoints are detected. The structure image
+// is stretched to the full 8-bit range, since it is not necessarily between 0
+// and 1 (e.g. principal component projections).
+cv::Mat GetDetectionImage(
+    const ImageData& image, const ImageStructureMode structure_mode) {
+
   cv::Mat detection_image;
-  image.GetChannelImage(0).convertTo(detection_image, CV_8U, 255);
+  cv::normalize(
+      image.GetStructureImage(structure_mode),
+      detection_image,
+      0,
+      255,
+      cv::NORM_MINMAX,
+      CV_8U);
+  return detection_image;
+}
+
+// Returns the detection image downscaled by a factor of 2 per pyramid level.
+cv::Mat GetCoarseDetectionImage(
+    const cv::Mat& detection_image, const int num_pyramid_levels) {
+
+  const double scale = 1.0 / (1 << num_pyramid_levels);
+  cv::Mat coarse_image;
+  cv::resize(
+      detection_image, coarse_image, cv::Size(), scale, scale, cv::INTER_AREA);
+  return coarse_image;
+}
 
+// Returns a list of keypoints, and their associated feature descriptors,
+// detected in the given 8-bit image.
+// TODO: Add a parameter for choosing the feature detection algorithm.
+KeypointsAndDescriptors DetectKeypoints(const cv::Mat& detection_image) {
   KeypointsAndDescriptors keypoints_and_descriptors;
   cv::Ptr<cv::BRISK> detector = cv::BRISK::create();
+  cv::Mat binary_descriptors;
   detector->detectAndCompute(
       detection_image,
       cv::noArray(),
       keypoints_and_descriptors.keypoints,
-      keypoints_and_descriptors.descriptors);
+      binary_descriptors);
+  binary_descriptors.convertTo(
+      keypoints_and_descriptors.descriptors, CV_32F);
 
   if (keypoints_and_descriptors.keypoints.empty()) {
     LOG(WARNING) << "No keypoints detected for the given image.";
@@ -61,31 +116,90 @@ KeypointsAndDescriptors DetectKeypoints(const ImageData& image) {
   return keypoints_and_descriptors;
 }
 
-// Computes pairwise keypoint matches between the two given feature descriptor
-// sets. This does does not guarantee ideal matches. Further filtering, such as
-// RANSAC, may be necessary.
+// Detects the keypoints of the reference image and builds their index.
+ReferenceFeatures GetReferenceFeatures(const cv::Mat& detection_image) {
+  ReferenceFeatures reference_features;
+  reference_features.keypoints_and_descriptors =
+      DetectKeypoints(detection_image);
+  const cv::Mat& descriptors =
+      reference_features.keypoints_and_descriptors.descriptors;
+  if (!descriptors.empty()) {
+    reference_features.descriptor_index = cv::Ptr<cv::flann::Index>(
+        new cv::flann::Index(
+            descriptors, cv::flann::KDTreeIndexParams(kFlannNumKDTrees)));
+  }
+  return reference_features;
+}
+
+// Computes keypoint matches between the reference and the given image,
+// returned as (reference, image) position pairs. This does does not guarantee
+// ideal matches. Further filtering, such as RANSAC, may be necessary.
+//
+// If predicted_shift is not null, each image keypoint is only matched to
+// reference keypoints within search_radius pixels of where the predicted
+// shift places them.
 KeypointPairing FindMatchingFeatures(
-    const KeypointsAndDescriptors& keypoints_and_descriptors_1,
-    const KeypointsAndDescriptors& keypoints_and_descriptors_2) {
+    const ReferenceFeatures& reference_features,
+    const KeypointsAndDescriptors& image_keypoints_and_descriptors,
+    const cv::Point2f* predicted_shift,
+    const double search_radius) {
 
   // If there are no features available for one of the images, returns an empty
   // set of matches.
   KeypointPairing keypoint_matches;
-  if (keypoints_and_descriptors_1.descriptors.empty() ||
-      keypoints_and_descriptors_2.descriptors.empty()) {
+  const KeypointsAndDescriptors& reference_keypoints_and_descriptors =
+      reference_features.keypoints_and_descriptors;
+  if (!reference_features.descriptor_index ||
+      image_keypoints_and_descriptors.descriptors.empty()) {
     return keypoint_matches;
   }
 
-  // Need to convert to CV_32F so that the OpenCV Flann-based matcher can work.
-  cv::Mat descriptors_1;
-  keypoints_and_descriptors_1.descriptors.convertTo(descriptors_1, CV_32F);
-  cv::Mat descriptors_2;
-  keypoints_and_descriptors_2.descriptors.convertTo(descriptors_2, CV_32F);
+  // Find the nearest reference descriptors of every image descriptor.
+  const int num_reference_keypoints =
+      reference_keypoints_and_descriptors.keypoints.size();
+  const int num_candidates = (predicted_shift != nullptr) ?
+      std::min(kNumLocalSearchCandidates, num_reference_keypoints) : 1;
+  cv::Mat candidate_indices;
+  cv::Mat candidate_distances;
+  reference_features.descriptor_index->knnSearch(
+      image_keypoints_and_descriptors.descriptors,
+      candidate_indices,
+      candidate_distances,
+      num_candidates,
+      cv::flann::SearchParams(kFlannNumSearchChecks));
 
-  // Run the Flann-based matcher.
-  cv::FlannBasedMatcher matcher;
+  // Keep the nearest candidate of each image keypoint (that agrees with the
+  // predicted shift). FLANN returns squared L2 distances.
   std::vector<cv::DMatch> feature_matches;
-  matcher.match(descriptors_1, descriptors_2, feature_matches);
+  const int num_image_keypoints =
+      image_keypoints_and_descriptors.keypoints.size();
+  for (int i = 0; i < num_image_keypoints; ++i) {
+    const cv::Point2f& image_point =
+        image_keypoints_and_descriptors.keypoints[i].pt;
+    for (int candidate = 0; candidate < num_candidates; ++candidate) {
+      const int reference_index = candidate_indices.at<int>(i, candidate);
+      if (reference_index < 0 || reference_index >= num_reference_keypoints) {
+        continue;
+      }
+      if (predicted_shift != nullptr) {
+        const cv::Point2f& reference_point =
+            reference_keypoints_and_descriptors.keypoints[reference_index].pt;
+        const double offset_x =
+            image_point.x - reference_point.x - predicted_shift->x;
+        const double offset_y =
+            image_point.y - reference_point.y - predicted_shift->y;
+        if (offset_x * offset_x + offset_y * offset_y >
+            search_radius * search_radius) {
+          continue;
+        }
+      }
+      feature_matches.push_back(cv::DMatch(
+          reference_index,
+          i,
+          std::sqrt(candidate_distances.at<float>(i, candidate))));
+      break;
+    }
+  }
 
   // Filter out the keypoint matches to only keep the best ones based on
   // feature-space distance thresholding.
@@ -112,9 +226,9 @@ KeypointPairing FindMatchingFeatures(
   // Build a parallel list of keypoint match pairs.
   for (const cv::DMatch& match : good_feature_matches) {
     cv::Point2f pixel_loc_1 =
-        keypoints_and_descriptors_1.keypoints[match.queryIdx].pt;
+        reference_keypoints_and_descriptors.keypoints[match.queryIdx].pt;
     cv::Point2f pixel_loc_2 =
-        keypoints_and_descriptors_2.keypoints[match.trainIdx].pt;
+        image_keypoints_and_descriptors.keypoints[match.trainIdx].pt;
     keypoint_matches.first.push_back(pixel_loc_1);
     keypoint_matches.second.push_back(pixel_loc_2);
   }
@@ -156,10 +270,165 @@ KeypointPairing ApplyRANSAC(const KeypointPairing& unfiltered_matches) {
   return filtered_matches;
 }
 
+// Returns the rigid transformation between the matched keypoints after
+// removing outliers with RANSAC, or an empty matrix if it cannot be found.
+cv::Mat EstimateRigidTransform(const KeypointPairing& keypoint_matches) {
+  const KeypointPairing good_matches = ApplyRANSAC(keypoint_matches);
+  if (good_matches.first.size() < 3) {
+    return cv::Mat();
+  }
+
+  // Last parameter:
+  //   false = translation, rotation, scaling only (5 degrees of freedom).
+  //   true = finds full affine transformation (6 degrees of freedom).
+  return cv::estimateRigidTransform(
+      good_matches.first, good_matches.second, false);
+}
+
+// Registers the given image against the reference features, and returns the
+// translation of the rigid transformation between the matched keypoints.
+//
+// With pyramid levels, the shift is first estimated between the coarse
+// images, whose keypoints are few and cheap to match. The full resolution
+// keypoints are then only matched locally around the coarse estimate, which
+// keeps the matching cost from growing with the number of keypoints squared
+// and rejects far-away false matches. If the coarse estimate fails, the full
+// resolution keypoints are matched globally.
+MotionShift EstimateFeatureMatchingShift(
+    const ReferenceFeatures& reference_features,
+    const ReferenceFeatures& coarse_reference_features,
+    const ImageData& image,
+    const TranslationalRegistrationOptions& options) {
+
+  const cv::Mat detection_image =
+      GetDetectionImage(image, options.structure_mode);
+
+  cv::Point2f predicted_shift;
+  bool has_predicted_shift = false;
+  const double coarse_scale = 1 << options.num_pyramid_levels;
+  if (options.num_pyramid_levels > 0) {
+    const KeypointsAndDescriptors coarse_keypoints = DetectKeypoints(
+        GetCoarseDetectionImage(detection_image, options.num_pyramid_levels));
+    const cv::Mat coarse_transform = EstimateRigidTransform(
+        FindMatchingFeatures(
+            coarse_reference_features, coarse_keypoints, nullptr, 0.0));
+    if (!coarse_transform.empty()) {
+      predicted_shift = cv::Point2f(
+          coarse_transform.at<double>(0, 2) * coarse_scale,
+          coarse_transform.at<double>(1, 2) * coarse_scale);
+      has_predicted_shift = true;
+    } else {
+      LOG(WARNING) << "Could not estimate the coarse motion shift. "
+                   << "Matching all keypoints at full resolution instead.";
+    }
+  }
+
+  const KeypointPairing keypoint_matches = FindMatchingFeatures(
+      reference_features,
+      DetectKeypoints(detection_image),
+      has_predicted_shift ? &predicted_shift : nullptr,
+      kLocalSearchRadiusInCoarsePixels * coarse_scale);
+  const cv::Mat affine_transform = EstimateRigidTransform(keypoint_matches);
+  CHECK(!affine_transform.empty())
+      << "Could not determine motion shift between images.";
+  const double dx = affine_transform.at<double>(0, 2);
+  const double dy = affine_transform.at<double>(1, 2);
+  return MotionShift(dx, dy);
+}
+
+// Returns the spectrum of the structure image of the given image. The mean is
+// removed and the image is multiplied by the (Hanning) window, so that the
+// image borders do not dominate the correlation.
+cv::Mat GetWindowedSpectrum(
+    const ImageData& image,
+    const cv::Mat& window,
+    const ImageStructureMode structure_mode) {
+
+  cv::Mat structure_image = image.GetStructureImage(structure_mode);
+  CHECK_EQ(structure_image.size(), window.size())
+      << "All images must have the same size for phase correlation.";
+  structure_image -= cv::mean(structure_image);
+  const cv::Mat windowed_image = structure_image.mul(window);
+  cv::Mat spectrum;
+  cv::dft(windowed_image, spectrum, cv::DFT_COMPLEX_OUTPUT);
+  return spectrum;
+}
+
+// Returns the offset (in [-0.5, 0.5] for a peak) of the vertex of the parabola
+// through three neighboring samples, relative to the center sample.
+double GetParabolicPeakOffset(
+    const double previous_value,
+    const double peak_value,
+    const double next_value) {
+
+  const double curvature = previous_value - 2.0 * peak_value + next_value;
+  if (std::abs(curvature) < kPhaseCorrelationEpsilon) {
+    return 0.0;
+  }
+  return 0.5 * (previous_value - next_value) / curvature;
+}
+
+// Estimates the translation of the given image relative to the reference
+// from the peak of the normalized cross-power spectrum:
+//   R = (F_i * conj(F_0)) / |F_i * conj(F_0)|,
+// whose inverse transform is (ideally) an impulse at the shift. The peak is
+// refined to sub-pixel accuracy with a parabola fit along each axis.
+MotionShift EstimatePhaseCorrelationShift(
+    const cv::Mat& reference_spectrum,
+    const cv::Mat& window,
+    const ImageData& image,
+    const ImageStructureMode structure_mode) {
+
+  const cv::Mat spectrum = GetWindowedSpectrum(image, window, structure_mode);
+  cv::Mat cross_power_spectrum;
+  cv::mulSpectrums(
+      spectrum, reference_spectrum, cross_power_spectrum, 0, true);
+  for (int row = 0; row < cross_power_spectrum.rows; ++row) {
+    cv::Vec2d* values = cross_power_spectrum.ptr<cv::Vec2d>(row);
+    for (int col = 0; col < cross_power_spectrum.cols; ++col) {
+      const double magnitude = std::sqrt(
+          values[col][0] * values[col][0] + values[col][1] * values[col][1]);
+      if (magnitude > kPhaseCorrelationEpsilon) {
+        values[col][0] /= magnitude;
+        values[col][1] /= magnitude;
+      }
+    }
+  }
+  cv::Mat correlation;
+  cv::dft(
+      cross_power_spectrum,
+      correlation,
+      cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+
+  cv::Point peak;
+  cv::minMaxLoc(correlation, nullptr, nullptr, nullptr, &peak);
+
+  // The correlation is circular, so the neighbors wrap around the borders.
+  const int width = correlation.cols;
+  const int height = correlation.rows;
+  const double peak_value = correlation.at<double>(peak.y, peak.x);
+  const double offset_x = GetParabolicPeakOffset(
+      correlation.at<double>(peak.y, (peak.x + width - 1) % width),
+      peak_value,
+      correlation.at<double>(peak.y, (peak.x + 1) % width));
+  const double offset_y = GetParabolicPeakOffset(
+      correlation.at<double>((peak.y + height - 1) % height, peak.x),
+      peak_value,
+      correlation.at<double>((peak.y + 1) % height, peak.x));
+
+  // Peaks past the middle of the image are negative shifts.
+  const double dx = ((peak.x > width / 2) ? peak.x - width : peak.x) +
+      offset_x;
+  const double dy = ((peak.y > height / 2) ? peak.y - height : peak.y) +
+      offset_y;
+  return MotionShift(dx, dy);
+}
+
 }  // namespace
 
 MotionShiftSequence TranslationalRegistration(
-    const std::vector<ImageData>& images) {
+    const std::vector<ImageData>& images,
+    const TranslationalRegistrationOptions& options) {
 
   // If no images, return an empty sequence.
   if (images.empty()) {
@@ -167,35 +436,68 @@ MotionShiftSequence TranslationalRegistration(
     return MotionShiftSequence();
   }
 
-  // The first image is relative to itself, so its shift is always (0, 0).
-  std::vector<MotionShift> motion_shifts;
-  motion_shifts.push_back(MotionShift(0, 0));
+  // Everything derived from the reference image (its keypoints, or its
+  // windowed spectrum) is computed once and shared (read-only) by all frames.
+  std::function<MotionShift(const int)> estimate_shift;
+  ReferenceFeatures reference_features;
+  ReferenceFeatures coarse_reference_features;
+  cv::Mat window;
+  cv::Mat reference_spectrum;
+  switch (options.method) {
+    case REGISTRATION_FEATURE_MATCHING: {
+      CHECK_GE(options.num_pyramid_levels, 0)
+          << "The number of pyramid levels cannot be negative.";
+      const cv::Mat detection_image =
+          GetDetectionImage(images[0], options.structure_mode);
+      reference_features = GetReferenceFeatures(detection_image);
+      if (options.num_pyramid_levels > 0) {
+        coarse_reference_features = GetReferenceFeatures(
+            GetCoarseDetectionImage(
+                detection_image, options.num_pyramid_levels));
+      }
+      estimate_shift = [&](const int i) {
+        return EstimateFeatureMatchingShift(
+            reference_features, coarse_reference_features, images[i], options);
+      };
+      break;
+    }
+    case REGISTRATION_PHASE_CORRELATION:
+      cv::createHanningWindow(
+          window, images[0].GetImageSize(), util::kOpenCvMatrixType);
+      reference_spectrum =
+          GetWindowedSpectrum(images[0], window, options.structure_mode);
+      estimate_shift = [&](const int i) {
+        return EstimatePhaseCorrelationShift(
+            reference_spectrum, window, images[i], options.structure_mode);
+      };
+      break;
+    default:
+      LOG(FATAL) << "Unknown registration method.";
+  }
 
-  // Run keypoint matching between the first image and all other images.
-  const KeypointsAndDescriptors& image_0_keypoints =
-      DetectKeypoints(images[0]);
+  // The first image is relative to itself, so its shift is always (0, 0).
+  // Every other frame is registered independently against the first image,
+  // so they can be registered concurrently.
   const int num_images = images.size();
-  for (int i = 1; i < num_images; ++i) {
-    const KeypointsAndDescriptors& image_i_keypoints =
-        DetectKeypoints(images[i]);
-
-    // Get keypoint matches between images 0 and i, and apply RANSAC to remove
-    // bad matches.
-    const KeypointPairing& keypoint_matches =
-        FindMatchingFeatures(image_0_keypoints, image_i_keypoints);
-    const KeypointPairing& good_matches = ApplyRANSAC(keypoint_matches);
-
-    // Compute the affine transformation between the matched keypoints.
-    // Last parameter:
-    //   false = translation, rotation, scaling only (5 degrees of freedom).
-    //   true = finds full affine transformation (6 degrees of freedom).
-    const cv::Mat affine_transform = cv::estimateRigidTransform(
-        good_matches.first, good_matches.second, false);
-    CHECK(!affine_transform.empty())
-        << "Could not determine motion shift between images.";
-    const double dx = affine_transform.at<double>(0, 2);
-    const double dy = affine_transform.at<double>(1, 2);
-    motion_shifts.push_back(MotionShift(dx, dy));
+  std::vector<MotionShift> motion_shifts(num_images, MotionShift(0, 0));
+  const auto register_image = [&](const int i) {
+    motion_shifts[i] = estimate_shift(i);
+  };
+
+  const int num_frames_to_register = num_images - 1;
+  const int num_workers = std::min(
+      util::GetNumThreadsToUse(options.num_threads), num_frames_to_register);
+  if (num_workers > 1) {
+    // The calling thread also registers frames, so one fewer worker is
+    // needed.
+    util::ThreadPool thread_pool(num_workers - 1);
+    thread_pool.ParallelFor(num_frames_to_register, [&](const int index) {
+      register_image(index + 1);
+    });
+  } else {
+    for (int i = 1; i < num_images; ++i) {
+      register_image(i);
+    }
   }
   return MotionShiftSequence(motion_shifts);
 }
@@ -1,4 +1,4 @@
-// This file provides everal utility registration functions that perform an
+// This file provides several utility registration functions that perform an
 // image registration on some given ImageData images.
 //
 // TODO: Add support for dense optical flow:
@@ -17,10 +17,43 @@
 namespace super_resolution {
 namespace registration {
 
+// The strategies for estimating the translation between two images.
+enum RegistrationMethod {
+  // Detects BRISK keypoints in the structure image, matches them with FLANN
+  // and RANSAC, and fits a rigid transformation. This fails if there are not
+  // enough keypoint matches.
+  REGISTRATION_FEATURE_MATCHING,
+
+  // Finds the peak of the FFT phase correlation of the structure images,
+  // refined to sub-pixel accuracy. This is faster and more robust for purely
+  // translational motion, and requires images of the same size.
+  REGISTRATION_PHASE_CORRELATION
+};
+
+struct TranslationalRegistrationOptions {
+  RegistrationMethod method = REGISTRATION_FEATURE_MATCHING;
+
+  // How the channels of every image are combined into the single image that
+  // is registered (see ImageData::GetStructureImage()).
+  ImageStructureMode structure_mode = STRUCTURE_IMAGE_MEAN;
+
+  // For feature matching, the number of times (if any) the images are
+  // downscaled by a factor of 2 to estimate a coarse shift first. The full
+  // resolution keypoints are then only matched near their predicted positions,
+  // which is faster and more robust for large images.
+  int num_pyramid_levels = 0;
+
+  // The frames are registered independently against the reference on this
+  // many threads (0 = all hardware threads).
+  int num_threads = 1;
+};
+
 // Performs translational registration on the given images, with the first
 // image in the list as the reference image.
 MotionShiftSequence TranslationalRegistration(
-    const std::vector<ImageData>& images);
+    const std::vector<ImageData>& images,
+    const TranslationalRegistrationOptions& options =
+        TranslationalRegistrationOptions());
 
 }  // namespace registration
 }  // namespace super_resolution
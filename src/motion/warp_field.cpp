@@ -0,0 +1,147 @@
+#include "motion/warp_field.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "motion/motion_shift.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+
+WarpField::WarpField() {
+  inverse_homography_ = cv::Mat::eye(3, 3, CV_64FC1);
+}
+
+WarpField WarpField::FromHomography(const cv::Mat& homography) {
+  CHECK((homography.rows == 3 || homography.rows == 2) &&
+        homography.cols == 3 && homography.channels() == 1)
+      << "A homography must be a 3x3 or 2x3 matrix.";
+
+  // Affine matrices keep the last row of the identity.
+  cv::Mat full_homography = cv::Mat::eye(3, 3, CV_64FC1);
+  cv::Mat given_rows = full_homography.rowRange(0, homography.rows);
+  homography.convertTo(given_rows, CV_64FC1);
+  WarpField warp_field;
+  const double inverted = cv::invert(
+      full_homography, warp_field.inverse_homography_, cv::DECOMP_LU);
+  CHECK_NE(inverted, 0.0) << "The homography is not invertible.";
+  return warp_field;
+}
+
+WarpField WarpField::FromFlow(const cv::Mat& flow) {
+  CHECK(!flow.empty()) << "The flow field is empty.";
+  CHECK_EQ(flow.channels(), 2) << "A flow field must have 2 channels.";
+
+  WarpField warp_field;
+  warp_field.inverse_homography_ = cv::Mat();
+  flow.convertTo(warp_field.flow_, CV_64FC2);
+  return warp_field;
+}
+
+WarpField WarpField::FromMotionShift(const MotionShift& motion_shift) {
+  const cv::Mat homography = (cv::Mat_<double>(3, 3)
+      << 1, 0, motion_shift.dx,
+         0, 1, motion_shift.dy,
+         0, 0, 1);
+  return FromHomography(homography);
+}
+
+void WarpField::ComputeSampleMaps(
+    const cv::Size& image_size, cv::Mat* map_x, cv::Mat* map_y) const {
+
+  CHECK_NOTNULL(map_x);
+  CHECK_NOTNULL(map_y);
+
+  map_x->create(image_size, CV_64FC1);
+  map_y->create(image_size, CV_64FC1);
+  if (IsFlow()) {
+    CHECK_EQ(flow_.size(), image_size)
+        << "The flow field does not match the image size.";
+    for (int row = 0; row < image_size.height; ++row) {
+      const cv::Vec2d* flow_row = flow_.ptr<cv::Vec2d>(row);
+      double* map_x_row = map_x->ptr<double>(row);
+      double* map_y_row = map_y->ptr<double>(row);
+      for (int col = 0; col < image_size.width; ++col) {
+        map_x_row[col] = col - flow_row[col][0];
+        map_y_row[col] = row - flow_row[col][1];
+      }
+    }
+    return;
+  }
+
+  const cv::Mat& h = inverse_homography_;
+  const double h00 = h.at<double>(0, 0);
+  const double h01 = h.at<double>(0, 1);
+  const double h02 = h.at<double>(0, 2);
+  const double h10 = h.at<double>(1, 0);
+  const double h11 = h.at<double>(1, 1);
+  const double h12 = h.at<double>(1, 2);
+  const double h20 = h.at<double>(2, 0);
+  const double h21 = h.at<double>(2, 1);
+  const double h22 = h.at<double>(2, 2);
+  for (int row = 0; row < image_size.height; ++row) {
+    double* map_x_row = map_x->ptr<double>(row);
+    double* map_y_row = map_y->ptr<double>(row);
+    for (int col = 0; col < image_size.width; ++col) {
+      const double w = h20 * col + h21 * row + h22;
+      // Points that map to infinity never sample the image.
+      if (w == 0.0) {
+        map_x_row[col] = -1.0e9;
+        map_y_row[col] = -1.0e9;
+        continue;
+      }
+      map_x_row[col] = (h00 * col + h01 * row + h02) / w;
+      map_y_row[col] = (h10 * col + h11 * row + h12) / w;
+    }
+  }
+}
+
+void WarpFieldSequence::LoadHomographiesFromFile(
+    const std::string& file_path) {
+
+  std::ifstream fin(file_path);
+  CHECK(fin.is_open()) << "Could not open file " << file_path;
+
+  warp_fields_.clear();
+  std::string line;
+  while (std::getline(fin, line)) {
+    std::istringstream line_stream(line);
+    std::vector<double> values;
+    double value;
+    while (line_stream >> value) {
+      values.push_back(value);
+    }
+    if (values.empty()) {
+      continue;
+    }
+    if (values.size() == 2) {
+      warp_fields_.push_back(
+          WarpField::FromMotionShift(MotionShift(values[0], values[1])));
+      continue;
+    }
+    CHECK(values.size() == 6 || values.size() == 9)
+        << "Invalid warp in '" << file_path << "': expected 2, 6 or 9 values "
+        << "per line, but got " << values.size() << ".";
+    const cv::Mat homography(values.size() / 3, 3, CV_64FC1, values.data());
+    warp_fields_.push_back(WarpField::FromHomography(homography));
+  }
+  fin.close();
+
+  LOG(INFO) << "Loaded " << warp_fields_.size() << " warps from '"
+            << file_path << "'.";
+}
+
+const WarpField& WarpFieldSequence::GetWarpField(const int index) const {
+  CHECK(index >= 0 && index < warp_fields_.size())
+      << "The given index " << index << " is out of range. "
+      << "It must be between 0 and " << (warp_fields_.size() - 1);
+
+  return warp_fields_[index];
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,92 @@
+// Provides general (non-translational) motion models for frames whose motion
+// is not a pure pixel shift, e.g. handheld bursts with rotation or
+// perspective change. A WarpField describes where every pixel of a frame
+// samples the reference (HR) image, either with a global homography (which
+// includes affine motion) or with a dense flow field. Like a MotionShift
+// (dx, dy), which is the same as the homography [1 0 dx; 0 1 dy; 0 0 1], the
+// warp maps reference coordinates to frame coordinates, so the warped image
+// is warped(p) = reference(H^-1 p) or warped(p) = reference(p - flow(p)).
+
+#ifndef SRC_MOTION_WARP_FIELD_H_
+#define SRC_MOTION_WARP_FIELD_H_
+
+#include <string>
+#include <vector>
+
+#include "motion/motion_shift.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+class WarpField {
+ public:
+  // The identity warp.
+  WarpField();
+
+  // The warp of the given 3x3 homography (or 2x3 affine matrix), which maps
+  // reference pixel coordinates (x, y, 1) to frame pixel coordinates. The
+  // homography must be invertible.
+  static WarpField FromHomography(const cv::Mat& homography);
+
+  // The warp of the given dense flow field, a 2-channel CV_32F or CV_64F
+  // image of the displacement (dx, dy) of every frame pixel. The flow field
+  // fixes the image size of the warp.
+  static WarpField FromFlow(const cv::Mat& flow);
+
+  // The warp of a translation, which is the same as the MotionModule shift.
+  static WarpField FromMotionShift(const MotionShift& motion_shift);
+
+  // Computes the reference positions sampled by every pixel of an image of
+  // the given size. Both maps are CV_64FC1 images of that size, holding the x
+  // and y coordinates. Flow warps must have the same image size.
+  void ComputeSampleMaps(
+      const cv::Size& image_size, cv::Mat* map_x, cv::Mat* map_y) const;
+
+  // Returns true if the warp is given by a flow field.
+  bool IsFlow() const {
+    return !flow_.empty();
+  }
+
+ private:
+  // The inverse homography (frame to reference coordinates), or empty for
+  // flow warps.
+  cv::Mat inverse_homography_;
+
+  // The flow field in double precision, or empty for homography warps.
+  cv::Mat flow_;
+};
+
+// Defines an ordered sequence of warps, one per frame.
+class WarpFieldSequence {
+ public:
+  WarpFieldSequence() {}
+
+  explicit WarpFieldSequence(const std::vector<WarpField>& warp_fields)
+      : warp_fields_(warp_fields) {}
+
+  // Loads one homography per frame from a text file. Each line holds the
+  // values of one frame in row-major order: 9 values for a homography, 6 for
+  // an affine matrix (with the last row 0 0 1), or 2 for a translation (dx
+  // dy, as in the motion sequence files). Empty lines are skipped.
+  void LoadHomographiesFromFile(const std::string& file_path);
+
+  // Returns the number of warps.
+  int GetNumWarpFields() const {
+    return warp_fields_.size();
+  }
+
+  // Returns the warp of the given frame index.
+  const WarpField& GetWarpField(const int index) const;
+
+  const WarpField& operator[] (const int index) const {
+    return GetWarpField(index);
+  }
+
+ private:
+  std::vector<WarpField> warp_fields_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_MOTION_WARP_FIELD_H_
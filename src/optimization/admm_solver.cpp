@@ -1,36 +1,387 @@
 #include "optimization/admm_solver.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
 #include <memory>
+#include <utility>
+#include <vector>
 
+#include "image/image_data.h"
+#include "image_model/image_model.h"
 #include "optimization/objective_data_term.h"
-#include "optimization/objective_function.h"
+#include "optimization/regularizer.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
 
 namespace super_resolution {
+namespace {
+
+// The split variables of a single regularizer. The regularizer's difference
+// operators G are split off as z = Gx, and u is the scaled dual variable of
+// that constraint. Every vector has one value per difference operator per
+// data point.
+struct SplitRegularizer {
+  std::shared_ptr<Regularizer> regularizer;
+  double regularization_parameter;
+
+  std::vector<double> z;
+  std::vector<double> u;
+
+  // Scratch buffers for the differences Gx and for other intermediate values.
+  std::vector<double> differences;
+  std::vector<double> scratch;
+};
+
+double DotProduct(const std::vector<double>& a, const std::vector<double>& b) {
+  double dot_product = 0.0;
+  for (int64_t i = 0; i < a.size(); ++i) {
+    dot_product += a[i] * b[i];
+  }
+  return dot_product;
+}
+
+double SquaredNorm(const std::vector<double>& values) {
+  return DotProduct(values, values);
+}
+
+// Soft thresholding, the proximal operator of threshold * |x|.
+inline double Shrink(const double value, const double threshold) {
+  if (value > threshold) {
+    return value - threshold;
+  }
+  if (value < -threshold) {
+    return value + threshold;
+  }
+  return 0.0;
+}
+
+// Adds penalty * G^T (Gx - target) for every split regularizer to the result.
+// If use_target is false, the target is treated as zero (i.e. this computes
+// the product of the penalty Hessian with x). Otherwise, the target of each
+// split must be stored in its scratch buffer.
+void AddPenaltyGradient(
+    const double penalty,
+    const std::vector<double>& image_data,
+    const int num_channels,
+    const bool use_target,
+    std::vector<SplitRegularizer>* splits,
+    std::vector<double>* transpose_buffer,
+    std::vector<double>* result) {
+
+  const int64_t num_data_points = image_data.size();
+  for (SplitRegularizer& split : *splits) {
+    split.regularizer->ApplyDifferenceOperators(
+        image_data.data(), num_channels, split.differences.data());
+    if (use_target) {
+      for (int64_t i = 0; i < split.differences.size(); ++i) {
+        split.differences[i] -= split.scratch[i];
+      }
+    }
+    split.regularizer->ApplyDifferenceOperatorsTranspose(
+        split.differences.data(), num_channels, transpose_buffer->data());
+    for (int64_t i = 0; i < num_data_points; ++i) {
+      (*result)[i] += penalty * (*transpose_buffer)[i];
+    }
+  }
+}
+
+// Runs conjugate gradient on the x-update least squares problem
+//
+//   min_x ||Ax - y||^2 + (penalty / 2) * sum_j ||G_j x - z_j + u_j||^2,
+//
+// starting from the current estimate. The data term is quadratic, so the
+// product of its Hessian with a vector v is computed from the gradient as
+// grad(v) - grad(0), where data_gradient_at_zero is grad(0).
+//
+// Returns the norm of the final CG residual (the gradient of the problem).
+double UpdateEstimate(
+    const AdmmSolverOptions& options,
+    const ObjectiveDataTerm& data_term,
+    const std::vector<double>& data_gradient_at_zero,
+    const double penalty,
+    const int num_channels,
+    std::vector<SplitRegularizer>* splits,
+    std::vector<double>* estimate) {
+
+  const int64_t num_data_points = estimate->size();
+  for (SplitRegularizer& split : *splits) {
+    for (int64_t i = 0; i < split.z.size(); ++i) {
+      split.scratch[i] = split.z[i] - split.u[i];
+    }
+  }
+
+  // The CG residual is the negative gradient at the current estimate.
+  std::vector<double> residual(num_data_points, 0.0);
+  std::vector<double> transpose_buffer(num_data_points);
+  data_term.Compute(estimate->data(), residual.data());
+  AddPenaltyGradient(
+      penalty,
+      *estimate,
+      num_channels,
+      true,
+      splits,
+      &transpose_buffer,
+      &residual);
+  for (int64_t i = 0; i < num_data_points; ++i) {
+    residual[i] = -residual[i];
+  }
+
+  std::vector<double> direction = residual;
+  std::vector<double> hessian_direction(num_data_points);
+  double residual_squared_norm = SquaredNorm(residual);
+  for (int iteration = 0;
+       iteration < options.max_num_solver_iterations &&
+       std::sqrt(residual_squared_norm) > options.gradient_norm_threshold;
+       ++iteration) {
+    std::fill(hessian_direction.begin(), hessian_direction.end(), 0.0);
+    data_term.Compute(direction.data(), hessian_direction.data());
+    for (int64_t i = 0; i < num_data_points; ++i) {
+      hessian_direction[i] -= data_gradient_at_zero[i];
+    }
+    AddPenaltyGradient(
+        penalty,
+        direction,
+        num_channels,
+        false,
+        splits,
+        &transpose_buffer,
+        &hessian_direction);
+
+    const double curvature = DotProduct(direction, hessian_direction);
+    if (curvature <= 0.0) {
+      break;
+    }
+    const double step_size = residual_squared_norm / curvature;
+    for (int64_t i = 0; i < num_data_points; ++i) {
+      (*estimate)[i] += step_size * direction[i];
+      residual[i] -= step_size * hessian_direction[i];
+    }
+    const double new_residual_squared_norm = SquaredNorm(residual);
+    const double beta = new_residual_squared_norm / residual_squared_norm;
+    for (int64_t i = 0; i < num_data_points; ++i) {
+      direction[i] = residual[i] + beta * direction[i];
+    }
+    residual_squared_norm = new_residual_squared_norm;
+  }
+  return std::sqrt(residual_squared_norm);
+}
+
+}  // namespace
+
+void AdmmSolverOptions::PrintSolverOptions() const {
+  std::cout << "AdmmSolver Options" << std::endl;
+  std::cout << "  Objective:                           "
+            << "maximum a posteriori" << std::endl;
+  std::cout << "  Optimization strategy:               "
+            << "alternating direction method of multipliers" << std::endl;
+  MapSolverOptions::PrintSolverOptions();
+  std::cout << "  Initial penalty parameter:           "
+            << penalty_parameter;
+  if (use_adaptive_penalty) {
+    std::cout << " (adaptive)";
+  }
+  std::cout << std::endl;
+  std::cout << "  Absolute tolerance:                  "
+            << absolute_tolerance << std::endl;
+  std::cout << "  Relative tolerance:                  "
+            << relative_tolerance << std::endl;
+}
+
+AdmmSolver::AdmmSolver(
+    const AdmmSolverOptions& solver_options,
+    const ImageModel& image_model,
+    const std::vector<ImageData>& low_res_images,
+    const bool print_solver_output)
+    : MapSolver(image_model, low_res_images, print_solver_output),
+      solver_options_(solver_options) {}
+
+AdmmSolver::AdmmSolver(
+    const AdmmSolverOptions& solver_options,
+    const ImageModel& image_model,
+    const std::shared_ptr<const SharedSolverInputs>& inputs,
+    const bool print_solver_output)
+    : MapSolver(image_model, inputs, print_solver_output),
+      solver_options_(solver_options) {}
 
 ImageData AdmmSolver::Solve(const ImageData& initial_estimate) {
+  const int64_t num_pixels = GetNumPixels();
   const int num_channels = GetNumChannels();
-  const int num_data_points = GetNumDataPoints();
-
-  ObjectiveFunction data_term_objective(num_data_points);
-  // TODO: Fix the range (0 - num_channels?).
-  std::shared_ptr<ObjectiveTerm> data_term(new ObjectiveDataTerm(
-      image_model_, observations_, 0, num_channels, GetImageSize()));
-  data_term_objective.AddTerm(data_term);
-  // ObjectiveEqualityConstraintTerm  TODO: implement this.
-
-  ObjectiveFunction regularization_objective(num_data_points);
-  // ObjectiveRegularizationTerm ?
-  // ObjectiveEqualityConstraintTerm
-
-  // TODO: verify that this is the correct approach and then implement it.
-  // X = Z = initial_estimate;
-  // while (not converged) {
-  //   Z = solve(data_term_objective) <- X, Z
-  //   X = solve(regularization_objective) <- X, Z
-  // }
-
-  // TODO: return the solved Image.
-  return initial_estimate;
+  const int64_t num_data_points = GetNumDataPoints();
+  const cv::Size image_size = GetImageSize();
+  CHECK_EQ(initial_estimate.GetNumPixels(), num_pixels);
+  CHECK_EQ(initial_estimate.GetNumChannels(), num_channels);
+  CHECK_EQ(initial_estimate.GetImageSize(), image_size);
+
+  if (IsVerbose()) {
+    solver_options_.PrintSolverOptions();
+  }
+
+  const ObjectiveDataTerm data_term(
+      *image_model_,
+      GetObservations(),
+      0,
+      num_channels,
+      image_size,
+      solver_options_.num_threads,
+      solver_options_.use_single_precision ?
+          SINGLE_PRECISION : DOUBLE_PRECISION,
+      GetCompiledImageModel(solver_options_));
+
+  std::vector<double> estimate(num_data_points);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const double* channel_ptr = initial_estimate.GetChannelData(channel);
+    std::copy(
+        channel_ptr,
+        channel_ptr + num_pixels,
+        estimate.begin() + channel * num_pixels);
+  }
+
+  // Initialize z = Gx and u = 0 for every regularizer.
+  std::vector<SplitRegularizer> splits;
+  int num_split_variables = 0;
+  for (const auto& regularizer_and_parameter : regularizers_) {
+    if (regularizer_and_parameter.second <= 0.0) {
+      continue;
+    }
+    const int num_operators =
+        regularizer_and_parameter.first->GetNumDifferenceOperators();
+    CHECK_GT(num_operators, 0)
+        << "The ADMM solver only supports regularizers that are defined by "
+        << "difference operators.";
+    const int64_t num_variables = num_operators * num_data_points;
+    SplitRegularizer split;
+    split.regularizer = regularizer_and_parameter.first;
+    split.regularization_parameter = regularizer_and_parameter.second;
+    split.z.resize(num_variables);
+    split.u.assign(num_variables, 0.0);
+    split.differences.resize(num_variables);
+    split.scratch.resize(num_variables);
+    split.regularizer->ApplyDifferenceOperators(
+        estimate.data(), num_channels, split.z.data());
+    splits.push_back(std::move(split));
+    num_split_variables += num_variables;
+  }
+
+  std::vector<double> data_gradient_at_zero(num_data_points, 0.0);
+  const std::vector<double> zeros(num_data_points, 0.0);
+  data_term.Compute(zeros.data(), data_gradient_at_zero.data());
+
+  std::vector<double> transpose_buffer(num_data_points);
+  std::vector<double> dual_residual(num_data_points);
+  std::vector<double> scaled_dual(num_data_points);
+  double penalty = solver_options_.penalty_parameter;
+  for (int iteration = 0;
+       iteration < solver_options_.max_num_admm_iterations;
+       ++iteration) {
+    const double update_residual_norm = UpdateEstimate(
+        solver_options_,
+        data_term,
+        data_gradient_at_zero,
+        penalty,
+        num_channels,
+        &splits,
+        &estimate);
+
+    // Without regularizers, this is just least squares.
+    if (splits.empty()) {
+      if (update_residual_norm <= solver_options_.gradient_norm_threshold) {
+        break;
+      }
+      continue;
+    }
+
+    // Update z with shrinkage and then update the dual variables. The old z
+    // is kept in the scratch buffer to compute the dual residual.
+    double primal_residual_squared_norm = 0.0;
+    double differences_squared_norm = 0.0;
+    double z_squared_norm = 0.0;
+    std::fill(dual_residual.begin(), dual_residual.end(), 0.0);
+    std::fill(scaled_dual.begin(), scaled_dual.end(), 0.0);
+    for (SplitRegularizer& split : splits) {
+      split.regularizer->ApplyDifferenceOperators(
+          estimate.data(), num_channels, split.differences.data());
+      const double threshold = split.regularization_parameter / penalty;
+      for (int64_t i = 0; i < split.z.size(); ++i) {
+        const double difference = split.differences[i];
+        const double value = difference + split.u[i];
+        const double new_z = Shrink(value, threshold);
+        split.scratch[i] = new_z - split.z[i];
+        split.z[i] = new_z;
+        split.u[i] = value - new_z;
+
+        const double constraint_violation = difference - new_z;
+        primal_residual_squared_norm +=
+            constraint_violation * constraint_violation;
+        differences_squared_norm += difference * difference;
+        z_squared_norm += new_z * new_z;
+      }
+
+      // Dual residual penalty * G^T (z - z_old).
+      split.regularizer->ApplyDifferenceOperatorsTranspose(
+          split.scratch.data(), num_channels, transpose_buffer.data());
+      for (int64_t i = 0; i < num_data_points; ++i) {
+        dual_residual[i] += penalty * transpose_buffer[i];
+      }
+      // Dual variable in the x space penalty * G^T u.
+      split.regularizer->ApplyDifferenceOperatorsTranspose(
+          split.u.data(), num_channels, transpose_buffer.data());
+      for (int64_t i = 0; i < num_data_points; ++i) {
+        scaled_dual[i] += penalty * transpose_buffer[i];
+      }
+    }
+
+    const double primal_residual_norm =
+        std::sqrt(primal_residual_squared_norm);
+    const double dual_residual_norm = std::sqrt(SquaredNorm(dual_residual));
+    const double primal_tolerance =
+        std::sqrt(num_split_variables) * solver_options_.absolute_tolerance +
+        solver_options_.relative_tolerance * std::sqrt(std::max(
+            differences_squared_norm, z_squared_norm));
+    const double dual_tolerance =
+        std::sqrt(num_data_points) * solver_options_.absolute_tolerance +
+        solver_options_.relative_tolerance * std::sqrt(
+            SquaredNorm(scaled_dual));
+    LOG(INFO) << "ADMM Iteration complete (#" << (iteration + 1) << "). "
+              << "Primal residual is " << primal_residual_norm
+              << " and dual residual is " << dual_residual_norm
+              << " with penalty " << penalty << ".";
+    if (primal_residual_norm <= primal_tolerance &&
+        dual_residual_norm <= dual_tolerance) {
+      break;
+    }
+
+    // Balance the primal and dual residuals by adapting the penalty. The
+    // scaled dual variables u = y / penalty must be rescaled accordingly.
+    if (solver_options_.use_adaptive_penalty) {
+      double penalty_scale = 1.0;
+      if (primal_residual_norm >
+          solver_options_.penalty_balance_threshold * dual_residual_norm) {
+        penalty_scale = solver_options_.penalty_scale_factor;
+      } else if (dual_residual_norm >
+          solver_options_.penalty_balance_threshold * primal_residual_norm) {
+        penalty_scale = 1.0 / solver_options_.penalty_scale_factor;
+      }
+      if (penalty_scale != 1.0) {
+        penalty *= penalty_scale;
+        for (SplitRegularizer& split : splits) {
+          for (double& u_value : split.u) {
+            u_value /= penalty_scale;
+          }
+        }
+      }
+    }
+  }
+
+  ImageData estimated_image;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    estimated_image.AddChannel(
+        estimate.data() + channel * num_pixels, image_size);
+  }
+  return estimated_image;
 }
 
 }  // namespace super_resolution
@@ -1,13 +1,83 @@
+// An alternating direction method of multipliers (ADMM) implementation of the
+// MAP objective formulation. Each regularizer is split off from the data term
+// with a new variable z = Gx, where G are the regularizer's difference
+// operators (see Regularizer::GetNumDifferenceOperators()). The objective
+//
+//   ||Ax - y||_2^2 + lambda * ||Gx||_1
+//
+// is then minimized by alternating between a least squares update of x, a
+// closed-form shrinkage (soft thresholding) update of z, and a dual update.
+// Unlike IRLS, the 1-norm is minimized directly without any reweighting.
+
 #ifndef SRC_OPTIMIZATION_ADMM_SOLVER_H_
 #define SRC_OPTIMIZATION_ADMM_SOLVER_H_
 
+#include <memory>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
 #include "optimization/map_solver.h"
 
 namespace super_resolution {
 
+struct AdmmSolverOptions : public MapSolverOptions {
+  // The x-update is warm-started from the previous ADMM iteration, so it only
+  // needs a few conjugate gradient iterations.
+  AdmmSolverOptions() {
+    max_num_solver_iterations = 10;
+  }
+
+  // Print also includes specific ADMM parameters.
+  virtual void PrintSolverOptions() const;
+
+  // Maximum number of ADMM iterations. Each iteration runs conjugate gradient
+  // for the x-update, which is limited by max_num_solver_iterations and stops
+  // early once the residual norm is below gradient_norm_threshold.
+  int max_num_admm_iterations = 100;
+
+  // The initial penalty parameter (rho) of the augmented Lagrangian. Larger
+  // values enforce the z = Gx constraint more strongly at the cost of slower
+  // progress on the objective.
+  double penalty_parameter = 1.0;
+
+  // If true, the penalty parameter is adapted after every iteration to keep
+  // the primal and dual residuals within penalty_balance_threshold of each
+  // other. The penalty is multiplied or divided by penalty_scale_factor.
+  bool use_adaptive_penalty = true;
+  double penalty_balance_threshold = 10.0;
+  double penalty_scale_factor = 2.0;
+
+  // The solver stops when both the primal and dual residual norms fall below
+  // their tolerances, which are computed from these absolute and relative
+  // tolerances as described by Boyd et al. (2011), Section 3.3.1.
+  double absolute_tolerance = 1.0e-4;
+  double relative_tolerance = 1.0e-3;
+};
+
 class AdmmSolver : public MapSolver {
  public:
+  AdmmSolver(
+      const AdmmSolverOptions& solver_options,
+      const ImageModel& image_model,
+      const std::vector<ImageData>& low_res_images,
+      const bool print_solver_output = true);
+
+  // Same as above, but shares the observations (and the compiled image
+  // model) with other solvers instead of copying them.
+  AdmmSolver(
+      const AdmmSolverOptions& solver_options,
+      const ImageModel& image_model,
+      const std::shared_ptr<const SharedSolverInputs>& inputs,
+      const bool print_solver_output = true);
+
+  // The ADMM solver implementation. All channels are solved together. Every
+  // regularizer must be defined by difference operators.
   virtual ImageData Solve(const ImageData& initial_estimate);
+
+ private:
+  // Passed in through the constructor.
+  const AdmmSolverOptions solver_options_;
 };
 
 }  // namespace super_resolution
@@ -1,9 +1,11 @@
 #include "optimization/alglib_objective.h"
 
+#include <cstdint>
 #include <utility>
 #include <vector>
 
 #include "optimization/objective_function.h"
+#include "util/profiler.h"
 
 #include "alglib/src/optimization.h"
 
@@ -139,12 +141,160 @@ double RunLBFGSSolverAnalyticalDiff(
   return solver_state.f;
 }
 
+AlglibSolverSession::AlglibSolverSession(
+    const MapSolverOptions& solver_options,
+    const ObjectiveFunction& objective_function)
+    : solver_options_(solver_options),
+      objective_function_(objective_function),
+      has_preconditioner_(false),
+      num_parameters_(0),
+      num_solves_(0),
+      max_num_iterations_(solver_options.max_num_solver_iterations) {
+
+  CHECK(solver_options_.least_squares_solver == CG_SOLVER ||
+        solver_options_.least_squares_solver == LBFGS_SOLVER)
+      << "ALGLIB only supports CG_SOLVER or LBFGS_SOLVER.";
+}
+
+double AlglibSolverSession::Solve(alglib::real_1d_array* solver_data) {
+  CHECK_NOTNULL(solver_data);
+  InitializeSolverState(*solver_data);
+  num_solves_++;
+  if (has_preconditioner_) {
+    CHECK_EQ(preconditioner_.length(), num_parameters_)
+        << "The preconditioner does not match the number of parameters.";
+    if (solver_options_.least_squares_solver == CG_SOLVER) {
+      alglib::mincgsetprecdiag(cg_solver_state_, preconditioner_);
+    } else {
+      alglib::minlbfgssetprecdiag(lbfgs_solver_state_, preconditioner_);
+    }
+  }
+
+  void* objective_function_ptr = const_cast<void*>(
+      reinterpret_cast<const void*>(&objective_function_));
+  if (solver_options_.least_squares_solver == CG_SOLVER) {
+    alglib::mincgreport solver_report;
+    if (solver_options_.use_numerical_differentiation) {
+      alglib::mincgoptimize(
+          cg_solver_state_,
+          AlglibObjectiveFunctionNumericalDiff,
+          AlglibSolverIterationCallback,
+          objective_function_ptr);
+    } else {
+      alglib::mincgoptimize(
+          cg_solver_state_,
+          AlglibObjectiveFunction,
+          AlglibSolverIterationCallback,
+          objective_function_ptr);
+    }
+    alglib::mincgresultsbuf(cg_solver_state_, *solver_data, solver_report);
+    return cg_solver_state_.f;
+  }
+
+  alglib::minlbfgsreport solver_report;
+  if (solver_options_.use_numerical_differentiation) {
+    alglib::minlbfgsoptimize(
+        lbfgs_solver_state_,
+        AlglibObjectiveFunctionNumericalDiff,
+        AlglibSolverIterationCallback,
+        objective_function_ptr);
+  } else {
+    alglib::minlbfgsoptimize(
+        lbfgs_solver_state_,
+        AlglibObjectiveFunction,
+        AlglibSolverIterationCallback,
+        objective_function_ptr);
+  }
+  alglib::minlbfgsresultsbuf(lbfgs_solver_state_, *solver_data, solver_report);
+  return lbfgs_solver_state_.f;
+}
+
+void AlglibSolverSession::SetDiagonalPreconditioner(
+    const std::vector<double>& hessian_diagonal) {
+
+  preconditioner_.setcontent(hessian_diagonal.size(), hessian_diagonal.data());
+  has_preconditioner_ = true;
+}
+
+void AlglibSolverSession::InitializeSolverState(
+    const alglib::real_1d_array& solver_data) {
+
+  const int64_t num_parameters = solver_data.length();
+  if (num_solves_ > 0) {
+    CHECK_EQ(num_parameters, num_parameters_)
+        << "The number of parameters cannot change between solves.";
+    // The state is already set up, so just restart it from the new point.
+    // This keeps all of the allocated solver buffers and stopping criteria.
+    if (solver_options_.least_squares_solver == CG_SOLVER) {
+      alglib::mincgrestartfrom(cg_solver_state_, solver_data);
+    } else {
+      alglib::minlbfgsrestartfrom(lbfgs_solver_state_, solver_data);
+    }
+    return;
+  }
+
+  num_parameters_ = num_parameters;
+  if (solver_options_.least_squares_solver == CG_SOLVER) {
+    if (solver_options_.use_numerical_differentiation) {
+      alglib::mincgcreatef(
+          solver_data,
+          solver_options_.numerical_differentiation_step,
+          cg_solver_state_);
+    } else {
+      alglib::mincgcreate(solver_data, cg_solver_state_);
+    }
+    alglib::mincgsetxrep(cg_solver_state_, true);
+  } else {
+    if (solver_options_.use_numerical_differentiation) {
+      alglib::minlbfgscreatef(
+          solver_options_.num_lbfgs_hessian_corrections,
+          solver_data,
+          solver_options_.numerical_differentiation_step,
+          lbfgs_solver_state_);
+    } else {
+      alglib::minlbfgscreate(
+          solver_options_.num_lbfgs_hessian_corrections,
+          solver_data,
+          lbfgs_solver_state_);
+    }
+    alglib::minlbfgssetxrep(lbfgs_solver_state_, true);
+  }
+  SetStoppingCriteria();
+}
+
+void AlglibSolverSession::SetMaxNumIterations(const int max_num_iterations) {
+  max_num_iterations_ = max_num_iterations;
+  if (num_solves_ > 0) {
+    SetStoppingCriteria();
+  }
+}
+
+void AlglibSolverSession::SetStoppingCriteria() {
+  if (solver_options_.least_squares_solver == CG_SOLVER) {
+    alglib::mincgsetcond(
+        cg_solver_state_,
+        solver_options_.gradient_norm_threshold,
+        solver_options_.cost_decrease_threshold,
+        solver_options_.parameter_variation_threshold,
+        max_num_iterations_);
+  } else {
+    alglib::minlbfgssetcond(
+        lbfgs_solver_state_,
+        solver_options_.gradient_norm_threshold,
+        solver_options_.cost_decrease_threshold,
+        solver_options_.parameter_variation_threshold,
+        max_num_iterations_);
+  }
+}
+
 void AlglibObjectiveFunction(
     const alglib::real_1d_array& estimated_data,
     double& residual_sum,  // NOLINT
     alglib::real_1d_array& gradient,  // NOLINT
     void* objective_function_ptr) {
 
+  PROFILE_SCOPE("AlglibObjectiveFunction");
+
   const ObjectiveFunction* objective_function =
       reinterpret_cast<ObjectiveFunction*>(objective_function_ptr);
   residual_sum = objective_function->ComputeAllTerms(
@@ -156,6 +306,8 @@ void AlglibObjectiveFunctionNumericalDiff(
     double& residual_sum,  // NOLINT
     void* objective_function_ptr) {
 
+  PROFILE_SCOPE("AlglibObjectiveFunctionNumericalDiff");
+
   const ObjectiveFunction* objective_function =
       reinterpret_cast<ObjectiveFunction*>(objective_function_ptr);
   residual_sum = objective_function->ComputeAllTerms(
@@ -167,9 +319,12 @@ void AlglibSolverIterationCallback(
     double residual_sum,
     void* objective_function_ptr) {
 
+  PROFILE_SCOPE("AlglibSolverIterationCallback");
+
   ObjectiveFunction* objective_function =
       reinterpret_cast<ObjectiveFunction*>(objective_function_ptr);
-  objective_function->ReportIterationComplete(residual_sum);
+  objective_function->ReportIterationComplete(
+      residual_sum, -1.0, estimated_data.getcontent());
 
   // TODO: Don't log this if the solver is not verbose...
   LOG(INFO) << "Iteration complete ("
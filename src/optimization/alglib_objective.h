@@ -5,6 +5,9 @@
 #ifndef SRC_OPTIMIZATION_ALGLIB_OBJECTIVE_H_
 #define SRC_OPTIMIZATION_ALGLIB_OBJECTIVE_H_
 
+#include <cstdint>
+#include <vector>
+
 #include "optimization/map_solver.h"
 #include "optimization/objective_function.h"
 
@@ -44,6 +47,68 @@ double RunLBFGSSolverAnalyticalDiff(
     const ObjectiveFunction& objective_function,
     alglib::real_1d_array* solver_data);
 
+// Runs the ALGLIB solver selected by the solver options repeatedly on the
+// same objective function, keeping the solver state between runs. The first
+// call to Solve() creates the solver state, and every following call restarts
+// the existing state from the new starting point. This avoids reallocating
+// the state for every run, which is useful for solvers that run many times on
+// the same problem (e.g. once for every IRLS iteration).
+//
+// The objective function is referenced, so it must outlive the session. It
+// may be changed between runs (e.g. by updating IRLS weights in place), but
+// its number of parameters must stay the same.
+class AlglibSolverSession {
+ public:
+  AlglibSolverSession(
+      const MapSolverOptions& solver_options,
+      const ObjectiveFunction& objective_function);
+
+  // Runs the solver starting from the given solver_data, which is modified to
+  // contain the solution. The number of parameters must be the same for every
+  // call.
+  //
+  // Returns the final objective cost value.
+  double Solve(alglib::real_1d_array* solver_data);
+
+  // Preconditions the following solves with the given diagonal of the
+  // approximate Hessian (not its inverse), which must have one positive value
+  // per parameter.
+  void SetDiagonalPreconditioner(const std::vector<double>& hessian_diagonal);
+
+  // Limits the following solves to the given number of iterations (0 for no
+  // limit) instead of MapSolverOptions::max_num_solver_iterations, e.g. to
+  // finish before a deadline.
+  void SetMaxNumIterations(const int max_num_iterations);
+
+  // Returns the number of times that the solver was run.
+  int GetNumSolves() const {
+    return num_solves_;
+  }
+
+ private:
+  // Creates or restarts the solver state from the given starting point.
+  void InitializeSolverState(const alglib::real_1d_array& solver_data);
+
+  // Sets the stopping criteria of the solver state.
+  void SetStoppingCriteria();
+
+  const MapSolverOptions solver_options_;
+  const ObjectiveFunction& objective_function_;
+
+  // Only the state of the solver selected by the options is used.
+  alglib::mincgstate cg_solver_state_;
+  alglib::minlbfgsstate lbfgs_solver_state_;
+
+  // The diagonal preconditioner, which is empty if none is set.
+  alglib::real_1d_array preconditioner_;
+  bool has_preconditioner_;
+
+  // The number of parameters the solver state was created for.
+  int64_t num_parameters_;
+  int num_solves_;
+  int max_num_iterations_;
+};
+
 // The objective function used by the ALGLIB solver to compute residuals. This
 // version uses analyitical differentiation, meaning that the gradient is
 // computed manually.
@@ -55,7 +120,8 @@ void AlglibObjectiveFunction(
 
 // The same objective function as above, but does not compute the gradients.
 // This is for numerical differentiation (test purposes only). This version of
-// the objective function is very slow.
+// the objective function is very slow. To validate analytical gradients on
+// larger images, use ComputeColoredNumericalGradient() instead.
 void AlglibObjectiveFunctionNumericalDiff(
     const alglib::real_1d_array& estimated_data,
     double& residual_sum,  // NOLINT
@@ -1,47 +1,35 @@
 // The bilateral total variation regularizer is a cheap-to-compute
 // edge-preserving method for approximating the image gradient (i.e. standard
 // total variation).
+//
+// BTV is the 1-norm stencil of the decay-weighted differences between every
+// pixel and the pixels below and to the right of it within the scale range
+// (see GetBilateralTotalVariationStencil()), so it shares the residual and
+// gradient kernels of the StencilRegularizer.
 
 #ifndef SRC_OPTIMIZATION_BTV_REGULARIZER_H_
 #define SRC_OPTIMIZATION_BTV_REGULARIZER_H_
 
-#include <utility>
-#include <vector>
-
-#include "optimization/regularizer.h"
+#include "optimization/stencil_regularizer.h"
 
 #include "opencv2/core/core.hpp"
 
 namespace super_resolution {
 
-class BilateralTotalVariationRegularizer : public Regularizer {
+class BilateralTotalVariationRegularizer : public StencilRegularizer {
  public:
+  // The scale range controls the size of the patch that is checked for pixel
+  // intensity variation. BTV has one difference operator for every offset
+  // (i, j) in the window except (0, 0), ordered by i and then j.
+  //
+  // The spatial decay parameter (0 < spatial_decay <= 1) controls the weight
+  // of each compared pixel. Pixels further from from the source pixel will
+  // receive lower weights. Smaller spatial_decay values mean more decay as the
+  // pixels get further, and larger values will make the decay minimal.
   BilateralTotalVariationRegularizer(
       const cv::Size& image_size,
       const int scale_range,
       const double spatial_decay);
-
-  virtual std::vector<double> ApplyToImage(
-      const double* image_data, const int num_channels) const;
-
-  virtual std::pair<std::vector<double>, std::vector<double>>
-  ApplyToImageWithDifferentiation(
-      const double* image_data,
-      const std::vector<double>& gradient_constants,
-      const int num_channels) const;
-
- private:
-  // The scale range controls the size of the patch that is checked for pixel
-  // intensity variation.
-  const int scale_range_;
-
-  // The spatial decay parameter (0 < spatial_decay_ < 1) controls the weight
-  // of each compared pixel. Pixels further from from the source pixel will
-  // receive lower weights.
-  //
-  // Smaller spatial_decay_ values mean more decay as the pixels get further,
-  // and larger values will make the decay minimal.
-  const double spatial_decay_;
 };
 
 }  // namespace super_resolution
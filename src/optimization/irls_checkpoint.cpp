@@ -0,0 +1,193 @@
+#include "optimization/irls_checkpoint.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+constexpr char kCheckpointMagic[] = "SRIRLSCK";
+constexpr int kCheckpointMagicSize = 8;
+constexpr uint32_t kCheckpointVersion = 2;
+
+// The FNV-1a parameters of the 64 bit hashes.
+constexpr uint64_t kHashOffsetBasis = 14695981039346656037ULL;
+constexpr uint64_t kHashPrime = 1099511628211ULL;
+
+// Returns the given hash extended with the given bytes.
+uint64_t HashBytes(
+    uint64_t hash, const void* data, const int64_t num_bytes) {
+
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  for (int64_t i = 0; i < num_bytes; ++i) {
+    hash ^= bytes[i];
+    hash *= kHashPrime;
+  }
+  return hash;
+}
+
+// The number of temporary files created by this process, which makes their
+// names unique.
+std::atomic<int> num_temporary_files(0);
+
+template <typename T>
+void WriteValue(const T& value, std::ofstream* file) {
+  file->write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool ReadValue(std::ifstream* file, T* value) {
+  file->read(reinterpret_cast<char*>(value), sizeof(T));
+  return file->good();
+}
+
+void WriteValues(const std::vector<double>& values, std::ofstream* file) {
+  file->write(
+      reinterpret_cast<const char*>(values.data()),
+      values.size() * sizeof(double));
+}
+
+bool ReadValues(
+    std::ifstream* file,
+    const int64_t num_values,
+    std::vector<double>* values) {
+
+  values->resize(num_values);
+  file->read(
+      reinterpret_cast<char*>(values->data()), num_values * sizeof(double));
+  return file->good();
+}
+
+}  // namespace
+
+bool WriteIRLSCheckpoint(
+    const std::string& file_path, const IRLSCheckpoint& checkpoint) {
+
+  const int64_t num_data_points = checkpoint.estimate.size();
+  for (const std::vector<double>& weights : checkpoint.irls_weights) {
+    CHECK_EQ(weights.size(), num_data_points)
+        << "The IRLS weights do not match the estimate.";
+  }
+
+  const std::string temporary_file_path =
+      file_path + ".tmp." + std::to_string(getpid()) + "." +
+      std::to_string(num_temporary_files++);
+  std::ofstream file(temporary_file_path, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    LOG(ERROR) << "Could not open '" << temporary_file_path
+               << "' for writing the checkpoint.";
+    return false;
+  }
+  file.write(kCheckpointMagic, kCheckpointMagicSize);
+  WriteValue(kCheckpointVersion, &file);
+  WriteValue(checkpoint.problem_hash, &file);
+  WriteValue<int32_t>(checkpoint.channel_start, &file);
+  WriteValue<int32_t>(checkpoint.channel_end, &file);
+  WriteValue(num_data_points, &file);
+  WriteValue<int32_t>(checkpoint.num_completed_iterations, &file);
+  WriteValue<uint8_t>(checkpoint.is_converged ? 1 : 0, &file);
+  WriteValue(checkpoint.previous_cost, &file);
+  WriteValue(checkpoint.cost_difference, &file);
+  WriteValue<int32_t>(checkpoint.irls_weights.size(), &file);
+  WriteValues(checkpoint.estimate, &file);
+  for (const std::vector<double>& weights : checkpoint.irls_weights) {
+    WriteValues(weights, &file);
+  }
+  file.close();
+  if (file.fail()) {
+    LOG(ERROR) << "Could not write the checkpoint to '"
+               << temporary_file_path << "'.";
+    return false;
+  }
+  if (std::rename(temporary_file_path.c_str(), file_path.c_str()) != 0) {
+    LOG(ERROR) << "Could not move the checkpoint to '" << file_path << "'.";
+    return false;
+  }
+  return true;
+}
+
+bool ReadIRLSCheckpoint(
+    const std::string& file_path, IRLSCheckpoint* checkpoint) {
+
+  CHECK_NOTNULL(checkpoint);
+  std::ifstream file(file_path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  char magic[kCheckpointMagicSize];
+  uint32_t version = 0;
+  file.read(magic, kCheckpointMagicSize);
+  if (!file.good() ||
+      std::memcmp(magic, kCheckpointMagic, kCheckpointMagicSize) != 0 ||
+      !ReadValue(&file, &version) || version != kCheckpointVersion) {
+    LOG(WARNING) << "'" << file_path << "' is not a valid IRLS checkpoint.";
+    return false;
+  }
+
+  int32_t channel_start;
+  int32_t channel_end;
+  int64_t num_data_points;
+  int32_t num_completed_iterations;
+  uint8_t is_converged;
+  int32_t num_regularizers;
+  IRLSCheckpoint read_checkpoint;
+  bool is_valid =
+      ReadValue(&file, &read_checkpoint.problem_hash) &&
+      ReadValue(&file, &channel_start) &&
+      ReadValue(&file, &channel_end) &&
+      ReadValue(&file, &num_data_points) &&
+      ReadValue(&file, &num_completed_iterations) &&
+      ReadValue(&file, &is_converged) &&
+      ReadValue(&file, &read_checkpoint.previous_cost) &&
+      ReadValue(&file, &read_checkpoint.cost_difference) &&
+      ReadValue(&file, &num_regularizers) &&
+      num_data_points >= 0 && num_regularizers >= 0 &&
+      ReadValues(&file, num_data_points, &read_checkpoint.estimate);
+  read_checkpoint.irls_weights.resize(is_valid ? num_regularizers : 0);
+  for (std::vector<double>& weights : read_checkpoint.irls_weights) {
+    is_valid = is_valid && ReadValues(&file, num_data_points, &weights);
+  }
+  if (!is_valid) {
+    LOG(WARNING) << "The IRLS checkpoint '" << file_path << "' is truncated.";
+    return false;
+  }
+  read_checkpoint.channel_start = channel_start;
+  read_checkpoint.channel_end = channel_end;
+  read_checkpoint.num_completed_iterations = num_completed_iterations;
+  read_checkpoint.is_converged = (is_converged != 0);
+  *checkpoint = std::move(read_checkpoint);
+  return true;
+}
+
+uint64_t HashIRLSInitialEstimate(
+    const double* initial_estimate, const int64_t num_data_points) {
+
+  CHECK_NOTNULL(initial_estimate);
+  return HashBytes(
+      kHashOffsetBasis, initial_estimate, num_data_points * sizeof(double));
+}
+
+uint64_t HashIRLSProblemValues(
+    const uint64_t hash, const std::vector<double>& values) {
+
+  return HashBytes(hash, values.data(), values.size() * sizeof(double));
+}
+
+std::string GetIRLSCheckpointPath(
+    const std::string& checkpoint_path, const int round_index) {
+
+  return checkpoint_path + "." + std::to_string(round_index);
+}
+
+}  // namespace super_resolution
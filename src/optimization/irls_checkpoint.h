@@ -0,0 +1,86 @@
+// Checkpoints of the IRLS solver state, so that long solves can be resumed
+// after the process is interrupted (e.g. on a preemptible machine). A
+// checkpoint holds the state of a single channel split after a completed IRLS
+// iteration: the current estimate, the IRLS weights of every regularizer, and
+// the iteration counters.
+//
+// Checkpoints are stored in a compact binary format in the byte order of the
+// machine that wrote them:
+//   "SRIRLSCK" magic, uint32 version, uint64 problem_hash,
+//   int32 channel_start, int32 channel_end, int64 num_data_points,
+//   int32 num_completed_iterations, uint8 is_converged,
+//   double previous_cost, double cost_difference,
+//   int32 num_regularizers,
+//   num_data_points doubles of the estimate,
+//   num_regularizers * num_data_points doubles of the IRLS weights.
+// They are first written to a temporary file (unique to the writer) which then
+// replaces the previous checkpoint, so an interrupted write never corrupts the
+// last checkpoint, and concurrent writers do not share a temporary file.
+
+#ifndef SRC_OPTIMIZATION_IRLS_CHECKPOINT_H_
+#define SRC_OPTIMIZATION_IRLS_CHECKPOINT_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace super_resolution {
+
+struct IRLSCheckpoint {
+  // A hash of the problem that the split solves: the initial estimate that it
+  // was started from (see HashIRLSInitialEstimate()), combined with the
+  // regularization parameters and the solver options that change its
+  // solution (see HashIRLSProblemValues()). A solve only resumes from a
+  // checkpoint of the same problem, so checkpoints of other solves that share
+  // the checkpoint path (e.g. with other parameters) are not resumed by
+  // mistake.
+  uint64_t problem_hash = 0;
+
+  // The channel range [channel_start, channel_end) of the split.
+  int channel_start = 0;
+  int channel_end = 0;
+
+  // The number of IRLS iterations completed so far, and whether the split
+  // converged, in which case resuming just returns the estimate.
+  int num_completed_iterations = 0;
+  bool is_converged = false;
+
+  // The cost after the last iteration and its change from the iteration
+  // before.
+  double previous_cost = 0.0;
+  double cost_difference = 0.0;
+
+  // The estimate of all channels of the split, one channel after the other.
+  std::vector<double> estimate;
+
+  // The IRLS weights of each regularizer, as many as there are estimate
+  // values.
+  std::vector<std::vector<double>> irls_weights;
+};
+
+// Writes the checkpoint to the given path, replacing any existing checkpoint.
+// Returns false (and logs an error) if it could not be written.
+bool WriteIRLSCheckpoint(
+    const std::string& file_path, const IRLSCheckpoint& checkpoint);
+
+// Reads a checkpoint from the given path. Returns false if the file does not
+// exist, and logs a warning if it is not a valid checkpoint.
+bool ReadIRLSCheckpoint(
+    const std::string& file_path, IRLSCheckpoint* checkpoint);
+
+// Returns a hash (FNV-1a) of the given initial estimate values.
+uint64_t HashIRLSInitialEstimate(
+    const double* initial_estimate, const int64_t num_data_points);
+
+// Returns the given hash extended (FNV-1a) with the given values, which
+// describe the problem, e.g. its regularization parameters.
+uint64_t HashIRLSProblemValues(
+    const uint64_t hash, const std::vector<double>& values);
+
+// Returns the checkpoint path of the given channel split (solver round).
+std::string GetIRLSCheckpointPath(
+    const std::string& checkpoint_path, const int round_index);
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_IRLS_CHECKPOINT_H_
@@ -1,18 +1,31 @@
 #include "optimization/irls_map_solver.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "image/image_data.h"
 #include "image_model/image_model.h"
 #include "optimization/alglib_objective.h"
+#include "optimization/irls_checkpoint.h"
+#include "optimization/memory_planner.h"
+#include "optimization/multigrid.h"
+#include "optimization/native_solver.h"
 #include "optimization/objective_data_term.h"
 #include "optimization/objective_function.h"
 #include "optimization/objective_irls_regularization_term.h"
+#include "optimization/solver_deadline.h"
+#include "optimization/solver_telemetry.h"
+#include "util/memory_accounting.h"
+#include "util/thread_pool.h"
 
 #include "alglib/src/optimization.h"
 
@@ -34,6 +47,328 @@ namespace {
 // zero.
 constexpr double kMinResidualValue = 0.00001;
 
+
+// The diagonal preconditioner values are kept at least this fraction of their
+// mean, so that pixels without any curvature (e.g. not covered by any
+// observation and with zero regularization weight) get a finite scaling.
+constexpr double kMinRelativePreconditionerValue = 1e-6;
+
+// The approximate number of objective evaluations of a solver iteration (the
+// gradient and the line search). Under a deadline, the first solve is
+// budgeted with the time of one evaluation, since no iteration was timed yet.
+constexpr double kEvaluationsPerSolverIteration = 2.0;
+
+// Sets the IRLS weights w = max(kMinResidualValue, |r|)^(p - 2) for the
+// regularizer values r, which turns the weighted least squares cost w r^2
+// into |r|^p, the Lp norm of the regularizer (with p = 1 for TV and BTV).
+// The values are split into one block per thread if there is a thread pool.
+// The weights of the frozen parameters (nonzero mask values) are kept if a
+// mask is given.
+void UpdateIRLSWeights(
+    const std::vector<double>& residuals,
+    const double norm_exponent,
+    const std::vector<uint8_t>* frozen_parameters,
+    util::ThreadPool* thread_pool,
+    const int num_blocks,
+    std::vector<double>* weights) {
+
+  const int64_t num_data_points = weights->size();
+  CHECK_EQ(residuals.size(), num_data_points)
+      << "Number of residuals does not match number of weights.";
+  const double weight_exponent = norm_exponent - 2.0;
+  const uint8_t* frozen_data =
+      (frozen_parameters != nullptr) ? frozen_parameters->data() : nullptr;
+  const auto update_block = [&](const int block) {
+    const int64_t start = block * num_data_points / num_blocks;
+    const int64_t end = (block + 1) * num_data_points / num_blocks;
+    double* weight_data = weights->data();
+    for (int64_t i = start; i < end; ++i) {
+      if (frozen_data != nullptr && frozen_data[i] != 0) {
+        continue;
+      }
+      const double residual_magnitude =
+          std::max(kMinResidualValue, std::abs(residuals[i]));
+      weight_data[i] = (norm_exponent == 1.0) ?
+          1.0 / residual_magnitude :
+          std::pow(residual_magnitude, weight_exponent);
+    }
+  };
+  if (thread_pool != nullptr && num_blocks > 1) {
+    thread_pool->ParallelFor(num_blocks, update_block);
+  } else {
+    update_block(0);
+  }
+}
+
+// Tracks which tiles of the estimate are still changing from one IRLS
+// iteration to the next (see IRLSMapSolverOptions::active_set_tile_size), and
+// keeps a mask that freezes the pixels of the other tiles in all channels.
+class ActiveSet {
+ public:
+  ActiveSet(
+      const cv::Size& image_size,
+      const int num_channels,
+      const int tile_size,
+      const double change_threshold)
+      : image_size_(image_size),
+        num_channels_(num_channels),
+        tile_size_(tile_size),
+        change_threshold_(change_threshold),
+        num_tile_rows_((image_size.height + tile_size - 1) / tile_size),
+        num_tile_cols_((image_size.width + tile_size - 1) / tile_size),
+        tile_is_active_(num_tile_rows_ * num_tile_cols_, 1) {
+
+    CHECK_GT(tile_size_, 0) << "The active set tile size must be positive.";
+    CHECK_GE(change_threshold_, 0.0)
+        << "The active set change threshold cannot be negative.";
+    const int64_t num_data_points =
+        static_cast<int64_t>(image_size.width) * image_size.height *
+        num_channels;
+    previous_estimate_.resize(num_data_points);
+    frozen_parameters_.assign(num_data_points, 0);
+  }
+
+  // Remembers the estimate at the start of an IRLS iteration.
+  void SetPreviousEstimate(const double* estimate) {
+    std::copy(
+        estimate, estimate + previous_estimate_.size(),
+        previous_estimate_.begin());
+  }
+
+  // Activates the tiles that changed by at least the threshold since the
+  // last call to SetPreviousEstimate() and their neighbors, and freezes all
+  // other tiles. Returns the number of active tiles.
+  int Update(const double* estimate) {
+    // Every image row crosses one row of tiles.
+    const int64_t num_pixels = GetNumPixels();
+    std::vector<uint8_t> tile_changed(tile_is_active_.size(), 0);
+    for (int channel = 0; channel < num_channels_; ++channel) {
+      for (int row = 0; row < image_size_.height; ++row) {
+        const int64_t row_offset = channel * num_pixels +
+            static_cast<int64_t>(row) * image_size_.width;
+        const double* estimate_row = estimate + row_offset;
+        const double* previous_row = previous_estimate_.data() + row_offset;
+        uint8_t* tile_row_changed =
+            tile_changed.data() + (row / tile_size_) * num_tile_cols_;
+        for (int col = 0; col < image_size_.width; ++col) {
+          if (std::abs(estimate_row[col] - previous_row[col]) >=
+              change_threshold_) {
+            tile_row_changed[col / tile_size_] = 1;
+          }
+        }
+      }
+    }
+
+    int num_active_tiles = 0;
+    for (int tile_row = 0; tile_row < num_tile_rows_; ++tile_row) {
+      for (int tile_col = 0; tile_col < num_tile_cols_; ++tile_col) {
+        bool is_active = false;
+        for (int row = std::max(tile_row - 1, 0);
+             row <= std::min(tile_row + 1, num_tile_rows_ - 1); ++row) {
+          for (int col = std::max(tile_col - 1, 0);
+               col <= std::min(tile_col + 1, num_tile_cols_ - 1); ++col) {
+            is_active = is_active || tile_changed[row * num_tile_cols_ + col];
+          }
+        }
+        tile_is_active_[tile_row * num_tile_cols_ + tile_col] = is_active;
+        num_active_tiles += is_active;
+      }
+    }
+
+    for (int channel = 0; channel < num_channels_; ++channel) {
+      for (int row = 0; row < image_size_.height; ++row) {
+        uint8_t* row_mask = frozen_parameters_.data() +
+            channel * num_pixels + static_cast<int64_t>(row) *
+            image_size_.width;
+        const uint8_t* tile_row_is_active =
+            tile_is_active_.data() + (row / tile_size_) * num_tile_cols_;
+        for (int col = 0; col < image_size_.width; ++col) {
+          row_mask[col] = !tile_row_is_active[col / tile_size_];
+        }
+      }
+    }
+    return num_active_tiles;
+  }
+
+  // Returns the mask of frozen parameters (nonzero values) for
+  // ObjectiveFunction::SetFrozenParameters().
+  const std::vector<uint8_t>& GetFrozenParameters() const {
+    return frozen_parameters_;
+  }
+
+  int GetNumTiles() const {
+    return tile_is_active_.size();
+  }
+
+ private:
+  int64_t GetNumPixels() const {
+    return static_cast<int64_t>(image_size_.width) * image_size_.height;
+  }
+
+  const cv::Size image_size_;
+  const int num_channels_;
+  const int tile_size_;
+  const double change_threshold_;
+  const int num_tile_rows_;
+  const int num_tile_cols_;
+
+  // One value per tile, in row-major order.
+  std::vector<uint8_t> tile_is_active_;
+
+  std::vector<double> previous_estimate_;
+  std::vector<uint8_t> frozen_parameters_;
+};
+
+// The data terms of a mixed precision solve (see
+// IRLSMapSolverOptions::use_mixed_precision): the single precision term that
+// the inner solves evaluate, and the double precision term that corrects it.
+struct MixedPrecisionDataTerms {
+  std::shared_ptr<ObjectiveDataTerm> single_precision_term;
+  std::shared_ptr<ObjectiveDataTerm> double_precision_term;
+};
+
+// The data terms of the coarse multigrid levels, rediscretized with the image
+// model scaled down to every level (see ImageModel::CreateCoarseImageModel()
+// and NativeSolver::SetLevelObjectiveFunction()). All vectors are indexed by
+// level, and the full resolution level 0 has neither a model nor a term. The
+// terms stop at the first level that the image model cannot be scaled down
+// to, and the coarser levels use Galerkin products instead.
+struct MultigridDataTerms {
+  std::vector<cv::Size> level_image_sizes;
+  std::vector<std::unique_ptr<ImageModel>> image_models;
+  std::vector<std::shared_ptr<ObjectiveDataTerm>> data_terms;
+};
+
+// The linear correction that makes the single precision data term agree with
+// the double precision one to first order around a refinement point x0:
+//   (D(x0) - S(x0)) + (grad D(x0) - grad S(x0))'(x - x0),
+// where D and S are the double and single precision data terms. The data
+// term is quadratic, so with this term added the objective at x = x0 + d
+// differs from the exact one only by the single precision rounding of the
+// terms in d, and minimizing it refines x0 by the correction d.
+class PrecisionCorrectionTerm : public ObjectiveTerm {
+ public:
+  explicit PrecisionCorrectionTerm(const int64_t num_parameters)
+      : refinement_point_(num_parameters, 0.0),
+        gradient_correction_(num_parameters, 0.0) {}
+
+  // Evaluates both data terms at the given estimate and makes it the new
+  // refinement point. Returns the double precision cost of the data term.
+  double Refine(
+      const MixedPrecisionDataTerms& data_terms,
+      const double* estimated_image_data) {
+
+    const int64_t num_parameters = refinement_point_.size();
+    std::copy(
+        estimated_image_data,
+        estimated_image_data + num_parameters,
+        refinement_point_.begin());
+    std::fill(gradient_correction_.begin(), gradient_correction_.end(), 0.0);
+    single_precision_gradient_.assign(num_parameters, 0.0);
+    const double double_precision_cost =
+        data_terms.double_precision_term->Compute(
+            estimated_image_data, gradient_correction_.data());
+    const double single_precision_cost =
+        data_terms.single_precision_term->Compute(
+            estimated_image_data, single_precision_gradient_.data());
+    for (int64_t i = 0; i < num_parameters; ++i) {
+      gradient_correction_[i] -= single_precision_gradient_[i];
+    }
+    cost_correction_ = double_precision_cost - single_precision_cost;
+    return double_precision_cost;
+  }
+
+  virtual double Compute(
+      const double* estimated_image_data, double* gradient) const {
+
+    const int64_t num_parameters = refinement_point_.size();
+    double cost = cost_correction_;
+    for (int64_t i = 0; i < num_parameters; ++i) {
+      cost += gradient_correction_[i] *
+          (estimated_image_data[i] - refinement_point_[i]);
+    }
+    if (gradient != nullptr) {
+      for (int64_t i = 0; i < num_parameters; ++i) {
+        gradient[i] += gradient_correction_[i];
+      }
+    }
+    return cost;
+  }
+
+ private:
+  std::vector<double> refinement_point_;
+  double cost_correction_ = 0.0;
+  std::vector<double> gradient_correction_;
+
+  // Scratch buffer for the single precision gradient.
+  std::vector<double> single_precision_gradient_;
+};
+
+// Returns the values that, besides the initial estimate, identify the problem
+// that the IRLS loop solves with the given options and regularizers: the
+// regularization parameters, the norm exponent, and the solver options that
+// change the solution, including the iteration budget of the split. The IRLS
+// iteration limit is not included, so a solve can be resumed with a higher
+// limit.
+std::vector<double> GetCheckpointProblemValues(
+    const IRLSMapSolverOptions& options,
+    const RegularizersAndParameters& regularizers) {
+
+  std::vector<double> values;
+  for (const auto& regularizer_and_parameter : regularizers) {
+    values.push_back(regularizer_and_parameter.second);
+  }
+  values.insert(values.end(), {
+    options.irls_norm_exponent,
+    options.irls_cost_difference_threshold,
+    static_cast<double>(options.least_squares_solver),
+    static_cast<double>(options.num_lbfgs_hessian_corrections),
+    static_cast<double>(options.max_num_multigrid_levels),
+    static_cast<double>(options.num_multigrid_smoothing_iterations),
+    static_cast<double>(options.num_multigrid_coarsest_iterations),
+    static_cast<double>(options.max_num_solver_iterations),
+    options.gradient_norm_threshold,
+    options.cost_decrease_threshold,
+    options.parameter_variation_threshold,
+    options.use_single_precision ? 1.0 : 0.0,
+    options.use_mixed_precision ? 1.0 : 0.0,
+    static_cast<double>(options.active_set_tile_size),
+    static_cast<double>(options.continuation_iterations_per_stage)
+  });
+  values.insert(
+      values.end(),
+      options.continuation_parameter_scales.begin(),
+      options.continuation_parameter_scales.end());
+  return values;
+}
+
+// Reads the checkpoint at the given path if it was made for the given problem
+// (see GetCheckpointProblemValues()) and channel range. Returns false if there
+// is no such checkpoint.
+bool ReadMatchingIRLSCheckpoint(
+    const std::string& checkpoint_path,
+    const uint64_t problem_hash,
+    const int channel_start,
+    const int channel_end,
+    const int64_t num_data_points,
+    const int num_regularizers,
+    IRLSCheckpoint* checkpoint) {
+
+  if (!ReadIRLSCheckpoint(checkpoint_path, checkpoint)) {
+    return false;
+  }
+  if (checkpoint->problem_hash != problem_hash ||
+      checkpoint->channel_start != channel_start ||
+      checkpoint->channel_end != channel_end ||
+      checkpoint->estimate.size() != num_data_points ||
+      checkpoint->irls_weights.size() != num_regularizers) {
+    LOG(WARNING) << "Ignoring the checkpoint '" << checkpoint_path
+                 << "', which was made for a different problem.";
+    return false;
+  }
+  return true;
+}
+
 // Runs the IRLS loop for the given data and channel(s). After every iteration,
 // update the IRLS weights and solve again until the change in residual sum is
 // sufficiently low.
@@ -42,20 +377,46 @@ constexpr double kMinResidualValue = 0.00001;
 // be at least one channel and must not exceed the number of channels in the
 // image. NOTE that the range is non-inclusive of the last element (i.e.
 // [channel_start, channel_end).
+//
+// If the telemetry is not null, the loop reports its statistics to it as a
+// new solve. If the checkpoint path is not empty, the loop saves its state
+// there as configured by the options, identified by the given problem hash.
+// If resume_checkpoint is not null, the loop resumes from it (see
+// ReadMatchingIRLSCheckpoint()) instead of the estimate in the solver data.
+//
+// If mixed_precision_data_terms is not null, the data term of the objective
+// function must be its single precision term, and every solve is refined in
+// double precision (see IRLSMapSolverOptions::use_mixed_precision).
+//
+// If multigrid_data_terms is not null, the multigrid solver evaluates every
+// coarse level that has a data term on that term and the regularizers scaled
+// down to the level, as long as all regularizers can be.
+//
+// If solver_state is not null, the loop starts from its IRLS weights if it
+// has any (the estimate must already be in the solver data), and stores the
+// final estimate and weights in it when it is done.
 void RunIRLSLoop(
     const IRLSMapSolverOptions& options,
     const ObjectiveFunction& objective_function_data_term_only,
+    const MixedPrecisionDataTerms* mixed_precision_data_terms,
+    const MultigridDataTerms* multigrid_data_terms,
     const RegularizersAndParameters& regularizers,
     const cv::Size& image_size,
     const int channel_start,
     const int channel_end,
+    const std::shared_ptr<SolverTelemetry> telemetry,
+    const std::string& checkpoint_path,
+    const uint64_t checkpoint_problem_hash,
+    IRLSCheckpoint* resume_checkpoint,
+    IRLSCheckpoint* solver_state,
     alglib::real_1d_array* solver_data) {
 
   CHECK_GE(channel_end, channel_start) << "Invalid channel range.";
 
-  const int num_pixels = image_size.width * image_size.height;
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size.width) * image_size.height;
   const int num_channels = channel_end - channel_start;
-  const int num_data_points = num_pixels * num_channels;
+  const int64_t num_data_points = num_pixels * num_channels;
 
   // A vector containing the IRLS weights, one per parameter of the solver
   // system, and one set of weights per regularization term. These weights get
@@ -63,103 +424,591 @@ void RunIRLSLoop(
   // The effect of reweighting is to allow solving a 1-norm (or arbitrary
   // p-norm) regularizer with least squares. Weights are initialized to 1.
   const int num_regularizers = regularizers.size();
-  std::vector<std::vector<double>> irls_weights(num_regularizers);
-  for (int reg_index = 0; reg_index < num_regularizers; ++reg_index) {
-    std::vector<double> weights_for_regularizer(num_data_points);
-    std::fill(
-        weights_for_regularizer.begin(),
-        weights_for_regularizer.end(),
-        1.0);
-    irls_weights[reg_index] = weights_for_regularizer;
+  std::vector<std::vector<double>> irls_weights(
+      num_regularizers, std::vector<double>(num_data_points, 1.0));
+  util::MemoryAccount irls_weights_memory(util::MEMORY_TAG_REGULARIZER);
+  irls_weights_memory.SetBytes(
+      num_regularizers * num_data_points * sizeof(double));
+
+  // Continue with the weights of a previous solve of this split. The
+  // objective may have changed since (e.g. with new observations), so the
+  // cost is tracked from scratch.
+  if (solver_state != nullptr && !solver_state->irls_weights.empty()) {
+    CHECK_EQ(solver_state->irls_weights.size(), num_regularizers)
+        << "The solver state has a different number of regularizers.";
+    CHECK_EQ(solver_state->irls_weights[0].size(), num_data_points)
+        << "The solver state is of a different channel range.";
+    irls_weights = std::move(solver_state->irls_weights);
+    solver_state->irls_weights.clear();
   }
 
   double previous_cost = std::numeric_limits<double>::infinity();
   double cost_difference = options.irls_cost_difference_threshold + 1.0;
   int num_iterations_ran = 0;
-  while (std::abs(cost_difference) >= options.irls_cost_difference_threshold) {
-    // Add the weighted regularization term(s) to the next objective function.
-    // This makes a new copy of the objective function for each iteration.
-    ObjectiveFunction objective_function = objective_function_data_term_only;
-    for (int reg_index = 0; reg_index < num_regularizers; ++reg_index) {
-      const auto& regularizer_and_parameter = regularizers[reg_index];
-      std::shared_ptr<ObjectiveTerm> regularization_term(
-          new ObjectiveIRLSRegularizationTerm(
-              regularizer_and_parameter.first,
-              regularizer_and_parameter.second,
-              irls_weights[reg_index],
-              num_channels,
-              image_size));
-      objective_function.AddTerm(regularization_term);
+  const bool use_quality_metric =
+      options.quality_metric && options.quality_evaluation_interval > 0;
+  double previous_quality = -std::numeric_limits<double>::infinity();
+
+  const auto save_solver_state = [&]() {
+    if (solver_state == nullptr) {
+      return;
+    }
+    solver_state->channel_start = channel_start;
+    solver_state->channel_end = channel_end;
+    solver_state->num_completed_iterations = num_iterations_ran;
+    solver_state->previous_cost = previous_cost;
+    solver_state->cost_difference = cost_difference;
+    solver_state->estimate.assign(
+        solver_data->getcontent(),
+        solver_data->getcontent() + num_data_points);
+    solver_state->irls_weights = std::move(irls_weights);
+  };
+
+  // Resume from the checkpoint of an earlier run of the same solve, which
+  // restores the estimate, the weights and the iteration counters.
+  const bool use_checkpoint = !checkpoint_path.empty();
+  if (resume_checkpoint != nullptr) {
+    std::copy(
+        resume_checkpoint->estimate.begin(),
+        resume_checkpoint->estimate.end(),
+        solver_data->getcontent());
+    irls_weights = std::move(resume_checkpoint->irls_weights);
+    previous_cost = resume_checkpoint->previous_cost;
+    cost_difference = resume_checkpoint->cost_difference;
+    num_iterations_ran = resume_checkpoint->num_completed_iterations;
+    LOG(INFO) << "Resuming channels [" << channel_start << ", "
+              << channel_end << ") from '" << checkpoint_path
+              << "' after " << num_iterations_ran << " IRLS iteration(s).";
+    if (resume_checkpoint->is_converged ||
+        (options.max_num_irls_iterations > 0 &&
+         num_iterations_ran >= options.max_num_irls_iterations)) {
+      save_solver_state();
+      return;
+    }
+  }
+  const auto save_checkpoint = [&](const bool is_converged) {
+    IRLSCheckpoint checkpoint;
+    checkpoint.problem_hash = checkpoint_problem_hash;
+    checkpoint.channel_start = channel_start;
+    checkpoint.channel_end = channel_end;
+    checkpoint.num_completed_iterations = num_iterations_ran;
+    checkpoint.is_converged = is_converged;
+    checkpoint.previous_cost = previous_cost;
+    checkpoint.cost_difference = cost_difference;
+    checkpoint.estimate.assign(
+        solver_data->getcontent(),
+        solver_data->getcontent() + num_data_points);
+    checkpoint.irls_weights = irls_weights;
+    WriteIRLSCheckpoint(checkpoint_path, checkpoint);
+  };
+
+  // Add the weighted regularization term(s) to the objective function. The
+  // terms reference the IRLS weights, which are updated in place after every
+  // iteration, so the same objective function is used for all iterations.
+  ObjectiveFunction objective_function = objective_function_data_term_only;
+  std::vector<std::shared_ptr<ObjectiveIRLSRegularizationTerm>>
+      regularization_terms;
+  for (int reg_index = 0; reg_index < num_regularizers; ++reg_index) {
+    const auto& regularizer_and_parameter = regularizers[reg_index];
+    std::shared_ptr<ObjectiveIRLSRegularizationTerm> regularization_term(
+        new ObjectiveIRLSRegularizationTerm(
+            regularizer_and_parameter.first,
+            regularizer_and_parameter.second,
+            irls_weights[reg_index],
+            num_channels,
+            image_size));
+    objective_function.AddTerm(
+        regularization_term, "regularizer " + std::to_string(reg_index));
+    regularization_terms.push_back(regularization_term);
+  }
+  // In mixed precision, the correction of the single precision data term is
+  // updated at the estimate before every solve.
+  std::shared_ptr<PrecisionCorrectionTerm> precision_correction_term;
+  if (mixed_precision_data_terms != nullptr) {
+    precision_correction_term.reset(
+        new PrecisionCorrectionTerm(num_data_points));
+    objective_function.AddTerm(
+        precision_correction_term, "precision correction");
+  }
+  if (options.evaluate_terms_concurrently) {
+    objective_function.SetNumThreads(objective_function.GetNumTerms());
+  }
+  if (options.progressive_results != nullptr) {
+    const std::shared_ptr<ProgressiveResults> progressive_results =
+        options.progressive_results;
+    objective_function.SetIterationCallback(
+        [progressive_results, channel_start, channel_end](
+            const double* estimated_image_data) {
+          progressive_results->ReportIteration(
+              estimated_image_data, channel_start, channel_end);
+        });
+  }
+  int telemetry_solve_index = 0;
+  if (telemetry != nullptr) {
+    telemetry_solve_index = telemetry->BeginSolve(channel_start, channel_end);
+    objective_function.SetTelemetry(telemetry, telemetry_solve_index);
+  }
+
+  // Buffer for the regularizer values used to update the IRLS weights if
+  // they have to be computed again after a solve.
+  std::vector<double> regularization_residuals;
+
+  // The weight update is split across the data term threads.
+  const int num_weight_blocks = std::max(1, static_cast<int>(std::min<int64_t>(
+      util::GetNumThreadsToUse(options.num_threads), num_data_points)));
+  std::unique_ptr<util::ThreadPool> weight_thread_pool;
+  if (num_regularizers > 0 && num_weight_blocks > 1) {
+    weight_thread_pool.reset(new util::ThreadPool(num_weight_blocks - 1));
+  }
+
+  // The solver state is kept between iterations, since the number of
+  // parameters does not change. The native solvers work directly on the
+  // solver data buffer.
+  std::unique_ptr<AlglibSolverSession> alglib_solver_session;
+  std::unique_ptr<NativeSolver> native_solver;
+  if (IsNativeLeastSquaresSolver(options.least_squares_solver)) {
+    native_solver.reset(new NativeSolver(
+        options, objective_function, num_data_points, image_size));
+  } else {
+    alglib_solver_session.reset(
+        new AlglibSolverSession(options, objective_function));
+  }
+
+  // Rediscretize the coarse multigrid levels. Their regularization terms
+  // reference the IRLS weights averaged onto the level's grid, which are
+  // updated before every solve.
+  std::vector<std::unique_ptr<ObjectiveFunction>> level_objective_functions;
+  std::vector<std::vector<std::vector<double>>> level_irls_weights;
+  if (native_solver != nullptr && multigrid_data_terms != nullptr) {
+    const int num_levels = multigrid_data_terms->data_terms.size();
+    level_irls_weights.resize(num_levels);
+    for (int level = 1; level < num_levels; ++level) {
+      const cv::Size& level_image_size =
+          multigrid_data_terms->level_image_sizes[level];
+      const int64_t num_level_data_points =
+          static_cast<int64_t>(level_image_size.area()) * num_channels;
+      std::vector<std::shared_ptr<Regularizer>> level_regularizers;
+      for (const auto& regularizer_and_parameter : regularizers) {
+        const std::shared_ptr<Regularizer> level_regularizer =
+            regularizer_and_parameter.first->CreateCoarseRegularizer(
+                level_image_size);
+        if (level_regularizer == nullptr) {
+          break;
+        }
+        level_regularizers.push_back(level_regularizer);
+      }
+      if (level_regularizers.size() < num_regularizers) {
+        break;
+      }
+      level_irls_weights[level].assign(
+          num_regularizers, std::vector<double>(num_level_data_points, 1.0));
+      std::unique_ptr<ObjectiveFunction> level_objective_function(
+          new ObjectiveFunction(num_level_data_points));
+      level_objective_function->AddTerm(
+          multigrid_data_terms->data_terms[level], "data term");
+      for (int reg_index = 0; reg_index < num_regularizers; ++reg_index) {
+        level_objective_function->AddTerm(
+            std::make_shared<ObjectiveIRLSRegularizationTerm>(
+                level_regularizers[reg_index],
+                regularizers[reg_index].second,
+                level_irls_weights[level][reg_index],
+                num_channels,
+                level_image_size),
+            "regularizer " + std::to_string(reg_index));
+      }
+      if (options.evaluate_terms_concurrently) {
+        level_objective_function->SetNumThreads(
+            level_objective_function->GetNumTerms());
+      }
+      native_solver->SetLevelObjectiveFunction(
+          level, level_objective_function.get());
+      level_objective_functions.push_back(std::move(level_objective_function));
     }
+  }
+  const auto update_level_irls_weights = [&]() {
+    for (int level = 1; level <= level_objective_functions.size(); ++level) {
+      const cv::Size& fine_size =
+          multigrid_data_terms->level_image_sizes[level - 1];
+      const cv::Size& level_image_size =
+          multigrid_data_terms->level_image_sizes[level];
+      for (int reg_index = 0; reg_index < num_regularizers; ++reg_index) {
+        AverageImage(
+            (level == 1) ? irls_weights[reg_index].data() :
+                level_irls_weights[level - 1][reg_index].data(),
+            fine_size,
+            level_image_size,
+            num_channels,
+            level_irls_weights[level][reg_index].data());
+      }
+    }
+  };
+
+  // The native solvers report whether their solution was the last evaluated
+  // point, so the regularizer values kept from that evaluation can be used
+  // for the weights. The ALGLIB solvers may evaluate other points last.
+  for (const auto& regularization_term : regularization_terms) {
+    regularization_term->SetKeepLastResiduals(native_solver != nullptr);
+  }
+
+  // In active-set mode, the solvers only move the pixels of the tiles that
+  // are still changing. All tiles are active in the first iteration.
+  std::unique_ptr<ActiveSet> active_set;
+  const std::vector<uint8_t>* frozen_parameters = nullptr;
+  int num_active_tiles = 0;
+  // The multigrid solver moves all pixels through its coarse grid
+  // corrections, so it cannot freeze any.
+  const bool use_active_set = options.active_set_tile_size > 0 &&
+      num_regularizers > 0 &&
+      options.least_squares_solver != MULTIGRID_SOLVER;
+  if (use_active_set) {
+    active_set.reset(new ActiveSet(
+        image_size,
+        num_channels,
+        options.active_set_tile_size,
+        options.active_set_change_threshold));
+    frozen_parameters = &active_set->GetFrozenParameters();
+    objective_function.SetFrozenParameters(frozen_parameters);
+    num_active_tiles = active_set->GetNumTiles();
+  }
 
+  // The diagonal preconditioner is rebuilt before every solve since the
+  // regularization terms change with the IRLS weights.
+  std::vector<double> hessian_diagonal;
+  if (options.use_diagonal_preconditioner) {
+    hessian_diagonal.resize(objective_function.GetNumParameters());
+  }
+
+  // Under a deadline, the time of a solver iteration and of everything else
+  // in an IRLS iteration (the reweighting and the setup of the solve), as
+  // measured by the last IRLS iteration.
+  SolverDeadline* deadline = options.deadline.get();
+  double seconds_per_solver_iteration = 0.0;
+  double irls_overhead_seconds = 0.0;
+
+  while (std::abs(cost_difference) >= options.irls_cost_difference_threshold) {
     // Run the solver on the reweighted objective function. Solver choice and
-    // differentiation method are determined by options.
-    double final_cost = 0.0;
-    if (options.use_numerical_differentiation) {
-      if (options.least_squares_solver == CG_SOLVER) {
-        final_cost = RunCGSolverNumericalDiff(
-            options, objective_function, solver_data);
+    // differentiation method are determined by options. After the first
+    // iteration, the solver reuses its existing state and buffers.
+    const auto solver_start_time = SolverTelemetry::Clock::now();
+
+    // Under a deadline, only run the solver iterations that still fit.
+    if (deadline != nullptr) {
+      if (seconds_per_solver_iteration <= 0.0) {
+        std::vector<double> gradient(objective_function.GetNumParameters());
+        objective_function.ComputeAllTerms(
+            solver_data->getcontent(), gradient.data());
+        const std::chrono::duration<double> evaluation_time =
+            SolverTelemetry::Clock::now() - solver_start_time;
+        seconds_per_solver_iteration =
+            kEvaluationsPerSolverIteration * evaluation_time.count();
+      }
+      const int num_affordable_iterations = GetNumAffordableIterations(
+          deadline->GetRemainingSeconds() - irls_overhead_seconds,
+          seconds_per_solver_iteration,
+          options.max_num_solver_iterations);
+      if (num_affordable_iterations == 0) {
+        LOG(INFO) << "Out of time after " << num_iterations_ran
+                  << " IRLS iteration(s). Stopping IRLS.";
+        break;
+      }
+      if (native_solver != nullptr) {
+        native_solver->SetMaxNumIterations(num_affordable_iterations);
       } else {
-        final_cost = RunLBFGSSolverNumericalDiff(
-            options, objective_function, solver_data);
+        alglib_solver_session->SetMaxNumIterations(num_affordable_iterations);
       }
-    } else {
-      if (options.least_squares_solver == CG_SOLVER) {
-        final_cost = RunCGSolverAnalyticalDiff(
-            options, objective_function, solver_data);
+    }
+    if (precision_correction_term != nullptr) {
+      precision_correction_term->Refine(
+          *mixed_precision_data_terms, solver_data->getcontent());
+    }
+    if (options.use_diagonal_preconditioner) {
+      objective_function.ComputeHessianDiagonal(hessian_diagonal.data());
+      double mean_value = 0.0;
+      for (const double value : hessian_diagonal) {
+        mean_value += value;
+      }
+      mean_value /= hessian_diagonal.size();
+      const double min_value = std::max(
+          kMinRelativePreconditionerValue * mean_value,
+          std::numeric_limits<double>::min());
+      for (double& value : hessian_diagonal) {
+        value = std::max(value, min_value);
+      }
+      if (native_solver != nullptr) {
+        native_solver->SetDiagonalPreconditioner(hessian_diagonal);
       } else {
-        final_cost = RunLBFGSSolverAnalyticalDiff(
-            options, objective_function, solver_data);
+        alglib_solver_session->SetDiagonalPreconditioner(hessian_diagonal);
       }
     }
+    if (active_set != nullptr) {
+      active_set->SetPreviousEstimate(solver_data->getcontent());
+    }
+    update_level_irls_weights();
+    if (deadline != nullptr) {
+      deadline->RecordStage("solve setup", solver_start_time);
+    }
+    const auto least_squares_start_time = SolverTelemetry::Clock::now();
+    const int num_previous_solver_iterations =
+        objective_function.GetNumCompletedIterations();
+    const double final_cost = (native_solver != nullptr) ?
+        native_solver->Solve(solver_data->getcontent()) :
+        alglib_solver_session->Solve(solver_data);
+    const auto reweighting_start_time = SolverTelemetry::Clock::now();
+    if (telemetry != nullptr) {
+      telemetry->RecordSolverRun(
+          telemetry_solve_index, solver_start_time, reweighting_start_time);
+    }
+    if (deadline != nullptr) {
+      deadline->RecordStage("least squares solve", least_squares_start_time);
+      const std::chrono::duration<double> least_squares_time =
+          reweighting_start_time - least_squares_start_time;
+      const int num_solver_iterations =
+          objective_function.GetNumCompletedIterations() -
+          num_previous_solver_iterations;
+      seconds_per_solver_iteration =
+          least_squares_time.count() / std::max(num_solver_iterations, 1);
+    }
 
     // If there are no regularizers, then no need to continue since the solver
     // already converged and the objective won't change.
     if (num_regularizers == 0) {
       LOG(INFO) << "Least squares done (no regularization terms to reweight).";
+      if (telemetry != nullptr) {
+        telemetry->RecordIRLSIteration(
+            telemetry_solve_index, final_cost, previous_cost - final_cost,
+            solver_start_time, reweighting_start_time, reweighting_start_time);
+      }
       break;
     }
 
-    // Update the IRLS weights.
+    // In active-set mode, the tiles that stopped changing are frozen for the
+    // next solve, and their weights are kept.
+    if (active_set != nullptr) {
+      num_active_tiles = active_set->Update(solver_data->getcontent());
+    }
+
+    // Update the IRLS weights. The regularizer values at the solution are
+    // reused from the solver's last evaluation if possible, which saves a
+    // full regularizer pass per iteration.
     // TODO: should this be computed off of the initial estimate? That seems to
     // get better results at the cost of A LOT of extra computational time.
-    // TODO: the regularizer is assumed to be L1 norm. Scale appropriately to
-    // L* norm based on the regularizer's properties.
+    const bool reuse_residuals =
+        native_solver != nullptr && native_solver->IsSolutionLastEvaluated();
+    const double* estimated_image_data = solver_data->getcontent();
     for (int reg_index = 0; reg_index < num_regularizers; ++reg_index) {
-      const auto& regularizer_and_parameter = regularizers[reg_index];
-      const double* estimated_image_data = solver_data->getcontent();
-      const std::vector<double>& regularization_residuals =
-          regularizer_and_parameter.first->ApplyToImage(
-              estimated_image_data, num_channels);
-      CHECK_EQ(regularization_residuals.size(), num_data_points)
-          << "Number of residuals does not match number of weights.";
-      for (int pixel_index = 0; pixel_index < num_data_points; ++pixel_index) {
-        // TODO: this assumes L1 loss!
-        // w = |r|^(p-2)
-        const double residual_value = regularization_residuals[pixel_index];
-        irls_weights[reg_index][pixel_index] =
-            1.0 / std::max(kMinResidualValue, residual_value);
+      const std::vector<double>* residuals = reuse_residuals ?
+          regularization_terms[reg_index]->GetLastResiduals() : nullptr;
+      if (residuals == nullptr) {
+        regularizers[reg_index].first->ApplyToImage(
+            estimated_image_data, num_channels, &regularization_residuals);
+        residuals = &regularization_residuals;
       }
+      UpdateIRLSWeights(
+          *residuals,
+          options.irls_norm_exponent,
+          frozen_parameters,
+          weight_thread_pool.get(),
+          num_weight_blocks,
+          &irls_weights[reg_index]);
+    }
+    // The regularization terms drop the values they cached for the frozen
+    // rows, since the mask and the weights changed.
+    if (active_set != nullptr) {
+      objective_function.SetFrozenParameters(frozen_parameters);
+    }
+
+    if (deadline != nullptr) {
+      deadline->RecordStage("IRLS reweighting", reweighting_start_time);
+      const std::chrono::duration<double> irls_iteration_time =
+          SolverTelemetry::Clock::now() - solver_start_time;
+      const std::chrono::duration<double> least_squares_time =
+          reweighting_start_time - least_squares_start_time;
+      irls_overhead_seconds =
+          irls_iteration_time.count() - least_squares_time.count();
     }
 
     cost_difference = previous_cost - final_cost;
     previous_cost = final_cost;
     num_iterations_ran++;
+    if (telemetry != nullptr) {
+      telemetry->RecordIRLSIteration(
+          telemetry_solve_index, final_cost, cost_difference,
+          solver_start_time, reweighting_start_time,
+          SolverTelemetry::Clock::now());
+    }
     LOG(INFO) << "IRLS Iteration complete (#" << num_iterations_ran << "). "
               << "New loss is " << final_cost
               << " with a difference of " << cost_difference << ".";
+    if (active_set != nullptr) {
+      LOG(INFO) << num_active_tiles << " of " << active_set->GetNumTiles()
+                << " tiles are still active.";
+      if (num_active_tiles == 0) {
+        LOG(INFO) << "All tiles stopped changing. Stopping IRLS.";
+        break;
+      }
+    }
+    // Stop if the image quality stopped improving.
+    if (use_quality_metric &&
+        num_iterations_ran % options.quality_evaluation_interval == 0) {
+      const double quality = options.quality_metric(
+          solver_data->getcontent(), channel_start, channel_end);
+      const double quality_improvement = quality - previous_quality;
+      previous_quality = quality;
+      if (quality_improvement < options.min_quality_improvement) {
+        LOG(INFO) << "Image quality plateaued at " << quality
+                  << " (improved by " << quality_improvement << "). "
+                  << "Stopping IRLS.";
+        break;
+      }
+    }
     // Stop if max number of iterations have been completed.
     if (options.max_num_irls_iterations > 0 &&
         num_iterations_ran >= options.max_num_irls_iterations) {
       break;
     }
+    if (use_checkpoint && options.checkpoint_interval > 0 &&
+        num_iterations_ran % options.checkpoint_interval == 0) {
+      save_checkpoint(false);
+    }
+  }
+  // Splits that stopped at the iteration limit can still be resumed with a
+  // higher limit.
+  if (use_checkpoint) {
+    save_checkpoint(
+        num_regularizers == 0 ||
+        (active_set != nullptr && num_active_tiles == 0) ||
+        std::abs(cost_difference) < options.irls_cost_difference_threshold);
+  }
+  save_solver_state();
+}
+
+// A range of channels solved together in one solver round. The round solves
+// the channels in [channel_start, channel_end), but only the channels in
+// [kept_channel_start, kept_channel_end) are kept in the final result. The
+// other channels overlap with neighboring splits.
+struct ChannelSplit {
+  int GetNumChannels() const {
+    return channel_end - channel_start;
+  }
+
+  int channel_start;
+  int channel_end;
+  int kept_channel_start;
+  int kept_channel_end;
+};
+
+// Divides the channels into splits based on the split options. If channel
+// splitting is disabled, this returns a single split containing all channels.
+std::vector<ChannelSplit> GetChannelSplits(
+    const MapSolverOptions& options, const int num_channels) {
+
+  const int num_channels_per_split =
+      options.split_channels ? options.num_channels_per_split : num_channels;
+  const int num_overlap_channels =
+      options.split_channels ? options.num_split_overlap_channels : 0;
+  CHECK_GT(num_channels_per_split, 0)
+      << "Splits must contain at least one channel.";
+  CHECK_GE(num_overlap_channels, 0)
+      << "Number of overlapping channels cannot be negative.";
+
+  std::vector<ChannelSplit> channel_splits;
+  for (int channel = 0; channel < num_channels;
+       channel += num_channels_per_split) {
+    ChannelSplit split;
+    split.kept_channel_start = channel;
+    split.kept_channel_end =
+        std::min(channel + num_channels_per_split, num_channels);
+    split.channel_start = std::max(channel - num_overlap_channels, 0);
+    split.channel_end = std::min(
+        split.kept_channel_end + num_overlap_channels, num_channels);
+    channel_splits.push_back(split);
+  }
+  return channel_splits;
+}
+
+// Returns the number of solver rounds (channel splits) that should be solved
+// concurrently, based on the requested number of workers and the memory
+// limit. Each round needs its own solver state and data term observations,
+// which is estimated from the number of data points in the largest round.
+int GetNumConcurrentSolverRounds(
+    const MapSolverOptions& options,
+    const int num_solver_rounds,
+    const int64_t num_data_points,
+    const int num_observations) {
+
+  int num_concurrent_rounds = std::min(
+      util::GetNumThreadsToUse(options.num_split_solver_workers),
+      num_solver_rounds);
+  if (options.split_solver_memory_limit_mb > 0.0) {
+    // Encoded observations are not discounted: the double precision
+    // observations that they are encoded from stay resident, so encoding only
+    // saves memory bandwidth.
+    const double bytes_per_round =
+        static_cast<double>(num_data_points) * sizeof(double) *
+        (kNumSolverImageBuffers + num_observations);
+    const double memory_limit_bytes =
+        options.split_solver_memory_limit_mb * 1024.0 * 1024.0;
+    const int max_rounds_in_memory =
+        static_cast<int>(memory_limit_bytes / bytes_per_round);
+    num_concurrent_rounds = std::min(
+        num_concurrent_rounds, max_rounds_in_memory);
+  }
+  return std::max(num_concurrent_rounds, 1);
+}
+
+// Returns the importance of every split relative to the most important one
+// (see MapSolverOptions::channel_importances). All splits are equally
+// important if no channel importances are given, or if they do not match the
+// number of channels.
+std::vector<double> GetRelativeSplitImportances(
+    const MapSolverOptions& options,
+    const std::vector<ChannelSplit>& channel_splits,
+    const int num_channels) {
+
+  std::vector<double> split_importances(channel_splits.size(), 1.0);
+  if (options.channel_importances.empty()) {
+    return split_importances;
+  }
+  if (options.channel_importances.size() != num_channels) {
+    LOG(WARNING) << "There are " << options.channel_importances.size()
+                 << " channel importances for " << num_channels
+                 << " channels. Ignoring them.";
+    return split_importances;
+  }
+  double max_split_importance = 0.0;
+  for (int i = 0; i < channel_splits.size(); ++i) {
+    double split_importance = 0.0;
+    for (int channel = channel_splits[i].kept_channel_start;
+         channel < channel_splits[i].kept_channel_end;
+         ++channel) {
+      split_importance += std::max(options.channel_importances[channel], 0.0);
+    }
+    split_importances[i] = split_importance;
+    max_split_importance = std::max(max_split_importance, split_importance);
+  }
+  if (max_split_importance <= 0.0) {
+    return std::vector<double>(channel_splits.size(), 1.0);
+  }
+  for (double& split_importance : split_importances) {
+    split_importance /= max_split_importance;
+  }
+  return split_importances;
+}
+
+// Returns the given number of iterations scaled by the relative importance,
+// but at least one. A limit of 0 (no limit) is kept.
+int GetIterationBudget(const int num_iterations, const double importance) {
+  if (num_iterations <= 0) {
+    return num_iterations;
   }
+  return std::max(
+      1, static_cast<int>(std::ceil(num_iterations * importance)));
 }
 
 }  // namespace
 
 void IRLSMapSolverOptions::AdjustThresholdsAdaptively(
-    const int num_parameters, const double regularization_parameter_sum) {
+    const int64_t num_parameters, const double regularization_parameter_sum) {
 
   const double threshold_scale = num_parameters * regularization_parameter_sum;
   if (threshold_scale < 1.0) {
@@ -179,6 +1028,30 @@ void IRLSMapSolverOptions::PrintSolverOptions() const {
   MapSolverOptions::PrintSolverOptions();
   std::cout << "  IRLS cost difference threshold:      "
             << irls_cost_difference_threshold << std::endl;
+  std::cout << "  IRLS norm exponent:                  "
+            << irls_norm_exponent << std::endl;
+  if (!continuation_parameter_scales.empty()) {
+    std::cout << "  Continuation parameter scales:       ";
+    for (const double parameter_scale : continuation_parameter_scales) {
+      std::cout << parameter_scale << " ";
+    }
+    std::cout << "(" << continuation_iterations_per_stage
+              << " IRLS iterations per stage)" << std::endl;
+  }
+  if (use_mixed_precision) {
+    std::cout << "  Mixed precision refinement enabled." << std::endl;
+  }
+  if (progressive_results != nullptr) {
+    std::cout << "  Progressive results streaming enabled." << std::endl;
+  }
+  if (keep_solver_state) {
+    std::cout << "  Solver state kept for continuing." << std::endl;
+  }
+  if (active_set_tile_size > 0) {
+    std::cout << "  Active set tile size:                "
+              << active_set_tile_size << " (change threshold "
+              << active_set_change_threshold << ")" << std::endl;
+  }
 }
 
 IRLSMapSolver::IRLSMapSolver(
@@ -189,74 +1062,566 @@ IRLSMapSolver::IRLSMapSolver(
     : MapSolver(image_model, low_res_images, print_solver_output),
       solver_options_(solver_options) {}
 
+IRLSMapSolver::IRLSMapSolver(
+    const IRLSMapSolverOptions& solver_options,
+    const ImageModel& image_model,
+    const std::shared_ptr<const SharedSolverInputs>& inputs,
+    const bool print_solver_output)
+    : MapSolver(image_model, inputs, print_solver_output),
+      solver_options_(solver_options) {}
+
+// The data terms of a channel split and the image model of the split, which
+// they reference.
+struct IRLSMapSolver::SplitDataTerms {
+  std::unique_ptr<ImageModel> image_model;
+  std::shared_ptr<ObjectiveDataTerm> data_term;
+  std::unique_ptr<MixedPrecisionDataTerms> mixed_precision_data_terms;
+  std::unique_ptr<MultigridDataTerms> multigrid_data_terms;
+};
+
 ImageData IRLSMapSolver::Solve(const ImageData& initial_estimate) {
-  const int num_pixels = GetNumPixels();
+  CHECK_EQ(initial_estimate.GetNumPixels(), GetNumPixels());
+  CHECK_EQ(initial_estimate.GetNumChannels(), GetNumChannels());
+  CHECK_EQ(initial_estimate.GetImageSize(), GetImageSize());
+  return SolveChannelSplits(solver_options_, initial_estimate, false);
+}
+
+ImageData IRLSMapSolver::ContinueSolve(const int max_num_irls_iterations) {
+  CHECK(!split_states_.empty())
+      << "There is no solver state to continue from. Solve() must be run "
+      << "first with keep_solver_state set.";
+  CHECK_GE(max_num_irls_iterations, 0);
+
+  // Splits that were not solved kept their initial estimate, which is the
+  // estimate of their state, so the estimate of the last solve is assembled
+  // from the states.
+  const int64_t num_pixels = GetNumPixels();
+  const std::vector<ChannelSplit> channel_splits =
+      GetChannelSplits(solver_options_, GetNumChannels());
+  CHECK_EQ(channel_splits.size(), split_states_.size());
+  ImageData previous_estimate;
+  for (int i = 0; i < channel_splits.size(); ++i) {
+    const ChannelSplit& split = channel_splits[i];
+    for (int channel = split.kept_channel_start;
+         channel < split.kept_channel_end;
+         ++channel) {
+      previous_estimate.AddChannel(
+          split_states_[i].estimate.data() +
+              num_pixels * (channel - split.channel_start),
+          GetImageSize());
+    }
+  }
+
+  IRLSMapSolverOptions solver_options = solver_options_;
+  if (max_num_irls_iterations > 0) {
+    solver_options.max_num_irls_iterations = max_num_irls_iterations;
+  }
+  solver_options.continuation_parameter_scales.clear();
+  solver_options.checkpoint_path = "";
+  solver_options.keep_solver_state = true;
+  return SolveChannelSplits(solver_options, previous_estimate, true);
+}
+
+std::shared_ptr<IRLSMapSolver::SplitDataTerms>
+IRLSMapSolver::CreateSplitDataTerms(
+    const IRLSMapSolverOptions& solver_options,
+    const int channel_start,
+    const int channel_end,
+    const std::shared_ptr<const CompiledImageModel>& compiled_image_model)
+    const {
+
+  const cv::Size image_size = GetImageSize();
+  const bool use_mixed_precision = solver_options.use_mixed_precision;
+  std::shared_ptr<SplitDataTerms> split_data_terms(new SplitDataTerms());
+
+  // Channel c of the split is band channel_start + c of the images, which
+  // operators that depend on the band (e.g. a spectral blur) must know.
+  split_data_terms->image_model.reset(new ImageModel(
+      image_model_->CreateBandOffsetImageModel(channel_start)));
+  const ImageModel& split_image_model = *split_data_terms->image_model;
+  split_data_terms->data_term.reset(new ObjectiveDataTerm(
+      split_image_model,
+      GetObservations(),
+      channel_start,
+      channel_end,
+      image_size,
+      solver_options.num_threads,
+      (solver_options.use_single_precision || use_mixed_precision) ?
+          SINGLE_PRECISION : DOUBLE_PRECISION,
+      use_mixed_precision ? nullptr : compiled_image_model,
+      solver_options.observation_encoding));
+  split_data_terms->data_term->SetUseLineSearchCache(
+      solver_options.use_line_search_cache);
+  if (use_mixed_precision) {
+    MixedPrecisionDataTerms* mixed_precision_data_terms =
+        new MixedPrecisionDataTerms();
+    split_data_terms->mixed_precision_data_terms.reset(
+        mixed_precision_data_terms);
+    mixed_precision_data_terms->single_precision_term =
+        split_data_terms->data_term;
+    mixed_precision_data_terms->double_precision_term.reset(
+        new ObjectiveDataTerm(
+            split_image_model,
+            GetObservations(),
+            channel_start,
+            channel_end,
+            image_size,
+            solver_options.num_threads,
+            DOUBLE_PRECISION,
+            compiled_image_model,
+            solver_options.observation_encoding));
+  }
+
+  // The multigrid solver evaluates its coarse levels on data terms with the
+  // image model scaled down to them. Each term keeps the same copy of the
+  // observation channels as the full resolution term, if any.
+  if (solver_options.least_squares_solver == MULTIGRID_SOLVER) {
+    MultigridDataTerms* multigrid_data_terms = new MultigridDataTerms();
+    split_data_terms->multigrid_data_terms.reset(multigrid_data_terms);
+    multigrid_data_terms->level_image_sizes =
+        NativeSolver::GetMultigridLevelImageSizes(solver_options, image_size);
+    multigrid_data_terms->image_models.resize(1);
+    multigrid_data_terms->data_terms.resize(1);
+    const int num_levels = multigrid_data_terms->level_image_sizes.size();
+    for (int level = 1; level < num_levels; ++level) {
+      const ImageModel& fine_image_model = (level == 1) ?
+          split_image_model : *multigrid_data_terms->image_models.back();
+      std::unique_ptr<ImageModel> level_image_model =
+          fine_image_model.CreateCoarseImageModel();
+      if (level_image_model == nullptr) {
+        break;
+      }
+      multigrid_data_terms->data_terms.emplace_back(new ObjectiveDataTerm(
+          *level_image_model,
+          GetObservations(),
+          channel_start,
+          channel_end,
+          multigrid_data_terms->level_image_sizes[level],
+          solver_options.num_threads,
+          (solver_options.use_single_precision || use_mixed_precision) ?
+              SINGLE_PRECISION : DOUBLE_PRECISION,
+          nullptr,
+          solver_options.observation_encoding));
+      multigrid_data_terms->image_models.push_back(
+          std::move(level_image_model));
+    }
+  }
+  return split_data_terms;
+}
+
+void IRLSMapSolver::ExtendSplitDataTerms(
+    const bool use_mixed_precision,
+    const int channel_start,
+    const std::shared_ptr<const CompiledImageModel>& compiled_image_model,
+    SplitDataTerms* split_data_terms) const {
+
+  // Adding observations replaces the image model and the observations of the
+  // solver, so the terms are moved over to the new ones, which they
+  // reference. The models of the terms are only replaced once every term
+  // that references them has moved on.
+  std::unique_ptr<ImageModel> split_image_model(new ImageModel(
+      image_model_->CreateBandOffsetImageModel(channel_start)));
+  split_data_terms->data_term->AddObservations(
+      *split_image_model,
+      GetObservations(),
+      use_mixed_precision ? nullptr : compiled_image_model);
+  if (split_data_terms->mixed_precision_data_terms != nullptr) {
+    split_data_terms->mixed_precision_data_terms->double_precision_term
+        ->AddObservations(
+            *split_image_model, GetObservations(), compiled_image_model);
+  }
+  MultigridDataTerms* multigrid_data_terms =
+      split_data_terms->multigrid_data_terms.get();
+  if (multigrid_data_terms != nullptr) {
+    std::vector<std::unique_ptr<ImageModel>> level_image_models(1);
+    for (int level = 1;
+         level < multigrid_data_terms->data_terms.size();
+         ++level) {
+      const ImageModel& fine_image_model = (level == 1) ?
+          *split_image_model : *level_image_models.back();
+      std::unique_ptr<ImageModel> level_image_model =
+          fine_image_model.CreateCoarseImageModel();
+      CHECK(level_image_model != nullptr)
+          << "The image model can no longer be scaled down to level "
+          << level << ".";
+      multigrid_data_terms->data_terms[level]->AddObservations(
+          *level_image_model, GetObservations(), nullptr);
+      level_image_models.push_back(std::move(level_image_model));
+    }
+    multigrid_data_terms->image_models = std::move(level_image_models);
+  }
+  split_data_terms->image_model = std::move(split_image_model);
+}
+
+ImageData IRLSMapSolver::SolveChannelSplits(
+    const IRLSMapSolverOptions& solver_options,
+    const ImageData& initial_estimate,
+    const bool continue_from_solver_state) {
+
+  const int64_t num_pixels = GetNumPixels();
   const int num_channels = GetNumChannels();
   const cv::Size image_size = GetImageSize();
-  CHECK_EQ(initial_estimate.GetNumPixels(), num_pixels);
-  CHECK_EQ(initial_estimate.GetNumChannels(), num_channels);
-  CHECK_EQ(initial_estimate.GetImageSize(), image_size);
+  CHECK(solver_options.irls_norm_exponent > 0.0 &&
+        solver_options.irls_norm_exponent <= 2.0)
+      << "The IRLS norm exponent must be in (0, 2].";
+  for (const double parameter_scale :
+       solver_options.continuation_parameter_scales) {
+    CHECK_GT(parameter_scale, 0.0)
+        << "Continuation parameter scales must be positive.";
+  }
+  if (!solver_options.continuation_parameter_scales.empty()) {
+    CHECK_GT(solver_options.continuation_iterations_per_stage, 0)
+        << "Continuation stages need at least one IRLS iteration.";
+  }
 
-  // If the split_channels option is set, loop over the channels here and solve
-  // them independently. Otherwise, solve all channels at once.
-  const int num_channels_per_split =
-      solver_options_.split_channels ? 1 : num_channels;
-  const int num_solver_rounds = num_channels / num_channels_per_split;
-  const int num_data_points = num_channels_per_split * num_pixels;
-  if (num_channels_per_split != num_channels) {
+  // If the split_channels option is set, solve the channels in independent
+  // splits. Otherwise, solve all channels at once.
+  const std::vector<ChannelSplit> channel_splits =
+      GetChannelSplits(solver_options, num_channels);
+  const int num_solver_rounds = channel_splits.size();
+  int64_t max_num_data_points = 0;
+  for (const ChannelSplit& split : channel_splits) {
+    max_num_data_points = std::max(
+        max_num_data_points, split.GetNumChannels() * num_pixels);
+  }
+  if (num_solver_rounds > 1) {
     LOG(INFO) << "Splitting up image into " << num_solver_rounds
-              << " sections with " << num_channels_per_split
-              << " channel(s) in each section.";
+              << " sections with " << solver_options.num_channels_per_split
+              << " channel(s) in each section (plus "
+              << solver_options.num_split_overlap_channels
+              << " overlapping channel(s) on each side).";
   }
 
   // Scale the option stop criteria parameters based on the number of
-  // parameters and strength of the regularizers.
-  IRLSMapSolverOptions solver_options_scaled = solver_options_;
-  solver_options_scaled.AdjustThresholdsAdaptively(
-      num_data_points, GetRegularizationParameterSum());
+  // parameters and strength of the regularizers. Splits can differ in size,
+  // so each split is scaled independently.
+  const double regularization_parameter_sum = GetRegularizationParameterSum();
+  const auto get_scaled_solver_options = [&](
+      const IRLSMapSolverOptions& unscaled_solver_options,
+      const int64_t num_data_points) {
+    IRLSMapSolverOptions solver_options_scaled = unscaled_solver_options;
+    solver_options_scaled.AdjustThresholdsAdaptively(
+        num_data_points, regularization_parameter_sum);
+    return solver_options_scaled;
+  };
 
   if (IsVerbose()) {
-    solver_options_scaled.PrintSolverOptions();
+    get_scaled_solver_options(solver_options, max_num_data_points)
+        .PrintSolverOptions();
   }
 
-  ImageData estimated_image;
+  // The most important splits are started first, so that with a limited
+  // number of concurrent splits the ones that matter most finish first.
+  const std::vector<double> split_importances = GetRelativeSplitImportances(
+      solver_options, channel_splits, num_channels);
+  std::vector<int> round_order(num_solver_rounds);
   for (int i = 0; i < num_solver_rounds; ++i) {
+    round_order[i] = i;
+  }
+  std::stable_sort(
+      round_order.begin(),
+      round_order.end(),
+      [&split_importances](const int round_1, const int round_2) {
+        return split_importances[round_1] > split_importances[round_2];
+      });
+
+  // The compiled model does not depend on the channels, so all rounds share
+  // it.
+  const std::shared_ptr<const CompiledImageModel> compiled_image_model =
+      GetCompiledImageModel(solver_options);
+
+  // Under a deadline, every round gets a share of the remaining time when it
+  // starts, in proportion to its importance among the rounds that did not
+  // start yet. Concurrent rounds use the remaining time side by side, so
+  // their shares are scaled by the number of concurrent rounds.
+  const int num_concurrent_rounds = GetNumConcurrentSolverRounds(
+      solver_options, num_solver_rounds, max_num_data_points, GetNumImages());
+  std::mutex deadline_mutex;
+  double remaining_importance = 0.0;
+  for (const double importance : split_importances) {
+    if (importance >= solver_options.min_split_importance) {
+      remaining_importance += importance;
+    }
+  }
+
+  // Each round solves its own channel range into its own solver array, so the
+  // rounds can run concurrently. The results are assembled in channel order
+  // once all of the rounds are done.
+  std::vector<alglib::real_1d_array> round_solver_data(num_solver_rounds);
+  std::vector<util::MemoryAccount> round_solver_data_memory(
+      num_solver_rounds);
+
+  // The state that every round continues from and ends with, if it is kept.
+  const bool keep_solver_state =
+      solver_options.keep_solver_state || continue_from_solver_state;
+  std::vector<IRLSCheckpoint> round_states;
+  std::vector<std::shared_ptr<SplitDataTerms>> round_data_terms;
+  if (continue_from_solver_state) {
+    CHECK_EQ(split_states_.size(), num_solver_rounds);
+    round_states = std::move(split_states_);
+    round_data_terms = std::move(split_data_terms_);
+  } else if (keep_solver_state) {
+    round_states.resize(num_solver_rounds);
+    round_data_terms.resize(num_solver_rounds);
+  }
+  split_states_.clear();
+  split_data_terms_.clear();
+  split_states_memory_.Set(util::MEMORY_TAG_ESTIMATE, 0);
+
+  const auto run_solver_round = [&](const int round_index) {
     if (num_solver_rounds > 1) {
-      LOG(INFO) << "Starting solver on image subset #" << (i + 1) << ".";
+      LOG(INFO) << "Starting solver on image subset #"
+                << (round_index + 1) << ".";
     }
-    const int channel_start = i * num_channels_per_split;
-    const int channel_end = channel_start + num_channels_per_split;
+    const ChannelSplit& split = channel_splits[round_index];
+    const int num_split_channels = split.GetNumChannels();
+    const int64_t num_data_points = num_split_channels * num_pixels;
 
     // Copy the initial estimate data (within the appropriate channel range) to
-    // the solver's array.
-    alglib::real_1d_array solver_data;
+    // the solver's array. A continued round starts from the estimate of its
+    // state instead, which also holds its overlapping channels.
+    alglib::real_1d_array& solver_data = round_solver_data[round_index];
     solver_data.setlength(num_data_points);
-    for (int channel = 0; channel < num_channels_per_split; ++channel) {
-      double* data_ptr = solver_data.getcontent() + (num_pixels * channel);
-      const double* channel_ptr = initial_estimate.GetChannelData(
-          channel_start + channel);
-      std::copy(channel_ptr, channel_ptr + num_pixels, data_ptr);
+    round_solver_data_memory[round_index].Set(
+        util::MEMORY_TAG_ESTIMATE, num_data_points * sizeof(double));
+    IRLSCheckpoint* round_state =
+        keep_solver_state ? &round_states[round_index] : nullptr;
+    if (round_state != nullptr && !round_state->estimate.empty()) {
+      CHECK_EQ(round_state->estimate.size(), num_data_points);
+      std::copy(
+          round_state->estimate.begin(),
+          round_state->estimate.end(),
+          solver_data.getcontent());
+    } else {
+      for (int channel = 0; channel < num_split_channels; ++channel) {
+        double* data_ptr = solver_data.getcontent() + (num_pixels * channel);
+        const double* channel_ptr = initial_estimate.GetChannelData(
+            split.channel_start + channel);
+        std::copy(channel_ptr, channel_ptr + num_pixels, data_ptr);
+      }
+    }
+
+    // Each split gets its share of the iterations. Splits that are not
+    // important enough keep the initial estimate.
+    const double importance = split_importances[round_index];
+    if (importance < solver_options.min_split_importance) {
+      LOG(INFO) << "Keeping the initial estimate for image subset #"
+                << (round_index + 1) << " (relative importance "
+                << importance << ").";
+      return;
     }
+    const auto round_start_time = SolverDeadline::Clock::now();
+    std::shared_ptr<SolverDeadline> round_deadline;
+    if (solver_options.deadline != nullptr) {
+      std::lock_guard<std::mutex> lock(deadline_mutex);
+      const double share = (remaining_importance > 0.0) ?
+          num_concurrent_rounds * importance / remaining_importance : 1.0;
+      remaining_importance -= importance;
+      round_deadline = solver_options.deadline->CreateShare(
+          std::min(share, 1.0));
+      if (round_deadline->IsExpired()) {
+        LOG(INFO) << "Out of time. Keeping the initial estimate for image "
+                  << "subset #" << (round_index + 1) << ".";
+        return;
+      }
+    }
+    IRLSMapSolverOptions round_solver_options = solver_options;
+    round_solver_options.deadline = round_deadline;
+    round_solver_options.max_num_irls_iterations = GetIterationBudget(
+        solver_options.max_num_irls_iterations, importance);
+    round_solver_options.max_num_solver_iterations = GetIterationBudget(
+        solver_options.max_num_solver_iterations, importance);
+    round_solver_options.continuation_iterations_per_stage =
+        GetIterationBudget(
+            solver_options.continuation_iterations_per_stage, importance);
 
     // Set up the base objective function (just data term). The regularization
     // term depends on the IRLS weights, so it gets added in the IRLS loop.
+    // In mixed precision, the objective evaluates a single precision data
+    // term, and a double precision one refines its solves.
+    //
+    // A continued round reuses the data terms of its split from the last
+    // solve, which only have to be extended with the observations that were
+    // added since (see MapSolver::AddObservation()).
+    const bool use_mixed_precision = solver_options.use_mixed_precision;
+    std::shared_ptr<SplitDataTerms> split_data_terms =
+        keep_solver_state ? round_data_terms[round_index] : nullptr;
+    if (split_data_terms == nullptr) {
+      split_data_terms = CreateSplitDataTerms(
+          solver_options,
+          split.channel_start,
+          split.channel_end,
+          compiled_image_model);
+    } else if (split_data_terms->data_term->GetNumObservations() <
+               GetNumImages()) {
+      ExtendSplitDataTerms(
+          use_mixed_precision,
+          split.channel_start,
+          compiled_image_model,
+          split_data_terms.get());
+    }
+    if (keep_solver_state) {
+      round_data_terms[round_index] = split_data_terms;
+    }
     ObjectiveFunction objective_function_data_term_only(num_data_points);
-    std::shared_ptr<ObjectiveTerm> data_term(new ObjectiveDataTerm(
-        image_model_, observations_, channel_start, channel_end, image_size));
-    objective_function_data_term_only.AddTerm(data_term);
+    objective_function_data_term_only.AddTerm(
+        split_data_terms->data_term, "data term");
+    const MixedPrecisionDataTerms* mixed_precision_data_terms =
+        split_data_terms->mixed_precision_data_terms.get();
+    const MultigridDataTerms* multigrid_data_terms =
+        split_data_terms->multigrid_data_terms.get();
+
+    if (round_deadline != nullptr) {
+      round_deadline->RecordStage("data term setup", round_start_time);
+    }
+
+    // The checkpoint of the round identifies its problem by the estimate that
+    // the round starts from, before any continuation stage. A round that
+    // resumes from its checkpoint has already run the continuation stages.
+    const IRLSMapSolverOptions final_solver_options =
+        get_scaled_solver_options(round_solver_options, num_data_points);
+    const std::string checkpoint_path =
+        solver_options.checkpoint_path.empty() ? "" :
+            GetIRLSCheckpointPath(solver_options.checkpoint_path, round_index);
+    uint64_t checkpoint_problem_hash = 0;
+    IRLSCheckpoint resume_checkpoint;
+    bool is_resumed = false;
+    if (!checkpoint_path.empty()) {
+      checkpoint_problem_hash = HashIRLSProblemValues(
+          HashIRLSInitialEstimate(solver_data.getcontent(), num_data_points),
+          GetCheckpointProblemValues(final_solver_options, regularizers_));
+      is_resumed = ReadMatchingIRLSCheckpoint(
+          checkpoint_path,
+          checkpoint_problem_hash,
+          split.channel_start,
+          split.channel_end,
+          num_data_points,
+          regularizers_.size(),
+          &resume_checkpoint);
+    }
+
+    // Run the continuation stages with stronger regularization first. Each
+    // stage continues from the estimate of the previous one. Under a
+    // deadline, the remaining stages (including the final one) share the
+    // remaining time equally.
+    const int num_continuation_stages = is_resumed ? 0 :
+        solver_options.continuation_parameter_scales.size();
+    for (int stage = 0; stage < num_continuation_stages; ++stage) {
+      const double parameter_scale =
+          solver_options.continuation_parameter_scales[stage];
+      RegularizersAndParameters stage_regularizers = regularizers_;
+      for (auto& regularizer_and_parameter : stage_regularizers) {
+        regularizer_and_parameter.second *= parameter_scale;
+      }
+      IRLSMapSolverOptions stage_options = round_solver_options;
+      stage_options.AdjustThresholdsAdaptively(
+          num_data_points, regularization_parameter_sum * parameter_scale);
+      stage_options.max_num_irls_iterations =
+          round_solver_options.continuation_iterations_per_stage;
+      stage_options.quality_metric = nullptr;
+      if (round_deadline != nullptr) {
+        stage_options.deadline = round_deadline->CreateShare(
+            1.0 / (num_continuation_stages - stage + 1));
+      }
+      LOG(INFO) << "Continuation stage with the regularization parameters "
+                << "scaled by " << parameter_scale << ".";
+      RunIRLSLoop(
+          stage_options,
+          objective_function_data_term_only,
+          mixed_precision_data_terms,
+          multigrid_data_terms,
+          stage_regularizers,
+          image_size,
+          split.channel_start,
+          split.channel_end,
+          telemetry_,
+          "",
+          0,
+          nullptr,
+          nullptr,
+          &solver_data);
+    }
 
     RunIRLSLoop(
-        solver_options_scaled,
+        final_solver_options,
         objective_function_data_term_only,
+        mixed_precision_data_terms,
+        multigrid_data_terms,
         regularizers_,
         image_size,
-        channel_start,
-        channel_end,
+        split.channel_start,
+        split.channel_end,
+        telemetry_,
+        checkpoint_path,
+        checkpoint_problem_hash,
+        is_resumed ? &resume_checkpoint : nullptr,
+        round_state,
         &solver_data);
 
-    for (int channel = 0; channel < num_channels_per_split; ++channel) {
-      const double* data_ptr =
-          solver_data.getcontent() + (num_pixels * channel);
+    // Later snapshots show the final estimate of the channels that this split
+    // is responsible for.
+    if (solver_options.progressive_results != nullptr) {
+      solver_options.progressive_results->UpdateChannels(
+          solver_data.getcontent() +
+              num_pixels * (split.kept_channel_start - split.channel_start),
+          split.kept_channel_start,
+          split.kept_channel_end);
+    }
+  };
+
+  if (solver_options.progressive_results != nullptr) {
+    solver_options.progressive_results->Start(initial_estimate);
+  }
+  if (num_concurrent_rounds > 1) {
+    LOG(INFO) << "Solving up to " << num_concurrent_rounds
+              << " image subsets concurrently.";
+    // The calling thread also runs rounds, so one fewer worker is needed.
+    util::ThreadPool thread_pool(num_concurrent_rounds - 1);
+    thread_pool.ParallelFor(num_solver_rounds, [&](const int task_index) {
+      run_solver_round(round_order[task_index]);
+    });
+  } else {
+    for (int i = 0; i < num_solver_rounds; ++i) {
+      run_solver_round(round_order[i]);
+    }
+  }
+  if (solver_options.progressive_results != nullptr) {
+    solver_options.progressive_results->Finish();
+  }
+
+  // Rounds that were not solved keep the estimate they started with.
+  if (keep_solver_state) {
+    int64_t num_state_bytes = 0;
+    for (int i = 0; i < num_solver_rounds; ++i) {
+      IRLSCheckpoint& round_state = round_states[i];
+      if (round_state.estimate.empty()) {
+        const int64_t num_data_points =
+            channel_splits[i].GetNumChannels() * num_pixels;
+        round_state.estimate.assign(
+            round_solver_data[i].getcontent(),
+            round_solver_data[i].getcontent() + num_data_points);
+      }
+      num_state_bytes += util::GetBufferBytes(round_state.estimate);
+      for (const std::vector<double>& weights : round_state.irls_weights) {
+        num_state_bytes += util::GetBufferBytes(weights);
+      }
+    }
+    split_states_ = std::move(round_states);
+    split_states_memory_.SetBytes(num_state_bytes);
+    split_data_terms_ = std::move(round_data_terms);
+  }
+
+  // Only the channels that each split is responsible for are kept. The
+  // overlapping channels are discarded.
+  const util::ScopedMemoryTag memory_tag(util::MEMORY_TAG_ESTIMATE);
+  ImageData estimated_image;
+  for (int i = 0; i < num_solver_rounds; ++i) {
+    const ChannelSplit& split = channel_splits[i];
+    for (int channel = split.kept_channel_start;
+         channel < split.kept_channel_end;
+         ++channel) {
+      const double* data_ptr = round_solver_data[i].getcontent() +
+          (num_pixels * (channel - split.channel_start));
       estimated_image.AddChannel(data_ptr, image_size);
     }
   }
@@ -3,11 +3,18 @@
 #ifndef SRC_OPTIMIZATION_IRLS_MAP_SOLVER_H_
 #define SRC_OPTIMIZATION_IRLS_MAP_SOLVER_H_
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "image/image_data.h"
+#include "optimization/irls_checkpoint.h"
 #include "optimization/map_solver.h"
+#include "optimization/progressive_results.h"
+#include "util/memory_accounting.h"
 
 namespace super_resolution {
 
@@ -16,7 +23,7 @@ struct IRLSMapSolverOptions : public MapSolverOptions {
 
   // Augments the adjustment to also include the irls cost difference.
   virtual void AdjustThresholdsAdaptively(
-      const int num_parameters, const double regularization_parameter_sum);
+      const int64_t num_parameters, const double regularization_parameter_sum);
 
   // Print also includes specific IRLS parameters.
   virtual void PrintSolverOptions() const;
@@ -33,6 +40,103 @@ struct IRLSMapSolverOptions : public MapSolverOptions {
   // The stopping criteria for the inner loop (conjugate gradient) is defined
   // independently in MapSolverOptions.
   double irls_cost_difference_threshold = 1.0e-5;
+
+  // The exponent p of the regularizer norm that the IRLS weights approximate,
+  // i.e. the weights are |r|^(p - 2) for the regularizer values r. The
+  // default of 1 minimizes the 1-norm of the regularizer (e.g. the total
+  // variation). Smaller values (0 < p < 1) preserve edges more strongly, and 2
+  // solves a single least squares problem. Must be in (0, 2].
+  double irls_norm_exponent = 1.0;
+
+  // If not empty, the state of every channel split is saved to
+  // "<checkpoint_path>.<split index>" after every checkpoint_interval IRLS
+  // iterations and when the split is done (see irls_checkpoint.h). Solve()
+  // resumes every split from its checkpoint if it exists and was made for the
+  // same initial estimate, so an interrupted solve can be continued by
+  // running it again. Converged splits are not solved again, and splits that
+  // stopped at max_num_irls_iterations continue if the limit is raised.
+  std::string checkpoint_path = "";
+  int checkpoint_interval = 1;
+
+  // An optional stopping rule based on image quality (e.g. the PSNR against a
+  // known ground truth), which often plateaus long before the cost does. If
+  // set, the metric is evaluated on the estimate of every channel split after
+  // every quality_evaluation_interval IRLS iterations, and the split stops
+  // once the metric improved by less than min_quality_improvement since the
+  // previous evaluation. Higher metric values must mean better quality.
+  //
+  // The metric is given the estimate of the channels [channel_start,
+  // channel_end), stored one channel after the other. It must be safe to call
+  // concurrently if the splits are solved concurrently.
+  using QualityMetric = std::function<double(
+      const double* estimate_data,
+      const int channel_start,
+      const int channel_end)>;
+  QualityMetric quality_metric;
+  int quality_evaluation_interval = 1;
+  double min_quality_improvement = 0.0;
+
+  // Continuation (homotopy) on the regularization parameters. TV and BTV
+  // converge much faster from the smooth solution of a stronger
+  // regularization than from a cold start. If not empty, every channel split
+  // is first solved in stages with all regularization parameters multiplied
+  // by each of these scales in order (e.g. {100, 10}), each stage starting
+  // from the result of the previous one and running at most
+  // continuation_iterations_per_stage IRLS iterations. The final stage then
+  // solves at the actual parameters with the full iteration budget.
+  //
+  // Only the final stage is checkpointed and evaluated by the quality metric.
+  std::vector<double> continuation_parameter_scales;
+  int continuation_iterations_per_stage = 2;
+
+  // Active-set mode for the later IRLS iterations, in which flat regions have
+  // usually stopped changing and only the edges are still converging. If
+  // positive, the image is divided into square tiles of this size, and after
+  // every IRLS iteration the tiles whose pixels (in any channel) changed by
+  // less than active_set_change_threshold are frozen, unless a neighboring
+  // tile is still changing. The solver keeps frozen pixels fixed (their
+  // gradient is set to zero) and their IRLS weights are not updated, so the
+  // remaining iterations only solve for the active pixels. The regularizers
+  // that support it only evaluate the image rows that reach an active tile,
+  // and reuse the cached values of the other rows (see
+  // ObjectiveTerm::SetFrozenParameters()), but the data term still evaluates
+  // the whole image. A frozen tile is active again as soon as one of its
+  // neighbors changes, since that moves the regularizer values across their
+  // shared boundary. The split stops once all tiles are frozen. Checkpoints
+  // do not store the active set, so all tiles are active again after
+  // resuming. It is ignored by the MULTIGRID_SOLVER, which cannot keep pixels
+  // fixed.
+  int active_set_tile_size = 0;
+  double active_set_change_threshold = 1.0e-4;
+
+  // Mixed precision iterative refinement. If true, the inner least squares
+  // solves evaluate the data term in single precision (as with
+  // use_single_precision), but before every solve the data term is evaluated
+  // once in double precision at the current estimate. The difference between
+  // the double and single precision cost and gradient there is added to the
+  // objective as a linear correction, so each inner solve computes a
+  // correction of the estimate whose rounding errors are relative to the
+  // size of the correction rather than of the estimate. The IRLS weights and
+  // regularizers stay in double precision. The final estimate then has
+  // nearly double precision quality at about the speed of single precision,
+  // at the cost of one double precision evaluation per IRLS iteration and a
+  // second (double precision) copy of the data term.
+  bool use_mixed_precision = false;
+
+  // If set, the intermediate estimates are streamed to it while solving (see
+  // progressive_results.h). Every channel split reports its estimate after
+  // every least squares solver iteration, including the continuation stages,
+  // and the final estimate of each split is kept for the later snapshots.
+  // The stream is started and finished by Solve().
+  std::shared_ptr<ProgressiveResults> progressive_results;
+
+  // If true, Solve() keeps the final estimate and IRLS weights of every
+  // channel split (one estimate and one set of weights per regularizer), so
+  // that ContinueSolve() can continue from them, e.g. after new observations
+  // were added (see MapSolver::AddObservation()). The data terms of every
+  // split are kept as well, so a continued solve only has to extend them
+  // with the new observations.
+  bool keep_solver_state = false;
 };
 
 class IRLSMapSolver : public MapSolver {
@@ -43,13 +147,71 @@ class IRLSMapSolver : public MapSolver {
       const std::vector<ImageData>& low_res_images,
       const bool print_solver_output = true);
 
+  // Same as above, but shares the observations (and the compiled image
+  // model) with other solvers instead of copying them.
+  IRLSMapSolver(
+      const IRLSMapSolverOptions& solver_options,
+      const ImageModel& image_model,
+      const std::shared_ptr<const SharedSolverInputs>& inputs,
+      const bool print_solver_output = true);
+
   // The IRLS MAP formulation solver implementation. Uses a least squares
   // solver library to do the actual optimization.
   virtual ImageData Solve(const ImageData& initial_estimate);
 
+  // Continues from the estimate and IRLS weights that the last Solve() or
+  // ContinueSolve() ended with, and runs at most the given number of IRLS
+  // iterations (0 for the limit of the options). This is meant for
+  // observations that are added while solving (see AddObservation()), so
+  // each new frame costs a few iterations rather than a full solve from the
+  // initial estimate. The continuation stages are skipped, and checkpoints
+  // are neither read nor written. The solver must have been solved before
+  // with keep_solver_state set.
+  ImageData ContinueSolve(const int max_num_irls_iterations);
+
  private:
+  // The data terms of a channel split (see irls_map_solver.cpp).
+  struct SplitDataTerms;
+
+  // Creates the data terms of the split of the given channel range
+  // (channel_end is non-inclusive).
+  std::shared_ptr<SplitDataTerms> CreateSplitDataTerms(
+      const IRLSMapSolverOptions& solver_options,
+      const int channel_start,
+      const int channel_end,
+      const std::shared_ptr<const CompiledImageModel>& compiled_image_model)
+      const;
+
+  // Extends the data terms of the split that starts at the given channel
+  // with the observations that were added since they were created, which
+  // does not convert, encode or reduce the earlier observations again.
+  void ExtendSplitDataTerms(
+      const bool use_mixed_precision,
+      const int channel_start,
+      const std::shared_ptr<const CompiledImageModel>& compiled_image_model,
+      SplitDataTerms* split_data_terms) const;
+
+  // Solves all channel splits with the given options, starting each split
+  // from the initial estimate or, if continue_from_solver_state is true, from
+  // its kept solver state.
+  ImageData SolveChannelSplits(
+      const IRLSMapSolverOptions& solver_options,
+      const ImageData& initial_estimate,
+      const bool continue_from_solver_state);
+
   // Passed in through the constructor.
   const IRLSMapSolverOptions solver_options_;
+
+  // The state of every channel split at the end of the last solve if
+  // keep_solver_state is set, or empty otherwise. The estimate holds all
+  // channels of the split, including its overlapping channels.
+  std::vector<IRLSCheckpoint> split_states_;
+  util::MemoryAccount split_states_memory_;
+
+  // The data terms of every channel split at the end of the last solve if
+  // keep_solver_state is set, or empty otherwise. A split that was not
+  // solved has none.
+  std::vector<std::shared_ptr<SplitDataTerms>> split_data_terms_;
 };
 
 }  // namespace super_resolution
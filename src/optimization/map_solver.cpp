@@ -1,20 +1,38 @@
 #include "optimization/map_solver.h"
 
+#include <cstdint>
 #include <iostream>
-#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "image_model/compiled_image_model.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
 #include "optimization/regularizer.h"
+#include "util/memory_accounting.h"
 
 #include "glog/logging.h"
 
 namespace super_resolution {
+namespace {
+
+// Returns an image whose channels share the pixels of the given image's
+// channels (and their reference counts), so no pixels are copied.
+ImageData ShareImageChannels(const ImageData& image) {
+  std::vector<cv::Mat> channel_images;
+  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+    channel_images.push_back(image.GetChannelImage(channel));
+  }
+  return ImageData(channel_images, image.GetPrecision());
+}
+
+}  // namespace
 
 void MapSolverOptions::AdjustThresholdsAdaptively(
-    const int num_parameters, const double regularization_parameter_sum) {
+    const int64_t num_parameters, const double regularization_parameter_sum) {
 
   const double threshold_scale = num_parameters * regularization_parameter_sum;
   if (threshold_scale < 1.0) {
@@ -29,6 +47,12 @@ void MapSolverOptions::PrintSolverOptions() const {
   std::string solver_name = "conjugate gradient";
   if (least_squares_solver == LBFGS_SOLVER) {
     solver_name = "LBFGS";
+  } else if (least_squares_solver == NATIVE_CG_SOLVER) {
+    solver_name = "native conjugate gradient";
+  } else if (least_squares_solver == NATIVE_LBFGS_SOLVER) {
+    solver_name = "native LBFGS";
+  } else if (least_squares_solver == MULTIGRID_SOLVER) {
+    solver_name = "multigrid";
   }
   std::cout << "  Least squares solver:                "
             << solver_name;
@@ -38,8 +62,60 @@ void MapSolverOptions::PrintSolverOptions() const {
   } else {
     std::cout << " (analytical differentiation)" << std::endl;
   }
+  if (least_squares_solver == MULTIGRID_SOLVER) {
+    std::cout << "  Multigrid levels (maximum):          "
+              << max_num_multigrid_levels << std::endl;
+    std::cout << "  Multigrid smoothing iterations:      "
+              << num_multigrid_smoothing_iterations << " ("
+              << num_multigrid_coarsest_iterations << " on the coarsest level)"
+              << std::endl;
+  }
   if (split_channels) {
     std::cout << "  Channel splitting enabled." << std::endl;
+    std::cout << "  Channels per split:                  "
+              << num_channels_per_split << std::endl;
+    std::cout << "  Overlapping channels per split:      "
+              << num_split_overlap_channels << std::endl;
+    std::cout << "  Concurrent channel splits:           "
+              << num_split_solver_workers << std::endl;
+    if (split_solver_memory_limit_mb > 0.0) {
+      std::cout << "  Channel split memory limit (MB):     "
+                << split_solver_memory_limit_mb << std::endl;
+    }
+    if (!channel_importances.empty()) {
+      std::cout << "  Split budgets by channel importance (minimum "
+                << min_split_importance << ")." << std::endl;
+    }
+  }
+  std::cout << "  Number of threads:                   "
+            << num_threads << std::endl;
+  if (use_single_precision) {
+    std::cout << "  Single precision data term enabled." << std::endl;
+  }
+  if (observation_encoding == OBSERVATION_ENCODING_HALF) {
+    std::cout << "  Half precision observations enabled." << std::endl;
+  } else if (observation_encoding == OBSERVATION_ENCODING_UINT16) {
+    std::cout << "  16-bit quantized observations enabled." << std::endl;
+  }
+  if (use_compiled_image_model) {
+    std::cout << "  Compiled image model enabled." << std::endl;
+  }
+  if (use_normal_equations) {
+    std::cout << "  Normal equations data term enabled." << std::endl;
+  }
+  if (use_diagonal_preconditioner) {
+    std::cout << "  Diagonal preconditioner enabled." << std::endl;
+  }
+  if (use_line_search_cache) {
+    std::cout << "  Line search cache enabled." << std::endl;
+  }
+  if (evaluate_terms_concurrently) {
+    std::cout << "  Concurrent term evaluation enabled." << std::endl;
+  }
+  if (deadline != nullptr) {
+    std::cout << "  Time budget (seconds):               "
+              << deadline->GetRemainingSeconds() << " remaining of "
+              << deadline->GetBudgetSeconds() << std::endl;
   }
   std::cout << "  Threshold 1 (gradient norm):         "
             << gradient_norm_threshold << std::endl;
@@ -49,12 +125,79 @@ void MapSolverOptions::PrintSolverOptions() const {
             << parameter_variation_threshold << std::endl;
 }
 
+SharedSolverInputs::SharedSolverInputs(std::vector<ImageData> observations)
+    : observations_(std::move(observations)) {}
+
+std::shared_ptr<const CompiledImageModel>
+SharedSolverInputs::GetCompiledImageModel(
+    const ImageModel& image_model,
+    const cv::Size& image_size,
+    const bool with_normal_matrix) const {
+
+  // A model with the normal matrix also serves solvers that do not need it,
+  // and one without it is only compiled again if the normal matrix is needed.
+  std::lock_guard<std::mutex> lock(compiled_image_model_mutex_);
+  if (compiled_image_model_ == nullptr ||
+      (with_normal_matrix && !compiled_image_model_->HasNormalMatrix())) {
+    compiled_image_model_.reset(new CompiledImageModel(
+        image_model.Compile(
+            image_size, observations_.size(), with_normal_matrix)));
+    LOG(INFO) << "Compiled the image model with "
+              << compiled_image_model_->GetNumNonZeros()
+              << " matrix entries.";
+  }
+  CHECK(compiled_image_model_->GetImageSize() == image_size)
+      << "The shared inputs were compiled for a different image size.";
+  return compiled_image_model_;
+}
+
+std::shared_ptr<const SharedSolverInputs> SharedSolverInputs::AddObservation(
+    const ImageData& observation, const ImageModel& image_model) const {
+
+  // The new inputs share the pixels of the existing observations, so only
+  // the new observation is copied.
+  std::vector<ImageData> observations;
+  observations.reserve(observations_.size() + 1);
+  for (const ImageData& existing_observation : observations_) {
+    observations.push_back(ShareImageChannels(existing_observation));
+  }
+  {
+    const util::ScopedMemoryTag memory_tag(util::MEMORY_TAG_OBSERVATIONS);
+    observations.push_back(observation);
+  }
+  std::shared_ptr<SharedSolverInputs> inputs(
+      new SharedSolverInputs(std::move(observations)));
+
+  // The copy of the compiled model shares the matrices of the existing
+  // frames (see CompiledImageModel::AddFrame()).
+  std::lock_guard<std::mutex> lock(compiled_image_model_mutex_);
+  if (compiled_image_model_ != nullptr) {
+    std::shared_ptr<CompiledImageModel> compiled_image_model(
+        new CompiledImageModel(*compiled_image_model_));
+    compiled_image_model->AddFrame(image_model.GetSparseModelMatrix(
+        compiled_image_model->GetImageSize(), observations_.size()));
+    inputs->compiled_image_model_ = compiled_image_model;
+  }
+  return inputs;
+}
+
 MapSolver::MapSolver(
     const ImageModel& image_model,
     const std::vector<ImageData>& low_res_images,
     const bool print_solver_output)
-    : Solver(image_model, print_solver_output) {
+    : MapSolver(
+          image_model,
+          std::make_shared<const SharedSolverInputs>(low_res_images),
+          print_solver_output) {}
+
+MapSolver::MapSolver(
+    const ImageModel& image_model,
+    const std::shared_ptr<const SharedSolverInputs>& inputs,
+    const bool print_solver_output)
+    : Solver(image_model, print_solver_output), inputs_(inputs) {
 
+  CHECK_NOTNULL(inputs_.get());
+  const std::vector<ImageData>& low_res_images = inputs_->GetObservations();
   const int num_observations = low_res_images.size();
   CHECK_GT(num_observations, 0)
       << "Cannot super-resolve with 0 low-res images.";
@@ -69,19 +212,17 @@ MapSolver::MapSolver(
 
   // Set the size of the HR images. There must be at least one image at
   // low_res_images[0], otherwise the above check will have failed.
-  const int upsampling_scale = image_model_.GetDownsamplingScale();
+  const int upsampling_scale = image_model_->GetDownsamplingScale();
   const cv::Size lr_image_size = low_res_images[0].GetImageSize();
   image_size_ = cv::Size(
       lr_image_size.width * upsampling_scale,
       lr_image_size.height * upsampling_scale);
 
-  // Rescale the LR observations to the HR image size so they're useful for in
-  // the objective function.
-  observations_.reserve(num_observations);
+  // The observations are kept at the LR size, since the data term computes
+  // its residuals on the LR grid.
   for (const ImageData& low_res_image : low_res_images) {
-    ImageData observation = low_res_image;  // copy
-    observation.ResizeImage(image_size_, INTERPOLATE_NEAREST);
-    observations_.push_back(observation);
+    CHECK(low_res_image.GetImageSize() == lr_image_size)
+        << "Low-res image sizes do not match up.";
   }
 }
 
@@ -93,10 +234,24 @@ void MapSolver::AddRegularizer(
       std::make_pair(regularizer, regularization_parameter));
 }
 
-int MapSolver::GetNumDataPoints() const {
-  const long num_data_points = GetNumPixels() * GetNumChannels();
-  CHECK_LE(num_data_points, std::numeric_limits<int>::max())
-      << "Number of data points exceeds maximum size.";
+void MapSolver::AddObservation(
+    const ImageData& observation, const MotionShift& motion_shift) {
+
+  CHECK(image_model_->CanAddFrames())
+      << "Observations cannot be added to an image model with per-frame "
+      << "warps or observation weights.";
+  const cv::Size lr_image_size = GetObservations()[0].GetImageSize();
+  CHECK_EQ(observation.GetNumChannels(), num_channels_)
+      << "Image channel counts do not match up.";
+  CHECK(observation.GetImageSize() == lr_image_size)
+      << "Low-res image sizes do not match up.";
+
+  image_model_ = std::make_shared<const ImageModel>(
+      image_model_->CreateWithMotionShift(motion_shift));
+  inputs_ = inputs_->AddObservation(observation, *image_model_);
+}
+
+int64_t MapSolver::GetNumDataPoints() const {
   return GetNumPixels() * GetNumChannels();
 }
 
@@ -108,4 +263,23 @@ double MapSolver::GetRegularizationParameterSum() const {
   return regularization_parameter_sum;
 }
 
+std::shared_ptr<const CompiledImageModel> MapSolver::GetCompiledImageModel(
+    const MapSolverOptions& solver_options) const {
+
+  std::shared_ptr<const CompiledImageModel> compiled_image_model;
+  const bool use_compiled_image_model =
+      solver_options.use_compiled_image_model ||
+      solver_options.use_normal_equations;
+  if (!use_compiled_image_model || solver_options.use_single_precision) {
+    return compiled_image_model;
+  }
+  if (!image_model_->IsCompilable()) {
+    LOG(WARNING) << "The image model cannot be compiled. "
+                 << "Applying the operators directly instead.";
+    return compiled_image_model;
+  }
+  return inputs_->GetCompiledImageModel(
+      *image_model_, image_size_, solver_options.use_normal_equations);
+}
+
 }  // namespace super_resolution
@@ -6,21 +6,31 @@
 #ifndef SRC_OPTIMIZATION_MAP_SOLVER_H_
 #define SRC_OPTIMIZATION_MAP_SOLVER_H_
 
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
+#include "image/encoded_observations.h"
 #include "image/image_data.h"
+#include "image_model/compiled_image_model.h"
 #include "image_model/image_model.h"
+#include "motion/motion_shift.h"
 #include "optimization/regularizer.h"
 #include "optimization/solver.h"
+#include "optimization/solver_deadline.h"
+#include "optimization/solver_telemetry.h"
 
 namespace super_resolution {
 
 // The available solvers to use for least squares minimization.
 enum LeastSquaresSolver {
-  CG_SOLVER,    // Conjugate gradient solver.
-  LBFGS_SOLVER  // Limited-memory BFGS solver.
+  CG_SOLVER,            // Conjugate gradient solver.
+  LBFGS_SOLVER,         // Limited-memory BFGS solver.
+  NATIVE_CG_SOLVER,     // Conjugate gradient solver without ALGLIB.
+  NATIVE_LBFGS_SOLVER,  // Limited-memory BFGS solver without ALGLIB.
+  MULTIGRID_SOLVER      // Geometric multigrid V-cycles on the HR image grid.
 };
 
 // Options for the solver. Set/update these as needed for subclasses of
@@ -36,7 +46,7 @@ struct MapSolverOptions {
   // NOTE: The base thresholds must be set appropriately beforehand for this
   // adjustment to work.
   virtual void AdjustThresholdsAdaptively(
-      const int num_parameters, const double regularization_parameter_sum);
+      const int64_t num_parameters, const double regularization_parameter_sum);
 
   // Neatly prints out all options used for the user.
   virtual void PrintSolverOptions() const;
@@ -47,9 +57,20 @@ struct MapSolverOptions {
   // The number of corrections for approximating the Hessian for an LBFGS
   // iteration. ALGLIB recommends 3 <= num_lbfgs_hessian_corrections <= 7.
   //
-  // Only applicable if using LBFGS_SOLVER.
+  // Only applicable if using LBFGS_SOLVER or NATIVE_LBFGS_SOLVER.
   int num_lbfgs_hessian_corrections = 5;
 
+  // The grid hierarchy of the multigrid solver: the maximum number of grid
+  // levels (including the full resolution), each half the size of the
+  // previous one, the number of CG smoothing iterations on every level before
+  // and after its coarse grid correction, and the number of CG iterations on
+  // the coarsest level.
+  //
+  // Only applicable if using MULTIGRID_SOLVER.
+  int max_num_multigrid_levels = 4;
+  int num_multigrid_smoothing_iterations = 2;
+  int num_multigrid_coarsest_iterations = 10;
+
   // Maximum number of solver iterations. 0 for infinite.
   int max_num_solver_iterations = 50;
 
@@ -64,29 +85,190 @@ struct MapSolverOptions {
   // Optional parameters for numerical differentiation. Use for testing
   // analytical differentiation only. Numerical differentiation is very slow
   // but gives near-perfect estimates of the gradient. It is not feasible for
-  // larger data sets.
+  // larger data sets. Not supported by the native solvers. See
+  // ComputeColoredNumericalGradient() for validating gradients on larger
+  // images.
   bool use_numerical_differentiation = false;
   double numerical_differentiation_step = 1.0e-6;
 
   // If this is set to true, channels in the the given image will be solved
-  // independently. This split will occur after any other dimension reductions
-  // have been applied (such as PCA or color space interpolation).
+  // independently in splits of num_channels_per_split channels. This split
+  // will occur after any other dimension reductions have been applied (such as
+  // PCA or color space interpolation).
   //
   // WARNING: If a regularizer uses multiple channels (such as 3D TV), this
-  // option will prevent it from seeing multiple channels. Not recommended for
-  // 3D regularizers.
+  // option will prevent it from seeing channels outside of each split. Use
+  // larger splits or overlapping channels for 3D regularizers.
   bool split_channels = false;
+
+  // The number of channels solved together in each split if split_channels is
+  // set. The last split has fewer channels if the number of channels is not a
+  // multiple of this. Larger splits couple more channels in multi-channel
+  // regularizers, but need more memory and may converge more slowly.
+  int num_channels_per_split = 1;
+
+  // The number of neighboring channels on each side of a split that are
+  // solved along with it, but discarded when the splits are reassembled. This
+  // gives multi-channel regularizers some context at the split boundaries.
+  int num_split_overlap_channels = 0;
+
+  // The number of channel splits that are solved concurrently if
+  // split_channels is set. Each split runs its own independent solver, so the
+  // memory used by the solver grows with the number of concurrent splits. Set
+  // to 0 to use all available hardware threads.
+  int num_split_solver_workers = 1;
+
+  // Limits the estimated memory (in megabytes) used by concurrently solved
+  // channel splits. The number of concurrent splits is reduced as needed to
+  // stay within this limit, but at least one split is always solved. Set to 0
+  // to not limit the memory.
+  double split_solver_memory_limit_mb = 0.0;
+
+  // The relative importance of every channel for budgeting the channel
+  // splits, e.g. the fraction of the spectral variance explained by every PCA
+  // band (see SpectralPCA::GetExplainedVarianceRatios()). If there is one
+  // value per channel and split_channels is set, the importance of a split is
+  // the sum over its kept channels relative to the most important split.
+  // Every split then gets that share of the outer and inner solver iterations
+  // (but at least one of each), the splits are started in order of
+  // importance, and splits less important than min_split_importance are not
+  // solved at all: they keep the initial estimate (e.g. the interpolated
+  // image). Only the IRLS solver uses it.
+  std::vector<double> channel_importances;
+  double min_split_importance = 0.0;
+
+  // The number of threads used to evaluate the data term, which computes the
+  // cost and gradient of each observation independently. Set to 1 to compute
+  // everything serially, or 0 to use all available hardware threads.
+  int num_threads = 1;
+
+  // If true, the data term (the image model and its transpose, which dominate
+  // the cost of every evaluation) is computed in single precision. This
+  // halves its memory traffic. The solver, the regularizers and the estimate
+  // itself stay in double precision, so the results differ only slightly.
+  bool use_single_precision = false;
+
+  // How the data term stores its copy of the observations. The 16-bit
+  // encodings cut the memory traffic of the observations by 4x, and only
+  // change the results by the rounding of the observations (see
+  // ObservationEncoding). They add to the memory of the solve rather than
+  // saving any: the shared solver inputs keep the double precision
+  // observations, which other solvers over the same inputs, added frames
+  // (see AddObservation()) that make the uint16 codes be computed again, and
+  // the double precision and multigrid terms of the same solver still read.
+  ObservationEncoding observation_encoding = OBSERVATION_ENCODING_NONE;
+
+  // If true and the image model is compilable, the image model is compiled
+  // once for the solve (see ImageModel::Compile()) and the data term replays
+  // the precomputed per-frame matrices instead of applying the operators one
+  // by one. This is faster but stores a sparse matrix for every observation.
+  // It is ignored in single precision.
+  bool use_compiled_image_model = false;
+
+  // If true, the image model is compiled as above along with its normal
+  // matrix sum_k A_k'A_k, and the data term is evaluated from the normal
+  // equations. Every evaluation is then a single pass over the HR pixels
+  // independent of the number of observations, which pays off for long
+  // bursts. It is ignored in single precision.
+  bool use_normal_equations = false;
+
+  // If true, the least squares solvers are preconditioned with the diagonal
+  // of the objective's Hessian (see
+  // ObjectiveFunction::ComputeHessianDiagonal()), which is recomputed before
+  // every solve. This evens out the curvature of pixels that are observed by
+  // different numbers of frames and of the IRLS weights, which grow large in
+  // flat regions and otherwise make the inner solves badly conditioned. Only
+  // the IRLS solver uses it.
+  bool use_diagonal_preconditioner = false;
+
+  // If true, the data term caches its cost and gradient along the current
+  // search line (see ObjectiveDataTerm::SetUseLineSearchCache()), so the
+  // trial points of every line search cost a few vector operations instead
+  // of a pass of the image model over all observations. Only the IRLS solver
+  // uses it.
+  bool use_line_search_cache = false;
+
+  // If true, the terms of the objective (the data term and every
+  // regularizer) are evaluated concurrently, each into its own gradient
+  // buffer (see ObjectiveFunction::SetNumThreads()). This hides the cost of
+  // the regularizers behind the data term when there are several of them.
+  // Only the IRLS solver uses it.
+  bool evaluate_terms_concurrently = false;
+
+  // An optional wall-clock budget for the solve (see solver_deadline.h). The
+  // channel splits get shares of the remaining time in proportion to their
+  // importance as they start, and before every least squares solve the
+  // iterations are limited to the number that fit into the remaining time,
+  // as measured by the previous solves. A split stops once not even one
+  // iteration fits, and splits that start after the deadline keep their
+  // initial estimate, so Solve() returns the best estimate that was reached
+  // in time. The time of every stage is recorded in the deadline. Only the
+  // IRLS solver uses it.
+  std::shared_ptr<SolverDeadline> deadline;
+};
+
+// The inputs of a MAP solve that any number of solvers over the same
+// observations and image model can share, also while they run concurrently
+// (e.g. wavelet subbands, parameter sweeps, or channel splits): the
+// observations, and the image model compiled for them. Both are immutable
+// once created, so sharing them keeps memory from growing with the number of
+// solvers.
+class SharedSolverInputs {
+ public:
+  // Takes over the given LR observations.
+  explicit SharedSolverInputs(std::vector<ImageData> observations);
+
+  const std::vector<ImageData>& GetObservations() const {
+    return observations_;
+  }
+
+  // Returns the image model compiled for the given HR image size and every
+  // observation (see ImageModel::Compile()), including its normal matrix if
+  // requested. The model is compiled by the first call and reused by all
+  // later ones, and concurrent callers wait for it rather than compiling it
+  // again. Every call must pass the same image model and image size.
+  std::shared_ptr<const CompiledImageModel> GetCompiledImageModel(
+      const ImageModel& image_model,
+      const cv::Size& image_size,
+      const bool with_normal_matrix) const;
+
+  // Returns new inputs with the given observation appended to these
+  // observations, for a frame that arrives after the solvers were created
+  // (see MapSolver::AddObservation()). These inputs are not changed, since
+  // other solvers may still share them, but the new inputs share the pixels
+  // of their observations, so only the new observation is copied. If the
+  // image model was compiled, the new inputs get a copy of it that shares
+  // the existing frames and is extended by the new frame (see
+  // CompiledImageModel::AddFrame()) instead of being compiled again. The
+  // image model must already include the motion of the new frame.
+  std::shared_ptr<const SharedSolverInputs> AddObservation(
+      const ImageData& observation, const ImageModel& image_model) const;
+
+ private:
+  const std::vector<ImageData> observations_;
+
+  // The compiled image model, or null if it was not compiled yet. Protected
+  // by the mutex.
+  mutable std::shared_ptr<const CompiledImageModel> compiled_image_model_;
+  mutable std::mutex compiled_image_model_mutex_;
 };
 
 class MapSolver : public Solver {
  public:
   // Constructor is the same as Solver constructor but also takes the
-  // low-resolution images as input.
+  // low-resolution images as input. The images are copied.
   MapSolver(
       const ImageModel& image_model,
       const std::vector<ImageData>& low_res_images,
       const bool print_solver_output = true);
 
+  // Same as above, but shares the given inputs with other solvers instead of
+  // copying the images.
+  MapSolver(
+      const ImageModel& image_model,
+      const std::shared_ptr<const SharedSolverInputs>& inputs,
+      const bool print_solver_output = true);
+
   // Adds a regularizer term to the objective function.
   virtual void AddRegularizer(
       std::shared_ptr<Regularizer> regularizer,
@@ -94,8 +276,8 @@ class MapSolver : public Solver {
 
   // Returns the number of pixels in a single image channel. This is NOT the
   // total number of pixels in the entire image.
-  int GetNumPixels() const {
-    return image_size_.width * image_size_.height;
+  int64_t GetNumPixels() const {
+    return static_cast<int64_t>(image_size_.width) * image_size_.height;
   }
 
   // Returns the spatial size (width, height) of the image.
@@ -112,29 +294,70 @@ class MapSolver : public Solver {
   // Returns the number of observations (low-resolution images) in the solver
   // system.
   int GetNumImages() const {
-    return observations_.size();
+    return GetObservations().size();
+  }
+
+  // Returns the observed LR images. These are stored at the LR size, which
+  // is the HR image size divided by the downsampling scale.
+  const std::vector<ImageData>& GetObservations() const {
+    return inputs_->GetObservations();
+  }
+
+  // Returns the inputs of the solver, which can be shared with other solvers
+  // over the same observations and image model.
+  std::shared_ptr<const SharedSolverInputs> GetSharedInputs() const {
+    return inputs_;
   }
 
+  // Appends a new observation and the motion shift of its frame, e.g. for LR
+  // frames that arrive one at a time during a live capture. The solver's
+  // image model is replaced by one extended by the motion shift (see
+  // ImageModel::CreateWithMotionShift()), so the model that the solver was
+  // created with is not changed. The image model must be able to add frames
+  // (see ImageModel::CanAddFrames()). The following solves use all
+  // observations, and solvers that support it can continue from the state
+  // of their last solve instead of starting over (see
+  // IRLSMapSolver::ContinueSolve()). Other solvers that shared the inputs
+  // keep the observations they were created with.
+  void AddObservation(
+      const ImageData& observation, const MotionShift& motion_shift);
+
   // Returns the number of data points, which is the total number of pixels in
-  // an image across all channels. Also checks size limit, which cannot exceed
-  // the max size of an integer (approx. 2 billion). The limit of an int max
-  // value is somewhat arbitrary, but can help prevent overflow errors when
-  // dealing with data sizes as integer values.
-  int GetNumDataPoints() const;
+  // an image across all channels. This can exceed the max size of an int
+  // (approx. 2 billion) for large hyperspectral images, so all flattened
+  // indices into the data should be 64-bit.
+  int64_t GetNumDataPoints() const;
 
   // Returns the sum of all regularization parameters.
   double GetRegularizationParameterSum() const;
 
+  // Sets the telemetry that the following solves report their iterations and
+  // timings to. Currently only the IRLSMapSolver reports telemetry.
+  void SetTelemetry(const std::shared_ptr<SolverTelemetry> telemetry) {
+    telemetry_ = telemetry;
+  }
+
  protected:
+  // Returns the image model compiled for the HR image size and every
+  // observation if the solver options ask for it (see
+  // MapSolverOptions::use_compiled_image_model and use_normal_equations), or
+  // null if the data term should apply the image model directly. The model
+  // is compiled once for all solvers that share the inputs.
+  std::shared_ptr<const CompiledImageModel> GetCompiledImageModel(
+      const MapSolverOptions& solver_options) const;
+
   // All regularization terms and their respective regularization parameters to
   // be applied in the cost function.
   std::vector<std::pair<std::shared_ptr<Regularizer>, double>> regularizers_;
 
-  // The observed LR images scaled up to the HR image size for use in the cost
-  // function.
-  std::vector<ImageData> observations_;
+  // Optional. Null if no telemetry should be recorded.
+  std::shared_ptr<SolverTelemetry> telemetry_;
 
  private:
+  // The observations and compiled image model, possibly shared with other
+  // solvers.
+  std::shared_ptr<const SharedSolverInputs> inputs_;
+
   // This is the size of the HR image that is being estimated.
   cv::Size image_size_;
 
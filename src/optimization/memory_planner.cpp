@@ -0,0 +1,263 @@
+#include "optimization/memory_planner.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "image/encoded_observations.h"
+#include "image_model/image_model.h"
+#include "optimization/map_solver.h"
+#include "optimization/tiled_solver.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+constexpr double kBytesPerMegabyte = 1024.0 * 1024.0;
+
+// The bytes per nonzero entry of a compiled (sparse) operator matrix: the
+// value and its column index.
+constexpr double kBytesPerNonzero = sizeof(double) + sizeof(int);
+
+// Returns the number of channel splits, and the number of channels solved
+// together in every split including the overlap channels.
+void GetChannelSplits(
+    const MapSolverOptions& solver_options,
+    const int num_channels,
+    int* num_splits,
+    int* num_solved_channels) {
+
+  if (!solver_options.split_channels) {
+    *num_splits = 1;
+    *num_solved_channels = num_channels;
+    return;
+  }
+  const int num_channels_per_split =
+      std::max(solver_options.num_channels_per_split, 1);
+  *num_splits =
+      (num_channels + num_channels_per_split - 1) / num_channels_per_split;
+  *num_solved_channels = std::min(
+      num_channels_per_split + 2 * solver_options.num_split_overlap_channels,
+      num_channels);
+}
+
+// Returns the number of tiles, and the size of the largest padded tile.
+void GetTiles(
+    const ImageModelParameters& model_parameters,
+    const SolverMemoryProblem& problem,
+    int* num_tiles,
+    cv::Size* padded_tile_size) {
+
+  const cv::Size& image_size = problem.high_res_size;
+  if (problem.tile_size <= 0) {
+    *num_tiles = 1;
+    *padded_tile_size = image_size;
+    return;
+  }
+  const int scale = std::max(model_parameters.scale, 1);
+  const int tile_size = (problem.tile_size + scale - 1) / scale * scale;
+  const int halo_size = GetTileHaloSize(
+      scale,
+      model_parameters.blur_radius,
+      model_parameters.motion_sequence,
+      problem.regularizer_range);
+  *num_tiles =
+      ((image_size.width + tile_size - 1) / tile_size) *
+      ((image_size.height + tile_size - 1) / tile_size);
+  padded_tile_size->width =
+      std::min(tile_size + 2 * halo_size, image_size.width);
+  padded_tile_size->height =
+      std::min(tile_size + 2 * halo_size, image_size.height);
+}
+
+// Returns the sizes that are tried for a dimension of the layout: the given
+// size, and then halves of it down to the minimum.
+std::vector<int> GetHalvedSizes(
+    const int given_size, const int start_size, const int min_size) {
+  std::vector<int> sizes = {given_size};
+  for (int size = start_size / 2; size >= min_size && size > 0; size /= 2) {
+    sizes.push_back(size);
+  }
+  return sizes;
+}
+
+}  // namespace
+
+SolverMemoryEstimate EstimateSolverMemory(
+    const ImageModelParameters& model_parameters,
+    const MapSolverOptions& solver_options,
+    const SolverMemoryProblem& problem) {
+
+  CHECK_GT(problem.high_res_size.area(), 0) << "The image is empty.";
+  CHECK_GT(problem.num_channels, 0) << "The image has no channels.";
+  CHECK_GT(problem.num_observations, 0) << "There are no observations.";
+
+  const double scale_area =
+      static_cast<double>(model_parameters.scale) * model_parameters.scale;
+  const double num_hr_values =
+      static_cast<double>(problem.high_res_size.area()) * problem.num_channels;
+  SolverMemoryEstimate estimate;
+  estimate.image_bytes = sizeof(double) * num_hr_values *
+      (2.0 + problem.num_observations / scale_area);
+
+  int num_splits = 1;
+  int num_solved_channels = problem.num_channels;
+  GetChannelSplits(
+      solver_options, problem.num_channels, &num_splits, &num_solved_channels);
+  int num_tiles = 1;
+  cv::Size padded_tile_size;
+  GetTiles(model_parameters, problem, &num_tiles, &padded_tile_size);
+
+  // The solver state and the term buffers of a single solve.
+  const double num_solved_pixels = padded_tile_size.area();
+  const double num_solved_hr_values = num_solved_pixels * num_solved_channels;
+  const double num_solved_lr_values = num_solved_hr_values / scale_area;
+  const double value_bytes = solver_options.use_single_precision ?
+      sizeof(float) : sizeof(double);
+  double bytes_per_solve =
+      sizeof(double) * kNumSolverImageBuffers * num_solved_hr_values;
+
+  // The data term references the observations unless it encodes or converts
+  // them, or only uses a part of them.
+  const double num_observation_values =
+      problem.num_observations * num_solved_lr_values;
+  if (solver_options.observation_encoding != OBSERVATION_ENCODING_NONE) {
+    bytes_per_solve += sizeof(uint16_t) * num_observation_values;
+  } else if (solver_options.use_single_precision || num_splits > 1 ||
+             num_tiles > 1) {
+    bytes_per_solve += value_bytes * num_observation_values;
+  }
+
+  // Every data term thread degrades its own copy of the estimate.
+  const int num_data_term_threads = std::min(
+      util::GetNumThreadsToUse(solver_options.num_threads),
+      problem.num_observations);
+  bytes_per_solve += value_bytes * num_data_term_threads *
+      (num_solved_hr_values + num_solved_lr_values);
+
+  // The compiled model has a row of (blur + 1)^2 nonzeros (including the
+  // bilinear motion) for every LR pixel of every frame, and the normal
+  // matrix a row of (2 blur + 1)^2 nonzeros for every HR pixel. Area
+  // downsampling widens the rows by the patch size. The model is shared by
+  // all channels.
+  double compiled_model_bytes_per_solve = 0.0;
+  if (solver_options.use_compiled_image_model ||
+      solver_options.use_normal_equations) {
+    const int patch_size =
+        model_parameters.use_area_downsampling ? model_parameters.scale : 1;
+    const double kernel_size =
+        std::max(model_parameters.blur_radius, 1) + patch_size;
+    compiled_model_bytes_per_solve += kBytesPerNonzero *
+        problem.num_observations * (num_solved_pixels / scale_area) *
+        kernel_size * kernel_size;
+    if (solver_options.use_normal_equations) {
+      const double normal_kernel_size = 2.0 * kernel_size - 1.0;
+      compiled_model_bytes_per_solve += kBytesPerNonzero *
+          num_solved_pixels * normal_kernel_size * normal_kernel_size;
+    }
+  }
+
+  // The concurrent channel splits may be limited by their own memory limit.
+  int num_concurrent_splits = std::min(
+      util::GetNumThreadsToUse(solver_options.num_split_solver_workers),
+      num_splits);
+  if (solver_options.split_solver_memory_limit_mb > 0.0) {
+    const int max_splits_in_memory = static_cast<int>(
+        solver_options.split_solver_memory_limit_mb * kBytesPerMegabyte /
+        (bytes_per_solve + compiled_model_bytes_per_solve));
+    num_concurrent_splits = std::max(
+        std::min(num_concurrent_splits, max_splits_in_memory), 1);
+  }
+  const int num_concurrent_tiles = std::min(
+      util::GetNumThreadsToUse(problem.num_tile_workers), num_tiles);
+  estimate.num_concurrent_solves = num_concurrent_splits * num_concurrent_tiles;
+  estimate.solver_bytes = bytes_per_solve * estimate.num_concurrent_solves;
+  estimate.compiled_model_bytes =
+      compiled_model_bytes_per_solve * estimate.num_concurrent_solves;
+  return estimate;
+}
+
+SolverMemoryPlan PlanSolverMemory(
+    const ImageModelParameters& model_parameters,
+    const MapSolverOptions& solver_options,
+    const SolverMemoryProblem& problem,
+    const double memory_budget_bytes,
+    const int min_tile_size) {
+
+  CHECK_GT(memory_budget_bytes, 0.0) << "The memory budget must be positive.";
+
+  // The tile sizes are tried outermost, so that smaller channel blocks and
+  // single precision are both preferred over smaller tiles. Smaller blocks
+  // are tried before single precision unless the regularizer couples the
+  // channels.
+  const int num_given_channels_per_split = solver_options.split_channels ?
+      std::min(std::max(solver_options.num_channels_per_split, 1),
+               problem.num_channels) :
+      problem.num_channels;
+  const std::vector<int> channel_block_sizes = GetHalvedSizes(
+      num_given_channels_per_split, num_given_channels_per_split, 1);
+  std::vector<int> tile_sizes = {problem.tile_size};
+  if (min_tile_size > 0) {
+    tile_sizes = GetHalvedSizes(
+        problem.tile_size,
+        (problem.tile_size > 0) ? problem.tile_size : std::max(
+            problem.high_res_size.width, problem.high_res_size.height),
+        min_tile_size);
+  }
+  std::vector<bool> single_precision_choices = {
+    solver_options.use_single_precision
+  };
+  if (!solver_options.use_single_precision) {
+    single_precision_choices.push_back(true);
+  }
+
+  const int num_inner_choices =
+      channel_block_sizes.size() * single_precision_choices.size();
+  SolverMemoryPlan plan;
+  for (const int tile_size : tile_sizes) {
+    for (int choice = 0; choice < num_inner_choices; ++choice) {
+      int block_index = choice % channel_block_sizes.size();
+      int precision_index = choice / channel_block_sizes.size();
+      if (problem.regularizer_couples_channels) {
+        precision_index = choice % single_precision_choices.size();
+        block_index = choice / single_precision_choices.size();
+      }
+      const int channel_block_size = channel_block_sizes[block_index];
+      MapSolverOptions candidate_options = solver_options;
+      candidate_options.split_channels = solver_options.split_channels ||
+          channel_block_size < problem.num_channels;
+      if (candidate_options.split_channels) {
+        candidate_options.num_channels_per_split = channel_block_size;
+        if (problem.regularizer_couples_channels) {
+          candidate_options.num_split_overlap_channels =
+              std::max(solver_options.num_split_overlap_channels, 1);
+        }
+      }
+      candidate_options.use_single_precision =
+          single_precision_choices[precision_index];
+      SolverMemoryProblem candidate_problem = problem;
+      candidate_problem.tile_size = tile_size;
+
+      plan.split_channels = candidate_options.split_channels;
+      plan.num_channels_per_split = candidate_options.num_channels_per_split;
+      plan.num_split_overlap_channels =
+          candidate_options.num_split_overlap_channels;
+      plan.tile_size = tile_size;
+      plan.use_single_precision = candidate_options.use_single_precision;
+      plan.estimate = EstimateSolverMemory(
+          model_parameters, candidate_options, candidate_problem);
+      plan.fits_budget = plan.estimate.GetTotalBytes() <= memory_budget_bytes;
+      if (plan.fits_budget) {
+        return plan;
+      }
+    }
+  }
+  // Nothing fits, so the last (smallest) layout is returned.
+  return plan;
+}
+
+}  // namespace super_resolution
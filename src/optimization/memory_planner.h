@@ -0,0 +1,122 @@
+// The memory planner predicts the peak memory of a MAP solve before it runs,
+// and picks the solve layout that fits a memory budget. Peak memory grows
+// with frames x channels x scale^2 x the number of image-sized temporaries,
+// and with every channel split and tile that is solved concurrently:
+//
+//   images:      every LR observation, the initial estimate and the result,
+//                which the program holds throughout.
+//   per solve:   the solver state and term buffers (about
+//                kNumSolverImageBuffers HR images of the solved channels),
+//                the data term's own copy of the observations if it
+//                converts or encodes them, the per-thread degraded images of
+//                the data term, and the compiled image model if requested.
+//
+// A solve is one channel split of one tile (or the whole image). The
+// estimate is deliberately simple and errs on the high side; it is meant to
+// avoid running out of memory, not to account for every byte.
+//
+// PlanSolverMemory() shrinks the layout until the estimate fits the budget,
+// in order of least impact on the result and speed: first smaller channel
+// blocks (exact for per-channel regularizers), then single precision data
+// terms, and finally smaller tiles. If a regularizer couples neighboring
+// channels (such as 3D TV), splitting changes the result, so single precision
+// is tried before smaller channel blocks, and the blocks overlap.
+
+#ifndef SRC_OPTIMIZATION_MEMORY_PLANNER_H_
+#define SRC_OPTIMIZATION_MEMORY_PLANNER_H_
+
+#include "image_model/image_model.h"
+#include "optimization/map_solver.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+// The approximate number of image-sized buffers used by a single solve, not
+// counting the observations. This includes the solver's parameters,
+// direction and gradient vectors, and the per-evaluation term buffers.
+constexpr int kNumSolverImageBuffers = 16;
+
+// The problem whose memory is estimated, beyond the solver and image model
+// options.
+struct SolverMemoryProblem {
+  // The size of the whole HR image.
+  cv::Size high_res_size;
+
+  int num_channels = 1;
+  int num_observations = 1;
+
+  // The tile size (see TiledSolverOptions), or 0 if the whole image is
+  // solved at once, and the number of tiles solved concurrently.
+  int tile_size = 0;
+  int num_tile_workers = 1;
+
+  // The range of the regularizer, which is part of the tile halo (see
+  // GetTileHaloSize()).
+  int regularizer_range = 1;
+
+  // True if a regularizer compares neighboring channels, such as 3D TV.
+  bool regularizer_couples_channels = false;
+};
+
+// The estimated peak memory of a solve, in bytes, by what it is used for.
+struct SolverMemoryEstimate {
+  // The LR observations, the initial estimate and the result, which are held
+  // by the program.
+  double image_bytes = 0.0;
+
+  // The solver state and the data term buffers of all concurrent solves.
+  double solver_bytes = 0.0;
+
+  // The compiled image models of all concurrent solves.
+  double compiled_model_bytes = 0.0;
+
+  // The number of channel splits and tiles that are solved at the same time.
+  int num_concurrent_solves = 1;
+
+  double GetTotalBytes() const {
+    return image_bytes + solver_bytes + compiled_model_bytes;
+  }
+};
+
+// Returns the estimated peak memory of solving the given problem with the
+// given image model and solver options (see above). The channel split
+// options, the precision, the observation encoding and the compiled model
+// options of the solver options are all taken into account.
+SolverMemoryEstimate EstimateSolverMemory(
+    const ImageModelParameters& model_parameters,
+    const MapSolverOptions& solver_options,
+    const SolverMemoryProblem& problem);
+
+// A solve layout chosen by PlanSolverMemory().
+struct SolverMemoryPlan {
+  bool split_channels = false;
+  int num_channels_per_split = 1;
+  int num_split_overlap_channels = 0;
+  int tile_size = 0;
+  bool use_single_precision = false;
+
+  SolverMemoryEstimate estimate;
+
+  // False if even the smallest layout does not fit the budget, in which case
+  // the plan is the smallest layout.
+  bool fits_budget = true;
+};
+
+// Returns the layout with the least impact on the result (see above) whose
+// estimated memory fits the budget (in bytes). The given layout is kept if
+// it already fits. Channel blocks and tiles are halved until they fit, down
+// to single channels and tiles of min_tile_size HR pixels. The tile size is
+// never changed if min_tile_size is not positive (e.g. if the solve cannot
+// be tiled). If the regularizer couples channels, the planned channel blocks
+// have at least one overlap channel on each side.
+SolverMemoryPlan PlanSolverMemory(
+    const ImageModelParameters& model_parameters,
+    const MapSolverOptions& solver_options,
+    const SolverMemoryProblem& problem,
+    const double memory_budget_bytes,
+    const int min_tile_size = 64);
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_MEMORY_PLANNER_H_
@@ -0,0 +1,183 @@
+#include "optimization/multigrid.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// The two coarse cells that a fine cell is interpolated from, and their
+// weights. The cell centers of the fine grid lie a quarter of a coarse cell
+// away from the nearest coarse cell center, which gets 3/4 of the weight.
+// Fine cells past the last coarse cell center use that cell twice.
+struct InterpolationStencil {
+  int index[2];
+  double weight[2];
+};
+
+// Returns the interpolation stencil of every fine index along one axis.
+std::vector<InterpolationStencil> GetInterpolationStencils(
+    const int fine_length, const int coarse_length) {
+
+  std::vector<InterpolationStencil> stencils(fine_length);
+  for (int i = 0; i < fine_length; ++i) {
+    const int nearest = i / 2;
+    const int other = (i % 2 == 0) ? nearest - 1 : nearest + 1;
+    InterpolationStencil& stencil = stencils[i];
+    stencil.index[0] = nearest;
+    stencil.index[1] = std::min(std::max(other, 0), coarse_length - 1);
+    stencil.weight[0] = 0.75;
+    stencil.weight[1] = 0.25;
+  }
+  return stencils;
+}
+
+// Returns the sum of the restriction weights that every coarse index along
+// one axis receives.
+std::vector<double> GetRestrictionWeightSums(
+    const int fine_length, const int coarse_length) {
+
+  std::vector<double> weight_sums(coarse_length, 0.0);
+  for (const InterpolationStencil& stencil :
+       GetInterpolationStencils(fine_length, coarse_length)) {
+    weight_sums[stencil.index[0]] += stencil.weight[0];
+    weight_sums[stencil.index[1]] += stencil.weight[1];
+  }
+  return weight_sums;
+}
+
+void CheckCoarseSize(const cv::Size& fine_size, const cv::Size& coarse_size) {
+  CHECK(coarse_size.width == (fine_size.width + 1) / 2 &&
+        coarse_size.height == (fine_size.height + 1) / 2)
+      << "The coarse grid must be half the size of the fine grid.";
+}
+
+}  // namespace
+
+std::vector<cv::Size> GetMultigridLevelSizes(
+    const cv::Size& image_size,
+    const int max_num_levels,
+    const int min_level_size) {
+
+  std::vector<cv::Size> level_sizes = {image_size};
+  while (static_cast<int>(level_sizes.size()) < max_num_levels) {
+    const cv::Size& fine_size = level_sizes.back();
+    const cv::Size coarse_size(
+        (fine_size.width + 1) / 2, (fine_size.height + 1) / 2);
+    if (coarse_size.width < min_level_size ||
+        coarse_size.height < min_level_size ||
+        coarse_size == fine_size) {
+      break;
+    }
+    level_sizes.push_back(coarse_size);
+  }
+  return level_sizes;
+}
+
+void ProlongateImage(
+    const double* coarse_data,
+    const cv::Size& coarse_size,
+    const cv::Size& fine_size,
+    const int num_channels,
+    double* fine_data) {
+
+  CheckCoarseSize(fine_size, coarse_size);
+  const std::vector<InterpolationStencil> row_stencils =
+      GetInterpolationStencils(fine_size.height, coarse_size.height);
+  const std::vector<InterpolationStencil> col_stencils =
+      GetInterpolationStencils(fine_size.width, coarse_size.width);
+  const int64_t num_coarse_pixels = coarse_size.area();
+  const int64_t num_fine_pixels = fine_size.area();
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const double* coarse_channel = coarse_data + channel * num_coarse_pixels;
+    double* fine_channel = fine_data + channel * num_fine_pixels;
+    for (int row = 0; row < fine_size.height; ++row) {
+      const InterpolationStencil& row_stencil = row_stencils[row];
+      const double* coarse_rows[2] = {
+        coarse_channel + row_stencil.index[0] * coarse_size.width,
+        coarse_channel + row_stencil.index[1] * coarse_size.width
+      };
+      double* fine_row = fine_channel + row * fine_size.width;
+      for (int col = 0; col < fine_size.width; ++col) {
+        const InterpolationStencil& col_stencil = col_stencils[col];
+        double value = 0.0;
+        for (int i = 0; i < 2; ++i) {
+          value += row_stencil.weight[i] * (
+              col_stencil.weight[0] * coarse_rows[i][col_stencil.index[0]] +
+              col_stencil.weight[1] * coarse_rows[i][col_stencil.index[1]]);
+        }
+        fine_row[col] = value;
+      }
+    }
+  }
+}
+
+void RestrictImage(
+    const double* fine_data,
+    const cv::Size& fine_size,
+    const cv::Size& coarse_size,
+    const int num_channels,
+    double* coarse_data) {
+
+  CheckCoarseSize(fine_size, coarse_size);
+  const std::vector<InterpolationStencil> row_stencils =
+      GetInterpolationStencils(fine_size.height, coarse_size.height);
+  const std::vector<InterpolationStencil> col_stencils =
+      GetInterpolationStencils(fine_size.width, coarse_size.width);
+  const int64_t num_coarse_pixels = coarse_size.area();
+  const int64_t num_fine_pixels = fine_size.area();
+  std::fill(coarse_data, coarse_data + num_channels * num_coarse_pixels, 0.0);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    double* coarse_channel = coarse_data + channel * num_coarse_pixels;
+    const double* fine_channel = fine_data + channel * num_fine_pixels;
+    for (int row = 0; row < fine_size.height; ++row) {
+      const InterpolationStencil& row_stencil = row_stencils[row];
+      double* coarse_rows[2] = {
+        coarse_channel + row_stencil.index[0] * coarse_size.width,
+        coarse_channel + row_stencil.index[1] * coarse_size.width
+      };
+      const double* fine_row = fine_channel + row * fine_size.width;
+      for (int col = 0; col < fine_size.width; ++col) {
+        const InterpolationStencil& col_stencil = col_stencils[col];
+        for (int i = 0; i < 2; ++i) {
+          const double value = row_stencil.weight[i] * fine_row[col];
+          coarse_rows[i][col_stencil.index[0]] +=
+              col_stencil.weight[0] * value;
+          coarse_rows[i][col_stencil.index[1]] +=
+              col_stencil.weight[1] * value;
+        }
+      }
+    }
+  }
+}
+
+void AverageImage(
+    const double* fine_data,
+    const cv::Size& fine_size,
+    const cv::Size& coarse_size,
+    const int num_channels,
+    double* coarse_data) {
+
+  RestrictImage(fine_data, fine_size, coarse_size, num_channels, coarse_data);
+  const std::vector<double> row_weight_sums =
+      GetRestrictionWeightSums(fine_size.height, coarse_size.height);
+  const std::vector<double> col_weight_sums =
+      GetRestrictionWeightSums(fine_size.width, coarse_size.width);
+  const int64_t num_coarse_pixels = coarse_size.area();
+  for (int channel = 0; channel < num_channels; ++channel) {
+    double* coarse_channel = coarse_data + channel * num_coarse_pixels;
+    for (int row = 0; row < coarse_size.height; ++row) {
+      double* coarse_row = coarse_channel + row * coarse_size.width;
+      for (int col = 0; col < coarse_size.width; ++col) {
+        coarse_row[col] /= row_weight_sums[row] * col_weight_sums[col];
+      }
+    }
+  }
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,60 @@
+// Grid transfer operators for the geometric multigrid solver (see
+// MULTIGRID_SOLVER in map_solver.h). The solver parameters are images stored
+// one channel after the other, and every coarser grid halves the image size
+// of the finer one (rounding up). Prolongation interpolates every channel of
+// a coarse image bilinearly onto the fine grid, treating pixels as cells, and
+// restriction is its exact transpose, so the coarse grid operators
+// R * A * P built from a symmetric fine grid operator A stay symmetric.
+
+#ifndef SRC_OPTIMIZATION_MULTIGRID_H_
+#define SRC_OPTIMIZATION_MULTIGRID_H_
+
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+// Returns the image sizes of the multigrid levels, starting with the given
+// full resolution size. Every level halves the size of the previous one
+// (rounding up) until there are max_num_levels levels or another level would
+// have a side shorter than min_level_size. There is always at least the full
+// resolution level.
+std::vector<cv::Size> GetMultigridLevelSizes(
+    const cv::Size& image_size,
+    const int max_num_levels,
+    const int min_level_size);
+
+// Interpolates the coarse image (of the given number of channels) onto the
+// fine grid, overwriting fine_data. The coarse size must be the fine size
+// halved and rounded up.
+void ProlongateImage(
+    const double* coarse_data,
+    const cv::Size& coarse_size,
+    const cv::Size& fine_size,
+    const int num_channels,
+    double* fine_data);
+
+// Applies the transpose of ProlongateImage() to the fine image, overwriting
+// coarse_data.
+void RestrictImage(
+    const double* fine_data,
+    const cv::Size& fine_size,
+    const cv::Size& coarse_size,
+    const int num_channels,
+    double* coarse_data);
+
+// Same as RestrictImage(), but divides every coarse value by the sum of the
+// restriction weights that it received, so that it is a weighted average of
+// the fine values (and a constant image stays constant). This transfers
+// values such as the estimate or the IRLS weights rather than residuals.
+void AverageImage(
+    const double* fine_data,
+    const cv::Size& fine_size,
+    const cv::Size& coarse_size,
+    const int num_channels,
+    double* coarse_data);
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_MULTIGRID_H_
@@ -0,0 +1,981 @@
+#include "optimization/native_solver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "optimization/map_solver.h"
+#include "optimization/multigrid.h"
+#include "optimization/objective_function.h"
+#include "util/memory_accounting.h"
+#include "util/numa.h"
+#include "util/thread_pool.h"
+#include "util/vector_kernels.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// The sufficient decrease (Armijo) parameter of the Wolfe conditions.
+constexpr double kSufficientDecreaseParameter = 1.0e-4;
+
+// The curvature parameters of the strong Wolfe conditions. CG needs a more
+// exact line search than LBFGS to produce good search directions (see Nocedal
+// and Wright, Numerical Optimization, Chapter 5.2).
+constexpr double kCGCurvatureParameter = 0.1;
+constexpr double kLBFGSCurvatureParameter = 0.9;
+
+// Like the LBFGS direction, the multigrid correction approximates the Newton
+// step, so its unit step is tried first and an inexact line search suffices.
+constexpr double kMultigridCurvatureParameter = 0.9;
+
+// The coarsest multigrid level has at least this many pixels on each side.
+constexpr int kMinMultigridLevelSize = 4;
+
+// The maximum number of objective evaluations in each line search stage.
+constexpr int kMaxNumLineSearchSteps = 20;
+
+// The factor by which the step is increased while the line search has not
+// yet bracketed an acceptable step.
+constexpr double kStepExtrapolationFactor = 2.0;
+
+// Vector operations are only split across threads if every block has at
+// least this many parameters. Smaller blocks are not worth the overhead.
+constexpr int kMinNumParametersPerBlock = 16384;
+
+// ALGLIB stops on a small parameter variation if all stopping criteria are
+// disabled. The same is done here to avoid running forever.
+constexpr double kDefaultParameterVariationThreshold = 1.0e-6;
+
+// Returns the first index of the given block when splitting size indices into
+// num_blocks contiguous blocks. The block ends at the start of the next block.
+int64_t GetBlockStart(
+    const int block_index, const int num_blocks, const int64_t size) {
+
+  return block_index * size / num_blocks;
+}
+
+// Returns the step that minimizes the cubic interpolating the cost and
+// derivative at the two given points. If the cubic has no minimizer, or it is
+// too close to either end of the interval, the interval is bisected instead.
+template <typename PointType>
+double InterpolateStep(const PointType& a, const PointType& b) {
+  const double bisection_step = (a.step + b.step) / 2.0;
+  const double step_difference = b.step - a.step;
+  if (step_difference == 0.0) {
+    return a.step;
+  }
+  const double d1 = a.derivative + b.derivative +
+      3.0 * (a.cost - b.cost) / step_difference;
+  const double discriminant = d1 * d1 - a.derivative * b.derivative;
+  if (discriminant < 0.0) {
+    return bisection_step;
+  }
+  const double d2 = std::copysign(std::sqrt(discriminant), step_difference);
+  const double denominator = b.derivative - a.derivative + 2.0 * d2;
+  if (denominator == 0.0) {
+    return bisection_step;
+  }
+  const double step =
+      b.step - step_difference * (b.derivative + d2 - d1) / denominator;
+
+  // Keep the step away from the ends of the interval.
+  const double margin = 0.1 * std::abs(step_difference);
+  const double lower = std::min(a.step, b.step) + margin;
+  const double upper = std::max(a.step, b.step) - margin;
+  if (!std::isfinite(step) || step < lower || step > upper) {
+    return bisection_step;
+  }
+  return step;
+}
+
+}  // namespace
+
+bool IsNativeLeastSquaresSolver(const LeastSquaresSolver least_squares_solver) {
+  return least_squares_solver == NATIVE_CG_SOLVER ||
+         least_squares_solver == NATIVE_LBFGS_SOLVER ||
+         least_squares_solver == MULTIGRID_SOLVER;
+}
+
+std::vector<cv::Size> NativeSolver::GetMultigridLevelImageSizes(
+    const MapSolverOptions& solver_options, const cv::Size& image_size) {
+
+  return GetMultigridLevelSizes(
+      image_size,
+      std::max(1, solver_options.max_num_multigrid_levels),
+      kMinMultigridLevelSize);
+}
+
+NativeSolver::NativeSolver(
+    const MapSolverOptions& solver_options,
+    const ObjectiveFunction& objective_function,
+    const int64_t num_parameters,
+    const cv::Size& image_size)
+    : solver_options_(solver_options),
+      objective_function_(objective_function),
+      num_parameters_(num_parameters),
+      last_evaluated_step_(0.0),
+      num_lbfgs_corrections_(0),
+      newest_lbfgs_correction_(0),
+      num_multigrid_channels_(0),
+      estimate_memory_(util::MEMORY_TAG_ESTIMATE),
+      solver_memory_(util::MEMORY_TAG_GRADIENTS),
+      num_solves_(0),
+      max_num_iterations_(solver_options.max_num_solver_iterations) {
+
+  CHECK(IsNativeLeastSquaresSolver(solver_options_.least_squares_solver))
+      << "The native solver only supports NATIVE_CG_SOLVER, "
+      << "NATIVE_LBFGS_SOLVER or MULTIGRID_SOLVER.";
+  CHECK(!solver_options_.use_numerical_differentiation)
+      << "The native solver only supports analytical differentiation.";
+  CHECK_GT(num_parameters_, 0) << "Cannot solve for 0 parameters.";
+
+  num_blocks_ = static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(
+      util::GetNumThreadsToUse(solver_options_.num_threads),
+      num_parameters_ / kMinNumParametersPerBlock)));
+  if (num_blocks_ > 1) {
+    // The calling thread also runs blocks, so one fewer worker is needed.
+    thread_pool_.reset(new util::ThreadPool(num_blocks_ - 1));
+  }
+
+  estimate_.resize(num_parameters_);
+  gradient_.resize(num_parameters_);
+  direction_.resize(num_parameters_);
+  trial_estimate_.resize(num_parameters_);
+  trial_gradient_.resize(num_parameters_);
+
+  if (solver_options_.least_squares_solver == NATIVE_LBFGS_SOLVER) {
+    const int num_corrections =
+        std::max(1, solver_options_.num_lbfgs_hessian_corrections);
+    lbfgs_steps_.assign(
+        num_corrections, std::vector<double>(num_parameters_));
+    lbfgs_gradient_changes_.assign(
+        num_corrections, std::vector<double>(num_parameters_));
+    lbfgs_inverse_curvatures_.resize(num_corrections);
+    lbfgs_alphas_.resize(num_corrections);
+  }
+
+  if (solver_options_.least_squares_solver == MULTIGRID_SOLVER) {
+    const int64_t num_pixels = image_size.area();
+    CHECK(num_pixels > 0 && num_parameters_ % num_pixels == 0)
+        << "The multigrid solver needs the image size of the parameters.";
+    num_multigrid_channels_ = num_parameters_ / num_pixels;
+    const std::vector<cv::Size> level_sizes =
+        GetMultigridLevelImageSizes(solver_options_, image_size);
+    multigrid_levels_.resize(level_sizes.size());
+    for (int level = 0; level < multigrid_levels_.size(); ++level) {
+      MultigridLevel& grid = multigrid_levels_[level];
+      grid.image_size = level_sizes[level];
+      grid.num_parameters =
+          static_cast<int64_t>(grid.image_size.area()) *
+          num_multigrid_channels_;
+      grid.right_hand_side.resize(grid.num_parameters);
+      grid.residual.resize(grid.num_parameters);
+      grid.search_direction.resize(grid.num_parameters);
+      grid.operator_product.resize(grid.num_parameters);
+      if (level > 0) {
+        grid.correction.resize(grid.num_parameters);
+      }
+      if (level + 1 < multigrid_levels_.size()) {
+        grid.transfer.resize(grid.num_parameters);
+      }
+    }
+    MultigridLevel& fine_grid = multigrid_levels_[0];
+    for (std::vector<double>* buffer :
+         {&fine_grid.right_hand_side, &fine_grid.residual,
+          &fine_grid.search_direction, &fine_grid.operator_product,
+          &fine_grid.transfer}) {
+      if (!buffer->empty()) {
+        util::DistributeOverNumaNodes(
+            buffer->data(), num_parameters_, num_blocks_);
+      }
+    }
+  }
+
+  // Each block of every buffer lives on the NUMA node of the threads that
+  // run the block in RunOverBlocks() and DotProduct().
+  for (const std::vector<double>* buffer :
+       {&estimate_, &gradient_, &direction_, &trial_estimate_,
+        &trial_gradient_}) {
+    util::DistributeOverNumaNodes(buffer->data(), num_parameters_, num_blocks_);
+  }
+  for (int i = 0; i < lbfgs_steps_.size(); ++i) {
+    util::DistributeOverNumaNodes(
+        lbfgs_steps_[i].data(), num_parameters_, num_blocks_);
+    util::DistributeOverNumaNodes(
+        lbfgs_gradient_changes_[i].data(), num_parameters_, num_blocks_);
+  }
+  UpdateMemoryAccounts();
+}
+
+double NativeSolver::Solve(double* solver_data) {
+  CHECK_NOTNULL(solver_data);
+  num_solves_++;
+  num_lbfgs_corrections_ = 0;
+  newest_lbfgs_correction_ = 0;
+
+  const bool use_lbfgs =
+      solver_options_.least_squares_solver == NATIVE_LBFGS_SOLVER;
+  const bool use_multigrid =
+      solver_options_.least_squares_solver == MULTIGRID_SOLVER;
+  double curvature_parameter =
+      use_lbfgs ? kLBFGSCurvatureParameter : kCGCurvatureParameter;
+  if (use_multigrid) {
+    curvature_parameter = kMultigridCurvatureParameter;
+  }
+  double parameter_variation_threshold =
+      solver_options_.parameter_variation_threshold;
+  if (solver_options_.gradient_norm_threshold <= 0.0 &&
+      solver_options_.cost_decrease_threshold <= 0.0 &&
+      parameter_variation_threshold <= 0.0 &&
+      max_num_iterations_ <= 0) {
+    parameter_variation_threshold = kDefaultParameterVariationThreshold;
+  }
+
+  RunOverBlocks([&](const int64_t start, const int64_t end) {
+    std::copy(
+        solver_data + start, solver_data + end, estimate_.begin() + start);
+  });
+  double cost = objective_function_.ComputeAllTerms(
+      estimate_.data(), gradient_.data());
+  is_solution_last_evaluated_ = true;
+  double gradient_squared_norm = DotProduct(gradient_.data(), gradient_.data());
+
+  // Without a preconditioner, the first step is scaled so that it has unit
+  // length, since nothing is known about the curvature yet. The
+  // preconditioned direction is already scaled by the inverse curvature.
+  const bool use_preconditioner = !inverse_preconditioner_.empty();
+  const auto get_steepest_descent_step = [&]() {
+    if (use_preconditioner || gradient_squared_norm <= 0.0) {
+      return 1.0;
+    }
+    return 1.0 / std::sqrt(gradient_squared_norm);
+  };
+  // Sets the direction to the (preconditioned) steepest descent direction and
+  // returns g'M^-1 g.
+  const auto set_steepest_descent_direction = [&]() {
+    const double* preconditioned_gradient = GetPreconditionedGradient(true);
+    RunOverBlocks([&](const int64_t start, const int64_t end) {
+      for (int64_t i = start; i < end; ++i) {
+        direction_[i] = -preconditioned_gradient[i];
+      }
+    });
+    return DotProduct(gradient_.data(), preconditioned_gradient);
+  };
+  double initial_step = get_steepest_descent_step();
+  double previous_derivative = 0.0;
+  double gradient_preconditioned_product = set_steepest_descent_direction();
+
+  ObjectiveFunction& reporting_objective_function =
+      const_cast<ObjectiveFunction&>(objective_function_);
+  int num_iterations_ran = 0;
+  while (max_num_iterations_ <= 0 ||
+         num_iterations_ran < max_num_iterations_) {
+    if (std::sqrt(gradient_squared_norm) <=
+        solver_options_.gradient_norm_threshold) {
+      break;
+    }
+
+    if (use_multigrid) {
+      ComputeMultigridDirection();
+    }
+    LineSearchPoint start_point = {0.0, cost, 0.0};
+    start_point.derivative = DotProduct(gradient_.data(), direction_.data());
+    if (!(start_point.derivative < 0.0)) {
+      // Not a descent direction (possible after CG updates with an inexact
+      // line search, or a multigrid correction of a non-convex objective),
+      // so restart from steepest descent.
+      start_point.derivative = -set_steepest_descent_direction();
+      num_lbfgs_corrections_ = 0;
+      initial_step = get_steepest_descent_step();
+    } else if (use_multigrid) {
+      initial_step = 1.0;
+    } else if (num_iterations_ran > 0) {
+      if (use_lbfgs) {
+        initial_step = 1.0;
+      } else {
+        // Assume the first-order change is the same as in the last iteration.
+        initial_step *= previous_derivative / start_point.derivative;
+      }
+    }
+
+    LineSearchPoint accepted_point;
+    if (!LineSearch(
+        start_point, initial_step, curvature_parameter, &accepted_point)) {
+      LOG(INFO) << "Line search failed to decrease the cost. Stopping.";
+      break;
+    }
+    const double previous_cost = cost;
+    cost = accepted_point.cost;
+    const double step_norm = accepted_point.step *
+        std::sqrt(DotProduct(direction_.data(), direction_.data()));
+    previous_derivative = start_point.derivative;
+    initial_step = accepted_point.step;
+
+    // Compute the next search direction from the old and new gradients
+    // before the new point is accepted.
+    const double new_gradient_squared_norm =
+        DotProduct(trial_gradient_.data(), trial_gradient_.data());
+    if (use_lbfgs) {
+      const int num_corrections = lbfgs_steps_.size();
+      const int index = (num_lbfgs_corrections_ == 0) ? 0 :
+          (newest_lbfgs_correction_ + 1) % num_corrections;
+      std::vector<double>& step = lbfgs_steps_[index];
+      std::vector<double>& gradient_change = lbfgs_gradient_changes_[index];
+      RunOverBlocks([&](const int64_t start, const int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+          step[i] = trial_estimate_[i] - estimate_[i];
+          gradient_change[i] = trial_gradient_[i] - gradient_[i];
+        }
+      });
+      const double curvature =
+          DotProduct(step.data(), gradient_change.data());
+      // Only keep pairs with positive curvature, which keeps the Hessian
+      // approximation positive definite.
+      if (curvature > 0.0) {
+        lbfgs_inverse_curvatures_[index] = 1.0 / curvature;
+        newest_lbfgs_correction_ = index;
+        num_lbfgs_corrections_ =
+            std::min(num_lbfgs_corrections_ + 1, num_corrections);
+      } else if (num_lbfgs_corrections_ == num_corrections) {
+        // The rejected pair overwrote the oldest one, which is dropped.
+        num_lbfgs_corrections_--;
+      }
+    } else if (!use_multigrid) {
+      // The (preconditioned) Polak-Ribiere+ update
+      //   beta = g_new'M^-1 (g_new - g_old) / g_old'M^-1 g_old.
+      // The current preconditioned gradient is kept from the previous
+      // iteration.
+      const double* preconditioned_gradient = use_preconditioner ?
+          preconditioned_gradient_.data() : gradient_.data();
+      const double* new_preconditioned_gradient =
+          GetPreconditionedGradient(false);
+      const double new_gradient_preconditioned_product = use_preconditioner ?
+          DotProduct(trial_gradient_.data(), new_preconditioned_gradient) :
+          new_gradient_squared_norm;
+      const double gradient_dot_product =
+          DotProduct(trial_gradient_.data(), preconditioned_gradient);
+      const double beta = std::max(0.0,
+          (new_gradient_preconditioned_product - gradient_dot_product) /
+          gradient_preconditioned_product);
+      RunOverBlocks([&](const int64_t start, const int64_t end) {
+        util::LinearCombination(
+            end - start,
+            beta,
+            direction_.data() + start,
+            -1.0,
+            new_preconditioned_gradient + start,
+            direction_.data() + start);
+      });
+      gradient_preconditioned_product = new_gradient_preconditioned_product;
+    }
+    estimate_.swap(trial_estimate_);
+    gradient_.swap(trial_gradient_);
+    preconditioned_gradient_.swap(trial_preconditioned_gradient_);
+    // The accepted point is always the last one that was evaluated.
+    is_solution_last_evaluated_ = true;
+    gradient_squared_norm = new_gradient_squared_norm;
+    if (use_lbfgs) {
+      ComputeLBFGSDirection();
+    }
+
+    num_iterations_ran++;
+    reporting_objective_function.ReportIterationComplete(
+        cost, std::sqrt(gradient_squared_norm), estimate_.data());
+    LOG(INFO) << "Iteration complete ("
+              << objective_function_.GetNumCompletedIterations()
+              << "). Sum of squared residuals = " << cost;
+
+    const double cost_scale = std::max(
+        std::max(std::abs(previous_cost), std::abs(cost)), 1.0);
+    if (std::abs(previous_cost - cost) <=
+        solver_options_.cost_decrease_threshold * cost_scale) {
+      break;
+    }
+    if (step_norm <= parameter_variation_threshold) {
+      break;
+    }
+  }
+
+  RunOverBlocks([&](const int64_t start, const int64_t end) {
+    std::copy(estimate_.begin() + start, estimate_.begin() + end,
+              solver_data + start);
+  });
+  return cost;
+}
+
+void NativeSolver::SetDiagonalPreconditioner(
+    const std::vector<double>& hessian_diagonal) {
+
+  CHECK_EQ(hessian_diagonal.size(), num_parameters_)
+      << "The preconditioner does not match the number of parameters.";
+  inverse_preconditioner_.resize(num_parameters_);
+  RunOverBlocks([&](const int64_t start, const int64_t end) {
+    for (int64_t i = start; i < end; ++i) {
+      CHECK_GT(hessian_diagonal[i], 0.0)
+          << "The preconditioner must be positive.";
+      inverse_preconditioner_[i] = 1.0 / hessian_diagonal[i];
+    }
+  });
+  preconditioned_gradient_.resize(num_parameters_);
+  trial_preconditioned_gradient_.resize(num_parameters_);
+  std::vector<const std::vector<double>*> buffers = {
+    &inverse_preconditioner_, &preconditioned_gradient_,
+    &trial_preconditioned_gradient_
+  };
+  if (!multigrid_levels_.empty()) {
+    multigrid_levels_[0].preconditioned_residual.resize(num_parameters_);
+    buffers.push_back(&multigrid_levels_[0].preconditioned_residual);
+  }
+  for (const std::vector<double>* buffer : buffers) {
+    util::DistributeOverNumaNodes(buffer->data(), num_parameters_, num_blocks_);
+  }
+  UpdateMemoryAccounts();
+}
+
+void NativeSolver::SetLevelObjectiveFunction(
+    const int level, const ObjectiveFunction* objective_function) {
+
+  CHECK(level > 0 && level < multigrid_levels_.size())
+      << "Only the coarse multigrid levels can be rediscretized.";
+  MultigridLevel& grid = multigrid_levels_[level];
+  CHECK(objective_function == nullptr ||
+        objective_function->GetNumParameters() == grid.num_parameters)
+      << "The objective does not match the image size of the level.";
+  grid.objective_function = objective_function;
+
+  // The coarse estimates are averaged level by level, so every level above
+  // the coarsest one with an objective needs its estimate.
+  bool needs_estimate = false;
+  for (int coarse_level = multigrid_levels_.size() - 1; coarse_level > 0;
+       --coarse_level) {
+    MultigridLevel& coarse_grid = multigrid_levels_[coarse_level];
+    const bool has_objective = coarse_grid.objective_function != nullptr;
+    needs_estimate = needs_estimate || has_objective;
+    const auto resize_buffer = [&](
+        const bool is_needed, std::vector<double>* buffer) {
+      if (is_needed) {
+        buffer->resize(coarse_grid.num_parameters);
+      } else {
+        std::vector<double>().swap(*buffer);
+      }
+    };
+    resize_buffer(needs_estimate, &coarse_grid.estimate);
+    resize_buffer(has_objective, &coarse_grid.gradient);
+    resize_buffer(has_objective, &coarse_grid.trial_estimate);
+    resize_buffer(has_objective, &coarse_grid.trial_gradient);
+  }
+  UpdateMemoryAccounts();
+}
+
+void NativeSolver::UpdateMemoryAccounts() {
+  estimate_memory_.SetBytes(util::GetBufferBytes(estimate_) +
+                            util::GetBufferBytes(trial_estimate_));
+  int64_t num_solver_bytes = 0;
+  for (const std::vector<double>* buffer :
+       {&gradient_, &direction_, &trial_gradient_, &inverse_preconditioner_,
+        &preconditioned_gradient_, &trial_preconditioned_gradient_,
+        &lbfgs_inverse_curvatures_, &lbfgs_alphas_}) {
+    num_solver_bytes += util::GetBufferBytes(*buffer);
+  }
+  for (int i = 0; i < lbfgs_steps_.size(); ++i) {
+    num_solver_bytes += util::GetBufferBytes(lbfgs_steps_[i]) +
+        util::GetBufferBytes(lbfgs_gradient_changes_[i]);
+  }
+  for (const MultigridLevel& grid : multigrid_levels_) {
+    for (const std::vector<double>* buffer :
+         {&grid.right_hand_side, &grid.correction, &grid.residual,
+          &grid.preconditioned_residual, &grid.search_direction,
+          &grid.operator_product, &grid.transfer, &grid.estimate,
+          &grid.gradient, &grid.trial_estimate, &grid.trial_gradient}) {
+      num_solver_bytes += util::GetBufferBytes(*buffer);
+    }
+  }
+  solver_memory_.SetBytes(num_solver_bytes);
+}
+
+const double* NativeSolver::GetPreconditionedGradient(const bool current) {
+  const std::vector<double>& gradient = current ? gradient_ : trial_gradient_;
+  if (inverse_preconditioner_.empty()) {
+    return gradient.data();
+  }
+  std::vector<double>& preconditioned_gradient = current ?
+      preconditioned_gradient_ : trial_preconditioned_gradient_;
+  RunOverBlocks([&](const int64_t start, const int64_t end) {
+    for (int64_t i = start; i < end; ++i) {
+      preconditioned_gradient[i] = inverse_preconditioner_[i] * gradient[i];
+    }
+  });
+  return preconditioned_gradient.data();
+}
+
+void NativeSolver::RunOverBlocks(
+    const std::function<void(const int64_t, const int64_t)>& function) const {
+
+  if (thread_pool_ == nullptr) {
+    function(0, num_parameters_);
+    return;
+  }
+  thread_pool_->ParallelForOnNumaNodes(num_blocks_, [&](const int block_index) {
+    function(
+        GetBlockStart(block_index, num_blocks_, num_parameters_),
+        GetBlockStart(block_index + 1, num_blocks_, num_parameters_));
+  });
+}
+
+double NativeSolver::DotProduct(const double* a, const double* b) const {
+  // Each block writes its own partial sum, and the partial sums are added in
+  // block order so that the result does not depend on thread scheduling.
+  std::vector<double> block_sums(num_blocks_, 0.0);
+  if (thread_pool_ == nullptr) {
+    block_sums[0] = util::DotProduct(num_parameters_, a, b);
+  } else {
+    thread_pool_->ParallelForOnNumaNodes(
+        num_blocks_, [&](const int block_index) {
+          const int64_t start =
+              GetBlockStart(block_index, num_blocks_, num_parameters_);
+          const int64_t end =
+              GetBlockStart(block_index + 1, num_blocks_, num_parameters_);
+          block_sums[block_index] =
+              util::DotProduct(end - start, a + start, b + start);
+        });
+  }
+  double dot_product = 0.0;
+  for (const double block_sum : block_sums) {
+    dot_product += block_sum;
+  }
+  return dot_product;
+}
+
+NativeSolver::LineSearchPoint NativeSolver::Evaluate(const double step) {
+  RunOverBlocks([&](const int64_t start, const int64_t end) {
+    util::LinearCombination(
+        end - start,
+        1.0,
+        estimate_.data() + start,
+        step,
+        direction_.data() + start,
+        trial_estimate_.data() + start);
+  });
+  last_evaluated_step_ = step;
+  is_solution_last_evaluated_ = false;
+  LineSearchPoint point;
+  point.step = step;
+  point.cost = objective_function_.ComputeAllTerms(
+      trial_estimate_.data(), trial_gradient_.data());
+  point.derivative = DotProduct(trial_gradient_.data(), direction_.data());
+  return point;
+}
+
+bool NativeSolver::LineSearch(
+    const LineSearchPoint& start_point,
+    const double initial_step,
+    const double curvature_parameter,
+    LineSearchPoint* accepted_point) {
+
+  // This follows Algorithm 3.5 of Nocedal and Wright, Numerical Optimization.
+  LineSearchPoint previous_point = start_point;
+  double step = initial_step;
+  for (int i = 0; i < kMaxNumLineSearchSteps; ++i) {
+    const LineSearchPoint point = Evaluate(step);
+    if (!std::isfinite(point.cost) ||
+        point.cost > start_point.cost +
+            kSufficientDecreaseParameter * step * start_point.derivative ||
+        (i > 0 && point.cost >= previous_point.cost)) {
+      return Zoom(
+          start_point, previous_point, point, curvature_parameter,
+          accepted_point);
+    }
+    if (std::abs(point.derivative) <=
+        -curvature_parameter * start_point.derivative) {
+      *accepted_point = point;
+      return true;
+    }
+    if (point.derivative >= 0.0) {
+      return Zoom(
+          start_point, point, previous_point, curvature_parameter,
+          accepted_point);
+    }
+    previous_point = point;
+    step *= kStepExtrapolationFactor;
+  }
+
+  // The last point decreased the cost sufficiently but the minimum along the
+  // direction is still further away. Accept it and continue from there.
+  *accepted_point = previous_point;
+  return true;
+}
+
+bool NativeSolver::Zoom(
+    const LineSearchPoint& start_point,
+    LineSearchPoint low_point,
+    LineSearchPoint high_point,
+    const double curvature_parameter,
+    LineSearchPoint* accepted_point) {
+
+  // This follows Algorithm 3.6 of Nocedal and Wright, Numerical Optimization.
+  for (int i = 0; i < kMaxNumLineSearchSteps; ++i) {
+    // A non-finite cost cannot be interpolated, so bisect instead.
+    const double step = std::isfinite(high_point.cost) ?
+        InterpolateStep(low_point, high_point) :
+        (low_point.step + high_point.step) / 2.0;
+    const LineSearchPoint point = Evaluate(step);
+    if (!std::isfinite(point.cost) ||
+        point.cost > start_point.cost +
+            kSufficientDecreaseParameter * step * start_point.derivative ||
+        point.cost >= low_point.cost) {
+      high_point = point;
+    } else {
+      if (std::abs(point.derivative) <=
+          -curvature_parameter * start_point.derivative) {
+        *accepted_point = point;
+        return true;
+      }
+      if (point.derivative * (high_point.step - low_point.step) >= 0.0) {
+        high_point = low_point;
+      }
+      low_point = point;
+    }
+    if (std::abs(high_point.step - low_point.step) <=
+        std::numeric_limits<double>::epsilon() * low_point.step) {
+      break;  // The interval is too small to make any more progress.
+    }
+  }
+
+  // The curvature condition could not be satisfied. Fall back to the best
+  // point, which still decreases the cost sufficiently, if there is one.
+  if (low_point.step == 0.0) {
+    return false;
+  }
+  if (last_evaluated_step_ != low_point.step) {
+    low_point = Evaluate(low_point.step);
+  }
+  *accepted_point = low_point;
+  return true;
+}
+
+void NativeSolver::ComputeLBFGSDirection() {
+  // Two-loop recursion (Nocedal and Wright, Algorithm 7.4), starting from the
+  // negative gradient. The initial inverse Hessian approximation is the
+  // identity (or the inverse preconditioner) scaled by s^T y / y^T H y of the
+  // newest correction pair.
+  const bool use_preconditioner = !inverse_preconditioner_.empty();
+  RunOverBlocks([&](const int64_t start, const int64_t end) {
+    for (int64_t i = start; i < end; ++i) {
+      direction_[i] = -gradient_[i];
+    }
+  });
+  if (num_lbfgs_corrections_ == 0) {
+    if (use_preconditioner) {
+      RunOverBlocks([&](const int64_t start, const int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+          direction_[i] *= inverse_preconditioner_[i];
+        }
+      });
+    }
+    return;
+  }
+  const int num_corrections = lbfgs_steps_.size();
+  for (int k = 0; k < num_lbfgs_corrections_; ++k) {
+    const int index =
+        (newest_lbfgs_correction_ - k + num_corrections) % num_corrections;
+    const double alpha = lbfgs_inverse_curvatures_[index] *
+        DotProduct(lbfgs_steps_[index].data(), direction_.data());
+    lbfgs_alphas_[index] = alpha;
+    const std::vector<double>& gradient_change =
+        lbfgs_gradient_changes_[index];
+    RunOverBlocks([&](const int64_t start, const int64_t end) {
+      for (int64_t i = start; i < end; ++i) {
+        direction_[i] -= alpha * gradient_change[i];
+      }
+    });
+  }
+
+  const std::vector<double>& newest_gradient_change =
+      lbfgs_gradient_changes_[newest_lbfgs_correction_];
+  double gradient_change_squared_norm = 0.0;
+  if (use_preconditioner) {
+    std::vector<double>& preconditioned_gradient_change =
+        trial_preconditioned_gradient_;
+    RunOverBlocks([&](const int64_t start, const int64_t end) {
+      for (int64_t i = start; i < end; ++i) {
+        preconditioned_gradient_change[i] =
+            inverse_preconditioner_[i] * newest_gradient_change[i];
+      }
+    });
+    gradient_change_squared_norm = DotProduct(
+        newest_gradient_change.data(), preconditioned_gradient_change.data());
+  } else {
+    gradient_change_squared_norm = DotProduct(
+        newest_gradient_change.data(), newest_gradient_change.data());
+  }
+  const double hessian_scale = 1.0 / (
+      lbfgs_inverse_curvatures_[newest_lbfgs_correction_] *
+      gradient_change_squared_norm);
+  RunOverBlocks([&](const int64_t start, const int64_t end) {
+    for (int64_t i = start; i < end; ++i) {
+      direction_[i] *= use_preconditioner ?
+          hessian_scale * inverse_preconditioner_[i] : hessian_scale;
+    }
+  });
+
+  for (int k = num_lbfgs_corrections_ - 1; k >= 0; --k) {
+    const int index =
+        (newest_lbfgs_correction_ - k + num_corrections) % num_corrections;
+    const double beta = lbfgs_inverse_curvatures_[index] *
+        DotProduct(lbfgs_gradient_changes_[index].data(), direction_.data());
+    const double coefficient = lbfgs_alphas_[index] - beta;
+    const std::vector<double>& step = lbfgs_steps_[index];
+    RunOverBlocks([&](const int64_t start, const int64_t end) {
+      for (int64_t i = start; i < end; ++i) {
+        direction_[i] += coefficient * step[i];
+      }
+    });
+  }
+}
+
+void NativeSolver::ComputeMultigridDirection() {
+  std::vector<double>& right_hand_side = multigrid_levels_[0].right_hand_side;
+  RunOverBlocks([&](const int64_t start, const int64_t end) {
+    for (int64_t i = start; i < end; ++i) {
+      right_hand_side[i] = -gradient_[i];
+    }
+  });
+
+  // Average the estimate onto the coarse levels that need it, and evaluate
+  // the gradient of every coarse objective there.
+  for (int level = 1; level < multigrid_levels_.size(); ++level) {
+    MultigridLevel& grid = multigrid_levels_[level];
+    if (grid.estimate.empty()) {
+      break;
+    }
+    const MultigridLevel& fine_grid = multigrid_levels_[level - 1];
+    AverageImage(
+        (level == 1) ? estimate_.data() : fine_grid.estimate.data(),
+        fine_grid.image_size,
+        grid.image_size,
+        num_multigrid_channels_,
+        grid.estimate.data());
+    if (grid.objective_function != nullptr) {
+      grid.objective_function->ComputeAllTerms(
+          grid.estimate.data(), grid.gradient.data());
+    }
+  }
+  RunMultigridCycle(0);
+}
+
+void NativeSolver::RunMultigridCycle(const int level) {
+  MultigridLevel& grid = multigrid_levels_[level];
+  double* correction =
+      (level == 0) ? direction_.data() : grid.correction.data();
+  RunOverLevelBlocks(level, [&](const int64_t start, const int64_t end) {
+    std::fill(correction + start, correction + end, 0.0);
+    std::copy(
+        grid.right_hand_side.begin() + start,
+        grid.right_hand_side.begin() + end,
+        grid.residual.begin() + start);
+  });
+  if (level + 1 == multigrid_levels_.size()) {
+    RunMultigridCG(level, solver_options_.num_multigrid_coarsest_iterations);
+    return;
+  }
+
+  // Smooth the error, correct it on the coarser levels, and smooth the error
+  // of the interpolated correction again.
+  RunMultigridCG(level, solver_options_.num_multigrid_smoothing_iterations);
+  MultigridLevel& coarse_grid = multigrid_levels_[level + 1];
+  RestrictImage(
+      grid.residual.data(),
+      grid.image_size,
+      coarse_grid.image_size,
+      num_multigrid_channels_,
+      coarse_grid.right_hand_side.data());
+  RunMultigridCycle(level + 1);
+  ProlongateImage(
+      coarse_grid.correction.data(),
+      coarse_grid.image_size,
+      grid.image_size,
+      num_multigrid_channels_,
+      grid.operator_product.data());
+  RunOverLevelBlocks(level, [&](const int64_t start, const int64_t end) {
+    for (int64_t i = start; i < end; ++i) {
+      correction[i] += grid.operator_product[i];
+    }
+  });
+  ApplyMultigridOperator(level, correction, grid.operator_product.data());
+  RunOverLevelBlocks(level, [&](const int64_t start, const int64_t end) {
+    for (int64_t i = start; i < end; ++i) {
+      grid.residual[i] = grid.right_hand_side[i] - grid.operator_product[i];
+    }
+  });
+  RunMultigridCG(level, solver_options_.num_multigrid_smoothing_iterations);
+}
+
+void NativeSolver::RunMultigridCG(const int level, const int num_iterations) {
+  MultigridLevel& grid = multigrid_levels_[level];
+  double* correction =
+      (level == 0) ? direction_.data() : grid.correction.data();
+  const bool use_preconditioner =
+      level == 0 && !inverse_preconditioner_.empty();
+  std::vector<double>& preconditioned_residual =
+      use_preconditioner ? grid.preconditioned_residual : grid.residual;
+  const auto precondition_residual = [&]() {
+    if (!use_preconditioner) {
+      return;
+    }
+    RunOverBlocks([&](const int64_t start, const int64_t end) {
+      for (int64_t i = start; i < end; ++i) {
+        preconditioned_residual[i] =
+            inverse_preconditioner_[i] * grid.residual[i];
+      }
+    });
+  };
+
+  precondition_residual();
+  double residual_product = LevelDotProduct(
+      level, grid.residual.data(), preconditioned_residual.data());
+  RunOverLevelBlocks(level, [&](const int64_t start, const int64_t end) {
+    std::copy(
+        preconditioned_residual.begin() + start,
+        preconditioned_residual.begin() + end,
+        grid.search_direction.begin() + start);
+  });
+  for (int iteration = 0; iteration < num_iterations; ++iteration) {
+    if (!(residual_product > 0.0)) {
+      break;  // The level's system is solved.
+    }
+    ApplyMultigridOperator(
+        level, grid.search_direction.data(), grid.operator_product.data());
+    const double curvature = LevelDotProduct(
+        level, grid.search_direction.data(), grid.operator_product.data());
+    if (!(curvature > 0.0)) {
+      break;  // The objective is not convex along the search direction.
+    }
+    const double step = residual_product / curvature;
+    RunOverLevelBlocks(level, [&](const int64_t start, const int64_t end) {
+      for (int64_t i = start; i < end; ++i) {
+        correction[i] += step * grid.search_direction[i];
+        grid.residual[i] -= step * grid.operator_product[i];
+      }
+    });
+    precondition_residual();
+    const double new_residual_product = LevelDotProduct(
+        level, grid.residual.data(), preconditioned_residual.data());
+    const double beta = new_residual_product / residual_product;
+    RunOverLevelBlocks(level, [&](const int64_t start, const int64_t end) {
+      util::LinearCombination(
+          end - start,
+          beta,
+          grid.search_direction.data() + start,
+          1.0,
+          preconditioned_residual.data() + start,
+          grid.search_direction.data() + start);
+    });
+    residual_product = new_residual_product;
+  }
+}
+
+void NativeSolver::ApplyMultigridOperator(
+    const int level, const double* vector, double* product) {
+
+  // The operator is applied on the nearest level that has an objective,
+  // which the full resolution level always has.
+  int objective_level = level;
+  while (objective_level > 0 &&
+         multigrid_levels_[objective_level].objective_function == nullptr) {
+    --objective_level;
+  }
+
+  // Interpolate the vector up to that level.
+  for (int coarse_level = level; coarse_level > objective_level;
+       --coarse_level) {
+    const MultigridLevel& coarse_grid = multigrid_levels_[coarse_level];
+    MultigridLevel& fine_grid = multigrid_levels_[coarse_level - 1];
+    ProlongateImage(
+        (coarse_level == level) ? vector : coarse_grid.transfer.data(),
+        coarse_grid.image_size,
+        fine_grid.image_size,
+        num_multigrid_channels_,
+        fine_grid.transfer.data());
+  }
+
+  // H v = g(x + v) - g(x), which is exact for a quadratic objective.
+  MultigridLevel& grid = multigrid_levels_[objective_level];
+  const bool is_full_resolution = objective_level == 0;
+  const ObjectiveFunction& objective_function =
+      is_full_resolution ? objective_function_ : *grid.objective_function;
+  const double* estimate =
+      is_full_resolution ? estimate_.data() : grid.estimate.data();
+  const double* gradient =
+      is_full_resolution ? gradient_.data() : grid.gradient.data();
+  double* trial_estimate =
+      is_full_resolution ? trial_estimate_.data() : grid.trial_estimate.data();
+  double* trial_gradient =
+      is_full_resolution ? trial_gradient_.data() : grid.trial_gradient.data();
+  const double* level_vector =
+      (objective_level == level) ? vector : grid.transfer.data();
+  RunOverLevelBlocks(
+      objective_level, [&](const int64_t start, const int64_t end) {
+    util::LinearCombination(
+        end - start,
+        1.0,
+        estimate + start,
+        1.0,
+        level_vector + start,
+        trial_estimate + start);
+  });
+  objective_function.ComputeAllTerms(trial_estimate, trial_gradient);
+  if (is_full_resolution) {
+    is_solution_last_evaluated_ = false;
+  }
+  double* level_product =
+      (objective_level == level) ? product : grid.transfer.data();
+  RunOverLevelBlocks(
+      objective_level, [&](const int64_t start, const int64_t end) {
+    for (int64_t i = start; i < end; ++i) {
+      level_product[i] = trial_gradient[i] - gradient[i];
+    }
+  });
+
+  // Restrict the product back down to the level.
+  for (int coarse_level = objective_level + 1; coarse_level <= level;
+       ++coarse_level) {
+    const MultigridLevel& fine_grid = multigrid_levels_[coarse_level - 1];
+    MultigridLevel& coarse_grid = multigrid_levels_[coarse_level];
+    RestrictImage(
+        fine_grid.transfer.data(),
+        fine_grid.image_size,
+        coarse_grid.image_size,
+        num_multigrid_channels_,
+        (coarse_level == level) ? product : coarse_grid.transfer.data());
+  }
+}
+
+void NativeSolver::RunOverLevelBlocks(
+    const int level,
+    const std::function<void(const int64_t, const int64_t)>& function) const {
+
+  if (level == 0) {
+    RunOverBlocks(function);
+  } else {
+    function(0, multigrid_levels_[level].num_parameters);
+  }
+}
+
+double NativeSolver::LevelDotProduct(
+    const int level, const double* a, const double* b) const {
+
+  if (level == 0) {
+    return DotProduct(a, b);
+  }
+  return util::DotProduct(multigrid_levels_[level].num_parameters, a, b);
+}
+
+}  // namespace super_resolution
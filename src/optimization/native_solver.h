@@ -0,0 +1,292 @@
+// Defines an in-house implementation of the conjugate gradient and LBFGS
+// solvers, as an alternative to the ALGLIB solvers in alglib_objective.h. The
+// objective function is called directly on the solver's own buffers instead
+// of through ALGLIB's reverse-communication loop, and the vector operations of
+// the solver itself (dot products and vector updates) are split across
+// threads in the same way as the objective function evaluation.
+
+#ifndef SRC_OPTIMIZATION_NATIVE_SOLVER_H_
+#define SRC_OPTIMIZATION_NATIVE_SOLVER_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "optimization/map_solver.h"
+#include "optimization/objective_function.h"
+#include "util/memory_accounting.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+// Returns true if the given least squares solver is implemented by the
+// NativeSolver rather than by ALGLIB.
+bool IsNativeLeastSquaresSolver(const LeastSquaresSolver least_squares_solver);
+
+// Runs the native solver selected by the solver options (NATIVE_CG_SOLVER,
+// NATIVE_LBFGS_SOLVER or MULTIGRID_SOLVER) repeatedly on the same objective
+// function. Like the
+// AlglibSolverSession, all solver buffers are allocated once and reused for
+// every call to Solve(), and the stopping criteria have the same meaning as
+// for the ALGLIB solvers.
+//
+// Both solvers use a line search that satisfies the strong Wolfe conditions.
+// CG uses the Polak-Ribiere+ update, and LBFGS uses the standard two-loop
+// recursion with num_lbfgs_hessian_corrections correction pairs.
+//
+// The multigrid solver treats the parameters as an image and searches along
+// the correction of one geometric multigrid V-cycle per iteration, which
+// approximately solves the Newton system H d = -g of the (quadratic) IRLS
+// objective. On every level, a few CG iterations smooth the error before and
+// after the correction from the next coarser level, and the coarsest level
+// runs more CG iterations. Every operator is applied through an objective as
+// H v = g(x + v) - g(x). A coarse level that was given its own objective
+// (see SetLevelObjectiveFunction()), i.e. the problem rediscretized on its
+// grid, is evaluated at the average of the estimate on that grid, so its
+// products only cost a coarse evaluation. The other coarse levels use the
+// Galerkin products R H P (see multigrid.h) through the next finer level
+// that has an objective, which needs nothing from the objective terms but
+// costs an evaluation of that level. Without any coarse objectives, a
+// V-cycle thus costs about (number of levels) *
+// (2 * num_multigrid_smoothing_iterations + 1) +
+// num_multigrid_coarsest_iterations full resolution evaluations, and with
+// all of them only 2 * num_multigrid_smoothing_iterations + 1, but either
+// way the number of V-cycles hardly grows with the image size. The line
+// search along the correction keeps every iteration a descent step even if
+// the objective is not quadratic. The solver does not support frozen
+// parameters.
+//
+// The objective function is referenced, so it must outlive the solver. It may
+// be changed between runs (e.g. by updating IRLS weights in place). Only
+// analytical differentiation is supported.
+class NativeSolver {
+ public:
+  // The image size of the parameters (num_parameters / image_size.area()
+  // channels of it, one after the other) is only needed by the multigrid
+  // solver.
+  NativeSolver(
+      const MapSolverOptions& solver_options,
+      const ObjectiveFunction& objective_function,
+      const int64_t num_parameters,
+      const cv::Size& image_size = cv::Size());
+
+  // Runs the solver starting from the given solver_data, which must contain
+  // num_parameters values and is modified to contain the solution. The
+  // search history (CG direction or LBFGS corrections) is reset for every
+  // call.
+  //
+  // Returns the final objective cost value.
+  double Solve(double* solver_data);
+
+  // Preconditions the following solves with the given diagonal of the
+  // approximate Hessian (not its inverse), which must have one positive value
+  // per parameter. CG then uses the preconditioned Polak-Ribiere+ update, and
+  // LBFGS starts its two-loop recursion from the scaled inverse diagonal
+  // instead of a scaled identity.
+  void SetDiagonalPreconditioner(const std::vector<double>& hessian_diagonal);
+
+  // Returns the image sizes of the levels that the multigrid solver uses for
+  // parameters of the given image size, starting with the full resolution
+  // (see GetMultigridLevelSizes()).
+  static std::vector<cv::Size> GetMultigridLevelImageSizes(
+      const MapSolverOptions& solver_options, const cv::Size& image_size);
+
+  // Rediscretizes the given coarse multigrid level (from 1) with the given
+  // objective function, which must be defined on the image size of the level
+  // (see GetMultigridLevelImageSizes()) with the same number of channels,
+  // and should approximate the Galerkin product R H P of the next finer
+  // level, e.g. the same problem on the coarser grid. Then the following
+  // solves apply the level's operator through this objective instead of a
+  // finer one (see the class comment). Null restores the Galerkin products.
+  // The objective function is referenced, so it must outlive the solver, and
+  // it may be changed between runs (e.g. with IRLS weights on the grid).
+  void SetLevelObjectiveFunction(
+      const int level, const ObjectiveFunction* objective_function);
+
+  // Limits the following solves to the given number of iterations (0 for no
+  // limit) instead of MapSolverOptions::max_num_solver_iterations, e.g. to
+  // finish before a deadline.
+  void SetMaxNumIterations(const int max_num_iterations) {
+    max_num_iterations_ = max_num_iterations;
+  }
+
+  // Returns the number of times that the solver was run.
+  int GetNumSolves() const {
+    return num_solves_;
+  }
+
+  // Returns true if the last objective evaluation of the last solve was at
+  // the solution that it returned. Then the terms still hold the values they
+  // computed at the solution (see
+  // ObjectiveIRLSRegularizationTerm::GetLastResiduals()). This is false if
+  // the solve stopped after a failed line search.
+  bool IsSolutionLastEvaluated() const {
+    return is_solution_last_evaluated_;
+  }
+
+ private:
+  // A point on the line search, with the cost at the step and the directional
+  // derivative of the cost along the search direction.
+  struct LineSearchPoint {
+    double step;
+    double cost;
+    double derivative;
+  };
+
+  // Runs function(start, end) over contiguous blocks covering the parameter
+  // index range [0, num_parameters_). The blocks are run in parallel if the
+  // solver has a thread pool.
+  void RunOverBlocks(
+      const std::function<void(const int64_t, const int64_t)>& function) const;
+
+  // Returns the dot product of two parameter-sized vectors.
+  double DotProduct(const double* a, const double* b) const;
+
+  // Returns the preconditioned gradient M^-1 g of the gradient in gradient_
+  // (if current) or trial_gradient_ (if not current), computing it if there is
+  // a preconditioner. Without a preconditioner, this is the gradient itself.
+  const double* GetPreconditionedGradient(const bool current);
+
+  // Evaluates the objective at estimate_ + step * direction_, which is written
+  // into trial_estimate_ (and the gradient into trial_gradient_). The step is
+  // kept in last_evaluated_step_.
+  LineSearchPoint Evaluate(const double step);
+
+  // Finds a step along direction_ that satisfies the strong Wolfe conditions
+  // with the given curvature parameter, starting from the given step. On
+  // success, trial_estimate_ and trial_gradient_ contain the accepted point,
+  // which is also returned in accepted_point. Returns false if no step that
+  // decreases the cost was found.
+  bool LineSearch(
+      const LineSearchPoint& start_point,
+      const double initial_step,
+      const double curvature_parameter,
+      LineSearchPoint* accepted_point);
+
+  // The zoom stage of the line search, which narrows the step interval
+  // between low_point (the best point so far) and high_point until a step
+  // that satisfies the strong Wolfe conditions is found.
+  bool Zoom(
+      const LineSearchPoint& start_point,
+      LineSearchPoint low_point,
+      LineSearchPoint high_point,
+      const double curvature_parameter,
+      LineSearchPoint* accepted_point);
+
+  // Sets direction_ to the LBFGS search direction using the stored correction
+  // pairs.
+  void ComputeLBFGSDirection();
+
+  // Sets direction_ to the multigrid correction of one V-cycle for the
+  // current gradient (see the class comment).
+  void ComputeMultigridDirection();
+
+  // Runs a V-cycle from the given level down, which approximately solves the
+  // level's system A c = b for its correction, starting from c = 0.
+  void RunMultigridCycle(const int level);
+
+  // Runs the given number of CG iterations on the level's system, continuing
+  // from its current correction and residual. The full resolution level is
+  // preconditioned by the diagonal preconditioner if there is one.
+  void RunMultigridCG(const int level, const int num_iterations);
+
+  // Computes the product of the level's operator with the given vector of the
+  // level's size, through the objective of the level or of the next finer
+  // level that has one (see the class comment).
+  void ApplyMultigridOperator(
+      const int level, const double* vector, double* product);
+
+  // Same as RunOverBlocks() and DotProduct() for the vectors of the given
+  // multigrid level. The coarse levels are processed in a single block.
+  void RunOverLevelBlocks(
+      const int level,
+      const std::function<void(const int64_t, const int64_t)>& function)
+      const;
+  double LevelDotProduct(
+      const int level, const double* a, const double* b) const;
+
+  // Records the size of the estimate buffers and of all other solver buffers
+  // in the memory accounting.
+  void UpdateMemoryAccounts();
+
+  const MapSolverOptions solver_options_;
+  const ObjectiveFunction& objective_function_;
+  const int64_t num_parameters_;
+
+  // The number of parallel blocks for the vector operations, and the pool
+  // that runs them (null if there is only one block).
+  int num_blocks_;
+  std::unique_ptr<util::ThreadPool> thread_pool_;
+
+  // Solver buffers, each of size num_parameters_.
+  std::vector<double> estimate_;
+  std::vector<double> gradient_;
+  std::vector<double> direction_;
+  std::vector<double> trial_estimate_;
+  std::vector<double> trial_gradient_;
+
+  // The inverse of the diagonal preconditioner and the preconditioned current
+  // and trial gradients. All are empty if there is no preconditioner.
+  std::vector<double> inverse_preconditioner_;
+  std::vector<double> preconditioned_gradient_;
+  std::vector<double> trial_preconditioned_gradient_;
+
+  // The step of the point currently held in the trial buffers.
+  double last_evaluated_step_;
+
+  // True if the objective was last evaluated at estimate_.
+  bool is_solution_last_evaluated_ = false;
+
+  // The LBFGS correction pairs s = x_{k+1} - x_k and y = g_{k+1} - g_k, used
+  // as a ring buffer. Only allocated for NATIVE_LBFGS_SOLVER.
+  std::vector<std::vector<double>> lbfgs_steps_;
+  std::vector<std::vector<double>> lbfgs_gradient_changes_;
+  std::vector<double> lbfgs_inverse_curvatures_;  // 1 / (s^T y) of each pair.
+  std::vector<double> lbfgs_alphas_;  // Two-loop recursion scratch values.
+  int num_lbfgs_corrections_;
+  int newest_lbfgs_correction_;
+
+  // The grid levels of the multigrid solver, starting with the full
+  // resolution, and the number of channels of every level's image. Only
+  // allocated for MULTIGRID_SOLVER. The correction of the full resolution
+  // level is direction_, and its transfer buffer is only needed if there are
+  // coarser levels. The estimate of a coarse level is only allocated if the
+  // level or a coarser one has an objective, and the other evaluation
+  // buffers only if the level has one. The full resolution level uses the
+  // solver buffers instead.
+  struct MultigridLevel {
+    cv::Size image_size;
+    int64_t num_parameters;
+    std::vector<double> right_hand_side;
+    std::vector<double> correction;
+    std::vector<double> residual;
+    std::vector<double> preconditioned_residual;
+    std::vector<double> search_direction;
+    std::vector<double> operator_product;
+    // Holds the vector of this level while the operator of a coarser level
+    // is applied through it.
+    std::vector<double> transfer;
+    const ObjectiveFunction* objective_function = nullptr;
+    std::vector<double> estimate;
+    std::vector<double> gradient;
+    std::vector<double> trial_estimate;
+    std::vector<double> trial_gradient;
+  };
+  std::vector<MultigridLevel> multigrid_levels_;
+  int num_multigrid_channels_;
+
+  // The memory of the buffers above, recorded as the estimate and as
+  // gradients.
+  util::MemoryAccount estimate_memory_;
+  util::MemoryAccount solver_memory_;
+
+  int num_solves_;
+  int max_num_iterations_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_NATIVE_SOLVER_H_
@@ -0,0 +1,179 @@
+#include "optimization/numerical_gradient.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "optimization/objective_function.h"
+#include "util/profiler.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// The coloring of one dimension of the image (rows, columns or channels).
+// Each index is colored by its remainder modulo the period, so indices of the
+// same color are at least 2 * radius + 1 apart, unless the dimension is too
+// small to have that many colors.
+class DimensionColoring {
+ public:
+  DimensionColoring(const int size, const int radius)
+      : size_(size),
+        radius_(radius),
+        num_colors_(std::min(2 * radius + 1, size)) {}
+
+  int GetNumColors() const {
+    return num_colors_;
+  }
+
+  // Returns the index of the given color within the radius of the given
+  // index, or -1 if there is none. There is at most one such index.
+  int GetOwner(const int index, const int color) const {
+    int owner = color;
+    if (num_colors_ < size_) {
+      int offset = (color - index) % num_colors_;
+      if (offset < 0) {
+        offset += num_colors_;
+      }
+      if (offset > radius_) {
+        offset -= num_colors_;
+      }
+      owner = index + offset;
+    }
+    if (owner < 0 || owner >= size_ || std::abs(owner - index) > radius_) {
+      return -1;
+    }
+    return owner;
+  }
+
+ private:
+  const int size_;
+  const int radius_;
+  const int num_colors_;
+};
+
+}  // namespace
+
+bool ComputeColoredNumericalGradient(
+    const ObjectiveFunction& objective_function,
+    const double* estimated_image_data,
+    const cv::Size& image_size,
+    const int num_channels,
+    const ColoredDifferentiationOptions& options,
+    std::vector<double>* gradient) {
+
+  PROFILE_SCOPE("ComputeColoredNumericalGradient");
+
+  CHECK_NOTNULL(estimated_image_data);
+  CHECK_NOTNULL(gradient);
+  CHECK_GE(options.spatial_radius, 0) << "The radius cannot be negative.";
+  CHECK_GE(options.channel_radius, 0) << "The radius cannot be negative.";
+  CHECK_GT(options.step, 0.0) << "The step must be positive.";
+
+  const int width = image_size.width;
+  const int height = image_size.height;
+  const int64_t num_pixels = static_cast<int64_t>(width) * height;
+  const int64_t num_parameters = num_pixels * num_channels;
+  CHECK_EQ(num_parameters, objective_function.GetNumParameters())
+      << "The image does not match the objective function.";
+
+  // Check that every term can be split into local costs before doing any of
+  // the work.
+  std::vector<double> local_costs(num_parameters);
+  if (!objective_function.ComputeLocalCosts(
+          estimated_image_data, local_costs.data())) {
+    return false;
+  }
+
+  const DimensionColoring column_coloring(width, options.spatial_radius);
+  const DimensionColoring row_coloring(height, options.spatial_radius);
+  const DimensionColoring channel_coloring(
+      num_channels, options.channel_radius);
+  const int num_column_colors = column_coloring.GetNumColors();
+  const int num_row_colors = row_coloring.GetNumColors();
+  const int num_colors = channel_coloring.GetNumColors() * num_row_colors *
+      num_column_colors;
+
+  // Every parameter only has its own color, so the tasks of different colors
+  // write to different parameters of the gradient.
+  gradient->assign(num_parameters, 0.0);
+  double* gradient_data = gradient->data();
+  const auto differentiate_color = [&](const int color) {
+    const int column_color = color % num_column_colors;
+    const int row_color = (color / num_column_colors) % num_row_colors;
+    const int channel_color = color / (num_column_colors * num_row_colors);
+
+    std::vector<double> perturbed_image(
+        estimated_image_data, estimated_image_data + num_parameters);
+    const auto perturb = [&](const double step) {
+      for (int channel = channel_color; channel < num_channels;
+           channel += channel_coloring.GetNumColors()) {
+        for (int row = row_color; row < height; row += num_row_colors) {
+          for (int col = column_color; col < width; col += num_column_colors) {
+            const int64_t index =
+                channel * num_pixels + static_cast<int64_t>(row) * width + col;
+            perturbed_image[index] = estimated_image_data[index] + step;
+          }
+        }
+      }
+    };
+    std::vector<double> forward_local_costs(num_parameters);
+    std::vector<double> backward_local_costs(num_parameters);
+    perturb(options.step);
+    objective_function.ComputeLocalCosts(
+        perturbed_image.data(), forward_local_costs.data());
+    perturb(-options.step);
+    objective_function.ComputeLocalCosts(
+        perturbed_image.data(), backward_local_costs.data());
+
+    // Each local cost only changed because of the perturbed parameter within
+    // the radii around it, if there is one.
+    const double inverse_step_size = 0.5 / options.step;
+    for (int channel = 0; channel < num_channels; ++channel) {
+      const int owner_channel =
+          channel_coloring.GetOwner(channel, channel_color);
+      if (owner_channel < 0) {
+        continue;
+      }
+      for (int row = 0; row < height; ++row) {
+        const int owner_row = row_coloring.GetOwner(row, row_color);
+        if (owner_row < 0) {
+          continue;
+        }
+        for (int col = 0; col < width; ++col) {
+          const int owner_col = column_coloring.GetOwner(col, column_color);
+          if (owner_col < 0) {
+            continue;
+          }
+          const int64_t index =
+              channel * num_pixels + static_cast<int64_t>(row) * width + col;
+          const int64_t owner_index = owner_channel * num_pixels +
+              static_cast<int64_t>(owner_row) * width + owner_col;
+          gradient_data[owner_index] +=
+              (forward_local_costs[index] - backward_local_costs[index]) *
+              inverse_step_size;
+        }
+      }
+    }
+  };
+
+  const int num_threads =
+      std::min(util::GetNumThreadsToUse(options.num_threads), num_colors);
+  if (num_threads <= 1) {
+    for (int color = 0; color < num_colors; ++color) {
+      differentiate_color(color);
+    }
+  } else {
+    // The calling thread also differentiates colors, so it is not included.
+    util::ThreadPool thread_pool(num_threads - 1);
+    thread_pool.ParallelFor(num_colors, differentiate_color);
+  }
+  return true;
+}
+
+}  // namespace super_resolution
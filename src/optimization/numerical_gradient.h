@@ -0,0 +1,62 @@
+// Numerical differentiation of objective functions for validating analytical
+// gradients. Perturbing one parameter at a time (as ALGLIB's numerical
+// differentiation does) costs two evaluations of the whole objective per
+// parameter, which is only feasible for tiny images. The objective terms of
+// the MAP formulation are sums of local costs with bounded stencils, though,
+// so parameters that are far enough apart never affect the same local cost.
+// These are grouped into colors by a regular coloring of the image grid, and
+// all parameters of a color are perturbed at once. The change of every local
+// cost is then caused by exactly one perturbed parameter, which gives every
+// partial derivative from two evaluations per color.
+
+#ifndef SRC_OPTIMIZATION_NUMERICAL_GRADIENT_H_
+#define SRC_OPTIMIZATION_NUMERICAL_GRADIENT_H_
+
+#include <vector>
+
+#include "optimization/objective_function.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+struct ColoredDifferentiationOptions {
+  // Every local cost of the objective (see ObjectiveTerm::AddLocalCosts())
+  // may only depend on the pixels within this many rows and columns of its
+  // own pixel, and within channel_radius channels of its channel. Larger
+  // radii are always correct but need more colors, and the number of colors
+  // is (2 * spatial_radius + 1)^2 * (2 * channel_radius + 1), limited by the
+  // image size and number of channels.
+  //
+  // For example, total variation needs a radius of 1 (and a channel radius
+  // of 1 for 3D TV), BTV needs its scale range, and the data term needs its
+  // downsampling scale plus the blur radius and the largest motion shift.
+  int spatial_radius = 1;
+  int channel_radius = 0;
+
+  // The step of the central differences.
+  double step = 1.0e-6;
+
+  // The number of colors differentiated concurrently. Set to 0 to use all
+  // available hardware threads. The objective terms must be safe to evaluate
+  // concurrently.
+  int num_threads = 1;
+};
+
+// Computes the gradient of the objective function at the given estimate of
+// the given size and number of channels with central finite differences over
+// the colors described above, and writes it into the given gradient (one
+// value per parameter). Returns false if any term of the objective function
+// cannot be split into local costs, in which case the gradient is not
+// computed.
+bool ComputeColoredNumericalGradient(
+    const ObjectiveFunction& objective_function,
+    const double* estimated_image_data,
+    const cv::Size& image_size,
+    const int num_channels,
+    const ColoredDifferentiationOptions& options,
+    std::vector<double>* gradient);
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_NUMERICAL_GRADIENT_H_
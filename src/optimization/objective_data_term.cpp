@@ -1,9 +1,23 @@
 #include "optimization/objective_data_term.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <vector>
 
+#include "image/encoded_observations.h"
 #include "image/image_data.h"
+#include "image_model/compiled_image_model.h"
 #include "image_model/image_model.h"
+#include "optimization/objective_workspace.h"
+#include "util/matrix_util.h"
+#include "util/memory_accounting.h"
+#include "util/numa.h"
+#include "util/profiler.h"
+#include "util/sparse_matrix.h"
+#include "util/thread_pool.h"
+#include "util/vector_kernels.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -12,66 +26,389 @@
 namespace super_resolution {
 namespace {
 
-double ComputeTermForObservation(
+// Returns the given channel range of the observation in the given precision.
+ImageData GetObservationChannels(
     const ImageData& observation,
-    const int image_index,
-    const ImageModel& image_model,
     const int channel_start,
     const int channel_end,
+    const ImagePrecision precision) {
+
+  ImageData channels;
+  for (int channel = channel_start; channel < channel_end; ++channel) {
+    channels.AddChannel(
+        observation.GetChannelImage(channel), DO_NOT_NORMALIZE_IMAGE);
+  }
+  channels.SetPrecision(precision);
+  return channels;
+}
+
+// Returns true if any channel of the given observations is not stored
+// continuously, e.g. if the observations are views of wavelet subbands.
+bool HasNonContinuousChannels(const std::vector<ImageData>& observations) {
+  for (const ImageData& observation : observations) {
+    for (int channel = 0; channel < observation.GetNumChannels(); ++channel) {
+      if (!observation.GetChannelImage(channel).isContinuous()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// An estimate within this relative distance of the cached line is evaluated
+// as a point on that line (see SetUseLineSearchCache()). Solvers compute
+// their trial points as x + a * d, so the points of one line search only
+// differ from the line by rounding.
+constexpr double kLineSearchCacheTolerance = 1e-12;
+
+// The cached cost and gradient are refreshed with a full evaluation after
+// this many moves of the cached point, which bounds the rounding errors that
+// the updates accumulate.
+constexpr int kMaxLineSearchCacheUpdates = 20;
+
+// Replaces the degraded channel with its residuals against the observation
+// channel, premultiplied by gradient_weight, and returns the unweighted sum of
+// squared residuals. If the observation channel is null, the degraded values
+// themselves are the residuals. The channels are stored with the given pixel
+// type.
+template <typename PixelType>
+double ComputeChannelResiduals(
+    const cv::Mat* observation_channel,
+    const double gradient_weight,
+    cv::Mat* residual_channel) {
+
+  const PixelType* observation_channel_data =
+      (observation_channel != nullptr) ?
+      observation_channel->ptr<PixelType>() : nullptr;
+  return util::ComputeWeightedResiduals(
+      residual_channel->total(),
+      observation_channel_data,
+      gradient_weight,
+      residual_channel->ptr<PixelType>());
+}
+
+// The observations that the residuals of the term are computed against:
+// either the observation images or, if the term encodes its observations,
+// their encoded copy.
+class ObservationView {
+ public:
+  ObservationView(
+      const std::vector<ImageData>& images,
+      const EncodedObservations* encoded_observations)
+      : images_(images), encoded_observations_(encoded_observations) {}
+
+  int GetNumObservations() const {
+    return (encoded_observations_ != nullptr) ?
+        encoded_observations_->GetNumObservations() : images_.size();
+  }
+
+  int GetNumChannels() const {
+    return (encoded_observations_ != nullptr) ?
+        encoded_observations_->GetNumChannels() : images_[0].GetNumChannels();
+  }
+
+  cv::Size GetImageSize(const int image_index) const {
+    return (encoded_observations_ != nullptr) ?
+        encoded_observations_->GetImageSize() :
+        images_[image_index].GetImageSize();
+  }
+
+  // Same as ComputeChannelResiduals() against the given channel of the given
+  // observation, or against zero if subtract_observation is false. Encoded
+  // observations are decoded on the fly.
+  template <typename PixelType>
+  double ComputeChannelResiduals(
+      const int image_index,
+      const int channel,
+      const bool subtract_observation,
+      const double gradient_weight,
+      cv::Mat* residual_channel) const {
+
+    if (!subtract_observation) {
+      return super_resolution::ComputeChannelResiduals<PixelType>(
+          nullptr, gradient_weight, residual_channel);
+    }
+    if (encoded_observations_ != nullptr) {
+      return encoded_observations_->ComputeWeightedResiduals(
+          image_index,
+          channel,
+          gradient_weight,
+          residual_channel->ptr<PixelType>());
+    }
+    const cv::Mat observation_channel =
+        images_[image_index].GetChannelImage(channel);
+    return super_resolution::ComputeChannelResiduals<PixelType>(
+        &observation_channel, gradient_weight, residual_channel);
+  }
+
+ private:
+  const std::vector<ImageData>& images_;
+  const EncodedObservations* encoded_observations_;
+};
+
+// Adds the weighted squared values of an LR residual channel to the local
+// costs of the HR pixels at the top left corners of the LR pixels.
+template <typename PixelType>
+void AddChannelLocalCosts(
+    const cv::Mat& residual_channel,
+    const int scale,
+    const double pixel_weight,
+    const cv::Size& image_size,
+    double* channel_local_costs) {
+
+  for (int row = 0; row < residual_channel.rows; ++row) {
+    const PixelType* residuals = residual_channel.ptr<PixelType>(row);
+    double* local_costs =
+        channel_local_costs + static_cast<int64_t>(row) * scale *
+        image_size.width;
+    for (int col = 0; col < residual_channel.cols; ++col) {
+      const double residual = residuals[col];
+      local_costs[col * scale] += pixel_weight * residual * residual;
+    }
+  }
+}
+
+// Adds a single precision channel to the given (double precision) gradient.
+void AddSinglePrecisionChannelToGradient(
+    const cv::Mat& channel, double* gradient) {
+
+  const int64_t num_pixels = channel.total();
+  const float* channel_data = channel.ptr<float>();
+  for (int64_t pixel_index = 0; pixel_index < num_pixels; ++pixel_index) {
+    gradient[pixel_index] += channel_data[pixel_index];
+  }
+}
+
+// Returns the weighted cost s^2 ||A_k x - y_k||^2 of a single observation k
+// and adds its gradient to the given gradient if it is not null. If
+// subtract_observation is false, y_k is taken to be zero, which gives the
+// homogeneous part s^2 ||A_k x||^2 of the term.
+double ComputeTermForObservation(
+    const ObservationView& low_res_observations,
+    const bool subtract_observation,
+    const int image_index,
+    const ImagePrecision precision,
+    const ImageModel& image_model,
     const cv::Size& image_size,
     const double* estimated_image_data,
+    ObjectiveWorkspace* workspace,
     double* gradient) {
 
-  // Degrade (and re-upsample) the HR estimate with the image model.
-  const int num_channels = channel_end - channel_start;
-  ImageData degraded_hr_image(estimated_image_data, image_size, num_channels);
-  image_model.ApplyToImage(&degraded_hr_image, image_index);
-  degraded_hr_image.ResizeImage(image_size, INTERPOLATE_NEAREST);
+  // Degrade the HR estimate with the image model. The result is compared
+  // directly against the observation on the LR grid.
+  //
+  // In double precision, the estimate is read through a borrowed view and the
+  // first operator of the model writes into a reused workspace buffer, so the
+  // estimate is never copied. The scratch buffer must outlive the degraded
+  // image, which may still be backed by it. In single precision, the estimate
+  // has to be converted anyway, so the converted copy is degraded in place.
+  const int num_channels = low_res_observations.GetNumChannels();
+  const bool single_precision = precision == SINGLE_PRECISION;
+  ObjectiveWorkspace::ScratchBuffer scratch_buffer =
+      workspace->GetScratchBuffer(
+          single_precision ? 0 :
+              static_cast<int64_t>(image_size.width) * image_size.height *
+              num_channels,
+          util::MEMORY_TAG_DATA_TERM);
+  ImageData degraded_image;
+  if (single_precision) {
+    degraded_image = ImageData(
+        estimated_image_data, image_size, num_channels, SINGLE_PRECISION);
+    image_model.ApplyToImage(&degraded_image, image_index);
+  } else {
+    const ImageData estimated_image(
+        estimated_image_data, image_size, num_channels, WRAP_PIXEL_DATA);
+    degraded_image = ImageData(
+        scratch_buffer.GetData(), image_size, num_channels, WRAP_PIXEL_DATA);
+    image_model.ApplyToImage(estimated_image, image_index, &degraded_image);
+  }
+  CHECK(degraded_image.GetImageSize() ==
+        low_res_observations.GetImageSize(image_index))
+      << "Degraded image size does not match the observation size.";
 
-  // Compute the individual residuals by comparing pixel values. Sum them up
-  // for the final residual sum.
+  // Each LR pixel covers scale^2 pixels of the HR grid. The residual sum is
+  // weighted accordingly so that the cost matches the value of the objective
+  // measured on the HR grid, which keeps regularization parameters consistent.
+  const int scale = image_model.GetDownsamplingScale();
+  const double pixel_weight = static_cast<double>(scale * scale);
+
+  // Compute the residuals in place of the degraded image, since the degraded
+  // pixel values are not needed after this. If the gradient is needed, the
+  // residuals are stored premultiplied by the derivative of the squared
+  // residual (2r) so that the transpose can be accumulated into the gradient
+  // directly.
+  const double gradient_weight = 2.0 * pixel_weight;
   double residual_sum = 0;
-  const int num_pixels = image_size.width * image_size.height;
-  const int num_data_points = num_pixels * num_channels;
-  std::vector<double> residuals;
-  residuals.reserve(num_data_points);
   for (int channel = 0; channel < num_channels; ++channel) {
-    const double* degraded_hr_channel_data =
-        degraded_hr_image.GetChannelData(channel);
-    const double* observation_channel_data =
-        observation.GetChannelData(channel + channel_start);
-    for (int pixel_index = 0; pixel_index < num_pixels; ++pixel_index) {
-      const double residual =
-          degraded_hr_channel_data[pixel_index] -
-          observation_channel_data[pixel_index];
-      residuals.push_back(residual);
-      residual_sum += (residual * residual);
+    cv::Mat residual_channel = degraded_image.GetChannelImage(channel);
+    if (single_precision) {
+      residual_sum += low_res_observations.ComputeChannelResiduals<float>(
+          image_index,
+          channel,
+          subtract_observation,
+          gradient_weight,
+          &residual_channel);
+    } else {
+      residual_sum += low_res_observations.ComputeChannelResiduals<double>(
+          image_index,
+          channel,
+          subtract_observation,
+          gradient_weight,
+          &residual_channel);
     }
   }
 
-  // If gradient is not null, apply transpose operations to the residual image.
-  // This is used to compute the gradient.
+  // If gradient is not null, apply the transpose operations to the residual
+  // image and add the result to the gradient.
   if (gradient != nullptr) {
-    ImageData residual_image(residuals.data(), image_size, num_channels);
-    const int scale = image_model.GetDownsamplingScale();
-    residual_image.ResizeImage(
-        cv::Size(image_size.width / scale, image_size.height / scale),
-        INTERPOLATE_ADDITIVE);
-    image_model.ApplyTransposeToImage(&residual_image, image_index);
-
-    // Add to the gradient.
+    image_model.ApplyTransposeToImage(&degraded_image, image_index);
+    CHECK(degraded_image.GetImageSize() == image_size)
+        << "Transposed residual size does not match the estimate size.";
+    const int64_t num_pixels =
+        static_cast<int64_t>(image_size.width) * image_size.height;
     for (int channel = 0; channel < num_channels; ++channel) {
-      const int channel_index = channel * num_pixels;
-      const double* residual_channel_data =
-          residual_image.GetChannelData(channel);
-      for (int pixel_index = 0; pixel_index < num_pixels; ++pixel_index) {
-        const int index = channel_index + pixel_index;
-        gradient[index] += 2 * residual_channel_data[pixel_index];
+      double* gradient_channel_data = gradient + channel * num_pixels;
+      if (single_precision) {
+        AddSinglePrecisionChannelToGradient(
+            degraded_image.GetChannelImage(channel), gradient_channel_data);
+      } else {
+        cv::Mat gradient_channel(
+            image_size, util::kOpenCvMatrixType, gradient_channel_data);
+        gradient_channel += degraded_image.GetChannelImage(channel);
       }
     }
   }
 
-  return residual_sum;
+  return pixel_weight * residual_sum;
+}
+
+// Same as ComputeTermForObservation() for the observations first_image_index
+// to last_image_index - 1 (non-inclusive) with a compiled image model. All of
+// these frames are degraded and transposed together (see
+// CompiledImageModel::ApplyToChannelBatch()), so every channel of the
+// estimate and of the gradient is streamed through memory once per batch
+// rather than once per observation.
+double ComputeTermForCompiledObservations(
+    const ObservationView& low_res_observations,
+    const bool subtract_observations,
+    const int first_image_index,
+    const int last_image_index,
+    const int scale,
+    const CompiledImageModel& compiled_image_model,
+    const cv::Size& image_size,
+    const double* estimated_image_data,
+    ObjectiveWorkspace* workspace,
+    double* gradient) {
+
+  const int num_batch_images = last_image_index - first_image_index;
+  if (num_batch_images <= 0) {
+    return 0.0;
+  }
+  const int num_channels = low_res_observations.GetNumChannels();
+  const cv::Size low_res_size = compiled_image_model.GetLowResImageSize();
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size.width) * image_size.height;
+  const int64_t num_low_res_pixels =
+      static_cast<int64_t>(low_res_size.width) * low_res_size.height;
+
+  // The degraded channels (and then the residuals) of the batch are stored
+  // in a reused workspace buffer, ordered by image and then by channel.
+  ObjectiveWorkspace::ScratchBuffer scratch_buffer =
+      workspace->GetScratchBuffer(
+          num_batch_images * num_channels * num_low_res_pixels,
+          util::MEMORY_TAG_DATA_TERM);
+  const auto get_residual_channel_data = [&](const int i, const int channel) {
+    return scratch_buffer.GetData() +
+        (static_cast<int64_t>(i) * num_channels + channel) *
+        num_low_res_pixels;
+  };
+
+  std::vector<double*> degraded_channel_data(num_batch_images);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    for (int i = 0; i < num_batch_images; ++i) {
+      degraded_channel_data[i] = get_residual_channel_data(i, channel);
+    }
+    compiled_image_model.ApplyToChannelBatch(
+        estimated_image_data + channel * num_pixels,
+        first_image_index,
+        degraded_channel_data);
+  }
+
+  // See ComputeTermForObservation() for the weighting of the residuals.
+  const double pixel_weight = static_cast<double>(scale * scale);
+  const double gradient_weight = 2.0 * pixel_weight;
+  double residual_sum = 0;
+  for (int i = 0; i < num_batch_images; ++i) {
+    const int image_index = first_image_index + i;
+    CHECK(low_res_observations.GetImageSize(image_index) == low_res_size)
+        << "Degraded image size does not match the observation size.";
+    for (int channel = 0; channel < num_channels; ++channel) {
+      cv::Mat residual_channel(
+          low_res_size,
+          util::kOpenCvMatrixType,
+          get_residual_channel_data(i, channel));
+      residual_sum += low_res_observations.ComputeChannelResiduals<double>(
+          image_index,
+          channel,
+          subtract_observations,
+          gradient_weight,
+          &residual_channel);
+    }
+  }
+
+  if (gradient != nullptr) {
+    std::vector<const double*> residual_channel_data(num_batch_images);
+    for (int channel = 0; channel < num_channels; ++channel) {
+      for (int i = 0; i < num_batch_images; ++i) {
+        residual_channel_data[i] = get_residual_channel_data(i, channel);
+      }
+      compiled_image_model.AddTransposeToChannelBatch(
+          residual_channel_data,
+          first_image_index,
+          gradient + channel * num_pixels);
+    }
+  }
+
+  return pixel_weight * residual_sum;
+}
+
+// Returns the unweighted cost sum_k ||A_k x - y_k||^2 of a single channel x
+// from the normal equations as x'Nx - 2x'b + y'y, where N = sum_k A_k'A_k,
+// b = sum_k A_k'y_k and y'y = sum_k ||y_k||^2. If the gradient is not null,
+// gradient_weight * (Nx - b) is added to it. The normal product buffer must
+// have room for one HR channel. If subtract_observations is false, b and y'y
+// are taken to be zero, which gives the homogeneous part x'Nx of the term.
+//
+// The cost is the difference of much larger terms, so it is only accurate to
+// about 1e-16 times y'y and can be slightly negative close to the solution.
+double ComputeChannelTermFromNormalEquations(
+    const util::SparseMatrix& normal_matrix,
+    const std::vector<double>& normal_right_hand_side,
+    const double observation_squared_norm,
+    const bool subtract_observations,
+    const double* estimated_channel_data,
+    const double gradient_weight,
+    double* normal_product,
+    double* gradient) {
+
+  normal_matrix.MultiplyVector(estimated_channel_data, normal_product);
+  const int64_t num_pixels = normal_right_hand_side.size();
+  const double right_hand_side_scale = subtract_observations ? 1.0 : 0.0;
+  double quadratic_term = 0.0;
+  double linear_term = 0.0;
+  for (int64_t pixel_index = 0; pixel_index < num_pixels; ++pixel_index) {
+    const double value = estimated_channel_data[pixel_index];
+    const double right_hand_side =
+        right_hand_side_scale * normal_right_hand_side[pixel_index];
+    quadratic_term += value * normal_product[pixel_index];
+    linear_term += value * right_hand_side;
+    if (gradient != nullptr) {
+      gradient[pixel_index] += gradient_weight *
+          (normal_product[pixel_index] - right_hand_side);
+    }
+  }
+  return quadratic_term - 2.0 * linear_term +
+      right_hand_side_scale * observation_squared_norm;
 }
 
 }  // namespace
@@ -81,38 +418,559 @@ ObjectiveDataTerm::ObjectiveDataTerm(
     const std::vector<ImageData>& observations,
     const int channel_start,
     const int channel_end,
-    const cv::Size& image_size)
-    : image_model_(image_model),
-      observations_(observations),
+    const cv::Size& image_size,
+    const int num_threads,
+    const ImagePrecision precision,
+    const std::shared_ptr<const CompiledImageModel>& compiled_image_model,
+    const ObservationEncoding observation_encoding)
+    : image_model_(&image_model),
+      compiled_image_model_(compiled_image_model),
+      observations_(&observations),
+      num_observations_(observations.size()),
       channel_start_(channel_start),
       channel_end_(channel_end),
-      image_size_(image_size) {
+      image_size_(image_size),
+      precision_(precision),
+      normal_equations_memory_(util::MEMORY_TAG_OBSERVATIONS) {
 
+  const util::ScopedMemoryTag memory_tag(util::MEMORY_TAG_OBSERVATIONS);
   CHECK_GT(observations.size(), 0) << "Cannot solve with 0 observations.";
   CHECK_GE(channel_start, 0) << "First channel in range is out of bounds.";
   CHECK_LE(channel_end, observations[0].GetNumChannels())
       << "Last channel in range is out of bounds (non-inclusive).";
   CHECK_GT(channel_end, channel_start) << "Invalid channel range.";
+  const int scale = image_model.GetDownsamplingScale();
+  const cv::Size low_res_size(
+      image_size.width / scale, image_size.height / scale);
+  for (const ImageData& observation : observations) {
+    CHECK(observation.GetImageSize() == low_res_size)
+        << "The observations must be at the LR image size.";
+  }
+  if (compiled_image_model_ != nullptr) {
+    CHECK_EQ(precision, DOUBLE_PRECISION)
+        << "A compiled image model is only evaluated in double precision.";
+    CHECK_EQ(compiled_image_model_->GetImageSize(), image_size)
+        << "The compiled image model does not match the image size.";
+    CHECK_GE(compiled_image_model_->GetNumFrames(), observations.size())
+        << "The compiled image model does not cover every observation.";
+  }
+
+  // With a precomputed normal matrix, the observations are only read here,
+  // so they are never encoded. Otherwise, encoded observations replace the
+  // observation images for good. The observation images are only copied if
+  // the term uses a subset of their channels or a different precision, or if
+  // their channels are not continuous (the residuals are computed over whole
+  // channel buffers), and used directly otherwise.
+  const bool use_normal_equations = compiled_image_model_ != nullptr &&
+      compiled_image_model_->HasNormalMatrix();
+  const bool use_all_channels =
+      (channel_start == 0 &&
+       channel_end == observations[0].GetNumChannels());
+  if (observation_encoding != OBSERVATION_ENCODING_NONE &&
+      !use_normal_equations) {
+    encoded_observations_.reset(new EncodedObservations(
+        observations, channel_start, channel_end, observation_encoding));
+  } else if (!use_all_channels ||
+             precision != observations[0].GetPrecision() ||
+             HasNonContinuousChannels(observations)) {
+    copy_observation_channels_ = true;
+    observation_channels_.reserve(observations.size());
+    for (const ImageData& observation : observations) {
+      observation_channels_.push_back(GetObservationChannels(
+          observation, channel_start, channel_end, precision));
+    }
+  }
+  const std::vector<ImageData>& low_res_observations = GetObservations();
+
+  // With a precomputed normal matrix, the observations only enter the term
+  // through b = sum_k A_k'y_k and y'y = sum_k ||y_k||^2 for every channel, so
+  // they are reduced here once.
+  if (use_normal_equations) {
+    const int num_channels = channel_end - channel_start;
+    const int64_t num_pixels =
+        static_cast<int64_t>(image_size.width) * image_size.height;
+    normal_right_hand_sides_.assign(
+        num_channels, std::vector<double>(num_pixels, 0.0));
+    observation_squared_norms_.assign(num_channels, 0.0);
+    normal_equations_memory_.SetBytes(
+        num_channels * util::GetBufferBytes(normal_right_hand_sides_[0]));
+    for (int image_index = 0; image_index < num_observations_; ++image_index) {
+      AddToNormalEquations(image_index);
+    }
+  }
+
+  // The thread calling Compute() also evaluates observations, so it is not
+  // included in the pool.
+  max_num_threads_ = util::GetNumThreadsToUse(num_threads);
+  num_threads_ = std::min(max_num_threads_, num_observations_);
+  if (num_threads_ > 1) {
+    thread_pool_.reset(new util::ThreadPool(num_threads_ - 1));
+
+    // The observation images of each block live on the NUMA node that
+    // evaluates the block in Compute().
+    for (int block_index = 0;
+         encoded_observations_ == nullptr && block_index < num_threads_;
+         ++block_index) {
+      const int node_index =
+          util::GetBlockNumaNode(block_index, num_threads_);
+      for (int image_index = block_index * num_observations_ / num_threads_;
+           image_index < (block_index + 1) * num_observations_ / num_threads_;
+           ++image_index) {
+        const ImageData& observation = low_res_observations[image_index];
+        for (int channel = 0;
+             channel < observation.GetNumChannels();
+             ++channel) {
+          const cv::Mat channel_image = observation.GetChannelImage(channel);
+          util::MoveToNumaNode(
+              channel_image.data,
+              channel_image.total() * channel_image.elemSize(),
+              node_index);
+        }
+      }
+    }
+  }
+}
+
+void ObjectiveDataTerm::AddObservations(
+    const ImageModel& image_model,
+    const std::vector<ImageData>& observations,
+    const std::shared_ptr<const CompiledImageModel>& compiled_image_model) {
+
+  const util::ScopedMemoryTag memory_tag(util::MEMORY_TAG_OBSERVATIONS);
+  CHECK_GE(observations.size(), num_observations_)
+      << "The observations must include those of the term.";
+  CHECK_EQ(compiled_image_model != nullptr, compiled_image_model_ != nullptr)
+      << "The term must keep using (or not using) a compiled image model.";
+  const int scale = image_model.GetDownsamplingScale();
+  const cv::Size low_res_size(
+      image_size_.width / scale, image_size_.height / scale);
+  for (int image_index = num_observations_;
+       image_index < observations.size();
+       ++image_index) {
+    CHECK(observations[image_index].GetImageSize() == low_res_size)
+        << "The observations must be at the LR image size.";
+    CHECK_LE(channel_end_, observations[image_index].GetNumChannels())
+        << "Last channel in range is out of bounds (non-inclusive).";
+  }
+  if (compiled_image_model != nullptr) {
+    CHECK_GE(compiled_image_model->GetNumFrames(), observations.size())
+        << "The compiled image model does not cover every observation.";
+    CHECK_EQ(compiled_image_model->HasNormalMatrix(),
+             compiled_image_model_->HasNormalMatrix())
+        << "The term must keep using (or not using) the normal equations.";
+  }
+
+  const int first_new_index = num_observations_;
+  image_model_ = &image_model;
+  compiled_image_model_ = compiled_image_model;
+  observations_ = &observations;
+  num_observations_ = observations.size();
+
+  // Only the new observations are encoded, copied and reduced. If a new
+  // observation does not fit the uint16 encoding of the earlier ones, all of
+  // them are encoded again.
+  if (encoded_observations_ != nullptr) {
+    for (int image_index = first_new_index;
+         image_index < num_observations_;
+         ++image_index) {
+      if (!encoded_observations_->AddObservation(observations[image_index])) {
+        encoded_observations_.reset(new EncodedObservations(
+            observations,
+            channel_start_,
+            channel_end_,
+            encoded_observations_->GetEncoding()));
+        break;
+      }
+    }
+  } else if (copy_observation_channels_) {
+    for (int image_index = first_new_index;
+         image_index < num_observations_;
+         ++image_index) {
+      observation_channels_.push_back(GetObservationChannels(
+          observations[image_index],
+          channel_start_,
+          channel_end_,
+          precision_));
+    }
+  }
+  if (!normal_right_hand_sides_.empty()) {
+    for (int image_index = first_new_index;
+         image_index < num_observations_;
+         ++image_index) {
+      AddToNormalEquations(image_index);
+    }
+  }
+
+  // The thread pool grows up to the requested number of threads. The new
+  // observations are not moved to the NUMA nodes of their blocks.
+  const int num_threads = std::min(max_num_threads_, num_observations_);
+  if (num_threads > num_threads_) {
+    num_threads_ = num_threads;
+    thread_pool_.reset(new util::ThreadPool(num_threads_ - 1));
+  }
+
+  std::lock_guard<std::mutex> lock(line_search_cache_mutex_);
+  line_search_cache_ = LineSearchCache();
 }
 
 double ObjectiveDataTerm::Compute(
     const double* estimated_image_data, double* gradient) const {
 
+  PROFILE_SCOPE("ObjectiveDataTerm::Compute");
+
   CHECK_NOTNULL(estimated_image_data);
+  if (use_line_search_cache_) {
+    return ComputeWithLineSearchCache(estimated_image_data, gradient);
+  }
+  return ComputeTerm(estimated_image_data, true, gradient);
+}
 
-  double residual_sum = 0.0;
-  for (int image_index = 0; image_index < observations_.size(); ++image_index) {
-    residual_sum += ComputeTermForObservation(
-        observations_[image_index],
+void ObjectiveDataTerm::AddToNormalEquations(const int image_index) {
+  const ImageData& low_res_observation = GetObservations()[image_index];
+  for (int channel = 0; channel < normal_right_hand_sides_.size(); ++channel) {
+    compiled_image_model_->AddTransposeToChannel(
+        low_res_observation.GetChannelData(channel),
         image_index,
-        image_model_,
-        channel_start_,
-        channel_end_,
-        image_size_,
-        estimated_image_data,
-        gradient);
+        normal_right_hand_sides_[channel].data());
+    const cv::Mat observation_channel =
+        low_res_observation.GetChannelImage(channel);
+    observation_squared_norms_[channel] +=
+        observation_channel.dot(observation_channel);
+  }
+}
+
+void ObjectiveDataTerm::SetUseLineSearchCache(
+    const bool use_line_search_cache) {
+
+  std::lock_guard<std::mutex> lock(line_search_cache_mutex_);
+  use_line_search_cache_ = use_line_search_cache;
+  line_search_cache_ = LineSearchCache();
+}
+
+double ObjectiveDataTerm::ComputeWithLineSearchCache(
+    const double* estimated_image_data, double* gradient) const {
+
+  const int64_t num_parameters = static_cast<int64_t>(image_size_.width) *
+      image_size_.height * (channel_end_ - channel_start_);
+  std::lock_guard<std::mutex> lock(line_search_cache_mutex_);
+  LineSearchCache& cache = line_search_cache_;
+
+  // Find the step of the estimate along the cached line, if it is on it.
+  double step = 0.0;
+  bool is_on_line = false;
+  if (cache.has_direction) {
+    double direction_dot_product = 0.0;
+    for (int64_t i = 0; i < num_parameters; ++i) {
+      direction_dot_product +=
+          (estimated_image_data[i] - cache.point[i]) * cache.direction[i];
+    }
+    step = direction_dot_product / cache.direction_squared_norm;
+    double distance_squared = 0.0;
+    double estimate_squared_norm = 0.0;
+    for (int64_t i = 0; i < num_parameters; ++i) {
+      const double distance = estimated_image_data[i] -
+          (cache.point[i] + step * cache.direction[i]);
+      distance_squared += distance * distance;
+      estimate_squared_norm +=
+          estimated_image_data[i] * estimated_image_data[i];
+    }
+    is_on_line = distance_squared <=
+        kLineSearchCacheTolerance * kLineSearchCacheTolerance *
+        estimate_squared_norm;
+  }
+
+  if (!is_on_line) {
+    // Off the line, the estimate starts a new line from the last evaluated
+    // point, which is usually the point accepted by the last line search.
+    // The new direction is the only one the image model is applied to.
+    if (cache.has_direction) {
+      cache.cost = cache.GetCost(cache.last_step);
+      for (int64_t i = 0; i < num_parameters; ++i) {
+        cache.point[i] += cache.last_step * cache.direction[i];
+        cache.gradient[i] += cache.last_step * cache.direction_gradient[i];
+      }
+      cache.has_direction = false;
+      cache.num_updates++;
+    }
+    if (!cache.has_point ||
+        cache.num_updates >= kMaxLineSearchCacheUpdates) {
+      cache.point.assign(
+          estimated_image_data, estimated_image_data + num_parameters);
+      cache.gradient.assign(num_parameters, 0.0);
+      cache.cost = ComputeTerm(
+          estimated_image_data, true, cache.gradient.data());
+      cache.has_point = true;
+      cache.num_updates = 0;
+    } else {
+      cache.direction.resize(num_parameters);
+      cache.direction_squared_norm = 0.0;
+      cache.slope = 0.0;
+      for (int64_t i = 0; i < num_parameters; ++i) {
+        const double direction = estimated_image_data[i] - cache.point[i];
+        cache.direction[i] = direction;
+        cache.direction_squared_norm += direction * direction;
+        cache.slope += cache.gradient[i] * direction;
+      }
+      if (cache.direction_squared_norm > 0.0) {
+        // The gradient of the homogeneous part at d is H d, and its cost is
+        // d'Hd / 2.
+        cache.direction_gradient.assign(num_parameters, 0.0);
+        cache.curvature = 2.0 * ComputeTerm(
+            cache.direction.data(), false, cache.direction_gradient.data());
+        cache.has_direction = true;
+        step = 1.0;
+      }
+    }
+  }
+
+  // The cost and gradient at the point x + a * d are
+  //   f(x) + a * g'd + a^2 / 2 * d'Hd  and  g + a * H d.
+  if (!cache.has_direction) {
+    step = 0.0;
+  }
+  cache.last_step = step;
+  if (gradient != nullptr) {
+    for (int64_t i = 0; i < num_parameters; ++i) {
+      gradient[i] += cache.gradient[i];
+    }
+    if (cache.has_direction) {
+      for (int64_t i = 0; i < num_parameters; ++i) {
+        gradient[i] += step * cache.direction_gradient[i];
+      }
+    }
+  }
+  return cache.has_direction ? cache.GetCost(step) : cache.cost;
+}
+
+double ObjectiveDataTerm::ComputeTerm(
+    const double* estimated_image_data,
+    const bool subtract_observations,
+    double* gradient) const {
+
+  // With the normal equations, every channel is evaluated in a single pass
+  // over the HR pixels regardless of the number of observations. See
+  // ComputeTermForObservation() for the weighting.
+  if (!normal_right_hand_sides_.empty()) {
+    const int scale = image_model_->GetDownsamplingScale();
+    const double pixel_weight = static_cast<double>(scale * scale);
+    const int64_t num_pixels =
+        static_cast<int64_t>(image_size_.width) * image_size_.height;
+    ObjectiveWorkspace::ScratchBuffer normal_product =
+        GetWorkspace()->GetScratchBuffer(
+            num_pixels, util::MEMORY_TAG_DATA_TERM);
+    double residual_sum = 0.0;
+    for (int channel = 0; channel < normal_right_hand_sides_.size();
+         ++channel) {
+      residual_sum += ComputeChannelTermFromNormalEquations(
+          compiled_image_model_->GetNormalMatrix(),
+          normal_right_hand_sides_[channel],
+          observation_squared_norms_[channel],
+          subtract_observations,
+          estimated_image_data + channel * num_pixels,
+          2.0 * pixel_weight,
+          normal_product.GetData(),
+          (gradient != nullptr) ? gradient + channel * num_pixels : nullptr);
+    }
+    return pixel_weight * residual_sum;
+  }
+
+  const ObservationView low_res_observations(
+      GetObservations(), encoded_observations_.get());
+
+  // Computes the term for the observations [first_image_index,
+  // last_image_index). With a compiled image model, the whole range is
+  // evaluated as one batch.
+  const auto compute_observations = [&](
+      const int first_image_index,
+      const int last_image_index,
+      double* observations_gradient) {
+    if (compiled_image_model_ != nullptr) {
+      return ComputeTermForCompiledObservations(
+          low_res_observations,
+          subtract_observations,
+          first_image_index,
+          last_image_index,
+          image_model_->GetDownsamplingScale(),
+          *compiled_image_model_,
+          image_size_,
+          estimated_image_data,
+          GetWorkspace(),
+          observations_gradient);
+    }
+    double residual_sum = 0.0;
+    for (int image_index = first_image_index;
+         image_index < last_image_index;
+         ++image_index) {
+      residual_sum += ComputeTermForObservation(
+          low_res_observations,
+          subtract_observations,
+          image_index,
+          precision_,
+          *image_model_,
+          image_size_,
+          estimated_image_data,
+          GetWorkspace(),
+          observations_gradient);
+    }
+    return residual_sum;
+  };
+
+  const int num_observations = num_observations_;
+  if (thread_pool_ == nullptr) {
+    return compute_observations(0, num_observations, gradient);
+  }
+
+  // Split the observations into one contiguous block per thread. Each block
+  // accumulates into its own cost and gradient, which are reduced in block
+  // order afterwards so that the result does not depend on thread timing.
+  const int num_blocks = num_threads_;
+  const int64_t num_parameters = static_cast<int64_t>(image_size_.width) *
+      image_size_.height * (channel_end_ - channel_start_);
+  std::vector<double> block_residual_sums(num_blocks, 0.0);
+  std::vector<ObjectiveWorkspace::ScratchBuffer> block_gradients;
+  if (gradient != nullptr) {
+    block_gradients.reserve(num_blocks);
+    for (int block_index = 0; block_index < num_blocks; ++block_index) {
+      block_gradients.push_back(GetWorkspace()->GetScratchBuffer(
+          num_parameters, util::MEMORY_TAG_GRADIENTS));
+    }
+  }
+  thread_pool_->ParallelForOnNumaNodes(num_blocks, [&](const int block_index) {
+    const int first_image_index = block_index * num_observations / num_blocks;
+    const int last_image_index =
+        (block_index + 1) * num_observations / num_blocks;
+    double* block_gradient = nullptr;
+    if (gradient != nullptr) {
+      // Each block clears its own gradient, so a newly allocated gradient is
+      // first touched (and placed) on the NUMA node of the block.
+      block_gradients[block_index].GetVector()->assign(num_parameters, 0.0);
+      block_gradient = block_gradients[block_index].GetData();
+    }
+    block_residual_sums[block_index] = compute_observations(
+        first_image_index, last_image_index, block_gradient);
+  });
+
+  double residual_sum = 0.0;
+  for (int block_index = 0; block_index < num_blocks; ++block_index) {
+    residual_sum += block_residual_sums[block_index];
+    if (gradient != nullptr) {
+      const double* block_gradient = block_gradients[block_index].GetData();
+      for (int64_t i = 0; i < num_parameters; ++i) {
+        gradient[i] += block_gradient[i];
+      }
+    }
   }
   return residual_sum;
 }
 
+void ObjectiveDataTerm::AddHessianDiagonal(double* diagonal) const {
+  CHECK_NOTNULL(diagonal);
+
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size_.width) * image_size_.height;
+  std::vector<double> channel_diagonal(num_pixels, 0.0);
+  if (compiled_image_model_ != nullptr &&
+      compiled_image_model_->HasNormalMatrix()) {
+    const util::SparseMatrix& normal_matrix =
+        compiled_image_model_->GetNormalMatrix();
+    const std::vector<int64_t>& row_offsets = normal_matrix.GetRowOffsets();
+    const std::vector<int64_t>& column_indices =
+        normal_matrix.GetColumnIndices();
+    const std::vector<double>& values = normal_matrix.GetValues();
+    for (int64_t row = 0; row < num_pixels; ++row) {
+      for (int64_t i = row_offsets[row]; i < row_offsets[row + 1]; ++i) {
+        if (column_indices[i] == row) {
+          channel_diagonal[row] = values[i];
+        }
+      }
+    }
+  } else if (compiled_image_model_ != nullptr) {
+    // The diagonal of A'A is the sum of the squared entries of each column.
+    for (int image_index = 0;
+         image_index < num_observations_;
+         ++image_index) {
+      const util::SparseMatrix& frame_matrix =
+          compiled_image_model_->GetFrameMatrix(image_index);
+      const std::vector<int64_t>& column_indices =
+          frame_matrix.GetColumnIndices();
+      const std::vector<double>& values = frame_matrix.GetValues();
+      for (int64_t i = 0; i < frame_matrix.GetNumNonZeros(); ++i) {
+        channel_diagonal[column_indices[i]] += values[i] * values[i];
+      }
+    }
+  } else {
+    const ImageData ones(
+        cv::Mat::ones(image_size_, util::kOpenCvMatrixType),
+        DO_NOT_NORMALIZE_IMAGE);
+    for (int image_index = 0;
+         image_index < num_observations_;
+         ++image_index) {
+      ImageData row_sums = image_model_->ApplyToImage(ones, image_index);
+      image_model_->ApplyTransposeToImage(&row_sums, image_index);
+      const double* row_sums_data = row_sums.GetChannelData(0);
+      for (int64_t i = 0; i < num_pixels; ++i) {
+        channel_diagonal[i] += row_sums_data[i];
+      }
+    }
+  }
+
+  // See ComputeTermForObservation() for the weighting of the residuals.
+  const int scale = image_model_->GetDownsamplingScale();
+  const double hessian_weight = 2.0 * scale * scale;
+  const int num_channels = channel_end_ - channel_start_;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    double* diagonal_channel = diagonal + channel * num_pixels;
+    for (int64_t i = 0; i < num_pixels; ++i) {
+      diagonal_channel[i] += hessian_weight * channel_diagonal[i];
+    }
+  }
+}
+
+bool ObjectiveDataTerm::AddLocalCosts(
+    const double* estimated_image_data, double* local_costs) const {
+
+  CHECK_NOTNULL(estimated_image_data);
+  CHECK_NOTNULL(local_costs);
+
+  // The image model is applied to each observation directly (rather than
+  // through the compiled model or the normal equations), since the residuals
+  // of the individual LR pixels are needed.
+  const ObservationView observations(
+      GetObservations(), encoded_observations_.get());
+  const int num_channels = channel_end_ - channel_start_;
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size_.width) * image_size_.height;
+  const int scale = image_model_->GetDownsamplingScale();
+  const double pixel_weight = static_cast<double>(scale * scale);
+  for (int image_index = 0; image_index < num_observations_; ++image_index) {
+    ImageData residual_image(
+        estimated_image_data, image_size_, num_channels, precision_);
+    image_model_->ApplyToImage(&residual_image, image_index);
+    for (int channel = 0; channel < num_channels; ++channel) {
+      cv::Mat residual_channel = residual_image.GetChannelImage(channel);
+      double* channel_local_costs = local_costs + channel * num_pixels;
+      if (precision_ == SINGLE_PRECISION) {
+        observations.ComputeChannelResiduals<float>(
+            image_index, channel, true, 1.0, &residual_channel);
+        AddChannelLocalCosts<float>(
+            residual_channel,
+            scale,
+            pixel_weight,
+            image_size_,
+            channel_local_costs);
+      } else {
+        observations.ComputeChannelResiduals<double>(
+            image_index, channel, true, 1.0, &residual_channel);
+        AddChannelLocalCosts<double>(
+            residual_channel,
+            scale,
+            pixel_weight,
+            image_size_,
+            channel_local_costs);
+      }
+    }
+  }
+  return true;
+}
+
 }  // namespace super_resolution
@@ -2,15 +2,24 @@
 // computes ||Ax - y||_2^2 where A is the image model, x is the estimated data,
 // and y is an observation. For multiple observations, the term is computed as
 // the sum of costs over all observations k, ||A_kx - y_k||_2^2.
+//
+// The residuals are computed on the LR grid, and the transpose of the image
+// model is applied to the residuals to accumulate the gradient in place.
 
 #ifndef SRC_OPTIMIZATION_OBJECTIVE_DATA_TERM_H_
 #define SRC_OPTIMIZATION_OBJECTIVE_DATA_TERM_H_
 
+#include <memory>
+#include <mutex>
 #include <vector>
 
+#include "image/encoded_observations.h"
 #include "image/image_data.h"
+#include "image_model/compiled_image_model.h"
 #include "image_model/image_model.h"
 #include "optimization/objective_function.h"
+#include "util/memory_accounting.h"
+#include "util/thread_pool.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -25,23 +34,200 @@ class ObjectiveDataTerm : public ObjectiveTerm {
   // We only include the range here because the low-resolution images consist
   // of all channels, and if channels are being split up and solved
   // individually or in smaller subsets, the correct channels must be used.
+  //
+  // The observations must be at the LR image size, i.e. image_size divided by
+  // the downsampling scale of the image model. They are referenced rather
+  // than copied unless the term uses a subset of their channels or a
+  // different precision, so they must outlive the term (or be replaced with
+  // AddObservations()). The same holds for the image model.
+  //
+  // If num_threads is not 1, the observations are evaluated in parallel using
+  // that many threads (0 uses all hardware threads). The observations are
+  // split into fixed contiguous blocks, one per thread, and the per-block
+  // costs and gradients are added up in block order, so results are
+  // reproducible for a given number of threads.
+  //
+  // If precision is SINGLE_PRECISION, the image model and its transpose are
+  // applied to single precision copies of the estimate and residuals, which
+  // halves the memory traffic of every evaluation. The estimate and gradient
+  // are still given in double precision, and the cost is accumulated in
+  // double precision.
+  //
+  // If compiled_image_model is not null, it is used in place of the image
+  // model to degrade the estimate and to accumulate the gradient (see
+  // ImageModel::Compile()). It must be compiled for the given image size and
+  // at least as many frames as there are observations, and it can only be
+  // used in double precision. The observations of each thread are then
+  // evaluated as one batch (see CompiledImageModel::ApplyToChannelBatch()).
+  // If the compiled model also has its normal matrix (see
+  // CompiledImageModel::ComputeNormalMatrix()), the observations are reduced
+  // once in the constructor, and every evaluation instead costs a single
+  // pass over the HR pixels independent of the number of observations.
+  //
+  // If observation_encoding is not OBSERVATION_ENCODING_NONE, the term keeps
+  // its own copy of the observation channels with 16 bits per pixel (see
+  // EncodedObservations), which is decoded on the fly when the residuals are
+  // computed. The given observations are then only read by the constructor.
+  // The encoding is ignored if the observations are reduced to the normal
+  // equations.
   ObjectiveDataTerm(
       const ImageModel& image_model,
       const std::vector<ImageData>& observations,
       const int channel_start,
       const int channel_end,
-      const cv::Size& image_size);
+      const cv::Size& image_size,
+      const int num_threads = 1,
+      const ImagePrecision precision = DOUBLE_PRECISION,
+      const std::shared_ptr<const CompiledImageModel>& compiled_image_model =
+          nullptr,
+      const ObservationEncoding observation_encoding =
+          OBSERVATION_ENCODING_NONE);
+
+  // Extends the term with the observations that were added after the given
+  // ones, e.g. frames that arrive while the solver runs. The observations
+  // must start with the observations of the term, and the image model (and
+  // the compiled image model if the term uses one) must cover every one of
+  // them. They replace the ones given before, which no longer have to
+  // outlive the term. Only the new observations are copied, encoded and
+  // added to the normal equations, so the cost of extending the term does
+  // not grow with the number of observations it already has.
+  void AddObservations(
+      const ImageModel& image_model,
+      const std::vector<ImageData>& observations,
+      const std::shared_ptr<const CompiledImageModel>& compiled_image_model);
+
+  int GetNumObservations() const {
+    return num_observations_;
+  }
 
   virtual double Compute(
       const double* estimated_image_data, double* gradient) const;
 
+  // If enabled, the term exploits that it is quadratic to make evaluations
+  // along a line almost free. Since A_k(x + a * d) = A_k x + a * A_k d, the
+  // cost and gradient at any point on a line follow from those at one point
+  // of the line and from H d, where H is the Hessian. The term caches these,
+  // and evaluates every estimate that lies on the cached line (e.g. every
+  // trial point of a line search, whichever solver runs it) with a few vector
+  // operations. Any other estimate starts a new line from the last evaluated
+  // point, which costs one application of the image model and its transpose.
+  // Disabled by default.
+  void SetUseLineSearchCache(const bool use_line_search_cache);
+
+  // Adds the diagonal of the Hessian 2 sum_k A_k'A_k, which is the same for
+  // every channel. It is exact with a compiled image model. Otherwise it is
+  // estimated as A_k'A_k 1 (the row sums of A_k'A_k), which bounds the
+  // diagonal from above for the nonnegative blur, warp and decimation
+  // operators and costs one application of the model and its transpose per
+  // observation.
+  virtual void AddHessianDiagonal(double* diagonal) const;
+
+  // The squared residual of every LR pixel is a local cost of the HR pixel at
+  // the top left corner of that LR pixel, so each local cost depends on the
+  // HR pixels within the footprint of the image model around it (the
+  // downsampling scale, blur radius and motion).
+  virtual bool AddLocalCosts(
+      const double* estimated_image_data, double* local_costs) const;
+
  private:
-  // The image model and observation information.
-  const ImageModel& image_model_;
-  const std::vector<ImageData>& observations_;
+  // The cost and gradient of the term at the cached point x, and the line
+  // x + a * d through it (see SetUseLineSearchCache()).
+  struct LineSearchCache {
+    // Returns the cost at x + step * d.
+    double GetCost(const double step) const {
+      return cost + step * slope + 0.5 * step * step * curvature;
+    }
+
+    bool has_point = false;
+    std::vector<double> point;
+    double cost = 0.0;
+    std::vector<double> gradient;
+
+    // The direction d, H d, g'd, d'Hd and d'd. Only valid if has_direction.
+    bool has_direction = false;
+    std::vector<double> direction;
+    std::vector<double> direction_gradient;
+    double slope = 0.0;
+    double curvature = 0.0;
+    double direction_squared_norm = 0.0;
+
+    // The step of the last evaluated point along the line.
+    double last_step = 0.0;
+
+    // The number of times the point was moved along a line since it was last
+    // evaluated in full.
+    int num_updates = 0;
+  };
+
+  // Adds A_k'y_k and ||y_k||^2 of the observation at the given index to the
+  // normal equation right hand sides.
+  void AddToNormalEquations(const int image_index);
+
+  // Computes the term using the line search cache.
+  double ComputeWithLineSearchCache(
+      const double* estimated_image_data, double* gradient) const;
+
+  // Computes the cost and gradient of the term by applying the image model.
+  // If subtract_observations is false, the observations are taken to be zero,
+  // which computes the homogeneous part sum_k s^2 ||A_k x||^2 of the term.
+  double ComputeTerm(
+      const double* estimated_image_data,
+      const bool subtract_observations,
+      double* gradient) const;
+
+  // The image model and observation information. These are replaced by
+  // AddObservations().
+  const ImageModel* image_model_;
+  std::shared_ptr<const CompiledImageModel> compiled_image_model_;
+  const std::vector<ImageData>* observations_;
+  int num_observations_;
   const int channel_start_;
   const int channel_end_;
   const cv::Size& image_size_;
+  const ImagePrecision precision_;
+
+  // Returns the LR observations that the residuals are computed against,
+  // which are restricted to the channel range and in the precision that the
+  // term is evaluated in.
+  const std::vector<ImageData>& GetObservations() const {
+    return copy_observation_channels_ ?
+        observation_channels_ : *observations_;
+  }
+
+  // The copies of the observations restricted to the channel range and
+  // converted to the evaluation precision. This is empty if the observations
+  // are used as given or encoded.
+  bool copy_observation_channels_ = false;
+  std::vector<ImageData> observation_channels_;
+
+  // The encoded observation channels, or null if the observations are not
+  // encoded. If set, the residuals are computed against these instead of
+  // the observation images.
+  std::shared_ptr<EncodedObservations> encoded_observations_;
+
+  // If the compiled image model has a normal matrix, these are b = sum_k
+  // A_k'y_k and y'y = sum_k ||y_k||^2 of every channel in the range.
+  // Otherwise they are empty.
+  std::vector<std::vector<double>> normal_right_hand_sides_;
+  std::vector<double> observation_squared_norms_;
+
+  // The memory of the normal equation right hand sides. The observation
+  // copies are recorded by the image allocator.
+  util::MemoryAccount normal_equations_memory_;
+
+  // The number of threads used to evaluate the observations, and the pool of
+  // additional threads used to do so. The pool is null if the term is
+  // computed serially. There are at most as many threads as observations, up
+  // to the requested number.
+  int max_num_threads_;
+  int num_threads_;
+  std::shared_ptr<util::ThreadPool> thread_pool_;
+
+  // The line search cache is updated by every evaluation, which is serialized
+  // by the mutex.
+  bool use_line_search_cache_ = false;
+  mutable LineSearchCache line_search_cache_;
+  mutable std::mutex line_search_cache_mutex_;
 };
 
 }  // namespace super_resolution
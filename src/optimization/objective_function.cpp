@@ -1,26 +1,224 @@
 #include "optimization/objective_function.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "optimization/objective_workspace.h"
+#include "util/memory_accounting.h"
+#include "util/thread_pool.h"
+
 namespace super_resolution {
 
+void ObjectiveFunction::SetNumThreads(const int num_threads) {
+  num_threads_ = util::GetNumThreadsToUse(num_threads);
+  thread_pool_.reset();
+  if (num_threads_ > 1) {
+    // The calling thread also evaluates terms, so it is not included.
+    thread_pool_.reset(new util::ThreadPool(num_threads_ - 1));
+  }
+}
+
 double ObjectiveFunction::ComputeAllTerms(
     const double* estimated_image_data, double* gradient) const {
 
   // Reset gradient to 0 (if applicable).
   if (gradient != nullptr) {
-    for (int i = 0; i < num_parameters_; ++i) {
+    for (int64_t i = 0; i < num_parameters_; ++i) {
       gradient[i] = 0.0;
     }
   }
 
+  if (thread_pool_ != nullptr && terms_.size() > 1) {
+    return ComputeAllTermsConcurrently(estimated_image_data, gradient);
+  }
+
+  if (telemetry_ == nullptr) {
+    double residual_sum = 0.0;
+    for (const std::shared_ptr<ObjectiveTerm> term : terms_) {
+      residual_sum += term->Compute(estimated_image_data, gradient);
+    }
+    if (gradient != nullptr) {
+      ZeroFrozenGradient(0, num_parameters_, gradient);
+    }
+    return residual_sum;
+  }
+
+  // Same as above, but every term is timed.
+  const SolverTelemetry::Clock::time_point start_time =
+      SolverTelemetry::Clock::now();
+  double residual_sum = 0.0;
+  for (int i = 0; i < terms_.size(); ++i) {
+    const SolverTelemetry::Clock::time_point term_start_time =
+        SolverTelemetry::Clock::now();
+    residual_sum += terms_[i]->Compute(estimated_image_data, gradient);
+    telemetry_->RecordTermEvaluation(
+        telemetry_solve_index_,
+        term_names_[i],
+        term_start_time,
+        SolverTelemetry::Clock::now());
+  }
+  double gradient_norm = -1.0;
+  if (gradient != nullptr) {
+    ZeroFrozenGradient(0, num_parameters_, gradient);
+    double gradient_squared_norm = 0.0;
+    for (int64_t i = 0; i < num_parameters_; ++i) {
+      gradient_squared_norm += gradient[i] * gradient[i];
+    }
+    gradient_norm = std::sqrt(gradient_squared_norm);
+  }
+  telemetry_->RecordObjectiveEvaluation(
+      telemetry_solve_index_,
+      start_time,
+      SolverTelemetry::Clock::now(),
+      gradient_norm);
+  return residual_sum;
+}
+
+double ObjectiveFunction::ComputeAllTermsConcurrently(
+    const double* estimated_image_data, double* gradient) const {
+
+  const SolverTelemetry::Clock::time_point start_time =
+      SolverTelemetry::Clock::now();
+  const int num_terms = terms_.size();
+
+  // The first term adds its gradient into the (zeroed) output gradient, and
+  // every other term into its own zeroed buffer.
+  std::vector<ObjectiveWorkspace::ScratchBuffer> term_gradients;
+  if (gradient != nullptr) {
+    term_gradients.reserve(num_terms - 1);
+    for (int i = 1; i < num_terms; ++i) {
+      term_gradients.push_back(workspace_->GetScratchBuffer(
+          num_parameters_, util::MEMORY_TAG_GRADIENTS));
+    }
+  }
+  std::vector<double> costs(num_terms, 0.0);
+  const auto compute_term = [&](const int i) {
+    const SolverTelemetry::Clock::time_point term_start_time =
+        SolverTelemetry::Clock::now();
+    double* term_gradient = nullptr;
+    if (gradient != nullptr) {
+      term_gradient = (i == 0) ? gradient : term_gradients[i - 1].GetData();
+      if (i > 0) {
+        std::fill(term_gradient, term_gradient + num_parameters_, 0.0);
+      }
+    }
+    costs[i] = terms_[i]->Compute(estimated_image_data, term_gradient);
+    if (telemetry_ != nullptr) {
+      telemetry_->RecordTermEvaluation(
+          telemetry_solve_index_,
+          term_names_[i],
+          term_start_time,
+          SolverTelemetry::Clock::now());
+    }
+  };
+  thread_pool_->ParallelFor(num_terms, compute_term);
+
   double residual_sum = 0.0;
-  for (const std::shared_ptr<ObjectiveTerm> term : terms_) {
-    residual_sum += term->Compute(estimated_image_data, gradient);
+  for (const double cost : costs) {
+    residual_sum += cost;
+  }
+  if (gradient == nullptr) {
+    if (telemetry_ != nullptr) {
+      telemetry_->RecordObjectiveEvaluation(
+          telemetry_solve_index_, start_time, SolverTelemetry::Clock::now(),
+          -1.0);
+    }
+    return residual_sum;
+  }
+
+  // Sum the term gradients in blocks, which also computes the gradient norm
+  // for the telemetry. The block sums are added in block order.
+  const int num_blocks = static_cast<int>(
+      std::min<int64_t>(num_threads_, std::max<int64_t>(num_parameters_, 1)));
+  std::vector<double> block_squared_norms(num_blocks, 0.0);
+  const auto reduce_block = [&](const int block) {
+    const int64_t start = block * num_parameters_ / num_blocks;
+    const int64_t end = (block + 1) * num_parameters_ / num_blocks;
+    for (const ObjectiveWorkspace::ScratchBuffer& term_gradient :
+         term_gradients) {
+      const double* term_gradient_data = term_gradient.GetData();
+      for (int64_t i = start; i < end; ++i) {
+        gradient[i] += term_gradient_data[i];
+      }
+    }
+    ZeroFrozenGradient(start, end, gradient);
+    if (telemetry_ != nullptr) {
+      double squared_norm = 0.0;
+      for (int64_t i = start; i < end; ++i) {
+        squared_norm += gradient[i] * gradient[i];
+      }
+      block_squared_norms[block] = squared_norm;
+    }
+  };
+  thread_pool_->ParallelFor(num_blocks, reduce_block);
+
+  if (telemetry_ != nullptr) {
+    double gradient_squared_norm = 0.0;
+    for (const double squared_norm : block_squared_norms) {
+      gradient_squared_norm += squared_norm;
+    }
+    telemetry_->RecordObjectiveEvaluation(
+        telemetry_solve_index_,
+        start_time,
+        SolverTelemetry::Clock::now(),
+        std::sqrt(gradient_squared_norm));
   }
   return residual_sum;
 }
 
-void ObjectiveFunction::ReportIterationComplete(const double residual_sum) {
+void ObjectiveFunction::ZeroFrozenGradient(
+    const int64_t start, const int64_t end, double* gradient) const {
+
+  if (frozen_parameters_ == nullptr) {
+    return;
+  }
+  const uint8_t* frozen_data = frozen_parameters_->data();
+  for (int64_t i = start; i < end; ++i) {
+    if (frozen_data[i] != 0) {
+      gradient[i] = 0.0;
+    }
+  }
+}
+
+void ObjectiveFunction::ComputeHessianDiagonal(double* diagonal) const {
+  for (int64_t i = 0; i < num_parameters_; ++i) {
+    diagonal[i] = 0.0;
+  }
+  for (const std::shared_ptr<ObjectiveTerm>& term : terms_) {
+    term->AddHessianDiagonal(diagonal);
+  }
+}
+
+bool ObjectiveFunction::ComputeLocalCosts(
+    const double* estimated_image_data, double* local_costs) const {
+
+  std::fill(local_costs, local_costs + num_parameters_, 0.0);
+  for (const std::shared_ptr<ObjectiveTerm>& term : terms_) {
+    if (!term->AddLocalCosts(estimated_image_data, local_costs)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ObjectiveFunction::ReportIterationComplete(
+    const double residual_sum,
+    const double gradient_norm,
+    const double* estimated_image_data) {
   num_iterations_completed_++;
+  if (telemetry_ != nullptr) {
+    telemetry_->RecordSolverIteration(
+        telemetry_solve_index_,
+        residual_sum,
+        gradient_norm,
+        workspace_->GetNumAllocations());
+  }
+  if (iteration_callback_ && estimated_image_data != nullptr) {
+    iteration_callback_(estimated_image_data);
+  }
 }
 
 }  // namespace super_resolution
@@ -7,9 +7,16 @@
 #ifndef SRC_OPTIMIZATION_OBJECTIVE_FUNCTION_H_
 #define SRC_OPTIMIZATION_OBJECTIVE_FUNCTION_H_
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "optimization/objective_workspace.h"
+#include "optimization/solver_telemetry.h"
+#include "util/thread_pool.h"
+
 namespace super_resolution {
 
 // An ObjectiveTerm computes the cost and gradient of a part of the objective
@@ -17,25 +24,122 @@ namespace super_resolution {
 // term may be the data fidelity term, or one of several regularization terms.
 class ObjectiveTerm {
  public:
+  // Each term starts out with its own workspace, which is replaced by the
+  // shared workspace of the ObjectiveFunction that the term is added to.
+  ObjectiveTerm() : workspace_(new ObjectiveWorkspace()) {}
+
+  virtual ~ObjectiveTerm() = default;
+
   // Compute the cost and gradient of this objective term. Each term must be
   // implemented as needed for that specific computation.
   //
   // NOTE: The gradient may be NULL (nullptr), in which case it is not computed.
   virtual double Compute(
       const double* estimated_image_data, double* gradient) const = 0;
+
+  // Adds an approximation of the diagonal of this term's Hessian (one value
+  // per parameter) to the given diagonal. The solvers use it as a diagonal
+  // preconditioner, so it only needs to capture the scale of the curvature of
+  // every parameter. The default implementation adds nothing.
+  virtual void AddHessianDiagonal(double* diagonal) const {}
+
+  // Adds the cost of this term split into local costs, one per parameter, to
+  // the given local costs. The local costs must add up to the cost returned
+  // by Compute(), and each of them may only depend on the parameters close to
+  // it in the image (see ComputeColoredNumericalGradient()). This must be
+  // safe to call concurrently. Returns false if the term cannot be split into
+  // local costs, which is the default.
+  virtual bool AddLocalCosts(
+      const double* estimated_image_data, double* local_costs) const {
+
+    return false;
+  }
+
+  // Called by ObjectiveFunction::SetFrozenParameters() with the mask of the
+  // parameters that stay fixed, or null if none do. Terms may then skip the
+  // work that only depends on frozen parameters and reuse its results from
+  // earlier evaluations, until this is called again. The default ignores the
+  // mask.
+  virtual void SetFrozenParameters(
+      const std::vector<uint8_t>* frozen_parameters) {}
+
+  // Sets the workspace that this term borrows its scratch buffers from.
+  void SetWorkspace(const std::shared_ptr<ObjectiveWorkspace> workspace) {
+    workspace_ = workspace;
+  }
+
+ protected:
+  // Returns the workspace for borrowing scratch buffers during Compute().
+  ObjectiveWorkspace* GetWorkspace() const {
+    return workspace_.get();
+  }
+
+ private:
+  std::shared_ptr<ObjectiveWorkspace> workspace_;
 };
 
 // The ObjectiveFunction is just a collection of ObjectiveTerms which are
 // computed independently.
 class ObjectiveFunction {
  public:
-  explicit ObjectiveFunction(const int num_parameters)
+  explicit ObjectiveFunction(const int64_t num_parameters)
       : num_parameters_(num_parameters),
-        num_iterations_completed_(0) {}
+        num_iterations_completed_(0),
+        workspace_(new ObjectiveWorkspace()) {}
 
-  // Add a new ObjectiveTerm to the list.
-  void AddTerm(const std::shared_ptr<ObjectiveTerm> objective_term) {
+  // Add a new ObjectiveTerm to the list. The term will borrow its scratch
+  // buffers from this ObjectiveFunction's workspace. The name identifies the
+  // term in the telemetry, and defaults to "term <index>".
+  void AddTerm(
+      const std::shared_ptr<ObjectiveTerm> objective_term,
+      const std::string& name = "") {
+    objective_term->SetWorkspace(workspace_);
+    if (frozen_parameters_ != nullptr) {
+      objective_term->SetFrozenParameters(frozen_parameters_);
+    }
     terms_.push_back(objective_term);
+    term_names_.push_back(
+        name.empty() ? "term " + std::to_string(terms_.size() - 1) : name);
+  }
+
+  // Reports the evaluations and iterations of this ObjectiveFunction to the
+  // given telemetry under the given solve index (see
+  // SolverTelemetry::BeginSolve()). Without a telemetry, nothing is timed.
+  void SetTelemetry(
+      const std::shared_ptr<SolverTelemetry> telemetry,
+      const int telemetry_solve_index) {
+    telemetry_ = telemetry;
+    telemetry_solve_index_ = telemetry_solve_index;
+  }
+
+  // Evaluates up to the given number of terms concurrently in every call to
+  // ComputeAllTerms(), e.g. the regularizers while the data term runs. Each
+  // term after the first one then computes its gradient into its own
+  // workspace buffer, and the buffers are summed into the gradient in
+  // parallel blocks afterwards. The costs are always summed in term order,
+  // so the results do not depend on the number of threads. Set to 0 to use
+  // all available hardware threads. By default, the terms are evaluated one
+  // after another into the same gradient. The terms must be safe to evaluate
+  // concurrently. Copies of this ObjectiveFunction share the threads.
+  void SetNumThreads(const int num_threads);
+
+  // Keeps the parameters whose mask value is nonzero fixed: ComputeAllTerms()
+  // sets their gradient values to zero, so the solvers only move the other
+  // parameters. Their costs are still included. The mask must have one value
+  // per parameter and is referenced, so it must outlive the evaluations.
+  // Copies of this ObjectiveFunction reference the same mask. Pass nullptr to
+  // free all parameters again.
+  //
+  // The mask is also passed on to the terms (see
+  // ObjectiveTerm::SetFrozenParameters()), which may cache the parts of their
+  // cost that only depend on frozen parameters. This must therefore be called
+  // again after changing the mask, the values of the frozen parameters, or
+  // anything else that the cost of a term depends on (such as IRLS weights).
+  void SetFrozenParameters(const std::vector<uint8_t>* frozen_parameters) {
+    frozen_parameters_ = frozen_parameters;
+    for (const std::shared_ptr<ObjectiveTerm>& term : terms_) {
+      term->SetFrozenParameters(frozen_parameters);
+    }
   }
 
   // Computes all terms and returns the sum of the residual costs and the sum
@@ -43,13 +147,44 @@ class ObjectiveFunction {
   double ComputeAllTerms(
       const double* estimated_image_data, double* gradient = nullptr) const;
 
+  // Computes the sum of the Hessian diagonal approximations of all terms (see
+  // ObjectiveTerm::AddHessianDiagonal()) into the given diagonal, which must
+  // have room for every parameter.
+  void ComputeHessianDiagonal(double* diagonal) const;
+
+  // Computes the sum of the local costs of all terms (see
+  // ObjectiveTerm::AddLocalCosts()) into the given local costs, which must
+  // have room for every parameter. Returns false if any term does not
+  // support local costs, in which case the local costs are incomplete.
+  bool ComputeLocalCosts(
+      const double* estimated_image_data, double* local_costs) const;
+
+  // Returns the number of parameters of the objective.
+  int64_t GetNumParameters() const {
+    return num_parameters_;
+  }
+
+  // Calls the given function with the new estimate after every solver
+  // iteration that is reported with its estimate (see
+  // ReportIterationComplete()), e.g. to stream intermediate results. It runs
+  // on the solver thread, so it should return quickly. Copies of this
+  // ObjectiveFunction call the same function.
+  void SetIterationCallback(
+      const std::function<void(const double* estimated_image_data)>&
+          iteration_callback) {
+    iteration_callback_ = iteration_callback;
+  }
+
   // Callback to report that a solver iteration was complete, allowing the
   // ObjectiveFunction to track progress and statistics about the solver's
-  // progress. This is optional.
-  //
-  // TODO: Do some more advanced tracking of the solver progress, like
-  // visualizing a graph of the cost, etc.
-  void ReportIterationComplete(const double residual_sum);
+  // progress. This is optional. The gradient norm at the new estimate is
+  // recorded in the telemetry if given (non-negative); otherwise the norm of
+  // the last evaluated gradient is recorded. If the new estimate is given, it
+  // is passed to the iteration callback.
+  void ReportIterationComplete(
+      const double residual_sum,
+      const double gradient_norm = -1.0,
+      const double* estimated_image_data = nullptr);
 
   // Returns the number of iterations that were completed by the solver. This
   // only works if the solver reports its progress after every iteration by
@@ -58,17 +193,59 @@ class ObjectiveFunction {
     return num_iterations_completed_;
   }
 
+  // Returns the number of terms that were added.
+  int GetNumTerms() const {
+    return terms_.size();
+  }
+
+  // Returns the workspace shared by all terms. Copies of this
+  // ObjectiveFunction share the same workspace, so buffers persist across the
+  // whole solve.
+  const ObjectiveWorkspace& GetWorkspace() const {
+    return *workspace_;
+  }
+
  private:
+  // Evaluates the terms concurrently (see SetNumThreads()) and returns the
+  // sum of their costs. The telemetry records the evaluation time of every
+  // term, which overlaps with the other terms.
+  double ComputeAllTermsConcurrently(
+      const double* estimated_image_data, double* gradient) const;
+
+  // Sets the gradient values of the frozen parameters in [start, end) to zero
+  // (see SetFrozenParameters()).
+  void ZeroFrozenGradient(
+      const int64_t start, const int64_t end, double* gradient) const;
+
   // The number of parameters in the given estimated_image_data. This is also
   // the number of variables in the gradient vector.
-  const int num_parameters_;
+  const int64_t num_parameters_;
 
   // Independent terms of the ObjectiveFunction. The costs and gradients of all
   // terms are added together for the final cost/gradient produced.
   std::vector<std::shared_ptr<ObjectiveTerm>> terms_;
+  std::vector<std::string> term_names_;
 
   // The number of iterations performed. Updated with ReportIterationComplete().
   int num_iterations_completed_;
+
+  // Scratch buffers shared by all terms.
+  std::shared_ptr<ObjectiveWorkspace> workspace_;
+
+  // The number of terms evaluated concurrently, and the pool of additional
+  // threads. The pool is null if the terms are evaluated one after another.
+  int num_threads_ = 1;
+  std::shared_ptr<util::ThreadPool> thread_pool_;
+
+  // Optional mask of parameters whose gradient is set to zero.
+  const std::vector<uint8_t>* frozen_parameters_ = nullptr;
+
+  // Optional (see SetIterationCallback()).
+  std::function<void(const double*)> iteration_callback_;
+
+  // Optional. Copies of this ObjectiveFunction report to the same telemetry.
+  std::shared_ptr<SolverTelemetry> telemetry_;
+  int telemetry_solve_index_ = 0;
 };
 
 }  // namespace super_resolution
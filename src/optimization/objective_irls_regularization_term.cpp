@@ -1,8 +1,11 @@
 #include "optimization/objective_irls_regularization_term.h"
 
-#include <utility>
+#include <cstdint>
 #include <vector>
 
+#include "optimization/objective_workspace.h"
+#include "util/memory_accounting.h"
+
 #include "glog/logging.h"
 
 namespace super_resolution {
@@ -13,48 +16,190 @@ double ObjectiveIRLSRegularizationTerm::Compute(
   CHECK_NOTNULL(estimated_image_data);
 
   // Don't compute anything if the regularization parameter is 0.
+  has_last_residuals_ = false;
   if (regularization_parameter_ <= 0.0) {
     return 0.0;
   }
 
-  double residual_sum = 0.0;
+  if (!active_rows_.empty()) {
+    return ComputeActiveRows(estimated_image_data, gradient);
+  }
 
-  // Precompute the constant terms in the gradients at each pixel. This is
-  // the regularization parameter (lambda) and the IRLS weights.
-  // TODO: if gradient == nullptr, no need to compute the constants.
-  const int num_pixels = image_size_.width * image_size_.height;
-  const int num_data_points = num_pixels * num_channels_;
-  std::vector<double> gradient_constants;
-  gradient_constants.reserve(num_data_points);
-  for (int i = 0; i < num_data_points; ++i) {
-    gradient_constants.push_back(
-        regularization_parameter_ * irls_weights_.at(i));
-  }
-
-  // Compute the residuals and squared residual sum.
-  // TODO: just ApplyToImage if gradient == nullptr.
-  const std::pair<std::vector<double>, std::vector<double>>&
-  values_and_partials = regularizer_->ApplyToImageWithDifferentiation(
-          estimated_image_data, gradient_constants, num_channels_);
-
-  // The values are the regularizer values at each pixel and the partials are
-  // the sum of partial derivatives at each pixel.
-  const std::vector<double>& values = values_and_partials.first;
-  const std::vector<double>& partials = values_and_partials.second;
-
-  for (int i = 0; i < num_data_points; ++i) {
-    const double residual = values[i];
-    const double weight = irls_weights_.at(i);
+  const int64_t num_pixels =
+      static_cast<int64_t>(image_size_.width) * image_size_.height;
+  const int64_t num_data_points = num_pixels * num_channels_;
+  ObjectiveWorkspace* workspace = GetWorkspace();
+  ObjectiveWorkspace::ScratchBuffer values_buffer =
+      workspace->GetScratchBuffer(
+          num_data_points, util::MEMORY_TAG_REGULARIZER);
 
-    residual_sum += regularization_parameter_ * weight * residual * residual;
-    // TODO: this still computes the gradient, just use ApplyToImage if
-    // gradient is nullptr.
-    if (gradient != nullptr) {
-      gradient[i] += partials[i];
+  // Regularizers that evaluate rows return the cost summed by rows, with or
+  // without the gradient, so the cost-only evaluations agree exactly with the
+  // gradient evaluations. The row costs are also borrowed from the workspace.
+  if (regularizer_->CanEvaluateRows()) {
+    CHECK_GE(irls_weights_.size(), num_data_points) << "Missing IRLS weights.";
+    ObjectiveWorkspace::ScratchBuffer row_costs_buffer =
+        workspace->GetScratchBuffer(
+            image_size_.height, util::MEMORY_TAG_REGULARIZER);
+    const double residual_sum = regularizer_->AccumulateWeightedGradientInRows(
+        estimated_image_data,
+        num_channels_,
+        regularization_parameter_,
+        irls_weights_.data(),
+        nullptr,
+        gradient,
+        values_buffer.GetData(),
+        row_costs_buffer.GetData());
+    KeepResiduals(values_buffer.GetVector());
+    return residual_sum;
+  }
+
+  // If only the cost is needed, just evaluate the regularizer without any of
+  // the gradient work. This is the case for numerical differentiation and
+  // cost-only evaluations by the solvers.
+  if (gradient == nullptr) {
+    regularizer_->ApplyToImage(
+        estimated_image_data, num_channels_, values_buffer.GetVector());
+    const double residual_sum =
+        ComputeWeightedResidualSum(*values_buffer.GetVector());
+    KeepResiduals(values_buffer.GetVector());
+    return residual_sum;
+  }
+
+  // Otherwise the regularizer adds the weighted gradient directly into the
+  // solver's gradient and returns the weighted cost in a single pass. The
+  // values are always written into the workspace buffer, even if they are not
+  // kept, so the regularizer never allocates its own residual buffer.
+  CHECK_GE(irls_weights_.size(), num_data_points) << "Missing IRLS weights.";
+  const double residual_sum = regularizer_->AccumulateWeightedGradient(
+      estimated_image_data,
+      num_channels_,
+      regularization_parameter_,
+      irls_weights_.data(),
+      gradient,
+      values_buffer.GetData());
+  KeepResiduals(values_buffer.GetVector());
+  return residual_sum;
+}
+
+void ObjectiveIRLSRegularizationTerm::SetFrozenParameters(
+    const std::vector<uint8_t>* frozen_parameters) {
+
+  has_row_cache_ = false;
+  active_rows_.clear();
+  if (frozen_parameters == nullptr || !regularizer_->CanEvaluateRows()) {
+    return;
+  }
+  const int width = image_size_.width;
+  const int height = image_size_.height;
+  const int64_t num_pixels = static_cast<int64_t>(width) * height;
+  CHECK_EQ(frozen_parameters->size(), num_pixels * num_channels_)
+      << "Need one mask value per parameter.";
+  active_rows_.assign(height, 0);
+  for (int channel = 0; channel < num_channels_; ++channel) {
+    for (int row = 0; row < height; ++row) {
+      const uint8_t* row_mask = frozen_parameters->data() +
+          channel * num_pixels + static_cast<int64_t>(row) * width;
+      for (int col = 0; col < width && active_rows_[row] == 0; ++col) {
+        active_rows_[row] = (row_mask[col] == 0);
+      }
     }
   }
+}
+
+double ObjectiveIRLSRegularizationTerm::ComputeActiveRows(
+    const double* estimated_image_data, double* gradient) const {
 
+  const int64_t num_data_points =
+      static_cast<int64_t>(image_size_.width) * image_size_.height *
+      num_channels_;
+  CHECK_GE(irls_weights_.size(), num_data_points) << "Missing IRLS weights.";
+  if (!has_row_cache_) {
+    last_residuals_.resize(num_data_points);
+    row_costs_.resize(image_size_.height);
+  }
+  const double residual_sum = regularizer_->AccumulateWeightedGradientInRows(
+      estimated_image_data,
+      num_channels_,
+      regularization_parameter_,
+      irls_weights_.data(),
+      has_row_cache_ ? &active_rows_ : nullptr,
+      gradient,
+      last_residuals_.data(),
+      row_costs_.data());
+  has_row_cache_ = true;
+  has_last_residuals_ = keep_last_residuals_;
   return residual_sum;
 }
 
+void ObjectiveIRLSRegularizationTerm::AddHessianDiagonal(
+    double* diagonal) const {
+
+  CHECK_NOTNULL(diagonal);
+  if (regularization_parameter_ <= 0.0) {
+    return;
+  }
+
+  const int64_t num_data_points =
+      static_cast<int64_t>(image_size_.width) * image_size_.height *
+      num_channels_;
+  ObjectiveWorkspace::ScratchBuffer gradient_constants_buffer =
+      GetWorkspace()->GetScratchBuffer(
+          num_data_points, util::MEMORY_TAG_REGULARIZER);
+  std::vector<double>& gradient_constants =
+      *gradient_constants_buffer.GetVector();
+  for (int64_t i = 0; i < num_data_points; ++i) {
+    gradient_constants[i] = regularization_parameter_ * irls_weights_.at(i);
+  }
+  regularizer_->AddWeightedHessianDiagonal(
+      gradient_constants, num_channels_, diagonal);
+}
+
+bool ObjectiveIRLSRegularizationTerm::AddLocalCosts(
+    const double* estimated_image_data, double* local_costs) const {
+
+  CHECK_NOTNULL(estimated_image_data);
+  CHECK_NOTNULL(local_costs);
+  if (regularization_parameter_ <= 0.0) {
+    return true;
+  }
+
+  // The values are not borrowed from the workspace, since this may be called
+  // concurrently with other evaluations.
+  const std::vector<double> values =
+      regularizer_->ApplyToImage(estimated_image_data, num_channels_);
+  const int64_t num_data_points = values.size();
+  for (int64_t i = 0; i < num_data_points; ++i) {
+    local_costs[i] +=
+        regularization_parameter_ * irls_weights_.at(i) * values[i] * values[i];
+  }
+  return true;
+}
+
+double ObjectiveIRLSRegularizationTerm::ComputeWeightedResidualSum(
+    const std::vector<double>& values) const {
+
+  // The values are the regularizer values at each pixel.
+  const int64_t num_data_points = values.size();
+  double residual_sum = 0.0;
+  for (int64_t i = 0; i < num_data_points; ++i) {
+    const double residual = values[i];
+    const double weight = irls_weights_.at(i);
+    residual_sum += regularization_parameter_ * weight * residual * residual;
+  }
+  return residual_sum;
+}
+
+void ObjectiveIRLSRegularizationTerm::KeepResiduals(
+    std::vector<double>* values) const {
+
+  if (!keep_last_residuals_) {
+    return;
+  }
+  // Swapping hands the previous values back to the workspace instead of
+  // copying, so keeping the values costs no extra pass over the image.
+  last_residuals_.swap(*values);
+  has_last_residuals_ = true;
+}
+
 }  // namespace super_resolution
@@ -6,6 +6,7 @@
 #ifndef SRC_OPTIMIZATION_OBJECTIVE_IRLS_REGULARIZATION_TERM_H_
 #define SRC_OPTIMIZATION_OBJECTIVE_IRLS_REGULARIZATION_TERM_H_
 
+#include <cstdint>
 #include <vector>
 
 #include "optimization/objective_function.h"
@@ -19,6 +20,10 @@ class ObjectiveIRLSRegularizationTerm : public ObjectiveTerm {
  public:
   // Here num_channels is the number of channels in the image being optimized
   // for.
+  //
+  // The IRLS weights are referenced, not copied, so they must outlive this
+  // term. The weights can be updated in place between evaluations, which lets
+  // the same term be reused for every IRLS iteration.
   ObjectiveIRLSRegularizationTerm(
       const std::shared_ptr<Regularizer> regularizer,
       const double regularization_parameter,
@@ -31,15 +36,81 @@ class ObjectiveIRLSRegularizationTerm : public ObjectiveTerm {
       num_channels_(num_channels),
       image_size_(image_size) {}
 
+  // If gradient is nullptr, only the regularizer values are computed, which
+  // skips all of the gradient work.
   virtual double Compute(
       const double* estimated_image_data, double* gradient) const;
 
+  // Adds the Hessian diagonal of the regularizer's weighted least squares
+  // problem at the current IRLS weights (see
+  // Regularizer::AddWeightedHessianDiagonal()).
+  virtual void AddHessianDiagonal(double* diagonal) const;
+
+  // If the regularizer can evaluate individual rows (see
+  // Regularizer::CanEvaluateRows()), the rows that contain a parameter that
+  // is not frozen are active. The first evaluation after this call evaluates
+  // the whole image, and the following ones only the rows that reach an
+  // active row, reusing the values and costs of all other rows.
+  virtual void SetFrozenParameters(
+      const std::vector<uint8_t>* frozen_parameters);
+
+  // The local cost of each pixel is its weighted squared regularizer value,
+  // which only depends on the pixels that the regularizer compares it to.
+  virtual bool AddLocalCosts(
+      const double* estimated_image_data, double* local_costs) const;
+
+  // If enabled, the regularizer values of every evaluation are kept by the
+  // term until the next evaluation (their workspace buffer is swapped with
+  // the kept one, so nothing is copied). The IRLS loop then updates the
+  // weights from the values of the final evaluation of a solve instead of
+  // evaluating the regularizer again. This is disabled by default.
+  void SetKeepLastResiduals(const bool keep_last_residuals) {
+    keep_last_residuals_ = keep_last_residuals;
+  }
+
+  // Returns the regularizer values computed by the last evaluation, or null
+  // if they were not kept (see SetKeepLastResiduals()) or nothing was
+  // evaluated yet. The caller has to know which estimate they belong to (see
+  // NativeSolver::IsSolutionLastEvaluated()), and must not call this while
+  // the term is being evaluated.
+  const std::vector<double>* GetLastResiduals() const {
+    return has_last_residuals_ ? &last_residuals_ : nullptr;
+  }
+
  private:
+  // Returns the sum of the squared regularizer values, each multiplied by the
+  // regularization parameter and its IRLS weight.
+  double ComputeWeightedResidualSum(const std::vector<double>& values) const;
+
+  // Keeps the given regularizer values as the last residuals if enabled, by
+  // swapping them with the previously kept values.
+  void KeepResiduals(std::vector<double>* values) const;
+
+  // Evaluates the rows that reach the active rows, and reuses the values and
+  // costs of the others from the previous evaluation (see
+  // SetFrozenParameters()).
+  double ComputeActiveRows(
+      const double* estimated_image_data, double* gradient) const;
+
   const std::shared_ptr<Regularizer> regularizer_;
   const double regularization_parameter_;
   const std::vector<double>& irls_weights_;
   const int num_channels_;
   const cv::Size& image_size_;
+
+  // The regularizer values of the last evaluation, if they are kept.
+  bool keep_last_residuals_ = false;
+  mutable bool has_last_residuals_ = false;
+  mutable std::vector<double> last_residuals_;
+
+  // One value per image row, which is nonzero if the row has a parameter that
+  // is not frozen, or empty if the rows are not evaluated individually. The
+  // values of every row are cached in last_residuals_ (whether or not they
+  // are kept) and their weighted costs in row_costs_ once has_row_cache_ is
+  // set.
+  std::vector<uint8_t> active_rows_;
+  mutable bool has_row_cache_ = false;
+  mutable std::vector<double> row_costs_;
 };
 
 }  // namespace super_resolution
@@ -0,0 +1,86 @@
+#include "optimization/objective_workspace.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "util/memory_accounting.h"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+
+ObjectiveWorkspace::ScratchBuffer::ScratchBuffer(
+    ObjectiveWorkspace* workspace,
+    std::unique_ptr<PooledBuffer> buffer)
+    : workspace_(workspace), buffer_(std::move(buffer)) {}
+
+ObjectiveWorkspace::ScratchBuffer::ScratchBuffer(ScratchBuffer&& other)
+    : workspace_(other.workspace_), buffer_(std::move(other.buffer_)) {
+  other.workspace_ = nullptr;
+}
+
+ObjectiveWorkspace::ScratchBuffer::~ScratchBuffer() {
+  if (workspace_ != nullptr && buffer_ != nullptr) {
+    workspace_->ReturnBuffer(std::move(buffer_));
+  }
+}
+
+ObjectiveWorkspace::ScratchBuffer ObjectiveWorkspace::GetScratchBuffer(
+    const int64_t size, const util::MemoryTag memory_tag) {
+
+  CHECK_GE(size, 0) << "Buffer size cannot be negative.";
+
+  std::unique_ptr<PooledBuffer> buffer;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // Find the smallest free buffer that fits the requested size. If none of
+    // them fit, the largest one is grown instead.
+    int best_index = -1;
+    for (int i = 0; i < free_buffers_.size(); ++i) {
+      const int64_t capacity = free_buffers_[i]->values.capacity();
+      if (best_index < 0) {
+        best_index = i;
+        continue;
+      }
+      const int64_t best_capacity =
+          free_buffers_[best_index]->values.capacity();
+      const bool fits = capacity >= size;
+      const bool best_fits = best_capacity >= size;
+      if ((fits && (!best_fits || capacity < best_capacity)) ||
+          (!fits && !best_fits && capacity > best_capacity)) {
+        best_index = i;
+      }
+    }
+
+    if (best_index >= 0) {
+      buffer = std::move(free_buffers_[best_index]);
+      free_buffers_.erase(free_buffers_.begin() + best_index);
+    } else {
+      buffer.reset(new PooledBuffer());
+    }
+    if (static_cast<int64_t>(buffer->values.capacity()) < size) {
+      num_allocations_++;
+    }
+  }
+
+  buffer->values.resize(size);
+  buffer->memory.Set(memory_tag, util::GetBufferBytes(buffer->values));
+  return ScratchBuffer(this, std::move(buffer));
+}
+
+int ObjectiveWorkspace::GetNumAllocations() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return num_allocations_;
+}
+
+void ObjectiveWorkspace::ReturnBuffer(std::unique_ptr<PooledBuffer> buffer) {
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  free_buffers_.push_back(std::move(buffer));
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,99 @@
+// The ObjectiveWorkspace is a pool of reusable scratch buffers for objective
+// terms. Solvers evaluate the objective function hundreds of times, and most
+// terms need several temporary buffers the size of the full image for each
+// evaluation. Borrowing these buffers from a workspace that persists for the
+// whole solve means that they are only allocated once, during the first
+// evaluation, instead of on every evaluation. The memory of every buffer is
+// recorded under the memory tag of the term that last borrowed it (see
+// util/memory_accounting.h).
+
+#ifndef SRC_OPTIMIZATION_OBJECTIVE_WORKSPACE_H_
+#define SRC_OPTIMIZATION_OBJECTIVE_WORKSPACE_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "util/memory_accounting.h"
+
+namespace super_resolution {
+
+class ObjectiveWorkspace {
+ private:
+  // A pooled buffer and the account of its memory.
+  struct PooledBuffer {
+    std::vector<double> values;
+    util::MemoryAccount memory;
+  };
+
+ public:
+  // A buffer borrowed from the workspace. The buffer is returned to the
+  // workspace automatically when this object goes out of scope, so it should
+  // only be kept for the duration of a single objective evaluation.
+  class ScratchBuffer {
+   public:
+    ScratchBuffer(ScratchBuffer&& other);
+    ~ScratchBuffer();
+
+    // Returns the underlying vector. Resizing it within its capacity does not
+    // allocate any memory.
+    std::vector<double>* GetVector() const {
+      return &buffer_->values;
+    }
+
+    // Returns a pointer to the buffer data.
+    double* GetData() const {
+      return buffer_->values.data();
+    }
+
+   private:
+    friend class ObjectiveWorkspace;
+
+    ScratchBuffer(
+        ObjectiveWorkspace* workspace,
+        std::unique_ptr<PooledBuffer> buffer);
+
+    ScratchBuffer(const ScratchBuffer&) = delete;
+    ScratchBuffer& operator=(const ScratchBuffer&) = delete;
+
+    ObjectiveWorkspace* workspace_;
+    std::unique_ptr<PooledBuffer> buffer_;
+  };
+
+  ObjectiveWorkspace() : num_allocations_(0) {}
+
+  // Returns a buffer of the given size. The contents of the buffer are not
+  // initialized, and may contain values from a previous use. If a free buffer
+  // with sufficient capacity exists, it is reused without allocating memory.
+  //
+  // The memory of the buffer is recorded under the given tag while it is
+  // borrowed and until another borrower changes it.
+  //
+  // This is thread safe, so terms evaluated in parallel can share the same
+  // workspace.
+  ScratchBuffer GetScratchBuffer(
+      const int64_t size,
+      const util::MemoryTag memory_tag = util::MEMORY_TAG_OTHER);
+
+  // Returns the number of times that the workspace had to allocate (or grow)
+  // a buffer. Once every buffer needed by an evaluation has been allocated,
+  // this number does not change for repeated evaluations of the same size.
+  int GetNumAllocations() const;
+
+ private:
+  // Puts the buffer back into the pool of free buffers.
+  void ReturnBuffer(std::unique_ptr<PooledBuffer> buffer);
+
+  // Buffers that are not currently borrowed.
+  std::vector<std::unique_ptr<PooledBuffer>> free_buffers_;
+
+  int num_allocations_;
+
+  // Protects free_buffers_ and num_allocations_.
+  mutable std::mutex mutex_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_OBJECTIVE_WORKSPACE_H_
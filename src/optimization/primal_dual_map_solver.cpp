@@ -0,0 +1,324 @@
+#include "optimization/primal_dual_map_solver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "optimization/objective_data_term.h"
+#include "optimization/regularizer.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// The dual variables of a single regularizer, one per difference operator per
+// data point. The dual of lambda * ||Gx||_1 is constrained to [-lambda,
+// lambda].
+struct DualRegularizer {
+  std::shared_ptr<Regularizer> regularizer;
+  double regularization_parameter;
+  std::vector<double> dual;
+
+  // Scratch buffer for the differences Gx.
+  std::vector<double> differences;
+};
+
+double DotProduct(const std::vector<double>& a, const std::vector<double>& b) {
+  double dot_product = 0.0;
+  for (int64_t i = 0; i < a.size(); ++i) {
+    dot_product += a[i] * b[i];
+  }
+  return dot_product;
+}
+
+// Estimates the largest eigenvalue of a symmetric positive semi-definite
+// linear operator with power iteration. The operator writes the product with
+// the first argument into the second.
+double EstimateLargestEigenvalue(
+    const std::function<void(
+        const std::vector<double>&, std::vector<double>*)>& apply_operator,
+    const int64_t size,
+    const int num_iterations) {
+
+  // Start from a non-constant vector, since constant images are in the null
+  // space of difference operators.
+  std::vector<double> vector(size);
+  for (int64_t i = 0; i < size; ++i) {
+    vector[i] = std::cos(1.3 * i) + 0.5;
+  }
+  double norm = std::sqrt(DotProduct(vector, vector));
+  std::vector<double> product(size);
+  double eigenvalue = 0.0;
+  for (int iteration = 0; iteration < num_iterations; ++iteration) {
+    for (double& value : vector) {
+      value /= norm;
+    }
+    apply_operator(vector, &product);
+    norm = std::sqrt(DotProduct(product, product));
+    eigenvalue = norm;
+    if (norm <= 0.0) {
+      break;
+    }
+    vector.swap(product);
+  }
+  return eigenvalue;
+}
+
+}  // namespace
+
+void PrimalDualMapSolverOptions::PrintSolverOptions() const {
+  std::cout << "PrimalDualMapSolver Options" << std::endl;
+  std::cout << "  Objective:                           "
+            << "maximum a posteriori" << std::endl;
+  std::cout << "  Optimization strategy:               "
+            << "primal-dual (Chambolle-Pock)" << std::endl;
+  std::cout << "  Number of threads:                   "
+            << num_threads << std::endl;
+  std::cout << "  Max number of iterations:            "
+            << max_num_primal_dual_iterations << std::endl;
+  std::cout << "  Relative change threshold:           "
+            << relative_change_threshold << std::endl;
+  std::cout << "  Step size scale:                     "
+            << step_size_scale << std::endl;
+}
+
+PrimalDualMapSolver::PrimalDualMapSolver(
+    const PrimalDualMapSolverOptions& solver_options,
+    const ImageModel& image_model,
+    const std::vector<ImageData>& low_res_images,
+    const bool print_solver_output)
+    : MapSolver(image_model, low_res_images, print_solver_output),
+      solver_options_(solver_options) {}
+
+PrimalDualMapSolver::PrimalDualMapSolver(
+    const PrimalDualMapSolverOptions& solver_options,
+    const ImageModel& image_model,
+    const std::shared_ptr<const SharedSolverInputs>& inputs,
+    const bool print_solver_output)
+    : MapSolver(image_model, inputs, print_solver_output),
+      solver_options_(solver_options) {}
+
+ImageData PrimalDualMapSolver::Solve(const ImageData& initial_estimate) {
+  const int64_t num_pixels = GetNumPixels();
+  const int num_channels = GetNumChannels();
+  const int64_t num_data_points = GetNumDataPoints();
+  const cv::Size image_size = GetImageSize();
+  CHECK_EQ(initial_estimate.GetNumPixels(), num_pixels);
+  CHECK_EQ(initial_estimate.GetNumChannels(), num_channels);
+  CHECK_EQ(initial_estimate.GetImageSize(), image_size);
+  CHECK(solver_options_.step_size_scale > 0.0 &&
+        solver_options_.step_size_scale < 1.0)
+      << "The step size scale must be in (0, 1).";
+
+  if (IsVerbose()) {
+    solver_options_.PrintSolverOptions();
+  }
+
+  const ObjectiveDataTerm data_term(
+      *image_model_,
+      GetObservations(),
+      0,
+      num_channels,
+      image_size,
+      solver_options_.num_threads,
+      solver_options_.use_single_precision ?
+          SINGLE_PRECISION : DOUBLE_PRECISION,
+      GetCompiledImageModel(solver_options_));
+
+  // The per-pixel updates are split into one contiguous block per thread.
+  // The function is called with the block index and the block's index range
+  // [start, end).
+  const int num_blocks = static_cast<int>(std::min<int64_t>(
+      util::GetNumThreadsToUse(solver_options_.num_threads), num_data_points));
+  std::unique_ptr<util::ThreadPool> thread_pool;
+  if (num_blocks > 1) {
+    thread_pool.reset(new util::ThreadPool(num_blocks - 1));
+  }
+  const auto run_over_blocks = [&](
+      const int64_t size,
+      const std::function<void(
+          const int, const int64_t, const int64_t)>& function) {
+    if (thread_pool == nullptr) {
+      function(0, 0, size);
+      return;
+    }
+    thread_pool->ParallelFor(num_blocks, [&](const int block_index) {
+      function(
+          block_index,
+          block_index * size / num_blocks,
+          (block_index + 1) * size / num_blocks);
+    });
+  };
+
+  std::vector<double> estimate(num_data_points);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const double* channel_ptr = initial_estimate.GetChannelData(channel);
+    std::copy(
+        channel_ptr,
+        channel_ptr + num_pixels,
+        estimate.begin() + channel * num_pixels);
+  }
+
+  std::vector<DualRegularizer> dual_regularizers;
+  for (const auto& regularizer_and_parameter : regularizers_) {
+    if (regularizer_and_parameter.second <= 0.0) {
+      continue;
+    }
+    const int num_operators =
+        regularizer_and_parameter.first->GetNumDifferenceOperators();
+    CHECK_GT(num_operators, 0)
+        << "The primal-dual solver only supports regularizers that are "
+        << "defined by difference operators.";
+    DualRegularizer dual_regularizer;
+    dual_regularizer.regularizer = regularizer_and_parameter.first;
+    dual_regularizer.regularization_parameter =
+        regularizer_and_parameter.second;
+    dual_regularizer.dual.assign(num_operators * num_data_points, 0.0);
+    dual_regularizer.differences.resize(num_operators * num_data_points);
+    dual_regularizers.push_back(std::move(dual_regularizer));
+  }
+
+  // The data term is quadratic, so its Hessian is constant and the product
+  // with a vector v is grad(v) - grad(0). Its largest eigenvalue is the
+  // Lipschitz constant of the data term gradient.
+  std::vector<double> data_gradient_at_zero(num_data_points, 0.0);
+  const std::vector<double> zeros(num_data_points, 0.0);
+  data_term.Compute(zeros.data(), data_gradient_at_zero.data());
+  const double data_lipschitz_constant = EstimateLargestEigenvalue(
+      [&](const std::vector<double>& vector, std::vector<double>* product) {
+        std::fill(product->begin(), product->end(), 0.0);
+        data_term.Compute(vector.data(), product->data());
+        for (int64_t i = 0; i < num_data_points; ++i) {
+          (*product)[i] -= data_gradient_at_zero[i];
+        }
+      },
+      num_data_points,
+      solver_options_.num_power_iterations);
+
+  // The squared norm of all stacked difference operators is at most the sum
+  // of the squared norms of each regularizer's operators.
+  double operator_squared_norm = 0.0;
+  for (DualRegularizer& dual_regularizer : dual_regularizers) {
+    operator_squared_norm += EstimateLargestEigenvalue(
+        [&](const std::vector<double>& vector, std::vector<double>* product) {
+          dual_regularizer.regularizer->ApplyDifferenceOperators(
+              vector.data(), num_channels,
+              dual_regularizer.differences.data());
+          dual_regularizer.regularizer->ApplyDifferenceOperatorsTranspose(
+              dual_regularizer.differences.data(), num_channels,
+              product->data());
+        },
+        num_data_points,
+        solver_options_.num_power_iterations);
+  }
+  const double operator_norm = std::sqrt(operator_squared_norm);
+
+  // Convergence requires tau * (L / 2 + sigma * ||G||^2) < 1. Choosing
+  // sigma = 1 / ||G|| balances the primal and dual steps.
+  CHECK_GT(data_lipschitz_constant + operator_norm, 0.0)
+      << "The objective is constant.";
+  const double primal_step_size = solver_options_.step_size_scale /
+      (data_lipschitz_constant / 2.0 + operator_norm);
+  const double dual_step_size =
+      (operator_norm > 0.0) ? (1.0 / operator_norm) : 0.0;
+  LOG(INFO) << "Primal-dual step sizes are " << primal_step_size
+            << " (primal) and " << dual_step_size << " (dual).";
+
+  std::vector<double> gradient(num_data_points);
+  std::vector<double> transpose_buffer(num_data_points);
+  std::vector<double> extrapolated_estimate(num_data_points);
+  int num_iterations_ran = 0;
+  double relative_change = 0.0;
+  while (num_iterations_ran < solver_options_.max_num_primal_dual_iterations) {
+    // Primal step: gradient descent on the data term plus G^T y.
+    std::fill(gradient.begin(), gradient.end(), 0.0);
+    data_term.Compute(estimate.data(), gradient.data());
+    for (const DualRegularizer& dual_regularizer : dual_regularizers) {
+      dual_regularizer.regularizer->ApplyDifferenceOperatorsTranspose(
+          dual_regularizer.dual.data(), num_channels, transpose_buffer.data());
+      run_over_blocks(
+          num_data_points,
+          [&](const int block_index, const int64_t start, const int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+          gradient[i] += transpose_buffer[i];
+        }
+      });
+    }
+
+    // The next estimate is written into the extrapolated estimate buffer,
+    // which is then extrapolated in place to 2 * x_new - x.
+    std::vector<double> block_change(num_blocks, 0.0);
+    std::vector<double> block_norm(num_blocks, 0.0);
+    run_over_blocks(
+        num_data_points,
+        [&](const int block_index, const int64_t start, const int64_t end) {
+      double change = 0.0;
+      double norm = 0.0;
+      for (int64_t i = start; i < end; ++i) {
+        const double step = primal_step_size * gradient[i];
+        const double new_value = estimate[i] - step;
+        extrapolated_estimate[i] = new_value - step;
+        estimate[i] = new_value;
+        change += step * step;
+        norm += new_value * new_value;
+      }
+      block_change[block_index] = change;
+      block_norm[block_index] = norm;
+    });
+    double change_squared_norm = 0.0;
+    double estimate_squared_norm = 0.0;
+    for (int block_index = 0; block_index < num_blocks; ++block_index) {
+      change_squared_norm += block_change[block_index];
+      estimate_squared_norm += block_norm[block_index];
+    }
+
+    // Dual step: y = clip(y + sigma * G(2 * x_new - x), lambda).
+    for (DualRegularizer& dual_regularizer : dual_regularizers) {
+      dual_regularizer.regularizer->ApplyDifferenceOperators(
+          extrapolated_estimate.data(),
+          num_channels,
+          dual_regularizer.differences.data());
+      const double bound = dual_regularizer.regularization_parameter;
+      std::vector<double>& dual = dual_regularizer.dual;
+      const std::vector<double>& differences = dual_regularizer.differences;
+      run_over_blocks(
+          dual.size(),
+          [&](const int block_index, const int64_t start, const int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+          const double value = dual[i] + dual_step_size * differences[i];
+          dual[i] = std::max(-bound, std::min(bound, value));
+        }
+      });
+    }
+
+    num_iterations_ran++;
+    relative_change = std::sqrt(
+        change_squared_norm / std::max(estimate_squared_norm, 1.0e-20));
+    if (relative_change < solver_options_.relative_change_threshold) {
+      break;
+    }
+  }
+  LOG(INFO) << "Primal-dual solver finished after " << num_iterations_ran
+            << " iterations with a relative change of " << relative_change
+            << ".";
+
+  ImageData estimated_image;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    estimated_image.AddChannel(
+        estimate.data() + channel * num_pixels, image_size);
+  }
+  return estimated_image;
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,76 @@
+// A first-order primal-dual implementation of the MAP objective formulation,
+// based on the Chambolle-Pock algorithm in the form of Condat (2013) and Vu
+// (2013), which allows a smooth data term. The objective
+//
+//   ||Ax - y||_2^2 + lambda * ||Gx||_1
+//
+// is minimized with explicit gradient steps on the data term and dual
+// projection steps on the regularizer's difference operators G (see
+// Regularizer::GetNumDifferenceOperators()). There are no nested solver loops
+// and no reweighting, so every iteration has the same fixed cost: one data
+// term gradient and one application of G and its transpose.
+
+#ifndef SRC_OPTIMIZATION_PRIMAL_DUAL_MAP_SOLVER_H_
+#define SRC_OPTIMIZATION_PRIMAL_DUAL_MAP_SOLVER_H_
+
+#include <memory>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "optimization/map_solver.h"
+
+namespace super_resolution {
+
+struct PrimalDualMapSolverOptions : public MapSolverOptions {
+  PrimalDualMapSolverOptions() {}  // Required for making a const instance.
+
+  // Print also includes specific primal-dual parameters.
+  virtual void PrintSolverOptions() const;
+
+  // Maximum number of primal-dual iterations.
+  int max_num_primal_dual_iterations = 500;
+
+  // The solver stops when the relative change of the estimate in one
+  // iteration, ||x_new - x|| / ||x||, falls below this threshold.
+  double relative_change_threshold = 1.0e-5;
+
+  // The step sizes are derived from the norms of the data term Hessian and
+  // the difference operators, which are estimated with this many power
+  // iterations.
+  int num_power_iterations = 20;
+
+  // Scales the step sizes below the largest values that guarantee
+  // convergence, which leaves some margin for the norm estimates. Must be in
+  // (0, 1).
+  double step_size_scale = 0.9;
+};
+
+class PrimalDualMapSolver : public MapSolver {
+ public:
+  PrimalDualMapSolver(
+      const PrimalDualMapSolverOptions& solver_options,
+      const ImageModel& image_model,
+      const std::vector<ImageData>& low_res_images,
+      const bool print_solver_output = true);
+
+  // Same as above, but shares the observations (and the compiled image
+  // model) with other solvers instead of copying them.
+  PrimalDualMapSolver(
+      const PrimalDualMapSolverOptions& solver_options,
+      const ImageModel& image_model,
+      const std::shared_ptr<const SharedSolverInputs>& inputs,
+      const bool print_solver_output = true);
+
+  // The primal-dual solver implementation. All channels are solved together.
+  // Every regularizer must be defined by difference operators.
+  virtual ImageData Solve(const ImageData& initial_estimate);
+
+ private:
+  // Passed in through the constructor.
+  const PrimalDualMapSolverOptions solver_options_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_PRIMAL_DUAL_MAP_SOLVER_H_
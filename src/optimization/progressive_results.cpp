@@ -0,0 +1,157 @@
+#include "optimization/progressive_results.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "image/image_data.h"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+
+ProgressiveResults::ProgressiveResults(
+    const int iteration_interval,
+    const double time_interval_seconds,
+    const Callback& callback)
+    : iteration_interval_(iteration_interval),
+      time_interval_seconds_(time_interval_seconds),
+      callback_(callback) {
+
+  CHECK(iteration_interval > 0 || time_interval_seconds > 0.0)
+      << "Progressive results need an iteration or a time interval.";
+  CHECK(callback) << "Progressive results need a callback.";
+}
+
+ProgressiveResults::~ProgressiveResults() {
+  Finish();
+}
+
+void ProgressiveResults::Start(const ImageData& initial_estimate) {
+  Finish();
+  CHECK_EQ(initial_estimate.GetPrecision(), DOUBLE_PRECISION)
+      << "Progressive results are streamed in double precision.";
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  image_size_ = initial_estimate.GetImageSize();
+  num_channels_ = initial_estimate.GetNumChannels();
+  const int num_pixels = initial_estimate.GetNumPixels();
+  snapshot_buffer_.resize(static_cast<size_t>(num_pixels) * num_channels_);
+  for (int channel = 0; channel < num_channels_; ++channel) {
+    const double* channel_data = initial_estimate.GetChannelData(channel);
+    std::copy(
+        channel_data,
+        channel_data + num_pixels,
+        snapshot_buffer_.data() + static_cast<size_t>(num_pixels) * channel);
+  }
+
+  start_time_ = std::chrono::steady_clock::now();
+  last_snapshot_time_ = start_time_;
+  num_iterations_ = 0;
+  last_snapshot_iteration_ = 0;
+  is_snapshot_pending_ = false;
+  stop_requested_ = false;
+  is_running_ = true;
+  delivery_thread_ = std::thread(&ProgressiveResults::DeliverSnapshots, this);
+}
+
+void ProgressiveResults::ReportIteration(
+    const double* estimate_data,
+    const int channel_start,
+    const int channel_end) {
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!is_running_) {
+    return;
+  }
+  const int num_iterations = ++num_iterations_;
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  const bool is_iteration_due = iteration_interval_ > 0 &&
+      num_iterations - last_snapshot_iteration_ >= iteration_interval_;
+  const bool is_time_due = time_interval_seconds_ > 0.0 &&
+      std::chrono::duration<double>(now - last_snapshot_time_).count() >=
+          time_interval_seconds_;
+  if (!is_iteration_due && !is_time_due) {
+    return;
+  }
+
+  CopyChannels(estimate_data, channel_start, channel_end);
+  last_snapshot_iteration_ = num_iterations;
+  last_snapshot_time_ = now;
+  pending_snapshot_.num_iterations = num_iterations;
+  pending_snapshot_.elapsed_seconds =
+      std::chrono::duration<double>(now - start_time_).count();
+  is_snapshot_pending_ = true;
+  lock.unlock();
+  snapshot_condition_.notify_one();
+}
+
+void ProgressiveResults::UpdateChannels(
+    const double* estimate_data,
+    const int channel_start,
+    const int channel_end) {
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (is_running_) {
+    CopyChannels(estimate_data, channel_start, channel_end);
+  }
+}
+
+void ProgressiveResults::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!is_running_) {
+      return;
+    }
+    is_running_ = false;
+    stop_requested_ = true;
+  }
+  snapshot_condition_.notify_one();
+  delivery_thread_.join();
+}
+
+int ProgressiveResults::GetNumDeliveredSnapshots() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_delivered_snapshots_;
+}
+
+void ProgressiveResults::DeliverSnapshots() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    snapshot_condition_.wait(lock, [this]() {
+      return is_snapshot_pending_ || stop_requested_;
+    });
+    if (!is_snapshot_pending_) {
+      return;
+    }
+    ProgressiveSnapshot snapshot = pending_snapshot_;
+    snapshot.index = num_delivered_snapshots_++;
+    is_snapshot_pending_ = false;
+    // The image is copied while holding the lock, but the callback runs
+    // without it, so the solver can take the next snapshot meanwhile.
+    const ImageData estimate(
+        snapshot_buffer_.data(), image_size_, num_channels_);
+    lock.unlock();
+    callback_(estimate, snapshot);
+    lock.lock();
+  }
+}
+
+void ProgressiveResults::CopyChannels(
+    const double* estimate_data,
+    const int channel_start,
+    const int channel_end) {
+
+  CHECK(0 <= channel_start && channel_start <= channel_end &&
+        channel_end <= num_channels_) << "Invalid channel range.";
+  const size_t num_pixels =
+      static_cast<size_t>(image_size_.width) * image_size_.height;
+  std::copy(
+      estimate_data,
+      estimate_data + num_pixels * (channel_end - channel_start),
+      snapshot_buffer_.data() + num_pixels * channel_start);
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,141 @@
+// ProgressiveResults streams intermediate estimates of a long solve, so that
+// downstream consumers can start working with a preview early and operators
+// can cancel runs that are already good enough. The solver reports its
+// estimate after every iteration, and every iteration_interval iterations or
+// time_interval_seconds seconds (whichever comes first) the estimate is copied
+// into a snapshot buffer. A background thread turns the latest snapshot into
+// an image and passes it to the callback (e.g. to save it to disk), so the
+// solver never waits for the callback. If the callback is slower than the
+// snapshots are taken, the snapshots that it had no time for are skipped and
+// only the latest one is delivered.
+//
+// The estimate of a solve with channel splits is assembled from the latest
+// snapshot of every split, and splits that have not started yet contribute
+// their initial estimate. Use as follows:
+//   std::shared_ptr<ProgressiveResults> progressive_results(
+//       new ProgressiveResults(10, 60.0, callback));
+//   solver_options.progressive_results = progressive_results;
+//   ... = solver.Solve(initial_estimate);
+
+#ifndef SRC_OPTIMIZATION_PROGRESSIVE_RESULTS_H_
+#define SRC_OPTIMIZATION_PROGRESSIVE_RESULTS_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "image/image_data.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+// Describes a snapshot passed to the ProgressiveResults callback.
+struct ProgressiveSnapshot {
+  // The number of snapshots delivered before this one, including those of
+  // earlier streams (see ProgressiveResults::Start()).
+  int index = 0;
+
+  // The number of solver iterations reported up to this snapshot, counting
+  // all channel splits.
+  int num_iterations = 0;
+
+  // The time since Start() at which the snapshot was taken.
+  double elapsed_seconds = 0.0;
+};
+
+class ProgressiveResults {
+ public:
+  using Callback = std::function<void(
+      const ImageData& estimate, const ProgressiveSnapshot& snapshot)>;
+
+  // A snapshot is taken once iteration_interval iterations were reported
+  // since the last one, or once time_interval_seconds seconds passed since
+  // the last one (or since Start()). Either interval is ignored if it is not
+  // positive, but at least one of them must be. The callback is called on
+  // the background thread, one snapshot at a time.
+  ProgressiveResults(
+      const int iteration_interval,
+      const double time_interval_seconds,
+      const Callback& callback);
+
+  // Finishes the stream if it is still running.
+  ~ProgressiveResults();
+
+  // Starts a new stream from the given initial estimate, which must be in
+  // double precision, and starts the background thread. Any running stream
+  // is finished first. The snapshot indices continue from the earlier
+  // streams, e.g. over the levels of a coarse-to-fine solve.
+  void Start(const ImageData& initial_estimate);
+
+  // Reports that a solver iteration is complete with the given estimate of
+  // the channels [channel_start, channel_end), stored one channel after the
+  // other. If a snapshot is due, the channels are copied into the snapshot
+  // buffer and the background thread is woken up. The buffer is only locked
+  // while it is copied, never while the callback runs. This is safe to call
+  // concurrently for different channel ranges.
+  void ReportIteration(
+      const double* estimate_data,
+      const int channel_start,
+      const int channel_end);
+
+  // Copies the given channels into the snapshot buffer without taking a
+  // snapshot, e.g. the final estimate of a channel split, so that later
+  // snapshots include it.
+  void UpdateChannels(
+      const double* estimate_data,
+      const int channel_start,
+      const int channel_end);
+
+  // Delivers the pending snapshot (if any) and stops the background thread.
+  // Nothing is reported after this until Start() is called again.
+  void Finish();
+
+  // Returns the number of snapshots delivered in all streams so far.
+  int GetNumDeliveredSnapshots() const;
+
+ private:
+  // Runs on the background thread: waits for snapshots and delivers them.
+  void DeliverSnapshots();
+
+  // Copies the channels into the snapshot buffer. The mutex must be held.
+  void CopyChannels(
+      const double* estimate_data,
+      const int channel_start,
+      const int channel_end);
+
+  const int iteration_interval_;
+  const double time_interval_seconds_;
+  const Callback callback_;
+
+  // Guards everything below.
+  mutable std::mutex mutex_;
+  std::condition_variable snapshot_condition_;
+
+  // The latest estimate of all channels, and its layout.
+  std::vector<double> snapshot_buffer_;
+  cv::Size image_size_;
+  int num_channels_ = 0;
+
+  // The counters that decide when the next snapshot is due.
+  std::chrono::steady_clock::time_point start_time_;
+  std::chrono::steady_clock::time_point last_snapshot_time_;
+  int num_iterations_ = 0;
+  int last_snapshot_iteration_ = 0;
+
+  // The snapshot waiting for the background thread, if any.
+  bool is_snapshot_pending_ = false;
+  ProgressiveSnapshot pending_snapshot_;
+  int num_delivered_snapshots_ = 0;
+
+  bool is_running_ = false;
+  bool stop_requested_ = false;
+  std::thread delivery_thread_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_PROGRESSIVE_RESULTS_H_
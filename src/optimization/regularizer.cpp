@@ -0,0 +1,106 @@
+#include "optimization/regularizer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+
+void Regularizer::ApplyToImage(
+    const double* image_data,
+    const int num_channels,
+    std::vector<double>* residuals) const {
+
+  CHECK_NOTNULL(residuals);
+
+  const std::vector<double> values = ApplyToImage(image_data, num_channels);
+  residuals->assign(values.begin(), values.end());
+}
+
+void Regularizer::ApplyToImageWithDifferentiation(
+    const double* image_data,
+    const std::vector<double>& gradient_constants,
+    const int num_channels,
+    std::vector<double>* residuals,
+    std::vector<double>* gradient) const {
+
+  CHECK_NOTNULL(residuals);
+  CHECK_NOTNULL(gradient);
+
+  const std::pair<std::vector<double>, std::vector<double>>&
+  values_and_partials = ApplyToImageWithDifferentiation(
+      image_data, gradient_constants, num_channels);
+  residuals->assign(
+      values_and_partials.first.begin(), values_and_partials.first.end());
+  gradient->assign(
+      values_and_partials.second.begin(), values_and_partials.second.end());
+}
+
+double Regularizer::AccumulateWeightedGradient(
+    const double* image_data,
+    const int num_channels,
+    const double regularization_parameter,
+    const double* weights,
+    double* gradient,
+    double* residuals) const {
+
+  CHECK_NOTNULL(weights);
+  CHECK_NOTNULL(gradient);
+
+  const int64_t num_data_points =
+      static_cast<int64_t>(image_size_.width) * image_size_.height *
+      num_channels;
+  std::vector<double> gradient_constants(num_data_points);
+  for (int64_t i = 0; i < num_data_points; ++i) {
+    gradient_constants[i] = regularization_parameter * weights[i];
+  }
+  std::vector<double> values;
+  std::vector<double> partials;
+  ApplyToImageWithDifferentiation(
+      image_data, gradient_constants, num_channels, &values, &partials);
+
+  double cost = 0.0;
+  for (int64_t i = 0; i < num_data_points; ++i) {
+    gradient[i] += partials[i];
+    cost += gradient_constants[i] * values[i] * values[i];
+  }
+  if (residuals != nullptr) {
+    std::copy(values.begin(), values.end(), residuals);
+  }
+  return cost;
+}
+
+double Regularizer::AccumulateWeightedGradientInRows(
+    const double* image_data,
+    const int num_channels,
+    const double regularization_parameter,
+    const double* weights,
+    const std::vector<uint8_t>* active_rows,
+    double* gradient,
+    double* residuals,
+    double* row_costs) const {
+
+  LOG(FATAL) << "This regularizer cannot evaluate individual rows.";
+  return 0.0;
+}
+
+void Regularizer::ApplyDifferenceOperators(
+    const double* image_data,
+    const int num_channels,
+    double* differences) const {
+
+  LOG(FATAL) << "This regularizer does not have difference operators.";
+}
+
+void Regularizer::ApplyDifferenceOperatorsTranspose(
+    const double* differences,
+    const int num_channels,
+    double* image_data) const {
+
+  LOG(FATAL) << "This regularizer does not have difference operators.";
+}
+
+}  // namespace super_resolution
@@ -3,6 +3,8 @@
 #ifndef SRC_OPTIMIZATION_REGULARIZER_H_
 #define SRC_OPTIMIZATION_REGULARIZER_H_
 
+#include <cstdint>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -44,6 +46,144 @@ class Regularizer {
       const std::vector<double>& gradient_constants,
       const int num_channels) const = 0;
 
+  // Same as ApplyToImage, but the values are written into the given residuals
+  // vector, which is resized to the number of parameters. This allows the
+  // caller to reuse buffers between evaluations, since no memory is allocated
+  // if the vector capacity is already large enough.
+  //
+  // The default implementation just copies the result of ApplyToImage.
+  virtual void ApplyToImage(
+      const double* image_data,
+      const int num_channels,
+      std::vector<double>* residuals) const;
+
+  // Same as ApplyToImageWithDifferentiation, but writes the residuals and the
+  // gradient into the given vectors, which are resized as needed.
+  //
+  // The default implementation just copies the result of
+  // ApplyToImageWithDifferentiation.
+  virtual void ApplyToImageWithDifferentiation(
+      const double* image_data,
+      const std::vector<double>& gradient_constants,
+      const int num_channels,
+      std::vector<double>* residuals,
+      std::vector<double>* gradient) const;
+
+  // Fused evaluation of the weighted least squares regularization cost
+  //   regularization_parameter * sum_i w_i r_i^2
+  // where r_i are the values returned by ApplyToImage and w_i are the given
+  // weights (one per pixel of every channel). The gradient of this cost is
+  // added directly to the given gradient, which is not cleared first, and the
+  // cost is returned. This replaces building the gradient constants,
+  // differentiating into separate buffers and accumulating them afterwards.
+  //
+  // If residuals is not null, the values r_i are also written into it, which
+  // must have space for all of them. Callers that evaluate repeatedly should
+  // pass a reused buffer even if they don't need the values, since otherwise
+  // the regularizer may have to allocate a buffer for them on every call.
+  //
+  // The default implementation does exactly the above using
+  // ApplyToImageWithDifferentiation, so it only saves work for regularizers
+  // that override it.
+  virtual double AccumulateWeightedGradient(
+      const double* image_data,
+      const int num_channels,
+      const double regularization_parameter,
+      const double* weights,
+      double* gradient,
+      double* residuals) const;
+
+  // Returns true if the regularizer can evaluate a subset of the image rows
+  // (see AccumulateWeightedGradientInRows()). The default is false.
+  virtual bool CanEvaluateRows() const {
+    return false;
+  }
+
+  // Same as AccumulateWeightedGradient, but only evaluates the rows that can
+  // have changed since an earlier evaluation: the rows with a nonzero value in
+  // active_rows (one value per image row) and the rows whose values depend on
+  // them. The values r_i of all other rows, and their costs sum_i w_i r_i^2
+  // (one per row, summed over the channels, without the regularization
+  // parameter), are read from residuals and row_costs. These must hold them
+  // from an earlier call with the same weights and the same pixels outside of
+  // the active rows, and receive the values and costs of the evaluated rows.
+  // If active_rows is null, every row is evaluated, which fills both for the
+  // following calls. The gradient may be null, and is only complete for the
+  // pixels of the active rows; the pixels of other rows may receive part of
+  // their gradient.
+  //
+  // The default implementation check fails, since rows cannot be evaluated.
+  virtual double AccumulateWeightedGradientInRows(
+      const double* image_data,
+      const int num_channels,
+      const double regularization_parameter,
+      const double* weights,
+      const std::vector<uint8_t>* active_rows,
+      double* gradient,
+      double* residuals,
+      double* row_costs) const;
+
+  // Some regularizers are defined as a sum of absolute values of linear
+  // difference operators G_k applied to the image. That is, the value at each
+  // pixel i is
+  //   r_i = sum_k |(G_k x)_i|.
+  // Exposing these operators allows splitting solvers (such as ADMM) to
+  // minimize the 1-norm of the regularizer directly instead of reweighting a
+  // least squares problem.
+  //
+  // Returns the number of difference operators, or 0 if this regularizer is
+  // not defined in terms of difference operators (the default).
+  virtual int GetNumDifferenceOperators() const {
+    return 0;
+  }
+
+  // Applies every difference operator to the given image. The differences
+  // array must have space for GetNumDifferenceOperators() * num_data_points
+  // values, and the result of operator k is stored at offset
+  // k * num_data_points.
+  //
+  // The default implementation check fails, since there are no operators.
+  virtual void ApplyDifferenceOperators(
+      const double* image_data,
+      const int num_channels,
+      double* differences) const;
+
+  // Applies the transpose of every difference operator to the given
+  // differences (laid out as above) and writes the sum of the results into
+  // image_data, which is overwritten.
+  //
+  // The default implementation check fails, since there are no operators.
+  virtual void ApplyDifferenceOperatorsTranspose(
+      const double* differences,
+      const int num_channels,
+      double* image_data) const;
+
+  // Adds the diagonal of the Hessian of the quadratic
+  //   sum_i c_i sum_k (G_k x)_i^2
+  // to the given diagonal (of num_channels * num_pixels values), where the
+  // c_i are the given gradient constants and G_k are the difference
+  // operators. This is the weighted least squares problem that IRLS solves
+  // in every iteration if the differences at each pixel are uncorrelated, so
+  // it approximates the Hessian diagonal of the IRLS regularization term
+  // without depending on the signs of the differences. It is used to
+  // precondition the least squares solvers.
+  //
+  // The default implementation adds nothing, in which case only the other
+  // objective terms precondition the solver.
+  virtual void AddWeightedHessianDiagonal(
+      const std::vector<double>& gradient_constants,
+      const int num_channels,
+      double* diagonal) const {}
+
+  // Returns the same regularizer for images of the given coarser size, or
+  // null if it cannot be applied to another size, which is the default. The
+  // multigrid solver uses it to rediscretize the regularization terms on its
+  // coarse grids.
+  virtual std::shared_ptr<Regularizer> CreateCoarseRegularizer(
+      const cv::Size& coarse_image_size) const {
+    return nullptr;
+  }
+
  protected:
   // The size of the image to be regularized.
   const cv::Size image_size_;
@@ -4,6 +4,7 @@
 #ifndef SRC_OPTIMIZATION_SOLVER_H_
 #define SRC_OPTIMIZATION_SOLVER_H_
 
+#include <memory>
 #include <vector>
 
 #include "image/image_data.h"
@@ -13,8 +14,11 @@ namespace super_resolution {
 
 class Solver {
  public:
+  // The solver keeps its own copy of the image model, which shares the
+  // operators of the given model.
   explicit Solver(const ImageModel& image_model, const bool verbose = true)
-      : image_model_(image_model), is_verbose_(verbose) {}
+      : image_model_(std::make_shared<const ImageModel>(image_model)),
+        is_verbose_(verbose) {}
 
   // Solves the super-resolution optimization and returns the super-resolved
   // image. The given initial estimate is used as a starting point for
@@ -33,8 +37,15 @@ class Solver {
     return is_verbose_;
   }
 
+  // Returns the image model of the solver.
+  const ImageModel& GetImageModel() const {
+    return *image_model_;
+  }
+
  protected:
-  const ImageModel& image_model_;
+  // The solver's image model. Solvers that add frames replace it with an
+  // extended model (see MapSolver::AddObservation()).
+  std::shared_ptr<const ImageModel> image_model_;
 
   // If set to false (true is the default), the solver should not print any
   // output (after or even during iterations) so that it runs silently. This
@@ -0,0 +1,112 @@
+#include "optimization/solver_deadline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+
+int GetNumAffordableIterations(
+    const double remaining_seconds,
+    const double seconds_per_iteration,
+    const int max_num_iterations) {
+
+  if (remaining_seconds <= 0.0) {
+    return 0;
+  }
+  if (seconds_per_iteration <= 0.0) {
+    return max_num_iterations;
+  }
+  const double num_iterations =
+      std::floor(remaining_seconds / seconds_per_iteration);
+  if (max_num_iterations > 0 && num_iterations >= max_num_iterations) {
+    return max_num_iterations;
+  }
+  return static_cast<int>(std::min(
+      num_iterations,
+      static_cast<double>(std::numeric_limits<int>::max())));
+}
+
+SolverDeadline::SolverDeadline(const double budget_seconds)
+    : SolverDeadline(budget_seconds, std::make_shared<StageRecords>()) {}
+
+SolverDeadline::SolverDeadline(
+    const double budget_seconds,
+    const std::shared_ptr<StageRecords>& stage_records)
+    : budget_seconds_(budget_seconds),
+      start_time_(Clock::now()),
+      deadline_(start_time_ + std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(std::max(budget_seconds, 0.0)))),
+      stage_records_(stage_records) {
+
+  CHECK_GE(budget_seconds, 0.0) << "The time budget cannot be negative.";
+}
+
+std::shared_ptr<SolverDeadline> SolverDeadline::CreateShare(
+    const double share) const {
+
+  CHECK(share >= 0.0 && share <= 1.0) << "The share must be in [0, 1].";
+  return std::shared_ptr<SolverDeadline>(
+      new SolverDeadline(GetRemainingSeconds() * share, stage_records_));
+}
+
+double SolverDeadline::GetRemainingSeconds() const {
+  const std::chrono::duration<double> remaining_time =
+      deadline_ - Clock::now();
+  return std::max(remaining_time.count(), 0.0);
+}
+
+double SolverDeadline::GetElapsedSeconds() const {
+  const std::chrono::duration<double> elapsed_time =
+      Clock::now() - start_time_;
+  return elapsed_time.count();
+}
+
+void SolverDeadline::RecordStage(
+    const std::string& name, const Clock::time_point start_time) {
+
+  const std::chrono::duration<double> stage_time = Clock::now() - start_time;
+  std::lock_guard<std::mutex> lock(stage_records_->mutex);
+  std::vector<SolverDeadlineStage>& stages = stage_records_->stages;
+  auto stage = std::find_if(
+      stages.begin(), stages.end(),
+      [&name](const SolverDeadlineStage& stage) {
+        return stage.name == name;
+      });
+  if (stage == stages.end()) {
+    stages.push_back(SolverDeadlineStage());
+    stages.back().name = name;
+    stage = stages.end() - 1;
+  }
+  stage->seconds += stage_time.count();
+}
+
+std::vector<SolverDeadlineStage> SolverDeadline::GetStages() const {
+  std::lock_guard<std::mutex> lock(stage_records_->mutex);
+  return stage_records_->stages;
+}
+
+std::string SolverDeadline::GetReport() const {
+  std::ostringstream report;
+  report << "Time budget: " << budget_seconds_ << " seconds, "
+         << GetElapsedSeconds() << " seconds elapsed." << std::endl;
+  for (const SolverDeadlineStage& stage : GetStages()) {
+    report << "  " << stage.name << ": " << stage.seconds << " seconds";
+    if (budget_seconds_ > 0.0) {
+      report << " (" << (100.0 * stage.seconds / budget_seconds_)
+             << "% of the budget)";
+    }
+    report << std::endl;
+  }
+  return report.str();
+}
+
+}  // namespace super_resolution
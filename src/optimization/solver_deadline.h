@@ -0,0 +1,97 @@
+// A SolverDeadline is a wall-clock budget for a solve that is shared by all of
+// its parts: the channel splits and tiles that are solved one after another
+// or concurrently, and the IRLS iterations of every split. Each part gets its
+// own share of the remaining time when it starts (see CreateShare()), so the
+// parts that start late are not left without time, and every part stops
+// early enough to return its estimate at its share's deadline. The time spent
+// in every stage of the solve (e.g. the least squares solves or the IRLS
+// reweighting) is recorded to see where the budget went. Use as follows:
+//   std::shared_ptr<SolverDeadline> deadline(new SolverDeadline(60.0));
+//   solver_options.deadline = deadline;
+//   ... = solver.Solve(initial_estimate);
+//   std::cout << deadline->GetReport();
+
+#ifndef SRC_OPTIMIZATION_SOLVER_DEADLINE_H_
+#define SRC_OPTIMIZATION_SOLVER_DEADLINE_H_
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace super_resolution {
+
+// The time that a stage of the solve used. Stages of concurrent parts of the
+// solve are added up, so their total can exceed the elapsed time.
+struct SolverDeadlineStage {
+  std::string name;
+  double seconds = 0.0;
+};
+
+// Returns the number of solver iterations that fit into the remaining time,
+// at most max_num_iterations (unless that is 0, which means no limit). It is
+// 0 if not even a single iteration fits.
+int GetNumAffordableIterations(
+    const double remaining_seconds,
+    const double seconds_per_iteration,
+    const int max_num_iterations);
+
+class SolverDeadline {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Starts a budget of the given number of seconds now.
+  explicit SolverDeadline(const double budget_seconds);
+
+  // Returns a deadline for a part of the remaining work that should take the
+  // given share (in [0, 1]) of the remaining time, starting now. It records
+  // its stages into this deadline, and never ends after it.
+  std::shared_ptr<SolverDeadline> CreateShare(const double share) const;
+
+  // Returns the seconds left until the deadline, which is 0 once it passed.
+  double GetRemainingSeconds() const;
+
+  bool IsExpired() const {
+    return GetRemainingSeconds() <= 0.0;
+  }
+
+  // Returns the budget of this deadline, and the time since it started.
+  double GetBudgetSeconds() const {
+    return budget_seconds_;
+  }
+  double GetElapsedSeconds() const;
+
+  // Adds the time between the given start time and now to the named stage.
+  // This is safe to call concurrently.
+  void RecordStage(const std::string& name, const Clock::time_point start_time);
+
+  // Returns the time used by every stage, in the order that the stages were
+  // first recorded. Shares record into the deadline that they were created
+  // from, so the stages of all parts are found there.
+  std::vector<SolverDeadlineStage> GetStages() const;
+
+  // Returns a printable report of the time used by every stage and its
+  // percentage of the budget.
+  std::string GetReport() const;
+
+ private:
+  // The stages are shared with the deadlines that this one was created from.
+  struct StageRecords {
+    std::mutex mutex;
+    std::vector<SolverDeadlineStage> stages;
+  };
+
+  SolverDeadline(
+      const double budget_seconds,
+      const std::shared_ptr<StageRecords>& stage_records);
+
+  const double budget_seconds_;
+  const Clock::time_point start_time_;
+  const Clock::time_point deadline_;
+  const std::shared_ptr<StageRecords> stage_records_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_SOLVER_DEADLINE_H_
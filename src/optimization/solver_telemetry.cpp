@@ -0,0 +1,355 @@
+#include "optimization/solver_telemetry.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "util/memory_accounting.h"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// Writes the value as a JSON number. JSON cannot represent infinite values
+// (e.g. the cost difference of the first IRLS iteration), so they are null.
+std::string FormatJsonNumber(const double value) {
+  if (!std::isfinite(value)) {
+    return "null";
+  }
+  std::ostringstream stream;
+  stream << std::setprecision(std::numeric_limits<double>::max_digits10)
+         << value;
+  return stream.str();
+}
+
+// Returns the string as a quoted JSON string.
+std::string FormatJsonString(const std::string& value) {
+  std::string quoted = "\"";
+  for (const char character : value) {
+    if (character == '"' || character == '\\') {
+      quoted += '\\';
+    }
+    quoted += character;
+  }
+  return quoted + "\"";
+}
+
+// Returns the memory usage as the members of a JSON object.
+std::string FormatJsonMemoryUsage(const util::MemoryUsage& usage) {
+  std::ostringstream json;
+  json << "\"current_bytes\": " << usage.current_bytes << ", "
+       << "\"peak_bytes\": " << usage.peak_bytes << ", "
+       << "\"num_allocations\": " << usage.num_allocations;
+  return json.str();
+}
+
+// Writes the given contents to the file, logging an error on failure.
+bool WriteStringToFile(
+    const std::string& contents, const std::string& file_path) {
+  std::ofstream file(file_path);
+  if (!file.is_open()) {
+    LOG(ERROR) << "Could not open file " << file_path << " for writing.";
+    return false;
+  }
+  file << contents;
+  if (!file.good()) {
+    LOG(ERROR) << "Could not write telemetry to file " << file_path << ".";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+SolverTelemetry::SolverTelemetry(const bool record_trace_events)
+    : record_trace_events_(record_trace_events),
+      creation_time_(Clock::now()) {}
+
+int SolverTelemetry::BeginSolve(
+    const int channel_start, const int channel_end) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  SolveTelemetry solve;
+  solve.channel_start = channel_start;
+  solve.channel_end = channel_end;
+  solves_.push_back(solve);
+  irls_iteration_start_.push_back(0);
+  return solves_.size() - 1;
+}
+
+void SolverTelemetry::RecordTermEvaluation(
+    const int solve_index,
+    const std::string& term_name,
+    const Clock::time_point& start_time,
+    const Clock::time_point& end_time) {
+
+  const std::chrono::duration<double> duration = end_time - start_time;
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_LT(solve_index, solves_.size()) << "Unknown solve.";
+  std::vector<ObjectiveTermTiming>& term_timings =
+      solves_[solve_index].term_timings;
+  // There are only a few terms, so a linear search is fine.
+  ObjectiveTermTiming* term_timing = nullptr;
+  for (ObjectiveTermTiming& timing : term_timings) {
+    if (timing.name == term_name) {
+      term_timing = &timing;
+      break;
+    }
+  }
+  if (term_timing == nullptr) {
+    term_timings.push_back(ObjectiveTermTiming());
+    term_timing = &term_timings.back();
+    term_timing->name = term_name;
+  }
+  term_timing->num_evaluations++;
+  term_timing->total_seconds += duration.count();
+  AddTraceEvent(term_name, solve_index, start_time, end_time);
+}
+
+void SolverTelemetry::RecordObjectiveEvaluation(
+    const int solve_index,
+    const Clock::time_point& start_time,
+    const Clock::time_point& end_time,
+    const double gradient_norm) {
+
+  const std::chrono::duration<double> duration = end_time - start_time;
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_LT(solve_index, solves_.size()) << "Unknown solve.";
+  SolveTelemetry& solve = solves_[solve_index];
+  solve.num_objective_evaluations++;
+  solve.objective_seconds += duration.count();
+  if (gradient_norm >= 0.0) {
+    solve.last_gradient_norm = gradient_norm;
+  }
+}
+
+void SolverTelemetry::RecordSolverIteration(
+    const int solve_index,
+    const double cost,
+    const double gradient_norm,
+    const int num_allocations) {
+
+  const Clock::time_point now = Clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_LT(solve_index, solves_.size()) << "Unknown solve.";
+  SolveTelemetry& solve = solves_[solve_index];
+  SolverIterationRecord record;
+  record.irls_iteration = solve.irls_iterations.size();
+  record.iteration = solve.iterations.size() + 1;
+  record.cost = cost;
+  record.gradient_norm =
+      (gradient_norm >= 0.0) ? gradient_norm : solve.last_gradient_norm;
+  record.time_seconds = GetSecondsSinceCreation(now);
+  record.num_allocations = num_allocations;
+  record.memory_bytes = util::GetTotalMemoryUsage().current_bytes;
+  solve.iterations.push_back(record);
+}
+
+void SolverTelemetry::RecordSolverRun(
+    const int solve_index,
+    const Clock::time_point& start_time,
+    const Clock::time_point& end_time) {
+
+  const std::chrono::duration<double> duration = end_time - start_time;
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_LT(solve_index, solves_.size()) << "Unknown solve.";
+  solves_[solve_index].solver_seconds += duration.count();
+  AddTraceEvent("least squares solver", solve_index, start_time, end_time);
+}
+
+void SolverTelemetry::RecordIRLSIteration(
+    const int solve_index,
+    const double cost,
+    const double cost_difference,
+    const Clock::time_point& solver_start_time,
+    const Clock::time_point& reweighting_start_time,
+    const Clock::time_point& end_time) {
+
+  const std::chrono::duration<double> solver_duration =
+      reweighting_start_time - solver_start_time;
+  const std::chrono::duration<double> reweighting_duration =
+      end_time - reweighting_start_time;
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_LT(solve_index, solves_.size()) << "Unknown solve.";
+  SolveTelemetry& solve = solves_[solve_index];
+  IRLSIterationRecord record;
+  record.irls_iteration = solve.irls_iterations.size();
+  record.cost = cost;
+  record.cost_difference = cost_difference;
+  record.num_solver_iterations =
+      solve.iterations.size() - irls_iteration_start_[solve_index];
+  record.solver_seconds = solver_duration.count();
+  record.reweighting_seconds = reweighting_duration.count();
+  solve.irls_iterations.push_back(record);
+  irls_iteration_start_[solve_index] = solve.iterations.size();
+  if (reweighting_start_time < end_time) {
+    AddTraceEvent(
+        "IRLS reweighting", solve_index, reweighting_start_time, end_time);
+  }
+}
+
+std::vector<SolveTelemetry> SolverTelemetry::GetSolves() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return solves_;
+}
+
+std::string SolverTelemetry::ToJson() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream json;
+  json << "{\"solves\": [";
+  for (int i = 0; i < solves_.size(); ++i) {
+    const SolveTelemetry& solve = solves_[i];
+    json << (i > 0 ? ", " : "") << "{"
+         << "\"channel_start\": " << solve.channel_start << ", "
+         << "\"channel_end\": " << solve.channel_end << ", "
+         << "\"num_objective_evaluations\": "
+         << solve.num_objective_evaluations << ", "
+         << "\"objective_seconds\": "
+         << FormatJsonNumber(solve.objective_seconds) << ", "
+         << "\"solver_seconds\": "
+         << FormatJsonNumber(solve.solver_seconds) << ", "
+         << "\"optimizer_overhead_seconds\": "
+         << FormatJsonNumber(solve.solver_seconds - solve.objective_seconds);
+
+    json << ", \"terms\": [";
+    for (int j = 0; j < solve.term_timings.size(); ++j) {
+      const ObjectiveTermTiming& timing = solve.term_timings[j];
+      json << (j > 0 ? ", " : "") << "{"
+           << "\"name\": " << FormatJsonString(timing.name) << ", "
+           << "\"num_evaluations\": " << timing.num_evaluations << ", "
+           << "\"total_seconds\": " << FormatJsonNumber(timing.total_seconds)
+           << "}";
+    }
+
+    json << "], \"irls_iterations\": [";
+    for (int j = 0; j < solve.irls_iterations.size(); ++j) {
+      const IRLSIterationRecord& record = solve.irls_iterations[j];
+      json << (j > 0 ? ", " : "") << "{"
+           << "\"irls_iteration\": " << record.irls_iteration << ", "
+           << "\"cost\": " << FormatJsonNumber(record.cost) << ", "
+           << "\"cost_difference\": "
+           << FormatJsonNumber(record.cost_difference) << ", "
+           << "\"num_solver_iterations\": " << record.num_solver_iterations
+           << ", \"solver_seconds\": "
+           << FormatJsonNumber(record.solver_seconds) << ", "
+           << "\"reweighting_seconds\": "
+           << FormatJsonNumber(record.reweighting_seconds) << "}";
+    }
+
+    json << "], \"iterations\": [";
+    for (int j = 0; j < solve.iterations.size(); ++j) {
+      const SolverIterationRecord& record = solve.iterations[j];
+      json << (j > 0 ? ", " : "") << "{"
+           << "\"irls_iteration\": " << record.irls_iteration << ", "
+           << "\"iteration\": " << record.iteration << ", "
+           << "\"cost\": " << FormatJsonNumber(record.cost) << ", "
+           << "\"gradient_norm\": "
+           << (record.gradient_norm >= 0.0 ?
+               FormatJsonNumber(record.gradient_norm) : "null") << ", "
+           << "\"time_seconds\": " << FormatJsonNumber(record.time_seconds)
+           << ", \"num_allocations\": " << record.num_allocations
+           << ", \"memory_bytes\": " << record.memory_bytes << "}";
+    }
+    json << "]}";
+  }
+
+  json << "], \"memory\": {\"tags\": [";
+  for (int tag = 0; tag < util::NUM_MEMORY_TAGS; ++tag) {
+    const util::MemoryTag memory_tag = static_cast<util::MemoryTag>(tag);
+    json << (tag > 0 ? ", " : "") << "{"
+         << "\"tag\": " << FormatJsonString(util::GetMemoryTagName(memory_tag))
+         << ", " << FormatJsonMemoryUsage(util::GetMemoryUsage(memory_tag))
+         << "}";
+  }
+  json << "], \"total\": {"
+       << FormatJsonMemoryUsage(util::GetTotalMemoryUsage()) << "}}}\n";
+  return json.str();
+}
+
+std::string SolverTelemetry::IterationsToCsv() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream csv;
+  csv << std::setprecision(std::numeric_limits<double>::max_digits10);
+  csv << "solve,channel_start,channel_end,irls_iteration,iteration,cost,"
+      << "gradient_norm,time_seconds,num_allocations,memory_bytes\n";
+  for (int i = 0; i < solves_.size(); ++i) {
+    const SolveTelemetry& solve = solves_[i];
+    for (const SolverIterationRecord& record : solve.iterations) {
+      csv << i << "," << solve.channel_start << "," << solve.channel_end << ","
+          << record.irls_iteration << "," << record.iteration << ","
+          << record.cost << ",";
+      if (record.gradient_norm >= 0.0) {
+        csv << record.gradient_norm;
+      }
+      csv << "," << record.time_seconds << "," << record.num_allocations
+          << "," << record.memory_bytes << "\n";
+    }
+  }
+  return csv.str();
+}
+
+std::string SolverTelemetry::ToChromeTrace() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream trace;
+  trace << "{\"traceEvents\": [";
+  for (int i = 0; i < trace_events_.size(); ++i) {
+    const TraceEvent& event = trace_events_[i];
+    trace << (i > 0 ? ",\n" : "\n") << "{"
+          << "\"name\": " << FormatJsonString(event.name) << ", "
+          << "\"cat\": \"solver\", \"ph\": \"X\", \"pid\": 0, "
+          << "\"tid\": " << event.solve_index << ", "
+          << "\"ts\": " << FormatJsonNumber(event.start_microseconds) << ", "
+          << "\"dur\": " << FormatJsonNumber(event.duration_microseconds)
+          << "}";
+  }
+  trace << "\n]}\n";
+  return trace.str();
+}
+
+bool SolverTelemetry::WriteToFile(const std::string& file_path) const {
+  const std::string csv_extension = ".csv";
+  const bool is_csv = file_path.size() >= csv_extension.size() &&
+      file_path.compare(
+          file_path.size() - csv_extension.size(),
+          csv_extension.size(),
+          csv_extension) == 0;
+  return WriteStringToFile(is_csv ? IterationsToCsv() : ToJson(), file_path);
+}
+
+bool SolverTelemetry::WriteChromeTrace(const std::string& file_path) const {
+  return WriteStringToFile(ToChromeTrace(), file_path);
+}
+
+double SolverTelemetry::GetSecondsSinceCreation(
+    const Clock::time_point& time_point) const {
+  const std::chrono::duration<double> duration = time_point - creation_time_;
+  return duration.count();
+}
+
+void SolverTelemetry::AddTraceEvent(
+    const std::string& name,
+    const int solve_index,
+    const Clock::time_point& start_time,
+    const Clock::time_point& end_time) {
+
+  if (!record_trace_events_) {
+    return;
+  }
+  const std::chrono::duration<double, std::micro> duration =
+      end_time - start_time;
+  TraceEvent event;
+  event.name = name;
+  event.solve_index = solve_index;
+  event.start_microseconds = GetSecondsSinceCreation(start_time) * 1.0e6;
+  event.duration_microseconds = duration.count();
+  trace_events_.push_back(event);
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,216 @@
+// The SolverTelemetry collects structured statistics about a solve: the cost
+// and gradient norm after every solver iteration, the time spent in each
+// objective term, the time spent in the optimizer itself, the number of
+// scratch buffer allocations, the memory recorded by the memory accounting
+// (see util/memory_accounting.h), and the outer loop statistics of the IRLS
+// solver. The statistics can be exported as JSON or CSV for tuning the solver
+// options, and optionally as Chrome trace events (load the file at
+// chrome://tracing or in Perfetto) to see where the time goes.
+//
+// A telemetry can be shared by solves that run concurrently (e.g. the channel
+// splits of the IRLSMapSolver). Each solve registers itself with BeginSolve()
+// and reports its statistics under the returned solve index. Use as follows:
+//   std::shared_ptr<SolverTelemetry> telemetry(new SolverTelemetry());
+//   solver.SetTelemetry(telemetry);
+//   solver.Solve(initial_estimate);
+//   telemetry->WriteToFile("telemetry.json");
+
+#ifndef SRC_OPTIMIZATION_SOLVER_TELEMETRY_H_
+#define SRC_OPTIMIZATION_SOLVER_TELEMETRY_H_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace super_resolution {
+
+// The state after a single iteration of the least squares solver.
+struct SolverIterationRecord {
+  // The outer (IRLS) iteration that the solver iteration belongs to.
+  int irls_iteration;
+
+  // The number of iterations completed in this solve so far, counting all
+  // outer iterations.
+  int iteration;
+
+  double cost;
+
+  // The norm of the gradient at the new estimate, or at the last point that
+  // the objective was evaluated at if the solver does not report it. It is
+  // negative if no gradient was computed.
+  double gradient_norm;
+
+  // The time since the telemetry was created.
+  double time_seconds;
+
+  // The total number of scratch buffer allocations of the objective function
+  // so far. This should stop growing after the first iteration.
+  int num_allocations;
+
+  // The memory of all tags of the memory accounting after the iteration.
+  int64_t memory_bytes;
+};
+
+// The state after a single outer iteration of the IRLS solver.
+struct IRLSIterationRecord {
+  int irls_iteration;
+  double cost;
+  double cost_difference;
+
+  // The number of least squares solver iterations of this outer iteration.
+  int num_solver_iterations;
+
+  // The time spent running the least squares solver and updating the IRLS
+  // weights.
+  double solver_seconds;
+  double reweighting_seconds;
+};
+
+// The accumulated evaluations of a single objective term.
+struct ObjectiveTermTiming {
+  std::string name;
+  int num_evaluations = 0;
+  double total_seconds = 0.0;
+};
+
+// All statistics of a single solve.
+struct SolveTelemetry {
+  // The channel range [channel_start, channel_end) that was solved.
+  int channel_start;
+  int channel_end;
+
+  std::vector<SolverIterationRecord> iterations;
+  std::vector<IRLSIterationRecord> irls_iterations;
+  std::vector<ObjectiveTermTiming> term_timings;
+
+  // The number of full objective evaluations and the time spent in them.
+  int num_objective_evaluations = 0;
+  double objective_seconds = 0.0;
+
+  // The total time spent in the least squares solver, including the
+  // objective evaluations. The difference is the optimizer overhead (line
+  // searches, direction updates, etc.).
+  double solver_seconds = 0.0;
+
+  // The last gradient norm computed by an evaluation, for solvers that do not
+  // report it with their iterations.
+  double last_gradient_norm = -1.0;
+};
+
+class SolverTelemetry {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // If record_trace_events is true, every term evaluation, solver run and
+  // IRLS reweighting is also kept as a trace event for ToChromeTrace(). This
+  // uses memory for every evaluation, so it is off by default.
+  explicit SolverTelemetry(const bool record_trace_events = false);
+
+  // Registers a new solve of the given channel range and returns its index,
+  // which is used to report all of its statistics. This is thread safe, as
+  // are all of the Record methods below.
+  int BeginSolve(const int channel_start, const int channel_end);
+
+  // Records one evaluation of the named objective term.
+  void RecordTermEvaluation(
+      const int solve_index,
+      const std::string& term_name,
+      const Clock::time_point& start_time,
+      const Clock::time_point& end_time);
+
+  // Records one evaluation of the whole objective function. The gradient norm
+  // is negative if no gradient was computed.
+  void RecordObjectiveEvaluation(
+      const int solve_index,
+      const Clock::time_point& start_time,
+      const Clock::time_point& end_time,
+      const double gradient_norm);
+
+  // Records a completed solver iteration. If the gradient norm is negative,
+  // the norm of the last evaluated gradient is used.
+  void RecordSolverIteration(
+      const int solve_index,
+      const double cost,
+      const double gradient_norm,
+      const int num_allocations);
+
+  // Records one run of the least squares solver (one IRLS iteration).
+  void RecordSolverRun(
+      const int solve_index,
+      const Clock::time_point& start_time,
+      const Clock::time_point& end_time);
+
+  // Records a completed IRLS outer iteration. The number of solver iterations
+  // is counted from the iterations recorded since the previous one. The
+  // reweighting times are zero if the weights were not updated.
+  void RecordIRLSIteration(
+      const int solve_index,
+      const double cost,
+      const double cost_difference,
+      const Clock::time_point& solver_start_time,
+      const Clock::time_point& reweighting_start_time,
+      const Clock::time_point& end_time);
+
+  // Returns a copy of the statistics of every solve, in the order the solves
+  // began.
+  std::vector<SolveTelemetry> GetSolves() const;
+
+  // Returns all statistics as a JSON object. It also contains the current and
+  // peak memory of every memory tag at the time of the call.
+  std::string ToJson() const;
+
+  // Returns the solver iterations of all solves as CSV, with one header line.
+  std::string IterationsToCsv() const;
+
+  // Returns the recorded trace events in the Chrome trace event format, with
+  // one track per solve. Empty if trace events are not recorded.
+  std::string ToChromeTrace() const;
+
+  // Writes IterationsToCsv() if the path ends in ".csv", and ToJson()
+  // otherwise. Returns false (and logs an error) if the file could not be
+  // written.
+  bool WriteToFile(const std::string& file_path) const;
+
+  // Writes ToChromeTrace() to the given file.
+  bool WriteChromeTrace(const std::string& file_path) const;
+
+ private:
+  // A complete ("X" phase) trace event.
+  struct TraceEvent {
+    std::string name;
+    int solve_index;
+    double start_microseconds;
+    double duration_microseconds;
+  };
+
+  // Returns the time of the given point since the telemetry was created.
+  double GetSecondsSinceCreation(const Clock::time_point& time_point) const;
+
+  // Adds a trace event if they are recorded. Must be called with the mutex
+  // held.
+  void AddTraceEvent(
+      const std::string& name,
+      const int solve_index,
+      const Clock::time_point& start_time,
+      const Clock::time_point& end_time);
+
+  const bool record_trace_events_;
+  const Clock::time_point creation_time_;
+
+  std::vector<SolveTelemetry> solves_;
+
+  // The index of the first solver iteration of the current IRLS iteration of
+  // every solve.
+  std::vector<int> irls_iteration_start_;
+
+  std::vector<TraceEvent> trace_events_;
+
+  // Protects all of the recorded data.
+  mutable std::mutex mutex_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_SOLVER_TELEMETRY_H_
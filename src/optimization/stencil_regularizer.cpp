@@ -0,0 +1,1070 @@
+#include "optimization/stencil_regularizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "optimization/regularizer.h"
+#include "util/profiler.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// Returns the sign of the value (-1, 0, or 1) without branching.
+inline double Sign(const double value) {
+  return static_cast<double>((value > 0.0) - (value < 0.0));
+}
+
+// The penalty functions of StencilPenaltyType. Each one returns the penalty
+// of a difference and its derivative. They are template parameters of the
+// row kernels below, so that the kernels are compiled (and vectorized) for
+// each penalty.
+struct L1Penalty {
+  double Value(const double difference) const {
+    return std::abs(difference);
+  }
+  double Derivative(const double difference) const {
+    return Sign(difference);
+  }
+};
+
+struct HuberPenalty {
+  explicit HuberPenalty(const double delta)
+      : delta(delta), inverse_delta(1.0 / delta) {}
+
+  double Value(const double difference) const {
+    const double absolute_difference = std::abs(difference);
+    return (absolute_difference <= delta) ?
+        0.5 * difference * difference * inverse_delta :
+        absolute_difference - 0.5 * delta;
+  }
+  double Derivative(const double difference) const {
+    return std::min(std::max(difference * inverse_delta, -1.0), 1.0);
+  }
+
+  const double delta;
+  const double inverse_delta;
+};
+
+struct LpPenalty {
+  explicit LpPenalty(const double exponent) : exponent(exponent) {}
+
+  double Value(const double difference) const {
+    return std::pow(std::abs(difference), exponent);
+  }
+  double Derivative(const double difference) const {
+    const double absolute_difference = std::abs(difference);
+    if (absolute_difference == 0.0) {
+      return 0.0;
+    }
+    return exponent * std::pow(absolute_difference, exponent - 1.0) *
+        Sign(difference);
+  }
+
+  const double exponent;
+};
+
+// The image that the row kernels below work on, and the stencil applied to
+// it. The neighbor delta of each term is the distance in memory from a pixel
+// to its neighbor.
+struct StencilImage {
+  const double* image_data;
+  int width;
+  int height;
+  int num_channels;
+  int64_t num_pixels;
+  const std::vector<StencilTerm>* stencil;
+  std::vector<int64_t> neighbor_deltas;
+
+  // True if the stencil is the one of total variation, which has a fused
+  // kernel (see ScatterTotalVariationRow()), and whether it is 3D TV.
+  bool is_total_variation;
+  bool is_3d_total_variation;
+};
+
+// Returns true if the stencil is exactly the one returned by
+// GetTotalVariationStencil(use_3d_total_variation).
+bool IsTotalVariationStencil(
+    const std::vector<StencilTerm>& stencil,
+    const bool use_3d_total_variation) {
+
+  const std::vector<StencilTerm> total_variation_stencil =
+      GetTotalVariationStencil(use_3d_total_variation);
+  if (stencil.size() != total_variation_stencil.size()) {
+    return false;
+  }
+  for (int k = 0; k < stencil.size(); ++k) {
+    const StencilTerm& term = stencil[k];
+    const StencilTerm& expected_term = total_variation_stencil[k];
+    if (term.row_offset != expected_term.row_offset ||
+        term.col_offset != expected_term.col_offset ||
+        term.channel_offset != expected_term.channel_offset ||
+        term.weight != expected_term.weight) {
+      return false;
+    }
+  }
+  return true;
+}
+
+StencilImage GetStencilImage(
+    const double* image_data,
+    const cv::Size& image_size,
+    const int num_channels,
+    const std::vector<StencilTerm>& stencil) {
+
+  StencilImage image;
+  image.image_data = image_data;
+  image.width = image_size.width;
+  image.height = image_size.height;
+  image.num_channels = num_channels;
+  image.num_pixels =
+      static_cast<int64_t>(image_size.width) * image_size.height;
+  image.stencil = &stencil;
+  for (const StencilTerm& term : stencil) {
+    image.neighbor_deltas.push_back(
+        term.channel_offset * image.num_pixels +
+        static_cast<int64_t>(term.row_offset) * image.width +
+        term.col_offset);
+  }
+  image.is_3d_total_variation = IsTotalVariationStencil(stencil, true);
+  image.is_total_variation =
+      image.is_3d_total_variation || IsTotalVariationStencil(stencil, false);
+  return image;
+}
+
+// Finds the columns [col_begin, col_end) of the given row whose pixels have a
+// neighbor at the given offset. Returns false if there are none (e.g. if the
+// neighbor row or channel is outside of the image).
+bool GetNeighborColumns(
+    const StencilImage& image,
+    const int row_offset,
+    const int col_offset,
+    const int channel_offset,
+    const int channel,
+    const int row,
+    int* col_begin,
+    int* col_end) {
+
+  const int neighbor_row = row + row_offset;
+  const int neighbor_channel = channel + channel_offset;
+  if (neighbor_row < 0 || neighbor_row >= image.height ||
+      neighbor_channel < 0 || neighbor_channel >= image.num_channels) {
+    return false;
+  }
+  *col_begin = std::max(0, -col_offset);
+  *col_end = std::min(image.width, image.width - col_offset);
+  return *col_begin < *col_end;
+}
+
+// Writes the residuals of the given row of a channel. Every term of the
+// stencil is applied to the whole row at once (the shifted row minus the
+// row), so the inner loop runs over contiguous pixels.
+template <typename Penalty>
+void ComputeResidualRow(
+    const StencilImage& image,
+    const Penalty& penalty,
+    const int channel,
+    const int row,
+    double* row_residuals) {
+
+  const int64_t offset = channel * image.num_pixels +
+      static_cast<int64_t>(row) * image.width;
+  const double* pixels = image.image_data + offset;
+  // The first term that applies to the row assigns the residuals instead of
+  // adding to them, which saves clearing the row first.
+  bool is_first_term = true;
+  for (int k = 0; k < image.stencil->size(); ++k) {
+    const StencilTerm& term = (*image.stencil)[k];
+    int col_begin;
+    int col_end;
+    if (!GetNeighborColumns(
+        image, term.row_offset, term.col_offset, term.channel_offset,
+        channel, row, &col_begin, &col_end)) {
+      continue;
+    }
+    const double* neighbors = pixels + image.neighbor_deltas[k];
+    const double weight = term.weight;
+    if (is_first_term) {
+      std::fill(row_residuals, row_residuals + col_begin, 0.0);
+      std::fill(row_residuals + col_end, row_residuals + image.width, 0.0);
+      for (int col = col_begin; col < col_end; ++col) {
+        row_residuals[col] =
+            penalty.Value(weight * (neighbors[col] - pixels[col]));
+      }
+      is_first_term = false;
+      continue;
+    }
+    for (int col = col_begin; col < col_end; ++col) {
+      row_residuals[col] +=
+          penalty.Value(weight * (neighbors[col] - pixels[col]));
+    }
+  }
+  if (is_first_term) {
+    std::fill(row_residuals, row_residuals + image.width, 0.0);
+  }
+}
+
+// Returns the weighted squared residuals c * r^2 of a row.
+double GetWeightedRowCost(
+    const double* row_residuals,
+    const double* row_gradient_constants,
+    const int width) {
+
+  double row_cost = 0.0;
+  for (int col = 0; col < width; ++col) {
+    row_cost +=
+        row_gradient_constants[col] * row_residuals[col] * row_residuals[col];
+  }
+  return row_cost;
+}
+
+// Adds the derivative of the weighted squared residuals s * c * r^2 of the
+// given row to the gradient, where s is the gradient scale, and returns the
+// sum of c * r^2 over the row. The derivative of every difference is
+// subtracted from the pixel and added to its neighbor, so every difference is
+// only computed once. The neighbors may be in other rows, so this can only be
+// used if a single thread computes the whole gradient.
+//
+// The derivatives of each term are subtracted from the pixels as they are
+// written into a row buffer, which must have space for two rows of values,
+// and are then added to the neighbors in a separate loop. This keeps both
+// loops vectorized even when the neighbor is in the same row, where a single
+// loop would depend on its previous iteration.
+template <typename Penalty>
+double ScatterGradientRow(
+    const StencilImage& image,
+    const Penalty& penalty,
+    const int channel,
+    const int row,
+    const double* row_residuals,
+    const double* row_gradient_constants,
+    const double gradient_scale,
+    double* row_buffer,
+    double* gradient) {
+
+  const int width = image.width;
+  const int64_t offset = channel * image.num_pixels +
+      static_cast<int64_t>(row) * width;
+  const double* pixels = image.image_data + offset;
+  double* row_gradient = gradient + offset;
+  double* residual_derivatives = row_buffer;
+  double* derivatives = row_buffer + width;
+  double row_cost = 0.0;
+  for (int col = 0; col < width; ++col) {
+    const double weighted_residual =
+        row_gradient_constants[col] * row_residuals[col];
+    row_cost += weighted_residual * row_residuals[col];
+    residual_derivatives[col] = 2.0 * gradient_scale * weighted_residual;
+  }
+  for (int k = 0; k < image.stencil->size(); ++k) {
+    const StencilTerm& term = (*image.stencil)[k];
+    int col_begin;
+    int col_end;
+    if (!GetNeighborColumns(
+        image, term.row_offset, term.col_offset, term.channel_offset,
+        channel, row, &col_begin, &col_end)) {
+      continue;
+    }
+    const double* neighbors = pixels + image.neighbor_deltas[k];
+    double* neighbor_gradient = row_gradient + image.neighbor_deltas[k];
+    const double weight = term.weight;
+    for (int col = col_begin; col < col_end; ++col) {
+      derivatives[col] = weight * residual_derivatives[col] *
+          penalty.Derivative(weight * (neighbors[col] - pixels[col]));
+      row_gradient[col] -= derivatives[col];
+    }
+    for (int col = col_begin; col < col_end; ++col) {
+      neighbor_gradient[col] += derivatives[col];
+    }
+  }
+  return row_cost;
+}
+
+// Pointers to the data of a single row for the fused total variation kernel
+// below. Neighboring row and channel pointers are only used if those
+// neighbors exist.
+struct TotalVariationRow {
+  // The image data at this row, the row below, and the same row in the next
+  // channel.
+  const double* pixels;
+  const double* pixels_below;
+  const double* pixels_next_channel;
+
+  // The output residuals at this row.
+  double* residuals;
+
+  // The gradient constants (each multiplied by the scale as it is used) and
+  // the gradient at this row, the row below, and the same row in the next
+  // channel.
+  const double* gradient_constants;
+  double gradient_scale;
+  double* gradient;
+  double* gradient_below;
+  double* gradient_next_channel;
+};
+
+// Computes the total variation at the pixel in the given column of the row,
+// adds the derivative of its weighted squared residual c * r^2 to the pixel
+// and its neighbors, and returns c * r^2 (without the gradient scale).
+// Differences to neighbors that don't exist are 0.
+template <bool kHasPixelRight, bool kHasRowBelow, bool kHasNextChannel>
+inline double ComputeTotalVariationAtPixel(
+    const TotalVariationRow& row, const int col) {
+
+  const double pixel = row.pixels[col];
+  const double x_difference =
+      kHasPixelRight ? (row.pixels[col + 1] - pixel) : 0.0;
+  const double y_difference =
+      kHasRowBelow ? (row.pixels_below[col] - pixel) : 0.0;
+  const double z_difference =
+      kHasNextChannel ? (row.pixels_next_channel[col] - pixel) : 0.0;
+  const double residual =
+      std::abs(x_difference) + std::abs(y_difference) + std::abs(z_difference);
+  row.residuals[col] = residual;
+
+  const double weighted_residual = row.gradient_constants[col] * residual;
+  const double weight = 2.0 * row.gradient_scale * weighted_residual;
+  const double x_sign = Sign(x_difference);
+  const double y_sign = Sign(y_difference);
+  const double z_sign = Sign(z_difference);
+  row.gradient[col] -= weight * (x_sign + y_sign + z_sign);
+  if (kHasPixelRight) {
+    row.gradient[col + 1] += weight * x_sign;
+  }
+  if (kHasRowBelow) {
+    row.gradient_below[col] += weight * y_sign;
+  }
+  if (kHasNextChannel) {
+    row.gradient_next_channel[col] += weight * z_sign;
+  }
+  return weighted_residual * residual;
+}
+
+// Computes the fused total variation kernel for every pixel in the row. The
+// last column, which has no right neighbor, is computed separately so the
+// inner loop has no boundary checks.
+template <bool kHasRowBelow, bool kHasNextChannel>
+double ComputeTotalVariationRow(
+    const TotalVariationRow& row, const int width) {
+
+  const int last_col = width - 1;
+  double row_cost = 0.0;
+  for (int col = 0; col < last_col; ++col) {
+    row_cost += ComputeTotalVariationAtPixel<
+        true, kHasRowBelow, kHasNextChannel>(row, col);
+  }
+  row_cost += ComputeTotalVariationAtPixel<
+      false, kHasRowBelow, kHasNextChannel>(row, last_col);
+  return row_cost;
+}
+
+// Same as ComputeResidualRow() followed by ScatterGradientRow(), specialized
+// for the 1-norm total variation stencil. All differences of a pixel are
+// computed in a single loop, without the per-term passes over the row buffer
+// of the generic kernels, which makes 2D TV about 15% faster.
+double ScatterTotalVariationRow(
+    const StencilImage& image,
+    const int channel,
+    const int row_index,
+    double* row_residuals,
+    const double* row_gradient_constants,
+    const double gradient_scale,
+    double* gradient) {
+
+  const int width = image.width;
+  const int64_t offset = channel * image.num_pixels +
+      static_cast<int64_t>(row_index) * width;
+  const bool has_row_below = (row_index + 1 < image.height);
+  const bool has_next_channel =
+      image.is_3d_total_variation && (channel + 1 < image.num_channels);
+  TotalVariationRow row = {};
+  row.pixels = image.image_data + offset;
+  row.residuals = row_residuals;
+  row.gradient_constants = row_gradient_constants;
+  row.gradient_scale = gradient_scale;
+  row.gradient = gradient + offset;
+  if (has_row_below) {
+    row.pixels_below = row.pixels + width;
+    row.gradient_below = row.gradient + width;
+  }
+  if (has_next_channel) {
+    row.pixels_next_channel = row.pixels + image.num_pixels;
+    row.gradient_next_channel = row.gradient + image.num_pixels;
+  }
+  if (has_row_below) {
+    return has_next_channel ?
+        ComputeTotalVariationRow<true, true>(row, width) :
+        ComputeTotalVariationRow<true, false>(row, width);
+  }
+  return has_next_channel ?
+      ComputeTotalVariationRow<false, true>(row, width) :
+      ComputeTotalVariationRow<false, false>(row, width);
+}
+
+// Same as ScatterGradientRow(), but only writes to the given row of the
+// gradient, so that the rows can be computed by different threads. The
+// gradient at each pixel gathers the derivative of its own residual and of
+// the residuals of the pixels that have it as a neighbor. The residuals of all
+// rows must already be computed.
+template <typename Penalty>
+void GatherGradientRow(
+    const StencilImage& image,
+    const Penalty& penalty,
+    const int channel,
+    const int row,
+    const double* residuals,
+    const double* gradient_constants,
+    const double gradient_scale,
+    double* gradient) {
+
+  const int64_t offset = channel * image.num_pixels +
+      static_cast<int64_t>(row) * image.width;
+  const double* pixels = image.image_data + offset;
+  double* row_gradient = gradient + offset;
+  const double scale = 2.0 * gradient_scale;
+  for (int k = 0; k < image.stencil->size(); ++k) {
+    const StencilTerm& term = (*image.stencil)[k];
+    const int64_t delta = image.neighbor_deltas[k];
+    const double weight = term.weight;
+    const double scaled_weight = scale * weight;
+    int col_begin;
+    int col_end;
+
+    // Derivative of this pixel's own residual.
+    if (GetNeighborColumns(
+        image, term.row_offset, term.col_offset, term.channel_offset,
+        channel, row, &col_begin, &col_end)) {
+      const double* neighbors = pixels + delta;
+      const double* row_residuals = residuals + offset;
+      const double* row_gradient_constants = gradient_constants + offset;
+      for (int col = col_begin; col < col_end; ++col) {
+        row_gradient[col] -=
+            scaled_weight * row_gradient_constants[col] * row_residuals[col] *
+            penalty.Derivative(weight * (neighbors[col] - pixels[col]));
+      }
+    }
+
+    // Derivative of the residual of the pixel that has this one as its
+    // neighbor.
+    if (GetNeighborColumns(
+        image, -term.row_offset, -term.col_offset, -term.channel_offset,
+        channel, row, &col_begin, &col_end)) {
+      const double* source_pixels = pixels - delta;
+      const double* source_residuals = residuals + offset - delta;
+      const double* source_gradient_constants =
+          gradient_constants + offset - delta;
+      for (int col = col_begin; col < col_end; ++col) {
+        row_gradient[col] +=
+            scaled_weight * source_gradient_constants[col] *
+            source_residuals[col] *
+            penalty.Derivative(weight * (pixels[col] - source_pixels[col]));
+      }
+    }
+  }
+}
+
+// The amount of cache memory (about the size of a per-core L2 cache) that the
+// rows of a single tile of the traversal below should fit into.
+constexpr int64_t kTileCacheSizeBytes = 256 * 1024;
+
+// Returns the number of rows of the tiles of ForEachRowInTiles(). If the
+// stencil reaches into other channels, every row also accesses rows of those
+// channels, which are whole bands away in memory. The tiles are sized so that
+// the rows of all channels within reach in all num_arrays accessed arrays fit
+// into the cache. Otherwise, the whole channel is a single tile.
+int GetNumTileRows(const StencilImage& image, const int num_arrays) {
+  int max_channel_offset = 0;
+  for (const StencilTerm& term : *image.stencil) {
+    max_channel_offset =
+        std::max(max_channel_offset, std::abs(term.channel_offset));
+  }
+  if (max_channel_offset == 0 || image.num_channels == 1) {
+    return image.height;
+  }
+  const int64_t tile_row_bytes =
+      static_cast<int64_t>(image.width) * sizeof(double) * num_arrays *
+      (max_channel_offset + 1);
+  return static_cast<int>(std::min<int64_t>(
+      std::max<int64_t>(kTileCacheSizeBytes / tile_row_bytes, 1),
+      image.height));
+}
+
+// Calls row_function(channel, row) for every channel and every row in
+// [row_start, row_end). The rows are split into tiles of num_tile_rows rows
+// that are traversed across all channels before moving on to the next tile.
+template <typename RowFunction>
+void ForEachRowInTiles(
+    const int row_start,
+    const int row_end,
+    const int num_channels,
+    const int num_tile_rows,
+    const RowFunction& row_function) {
+
+  for (int tile_start = row_start;
+       tile_start < row_end;
+       tile_start += num_tile_rows) {
+    const int tile_end = std::min(tile_start + num_tile_rows, row_end);
+    for (int channel = 0; channel < num_channels; ++channel) {
+      for (int row = tile_start; row < tile_end; ++row) {
+        row_function(channel, row);
+      }
+    }
+  }
+}
+
+// Computes the residuals of the whole image, and if gradient is not null, adds
+// the gradient of the weighted cost s * sum_p c_p r_p^2 to it and returns the
+// cost, where s is the gradient scale and c_p are the gradient constants. If
+// residuals is null, they are written into a buffer instead, since they are
+// only needed to compute the gradient.
+//
+// A single thread computes the residuals and scatters the gradient of each
+// row in the same sweep over the image. With multiple threads, all residuals
+// are computed first, and then every row gathers its gradient (see
+// GatherGradientRow()). The weighted costs of the rows are summed in order in
+// both cases, so the cost does not depend on the number of threads. The
+// serial sweep of 1-norm total variation uses a fused kernel (see
+// ScatterTotalVariationRow()).
+//
+// If evaluated_rows is not null, only the rows with a nonzero value in it are
+// evaluated, and the residuals and unscaled weighted costs of the other rows
+// are read from residuals and row_costs (one cost per row, summed over the
+// channels), which must be given and which receive those of the evaluated
+// rows. Otherwise all rows are evaluated, and their costs are written into
+// row_costs if it is not null.
+template <typename Penalty>
+double EvaluateStencil(
+    const StencilImage& image,
+    const Penalty& penalty,
+    const double* gradient_constants,
+    const double gradient_scale,
+    const bool is_serial,
+    const std::function<void(
+        const std::function<void(const int, const int)>&)>& run_over_rows,
+    const uint8_t* evaluated_rows,
+    double* residuals,
+    double* gradient,
+    double* row_costs) {
+
+  const int width = image.width;
+  const bool compute_cost = (gradient_constants != nullptr);
+  const bool compute_gradient = (gradient != nullptr);
+  const bool scatter_gradient = compute_gradient && is_serial;
+  const bool use_total_variation_kernel = scatter_gradient &&
+      image.is_total_variation && std::is_same<Penalty, L1Penalty>::value;
+  std::vector<double> residual_buffer;
+  if (residuals == nullptr) {
+    residual_buffer.resize(
+        scatter_gradient ? width : image.num_pixels * image.num_channels);
+  }
+  std::vector<double> row_cost_buffer;
+  if (row_costs == nullptr) {
+    row_cost_buffer.resize(image.height);
+    row_costs = row_cost_buffer.data();
+  }
+  const auto is_evaluated = [evaluated_rows](const int row) {
+    return evaluated_rows == nullptr || evaluated_rows[row] != 0;
+  };
+  for (int row = 0; row < image.height; ++row) {
+    if (is_evaluated(row)) {
+      row_costs[row] = 0.0;
+    }
+  }
+  const int num_tile_rows =
+      GetNumTileRows(image, compute_gradient ? 4 : 2);
+  run_over_rows([&](const int row_start, const int row_end) {
+    std::vector<double> row_buffer;
+    if (scatter_gradient) {
+      row_buffer.resize(2 * width);
+    }
+    ForEachRowInTiles(
+        row_start,
+        row_end,
+        image.num_channels,
+        num_tile_rows,
+        [&](const int channel, const int row) {
+      if (!is_evaluated(row)) {
+        return;
+      }
+      const int64_t offset = channel * image.num_pixels +
+          static_cast<int64_t>(row) * width;
+      double* row_residuals = residual_buffer.data();
+      if (residuals != nullptr) {
+        row_residuals = residuals + offset;
+      } else if (!scatter_gradient) {
+        row_residuals += offset;
+      }
+      if (use_total_variation_kernel) {
+        row_costs[row] += ScatterTotalVariationRow(
+            image,
+            channel,
+            row,
+            row_residuals,
+            gradient_constants + offset,
+            gradient_scale,
+            gradient);
+        return;
+      }
+      ComputeResidualRow(image, penalty, channel, row, row_residuals);
+      if (scatter_gradient) {
+        row_costs[row] += ScatterGradientRow(
+            image,
+            penalty,
+            channel,
+            row,
+            row_residuals,
+            gradient_constants + offset,
+            gradient_scale,
+            row_buffer.data(),
+            gradient);
+      } else if (compute_cost) {
+        row_costs[row] += GetWeightedRowCost(
+            row_residuals, gradient_constants + offset, width);
+      }
+    });
+  });
+
+  if (compute_gradient && !scatter_gradient) {
+    const double* all_residuals =
+        (residuals != nullptr) ? residuals : residual_buffer.data();
+    run_over_rows([&](const int row_start, const int row_end) {
+      ForEachRowInTiles(
+          row_start,
+          row_end,
+          image.num_channels,
+          num_tile_rows,
+          [&](const int channel, const int row) {
+        if (!is_evaluated(row)) {
+          return;
+        }
+        GatherGradientRow(
+            image,
+            penalty,
+            channel,
+            row,
+            all_residuals,
+            gradient_constants,
+            gradient_scale,
+            gradient);
+      });
+    });
+  }
+
+  double cost = 0.0;
+  for (int row = 0; row < image.height; ++row) {
+    cost += row_costs[row];
+  }
+  return gradient_scale * cost;
+}
+
+}  // namespace
+
+std::vector<StencilTerm> GetTotalVariationStencil(
+    const bool use_3d_total_variation) {
+
+  std::vector<StencilTerm> stencil = {
+    StencilTerm(0, 1, 0, 1.0),
+    StencilTerm(1, 0, 0, 1.0)
+  };
+  if (use_3d_total_variation) {
+    stencil.push_back(StencilTerm(0, 0, 1, 1.0));
+  }
+  return stencil;
+}
+
+std::vector<StencilTerm> GetBilateralTotalVariationStencil(
+    const int scale_range, const double spatial_decay) {
+
+  // BTV compares the pixel to its neighbor (x_p - x_n) instead of the other
+  // way around, hence the negative weights.
+  std::vector<StencilTerm> stencil;
+  for (int i = 0; i <= scale_range; ++i) {
+    for (int j = (i == 0) ? 1 : 0; j <= scale_range; ++j) {
+      stencil.push_back(StencilTerm(i, j, 0, -std::pow(spatial_decay, i + j)));
+    }
+  }
+  return stencil;
+}
+
+StencilRegularizer::StencilRegularizer(
+    const cv::Size& image_size,
+    const std::vector<StencilTerm>& stencil,
+    const StencilPenalty& penalty)
+    : Regularizer(image_size), penalty_(penalty) {
+
+  if (penalty_.type == STENCIL_PENALTY_HUBER) {
+    CHECK_GT(penalty_.parameter, 0.0) << "The Huber delta must be positive.";
+  } else if (penalty_.type == STENCIL_PENALTY_LP) {
+    CHECK(1.0 <= penalty_.parameter && penalty_.parameter <= 2.0)
+        << "The exponent of the Lp penalty must be between 1 and 2.";
+  }
+  SetStencil(stencil);
+}
+
+void StencilRegularizer::SetStencil(const std::vector<StencilTerm>& stencil) {
+  for (const StencilTerm& term : stencil) {
+    CHECK(term.row_offset != 0 || term.col_offset != 0 ||
+          term.channel_offset != 0)
+        << "A stencil term cannot compare a pixel to itself.";
+  }
+  stencil_ = stencil;
+}
+
+std::shared_ptr<Regularizer> StencilRegularizer::CreateCoarseRegularizer(
+    const cv::Size& coarse_image_size) const {
+
+  std::shared_ptr<StencilRegularizer> coarse_regularizer(
+      new StencilRegularizer(coarse_image_size, stencil_, penalty_));
+  coarse_regularizer->SetNumThreads(num_threads_);
+  return coarse_regularizer;
+}
+
+void StencilRegularizer::SetNumThreads(const int num_threads) {
+  const int num_threads_to_use = std::min(
+      util::GetNumThreadsToUse(num_threads), image_size_.height);
+  num_threads_ = std::max(num_threads_to_use, 1);
+  thread_pool_.reset();
+  if (num_threads_ > 1) {
+    // The calling thread also processes rows, so it is not included.
+    thread_pool_.reset(new util::ThreadPool(num_threads_ - 1));
+  }
+}
+
+void StencilRegularizer::RunOverRows(
+    const std::function<void(const int, const int)>& function) const {
+
+  const int height = image_size_.height;
+  if (thread_pool_ == nullptr) {
+    function(0, height);
+    return;
+  }
+  thread_pool_->ParallelFor(num_threads_, [&](const int block_index) {
+    const int row_start = block_index * height / num_threads_;
+    const int row_end = (block_index + 1) * height / num_threads_;
+    function(row_start, row_end);
+  });
+}
+
+double StencilRegularizer::ComputeResidualsAndGradient(
+    const double* image_data,
+    const int num_channels,
+    const double* gradient_constants,
+    const double gradient_scale,
+    const uint8_t* evaluated_rows,
+    double* residuals,
+    double* gradient,
+    double* row_costs) const {
+
+  const StencilImage image =
+      GetStencilImage(image_data, image_size_, num_channels, stencil_);
+  const auto run_over_rows = [this](
+      const std::function<void(const int, const int)>& function) {
+    RunOverRows(function);
+  };
+  const bool is_serial = (thread_pool_ == nullptr);
+  switch (penalty_.type) {
+    case STENCIL_PENALTY_HUBER:
+      return EvaluateStencil(
+          image, HuberPenalty(penalty_.parameter), gradient_constants,
+          gradient_scale, is_serial, run_over_rows, evaluated_rows,
+          residuals, gradient, row_costs);
+    case STENCIL_PENALTY_LP:
+      return EvaluateStencil(
+          image, LpPenalty(penalty_.parameter), gradient_constants,
+          gradient_scale, is_serial, run_over_rows, evaluated_rows,
+          residuals, gradient, row_costs);
+    default:
+      return EvaluateStencil(
+          image, L1Penalty(), gradient_constants,
+          gradient_scale, is_serial, run_over_rows, evaluated_rows,
+          residuals, gradient, row_costs);
+  }
+}
+
+std::vector<double> StencilRegularizer::ApplyToImage(
+    const double* image_data, const int num_channels) const {
+
+  std::vector<double> residuals;
+  ApplyToImage(image_data, num_channels, &residuals);
+  return residuals;
+}
+
+void StencilRegularizer::ApplyToImage(
+    const double* image_data,
+    const int num_channels,
+    std::vector<double>* residuals) const {
+
+  PROFILE_SCOPE("StencilRegularizer::ApplyToImage");
+
+  CHECK_NOTNULL(image_data);
+  CHECK_NOTNULL(residuals);
+
+  residuals->resize(
+      static_cast<int64_t>(image_size_.width) * image_size_.height *
+      num_channels);
+  ComputeResidualsAndGradient(
+      image_data, num_channels, nullptr, 1.0, nullptr, residuals->data(),
+      nullptr, nullptr);
+}
+
+std::pair<std::vector<double>, std::vector<double>>
+StencilRegularizer::ApplyToImageWithDifferentiation(
+    const double* image_data,
+    const std::vector<double>& gradient_constants,
+    const int num_channels) const {
+
+  std::vector<double> residuals;
+  std::vector<double> gradient;
+  ApplyToImageWithDifferentiation(
+      image_data, gradient_constants, num_channels, &residuals, &gradient);
+  return std::make_pair(residuals, gradient);
+}
+
+void StencilRegularizer::ApplyToImageWithDifferentiation(
+    const double* image_data,
+    const std::vector<double>& gradient_constants,
+    const int num_channels,
+    std::vector<double>* residuals,
+    std::vector<double>* gradient) const {
+
+  PROFILE_SCOPE("StencilRegularizer::ApplyToImageWithDifferentiation");
+
+  CHECK_NOTNULL(image_data);
+  CHECK_NOTNULL(residuals);
+  CHECK_NOTNULL(gradient);
+
+  const int64_t num_parameters =
+      static_cast<int64_t>(image_size_.width) * image_size_.height *
+      num_channels;
+  CHECK_GE(gradient_constants.size(), num_parameters)
+      << "Missing gradient constants.";
+
+  residuals->resize(num_parameters);
+  gradient->assign(num_parameters, 0.0);
+  ComputeResidualsAndGradient(
+      image_data,
+      num_channels,
+      gradient_constants.data(),
+      1.0,
+      nullptr,
+      residuals->data(),
+      gradient->data(),
+      nullptr);
+}
+
+double StencilRegularizer::AccumulateWeightedGradient(
+    const double* image_data,
+    const int num_channels,
+    const double regularization_parameter,
+    const double* weights,
+    double* gradient,
+    double* residuals) const {
+
+  PROFILE_SCOPE("StencilRegularizer::AccumulateWeightedGradient");
+
+  CHECK_NOTNULL(image_data);
+  CHECK_NOTNULL(weights);
+  CHECK_NOTNULL(gradient);
+
+  // The weights are the gradient constants, scaled by the regularization
+  // parameter as they are used.
+  return ComputeResidualsAndGradient(
+      image_data,
+      num_channels,
+      weights,
+      regularization_parameter,
+      nullptr,
+      residuals,
+      gradient,
+      nullptr);
+}
+
+double StencilRegularizer::AccumulateWeightedGradientInRows(
+    const double* image_data,
+    const int num_channels,
+    const double regularization_parameter,
+    const double* weights,
+    const std::vector<uint8_t>* active_rows,
+    double* gradient,
+    double* residuals,
+    double* row_costs) const {
+
+  PROFILE_SCOPE("StencilRegularizer::AccumulateWeightedGradientInRows");
+
+  CHECK_NOTNULL(image_data);
+  CHECK_NOTNULL(weights);
+  CHECK_NOTNULL(residuals);
+  CHECK_NOTNULL(row_costs);
+
+  if (active_rows == nullptr) {
+    return ComputeResidualsAndGradient(
+        image_data, num_channels, weights, regularization_parameter, nullptr,
+        residuals, gradient, row_costs);
+  }
+
+  // The value of row r depends on the rows r + o for every row offset o of
+  // the stencil, so it changes if any of them is active. These are also
+  // exactly the rows whose derivatives reach the active rows.
+  const int height = image_size_.height;
+  CHECK_EQ(active_rows->size(), height) << "Need one value per image row.";
+  std::vector<uint8_t> evaluated_rows(*active_rows);
+  for (const StencilTerm& term : stencil_) {
+    for (int row = 0; row < height; ++row) {
+      const int neighbor_row = row + term.row_offset;
+      if (neighbor_row >= 0 && neighbor_row < height &&
+          (*active_rows)[neighbor_row] != 0) {
+        evaluated_rows[row] = 1;
+      }
+    }
+  }
+  return ComputeResidualsAndGradient(
+      image_data,
+      num_channels,
+      weights,
+      regularization_parameter,
+      evaluated_rows.data(),
+      residuals,
+      gradient,
+      row_costs);
+}
+
+int StencilRegularizer::GetNumDifferenceOperators() const {
+  if (penalty_.type != STENCIL_PENALTY_L1) {
+    return 0;
+  }
+  return stencil_.size();
+}
+
+void StencilRegularizer::ApplyDifferenceOperators(
+    const double* image_data,
+    const int num_channels,
+    double* differences) const {
+
+  CHECK_NOTNULL(image_data);
+  CHECK_NOTNULL(differences);
+  CHECK_GT(GetNumDifferenceOperators(), 0)
+      << "Only 1-norm stencils have difference operators.";
+
+  const StencilImage image =
+      GetStencilImage(image_data, image_size_, num_channels, stencil_);
+  const int64_t num_data_points = image.num_pixels * num_channels;
+  for (int k = 0; k < stencil_.size(); ++k) {
+    const StencilTerm& term = stencil_[k];
+    double* operator_differences = differences + k * num_data_points;
+    std::fill(
+        operator_differences, operator_differences + num_data_points, 0.0);
+    for (int channel = 0; channel < num_channels; ++channel) {
+      for (int row = 0; row < image.height; ++row) {
+        int col_begin;
+        int col_end;
+        if (!GetNeighborColumns(
+            image, term.row_offset, term.col_offset, term.channel_offset,
+            channel, row, &col_begin, &col_end)) {
+          continue;
+        }
+        const int64_t offset = channel * image.num_pixels +
+            static_cast<int64_t>(row) * image.width;
+        const double* pixels = image_data + offset;
+        const double* neighbors = pixels + image.neighbor_deltas[k];
+        double* row_differences = operator_differences + offset;
+        for (int col = col_begin; col < col_end; ++col) {
+          row_differences[col] = term.weight * (neighbors[col] - pixels[col]);
+        }
+      }
+    }
+  }
+}
+
+void StencilRegularizer::ApplyDifferenceOperatorsTranspose(
+    const double* differences,
+    const int num_channels,
+    double* image_data) const {
+
+  CHECK_NOTNULL(differences);
+  CHECK_NOTNULL(image_data);
+  CHECK_GT(GetNumDifferenceOperators(), 0)
+      << "Only 1-norm stencils have difference operators.";
+
+  const StencilImage image =
+      GetStencilImage(image_data, image_size_, num_channels, stencil_);
+  const int64_t num_data_points = image.num_pixels * num_channels;
+  std::fill(image_data, image_data + num_data_points, 0.0);
+  for (int k = 0; k < stencil_.size(); ++k) {
+    const StencilTerm& term = stencil_[k];
+    const double* operator_differences = differences + k * num_data_points;
+    for (int channel = 0; channel < num_channels; ++channel) {
+      for (int row = 0; row < image.height; ++row) {
+        int col_begin;
+        int col_end;
+        if (!GetNeighborColumns(
+            image, term.row_offset, term.col_offset, term.channel_offset,
+            channel, row, &col_begin, &col_end)) {
+          continue;
+        }
+        const int64_t offset = channel * image.num_pixels +
+            static_cast<int64_t>(row) * image.width;
+        double* pixels = image_data + offset;
+        double* neighbors = pixels + image.neighbor_deltas[k];
+        const double* row_differences = operator_differences + offset;
+        // Each difference is subtracted from the pixel itself and added to
+        // the neighbor it was taken with.
+        for (int col = col_begin; col < col_end; ++col) {
+          const double weighted_difference = term.weight * row_differences[col];
+          pixels[col] -= weighted_difference;
+          neighbors[col] += weighted_difference;
+        }
+      }
+    }
+  }
+}
+
+void StencilRegularizer::AddWeightedHessianDiagonal(
+    const std::vector<double>& gradient_constants,
+    const int num_channels,
+    double* diagonal) const {
+
+  CHECK_NOTNULL(diagonal);
+
+  const StencilImage image =
+      GetStencilImage(nullptr, image_size_, num_channels, stencil_);
+  CHECK_GE(gradient_constants.size(), image.num_pixels * num_channels)
+      << "Missing gradient constants.";
+  for (int k = 0; k < stencil_.size(); ++k) {
+    const StencilTerm& term = stencil_[k];
+    const double squared_weight = term.weight * term.weight;
+    for (int channel = 0; channel < num_channels; ++channel) {
+      for (int row = 0; row < image.height; ++row) {
+        int col_begin;
+        int col_end;
+        if (!GetNeighborColumns(
+            image, term.row_offset, term.col_offset, term.channel_offset,
+            channel, row, &col_begin, &col_end)) {
+          continue;
+        }
+        const int64_t offset = channel * image.num_pixels +
+            static_cast<int64_t>(row) * image.width;
+        const double* constants = gradient_constants.data() + offset;
+        double* pixels = diagonal + offset;
+        double* neighbors = pixels + image.neighbor_deltas[k];
+        for (int col = col_begin; col < col_end; ++col) {
+          const double weight = 2.0 * squared_weight * constants[col];
+          pixels[col] += weight;
+          neighbors[col] += weight;
+        }
+      }
+    }
+  }
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,226 @@
+// A regularizer defined by a stencil: a set of weighted differences between
+// every pixel and its neighbors at fixed (row, column, channel) offsets, and a
+// penalty function applied to each difference. The value at each pixel p is
+//   r_p = sum_k penalty(w_k * (x_{p + o_k} - x_p)),
+// where differences to neighbors outside of the image are 0. As for every
+// regularizer, the cost is the weighted least squares sum_p c_p r_p^2.
+//
+// The residual and gradient kernels are shared by all stencils, so a new
+// regularizer only has to describe its stencil. Every difference of the
+// stencil is applied to a whole row at once, so the inner loops run over
+// contiguous pixels without bounds checks and are vectorized by the compiler.
+// The rows are split between threads (see SetNumThreads()), and stencils that
+// reach into the next channels are traversed in tiles of rows across all
+// channels to keep the neighboring channels cached.
+//
+// TotalVariationRegularizer and BilateralTotalVariationRegularizer are
+// stencil regularizers. Other stencils can be used directly, e.g. a Huber
+// total variation:
+//   StencilRegularizer regularizer(
+//       image_size,
+//       GetTotalVariationStencil(false),
+//       StencilPenalty(STENCIL_PENALTY_HUBER, 0.01));
+
+#ifndef SRC_OPTIMIZATION_STENCIL_REGULARIZER_H_
+#define SRC_OPTIMIZATION_STENCIL_REGULARIZER_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "optimization/regularizer.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+// One difference of a stencil: the weighted difference between the neighbor
+// at the given offset and the pixel itself.
+struct StencilTerm {
+  StencilTerm() = default;
+  StencilTerm(
+      const int row_offset,
+      const int col_offset,
+      const int channel_offset,
+      const double weight)
+      : row_offset(row_offset),
+        col_offset(col_offset),
+        channel_offset(channel_offset),
+        weight(weight) {}
+
+  int row_offset = 0;
+  int col_offset = 0;
+  int channel_offset = 0;
+  double weight = 1.0;
+};
+
+// The penalty function applied to every difference d of a stencil.
+enum StencilPenaltyType {
+  // |d|, as in total variation.
+  STENCIL_PENALTY_L1,
+
+  // d^2 / (2 delta) if |d| <= delta, and |d| - delta / 2 otherwise. This is
+  // smooth at 0, so small differences (noise) are penalized less than by the
+  // 1-norm while edges are still preserved.
+  STENCIL_PENALTY_HUBER,
+
+  // |d|^p for 1 <= p <= 2.
+  STENCIL_PENALTY_LP
+};
+
+struct StencilPenalty {
+  StencilPenalty() = default;
+  StencilPenalty(const StencilPenaltyType type, const double parameter)
+      : type(type), parameter(parameter) {}
+
+  StencilPenaltyType type = STENCIL_PENALTY_L1;
+
+  // The delta of the Huber penalty or the exponent p of the Lp penalty.
+  double parameter = 0.0;
+};
+
+// Returns the stencil of total variation: the forward differences to the
+// right, below, and (for 3D total variation) to the next channel.
+std::vector<StencilTerm> GetTotalVariationStencil(
+    const bool use_3d_total_variation);
+
+// Returns the stencil of bilateral total variation: the difference between the
+// pixel and every pixel at offset (i, j) with 0 <= i, j <= scale_range except
+// (0, 0), ordered by i and then j, weighted by spatial_decay^(i + j).
+std::vector<StencilTerm> GetBilateralTotalVariationStencil(
+    const int scale_range, const double spatial_decay);
+
+class StencilRegularizer : public Regularizer {
+ public:
+  StencilRegularizer(
+      const cv::Size& image_size,
+      const std::vector<StencilTerm>& stencil,
+      const StencilPenalty& penalty = StencilPenalty());
+
+  virtual std::vector<double> ApplyToImage(
+      const double* image_data, const int num_channels) const;
+
+  virtual std::pair<std::vector<double>, std::vector<double>>
+  ApplyToImageWithDifferentiation(
+      const double* image_data,
+      const std::vector<double>& gradient_constants,
+      const int num_channels) const;
+
+  // Versions of the above that write into the given buffers.
+  virtual void ApplyToImage(
+      const double* image_data,
+      const int num_channels,
+      std::vector<double>* residuals) const;
+
+  virtual void ApplyToImageWithDifferentiation(
+      const double* image_data,
+      const std::vector<double>& gradient_constants,
+      const int num_channels,
+      std::vector<double>* residuals,
+      std::vector<double>* gradient) const;
+
+  // Computes the residuals and adds the gradient of the weighted cost
+  // directly into the given gradient, without any gradient constants.
+  virtual double AccumulateWeightedGradient(
+      const double* image_data,
+      const int num_channels,
+      const double regularization_parameter,
+      const double* weights,
+      double* gradient,
+      double* residuals) const;
+
+  // The value of a pixel only depends on the rows within the row offsets of
+  // the stencil, so every row that reaches an active row is evaluated.
+  virtual bool CanEvaluateRows() const {
+    return true;
+  }
+
+  virtual double AccumulateWeightedGradientInRows(
+      const double* image_data,
+      const int num_channels,
+      const double regularization_parameter,
+      const double* weights,
+      const std::vector<uint8_t>* active_rows,
+      double* gradient,
+      double* residuals,
+      double* row_costs) const;
+
+  // With the 1-norm penalty, every term of the stencil is a difference
+  // operator, in the order of the stencil. Other penalties have no difference
+  // operators.
+  virtual int GetNumDifferenceOperators() const;
+
+  virtual void ApplyDifferenceOperators(
+      const double* image_data,
+      const int num_channels,
+      double* differences) const;
+
+  virtual void ApplyDifferenceOperatorsTranspose(
+      const double* differences,
+      const int num_channels,
+      double* image_data) const;
+
+  // An approximation of the diagonal: every difference with weight w adds
+  // 2 c w^2 at both the pixel and its neighbor, whatever the penalty, as if
+  // the cost were the sum of the squared differences. The cross terms of the
+  // differences in c (sum_k |w_k d_k|)^2 are dropped, which is good enough
+  // for a diagonal preconditioner.
+  virtual void AddWeightedHessianDiagonal(
+      const std::vector<double>& gradient_constants,
+      const int num_channels,
+      double* diagonal) const;
+
+  // The coarse regularizer has the same stencil and penalty. Since the
+  // stencil offsets are in pixels, each difference then spans twice the
+  // distance, which matches the Galerkin product of the fine differences.
+  virtual std::shared_ptr<Regularizer> CreateCoarseRegularizer(
+      const cv::Size& coarse_image_size) const;
+
+  // Sets the number of threads used to compute the residuals and gradient.
+  // The image rows are split evenly between the threads. Set to 0 to use all
+  // hardware threads. By default, everything is computed serially.
+  void SetNumThreads(const int num_threads);
+
+  const std::vector<StencilTerm>& GetStencil() const {
+    return stencil_;
+  }
+
+ protected:
+  // Replaces the stencil, e.g. to switch between 2D and 3D total variation.
+  void SetStencil(const std::vector<StencilTerm>& stencil);
+
+ private:
+  // Computes the residuals, and the gradient of the weighted cost if gradient
+  // is not null, in the rows marked in evaluated_rows or in all rows if it is
+  // null (see the source file).
+  double ComputeResidualsAndGradient(
+      const double* image_data,
+      const int num_channels,
+      const double* gradient_constants,
+      const double gradient_scale,
+      const uint8_t* evaluated_rows,
+      double* residuals,
+      double* gradient,
+      double* row_costs) const;
+
+  // Runs the given function over row ranges [row_start, row_end) that cover
+  // the whole image. The ranges are processed in parallel if multiple threads
+  // are used.
+  void RunOverRows(
+      const std::function<void(const int, const int)>& function) const;
+
+  std::vector<StencilTerm> stencil_;
+  const StencilPenalty penalty_;
+
+  // The number of threads used and the pool of additional threads. The pool
+  // is null if everything is computed serially.
+  int num_threads_ = 1;
+  std::shared_ptr<util::ThreadPool> thread_pool_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_STENCIL_REGULARIZER_H_
@@ -0,0 +1,139 @@
+#include "optimization/temporal_prior_regularizer.h"
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "image/image_data.h"
+#include "util/matrix_util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+
+TemporalPriorRegularizer::TemporalPriorRegularizer(
+    const ImageData& prior, const cv::Mat& confidence)
+    : Regularizer(prior.GetImageSize()),
+      num_channels_(prior.GetNumChannels()) {
+
+  CHECK_GT(num_channels_, 0) << "The prior is empty.";
+  CHECK_EQ(confidence.size(), image_size_)
+      << "The confidence must have the size of the prior.";
+  CHECK_EQ(confidence.channels(), 1) << "The confidence must be one channel.";
+
+  const int64_t num_pixels = prior.GetNumPixels();
+  prior_values_.resize(num_pixels * num_channels_);
+  for (int channel = 0; channel < num_channels_; ++channel) {
+    cv::Mat prior_channel(
+        image_size_, util::kOpenCvMatrixType,
+        prior_values_.data() + channel * num_pixels);
+    prior.GetChannelImage(channel).convertTo(
+        prior_channel, util::kOpenCvMatrixType);
+  }
+  confidences_.resize(num_pixels);
+  cv::Mat confidence_image(
+      image_size_, util::kOpenCvMatrixType, confidences_.data());
+  confidence.convertTo(confidence_image, util::kOpenCvMatrixType);
+}
+
+std::vector<double> TemporalPriorRegularizer::ApplyToImage(
+    const double* image_data, const int num_channels) const {
+
+  std::vector<double> residuals;
+  ApplyToImage(image_data, num_channels, &residuals);
+  return residuals;
+}
+
+std::pair<std::vector<double>, std::vector<double>>
+TemporalPriorRegularizer::ApplyToImageWithDifferentiation(
+    const double* image_data,
+    const std::vector<double>& gradient_constants,
+    const int num_channels) const {
+
+  std::vector<double> residuals;
+  std::vector<double> gradient;
+  ApplyToImageWithDifferentiation(
+      image_data, gradient_constants, num_channels, &residuals, &gradient);
+  return std::make_pair(residuals, gradient);
+}
+
+void TemporalPriorRegularizer::ApplyToImage(
+    const double* image_data,
+    const int num_channels,
+    std::vector<double>* residuals) const {
+
+  CHECK_NOTNULL(image_data);
+  CHECK_NOTNULL(residuals);
+  CheckNumChannels(num_channels);
+
+  const int64_t num_pixels = confidences_.size();
+  residuals->resize(prior_values_.size());
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const int64_t offset = channel * num_pixels;
+    for (int64_t i = 0; i < num_pixels; ++i) {
+      (*residuals)[offset + i] = confidences_[i] *
+          std::abs(image_data[offset + i] - prior_values_[offset + i]);
+    }
+  }
+}
+
+void TemporalPriorRegularizer::ApplyToImageWithDifferentiation(
+    const double* image_data,
+    const std::vector<double>& gradient_constants,
+    const int num_channels,
+    std::vector<double>* residuals,
+    std::vector<double>* gradient) const {
+
+  CHECK_NOTNULL(image_data);
+  CHECK_NOTNULL(residuals);
+  CHECK_NOTNULL(gradient);
+  CheckNumChannels(num_channels);
+  CHECK_GE(gradient_constants.size(), prior_values_.size())
+      << "Missing gradient constants.";
+
+  // The derivative of c * (confidence * |x - p|)^2 is
+  // 2 c confidence^2 (x - p).
+  const int64_t num_pixels = confidences_.size();
+  residuals->resize(prior_values_.size());
+  gradient->resize(prior_values_.size());
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const int64_t offset = channel * num_pixels;
+    for (int64_t i = 0; i < num_pixels; ++i) {
+      const double difference =
+          image_data[offset + i] - prior_values_[offset + i];
+      (*residuals)[offset + i] = confidences_[i] * std::abs(difference);
+      (*gradient)[offset + i] = 2.0 * gradient_constants[offset + i] *
+          confidences_[i] * confidences_[i] * difference;
+    }
+  }
+}
+
+void TemporalPriorRegularizer::AddWeightedHessianDiagonal(
+    const std::vector<double>& gradient_constants,
+    const int num_channels,
+    double* diagonal) const {
+
+  CHECK_NOTNULL(diagonal);
+  CheckNumChannels(num_channels);
+  CHECK_GE(gradient_constants.size(), prior_values_.size())
+      << "Missing gradient constants.";
+
+  const int64_t num_pixels = confidences_.size();
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const int64_t offset = channel * num_pixels;
+    for (int64_t i = 0; i < num_pixels; ++i) {
+      diagonal[offset + i] += 2.0 * gradient_constants[offset + i] *
+          confidences_[i] * confidences_[i];
+    }
+  }
+}
+
+void TemporalPriorRegularizer::CheckNumChannels(const int num_channels) const {
+  CHECK_EQ(num_channels, num_channels_)
+      << "The image must have as many channels as the prior.";
+}
+
+}  // namespace super_resolution
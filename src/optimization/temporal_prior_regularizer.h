@@ -0,0 +1,76 @@
+// The temporal prior regularizer pulls the estimate towards a prior image,
+// such as the previous high-resolution frame of a video moved to the current
+// frame's position. The value at each pixel i is
+//   r_i = c_i |x_i - p_i|
+// where p is the prior and c is a per-pixel confidence in [0, 1] that is
+// shared by all channels. Pixels where the prior is not known (e.g. those
+// moved in from outside the previous frame) or disagrees with the new
+// observations get a low confidence, so they are left to the data term.
+//
+// With the IRLS solver's default 1-norm, the prior is robust: pixels that
+// differ a lot from the prior (e.g. occlusions) are pulled towards it less.
+
+#ifndef SRC_OPTIMIZATION_TEMPORAL_PRIOR_REGULARIZER_H_
+#define SRC_OPTIMIZATION_TEMPORAL_PRIOR_REGULARIZER_H_
+
+#include <utility>
+#include <vector>
+
+#include "image/image_data.h"
+#include "optimization/regularizer.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+class TemporalPriorRegularizer : public Regularizer {
+ public:
+  // The confidence must be a single channel image of the prior's size. The
+  // prior and confidence are copied.
+  TemporalPriorRegularizer(const ImageData& prior, const cv::Mat& confidence);
+
+  virtual std::vector<double> ApplyToImage(
+      const double* image_data, const int num_channels) const;
+
+  virtual std::pair<std::vector<double>, std::vector<double>>
+  ApplyToImageWithDifferentiation(
+      const double* image_data,
+      const std::vector<double>& gradient_constants,
+      const int num_channels) const;
+
+  // Versions of the above that write into the given buffers.
+  virtual void ApplyToImage(
+      const double* image_data,
+      const int num_channels,
+      std::vector<double>* residuals) const;
+
+  virtual void ApplyToImageWithDifferentiation(
+      const double* image_data,
+      const std::vector<double>& gradient_constants,
+      const int num_channels,
+      std::vector<double>* residuals,
+      std::vector<double>* gradient) const;
+
+  // Every value depends only on its own pixel, so the diagonal is exact:
+  // c_i r_i^2 adds 2 c_i confidence_i^2.
+  virtual void AddWeightedHessianDiagonal(
+      const std::vector<double>& gradient_constants,
+      const int num_channels,
+      double* diagonal) const;
+
+ private:
+  // Checks that the number of channels matches the prior.
+  void CheckNumChannels(const int num_channels) const;
+
+  // The prior values of all channels, one channel after another.
+  std::vector<double> prior_values_;
+
+  // The confidence of every pixel.
+  std::vector<double> confidences_;
+
+  int num_channels_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_TEMPORAL_PRIOR_REGULARIZER_H_
@@ -0,0 +1,343 @@
+#include "optimization/tiled_solver.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
+#include "util/matrix_util.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace {
+
+// Rounds the given value up to the nearest multiple of the factor.
+int RoundUpToMultiple(const int value, const int factor) {
+  return ((value + factor - 1) / factor) * factor;
+}
+
+// Splits the region of the image into tiles with interiors of (at most)
+// tile_size pixels, padded by halo_size pixels on every side that is not an
+// image border. The halo only contributes to the blend with decreasing
+// weights.
+std::vector<TiledSolverTile> GetTiles(
+    const cv::Size& image_size,
+    const cv::Rect& region,
+    const int tile_size,
+    const int halo_size) {
+
+  const int region_x_end = region.x + region.width;
+  const int region_y_end = region.y + region.height;
+  std::vector<TiledSolverTile> tiles;
+  for (int y = region.y; y < region_y_end; y += tile_size) {
+    for (int x = region.x; x < region_x_end; x += tile_size) {
+      TiledSolverTile tile;
+      tile.index = tiles.size();
+      tile.interior = cv::Rect(
+          x, y,
+          std::min(tile_size, region_x_end - x),
+          std::min(tile_size, region_y_end - y));
+      const int padded_x = std::max(0, x - halo_size);
+      const int padded_y = std::max(0, y - halo_size);
+      const int padded_x_end = std::min(
+          image_size.width, tile.interior.x + tile.interior.width + halo_size);
+      const int padded_y_end = std::min(
+          image_size.height,
+          tile.interior.y + tile.interior.height + halo_size);
+      tile.padded_region = cv::Rect(
+          padded_x, padded_y, padded_x_end - padded_x, padded_y_end - padded_y);
+      tiles.push_back(tile);
+    }
+  }
+  return tiles;
+}
+
+// Returns the blending weight along one axis for a pixel at the given
+// coordinate. The weight is 1 inside the interior [interior_start,
+// interior_end) and falls off linearly towards the ends of the padded range
+// [padded_start, padded_end).
+double GetBlendWeight(
+    const int coordinate,
+    const int padded_start,
+    const int padded_end,
+    const int interior_start,
+    const int interior_end) {
+
+  if (coordinate < interior_start) {
+    return static_cast<double>(coordinate - padded_start + 1) /
+        (interior_start - padded_start + 1);
+  }
+  if (coordinate >= interior_end) {
+    return static_cast<double>(padded_end - coordinate) /
+        (padded_end - interior_end + 1);
+  }
+  return 1.0;
+}
+
+// Returns the total variation (the sum of the absolute differences between
+// horizontal and vertical neighbors) of the given region of the image, over
+// all channels. This is a cheap estimate of how much detail a tile has, and
+// thus of how many iterations its solver needs.
+double GetTotalVariation(const ImageData& image, const cv::Rect& region) {
+  double total_variation = 0.0;
+  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+    const cv::Mat channel_region = image.GetChannelImage(channel)(region);
+    if (region.width > 1) {
+      total_variation += cv::norm(
+          channel_region.colRange(1, region.width),
+          channel_region.colRange(0, region.width - 1),
+          cv::NORM_L1);
+    }
+    if (region.height > 1) {
+      total_variation += cv::norm(
+          channel_region.rowRange(1, region.height),
+          channel_region.rowRange(0, region.height - 1),
+          cv::NORM_L1);
+    }
+  }
+  return total_variation;
+}
+
+// Returns the given region of every (visible) channel of the image.
+ImageData CropImage(const ImageData& image, const cv::Rect& region) {
+  ImageData cropped_image;
+  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+    cropped_image.AddChannel(
+        image.GetChannelImage(channel)(region).clone(),
+        DO_NOT_NORMALIZE_IMAGE);
+  }
+  return cropped_image;
+}
+
+}  // namespace
+
+int GetTileHaloSize(
+    const int scale,
+    const int blur_radius,
+    const MotionShiftSequence& motion_sequence,
+    const int regularizer_range) {
+
+  CHECK_GE(scale, 1);
+  double max_motion = 0.0;
+  for (int i = 0; i < motion_sequence.GetNumMotionShifts(); ++i) {
+    const MotionShift& motion_shift = motion_sequence[i];
+    max_motion = std::max(max_motion, std::abs(motion_shift.dx));
+    max_motion = std::max(max_motion, std::abs(motion_shift.dy));
+  }
+
+  // The gradient of the data term applies the image model and then its
+  // transpose, so the blur and motion reach is counted twice. The
+  // downsampling grid adds up to one LR pixel.
+  const int model_reach = (blur_radius / 2) + static_cast<int>(
+      std::ceil(max_motion));
+  const int halo_size = 2 * model_reach + scale + regularizer_range;
+  return RoundUpToMultiple(halo_size, scale);
+}
+
+TiledSolver::TiledSolver(
+    const TiledSolverOptions& solver_options,
+    const ImageModel& image_model,
+    const std::vector<ImageData>& low_res_images,
+    const TileSolveFunction& solve_tile,
+    const bool print_solver_output)
+    : Solver(image_model, print_solver_output),
+      solver_options_(solver_options),
+      low_res_images_(low_res_images),
+      solve_tile_(solve_tile) {
+
+  CHECK_GT(low_res_images_.size(), 0)
+      << "Cannot super-resolve with 0 low-res images.";
+  CHECK_GT(solver_options_.tile_size, 0) << "Tile size must be positive.";
+  CHECK_GE(solver_options_.halo_size, 0) << "Halo size cannot be negative.";
+}
+
+ImageData TiledSolver::Solve(const ImageData& initial_estimate) {
+  const int scale = image_model_->GetDownsamplingScale();
+  const cv::Size image_size = initial_estimate.GetImageSize();
+  const cv::Size low_res_size = low_res_images_[0].GetImageSize();
+  CHECK_EQ(image_size.width, low_res_size.width * scale)
+      << "The initial estimate must be the HR size of the low-res images.";
+  CHECK_EQ(image_size.height, low_res_size.height * scale)
+      << "The initial estimate must be the HR size of the low-res images.";
+
+  // Tiles must be aligned with the LR grid, so that every tile is the exact
+  // HR size of its LR crops.
+  // The region of interest is solved as the smallest region around it that
+  // is aligned with the LR grid, and cropped at the end.
+  const cv::Rect image_region(cv::Point(0, 0), image_size);
+  cv::Rect region_of_interest = image_region;
+  cv::Rect solved_region = image_region;
+  if (solver_options_.region_of_interest.area() > 0) {
+    region_of_interest = solver_options_.region_of_interest;
+    CHECK((region_of_interest & image_region) == region_of_interest)
+        << "The region of interest must be inside the HR image.";
+    const int x = (region_of_interest.x / scale) * scale;
+    const int y = (region_of_interest.y / scale) * scale;
+    solved_region = cv::Rect(
+        x, y,
+        RoundUpToMultiple(
+            region_of_interest.x + region_of_interest.width, scale) - x,
+        RoundUpToMultiple(
+            region_of_interest.y + region_of_interest.height, scale) - y);
+    LOG(INFO) << "Solving the region of interest " << solved_region
+              << " of the " << image_size << " HR image.";
+  }
+  const int tile_size = RoundUpToMultiple(solver_options_.tile_size, scale);
+  const int halo_size = RoundUpToMultiple(solver_options_.halo_size, scale);
+  const std::vector<TiledSolverTile> tiles =
+      GetTiles(image_size, solved_region, tile_size, halo_size);
+  const int num_tiles = tiles.size();
+  LOG(INFO) << "Solving " << num_tiles << " tiles of size " << tile_size
+            << " with a halo of " << halo_size << " pixels.";
+
+  // The tiles with the most detail usually take the longest to converge, so
+  // they are started first. Ties keep the row-major order.
+  std::vector<double> tile_total_variations(num_tiles);
+  for (int tile_index = 0; tile_index < num_tiles; ++tile_index) {
+    tile_total_variations[tile_index] = GetTotalVariation(
+        initial_estimate, tiles[tile_index].padded_region);
+  }
+  std::vector<int> tile_order(num_tiles);
+  for (int tile_index = 0; tile_index < num_tiles; ++tile_index) {
+    tile_order[tile_index] = tile_index;
+  }
+  std::stable_sort(
+      tile_order.begin(), tile_order.end(),
+      [&tile_total_variations](const int first, const int second) {
+        return tile_total_variations[first] > tile_total_variations[second];
+      });
+
+  // The weighted sum of the tile results and the sum of the weights at every
+  // pixel of the solved region, which are divided after all tiles are done.
+  const int num_channels = initial_estimate.GetNumChannels();
+  std::vector<cv::Mat> weighted_sums;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    weighted_sums.push_back(
+        cv::Mat::zeros(solved_region.size(), util::kOpenCvMatrixType));
+  }
+  cv::Mat weight_sums =
+      cv::Mat::zeros(solved_region.size(), util::kOpenCvMatrixType);
+  std::mutex blend_mutex;
+
+  // The area of the tiles that did not start yet, for sharing the deadline.
+  const int num_workers = std::min(
+      util::GetNumThreadsToUse(solver_options_.num_tile_workers), num_tiles);
+  std::mutex deadline_mutex;
+  double remaining_area = 0.0;
+  for (const TiledSolverTile& tile : tiles) {
+    remaining_area += tile.padded_region.area();
+  }
+
+  const auto solve_tile = [&](const int order_index) {
+    const int tile_index = tile_order[order_index];
+    TiledSolverTile tile = tiles[tile_index];
+    const cv::Rect& padded_region = tile.padded_region;
+    SolverDeadline* deadline = solver_options_.deadline.get();
+    if (deadline != nullptr) {
+      std::lock_guard<std::mutex> lock(deadline_mutex);
+      const double area = padded_region.area();
+      tile.deadline = deadline->CreateShare(
+          std::min(num_workers * area / remaining_area, 1.0));
+      remaining_area -= area;
+    }
+    const auto crop_start_time = SolverDeadline::Clock::now();
+    const cv::Rect low_res_region(
+        padded_region.x / scale,
+        padded_region.y / scale,
+        padded_region.width / scale,
+        padded_region.height / scale);
+    std::vector<ImageData> tile_low_res_images;
+    for (const ImageData& low_res_image : low_res_images_) {
+      tile_low_res_images.push_back(CropImage(low_res_image, low_res_region));
+    }
+    const ImageData tile_initial_estimate =
+        CropImage(initial_estimate, padded_region);
+    if (deadline != nullptr) {
+      deadline->RecordStage("tile cropping", crop_start_time);
+    }
+
+    LOG(INFO) << "Solving tile " << (tile_index + 1) << " of " << num_tiles
+              << ".";
+    const auto start_time = std::chrono::steady_clock::now();
+    const ImageData tile_result =
+        solve_tile_(tile_low_res_images, tile_initial_estimate, tile);
+    const std::chrono::duration<double> elapsed_time_seconds =
+        std::chrono::steady_clock::now() - start_time;
+    LOG(INFO) << "Solved tile " << (tile_index + 1) << " in "
+              << elapsed_time_seconds.count() << " seconds.";
+    CHECK_EQ(tile_result.GetImageSize(), padded_region.size())
+        << "The tile result does not match the tile size.";
+    CHECK_EQ(tile_result.GetNumChannels(), num_channels)
+        << "The tile result does not match the number of channels.";
+
+    // Blend the result into the solved region. The halo outside of the
+    // region is only context for the solver and is discarded.
+    const auto blend_start_time = SolverDeadline::Clock::now();
+    std::lock_guard<std::mutex> lock(blend_mutex);
+    const cv::Rect blended_region = padded_region & solved_region;
+    for (int row = blended_region.y - padded_region.y;
+         row < blended_region.y + blended_region.height - padded_region.y;
+         ++row) {
+      const int y = padded_region.y + row;
+      const double row_weight = GetBlendWeight(
+          y,
+          padded_region.y,
+          padded_region.y + padded_region.height,
+          tile.interior.y,
+          tile.interior.y + tile.interior.height);
+      for (int col = blended_region.x - padded_region.x;
+           col < blended_region.x + blended_region.width - padded_region.x;
+           ++col) {
+        const int x = padded_region.x + col;
+        const double weight = row_weight * GetBlendWeight(
+            x,
+            padded_region.x,
+            padded_region.x + padded_region.width,
+            tile.interior.x,
+            tile.interior.x + tile.interior.width);
+        const int region_y = y - solved_region.y;
+        const int region_x = x - solved_region.x;
+        weight_sums.at<double>(region_y, region_x) += weight;
+        for (int channel = 0; channel < num_channels; ++channel) {
+          weighted_sums[channel].at<double>(region_y, region_x) +=
+              weight * tile_result.GetPixelValue(channel, row, col);
+        }
+      }
+    }
+    if (deadline != nullptr) {
+      deadline->RecordStage("tile blending", blend_start_time);
+    }
+  };
+
+  if (num_workers > 1) {
+    // The calling thread also solves tiles, so one fewer worker is needed.
+    util::ThreadPool thread_pool(num_workers - 1);
+    thread_pool.ParallelFor(num_tiles, solve_tile);
+  } else {
+    for (int order_index = 0; order_index < num_tiles; ++order_index) {
+      solve_tile(order_index);
+    }
+  }
+
+  // Every pixel is in the interior of exactly one tile, so every weight sum
+  // is at least 1.
+  const cv::Rect result_region(
+      region_of_interest.tl() - solved_region.tl(), region_of_interest.size());
+  ImageData result;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const cv::Mat solved_channel = weighted_sums[channel] / weight_sums;
+    result.AddChannel(
+        solved_channel(result_region).clone(), DO_NOT_NORMALIZE_IMAGE);
+  }
+  return result;
+}
+
+}  // namespace super_resolution
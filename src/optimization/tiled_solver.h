@@ -0,0 +1,130 @@
+// The TiledSolver splits a super-resolution problem over a large HR domain
+// into rectangular tiles that are solved independently. Each tile is padded
+// with a halo of neighboring pixels so that the image model and regularizer
+// see the same context as they would in the full image, and the overlapping
+// halos are blended with linear weights to hide the seams. The memory used by
+// the solver for each tile is bounded by the padded tile size rather than by
+// the image size, so images that are too large to solve at once can be
+// super-resolved.
+
+#ifndef SRC_OPTIMIZATION_TILED_SOLVER_H_
+#define SRC_OPTIMIZATION_TILED_SOLVER_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
+#include "optimization/solver.h"
+#include "optimization/solver_deadline.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+
+// Returns a halo size (in HR pixels) that covers everything that affects a
+// pixel's gradient in the MAP objective: the blur and motion of the forward
+// model and its transpose, plus the range of the regularizer (e.g. 1 for TV
+// or the scale range for BTV). The blur radius is the kernel size as given in
+// ImageModelParameters. The halo is rounded up to a multiple of the scale so
+// that tiles stay aligned with the LR grid.
+int GetTileHaloSize(
+    const int scale,
+    const int blur_radius,
+    const MotionShiftSequence& motion_sequence,
+    const int regularizer_range);
+
+// A tile of the HR image, as given to the tile solve function. The padded
+// region, which includes the halo, is the region that gets solved. The
+// interior is the part of the image that the tile is responsible for. Both
+// are in the pixel coordinates of the full HR image.
+struct TiledSolverTile {
+  // The position of the tile in row-major order, which identifies it across
+  // runs of the same image and options (e.g. for per-tile checkpoints).
+  int index = 0;
+
+  cv::Rect padded_region;
+  cv::Rect interior;
+
+  // The tile's share of the deadline of the solve, or null if there is none
+  // (see TiledSolverOptions::deadline).
+  std::shared_ptr<SolverDeadline> deadline;
+};
+
+struct TiledSolverOptions {
+  // The size (width and height) of the interior of every tile in HR pixels,
+  // not including the halo. It is rounded up to a multiple of the scale.
+  // Tiles at the right and bottom borders of the image may be smaller.
+  int tile_size = 256;
+
+  // The number of HR pixels added around each tile on every side that has a
+  // neighboring tile. See GetTileHaloSize(). It is rounded up to a multiple
+  // of the scale.
+  int halo_size = 16;
+
+  // If not empty, only this region of the HR image (in HR pixels) is solved,
+  // and Solve() returns an image of the size of the region. The region is
+  // tiled like the full image would be, and the halo of the tiles extends
+  // into the rest of the image, so the observations are only cropped and
+  // solved around the region and the cost scales with its area rather than
+  // with the image size. Use a tile size of at least the region size to solve
+  // it as a single tile.
+  cv::Rect region_of_interest;
+
+  // The number of tiles that are solved concurrently. Every concurrent tile
+  // runs its own solver, so memory use grows with the number of workers. Set
+  // to 0 to use all available hardware threads.
+  //
+  // Tiles differ a lot in how many iterations they need to converge (e.g. sky
+  // vs. texture), and every tile solver stops on its own. The workers pick up
+  // the next tile as soon as they are done, and the tiles are started in
+  // order of decreasing total variation of their initial estimate, so that
+  // the slowest tiles do not start last and easy tiles fill in around them.
+  int num_tile_workers = 1;
+
+  // An optional wall-clock budget for the whole solve. Every tile gets a
+  // share of the remaining time when it starts, in proportion to its area
+  // among the tiles that did not start yet (scaled by the number of
+  // concurrent workers), which is given to the tile solve function to use as
+  // the tile's deadline. The cropping and blending of the tiles are recorded
+  // as stages of the deadline.
+  std::shared_ptr<SolverDeadline> deadline;
+};
+
+class TiledSolver : public Solver {
+ public:
+  // Solves a single tile and returns its super-resolved image. The function
+  // is given the tile's LR images and its initial estimate, which has the
+  // padded tile size, and the tile itself, so that any state of the solve
+  // (e.g. checkpoints or a ground truth for stopping) can be kept per tile.
+  // It must be safe to call from multiple threads at once if
+  // num_tile_workers is not 1.
+  using TileSolveFunction = std::function<ImageData(
+      const std::vector<ImageData>& tile_low_res_images,
+      const ImageData& tile_initial_estimate,
+      const TiledSolverTile& tile)>;
+
+  // The low-res images are referenced, so they must outlive the solver.
+  TiledSolver(
+      const TiledSolverOptions& solver_options,
+      const ImageModel& image_model,
+      const std::vector<ImageData>& low_res_images,
+      const TileSolveFunction& solve_tile,
+      const bool print_solver_output = true);
+
+  // Solves every tile and returns the blended result, which has the same size
+  // as the initial estimate (or as the region of interest, if one is given).
+  // The initial estimate must be the HR size of the low-res images.
+  virtual ImageData Solve(const ImageData& initial_estimate);
+
+ private:
+  const TiledSolverOptions solver_options_;
+  const std::vector<ImageData>& low_res_images_;
+  const TileSolveFunction solve_tile_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_OPTIMIZATION_TILED_SOLVER_H_
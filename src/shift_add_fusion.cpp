@@ -1,18 +1,17 @@
-// Contains code for the shift-add fusion algorithm as explained in "An
-// Introduction to Super-Resolution Imaging (2012)".
+// Runs the shift-add fusion algorithm as explained in "An Introduction to
+// Super-Resolution Imaging (2012)" on a directory of LR images with a known
+// motion sequence. See image_model/shift_add_fusion.h for the algorithm.
 
 #include <string>
 #include <vector>
 
+#include "image/image_data.h"
+#include "image_model/shift_add_fusion.h"
 #include "motion/motion_shift.h"
+#include "util/data_loader.h"
 #include "util/macros.h"
 #include "util/util.h"
-#include "video/video_loader.h"
-
-#include "opencv2/core/core.hpp"
-#include "opencv2/highgui/highgui.hpp"
-#include "opencv2/imgproc/imgproc.hpp"
-#include "opencv2/photo/photo.hpp"
+#include "util/visualization.h"
 
 #include "gflags/gflags.h"
 #include "glog/logging.h"
@@ -26,6 +25,17 @@ DEFINE_string(input_motion_sequence, "",
 // Parameters for generating the high-resolution image.
 DEFINE_int32(upsampling_scale, 2,
     "The scale by which to up-scale the LR images.");
+DEFINE_string(fusion_mode, "mean",
+    "How the samples of each HR pixel are fused: 'mean', 'median' or "
+    "'trimmed'.");
+DEFINE_int32(num_threads, 1,
+    "Number of threads used for fusion (0 = all hardware threads).");
+
+// What to do with the result.
+DEFINE_bool(display_result, false,
+    "Display the fused image in a window.");
+DEFINE_string(result_path, "",
+    "Name of file (with path) where the fused image will be saved.");
 
 int main(int argc, char** argv) {
   super_resolution::util::InitApp(argc, argv,
@@ -34,62 +44,36 @@ int main(int argc, char** argv) {
   REQUIRE_ARG(FLAGS_input_image_dir);
   REQUIRE_ARG(FLAGS_input_motion_sequence);
 
-  super_resolution::VideoLoader video_loader;
-  video_loader.LoadFramesFromDirectory(FLAGS_input_image_dir);
-
-  // Create an empty HR image.
-  const cv::Size low_res_image_size = video_loader.GetImageSize();
-  const int fused_width = FLAGS_upsampling_scale * low_res_image_size.width;
-  const int fused_height = FLAGS_upsampling_scale * low_res_image_size.height;
-  cv::Mat fusion_image = cv::Mat::zeros(fused_width, fused_height, CV_8UC1);
-
-  // Non-zero pixels in the inpaint mask will indicate where the SR image needs
-  // to be inpainted after fusion.
-  cv::Mat inpaint_mask = cv::Mat::ones(fused_width, fused_height, CV_8UC1);
+  const std::vector<super_resolution::ImageData> low_res_images =
+      super_resolution::util::LoadImages(
+          FLAGS_input_image_dir, FLAGS_num_threads);
 
   // TODO: Eventually estimate the motion automatically.
   super_resolution::MotionShiftSequence motion_shift_sequence;
   motion_shift_sequence.LoadSequenceFromFile(FLAGS_input_motion_sequence);
-
-  const std::vector<cv::Mat>& frames = video_loader.GetFrames();
-  CHECK(motion_shift_sequence.GetNumMotionShifts() == frames.size())
+  CHECK(motion_shift_sequence.GetNumMotionShifts() == low_res_images.size())
       << "The number of motion estimates must match the number of frames.";
 
-  for (int i = 0; i < frames.size(); ++i) {
-    cv::Mat frame = frames[i];
-    cv::cvtColor(frame, frame, CV_BGR2GRAY);
-
-    // Add this frame to the SR image.
-    for (int x = 0; x < frame.cols; ++x) {
-      for (int y = 0; y < frame.rows; ++y) {
-        const super_resolution::MotionShift& motion_shift =
-            motion_shift_sequence[i];
-        const int hr_x = FLAGS_upsampling_scale * x - motion_shift.dx;
-        const int hr_y = FLAGS_upsampling_scale * y - motion_shift.dy;
-        if (hr_x < 0 || hr_x >= fused_width ||
-            hr_y < 0 || hr_y >= fused_height) {
-          continue;
-        }
-        fusion_image.at<uchar>(hr_y, hr_x) = frame.at<uchar>(y, x);
-        inpaint_mask.at<uchar>(hr_y, hr_x) = 0;
-      }
-    }
+  super_resolution::ShiftAddFusionOptions fusion_options;
+  fusion_options.scale = FLAGS_upsampling_scale;
+  fusion_options.num_threads = FLAGS_num_threads;
+  if (FLAGS_fusion_mode == "median") {
+    fusion_options.mode = super_resolution::SHIFT_ADD_MEDIAN;
+  } else if (FLAGS_fusion_mode == "trimmed") {
+    fusion_options.mode = super_resolution::SHIFT_ADD_TRIMMED_MEAN;
+  } else if (FLAGS_fusion_mode != "mean") {
+    LOG(WARNING) << "Invalid fusion mode flag. Using default (mean).";
   }
+  const super_resolution::ImageData fused_image =
+      super_resolution::ShiftAddFusion(
+          low_res_images, motion_shift_sequence, fusion_options);
 
-  // Display the image before inpainting.
-  cv::imshow("Visualization", fusion_image);
-  cv::waitKey(0);
-
-  // Then inpaint it and display it after.
-  cv::Mat inpainted_image;
-  cv::inpaint(
-      fusion_image,
-      inpaint_mask,
-      inpainted_image,
-      FLAGS_upsampling_scale,  // The radius considered for inpainting.
-      cv::INPAINT_NS);
-  cv::imshow("Visualization", inpainted_image);
-  cv::waitKey(0);
+  if (FLAGS_display_result) {
+    super_resolution::util::DisplayImage(fused_image, "Shift-Add Fusion");
+  }
+  if (!FLAGS_result_path.empty()) {
+    super_resolution::util::SaveImage(fused_image, FLAGS_result_path);
+  }
 
   return EXIT_SUCCESS;
 }
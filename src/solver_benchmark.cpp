@@ -0,0 +1,503 @@
+// This binary compares the MAP solvers end to end on standard synthetic
+// problems. The low-resolution frames of each problem are generated from a
+// ground truth image with the ImageModel (like the GenerateData binary does),
+// and every solver is run with increasing iteration budgets. After each run,
+// the wall time and the PSNR and SSIM of the result against the ground truth
+// are recorded, which gives a convergence-vs-time curve per solver:
+//   SolverBenchmark --problems=clean,noisy --solvers=irls_cg,admm
+//       --iteration_checkpoints=1,2,4,8 --result_path=results.csv
+//
+// Every checkpoint is a separate solve from the same initial estimate, so its
+// time includes the solver setup (and the time to compute the initial
+// estimate), and the solvers do not need a per-iteration callback. The
+// solvers are run from every initial estimate of --initial_estimates, and
+// with --target_psnr, the time each of them takes to reach that PSNR is
+// summarized, which shows how much a better starting point saves:
+//   SolverBenchmark --initial_estimates=bilinear,edge_directed
+//       --target_psnr=30
+//
+// An outer iteration is an IRLS iteration (each of which runs up to
+// --solver_iterations least squares iterations), an ADMM iteration or a
+// primal-dual step, depending on the solver.
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "evaluation/image_quality_evaluator.h"
+#include "image/edge_directed_upsampling.h"
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
+#include "optimization/admm_solver.h"
+#include "optimization/irls_map_solver.h"
+#include "optimization/map_solver.h"
+#include "optimization/primal_dual_map_solver.h"
+#include "optimization/solver_telemetry.h"
+#include "optimization/tv_regularizer.h"
+#include "util/data_loader.h"
+#include "util/string_util.h"
+#include "util/util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+using super_resolution::ImageData;
+
+// The problems and solvers to compare.
+DEFINE_string(ground_truth_path, "",
+    "The HR ground truth image (default: test_data/goat.jpg).");
+DEFINE_int32(image_size, 96,
+    "The ground truth is resized to this width and height (0 to keep it).");
+DEFINE_string(problems, "clean,blurred,noisy",
+    "Comma-delimited synthetic problems ('clean', 'blurred', 'noisy').");
+DEFINE_string(solvers, "irls_cg,irls_lbfgs,irls_native_cg,admm,primal_dual",
+    "Comma-delimited solvers ('irls_cg', 'irls_lbfgs', 'irls_native_cg', "
+    "'irls_native_lbfgs', 'irls_multigrid', 'admm', 'primal_dual'). Append "
+    "'_precond' to an IRLS solver to use the diagonal preconditioner.");
+DEFINE_string(iteration_checkpoints, "1,2,4,8,16",
+    "Comma-delimited outer iteration budgets to run each solver with.");
+DEFINE_string(initial_estimates, "bilinear",
+    "Comma-delimited initial estimates to run each solver from ('bilinear', "
+    "'bicubic', 'edge_directed').");
+DEFINE_double(target_psnr, 0.0,
+    "If positive, also print the time each solver takes to reach this PSNR.");
+
+// Solver parameters shared by all solvers.
+DEFINE_int32(solver_iterations, 20,
+    "The maximum number of least squares iterations per outer iteration.");
+DEFINE_double(regularization_parameter, 0.01,
+    "The weight of the TV regularizer (0 = no regularization).");
+DEFINE_int32(num_threads, 1,
+    "Number of threads used by the solvers (0 = all hardware threads).");
+
+// Output.
+DEFINE_string(result_path, "",
+    "Optional CSV file that the results are written to.");
+
+namespace {
+
+// A synthetic problem: the degradation used to generate the frames. The
+// frames are shifted to every sub-pixel position of the scale, so the
+// problem is well posed without the regularizer.
+struct SyntheticProblem {
+  std::string name;
+  int scale;
+  int blur_radius;
+  double blur_sigma;
+  double noise_sigma;  // In the 0-255 range, as in the ImageModel.
+};
+
+// One measurement of a solver.
+struct BenchmarkResult {
+  std::string problem;
+  std::string initial_estimate;
+  std::string solver;
+  int outer_iterations;
+
+  // The total number of least squares iterations, or -1 if the solver does
+  // not report them.
+  int inner_iterations;
+
+  // The wall time of the solve, including the initial estimate.
+  double seconds;
+  double peak_signal_to_noise_ratio;
+  double structural_similarity;
+};
+
+// Returns the standard problem with the given name. Returns false if there
+// is no such problem.
+bool GetSyntheticProblem(
+    const std::string& name, SyntheticProblem* problem) {
+  if (name == "clean") {
+    *problem = {name, 2, 0, 0.0, 0.0};
+  } else if (name == "blurred") {
+    *problem = {name, 2, 2, 1.0, 0.0};
+  } else if (name == "noisy") {
+    *problem = {name, 3, 2, 1.0, 5.0};
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Returns one shift per sub-pixel position of the given scale.
+super_resolution::MotionShiftSequence GetSubPixelMotionSequence(
+    const int scale) {
+  std::vector<super_resolution::MotionShift> motion_shifts;
+  for (int dy = 0; dy < scale; ++dy) {
+    for (int dx = 0; dx < scale; ++dx) {
+      motion_shifts.push_back(super_resolution::MotionShift(dx, dy));
+    }
+  }
+  return super_resolution::MotionShiftSequence(motion_shifts);
+}
+
+// Creates the solver with the given name and outer iteration budget. Returns
+// null if the name is unknown.
+std::unique_ptr<super_resolution::MapSolver> CreateSolver(
+    const std::string& name,
+    const int num_outer_iterations,
+    const super_resolution::ImageModel& image_model,
+    const std::vector<ImageData>& low_res_images) {
+
+  std::unique_ptr<super_resolution::MapSolver> solver;
+  if (name == "admm") {
+    super_resolution::AdmmSolverOptions solver_options;
+    solver_options.max_num_solver_iterations = FLAGS_solver_iterations;
+    solver_options.num_threads = FLAGS_num_threads;
+    solver_options.max_num_admm_iterations = num_outer_iterations;
+    solver.reset(new super_resolution::AdmmSolver(
+        solver_options, image_model, low_res_images, false));
+  } else if (name == "primal_dual") {
+    super_resolution::PrimalDualMapSolverOptions solver_options;
+    solver_options.num_threads = FLAGS_num_threads;
+    solver_options.max_num_primal_dual_iterations = num_outer_iterations;
+    solver.reset(new super_resolution::PrimalDualMapSolver(
+        solver_options, image_model, low_res_images, false));
+  } else {
+    super_resolution::IRLSMapSolverOptions solver_options;
+    std::string irls_name = name;
+    const std::string preconditioner_suffix = "_precond";
+    if (irls_name.size() > preconditioner_suffix.size() &&
+        irls_name.compare(
+            irls_name.size() - preconditioner_suffix.size(),
+            preconditioner_suffix.size(),
+            preconditioner_suffix) == 0) {
+      irls_name.resize(irls_name.size() - preconditioner_suffix.size());
+      solver_options.use_diagonal_preconditioner = true;
+    }
+    if (irls_name == "irls_cg") {
+      solver_options.least_squares_solver = super_resolution::CG_SOLVER;
+    } else if (irls_name == "irls_lbfgs") {
+      solver_options.least_squares_solver = super_resolution::LBFGS_SOLVER;
+    } else if (irls_name == "irls_native_cg") {
+      solver_options.least_squares_solver =
+          super_resolution::NATIVE_CG_SOLVER;
+    } else if (irls_name == "irls_native_lbfgs") {
+      solver_options.least_squares_solver =
+          super_resolution::NATIVE_LBFGS_SOLVER;
+    } else if (irls_name == "irls_multigrid") {
+      solver_options.least_squares_solver =
+          super_resolution::MULTIGRID_SOLVER;
+    } else {
+      return nullptr;
+    }
+    solver_options.max_num_solver_iterations = FLAGS_solver_iterations;
+    solver_options.num_threads = FLAGS_num_threads;
+    solver_options.max_num_irls_iterations = num_outer_iterations;
+    solver.reset(new super_resolution::IRLSMapSolver(
+        solver_options, image_model, low_res_images, false));
+  }
+  return solver;
+}
+
+// Creates the initial estimate with the given name from the first frame,
+// which is not shifted. Returns false if the name is unknown.
+bool CreateInitialEstimate(
+    const std::string& name,
+    const ImageData& low_res_image,
+    const int scale,
+    ImageData* initial_estimate) {
+
+  if (name == "edge_directed") {
+    *initial_estimate = super_resolution::EdgeDirectedUpsample(
+        low_res_image, scale, FLAGS_num_threads);
+    return true;
+  }
+  super_resolution::ResizeInterpolationMethod interpolation_method;
+  if (name == "bilinear") {
+    interpolation_method = super_resolution::INTERPOLATE_LINEAR;
+  } else if (name == "bicubic") {
+    interpolation_method = super_resolution::INTERPOLATE_CUBIC;
+  } else {
+    return false;
+  }
+  *initial_estimate = low_res_image;
+  initial_estimate->ResizeImage(
+      low_res_image.GetImageSize() * scale, interpolation_method);
+  return true;
+}
+
+// Runs every solver at every checkpoint from every initial estimate on the
+// given problem and appends the results. The first result for each initial
+// estimate is the initial estimate itself.
+void RunProblem(
+    const SyntheticProblem& problem,
+    const ImageData& ground_truth,
+    const std::vector<std::string>& initial_estimate_names,
+    const std::vector<std::string>& solver_names,
+    const std::vector<int>& checkpoints,
+    std::vector<BenchmarkResult>* results) {
+
+  // The frames are generated with noise, but solved with the same model
+  // without noise.
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = problem.scale;
+  model_parameters.blur_radius = problem.blur_radius;
+  model_parameters.blur_sigma = problem.blur_sigma;
+  model_parameters.motion_sequence = GetSubPixelMotionSequence(problem.scale);
+  model_parameters.num_threads = FLAGS_num_threads;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  model_parameters.noise_sigma = problem.noise_sigma;
+  const super_resolution::ImageModel generating_image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+
+  const int num_frames = problem.scale * problem.scale;
+  std::vector<ImageData> low_res_images;
+  for (int i = 0; i < num_frames; ++i) {
+    low_res_images.push_back(
+        generating_image_model.ApplyToImage(ground_truth, i));
+  }
+
+  super_resolution::ImageQualityEvaluatorOptions evaluator_options;
+  evaluator_options.num_threads = FLAGS_num_threads;
+  const super_resolution::ImageQualityEvaluator evaluator(
+      ground_truth, evaluator_options);
+  for (const std::string& initial_estimate_name : initial_estimate_names) {
+    ImageData initial_estimate;
+    const auto initial_estimate_start_time = std::chrono::steady_clock::now();
+    if (!CreateInitialEstimate(
+            initial_estimate_name,
+            low_res_images[0],
+            problem.scale,
+            &initial_estimate)) {
+      LOG(ERROR) << "Unknown initial estimate '" << initial_estimate_name
+                 << "'.";
+      continue;
+    }
+    const std::chrono::duration<double> initial_estimate_seconds =
+        std::chrono::steady_clock::now() - initial_estimate_start_time;
+    const super_resolution::ImageQualityMetrics initial_metrics =
+        evaluator.Evaluate(initial_estimate);
+    results->push_back({
+        problem.name, initial_estimate_name, "initial", 0, 0,
+        initial_estimate_seconds.count(),
+        initial_metrics.peak_signal_to_noise_ratio,
+        initial_metrics.structural_similarity});
+
+    for (const std::string& solver_name : solver_names) {
+      for (const int num_outer_iterations : checkpoints) {
+        std::unique_ptr<super_resolution::MapSolver> solver = CreateSolver(
+            solver_name, num_outer_iterations, image_model, low_res_images);
+        if (solver == nullptr) {
+          LOG(ERROR) << "Unknown solver '" << solver_name << "'.";
+          break;
+        }
+        if (FLAGS_regularization_parameter > 0.0) {
+          solver->AddRegularizer(
+              std::shared_ptr<super_resolution::Regularizer>(
+                  new super_resolution::TotalVariationRegularizer(
+                      ground_truth.GetImageSize())),
+              FLAGS_regularization_parameter);
+        }
+        const std::shared_ptr<super_resolution::SolverTelemetry> telemetry(
+            new super_resolution::SolverTelemetry());
+        solver->SetTelemetry(telemetry);
+
+        const auto start_time = std::chrono::steady_clock::now();
+        const ImageData result = solver->Solve(initial_estimate);
+        const auto end_time = std::chrono::steady_clock::now();
+        const std::chrono::duration<double> elapsed_time_seconds =
+            end_time - start_time;
+
+        // Only the solvers that use an ObjectiveFunction report telemetry.
+        int inner_iterations = -1;
+        const std::vector<super_resolution::SolveTelemetry> solves =
+            telemetry->GetSolves();
+        if (!solves.empty()) {
+          inner_iterations = 0;
+          for (const auto& solve : solves) {
+            inner_iterations += solve.iterations.size();
+          }
+        }
+
+        const super_resolution::ImageQualityMetrics metrics =
+            evaluator.Evaluate(result);
+        const double seconds =
+            initial_estimate_seconds.count() + elapsed_time_seconds.count();
+        results->push_back({
+            problem.name, initial_estimate_name, solver_name,
+            num_outer_iterations, inner_iterations, seconds,
+            metrics.peak_signal_to_noise_ratio,
+            metrics.structural_similarity});
+        LOG(INFO) << problem.name << " / " << initial_estimate_name << " / "
+                  << solver_name << " (" << num_outer_iterations
+                  << " iterations): PSNR "
+                  << metrics.peak_signal_to_noise_ratio << " in " << seconds
+                  << " seconds.";
+      }
+    }
+  }
+}
+
+// Returns the results as CSV with a header line.
+std::string FormatResultsAsCsv(const std::vector<BenchmarkResult>& results) {
+  std::ostringstream csv;
+  csv << "problem,initial_estimate,solver,outer_iterations,inner_iterations,"
+      << "seconds,psnr,ssim" << std::endl;
+  for (const BenchmarkResult& result : results) {
+    csv << result.problem << "," << result.initial_estimate << ","
+        << result.solver << "," << result.outer_iterations << ",";
+    if (result.inner_iterations >= 0) {
+      csv << result.inner_iterations;
+    }
+    csv << "," << result.seconds << ","
+        << result.peak_signal_to_noise_ratio << ","
+        << result.structural_similarity << std::endl;
+  }
+  return csv.str();
+}
+
+// Prints the results as an aligned table.
+void PrintResultsTable(const std::vector<BenchmarkResult>& results) {
+  std::cout << std::left << std::setw(10) << "Problem"
+            << std::setw(15) << "Initial"
+            << std::setw(20) << "Solver" << std::right
+            << std::setw(8) << "Outer" << std::setw(8) << "Inner"
+            << std::setw(12) << "Seconds" << std::setw(10) << "PSNR"
+            << std::setw(10) << "SSIM" << std::endl;
+  for (const BenchmarkResult& result : results) {
+    std::cout << std::left << std::setw(10) << result.problem
+              << std::setw(15) << result.initial_estimate
+              << std::setw(20) << result.solver << std::right
+              << std::setw(8) << result.outer_iterations << std::setw(8)
+              << (result.inner_iterations >= 0 ?
+                  std::to_string(result.inner_iterations) : "-")
+              << std::fixed << std::setprecision(4)
+              << std::setw(12) << result.seconds
+              << std::setprecision(3)
+              << std::setw(10) << result.peak_signal_to_noise_ratio
+              << std::setprecision(4)
+              << std::setw(10) << result.structural_similarity
+              << std::defaultfloat << std::endl;
+  }
+}
+
+// Prints the time and outer iterations that each solver took from each
+// initial estimate to first reach the target PSNR, or "-" if no checkpoint
+// reached it.
+void PrintTimeToTargetTable(
+    const std::vector<BenchmarkResult>& results, const double target_psnr) {
+  std::cout << std::endl << "Time to PSNR " << target_psnr << ":" << std::endl;
+  std::cout << std::left << std::setw(10) << "Problem"
+            << std::setw(15) << "Initial"
+            << std::setw(20) << "Solver" << std::right
+            << std::setw(8) << "Outer" << std::setw(12) << "Seconds"
+            << std::endl;
+  for (int i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& result = results[i];
+    // Each solver run is printed once, at its first checkpoint.
+    if (result.solver == "initial" ||
+        (i > 0 && results[i - 1].solver == result.solver &&
+         results[i - 1].initial_estimate == result.initial_estimate &&
+         results[i - 1].problem == result.problem)) {
+      continue;
+    }
+    const BenchmarkResult* first_reached = nullptr;
+    for (int j = i; j < results.size() &&
+         results[j].solver == result.solver &&
+         results[j].initial_estimate == result.initial_estimate &&
+         results[j].problem == result.problem; ++j) {
+      if (results[j].peak_signal_to_noise_ratio >= target_psnr) {
+        first_reached = &results[j];
+        break;
+      }
+    }
+    std::cout << std::left << std::setw(10) << result.problem
+              << std::setw(15) << result.initial_estimate
+              << std::setw(20) << result.solver << std::right;
+    if (first_reached == nullptr) {
+      std::cout << std::setw(8) << "-" << std::setw(12) << "-" << std::endl;
+      continue;
+    }
+    std::cout << std::setw(8) << first_reached->outer_iterations
+              << std::fixed << std::setprecision(4)
+              << std::setw(12) << first_reached->seconds
+              << std::defaultfloat << std::endl;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  super_resolution::util::InitApp(argc, argv,
+      "Compare the MAP solvers on synthetic problems.");
+
+  const std::string ground_truth_path = FLAGS_ground_truth_path.empty() ?
+      super_resolution::util::GetAbsoluteCodePath("test_data/goat.jpg") :
+      FLAGS_ground_truth_path;
+  ImageData ground_truth =
+      super_resolution::util::LoadImage(ground_truth_path);
+  CHECK_GT(ground_truth.GetNumChannels(), 0)
+      << "Could not load the ground truth " << ground_truth_path;
+  if (FLAGS_image_size > 0) {
+    ground_truth.ResizeImage(
+        cv::Size(FLAGS_image_size, FLAGS_image_size),
+        super_resolution::INTERPOLATE_LINEAR);
+  }
+
+  std::vector<int> checkpoints;
+  for (const std::string& checkpoint :
+       super_resolution::util::SplitString(FLAGS_iteration_checkpoints, ',')) {
+    const int num_iterations =
+        std::stoi(super_resolution::util::TrimString(checkpoint));
+    CHECK_GT(num_iterations, 0) << "Iteration checkpoints must be positive.";
+    checkpoints.push_back(num_iterations);
+  }
+  std::vector<std::string> initial_estimate_names;
+  for (const std::string& initial_estimate_name :
+       super_resolution::util::SplitString(FLAGS_initial_estimates, ',')) {
+    initial_estimate_names.push_back(
+        super_resolution::util::TrimString(initial_estimate_name));
+  }
+  std::vector<std::string> solver_names;
+  for (const std::string& solver_name :
+       super_resolution::util::SplitString(FLAGS_solvers, ',')) {
+    solver_names.push_back(super_resolution::util::TrimString(solver_name));
+  }
+
+  std::vector<BenchmarkResult> results;
+  for (const std::string& problem_arg :
+       super_resolution::util::SplitString(FLAGS_problems, ',')) {
+    const std::string problem_name =
+        super_resolution::util::TrimString(problem_arg);
+    SyntheticProblem problem;
+    if (!GetSyntheticProblem(problem_name, &problem)) {
+      LOG(ERROR) << "Unknown problem '" << problem_name << "'.";
+      continue;
+    }
+    // The HR size must be divisible by the scale.
+    ImageData problem_ground_truth = ground_truth;
+    const cv::Size image_size = ground_truth.GetImageSize();
+    problem_ground_truth.ResizeImage(
+        cv::Size(image_size.width - image_size.width % problem.scale,
+                 image_size.height - image_size.height % problem.scale),
+        super_resolution::INTERPOLATE_LINEAR);
+    RunProblem(
+        problem, problem_ground_truth, initial_estimate_names, solver_names,
+        checkpoints, &results);
+  }
+
+  PrintResultsTable(results);
+  if (FLAGS_target_psnr > 0.0) {
+    PrintTimeToTargetTable(results, FLAGS_target_psnr);
+  }
+  if (!FLAGS_result_path.empty()) {
+    std::ofstream result_file(FLAGS_result_path);
+    CHECK(result_file.is_open())
+        << "Could not open " << FLAGS_result_path << " for writing.";
+    result_file << FormatResultsAsCsv(results);
+    LOG(INFO) << "Saved results to " << FLAGS_result_path;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -2,28 +2,64 @@
 // a given set of images or a video. It provides an interface for the user to
 // specify parameters of the algorithm without needing to code it directly.
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <functional>
+#include <fstream>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
-#include "evaluation/peak_signal_to_noise_ratio.h"
+#include "evaluation/image_quality_evaluator.h"
 #include "evaluation/structural_similarity.h"
+#include "hyperspectral/hyperspectral_data_loader.h"
 #include "hyperspectral/spectral_pca.h"
+#include "image/edge_directed_upsampling.h"
 #include "image/image_data.h"
 #include "image_model/additive_noise_module.h"
 #include "image_model/blur_module.h"
 #include "image_model/downsampling_module.h"
 #include "image_model/image_model.h"
 #include "image_model/motion_module.h"
+#include "image_model/shift_add_fusion.h"
 #include "motion/motion_shift.h"
+#include "motion/frame_selection.h"
+#include "motion/phase_grouping.h"
+#include "optimization/admm_solver.h"
 #include "optimization/btv_regularizer.h"
 #include "optimization/irls_map_solver.h"
+#include "optimization/map_solver.h"
+#include "optimization/memory_planner.h"
+#include "optimization/objective_data_term.h"
+#include "optimization/primal_dual_map_solver.h"
+#include "optimization/progressive_results.h"
+#include "optimization/solver_deadline.h"
+#include "optimization/solver_telemetry.h"
+#include "optimization/stencil_regularizer.h"
+#include "optimization/tiled_solver.h"
 #include "optimization/tv_regularizer.h"
+#include "util/autotuner.h"
+#include "util/config_reader.h"
 #include "util/data_loader.h"
+#include "util/job_server.h"
 #include "util/macros.h"
+#include "util/memory_accounting.h"
+#include "util/prefetch_queue.h"
+#include "util/process_rank.h"
+#include "util/preprocessing_cache.h"
+#include "util/profiler.h"
+#include "util/staged_pipeline.h"
 #include "util/string_util.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 #include "util/visualization.h"
 #include "wavelet/wavelet_transform.h"
@@ -63,15 +99,48 @@ DEFINE_int32(blur_radius, 3,
     "The radius of the blur kernel. Set to 0 to inactivate blurring.");
 DEFINE_double(blur_sigma, 1.0,
     "The sigma value of the Gaussian blur. Set to 0 to inactivate blurring.");
+DEFINE_double(blur_sigma_per_band, 0.0,
+    "Change of the blur sigma per spectral band, for optics whose blur "
+    "depends on the wavelength (0 = the same blur for every band).");
+DEFINE_int32(blur_band_group_size, 1,
+    "The number of consecutive bands that share a blur kernel when "
+    "--blur_sigma_per_band is set.");
 DEFINE_string(motion_sequence_path, "",
     "Path to a file containing the motion shifts for each image.");
+DEFINE_string(warp_sequence_path, "",
+    "Path to a file containing a homography (or affine warp) for each image.");
+DEFINE_bool(group_motion_phases, false,
+    "Merge frames with the same sub-pixel motion phase before solving.");
+DEFINE_int32(motion_phase_steps, 4,
+    "Sub-pixel phases are quantized to 1/steps HR pixels for merging.");
+DEFINE_int32(num_selected_frames, 0,
+    "Solve with only this many of the most informative frames, judged by "
+    "sharpness, registration error and sub-pixel phase (0 = all frames).");
+DEFINE_bool(use_fourier_blur, false,
+    "Apply the blur and motion in the Fourier domain (for large kernels).");
+DEFINE_bool(use_area_downsampling, false,
+    "Average each scale x scale patch into an LR pixel (a box sensor PSF) "
+    "instead of sampling its top-left pixel.");
 
 // Solver strategy parameters:
-// TODO: Add support for different solver strategies (e.g. ADMM).
+DEFINE_string(map_solver, "irls",
+    "The MAP solver strategy ('irls', 'admm' or 'primal_dual').");
+DEFINE_string(initial_estimate, "bilinear",
+    "Initial estimate ('bilinear', 'bicubic', 'edge_directed', 'shift_add', "
+    "'shift_add_median' or 'shift_add_trimmed_mean').");
+DEFINE_string(initial_estimate_path, "",
+    "Load the initial estimate from this HR image instead, e.g. the output "
+    "of a learned single-image super-resolution model.");
 DEFINE_int32(optimization_iterations, 20,
     "Max number of optimization iterations (e.g. number of IRLS iterations).");
+DEFINE_int32(num_pyramid_levels, 1,
+    "Number of coarse-to-fine levels (1 = only solve at full resolution).");
 DEFINE_bool(solve_in_wavelet_domain, false,
     "Run super-resolution in the wavelet domain (experimental).");
+DEFINE_int32(num_wavelet_subband_workers, 1,
+    "Number of wavelet subbands solved concurrently (0 = hardware threads).");
+DEFINE_int32(wavelet_detail_iterations, 0,
+    "Max optimization iterations of the detail subbands (0 = same as LL).");
 DEFINE_bool(interpolate_color, false,
     "Run SR only on the luminance channel and interpolate colors later.");
 DEFINE_bool(solve_in_pca_space, false,
@@ -80,8 +149,60 @@ DEFINE_int32(num_pca_components, 0,
     "Number of PCA components to use (0 = all) if solve_in_pca_space is set.");
 DEFINE_double(pca_retained_variance, 0.0,
     "Retained variance for PCA (1.0 = all, 0.0 = use num_pca_components).");
+DEFINE_double(pca_pixel_sampling_ratio, 0.0,
+    "Fraction of pixels randomly sampled to fit PCA (0 = 10 per band).");
+DEFINE_bool(pca_randomized_decomposition, false,
+    "Fit the num_pca_components top PCA bands with a randomized method.");
+DEFINE_int32(pca_randomized_oversampling, 10,
+    "Extra random vectors used by the randomized PCA decomposition.");
+DEFINE_int32(pca_randomized_power_iterations, 2,
+    "Number of power iterations of the randomized PCA decomposition.");
+DEFINE_bool(pca_split_budgets, false,
+    "With --solve_in_pca_space and --split_channels, budget the solver "
+    "iterations of each split by the variance of its PCA components, and "
+    "solve the most important splits first.");
+DEFINE_double(pca_min_split_importance, 0.0,
+    "With --pca_split_budgets, splits with less than this fraction of the "
+    "variance of the most important split keep the initial estimate.");
 DEFINE_bool(split_channels, false,
     "Each channel will be solved as an independent image.");
+DEFINE_int32(num_channels_per_split, 1,
+    "Number of channels solved together in each split (if split_channels).");
+DEFINE_int32(num_split_overlap_channels, 0,
+    "Extra channels solved (and discarded) on each side of a split.");
+DEFINE_int32(num_split_solver_workers, 1,
+    "Number of channel splits solved concurrently (0 = all hardware threads).");
+DEFINE_double(split_solver_memory_limit_mb, 0.0,
+    "Memory limit (MB) for concurrently solved channel splits (0 = no limit).");
+DEFINE_double(memory_budget_mb, 0.0,
+    "Estimate the peak memory of the solve, and choose the channel split "
+    "size, tile size and precision that fit in this many MB (0 = no budget).");
+DEFINE_int32(tile_size, 0,
+    "Solve the HR image in tiles of this size (0 = solve the whole image).");
+DEFINE_int32(num_tile_workers, 1,
+    "Number of tiles solved concurrently (0 = all hardware threads).");
+DEFINE_string(region_of_interest, "",
+    "Only super-resolve this region of the HR image, given as "
+    "'x,y,width,height' in HR pixels (empty = the whole image).");
+DEFINE_int32(stream_band_block_size, 0,
+    "Load, solve and save HS images in blocks of this many bands (0 = all).");
+DEFINE_int32(stream_band_overlap, 0,
+    "Extra bands loaded and solved (and discarded) on each side of a "
+    "streamed band block, as 3D TV context across the block boundaries.");
+DEFINE_bool(distributed, false,
+    "Distribute a streamed solve over the processes of an MPI or Slurm "
+    "launcher, reading the rank and number of ranks from its environment.");
+DEFINE_int32(rank, -1,
+    "Rank of this process in a distributed streamed solve (-1 = from the "
+    "launcher environment with --distributed, or 0).");
+DEFINE_int32(num_ranks, 0,
+    "Number of processes in a distributed streamed solve (0 = from the "
+    "launcher environment with --distributed, or 1).");
+DEFINE_int32(num_io_threads, 1,
+    "Number of threads that load input files (0 = all hardware threads).");
+DEFINE_string(preprocessing_cache_dir, "",
+    "Cache the loaded observations and their PCA projection in this "
+    "directory, keyed by the input file contents and options.");
 
 // Regularization options:
 // TODO: Add support for multiple regularizers simultaneously.
@@ -96,23 +217,127 @@ DEFINE_double(regularization_parameter, 0.01,
 
 // Solver parameters:
 DEFINE_string(solver, "cg",
-    "The least squares solver to use ('cg' or 'lbfgs').");
+    "The least squares solver ('cg', 'lbfgs', 'native_cg', 'native_lbfgs' "
+    "or 'multigrid').");
 DEFINE_int32(solver_iterations, 50,
     "The maximum number of solver iterations.");
+DEFINE_int32(multigrid_levels, 4,
+    "The maximum number of grid levels of the multigrid solver.");
+DEFINE_int32(multigrid_smoothing_iterations, 2,
+    "CG iterations before and after every coarse grid correction of the "
+    "multigrid solver.");
+DEFINE_int32(multigrid_coarsest_iterations, 10,
+    "CG iterations on the coarsest level of the multigrid solver.");
 DEFINE_bool(use_numerical_differentiation, false,
     "Use numerical differentiation (very slow) for test purposes.");
+DEFINE_int32(num_threads, 1,
+    "Number of threads used by the solver (0 = all hardware threads).");
+DEFINE_bool(use_single_precision, false,
+    "Compute the data term in single precision (faster, less accurate).");
+DEFINE_string(observation_encoding, "none",
+    "Store the observations in the data term as 'half' floats or as 'uint16' "
+    "codes with a per-band scale and offset (4x less memory traffic, but "
+    "no less memory).");
+DEFINE_bool(use_compiled_image_model, false,
+    "Precompute the image model as sparse per-frame matrices (more memory).");
+DEFINE_bool(use_normal_equations, false,
+    "Evaluate the data term from precomputed normal equations A'A.");
+DEFINE_bool(use_diagonal_preconditioner, false,
+    "Precondition the least squares solvers with the Hessian diagonal.");
+DEFINE_bool(use_line_search_cache, false,
+    "Evaluate the data term along search lines from cached products.");
+DEFINE_bool(evaluate_terms_concurrently, false,
+    "Evaluate the data term and the regularizers concurrently.");
+DEFINE_string(autotune_cache_path, "",
+    "Time the blur and data term thread count options that are not set "
+    "explicitly, use the fastest, and cache the choices in this file.");
+DEFINE_string(checkpoint_path, "",
+    "Save the IRLS solver state here and resume from it (irls solver only).");
+DEFINE_int32(checkpoint_interval, 1,
+    "Number of IRLS iterations between checkpoints.");
+DEFINE_int32(quality_stop_interval, 0,
+    "Stop IRLS when the PSNR against the ground truth plateaus, checking "
+    "every this many iterations (0 = never).");
+DEFINE_double(quality_stop_min_improvement, 0.01,
+    "Minimum PSNR improvement (dB) between checks to keep iterating.");
+DEFINE_string(continuation_scales, "",
+    "Solve first with the regularization parameter scaled by each of these, "
+    "e.g. '100,10' (irls solver only).");
+DEFINE_int32(continuation_iterations, 2,
+    "Maximum number of IRLS iterations of each continuation stage.");
+DEFINE_double(irls_norm_exponent, 1.0,
+    "The exponent p of the regularizer Lp norm (irls solver only).");
+DEFINE_bool(use_mixed_precision, false,
+    "Run the inner solves with a single precision data term and refine them "
+    "in double precision after every IRLS iteration (irls solver only).");
+DEFINE_int32(active_set_tile_size, 0,
+    "Freeze tiles of this size once they stop changing between IRLS "
+    "iterations (irls solver only, 0 = off).");
+DEFINE_double(active_set_threshold, 1.0e-4,
+    "Pixel change below which an IRLS tile counts as converged.");
+DEFINE_double(time_budget_seconds, 0.0,
+    "Return the best estimate found within this many seconds of solving "
+    "(irls solver only, 0 = no limit).");
 
 // Evaluation and testing:
 DEFINE_bool(verbose, false,
     "Solver will log progress and image stats will be printed.");
 DEFINE_string(evaluators, "",
-    "Comma-delimited evaluation metrics to test against (e.g. 'psnr,ssim').");
+    "Comma-delimited evaluation metrics to test against: 'psnr', 'mse', "
+    "'ssim' (Gaussian-windowed), 'sam' (spectral angle) or 'global_ssim'.");
+DEFINE_string(solver_telemetry_path, "",
+    "Save per-iteration solver telemetry to this file (.csv or .json).");
+DEFINE_string(solver_trace_path, "",
+    "Save solver trace events to this file (Chrome trace JSON).");
+DEFINE_bool(print_profile, false,
+    "Print the profiling timers (build with -DENABLE_PROFILING=ON) and the "
+    "memory by subsystem at exit.");
 
 // What to do with the results (optional):
 DEFINE_string(display_mode, "",
     "'result' to display; 'compare' to also display bilinear upsampling.");
 DEFINE_string(result_path, "",
     "Name of file (with path) where the result image will be saved.");
+DEFINE_string(progressive_results_path, "",
+    "Save intermediate estimates while solving, as <name>.<index>.<ext> for "
+    "this path (irls solver only).");
+DEFINE_int32(progressive_results_iterations, 0,
+    "Save an intermediate estimate every this many solver iterations "
+    "(0 = never).");
+DEFINE_double(progressive_results_seconds, 60.0,
+    "Save an intermediate estimate every this many seconds (0 = never).");
+
+// Batch mode (optional). Runs many jobs in one process instead of --data_path.
+DEFINE_string(batch_manifest, "",
+    "File listing one job configuration file (of flag/value pairs) per line.");
+DEFINE_string(batch_report_path, "",
+    "Save the status and run time of every batch job to this CSV file.");
+DEFINE_int32(batch_pipeline_depth, 0,
+    "Load and preprocess up to this many batch jobs ahead of the one being "
+    "solved, overlapping the stages. 0 runs one job at a time.");
+DEFINE_int32(batch_num_load_threads, 1,
+    "Number of batch jobs loaded at the same time if pipelined.");
+
+// Server mode (optional). Runs jobs sent to a local socket until shutdown.
+DEFINE_string(serve_socket_path, "",
+    "Run as a service that takes jobs from this Unix domain socket path.");
+
+// Sweep mode (optional). Solves a grid of solver parameters on the same input.
+// Each list is comma-separated and defaults to the single flag value above.
+DEFINE_string(sweep_regularization_parameters, "",
+    "Regularization parameters to sweep, e.g. '0.1,0.03,0.01'.");
+DEFINE_string(sweep_btv_scale_ranges, "",
+    "BTV scale ranges to sweep (only used with the 'btv' regularizer).");
+DEFINE_string(sweep_btv_spatial_decays, "",
+    "BTV spatial decays to sweep (only used with the 'btv' regularizer).");
+DEFINE_string(sweep_solvers, "",
+    "Least squares solvers to sweep, e.g. 'cg,lbfgs'.");
+DEFINE_int32(num_sweep_workers, 1,
+    "Number of sweep points solved concurrently. 0 uses all threads.");
+DEFINE_bool(sweep_warm_start, true,
+    "Start each regularization parameter from the result of the next larger.");
+DEFINE_string(sweep_report_path, "",
+    "Save the parameters, run time and quality of every sweep point as CSV.");
 
 // This struct is used to track input data.
 struct InputData {
@@ -120,76 +345,462 @@ struct InputData {
   std::vector<ImageData> low_res_images;  // Necessary for super-resolution.
 };
 
+// The options of the steps that prepare the inputs of a run: loading the
+// observations and converting them into the PCA space. They are taken from the
+// user input flags by GetInputOptions(). A pipelined batch prepares the inputs
+// of the next jobs while the flags are set for the job being solved, so these
+// steps must not read the flags themselves.
+struct InputOptions {
+  std::string data_path;
+  std::string ground_truth_image;
+  bool generate_lr_images = false;
+  int number_of_frames = 0;
+  double noise_sigma = 0.0;
+  int num_io_threads = 1;
+  std::string preprocessing_cache_dir;
+  super_resolution::ImageModelParameters model_parameters;
+
+  // Whether to make the bilinear upsampled reference, which is upsampled from
+  // the first observation before it is converted.
+  bool create_upsampled_image = false;
+  int upsampling_scale = 1;
+
+  // Whether to solve in the spectral PCA space (--solve_in_pca_space, unless
+  // the colors are interpolated), and the options of the PCA.
+  bool convert_to_pca_space = false;
+  double pca_retained_variance = 0.0;
+  int num_pca_components = 0;
+  super_resolution::SpectralPCAOptions pca_options;
+
+  // Returns true if the options provide a ground truth image.
+  bool HasGroundTruth() const {
+    return !ground_truth_image.empty() || generate_lr_images;
+  }
+};
+
+// The prepared inputs of a run (see LoadRunInputs() and
+// ConvertRunInputsToPCASpace()).
+struct RunInputs {
+  InputData input_data;
+
+  // The bilinear upsampled reference, if it was requested.
+  ImageData upsampled_image;
+
+  // The preprocessing cache entry of the observations, if cached.
+  std::string input_cache_entry_name;
+
+  // The PCA that converts the result back, if solving in the PCA space.
+  std::unique_ptr<super_resolution::SpectralPCA> spectral_pca;
+};
+
+// The ground truth for the quality stopping rule of the IRLS solver
+// (--quality_stop_interval), in the same space as the solver estimate. It is
+// empty if the rule is not used.
+static ImageData quality_stop_reference;
+
+// The fraction of the spectral variance explained by each PCA component when
+// solving in PCA space (--solve_in_pca_space). It budgets the channel splits
+// if --pca_split_budgets is set, and is empty otherwise.
+static std::vector<double> pca_explained_variance_ratios;
+
+// Streams the intermediate estimates of the solve to disk
+// (--progressive_results_path). It is null if they are not saved.
+static std::shared_ptr<super_resolution::ProgressiveResults>
+    progressive_results;
+
+// The wall-clock budget of the current solve (--time_budget_seconds). It is
+// null if the solve has no time limit.
+static std::shared_ptr<super_resolution::SolverDeadline> solve_deadline;
+
+// The settings that can differ between the solves of a single run (e.g. for
+// the wavelet subbands, the parameter sweep points that are solved
+// concurrently, or the tiles of the tiled solver). They default to the user
+// input flags.
+struct SolveSettings {
+  SolveSettings()
+      : num_optimization_iterations(FLAGS_optimization_iterations),
+        num_threads(FLAGS_num_threads),
+        solver(FLAGS_solver),
+        regularization_parameter(FLAGS_regularization_parameter),
+        btv_scale_range(FLAGS_btv_scale_range),
+        btv_spatial_decay(FLAGS_btv_spatial_decay),
+        checkpoint_path(FLAGS_checkpoint_path),
+        quality_stop_reference(&::quality_stop_reference),
+        progressive_results(::progressive_results),
+        deadline(::solve_deadline) {}
+
+  int num_optimization_iterations;
+  int num_threads;
+  std::string solver;
+  double regularization_parameter;
+  int btv_scale_range;
+  double btv_spatial_decay;
+
+  // The IRLS checkpoint path and the quality stopping rule's ground truth,
+  // which must outlive the solve.
+  std::string checkpoint_path;
+  const ImageData* quality_stop_reference;
+
+  // Null for solves whose estimates are not the final image (e.g. tiles).
+  std::shared_ptr<super_resolution::ProgressiveResults> progressive_results;
+
+  // The share of the time budget of this solve, or null if there is none.
+  std::shared_ptr<super_resolution::SolverDeadline> deadline;
+};
+
+// Returns the PSNR of the given channels of the estimate against the same
+// channels of the reference image.
+super_resolution::IRLSMapSolverOptions::QualityMetric CreatePSNRQualityMetric(
+    const ImageData& reference_image) {
+
+  return [&reference_image](
+      const double* estimate_data,
+      const int channel_start,
+      const int channel_end) {
+    const int64_t num_pixels = reference_image.GetNumPixels();
+    double sum_of_squared_differences = 0.0;
+    for (int channel = channel_start; channel < channel_end; ++channel) {
+      const double* reference_data = reference_image.GetChannelData(channel);
+      const double* channel_data =
+          estimate_data + (channel - channel_start) * num_pixels;
+      for (int64_t i = 0; i < num_pixels; ++i) {
+        const double difference = reference_data[i] - channel_data[i];
+        sum_of_squared_differences += difference * difference;
+      }
+    }
+    const double mean_squared_error = sum_of_squared_differences /
+        (static_cast<double>(num_pixels) * (channel_end - channel_start));
+    return -10.0 * std::log10(std::max(mean_squared_error, 1.0e-20));
+  };
+}
+
+// Sets the options shared by all MAP solvers based on the user input flags
+// and the given solve settings.
+void SetMapSolverOptions(
+    const SolveSettings& settings,
+    super_resolution::MapSolverOptions* solver_options) {
+  if (settings.solver == "cg") {
+    solver_options->least_squares_solver = super_resolution::CG_SOLVER;
+    LOG(INFO) << "Using conjugate gradient solver.";
+  } else if (settings.solver == "lbfgs") {
+    solver_options->least_squares_solver = super_resolution::LBFGS_SOLVER;
+    LOG(INFO) << "Using LBFGS solver.";
+  } else if (settings.solver == "native_cg") {
+    solver_options->least_squares_solver = super_resolution::NATIVE_CG_SOLVER;
+    LOG(INFO) << "Using native conjugate gradient solver.";
+  } else if (settings.solver == "native_lbfgs") {
+    solver_options->least_squares_solver =
+        super_resolution::NATIVE_LBFGS_SOLVER;
+    LOG(INFO) << "Using native LBFGS solver.";
+  } else if (settings.solver == "multigrid") {
+    solver_options->least_squares_solver = super_resolution::MULTIGRID_SOLVER;
+    LOG(INFO) << "Using multigrid solver.";
+  } else {
+    LOG(WARNING) << "Invalid solver flag. Using default (conjugate gradient).";
+  }
+  solver_options->max_num_solver_iterations = FLAGS_solver_iterations;
+  solver_options->max_num_multigrid_levels = FLAGS_multigrid_levels;
+  solver_options->num_multigrid_smoothing_iterations =
+      FLAGS_multigrid_smoothing_iterations;
+  solver_options->num_multigrid_coarsest_iterations =
+      FLAGS_multigrid_coarsest_iterations;
+  solver_options->use_numerical_differentiation =
+      FLAGS_use_numerical_differentiation;
+  solver_options->split_channels = FLAGS_split_channels;
+  solver_options->num_channels_per_split = FLAGS_num_channels_per_split;
+  solver_options->num_split_overlap_channels =
+      FLAGS_num_split_overlap_channels;
+  solver_options->num_split_solver_workers = FLAGS_num_split_solver_workers;
+  solver_options->split_solver_memory_limit_mb =
+      FLAGS_split_solver_memory_limit_mb;
+  solver_options->channel_importances = pca_explained_variance_ratios;
+  solver_options->min_split_importance = FLAGS_pca_min_split_importance;
+  solver_options->num_threads = settings.num_threads;
+  solver_options->use_single_precision = FLAGS_use_single_precision;
+  CHECK(super_resolution::ParseObservationEncoding(
+      FLAGS_observation_encoding, &solver_options->observation_encoding))
+      << "Unknown observation encoding: " << FLAGS_observation_encoding;
+  solver_options->use_compiled_image_model = FLAGS_use_compiled_image_model;
+  solver_options->use_normal_equations = FLAGS_use_normal_equations;
+  solver_options->use_diagonal_preconditioner =
+      FLAGS_use_diagonal_preconditioner;
+  solver_options->use_line_search_cache = FLAGS_use_line_search_cache;
+  solver_options->evaluate_terms_concurrently =
+      FLAGS_evaluate_terms_concurrently;
+}
+
+// Returns the initial estimate for the solver as selected by the user input
+// flags: the image at --initial_estimate_path, the first image upsampled with
+// bilinear, bicubic or edge-directed interpolation, or the shift-add fusion
+// of all images under the motion of the image model. The median and trimmed
+// mean fusions are robust to outliers in the images. Edge-directed
+// interpolation keeps edges sharp, which saves the solver the iterations
+// that it otherwise spends recovering them.
+ImageData CreateInitialEstimate(
+    const super_resolution::ImageModelParameters& model_parameters,
+    const std::vector<ImageData>& input_images) {
+
+  if (!FLAGS_initial_estimate_path.empty()) {
+    const ImageData initial_estimate =
+        super_resolution::util::LoadImage(FLAGS_initial_estimate_path);
+    const cv::Size expected_size =
+        input_images[0].GetImageSize() * FLAGS_upsampling_scale;
+    CHECK(initial_estimate.GetImageSize() == expected_size &&
+          initial_estimate.GetNumChannels() ==
+          input_images[0].GetNumChannels())
+        << "The initial estimate at " << FLAGS_initial_estimate_path
+        << " must have the HR size and the channels of the input images.";
+    return initial_estimate;
+  }
+  if (FLAGS_initial_estimate == "edge_directed") {
+    return super_resolution::EdgeDirectedUpsample(
+        input_images[0], FLAGS_upsampling_scale, FLAGS_num_threads);
+  }
+
+  super_resolution::ShiftAddFusionOptions fusion_options;
+  fusion_options.scale = FLAGS_upsampling_scale;
+  fusion_options.num_threads = FLAGS_num_threads;
+  bool use_shift_add_fusion = true;
+  if (FLAGS_initial_estimate == "shift_add") {
+    fusion_options.mode = super_resolution::SHIFT_ADD_MEAN;
+  } else if (FLAGS_initial_estimate == "shift_add_median") {
+    fusion_options.mode = super_resolution::SHIFT_ADD_MEDIAN;
+  } else if (FLAGS_initial_estimate == "shift_add_trimmed_mean") {
+    fusion_options.mode = super_resolution::SHIFT_ADD_TRIMMED_MEAN;
+  } else {
+    use_shift_add_fusion = false;
+  }
+
+  if (use_shift_add_fusion) {
+    super_resolution::MotionShiftSequence motion_shift_sequence =
+        model_parameters.motion_sequence;
+    if (motion_shift_sequence.GetNumMotionShifts() == 0 &&
+        !model_parameters.motion_sequence_path.empty()) {
+      motion_shift_sequence.LoadSequenceFromFile(
+          model_parameters.motion_sequence_path);
+    }
+    return super_resolution::ShiftAddFusion(
+        input_images, motion_shift_sequence, fusion_options);
+  }
+  if (FLAGS_initial_estimate == "bicubic") {
+    ImageData initial_estimate = input_images[0];
+    initial_estimate.ResizeImage(
+        FLAGS_upsampling_scale, super_resolution::INTERPOLATE_CUBIC);
+    return initial_estimate;
+  }
+  if (FLAGS_initial_estimate != "bilinear") {
+    LOG(WARNING) << "Invalid initial estimate flag. Using default (bilinear).";
+  }
+  ImageData initial_estimate = input_images[0];
+  initial_estimate.ResizeImage(
+      FLAGS_upsampling_scale, super_resolution::INTERPOLATE_LINEAR);
+  return initial_estimate;
+}
+
+// The telemetry shared by all solves of the current run (or batch job). It is
+// null if neither telemetry output flag is set.
+static std::shared_ptr<super_resolution::SolverTelemetry> solver_telemetry;
+
+// Creates a new telemetry for the next run based on the user input flags.
+void ResetSolverTelemetry() {
+  solver_telemetry =
+      (FLAGS_solver_telemetry_path.empty() && FLAGS_solver_trace_path.empty()) ?
+      nullptr :
+      std::make_shared<super_resolution::SolverTelemetry>(
+          !FLAGS_solver_trace_path.empty());
+}
+
+// Returns the telemetry of the current run, or null if it is not recorded.
+std::shared_ptr<super_resolution::SolverTelemetry> GetSolverTelemetry() {
+  return solver_telemetry;
+}
+
+// Writes the solver telemetry to the files given by the user input flags.
+void WriteSolverTelemetry() {
+  const std::shared_ptr<super_resolution::SolverTelemetry> telemetry =
+      GetSolverTelemetry();
+  if (telemetry == nullptr) {
+    return;
+  }
+  if (!FLAGS_solver_telemetry_path.empty() &&
+      telemetry->WriteToFile(FLAGS_solver_telemetry_path)) {
+    LOG(INFO) << "Saved solver telemetry to " << FLAGS_solver_telemetry_path;
+  }
+  if (!FLAGS_solver_trace_path.empty() &&
+      telemetry->WriteChromeTrace(FLAGS_solver_trace_path)) {
+    LOG(INFO) << "Saved solver trace to " << FLAGS_solver_trace_path;
+  }
+}
+
+// Returns the path of the given intermediate estimate for
+// --progressive_results_path, with the snapshot index inserted before the
+// extension (e.g. "result.3.png").
+std::string GetProgressiveResultPath(const int snapshot_index) {
+  const std::string extension =
+      super_resolution::util::GetFileExtension(FLAGS_progressive_results_path);
+  const std::string index = std::to_string(snapshot_index);
+  if (extension.empty()) {
+    return FLAGS_progressive_results_path + "." + index;
+  }
+  return FLAGS_progressive_results_path.substr(
+      0, FLAGS_progressive_results_path.size() - extension.size()) +
+      index + "." + extension;
+}
+
+// Prints the profiling timers and the memory by subsystem if requested by the
+// user input flags. The memory is recorded even if the timers are not
+// compiled in.
+void PrintProfile() {
+  if (!FLAGS_print_profile) {
+    return;
+  }
+  if (super_resolution::util::IsProfilingEnabled()) {
+    std::cout << super_resolution::util::GetProfileReport();
+  } else {
+    LOG(WARNING) << "Profiling is not compiled in. "
+                 << "Rebuild with 'cmake -DENABLE_PROFILING=ON'.";
+  }
+  std::cout << super_resolution::util::GetMemoryReport();
+}
+
+// Returns the regularizer named by --regularizer, or "tv" if the name is
+// unknown. The flag is never rewritten, so concurrent solves can read it
+// safely. CheckRunFlags() and RunSweep() warn about unknown names once.
+std::string GetRegularizerName() {
+  if (FLAGS_regularizer == "tv" || FLAGS_regularizer == "3dtv" ||
+      FLAGS_regularizer == "btv") {
+    return FLAGS_regularizer;
+  }
+  return "tv";
+}
+
+// Logs a warning if --regularizer is unknown and the default is used.
+void CheckRegularizerFlag() {
+  if (GetRegularizerName() != FLAGS_regularizer) {
+    LOG(WARNING) << "Unknown regularizer option '" << FLAGS_regularizer
+                 << "'. Using default Total Variation regularizer.";
+  }
+}
+
 // Runs the solver on the given inputs and returns the output. All solver
 // options are set based on the user input flags. Post-processing the result
-// (such as changing color space back to BGR) is not handled here.
+// (such as changing color space back to BGR) is not handled here. The inputs
+// may be shared with other (concurrent) solves, which then also share the
+// compiled image model.
 ImageData SetupAndRunSolver(
     const ImageModel& image_model,
-    const std::vector<ImageData>& input_images,
-    const ImageData& initial_estimate) {
+    const std::shared_ptr<const super_resolution::SharedSolverInputs>& inputs,
+    const ImageData& initial_estimate,
+    const SolveSettings& settings = SolveSettings()) {
 
   // Set up the solver.
-  // TODO: let the user choose the solver (once more solvers are supported).
-  super_resolution::IRLSMapSolverOptions solver_options;
-  if (FLAGS_solver == "cg") {
-    solver_options.least_squares_solver = super_resolution::CG_SOLVER;
-    LOG(INFO) << "Using conjugate gradient solver.";
-  } else if (FLAGS_solver == "lbfgs") {
-    solver_options.least_squares_solver = super_resolution::LBFGS_SOLVER;
-    LOG(INFO) << "Using LBFGS solver.";
+  std::unique_ptr<super_resolution::MapSolver> solver;
+  if (FLAGS_map_solver == "admm") {
+    super_resolution::AdmmSolverOptions solver_options;
+    SetMapSolverOptions(settings, &solver_options);
+    solver_options.max_num_admm_iterations =
+        settings.num_optimization_iterations;
+    solver.reset(new super_resolution::AdmmSolver(
+        solver_options, image_model, inputs));
+    LOG(INFO) << "Using ADMM solver.";
+  } else if (FLAGS_map_solver == "primal_dual") {
+    super_resolution::PrimalDualMapSolverOptions solver_options;
+    SetMapSolverOptions(settings, &solver_options);
+    solver_options.max_num_primal_dual_iterations =
+        settings.num_optimization_iterations;
+    solver.reset(new super_resolution::PrimalDualMapSolver(
+        solver_options, image_model, inputs));
+    LOG(INFO) << "Using primal-dual solver.";
   } else {
-    LOG(WARNING) << "Invalid solver flag. Using default (conjugate gradient).";
+    if (FLAGS_map_solver != "irls") {
+      LOG(WARNING) << "Invalid MAP solver flag. Using default (IRLS).";
+    }
+    super_resolution::IRLSMapSolverOptions solver_options;
+    SetMapSolverOptions(settings, &solver_options);
+    solver_options.max_num_irls_iterations =
+        settings.num_optimization_iterations;
+    solver_options.checkpoint_path = settings.checkpoint_path;
+    solver_options.checkpoint_interval = FLAGS_checkpoint_interval;
+    solver_options.irls_norm_exponent = FLAGS_irls_norm_exponent;
+    for (const std::string& scale :
+         super_resolution::util::SplitString(FLAGS_continuation_scales, ',')) {
+      if (!super_resolution::util::TrimString(scale).empty()) {
+        solver_options.continuation_parameter_scales.push_back(
+            std::stod(scale));
+      }
+    }
+    solver_options.continuation_iterations_per_stage =
+        FLAGS_continuation_iterations;
+    solver_options.use_mixed_precision = FLAGS_use_mixed_precision;
+    solver_options.progressive_results = settings.progressive_results;
+    solver_options.deadline = settings.deadline;
+    solver_options.active_set_tile_size = FLAGS_active_set_tile_size;
+    solver_options.active_set_change_threshold = FLAGS_active_set_threshold;
+    if (FLAGS_quality_stop_interval > 0) {
+      const ImageData& reference = *settings.quality_stop_reference;
+      if (reference.GetImageSize() == initial_estimate.GetImageSize() &&
+          reference.GetNumChannels() == initial_estimate.GetNumChannels()) {
+        solver_options.quality_metric = CreatePSNRQualityMetric(reference);
+        solver_options.quality_evaluation_interval =
+            FLAGS_quality_stop_interval;
+        solver_options.min_quality_improvement =
+            FLAGS_quality_stop_min_improvement;
+      } else {
+        LOG(WARNING) << "The quality stopping rule needs a ground truth of "
+                     << "the same size as the solver estimate. Ignoring it.";
+      }
+    }
+    solver.reset(new super_resolution::IRLSMapSolver(
+        solver_options, image_model, inputs));
   }
-  solver_options.max_num_irls_iterations = FLAGS_optimization_iterations;
-  solver_options.max_num_solver_iterations = FLAGS_solver_iterations;
-  solver_options.use_numerical_differentiation =
-      FLAGS_use_numerical_differentiation;
-  solver_options.split_channels = FLAGS_split_channels;
-  super_resolution::IRLSMapSolver solver(
-      solver_options, image_model, input_images);
   if (!FLAGS_verbose) {
-    solver.Stfu();
+    solver->Stfu();
   }
+  solver->SetTelemetry(GetSolverTelemetry());
 
   // Add the appropriate regularizer based on user input.
   // TODO: support for multiple regularizers at once.
-  std::shared_ptr<super_resolution::Regularizer> regularizer;
-  if (FLAGS_regularization_parameter > 0.0) {
-    if (FLAGS_regularizer == "tv" || FLAGS_regularizer == "3dtv") {
-      regularizer =
-          std::shared_ptr<super_resolution::Regularizer>(
-              new super_resolution::TotalVariationRegularizer(
-                  initial_estimate.GetImageSize()));
-      if (FLAGS_regularizer == "3dtv") {
-        dynamic_cast<super_resolution::TotalVariationRegularizer*>(
-            regularizer.get())->SetUse3dTotalVariation(true);
-      }
-    } else if (FLAGS_regularizer == "btv") {
-      regularizer =
-          std::shared_ptr<super_resolution::Regularizer>(
-              new super_resolution::BilateralTotalVariationRegularizer(
-                  initial_estimate.GetImageSize(),
-                  FLAGS_btv_scale_range,
-                  FLAGS_btv_spatial_decay));
+  if (settings.regularization_parameter > 0.0) {
+    // Both regularizers are stencils, which split their rows between threads.
+    std::shared_ptr<super_resolution::StencilRegularizer> regularizer;
+    const std::string regularizer_name = GetRegularizerName();
+    if (regularizer_name == "btv") {
+      regularizer.reset(
+          new super_resolution::BilateralTotalVariationRegularizer(
+              initial_estimate.GetImageSize(),
+              settings.btv_scale_range,
+              settings.btv_spatial_decay));
     } else {
-      LOG(WARNING) << "Unknown regularizer option '" << FLAGS_regularizer
-                   << "'. Using default Total Variation regularizer.";
-      FLAGS_regularizer = "tv";
-      regularizer =
-          std::shared_ptr<super_resolution::Regularizer>(
-              new super_resolution::TotalVariationRegularizer(
-                  initial_estimate.GetImageSize()));
-    }
-    solver.AddRegularizer(regularizer, FLAGS_regularization_parameter);
-    LOG(INFO) << "Added " << FLAGS_regularizer
+      std::shared_ptr<super_resolution::TotalVariationRegularizer>
+          tv_regularizer(new super_resolution::TotalVariationRegularizer(
+              initial_estimate.GetImageSize()));
+      tv_regularizer->SetUse3dTotalVariation(regularizer_name == "3dtv");
+      regularizer = tv_regularizer;
+    }
+    regularizer->SetNumThreads(settings.num_threads);
+    solver->AddRegularizer(regularizer, settings.regularization_parameter);
+    LOG(INFO) << "Added " << regularizer_name
               << " regularizer with regularization parameter "
-              << FLAGS_regularization_parameter;
+              << settings.regularization_parameter;
   }
 
   // Run the solver and time it.
-  LOG(INFO) << "Super-resolving from " << input_images.size() << " images...";
+  LOG(INFO) << "Super-resolving from " << inputs->GetObservations().size()
+            << " images...";
   const auto start_time = std::chrono::steady_clock::now();
-  ImageData result = solver.Solve(initial_estimate);
+  // Images that were loaded in single precision (see HSIBinaryDataParameters)
+  // are only widened here. The solvers read the initial estimate in double
+  // precision, and the data term converts the observations one channel split
+  // at a time.
+  ImageData result;
+  if (initial_estimate.GetPrecision() == super_resolution::DOUBLE_PRECISION) {
+    result = solver->Solve(initial_estimate);
+  } else {
+    ImageData double_precision_estimate = initial_estimate;
+    double_precision_estimate.SetPrecision(
+        super_resolution::DOUBLE_PRECISION);
+    result = solver->Solve(double_precision_estimate);
+  }
   const auto end_time = std::chrono::steady_clock::now();
   std::chrono::duration<double> elapsed_time_seconds = end_time - start_time;
   LOG(INFO) << "Done! Finished in "
@@ -198,6 +809,244 @@ ImageData SetupAndRunSolver(
   return result;
 }
 
+// Same as above for input images that are not shared with other solves.
+ImageData SetupAndRunSolver(
+    const ImageModel& image_model,
+    const std::vector<ImageData>& input_images,
+    const ImageData& initial_estimate,
+    const SolveSettings& settings = SolveSettings()) {
+
+  return SetupAndRunSolver(
+      image_model,
+      std::make_shared<const super_resolution::SharedSolverInputs>(
+          input_images),
+      initial_estimate,
+      settings);
+}
+
+// Returns the image model parameters for solving at a coarser resolution, where
+// both the HR estimate and the LR images are downscaled by the given factor.
+// The upsampling scale stays the same, but motion shifts and blur, which are
+// measured in HR pixels, are scaled down by the same factor.
+super_resolution::ImageModelParameters GetCoarseImageModelParameters(
+    const super_resolution::ImageModelParameters& model_parameters,
+    const int downscale_factor) {
+
+  super_resolution::ImageModelParameters coarse_model_parameters =
+      model_parameters;
+  coarse_model_parameters.noise_sigma = 0.0;  // Only for generating data.
+
+  // The motion shifts have to be loaded here to scale them.
+  super_resolution::MotionShiftSequence motion_sequence =
+      model_parameters.motion_sequence;
+  if (motion_sequence.GetNumMotionShifts() == 0 &&
+      !model_parameters.motion_sequence_path.empty()) {
+    motion_sequence.LoadSequenceFromFile(model_parameters.motion_sequence_path);
+  }
+  std::vector<super_resolution::MotionShift> coarse_motion_shifts;
+  for (int i = 0; i < motion_sequence.GetNumMotionShifts(); ++i) {
+    const super_resolution::MotionShift& motion_shift = motion_sequence[i];
+    coarse_motion_shifts.push_back(super_resolution::MotionShift(
+        motion_shift.dx / downscale_factor,
+        motion_shift.dy / downscale_factor));
+  }
+  coarse_model_parameters.motion_sequence =
+      super_resolution::MotionShiftSequence(coarse_motion_shifts);
+  coarse_model_parameters.motion_sequence_path = "";
+
+  // The blur kernel size must stay odd. Blur that shrinks to a single pixel is
+  // dropped entirely.
+  if (model_parameters.blur_radius > 0 && model_parameters.blur_sigma > 0.0) {
+    int coarse_blur_radius = static_cast<int>(std::round(
+        static_cast<double>(model_parameters.blur_radius) / downscale_factor));
+    if (coarse_blur_radius % 2 == 0) {
+      coarse_blur_radius++;
+    }
+    if (coarse_blur_radius > 1) {
+      coarse_model_parameters.blur_radius = coarse_blur_radius;
+      coarse_model_parameters.blur_sigma =
+          model_parameters.blur_sigma / downscale_factor;
+    } else {
+      coarse_model_parameters.blur_radius = 0;
+      coarse_model_parameters.blur_sigma = 0.0;
+    }
+  }
+  return coarse_model_parameters;
+}
+
+// Runs the solver coarse-to-fine. The problem is first solved with the LR
+// images and the HR estimate downscaled by 2^(num_pyramid_levels - 1), then
+// by half as much, and so on until the full resolution. Each result is
+// upsampled to be the initial estimate of the next level, so most of the
+// low-frequency content converges on the cheaper coarse grids.
+ImageData SolveCoarseToFine(
+    const super_resolution::ImageModelParameters& model_parameters,
+    const ImageModel& image_model,
+    const std::vector<ImageData>& input_images,
+    const ImageData& initial_estimate) {
+
+  const cv::Size low_res_size = input_images[0].GetImageSize();
+  ImageData level_estimate = initial_estimate;
+  // Every level gets a share of the time budget in proportion to its number
+  // of pixels, among the levels that are left.
+  double remaining_level_area = 0.0;
+  for (int level = 0; level < FLAGS_num_pyramid_levels; ++level) {
+    remaining_level_area += 1.0 / (1 << (2 * level));
+  }
+  for (int level = FLAGS_num_pyramid_levels - 1; level > 0; --level) {
+    const double level_area = 1.0 / (1 << (2 * level));
+    SolveSettings settings;
+    if (!settings.checkpoint_path.empty()) {
+      settings.checkpoint_path += ".level" + std::to_string(level);
+    }
+    if (solve_deadline != nullptr) {
+      settings.deadline = solve_deadline->CreateShare(
+          std::min(level_area / remaining_level_area, 1.0));
+    }
+    remaining_level_area -= level_area;
+    const int downscale_factor = 1 << level;
+    const cv::Size level_low_res_size(
+        low_res_size.width / downscale_factor,
+        low_res_size.height / downscale_factor);
+    if (level_low_res_size.width < 1 || level_low_res_size.height < 1) {
+      LOG(WARNING) << "Skipping pyramid level " << level
+                   << ": the images are too small to downscale by "
+                   << downscale_factor << ".";
+      continue;
+    }
+
+    std::vector<ImageData> level_input_images;
+    for (const ImageData& input_image : input_images) {
+      ImageData level_input_image = input_image;
+      level_input_image.ResizeImage(
+          level_low_res_size, super_resolution::INTERPOLATE_LINEAR);
+      level_input_images.push_back(level_input_image);
+    }
+    level_estimate.ResizeImage(
+        cv::Size(
+            level_low_res_size.width * FLAGS_upsampling_scale,
+            level_low_res_size.height * FLAGS_upsampling_scale),
+        super_resolution::INTERPOLATE_LINEAR);
+
+    // The level keeps the first band of the images, e.g. of a band block.
+    const ImageModel level_image_model = ImageModel::CreateImageModel(
+        GetCoarseImageModelParameters(model_parameters, downscale_factor))
+        .CreateBandOffsetImageModel(image_model.GetBandOffset());
+    LOG(INFO) << "Solving pyramid level " << level << " at 1/"
+              << downscale_factor << " resolution.";
+    level_estimate = SetupAndRunSolver(
+        level_image_model, level_input_images, level_estimate, settings);
+  }
+
+  level_estimate.ResizeImage(
+      initial_estimate.GetImageSize(), super_resolution::INTERPOLATE_LINEAR);
+  return SetupAndRunSolver(image_model, input_images, level_estimate);
+}
+
+// Returns the region given by --region_of_interest, or an empty region if the
+// flag is not set.
+cv::Rect GetRegionOfInterest() {
+  if (FLAGS_region_of_interest.empty()) {
+    return cv::Rect();
+  }
+  const std::vector<std::string> values =
+      super_resolution::util::SplitString(FLAGS_region_of_interest, ',');
+  CHECK_EQ(values.size(), 4)
+      << "--region_of_interest must be given as 'x,y,width,height'.";
+  const cv::Rect region_of_interest(
+      std::stoi(values[0]),
+      std::stoi(values[1]),
+      std::stoi(values[2]),
+      std::stoi(values[3]));
+  CHECK(region_of_interest.x >= 0 && region_of_interest.y >= 0 &&
+        region_of_interest.area() > 0)
+      << "Invalid --region_of_interest '" << FLAGS_region_of_interest << "'.";
+  return region_of_interest;
+}
+
+// Returns the given region of every (visible) channel of the image.
+ImageData CropImage(const ImageData& image, const cv::Rect& region) {
+  ImageData cropped_image;
+  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+    cropped_image.AddChannel(
+        image.GetChannelImage(channel)(region).clone(),
+        super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  }
+  return cropped_image;
+}
+
+// Runs the solver independently on tiles of the HR image. Each tile is padded
+// with a halo that covers the reach of the image model and the regularizer,
+// and the overlapping halos are blended so the seams are not visible. Only
+// one tile (per tile worker) is held by a solver at a time. Each tile has its
+// own IRLS stopping state, so tiles with little detail finish early and free
+// their worker for the next tile.
+//
+// With --region_of_interest, only the tiles of the region are solved (as a
+// single tile if --tile_size is not set), and the result is the region.
+ImageData SolveInTiles(
+    const super_resolution::ImageModelParameters& model_parameters,
+    const ImageModel& image_model,
+    const std::vector<ImageData>& input_images,
+    const ImageData& initial_estimate) {
+
+  super_resolution::MotionShiftSequence motion_sequence =
+      model_parameters.motion_sequence;
+  if (motion_sequence.GetNumMotionShifts() == 0 &&
+      !model_parameters.motion_sequence_path.empty()) {
+    motion_sequence.LoadSequenceFromFile(model_parameters.motion_sequence_path);
+  }
+  int regularizer_range = 0;
+  if (FLAGS_regularization_parameter > 0.0) {
+    regularizer_range =
+        (FLAGS_regularizer == "btv") ? FLAGS_btv_scale_range : 1;
+  }
+
+  super_resolution::TiledSolverOptions solver_options;
+  solver_options.tile_size = FLAGS_tile_size;
+  solver_options.region_of_interest = GetRegionOfInterest();
+  if (solver_options.tile_size <= 0) {
+    solver_options.tile_size = std::max(
+        solver_options.region_of_interest.width,
+        solver_options.region_of_interest.height);
+  }
+  solver_options.halo_size = super_resolution::GetTileHaloSize(
+      model_parameters.scale,
+      model_parameters.blur_radius,
+      motion_sequence,
+      regularizer_range);
+  solver_options.num_tile_workers = FLAGS_num_tile_workers;
+  solver_options.deadline = solve_deadline;
+
+  super_resolution::TiledSolver solver(
+      solver_options,
+      image_model,
+      input_images,
+      [&image_model, &initial_estimate](
+          const std::vector<ImageData>& tile_input_images,
+          const ImageData& tile_initial_estimate,
+          const super_resolution::TiledSolverTile& tile) {
+        // Every tile stops on its own, so it keeps its own checkpoint and
+        // compares against its own part of the ground truth.
+        SolveSettings settings;
+        if (!settings.checkpoint_path.empty()) {
+          settings.checkpoint_path += ".tile" + std::to_string(tile.index);
+        }
+        settings.progressive_results = nullptr;
+        settings.deadline = tile.deadline;
+        ImageData tile_quality_stop_reference;
+        if (quality_stop_reference.GetImageSize() ==
+            initial_estimate.GetImageSize()) {
+          tile_quality_stop_reference =
+              CropImage(quality_stop_reference, tile.padded_region);
+          settings.quality_stop_reference = &tile_quality_stop_reference;
+        }
+        return SetupAndRunSolver(
+            image_model, tile_input_images, tile_initial_estimate, settings);
+      });
+  return solver.Solve(initial_estimate);
+}
+
 ImageData SolveInWaveletDomain(
     const ImageModel& image_model,
     const std::vector<ImageData>& input_images) {
@@ -216,42 +1065,83 @@ ImageData SolveInWaveletDomain(
     input_dwt_hh_coefficients.push_back(coefficients.hh);
   }
 
-  // Run super-resolution on each component individually.
+  // Run super-resolution on each subband individually. The subbands are
+  // independent, so they are solved concurrently and share the solver
+  // threads. The detail subbands are sparse and usually converge faster.
+  // The coefficients are views of each transformed input, and are handed to
+  // the solvers without another copy. Only the data terms that read whole
+  // channel buffers copy the rows of their channels.
   // TODO: Allow selecting which of these actually get super-resolved.
-  // LL:
-  ImageData initial_estimate_ll = input_dwt_ll_coefficients[0];
-  initial_estimate_ll.ResizeImage(
-      FLAGS_upsampling_scale, super_resolution::INTERPOLATE_LINEAR);
-  ImageData result_ll = SetupAndRunSolver(
-      image_model, input_dwt_ll_coefficients, initial_estimate_ll);
-  // LH:
-  ImageData initial_estimate_lh = input_dwt_lh_coefficients[0];
-  initial_estimate_lh.ResizeImage(
-      FLAGS_upsampling_scale, super_resolution::INTERPOLATE_LINEAR);
-  ImageData result_lh = SetupAndRunSolver(
-      image_model, input_dwt_lh_coefficients, initial_estimate_lh);
-  // HL:
-  ImageData initial_estimate_hl = input_dwt_hl_coefficients[0];
-  initial_estimate_hl.ResizeImage(
-      FLAGS_upsampling_scale, super_resolution::INTERPOLATE_LINEAR);
-  ImageData result_hl = SetupAndRunSolver(
-      image_model, input_dwt_hl_coefficients, initial_estimate_hl);
-  // HH:
-  ImageData initial_estimate_hh = input_dwt_hh_coefficients[0];
-  initial_estimate_hh.ResizeImage(
-      FLAGS_upsampling_scale, super_resolution::INTERPOLATE_LINEAR);
-  ImageData result_hh = SetupAndRunSolver(
-      image_model, input_dwt_hh_coefficients, initial_estimate_hh);
+  using super_resolution::SharedSolverInputs;
+  std::vector<std::shared_ptr<const SharedSolverInputs>> subband_inputs;
+  for (std::vector<ImageData>* subband_coefficients : {
+      &input_dwt_ll_coefficients,
+      &input_dwt_lh_coefficients,
+      &input_dwt_hl_coefficients,
+      &input_dwt_hh_coefficients}) {
+    subband_inputs.push_back(std::make_shared<const SharedSolverInputs>(
+        std::move(*subband_coefficients)));
+  }
+  const int num_subbands = subband_inputs.size();
+  const int num_workers = std::min(
+      super_resolution::util::GetNumThreadsToUse(
+          FLAGS_num_wavelet_subband_workers),
+      num_subbands);
+  SolveSettings ll_settings;
+  ll_settings.num_threads = std::max(
+      1,
+      super_resolution::util::GetNumThreadsToUse(FLAGS_num_threads) /
+          num_workers);
+  ll_settings.progressive_results = nullptr;  // Subbands are not images.
+  SolveSettings detail_settings = ll_settings;
+  if (FLAGS_wavelet_detail_iterations > 0) {
+    detail_settings.num_optimization_iterations =
+        FLAGS_wavelet_detail_iterations;
+  }
+
+  // Every subband gets an equal share of the time left when it starts,
+  // among the subbands that did not start yet.
+  std::vector<ImageData> subband_results(num_subbands);
+  std::mutex deadline_mutex;
+  int num_started_subbands = 0;
+  const auto solve_subband = [&](const int subband) {
+    SolveSettings settings = (subband == 0) ? ll_settings : detail_settings;
+    if (!settings.checkpoint_path.empty()) {
+      settings.checkpoint_path += ".subband" + std::to_string(subband);
+    }
+    if (solve_deadline != nullptr) {
+      std::lock_guard<std::mutex> lock(deadline_mutex);
+      settings.deadline = solve_deadline->CreateShare(std::min(
+          static_cast<double>(num_workers) /
+              (num_subbands - num_started_subbands),
+          1.0));
+      num_started_subbands++;
+    }
+    ImageData initial_estimate =
+        subband_inputs[subband]->GetObservations()[0];
+    initial_estimate.ResizeImage(
+        FLAGS_upsampling_scale, super_resolution::INTERPOLATE_LINEAR);
+    subband_results[subband] = SetupAndRunSolver(
+        image_model, subband_inputs[subband], initial_estimate, settings);
+  };
+  if (num_workers > 1) {
+    super_resolution::util::ThreadPool thread_pool(num_workers - 1);
+    thread_pool.ParallelFor(num_subbands, solve_subband);
+  } else {
+    for (int subband = 0; subband < num_subbands; ++subband) {
+      solve_subband(subband);
+    }
+  }
 
   // Merge and reconstruct. Because of size precision errors where the lower
   // resolutions don't divide evenly by the upsampling scale, scale the ll
   // coefficient to the same size as the others. Then once reconstructed, scale
   // everything back to the target size. This offset should be only one pixel.
   super_resolution::wavelet::WaveletCoefficients result_coefficients;
-  result_coefficients.ll = result_ll;
-  result_coefficients.lh = result_lh;
-  result_coefficients.hl = result_hl;
-  result_coefficients.hh = result_hh;
+  result_coefficients.ll = std::move(subband_results[0]);
+  result_coefficients.lh = std::move(subband_results[1]);
+  result_coefficients.hl = std::move(subband_results[2]);
+  result_coefficients.hh = std::move(subband_results[3]);
   // result_coefficients.ll.ResizeImage(  // TODO: Put back if needed.
   //     result_coefficients.lh.GetImageSize(),
   //     super_resolution::INTERPOLATE_CUBIC);
@@ -266,34 +1156,462 @@ ImageData SolveInWaveletDomain(
   return result;
 }
 
-int main(int argc, char** argv) {
-  super_resolution::util::InitApp(argc, argv, "Super resolution.");
+// Returns a new time budget for a solve (--time_budget_seconds), or null if
+// the solve has no time limit.
+std::shared_ptr<super_resolution::SolverDeadline> CreateSolveDeadline() {
+  if (FLAGS_time_budget_seconds <= 0.0) {
+    return nullptr;
+  }
+  if (FLAGS_map_solver != "irls") {
+    LOG(WARNING) << "Only the IRLS solver keeps to the time budget.";
+  }
+  return std::make_shared<super_resolution::SolverDeadline>(
+      FLAGS_time_budget_seconds);
+}
 
-  REQUIRE_ARG(FLAGS_data_path);
+// Runs super-resolution in the domain selected by the user input flags (the
+// wavelet domain, coarse-to-fine, in tiles, or directly on the images).
+ImageData SolveInSelectedDomain(
+    const super_resolution::ImageModelParameters& model_parameters,
+    const ImageModel& image_model,
+    const std::vector<ImageData>& input_images,
+    const ImageData& initial_estimate) {
+
+  if (FLAGS_solve_in_wavelet_domain) {
+    return SolveInWaveletDomain(image_model, input_images);
+  }
+  if (FLAGS_num_pyramid_levels > 1) {
+    return SolveCoarseToFine(
+        model_parameters, image_model, input_images, initial_estimate);
+  }
+  if (FLAGS_tile_size > 0 || !FLAGS_region_of_interest.empty()) {
+    return SolveInTiles(
+        model_parameters, image_model, input_images, initial_estimate);
+  }
+  // Solving is handled in the SetupAndRunSolver function above.
+  return SetupAndRunSolver(image_model, input_images, initial_estimate);
+}
+
+// Super-resolves the hyperspectral images given by the configuration file(s)
+// at --data_path in blocks of --stream_band_block_size bands. Each block of
+// every LR image is read, solved and written into the result file at
+// --result_path before the next block is read, so the peak memory scales with
+// the block size rather than with the number of bands. Channel splits
+// (--split_channels) are made within each block.
+//
+// Each block is solved with --stream_band_overlap extra bands on each side,
+// which are discarded, so 3D TV sees the neighbouring bands at the block
+// boundaries. Blocks are thereby independent, and with several ranks (e.g.
+// processes started by mpirun or srun), every rank solves its share of the
+// blocks, reads only the bands of those blocks, and writes them in place into
+// the shared result file.
+void SuperResolveInBandBlocks(
+    const super_resolution::ImageModelParameters& model_parameters,
+    const ImageModel& image_model) {
+
+  const std::vector<std::string> config_file_paths =
+      super_resolution::util::GetFilePaths(FLAGS_data_path);
+  CHECK_GT(config_file_paths.size(), 0)
+      << "At least one low-resolution image is required for super-resolution.";
+  // The loaders reference the paths, so the path list must not change.
+  std::vector<std::unique_ptr<super_resolution::HyperspectralDataLoader>>
+      hs_data_loaders;
+  for (const std::string& config_file_path : config_file_paths) {
+    hs_data_loaders.emplace_back(
+        new super_resolution::HyperspectralDataLoader(config_file_path));
+    // The blocks are loaded while the previous block is solved.
+    hs_data_loaders.back()->SetNumThreads(FLAGS_num_io_threads);
+  }
+  const int num_bands = hs_data_loaders[0]->GetNumBands();
+  for (const auto& hs_data_loader : hs_data_loaders) {
+    CHECK_EQ(hs_data_loader->GetNumBands(), num_bands)
+        << "Image channel counts do not match up.";
+  }
+
+  const int block_size = FLAGS_stream_band_block_size;
+  const int band_overlap = FLAGS_stream_band_overlap;
+  CHECK_GE(band_overlap, 0) << "The band overlap cannot be negative.";
+  const int num_blocks = (num_bands + block_size - 1) / block_size;
+  const super_resolution::util::ProcessRank process_rank =
+      super_resolution::util::GetProcessRank(
+          FLAGS_rank, FLAGS_num_ranks, FLAGS_distributed);
+  std::vector<int> block_indices;
+  for (int block_index = 0; block_index < num_blocks; ++block_index) {
+    if (process_rank.OwnsItem(block_index)) {
+      block_indices.push_back(block_index);
+    }
+  }
+  if (process_rank.num_ranks > 1) {
+    LOG(INFO) << "Rank " << process_rank.rank << " of "
+              << process_rank.num_ranks << " solves " << block_indices.size()
+              << " of " << num_blocks << " band blocks.";
+  }
+
+  // Returns the bands [start, end) that are loaded for the given block.
+  const auto get_loaded_bands =
+      [block_size, band_overlap, num_bands](const int block_index) {
+        const int first_band = block_index * block_size;
+        return std::make_pair(
+            std::max(first_band - band_overlap, 0),
+            std::min(first_band + block_size + band_overlap, num_bands));
+      };
+
+  // The next block is loaded in the background while the current block is
+  // solved. Only one loader thread uses the data loaders, and at most one
+  // block is loaded ahead, so two blocks are held in memory at a time.
+  super_resolution::util::PrefetchQueue<std::vector<ImageData>> block_queue(
+      block_indices.size(),
+      [&hs_data_loaders, &block_indices, &get_loaded_bands](
+          const int queue_index) {
+        const std::pair<int, int> loaded_bands =
+            get_loaded_bands(block_indices[queue_index]);
+        const super_resolution::util::ScopedMemoryTag memory_tag(
+            super_resolution::util::MEMORY_TAG_OBSERVATIONS);
+        std::vector<ImageData> block_images;
+        for (const auto& hs_data_loader : hs_data_loaders) {
+          hs_data_loader->LoadBandsFromENVIFile(
+              loaded_bands.first, loaded_bands.second - loaded_bands.first);
+          block_images.push_back(hs_data_loader->GetImage());
+        }
+        return block_images;
+      },
+      1,   // Loader thread.
+      1);  // Prefetched block.
+
+  // Each result block is written in the background while the next block is
+  // solved. Blocks are written in place, so they can be written in any order
+  // and by any rank.
+  const super_resolution::HyperspectralDataLoader result_writer(
+      FLAGS_result_path);
+  const super_resolution::HSIBinaryDataFormat result_format;  // BSQ.
+  ImageData written_result;
+  std::future<void> pending_result_write;
+  // Every block gets an equal share of the time left when it starts.
+  const std::shared_ptr<super_resolution::SolverDeadline> deadline =
+      CreateSolveDeadline();
+  int num_solved_blocks = 0;
+  for (const int block_index : block_indices) {
+    if (deadline != nullptr) {
+      solve_deadline = deadline->CreateShare(
+          1.0 / (block_indices.size() - num_solved_blocks));
+    }
+    num_solved_blocks++;
+    const int first_band = block_index * block_size;
+    const int num_block_bands = std::min(block_size, num_bands - first_band);
+    const std::pair<int, int> loaded_bands = get_loaded_bands(block_index);
+    const std::vector<ImageData> block_images = block_queue.GetNext();
+    LOG(INFO) << "Super-resolving bands " << first_band << " to "
+              << (first_band + num_block_bands - 1)
+              << " of " << num_bands << ".";
+    const ImageData initial_estimate =
+        CreateInitialEstimate(model_parameters, block_images);
+    // Channel 0 of the block is its first loaded band, which matters for the
+    // band-dependent blur.
+    ImageData result = SolveInSelectedDomain(
+        model_parameters,
+        image_model.CreateBandOffsetImageModel(loaded_bands.first),
+        block_images,
+        initial_estimate);
+    if (result.GetNumChannels() > num_block_bands) {
+      std::vector<cv::Mat> block_channels;
+      for (int band = 0; band < num_block_bands; ++band) {
+        block_channels.push_back(result.GetChannelImage(
+            first_band - loaded_bands.first + band));
+      }
+      result = ImageData(block_channels, result.GetPrecision());
+    }
+    if (pending_result_write.valid()) {
+      pending_result_write.get();
+    }
+    written_result = std::move(result);
+    pending_result_write = std::async(
+        std::launch::async,
+        [&result_writer, &result_format, &written_result, first_band,
+         num_bands]() {
+          result_writer.SaveImageBands(
+              written_result, result_format, first_band, num_bands);
+        });
+  }
+  solve_deadline.reset();
+  if (deadline != nullptr) {
+    LOG(INFO) << deadline->GetReport();
+  }
+  if (pending_result_write.valid()) {
+    pending_result_write.get();
+  }
+}
+
+// Returns the image model for the given parameters. The models are cached, so
+// batch jobs with the same parameters share the degradation operators and
+// their precomputed state (e.g. the transfer functions of the Fourier blur).
+// The motion sequence and the warps are identified by their file paths, or
+// by the shifts themselves if the sequence is given directly (e.g. after
+// frame selection).
+const ImageModel& GetImageModel(
+    const super_resolution::ImageModelParameters& model_parameters) {
+
+  static std::map<std::string, ImageModel> image_models;
+  std::ostringstream key;
+  key << std::setprecision(17)
+      << model_parameters.scale << " "
+      << model_parameters.blur_radius << " "
+      << model_parameters.blur_sigma << " "
+      << model_parameters.blur_sigma_per_band << " "
+      << model_parameters.blur_band_group_size << " "
+      << model_parameters.noise_sigma << " "
+      << model_parameters.use_fourier_blur << " "
+      << model_parameters.use_area_downsampling << " "
+      << model_parameters.num_threads << " "
+      << model_parameters.motion_sequence_path << " "
+      << model_parameters.warp_sequence_path;
+  const super_resolution::MotionShiftSequence& motion_sequence =
+      model_parameters.motion_sequence;
+  for (int i = 0; i < motion_sequence.GetNumMotionShifts(); ++i) {
+    key << " " << motion_sequence[i].dx << " " << motion_sequence[i].dy;
+  }
+  auto iterator = image_models.find(key.str());
+  if (iterator == image_models.end()) {
+    iterator = image_models.emplace(
+        key.str(), ImageModel::CreateImageModel(model_parameters)).first;
+  } else {
+    LOG(INFO) << "Reusing the image model of a previous run.";
+  }
+  return iterator->second;
+}
 
-  // Create the forward image model.
+// Returns the parameters of the forward image model given by the user input
+// flags.
+super_resolution::ImageModelParameters GetImageModelParameters() {
   super_resolution::ImageModelParameters model_parameters;
   model_parameters.scale = FLAGS_upsampling_scale;
   model_parameters.blur_radius = FLAGS_blur_radius;
   model_parameters.blur_sigma = FLAGS_blur_sigma;
+  model_parameters.blur_sigma_per_band = FLAGS_blur_sigma_per_band;
+  model_parameters.blur_band_group_size = FLAGS_blur_band_group_size;
   model_parameters.motion_sequence_path = FLAGS_motion_sequence_path;
+  model_parameters.warp_sequence_path = FLAGS_warp_sequence_path;
+  model_parameters.use_fourier_blur = FLAGS_use_fourier_blur;
+  model_parameters.use_area_downsampling = FLAGS_use_area_downsampling;
+  model_parameters.num_threads = FLAGS_num_threads;
+  return model_parameters;
+}
+
+// Returns true if the given flag was not set by the user (or a job).
+bool IsFlagDefault(const std::string& flag_name) {
+  return gflags::GetCommandLineFlagInfoOrDie(flag_name.c_str()).is_default;
+}
+
+// Picks the fastest blur implementation and data term thread count for the
+// given observations with the autotuner (--autotune_cache_path), and sets
+// them in the model parameters and --num_threads. Options set explicitly by
+// the user are kept. The Fourier blur interpolates sub-pixel motion
+// differently, so it is only considered without motion.
+void AutotunePerformanceSettings(
+    const std::vector<ImageData>& observations,
+    super_resolution::ImageModelParameters* model_parameters) {
+
+  super_resolution::util::Autotuner autotuner(FLAGS_autotune_cache_path);
+  const cv::Size low_res_size = observations[0].GetImageSize();
+  const int num_channels = observations[0].GetNumChannels();
+  const cv::Size image_size(
+      low_res_size.width * model_parameters->scale,
+      low_res_size.height * model_parameters->scale);
+  std::ostringstream problem;
+  problem << image_size.width << "x" << image_size.height
+          << " channels=" << num_channels
+          << " frames=" << observations.size()
+          << " scale=" << model_parameters->scale
+          << " blur=" << model_parameters->blur_radius;
+
+  if (IsFlagDefault("use_fourier_blur") &&
+      model_parameters->blur_sigma_per_band == 0.0 &&
+      model_parameters->motion_sequence_path.empty() &&
+      model_parameters->warp_sequence_path.empty()) {
+    std::vector<ImageModel> image_models;
+    for (const bool use_fourier_blur : {false, true}) {
+      super_resolution::ImageModelParameters candidate_parameters =
+          *model_parameters;
+      candidate_parameters.use_fourier_blur = use_fourier_blur;
+      image_models.push_back(
+          ImageModel::CreateImageModel(candidate_parameters));
+    }
+    const std::vector<double> pixels(
+        static_cast<int64_t>(image_size.area()) * num_channels, 0.5);
+    const ImageData image(pixels.data(), image_size, num_channels);
+    const int choice = autotuner.SelectFastest(
+        "blur " + problem.str(), image_models.size(), [&](const int index) {
+      ImageData degraded_image = image_models[index].ApplyToImage(image, 0);
+      image_models[index].ApplyTransposeToImage(&degraded_image, 0);
+    });
+    model_parameters->use_fourier_blur = (choice == 1);
+    LOG(INFO) << "Tuned blur: "
+              << (model_parameters->use_fourier_blur ? "Fourier" : "spatial");
+  }
+
+  if (IsFlagDefault("num_threads")) {
+    const ImageModel image_model =
+        ImageModel::CreateImageModel(*model_parameters);
+    const int max_num_threads = super_resolution::util::GetMaxNumThreads();
+    std::vector<int> thread_counts;
+    for (int num_threads = 1;
+         num_threads < max_num_threads;
+         num_threads *= 2) {
+      thread_counts.push_back(num_threads);
+    }
+    thread_counts.push_back(max_num_threads);
+    std::vector<std::unique_ptr<super_resolution::ObjectiveDataTerm>>
+        data_terms;
+    for (const int num_threads : thread_counts) {
+      data_terms.emplace_back(new super_resolution::ObjectiveDataTerm(
+          image_model,
+          observations,
+          0,
+          num_channels,
+          image_size,
+          num_threads,
+          FLAGS_use_single_precision ?
+              super_resolution::SINGLE_PRECISION :
+              super_resolution::DOUBLE_PRECISION));
+    }
+    const int64_t num_parameters =
+        static_cast<int64_t>(image_size.area()) * num_channels;
+    const std::vector<double> estimate(num_parameters, 0.5);
+    std::vector<double> gradient(num_parameters);
+    problem << " fourier=" << model_parameters->use_fourier_blur
+            << " single_precision=" << FLAGS_use_single_precision;
+    const int choice = autotuner.SelectFastest(
+        "data_term_threads " + problem.str(),
+        thread_counts.size(),
+        [&](const int index) {
+      std::fill(gradient.begin(), gradient.end(), 0.0);
+      data_terms[index]->Compute(estimate.data(), gradient.data());
+    });
+    FLAGS_num_threads = thread_counts[choice];
+    model_parameters->num_threads = FLAGS_num_threads;
+    ImageData::SetNumThreads(FLAGS_num_threads);
+    LOG(INFO) << "Tuned number of threads: " << FLAGS_num_threads;
+  }
+}
 
-  const ImageModel image_model =
-      ImageModel::CreateImageModel(model_parameters);
+// Estimates the peak memory of solving the given observations, and sets
+// --split_channels, --num_channels_per_split, --num_split_overlap_channels,
+// --use_single_precision and --tile_size to the layout that fits in
+// --memory_budget_mb (see PlanSolverMemory()). The tile size is only chosen
+// if the solve can be tiled.
+void PlanMemoryBudget(
+    const super_resolution::ImageModelParameters& model_parameters,
+    const std::vector<ImageData>& observations) {
+
+  super_resolution::ImageModelParameters planned_model_parameters =
+      model_parameters;
+  if (planned_model_parameters.motion_sequence.GetNumMotionShifts() == 0 &&
+      !planned_model_parameters.motion_sequence_path.empty()) {
+    planned_model_parameters.motion_sequence.LoadSequenceFromFile(
+        planned_model_parameters.motion_sequence_path);
+  }
+  super_resolution::MapSolverOptions solver_options;
+  SetMapSolverOptions(SolveSettings(), &solver_options);
+
+  const cv::Size low_res_size = observations[0].GetImageSize();
+  super_resolution::SolverMemoryProblem problem;
+  problem.high_res_size = cv::Size(
+      low_res_size.width * model_parameters.scale,
+      low_res_size.height * model_parameters.scale);
+  problem.num_channels = observations[0].GetNumChannels();
+  problem.num_observations = observations.size();
+  problem.tile_size = FLAGS_tile_size;
+  problem.num_tile_workers = FLAGS_num_tile_workers;
+  problem.regularizer_range = 0;
+  if (FLAGS_regularization_parameter > 0.0) {
+    problem.regularizer_range =
+        (FLAGS_regularizer == "btv") ? FLAGS_btv_scale_range : 1;
+    problem.regularizer_couples_channels = (FLAGS_regularizer == "3dtv");
+  }
+  const bool can_tile = !FLAGS_solve_in_wavelet_domain &&
+      FLAGS_num_pyramid_levels <= 1 && FLAGS_warp_sequence_path.empty() &&
+      FLAGS_region_of_interest.empty();
+
+  const super_resolution::SolverMemoryPlan plan =
+      super_resolution::PlanSolverMemory(
+          planned_model_parameters,
+          solver_options,
+          problem,
+          FLAGS_memory_budget_mb * 1024.0 * 1024.0,
+          can_tile ? 64 : 0);
+  LOG(INFO) << "Estimated peak memory: "
+            << plan.estimate.GetTotalBytes() / (1024.0 * 1024.0) << " MB ("
+            << plan.estimate.num_concurrent_solves << " concurrent solves).";
+  LOG_IF(WARNING, !plan.fits_budget)
+      << "No solve layout fits in the memory budget of "
+      << FLAGS_memory_budget_mb << " MB. Using the smallest one.";
+  FLAGS_split_channels = plan.split_channels;
+  FLAGS_num_channels_per_split = plan.num_channels_per_split;
+  FLAGS_num_split_overlap_channels = plan.num_split_overlap_channels;
+  FLAGS_use_single_precision = plan.use_single_precision;
+  FLAGS_tile_size = plan.tile_size;
+  LOG(INFO) << "Memory plan: split_channels=" << FLAGS_split_channels
+            << " num_channels_per_split=" << FLAGS_num_channels_per_split
+            << " num_split_overlap_channels="
+            << FLAGS_num_split_overlap_channels
+            << " use_single_precision=" << FLAGS_use_single_precision
+            << " tile_size=" << FLAGS_tile_size;
+}
 
-  // Load in or generate the low-resolution images.
+// Returns true if the user input flags provide a ground truth image.
+bool HasGroundTruth() {
+  return !FLAGS_ground_truth_image.empty() || FLAGS_generate_lr_images;
+}
+
+// Returns the options of the input preparation given by the user input flags.
+InputOptions GetInputOptions() {
+  InputOptions options;
+  options.data_path = FLAGS_data_path;
+  options.ground_truth_image = FLAGS_ground_truth_image;
+  options.generate_lr_images = FLAGS_generate_lr_images;
+  options.number_of_frames = FLAGS_number_of_frames;
+  options.noise_sigma = FLAGS_noise_sigma;
+  options.num_io_threads = FLAGS_num_io_threads;
+  options.preprocessing_cache_dir = FLAGS_preprocessing_cache_dir;
+  options.model_parameters = GetImageModelParameters();
+  options.create_upsampled_image =
+      (HasGroundTruth() && !FLAGS_evaluators.empty()) ||
+      FLAGS_display_mode == "compare";
+  options.upsampling_scale = FLAGS_upsampling_scale;
+  options.convert_to_pca_space =
+      FLAGS_solve_in_pca_space && !FLAGS_interpolate_color;
+  options.pca_retained_variance = FLAGS_pca_retained_variance;
+  options.num_pca_components = FLAGS_num_pca_components;
+  options.pca_options.pixel_sampling_ratio = FLAGS_pca_pixel_sampling_ratio;
+  options.pca_options.num_threads = FLAGS_num_threads;
+  options.pca_options.use_randomized_decomposition =
+      FLAGS_pca_randomized_decomposition;
+  options.pca_options.randomized_oversampling =
+      FLAGS_pca_randomized_oversampling;
+  options.pca_options.randomized_power_iterations =
+      FLAGS_pca_randomized_power_iterations;
+  return options;
+}
+
+// Loads in or generates the low-resolution images (and the ground truth, if
+// available) as given by the options. The low-resolution images are generated
+// with the image model parameters of the options and their noise_sigma.
+InputData LoadInputData(const InputOptions& options) {
   InputData input_data;
-  if (FLAGS_generate_lr_images) {
+  if (options.generate_lr_images) {
     // If generating low-res images, use the specified data_path as the ground
     // truth file.
     LOG(INFO) << "Generating low-resolution images from ground truth.";
     input_data.high_res_image =
-        super_resolution::util::LoadImage(FLAGS_data_path);
+        super_resolution::util::LoadImage(options.data_path);
     // Create another image model with the noise module to generate LR images.
-    model_parameters.noise_sigma = FLAGS_noise_sigma;
+    super_resolution::ImageModelParameters model_parameters =
+        options.model_parameters;
+    model_parameters.noise_sigma = options.noise_sigma;
     ImageModel image_model_with_noise =
         ImageModel::CreateImageModel(model_parameters);
-    for (int i = 0; i < FLAGS_number_of_frames; ++i) {
+    const super_resolution::util::ScopedMemoryTag memory_tag(
+        super_resolution::util::MEMORY_TAG_OBSERVATIONS);
+    for (int i = 0; i < options.number_of_frames; ++i) {
       const ImageData low_res_frame =
           image_model_with_noise.ApplyToImage(input_data.high_res_image, i);
       input_data.low_res_images.push_back(low_res_frame);
@@ -301,31 +1619,301 @@ int main(int argc, char** argv) {
   } else {
     // Otherwise, assume the given data_path is a directory containing the LR
     // images.
-    input_data.low_res_images =
-        super_resolution::util::LoadImages(FLAGS_data_path);
+    input_data.low_res_images = super_resolution::util::LoadImages(
+        options.data_path,
+        options.num_io_threads,
+        super_resolution::util::MEMORY_TAG_OBSERVATIONS);
     // We can also load in a ground truth file for comparison, if available.
-    if (!FLAGS_ground_truth_image.empty()) {
+    if (!options.ground_truth_image.empty()) {
       input_data.high_res_image =
-          super_resolution::util::LoadImage(FLAGS_ground_truth_image);
+          super_resolution::util::LoadImage(options.ground_truth_image);
     }
   }
   CHECK_GT(input_data.low_res_images.size(), 0)
       << "At least one low-resolution image is required for super-resolution.";
+  return input_data;
+}
 
-  // Set flags for evaluation. We will evaluate if ground truth is available
-  // and if an evaluator is specified.
-  const bool has_ground_truth =
-      !FLAGS_ground_truth_image.empty() || FLAGS_generate_lr_images;
-  const bool evaluate_results = has_ground_truth && !FLAGS_evaluators.empty();
+// Same as LoadInputData(), but takes the images from the given preprocessing
+// cache if it has them, and caches them otherwise. The key covers the input
+// files and every option that the images depend on. The name of the cache
+// entry is returned in cache_entry_name, so that the products of the later
+// stages can be keyed by it.
+InputData LoadCachedInputData(
+    const InputOptions& options,
+    const super_resolution::util::PreprocessingCache& preprocessing_cache,
+    std::string* cache_entry_name) {
+
+  const super_resolution::ImageModelParameters& model_parameters =
+      options.model_parameters;
+  super_resolution::util::PreprocessingCacheKey key("observations");
+  key.AddInputFiles(options.data_path);
+  key.AddValue("generate_lr_images", options.generate_lr_images);
+  if (options.generate_lr_images) {
+    key.AddValue("number_of_frames", options.number_of_frames);
+    key.AddValue("noise_sigma", options.noise_sigma);
+    key.AddValue("scale", model_parameters.scale);
+    key.AddValue("blur_radius", model_parameters.blur_radius);
+    key.AddValue("blur_sigma", model_parameters.blur_sigma);
+    key.AddValue("use_fourier_blur", model_parameters.use_fourier_blur);
+    key.AddValue(
+        "use_area_downsampling", model_parameters.use_area_downsampling);
+    if (!model_parameters.motion_sequence_path.empty()) {
+      key.AddFileContents(model_parameters.motion_sequence_path);
+    }
+    if (!model_parameters.warp_sequence_path.empty()) {
+      key.AddFileContents(model_parameters.warp_sequence_path);
+    }
+  } else if (!options.ground_truth_image.empty()) {
+    key.AddValue("ground_truth_image", true);
+    key.AddInputFiles(options.ground_truth_image);
+  }
+  *cache_entry_name = key.GetEntryName();
+
+  // The entry stores the low-resolution images followed by the ground truth,
+  // if there is one.
+  InputData input_data;
+  std::vector<ImageData> images;
+  if (preprocessing_cache.Load(key, &images)) {
+    if (options.HasGroundTruth()) {
+      input_data.high_res_image = std::move(images.back());
+      images.pop_back();
+    }
+    input_data.low_res_images = std::move(images);
+    return input_data;
+  }
+  input_data = LoadInputData(options);
+  images = input_data.low_res_images;
+  if (options.HasGroundTruth()) {
+    images.push_back(input_data.high_res_image);
+  }
+  preprocessing_cache.Save(key, images);
+  return input_data;
+}
+
+// Fits the spectral PCA (--solve_in_pca_space) to the low-resolution images
+// and converts them into the PCA space. If the preprocessing cache is given,
+// the basis and the converted images are taken from it if it has them, and
+// cached otherwise, keyed by the cache entry of the images and the PCA
+// options. Returns the PCA that converts the result back.
+std::unique_ptr<super_resolution::SpectralPCA> ConvertToPCASpace(
+    const InputOptions& options,
+    const super_resolution::util::PreprocessingCache* preprocessing_cache,
+    const std::string& input_cache_entry_name,
+    std::vector<ImageData>* low_res_images) {
+
+  const super_resolution::SpectralPCAOptions& pca_options =
+      options.pca_options;
+
+  // The entry stores the eigenvectors, the mean, and the eigenvalues followed
+  // by the total variance as single-channel images, followed by the converted
+  // images.
+  super_resolution::util::PreprocessingCacheKey key("pca");
+  key.AddValue("format", 2);
+  key.AddValue("observations", input_cache_entry_name);
+  key.AddValue("pca_retained_variance", options.pca_retained_variance);
+  key.AddValue("num_pca_components", options.num_pca_components);
+  key.AddValue("pixel_sampling_ratio", pca_options.pixel_sampling_ratio);
+  key.AddValue("random_seed", pca_options.random_seed);
+  key.AddValue("use_randomized_decomposition",
+               pca_options.use_randomized_decomposition);
+  key.AddValue("randomized_oversampling", pca_options.randomized_oversampling);
+  key.AddValue("randomized_power_iterations",
+               pca_options.randomized_power_iterations);
+  std::vector<ImageData> cached_images;
+  if (preprocessing_cache != nullptr &&
+      preprocessing_cache->Load(key, &cached_images)) {
+    CHECK_EQ(cached_images.size(), low_res_images->size() + 3)
+        << "The cached PCA does not match the observations.";
+    const cv::Mat variances = cached_images[2].GetChannelImage(0);
+    std::unique_ptr<super_resolution::SpectralPCA> spectral_pca(
+        new super_resolution::SpectralPCA(
+            cached_images[0].GetChannelImage(0),
+            cached_images[1].GetChannelImage(0),
+            pca_options,
+            variances.colRange(0, variances.cols - 1),
+            variances.at<double>(variances.cols - 1)));
+    low_res_images->assign(
+        std::make_move_iterator(cached_images.begin() + 3),
+        std::make_move_iterator(cached_images.end()));
+    return spectral_pca;
+  }
+
+  std::unique_ptr<super_resolution::SpectralPCA> spectral_pca;
+  if (options.pca_retained_variance > 0.0) {
+    spectral_pca = std::unique_ptr<super_resolution::SpectralPCA>(
+        new super_resolution::SpectralPCA(
+            *low_res_images, options.pca_retained_variance, pca_options));
+  } else {
+    spectral_pca = std::unique_ptr<super_resolution::SpectralPCA>(
+        new super_resolution::SpectralPCA(
+            *low_res_images, options.num_pca_components, pca_options));
+  }
+  for (int i = 0; i < low_res_images->size(); ++i) {
+    (*low_res_images)[i] = spectral_pca->GetPCAImage((*low_res_images)[i]);
+  }
+  if (preprocessing_cache != nullptr) {
+    cv::Mat variances;
+    cv::hconcat(
+        spectral_pca->GetEigenvalues().t(),
+        cv::Mat(1, 1, spectral_pca->GetEigenvalues().type(),
+                cv::Scalar(spectral_pca->GetTotalVariance())),
+        variances);
+    cached_images = {
+        ImageData(spectral_pca->GetEigenvectors(),
+                  super_resolution::DO_NOT_NORMALIZE_IMAGE),
+        ImageData(spectral_pca->GetMean(),
+                  super_resolution::DO_NOT_NORMALIZE_IMAGE),
+        ImageData(variances, super_resolution::DO_NOT_NORMALIZE_IMAGE)};
+    cached_images.insert(
+        cached_images.end(), low_res_images->begin(), low_res_images->end());
+    preprocessing_cache->Save(key, cached_images);
+  }
+  return spectral_pca;
+}
+
+// Returns "ok" if the user input flags of a run can be used together, or the
+// reason that they cannot. Jobs are checked with this before they are run, so
+// an invalid job does not stop a batch or the job server.
+std::string ValidateRunFlags() {
+  if (FLAGS_data_path.empty()) {
+    return "missing data_path";
+  }
+  if (!super_resolution::util::PathExists(FLAGS_data_path)) {
+    return "data_path " + FLAGS_data_path + " does not exist";
+  }
+
+  // Warps are given in coordinates of the full HR image, so they cannot be
+  // rescaled or cropped like motion shifts (e.g. for the half size wavelet
+  // subbands).
+  if (!FLAGS_warp_sequence_path.empty() &&
+      (FLAGS_num_pyramid_levels > 1 || FLAGS_tile_size > 0 ||
+       FLAGS_group_motion_phases || FLAGS_solve_in_wavelet_domain ||
+       FLAGS_initial_estimate.find("shift_add") == 0)) {
+    return "--warp_sequence_path cannot be used with --num_pyramid_levels, "
+           "--tile_size, --group_motion_phases, --solve_in_wavelet_domain "
+           "or a shift-add initial estimate";
+  }
+
+  // A region of interest is solved in tiles, and its halo is cropped from the
+  // full observations.
+  if (!FLAGS_region_of_interest.empty() &&
+      (FLAGS_solve_in_wavelet_domain || FLAGS_num_pyramid_levels > 1 ||
+       !FLAGS_warp_sequence_path.empty() || FLAGS_interpolate_color)) {
+    return "--region_of_interest cannot be used with "
+           "--solve_in_wavelet_domain, --num_pyramid_levels, "
+           "--warp_sequence_path or --interpolate_color";
+  }
+
+  // Only streamed band blocks are distributed across ranks.
+  if (FLAGS_stream_band_block_size <= 0 &&
+      (FLAGS_distributed || FLAGS_num_ranks > 1)) {
+    return "distributed runs require --stream_band_block_size";
+  }
+
+  if (FLAGS_stream_band_block_size > 0) {
+    if (FLAGS_result_path.empty()) {
+      return "missing result_path";
+    }
+    if (FLAGS_generate_lr_images || FLAGS_interpolate_color ||
+        FLAGS_solve_in_pca_space || !FLAGS_initial_estimate_path.empty()) {
+      return "streaming bands cannot be used with --generate_lr_images, "
+             "--interpolate_color, --solve_in_pca_space or "
+             "--initial_estimate_path";
+    }
+    // The planner only sees the whole image, not the band blocks.
+    if (FLAGS_memory_budget_mb > 0.0) {
+      return "--memory_budget_mb cannot be used with "
+             "--stream_band_block_size; choose the band block size instead";
+    }
+  }
+
+  // The band-dependent blur picks the PSF of every channel by its band, so
+  // the channels cannot be PCA components, and the precomputed per-frame
+  // matrices of the compiled model and the normal equations only hold a
+  // single blur for all channels.
+  if (FLAGS_blur_sigma_per_band != 0.0 &&
+      (FLAGS_solve_in_pca_space || FLAGS_use_compiled_image_model ||
+       FLAGS_use_normal_equations)) {
+    return "--blur_sigma_per_band cannot be used with --solve_in_pca_space, "
+           "--use_compiled_image_model or --use_normal_equations";
+  }
+  return "ok";
+}
+
+// Checks that the user input flags of a run can be used together.
+void CheckRunFlags() {
+  CheckRegularizerFlag();
+  const std::string status = ValidateRunFlags();
+  CHECK(status == "ok") << "Invalid flags: " << status << ".";
+}
+
+// Loads in or generates the low-resolution images as given by the options, or
+// takes them from the preprocessing cache, and creates the upsampled
+// reference if requested.
+void LoadRunInputs(const InputOptions& options, RunInputs* inputs) {
+  CHECK_NOTNULL(inputs);
+  if (!options.preprocessing_cache_dir.empty()) {
+    const super_resolution::util::PreprocessingCache preprocessing_cache(
+        options.preprocessing_cache_dir);
+    inputs->input_data = LoadCachedInputData(
+        options, preprocessing_cache, &inputs->input_cache_entry_name);
+  } else {
+    inputs->input_data = LoadInputData(options);
+  }
 
   // Create an interpolated (bilinear upsampled) image as a reference. We only
   // need this if evaluating the results or displaying a comparison.
-  ImageData upsampled_image;
-  if (evaluate_results || FLAGS_display_mode == "compare") {
-    upsampled_image = input_data.low_res_images[0];
-    upsampled_image.ResizeImage(
-        FLAGS_upsampling_scale, super_resolution::INTERPOLATE_LINEAR);
+  if (options.create_upsampled_image) {
+    inputs->upsampled_image = inputs->input_data.low_res_images[0];
+    inputs->upsampled_image.ResizeImage(
+        options.upsampling_scale, super_resolution::INTERPOLATE_LINEAR);
   }
+}
+
+// If the options request it, converts the loaded low-resolution images into
+// the spectral PCA space, and keeps the PCA to convert the result back.
+void ConvertRunInputsToPCASpace(
+    const InputOptions& options, RunInputs* inputs) {
+
+  CHECK_NOTNULL(inputs);
+  if (!options.convert_to_pca_space) {
+    return;
+  }
+  std::unique_ptr<super_resolution::util::PreprocessingCache>
+      preprocessing_cache;
+  if (!options.preprocessing_cache_dir.empty()) {
+    preprocessing_cache.reset(new super_resolution::util::PreprocessingCache(
+        options.preprocessing_cache_dir));
+  }
+  inputs->spectral_pca = ConvertToPCASpace(
+      options,
+      preprocessing_cache.get(),
+      inputs->input_cache_entry_name,
+      &inputs->input_data.low_res_images);
+  LOG(INFO) << "Super-resolving in PCA space with "
+            << inputs->input_data.low_res_images[0].GetNumChannels()
+            << " PCA components.";
+}
+
+// Super-resolves the prepared inputs with the options given by the user input
+// flags, then evaluates and displays the result as requested. The inputs are
+// consumed.
+ImageData SuperResolveRunInputs(RunInputs* inputs) {
+  CHECK_NOTNULL(inputs);
+  ResetSolverTelemetry();
+  quality_stop_reference = ImageData();
+  InputData& input_data = inputs->input_data;
+  ImageData& upsampled_image = inputs->upsampled_image;
+
+  // The parameters of the forward image model.
+  super_resolution::ImageModelParameters model_parameters =
+      GetImageModelParameters();
+
+  // Set flags for evaluation. We will evaluate if ground truth is available
+  // and if an evaluator is specified.
+  const bool has_ground_truth = HasGroundTruth();
+  const bool evaluate_results = has_ground_truth && !FLAGS_evaluators.empty();
 
   // If the interpolate_color flag is set, only run super-resolution on the
   // luminance channel and interpolate color information after. This will only
@@ -341,56 +1929,169 @@ int main(int argc, char** argv) {
     }
   }
 
-  // If solve_in_pca_space flag was set, convert the image(s) to the spectral
-  // PCA domain and solve. Then convert them back after the solver finishes.
-  // Cannot use this option if using the color interpolation scheme.
-  std::unique_ptr<super_resolution::SpectralPCA> spectral_pca;
+  // If the images were converted to the spectral PCA domain (by
+  // ConvertRunInputsToPCASpace()), they are solved there and the result is
+  // converted back after the solver finishes. This cannot be used with the
+  // color interpolation scheme.
+  const std::unique_ptr<super_resolution::SpectralPCA>& spectral_pca =
+      inputs->spectral_pca;
   if (FLAGS_solve_in_pca_space && !FLAGS_interpolate_color) {
-    // TODO: Get the sampling options and number of PCA bands from user args!
-    if (FLAGS_pca_retained_variance > 0.0) {
-      spectral_pca = std::unique_ptr<super_resolution::SpectralPCA>(
-          new super_resolution::SpectralPCA(
-              input_data.low_res_images, FLAGS_pca_retained_variance));
-    } else {
-      spectral_pca = std::unique_ptr<super_resolution::SpectralPCA>(
-          new super_resolution::SpectralPCA(
-              input_data.low_res_images, FLAGS_num_pca_components));
+    CHECK(spectral_pca != nullptr)
+        << "The inputs were not converted into the PCA space.";
+    if (FLAGS_pca_split_budgets) {
+      CHECK(FLAGS_split_channels)
+          << "--pca_split_budgets requires --split_channels.";
+      pca_explained_variance_ratios =
+          spectral_pca->GetExplainedVarianceRatios();
     }
-    for (int i = 0; i < input_data.low_res_images.size(); ++i) {
-      input_data.low_res_images[i] =
-          spectral_pca->GetPCAImage(input_data.low_res_images[i]);
+  }
+
+  // The quality stopping rule compares against the ground truth, which is
+  // only in the solver's space if the channels were not converted.
+  if (FLAGS_quality_stop_interval > 0 && has_ground_truth &&
+      !FLAGS_interpolate_color && !FLAGS_solve_in_pca_space) {
+    quality_stop_reference = input_data.high_res_image;
+    quality_stop_reference.SetPrecision(super_resolution::DOUBLE_PRECISION);
+  }
+
+  // Keep only the most informative frames if requested, which caps the cost
+  // of every data term evaluation. The initial estimate and the image model
+  // are then made from the selected frames and their motion shifts.
+  if (FLAGS_num_selected_frames > 0 &&
+      FLAGS_num_selected_frames < input_data.low_res_images.size()) {
+    REQUIRE_ARG(FLAGS_motion_sequence_path);
+    CHECK(FLAGS_warp_sequence_path.empty())
+        << "--num_selected_frames cannot be used with --warp_sequence_path.";
+    super_resolution::MotionShiftSequence motion_sequence;
+    motion_sequence.LoadSequenceFromFile(FLAGS_motion_sequence_path);
+    const std::vector<int> selected_frames = super_resolution::SelectFrames(
+        input_data.low_res_images,
+        motion_sequence,
+        FLAGS_upsampling_scale,
+        FLAGS_num_selected_frames);
+    std::vector<ImageData> selected_images;
+    std::vector<super_resolution::MotionShift> selected_motion_shifts;
+    for (const int frame_index : selected_frames) {
+      selected_images.push_back(
+          std::move(input_data.low_res_images[frame_index]));
+      selected_motion_shifts.push_back(motion_sequence[frame_index]);
     }
-    LOG(INFO) << "Super-resolving in PCA space with "
-              << input_data.low_res_images[0].GetNumChannels()
-              << " PCA components.";
+    input_data.low_res_images = std::move(selected_images);
+    model_parameters.motion_sequence =
+        super_resolution::MotionShiftSequence(selected_motion_shifts);
+    model_parameters.motion_sequence_path = "";
   }
 
-  // Use an interpolated (bilinear upsampled) image the initial estimate. This
-  // is done after any other conversions to keep it in the same spectral space
-  // that the solver will operate in.
-  ImageData initial_estimate = input_data.low_res_images[0];
-  initial_estimate.ResizeImage(
-      FLAGS_upsampling_scale, super_resolution::INTERPOLATE_LINEAR);
+  // Fit the solve into the memory budget before anything depends on its
+  // layout.
+  if (FLAGS_memory_budget_mb > 0.0) {
+    PlanMemoryBudget(model_parameters, input_data.low_res_images);
+  }
+
+  // Create the forward image model, with the fastest options for these
+  // observations if autotuning.
+  if (!FLAGS_autotune_cache_path.empty()) {
+    AutotunePerformanceSettings(input_data.low_res_images, &model_parameters);
+  }
+  const ImageModel& image_model = GetImageModel(model_parameters);
+
+  // Create the initial estimate. This is done after any other conversions to
+  // keep it in the same spectral space that the solver will operate in.
+  const ImageData initial_estimate =
+      CreateInitialEstimate(model_parameters, input_data.low_res_images);
 
-  // Run super-resolution in the selected domain.
+  // Save the intermediate estimates while solving if requested. They are
+  // converted to the output space in the same way as the result below. This
+  // runs on a background thread, so it only reads the inputs.
+  progressive_results.reset();
+  if (!FLAGS_progressive_results_path.empty()) {
+    if (FLAGS_map_solver != "irls") {
+      LOG(WARNING) << "Only the IRLS solver streams intermediate estimates.";
+    }
+    const ImageData& color_image = input_data.low_res_images[0];
+    progressive_results.reset(new super_resolution::ProgressiveResults(
+        FLAGS_progressive_results_iterations,
+        FLAGS_progressive_results_seconds,
+        [&color_image, &spectral_pca](
+            const ImageData& estimate,
+            const super_resolution::ProgressiveSnapshot& snapshot) {
+          ImageData output_estimate = estimate;
+          if (FLAGS_interpolate_color) {
+            output_estimate.InterpolateColorFrom(color_image);
+            output_estimate.ChangeColorSpace(
+                super_resolution::SPECTRAL_MODE_COLOR_BGR);
+          } else if (FLAGS_solve_in_pca_space) {
+            output_estimate = spectral_pca->ReconstructImage(estimate);
+          }
+          const std::string path = GetProgressiveResultPath(snapshot.index);
+          super_resolution::util::SaveImage(output_estimate, path);
+          LOG(INFO) << "Saved the estimate after " << snapshot.num_iterations
+                    << " iterations (" << snapshot.elapsed_seconds
+                    << " seconds) to " << path;
+        }));
+  }
+
+  // Limit the solve to the time budget if one is given. Every part of the
+  // solve (e.g. tiles or channel splits) gets its share of it.
+  solve_deadline = CreateSolveDeadline();
+
+  // Run super-resolution in the selected domain. If requested, the frames
+  // are merged by their sub-pixel motion phase first, and the merged
+  // observations are solved with their own weighted image model.
   ImageData result;
-  if (FLAGS_solve_in_wavelet_domain) {
-    result = SolveInWaveletDomain(image_model, input_data.low_res_images);
+  if (FLAGS_group_motion_phases) {
+    REQUIRE_ARG(FLAGS_motion_sequence_path);
+    CHECK(!FLAGS_solve_in_wavelet_domain)
+        << "Merged frames cannot be solved in the wavelet domain.";
+    // The motion of the selected frames, if frames were selected.
+    super_resolution::MotionShiftSequence motion_sequence =
+        model_parameters.motion_sequence;
+    if (motion_sequence.GetNumMotionShifts() == 0) {
+      motion_sequence.LoadSequenceFromFile(FLAGS_motion_sequence_path);
+    }
+    const super_resolution::PhaseGroupedObservations grouped =
+        super_resolution::GroupObservationsByPhase(
+            input_data.low_res_images,
+            motion_sequence,
+            FLAGS_upsampling_scale,
+            FLAGS_motion_phase_steps);
+    super_resolution::ImageModelParameters grouped_model_parameters =
+        model_parameters;
+    grouped_model_parameters.motion_sequence_path = "";
+    grouped_model_parameters.motion_sequence = grouped.motion_sequence;
+    grouped_model_parameters.observation_weights = grouped.weights;
+    const ImageModel grouped_image_model =
+        ImageModel::CreateImageModel(grouped_model_parameters);
+    result = SolveInSelectedDomain(
+        grouped_model_parameters,
+        grouped_image_model,
+        grouped.observations,
+        initial_estimate);
   } else {
-    // Solving is handled in the SetupAndRunSolver function above.
-    result = SetupAndRunSolver(
-        image_model, input_data.low_res_images, initial_estimate);
+    result = SolveInSelectedDomain(
+        model_parameters,
+        image_model,
+        input_data.low_res_images,
+        initial_estimate);
+  }
+  progressive_results.reset();
+  if (solve_deadline != nullptr) {
+    LOG(INFO) << solve_deadline->GetReport();
+    solve_deadline.reset();
   }
 
   // If SR was only done on the luminance channel, interpolate the colors now
   // and change the color space back to BGR.
   //
   // Note that the colors we're interpolating are in the luminance-dominant
-  // color space (not BGR), and so we must interpolate the initial estimate,
+  // color space (not BGR), and so we must interpolate the first input image,
   // which is in the same color space as the solved image, rather than the
-  // reference upsampled image which was never converted from BGR.
+  // reference upsampled image which was never converted from BGR. The
+  // shift-add estimate cannot be used since it has no hidden channels. The
+  // chroma channels of the first input image are only computed here, and are
+  // upsampled once, straight to the size of the result.
   if (FLAGS_interpolate_color) {
-    result.InterpolateColorFrom(initial_estimate);
+    result.InterpolateColorFrom(input_data.low_res_images[0]);
     result.ChangeColorSpace(super_resolution::SPECTRAL_MODE_COLOR_BGR);
   }
 
@@ -399,30 +2100,88 @@ int main(int argc, char** argv) {
     result = spectral_pca->ReconstructImage(result);
   }
 
+  // The result only covers the region of interest, so the references are
+  // cropped to it.
+  const cv::Rect region_of_interest = GetRegionOfInterest();
+  if (region_of_interest.area() > 0) {
+    if (has_ground_truth) {
+      input_data.high_res_image =
+          CropImage(input_data.high_res_image, region_of_interest);
+    }
+    if (upsampled_image.GetNumChannels() > 0) {
+      upsampled_image = CropImage(upsampled_image, region_of_interest);
+    }
+  }
+
   // If an evaluation criteria is passed in and the high-resolution image is
   // available, display the evaluation results.
   if (evaluate_results) {
+    // The evaluators read the pixels in double precision.
+    input_data.high_res_image.SetPrecision(super_resolution::DOUBLE_PRECISION);
+    upsampled_image.SetPrecision(super_resolution::DOUBLE_PRECISION);
     std::vector<std::string> evaluators =
         super_resolution::util::SplitString(FLAGS_evaluators, ',');
+
+    // All metrics except the global SSIM come from a single pass over each
+    // image, which is only made if one of them is requested.
+    super_resolution::ImageQualityEvaluatorOptions quality_options;
+    quality_options.num_threads = FLAGS_num_threads;
+    const super_resolution::ImageQualityEvaluator quality_evaluator(
+        input_data.high_res_image, quality_options);
+    bool has_quality_metrics = false;
+    super_resolution::ImageQualityMetrics upsampled_metrics;
+    super_resolution::ImageQualityMetrics result_metrics;
+    const auto print_scores = [](
+        const std::string& name,
+        const double upsampled_score,
+        const double result_score) {
+      std::cout << name << " score on upsampled: " << upsampled_score
+                << std::endl;
+      std::cout << name << " score on result:    " << result_score
+                << std::endl;
+    };
     for (const std::string& evaluator_arg : evaluators) {
       const std::string evaluator =
           super_resolution::util::TrimString(evaluator_arg);
-      if (evaluator == "psnr") {
-        super_resolution::PeakSignalToNoiseRatioEvaluator psnr_evaluator(
-            input_data.high_res_image);
-        const double upsampled_psnr = psnr_evaluator.Evaluate(upsampled_image);
-        const double result_psnr = psnr_evaluator.Evaluate(result);
-        std::cout << "PSNR score on upsampled: " << upsampled_psnr << std::endl;
-        std::cout << "PSNR score on result:    " << result_psnr << std::endl;
-      } else if (evaluator == "ssim") {
+      if (evaluator == "global_ssim") {
         super_resolution::StructuralSimilarityEvaluator ssim_evaluator(
             input_data.high_res_image);
-        const double upsampled_ssim = ssim_evaluator.Evaluate(upsampled_image);
-        const double result_ssim = ssim_evaluator.Evaluate(result);
-        std::cout << "SSIM score on upsampled: " << upsampled_ssim << std::endl;
-        std::cout << "SSIM score on result:    " << result_ssim << std::endl;
-      } else {
+        print_scores(
+            "Global SSIM",
+            ssim_evaluator.Evaluate(upsampled_image),
+            ssim_evaluator.Evaluate(result));
+        continue;
+      }
+      if (evaluator != "psnr" && evaluator != "mse" &&
+          evaluator != "ssim" && evaluator != "sam") {
         LOG(ERROR) << "Unknown/unsupported evaluator '" << evaluator << "'.";
+        continue;
+      }
+      if (!has_quality_metrics) {
+        upsampled_metrics = quality_evaluator.Evaluate(upsampled_image);
+        result_metrics = quality_evaluator.Evaluate(result);
+        has_quality_metrics = true;
+      }
+      if (evaluator == "psnr") {
+        print_scores(
+            "PSNR",
+            upsampled_metrics.peak_signal_to_noise_ratio,
+            result_metrics.peak_signal_to_noise_ratio);
+      } else if (evaluator == "mse") {
+        print_scores(
+            "MSE",
+            upsampled_metrics.mean_squared_error,
+            result_metrics.mean_squared_error);
+      } else if (evaluator == "ssim") {
+        print_scores(
+            "SSIM",
+            upsampled_metrics.structural_similarity,
+            result_metrics.structural_similarity);
+      } else {
+        print_scores(
+            "SAM",
+            upsampled_metrics.spectral_angle,
+            result_metrics.spectral_angle);
       }
     }
   }
@@ -443,11 +2202,572 @@ int main(int argc, char** argv) {
     super_resolution::util::DisplayImagesSideBySide(
         display_images, display_title);
   }
+  return result;
+}
+
+// Runs super-resolution on the inputs given by the user input flags, then
+// evaluates, displays and saves the result as requested.
+void RunSuperResolution() {
+  CheckRunFlags();
+
+  // Streaming hyperspectral images in blocks of bands is handled separately,
+  // since the full images are never loaded.
+  if (FLAGS_stream_band_block_size > 0) {
+    ResetSolverTelemetry();
+    const super_resolution::ImageModelParameters model_parameters =
+        GetImageModelParameters();
+    SuperResolveInBandBlocks(
+        model_parameters, GetImageModel(model_parameters));
+    WriteSolverTelemetry();
+    return;
+  }
+
+  const InputOptions input_options = GetInputOptions();
+  RunInputs inputs;
+  LoadRunInputs(input_options, &inputs);
+  ConvertRunInputsToPCASpace(input_options, &inputs);
+  const ImageData result = SuperResolveRunInputs(&inputs);
 
   // Save file.
   if (!FLAGS_result_path.empty()) {
     super_resolution::util::SaveImage(result, FLAGS_result_path);
   }
+  WriteSolverTelemetry();
+}
+
+// Sets the flags given by a batch or server job configuration, where every key
+// is a flag name (except for the job "priority"). Returns "ok", or the reason
+// that the job cannot be run (see ValidateRunFlags()).
+std::string ApplyJobFlags(
+    const super_resolution::util::ConfigurationFileReader& job_config) {
+
+  for (const std::string& flag_name : job_config.GetKeys()) {
+    if (flag_name == "priority") {
+      continue;
+    }
+    if (flag_name == "batch_manifest" ||
+        flag_name == "batch_report_path" ||
+        flag_name == "serve_socket_path" ||
+        gflags::SetCommandLineOption(
+            flag_name.c_str(),
+            job_config.GetValue(flag_name).c_str()).empty()) {
+      return "invalid flag " + flag_name;
+    }
+  }
+  return ValidateRunFlags();
+}
+
+// Writes the report line of a finished batch job, and flushes it.
+void WriteBatchReportLine(
+    const int job_index,
+    const std::string& job_config_path,
+    const std::string& data_path,
+    const std::string& status,
+    const double seconds,
+    std::ofstream* report) {
+
+  if (report->is_open()) {
+    *report << job_index << "," << job_config_path << "," << data_path << ","
+            << status << "," << seconds << std::endl;
+  }
+}
+
+// Runs the batch jobs in a pipeline (see util/staged_pipeline.h) of four
+// stages that work on different jobs at the same time: loading the
+// observations (with --batch_num_load_threads threads), converting them into
+// the PCA space, solving and evaluating, and saving the result. Up to
+// --batch_pipeline_depth jobs wait in front of each stage, but at most
+// --batch_pipeline_depth + 1 jobs are in the pipeline at once (including the
+// ones being solved and saved), which bounds the memory to that many sets of
+// observations.
+//
+// The flags of every job are read before the pipeline starts, and the load
+// and PCA stages only use the options taken from them (see InputOptions). The
+// solve stage sets the flags of one job at a time, so it runs the jobs in
+// order, as RunBatch() does. Streamed jobs (--stream_band_block_size) are run
+// entirely by the solve stage. Returns the number of skipped jobs.
+int RunPipelinedBatch(
+    const std::vector<std::string>& job_config_paths, std::ofstream* report) {
+
+  // The settings of a job, taken from its flags.
+  struct BatchJobSettings {
+    std::string status = "missing config file";
+    super_resolution::util::ConfigurationFileReader config;
+    std::string data_path;
+    std::string result_path;
+    bool is_streamed = false;
+    InputOptions input_options;
+  };
+  const int num_jobs = job_config_paths.size();
+  std::vector<BatchJobSettings> jobs(num_jobs);
+  for (int job_index = 0; job_index < num_jobs; ++job_index) {
+    const gflags::FlagSaver flag_saver;
+    BatchJobSettings& job = jobs[job_index];
+    if (super_resolution::util::PathExists(job_config_paths[job_index]) &&
+        super_resolution::util::IsFile(job_config_paths[job_index])) {
+      job.config.ReadFromFile(job_config_paths[job_index]);
+      job.status = ApplyJobFlags(job.config);
+    }
+    job.data_path = FLAGS_data_path;
+    if (job.status != "ok") {
+      continue;
+    }
+    CheckRunFlags();
+    job.result_path = FLAGS_result_path;
+    job.is_streamed = FLAGS_stream_band_block_size > 0;
+    job.input_options = GetInputOptions();
+  }
+
+  // The state of a job as it passes through the stages.
+  struct BatchJobState {
+    std::chrono::steady_clock::time_point start_time;
+    RunInputs inputs;
+    ImageData result;
+  };
+  const auto is_prepared = [&jobs](const int job_index) {
+    return jobs[job_index].status == "ok" && !jobs[job_index].is_streamed;
+  };
+  int num_skipped_jobs = 0;
+  std::vector<super_resolution::util::PipelineStage<BatchJobState>> stages(4);
+  stages[0].name = "load";
+  stages[0].num_threads = FLAGS_batch_num_load_threads;
+  stages[0].function = [&](const int job_index, BatchJobState* state) {
+    state->start_time = std::chrono::steady_clock::now();
+    if (is_prepared(job_index)) {
+      LoadRunInputs(jobs[job_index].input_options, &state->inputs);
+    }
+  };
+  stages[1].name = "pca";
+  stages[1].function = [&](const int job_index, BatchJobState* state) {
+    if (is_prepared(job_index)) {
+      ConvertRunInputsToPCASpace(
+          jobs[job_index].input_options, &state->inputs);
+    }
+  };
+  stages[2].name = "solve";
+  stages[2].function = [&](const int job_index, BatchJobState* state) {
+    const BatchJobSettings& job = jobs[job_index];
+    if (job.status != "ok") {
+      LOG(ERROR) << "Skipping batch job " << (job_index + 1) << " ("
+                 << job_config_paths[job_index] << "): " << job.status
+                 << ".";
+      num_skipped_jobs++;
+      return;
+    }
+    const gflags::FlagSaver flag_saver;
+    ApplyJobFlags(job.config);
+    LOG(INFO) << "Running batch job " << (job_index + 1) << " of "
+              << num_jobs << " (" << job_config_paths[job_index] << ").";
+    if (job.is_streamed) {
+      RunSuperResolution();
+      return;
+    }
+    state->result = SuperResolveRunInputs(&state->inputs);
+    state->inputs = RunInputs();
+    WriteSolverTelemetry();
+  };
+  stages[3].name = "save";
+  stages[3].function = [&](const int job_index, BatchJobState* state) {
+    const BatchJobSettings& job = jobs[job_index];
+    if (is_prepared(job_index) && !job.result_path.empty()) {
+      super_resolution::util::SaveImage(state->result, job.result_path);
+    }
+    const std::chrono::duration<double> elapsed_time =
+        std::chrono::steady_clock::now() - state->start_time;
+    WriteBatchReportLine(
+        job_index,
+        job_config_paths[job_index],
+        job.data_path,
+        job.status,
+        elapsed_time.count(),
+        report);
+  };
+
+  super_resolution::util::StagedPipeline<BatchJobState> pipeline(
+      stages, FLAGS_batch_pipeline_depth, FLAGS_batch_pipeline_depth + 1);
+  pipeline.Run(num_jobs);
+  for (const super_resolution::util::PipelineStageStatistics& statistics :
+       pipeline.GetStageStatistics()) {
+    LOG(INFO) << "Batch stage " << statistics.name << ": "
+              << statistics.busy_seconds << " seconds busy on "
+              << statistics.num_threads << " thread(s).";
+  }
+  return num_skipped_jobs;
+}
+
+// Runs every job listed in the --batch_manifest file, in order, in this
+// process. Each line of the manifest is the path of a job configuration file
+// with one "flag_name value" pair per line, for example:
+//   data_path /data/scene_1/low_res
+//   result_path /data/scene_1/result.png
+//   upsampling_scale 3
+// Flags that are not set by a job keep their command line values, and all
+// flags are restored after each job. Jobs with the same image model
+// parameters share the image model (see GetImageModel()). With
+// --batch_pipeline_depth, the jobs are pipelined (see RunPipelinedBatch()).
+void RunBatch() {
+  std::ifstream manifest(FLAGS_batch_manifest);
+  CHECK(manifest.is_open())
+      << "Could not open batch manifest '" << FLAGS_batch_manifest << "'.";
+  std::vector<std::string> job_config_paths;
+  std::string line;
+  while (std::getline(manifest, line)) {
+    const std::string job_config_path =
+        super_resolution::util::TrimString(line);
+    if (!job_config_path.empty() && job_config_path.find("#") != 0) {
+      job_config_paths.push_back(job_config_path);
+    }
+  }
+  manifest.close();
+
+  // Every line of the report is flushed when its job finishes, so the report
+  // is complete up to the last finished job if the batch is interrupted.
+  std::ofstream report;
+  if (!FLAGS_batch_report_path.empty()) {
+    report.open(FLAGS_batch_report_path);
+    CHECK(report.is_open())
+        << "Could not open batch report '" << FLAGS_batch_report_path << "'.";
+    report << "job,config_path,data_path,status,seconds" << std::endl;
+  }
+
+  const int num_jobs = job_config_paths.size();
+  int num_skipped_jobs = 0;
+  if (FLAGS_batch_pipeline_depth > 0) {
+    num_skipped_jobs = RunPipelinedBatch(job_config_paths, &report);
+  } else {
+    for (int job_index = 0; job_index < num_jobs; ++job_index) {
+      const std::string& job_config_path = job_config_paths[job_index];
+      const gflags::FlagSaver flag_saver;
+      std::string status = "missing config file";
+      if (super_resolution::util::PathExists(job_config_path) &&
+          super_resolution::util::IsFile(job_config_path)) {
+        super_resolution::util::ConfigurationFileReader job_config;
+        job_config.ReadFromFile(job_config_path);
+        status = ApplyJobFlags(job_config);
+      }
+
+      const auto start_time = std::chrono::steady_clock::now();
+      if (status == "ok") {
+        LOG(INFO) << "Running batch job " << (job_index + 1) << " of "
+                  << num_jobs << " (" << job_config_path << ").";
+        RunSuperResolution();
+      } else {
+        LOG(ERROR) << "Skipping batch job " << (job_index + 1) << " ("
+                   << job_config_path << "): " << status << ".";
+        num_skipped_jobs++;
+      }
+      const std::chrono::duration<double> elapsed_time =
+          std::chrono::steady_clock::now() - start_time;
+      WriteBatchReportLine(
+          job_index,
+          job_config_path,
+          FLAGS_data_path,
+          status,
+          elapsed_time.count(),
+          &report);
+    }
+  }
+  LOG(INFO) << "Finished " << (num_jobs - num_skipped_jobs) << " of "
+            << num_jobs << " batch jobs.";
+}
+
+// Runs jobs received at the --serve_socket_path socket until a client sends
+// "shutdown" (see util/job_server.h for the protocol). Jobs are set up like
+// batch jobs, so the image models are kept between them, and they are run one
+// at a time in the order of their priority.
+void RunServer() {
+  super_resolution::util::JobServer job_server(FLAGS_serve_socket_path);
+  LOG(INFO) << "Waiting for jobs at " << FLAGS_serve_socket_path << ".";
+  super_resolution::util::ServerJob job;
+  while (job_server.GetNextJob(&job)) {
+    const gflags::FlagSaver flag_saver;
+    const std::string status = ApplyJobFlags(job.config);
+    if (status != "ok") {
+      LOG(ERROR) << "Rejecting job " << job.id << ": " << status << ".";
+      job_server.FinishJob(job, "error " + status);
+      continue;
+    }
+    LOG(INFO) << "Running job " << job.id << " (" << FLAGS_data_path << ").";
+    const auto start_time = std::chrono::steady_clock::now();
+    RunSuperResolution();
+    const std::chrono::duration<double> elapsed_time =
+        std::chrono::steady_clock::now() - start_time;
+    job_server.FinishJob(job, "ok " + std::to_string(elapsed_time.count()));
+  }
+}
+
+// Returns true if any of the sweep flags is set.
+bool IsSweepRequested() {
+  return !FLAGS_sweep_regularization_parameters.empty() ||
+         !FLAGS_sweep_btv_scale_ranges.empty() ||
+         !FLAGS_sweep_btv_spatial_decays.empty() ||
+         !FLAGS_sweep_solvers.empty();
+}
+
+// Returns the values of the comma-separated sweep flag, or the given default
+// value if the flag is empty. The default is converted exactly (unlike with
+// std::to_string(), which rounds to six decimals).
+template <typename T>
+std::vector<std::string> GetSweepValues(
+    const std::string& sweep_flag_value, const T& default_value) {
+
+  std::vector<std::string> values;
+  for (const std::string& value :
+       super_resolution::util::SplitString(sweep_flag_value, ',')) {
+    const std::string trimmed_value = super_resolution::util::TrimString(value);
+    if (!trimmed_value.empty()) {
+      values.push_back(trimmed_value);
+    }
+  }
+  if (values.empty()) {
+    std::ostringstream default_value_string;
+    default_value_string << std::setprecision(17) << default_value;
+    values.push_back(default_value_string.str());
+  }
+  return values;
+}
+
+// Solves every combination of the --sweep_* parameter values on the same
+// inputs, and reports the run time and the quality (if a ground truth is
+// given) of each. The images are loaded and the image model and the initial
+// estimate are created only once for the whole sweep.
+//
+// The sweep points that only differ in the regularization parameter form a
+// chain that is solved from the largest parameter to the smallest. With
+// --sweep_warm_start, each point starts from the result of the one before,
+// which is smoother and usually much closer to the solution than the initial
+// estimate. The chains are independent, so --num_sweep_workers of them are
+// solved concurrently and share the solver threads.
+void RunSweep() {
+  REQUIRE_ARG(FLAGS_data_path);
+  CHECK(FLAGS_stream_band_block_size <= 0 && !FLAGS_interpolate_color &&
+        !FLAGS_solve_in_pca_space)
+      << "Sweeps cannot be used with --stream_band_block_size, "
+      << "--interpolate_color or --solve_in_pca_space.";
+  if (FLAGS_solve_in_wavelet_domain || FLAGS_num_pyramid_levels > 1 ||
+      FLAGS_tile_size > 0 || !FLAGS_region_of_interest.empty()) {
+    LOG(WARNING) << "Sweep points are solved directly on the images. "
+                 << "Ignoring the wavelet, pyramid, tile and region of "
+                 << "interest flags.";
+  }
+  ResetSolverTelemetry();
+  quality_stop_reference = ImageData();
+
+  CheckRegularizerFlag();
+  const bool use_btv = (GetRegularizerName() == "btv");
+
+  // Build the grid of chains.
+  std::vector<double> regularization_parameters;
+  for (const std::string& value : GetSweepValues(
+           FLAGS_sweep_regularization_parameters,
+           FLAGS_regularization_parameter)) {
+    regularization_parameters.push_back(std::stod(value));
+  }
+  std::sort(
+      regularization_parameters.begin(),
+      regularization_parameters.end(),
+      std::greater<double>());
+  const std::vector<std::string> solvers =
+      GetSweepValues(FLAGS_sweep_solvers, FLAGS_solver);
+  std::vector<std::string> btv_scale_ranges = {"0"};
+  std::vector<std::string> btv_spatial_decays = {"0"};
+  if (use_btv) {
+    btv_scale_ranges = GetSweepValues(
+        FLAGS_sweep_btv_scale_ranges, FLAGS_btv_scale_range);
+    btv_spatial_decays = GetSweepValues(
+        FLAGS_sweep_btv_spatial_decays, FLAGS_btv_spatial_decay);
+  } else if (!FLAGS_sweep_btv_scale_ranges.empty() ||
+             !FLAGS_sweep_btv_spatial_decays.empty()) {
+    LOG(WARNING) << "The BTV parameters are only swept with the 'btv' "
+                 << "regularizer. Ignoring them.";
+  }
+  std::vector<SolveSettings> chain_settings;
+  for (const std::string& solver : solvers) {
+    for (const std::string& btv_scale_range : btv_scale_ranges) {
+      for (const std::string& btv_spatial_decay : btv_spatial_decays) {
+        SolveSettings settings;
+        settings.solver = solver;
+        if (use_btv) {
+          settings.btv_scale_range = std::stoi(btv_scale_range);
+          settings.btv_spatial_decay = std::stod(btv_spatial_decay);
+        }
+        chain_settings.push_back(settings);
+      }
+    }
+  }
+  const int num_chains = chain_settings.size();
+  const int num_chain_points = regularization_parameters.size();
+  const int num_workers = std::min(
+      super_resolution::util::GetNumThreadsToUse(FLAGS_num_sweep_workers),
+      num_chains);
+  const int num_threads_per_worker = std::max(
+      1,
+      super_resolution::util::GetNumThreadsToUse(FLAGS_num_threads) /
+          num_workers);
+  LOG(INFO) << "Sweeping " << (num_chains * num_chain_points)
+            << " parameter combinations with " << num_workers << " workers.";
+
+  // Load the inputs and create everything that all points share.
+  const super_resolution::ImageModelParameters model_parameters =
+      GetImageModelParameters();
+  const ImageModel& image_model = GetImageModel(model_parameters);
+  InputData input_data = LoadInputData(GetInputOptions());
+  const bool has_ground_truth = HasGroundTruth();
+  input_data.high_res_image.SetPrecision(super_resolution::DOUBLE_PRECISION);
+  if (FLAGS_quality_stop_interval > 0 && has_ground_truth) {
+    quality_stop_reference = input_data.high_res_image;
+  }
+  ImageData initial_estimate =
+      CreateInitialEstimate(model_parameters, input_data.low_res_images);
+  initial_estimate.SetPrecision(super_resolution::DOUBLE_PRECISION);
+  std::unique_ptr<super_resolution::ImageQualityEvaluator> quality_evaluator;
+  if (has_ground_truth) {
+    super_resolution::ImageQualityEvaluatorOptions quality_options;
+    quality_options.num_threads = num_threads_per_worker;
+    quality_evaluator.reset(new super_resolution::ImageQualityEvaluator(
+        input_data.high_res_image, quality_options));
+  }
+
+  // All points of all chains solve over the same observations, so they share
+  // a single copy of them and of the compiled image model.
+  const std::shared_ptr<const super_resolution::SharedSolverInputs>
+      shared_inputs =
+          std::make_shared<const super_resolution::SharedSolverInputs>(
+              input_data.low_res_images);
+
+  // Solve each chain from the largest regularization parameter down.
+  struct SweepPointResult {
+    double seconds = 0.0;
+    super_resolution::ImageQualityMetrics metrics;
+  };
+  std::vector<SweepPointResult> results(num_chains * num_chain_points);
+  const auto solve_chain = [&](const int chain) {
+    SolveSettings settings = chain_settings[chain];
+    settings.num_threads = num_threads_per_worker;
+    ImageData estimate = initial_estimate;
+    for (int point = 0; point < num_chain_points; ++point) {
+      settings.regularization_parameter = regularization_parameters[point];
+      // The chains are solved concurrently, so every point keeps its own
+      // checkpoints, and an interrupted sweep resumes each point.
+      if (!FLAGS_checkpoint_path.empty()) {
+        settings.checkpoint_path = FLAGS_checkpoint_path +
+            ".chain" + std::to_string(chain) +
+            ".point" + std::to_string(point);
+      }
+      const auto start_time = std::chrono::steady_clock::now();
+      ImageData result = SetupAndRunSolver(
+          image_model,
+          shared_inputs,
+          FLAGS_sweep_warm_start ? estimate : initial_estimate,
+          settings);
+      SweepPointResult& point_result =
+          results[chain * num_chain_points + point];
+      const std::chrono::duration<double> elapsed_time =
+          std::chrono::steady_clock::now() - start_time;
+      point_result.seconds = elapsed_time.count();
+      if (quality_evaluator != nullptr) {
+        point_result.metrics = quality_evaluator->Evaluate(result);
+      }
+      estimate = std::move(result);
+    }
+  };
+  if (num_workers > 1) {
+    super_resolution::util::ThreadPool thread_pool(num_workers - 1);
+    thread_pool.ParallelFor(num_chains, solve_chain);
+  } else {
+    for (int chain = 0; chain < num_chains; ++chain) {
+      solve_chain(chain);
+    }
+  }
+
+  // Report every point in grid order.
+  std::ofstream report;
+  if (!FLAGS_sweep_report_path.empty()) {
+    report.open(FLAGS_sweep_report_path);
+    CHECK(report.is_open())
+        << "Could not open sweep report '" << FLAGS_sweep_report_path << "'.";
+    report << "solver,btv_scale_range,btv_spatial_decay,"
+           << "regularization_parameter,warm_start,seconds,psnr,ssim"
+           << std::endl;
+  }
+  const auto describe_point = [&](const int chain, const int point) {
+    const SolveSettings& settings = chain_settings[chain];
+    std::ostringstream description;
+    description << "solver=" << settings.solver;
+    if (use_btv) {
+      description << " btv_scale_range=" << settings.btv_scale_range
+                  << " btv_spatial_decay=" << settings.btv_spatial_decay;
+    }
+    description << " regularization_parameter="
+                << regularization_parameters[point];
+    return description.str();
+  };
+  int best_index = -1;
+  for (int chain = 0; chain < num_chains; ++chain) {
+    const SolveSettings& settings = chain_settings[chain];
+    for (int point = 0; point < num_chain_points; ++point) {
+      const int index = chain * num_chain_points + point;
+      const SweepPointResult& point_result = results[index];
+      const bool is_warm_started = FLAGS_sweep_warm_start && point > 0;
+      std::ostringstream summary;
+      summary << describe_point(chain, point)
+              << (is_warm_started ? " (warm start)" : "")
+              << ": " << point_result.seconds << " seconds";
+      if (has_ground_truth) {
+        summary << ", PSNR " << point_result.metrics.peak_signal_to_noise_ratio
+                << ", SSIM " << point_result.metrics.structural_similarity;
+        if (best_index < 0 ||
+            point_result.metrics.peak_signal_to_noise_ratio >
+                results[best_index].metrics.peak_signal_to_noise_ratio) {
+          best_index = index;
+        }
+      }
+      std::cout << summary.str() << std::endl;
+      if (report.is_open()) {
+        report << settings.solver << ",";
+        if (use_btv) {
+          report << settings.btv_scale_range << ","
+                 << settings.btv_spatial_decay << ",";
+        } else {
+          report << ",,";
+        }
+        report << regularization_parameters[point] << ","
+               << (is_warm_started ? 1 : 0) << ","
+               << point_result.seconds << ",";
+        if (has_ground_truth) {
+          report << point_result.metrics.peak_signal_to_noise_ratio << ","
+                 << point_result.metrics.structural_similarity;
+        } else {
+          report << ",";
+        }
+        report << std::endl;
+      }
+    }
+  }
+  if (best_index >= 0) {
+    std::cout << "Best PSNR with "
+              << describe_point(
+                     best_index / num_chain_points,
+                     best_index % num_chain_points)
+              << std::endl;
+  }
+  WriteSolverTelemetry();
+}
+
+int main(int argc, char** argv) {
+  super_resolution::util::InitApp(argc, argv, "Super resolution.");
+  ImageData::SetNumThreads(FLAGS_num_threads);
+
+  if (!FLAGS_serve_socket_path.empty()) {
+    RunServer();
+  } else if (!FLAGS_batch_manifest.empty()) {
+    RunBatch();
+  } else if (IsSweepRequested()) {
+    RunSweep();
+  } else {
+    RunSuperResolution();
+  }
+  PrintProfile();
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,224 @@
+#include "util/aligned_allocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "util/memory_accounting.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+// The size of a (2 MB) huge page. Huge page buffers are aligned to it and
+// their mappings are rounded up to it.
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+// How a buffer was allocated, stored in the userdata of its cv::UMatData so
+// that it is freed the same way.
+enum AllocationKind {
+  ALLOCATION_USER_DATA,
+  ALLOCATION_ALIGNED,
+  ALLOCATION_HUGE_PAGE_MAPPING
+};
+
+// The userdata holds the allocation kind in its low byte and the memory tag
+// that the buffer is recorded under above it.
+constexpr int kMemoryTagShift = 8;
+
+void* EncodeUserData(const AllocationKind kind, const MemoryTag tag) {
+  return reinterpret_cast<void*>(
+      static_cast<intptr_t>(kind) |
+      (static_cast<intptr_t>(tag) << kMemoryTagShift));
+}
+
+AllocationKind GetAllocationKind(const void* userdata) {
+  return static_cast<AllocationKind>(
+      reinterpret_cast<intptr_t>(userdata) & ((1 << kMemoryTagShift) - 1));
+}
+
+MemoryTag GetAllocationMemoryTag(const void* userdata) {
+  return static_cast<MemoryTag>(
+      reinterpret_cast<intptr_t>(userdata) >> kMemoryTagShift);
+}
+
+// Returns the size rounded up to a whole number of huge pages.
+size_t RoundUpToHugePages(const size_t size) {
+  return (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+}
+
+// Returns a buffer of the given size aligned to the given power of two, which
+// must be freed with std::free().
+void* AllocateAligned(const size_t alignment, const size_t size) {
+  void* buffer = nullptr;
+  CHECK_EQ(posix_memalign(&buffer, alignment, size), 0)
+      << "Could not allocate " << size << " bytes.";
+  return buffer;
+}
+
+}  // namespace
+
+bool ParseHugePageMode(const std::string& name, HugePageMode* huge_page_mode) {
+  CHECK_NOTNULL(huge_page_mode);
+  if (name == "none") {
+    *huge_page_mode = HUGE_PAGES_NONE;
+  } else if (name == "transparent") {
+    *huge_page_mode = HUGE_PAGES_TRANSPARENT;
+  } else if (name == "explicit") {
+    *huge_page_mode = HUGE_PAGES_EXPLICIT;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+constexpr size_t AlignedMatAllocator::kAlignment;
+
+AlignedMatAllocator::AlignedMatAllocator(
+    const AlignedMatAllocatorOptions& options) : options_(options) {
+
+#ifndef __linux__
+  if (options_.huge_page_mode != HUGE_PAGES_NONE) {
+    LOG(WARNING) << "Huge pages are only supported on Linux.";
+  }
+#endif
+}
+
+cv::UMatData* AlignedMatAllocator::allocate(
+    int dims,
+    const int* sizes,
+    int type,
+    void* data,
+    size_t* step,
+#if CV_VERSION_MAJOR >= 4
+    cv::AccessFlag flags,
+#else
+    int flags,
+#endif
+    cv::UMatUsageFlags usage_flags) const {
+
+  // The steps are computed as by OpenCV's standard allocator: dense rows,
+  // unless user data with explicit steps is wrapped.
+  size_t total_size = CV_ELEM_SIZE(type);
+  for (int i = dims - 1; i >= 0; --i) {
+    if (step != nullptr) {
+      if (data != nullptr && step[i] != CV_AUTOSTEP) {
+        CV_Assert(total_size <= step[i]);
+        total_size = step[i];
+      } else {
+        step[i] = total_size;
+      }
+    }
+    total_size *= sizes[i];
+  }
+
+  cv::UMatData* mat_data = new cv::UMatData(this);
+  mat_data->size = total_size;
+  AllocationKind kind = ALLOCATION_ALIGNED;
+  void* buffer = data;
+  if (data != nullptr) {
+    kind = ALLOCATION_USER_DATA;
+    mat_data->flags |= cv::UMatData::USER_ALLOCATED;
+  } else if (options_.huge_page_mode == HUGE_PAGES_NONE ||
+             static_cast<int64_t>(total_size) <
+             options_.huge_page_threshold_bytes) {
+    buffer = AllocateAligned(kAlignment, total_size);
+  } else {
+#ifdef __linux__
+    if (options_.huge_page_mode == HUGE_PAGES_EXPLICIT) {
+      void* mapping = mmap(
+          nullptr,
+          RoundUpToHugePages(total_size),
+          PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+          -1,
+          0);
+      if (mapping != MAP_FAILED) {
+        buffer = mapping;
+        kind = ALLOCATION_HUGE_PAGE_MAPPING;
+      } else {
+        LOG_FIRST_N(WARNING, 1)
+            << "Could not map explicit huge pages (is the huge page pool "
+            << "reserved?). Using transparent huge pages instead.";
+      }
+    }
+    if (buffer == nullptr) {
+      // Transparent huge pages can only back whole, aligned huge pages.
+      buffer = AllocateAligned(kHugePageSize, total_size);
+      madvise(buffer, RoundUpToHugePages(total_size), MADV_HUGEPAGE);
+    }
+#else
+    buffer = AllocateAligned(kAlignment, total_size);
+#endif
+  }
+  mat_data->data = mat_data->origdata = static_cast<uchar*>(buffer);
+
+  // Buffers are recorded under the tag of the allocating thread, and released
+  // under the same tag even if another thread frees them.
+  const MemoryTag memory_tag = GetCurrentMemoryTag();
+  if (kind != ALLOCATION_USER_DATA) {
+    AddMemoryUsage(memory_tag, total_size);
+  }
+  mat_data->userdata = EncodeUserData(kind, memory_tag);
+  return mat_data;
+}
+
+bool AlignedMatAllocator::allocate(
+    cv::UMatData* data,
+#if CV_VERSION_MAJOR >= 4
+    cv::AccessFlag access_flags,
+#else
+    int access_flags,
+#endif
+    cv::UMatUsageFlags usage_flags) const {
+
+  // Host memory is always accessible.
+  return data != nullptr;
+}
+
+void AlignedMatAllocator::deallocate(cv::UMatData* data) const {
+  if (data == nullptr) {
+    return;
+  }
+  CV_Assert(data->urefcount == 0);
+  CV_Assert(data->refcount == 0);
+  const AllocationKind kind = GetAllocationKind(data->userdata);
+  if (kind != ALLOCATION_USER_DATA) {
+    AddMemoryUsage(
+        GetAllocationMemoryTag(data->userdata),
+        -static_cast<int64_t>(data->size));
+  }
+  switch (kind) {
+    case ALLOCATION_ALIGNED:
+      std::free(data->origdata);
+      break;
+    case ALLOCATION_HUGE_PAGE_MAPPING:
+#ifdef __linux__
+      munmap(data->origdata, RoundUpToHugePages(data->size));
+#endif
+      break;
+    case ALLOCATION_USER_DATA:
+    default:
+      break;
+  }
+  data->origdata = nullptr;
+  delete data;
+}
+
+void SetDefaultMatAllocator(const AlignedMatAllocatorOptions& options) {
+  // Matrices allocated by a previous allocator keep using it, so it is not
+  // destroyed either.
+  cv::Mat::setDefaultAllocator(new AlignedMatAllocator(options));
+}
+
+}  // namespace util
+}  // namespace super_resolution
@@ -0,0 +1,98 @@
+// An OpenCV matrix allocator for the large planar image buffers. Every buffer
+// is aligned to 64 bytes (a cache line, and the width of AVX-512 vectors), and
+// buffers above a size threshold can be backed by huge pages, which cuts the
+// TLB misses of sweeping over large hyperspectral images.
+//
+// The allocator is installed as the default allocator of all cv::Mat objects
+// with SetDefaultMatAllocator(), so ImageData and every other image buffer of
+// the library use it without further changes. It also records every buffer
+// in the memory accounting (see memory_accounting.h), under the memory tag of
+// the thread that allocates it. Use as follows:
+//   AlignedMatAllocatorOptions options;
+//   options.huge_page_mode = HUGE_PAGES_TRANSPARENT;
+//   SetDefaultMatAllocator(options);
+
+#ifndef SRC_UTIL_ALIGNED_ALLOCATOR_H_
+#define SRC_UTIL_ALIGNED_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+namespace util {
+
+// How large buffers are backed by huge pages.
+enum HugePageMode {
+  // Ordinary pages only.
+  HUGE_PAGES_NONE,
+
+  // Buffers are aligned to the huge page size and the kernel is advised to
+  // back them with transparent huge pages (Linux only).
+  HUGE_PAGES_TRANSPARENT,
+
+  // Buffers are mapped from the reserved huge page pool (hugetlbfs, Linux
+  // only). If the pool is exhausted, transparent huge pages are used instead.
+  HUGE_PAGES_EXPLICIT
+};
+
+// Converts huge page mode names ("none", "transparent" and "explicit") to the
+// mode. Returns false if the name is unknown.
+bool ParseHugePageMode(const std::string& name, HugePageMode* huge_page_mode);
+
+struct AlignedMatAllocatorOptions {
+  HugePageMode huge_page_mode = HUGE_PAGES_NONE;
+
+  // Only buffers of at least this many bytes are backed by huge pages, since
+  // smaller buffers would waste most of a huge page.
+  int64_t huge_page_threshold_bytes = 4 * 1024 * 1024;
+};
+
+class AlignedMatAllocator : public cv::MatAllocator {
+ public:
+  // The alignment of every buffer in bytes.
+  static constexpr size_t kAlignment = 64;
+
+  explicit AlignedMatAllocator(const AlignedMatAllocatorOptions& options);
+
+  // Implementation of cv::MatAllocator. Matrices that wrap user data do not
+  // allocate anything.
+  virtual cv::UMatData* allocate(
+      int dims,
+      const int* sizes,
+      int type,
+      void* data,
+      size_t* step,
+#if CV_VERSION_MAJOR >= 4
+      cv::AccessFlag flags,
+#else
+      int flags,
+#endif
+      cv::UMatUsageFlags usage_flags) const;
+
+  virtual bool allocate(
+      cv::UMatData* data,
+#if CV_VERSION_MAJOR >= 4
+      cv::AccessFlag access_flags,
+#else
+      int access_flags,
+#endif
+      cv::UMatUsageFlags usage_flags) const;
+
+  virtual void deallocate(cv::UMatData* data) const;
+
+ private:
+  const AlignedMatAllocatorOptions options_;
+};
+
+// Makes a new AlignedMatAllocator with the given options the default
+// allocator of all cv::Mat objects that are created afterwards. The allocator
+// is never destroyed, since matrices allocated by it may live until exit.
+void SetDefaultMatAllocator(const AlignedMatAllocatorOptions& options);
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_ALIGNED_ALLOCATOR_H_
@@ -0,0 +1,134 @@
+#include "util/autotuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "util/vector_kernels.h"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+// The number of timed runs of each candidate after the warm-up run. The
+// fastest run is used, which is the least affected by other load.
+constexpr int kNumTimedRuns = 3;
+
+}  // namespace
+
+Autotuner::Autotuner(const std::string& cache_path) : cache_path_(cache_path) {
+  if (cache_path_.empty()) {
+    return;
+  }
+  std::ifstream file(cache_path_);
+  if (!file.is_open()) {
+    return;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream line_stream(line);
+    int choice;
+    std::string key;
+    if (!(line_stream >> choice) || choice < 0) {
+      continue;
+    }
+    line_stream.ignore(1);
+    std::getline(line_stream, key);
+    if (!key.empty()) {
+      choices_[key] = choice;
+    }
+  }
+  LOG(INFO) << "Loaded " << choices_.size() << " tuned choices from '"
+            << cache_path_ << "'.";
+}
+
+int Autotuner::SelectFastest(
+    const std::string& key,
+    const int num_candidates,
+    const std::function<void(const int)>& run_candidate) {
+
+  CHECK_GT(num_candidates, 0) << "There must be at least one candidate.";
+
+  int choice;
+  if (GetCachedChoice(key, &choice) && choice < num_candidates) {
+    return choice;
+  }
+
+  choice = 0;
+  double fastest_seconds = std::numeric_limits<double>::max();
+  for (int candidate = 0; candidate < num_candidates; ++candidate) {
+    run_candidate(candidate);
+    double candidate_seconds = std::numeric_limits<double>::max();
+    for (int run = 0; run < kNumTimedRuns; ++run) {
+      const auto start_time = std::chrono::steady_clock::now();
+      run_candidate(candidate);
+      const std::chrono::duration<double> run_time =
+          std::chrono::steady_clock::now() - start_time;
+      candidate_seconds = std::min(candidate_seconds, run_time.count());
+    }
+    LOG(INFO) << "Tuning '" << key << "': candidate " << candidate
+              << " took " << candidate_seconds << " seconds.";
+    if (candidate_seconds < fastest_seconds) {
+      fastest_seconds = candidate_seconds;
+      choice = candidate;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  choices_[GetHostKey(key)] = choice;
+  if (!cache_path_.empty() && !SaveCache()) {
+    LOG(WARNING) << "Could not save the tuned choices to '" << cache_path_
+                 << "'.";
+  }
+  return choice;
+}
+
+bool Autotuner::GetCachedChoice(const std::string& key, int* choice) const {
+  CHECK_NOTNULL(choice);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto iterator = choices_.find(GetHostKey(key));
+  if (iterator == choices_.end()) {
+    return false;
+  }
+  *choice = iterator->second;
+  return true;
+}
+
+std::string Autotuner::GetHostKey(const std::string& key) const {
+  std::ostringstream host_key;
+  host_key << key
+           << " threads=" << std::thread::hardware_concurrency()
+           << " simd=" << GetSimdLevelName(GetSimdLevel());
+  return host_key.str();
+}
+
+bool Autotuner::SaveCache() const {
+  // The choices are written to a temporary file first, so an interrupted run
+  // never leaves a partial cache behind.
+  const std::string temporary_file_path = cache_path_ + ".tmp";
+  std::ofstream file(temporary_file_path, std::ios::trunc);
+  if (!file.is_open()) {
+    return false;
+  }
+  for (const auto& key_and_choice : choices_) {
+    file << key_and_choice.second << " " << key_and_choice.first << "\n";
+  }
+  file.close();
+  if (file.fail()) {
+    return false;
+  }
+  return std::rename(temporary_file_path.c_str(), cache_path_.c_str()) == 0;
+}
+
+}  // namespace util
+}  // namespace super_resolution
@@ -0,0 +1,57 @@
+// Picks the fastest of several equivalent configurations of a kernel (e.g.
+// spatial or Fourier blur, or the number of data term threads) by timing each
+// of them on the actual problem. The choice depends on the problem size and on
+// the host, so it is remembered for each problem key and can be persisted in
+// a small cache file, from which later runs take it without timing again.
+//
+// The cache file has one "<choice> <key>" line per tuned problem. Keys are
+// extended with the number of hardware threads and the SIMD level, so a cache
+// shared between different hosts does not mix up their choices.
+
+#ifndef SRC_UTIL_AUTOTUNER_H_
+#define SRC_UTIL_AUTOTUNER_H_
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace super_resolution {
+namespace util {
+
+class Autotuner {
+ public:
+  // Loads the choices cached in the given file, if it exists. New choices are
+  // saved back to it. If the path is empty, nothing is persisted.
+  explicit Autotuner(const std::string& cache_path);
+
+  // Returns the index of the fastest of num_candidates candidates for the
+  // problem described by the key. If the choice is not cached, each candidate
+  // is run with run_candidate(index) once to warm up and then timed over a
+  // few more runs, keeping the fastest time of each.
+  int SelectFastest(
+      const std::string& key,
+      const int num_candidates,
+      const std::function<void(const int)>& run_candidate);
+
+  // Returns true and sets the choice if the key is cached.
+  bool GetCachedChoice(const std::string& key, int* choice) const;
+
+ private:
+  // Returns the key extended with the host description.
+  std::string GetHostKey(const std::string& key) const;
+
+  // Writes all choices to the cache file. Returns false on failure.
+  bool SaveCache() const;
+
+  const std::string cache_path_;
+
+  // The choice of every host key, protected by mutex_.
+  std::map<std::string, int> choices_;
+  mutable std::mutex mutex_;
+};
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_AUTOTUNER_H_
@@ -1,6 +1,9 @@
 #include "util/config_reader.h"
 
+#include <algorithm>
 #include <fstream>
+#include <istream>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -17,9 +20,18 @@ void ConfigurationFileReader::ReadFromFile(const std::string& file_path) {
   std::ifstream fin(file_path);
   CHECK(fin.is_open())
       << "Could not open file '" << file_path << "' for reading.";
+  ReadFromStream(&fin);
+  fin.close();
+}
+
+void ConfigurationFileReader::ReadFromString(const std::string& text) {
+  std::istringstream stream(text);
+  ReadFromStream(&stream);
+}
 
+void ConfigurationFileReader::ReadFromStream(std::istream* stream) {
   std::string line;
-  while (std::getline(fin, line)) {
+  while (std::getline(*stream, line)) {
     if (line.find("#") == 0) {  // If string starts with a "#" it's a comment.
       continue;
     }
@@ -32,7 +44,6 @@ void ConfigurationFileReader::ReadFromFile(const std::string& file_path) {
     const std::string value = TrimString(parts[1]);
     config_map_[key] = value;
   }
-  fin.close();
 }
 
 bool ConfigurationFileReader::HasValue(const std::string& key) const {
@@ -65,5 +76,15 @@ std::string ConfigurationFileReader::GetValueOrDie(
   return GetValue(key);
 }
 
+std::vector<std::string> ConfigurationFileReader::GetKeys() const {
+  std::vector<std::string> keys;
+  keys.reserve(config_map_.size());
+  for (const auto& key_and_value : config_map_) {
+    keys.push_back(key_and_value.first);
+  }
+  std::sort(keys.begin(), keys.end());
+  return keys;
+}
+
 }  // namespace util
 }  // namespace super_resolution
@@ -4,8 +4,10 @@
 #ifndef SRC_UTIL_CONFIG_READER_H_
 #define SRC_UTIL_CONFIG_READER_H_
 
+#include <istream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace super_resolution {
 namespace util {
@@ -19,6 +21,10 @@ class ConfigurationFileReader {
   // the delimiter (use SetDelimiter() to change this).
   void ReadFromFile(const std::string& file_path);
 
+  // Reads the configuration data from the given text, in the same format as
+  // ReadFromFile().
+  void ReadFromString(const std::string& text);
+
   // Set the delimiter for file reading or writing. This delimiter will
   // determine how key-value pairs are separated on each line of the data. If
   // the file is being written, this is the delimiter that will be used to
@@ -49,7 +55,13 @@ class ConfigurationFileReader {
   // value, this will result in a fatal error, and the program will terminate.
   std::string GetValueOrDie(const std::string& key) const;
 
+  // Returns all keys that have a value, in sorted order.
+  std::vector<std::string> GetKeys() const;
+
  private:
+  // Reads all key-value pairs from the given stream.
+  void ReadFromStream(std::istream* stream);
+
   // The delimiter used to separate keys and values in the file. Set this for
   // reading or writing the configuration files.
   char key_value_delimiter_ = ' ';
@@ -10,8 +10,14 @@
 #include <unordered_set>
 #include <vector>
 
+#include "hyperspectral/chunked_hsi_file.h"
 #include "hyperspectral/hyperspectral_data_loader.h"
 #include "image/image_data.h"
+#include "image/image_data_file.h"
+#include "util/memory_accounting.h"
+#include "util/prefetch_queue.h"
+#include "util/profiler.h"
+#include "util/thread_pool.h"
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
@@ -43,6 +49,11 @@ bool DoesSetContain(
 
 }  // namespace
 
+bool PathExists(const std::string& path) {
+  struct stat path_stat;
+  return stat(path.c_str(), &path_stat) == 0;
+}
+
 bool IsDirectory(const std::string& path) {
   struct stat path_stat;
   CHECK(stat(path.c_str(), &path_stat) == 0)
@@ -72,8 +83,8 @@ bool IsSupportedImageExtension(const std::string& extension) {
   return DoesSetContain(kSupportedImageExtensions, extension);
 }
 
-std::vector<ImageData> LoadImages(const std::string& data_path) {
-  std::vector<ImageData> images;
+std::vector<std::string> GetFilePaths(const std::string& data_path) {
+  std::vector<std::string> file_paths;
   if (IsDirectory(data_path)) {
     DIR* dir;
     struct dirent* ent;
@@ -82,32 +93,85 @@ std::vector<ImageData> LoadImages(const std::string& data_path) {
         const std::string file_name(ent->d_name);
         const std::string file_path = data_path + "/" + file_name;
         if (IsFile(file_path)) {
-          images.push_back(LoadImage(file_path));
+          file_paths.push_back(file_path);
         }
       }
       closedir(dir);
     }
   } else {
-    images.push_back(LoadImage(data_path));
+    file_paths.push_back(data_path);
+  }
+  return file_paths;
+}
+
+std::vector<ImageData> LoadImages(
+    const std::string& data_path,
+    const int num_threads,
+    const MemoryTag memory_tag) {
+
+  const std::vector<std::string> file_paths = GetFilePaths(data_path);
+  const int num_files = file_paths.size();
+  std::vector<ImageData> images;
+  images.reserve(num_files);
+  if (num_threads == 1 || num_files < 2) {
+    for (const std::string& file_path : file_paths) {
+      images.push_back(LoadImage(file_path, num_threads, memory_tag));
+    }
+    return images;
+  }
+
+  // Every file is loaded and decoded independently, so all loader threads can
+  // work at once. Each of them reads its file with its share of the threads.
+  const int num_loader_threads =
+      std::min(GetNumThreadsToUse(num_threads), num_files);
+  const int num_file_threads = std::max(
+      GetNumThreadsToUse(num_threads) / num_loader_threads, 1);
+  PrefetchQueue<ImageData> image_queue(
+      num_files,
+      [&file_paths, num_file_threads, memory_tag](const int file_index) {
+        return LoadImage(
+            file_paths[file_index], num_file_threads, memory_tag);
+      },
+      num_loader_threads,
+      num_loader_threads);
+  while (image_queue.HasNext()) {
+    images.push_back(image_queue.GetNext());
   }
   return images;
 }
 
-ImageData LoadImage(const std::string& file_path) {
+ImageData LoadImage(
+    const std::string& file_path,
+    const int num_threads,
+    const MemoryTag memory_tag) {
+
+  PROFILE_SCOPE("util::LoadImage");
+  const ScopedMemoryTag scoped_memory_tag(memory_tag);
   CHECK(IsFile(file_path))
       << "The given path '" << file_path << "' is not a file.";
   std::string extension = file_path.substr(file_path.find_last_of(".") + 1);
   std::transform(
       extension.begin(), extension.end(), extension.begin(), tolower);
+  // Image data files are mapped without decoding them.
+  if (extension == kImageDataFileExtension) {
+    return LoadImageDataFile(file_path);
+  }
   // If the extension is a standard image type, try reading it.
   if (IsSupportedImageExtension(extension)) {
-    const cv::Mat image = cv::imread(file_path, cv::IMREAD_UNCHANGED);
+    // The decoded image is only a temporary of the loader, since the image
+    // data copies it.
+    cv::Mat image;
+    {
+      const ScopedMemoryTag decode_memory_tag(MEMORY_TAG_LOADERS);
+      image = cv::imread(file_path, cv::IMREAD_UNCHANGED);
+    }
     CHECK(!image.empty()) << "Could not load image '" << file_path << "'.";
     return ImageData(image);
   } else {
     // Otherwise, try loading it as a hyperspectral image (assuming the given
     // path was a configuration file).
     HyperspectralDataLoader hs_data_loader(file_path);
+    hs_data_loader.SetNumThreads(num_threads);
     hs_data_loader.LoadImageFromENVIFile();
     return hs_data_loader.GetImage();
   }
@@ -115,7 +179,17 @@ ImageData LoadImage(const std::string& file_path) {
 
 void SaveImage(const ImageData& image, const std::string& data_path) {
   const int num_channels = image.GetNumChannels();
-  if (num_channels == 1 || num_channels == 3) {
+  std::string extension = data_path.substr(data_path.find_last_of(".") + 1);
+  std::transform(
+      extension.begin(), extension.end(), extension.begin(), tolower);
+  if (extension == kImageDataFileExtension && num_channels > 0) {
+    // Image data files store any image without loss of precision.
+    SaveImageDataFile(image, data_path);
+  } else if (extension == kChunkedHSIFileExtension && num_channels > 0) {
+    // Chunked files are written by the hyperspectral data loader.
+    const HyperspectralDataLoader hs_data_loader(data_path);
+    hs_data_loader.SaveImage(image, HSIBinaryDataFormat());
+  } else if (num_channels == 1 || num_channels == 3) {
     // Monochrome or RGB images are put back together and saved with OpenCV.
     cv::imwrite(data_path, image.GetVisualizationImage());
   } else if (num_channels > 0) {
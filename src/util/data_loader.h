@@ -8,10 +8,14 @@
 #include <vector>
 
 #include "image/image_data.h"
+#include "util/memory_accounting.h"
 
 namespace super_resolution {
 namespace util {
 
+// Returns true if the given path exists (as any kind of file or directory).
+bool PathExists(const std::string& path);
+
 // Returns true if the given path is a directory, and false otherwise. If the
 // given path is not valid or cannot be accessed, this will cause an error.
 bool IsDirectory(const std::string& path);
@@ -29,6 +33,12 @@ bool IsFile(const std::string& path, const bool include_hidden_files = false);
 // that can be read or written with OpenCV.
 bool IsSupportedImageExtension(const std::string& extension);
 
+// Returns the paths of all (non-hidden) files in the given directory, in the
+// order that they are listed by the file system. If data_path is a file, the
+// returned list contains only data_path itself. This is the order in which
+// LoadImages() loads images.
+std::vector<std::string> GetFilePaths(const std::string& data_path);
+
 // Returns a list of images loaded from the given data_path. If the data_path
 // points to a directory, the list will contain images loaded from all files in
 // that directory. If it is the name of a file, the returned list will contain
@@ -38,19 +48,39 @@ bool IsSupportedImageExtension(const std::string& extension);
 // multiple image files. The file(s) can be one of the following formats:
 //   - Standard image file (.jpg, .png, etc.)
 //   - TODO: Standard video file (.avi, .mpg, etc.)
+//   - Image data files (.srimg, see image/image_data_file.h), which are
+//     memory mapped instead of copied.
 //   - Hyperspectral data in text format.
 //   - TODO: Binary hyperspectral data files.
 // Unsupported or invalid files or directories will result in an error.
-std::vector<ImageData> LoadImages(const std::string& data_path);
+//
+// The files are loaded and decoded on num_threads threads at once (0 = one per
+// hardware thread), which hides the file I/O latency when there are many
+// files. The threads are split between the files that are loaded at once, so
+// a single large hyperspectral file is read with all of them. The images are
+// always returned in the order of GetFilePaths().
+//
+// The memory of the images is recorded under the given tag (see
+// util/memory_accounting.h), e.g. MEMORY_TAG_OBSERVATIONS for the LR images
+// that the solver keeps for the whole run.
+std::vector<ImageData> LoadImages(
+    const std::string& data_path,
+    const int num_threads = 1,
+    const MemoryTag memory_tag = MEMORY_TAG_LOADERS);
 
 // A shortcut for LoadImages if only a single image is needed.
-ImageData LoadImage(const std::string& data_path);
+ImageData LoadImage(
+    const std::string& data_path,
+    const int num_threads = 1,
+    const MemoryTag memory_tag = MEMORY_TAG_LOADERS);
 
-// Saves the given image to a file at the given path. If the image has one or
+// Saves the given image to a file at the given path. If the path has the
+// image data file extension (.srimg), the image is saved losslessly in that
+// format with any number of channels. Otherwise, if the image has one or
 // three channels (monochrome or RGB, respectively), it will be saved as an
-// OpenCV image. Otherwise, it will be saved as a hyperspectral image. The user
-// provides the extension which defines the type of image that is saved (e.g.
-// JPEG or PNG).
+// OpenCV image, and if not, it will be saved as a hyperspectral image. The
+// user provides the extension which defines the type of image that is saved
+// (e.g. JPEG or PNG).
 void SaveImage(const ImageData& image, const std::string& data_path);
 
 }  // namespace util
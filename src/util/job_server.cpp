@@ -0,0 +1,269 @@
+#include "util/job_server.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/config_reader.h"
+#include "util/string_util.h"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+// Requests larger than this are rejected. Jobs are only a few flags, so this
+// just protects the server from clients that never stop writing.
+constexpr int kMaxRequestSize = 64 * 1024;
+
+// How long the server waits for the whole request after a client connects,
+// and how often it checks for expired requests and whether it was stopped.
+// Requests are read from all connections at the same time, so a slow client
+// does not hold up the others.
+constexpr int kReadTimeoutSeconds = 5;
+constexpr int kPollIntervalMilliseconds = 100;
+
+// Writes the line to the connection, ignoring clients that disconnected.
+void SendLine(const int connection, const std::string& line) {
+  const std::string message = line + "\n";
+#ifdef MSG_NOSIGNAL
+  const int send_flags = MSG_NOSIGNAL;
+#else
+  const int send_flags = 0;
+#endif
+  size_t num_sent = 0;
+  while (num_sent < message.size()) {
+    const ssize_t result = send(
+        connection,
+        message.data() + num_sent,
+        message.size() - num_sent,
+        send_flags);
+    if (result <= 0) {
+      LOG(WARNING) << "Could not send the response to a job client.";
+      return;
+    }
+    num_sent += result;
+  }
+}
+
+// The state of a request after reading from its connection.
+enum RequestStatus {
+  REQUEST_INCOMPLETE,
+  REQUEST_COMPLETE,
+  REQUEST_FAILED
+};
+
+// Reads the data that is available on the (non-blocking) connection without
+// waiting for more. The request is complete once the client closes the
+// connection for writing or sends an empty line. It fails if the read fails or
+// the request gets too long.
+RequestStatus ReadAvailableRequest(
+    const int connection, std::string* request) {
+
+  char buffer[4096];
+  while (true) {
+    const ssize_t num_read = recv(connection, buffer, sizeof(buffer), 0);
+    if (num_read < 0) {
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ?
+          REQUEST_INCOMPLETE : REQUEST_FAILED;
+    }
+    if (num_read == 0) {
+      return REQUEST_COMPLETE;
+    }
+    request->append(buffer, num_read);
+    if (request->find("\n\n") != std::string::npos ||
+        request->find("\n\r\n") != std::string::npos ||
+        request->find_first_not_of("\r\n") == std::string::npos) {
+      return REQUEST_COMPLETE;
+    }
+    if (request->size() >= kMaxRequestSize) {
+      return REQUEST_FAILED;
+    }
+  }
+}
+
+// Switches the connection between blocking and non-blocking mode.
+void SetNonBlocking(const int connection, const bool non_blocking) {
+  const int flags = fcntl(connection, F_GETFL, 0);
+  fcntl(connection, F_SETFL,
+        non_blocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+}
+
+}  // namespace
+
+JobServer::JobServer(const std::string& socket_path)
+    : socket_path_(socket_path), is_stopped_(false) {
+
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  CHECK_LT(socket_path_.size(), sizeof(address.sun_path))
+      << "The socket path '" << socket_path_ << "' is too long.";
+  std::strncpy(
+      address.sun_path, socket_path_.c_str(), sizeof(address.sun_path) - 1);
+
+  listen_socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK_GE(listen_socket_, 0)
+      << "Could not create a socket: " << std::strerror(errno);
+  unlink(socket_path_.c_str());
+  CHECK_EQ(bind(listen_socket_,
+                reinterpret_cast<const sockaddr*>(&address),
+                sizeof(address)), 0)
+      << "Could not bind to '" << socket_path_ << "': "
+      << std::strerror(errno);
+  CHECK_EQ(listen(listen_socket_, SOMAXCONN), 0)
+      << "Could not listen at '" << socket_path_ << "': "
+      << std::strerror(errno);
+
+  server_thread_ = std::thread(&JobServer::AcceptConnections, this);
+}
+
+JobServer::~JobServer() {
+  Stop();
+  server_thread_.join();
+  close(listen_socket_);
+  unlink(socket_path_.c_str());
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (!jobs_.empty()) {
+    SendLine(jobs_.top().connection, "error server stopped");
+    close(jobs_.top().connection);
+    jobs_.pop();
+  }
+}
+
+bool JobServer::GetNextJob(ServerJob* job) {
+  CHECK_NOTNULL(job);
+  std::unique_lock<std::mutex> lock(mutex_);
+  job_available_.wait(lock, [this]() {
+    return !jobs_.empty() || is_stopped_;
+  });
+  if (jobs_.empty()) {
+    return false;
+  }
+  *job = jobs_.top();
+  jobs_.pop();
+  return true;
+}
+
+void JobServer::FinishJob(const ServerJob& job, const std::string& response) {
+  SendLine(job.connection, response);
+  close(job.connection);
+}
+
+void JobServer::Stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  is_stopped_ = true;
+  job_available_.notify_all();
+}
+
+int JobServer::GetNumQueuedJobs() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return jobs_.size();
+}
+
+void JobServer::AcceptConnections() {
+  // The connections whose requests are still being read, and the time by
+  // which each request must be complete.
+  struct PendingRequest {
+    std::string request;
+    std::chrono::steady_clock::time_point deadline;
+  };
+  std::map<int, PendingRequest> pending_requests;
+  std::vector<pollfd> polled_sockets;
+  while (!is_stopped_) {
+    polled_sockets.clear();
+    polled_sockets.push_back({listen_socket_, POLLIN, 0});
+    for (const auto& pending_request : pending_requests) {
+      polled_sockets.push_back({pending_request.first, POLLIN, 0});
+    }
+    if (poll(polled_sockets.data(), polled_sockets.size(),
+             kPollIntervalMilliseconds) < 0) {
+      continue;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    for (int i = 1; i < polled_sockets.size(); ++i) {
+      const int connection = polled_sockets[i].fd;
+      PendingRequest& pending_request = pending_requests[connection];
+      RequestStatus status = REQUEST_INCOMPLETE;
+      if (polled_sockets[i].revents != 0) {
+        status = ReadAvailableRequest(connection, &pending_request.request);
+      }
+      if (status == REQUEST_INCOMPLETE && now > pending_request.deadline) {
+        status = REQUEST_FAILED;
+      }
+      if (status == REQUEST_FAILED) {
+        SendLine(connection, "error could not read the job");
+        close(connection);
+      } else if (status == REQUEST_COMPLETE) {
+        SetNonBlocking(connection, false);
+        QueueJob(connection, pending_request.request);
+      }
+      if (status != REQUEST_INCOMPLETE) {
+        pending_requests.erase(connection);
+      }
+    }
+
+    if (polled_sockets[0].revents != 0) {
+      const int connection = accept(listen_socket_, nullptr, nullptr);
+      if (connection < 0) {
+        LOG(WARNING) << "Could not accept a connection: "
+                     << std::strerror(errno);
+        continue;
+      }
+      SetNonBlocking(connection, true);
+      pending_requests[connection].deadline =
+          now + std::chrono::seconds(kReadTimeoutSeconds);
+    }
+  }
+
+  for (const auto& pending_request : pending_requests) {
+    SendLine(pending_request.first, "error server stopped");
+    close(pending_request.first);
+  }
+}
+
+void JobServer::QueueJob(const int connection, const std::string& request) {
+  if (TrimString(request) == "shutdown") {
+    LOG(INFO) << "Job server is shutting down.";
+    SendLine(connection, "ok");
+    close(connection);
+    Stop();
+    return;
+  }
+
+  ServerJob job;
+  job.config.ReadFromString(request);
+  if (job.config.GetKeys().empty()) {
+    SendLine(connection, "error empty job");
+    close(connection);
+    return;
+  }
+  if (job.config.HasValue("priority")) {
+    job.priority = job.config.GetValueAsInt("priority");
+  }
+  job.connection = connection;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  job.id = next_job_id_++;
+  LOG(INFO) << "Queued job " << job.id << " with priority " << job.priority
+            << " (" << (jobs_.size() + 1) << " queued).";
+  jobs_.push(job);
+  job_available_.notify_one();
+}
+
+}  // namespace util
+}  // namespace super_resolution
@@ -0,0 +1,118 @@
+// The JobServer receives super-resolution jobs from a local (Unix domain)
+// socket for running the solver as a long-running service. Clients send a job
+// as text with one "key value" pair per line (as read by the
+// ConfigurationFileReader), ended by an empty line or by closing the
+// connection for writing. The "priority" key is an integer (default 0), and
+// jobs with a higher priority are handed out first. Jobs with the same
+// priority are handed out in the order they were received. When the job is
+// finished, the server answers with a single line and closes the connection,
+// e.g. "ok 1.25" or "error missing data_path". Sending "shutdown" instead of a
+// job stops the server once the jobs already queued are done.
+//
+// Jobs are run by the owner of the server, which keeps any caches between
+// them. Use as follows:
+//   JobServer job_server("/tmp/sr.sock");
+//   ServerJob job;
+//   while (job_server.GetNextJob(&job)) {
+//     ...
+//     job_server.FinishJob(job, "ok");
+//   }
+// and from a shell:
+//   printf 'data_path lr_images\nresult_path sr.png\n\n' | nc -U /tmp/sr.sock
+
+#ifndef SRC_UTIL_JOB_SERVER_H_
+#define SRC_UTIL_JOB_SERVER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/config_reader.h"
+
+namespace super_resolution {
+namespace util {
+
+struct ServerJob {
+  // The order in which the job was received, starting at 0.
+  int id = -1;
+
+  int priority = 0;
+
+  // All values sent with the job, including the priority.
+  ConfigurationFileReader config;
+
+  // The client connection that the response is sent to.
+  int connection = -1;
+};
+
+class JobServer {
+ public:
+  // Starts listening at the given socket path on a background thread. An
+  // existing socket file at the path is replaced. The server cannot start if
+  // the socket cannot be created, which is a fatal error.
+  explicit JobServer(const std::string& socket_path);
+
+  // Stops the server. Clients of jobs that were never handed out are sent an
+  // error. The socket file is removed.
+  ~JobServer();
+
+  JobServer(const JobServer&) = delete;
+  JobServer& operator = (const JobServer&) = delete;
+
+  // Waits for the next job and returns true, or returns false once the server
+  // is stopped and all queued jobs were handed out.
+  bool GetNextJob(ServerJob* job);
+
+  // Sends the response (a single line) to the client of the given job and
+  // closes its connection. Must be called exactly once for every job returned
+  // by GetNextJob().
+  void FinishJob(const ServerJob& job, const std::string& response);
+
+  // Stops accepting new jobs. Jobs that are already queued are still handed
+  // out by GetNextJob().
+  void Stop();
+
+  // Returns the number of received jobs that were not handed out yet.
+  int GetNumQueuedJobs() const;
+
+ private:
+  // Orders the queue by priority first and then by arrival.
+  struct CompareJobs {
+    bool operator() (const ServerJob& a, const ServerJob& b) const {
+      if (a.priority != b.priority) {
+        return a.priority < b.priority;
+      }
+      return a.id > b.id;
+    }
+  };
+
+  // Accepts connections, reads their requests concurrently, and queues their
+  // jobs until the server is stopped. Runs on the server thread.
+  void AcceptConnections();
+
+  // Queues the job of the given complete request. Closes the connection if it
+  // is not a valid job.
+  void QueueJob(const int connection, const std::string& request);
+
+  const std::string socket_path_;
+  int listen_socket_ = -1;
+
+  std::priority_queue<ServerJob, std::vector<ServerJob>, CompareJobs> jobs_;
+  int next_job_id_ = 0;
+  std::atomic<bool> is_stopped_;
+
+  // Protects the job queue and the job ids.
+  mutable std::mutex mutex_;
+  std::condition_variable job_available_;
+
+  std::thread server_thread_;
+};
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_JOB_SERVER_H_
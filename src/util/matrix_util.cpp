@@ -1,5 +1,7 @@
 #include "util/matrix_util.h"
 
+#include <cmath>
+
 #include "image/image_data.h"
 
 #include "opencv2/core/core.hpp"
@@ -8,12 +10,22 @@
 
 namespace super_resolution {
 namespace util {
+namespace {
+
+// Singular values smaller than this (relative to the largest one) are treated
+// as zero when checking if a kernel is separable.
+constexpr double kSeparableKernelTolerance = 1.0e-10;
+
+}  // namespace
 
 void ApplyConvolutionToImage(
     ImageData* image_data, const cv::Mat& kernel, const int border_mode) {
 
   CHECK_NOTNULL(image_data);
 
+  // The channels are views of one planar allocation, so the border is
+  // isolated from the neighboring channels.
+  const int filter_border = border_mode | cv::BORDER_ISOLATED;
   int num_image_channels = image_data->GetNumChannels();
   for (int i = 0; i < num_image_channels; ++i) {
     cv::Mat channel_image = image_data->GetChannelImage(i);
@@ -24,8 +36,34 @@ void ApplyConvolutionToImage(
         kernel,              // the convolution kernel
         cv::Point(-1, -1),   // anchor kernel at its center
         0,                   // addition to all values (none)
-        border_mode);        // border mode (e.g. reflect, pad zeros, etc.)
+        filter_border);      // border mode (e.g. reflect, pad zeros, etc.)
+  }
+}
+
+bool GetSeparableKernelFactors(
+    const cv::Mat& kernel, cv::Mat* kernel_column, cv::Mat* kernel_row) {
+
+  CHECK_NOTNULL(kernel_column);
+  CHECK_NOTNULL(kernel_row);
+
+  cv::Mat singular_values, left_vectors, right_vectors_transposed;
+  cv::SVD::compute(
+      kernel, singular_values, left_vectors, right_vectors_transposed);
+  const double largest_singular_value = singular_values.at<double>(0);
+  if (largest_singular_value <= 0.0) {
+    return false;
   }
+  for (int i = 1; i < singular_values.rows; ++i) {
+    if (singular_values.at<double>(i) >
+        kSeparableKernelTolerance * largest_singular_value) {
+      return false;
+    }
+  }
+
+  const double factor_scale = std::sqrt(largest_singular_value);
+  *kernel_column = left_vectors.col(0) * factor_scale;
+  *kernel_row = right_vectors_transposed.row(0) * factor_scale;
+  return true;
 }
 
 void ThresholdImage(
@@ -13,13 +13,25 @@ namespace util {
 // This is the OpenCV matrix format that every matrix should use.
 constexpr int kOpenCvMatrixType = CV_64FC1;
 
+// The OpenCV matrix format of ImageData channels stored in single precision
+// (see ImagePrecision in image_data.h).
+constexpr int kOpenCvSinglePrecisionMatrixType = CV_32FC1;
+
 // Applies a 2D convolution to the given ImageData. The convolution is applied
 // independently to all channels of the image. Specify border mode as needed.
+// The border of every channel is extrapolated from the channel alone, even
+// though the channels share one allocation.
 void ApplyConvolutionToImage(
     ImageData* image_data,
     const cv::Mat& kernel,
     const int border_mode = cv::BORDER_CONSTANT);
 
+// Returns true if the given 2D kernel has rank 1, in which case it is equal to
+// kernel_column * kernel_row and the factors are returned. Separable kernels
+// can be applied as two 1D passes (see cv::sepFilter2D()).
+bool GetSeparableKernelFactors(
+    const cv::Mat& kernel, cv::Mat* kernel_column, cv::Mat* kernel_row);
+
 // Thresholds a matrix such that any value larger than the max value is reduced
 // to the max value and any value smaller than the min value is increased to
 // the min value. For example, with min_value = 0.0 and max_value = 1.0, all
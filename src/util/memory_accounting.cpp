@@ -0,0 +1,191 @@
+#include "util/memory_accounting.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+// The counters of one tag (or of the total).
+struct MemoryCounters {
+  std::atomic<int64_t> current_bytes;
+  std::atomic<int64_t> peak_bytes;
+  std::atomic<int64_t> num_allocations;
+};
+
+// Zero initialized, since they have static storage duration. The counters are
+// never destroyed, so accounts can still release memory during static
+// destruction.
+MemoryCounters tag_counters[NUM_MEMORY_TAGS];
+MemoryCounters total_counters;
+
+thread_local MemoryTag current_memory_tag = MEMORY_TAG_OTHER;
+
+// Adds the bytes to the counters and raises their peak if needed.
+void AddToCounters(const int64_t num_bytes, MemoryCounters* counters) {
+  const int64_t current_bytes = counters->current_bytes.fetch_add(
+      num_bytes, std::memory_order_relaxed) + num_bytes;
+  if (num_bytes <= 0) {
+    return;
+  }
+  counters->num_allocations.fetch_add(1, std::memory_order_relaxed);
+  int64_t peak_bytes = counters->peak_bytes.load(std::memory_order_relaxed);
+  while (current_bytes > peak_bytes &&
+         !counters->peak_bytes.compare_exchange_weak(
+             peak_bytes, current_bytes, std::memory_order_relaxed)) {}
+}
+
+MemoryUsage GetCounterUsage(const MemoryCounters& counters) {
+  MemoryUsage usage;
+  usage.current_bytes = counters.current_bytes.load(std::memory_order_relaxed);
+  usage.peak_bytes = counters.peak_bytes.load(std::memory_order_relaxed);
+  usage.num_allocations =
+      counters.num_allocations.load(std::memory_order_relaxed);
+  return usage;
+}
+
+void AddReportRow(
+    const std::string& name,
+    const MemoryUsage& usage,
+    std::ostringstream* report) {
+
+  constexpr double kBytesPerMegabyte = 1024.0 * 1024.0;
+  *report << std::left << std::setw(32) << ("  " + name) << std::right
+          << std::setw(16) << usage.current_bytes / kBytesPerMegabyte
+          << std::setw(16) << usage.peak_bytes / kBytesPerMegabyte
+          << std::setw(14) << usage.num_allocations << std::endl;
+}
+
+}  // namespace
+
+const char* GetMemoryTagName(const MemoryTag tag) {
+  switch (tag) {
+    case MEMORY_TAG_OTHER:
+      return "other";
+    case MEMORY_TAG_OBSERVATIONS:
+      return "observations";
+    case MEMORY_TAG_ESTIMATE:
+      return "estimate";
+    case MEMORY_TAG_GRADIENTS:
+      return "gradients";
+    case MEMORY_TAG_DATA_TERM:
+      return "data term temporaries";
+    case MEMORY_TAG_REGULARIZER:
+      return "regularizer temporaries";
+    case MEMORY_TAG_PCA:
+      return "PCA";
+    case MEMORY_TAG_LOADERS:
+      return "loaders";
+    default:
+      LOG(FATAL) << "Unknown memory tag " << tag << ".";
+      return "";
+  }
+}
+
+void AddMemoryUsage(const MemoryTag tag, const int64_t num_bytes) {
+  CHECK(tag >= 0 && tag < NUM_MEMORY_TAGS) << "Unknown memory tag.";
+  if (num_bytes == 0) {
+    return;
+  }
+  AddToCounters(num_bytes, &tag_counters[tag]);
+  AddToCounters(num_bytes, &total_counters);
+}
+
+MemoryUsage GetMemoryUsage(const MemoryTag tag) {
+  CHECK(tag >= 0 && tag < NUM_MEMORY_TAGS) << "Unknown memory tag.";
+  return GetCounterUsage(tag_counters[tag]);
+}
+
+MemoryUsage GetTotalMemoryUsage() {
+  return GetCounterUsage(total_counters);
+}
+
+void ResetMemoryPeaks() {
+  for (MemoryCounters& counters : tag_counters) {
+    counters.peak_bytes.store(
+        counters.current_bytes.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+  }
+  total_counters.peak_bytes.store(
+      total_counters.current_bytes.load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+}
+
+std::string GetMemoryReport() {
+  const MemoryUsage total_usage = GetTotalMemoryUsage();
+  if (total_usage.num_allocations == 0) {
+    return "";
+  }
+  std::ostringstream report;
+  report << "Memory by subsystem" << std::endl;
+  report << std::left << std::setw(32) << "  Tag" << std::right
+         << std::setw(16) << "Current (MB)" << std::setw(16) << "Peak (MB)"
+         << std::setw(14) << "Allocations" << std::endl;
+  report << std::fixed << std::setprecision(3);
+  for (int tag = 0; tag < NUM_MEMORY_TAGS; ++tag) {
+    const MemoryUsage usage = GetMemoryUsage(static_cast<MemoryTag>(tag));
+    if (usage.num_allocations > 0) {
+      AddReportRow(
+          GetMemoryTagName(static_cast<MemoryTag>(tag)), usage, &report);
+    }
+  }
+  AddReportRow("total", total_usage, &report);
+  return report.str();
+}
+
+MemoryAccount::MemoryAccount(MemoryAccount&& other)
+    : tag_(other.tag_), num_bytes_(other.num_bytes_) {
+  other.num_bytes_ = 0;
+}
+
+MemoryAccount& MemoryAccount::operator=(MemoryAccount&& other) {
+  if (this != &other) {
+    Set(tag_, 0);
+    tag_ = other.tag_;
+    num_bytes_ = other.num_bytes_;
+    other.num_bytes_ = 0;
+  }
+  return *this;
+}
+
+void MemoryAccount::Set(const MemoryTag tag, const int64_t num_bytes) {
+  CHECK_GE(num_bytes, 0) << "An account cannot hold negative memory.";
+  if (tag == tag_) {
+    AddMemoryUsage(tag_, num_bytes - num_bytes_);
+  } else {
+    // The bytes already held only move between the tags, so the total only
+    // changes by the difference in size. Recording the move as an allocation
+    // and a release would raise the peak of the total by the moved bytes.
+    CHECK(tag >= 0 && tag < NUM_MEMORY_TAGS) << "Unknown memory tag.";
+    AddToCounters(-num_bytes_, &tag_counters[tag_]);
+    AddToCounters(num_bytes, &tag_counters[tag]);
+    if (num_bytes != num_bytes_) {
+      AddToCounters(num_bytes - num_bytes_, &total_counters);
+    }
+    tag_ = tag;
+  }
+  num_bytes_ = num_bytes;
+}
+
+MemoryTag GetCurrentMemoryTag() {
+  return current_memory_tag;
+}
+
+ScopedMemoryTag::ScopedMemoryTag(const MemoryTag tag)
+    : previous_tag_(current_memory_tag) {
+  CHECK(tag >= 0 && tag < NUM_MEMORY_TAGS) << "Unknown memory tag.";
+  current_memory_tag = tag;
+}
+
+ScopedMemoryTag::~ScopedMemoryTag() {
+  current_memory_tag = previous_tag_;
+}
+
+}  // namespace util
+}  // namespace super_resolution
@@ -0,0 +1,173 @@
+// Memory accounting by subsystem. The large buffers of a run (image buffers,
+// solver arrays and objective term scratch space) are recorded under a tag
+// for the subsystem that allocated them, which keeps the current and the peak
+// number of bytes of every tag. This shows which part of a run causes the
+// peak memory use, which the process RSS alone cannot tell.
+//
+// Buffers that are owned by a class are recorded with a MemoryAccount member,
+// which releases its bytes when it is destroyed:
+//   MemoryAccount memory_(MEMORY_TAG_GRADIENTS);
+//   ...
+//   gradient_.resize(num_parameters);
+//   memory_.SetBytes(GetBufferBytes(gradient_));
+//
+// Image buffers are recorded by the aligned image allocator (see
+// aligned_allocator.h) if it is installed, under the tag of the thread that
+// allocates them:
+//   const ScopedMemoryTag memory_tag(MEMORY_TAG_OBSERVATIONS);
+//   ImageData image = ...;
+//
+// The accounting only updates a few atomic counters when buffers are
+// allocated or resized, so it is always on.
+
+#ifndef SRC_UTIL_MEMORY_ACCOUNTING_H_
+#define SRC_UTIL_MEMORY_ACCOUNTING_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace super_resolution {
+namespace util {
+
+// The subsystems that memory is recorded under.
+enum MemoryTag {
+  // Anything allocated outside of a tagged scope.
+  MEMORY_TAG_OTHER,
+
+  // The LR observations, as loaded or generated, and as used by the data
+  // terms (converted, encoded or channel subset copies).
+  MEMORY_TAG_OBSERVATIONS,
+
+  // The HR estimate of the solvers.
+  MEMORY_TAG_ESTIMATE,
+
+  // The gradients, search directions and other image-sized vectors of the
+  // solvers, and the per-term gradients of the objective function.
+  MEMORY_TAG_GRADIENTS,
+
+  // The degraded images and residuals of the data terms.
+  MEMORY_TAG_DATA_TERM,
+
+  // The regularizer values, IRLS weights and other regularizer temporaries.
+  MEMORY_TAG_REGULARIZER,
+
+  // The spectral PCA fit and the images converted to and from PCA space.
+  MEMORY_TAG_PCA,
+
+  // Images read by the data loaders that are not observations (e.g. ground
+  // truth images and cached video frames), and the temporary buffers of the
+  // loaders.
+  MEMORY_TAG_LOADERS,
+
+  NUM_MEMORY_TAGS
+};
+
+// Returns the name of the tag as shown in the reports, e.g. "observations".
+const char* GetMemoryTagName(const MemoryTag tag);
+
+// The recorded memory of a tag (or of all tags).
+struct MemoryUsage {
+  int64_t current_bytes = 0;
+
+  // The largest current_bytes since the start or the last
+  // ResetMemoryPeaks(). The peak of all tags is the peak of their sum, which
+  // can be less than the sum of their peaks.
+  int64_t peak_bytes = 0;
+
+  // The number of times memory was added.
+  int64_t num_allocations = 0;
+};
+
+// Records num_bytes more (or, if negative, fewer) bytes under the tag. This
+// is thread safe. Prefer a MemoryAccount, which cannot leak recorded bytes.
+void AddMemoryUsage(const MemoryTag tag, const int64_t num_bytes);
+
+// Returns the recorded memory of the tag.
+MemoryUsage GetMemoryUsage(const MemoryTag tag);
+
+// Returns the recorded memory of all tags together.
+MemoryUsage GetTotalMemoryUsage();
+
+// Sets the peaks of every tag (and the total) to their current usage, e.g. to
+// measure the peak of a single stage of a run.
+void ResetMemoryPeaks();
+
+// Returns a table of the current and peak memory of every tag that recorded
+// any memory, and of their total. Empty if nothing was recorded.
+std::string GetMemoryReport();
+
+// The bytes that a buffer holds, including its unused capacity.
+template <typename T>
+int64_t GetBufferBytes(const std::vector<T>& buffer) {
+  return static_cast<int64_t>(buffer.capacity()) * sizeof(T);
+}
+
+// Records the size of one or more buffers under a tag while it exists. An
+// account is not thread safe, but different accounts can be updated
+// concurrently.
+class MemoryAccount {
+ public:
+  explicit MemoryAccount(const MemoryTag tag = MEMORY_TAG_OTHER)
+      : tag_(tag), num_bytes_(0) {}
+
+  MemoryAccount(MemoryAccount&& other);
+  MemoryAccount& operator=(MemoryAccount&& other);
+
+  // Releases the recorded bytes.
+  ~MemoryAccount() {
+    Set(tag_, 0);
+  }
+
+  // Changes the recorded size of the buffers to num_bytes.
+  void SetBytes(const int64_t num_bytes) {
+    Set(tag_, num_bytes);
+  }
+
+  // Moves the recorded bytes to the given tag (e.g. for a pooled buffer that
+  // is reused by another subsystem) and changes their size to num_bytes. The
+  // total only changes by the difference in size, so moving bytes does not
+  // raise the peak of the total.
+  void Set(const MemoryTag tag, const int64_t num_bytes);
+
+  MemoryTag GetTag() const {
+    return tag_;
+  }
+
+  int64_t GetNumBytes() const {
+    return num_bytes_;
+  }
+
+ private:
+  MemoryAccount(const MemoryAccount&) = delete;
+  MemoryAccount& operator=(const MemoryAccount&) = delete;
+
+  MemoryTag tag_;
+  int64_t num_bytes_;
+};
+
+// Returns the tag of the innermost ScopedMemoryTag of the calling thread, or
+// MEMORY_TAG_OTHER if there is none.
+MemoryTag GetCurrentMemoryTag();
+
+// Sets the tag of the image buffers allocated by the calling thread until it
+// goes out of scope, which restores the previous tag. The tasks of the
+// ThreadPool::ParallelFor() calls made within the scope are run with the tag
+// on whichever thread runs them, but other threads started within the scope
+// (e.g. by OpenCV or a PrefetchQueue) do not inherit it.
+class ScopedMemoryTag {
+ public:
+  explicit ScopedMemoryTag(const MemoryTag tag);
+  ~ScopedMemoryTag();
+
+ private:
+  ScopedMemoryTag(const ScopedMemoryTag&) = delete;
+  ScopedMemoryTag& operator=(const ScopedMemoryTag&) = delete;
+
+  const MemoryTag previous_tag_;
+};
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_MEMORY_ACCOUNTING_H_
@@ -0,0 +1,219 @@
+#include "util/numa.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+// The mbind() policy and flag values from <numaif.h>, which is part of
+// libnuma and therefore not always installed.
+constexpr int kMemoryPolicyBind = 2;
+constexpr unsigned kMemoryPolicyMoveFlag = 1 << 1;
+
+// True if NUMA-aware placement is enabled.
+std::atomic<bool> numa_placement_enabled(false);
+
+// The NUMA node that the thread is pinned to, or -1.
+thread_local int pinned_numa_node = -1;
+
+// Parses a sysfs CPU or node list such as "0-15,32-47" into the indices it
+// contains. Returns false if the list is malformed.
+bool ParseIndexList(const std::string& list, std::vector<int>* indices) {
+  std::istringstream list_stream(list);
+  std::string range;
+  while (std::getline(list_stream, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    int first;
+    int last;
+    char separator;
+    std::istringstream range_stream(range);
+    if (!(range_stream >> first) || first < 0) {
+      return false;
+    }
+    last = first;
+    if (range_stream >> separator) {
+      if (separator != '-' || !(range_stream >> last) || last < first) {
+        return false;
+      }
+    }
+    for (int index = first; index <= last; ++index) {
+      indices->push_back(index);
+    }
+  }
+  return true;
+}
+
+// Reads the first line of a sysfs file. Returns an empty string on failure.
+std::string ReadSysfsLine(const std::string& path) {
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+// The NUMA nodes of the host and the CPUs of each of them. Nodes without
+// CPUs (e.g. memory-only nodes) are left out, since no thread can be bound
+// to them.
+struct NumaTopology {
+  std::vector<int> node_ids;
+  std::vector<std::vector<int>> node_cpus;
+};
+
+NumaTopology ReadNumaTopology() {
+  NumaTopology topology;
+#ifdef __linux__
+  const std::string node_directory = "/sys/devices/system/node/";
+  std::vector<int> online_node_ids;
+  if (!ParseIndexList(ReadSysfsLine(node_directory + "online"),
+                      &online_node_ids)) {
+    return NumaTopology();
+  }
+  for (const int node_id : online_node_ids) {
+    std::vector<int> cpus;
+    const std::string cpu_list = ReadSysfsLine(
+        node_directory + "node" + std::to_string(node_id) + "/cpulist");
+    if (ParseIndexList(cpu_list, &cpus) && !cpus.empty()) {
+      topology.node_ids.push_back(node_id);
+      topology.node_cpus.push_back(cpus);
+    }
+  }
+#endif
+  return topology;
+}
+
+// Returns the topology, which is read once on first use.
+const NumaTopology& GetNumaTopology() {
+  static const NumaTopology* topology = new NumaTopology(ReadNumaTopology());
+  return *topology;
+}
+
+#ifdef __linux__
+// Sets the CPU affinity of the calling thread. Returns false on failure.
+bool SetThreadCpus(const std::vector<int>& cpus) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (const int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpu_set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0;
+}
+#endif
+
+}  // namespace
+
+int GetNumNumaNodes() {
+  return std::max(1, static_cast<int>(GetNumaTopology().node_ids.size()));
+}
+
+void SetNumaPlacement(const bool enabled) {
+  numa_placement_enabled = enabled && GetNumNumaNodes() > 1;
+}
+
+bool IsNumaPlacementEnabled() {
+  return numa_placement_enabled;
+}
+
+int GetBlockNumaNode(const int block_index, const int num_blocks) {
+  CHECK_GE(block_index, 0);
+  CHECK_LT(block_index, num_blocks);
+  return static_cast<int>(
+      static_cast<int64_t>(block_index) * GetNumNumaNodes() / num_blocks);
+}
+
+void MoveToNumaNode(
+    const void* data, const size_t num_bytes, const int node_index) {
+
+  if (!IsNumaPlacementEnabled() || data == nullptr) {
+    return;
+  }
+#ifdef __linux__
+  const NumaTopology& topology = GetNumaTopology();
+  CHECK_GE(node_index, 0);
+  CHECK_LT(node_index, topology.node_ids.size());
+
+  // Only whole pages can be moved, and pages that are shared with
+  // neighbouring data stay where they are.
+  const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  const uintptr_t start = reinterpret_cast<uintptr_t>(data);
+  const uintptr_t first_page = (start + page_size - 1) / page_size * page_size;
+  const uintptr_t end_page = (start + num_bytes) / page_size * page_size;
+  if (end_page <= first_page) {
+    return;
+  }
+
+  const int node_id = topology.node_ids[node_index];
+  constexpr int kBitsPerMaskWord = 8 * sizeof(unsigned long);  // NOLINT
+  std::vector<unsigned long> node_mask(  // NOLINT
+      node_id / kBitsPerMaskWord + 1, 0);
+  node_mask[node_id / kBitsPerMaskWord] |= 1UL << (node_id % kBitsPerMaskWord);
+  const long result = syscall(  // NOLINT
+      SYS_mbind,
+      reinterpret_cast<void*>(first_page),
+      end_page - first_page,
+      kMemoryPolicyBind,
+      node_mask.data(),
+      node_mask.size() * kBitsPerMaskWord + 1,
+      kMemoryPolicyMoveFlag);
+  if (result != 0) {
+    LOG_FIRST_N(WARNING, 1) << "Could not move memory to NUMA node "
+                            << node_id << ".";
+  }
+#endif
+}
+
+void DistributeOverNumaNodes(
+    const double* data, const int64_t num_values, const int num_blocks) {
+
+  if (!IsNumaPlacementEnabled()) {
+    return;
+  }
+  for (int block_index = 0; block_index < num_blocks; ++block_index) {
+    const int64_t start = block_index * num_values / num_blocks;
+    const int64_t end = (block_index + 1) * num_values / num_blocks;
+    MoveToNumaNode(
+        data + start,
+        (end - start) * sizeof(double),
+        GetBlockNumaNode(block_index, num_blocks));
+  }
+}
+
+void PinThreadToNumaNode(const int node_index) {
+  if (!IsNumaPlacementEnabled() || pinned_numa_node == node_index) {
+    return;
+  }
+#ifdef __linux__
+  const NumaTopology& topology = GetNumaTopology();
+  CHECK_GE(node_index, 0);
+  CHECK_LT(node_index, topology.node_ids.size());
+  if (SetThreadCpus(topology.node_cpus[node_index])) {
+    pinned_numa_node = node_index;
+  }
+#endif
+}
+
+int GetThreadNumaNode() {
+  return pinned_numa_node;
+}
+
+}  // namespace util
+}  // namespace super_resolution
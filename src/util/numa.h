@@ -0,0 +1,63 @@
+// NUMA-aware placement of the large solver buffers on multi-socket hosts.
+// Parallel kernels split their buffers into contiguous blocks (ranges of rows
+// or pixels, or groups of observations), and with NUMA placement enabled,
+// block i of n is owned by NUMA node GetBlockNumaNode(i, n): its pages are
+// moved to that node, and the blocks are preferably run by worker threads
+// that are pinned to the CPUs of the same node (see
+// ThreadPool::ParallelForOnNumaNodes()). Workers are pinned once, since
+// changing the affinity for every task costs system calls and migrations.
+// This way every socket streams mostly from its local memory, and memory
+// bandwidth keeps scaling past a single socket.
+//
+// Placement is disabled by default, and it never changes any computed value.
+// On hosts with a single NUMA node (and on non-Linux systems), all of these
+// functions do nothing.
+
+#ifndef SRC_UTIL_NUMA_H_
+#define SRC_UTIL_NUMA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace super_resolution {
+namespace util {
+
+// Returns the number of NUMA nodes with CPUs on this host (at least 1).
+int GetNumNumaNodes();
+
+// Enables or disables NUMA-aware placement. It is only ever enabled if the
+// host has more than one NUMA node.
+void SetNumaPlacement(const bool enabled);
+
+// Returns true if NUMA-aware placement is enabled.
+bool IsNumaPlacementEnabled();
+
+// Returns the index of the NUMA node (in [0, GetNumNumaNodes())) that owns the
+// given block of num_blocks contiguous blocks. Consecutive blocks are owned by
+// the same node, so each node owns one contiguous part of the buffer.
+int GetBlockNumaNode(const int block_index, const int num_blocks);
+
+// Moves the memory pages that lie entirely inside the given range to the
+// given NUMA node. The contents are not changed. Does nothing if placement is
+// disabled.
+void MoveToNumaNode(
+    const void* data, const size_t num_bytes, const int node_index);
+
+// Splits the given buffer of num_values values into num_blocks contiguous
+// blocks (as in GetBlockNumaNode()) and moves each block to its NUMA node.
+void DistributeOverNumaNodes(
+    const double* data, const int64_t num_values, const int num_blocks);
+
+// Binds the calling thread to the CPUs of the given NUMA node for the rest of
+// its life. Does nothing if placement is disabled or if the thread is already
+// bound to the node.
+void PinThreadToNumaNode(const int node_index);
+
+// Returns the NUMA node that the calling thread is pinned to, or -1 if it is
+// not pinned.
+int GetThreadNumaNode();
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_NUMA_H_
@@ -0,0 +1,174 @@
+// A PrefetchQueue loads a sequence of items (e.g. image files or blocks of
+// hyperspectral bands) on background threads and hands them to the consumer in
+// order. At most a bounded number of items are loaded ahead of the consumer,
+// so file I/O and decoding overlap with the consumer's work without holding
+// the whole sequence in memory.
+
+#ifndef SRC_UTIL_PREFETCH_QUEUE_H_
+#define SRC_UTIL_PREFETCH_QUEUE_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "util/thread_pool.h"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+
+template <typename T>
+class PrefetchQueue {
+ public:
+  // Loads the item with the given index. It is called from the loader
+  // threads, so it must be safe to call concurrently if num_threads is
+  // greater than 1.
+  using LoadFunction = std::function<T(const int item_index)>;
+
+  // Starts loading the items [0, num_items) with num_threads loader threads
+  // (0 = one per hardware thread). At most max_num_prefetched items are
+  // loaded (or being loaded) ahead of the consumer at any time, which bounds
+  // the memory used by the queue. max_num_prefetched must be at least 1.
+  PrefetchQueue(
+      const int num_items,
+      const LoadFunction& load_function,
+      const int num_threads = 1,
+      const int max_num_prefetched = 2);
+
+  // Stops the loader threads after they finish their current items. Items
+  // that were not consumed are discarded.
+  ~PrefetchQueue();
+
+  PrefetchQueue(const PrefetchQueue&) = delete;
+  PrefetchQueue& operator = (const PrefetchQueue&) = delete;
+
+  // Returns true if there are items left that were not returned by GetNext().
+  bool HasNext() const {
+    return next_item_to_consume_ < num_items_;
+  }
+
+  // Returns the next item in index order, waiting for it to be loaded if
+  // necessary. HasNext() must be true.
+  T GetNext();
+
+ private:
+  // The loop run by each loader thread, which loads items until all items are
+  // claimed or the queue is destroyed.
+  void RunLoader();
+
+  const int num_items_;
+  const LoadFunction load_function_;
+  const int max_num_prefetched_;
+
+  std::vector<std::thread> loaders_;
+
+  // All of the following are protected by mutex_.
+  std::mutex mutex_;
+
+  // Signaled when an item finished loading.
+  std::condition_variable item_loaded_;
+
+  // Signaled when the consumer takes an item (or the queue is destroyed), so
+  // that loaders waiting on the prefetch limit can continue.
+  std::condition_variable item_consumed_;
+
+  // Loaded items that have not been consumed yet, by item index.
+  std::map<int, T> loaded_items_;
+
+  // The next item index to be claimed by a loader, and to be returned by
+  // GetNext(), respectively.
+  int next_item_to_load_;
+  int next_item_to_consume_;
+
+  // Set when the queue is being destroyed to stop the loaders.
+  bool stop_loaders_;
+};
+
+template <typename T>
+PrefetchQueue<T>::PrefetchQueue(
+    const int num_items,
+    const LoadFunction& load_function,
+    const int num_threads,
+    const int max_num_prefetched)
+    : num_items_(num_items),
+      load_function_(load_function),
+      max_num_prefetched_(max_num_prefetched),
+      next_item_to_load_(0),
+      next_item_to_consume_(0),
+      stop_loaders_(false) {
+
+  CHECK_GE(num_items_, 0) << "Number of items cannot be negative.";
+  CHECK_GE(max_num_prefetched_, 1) << "At least one item must be prefetched.";
+  // There is no point in having more loaders than items that can be loaded
+  // at the same time.
+  const int num_loaders = std::min(
+      GetNumThreadsToUse(num_threads),
+      std::min(num_items_, max_num_prefetched_));
+  loaders_.reserve(num_loaders);
+  for (int i = 0; i < num_loaders; ++i) {
+    loaders_.push_back(std::thread(&PrefetchQueue<T>::RunLoader, this));
+  }
+}
+
+template <typename T>
+PrefetchQueue<T>::~PrefetchQueue() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop_loaders_ = true;
+  }
+  item_consumed_.notify_all();
+  for (std::thread& loader : loaders_) {
+    loader.join();
+  }
+}
+
+template <typename T>
+T PrefetchQueue<T>::GetNext() {
+  CHECK(HasNext()) << "There are no items left in the queue.";
+  std::unique_lock<std::mutex> lock(mutex_);
+  const int item_index = next_item_to_consume_;
+  item_loaded_.wait(lock, [this, item_index]() {
+    return loaded_items_.count(item_index) > 0;
+  });
+  T item = std::move(loaded_items_[item_index]);
+  loaded_items_.erase(item_index);
+  next_item_to_consume_++;
+  lock.unlock();
+  item_consumed_.notify_all();
+  return item;
+}
+
+template <typename T>
+void PrefetchQueue<T>::RunLoader() {
+  while (true) {
+    int item_index;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      item_consumed_.wait(lock, [this]() {
+        return stop_loaders_ || next_item_to_load_ >= num_items_ ||
+            next_item_to_load_ < next_item_to_consume_ + max_num_prefetched_;
+      });
+      if (stop_loaders_ || next_item_to_load_ >= num_items_) {
+        return;
+      }
+      item_index = next_item_to_load_++;
+    }
+    T item = load_function_(item_index);
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      loaded_items_.insert(std::make_pair(item_index, std::move(item)));
+    }
+    item_loaded_.notify_all();
+  }
+}
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_PREFETCH_QUEUE_H_
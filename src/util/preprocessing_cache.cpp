@@ -0,0 +1,180 @@
+#include "util/preprocessing_cache.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "hyperspectral/chunked_hsi_file.h"
+#include "image/image_data.h"
+#include "image/image_data_file.h"
+#include "util/config_reader.h"
+#include "util/data_loader.h"
+#include "util/profiler.h"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+constexpr uint64_t kHashOffsetBasis = 14695981039346656037ULL;
+constexpr uint64_t kHashPrime = 1099511628211ULL;
+
+// The size of the chunks in which files are read for hashing.
+constexpr int kFileChunkSize = 1 << 20;
+
+// Returns the path of the image with the given index in an entry directory.
+std::string GetImagePath(const std::string& entry_path, const int index) {
+  return entry_path + "/" + std::to_string(index) + "." +
+      kImageDataFileExtension;
+}
+
+// Deletes the given entry directory and the first num_images images in it.
+void RemoveEntryDirectory(const std::string& entry_path, const int num_images) {
+  for (int index = 0; index < num_images; ++index) {
+    std::remove(GetImagePath(entry_path, index).c_str());
+  }
+  rmdir(entry_path.c_str());
+}
+
+}  // namespace
+
+PreprocessingCacheKey::PreprocessingCacheKey(const std::string& stage_name)
+    : stage_name_(stage_name), hash_(kHashOffsetBasis) {
+
+  CHECK(!stage_name_.empty()) << "The stage name cannot be empty.";
+  AddBytes(stage_name_.data(), stage_name_.size());
+}
+
+void PreprocessingCacheKey::AddFileContents(const std::string& path) {
+  PROFILE_SCOPE("PreprocessingCacheKey::AddFileContents");
+  std::vector<char> chunk(kFileChunkSize);
+  for (const std::string& file_path : GetFilePaths(path)) {
+    std::ifstream file(file_path, std::ios::binary);
+    CHECK(file.is_open())
+        << "File '" << file_path << "' could not be opened for hashing.";
+    int64_t file_size = 0;
+    while (file) {
+      file.read(chunk.data(), chunk.size());
+      AddBytes(chunk.data(), file.gcount());
+      file_size += file.gcount();
+    }
+    // The size separates the contents of consecutive files.
+    AddValue("file_size", file_size);
+  }
+}
+
+void PreprocessingCacheKey::AddInputFiles(const std::string& data_path) {
+  for (const std::string& file_path : GetFilePaths(data_path)) {
+    AddFileContents(file_path);
+    std::string extension = file_path.substr(file_path.find_last_of(".") + 1);
+    std::transform(
+        extension.begin(), extension.end(), extension.begin(), tolower);
+    if (IsSupportedImageExtension(extension) ||
+        extension == kImageDataFileExtension ||
+        extension == kChunkedHSIFileExtension) {
+      continue;
+    }
+    // Other files are loaded as hyperspectral configuration files, which
+    // refer to the data file.
+    ConfigurationFileReader config_reader;
+    config_reader.SetDelimiter(' ');
+    config_reader.ReadFromFile(file_path);
+    if (config_reader.HasValue("file")) {
+      AddFileContents(config_reader.GetValue("file"));
+    }
+  }
+}
+
+std::string PreprocessingCacheKey::GetEntryName() const {
+  std::ostringstream entry_name;
+  entry_name << stage_name_ << "-" << std::hex << std::setfill('0')
+             << std::setw(16) << hash_;
+  return entry_name.str();
+}
+
+void PreprocessingCacheKey::AddBytes(
+    const char* bytes, const size_t num_bytes) {
+
+  for (size_t i = 0; i < num_bytes; ++i) {
+    hash_ ^= static_cast<uint8_t>(bytes[i]);
+    hash_ *= kHashPrime;
+  }
+}
+
+PreprocessingCache::PreprocessingCache(const std::string& cache_directory)
+    : cache_directory_(cache_directory) {
+
+  CHECK(!cache_directory_.empty()) << "The cache directory cannot be empty.";
+  if (mkdir(cache_directory_.c_str(), 0755) != 0) {
+    CHECK_EQ(errno, EEXIST)
+        << "Cache directory '" << cache_directory_ << "' could not be "
+        << "created.";
+  }
+  CHECK(IsDirectory(cache_directory_))
+      << "Cache path '" << cache_directory_ << "' is not a directory.";
+}
+
+bool PreprocessingCache::Load(
+    const PreprocessingCacheKey& key, std::vector<ImageData>* images) const {
+
+  CHECK_NOTNULL(images);
+  const std::string entry_path =
+      cache_directory_ + "/" + key.GetEntryName();
+  if (!PathExists(entry_path)) {
+    return false;
+  }
+  images->clear();
+  for (int index = 0; PathExists(GetImagePath(entry_path, index)); ++index) {
+    images->push_back(LoadImageDataFile(GetImagePath(entry_path, index)));
+  }
+  LOG(INFO) << "Loaded " << images->size() << " cached image(s) from '"
+            << entry_path << "'.";
+  return !images->empty();
+}
+
+bool PreprocessingCache::Save(
+    const PreprocessingCacheKey& key,
+    const std::vector<ImageData>& images) const {
+
+  CHECK(!images.empty()) << "Cannot cache an empty list of images.";
+  const std::string entry_path =
+      cache_directory_ + "/" + key.GetEntryName();
+  if (PathExists(entry_path)) {
+    return true;
+  }
+
+  // The temporary name is unique to this process.
+  const std::string temporary_entry_path =
+      entry_path + ".tmp" + std::to_string(getpid());
+  if (mkdir(temporary_entry_path.c_str(), 0755) != 0) {
+    LOG(WARNING) << "Could not create cache entry '" << temporary_entry_path
+                 << "'.";
+    return false;
+  }
+  for (int index = 0; index < images.size(); ++index) {
+    SaveImageDataFile(images[index], GetImagePath(temporary_entry_path, index));
+  }
+  if (rename(temporary_entry_path.c_str(), entry_path.c_str()) != 0) {
+    // Another run may have stored the same entry in the meantime.
+    RemoveEntryDirectory(temporary_entry_path, images.size());
+    if (!PathExists(entry_path)) {
+      LOG(WARNING) << "Could not store cache entry '" << entry_path << "'.";
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace util
+}  // namespace super_resolution
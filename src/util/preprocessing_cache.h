@@ -0,0 +1,104 @@
+// A content-addressed on-disk cache for the products of the preprocessing
+// stages of a run, such as the loaded (or generated) observations and their
+// PCA projection. Each entry is keyed by a hash of the contents of the input
+// files and of the options that the stage depends on, so a later run with the
+// same inputs skips the stage no matter where the files are or when they were
+// written, and a changed input never hits a stale entry. The images of an
+// entry are stored as image data files (see image/image_data_file.h), so they
+// are loaded exactly and are memory mapped instead of decoded.
+//
+// Entries are never modified or evicted; delete the cache directory to clear
+// the cache. Use as follows:
+//   PreprocessingCache cache(cache_directory);
+//   PreprocessingCacheKey key("observations");
+//   key.AddInputFiles(data_path);
+//   key.AddValue("noise_sigma", noise_sigma);
+//   std::vector<ImageData> images;
+//   if (!cache.Load(key, &images)) {
+//     images = ...;
+//     cache.Save(key, images);
+//   }
+
+#ifndef SRC_UTIL_PREPROCESSING_CACHE_H_
+#define SRC_UTIL_PREPROCESSING_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "image/image_data.h"
+
+namespace super_resolution {
+namespace util {
+
+class PreprocessingCacheKey {
+ public:
+  // The stage name is part of the key, so that the entries of different
+  // stages never collide.
+  explicit PreprocessingCacheKey(const std::string& stage_name);
+
+  // Adds the contents of the given file to the key, or of every file of the
+  // given directory in the order of GetFilePaths(). Only the contents are
+  // hashed, not the paths.
+  void AddFileContents(const std::string& path);
+
+  // Same as AddFileContents(), but also adds the binary data file of every
+  // hyperspectral configuration file, so that the key covers every file that
+  // LoadImages() reads for the given data path.
+  void AddInputFiles(const std::string& data_path);
+
+  // Adds a named option value to the key. Floating point values are added
+  // with full precision.
+  template <typename T>
+  void AddValue(const std::string& name, const T& value) {
+    std::ostringstream name_and_value;
+    name_and_value << std::setprecision(17) << name << "=" << value << "\n";
+    const std::string text = name_and_value.str();
+    AddBytes(text.data(), text.size());
+  }
+
+  // Returns the name of the entry of this key, which is the stage name
+  // followed by the hash of everything that was added.
+  std::string GetEntryName() const;
+
+ private:
+  // Adds the bytes to the hash.
+  void AddBytes(const char* bytes, const size_t num_bytes);
+
+  const std::string stage_name_;
+
+  // The 64-bit FNV-1a hash of everything added to the key.
+  uint64_t hash_;
+};
+
+class PreprocessingCache {
+ public:
+  // The entries are stored in the given directory, which is created if it
+  // does not exist yet.
+  explicit PreprocessingCache(const std::string& cache_directory);
+
+  // Returns true and sets the images if the cache has an entry for the key.
+  // The images are memory mapped from the cache files.
+  bool Load(
+      const PreprocessingCacheKey& key, std::vector<ImageData>* images) const;
+
+  // Stores the (non-empty) images as the entry of the key. The entry is
+  // written under a temporary name and then renamed, so interrupted runs
+  // never leave partial entries and concurrent runs can share the cache. If
+  // the entry already exists, it is kept. Returns false and logs a warning if
+  // the entry could not be written.
+  bool Save(
+      const PreprocessingCacheKey& key,
+      const std::vector<ImageData>& images) const;
+
+ private:
+  const std::string cache_directory_;
+};
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_PREPROCESSING_CACHE_H_
@@ -0,0 +1,269 @@
+#include "util/preview_pyramid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <utility>
+#include <vector>
+
+#include "image/image_data.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+// Returns the cache key of the tile at the given level and position.
+int64_t GetTileKey(const int level, const int tile_row, const int tile_col) {
+  return (static_cast<int64_t>(level) << 48) |
+         (static_cast<int64_t>(tile_row) << 24) |
+         static_cast<int64_t>(tile_col);
+}
+
+// Returns the 2x2 average of the given 8-bit image. Odd sizes are rounded up
+// by replicating the last row or column.
+cv::Mat HalveImage(const cv::Mat& image) {
+  cv::Mat even_image = image;
+  if (image.rows % 2 != 0 || image.cols % 2 != 0) {
+    cv::copyMakeBorder(
+        image, even_image, 0, image.rows % 2, 0, image.cols % 2,
+        cv::BORDER_REPLICATE);
+  }
+  cv::Mat halved_image;
+  cv::resize(
+      even_image, halved_image,
+      cv::Size(even_image.cols / 2, even_image.rows / 2),
+      0, 0, cv::INTER_AREA);
+  return halved_image;
+}
+
+}  // namespace
+
+PreviewPyramid::PreviewPyramid(
+    const ImageData& image, const PreviewPyramidOptions& options)
+    : options_(options), image_(&image) {
+
+  CHECK_GT(image.GetNumChannels(), 0) << "Cannot preview an empty image.";
+  CHECK_GT(options.tile_size, 0) << "The tile size must be positive.";
+
+  const int num_channels = image.GetNumChannels();
+  if (num_channels == 3 &&
+      image.GetSpectralMode() == SPECTRAL_MODE_COLOR_YCRCB) {
+    color_converted_image_ = image;
+    color_converted_image_.ChangeColorSpace(SPECTRAL_MODE_COLOR_BGR);
+    image_ = &color_converted_image_;
+  }
+  // The same bands as in ImageData::GetVisualizationImage().
+  if (num_channels < 3) {
+    displayed_bands_ = {0};
+  } else {
+    displayed_bands_ = {0, num_channels / 2, num_channels - 1};
+  }
+  band_statistics_.resize(num_channels);
+  has_band_statistics_.assign(num_channels, false);
+
+  num_levels_ = 1;
+  cv::Size level_size = image.GetImageSize();
+  while (level_size.width > options.tile_size ||
+         level_size.height > options.tile_size) {
+    level_size = cv::Size((level_size.width + 1) / 2,
+                          (level_size.height + 1) / 2);
+    ++num_levels_;
+  }
+}
+
+cv::Mat PreviewPyramid::Render(
+    const cv::Rect& region, const cv::Size& output_size) {
+
+  const cv::Size image_size = image_->GetImageSize();
+  CHECK(region.width > 0 && region.height > 0 &&
+        (region & cv::Rect(cv::Point(0, 0), image_size)) == region)
+      << "The region must be a non-empty part of the image.";
+  CHECK(output_size.width > 0 && output_size.height > 0)
+      << "The output size must be positive.";
+
+  // The coarsest level that still has at least the output resolution.
+  const double downsampling_factor = std::min(
+      static_cast<double>(region.width) / output_size.width,
+      static_cast<double>(region.height) / output_size.height);
+  int level = 0;
+  while (level + 1 < num_levels_ && (2 << level) <= downsampling_factor) {
+    ++level;
+  }
+
+  // The pixels of the level that cover the region.
+  const int level_scale = 1 << level;
+  const cv::Size level_size = GetLevelSize(level);
+  const int start_x = region.x / level_scale;
+  const int start_y = region.y / level_scale;
+  const int end_x = std::min(
+      (region.x + region.width + level_scale - 1) / level_scale,
+      level_size.width);
+  const int end_y = std::min(
+      (region.y + region.height + level_scale - 1) / level_scale,
+      level_size.height);
+  const cv::Rect level_region(
+      start_x, start_y, end_x - start_x, end_y - start_y);
+
+  const int tile_size = options_.tile_size;
+  const int image_type = (displayed_bands_.size() == 1) ? CV_8UC1 : CV_8UC3;
+  cv::Mat level_image(level_region.size(), image_type);
+  for (int tile_row = start_y / tile_size;
+       tile_row <= (end_y - 1) / tile_size; ++tile_row) {
+    for (int tile_col = start_x / tile_size;
+         tile_col <= (end_x - 1) / tile_size; ++tile_col) {
+      const cv::Mat tile = GetTile(level, tile_row, tile_col);
+      const cv::Rect tile_region(
+          tile_col * tile_size, tile_row * tile_size, tile.cols, tile.rows);
+      const cv::Rect overlap = tile_region & level_region;
+      tile(overlap - tile_region.tl()).copyTo(
+          level_image(overlap - level_region.tl()));
+    }
+  }
+
+  if (level_image.size() == output_size) {
+    return level_image;
+  }
+  cv::Mat output_image;
+  const bool is_shrinking = level_image.cols > output_size.width ||
+                            level_image.rows > output_size.height;
+  cv::resize(
+      level_image, output_image, output_size, 0, 0,
+      is_shrinking ? cv::INTER_AREA : cv::INTER_LINEAR);
+  return output_image;
+}
+
+BandStatistics PreviewPyramid::GetBandStatistics(const int band) {
+  CHECK(band >= 0 && band < image_->GetNumChannels())
+      << "Band " << band << " is out of range.";
+  if (has_band_statistics_[band]) {
+    return band_statistics_[band];
+  }
+
+  const cv::Mat channel_image = image_->GetChannelImage(band);
+  const int64_t num_samples =
+      std::max<int64_t>(options_.num_statistics_samples, 1);
+  const int row_step = std::max(
+      1, static_cast<int>(
+          static_cast<int64_t>(channel_image.rows) * channel_image.cols /
+          num_samples));
+  BandStatistics statistics;
+  statistics.min_value = std::numeric_limits<double>::max();
+  statistics.max_value = std::numeric_limits<double>::lowest();
+  for (int row = 0; row < channel_image.rows; row += row_step) {
+    double row_min_value;
+    double row_max_value;
+    cv::minMaxLoc(channel_image.row(row), &row_min_value, &row_max_value);
+    statistics.min_value = std::min(statistics.min_value, row_min_value);
+    statistics.max_value = std::max(statistics.max_value, row_max_value);
+  }
+  band_statistics_[band] = statistics;
+  has_band_statistics_[band] = true;
+  return statistics;
+}
+
+cv::Mat PreviewPyramid::GetTile(
+    const int level, const int tile_row, const int tile_col) {
+
+  const int64_t key = GetTileKey(level, tile_row, tile_col);
+  const auto cached_tile = tiles_.find(key);
+  if (cached_tile != tiles_.end()) {
+    tile_usage_order_.splice(
+        tile_usage_order_.begin(), tile_usage_order_,
+        cached_tile->second.second);
+    return cached_tile->second.first;
+  }
+
+  cv::Mat tile;
+  if (level == 0) {
+    tile = DecodeTile(tile_row, tile_col);
+  } else {
+    // The tile covers 2x2 tiles of the level below, except at the far edges.
+    const int tile_size = options_.tile_size;
+    const cv::Size lower_level_size = GetLevelSize(level - 1);
+    const cv::Rect lower_region =
+        cv::Rect(2 * tile_col * tile_size, 2 * tile_row * tile_size,
+                 2 * tile_size, 2 * tile_size) &
+        cv::Rect(cv::Point(0, 0), lower_level_size);
+    const int image_type =
+        (displayed_bands_.size() == 1) ? CV_8UC1 : CV_8UC3;
+    cv::Mat lower_image(lower_region.size(), image_type);
+    for (int row = 0; row < 2; ++row) {
+      for (int col = 0; col < 2; ++col) {
+        const cv::Rect lower_tile_region = cv::Rect(
+            lower_region.x + col * tile_size,
+            lower_region.y + row * tile_size,
+            tile_size, tile_size) & lower_region;
+        if (lower_tile_region.area() > 0) {
+          GetTile(level - 1, 2 * tile_row + row, 2 * tile_col + col).copyTo(
+              lower_image(lower_tile_region - lower_region.tl()));
+        }
+      }
+    }
+    tile = HalveImage(lower_image);
+  }
+
+  tile_usage_order_.push_front(key);
+  tiles_[key] = std::make_pair(tile, tile_usage_order_.begin());
+  num_cached_bytes_ += tile.total() * tile.elemSize();
+  // The new tile is never evicted, even if it alone exceeds the limit.
+  while (num_cached_bytes_ > options_.max_cache_bytes &&
+         tile_usage_order_.size() > 1) {
+    const auto evicted_tile = tiles_.find(tile_usage_order_.back());
+    num_cached_bytes_ -=
+        evicted_tile->second.first.total() *
+        evicted_tile->second.first.elemSize();
+    tiles_.erase(evicted_tile);
+    tile_usage_order_.pop_back();
+  }
+  return tile;
+}
+
+cv::Mat PreviewPyramid::DecodeTile(const int tile_row, const int tile_col) {
+  const int tile_size = options_.tile_size;
+  const cv::Rect tile_region =
+      cv::Rect(tile_col * tile_size, tile_row * tile_size,
+               tile_size, tile_size) &
+      cv::Rect(cv::Point(0, 0), image_->GetImageSize());
+
+  // Maps the value range of each band to 0-255, saturating values outside of
+  // it.
+  std::vector<cv::Mat> band_tiles;
+  for (const int band : displayed_bands_) {
+    BandStatistics value_range;
+    if (options_.stretch_bands) {
+      value_range = GetBandStatistics(band);
+    }
+    const double range_size = value_range.max_value - value_range.min_value;
+    const double scale = (range_size > 0.0) ? 255.0 / range_size : 0.0;
+    cv::Mat band_tile;
+    image_->GetChannelImage(band)(tile_region).convertTo(
+        band_tile, CV_8U, scale, -value_range.min_value * scale);
+    band_tiles.push_back(band_tile);
+  }
+  ++num_decoded_tiles_;
+  if (band_tiles.size() == 1) {
+    return band_tiles[0];
+  }
+  cv::Mat tile;
+  cv::merge(band_tiles, tile);
+  return tile;
+}
+
+cv::Size PreviewPyramid::GetLevelSize(const int level) const {
+  cv::Size level_size = image_->GetImageSize();
+  for (int i = 0; i < level; ++i) {
+    level_size = cv::Size((level_size.width + 1) / 2,
+                          (level_size.height + 1) / 2);
+  }
+  return level_size;
+}
+
+}  // namespace util
+}  // namespace super_resolution
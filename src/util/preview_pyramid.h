@@ -0,0 +1,121 @@
+// A lazily built, cached multiresolution preview of an image for the viewer.
+// ImageData::GetVisualizationImage() converts the whole image at full
+// resolution, which is slow for large hyperspectral cubes, and most of its
+// pixels are never seen on a screen-sized window. The preview pyramid instead
+// renders only the requested region at the requested (screen) resolution.
+//
+// The pyramid is made of 8-bit tiles of the displayed bands (the same bands
+// that GetVisualizationImage() shows). Level 0 tiles are decoded from only
+// their region of the image, so for memory-mapped images (see
+// LoadImageDataFile()), only the pages of displayed tiles are ever read. Each
+// tile of level l is the 2x2 average of the four tiles below it at level
+// l - 1. Tiles are built when a rendered region first needs them, and are
+// kept in a cache of bounded size, so panning and zooming reuse them. The
+// pyramid is meant for a single viewer thread and is not thread-safe.
+
+#ifndef SRC_UTIL_PREVIEW_PYRAMID_H_
+#define SRC_UTIL_PREVIEW_PYRAMID_H_
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "image/image_data.h"
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+namespace util {
+
+struct PreviewPyramidOptions {
+  // The width and height of the tiles in pixels of their level.
+  int tile_size = 256;
+
+  // The maximum total size of the cached tiles in bytes. The least recently
+  // used tiles are evicted first.
+  int64_t max_cache_bytes = 512LL * 1024 * 1024;
+
+  // If true, each displayed band is mapped from its own value range (see
+  // GetBandStatistics()) to 0-255. Otherwise, values in [0, 1] are mapped to
+  // 0-255 as in ImageData::GetVisualizationImage().
+  bool stretch_bands = false;
+
+  // The band statistics are computed from evenly spaced rows with about this
+  // many pixels in total.
+  int64_t num_statistics_samples = 1 << 20;
+};
+
+// The value range of a band.
+struct BandStatistics {
+  double min_value = 0.0;
+  double max_value = 1.0;
+};
+
+class PreviewPyramid {
+ public:
+  // The image must outlive the pyramid and must not be empty. Pixels are read
+  // only when tiles are decoded.
+  explicit PreviewPyramid(
+      const ImageData& image,
+      const PreviewPyramidOptions& options = PreviewPyramidOptions());
+
+  // Returns the number of levels. The last level fits into a single tile.
+  int GetNumLevels() const {
+    return num_levels_;
+  }
+
+  // Returns the 8-bit (gray or BGR) rendering of the given region of the
+  // image, resized to the output size. The region is read from the finest
+  // level that is not finer than the output resolution, so only the tiles of
+  // that level that overlap the region are built (and, for level 0, decoded).
+  cv::Mat Render(const cv::Rect& region, const cv::Size& output_size);
+
+  // Returns the value range of the given band (channel) of the image, which is
+  // estimated from sampled rows (see PreviewPyramidOptions).
+  BandStatistics GetBandStatistics(const int band);
+
+  // Returns the number of level 0 tiles decoded from the image so far.
+  int GetNumDecodedTiles() const {
+    return num_decoded_tiles_;
+  }
+
+ private:
+  // Returns the tile at the given level and tile position, building it (and
+  // the tiles below it) if it is not cached.
+  cv::Mat GetTile(const int level, const int tile_row, const int tile_col);
+
+  // Decodes the level 0 tile at the given tile position from the image.
+  cv::Mat DecodeTile(const int tile_row, const int tile_col);
+
+  // Returns the size of the given level in pixels.
+  cv::Size GetLevelSize(const int level) const;
+
+  const PreviewPyramidOptions options_;
+
+  // The image to preview. Color images in other color spaces are converted
+  // to BGR into color_converted_image_, which this then points to.
+  const ImageData* image_;
+  ImageData color_converted_image_;
+
+  // The displayed bands of the image (one or three), and their value ranges.
+  std::vector<int> displayed_bands_;
+  std::vector<BandStatistics> band_statistics_;
+  std::vector<bool> has_band_statistics_;
+
+  int num_levels_;
+  int num_decoded_tiles_ = 0;
+
+  // The cached tiles by key (see GetTile()), with their positions in the
+  // least recently used order (most recently used first).
+  std::unordered_map<int64_t, std::pair<cv::Mat, std::list<int64_t>::iterator>>
+      tiles_;
+  std::list<int64_t> tile_usage_order_;
+  int64_t num_cached_bytes_ = 0;
+};
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_PREVIEW_PYRAMID_H_
@@ -0,0 +1,76 @@
+#include "util/process_rank.h"
+
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+// The environment variables of the rank and number of ranks set by the
+// supported launchers, in order of preference.
+const std::vector<std::pair<std::string, std::string>> kRankVariables = {
+  {"OMPI_COMM_WORLD_RANK", "OMPI_COMM_WORLD_SIZE"},
+  {"PMI_RANK", "PMI_SIZE"},
+  {"SLURM_PROCID", "SLURM_NTASKS"}
+};
+
+// Reads the value of the given environment variable into value. Returns false
+// if it is not set or is not an integer.
+bool GetEnvironmentInteger(const std::string& name, int* value) {
+  const char* text = std::getenv(name.c_str());
+  if (text == nullptr || *text == '\0') {
+    return false;
+  }
+  char* end = nullptr;
+  const long parsed_value = std::strtol(text, &end, 10);  // NOLINT
+  if (*end != '\0') {
+    return false;
+  }
+  *value = static_cast<int>(parsed_value);
+  return true;
+}
+
+}  // namespace
+
+ProcessRank GetProcessRank(
+    const int requested_rank,
+    const int requested_num_ranks,
+    const bool read_launcher_environment) {
+
+  ProcessRank process_rank;
+  int environment_rank = 0;
+  int environment_num_ranks = 1;
+  if (read_launcher_environment) {
+    bool has_environment = false;
+    for (const auto& variables : kRankVariables) {
+      int rank;
+      int num_ranks;
+      if (GetEnvironmentInteger(variables.first, &rank) &&
+          GetEnvironmentInteger(variables.second, &num_ranks)) {
+        environment_rank = rank;
+        environment_num_ranks = num_ranks;
+        has_environment = true;
+        break;
+      }
+    }
+    CHECK(has_environment)
+        << "No MPI or Slurm launcher environment to read the rank from.";
+  }
+  process_rank.rank =
+      (requested_rank >= 0) ? requested_rank : environment_rank;
+  process_rank.num_ranks = (requested_num_ranks > 0) ?
+      requested_num_ranks : environment_num_ranks;
+  CHECK_GT(process_rank.num_ranks, 0) << "There must be at least one rank.";
+  CHECK(process_rank.rank >= 0 && process_rank.rank < process_rank.num_ranks)
+      << "Rank " << process_rank.rank << " is not in [0, "
+      << process_rank.num_ranks << ").";
+  return process_rank;
+}
+
+}  // namespace util
+}  // namespace super_resolution
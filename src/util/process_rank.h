@@ -0,0 +1,44 @@
+// The rank of this process among the processes of a distributed job, e.g.
+// one started with mpirun or as the tasks of a Slurm job. The processes do not
+// communicate: each one takes its share of independent work items (such as
+// the band blocks of a streamed solve) by rank, and writes its results in
+// place into a shared output file.
+
+#ifndef SRC_UTIL_PROCESS_RANK_H_
+#define SRC_UTIL_PROCESS_RANK_H_
+
+namespace super_resolution {
+namespace util {
+
+struct ProcessRank {
+  // The index of this process, in [0, num_ranks).
+  int rank = 0;
+
+  // The number of processes of the job.
+  int num_ranks = 1;
+
+  // Returns true if the work item with the given index belongs to this
+  // process. Items are dealt out round-robin, so ranks get equal shares of
+  // work items of similar cost.
+  bool OwnsItem(const int item_index) const {
+    return item_index % num_ranks == rank;
+  }
+};
+
+// Returns the rank of this process. A negative rank or non-positive number of
+// ranks defaults to a single process, unless read_launcher_environment is set,
+// in which case they are read from the environment variables set by common
+// launchers (OMPI_COMM_WORLD_RANK/SIZE of Open MPI, PMI_RANK/SIZE of MPICH and
+// Intel MPI, and SLURM_PROCID/NTASKS of Slurm). These are only read on
+// request, since they are also set for processes that are not meant to share
+// any work, e.g. every step of a Slurm batch script. It is an error to request
+// them if none are set.
+ProcessRank GetProcessRank(
+    const int requested_rank = -1,
+    const int requested_num_ranks = 0,
+    const bool read_launcher_environment = false);
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_PROCESS_RANK_H_
@@ -0,0 +1,128 @@
+#include "util/profiler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+// All entries ever constructed. The registry is never destroyed, so entries
+// can still register (and be reported) during static destruction.
+struct ProfileRegistry {
+  std::vector<ProfileEntry*> entries;
+  std::mutex mutex;
+};
+
+ProfileRegistry& GetProfileRegistry() {
+  static ProfileRegistry* registry = new ProfileRegistry();
+  return *registry;
+}
+
+// The merged totals of all entries with the same name.
+struct ProfileTotals {
+  std::string name;
+  int64_t num_calls = 0;
+  int64_t total_nanoseconds = 0;
+  int64_t count = 0;
+};
+
+}  // namespace
+
+ProfileEntry::ProfileEntry(const char* name)
+    : name_(name), num_calls_(0), total_nanoseconds_(0), count_(0) {
+  ProfileRegistry& registry = GetProfileRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registry.entries.push_back(this);
+}
+
+void ProfileEntry::Reset() {
+  num_calls_.store(0, std::memory_order_relaxed);
+  total_nanoseconds_.store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+}
+
+std::string GetProfileReport() {
+  std::map<std::string, ProfileTotals> totals_by_name;
+  {
+    ProfileRegistry& registry = GetProfileRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const ProfileEntry* entry : registry.entries) {
+      if (entry->GetNumCalls() == 0) {
+        continue;
+      }
+      ProfileTotals& totals = totals_by_name[entry->GetName()];
+      totals.name = entry->GetName();
+      totals.num_calls += entry->GetNumCalls();
+      totals.total_nanoseconds += entry->GetTotalNanoseconds();
+      totals.count += entry->GetCount();
+    }
+  }
+  if (totals_by_name.empty()) {
+    return "";
+  }
+
+  // Timers first (by total time), then counters (by count).
+  std::vector<ProfileTotals> timers;
+  std::vector<ProfileTotals> counters;
+  for (const auto& name_and_totals : totals_by_name) {
+    const ProfileTotals& totals = name_and_totals.second;
+    if (totals.total_nanoseconds > 0 || totals.count == 0) {
+      timers.push_back(totals);
+    } else {
+      counters.push_back(totals);
+    }
+  }
+  std::sort(timers.begin(), timers.end(),
+            [](const ProfileTotals& a, const ProfileTotals& b) {
+              return a.total_nanoseconds > b.total_nanoseconds;
+            });
+  std::sort(counters.begin(), counters.end(),
+            [](const ProfileTotals& a, const ProfileTotals& b) {
+              return a.count > b.count;
+            });
+
+  std::ostringstream report;
+  report << "Profile (inclusive times)" << std::endl;
+  report << std::left << std::setw(48) << "  Scope" << std::right
+         << std::setw(12) << "Calls" << std::setw(14) << "Total (ms)"
+         << std::setw(14) << "Mean (us)" << std::endl;
+  report << std::fixed << std::setprecision(3);
+  for (const ProfileTotals& totals : timers) {
+    const double total_milliseconds = totals.total_nanoseconds * 1.0e-6;
+    const double mean_microseconds =
+        totals.total_nanoseconds * 1.0e-3 / totals.num_calls;
+    report << std::left << std::setw(48) << ("  " + totals.name)
+           << std::right << std::setw(12) << totals.num_calls
+           << std::setw(14) << total_milliseconds
+           << std::setw(14) << mean_microseconds << std::endl;
+  }
+  if (!counters.empty()) {
+    report << std::left << std::setw(48) << "  Counter" << std::right
+           << std::setw(12) << "Calls" << std::setw(14) << "Total"
+           << std::endl;
+    for (const ProfileTotals& totals : counters) {
+      report << std::left << std::setw(48) << ("  " + totals.name)
+             << std::right << std::setw(12) << totals.num_calls
+             << std::setw(14) << totals.count << std::endl;
+    }
+  }
+  return report.str();
+}
+
+void ResetProfileEntries() {
+  ProfileRegistry& registry = GetProfileRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (ProfileEntry* entry : registry.entries) {
+    entry->Reset();
+  }
+}
+
+}  // namespace util
+}  // namespace super_resolution
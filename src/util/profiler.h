@@ -0,0 +1,140 @@
+// A lightweight profiler for production runs. PROFILE_SCOPE() times the
+// enclosing scope and PROFILE_COUNT() accumulates a counter, both under a
+// static name. Every call site keeps its own atomic totals, so the hot path is
+// a clock read and two atomic additions, with no locking. Use as follows:
+//   void ImageModel::ApplyToImage(...) const {
+//     PROFILE_SCOPE("ImageModel::ApplyToImage");
+//     ...
+//   }
+//   PROFILE_COUNT("VideoLoader frames decoded", 1);
+//   ...
+//   std::cout << util::GetProfileReport();
+//
+// The macros are compiled in only if SUPER_RESOLUTION_PROFILING is defined
+// (configure with cmake -DENABLE_PROFILING=ON). Otherwise they expand to
+// nothing and the report is empty.
+
+#ifndef SRC_UTIL_PROFILER_H_
+#define SRC_UTIL_PROFILER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace super_resolution {
+namespace util {
+
+// The totals of one profiled call site. Entries register themselves on
+// construction and must not be destroyed, so they should be static.
+class ProfileEntry {
+ public:
+  // The name must be a string literal (or otherwise outlive the program).
+  // Entries with the same name are merged in the report.
+  explicit ProfileEntry(const char* name);
+
+  // Adds one timed call of the given duration.
+  void AddTime(const int64_t nanoseconds) {
+    num_calls_.fetch_add(1, std::memory_order_relaxed);
+    total_nanoseconds_.fetch_add(nanoseconds, std::memory_order_relaxed);
+  }
+
+  // Adds the given amount to the counter.
+  void AddCount(const int64_t amount) {
+    num_calls_.fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  const char* GetName() const {
+    return name_;
+  }
+
+  int64_t GetNumCalls() const {
+    return num_calls_.load(std::memory_order_relaxed);
+  }
+
+  int64_t GetTotalNanoseconds() const {
+    return total_nanoseconds_.load(std::memory_order_relaxed);
+  }
+
+  int64_t GetCount() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  // Sets all totals back to zero.
+  void Reset();
+
+ private:
+  const char* name_;
+  std::atomic<int64_t> num_calls_;
+  std::atomic<int64_t> total_nanoseconds_;
+  std::atomic<int64_t> count_;
+};
+
+// Adds the time from its construction to its destruction to the entry.
+class ScopedProfileTimer {
+ public:
+  explicit ScopedProfileTimer(ProfileEntry* entry)
+      : entry_(entry), start_time_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedProfileTimer() {
+    const std::chrono::nanoseconds duration =
+        std::chrono::steady_clock::now() - start_time_;
+    entry_->AddTime(duration.count());
+  }
+
+ private:
+  ProfileEntry* entry_;
+  const std::chrono::steady_clock::time_point start_time_;
+};
+
+// Returns true if the PROFILE macros are compiled in.
+constexpr bool IsProfilingEnabled() {
+#ifdef SUPER_RESOLUTION_PROFILING
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Returns a table of all entries that were called, merged by name and sorted
+// by total time. Times are inclusive, so a scope's time includes the time of
+// the profiled scopes nested inside of it. Counters are listed after the
+// timers. Empty if nothing was profiled.
+std::string GetProfileReport();
+
+// Resets the totals of every entry (e.g. to skip a warm-up).
+void ResetProfileEntries();
+
+}  // namespace util
+}  // namespace super_resolution
+
+#define SUPER_RESOLUTION_PROFILE_CONCAT_INNER(a, b) a##b
+#define SUPER_RESOLUTION_PROFILE_CONCAT(a, b) \
+    SUPER_RESOLUTION_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef SUPER_RESOLUTION_PROFILING
+
+// Times the rest of the enclosing scope under the given name.
+#define PROFILE_SCOPE(name) \
+    static ::super_resolution::util::ProfileEntry \
+        SUPER_RESOLUTION_PROFILE_CONCAT(profile_entry_, __LINE__)(name); \
+    const ::super_resolution::util::ScopedProfileTimer \
+        SUPER_RESOLUTION_PROFILE_CONCAT(profile_timer_, __LINE__)( \
+            &SUPER_RESOLUTION_PROFILE_CONCAT(profile_entry_, __LINE__))
+
+// Adds the given amount to the counter with the given name.
+#define PROFILE_COUNT(name, amount) \
+    do { \
+      static ::super_resolution::util::ProfileEntry profile_entry(name); \
+      profile_entry.AddCount(amount); \
+    } while (false)
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(name, amount) do {} while (false)
+
+#endif  // SUPER_RESOLUTION_PROFILING
+
+#endif  // SRC_UTIL_PROFILER_H_
@@ -0,0 +1,227 @@
+#include "util/sparse_matrix.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "util/matrix_util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+
+SparseMatrix::SparseMatrix()
+    : num_rows_(0), num_cols_(0), row_offsets_(1, 0) {}
+
+SparseMatrix::SparseMatrix(
+    const int64_t num_rows,
+    const int64_t num_cols,
+    const std::vector<SparseMatrixEntry>& entries)
+    : num_rows_(num_rows), num_cols_(num_cols) {
+
+  CHECK_GE(num_rows, 0) << "The number of rows cannot be negative.";
+  CHECK_GE(num_cols, 0) << "The number of columns cannot be negative.";
+
+  // Bucket the entries by row (counting sort).
+  std::vector<int64_t> row_counts(num_rows + 1, 0);
+  for (const SparseMatrixEntry& entry : entries) {
+    CHECK(entry.row >= 0 && entry.row < num_rows)
+        << "Entry row " << entry.row << " is out of bounds.";
+    CHECK(entry.col >= 0 && entry.col < num_cols)
+        << "Entry column " << entry.col << " is out of bounds.";
+    row_counts[entry.row + 1]++;
+  }
+  for (int64_t row = 0; row < num_rows; ++row) {
+    row_counts[row + 1] += row_counts[row];
+  }
+  std::vector<std::pair<int64_t, double>> row_entries(entries.size());
+  std::vector<int64_t> next_position(row_counts.begin(), row_counts.end() - 1);
+  for (const SparseMatrixEntry& entry : entries) {
+    row_entries[next_position[entry.row]++] =
+        std::make_pair(entry.col, entry.value);
+  }
+
+  // Sort each row by column and sum duplicate entries.
+  row_offsets_.reserve(num_rows + 1);
+  row_offsets_.push_back(0);
+  column_indices_.reserve(entries.size());
+  values_.reserve(entries.size());
+  for (int64_t row = 0; row < num_rows; ++row) {
+    const auto row_begin = row_entries.begin() + row_counts[row];
+    const auto row_end = row_entries.begin() + row_counts[row + 1];
+    std::sort(row_begin, row_end);
+    const int64_t row_start = values_.size();
+    for (auto it = row_begin; it != row_end; ++it) {
+      if (static_cast<int64_t>(values_.size()) > row_start &&
+          column_indices_.back() == it->first) {
+        values_.back() += it->second;
+      } else {
+        column_indices_.push_back(it->first);
+        values_.push_back(it->second);
+      }
+    }
+    row_offsets_.push_back(values_.size());
+  }
+}
+
+SparseMatrix SparseMatrix::Identity(const int64_t size) {
+  std::vector<SparseMatrixEntry> entries;
+  entries.reserve(size);
+  for (int64_t i = 0; i < size; ++i) {
+    entries.emplace_back(i, i, 1.0);
+  }
+  return SparseMatrix(size, size, entries);
+}
+
+SparseMatrix SparseMatrix::FromDense(const cv::Mat& matrix) {
+  CHECK_EQ(matrix.channels(), 1) << "Only single-channel matrices are valid.";
+  cv::Mat dense_matrix;
+  matrix.convertTo(dense_matrix, kOpenCvMatrixType);
+  std::vector<SparseMatrixEntry> entries;
+  for (int row = 0; row < dense_matrix.rows; ++row) {
+    for (int col = 0; col < dense_matrix.cols; ++col) {
+      const double value = dense_matrix.at<double>(row, col);
+      if (value != 0.0) {
+        entries.emplace_back(row, col, value);
+      }
+    }
+  }
+  return SparseMatrix(dense_matrix.rows, dense_matrix.cols, entries);
+}
+
+cv::Mat SparseMatrix::ToDense() const {
+  cv::Mat dense_matrix =
+      cv::Mat::zeros(num_rows_, num_cols_, kOpenCvMatrixType);
+  for (int64_t row = 0; row < num_rows_; ++row) {
+    for (int64_t i = row_offsets_[row]; i < row_offsets_[row + 1]; ++i) {
+      dense_matrix.at<double>(row, column_indices_[i]) = values_[i];
+    }
+  }
+  return dense_matrix;
+}
+
+SparseMatrix SparseMatrix::Multiply(const SparseMatrix& other) const {
+  CHECK_EQ(num_cols_, other.num_rows_)
+      << "Matrix dimensions do not match for multiplication.";
+
+  // Gustavson's algorithm: each row of the product is accumulated in a dense
+  // row buffer, and the columns that were touched are tracked separately.
+  SparseMatrix product;
+  product.num_rows_ = num_rows_;
+  product.num_cols_ = other.num_cols_;
+  product.row_offsets_.reserve(num_rows_ + 1);
+  std::vector<double> row_values(other.num_cols_, 0.0);
+  std::vector<bool> is_column_used(other.num_cols_, false);
+  std::vector<int64_t> used_columns;
+  for (int64_t row = 0; row < num_rows_; ++row) {
+    used_columns.clear();
+    for (int64_t i = row_offsets_[row]; i < row_offsets_[row + 1]; ++i) {
+      const int64_t inner_index = column_indices_[i];
+      const double value = values_[i];
+      for (int64_t j = other.row_offsets_[inner_index];
+           j < other.row_offsets_[inner_index + 1]; ++j) {
+        const int64_t col = other.column_indices_[j];
+        if (!is_column_used[col]) {
+          is_column_used[col] = true;
+          used_columns.push_back(col);
+        }
+        row_values[col] += value * other.values_[j];
+      }
+    }
+    std::sort(used_columns.begin(), used_columns.end());
+    for (const int64_t col : used_columns) {
+      product.column_indices_.push_back(col);
+      product.values_.push_back(row_values[col]);
+      row_values[col] = 0.0;
+      is_column_used[col] = false;
+    }
+    product.row_offsets_.push_back(product.values_.size());
+  }
+  return product;
+}
+
+SparseMatrix SparseMatrix::Add(const SparseMatrix& other) const {
+  CHECK_EQ(num_rows_, other.num_rows_)
+      << "Matrix dimensions do not match for addition.";
+  CHECK_EQ(num_cols_, other.num_cols_)
+      << "Matrix dimensions do not match for addition.";
+
+  // The columns of every row are sorted, so the rows are merged directly.
+  SparseMatrix sum;
+  sum.num_rows_ = num_rows_;
+  sum.num_cols_ = num_cols_;
+  sum.row_offsets_.reserve(num_rows_ + 1);
+  sum.column_indices_.reserve(values_.size() + other.values_.size());
+  sum.values_.reserve(values_.size() + other.values_.size());
+  for (int64_t row = 0; row < num_rows_; ++row) {
+    int64_t i = row_offsets_[row];
+    int64_t j = other.row_offsets_[row];
+    const int64_t row_end = row_offsets_[row + 1];
+    const int64_t other_row_end = other.row_offsets_[row + 1];
+    while (i < row_end || j < other_row_end) {
+      if (j == other_row_end ||
+          (i < row_end && column_indices_[i] < other.column_indices_[j])) {
+        sum.column_indices_.push_back(column_indices_[i]);
+        sum.values_.push_back(values_[i++]);
+      } else if (i == row_end ||
+                 other.column_indices_[j] < column_indices_[i]) {
+        sum.column_indices_.push_back(other.column_indices_[j]);
+        sum.values_.push_back(other.values_[j++]);
+      } else {
+        sum.column_indices_.push_back(column_indices_[i]);
+        sum.values_.push_back(values_[i++] + other.values_[j++]);
+      }
+    }
+    sum.row_offsets_.push_back(sum.values_.size());
+  }
+  return sum;
+}
+
+SparseMatrix SparseMatrix::Transpose() const {
+  std::vector<SparseMatrixEntry> entries;
+  entries.reserve(values_.size());
+  for (int64_t row = 0; row < num_rows_; ++row) {
+    for (int64_t i = row_offsets_[row]; i < row_offsets_[row + 1]; ++i) {
+      entries.emplace_back(column_indices_[i], row, values_[i]);
+    }
+  }
+  return SparseMatrix(num_cols_, num_rows_, entries);
+}
+
+void SparseMatrix::MultiplyVector(const double* x, double* y) const {
+  CHECK_NOTNULL(x);
+  CHECK_NOTNULL(y);
+  for (int64_t row = 0; row < num_rows_; ++row) {
+    double sum = 0.0;
+    for (int64_t i = row_offsets_[row]; i < row_offsets_[row + 1]; ++i) {
+      sum += values_[i] * x[column_indices_[i]];
+    }
+    y[row] = sum;
+  }
+}
+
+void SparseMatrix::MultiplyTransposeVector(const double* x, double* y) const {
+  CHECK_NOTNULL(x);
+  CHECK_NOTNULL(y);
+  std::fill(y, y + num_cols_, 0.0);
+  AddMultiplyTransposeVector(x, y);
+}
+
+void SparseMatrix::AddMultiplyTransposeVector(
+    const double* x, double* y) const {
+
+  CHECK_NOTNULL(x);
+  CHECK_NOTNULL(y);
+  for (int64_t row = 0; row < num_rows_; ++row) {
+    for (int64_t i = row_offsets_[row]; i < row_offsets_[row + 1]; ++i) {
+      y[column_indices_[i]] += values_[i] * x[row];
+    }
+  }
+}
+
+}  // namespace util
+}  // namespace super_resolution
@@ -0,0 +1,112 @@
+// A sparse matrix in compressed sparse row (CSR) format. Image model operators
+// (see DegradationOperator::GetSparseOperatorMatrix()) only touch a few pixels
+// for every output pixel, so their matrices can be stored and multiplied for
+// realistic image sizes, where the num_pixels x num_pixels dense matrices
+// would not fit in memory.
+
+#ifndef SRC_UTIL_SPARSE_MATRIX_H_
+#define SRC_UTIL_SPARSE_MATRIX_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+namespace super_resolution {
+namespace util {
+
+// A single (row, col, value) entry used to build a SparseMatrix.
+struct SparseMatrixEntry {
+  SparseMatrixEntry(const int64_t row, const int64_t col, const double value)
+      : row(row), col(col), value(value) {}
+
+  int64_t row;
+  int64_t col;
+  double value;
+};
+
+class SparseMatrix {
+ public:
+  // Creates an empty 0 x 0 matrix.
+  SparseMatrix();
+
+  // Builds the matrix from the given entries, which can be in any order.
+  // Entries at the same position are summed. All entries must be within the
+  // given number of rows and columns.
+  SparseMatrix(
+      const int64_t num_rows,
+      const int64_t num_cols,
+      const std::vector<SparseMatrixEntry>& entries);
+
+  // Returns the size x size identity matrix.
+  static SparseMatrix Identity(const int64_t size);
+
+  // Returns the sparse version of the given dense (single-channel) matrix,
+  // keeping only its non-zero values.
+  static SparseMatrix FromDense(const cv::Mat& matrix);
+
+  // Returns the dense version of this matrix. Only use this for small
+  // matrices (e.g. in tests).
+  cv::Mat ToDense() const;
+
+  // Returns the matrix product this * other. The number of columns of this
+  // matrix must match the number of rows of the other matrix.
+  SparseMatrix Multiply(const SparseMatrix& other) const;
+
+  // Returns the sum this + other. Both matrices must have the same size.
+  SparseMatrix Add(const SparseMatrix& other) const;
+
+  // Returns the transpose of this matrix.
+  SparseMatrix Transpose() const;
+
+  // Computes y = A * x, where x has GetNumCols() values and y has
+  // GetNumRows() values.
+  void MultiplyVector(const double* x, double* y) const;
+
+  // Computes y = A' * x, where x has GetNumRows() values and y has
+  // GetNumCols() values.
+  void MultiplyTransposeVector(const double* x, double* y) const;
+
+  // Same as MultiplyTransposeVector(), but adds the product to the existing
+  // values of y, i.e. computes y += A' * x.
+  void AddMultiplyTransposeVector(const double* x, double* y) const;
+
+  int64_t GetNumRows() const {
+    return num_rows_;
+  }
+
+  int64_t GetNumCols() const {
+    return num_cols_;
+  }
+
+  int64_t GetNumNonZeros() const {
+    return values_.size();
+  }
+
+  // The CSR arrays: the entries of row i are at indices [row_offsets[i],
+  // row_offsets[i + 1]) of the column index and value arrays, sorted by
+  // column.
+  const std::vector<int64_t>& GetRowOffsets() const {
+    return row_offsets_;
+  }
+
+  const std::vector<int64_t>& GetColumnIndices() const {
+    return column_indices_;
+  }
+
+  const std::vector<double>& GetValues() const {
+    return values_;
+  }
+
+ private:
+  int64_t num_rows_;
+  int64_t num_cols_;
+  std::vector<int64_t> row_offsets_;
+  std::vector<int64_t> column_indices_;
+  std::vector<double> values_;
+};
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_SPARSE_MATRIX_H_
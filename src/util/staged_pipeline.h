@@ -0,0 +1,315 @@
+// A StagedPipeline runs a sequence of items (e.g. batch jobs) through a chain
+// of stages (e.g. load, preprocess, solve, save), with the stages working on
+// different items at the same time. Each stage has its own threads, and
+// bounded queues between the stages keep a fast stage from running more than
+// a few items ahead of the next one. The throughput of the pipeline is then
+// limited by its slowest stage instead of the sum of all stages, and the
+// memory by the number of items in flight. The queues alone allow about
+// queue_capacity + 1 items per stage, so the total number of items in flight
+// can also be bounded directly.
+//
+// Every stage receives the items in index order, so a stage with a single
+// thread processes them in order (which matters if it has side effects such
+// as writing a report). Stages with several threads may finish items out of
+// order, but the next stage still receives them in order.
+
+#ifndef SRC_UTIL_STAGED_PIPELINE_H_
+#define SRC_UTIL_STAGED_PIPELINE_H_
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "util/thread_pool.h"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+
+// The work done by one stage of a StagedPipeline on the item with the given
+// index. The first stage receives a default-constructed item. It is called
+// from the threads of the stage, so it must be safe to call concurrently if
+// the stage has more than one thread.
+template <typename T>
+using PipelineStageFunction = std::function<void(const int item_index, T*)>;
+
+template <typename T>
+struct PipelineStage {
+  // The name of the stage, for logging.
+  std::string name;
+
+  PipelineStageFunction<T> function;
+
+  // The number of threads that run this stage (0 = one per hardware thread).
+  // Stages that are themselves parallel (e.g. the solve) should usually have
+  // a single thread.
+  int num_threads = 1;
+};
+
+// The time spent by a stage over a whole Run().
+struct PipelineStageStatistics {
+  std::string name;
+
+  // The total time that the stage functions ran, summed over the threads of
+  // the stage. The stage with the most busy time per thread limits the
+  // throughput.
+  double busy_seconds = 0.0;
+
+  int num_threads = 1;
+};
+
+template <typename T>
+class StagedPipeline {
+ public:
+  // At most queue_capacity items wait in the queue in front of each stage
+  // (after the first), beyond the items that its threads are working on.
+  // queue_capacity must be at least 1.
+  //
+  // If max_num_items_in_flight is positive, the first stage does not start an
+  // item until fewer than that many items are in the pipeline, counting every
+  // item from the start of the first stage until the end of the last one.
+  StagedPipeline(
+      const std::vector<PipelineStage<T>>& stages,
+      const int queue_capacity,
+      const int max_num_items_in_flight = 0);
+
+  StagedPipeline(const StagedPipeline&) = delete;
+  StagedPipeline& operator = (const StagedPipeline&) = delete;
+
+  // Runs the items [0, num_items) through all stages and returns once the
+  // last stage finished every item. Items are destroyed after the last stage.
+  void Run(const int num_items);
+
+  // Returns the time spent by each stage in the last Run().
+  std::vector<PipelineStageStatistics> GetStageStatistics() const;
+
+ private:
+  // The items waiting for a stage, by item index. The threads of a stage
+  // claim the item indices in order, and an item is only admitted if it is
+  // less than queue_capacity items ahead of the next one to be claimed. The
+  // claimed items are therefore always admitted, so a stage can never wait
+  // for an item that is blocked behind a full queue.
+  struct StageQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::map<int, T> items;
+    int next_item_to_take = 0;  // The next index to be claimed.
+  };
+
+  // The loop run by each thread of the given stage.
+  void RunStage(const int stage_index, const int num_items);
+
+  // Waits until the item can be admitted into the queue of the given stage,
+  // and adds it.
+  void AddItem(const int stage_index, const int item_index, T item);
+
+  // Waits until the item can enter the pipeline without exceeding
+  // max_num_items_in_flight_.
+  void WaitToStartItem(const int item_index);
+
+  // Records that an item left the last stage.
+  void FinishItem();
+
+  // Takes the next item from the queue of the given stage, waiting for it if
+  // necessary. Returns false if all items were taken.
+  bool TakeItem(
+      const int stage_index,
+      const int num_items,
+      int* item_index,
+      T* item);
+
+  const std::vector<PipelineStage<T>> stages_;
+  const int queue_capacity_;
+  const int max_num_items_in_flight_;
+
+  // The number of items that left the last stage in the current Run(),
+  // protected by flight_mutex_.
+  std::mutex flight_mutex_;
+  std::condition_variable item_finished_;
+  int num_finished_items_ = 0;
+
+  // The queue in front of each stage. The queue of the first stage is not
+  // bounded and only hands out the item indices.
+  std::vector<std::unique_ptr<StageQueue>> queues_;
+
+  // The busy time of every stage, protected by statistics_mutex_.
+  mutable std::mutex statistics_mutex_;
+  std::vector<double> busy_seconds_;
+};
+
+template <typename T>
+StagedPipeline<T>::StagedPipeline(
+    const std::vector<PipelineStage<T>>& stages,
+    const int queue_capacity,
+    const int max_num_items_in_flight)
+    : stages_(stages),
+      queue_capacity_(queue_capacity),
+      max_num_items_in_flight_(max_num_items_in_flight),
+      busy_seconds_(stages.size(), 0.0) {
+
+  CHECK(!stages_.empty()) << "The pipeline has no stages.";
+  CHECK_GE(queue_capacity_, 1) << "The queues must hold at least one item.";
+  CHECK_GE(max_num_items_in_flight_, 0)
+      << "The number of items in flight cannot be negative.";
+  for (int i = 0; i < stages_.size(); ++i) {
+    CHECK(stages_[i].function) << "Stage " << stages_[i].name
+                               << " has no function.";
+  }
+}
+
+template <typename T>
+void StagedPipeline<T>::Run(const int num_items) {
+  CHECK_GE(num_items, 0) << "Number of items cannot be negative.";
+  queues_.clear();
+  for (int i = 0; i < stages_.size(); ++i) {
+    queues_.emplace_back(new StageQueue());
+  }
+  {
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    std::fill(busy_seconds_.begin(), busy_seconds_.end(), 0.0);
+  }
+  {
+    std::lock_guard<std::mutex> lock(flight_mutex_);
+    num_finished_items_ = 0;
+  }
+
+  std::vector<std::thread> threads;
+  for (int stage_index = 0; stage_index < stages_.size(); ++stage_index) {
+    // There is no point in having more threads than items that can be in
+    // the stage at the same time.
+    const int num_threads = std::min(
+        GetNumThreadsToUse(stages_[stage_index].num_threads),
+        std::max(std::min(num_items, queue_capacity_), 1));
+    for (int i = 0; i < num_threads; ++i) {
+      threads.push_back(std::thread(
+          &StagedPipeline<T>::RunStage, this, stage_index, num_items));
+    }
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+template <typename T>
+std::vector<PipelineStageStatistics>
+StagedPipeline<T>::GetStageStatistics() const {
+  std::lock_guard<std::mutex> lock(statistics_mutex_);
+  std::vector<PipelineStageStatistics> statistics(stages_.size());
+  for (int i = 0; i < stages_.size(); ++i) {
+    statistics[i].name = stages_[i].name;
+    statistics[i].busy_seconds = busy_seconds_[i];
+    statistics[i].num_threads = GetNumThreadsToUse(stages_[i].num_threads);
+  }
+  return statistics;
+}
+
+template <typename T>
+void StagedPipeline<T>::RunStage(const int stage_index, const int num_items) {
+  const bool is_last_stage = stage_index + 1 == stages_.size();
+  int item_index;
+  T item;
+  while (TakeItem(stage_index, num_items, &item_index, &item)) {
+    if (stage_index == 0) {
+      WaitToStartItem(item_index);
+    }
+    const auto start_time = std::chrono::steady_clock::now();
+    stages_[stage_index].function(item_index, &item);
+    const std::chrono::duration<double> elapsed_time =
+        std::chrono::steady_clock::now() - start_time;
+    {
+      std::lock_guard<std::mutex> lock(statistics_mutex_);
+      busy_seconds_[stage_index] += elapsed_time.count();
+    }
+    if (!is_last_stage) {
+      AddItem(stage_index + 1, item_index, std::move(item));
+    }
+    // The item is destroyed before it counts as finished, so that its memory
+    // is released before the next item may start.
+    item = T();
+    if (is_last_stage) {
+      FinishItem();
+    }
+  }
+}
+
+template <typename T>
+void StagedPipeline<T>::WaitToStartItem(const int item_index) {
+  if (max_num_items_in_flight_ <= 0) {
+    return;
+  }
+  // The items are started in index order, so the items in flight are those
+  // before this one that have not finished yet.
+  std::unique_lock<std::mutex> lock(flight_mutex_);
+  item_finished_.wait(lock, [this, item_index]() {
+    return item_index - num_finished_items_ < max_num_items_in_flight_;
+  });
+}
+
+template <typename T>
+void StagedPipeline<T>::FinishItem() {
+  {
+    std::lock_guard<std::mutex> lock(flight_mutex_);
+    num_finished_items_++;
+  }
+  item_finished_.notify_all();
+}
+
+template <typename T>
+void StagedPipeline<T>::AddItem(
+    const int stage_index, const int item_index, T item) {
+
+  StageQueue& queue = *queues_[stage_index];
+  {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    queue.changed.wait(lock, [this, &queue, item_index]() {
+      return item_index < queue.next_item_to_take + queue_capacity_;
+    });
+    queue.items.insert(std::make_pair(item_index, std::move(item)));
+  }
+  queue.changed.notify_all();
+}
+
+template <typename T>
+bool StagedPipeline<T>::TakeItem(
+    const int stage_index,
+    const int num_items,
+    int* item_index,
+    T* item) {
+
+  StageQueue& queue = *queues_[stage_index];
+  {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (queue.next_item_to_take >= num_items) {
+      return false;
+    }
+    // The index is claimed before waiting for the item, so that the other
+    // threads of the stage claim the following items. The first stage
+    // creates its items, so it only claims an index, and is bounded by the
+    // queue of the second stage instead.
+    *item_index = queue.next_item_to_take++;
+    if (stage_index > 0) {
+      const int claimed_item_index = *item_index;
+      queue.changed.wait(lock, [&queue, claimed_item_index]() {
+        return queue.items.count(claimed_item_index) > 0;
+      });
+      *item = std::move(queue.items[claimed_item_index]);
+      queue.items.erase(claimed_item_index);
+    }
+  }
+  queue.changed.notify_all();
+  return true;
+}
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_STAGED_PIPELINE_H_
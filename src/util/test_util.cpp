@@ -1,9 +1,15 @@
 #include "util/test_util.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <limits>
+#include <random>
+#include <vector>
 
 #include "image/image_data.h"
+#include "optimization/objective_function.h"
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
@@ -133,5 +139,64 @@ bool AreImagesEqual(
   return true;
 }
 
+double ComputeDirectionalGradientError(
+    const ObjectiveTerm& objective_term,
+    const double* point,
+    const int64_t num_parameters,
+    const int num_directions,
+    const double step,
+    const unsigned seed) {
+
+  CHECK_NOTNULL(point);
+  CHECK_GT(num_parameters, 0);
+  CHECK_GT(step, 0.0);
+
+  // Terms add their gradient to the given one.
+  std::vector<double> gradient(num_parameters, 0.0);
+  objective_term.Compute(point, gradient.data());
+
+  std::mt19937 random_engine(seed);
+  std::normal_distribution<double> distribution;
+  std::vector<double> direction(num_parameters);
+  std::vector<double> shifted_point(num_parameters);
+  double max_error = 0.0;
+  for (int direction_index = 0;
+       direction_index < num_directions;
+       ++direction_index) {
+    double squared_norm = 0.0;
+    for (int64_t i = 0; i < num_parameters; ++i) {
+      direction[i] = distribution(random_engine);
+      squared_norm += direction[i] * direction[i];
+    }
+    const double inverse_norm = 1.0 / std::sqrt(squared_norm);
+    double analytical_derivative = 0.0;
+    for (int64_t i = 0; i < num_parameters; ++i) {
+      direction[i] *= inverse_norm;
+      analytical_derivative += gradient[i] * direction[i];
+    }
+
+    for (int64_t i = 0; i < num_parameters; ++i) {
+      shifted_point[i] = point[i] + step * direction[i];
+    }
+    const double forward_cost =
+        objective_term.Compute(shifted_point.data(), nullptr);
+    for (int64_t i = 0; i < num_parameters; ++i) {
+      shifted_point[i] = point[i] - step * direction[i];
+    }
+    const double backward_cost =
+        objective_term.Compute(shifted_point.data(), nullptr);
+    const double numerical_derivative =
+        (forward_cost - backward_cost) / (2.0 * step);
+
+    const double error =
+        std::abs(analytical_derivative - numerical_derivative) /
+        std::max({1.0,
+                  std::abs(analytical_derivative),
+                  std::abs(numerical_derivative)});
+    max_error = std::max(max_error, error);
+  }
+  return max_error;
+}
+
 }  // namespace test
 }  // namespace super_resolution
@@ -3,7 +3,10 @@
 #ifndef SRC_UTIL_TEST_UTIL_H_
 #define SRC_UTIL_TEST_UTIL_H_
 
+#include <cstdint>
+
 #include "image/image_data.h"
+#include "optimization/objective_function.h"
 
 #include "opencv2/core/core.hpp"
 
@@ -35,6 +38,27 @@ bool AreImagesEqual(
     const ImageData& image2,
     const double diff_tolerance = 0.0);
 
+// Checks the analytical gradient g of the given objective term at the given
+// point against central finite differences along num_directions random unit
+// directions d. For each direction, the directional derivative g'd is
+// compared with (f(x + step * d) - f(x - step * d)) / (2 * step). This costs
+// one evaluation with the gradient and two cost evaluations per direction
+// (instead of two per parameter), which is cheap enough to check every
+// kernel implementation on realistic image sizes. A wrong gradient is caught
+// by any random direction with probability 1.
+//
+// Returns the largest error over all directions, relative to the larger
+// magnitude of the two derivatives but at least 1 (so that derivatives close
+// to zero are compared absolutely). The directions are reproducible for a
+// given seed.
+double ComputeDirectionalGradientError(
+    const ObjectiveTerm& objective_term,
+    const double* point,
+    const int64_t num_parameters,
+    const int num_directions = 3,
+    const double step = 1.0e-6,
+    const unsigned seed = 0);
+
 }  // namespace test
 }  // namespace super_resolution
 
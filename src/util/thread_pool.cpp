@@ -0,0 +1,375 @@
+#include "util/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "util/memory_accounting.h"
+#include "util/numa.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+// The maximum number of threads, or 0 for the number of hardware threads.
+std::atomic<int> max_num_threads(0);
+
+// Returns the number of hardware threads, which is at least 1.
+int GetNumHardwareThreads() {
+  // hardware_concurrency() may return 0 if the value is not computable.
+  const int num_hardware_threads = std::thread::hardware_concurrency();
+  return std::max(num_hardware_threads, 1);
+}
+
+// Shared state of a single ParallelFor call. Runners hold a shared pointer to
+// it, so runners which only start after the call has returned can still
+// safely see that there is no work left.
+struct ParallelForState {
+  ParallelForState(
+      const int num_tasks,
+      const std::function<void(const int)>& function,
+      const std::shared_ptr<ParallelForState>& parent)
+      : num_tasks(num_tasks),
+        function(function),
+        parent(parent),
+        memory_tag(GetCurrentMemoryTag()),
+        next_task_index(0),
+        num_tasks_completed(0) {}
+
+  // Returns true if this is the given call, or a call nested in its tasks.
+  bool IsWithin(const ParallelForState* ancestor) const {
+    for (const ParallelForState* state = this;
+         state != nullptr;
+         state = state->parent.get()) {
+      if (state == ancestor) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const int num_tasks;
+  const std::function<void(const int)> function;
+
+  // The call whose task made this call, or null if it was not nested.
+  const std::shared_ptr<ParallelForState> parent;
+
+  // The memory tag of the calling thread, which the tasks are run with (see
+  // ScopedMemoryTag).
+  const MemoryTag memory_tag;
+
+  // The next task index to be claimed by a runner.
+  std::atomic<int> next_task_index;
+
+  // Counts finished tasks. The ParallelFor caller waits until all are done.
+  std::atomic<int> num_tasks_completed;
+};
+
+// The ParallelFor call whose task the current thread is running, if any.
+thread_local const std::shared_ptr<ParallelForState>* current_parallel_for =
+    nullptr;
+
+// The index of the scheduler worker that is the current thread, or -1 if the
+// thread is not a worker.
+thread_local int scheduler_worker_index = -1;
+
+// The library-wide scheduler. Its workers run queued units of work, and the
+// threads waiting in ParallelFor() run queued work as well until their own
+// tasks are done. The scheduler is created on first use and never destroyed,
+// so it is safe to use during static destruction.
+class TaskScheduler {
+ public:
+  static TaskScheduler* Get() {
+    static TaskScheduler* scheduler = new TaskScheduler();
+    return scheduler;
+  }
+
+  // Starts or stops workers until there are the given number of them.
+  // Workers that are running work stop once they are done with it.
+  void SetNumWorkers(const int num_workers) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    target_num_workers_ = num_workers;
+    while (num_running_workers_ < target_num_workers_) {
+      num_running_workers_++;
+      std::thread(&TaskScheduler::RunWorker, this).detach();
+    }
+    lock.unlock();
+    work_available_.notify_all();
+  }
+
+  // Returns the number of workers once pending changes are done.
+  int GetNumWorkers() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return target_num_workers_;
+  }
+
+  // Adds a unit of work of the given ParallelFor call to the queue and wakes
+  // up the threads that may run it.
+  void Schedule(
+      std::function<void()> work, const ParallelForState* parallel_for) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_queue_.push_back({std::move(work), parallel_for});
+    }
+    // Waiting callers only run some of the work (see RunUntil()), so one
+    // notification could wake a caller that leaves the work to the workers.
+    work_available_.notify_all();
+  }
+
+  // Runs queued work of the given ParallelFor call and of the calls nested in
+  // its tasks until is_done() returns true. Other work is left to the
+  // workers, so a waiting caller never picks up unrelated (possibly long)
+  // work that would delay its return. The predicate is checked with the
+  // scheduler mutex held, and NotifyAll() must be called after it becomes
+  // true.
+  void RunUntil(
+      const std::function<bool()>& is_done,
+      const ParallelForState* parallel_for) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!is_done()) {
+      auto work_item = std::find_if(
+          work_queue_.begin(),
+          work_queue_.end(),
+          [parallel_for](const WorkItem& item) {
+            return item.parallel_for->IsWithin(parallel_for);
+          });
+      if (work_item == work_queue_.end()) {
+        work_available_.wait(lock);
+        continue;
+      }
+      std::function<void()> work = std::move(work_item->work);
+      work_queue_.erase(work_item);
+      lock.unlock();
+      work();
+      lock.lock();
+    }
+  }
+
+  // Wakes up all waiting threads, e.g. after a ParallelFor() call is done.
+  void NotifyAll() {
+    // Locking makes sure that a thread that just checked its predicate is
+    // already waiting, so the notification is not lost.
+    { std::unique_lock<std::mutex> lock(mutex_); }
+    work_available_.notify_all();
+  }
+
+ private:
+  TaskScheduler() {
+    SetNumWorkers(GetMaxNumThreads() - 1);
+  }
+
+  // The loop run by each worker thread, which pulls and runs queued work
+  // until there are more workers than needed.
+  void RunWorker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    scheduler_worker_index = next_worker_index_++;
+    while (true) {
+      work_available_.wait(lock, [this]() {
+        return !work_queue_.empty() ||
+            num_running_workers_ > target_num_workers_;
+      });
+      if (num_running_workers_ > target_num_workers_) {
+        num_running_workers_--;
+        return;
+      }
+      std::function<void()> work = std::move(work_queue_.front().work);
+      work_queue_.pop_front();
+      lock.unlock();
+      work();
+      lock.lock();
+    }
+  }
+
+  // A unit of work and the ParallelFor call that it belongs to. The call's
+  // state outlives the work, since the work holds a pointer to it.
+  struct WorkItem {
+    std::function<void()> work;
+    const ParallelForState* parallel_for;
+  };
+
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+
+  // Queued units of work, protected by mutex_.
+  std::deque<WorkItem> work_queue_;
+
+  // The number of worker threads that are running and that should be
+  // running, protected by mutex_.
+  int num_running_workers_ = 0;
+  int target_num_workers_ = 0;
+
+  // The index of the next worker that starts, protected by mutex_.
+  int next_worker_index_ = 0;
+};
+
+// Claims and runs tasks until none are left, and wakes up the ParallelFor
+// caller if this finished the last task. The tasks are run with the memory tag
+// of the caller, whichever thread runs them.
+void RunTasks(const std::shared_ptr<ParallelForState>& state) {
+  const ScopedMemoryTag memory_tag(state->memory_tag);
+  int num_tasks_run = 0;
+  while (true) {
+    const int task_index = state->next_task_index++;
+    if (task_index >= state->num_tasks) {
+      break;
+    }
+    const std::shared_ptr<ParallelForState>* outer_parallel_for =
+        current_parallel_for;
+    current_parallel_for = &state;
+    state->function(task_index);
+    current_parallel_for = outer_parallel_for;
+    num_tasks_run++;
+  }
+  if (num_tasks_run > 0 &&
+      (state->num_tasks_completed += num_tasks_run) == state->num_tasks) {
+    TaskScheduler::Get()->NotifyAll();
+  }
+}
+
+}  // namespace
+
+void SetMaxNumThreads(const int num_threads) {
+  max_num_threads = std::max(num_threads, 0);
+  const int num_threads_to_use = GetMaxNumThreads();
+  cv::setNumThreads(num_threads_to_use);
+  TaskScheduler::Get()->SetNumWorkers(num_threads_to_use - 1);
+  LOG(INFO) << "Using at most " << num_threads_to_use << " threads.";
+}
+
+int GetMaxNumThreads() {
+  const int num_threads = max_num_threads;
+  return (num_threads > 0) ? num_threads : GetNumHardwareThreads();
+}
+
+int GetNumThreadsToUse(const int requested_num_threads) {
+  if (requested_num_threads > 0) {
+    return requested_num_threads;
+  }
+  return GetMaxNumThreads();
+}
+
+ThreadPool::ThreadPool(const int num_threads)
+    : num_threads_(GetNumThreadsToUse(num_threads)) {}
+
+void ThreadPool::ParallelFor(
+    const int num_tasks, const std::function<void(const int)>& function) {
+
+  CHECK_GE(num_tasks, 0) << "Number of tasks cannot be negative.";
+  if (num_tasks == 0) {
+    return;
+  }
+
+  // A single task is just run directly.
+  if (num_tasks == 1) {
+    function(0);
+    return;
+  }
+
+  // One runner per allowed worker (at most one per task, and no more than
+  // the scheduler has). The calling thread is an additional runner, so one
+  // fewer is scheduled.
+  TaskScheduler* scheduler = TaskScheduler::Get();
+  const int num_runners = std::min(
+      std::min(GetNumThreads(), num_tasks - 1), scheduler->GetNumWorkers());
+  if (num_runners <= 0) {
+    for (int i = 0; i < num_tasks; ++i) {
+      function(i);
+    }
+    return;
+  }
+
+  std::shared_ptr<ParallelForState> state(new ParallelForState(
+      num_tasks,
+      function,
+      (current_parallel_for != nullptr) ?
+          *current_parallel_for : std::shared_ptr<ParallelForState>()));
+  for (int i = 0; i < num_runners; ++i) {
+    scheduler->Schedule([state]() { RunTasks(state); }, state.get());
+  }
+  RunTasks(state);
+
+  // Help with the queued work of this call (e.g. the runners of nested calls
+  // made by the tasks still running) until all tasks are done.
+  scheduler->RunUntil(
+      [&state]() {
+        return state->num_tasks_completed == state->num_tasks;
+      },
+      state.get());
+}
+
+void ThreadPool::ParallelForOnNumaNodes(
+    const int num_tasks, const std::function<void(const int)>& function) {
+
+  if (!IsNumaPlacementEnabled()) {
+    ParallelFor(num_tasks, function);
+    return;
+  }
+
+  // The blocks of each node are the contiguous range [node_block_starts[node],
+  // node_block_starts[node + 1]), which its own counter hands out. Nodes
+  // without blocks have empty ranges.
+  const int num_nodes = GetNumNumaNodes();
+  std::vector<int> node_block_starts(num_nodes + 1, num_tasks);
+  for (int block_index = num_tasks - 1; block_index >= 0; --block_index) {
+    node_block_starts[GetBlockNumaNode(block_index, num_tasks)] = block_index;
+  }
+  for (int node = num_nodes - 1; node >= 0; --node) {
+    node_block_starts[node] =
+        std::min(node_block_starts[node], node_block_starts[node + 1]);
+  }
+  std::unique_ptr<std::atomic<int>[]> next_node_blocks(
+      new std::atomic<int>[num_nodes]);
+  for (int node = 0; node < num_nodes; ++node) {
+    next_node_blocks[node] = node_block_starts[node];
+  }
+
+  // Workers are pinned to the nodes round robin when they first run a block,
+  // and never rebound. Every task runs one block, taken from the node of its
+  // thread first and from the other nodes once those are all taken, so the
+  // tasks run every block exactly once.
+  ParallelFor(num_tasks, [&](const int task_index) {
+    if (scheduler_worker_index >= 0 && GetThreadNumaNode() < 0) {
+      PinThreadToNumaNode(scheduler_worker_index % num_nodes);
+    }
+    const int thread_node = std::max(GetThreadNumaNode(), 0);
+    for (int i = 0; i < num_nodes; ++i) {
+      const int node = (thread_node + i) % num_nodes;
+      const int block_index = next_node_blocks[node]++;
+      if (block_index < node_block_starts[node + 1]) {
+        function(block_index);
+        return;
+      }
+    }
+  });
+}
+
+void RunParallelFor(
+    const int num_threads,
+    const int num_tasks,
+    const std::function<void(const int)>& function) {
+
+  const int num_threads_to_use = GetNumThreadsToUse(num_threads);
+  if (num_threads_to_use <= 1) {
+    for (int task_index = 0; task_index < num_tasks; ++task_index) {
+      function(task_index);
+    }
+    return;
+  }
+  // The calling thread also runs tasks, so it is not included.
+  ThreadPool thread_pool(num_threads_to_use - 1);
+  thread_pool.ParallelFor(num_tasks, function);
+}
+
+}  // namespace util
+}  // namespace super_resolution
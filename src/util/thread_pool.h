@@ -0,0 +1,91 @@
+// Parallel loops for running independent pieces of work. Work is submitted as
+// a range of task indices with ThreadPool::ParallelFor(), which blocks until
+// every task in the range has finished.
+//
+// All ThreadPools share the workers of a single library-wide task scheduler,
+// whose size is capped by SetMaxNumThreads(). A ThreadPool only limits how
+// many of the shared workers a ParallelFor call may use, so independent
+// parallel features (e.g. channel splits that each evaluate a parallel data
+// term) never start more threads than the cap. Threads that wait for their
+// tasks to finish run the queued tasks of their own call (including the calls
+// nested in its tasks) in the meantime, so nested parallel regions keep all
+// workers busy instead of blocking them, and a waiting thread never picks up
+// unrelated work that would delay its return.
+
+#ifndef SRC_UTIL_THREAD_POOL_H_
+#define SRC_UTIL_THREAD_POOL_H_
+
+#include <functional>
+
+namespace super_resolution {
+namespace util {
+
+// Sets the maximum number of threads that run library work at the same time,
+// including the calling threads. Set to 0 to use one thread per hardware
+// thread (the default). OpenCV's internal threading is set to the same cap,
+// and since OpenCV runs functions that are called while its own threads are
+// busy serially, the two never run more than about twice the cap together.
+// This can be called at any time; lowering the cap stops idle workers.
+void SetMaxNumThreads(const int max_num_threads);
+
+// Returns the maximum number of threads (see SetMaxNumThreads()).
+int GetMaxNumThreads();
+
+// Returns the number of threads to use given a requested number of threads.
+// If the requested number is 0 (or negative), the maximum number of threads
+// (by default the number of hardware threads) is returned instead. The
+// result is always at least 1.
+int GetNumThreadsToUse(const int requested_num_threads);
+
+class ThreadPool {
+ public:
+  // Allows the ParallelFor calls of this pool to use up to the given number
+  // of the shared worker threads (in addition to the calling thread). If
+  // num_threads is 0, the limit is the maximum number of threads. No threads
+  // are started by the pool itself.
+  explicit ThreadPool(const int num_threads);
+
+  // Runs function(task_index) for every task_index in [0, num_tasks) and
+  // returns once all of them are complete. The calling thread also runs tasks
+  // while it waits, so ParallelFor can safely be called from inside another
+  // ParallelFor task without deadlocking.
+  //
+  // The order in which tasks are run is not defined. For deterministic
+  // results, each task should write its output to its own location which is
+  // then combined in task order after ParallelFor returns.
+  //
+  // The tasks record the memory that they allocate under the memory tag of
+  // the calling thread (see util::ScopedMemoryTag), even if a worker thread
+  // runs them.
+  void ParallelFor(
+      const int num_tasks, const std::function<void(const int)>& function);
+
+  // Same as ParallelFor(), but for tasks that each work on one of num_tasks
+  // contiguous blocks of NUMA-placed buffers (see util/numa.h). If NUMA
+  // placement is enabled, the thread running a task is bound to the NUMA node
+  // that owns its block for the duration of the task.
+  void ParallelForOnNumaNodes(
+      const int num_tasks, const std::function<void(const int)>& function);
+
+  // Returns the maximum number of worker threads used by the pool.
+  int GetNumThreads() const {
+    return num_threads_;
+  }
+
+ private:
+  const int num_threads_;
+};
+
+// Runs function(task_index) for every task_index in [0, num_tasks) on up to
+// num_threads threads, including the calling thread (0 = the maximum number
+// of threads). With a single thread, the tasks are run in order on the
+// calling thread without a pool.
+void RunParallelFor(
+    const int num_threads,
+    const int num_tasks,
+    const std::function<void(const int)>& function);
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_THREAD_POOL_H_
@@ -2,17 +2,44 @@
 
 #include <dirent.h>
 
+#include <cstdint>
 #include <iostream>
 #include <string>
 #include <vector>
 
 #include "image/image_data.h"
+#include "util/aligned_allocator.h"
+#include "util/numa.h"
+#include "util/thread_pool.h"
+#include "util/vector_kernels.h"
 
 #include "opencv2/core/core.hpp"
 
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
+DEFINE_int32(max_num_threads, 0,
+    "Maximum number of threads running library work at the same time, "
+    "including OpenCV's (0 = all hardware threads).");
+DEFINE_bool(use_aligned_allocator, false,
+    "Allocate all image buffers aligned to 64 bytes.");
+DEFINE_bool(track_image_memory, false,
+    "Record the image buffers in the memory by subsystem (see "
+    "--print_profile and --solver_telemetry_path). Implies "
+    "--use_aligned_allocator.");
+DEFINE_string(huge_pages, "none",
+    "Back image buffers of at least --huge_page_threshold_mb with "
+    "'transparent' or 'explicit' (reserved pool) huge pages. Implies "
+    "--use_aligned_allocator.");
+DEFINE_double(huge_page_threshold_mb, 4.0,
+    "The smallest image buffer (in MB) that is backed by huge pages.");
+DEFINE_bool(numa_placement, false,
+    "On multi-socket hosts, place each block of the parallel solver buffers "
+    "on the NUMA node of the threads that process it.");
+DEFINE_string(simd_level, "",
+    "Force the instruction set of the vectorized kernels ('baseline', 'sse4', "
+    "'avx2' or 'avx512'). By default, the best one the CPU supports is used.");
+
 namespace super_resolution {
 namespace util {
 namespace {
@@ -33,6 +60,33 @@ void InitApp(int argc, char** argv, const std::string& usage_message) {
   FLAGS_logtostderr = true;
 
   LOG(INFO) << "Running with OpenCV version " << CV_VERSION << ".";
+
+  // The allocator is set before any images are allocated.
+  AlignedMatAllocatorOptions allocator_options;
+  CHECK(ParseHugePageMode(FLAGS_huge_pages, &allocator_options.huge_page_mode))
+      << "Unknown huge page mode: " << FLAGS_huge_pages;
+  allocator_options.huge_page_threshold_bytes =
+      static_cast<int64_t>(FLAGS_huge_page_threshold_mb * 1024 * 1024);
+  if (FLAGS_use_aligned_allocator || FLAGS_track_image_memory ||
+      allocator_options.huge_page_mode != HUGE_PAGES_NONE) {
+    SetDefaultMatAllocator(allocator_options);
+    LOG(INFO) << "Using the aligned image allocator with huge pages: "
+              << FLAGS_huge_pages << ".";
+  }
+
+  SetMaxNumThreads(FLAGS_max_num_threads);
+  SetNumaPlacement(FLAGS_numa_placement);
+  if (FLAGS_numa_placement) {
+    LOG(INFO) << "NUMA placement is "
+              << (IsNumaPlacementEnabled() ? "enabled" : "disabled")
+              << " over " << GetNumNumaNodes() << " NUMA node(s).";
+  }
+  if (!FLAGS_simd_level.empty()) {
+    SimdLevel simd_level;
+    CHECK(ParseSimdLevel(FLAGS_simd_level, &simd_level))
+        << "Unknown SIMD level: " << FLAGS_simd_level;
+    SetSimdLevel(simd_level);
+  }
 }
 
 std::string GetRootCodeDirectory() {
@@ -78,14 +132,15 @@ std::vector<std::string> ListFilesInDirectory(const std::string& directory) {
   return list_of_files;
 }
 
-int GetPixelIndex(
+int64_t GetPixelIndex(
     const cv::Size& image_size,
     const int channel,
     const int row,
     const int col) {
 
-  const int channel_index = channel * (image_size.width * image_size.height);
-  return channel_index + (row * image_size.width + col);
+  const int64_t width = image_size.width;
+  const int64_t channel_index = channel * (width * image_size.height);
+  return channel_index + (row * width + col);
 }
 
 }  // namespace util
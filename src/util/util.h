@@ -3,6 +3,7 @@
 #ifndef SRC_UTIL_UTIL_H_
 #define SRC_UTIL_UTIL_H_
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -14,7 +15,10 @@ namespace util {
 constexpr char kCodeVersion[] = "0.1 (dev)";
 
 // Initializes the app. Processes all of the command line arguments with gflags
-// and initializes logging with glog. Sets the usage message and app version.
+// and initializes logging with glog. Sets the usage message and app version,
+// installs the aligned image allocator if requested, caps the number of
+// library threads to --max_num_threads, and applies --numa_placement and
+// --simd_level.
 void InitApp(int argc, char** argv, const std::string& usage_message = "");
 
 // Returns the root directory where this project was compiled. This uses the
@@ -38,8 +42,10 @@ std::vector<std::string> ListFilesInDirectory(const std::string& directory);
 
 // Returns the index into a pixel array given its channel (band), row, and
 // column coordinates. This assumes the standard channel-row-col ordering on an
-// array containing image data.
-int GetPixelIndex(
+// array containing image data. The index is computed in 64-bit arithmetic, so
+// it is valid for arrays with more than 2^31 values (e.g. large hyperspectral
+// images).
+int64_t GetPixelIndex(
     const cv::Size& image_size,
     const int channel,
     const int row,
@@ -0,0 +1,524 @@
+#include "util/vector_kernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "glog/logging.h"
+
+// The x86-64 kernels are compiled for each instruction set level with target
+// attributes and selected with CPUID at runtime.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SUPER_RESOLUTION_X86_DISPATCH
+#endif
+
+// Forces the loops to be inlined into the kernels of each level. Compilers
+// without the attribute only get the hint, and only build the baseline.
+#ifdef __GNUC__
+#define SUPER_RESOLUTION_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define SUPER_RESOLUTION_ALWAYS_INLINE inline
+#endif
+
+namespace super_resolution {
+namespace util {
+namespace {
+
+// The loops of the kernels. They are always inlined into the versions
+// compiled for each level, so that they are vectorized for that level.
+
+SUPER_RESOLUTION_ALWAYS_INLINE void LinearCombinationLoop(
+    const int64_t num_values,
+    const double a,
+    const double* x,
+    const double b,
+    const double* y,
+    double* out) {
+
+  for (int64_t i = 0; i < num_values; ++i) {
+    out[i] = a * x[i] + b * y[i];
+  }
+}
+
+SUPER_RESOLUTION_ALWAYS_INLINE double DotProductLoop(
+    const int64_t num_values, const double* x, const double* y) {
+
+  double sum = 0.0;
+  for (int64_t i = 0; i < num_values; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+// The observation check is outside of the loops so that each loop has no
+// branches.
+template <typename PixelType>
+SUPER_RESOLUTION_ALWAYS_INLINE double ComputeWeightedResidualsLoop(
+    const int64_t num_values,
+    const PixelType* observation,
+    const double weight,
+    PixelType* degraded) {
+
+  double residual_sum = 0.0;
+  if (observation == nullptr) {
+    for (int64_t i = 0; i < num_values; ++i) {
+      const double residual = static_cast<double>(degraded[i]);
+      residual_sum += residual * residual;
+      degraded[i] = static_cast<PixelType>(weight * residual);
+    }
+  } else {
+    for (int64_t i = 0; i < num_values; ++i) {
+      const double residual = static_cast<double>(degraded[i]) -
+          static_cast<double>(observation[i]);
+      residual_sum += residual * residual;
+      degraded[i] = static_cast<PixelType>(weight * residual);
+    }
+  }
+  return residual_sum;
+}
+
+// Reinterprets the bits of a float as an integer and back.
+SUPER_RESOLUTION_ALWAYS_INLINE uint32_t FloatToBits(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+SUPER_RESOLUTION_ALWAYS_INLINE float BitsToFloat(const uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Converts an IEEE half precision value to single precision without
+// branches, so that the loops that decode observations are vectorized.
+SUPER_RESOLUTION_ALWAYS_INLINE float DecodeHalfInline(
+    const uint16_t half) {
+
+  // Move the exponent and mantissa into place and rebias the exponent from
+  // 15 to 127. Infinities and NaNs need another rebias to the maximum
+  // exponent, and subnormals are renormalized by subtracting 2^-14.
+  const uint32_t kHalfExponentMask = 0x7c00u << 13;
+  const uint32_t magnitude = static_cast<uint32_t>(half & 0x7fffu) << 13;
+  const uint32_t exponent = magnitude & kHalfExponentMask;
+  uint32_t bits = magnitude + (112u << 23);
+  bits += (exponent == kHalfExponentMask) ? (112u << 23) : 0u;
+  bits += (exponent == 0u) ? (1u << 23) : 0u;
+  const float renormalization =
+      (exponent == 0u) ? BitsToFloat(113u << 23) : 0.0f;
+  const float value = BitsToFloat(bits) - renormalization;
+  return BitsToFloat(
+      FloatToBits(value) | (static_cast<uint32_t>(half & 0x8000u) << 16));
+}
+
+// Same as ComputeWeightedResidualsLoop() with an observation that is stored
+// as 16-bit codes and decoded by the given function.
+template <typename PixelType, typename DecodeFunction>
+SUPER_RESOLUTION_ALWAYS_INLINE double ComputeEncodedResidualsLoop(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const DecodeFunction& decode,
+    const double weight,
+    PixelType* degraded) {
+
+  double residual_sum = 0.0;
+  for (int64_t i = 0; i < num_values; ++i) {
+    const double residual =
+        static_cast<double>(degraded[i]) - decode(observation[i]);
+    residual_sum += residual * residual;
+    degraded[i] = static_cast<PixelType>(weight * residual);
+  }
+  return residual_sum;
+}
+
+template <typename PixelType>
+SUPER_RESOLUTION_ALWAYS_INLINE double ComputeHalfResidualsLoop(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const double weight,
+    PixelType* degraded) {
+
+  return ComputeEncodedResidualsLoop(
+      num_values,
+      observation,
+      [](const uint16_t code) {
+        return static_cast<double>(DecodeHalfInline(code));
+      },
+      weight,
+      degraded);
+}
+
+template <typename PixelType>
+SUPER_RESOLUTION_ALWAYS_INLINE double ComputeQuantizedResidualsLoop(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const double scale,
+    const double offset,
+    const double weight,
+    PixelType* degraded) {
+
+  return ComputeEncodedResidualsLoop(
+      num_values,
+      observation,
+      [scale, offset](const uint16_t code) {
+        return scale * static_cast<double>(code) + offset;
+      },
+      weight,
+      degraded);
+}
+
+// The comparisons are counted as 0 or 1 and the extremes are selected without
+// branches, so the loop vectorizes.
+template <typename PixelType>
+SUPER_RESOLUTION_ALWAYS_INLINE void SummarizeValuesLoop(
+    const int64_t num_values,
+    const PixelType* values,
+    ValueSummary* summary) {
+
+  int64_t num_negative_values = 0;
+  int64_t num_over_one_values = 0;
+  PixelType min_value = values[0];
+  PixelType max_value = values[0];
+  for (int64_t i = 0; i < num_values; ++i) {
+    const PixelType value = values[i];
+    num_negative_values += (value < PixelType(0));
+    num_over_one_values += (value > PixelType(1));
+    min_value = (value < min_value) ? value : min_value;
+    max_value = (value > max_value) ? value : max_value;
+  }
+  summary->num_negative_values += num_negative_values;
+  summary->num_over_one_values += num_over_one_values;
+  summary->min_value =
+      std::min(summary->min_value, static_cast<double>(min_value));
+  summary->max_value =
+      std::max(summary->max_value, static_cast<double>(max_value));
+}
+
+// The kernels of a single level.
+struct KernelTable {
+  void (*linear_combination)(
+      const int64_t, const double, const double*, const double,
+      const double*, double*);
+  double (*dot_product)(const int64_t, const double*, const double*);
+  double (*compute_weighted_residuals)(
+      const int64_t, const double*, const double, double*);
+  double (*compute_weighted_residuals_float)(
+      const int64_t, const float*, const double, float*);
+  double (*compute_half_residuals)(
+      const int64_t, const uint16_t*, const double, double*);
+  double (*compute_half_residuals_float)(
+      const int64_t, const uint16_t*, const double, float*);
+  double (*compute_quantized_residuals)(
+      const int64_t, const uint16_t*, const double, const double,
+      const double, double*);
+  double (*compute_quantized_residuals_float)(
+      const int64_t, const uint16_t*, const double, const double,
+      const double, float*);
+  void (*summarize_values)(const int64_t, const double*, ValueSummary*);
+  void (*summarize_values_float)(const int64_t, const float*, ValueSummary*);
+};
+
+// Defines the kernels of one level in the given namespace, compiled with the
+// given function attributes, and their KernelTable.
+#define SUPER_RESOLUTION_DEFINE_KERNELS(level_namespace, attributes)          \
+  namespace level_namespace {                                                 \
+  attributes void LinearCombination(                                          \
+      const int64_t num_values, const double a, const double* x,              \
+      const double b, const double* y, double* out) {                         \
+    LinearCombinationLoop(num_values, a, x, b, y, out);                       \
+  }                                                                           \
+  attributes double DotProduct(                                               \
+      const int64_t num_values, const double* x, const double* y) {           \
+    return DotProductLoop(num_values, x, y);                                  \
+  }                                                                           \
+  attributes double ComputeWeightedResiduals(                                 \
+      const int64_t num_values, const double* observation,                    \
+      const double weight, double* degraded) {                                \
+    return ComputeWeightedResidualsLoop<double>(                              \
+        num_values, observation, weight, degraded);                           \
+  }                                                                           \
+  attributes double ComputeWeightedResidualsFloat(                            \
+      const int64_t num_values, const float* observation,                     \
+      const double weight, float* degraded) {                                 \
+    return ComputeWeightedResidualsLoop<float>(                               \
+        num_values, observation, weight, degraded);                           \
+  }                                                                           \
+  attributes double ComputeHalfResiduals(                                     \
+      const int64_t num_values, const uint16_t* observation,                  \
+      const double weight, double* degraded) {                                \
+    return ComputeHalfResidualsLoop<double>(                                  \
+        num_values, observation, weight, degraded);                           \
+  }                                                                           \
+  attributes double ComputeHalfResidualsFloat(                                \
+      const int64_t num_values, const uint16_t* observation,                  \
+      const double weight, float* degraded) {                                 \
+    return ComputeHalfResidualsLoop<float>(                                   \
+        num_values, observation, weight, degraded);                           \
+  }                                                                           \
+  attributes double ComputeQuantizedResiduals(                                \
+      const int64_t num_values, const uint16_t* observation,                  \
+      const double scale, const double offset, const double weight,           \
+      double* degraded) {                                                     \
+    return ComputeQuantizedResidualsLoop<double>(                             \
+        num_values, observation, scale, offset, weight, degraded);            \
+  }                                                                           \
+  attributes double ComputeQuantizedResidualsFloat(                           \
+      const int64_t num_values, const uint16_t* observation,                  \
+      const double scale, const double offset, const double weight,           \
+      float* degraded) {                                                      \
+    return ComputeQuantizedResidualsLoop<float>(                              \
+        num_values, observation, scale, offset, weight, degraded);            \
+  }                                                                           \
+  attributes void SummarizeValues(                                            \
+      const int64_t num_values, const double* values,                         \
+      ValueSummary* summary) {                                                \
+    SummarizeValuesLoop<double>(num_values, values, summary);                 \
+  }                                                                           \
+  attributes void SummarizeValuesFloat(                                       \
+      const int64_t num_values, const float* values,                          \
+      ValueSummary* summary) {                                                \
+    SummarizeValuesLoop<float>(num_values, values, summary);                  \
+  }                                                                           \
+  const KernelTable kKernels = {                                              \
+      &LinearCombination,                                                     \
+      &DotProduct,                                                            \
+      &ComputeWeightedResiduals,                                              \
+      &ComputeWeightedResidualsFloat,                                         \
+      &ComputeHalfResiduals,                                                  \
+      &ComputeHalfResidualsFloat,                                             \
+      &ComputeQuantizedResiduals,                                             \
+      &ComputeQuantizedResidualsFloat,                                        \
+      &SummarizeValues,                                                       \
+      &SummarizeValuesFloat};                                                 \
+  }  // namespace level_namespace
+
+SUPER_RESOLUTION_DEFINE_KERNELS(baseline, )
+#ifdef SUPER_RESOLUTION_X86_DISPATCH
+SUPER_RESOLUTION_DEFINE_KERNELS(sse4, __attribute__((target("sse4.2"))))
+SUPER_RESOLUTION_DEFINE_KERNELS(avx2, __attribute__((target("avx2,fma"))))
+SUPER_RESOLUTION_DEFINE_KERNELS(
+    avx512, __attribute__((target("avx512f,avx512dq,avx512vl"))))
+#endif
+
+#undef SUPER_RESOLUTION_DEFINE_KERNELS
+#undef SUPER_RESOLUTION_ALWAYS_INLINE
+
+// The kernels of each level, indexed by SimdLevel. Only the baseline exists
+// on other architectures, where it is also the only supported level.
+const KernelTable* const kKernelTables[] = {
+  &baseline::kKernels,
+#ifdef SUPER_RESOLUTION_X86_DISPATCH
+  &sse4::kKernels,
+  &avx2::kKernels,
+  &avx512::kKernels,
+#endif
+};
+
+// The level used by the kernels, or -1 if it was not detected yet.
+std::atomic<int> simd_level(-1);
+
+const KernelTable& GetKernels() {
+  return *kKernelTables[GetSimdLevel()];
+}
+
+}  // namespace
+
+SimdLevel GetSupportedSimdLevel() {
+#ifdef SUPER_RESOLUTION_X86_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512dq") &&
+      __builtin_cpu_supports("avx512vl")) {
+    return SIMD_LEVEL_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return SIMD_LEVEL_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.2")) {
+    return SIMD_LEVEL_SSE4;
+  }
+#endif
+  return SIMD_LEVEL_BASELINE;
+}
+
+SimdLevel GetSimdLevel() {
+  int level = simd_level.load(std::memory_order_relaxed);
+  if (level < 0) {
+    // Detecting concurrently is harmless, since every thread finds the same.
+    level = GetSupportedSimdLevel();
+    simd_level.store(level, std::memory_order_relaxed);
+  }
+  return static_cast<SimdLevel>(level);
+}
+
+void SetSimdLevel(const SimdLevel level) {
+  const SimdLevel supported_level = GetSupportedSimdLevel();
+  SimdLevel level_to_use = level;
+  if (level > supported_level) {
+    LOG(WARNING) << "SIMD level " << GetSimdLevelName(level)
+                 << " is not supported by this CPU. Using "
+                 << GetSimdLevelName(supported_level) << " instead.";
+    level_to_use = supported_level;
+  }
+  simd_level.store(level_to_use, std::memory_order_relaxed);
+  LOG(INFO) << "Using SIMD level " << GetSimdLevelName(level_to_use) << ".";
+}
+
+std::string GetSimdLevelName(const SimdLevel level) {
+  switch (level) {
+    case SIMD_LEVEL_SSE4:
+      return "sse4";
+    case SIMD_LEVEL_AVX2:
+      return "avx2";
+    case SIMD_LEVEL_AVX512:
+      return "avx512";
+    case SIMD_LEVEL_BASELINE:
+    default:
+      return "baseline";
+  }
+}
+
+bool ParseSimdLevel(const std::string& name, SimdLevel* level) {
+  CHECK_NOTNULL(level);
+  for (const SimdLevel candidate : {
+      SIMD_LEVEL_BASELINE,
+      SIMD_LEVEL_SSE4,
+      SIMD_LEVEL_AVX2,
+      SIMD_LEVEL_AVX512}) {
+    if (name == GetSimdLevelName(candidate)) {
+      *level = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+void LinearCombination(
+    const int64_t num_values,
+    const double a,
+    const double* x,
+    const double b,
+    const double* y,
+    double* out) {
+
+  GetKernels().linear_combination(num_values, a, x, b, y, out);
+}
+
+double DotProduct(const int64_t num_values, const double* x, const double* y) {
+  return GetKernels().dot_product(num_values, x, y);
+}
+
+double ComputeWeightedResiduals(
+    const int64_t num_values,
+    const double* observation,
+    const double weight,
+    double* degraded) {
+
+  return GetKernels().compute_weighted_residuals(
+      num_values, observation, weight, degraded);
+}
+
+double ComputeWeightedResiduals(
+    const int64_t num_values,
+    const float* observation,
+    const double weight,
+    float* degraded) {
+
+  return GetKernels().compute_weighted_residuals_float(
+      num_values, observation, weight, degraded);
+}
+
+double ComputeWeightedResidualsHalf(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const double weight,
+    double* degraded) {
+
+  return GetKernels().compute_half_residuals(
+      num_values, observation, weight, degraded);
+}
+
+double ComputeWeightedResidualsHalf(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const double weight,
+    float* degraded) {
+
+  return GetKernels().compute_half_residuals_float(
+      num_values, observation, weight, degraded);
+}
+
+double ComputeWeightedResidualsQuantized(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const double scale,
+    const double offset,
+    const double weight,
+    double* degraded) {
+
+  return GetKernels().compute_quantized_residuals(
+      num_values, observation, scale, offset, weight, degraded);
+}
+
+double ComputeWeightedResidualsQuantized(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const double scale,
+    const double offset,
+    const double weight,
+    float* degraded) {
+
+  return GetKernels().compute_quantized_residuals_float(
+      num_values, observation, scale, offset, weight, degraded);
+}
+
+void SummarizeValues(
+    const int64_t num_values, const double* values, ValueSummary* summary) {
+  CHECK_NOTNULL(summary);
+  if (num_values > 0) {
+    GetKernels().summarize_values(num_values, values, summary);
+  }
+}
+
+void SummarizeValues(
+    const int64_t num_values, const float* values, ValueSummary* summary) {
+  CHECK_NOTNULL(summary);
+  if (num_values > 0) {
+    GetKernels().summarize_values_float(num_values, values, summary);
+  }
+}
+
+uint16_t EncodeHalf(const float value) {
+  const uint32_t bits = FloatToBits(value);
+  const uint16_t sign = (bits >> 16) & 0x8000u;
+  const uint32_t magnitude = bits & 0x7fffffffu;
+
+  // Values of at least 65520 round to infinity, and NaNs stay NaNs.
+  if (magnitude >= 0x477ff000u) {
+    return sign | ((magnitude > 0x7f800000u) ? 0x7e00u : 0x7c00u);
+  }
+
+  // Below the smallest normal half value (2^-14), the value is a multiple of
+  // 2^-24, which is rounded to the nearest even multiple.
+  if (magnitude < 0x38800000u) {
+    return sign | static_cast<uint16_t>(
+        std::nearbyint(BitsToFloat(magnitude) * 16777216.0f));
+  }
+
+  // Rebias the exponent from 127 to 15 and round the mantissa to the nearest
+  // even value. A carry out of the mantissa correctly increments the
+  // exponent.
+  const uint32_t mantissa_is_odd = (magnitude >> 13) & 1u;
+  return sign | static_cast<uint16_t>(
+      (magnitude - (112u << 23) + 0xfffu + mantissa_is_odd) >> 13);
+}
+
+float DecodeHalf(const uint16_t half) {
+  return DecodeHalfInline(half);
+}
+
+}  // namespace util
+}  // namespace super_resolution
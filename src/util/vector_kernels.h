@@ -0,0 +1,132 @@
+// Vectorized kernels for the hot element-wise loops of the solvers, with
+// runtime CPU feature dispatch. The library is built for the baseline
+// instruction set so that one build runs on every host, and each kernel is
+// additionally compiled for SSE4, AVX2 and AVX-512 on x86-64. The best level
+// supported by the CPU is detected on first use, and can be lowered with
+// SetSimdLevel() (or --simd_level) for benchmarking. On 64-bit ARM, NEON is
+// part of the baseline, so the baseline kernels are already vectorized.
+//
+// Only the kernels below are dispatched. The stencil regularizer kernels, the
+// additive resize, the PCA projection (a cv::gemm, which OpenCV dispatches
+// itself) and the hyperspectral file conversions are built for the baseline
+// only.
+
+#ifndef SRC_UTIL_VECTOR_KERNELS_H_
+#define SRC_UTIL_VECTOR_KERNELS_H_
+
+#include <cstdint>
+#include <limits>
+#include <string>
+
+namespace super_resolution {
+namespace util {
+
+// The instruction set levels, in increasing order.
+enum SimdLevel {
+  SIMD_LEVEL_BASELINE,
+  SIMD_LEVEL_SSE4,
+  SIMD_LEVEL_AVX2,
+  SIMD_LEVEL_AVX512
+};
+
+// Returns the highest level supported by the CPU.
+SimdLevel GetSupportedSimdLevel();
+
+// Returns the level used by the kernels, which is the supported level unless
+// it was lowered with SetSimdLevel().
+SimdLevel GetSimdLevel();
+
+// Uses the given level for all kernels. Levels the CPU does not support are
+// lowered to the supported level with a warning.
+void SetSimdLevel(const SimdLevel level);
+
+// Converts between levels and their names ("baseline", "sse4", "avx2" and
+// "avx512"). ParseSimdLevel() returns false if the name is unknown.
+std::string GetSimdLevelName(const SimdLevel level);
+bool ParseSimdLevel(const std::string& name, SimdLevel* level);
+
+// Sets out = a * x + b * y for num_values values. The output may be the same
+// array as either input.
+void LinearCombination(
+    const int64_t num_values,
+    const double a,
+    const double* x,
+    const double b,
+    const double* y,
+    double* out);
+
+// Returns the dot product of the two arrays.
+double DotProduct(const int64_t num_values, const double* x, const double* y);
+
+// Replaces the degraded values with their residuals against the observation,
+// premultiplied by the weight, and returns the unweighted sum of squared
+// residuals. If the observation is null, it is taken to be zero.
+double ComputeWeightedResiduals(
+    const int64_t num_values,
+    const double* observation,
+    const double weight,
+    double* degraded);
+double ComputeWeightedResiduals(
+    const int64_t num_values,
+    const float* observation,
+    const double weight,
+    float* degraded);
+
+// Same as ComputeWeightedResiduals(), but the observation (which must not be
+// null) is stored as IEEE half precision values, which are decoded on the
+// fly.
+double ComputeWeightedResidualsHalf(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const double weight,
+    double* degraded);
+double ComputeWeightedResidualsHalf(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const double weight,
+    float* degraded);
+
+// Same as ComputeWeightedResiduals(), but the observation (which must not be
+// null) is stored as unsigned 16-bit codes, which are decoded on the fly as
+// scale * code + offset.
+double ComputeWeightedResidualsQuantized(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const double scale,
+    const double offset,
+    const double weight,
+    double* degraded);
+double ComputeWeightedResidualsQuantized(
+    const int64_t num_values,
+    const uint16_t* observation,
+    const double scale,
+    const double offset,
+    const double weight,
+    float* degraded);
+
+// The statistics of one or more arrays of values (e.g. the channels of an
+// image, see ImageData::GetImageDataReport()).
+struct ValueSummary {
+  int64_t num_negative_values = 0;
+  int64_t num_over_one_values = 0;
+  double min_value = std::numeric_limits<double>::infinity();
+  double max_value = -std::numeric_limits<double>::infinity();
+};
+
+// Adds the values to the summary in a single pass: counts the values below 0
+// and above 1, and updates the extremes.
+void SummarizeValues(
+    const int64_t num_values, const double* values, ValueSummary* summary);
+void SummarizeValues(
+    const int64_t num_values, const float* values, ValueSummary* summary);
+
+// Converts between single and IEEE half precision values. Encoding rounds to
+// the nearest half value, and values beyond the half range (65504) become
+// infinite.
+uint16_t EncodeHalf(const float value);
+float DecodeHalf(const uint16_t half);
+
+}  // namespace util
+}  // namespace super_resolution
+
+#endif  // SRC_UTIL_VECTOR_KERNELS_H_
@@ -1,11 +1,13 @@
 #include "util/visualization.h"
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <string>
 #include <vector>
 
 #include "image/image_data.h"
+#include "util/preview_pyramid.h"
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
@@ -39,20 +41,54 @@ double GetResizeScale(const cv::Size& image_size) {
 }
 
 // A state for the OpenCV window mouse callback that allows tracking dragging
-// and rectangle position over time.
+// and rectangle position over time. The displayed image is rendered from the
+// preview pyramid of the image, so zooming in renders the selected region at
+// screen resolution from the (cached) tiles that it covers.
 struct WindowInteractionStatus {
-  WindowInteractionStatus(const cv::Mat image, const std::string window_name)
-      : original_image(image), window_name(window_name) {}
-
-  const cv::Mat original_image;
+  WindowInteractionStatus(
+      PreviewPyramid* pyramid,
+      const cv::Size& image_size,
+      const bool rescale,
+      const std::string window_name)
+      : pyramid(pyramid),
+        image_region(cv::Point(0, 0), image_size),
+        rescale(rescale),
+        window_name(window_name) {}
+
+  PreviewPyramid* pyramid;
+  const cv::Rect image_region;
+  const bool rescale;
   const std::string window_name;
 
+  // The region of the image that is displayed, and its rendering.
+  cv::Rect displayed_region;
+  cv::Mat displayed_image;
+
   int drag_start_x = 0;
   int drag_start_y = 0;
   bool dragging = false;
   bool is_zoomed_in = false;
 };
 
+// Renders the given region of the image and shows it in the window. The
+// region is scaled to fit the screen if rescale is true.
+void ShowRegion(
+    const cv::Rect& region,
+    const bool rescale,
+    WindowInteractionStatus* status) {
+
+  cv::Size display_size = region.size();
+  if (rescale) {
+    const double scale = GetResizeScale(region.size());
+    display_size = cv::Size(
+        std::max(1, static_cast<int>(std::round(region.width * scale))),
+        std::max(1, static_cast<int>(std::round(region.height * scale))));
+  }
+  status->displayed_region = region;
+  status->displayed_image = status->pyramid->Render(region, display_size);
+  cv::imshow(status->window_name, status->displayed_image);
+}
+
 // Callback function for OpenCV's window. This implements logic that allows the
 // user to zoom in to sections of the image by drawing rectangles.
 void DisplayWindowMouseCallback(
@@ -67,7 +103,7 @@ void DisplayWindowMouseCallback(
 
   // If image is zoomed in and right button is pressed, zooms the image out.
   if (event == CV_EVENT_RBUTTONDOWN && status->is_zoomed_in) {
-    cv::imshow(status->window_name, status->original_image);
+    ShowRegion(status->image_region, status->rescale, status);
     status->is_zoomed_in = false;
   }
 
@@ -83,7 +119,7 @@ void DisplayWindowMouseCallback(
   // button is no longer being pushed down. This can happen if the mouse goes
   // off screen. In this case, cancel the drag-to-zoom-in operation.
   if (status->dragging && !(flags & CV_EVENT_FLAG_LBUTTON)) {
-    cv::imshow(status->window_name, status->original_image);
+    cv::imshow(status->window_name, status->displayed_image);
     status->dragging = false;
   }
 
@@ -93,16 +129,35 @@ void DisplayWindowMouseCallback(
     const int top_y = std::min(y_pos, status->drag_start_y);
     const int selection_width = std::abs(x_pos - status->drag_start_x);
     const int selection_height = std::abs(y_pos - status->drag_start_y);
-    const cv::Rect selection(left_x, top_y, selection_width, selection_height);
-    cv::Mat cropped_image = status->original_image(selection);
-    const double scale = GetResizeScale(cropped_image.size());
-    cv::resize(cropped_image, cropped_image, cv::Size(), scale, scale);
-    cv::imshow(status->window_name, cropped_image);
-    status->is_zoomed_in = true;
+    const cv::Rect selection =
+        cv::Rect(left_x, top_y, selection_width, selection_height) &
+        cv::Rect(cv::Point(0, 0), status->displayed_image.size());
     status->dragging = false;
+    if (selection.area() == 0) {
+      cv::imshow(status->window_name, status->displayed_image);
+      return;
+    }
+    // Map the selection from window to image coordinates.
+    const cv::Rect& region = status->displayed_region;
+    const double scale_x =
+        static_cast<double>(region.width) / status->displayed_image.cols;
+    const double scale_y =
+        static_cast<double>(region.height) / status->displayed_image.rows;
+    const int start_x = region.x + static_cast<int>(selection.x * scale_x);
+    const int start_y = region.y + static_cast<int>(selection.y * scale_y);
+    const int end_x = region.x + static_cast<int>(
+        std::ceil((selection.x + selection.width) * scale_x));
+    const int end_y = region.y + static_cast<int>(
+        std::ceil((selection.y + selection.height) * scale_y));
+    const cv::Rect image_selection = cv::Rect(
+        start_x, start_y,
+        std::max(1, end_x - start_x), std::max(1, end_y - start_y)) &
+        status->image_region;
+    ShowRegion(image_selection, true, status);
+    status->is_zoomed_in = true;
   } else if (status->dragging) {
     // If dragging, draw a rectangle to indicate the user's current selection.
-    cv::Mat selection_image = status->original_image.clone();
+    cv::Mat selection_image = status->displayed_image.clone();
     cv::rectangle(
         selection_image,
         cv::Point(status->drag_start_x, status->drag_start_y),
@@ -118,18 +173,18 @@ void DisplayWindowMouseCallback(
 void DisplayImage(
     const ImageData& image,
     const std::string& window_name,
-    const bool rescale) {
+    const bool rescale,
+    const bool stretch_bands) {
 
-  ImageData display_image = ImageData(image.GetVisualizationImage());
-  if (rescale) {
-    display_image.ResizeImage(GetResizeScale(display_image.GetImageSize()));
-  }
+  PreviewPyramidOptions pyramid_options;
+  pyramid_options.stretch_bands = stretch_bands;
+  PreviewPyramid pyramid(image, pyramid_options);
 
   cv::namedWindow(window_name, CV_WINDOW_AUTOSIZE);
   WindowInteractionStatus status(
-      display_image.GetVisualizationImage(), window_name);
+      &pyramid, image.GetImageSize(), rescale, window_name);
   cv::setMouseCallback(window_name, DisplayWindowMouseCallback, &status);
-  cv::imshow(window_name, status.original_image);
+  ShowRegion(status.image_region, rescale, &status);
   std::cout << "Displaying image. Press any key to continue." << std::endl;
   cv::waitKey(0);
   cv::destroyWindow(window_name);
@@ -12,13 +12,17 @@ namespace super_resolution {
 namespace util {
 
 // Displays a given image until the user presses any key to close the window.
-// If rescale is set to true, the image will be resized (without interpolation)
-// if it is smaller than the predefined minimum size. Larger images will always
-// automatically be scaled to fit the screen.
+// If rescale is set to true, the image will be resized to fit the predefined
+// display size. Regions selected by dragging the mouse are zoomed in on, and
+// a right click zooms back out. Only the displayed regions are rendered, at
+// screen resolution, from a PreviewPyramid of the image (see
+// util/preview_pyramid.h), and if stretch_bands is true, each displayed band
+// is stretched over its own value range.
 void DisplayImage(
     const ImageData& image,
     const std::string& window_name = "Image",
-    const bool rescale = true);
+    const bool rescale = true,
+    const bool stretch_bands = false);
 
 // Displays multiple images side-by-side in the same way as DisplayImage.
 void DisplayImagesSideBySide(
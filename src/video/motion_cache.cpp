@@ -0,0 +1,113 @@
+#include "video/motion_cache.h"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "motion/motion_shift.h"
+
+#include "glog/logging.h"
+
+namespace super_resolution {
+
+void MotionCache::AddShift(
+    const int from_frame, const int to_frame, const MotionShift& shift) {
+
+  CHECK_NE(from_frame, to_frame) << "A frame has no shift relative to itself.";
+  const std::pair<int, int> key(from_frame, to_frame);
+  shifts_.erase(key);
+  shifts_.insert(std::make_pair(key, shift));
+}
+
+bool MotionCache::HasShift(const int from_frame, const int to_frame) const {
+  if (from_frame == to_frame) {
+    return true;
+  }
+  MotionShift reversed_shift(0, 0);
+  if (FindShift(from_frame, to_frame, &reversed_shift) != nullptr) {
+    return true;
+  }
+  const int first_frame = std::min(from_frame, to_frame);
+  const int last_frame = std::max(from_frame, to_frame);
+  for (int frame = first_frame; frame < last_frame; ++frame) {
+    if (FindShift(frame, frame + 1, &reversed_shift) == nullptr) {
+      return false;
+    }
+  }
+  return true;
+}
+
+MotionShift MotionCache::GetShift(const int from_frame, const int to_frame) {
+  if (from_frame == to_frame) {
+    return MotionShift(0, 0);
+  }
+  MotionShift reversed_shift(0, 0);
+  const MotionShift* cached_shift =
+      FindShift(from_frame, to_frame, &reversed_shift);
+  if (cached_shift != nullptr) {
+    return *cached_shift;
+  }
+
+  // Translations compose by adding them up along the consecutive pairs.
+  const int first_frame = std::min(from_frame, to_frame);
+  const int last_frame = std::max(from_frame, to_frame);
+  MotionShift composed_shift(0, 0);
+  for (int frame = first_frame; frame < last_frame; ++frame) {
+    const MotionShift* step = FindShift(frame, frame + 1, &reversed_shift);
+    CHECK(step != nullptr)
+        << "The shift between frames " << frame << " and " << (frame + 1)
+        << " is not cached.";
+    composed_shift.dx += step->dx;
+    composed_shift.dy += step->dy;
+  }
+  AddShift(first_frame, last_frame, composed_shift);
+  if (from_frame > to_frame) {
+    return MotionShift(-composed_shift.dx, -composed_shift.dy);
+  }
+  return composed_shift;
+}
+
+MotionShiftSequence MotionCache::GetMotionSequence(
+    const int reference_frame,
+    const int first_frame,
+    const int end_frame,
+    const double scale) {
+
+  std::vector<MotionShift> motion_shifts;
+  for (int frame = first_frame; frame < end_frame; ++frame) {
+    const MotionShift shift = GetShift(reference_frame, frame);
+    motion_shifts.push_back(MotionShift(shift.dx * scale, shift.dy * scale));
+  }
+  return MotionShiftSequence(motion_shifts);
+}
+
+void MotionCache::DropFramesBefore(const int frame_index) {
+  for (auto it = shifts_.begin(); it != shifts_.end();) {
+    if (it->first.first < frame_index || it->first.second < frame_index) {
+      it = shifts_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+const MotionShift* MotionCache::FindShift(
+    const int from_frame,
+    const int to_frame,
+    MotionShift* reversed_shift) const {
+
+  auto it = shifts_.find(std::make_pair(from_frame, to_frame));
+  if (it != shifts_.end()) {
+    return &it->second;
+  }
+  it = shifts_.find(std::make_pair(to_frame, from_frame));
+  if (it != shifts_.end()) {
+    reversed_shift->dx = -it->second.dx;
+    reversed_shift->dy = -it->second.dy;
+    return reversed_shift;
+  }
+  return nullptr;
+}
+
+}  // namespace super_resolution
@@ -0,0 +1,71 @@
+// The MotionCache stores the translational motion between pairs of video
+// frames, so that frames which appear in many overlapping temporal windows
+// are only registered once.
+//
+// Only consecutive frame pairs need to be registered: the shift between any
+// two frames is the composition (sum) of the consecutive shifts between them,
+// which is computed on first use and then cached as well. Consecutive output
+// frames of a sliding window of 2r + 1 frames share 2r frames, so every new
+// frame costs one registration instead of 2r.
+
+#ifndef SRC_VIDEO_MOTION_CACHE_H_
+#define SRC_VIDEO_MOTION_CACHE_H_
+
+#include <map>
+#include <utility>
+
+#include "motion/motion_shift.h"
+
+namespace super_resolution {
+
+class MotionCache {
+ public:
+  // Stores the shift of frame to_frame relative to frame from_frame, i.e.
+  // to_frame(x) = from_frame(x - shift).
+  void AddShift(
+      const int from_frame, const int to_frame, const MotionShift& shift);
+
+  // Returns true if the shift between the two frames is cached or can be
+  // composed from cached shifts.
+  bool HasShift(const int from_frame, const int to_frame) const;
+
+  // Returns the shift of to_frame relative to from_frame, composing (and
+  // caching) it from the consecutive shifts between the frames if needed. The
+  // reverse pair is returned negated. The shift must be available (see
+  // HasShift()).
+  MotionShift GetShift(const int from_frame, const int to_frame);
+
+  // Returns the shifts of the frames [first_frame, end_frame) relative to
+  // reference_frame, multiplied by the given scale (e.g. to convert
+  // low-resolution shifts to high-resolution pixels for the image model).
+  MotionShiftSequence GetMotionSequence(
+      const int reference_frame,
+      const int first_frame,
+      const int end_frame,
+      const double scale = 1.0);
+
+  // Removes all shifts that involve frames before the given frame, which are
+  // no longer needed once the sliding window has moved past them.
+  void DropFramesBefore(const int frame_index);
+
+  // Returns the number of cached frame pairs.
+  int GetNumCachedShifts() const {
+    return shifts_.size();
+  }
+
+ private:
+  // Returns the cached shift of the pair (in either direction) or nullptr if
+  // it is not cached. The shift is negated into *reversed_shift if only the
+  // reverse pair is cached.
+  const MotionShift* FindShift(
+      const int from_frame,
+      const int to_frame,
+      MotionShift* reversed_shift) const;
+
+  // The cached shifts by (from_frame, to_frame).
+  std::map<std::pair<int, int>, MotionShift> shifts_;
+};
+
+}  // namespace super_resolution
+
+#endif  // SRC_VIDEO_MOTION_CACHE_H_
@@ -1,74 +1,297 @@
 #include "video/super_resolver.h"
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <utility>
 #include <vector>
 
-#include "opencv2/highgui/highgui.hpp"
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "image_model/motion_module.h"
+#include "image_model/shift_add_fusion.h"
+#include "motion/motion_shift.h"
+#include "motion/registration.h"
+#include "optimization/irls_map_solver.h"
+#include "optimization/temporal_prior_regularizer.h"
+#include "optimization/tv_regularizer.h"
+#include "util/matrix_util.h"
+#include "video/video_loader.h"
+
+#include "opencv2/core/core.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
-#include "opencv2/superres.hpp"
-#include "opencv2/superres/optical_flow.hpp"
 
 #include "glog/logging.h"
 
 namespace super_resolution {
 
-void SuperResolver::SuperResolve() {
-  cv::Ptr<cv::superres::SuperResolution> super_resolution =
-      cv::superres::createSuperResolution_BTVL1();
-
-  // TODO: OpenCV has several optical flow options:
-  //  Farneback
-  //  Simple
-  //  DualTVL1
-  //  Brox
-  //  PyrLK
-  cv::Ptr<cv::superres::DenseOpticalFlowExt> optical_flow =
-      cv::superres::createOptFlow_DualTVL1();
-
-  super_resolution->setOpticalFlow(optical_flow);
-  super_resolution->setScale(options_.scale);
-  super_resolution->setIterations(options_.num_iterations);
-  super_resolution->setTemporalAreaRadius(options_.temporal_radius);
-  // TODO: All settings for the super resolution algorithm:
-  // double tau - Asymptotic value of steepest descent method.
-  // double lambda - Weight parameter to balance data term and smoothness term.
-  // double alpha - Parameter of spacial distribution in Bilateral-TV.
-  // int btvKernelSize - Kernel size of Bilateral-TV filter.
-  // int blurKernelSize - Gaussian blur kernel size.
-  // double blurSigma - Gaussian blur sigma.
-  // int temporalAreaRadius - Radius of the temporal search area.
-  // Ptr<DenseOpticalFlowExt> opticalFlow - Dense optical flow algorithm.
-
-  const std::vector<cv::Mat>& frames = video_loader_.GetFrames();
-
-  cv::Ptr<cv::superres::FrameSource> frame_source =
-      cv::superres::createFrameSource_Video("../data/ditchjump.mp4");
-
-  // Skip the first frame because it's usually corrupt.
-  cv::Mat first_frame;
-  frame_source->nextFrame(first_frame);
-  LOG(INFO) << "Dumped first frame.";
-
-  super_resolution->setInput(frame_source);
-  LOG(INFO) << "Set input.";
-
-
-  cv::Mat result_frame;
-  for (int i = 1; i < 11; ++i) {
-    LOG(INFO) << "Processing next frame...";
-    super_resolution->nextFrame(result_frame);
-    LOG(INFO) << "Done!";
-    cv::Mat before = frames[i];
-    cv::resize(before, before, result_frame.size());
-    cv::imshow("Before", before);
-    cv::imshow("After", result_frame);
-
-    if (cv::waitKey(0) < 0) {
-      break;
+SuperResolver::SuperResolver(
+    const SuperResolutionOptions& options, const FrameSink& frame_sink)
+    : options_(options),
+      frame_sink_(frame_sink),
+      first_window_frame_index_(0),
+      num_frames_added_(0),
+      next_frame_to_emit_(0),
+      is_finished_(false),
+      previous_result_frame_index_(-1),
+      total_solve_time_seconds_(0.0) {
+
+  CHECK_GE(options_.scale, 1) << "The scale must be at least 1.";
+  CHECK_GE(options_.temporal_radius, 0)
+      << "The temporal radius cannot be negative.";
+  CHECK(frame_sink_) << "A frame sink is required.";
+  if (options_.recursive) {
+    CHECK_GE(options_.recursive_prior_weight, 0.0)
+        << "The temporal prior weight cannot be negative.";
+    CHECK_GT(options_.recursive_error_threshold, 0.0)
+        << "The temporal prior error threshold must be positive.";
+  }
+}
+
+void SuperResolver::AddFrame(const ImageData& frame) {
+  CHECK(!is_finished_) << "Cannot add frames after Finish() was called.";
+  CHECK_GT(frame.GetNumChannels(), 0) << "Cannot add an empty frame.";
+
+  // Each frame is only registered against the frame before it. The shifts
+  // between any other two frames of a window are composed by the cache.
+  if (!window_frames_.empty()) {
+    CHECK_EQ(frame.GetImageSize(), window_frames_.back().GetImageSize())
+        << "All frames must have the same size.";
+    const MotionShiftSequence shifts =
+        registration::TranslationalRegistration(
+            {window_frames_.back(), frame}, options_.registration_options);
+    motion_cache_.AddShift(num_frames_added_ - 1, num_frames_added_, shifts[1]);
+  }
+  window_frames_.push_back(frame);
+  num_frames_added_++;
+
+  // A frame can be super-resolved once all frames of its window arrived.
+  while (next_frame_to_emit_ + GetTemporalRadius() < num_frames_added_) {
+    SuperResolveFrame(next_frame_to_emit_);
+    next_frame_to_emit_++;
+    DropExpiredFrames();
+  }
+}
+
+void SuperResolver::Finish() {
+  CHECK(!is_finished_) << "Finish() was already called.";
+  while (next_frame_to_emit_ < num_frames_added_) {
+    SuperResolveFrame(next_frame_to_emit_);
+    next_frame_to_emit_++;
+    DropExpiredFrames();
+  }
+  is_finished_ = true;
+
+  if (next_frame_to_emit_ > 0 && total_solve_time_seconds_ > 0.0) {
+    LOG(INFO) << "Super-resolved " << next_frame_to_emit_ << " frames in "
+              << total_solve_time_seconds_ << " seconds ("
+              << (next_frame_to_emit_ / total_solve_time_seconds_)
+              << " frames/sec).";
+  }
+}
+
+void SuperResolver::SuperResolve(const VideoLoader& video_loader) {
+  // Frames are decoded one at a time as they are added, so the whole video is
+  // never held in memory.
+  for (const cv::Mat& frame : video_loader) {
+    if (frame.empty()) {
+      continue;
     }
+    AddFrame(ImageData(frame));
+  }
+  Finish();
+}
+
+void SuperResolver::SuperResolveFrame(const int frame_index) {
+  const auto start_time = std::chrono::steady_clock::now();
+
+  ImageData result;
+  int num_frames_used = 1;
+  if (options_.recursive && previous_result_.GetNumChannels() > 0) {
+    result = SolveFromPreviousResult(frame_index);
+  } else {
+    result = SolveFromWindow(frame_index, &num_frames_used);
+  }
+
+  const auto end_time = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> elapsed_time_seconds =
+      end_time - start_time;
+  total_solve_time_seconds_ += elapsed_time_seconds.count();
+  LOG(INFO) << "Super-resolved frame " << frame_index << " from "
+            << num_frames_used << " frames in "
+            << elapsed_time_seconds.count() << " seconds.";
+
+  frame_sink_(frame_index, result);
+  previous_result_ = std::move(result);
+  previous_result_frame_index_ = frame_index;
+}
+
+ImageData SuperResolver::SolveFromWindow(
+    const int frame_index, int* num_frames_used) {
+
+  CHECK_NOTNULL(num_frames_used);
+
+  const int first_frame = std::max(
+      first_window_frame_index_, frame_index - GetTemporalRadius());
+  const int end_frame = std::min(
+      num_frames_added_, frame_index + GetTemporalRadius() + 1);
+  std::vector<ImageData> low_res_images;
+  for (int i = first_frame; i < end_frame; ++i) {
+    low_res_images.push_back(window_frames_[i - first_window_frame_index_]);
+  }
+  *num_frames_used = low_res_images.size();
+
+  // The motion of every window frame relative to this frame, in HR pixels.
+  ImageModelParameters model_parameters;
+  model_parameters.scale = options_.scale;
+  model_parameters.blur_radius = options_.blur_radius;
+  model_parameters.blur_sigma = options_.blur_sigma;
+  model_parameters.motion_sequence = motion_cache_.GetMotionSequence(
+      frame_index, first_frame, end_frame, options_.scale);
+  model_parameters.num_threads = options_.num_threads;
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+
+  // Warm start from the previous result moved to this frame's position, or
+  // from the shift-add fusion of the window for the first frame.
+  ImageData initial_estimate;
+  if (previous_result_.GetNumChannels() > 0) {
+    initial_estimate = GetShiftedPreviousResult(frame_index);
+  } else {
+    ShiftAddFusionOptions fusion_options;
+    fusion_options.scale = options_.scale;
+    fusion_options.num_threads = options_.num_threads;
+    initial_estimate = ShiftAddFusion(
+        low_res_images, model_parameters.motion_sequence, fusion_options);
+  }
+
+  IRLSMapSolverOptions solver_options;
+  solver_options.max_num_irls_iterations = options_.num_iterations;
+  solver_options.num_threads = options_.num_threads;
+  IRLSMapSolver solver(solver_options, image_model, low_res_images, false);
+  if (options_.regularization_parameter > 0.0) {
+    solver.AddRegularizer(
+        std::shared_ptr<Regularizer>(
+            new TotalVariationRegularizer(initial_estimate.GetImageSize())),
+        options_.regularization_parameter);
+  }
+  return solver.Solve(initial_estimate);
+}
+
+ImageData SuperResolver::SolveFromPreviousResult(const int frame_index) {
+  const ImageData& frame =
+      window_frames_[frame_index - first_window_frame_index_];
+  cv::Mat coverage;
+  const ImageData prior = GetShiftedPreviousResult(frame_index, &coverage);
+  const cv::Size image_size = prior.GetImageSize();
+  const int num_channels = frame.GetNumChannels();
+  CHECK_EQ(prior.GetNumChannels(), num_channels)
+      << "All frames must have the same number of channels.";
+
+  // The new frame is the only observation, so it needs no motion.
+  ImageModelParameters model_parameters;
+  model_parameters.scale = options_.scale;
+  model_parameters.blur_radius = options_.blur_radius;
+  model_parameters.blur_sigma = options_.blur_sigma;
+  model_parameters.motion_sequence = MotionShiftSequence({MotionShift(0, 0)});
+  model_parameters.num_threads = options_.num_threads;
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+
+  // The prior is trusted where it predicts the new frame well. The mean
+  // prediction error over the channels is interpolated to the HR grid.
+  const ImageData predicted_frame = image_model.ApplyToImage(prior, 0);
+  cv::Mat prediction_error =
+      cv::Mat::zeros(frame.GetImageSize(), util::kOpenCvMatrixType);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    cv::Mat channel_error;
+    cv::absdiff(
+        predicted_frame.GetChannelImage(channel),
+        frame.GetChannelImage(channel),
+        channel_error);
+    channel_error.convertTo(channel_error, util::kOpenCvMatrixType);
+    prediction_error += channel_error;
+  }
+  prediction_error /= num_channels;
+  cv::resize(
+      prediction_error, prediction_error, image_size, 0, 0, cv::INTER_LINEAR);
+  const cv::Mat relative_error =
+      prediction_error / options_.recursive_error_threshold;
+  const cv::Mat confidence =
+      coverage / (1.0 + relative_error.mul(relative_error));
+
+  // The initial estimate is the prior where it is trusted, and the upsampled
+  // new frame elsewhere.
+  ImageData upsampled_frame = frame;
+  upsampled_frame.ResizeImage(options_.scale, INTERPOLATE_CUBIC);
+  const cv::Mat inverse_confidence = 1.0 - confidence;
+  ImageData initial_estimate;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    cv::Mat prior_channel;
+    cv::Mat upsampled_channel;
+    prior.GetChannelImage(channel).convertTo(
+        prior_channel, util::kOpenCvMatrixType);
+    upsampled_frame.GetChannelImage(channel).convertTo(
+        upsampled_channel, util::kOpenCvMatrixType);
+    const cv::Mat blended_channel =
+        prior_channel.mul(confidence) +
+        upsampled_channel.mul(inverse_confidence);
+    initial_estimate.AddChannel(blended_channel, DO_NOT_NORMALIZE_IMAGE);
+  }
+
+  IRLSMapSolverOptions solver_options;
+  solver_options.max_num_irls_iterations = options_.num_iterations;
+  solver_options.num_threads = options_.num_threads;
+  const std::vector<ImageData> low_res_images = {frame};
+  IRLSMapSolver solver(solver_options, image_model, low_res_images, false);
+  if (options_.regularization_parameter > 0.0) {
+    solver.AddRegularizer(
+        std::shared_ptr<Regularizer>(
+            new TotalVariationRegularizer(image_size)),
+        options_.regularization_parameter);
+  }
+  if (options_.recursive_prior_weight > 0.0) {
+    solver.AddRegularizer(
+        std::shared_ptr<Regularizer>(
+            new TemporalPriorRegularizer(prior, confidence)),
+        options_.recursive_prior_weight);
   }
-  cv::destroyAllWindows();
+  return solver.Solve(initial_estimate);
+}
+
+ImageData SuperResolver::GetShiftedPreviousResult(
+    const int frame_index, cv::Mat* coverage) {
+
+  const MotionShift shift =
+      motion_cache_.GetShift(previous_result_frame_index_, frame_index);
+  const MotionModule motion_module(MotionShiftSequence({MotionShift(
+      shift.dx * options_.scale, shift.dy * options_.scale)}));
+  ImageData shifted_result = previous_result_;
+  motion_module.ApplyToImage(&shifted_result, 0);
+  if (coverage != nullptr) {
+    ImageData shifted_coverage;
+    shifted_coverage.AddChannel(
+        cv::Mat::ones(shifted_result.GetImageSize(), util::kOpenCvMatrixType),
+        DO_NOT_NORMALIZE_IMAGE);
+    motion_module.ApplyToImage(&shifted_coverage, 0);
+    *coverage = shifted_coverage.GetChannelImage(0).clone();
+  }
+  return shifted_result;
+}
 
-  LOG(INFO) << "SuperResolve()";
+void SuperResolver::DropExpiredFrames() {
+  // Frames before next_frame_to_emit_ - temporal_radius are not in the window
+  // of any remaining frame.
+  while (first_window_frame_index_ < num_frames_added_ - 1 &&
+         first_window_frame_index_ <
+             next_frame_to_emit_ - GetTemporalRadius()) {
+    window_frames_.pop_front();
+    first_window_frame_index_++;
+  }
+  // The previous result's frame is one before the next frame to emit, whose
+  // shift to the next frame is still needed if the temporal radius is 0.
+  motion_cache_.DropFramesBefore(
+      std::min(first_window_frame_index_, next_frame_to_emit_ - 1));
 }
 
 }  // namespace super_resolution
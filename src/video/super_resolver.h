@@ -1,48 +1,175 @@
-// The SuperResolver provides an interface to apply a super resolution
-// algorithm to the given data.
+// The SuperResolver super-resolves a video as a stream of frames. It keeps a
+// sliding window (ring buffer) of the low-resolution frames within
+// temporal_radius frames of the frame being super-resolved, and solves for
+// each high-resolution frame from all frames in its window with the IRLS MAP
+// solver.
+//
+// Work is reused between consecutive frames: every frame is registered only
+// once, against the frame before it, and the shifts within a window are
+// composed from these by a MotionCache. The previous high-resolution
+// result, shifted into the new frame's position, is the initial estimate of
+// the next solve, so few iterations are needed per frame. The first frame
+// starts from the shift-add fusion of its window.
+//
+// For live video, the recursive mode instead solves every frame from only the
+// new low-resolution frame and the previous high-resolution result, shifted
+// into the new frame's position, which is weighted by a per-pixel confidence
+// and acts as a temporal prior (see TemporalPriorRegularizer). The previous
+// result already holds the information of all earlier frames, so the cost
+// per frame does not depend on temporal_radius, and every frame is emitted as
+// soon as it is added.
+//
+// Results are handed to a FrameSink (e.g. a video writer) in frame order, so
+// no GUI is needed and only the window is held in memory. Use as follows:
+//   SuperResolver super_resolver(options, frame_sink);
+//   for (each frame) super_resolver.AddFrame(frame);
+//   super_resolver.Finish();
 
 #ifndef SRC_VIDEO_SUPER_RESOLVER_H_
 #define SRC_VIDEO_SUPER_RESOLVER_H_
 
-#include <string>
+#include <deque>
+#include <functional>
 
+#include "image/image_data.h"
+#include "motion/registration.h"
+#include "video/motion_cache.h"
 #include "video/video_loader.h"
 
+#include "opencv2/core/core.hpp"
+
 namespace super_resolution {
 
 // All possible options for the super resolution algorithm.
 struct SuperResolutionOptions {
-  std::string super_resolution_algorithm = "";
-  std::string optical_flow_algorithm = "";
+  // Frames are registered with phase correlation by default, which does not
+  // fail on frames with few keypoints.
+  SuperResolutionOptions() {
+    registration_options.method = registration::REGISTRATION_PHASE_CORRELATION;
+  }
 
   int scale = 2;
-  int num_iterations = 1;
+
+  // The number of frames on each side of a frame that are used to
+  // super-resolve it. Frames near the start and end of the video use the
+  // frames that are available. This is ignored in recursive mode.
   int temporal_radius = 3;
 
-  double blur_kernel_size = 3;
-  double blur_sigma = 3;
+  // If true, every frame is super-resolved recursively from the previous
+  // result and the new frame only (see above).
+  bool recursive = false;
+
+  // The weight of the temporal prior in recursive mode. Larger weights make
+  // the result more stable over time but slower to pick up new detail.
+  double recursive_prior_weight = 0.02;
+
+  // In recursive mode, the confidence of the prior at every pixel is
+  // 1 / (1 + (e / t)^2), where e is the mean absolute difference between the
+  // new frame and the prior degraded by the image model, and t is this
+  // threshold. Pixels that moved in from outside the previous frame have no
+  // confidence.
+  double recursive_error_threshold = 0.05;
+
+  // The blur of the image model. Keep either value at 0 to not include blur.
+  int blur_radius = 3;
+  double blur_sigma = 1.0;
+
+  // The weight of the total variation regularizer (0 = no regularization).
+  double regularization_parameter = 0.01;
 
-  bool use_gpu = false;
+  // The number of IRLS iterations per frame. Since every frame after the
+  // first starts from the previous result, a few iterations are enough.
+  int num_iterations = 3;
+
+  // The options for registering each frame against the one before it.
+  registration::TranslationalRegistrationOptions registration_options;
+
+  // The number of threads used by the image model and the solver (0 = all
+  // hardware threads).
+  int num_threads = 1;
 };
 
+// Receives the super-resolved frames, in frame order.
+using FrameSink = std::function<void(
+    const int frame_index, const ImageData& high_res_frame)>;
+
 class SuperResolver {
  public:
   SuperResolver(
-      const VideoLoader& video_loader,
-      const SuperResolutionOptions& options) :
-  video_loader_(video_loader),
-  options_(options) {}
+      const SuperResolutionOptions& options, const FrameSink& frame_sink);
+
+  // Adds the next low-resolution frame of the video. All frames must have the
+  // same size and number of channels. Every frame whose window is complete
+  // after this (in recursive mode, the added frame) is super-resolved and
+  // sent to the sink.
+  void AddFrame(const ImageData& frame);
+
+  // Super-resolves the remaining frames at the end of the video, whose
+  // windows are cut off, and logs the throughput. No frames may be added
+  // after this.
+  void Finish();
 
-  // Apply the super resolution algorithm to the given data (in the given
-  // VideoLoader). All parameters will be set according to the given
-  // SuperResolutionOptions.
-  void SuperResolve();
+  // Streams all frames of the given VideoLoader through AddFrame() and
+  // Finish().
+  void SuperResolve(const VideoLoader& video_loader);
+
+  // Returns the number of frames that were sent to the sink so far.
+  int GetNumFramesEmitted() const {
+    return next_frame_to_emit_;
+  }
 
  private:
-  // The VideoLoader object containing the low-resolution video frames.
-  const VideoLoader& video_loader_;
+  // Super-resolves the frame with the given index, which must be in the
+  // window, and sends the result to the sink.
+  void SuperResolveFrame(const int frame_index);
+
+  // Solves for the frame from all frames of its window, and returns the
+  // number of frames used.
+  ImageData SolveFromWindow(const int frame_index, int* num_frames_used);
+
+  // Solves for the frame from itself and the previous result (recursive
+  // mode), which must exist.
+  ImageData SolveFromPreviousResult(const int frame_index);
+
+  // Returns the previous result shifted into the given frame's position.
+  // Pixels that moved in from outside of the previous frame are 0. If
+  // coverage is not null, it is set to the fraction of every pixel that came
+  // from inside the previous frame.
+  ImageData GetShiftedPreviousResult(
+      const int frame_index, cv::Mat* coverage = nullptr);
+
+  // Returns the temporal radius of the window, which is 0 in recursive mode.
+  int GetTemporalRadius() const {
+    return options_.recursive ? 0 : options_.temporal_radius;
+  }
+
+  // Drops the frames that are no longer in the window of any frame that has
+  // not been emitted yet. The last added frame is always kept, since the next
+  // frame is registered against it.
+  void DropExpiredFrames();
+
+  const SuperResolutionOptions options_;
+  const FrameSink frame_sink_;
+
+  // The low-resolution frames in the window. window_frames_[0] is the frame
+  // with index first_window_frame_index_.
+  std::deque<ImageData> window_frames_;
+  int first_window_frame_index_;
+
+  // The shifts (in low-resolution pixels) between the frames of the window.
+  MotionCache motion_cache_;
+
+  int num_frames_added_;
+  int next_frame_to_emit_;
+  bool is_finished_;
+
+  // The last high-resolution result and the index of its frame, which are
+  // used as the warm start of the next frame.
+  ImageData previous_result_;
+  int previous_result_frame_index_;
 
-  const SuperResolutionOptions& options_;
+  // The total time spent super-resolving frames, for the throughput log.
+  double total_solve_time_seconds_;
 };
 
 }  // namespace super_resolution
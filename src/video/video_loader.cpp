@@ -1,8 +1,15 @@
 #include "video/video_loader.h"
 
+#include <algorithm>
+#include <list>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "util/memory_accounting.h"
+#include "util/prefetch_queue.h"
+#include "util/profiler.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 #include "opencv2/core/core.hpp"
@@ -20,50 +27,106 @@ static const cv::Size kDisplayFrameSize(1000, 600);
 
 }  // namespace
 
+VideoLoader::VideoLoader(
+    const int max_num_cached_frames, const int num_threads)
+    : max_num_cached_frames_(max_num_cached_frames),
+      num_threads_(num_threads),
+      num_frames_(0),
+      next_video_frame_index_(0),
+      num_frames_decoded_(0),
+      next_queued_frame_index_(0) {
+
+  CHECK_GE(max_num_cached_frames_, 1) << "At least one frame must be cached.";
+  CHECK_GE(num_threads_, 0) << "The number of threads cannot be negative.";
+}
+
 void VideoLoader::LoadFramesFromVideo(const std::string& video_path) {
-  cv::VideoCapture video_capture(video_path);
-  CHECK(video_capture.isOpened())
+  Reset();
+  video_capture_.open(video_path);
+  CHECK(video_capture_.isOpened())
       << "Failed to open video file: " + video_path;
+  num_frames_ = std::max(
+      0, static_cast<int>(video_capture_.get(cv::CAP_PROP_FRAME_COUNT)));
 
-  cv::Mat frame;
-  while (video_capture.grab()) {
-    video_capture.retrieve(frame);
-    video_frames_.push_back(frame.clone());
-  }
-
-  LOG(INFO) << "Frames successfully loaded from file: " + video_path;
+  LOG(INFO) << "Opened video file " << video_path << " with "
+            << num_frames_ << " frames.";
 }
 
 void VideoLoader::LoadFramesFromDirectory(const std::string& directory_path) {
-  std::vector<std::string> files_in_directory =
-      util::ListFilesInDirectory(directory_path);
-  for (const std::string& file_name : files_in_directory) {
-    const std::string file_path = directory_path + "/" + file_name;
-    cv::Mat frame = cv::imread(file_path, CV_LOAD_IMAGE_COLOR);
-    // Skip invalid images.
-    if (frame.cols == 0 || frame.rows == 0) {
-      LOG(WARNING) << "Skipped file " << file_path
-                   << ": could not read image. "
-                   << "Make sure it is a valid image type.";
-      continue;
-    }
-    video_frames_.push_back(frame);
+  Reset();
+  directory_path_ = directory_path;
+  frame_file_names_ = util::ListFilesInDirectory(directory_path);
+  num_frames_ = frame_file_names_.size();
+
+  // Every loader thread decodes one frame ahead of the consumer, so the
+  // queue holds at most one frame per thread on top of the cache.
+  const int num_loader_threads = util::GetNumThreadsToUse(num_threads_);
+  frame_queue_.reset(new util::PrefetchQueue<cv::Mat>(
+      num_frames_,
+      [this](const int frame_index) {
+        const util::ScopedMemoryTag memory_tag(util::MEMORY_TAG_LOADERS);
+        return DecodeFrame(frame_index);
+      },
+      num_loader_threads,
+      num_loader_threads));
+}
+
+cv::Mat VideoLoader::GetFrame(const int frame_index) const {
+  CHECK(frame_index >= 0 && frame_index < num_frames_)
+      << "Frame index " << frame_index << " is out of bounds.";
+
+  const auto cached_frame = cached_frame_index_.find(frame_index);
+  if (cached_frame != cached_frame_index_.end()) {
+    // Move the frame to the front of the LRU list.
+    cached_frames_.splice(
+        cached_frames_.begin(), cached_frames_, cached_frame->second);
+    return cached_frame->second->second;
+  }
+
+  // The next frame in order was (or is being) decoded by the prefetch queue.
+  // Other frames are decoded here.
+  cv::Mat frame;
+  if (frame_queue_ != nullptr && frame_queue_->HasNext() &&
+      frame_index == next_queued_frame_index_) {
+    frame = frame_queue_->GetNext();
+    next_queued_frame_index_++;
+  } else {
+    const util::ScopedMemoryTag memory_tag(util::MEMORY_TAG_LOADERS);
+    frame = DecodeFrame(frame_index);
   }
+  num_frames_decoded_++;
+  CacheFrame(frame_index, frame);
+  return frame;
 }
 
 cv::Size VideoLoader::GetImageSize() const {
-  if (video_frames_.empty()) {
+  if (num_frames_ == 0) {
     return cv::Size(0, 0);
   }
 
-  return video_frames_[0].size();
+  if (video_capture_.isOpened()) {
+    return cv::Size(
+        static_cast<int>(video_capture_.get(cv::CAP_PROP_FRAME_WIDTH)),
+        static_cast<int>(video_capture_.get(cv::CAP_PROP_FRAME_HEIGHT)));
+  }
+  // Use the first image that can be read.
+  for (int frame_index = 0; frame_index < num_frames_; ++frame_index) {
+    const cv::Mat frame = GetFrame(frame_index);
+    if (!frame.empty()) {
+      return frame.size();
+    }
+  }
+  return cv::Size(0, 0);
 }
 
 void VideoLoader::PlayOriginalVideo() const {
   const std::string window_name = "Original Video";
   cv::namedWindow(window_name);
 
-  for (const cv::Mat& frame : video_frames_) {
+  for (const cv::Mat& frame : *this) {
+    if (frame.empty()) {
+      continue;
+    }
     cv::Mat resized_frame;
     cv::resize(frame, resized_frame, kDisplayFrameSize);
     cv::imshow(window_name, resized_frame);
@@ -76,4 +139,56 @@ void VideoLoader::PlayOriginalVideo() const {
   cv::destroyWindow(window_name);
 }
 
+cv::Mat VideoLoader::DecodeFrame(const int frame_index) const {
+  PROFILE_SCOPE("VideoLoader::DecodeFrame");
+  PROFILE_COUNT("VideoLoader frames decoded", 1);
+  cv::Mat frame;
+  if (video_capture_.isOpened()) {
+    // Seeking is slow (and for some codecs inexact), so only seek when the
+    // frames are not accessed in order.
+    if (frame_index != next_video_frame_index_) {
+      video_capture_.set(cv::CAP_PROP_POS_FRAMES, frame_index);
+    }
+    if (!video_capture_.read(frame)) {
+      LOG(WARNING) << "Could not decode video frame " << frame_index << ".";
+    }
+    next_video_frame_index_ = frame_index + 1;
+    // The capture may reuse its buffer for the next frame.
+    return frame.clone();
+  }
+
+  const std::string file_path =
+      directory_path_ + "/" + frame_file_names_[frame_index];
+  frame = cv::imread(file_path, CV_LOAD_IMAGE_COLOR);
+  if (frame.empty()) {
+    LOG(WARNING) << "Skipped file " << file_path << ": could not read image. "
+                 << "Make sure it is a valid image type.";
+  }
+  return frame;
+}
+
+void VideoLoader::CacheFrame(
+    const int frame_index, const cv::Mat& frame) const {
+
+  cached_frames_.push_front(std::make_pair(frame_index, frame));
+  cached_frame_index_[frame_index] = cached_frames_.begin();
+  if (static_cast<int>(cached_frames_.size()) > max_num_cached_frames_) {
+    cached_frame_index_.erase(cached_frames_.back().first);
+    cached_frames_.pop_back();
+  }
+}
+
+void VideoLoader::Reset() {
+  // The loader threads read the frame source, so they are stopped first.
+  frame_queue_.reset();
+  next_queued_frame_index_ = 0;
+  video_capture_.release();
+  directory_path_.clear();
+  frame_file_names_.clear();
+  num_frames_ = 0;
+  next_video_frame_index_ = 0;
+  cached_frames_.clear();
+  cached_frame_index_.clear();
+}
+
 }  // namespace super_resolution
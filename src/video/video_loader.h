@@ -1,27 +1,115 @@
 // The VideoLoader class handles all file I/O and converts videos into
 // individual video frames. Load low-resolution videos with this class and
 // apply super resolution on the individual frames.
+//
+// Frames are decoded lazily: opening a video or directory only reads its
+// metadata, and every frame is decoded when it is first accessed. The most
+// recently accessed frames are kept in a bounded LRU cache, so a sliding
+// window over the video (e.g. the temporal window of the SuperResolver) does
+// not decode any frame twice, and memory does not grow with the video length.
+// The frames of an image directory are also decoded ahead of sequential
+// access on background threads, so decoding overlaps with the consumer.
+// Use as follows:
+//   VideoLoader video_loader(
+//       GetNumCachedFramesForTemporalRadius(temporal_radius));
+//   video_loader.LoadFramesFromVideo(video_path);
+//   for (const cv::Mat& frame : video_loader) { ... }
 
 #ifndef SRC_VIDEO_VIDEO_LOADER_H_
 #define SRC_VIDEO_VIDEO_LOADER_H_
 
+#include <iterator>
+#include <list>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "util/prefetch_queue.h"
+
 #include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
 
 namespace super_resolution {
 
+// The default number of decoded frames kept in memory.
+constexpr int kDefaultMaxNumCachedFrames = 8;
+
+// Returns the number of frames to cache for a sliding temporal window that
+// reaches temporal_radius frames before and after each frame, so that no
+// frame of the window is decoded twice.
+inline int GetNumCachedFramesForTemporalRadius(const int temporal_radius) {
+  return 2 * temporal_radius + 1;
+}
+
 class VideoLoader {
  public:
-  // Loads all frames of the given video file. The given path must be a valid
-  // video file supported by OpenCV.
+  // Iterates over all frames in order, decoding them as they are reached.
+  // A dereferenced frame stays valid until the iterator is advanced.
+  class FrameIterator
+      : public std::iterator<std::input_iterator_tag, const cv::Mat> {
+   public:
+    FrameIterator(const VideoLoader* video_loader, const int frame_index)
+        : video_loader_(video_loader), frame_index_(frame_index) {}
+
+    const cv::Mat& operator * () {
+      frame_ = video_loader_->GetFrame(frame_index_);
+      return frame_;
+    }
+
+    FrameIterator& operator ++ () {
+      frame_index_++;
+      return *this;
+    }
+
+    bool operator == (const FrameIterator& other) const {
+      return video_loader_ == other.video_loader_ &&
+          frame_index_ == other.frame_index_;
+    }
+
+    bool operator != (const FrameIterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    const VideoLoader* video_loader_;
+    int frame_index_;
+    cv::Mat frame_;
+  };
+
+  // At most max_num_cached_frames decoded frames are kept in memory. For
+  // windowed access this should be at least the window size (see
+  // GetNumCachedFramesForTemporalRadius()). The frames of an image directory
+  // are decoded ahead of sequential access on num_threads background threads
+  // (0 = one per hardware thread), with one frame in flight per thread.
+  explicit VideoLoader(
+      const int max_num_cached_frames = kDefaultMaxNumCachedFrames,
+      const int num_threads = 1);
+
+  // Opens the given video file. The given path must be a valid video file
+  // supported by OpenCV. Frames are decoded when they are accessed.
   void LoadFramesFromVideo(const std::string& video_path);
 
-  // Loads all frames in the given image directory. This does not technically
-  // need to be a video, but rather multiple frames of the same scene.
+  // Opens the given image directory. This does not technically need to be a
+  // video, but rather multiple frames of the same scene. The frames are in
+  // the order of the directory listing. The background threads start
+  // decoding the first frames right away, and keep decoding the frames after
+  // the last one that was accessed in order. Frames accessed out of order are
+  // decoded when they are accessed.
   void LoadFramesFromDirectory(const std::string& directory_path);
 
+  // Returns the number of frames. For video files this is the frame count
+  // reported by the container, since counting would require decoding.
+  int GetNumFrames() const {
+    return num_frames_;
+  }
+
+  // Returns the frame with the given index, decoding it unless it is cached.
+  // The returned Mat is empty if the frame could not be decoded (e.g. a file
+  // in the directory that is not an image).
+  cv::Mat GetFrame(const int frame_index) const;
+
   // Returns the size of the low resolution images. If the size of the images
   // varies, then this will return the size of the first image. If there are no
   // images, the size returned will be (0, 0).
@@ -30,14 +118,59 @@ class VideoLoader {
   // Plays the original video file in a GUI window.
   void PlayOriginalVideo() const;
 
-  // Returns the list of original video frames.
-  const std::vector<cv::Mat>& GetFrames() const {
-    return video_frames_;
+  // Iterators over all frames, for range-based for loops.
+  FrameIterator begin() const {
+    return FrameIterator(this, 0);
+  }
+  FrameIterator end() const {
+    return FrameIterator(this, num_frames_);
+  }
+
+  // Returns the number of frames that were decoded so far, including frames
+  // that were decoded more than once because they dropped out of the cache.
+  int GetNumFramesDecoded() const {
+    return num_frames_decoded_;
   }
 
  private:
-  // The original (low resolution) video frames.
-  std::vector<cv::Mat> video_frames_;
+  // Decodes the given frame from the video file or the image directory. The
+  // frames of an image directory can be decoded from any thread.
+  cv::Mat DecodeFrame(const int frame_index) const;
+
+  // Adds the given frame to the front of the cache, evicting the least
+  // recently used frame if the cache is full.
+  void CacheFrame(const int frame_index, const cv::Mat& frame) const;
+
+  // Clears the cache and the frame source.
+  void Reset();
+
+  const int max_num_cached_frames_;
+  const int num_threads_;
+  int num_frames_;
+
+  // The frame source: either an opened video, or the image files of a
+  // directory.
+  mutable cv::VideoCapture video_capture_;
+  std::string directory_path_;
+  std::vector<std::string> frame_file_names_;
+
+  // The index of the frame that the video capture decodes next, so that
+  // sequential access does not need to seek.
+  mutable int next_video_frame_index_;
+
+  // The cached frames, with the most recently used frame first, and their
+  // position in that list by frame index.
+  mutable std::list<std::pair<int, cv::Mat>> cached_frames_;
+  mutable std::unordered_map<
+      int, std::list<std::pair<int, cv::Mat>>::iterator> cached_frame_index_;
+
+  mutable int num_frames_decoded_;
+
+  // Decodes the frames of an image directory in order on background threads.
+  // It is declared last so that it is destroyed (and its threads stopped)
+  // before the frame source it reads.
+  mutable std::unique_ptr<util::PrefetchQueue<cv::Mat>> frame_queue_;
+  mutable int next_queued_frame_index_;
 };
 
 }  // namespace super_resolution
@@ -32,6 +32,12 @@ DEFINE_bool(rescale_image, false,
 DEFINE_bool(print_image_info, false,
     "If true, the image data report will be printed to standard output.");
 
+// Optionally, map each displayed band from its own value range to the display
+// range instead of clamping values to [0, 1]. This is useful for hyperspectral
+// images stored in sensor units.
+DEFINE_bool(stretch_bands, false,
+    "If true, each displayed band is stretched over its own value range.");
+
 int main(int argc, char** argv) {
   super_resolution::util::InitApp(argc, argv, "Image visualization.");
 
@@ -43,7 +49,10 @@ int main(int argc, char** argv) {
     image.GetImageDataReport().Print();
   }
   super_resolution::util::DisplayImage(
-      image, "Image: " + FLAGS_image_path, FLAGS_rescale_image);
+      image,
+      "Image: " + FLAGS_image_path,
+      FLAGS_rescale_image,
+      FLAGS_stretch_bands);
 
   return EXIT_SUCCESS;
 }
@@ -1,13 +1,244 @@
 #include "wavelet/wavelet_transform.h"
 
-#include "opencv2/core/core.hpp"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
 
 #include "image/image_data.h"
+#include "util/thread_pool.h"
+
+#include "opencv2/core/core.hpp"
 
 #include "glog/logging.h"
 
 namespace super_resolution {
 namespace wavelet {
+namespace {
+
+// One lifting step, which adds weighted neighbors from one half of a signal
+// to each sample of the other half. A predict step updates every high-pass
+// sample k from the low-pass samples k and k + 1, and an update step updates
+// every low-pass sample k from the high-pass samples k and k - 1. Neighbors
+// outside of the signal are mirrored back into it.
+struct LiftingStep {
+  bool is_predict;
+  double current_weight;
+  double neighbor_weight;
+};
+
+// The lifting factorization of a wavelet filter. The low-pass and high-pass
+// samples are scaled by low_scale and high_scale, respectively, after the
+// lifting steps.
+struct LiftingFilter {
+  std::vector<LiftingStep> steps;
+  double low_scale;
+  double high_scale;
+};
+
+LiftingFilter GetLiftingFilter(const WaveletFilter filter) {
+  switch (filter) {
+    case WAVELET_FILTER_HAAR: {
+      // The details are d = o - e and the averages s = (e + o) / 2. They are
+      // scaled to the orthonormal (e + o) / sqrt(2) and (e - o) / sqrt(2).
+      const double sqrt_two = std::sqrt(2.0);
+      return LiftingFilter{
+          {{true, -1.0, 0.0}, {false, 0.5, 0.0}}, sqrt_two, -1.0 / sqrt_two};
+    }
+    case WAVELET_FILTER_CDF_5_3:
+      return LiftingFilter{
+          {{true, -0.5, -0.5}, {false, 0.25, 0.25}}, 1.0, 1.0};
+    case WAVELET_FILTER_CDF_9_7: {
+      // Daubechies and Sweldens, "Factoring wavelet transforms into lifting
+      // steps" (1998).
+      const double alpha = -1.586134342059924;
+      const double beta = -0.052980118572961;
+      const double gamma = 0.882911075530934;
+      const double delta = 0.443506852043971;
+      const double k = 1.149604398860241;
+      return LiftingFilter{
+          {{true, alpha, alpha}, {false, beta, beta},
+           {true, gamma, gamma}, {false, delta, delta}},
+          1.0 / k,
+          k};
+    }
+    default:
+      LOG(FATAL) << "Unsupported wavelet filter.";
+  }
+  return LiftingFilter();
+}
+
+// Applies the given lifting step (or its inverse if sign is -1) to the rows
+// of the buffer, where the first num_low rows are the low-pass samples and
+// the next num_high rows are the high-pass samples. Each row is processed as
+// one vector.
+void ApplyLiftingStep(
+    const LiftingStep& step,
+    const double sign,
+    const int num_low,
+    const int num_high,
+    cv::Mat* buffer) {
+
+  const int width = buffer->cols;
+  const double current_weight = sign * step.current_weight;
+  const double neighbor_weight = sign * step.neighbor_weight;
+  if (step.is_predict) {
+    for (int k = 0; k < num_high; ++k) {
+      double* target = buffer->ptr<double>(num_low + k);
+      const double* current = buffer->ptr<double>(k);
+      const double* neighbor =
+          buffer->ptr<double>(std::min(k + 1, num_low - 1));
+      for (int x = 0; x < width; ++x) {
+        target[x] +=
+            current_weight * current[x] + neighbor_weight * neighbor[x];
+      }
+    }
+  } else {
+    for (int k = 0; k < num_low; ++k) {
+      double* target = buffer->ptr<double>(k);
+      const double* current =
+          buffer->ptr<double>(num_low + std::min(k, num_high - 1));
+      const double* neighbor =
+          buffer->ptr<double>(num_low + std::max(k - 1, 0));
+      for (int x = 0; x < width; ++x) {
+        target[x] +=
+            current_weight * current[x] + neighbor_weight * neighbor[x];
+      }
+    }
+  }
+}
+
+// Applies one level of the filter along the columns of the given region, so
+// that the low-pass rows end up in its top half (forward) or are merged back
+// from it (inverse). The buffer is reused between calls.
+void LiftColumns(
+    const LiftingFilter& filter,
+    const bool forward,
+    cv::Mat region,
+    cv::Mat* buffer) {
+
+  const int num_rows = region.rows;
+  if (num_rows < 2) {
+    return;
+  }
+  const int num_low = (num_rows + 1) / 2;
+  const int num_high = num_rows / 2;
+  buffer->create(num_rows, region.cols, CV_64FC1);
+
+  if (forward) {
+    // Split the even and odd rows.
+    for (int row = 0; row < num_rows; ++row) {
+      const int buffer_row = (row % 2 == 0) ? row / 2 : num_low + row / 2;
+      cv::Mat buffer_row_image = buffer->row(buffer_row);
+      region.row(row).copyTo(buffer_row_image);
+    }
+    for (const LiftingStep& step : filter.steps) {
+      ApplyLiftingStep(step, 1.0, num_low, num_high, buffer);
+    }
+    cv::Mat low_rows = buffer->rowRange(0, num_low);
+    cv::Mat high_rows = buffer->rowRange(num_low, num_rows);
+    low_rows *= filter.low_scale;
+    high_rows *= filter.high_scale;
+    buffer->copyTo(region);
+  } else {
+    region.copyTo(*buffer);
+    cv::Mat low_rows = buffer->rowRange(0, num_low);
+    cv::Mat high_rows = buffer->rowRange(num_low, num_rows);
+    low_rows *= 1.0 / filter.low_scale;
+    high_rows *= 1.0 / filter.high_scale;
+    for (int i = filter.steps.size() - 1; i >= 0; --i) {
+      ApplyLiftingStep(filter.steps[i], -1.0, num_low, num_high, buffer);
+    }
+    // Interleave the rows again.
+    for (int row = 0; row < num_rows; ++row) {
+      const int buffer_row = (row % 2 == 0) ? row / 2 : num_low + row / 2;
+      cv::Mat region_row = region.row(row);
+      buffer->row(buffer_row).copyTo(region_row);
+    }
+  }
+}
+
+// Applies one level of the filter along the rows of the given region. The
+// region is transposed so that the columns can be lifted as whole rows.
+void LiftRows(
+    const LiftingFilter& filter,
+    const bool forward,
+    cv::Mat region,
+    cv::Mat* transposed_region,
+    cv::Mat* buffer) {
+
+  if (region.cols < 2) {
+    return;
+  }
+  cv::transpose(region, *transposed_region);
+  LiftColumns(filter, forward, *transposed_region, buffer);
+  cv::transpose(*transposed_region, region);
+}
+
+// Returns the sizes of the regions that are transformed by each level.
+std::vector<cv::Size> GetLevelSizes(
+    const cv::Size& image_size, const int num_levels) {
+
+  std::vector<cv::Size> level_sizes;
+  cv::Size level_size = image_size;
+  for (int level = 0; level < num_levels; ++level) {
+    level_sizes.push_back(level_size);
+    level_size =
+        cv::Size((level_size.width + 1) / 2, (level_size.height + 1) / 2);
+  }
+  return level_sizes;
+}
+
+// Runs the forward or inverse transform on every channel of the image.
+void RunLiftingWaveletTransform(
+    const WaveletFilter filter,
+    const int num_levels,
+    const bool forward,
+    const int num_threads,
+    ImageData* image) {
+
+  CHECK_NOTNULL(image);
+  CHECK_GE(num_levels, 1) << "At least one level is required.";
+  CHECK_EQ(image->GetPrecision(), DOUBLE_PRECISION)
+      << "Only double precision images can be transformed.";
+
+  const LiftingFilter lifting_filter = GetLiftingFilter(filter);
+  const std::vector<cv::Size> level_sizes =
+      GetLevelSizes(image->GetImageSize(), num_levels);
+  const int num_channels = image->GetNumChannels();
+  const auto transform_channel = [&](const int channel) {
+    // Lifting writes through the views into the channel data.
+    cv::Mat channel_image = image->GetChannelImage(channel);
+    cv::Mat transposed_region;
+    cv::Mat buffer;
+    for (int i = 0; i < num_levels; ++i) {
+      const int level = forward ? i : num_levels - 1 - i;
+      const cv::Size& level_size = level_sizes[level];
+      cv::Mat region = channel_image(
+          cv::Rect(0, 0, level_size.width, level_size.height));
+      if (forward) {
+        LiftRows(lifting_filter, true, region, &transposed_region, &buffer);
+        LiftColumns(lifting_filter, true, region, &buffer);
+      } else {
+        LiftColumns(lifting_filter, false, region, &buffer);
+        LiftRows(lifting_filter, false, region, &transposed_region, &buffer);
+      }
+    }
+  };
+
+  const int num_workers =
+      std::min(util::GetNumThreadsToUse(num_threads), num_channels);
+  if (num_workers > 1) {
+    util::ThreadPool thread_pool(num_workers - 1);
+    thread_pool.ParallelFor(num_channels, transform_channel);
+  } else {
+    for (int channel = 0; channel < num_channels; ++channel) {
+      transform_channel(channel);
+    }
+  }
+}
+
+}  // namespace
 
 ImageData WaveletCoefficients::GetCoefficientsImage() const {
   const int num_channels = ll.GetNumChannels();
@@ -32,13 +263,15 @@ ImageData WaveletCoefficients::GetCoefficientsImage() const {
   const int width = coefficients_size.width;
   const int height = coefficients_size.height;
   const cv::Size visualization_image_size(width * 2, height * 2);
-  ImageData stitched_image;
+  // The coefficients are copied directly into the channels of the stitched
+  // image, which share their data with it.
+  ImageData stitched_image(visualization_image_size, num_channels);
   for (int channel = 0; channel < num_channels; ++channel) {
     const cv::Mat channel_ll = ll.GetChannelImage(channel);
     const cv::Mat channel_lh = lh.GetChannelImage(channel);
     const cv::Mat channel_hl = hl.GetChannelImage(channel);
     const cv::Mat channel_hh = hh.GetChannelImage(channel);
-    cv::Mat channel_image(visualization_image_size, channel_ll.type());
+    cv::Mat channel_image = stitched_image.GetChannelImage(channel);
 
     cv::Mat top_left =
         channel_image(cv::Rect(0, 0, width, height));
@@ -53,122 +286,97 @@ ImageData WaveletCoefficients::GetCoefficientsImage() const {
     cv::Mat bottom_right =
         channel_image(cv::Rect(width, height, width, height));
     channel_hh.copyTo(bottom_right);
-
-    stitched_image.AddChannel(channel_image, DO_NOT_NORMALIZE_IMAGE);
   }
 
   return stitched_image;
 }
 
+void LiftingWaveletTransform(
+    const WaveletFilter filter,
+    const int num_levels,
+    ImageData* image,
+    const int num_threads) {
+
+  RunLiftingWaveletTransform(filter, num_levels, true, num_threads, image);
+}
+
+void InverseLiftingWaveletTransform(
+    const WaveletFilter filter,
+    const int num_levels,
+    ImageData* image,
+    const int num_threads) {
+
+  RunLiftingWaveletTransform(filter, num_levels, false, num_threads, image);
+}
+
+cv::Rect GetSubbandRegion(
+    const cv::Size& image_size,
+    const int level,
+    const WaveletSubband subband) {
+
+  CHECK_GE(level, 1) << "Levels start at 1.";
+  const cv::Size level_size = GetLevelSizes(image_size, level).back();
+  const int low_width = (level_size.width + 1) / 2;
+  const int low_height = (level_size.height + 1) / 2;
+  const int high_width = level_size.width - low_width;
+  const int high_height = level_size.height - low_height;
+  switch (subband) {
+    case WAVELET_SUBBAND_LL:
+      return cv::Rect(0, 0, low_width, low_height);
+    case WAVELET_SUBBAND_LH:
+      return cv::Rect(low_width, 0, high_width, low_height);
+    case WAVELET_SUBBAND_HL:
+      return cv::Rect(0, low_height, low_width, high_height);
+    case WAVELET_SUBBAND_HH:
+      return cv::Rect(low_width, low_height, high_width, high_height);
+    default:
+      LOG(FATAL) << "Unsupported wavelet subband.";
+  }
+  return cv::Rect();
+}
+
 WaveletCoefficients WaveletTransform(const ImageData& image) {
   CHECK_GT(image.GetNumChannels(), 0) << "Image cannot be empty.";
 
   const cv::Size image_size = image.GetImageSize();
   const cv::Size target_size(image_size.width / 2, image_size.height / 2);
-  WaveletCoefficients coefficients;
+  const cv::Size even_size(target_size.width * 2, target_size.height * 2);
+  const int num_channels = image.GetNumChannels();
 
-  // TODO: This is haar filter only.
-  // TODO: Can this be done with a convolution?
-  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
-    const cv::Mat channel_image = image.GetChannelImage(channel);
-    cv::Mat channel_ll(target_size, channel_image.type());
-    cv::Mat channel_lh(target_size, channel_image.type());
-    cv::Mat channel_hl(target_size, channel_image.type());
-    cv::Mat channel_hh(target_size, channel_image.type());
-
-    // This code has been adapted from
-    // http://stackoverflow.com/questions/20071854/wavelet-transform-in-opencv
-    for (int row = 0; row < target_size.height; ++row) {
-      for (int col = 0; col < target_size.width; ++col) {
-        channel_ll.at<double>(row, col) = 0.5 * (
-            channel_image.at<double>(2 * row, 2 * col)
-            + channel_image.at<double>(2 * row, 2 * col + 1)
-            + channel_image.at<double>(2 * row + 1, 2 * col)
-            + channel_image.at<double>(2 * row + 1, 2 * col + 1));
-
-        channel_lh.at<double>(row, col) = 0.5 * (
-            channel_image.at<double>(2 * row, 2 * col)
-            - channel_image.at<double>(2 * row, 2 * col + 1)
-            + channel_image.at<double>(2 * row + 1, 2 * col)
-            - channel_image.at<double>(2 * row + 1, 2 * col + 1));
-
-        channel_hl.at<double>(row, col) = 0.5 * (
-            channel_image.at<double>(2 * row, 2 * col)
-            + channel_image.at<double>(2 * row, 2 * col + 1)
-            - channel_image.at<double>(2 * row + 1, 2 * col)
-            - channel_image.at<double>(2 * row + 1, 2 * col + 1));
-
-        channel_hh.at<double>(row, col) = 0.5 * (
-            channel_image.at<double>(2 * row, 2 * col)
-            - channel_image.at<double>(2 * row, 2 * col + 1)
-            - channel_image.at<double>(2 * row + 1, 2 * col)
-            + channel_image.at<double>(2 * row + 1, 2 * col + 1));
-      }
-    }
-    coefficients.ll.AddChannel(channel_ll, DO_NOT_NORMALIZE_IMAGE);
-    coefficients.lh.AddChannel(channel_lh, DO_NOT_NORMALIZE_IMAGE);
-    coefficients.hl.AddChannel(channel_hl, DO_NOT_NORMALIZE_IMAGE);
-    coefficients.hh.AddChannel(channel_hh, DO_NOT_NORMALIZE_IMAGE);
+  // Transform a double precision copy of the even part of the image. The
+  // subbands are views of the transformed channels, which share (and keep
+  // alive) their data, so they are not copied.
+  ImageData transformed_image(even_size, num_channels);
+  const cv::Rect even_region(0, 0, even_size.width, even_size.height);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    cv::Mat transformed_channel = transformed_image.GetChannelImage(channel);
+    image.GetChannelImage(channel)(even_region).convertTo(
+        transformed_channel, CV_64FC1);
   }
+  LiftingWaveletTransform(WAVELET_FILTER_HAAR, 1, &transformed_image);
 
+  const auto get_subband_views = [&](const WaveletSubband subband) {
+    const cv::Rect region = GetSubbandRegion(even_size, 1, subband);
+    std::vector<cv::Mat> subband_channels;
+    for (int channel = 0; channel < num_channels; ++channel) {
+      subband_channels.push_back(
+          transformed_image.GetChannelImage(channel)(region));
+    }
+    return ImageData(subband_channels, DOUBLE_PRECISION);
+  };
+  WaveletCoefficients coefficients;
+  coefficients.ll = get_subband_views(WAVELET_SUBBAND_LL);
+  coefficients.lh = get_subband_views(WAVELET_SUBBAND_LH);
+  coefficients.hl = get_subband_views(WAVELET_SUBBAND_HL);
+  coefficients.hh = get_subband_views(WAVELET_SUBBAND_HH);
   return coefficients;
 }
 
 ImageData InverseWaveletTransform(const WaveletCoefficients& coefficients) {
-  const int num_channels = coefficients.ll.GetNumChannels();
-  CHECK_GT(num_channels, 0)
-      << "Coefficient images may not be empty.";
-
-  CHECK_EQ(num_channels, coefficients.lh.GetNumChannels())
-      << "All coefficients must have the same number of channels.";
-  CHECK_EQ(num_channels, coefficients.hl.GetNumChannels())
-      << "All coefficients must have the same number of channels.";
-  CHECK_EQ(num_channels, coefficients.hh.GetNumChannels())
-      << "All coefficients must have the same number of channels.";
-
-  const cv::Size coefficients_size = coefficients.ll.GetImageSize();
-  CHECK_EQ(coefficients_size, coefficients.lh.GetImageSize())
-      << "All coefficients must be the same size.";
-  CHECK_EQ(coefficients_size, coefficients.hl.GetImageSize())
-      << "All coefficients must be the same size.";
-  CHECK_EQ(coefficients_size, coefficients.hh.GetImageSize())
-      << "All coefficients must be the same size.";
-
-  // TODO: Can this be done with more efficiently by utilizing OpenCV?
-  ImageData reconstructed_image;
-  const cv::Size original_size(
-      coefficients_size.width * 2, coefficients_size.height * 2);
-  for (int channel = 0; channel < coefficients.ll.GetNumChannels(); ++channel) {
-    const cv::Mat channel_ll = coefficients.ll.GetChannelImage(channel);
-    const cv::Mat channel_lh = coefficients.lh.GetChannelImage(channel);
-    const cv::Mat channel_hl = coefficients.hl.GetChannelImage(channel);
-    const cv::Mat channel_hh = coefficients.hh.GetChannelImage(channel);
-    cv::Mat channel_image(original_size, channel_ll.type());
-
-    // This code has been adapted from
-    // http://stackoverflow.com/questions/20071854/wavelet-transform-in-opencv
-    for (int row = 0; row < coefficients_size.height; ++row) {
-      for (int col = 0; col < coefficients_size.width; ++col) {
-        const double ll_value = channel_ll.at<double>(row, col);
-        const double lh_value = channel_lh.at<double>(row, col);
-        const double hl_value = channel_hl.at<double>(row, col);
-        const double hh_value = channel_hh.at<double>(row, col);
-
-        // TODO: Shrinkage?
-
-        channel_image.at<double>(row * 2, col * 2) =
-            0.5 * (ll_value + lh_value + hl_value + hh_value);
-        channel_image.at<double>(row * 2, col * 2 + 1) =
-            0.5 * (ll_value - lh_value + hl_value - hh_value);
-        channel_image.at<double>(row * 2 + 1, col * 2) =
-            0.5 * (ll_value + lh_value - hl_value - hh_value);
-        channel_image.at<double>(row * 2 + 1, col * 2 + 1) =
-            0.5 * (ll_value - lh_value - hl_value + hh_value);
-      }
-    }
-    reconstructed_image.AddChannel(channel_image, DO_NOT_NORMALIZE_IMAGE);
-  }
-
+  // The stitched coefficients are the layout of a single level transform.
+  ImageData reconstructed_image = coefficients.GetCoefficientsImage();
+  InverseLiftingWaveletTransform(
+      WAVELET_FILTER_HAAR, 1, &reconstructed_image);
   return reconstructed_image;
 }
 
@@ -1,11 +1,66 @@
+// Discrete wavelet transforms of images. The transforms are computed in place
+// with the lifting scheme: every level splits the low-frequency region of each
+// channel into its even and odd rows (and columns), and updates each half from
+// the other with a few short filter steps. The result is stored in the
+// standard (Mallat) layout, where the coefficients of the coarsest level are
+// in the top-left corner, and the subbands can be accessed as views of the
+// channel images with GetSubbandRegion().
+
 #ifndef SRC_WAVELET_WAVELET_TRANSFORM_H_
 #define SRC_WAVELET_WAVELET_TRANSFORM_H_
 
 #include "image/image_data.h"
 
+#include "opencv2/core/core.hpp"
+
 namespace super_resolution {
 namespace wavelet {
 
+// The available wavelet filters. All are applied with symmetric extension at
+// the image borders, so images of any size can be transformed.
+enum WaveletFilter {
+  WAVELET_FILTER_HAAR,     // Orthonormal Haar wavelet.
+  WAVELET_FILTER_CDF_5_3,  // LeGall 5/3 wavelet (as in lossless JPEG 2000).
+  WAVELET_FILTER_CDF_9_7   // CDF 9/7 wavelet (as in lossy JPEG 2000).
+};
+
+// The subbands of one level of a 2D wavelet transform. LH holds the
+// horizontal details (high frequencies along the rows) and HL the vertical
+// details.
+enum WaveletSubband {
+  WAVELET_SUBBAND_LL,
+  WAVELET_SUBBAND_LH,
+  WAVELET_SUBBAND_HL,
+  WAVELET_SUBBAND_HH
+};
+
+// Transforms every channel of the given image in place with num_levels levels
+// of the given filter. The channels are transformed on num_threads threads
+// (0 = all hardware threads). The image must be in double precision.
+void LiftingWaveletTransform(
+    const WaveletFilter filter,
+    const int num_levels,
+    ImageData* image,
+    const int num_threads = 1);
+
+// Reverses LiftingWaveletTransform() with the same filter and number of
+// levels, which reconstructs the original image up to small numerical errors.
+void InverseLiftingWaveletTransform(
+    const WaveletFilter filter,
+    const int num_levels,
+    ImageData* image,
+    const int num_threads = 1);
+
+// Returns the region of the given subband of the given level (1 is the finest
+// level) in a transformed image of the given size. The LL subband of a level
+// is the region that is transformed by the next level. Use it to get a view of
+// a subband that shares its data with the transformed image:
+//   image.GetChannelImage(channel)(GetSubbandRegion(size, level, subband))
+cv::Rect GetSubbandRegion(
+    const cv::Size& image_size,
+    const int level,
+    const WaveletSubband subband);
+
 // Contains the four wavelet coefficients (LL, LH, HL, HH) which contain the
 // low-frequency and high-frequency coefficients of the DWT image
 // decomposition.
@@ -21,7 +76,12 @@ struct WaveletCoefficients {
   ImageData GetCoefficientsImage() const;
 };
 
-// Computes a discrete wavelet transform (DWT) of the given image.
+// Computes a single level Haar discrete wavelet transform (DWT) of the given
+// image, and returns its subbands. If the image size is odd, the last row or
+// column is dropped. The subbands are views of one transformed image, so
+// their channels share that allocation and their rows are not continuous.
+// Copying a subband image (e.g. with the ImageData copy constructor) gives it
+// continuous channels of its own.
 WaveletCoefficients WaveletTransform(const ImageData& image);
 
 // Returns an image reconstructed from the given wavelet components. If the
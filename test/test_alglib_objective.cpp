@@ -0,0 +1,83 @@
+#include <memory>
+#include <vector>
+
+#include "optimization/alglib_objective.h"
+#include "optimization/map_solver.h"
+#include "optimization/objective_function.h"
+
+#include "alglib/src/optimization.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::AlglibSolverSession;
+using super_resolution::MapSolverOptions;
+using super_resolution::ObjectiveFunction;
+using super_resolution::ObjectiveTerm;
+
+// A simple quadratic term sum_i (x_i - t_i)^2, with a target t that can be
+// changed between solves.
+class QuadraticTerm : public ObjectiveTerm {
+ public:
+  explicit QuadraticTerm(const std::vector<double>& target) : target_(target) {}
+
+  virtual double Compute(
+      const double* estimated_image_data, double* gradient) const {
+
+    double cost = 0.0;
+    for (int i = 0; i < target_.size(); ++i) {
+      const double difference = estimated_image_data[i] - target_[i];
+      cost += difference * difference;
+      if (gradient != nullptr) {
+        gradient[i] += 2.0 * difference;
+      }
+    }
+    return cost;
+  }
+
+ private:
+  const std::vector<double>& target_;
+};
+
+// Verifies that a session can be solved repeatedly with an objective that
+// changes between solves, for every solver type.
+TEST(AlglibSolverSession, RepeatedSolves) {
+  const int num_parameters = 6;
+  for (const auto solver : {
+      super_resolution::CG_SOLVER, super_resolution::LBFGS_SOLVER}) {
+    for (const bool use_numerical_differentiation : {false, true}) {
+      MapSolverOptions solver_options;
+      solver_options.least_squares_solver = solver;
+      solver_options.use_numerical_differentiation =
+          use_numerical_differentiation;
+      solver_options.gradient_norm_threshold = 1.0e-10;
+      solver_options.cost_decrease_threshold = 0.0;
+      solver_options.parameter_variation_threshold = 0.0;
+
+      std::vector<double> target = {1.0, -2.0, 3.0, 0.5, -0.25, 4.0};
+      ObjectiveFunction objective_function(num_parameters);
+      objective_function.AddTerm(
+          std::shared_ptr<ObjectiveTerm>(new QuadraticTerm(target)));
+      AlglibSolverSession solver_session(solver_options, objective_function);
+
+      alglib::real_1d_array solver_data;
+      solver_data.setlength(num_parameters);
+      for (int i = 0; i < num_parameters; ++i) {
+        solver_data[i] = 0.0;
+      }
+
+      for (int solve = 0; solve < 3; ++solve) {
+        const double final_cost = solver_session.Solve(&solver_data);
+        EXPECT_NEAR(final_cost, 0.0, 1.0e-6);
+        for (int i = 0; i < num_parameters; ++i) {
+          EXPECT_NEAR(solver_data[i], target[i], 1.0e-4);
+        }
+        // Change the objective in place for the next solve.
+        for (int i = 0; i < num_parameters; ++i) {
+          target[i] = target[i] * 0.5 + i;
+        }
+      }
+      EXPECT_EQ(solver_session.GetNumSolves(), 3);
+    }
+  }
+}
@@ -0,0 +1,84 @@
+#include <cstdint>
+
+#include "image/image_data.h"
+#include "util/aligned_allocator.h"
+#include "util/memory_accounting.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::util::AlignedMatAllocator;
+using super_resolution::util::AlignedMatAllocatorOptions;
+using super_resolution::util::GetMemoryUsage;
+using super_resolution::util::MEMORY_TAG_LOADERS;
+using super_resolution::util::ScopedMemoryTag;
+
+// Returns true if the matrix data is aligned to the given number of bytes.
+bool IsAligned(const cv::Mat& matrix, const uintptr_t alignment) {
+  return reinterpret_cast<uintptr_t>(matrix.data) % alignment == 0;
+}
+
+// Verifies that buffers are aligned in every huge page mode, and that they can
+// be used and freed like any other matrix.
+TEST(AlignedMatAllocator, AllocatesAlignedBuffers) {
+  for (const auto huge_page_mode : {
+      super_resolution::util::HUGE_PAGES_NONE,
+      super_resolution::util::HUGE_PAGES_TRANSPARENT,
+      super_resolution::util::HUGE_PAGES_EXPLICIT}) {
+    AlignedMatAllocatorOptions options;
+    options.huge_page_mode = huge_page_mode;
+    options.huge_page_threshold_bytes = 1024 * 1024;
+    AlignedMatAllocator allocator(options);
+
+    // Both below and above the huge page threshold.
+    for (const int num_rows : {3, 1000}) {
+      cv::Mat matrix;
+      matrix.allocator = &allocator;
+      matrix.create(num_rows, 301, CV_64FC1);
+      EXPECT_TRUE(IsAligned(matrix, AlignedMatAllocator::kAlignment));
+      EXPECT_TRUE(matrix.isContinuous());
+      matrix.setTo(2.5);
+      EXPECT_EQ(cv::sum(matrix)[0], 2.5 * num_rows * 301);
+    }
+  }
+}
+
+// Verifies that images allocate their planar buffers with the default
+// allocator once it is set, and that wrapped user data is not copied.
+TEST(AlignedMatAllocator, DefaultAllocator) {
+  cv::MatAllocator* previous_allocator = cv::Mat::getDefaultAllocator();
+  super_resolution::util::SetDefaultMatAllocator(AlignedMatAllocatorOptions());
+
+  const ImageData image(cv::Size(37, 11), 5);
+  EXPECT_TRUE(IsAligned(
+      image.GetChannelImage(0), AlignedMatAllocator::kAlignment));
+
+  double pixels[6] = {1, 2, 3, 4, 5, 6};
+  const cv::Mat wrapped(2, 3, CV_64FC1, pixels);
+  EXPECT_EQ(wrapped.ptr<double>(), pixels);
+
+  cv::Mat::setDefaultAllocator(previous_allocator);
+}
+
+// Verifies that buffers are recorded under the memory tag of the allocating
+// thread until they are freed, also if the tag changed in the meantime.
+TEST(AlignedMatAllocator, RecordsMemoryUsage) {
+  AlignedMatAllocator allocator((AlignedMatAllocatorOptions()));
+  const int64_t initial_bytes =
+      GetMemoryUsage(MEMORY_TAG_LOADERS).current_bytes;
+  const int64_t num_bytes = 10 * 20 * sizeof(double);
+  {
+    cv::Mat matrix;
+    matrix.allocator = &allocator;
+    {
+      const ScopedMemoryTag memory_tag(MEMORY_TAG_LOADERS);
+      matrix.create(10, 20, CV_64FC1);
+    }
+    EXPECT_EQ(GetMemoryUsage(MEMORY_TAG_LOADERS).current_bytes,
+              initial_bytes + num_bytes);
+  }
+  EXPECT_EQ(GetMemoryUsage(MEMORY_TAG_LOADERS).current_bytes, initial_bytes);
+}
@@ -0,0 +1,55 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/autotuner.h"
+#include "util/util.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::util::Autotuner;
+using super_resolution::util::GetAbsoluteCodePath;
+
+static const std::string kTestCachePath =
+    GetAbsoluteCodePath("test_data/test_tmp_dir/autotuner_test_cache");
+
+// Verifies that the fastest candidate is selected, and that the choice is
+// reused from memory and from the cache file without timing again.
+TEST(Autotuner, SelectsAndCachesFastestCandidate) {
+  std::remove(kTestCachePath.c_str());
+
+  // Candidate 1 is the fastest.
+  const std::vector<int> candidate_milliseconds = {6, 1, 4};
+  std::vector<int> num_runs(candidate_milliseconds.size(), 0);
+  const auto run_candidate = [&](const int candidate) {
+    num_runs[candidate]++;
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(candidate_milliseconds[candidate]));
+  };
+
+  Autotuner autotuner(kTestCachePath);
+  int choice = -1;
+  EXPECT_FALSE(autotuner.GetCachedChoice("sleep 64x64", &choice));
+  EXPECT_EQ(autotuner.SelectFastest("sleep 64x64", 3, run_candidate), 1);
+  for (const int candidate_num_runs : num_runs) {
+    EXPECT_GT(candidate_num_runs, 1);
+  }
+  EXPECT_TRUE(autotuner.GetCachedChoice("sleep 64x64", &choice));
+  EXPECT_EQ(choice, 1);
+
+  // Cached choices are not timed again, in this or in a later run.
+  const std::vector<int> num_runs_after_tuning = num_runs;
+  EXPECT_EQ(autotuner.SelectFastest("sleep 64x64", 3, run_candidate), 1);
+  const Autotuner loaded_autotuner(kTestCachePath);
+  EXPECT_TRUE(loaded_autotuner.GetCachedChoice("sleep 64x64", &choice));
+  EXPECT_EQ(choice, 1);
+  EXPECT_EQ(num_runs, num_runs_after_tuning);
+
+  // Other keys are tuned separately.
+  EXPECT_FALSE(loaded_autotuner.GetCachedChoice("sleep 32x32", &choice));
+
+  std::remove(kTestCachePath.c_str());
+}
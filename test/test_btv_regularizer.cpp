@@ -1,11 +1,16 @@
 #include <algorithm>
+#include <cmath>
+#include <utility>
 #include <vector>
 
 #include "optimization/btv_regularizer.h"
 
+#include "opencv2/core/core.hpp"
+
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 
+using testing::ContainerEq;
 using testing::SizeIs;
 
 // Small test image and expected returned values for this data.
@@ -91,5 +96,246 @@ TEST(BilateralTotalVariationRegularizer, ApplyToImageWithDifferentiation) {
   EXPECT_DOUBLE_EQ(residuals[0], 2.8125);
   EXPECT_DOUBLE_EQ(residuals[24], 0.0);
 
-  // TODO: check the gradient for accuracy.
+  // Compare the gradient to numerical differentiation of the weighted squared
+  // residual sum.
+  const double finite_difference = 1e-6;
+  const double gradient_error_tolerance = 0.0001;
+  const std::vector<double> image_data(test_image_data, test_image_data + 25);
+  for (int i = 0; i < 25; ++i) {
+    std::vector<double> pos_diff_image_data = image_data;
+    pos_diff_image_data[i] += finite_difference;
+    std::vector<double> neg_diff_image_data = image_data;
+    neg_diff_image_data[i] -= finite_difference;
+    const std::vector<double> pos_diff_residuals =
+        btv_regularizer.ApplyToImage(pos_diff_image_data.data(), 1);
+    const std::vector<double> neg_diff_residuals =
+        btv_regularizer.ApplyToImage(neg_diff_image_data.data(), 1);
+    double residual_sum_difference = 0.0;
+    for (int j = 0; j < 25; ++j) {
+      residual_sum_difference += gradient_constants[j] * (
+          pos_diff_residuals[j] * pos_diff_residuals[j] -
+          neg_diff_residuals[j] * neg_diff_residuals[j]);
+    }
+    const double numerical_gradient_at_i =
+        residual_sum_difference / (2 * finite_difference);
+    EXPECT_NEAR(numerical_gradient_at_i, gradient[i], gradient_error_tolerance);
+  }
+}
+
+// Straightforward per-pixel implementation of BTV, used as a reference to
+// verify the optimized implementation. Returns the residuals and the gradient
+// of the weighted squared residuals for a single channel.
+std::pair<std::vector<double>, std::vector<double>> ComputeReferenceBTV(
+    const std::vector<double>& image_data,
+    const std::vector<double>& gradient_constants,
+    const cv::Size& image_size,
+    const int scale_range,
+    const double spatial_decay) {
+
+  const int width = image_size.width;
+  const int height = image_size.height;
+  const int num_pixels = width * height;
+  std::vector<double> residuals(num_pixels, 0.0);
+  for (int row = 0; row < height; ++row) {
+    for (int col = 0; col < width; ++col) {
+      for (int i = 0; i <= scale_range; ++i) {
+        for (int j = 0; j <= scale_range; ++j) {
+          if (row + i >= height || col + j >= width) {
+            continue;
+          }
+          const double decay = std::pow(spatial_decay, i + j);
+          residuals[row * width + col] += decay * std::abs(
+              image_data[row * width + col] -
+              image_data[(row + i) * width + (col + j)]);
+        }
+      }
+    }
+  }
+
+  std::vector<double> gradient(num_pixels, 0.0);
+  for (int row = 0; row < height; ++row) {
+    for (int col = 0; col < width; ++col) {
+      const int index = row * width + col;
+      const double weight = 2 * gradient_constants[index] * residuals[index];
+      for (int i = 0; i <= scale_range; ++i) {
+        for (int j = 0; j <= scale_range; ++j) {
+          if ((i == 0 && j == 0) || row + i >= height || col + j >= width) {
+            continue;
+          }
+          const int offset_index = (row + i) * width + (col + j);
+          const double diff = image_data[index] - image_data[offset_index];
+          const double sign = (diff > 0) ? 1.0 : ((diff < 0) ? -1.0 : 0.0);
+          const double decay = std::pow(spatial_decay, i + j);
+          gradient[index] += weight * decay * sign;
+          gradient[offset_index] -= weight * decay * sign;
+        }
+      }
+    }
+  }
+  return std::make_pair(residuals, gradient);
+}
+
+// Verifies the optimized implementation against the reference implementation
+// for various image sizes, ranges, channel counts, and thread counts. Ranges 1
+// to 3 use specialized kernels and range 4 uses the generic one.
+TEST(BilateralTotalVariationRegularizer, MatchesReferenceImplementation) {
+  const std::vector<cv::Size> image_sizes = {
+    cv::Size(5, 5), cv::Size(9, 4), cv::Size(2, 7), cv::Size(1, 1)
+  };
+  const int num_channels = 2;
+  for (const cv::Size& image_size : image_sizes) {
+    const int num_pixels = image_size.area();
+    std::vector<double> image_data(num_pixels * num_channels);
+    std::vector<double> gradient_constants(num_pixels * num_channels);
+    for (int i = 0; i < image_data.size(); ++i) {
+      image_data[i] = std::cos(2.3 * i) * 3.0;
+      gradient_constants[i] = 0.25 + (i % 5) * 0.1;
+    }
+
+    for (const int scale_range : {1, 2, 3, 4}) {
+      for (const int num_threads : {1, 3}) {
+        super_resolution::BilateralTotalVariationRegularizer btv_regularizer(
+            image_size, scale_range, 0.7);
+        btv_regularizer.SetNumThreads(num_threads);
+        const auto& residuals_and_gradient =
+            btv_regularizer.ApplyToImageWithDifferentiation(
+                image_data.data(), gradient_constants, num_channels);
+        EXPECT_THAT(
+            btv_regularizer.ApplyToImage(image_data.data(), num_channels),
+            ContainerEq(residuals_and_gradient.first));
+
+        for (int channel = 0; channel < num_channels; ++channel) {
+          const int offset = channel * num_pixels;
+          const std::vector<double> channel_data(
+              image_data.begin() + offset,
+              image_data.begin() + offset + num_pixels);
+          const std::vector<double> channel_gradient_constants(
+              gradient_constants.begin() + offset,
+              gradient_constants.begin() + offset + num_pixels);
+          const auto& expected = ComputeReferenceBTV(
+              channel_data,
+              channel_gradient_constants,
+              image_size,
+              scale_range,
+              0.7);
+          for (int i = 0; i < num_pixels; ++i) {
+            EXPECT_DOUBLE_EQ(
+                residuals_and_gradient.first[offset + i], expected.first[i]);
+            EXPECT_NEAR(
+                residuals_and_gradient.second[offset + i],
+                expected.second[i],
+                1e-9);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Verifies that the fused weighted gradient matches differentiating with the
+// equivalent gradient constants, and that it adds to the existing gradient.
+TEST(BilateralTotalVariationRegularizer, AccumulateWeightedGradient) {
+  const cv::Size image_size(9, 6);
+  const int num_channels = 2;
+  const int num_parameters = image_size.area() * num_channels;
+  const double regularization_parameter = 0.3;
+  std::vector<double> image_data(num_parameters);
+  std::vector<double> weights(num_parameters);
+  std::vector<double> gradient_constants(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = std::cos(2.3 * i) * 3.0;
+    weights[i] = 1.0 / (1.0 + (i % 4));
+    gradient_constants[i] = regularization_parameter * weights[i];
+  }
+
+  for (const int num_threads : {1, 3}) {
+    super_resolution::BilateralTotalVariationRegularizer btv_regularizer(
+        image_size, 2, 0.7);
+    btv_regularizer.SetNumThreads(num_threads);
+    const auto& residuals_and_gradient =
+        btv_regularizer.ApplyToImageWithDifferentiation(
+            image_data.data(), gradient_constants, num_channels);
+    double expected_cost = 0.0;
+    for (int i = 0; i < num_parameters; ++i) {
+      const double residual = residuals_and_gradient.first[i];
+      expected_cost += gradient_constants[i] * residual * residual;
+    }
+
+    std::vector<double> gradient(num_parameters, 1.0);
+    std::vector<double> residuals(num_parameters);
+    const double cost = btv_regularizer.AccumulateWeightedGradient(
+        image_data.data(),
+        num_channels,
+        regularization_parameter,
+        weights.data(),
+        gradient.data(),
+        residuals.data());
+    EXPECT_NEAR(cost, expected_cost, 1e-9);
+    EXPECT_THAT(residuals, ContainerEq(residuals_and_gradient.first));
+    for (int i = 0; i < num_parameters; ++i) {
+      EXPECT_NEAR(gradient[i], residuals_and_gradient.second[i] + 1.0, 1e-9);
+    }
+
+    // The residuals are optional.
+    std::vector<double> gradient_without_residuals(num_parameters, 1.0);
+    EXPECT_EQ(
+        btv_regularizer.AccumulateWeightedGradient(
+            image_data.data(),
+            num_channels,
+            regularization_parameter,
+            weights.data(),
+            gradient_without_residuals.data(),
+            nullptr),
+        cost);
+    EXPECT_THAT(gradient_without_residuals, ContainerEq(gradient));
+  }
+}
+
+// Verifies that the difference operators reproduce the regularizer values and
+// that the transpose operators are the adjoints of the operators.
+TEST(BilateralTotalVariationRegularizer, DifferenceOperators) {
+  const cv::Size image_size(6, 5);
+  const int num_channels = 2;
+  const int num_data_points = image_size.area() * num_channels;
+  std::vector<double> image_data(num_data_points);
+  for (int i = 0; i < num_data_points; ++i) {
+    image_data[i] = std::sin(1.3 * i) * 2.0;
+  }
+
+  const super_resolution::BilateralTotalVariationRegularizer btv_regularizer(
+      image_size, 2, 0.6);
+  const int num_operators = btv_regularizer.GetNumDifferenceOperators();
+  EXPECT_EQ(num_operators, 8);
+
+  // r_i = sum_k |(G_k x)_i|.
+  std::vector<double> differences(num_operators * num_data_points);
+  btv_regularizer.ApplyDifferenceOperators(
+      image_data.data(), num_channels, differences.data());
+  const std::vector<double> residuals =
+      btv_regularizer.ApplyToImage(image_data.data(), num_channels);
+  for (int i = 0; i < num_data_points; ++i) {
+    double residual = 0.0;
+    for (int k = 0; k < num_operators; ++k) {
+      residual += std::abs(differences[k * num_data_points + i]);
+    }
+    EXPECT_NEAR(residuals[i], residual, 1e-12);
+  }
+
+  // <Gx, d> = <x, G^T d>.
+  std::vector<double> test_differences(num_operators * num_data_points);
+  for (int i = 0; i < test_differences.size(); ++i) {
+    test_differences[i] = std::cos(0.7 * i);
+  }
+  std::vector<double> transpose(num_data_points);
+  btv_regularizer.ApplyDifferenceOperatorsTranspose(
+      test_differences.data(), num_channels, transpose.data());
+  double differences_dot_product = 0.0;
+  for (int i = 0; i < differences.size(); ++i) {
+    differences_dot_product += differences[i] * test_differences[i];
+  }
+  double image_dot_product = 0.0;
+  for (int i = 0; i < num_data_points; ++i) {
+    image_dot_product += image_data[i] * transpose[i];
+  }
+  EXPECT_NEAR(differences_dot_product, image_dot_product, 1e-9);
 }
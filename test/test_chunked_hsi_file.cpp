@@ -0,0 +1,164 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "hyperspectral/chunked_hsi_file.h"
+#include "hyperspectral/hyperspectral_data_loader.h"
+#include "image/image_data.h"
+#include "util/util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ChunkedHSIFileInfo;
+using super_resolution::ChunkedHSIFileOptions;
+using super_resolution::HSIDataRange;
+using super_resolution::HyperspectralDataLoader;
+using super_resolution::ImageData;
+using super_resolution::util::GetAbsoluteCodePath;
+
+static const std::string kTestChunkedFilePath =
+    GetAbsoluteCodePath("test_data/test_tmp_dir/chunked_hsi_file_test.srhsc");
+
+namespace {
+
+// Returns an image of the given size and number of bands in which every pixel
+// value is distinct.
+ImageData MakeTestImage(
+    const cv::Size& size,
+    const int num_bands,
+    const super_resolution::ImagePrecision precision) {
+
+  std::vector<double> pixels(size.width * size.height * num_bands);
+  for (int i = 0; i < pixels.size(); ++i) {
+    pixels[i] = 0.001 * i - 0.25;
+  }
+  return ImageData(pixels.data(), size, num_bands, precision);
+}
+
+// Expects the image to be the given range of the full image.
+void ExpectImageIsRange(
+    const ImageData& image,
+    const ImageData& full_image,
+    const HSIDataRange& data_range) {
+
+  const cv::Rect region(
+      data_range.start_col,
+      data_range.start_row,
+      data_range.end_col - data_range.start_col,
+      data_range.end_row - data_range.start_row);
+  ASSERT_EQ(image.GetImageSize(), region.size());
+  ASSERT_EQ(image.GetNumChannels(),
+            data_range.end_band - data_range.start_band);
+  EXPECT_EQ(image.GetPrecision(), full_image.GetPrecision());
+  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+    const cv::Mat expected_channel =
+        full_image.GetChannelImage(data_range.start_band + channel)(region);
+    EXPECT_EQ(cv::norm(image.GetChannelImage(channel), expected_channel,
+                       cv::NORM_INF), 0.0) << "channel " << channel;
+  }
+}
+
+}  // namespace
+
+// Verifies that the whole image and ranges that cut through tiles and band
+// blocks are loaded exactly, in both precisions and with and without
+// compression.
+TEST(ChunkedHSIFile, SaveAndLoadRanges) {
+  std::vector<super_resolution::ChunkCompression> compressions = {
+    super_resolution::CHUNK_COMPRESSION_NONE
+  };
+  if (super_resolution::IsChunkCompressionSupported(
+          super_resolution::CHUNK_COMPRESSION_ZSTD)) {
+    compressions.push_back(super_resolution::CHUNK_COMPRESSION_ZSTD);
+  }
+  for (const auto precision : {
+      super_resolution::DOUBLE_PRECISION,
+      super_resolution::SINGLE_PRECISION}) {
+    for (const auto compression : compressions) {
+      // The image size is not a multiple of the tile size, and the number of
+      // bands is not a multiple of the band block size.
+      const ImageData image = MakeTestImage(cv::Size(23, 17), 7, precision);
+      ChunkedHSIFileOptions options;
+      options.tile_size = cv::Size(8, 5);
+      options.band_block_size = 3;
+      options.compression = compression;
+      super_resolution::SaveChunkedHSIFile(
+          image, kTestChunkedFilePath, options);
+
+      ChunkedHSIFileInfo info;
+      ASSERT_TRUE(super_resolution::ReadChunkedHSIFileInfo(
+          kTestChunkedFilePath, &info));
+      EXPECT_EQ(info.image_size, cv::Size(23, 17));
+      EXPECT_EQ(info.num_bands, 7);
+      EXPECT_EQ(info.precision, precision);
+      EXPECT_EQ(info.tile_size, cv::Size(8, 5));
+      EXPECT_EQ(info.band_block_size, 3);
+      EXPECT_EQ(info.compression, compression);
+
+      HSIDataRange full_range;
+      full_range.end_row = 17;
+      full_range.end_col = 23;
+      full_range.end_band = 7;
+      ExpectImageIsRange(
+          super_resolution::LoadChunkedHSIFile(
+              kTestChunkedFilePath, full_range),
+          image,
+          full_range);
+
+      HSIDataRange cropped_range;
+      cropped_range.start_row = 4;
+      cropped_range.end_row = 11;
+      cropped_range.start_col = 7;
+      cropped_range.end_col = 20;
+      cropped_range.start_band = 2;
+      cropped_range.end_band = 5;
+      ExpectImageIsRange(
+          super_resolution::LoadChunkedHSIFile(
+              kTestChunkedFilePath, cropped_range, 1),
+          image,
+          cropped_range);
+    }
+  }
+}
+
+// Verifies that the hyperspectral data loader reads and writes chunked files,
+// both directly and through a configuration file that crops them.
+TEST(ChunkedHSIFile, LoaderRecognizesChunkedFiles) {
+  const ImageData image = MakeTestImage(
+      cv::Size(12, 9), 5, super_resolution::DOUBLE_PRECISION);
+  const HyperspectralDataLoader hs_data_writer(kTestChunkedFilePath);
+  hs_data_writer.SaveImage(image, super_resolution::HSIBinaryDataFormat());
+
+  HyperspectralDataLoader hs_data_loader(kTestChunkedFilePath);
+  EXPECT_EQ(hs_data_loader.GetNumBands(), 5);
+  hs_data_loader.LoadBandsFromENVIFile(1, 3);
+  HSIDataRange band_range;
+  band_range.end_row = 9;
+  band_range.end_col = 12;
+  band_range.start_band = 1;
+  band_range.end_band = 4;
+  ExpectImageIsRange(hs_data_loader.GetImage(), image, band_range);
+
+  const std::string config_file_path = kTestChunkedFilePath + ".config";
+  std::ofstream config_file(config_file_path);
+  ASSERT_TRUE(config_file.is_open());
+  config_file << "file " << kTestChunkedFilePath << "\n";
+  config_file << "start_row 2\nend_row 7\n";
+  config_file << "start_col 3\nend_col 12\n";
+  config_file << "start_band 1\nend_band 5\n";
+  config_file.close();
+  HyperspectralDataLoader config_data_loader(config_file_path);
+  EXPECT_EQ(config_data_loader.GetNumBands(), 4);
+  config_data_loader.LoadBandsFromENVIFile(2, 2);
+  HSIDataRange cropped_range;
+  cropped_range.start_row = 2;
+  cropped_range.end_row = 7;
+  cropped_range.start_col = 3;
+  cropped_range.end_col = 12;
+  cropped_range.start_band = 3;
+  cropped_range.end_band = 5;
+  ExpectImageIsRange(config_data_loader.GetImage(), image, cropped_range);
+}
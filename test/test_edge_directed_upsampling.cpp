@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cmath>
+
+#include "image/edge_directed_upsampling.h"
+#include "image/image_data.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+
+// Returns a single-channel image with the given pixel values.
+template <typename PixelFunction>
+ImageData MakeImage(const cv::Size& size, const PixelFunction& pixel_value) {
+  cv::Mat channel(size, CV_64FC1);
+  for (int row = 0; row < size.height; ++row) {
+    for (int col = 0; col < size.width; ++col) {
+      channel.at<double>(row, col) = pixel_value(row, col);
+    }
+  }
+  ImageData image;
+  image.AddChannel(channel, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  return image;
+}
+
+// Verifies that the original pixels are kept at the top-left of every patch,
+// and that linear gradients are reproduced exactly away from the border.
+TEST(EdgeDirectedUpsampling, KeepsPixelsAndLinearGradients) {
+  const cv::Size size(20, 16);
+  const ImageData image = MakeImage(size, [](const int row, const int col) {
+    return 0.1 * row + 0.05 * col;
+  });
+  for (const int scale : {1, 2, 3, 4}) {
+    const ImageData upsampled_image =
+        super_resolution::EdgeDirectedUpsample(image, scale, 2);
+    ASSERT_EQ(upsampled_image.GetImageSize(), size * scale);
+    ASSERT_EQ(upsampled_image.GetNumChannels(), 1);
+    const cv::Mat channel = upsampled_image.GetChannelImage(0);
+    for (int row = 0; row < size.height; ++row) {
+      for (int col = 0; col < size.width; ++col) {
+        EXPECT_NEAR(channel.at<double>(scale * row, scale * col),
+                    image.GetChannelImage(0).at<double>(row, col), 1.0e-9)
+            << "scale " << scale;
+      }
+    }
+    // The final cubic resampling of other scales is not exact.
+    if (scale == 3) {
+      continue;
+    }
+    const int margin = 5 * scale;
+    for (int row = margin; row < scale * size.height - margin; ++row) {
+      for (int col = margin; col < scale * size.width - margin; ++col) {
+        EXPECT_NEAR(channel.at<double>(row, col),
+                    (0.1 * row + 0.05 * col) / scale, 1.0e-9)
+            << "scale " << scale;
+      }
+    }
+  }
+
+  ImageData single_precision_image = image;
+  single_precision_image.SetPrecision(super_resolution::SINGLE_PRECISION);
+  EXPECT_EQ(
+      super_resolution::EdgeDirectedUpsample(single_precision_image, 2)
+          .GetPrecision(),
+      super_resolution::SINGLE_PRECISION);
+}
+
+// Verifies that a diagonal edge is reconstructed much more accurately than
+// with bilinear interpolation on the same grid.
+TEST(EdgeDirectedUpsampling, ReconstructsDiagonalEdges) {
+  const auto edge = [](const int row, const int col) {
+    const double distance = (col - 0.6 * row - 7.3) / 1.2;
+    return 0.1 + 0.8 / (1.0 + std::exp(-3.0 * distance));
+  };
+  const cv::Size high_res_size(32, 32);
+  const ImageData image = MakeImage(
+      cv::Size(16, 16), [&edge](const int row, const int col) {
+        return edge(2 * row, 2 * col);
+      });
+  const cv::Mat upsampled_channel =
+      super_resolution::EdgeDirectedUpsample(image, 2).GetChannelImage(0);
+
+  // Bilinear interpolation that also keeps the original pixels at the even
+  // pixels.
+  const cv::Mat channel = image.GetChannelImage(0);
+  const auto bilinear = [&channel](const int row, const int col) {
+    const int row_0 = row / 2;
+    const int col_0 = col / 2;
+    const int row_1 = std::min(row_0 + 1, channel.rows - 1);
+    const int col_1 = std::min(col_0 + 1, channel.cols - 1);
+    const double row_weight = 0.5 * (row % 2);
+    const double col_weight = 0.5 * (col % 2);
+    return (1.0 - row_weight) *
+        ((1.0 - col_weight) * channel.at<double>(row_0, col_0) +
+         col_weight * channel.at<double>(row_0, col_1)) +
+        row_weight *
+        ((1.0 - col_weight) * channel.at<double>(row_1, col_0) +
+         col_weight * channel.at<double>(row_1, col_1));
+  };
+
+  double squared_error = 0.0;
+  double bilinear_squared_error = 0.0;
+  for (int row = 4; row < high_res_size.height - 4; ++row) {
+    for (int col = 4; col < high_res_size.width - 4; ++col) {
+      const double error =
+          upsampled_channel.at<double>(row, col) - edge(row, col);
+      const double bilinear_error = bilinear(row, col) - edge(row, col);
+      squared_error += error * error;
+      bilinear_squared_error += bilinear_error * bilinear_error;
+    }
+  }
+  EXPECT_LT(squared_error, 0.25 * bilinear_squared_error);
+}
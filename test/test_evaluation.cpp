@@ -1,6 +1,7 @@
 #include <cmath>
 #include <limits>
 
+#include "evaluation/image_quality_evaluator.h"
 #include "evaluation/peak_signal_to_noise_ratio.h"
 #include "evaluation/structural_similarity.h"
 #include "image/image_data.h"
@@ -188,3 +189,109 @@ TEST(Evaluation, SSIM) {
       ssim_evaluator_2.Evaluate(test_image_2),
       ssim_evaluator_3.Evaluate(ground_truth_2));
 }
+
+// Tests that the single-pass evaluator agrees with the individual metrics.
+TEST(Evaluation, ImageQualityEvaluator) {
+  const cv::Mat ground_truth_matrix = (cv::Mat_<double>(4, 4)
+      << 0.0, 0.1, 0.2, 0.3,
+         0.7, 0.6, 0.5, 0.4,
+         0.8, 0.9, 1.0, 0.5,
+         0.4, 0.6, 0.0, 1.0);
+  const cv::Mat test_image_matrix = (cv::Mat_<double>(4, 4)
+      << 0.2, 0.9, 1.0, 0.0,
+         0.7, 0.0, 0.8, 0.3,
+         0.1, 0.0, 0.2, 1.0,
+         0.0, 0.5, 0.5, 0.3);
+  super_resolution::ImageData ground_truth;
+  super_resolution::ImageData test_image;
+  for (int i = 0; i < 3; ++i) {
+    ground_truth.AddChannel(
+        ground_truth_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+    test_image.AddChannel(
+        (i == 1) ? ground_truth_matrix : test_image_matrix,
+        super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  }
+
+  /* Identical images have no error, an SSIM of 1 and no spectral angle. */
+
+  const super_resolution::ImageQualityEvaluator evaluator(ground_truth);
+  const super_resolution::ImageQualityMetrics identical_metrics =
+      evaluator.Evaluate(ground_truth);
+  EXPECT_EQ(identical_metrics.mean_squared_error, 0.0);
+  EXPECT_EQ(
+      identical_metrics.peak_signal_to_noise_ratio,
+      std::numeric_limits<double>::infinity());
+  EXPECT_NEAR(identical_metrics.structural_similarity, 1.0, 1e-12);
+  EXPECT_NEAR(identical_metrics.spectral_angle, 0.0, 1e-6);
+
+  /* The PSNR and MSE match the PSNR evaluator. */
+
+  const super_resolution::ImageQualityMetrics metrics =
+      evaluator.Evaluate(test_image);
+  const super_resolution::PeakSignalToNoiseRatioEvaluator psnr_evaluator(
+      ground_truth);
+  EXPECT_NEAR(
+      metrics.peak_signal_to_noise_ratio,
+      psnr_evaluator.Evaluate(test_image),
+      1e-12);
+  ASSERT_EQ(metrics.channel_mean_squared_errors.size(), 3);
+  EXPECT_EQ(metrics.channel_mean_squared_errors[1], 0.0);
+  EXPECT_NEAR(
+      metrics.mean_squared_error,
+      2.0 * metrics.channel_mean_squared_errors[0] / 3.0,
+      1e-12);
+  ASSERT_EQ(metrics.channel_structural_similarities.size(), 3);
+  EXPECT_NEAR(metrics.channel_structural_similarities[1], 1.0, 1e-12);
+  EXPECT_LT(metrics.channel_structural_similarities[0], 1.0);
+
+  /* With a 1x1 window, the SSIM of each pixel only compares the means. */
+
+  super_resolution::ImageQualityEvaluatorOptions pixel_window_options;
+  pixel_window_options.ssim_window_size = 1;
+  const super_resolution::ImageQualityEvaluator pixel_window_evaluator(
+      ground_truth, pixel_window_options);
+  const double c1 = 0.0001;
+  double expected_ssim_sum = 0.0;
+  for (int i = 0; i < 16; ++i) {
+    const double x = ground_truth_matrix.at<double>(i);
+    const double y = test_image_matrix.at<double>(i);
+    expected_ssim_sum += (2.0 * x * y + c1) / (x * x + y * y + c1);
+  }
+  EXPECT_NEAR(
+      pixel_window_evaluator.Evaluate(test_image)
+          .channel_structural_similarities[0],
+      expected_ssim_sum / 16.0,
+      1e-12);
+
+  /* The spectral angle between orthogonal spectra is pi / 2, and does not
+     depend on the brightness. */
+
+  super_resolution::ImageData red_image;
+  super_resolution::ImageData green_image;
+  const cv::Mat ones = cv::Mat::ones(4, 4, CV_64F);
+  const cv::Mat zeros = cv::Mat::zeros(4, 4, CV_64F);
+  red_image.AddChannel(ones, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  red_image.AddChannel(zeros, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  green_image.AddChannel(zeros, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  green_image.AddChannel(ones, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  const super_resolution::ImageQualityEvaluator red_evaluator(red_image);
+  EXPECT_NEAR(
+      red_evaluator.Evaluate(green_image).spectral_angle, M_PI / 2.0, 1e-12);
+  super_resolution::ImageData dark_red_image = red_image;
+  dark_red_image *= 0.5;
+  EXPECT_NEAR(red_evaluator.Evaluate(dark_red_image).spectral_angle, 0.0, 1e-6);
+
+  /* The result does not depend on the number of threads. */
+
+  super_resolution::ImageQualityEvaluatorOptions threaded_options;
+  threaded_options.num_threads = 3;
+  const super_resolution::ImageQualityEvaluator threaded_evaluator(
+      ground_truth, threaded_options);
+  const super_resolution::ImageQualityMetrics threaded_metrics =
+      threaded_evaluator.Evaluate(test_image);
+  EXPECT_DOUBLE_EQ(threaded_metrics.mean_squared_error,
+                   metrics.mean_squared_error);
+  EXPECT_DOUBLE_EQ(threaded_metrics.structural_similarity,
+                   metrics.structural_similarity);
+  EXPECT_NEAR(threaded_metrics.spectral_angle, metrics.spectral_angle, 1e-12);
+}
@@ -0,0 +1,105 @@
+#include <cmath>
+#include <vector>
+
+#include "image/image_data.h"
+#include "motion/frame_selection.h"
+#include "motion/motion_shift.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::FrameScore;
+using super_resolution::ImageData;
+using super_resolution::MotionShift;
+using super_resolution::MotionShiftSequence;
+
+using testing::ElementsAre;
+
+constexpr int kScale = 2;
+
+// Returns the LR frame of a smooth HR scene seen with the given motion shift
+// (in HR pixels), using the convention of the motion module.
+ImageData GetTestFrame(const cv::Size& size, const double dx, const double dy) {
+  cv::Mat channel(size, CV_64FC1);
+  for (int row = 0; row < size.height; ++row) {
+    for (int col = 0; col < size.width; ++col) {
+      const double x = kScale * col - dx;
+      const double y = kScale * row - dy;
+      channel.at<double>(row, col) =
+          0.5 + 0.2 * std::sin(0.9 * x + 0.3 * y) +
+          0.2 * std::cos(0.4 * x - 0.8 * y);
+    }
+  }
+  ImageData frame;
+  frame.AddChannel(channel, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  return frame;
+}
+
+// Verifies that frames at new sub-pixel phases are preferred over frames at
+// phases that are already covered.
+TEST(FrameSelection, PrefersNewPhases) {
+  const cv::Size size(24, 24);
+  const MotionShiftSequence motion_sequence({
+    MotionShift(0, 0),
+    MotionShift(2, 0),  // The reference phase, one LR pixel to the right.
+    MotionShift(0, 0),
+    MotionShift(1, 1)
+  });
+  std::vector<ImageData> frames;
+  for (int i = 0; i < motion_sequence.GetNumMotionShifts(); ++i) {
+    frames.push_back(GetTestFrame(
+        size, motion_sequence[i].dx, motion_sequence[i].dy));
+  }
+
+  EXPECT_THAT(
+      super_resolution::SelectFrames(frames, motion_sequence, kScale, 2),
+      ElementsAre(0, 3));
+  EXPECT_THAT(
+      super_resolution::SelectFrames(frames, motion_sequence, kScale, 0),
+      ElementsAre(0, 1, 2, 3));
+  EXPECT_THAT(
+      super_resolution::SelectFrames(frames, motion_sequence, kScale, 4),
+      ElementsAre(0, 1, 2, 3));
+}
+
+// Verifies that blurry and poorly registered frames score lower than a sharp,
+// well registered frame at the same phase, and are not selected.
+TEST(FrameSelection, PrefersSharpRegisteredFrames) {
+  const cv::Size size(24, 24);
+  const MotionShiftSequence motion_sequence({
+    MotionShift(0, 0),
+    MotionShift(1, 0),
+    MotionShift(1, 0),
+    MotionShift(1, 0)
+  });
+  std::vector<ImageData> frames = {
+    GetTestFrame(size, 0, 0),
+    GetTestFrame(size, 1, 0),
+    GetTestFrame(size, 1, 0),
+    GetTestFrame(size, 7, 5)  // Not the motion given in the sequence.
+  };
+  cv::Mat blurred_channel;
+  cv::GaussianBlur(
+      frames[2].GetChannelImage(0), blurred_channel, cv::Size(5, 5), 1.5);
+  frames[2] = ImageData();
+  frames[2].AddChannel(
+      blurred_channel, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+
+  const std::vector<FrameScore> scores =
+      super_resolution::ScoreFrames(frames, motion_sequence, kScale);
+  ASSERT_EQ(scores.size(), 4);
+  EXPECT_EQ(scores[0].registration_error, 0.0);
+  EXPECT_LT(scores[2].sharpness, scores[1].sharpness);
+  EXPECT_GT(scores[3].registration_error, scores[1].registration_error);
+  for (const FrameScore& score : scores) {
+    EXPECT_GT(score.quality, 0.0);
+    EXPECT_LE(score.quality, 1.0);
+  }
+
+  EXPECT_THAT(
+      super_resolution::SelectFrames(frames, motion_sequence, kScale, 2),
+      ElementsAre(0, 1));
+}
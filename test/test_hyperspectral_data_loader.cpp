@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <fstream>
 #include <string>
+#include <vector>
 
 #include "hyperspectral/hyperspectral_data_loader.h"
 #include "image/image_data.h"
@@ -109,3 +112,389 @@ TEST(HyperspectralDataLoader, SaveBinaryData) {
   EXPECT_TRUE(AreImagesEqual(
       original_image, saved_image, kPrecisionErrorTolerance));
 }
+
+// Tests loading and saving an image in blocks of bands, which is used to
+// stream large images through the solver.
+TEST(HyperspectralDataLoader, LoadAndSaveBandBlocks) {
+  super_resolution::HyperspectralDataLoader hs_data_loader(
+      kTestConfigFilePath);
+  hs_data_loader.LoadImageFromENVIFile();
+  const super_resolution::ImageData original_image = hs_data_loader.GetImage();
+  const int num_bands = hs_data_loader.GetNumBands();
+  EXPECT_EQ(num_bands, 5);
+
+  // Save the image in blocks of two bands in any order, as distributed runs
+  // do. The second pass writes over the file of the first one, and saving
+  // its first block last must not cut off the other blocks.
+  const std::string output_file_path = kTestOutputFilePath + "_band_blocks";
+  const super_resolution::HyperspectralDataLoader block_writer(
+      output_file_path);
+  const super_resolution::HSIBinaryDataFormat data_format;
+  const std::vector<std::vector<int>> block_orders = {{0, 4, 2}, {4, 2, 0}};
+  for (const std::vector<int>& block_order : block_orders) {
+    for (const int first_band : block_order) {
+      const int num_block_bands = std::min(2, num_bands - first_band);
+      hs_data_loader.LoadBandsFromENVIFile(first_band, num_block_bands);
+      const super_resolution::ImageData block_image =
+          hs_data_loader.GetImage();
+      ASSERT_EQ(block_image.GetNumChannels(), num_block_bands);
+      for (int band = 0; band < num_block_bands; ++band) {
+        EXPECT_TRUE(AreMatricesEqual(
+            block_image.GetChannelImage(band),
+            original_image.GetChannelImage(first_band + band),
+            0.0));
+      }
+      block_writer.SaveImageBands(
+          block_image, data_format, first_band, num_bands);
+    }
+
+    const std::string config_file_path = output_file_path + ".config";
+    super_resolution::HyperspectralDataLoader saved_data_loader(
+        config_file_path);
+    saved_data_loader.LoadImageFromENVIFile();
+    EXPECT_TRUE(AreImagesEqual(
+        original_image,
+        saved_data_loader.GetImage(),
+        kPrecisionErrorTolerance));
+  }
+}
+
+// Tests that images saved in the BIL and BIP interleave formats are read back
+// in the same band layout as the BSQ original.
+TEST(HyperspectralDataLoader, SaveAndLoadInterleavedBinaryData) {
+  super_resolution::HyperspectralDataLoader hs_data_loader_1(
+      kTestConfigFilePath);
+  hs_data_loader_1.LoadImageFromENVIFile();
+  const super_resolution::ImageData original_image =
+      hs_data_loader_1.GetImage();
+
+  for (const auto interleave : {
+      super_resolution::HSI_BINARY_INTERLEAVE_BIL,
+      super_resolution::HSI_BINARY_INTERLEAVE_BIP}) {
+    const std::string output_file_path =
+        kTestOutputFilePath + "_interleave_" + std::to_string(interleave);
+    super_resolution::HyperspectralDataLoader hs_data_loader_2(
+        output_file_path);
+    super_resolution::HSIBinaryDataFormat data_format;
+    data_format.interleave = interleave;
+    hs_data_loader_2.SaveImage(original_image, data_format);
+
+    const std::string config_file_path = output_file_path + ".config";
+    super_resolution::HyperspectralDataLoader hs_data_loader_3(
+        config_file_path);
+    hs_data_loader_3.LoadImageFromENVIFile();
+    const super_resolution::ImageData saved_image =
+        hs_data_loader_3.GetImage();
+    EXPECT_TRUE(AreImagesEqual(
+        original_image, saved_image, kPrecisionErrorTolerance));
+  }
+}
+
+// Tests that integer and double data types are saved and read back exactly,
+// including when the data is loaded in single precision.
+TEST(HyperspectralDataLoader, SaveAndLoadDataTypes) {
+  // Integer values that fit in every supported data type.
+  super_resolution::ImageData original_image;
+  for (int channel = 0; channel < 4; ++channel) {
+    cv::Mat channel_image(5, 3, CV_64FC1);
+    for (int row = 0; row < 5; ++row) {
+      for (int col = 0; col < 3; ++col) {
+        channel_image.at<double>(row, col) = channel * 50 + row * 10 + col;
+      }
+    }
+    original_image.AddChannel(
+        channel_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  }
+
+  for (const auto data_type : {
+      super_resolution::HSI_DATA_TYPE_BYTE,
+      super_resolution::HSI_DATA_TYPE_INT16,
+      super_resolution::HSI_DATA_TYPE_INT32,
+      super_resolution::HSI_DATA_TYPE_DOUBLE,
+      super_resolution::HSI_DATA_TYPE_UINT16}) {
+    const std::string output_file_path =
+        kTestOutputFilePath + "_data_type_" + std::to_string(data_type);
+    super_resolution::HyperspectralDataLoader hs_data_loader_1(
+        output_file_path);
+    super_resolution::HSIBinaryDataFormat data_format;
+    data_format.data_type = data_type;
+    data_format.big_endian = true;
+    hs_data_loader_1.SaveImage(original_image, data_format);
+
+    const std::string config_file_path = output_file_path + ".config";
+    super_resolution::HyperspectralDataLoader hs_data_loader_2(
+        config_file_path);
+    hs_data_loader_2.LoadImageFromENVIFile();
+    const super_resolution::ImageData saved_image =
+        hs_data_loader_2.GetImage();
+    EXPECT_EQ(saved_image.GetPrecision(), super_resolution::DOUBLE_PRECISION);
+    EXPECT_TRUE(AreImagesEqual(original_image, saved_image, 0.0));
+
+    // Read the same file again, keeping the data in single precision.
+    std::ofstream config_file(config_file_path, std::ios::app);
+    ASSERT_TRUE(config_file.is_open());
+    config_file << "precision single\n";
+    config_file.close();
+    super_resolution::HyperspectralDataLoader hs_data_loader_3(
+        config_file_path);
+    hs_data_loader_3.LoadImageFromENVIFile();
+    super_resolution::ImageData single_precision_image =
+        hs_data_loader_3.GetImage();
+    EXPECT_EQ(single_precision_image.GetPrecision(),
+              super_resolution::SINGLE_PRECISION);
+    single_precision_image.SetPrecision(super_resolution::DOUBLE_PRECISION);
+    EXPECT_TRUE(AreImagesEqual(original_image, single_precision_image, 0.0));
+  }
+}
+
+// Tests that images that are larger than one write chunk (8 MB) are saved and
+// read back exactly, including the rows that straddle the chunk boundaries.
+TEST(HyperspectralDataLoader, SaveAndLoadMultipleWriteChunks) {
+  super_resolution::ImageData original_image;
+  for (int channel = 0; channel < 3; ++channel) {
+    cv::Mat channel_image(600, 700, CV_64FC1);
+    cv::randu(channel_image, -1000.0, 1000.0);
+    original_image.AddChannel(
+        channel_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  }
+
+  for (const auto interleave : {
+      super_resolution::HSI_BINARY_INTERLEAVE_BSQ,
+      super_resolution::HSI_BINARY_INTERLEAVE_BIP}) {
+    const std::string output_file_path =
+        kTestOutputFilePath + "_chunks_" + std::to_string(interleave);
+    super_resolution::HyperspectralDataLoader hs_data_loader_1(
+        output_file_path);
+    super_resolution::HSIBinaryDataFormat data_format;
+    data_format.interleave = interleave;
+    data_format.data_type = super_resolution::HSI_DATA_TYPE_DOUBLE;
+    data_format.big_endian = true;
+    hs_data_loader_1.SaveImage(original_image, data_format);
+
+    const std::string config_file_path = output_file_path + ".config";
+    super_resolution::HyperspectralDataLoader hs_data_loader_2(
+        config_file_path);
+    hs_data_loader_2.LoadImageFromENVIFile();
+    EXPECT_TRUE(AreImagesEqual(
+        original_image, hs_data_loader_2.GetImage(), 0.0)) << interleave;
+  }
+}
+
+// Tests reading a cropped range of a big-endian file with a header attached to
+// the data in every interleave format, which exercises the byte reversal, the
+// (byte) header offset and the de-interleaving of each format.
+TEST(HyperspectralDataLoader, LoadCroppedBinaryDataWithHeaderOffset) {
+  const int num_rows = 4;
+  const int num_cols = 5;
+  const int num_bands = 3;
+  const int header_offset = 12;
+  // Whether the values must be reversed to be written in big-endian order.
+  const unsigned int one = 1;
+  const bool machine_little_endian =
+      (*reinterpret_cast<const unsigned char*>(&one) == 1);
+
+  for (const std::string interleave : {"bsq", "bil", "bip"}) {
+    // Lay out the values in the file order of the interleave format.
+    std::vector<float> file_values(num_rows * num_cols * num_bands);
+    for (int band = 0; band < num_bands; ++band) {
+      for (int row = 0; row < num_rows; ++row) {
+        for (int col = 0; col < num_cols; ++col) {
+          int index = (band * num_rows + row) * num_cols + col;
+          if (interleave == "bil") {
+            index = (row * num_bands + band) * num_cols + col;
+          } else if (interleave == "bip") {
+            index = (row * num_cols + col) * num_bands + band;
+          }
+          file_values[index] = band + 0.1 * row + 0.01 * col;
+        }
+      }
+    }
+
+    const std::string data_file_path =
+        kTestOutputFilePath + "_big_endian_" + interleave;
+    std::ofstream data_file(data_file_path, std::ios::binary);
+    ASSERT_TRUE(data_file.is_open());
+    const std::string header(header_offset, 'h');
+    data_file.write(header.c_str(), header_offset);
+    for (const float value : file_values) {
+      const unsigned char* bytes =
+          reinterpret_cast<const unsigned char*>(&value);
+      for (int i = 0; i < sizeof(float); ++i) {
+        data_file.put(bytes[machine_little_endian ? sizeof(float) - 1 - i : i]);
+      }
+    }
+    data_file.close();
+
+    const std::string config_file_path = data_file_path + ".config";
+    std::ofstream config_file(config_file_path);
+    ASSERT_TRUE(config_file.is_open());
+    config_file << "file " << data_file_path << "\n";
+    config_file << "interleave " << interleave << "\n";
+    config_file << "data_type float\n";
+    config_file << "big_endian true\n";
+    config_file << "header_offset " << header_offset << "\n";
+    config_file << "num_data_rows " << num_rows << "\n";
+    config_file << "num_data_cols " << num_cols << "\n";
+    config_file << "num_data_bands " << num_bands << "\n";
+    config_file << "start_row 1\nend_row 3\n";
+    config_file << "start_col 2\nend_col 5\n";
+    config_file << "start_band 1\nend_band 3\n";
+    config_file.close();
+
+    super_resolution::HyperspectralDataLoader hs_data_loader(
+        config_file_path);
+    hs_data_loader.LoadImageFromENVIFile();
+    const super_resolution::ImageData image = hs_data_loader.GetImage();
+    EXPECT_EQ(image.GetImageSize(), cv::Size(3, 2));
+    EXPECT_EQ(image.GetNumChannels(), 2);
+    const cv::Mat expected_channel_0 = (cv::Mat_<double>(2, 3)
+        << 1.12, 1.13, 1.14,
+           1.22, 1.23, 1.24);
+    EXPECT_TRUE(AreMatricesEqual(
+        image.GetChannelImage(0),
+        expected_channel_0,
+        kPrecisionErrorTolerance)) << interleave;
+    const cv::Mat expected_channel_1 = (cv::Mat_<double>(2, 3)
+        << 2.12, 2.13, 2.14,
+           2.22, 2.23, 2.24);
+    EXPECT_TRUE(AreMatricesEqual(
+        image.GetChannelImage(1),
+        expected_channel_1,
+        kPrecisionErrorTolerance)) << interleave;
+  }
+}
+
+// Verifies that cropped ranges of comma-delimited MATLAB text files are read
+// in the order of each interleave format, including lines that cross rows and
+// bands, Windows line endings and blank lines after the data.
+TEST(HyperspectralDataLoader, LoadCroppedMatlabTextData) {
+  const int num_rows = 4;
+  const int num_cols = 5;
+  const int num_bands = 3;
+  const int num_values_per_line = 6;
+
+  for (const std::string interleave : {"bsq", "bil", "bip"}) {
+    std::vector<double> file_values(num_rows * num_cols * num_bands);
+    for (int band = 0; band < num_bands; ++band) {
+      for (int row = 0; row < num_rows; ++row) {
+        for (int col = 0; col < num_cols; ++col) {
+          int index = (band * num_rows + row) * num_cols + col;
+          if (interleave == "bil") {
+            index = (row * num_bands + band) * num_cols + col;
+          } else if (interleave == "bip") {
+            index = (row * num_cols + col) * num_bands + band;
+          }
+          file_values[index] = -band - 0.1 * row - 0.01 * col;
+        }
+      }
+    }
+
+    const std::string data_file_path =
+        kTestOutputFilePath + "_matlab_" + interleave + ".csv";
+    std::ofstream data_file(data_file_path);
+    ASSERT_TRUE(data_file.is_open());
+    for (int i = 0; i < file_values.size(); ++i) {
+      data_file << file_values[i];
+      if ((i + 1) % num_values_per_line == 0) {
+        data_file << "\r\n";
+      } else {
+        data_file << ", ";
+      }
+    }
+    data_file << "\n";
+    data_file.close();
+
+    const std::string config_file_path = data_file_path + ".config";
+    std::ofstream config_file(config_file_path);
+    ASSERT_TRUE(config_file.is_open());
+    config_file << "file " << data_file_path << "\n";
+    config_file << "interleave " << interleave << "\n";
+    config_file << "num_data_rows " << num_rows << "\n";
+    config_file << "num_data_cols " << num_cols << "\n";
+    config_file << "num_data_bands " << num_bands << "\n";
+    config_file << "start_row 1\nend_row 3\n";
+    config_file << "start_col 2\nend_col 5\n";
+    config_file << "start_band 1\nend_band 3\n";
+    config_file.close();
+
+    super_resolution::HyperspectralDataLoader hs_data_loader(
+        config_file_path);
+    hs_data_loader.LoadImageFromENVIFile();
+    const super_resolution::ImageData image = hs_data_loader.GetImage();
+    EXPECT_EQ(image.GetImageSize(), cv::Size(3, 2));
+    EXPECT_EQ(image.GetNumChannels(), 2);
+    const cv::Mat expected_channel_0 = (cv::Mat_<double>(2, 3)
+        << -1.12, -1.13, -1.14,
+           -1.22, -1.23, -1.24);
+    EXPECT_TRUE(AreMatricesEqual(
+        image.GetChannelImage(0),
+        expected_channel_0,
+        kPrecisionErrorTolerance)) << interleave;
+    const cv::Mat expected_channel_1 = (cv::Mat_<double>(2, 3)
+        << -2.12, -2.13, -2.14,
+           -2.22, -2.23, -2.24);
+    EXPECT_TRUE(AreMatricesEqual(
+        image.GetChannelImage(1),
+        expected_channel_1,
+        kPrecisionErrorTolerance)) << interleave;
+  }
+}
+
+// Verifies that a text file of several MB, which is split into chunks that
+// are counted and parsed in parallel, is read exactly. The lines do not line
+// up with the rows or bands, so the chunks start in the middle of them.
+TEST(HyperspectralDataLoader, LoadMatlabTextDataInChunks) {
+  const int num_rows = 64;
+  const int num_cols = 64;
+  const int num_bands = 200;
+  const int num_values_per_line = 25;
+  const int num_values = num_rows * num_cols * num_bands;
+
+  // Every value is its index in the (BSQ) file.
+  const std::string data_file_path =
+      kTestOutputFilePath + "_matlab_chunks.txt";
+  std::ofstream data_file(data_file_path);
+  ASSERT_TRUE(data_file.is_open());
+  for (int i = 0; i < num_values; ++i) {
+    data_file << i << (((i + 1) % num_values_per_line == 0) ? "\n" : ",");
+  }
+  data_file.close();
+
+  const std::string config_file_path = data_file_path + ".config";
+  std::ofstream config_file(config_file_path);
+  ASSERT_TRUE(config_file.is_open());
+  config_file << "file " << data_file_path << "\n";
+  config_file << "interleave bsq\n";
+  config_file << "num_data_rows " << num_rows << "\n";
+  config_file << "num_data_cols " << num_cols << "\n";
+  config_file << "num_data_bands " << num_bands << "\n";
+  config_file << "start_row 3\nend_row 60\n";
+  config_file << "start_col 0\nend_col 64\n";
+  config_file << "start_band 10\nend_band 190\n";
+  config_file.close();
+
+  // The file has a few MB, so it is split into several chunks.
+  for (const int num_threads : {1, 4}) {
+    super_resolution::HyperspectralDataLoader hs_data_loader(
+        config_file_path);
+    hs_data_loader.SetNumThreads(num_threads);
+    hs_data_loader.LoadImageFromENVIFile();
+    const super_resolution::ImageData image = hs_data_loader.GetImage();
+    ASSERT_EQ(image.GetImageSize(), cv::Size(64, 57));
+    ASSERT_EQ(image.GetNumChannels(), 180);
+    int num_wrong_values = 0;
+    for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+      const cv::Mat channel_image = image.GetChannelImage(channel);
+      for (int row = 0; row < channel_image.rows; ++row) {
+        for (int col = 0; col < channel_image.cols; ++col) {
+          const int expected_value =
+              ((channel + 10) * num_rows + row + 3) * num_cols + col;
+          if (channel_image.at<double>(row, col) != expected_value) {
+            num_wrong_values++;
+          }
+        }
+      }
+    }
+    EXPECT_EQ(num_wrong_values, 0) << num_threads << " threads";
+  }
+}
@@ -1,6 +1,11 @@
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "image/image_data.h"
+#include "util/matrix_util.h"
 #include "util/test_util.h"
 
 #include "opencv2/core/core.hpp"
@@ -285,14 +290,83 @@ TEST(ImageData, CopyConstructor) {
   // TODO: do this.
 }
 
+// Verifies that images can be stored in single precision and still support
+// the operations used by the image model.
+TEST(ImageData, SinglePrecision) {
+  ImageData image_data;
+  image_data.AddChannel(kTestChannelB);
+  EXPECT_EQ(image_data.GetPrecision(), super_resolution::DOUBLE_PRECISION);
+
+  image_data.SetPrecision(super_resolution::SINGLE_PRECISION);
+  EXPECT_EQ(image_data.GetPrecision(), super_resolution::SINGLE_PRECISION);
+  EXPECT_EQ(image_data.GetChannelImage(0).type(), CV_32FC1);
+  EXPECT_NEAR(image_data.GetPixelValue(0, 1, 2), 0.35, 1e-6);
+
+  // New channels and copies use the same precision.
+  image_data.AddChannel(kTestChannelG);
+  EXPECT_EQ(image_data.GetChannelImage(1).type(), CV_32FC1);
+  const ImageData image_data_copy = image_data;
+  EXPECT_EQ(image_data_copy.GetPrecision(), super_resolution::SINGLE_PRECISION);
+
+  // Additive downsampling and upsampling work the same way as for double
+  // precision images.
+  image_data.ResizeImage(0.5, super_resolution::INTERPOLATE_ADDITIVE);
+  EXPECT_NEAR(image_data.GetPixelValue(0, 0, 0), 0.7, 1e-6);
+  image_data.ResizeImage(2, super_resolution::INTERPOLATE_ADDITIVE);
+  EXPECT_NEAR(image_data.GetPixelValue(0, 0, 0), 0.7, 1e-6);
+  EXPECT_EQ(image_data.GetPixelValue(0, 0, 1), 0.0);
+
+  // The pixel array constructor converts the given values.
+  const std::vector<double> pixel_values = {0.25, 0.5, 0.75, 1.0};
+  const ImageData single_precision_image(
+      pixel_values.data(),
+      cv::Size(2, 2),
+      1,
+      super_resolution::SINGLE_PRECISION);
+  EXPECT_EQ(single_precision_image.GetChannelImage(0).type(), CV_32FC1);
+  EXPECT_EQ(single_precision_image.GetPixelValue(0, 3), 1.0);
+
+  // Converting back to double precision allows raw pixel access again.
+  ImageData double_precision_image = single_precision_image;
+  double_precision_image.SetPrecision(super_resolution::DOUBLE_PRECISION);
+  EXPECT_EQ(double_precision_image.GetChannelData(0)[1], 0.5);
+}
+
 // This test verifies that the constructor which takes an OpenCV image as input
 // works as expected, and correctly splits up the channels.
 TEST(ImageData, FromOpenCvImageConstructor) {
-  // TODO: implement.
-  // ImageData(const cv::Mat& image)
+  /* Verify that interleaved 8-bit images are split and normalized. */
+
+  cv::Mat color_image(5, 7, CV_8UC3);
+  cv::randu(color_image, 0, 256);
+  std::vector<cv::Mat> color_channels;
+  cv::split(color_image, color_channels);
+  const ImageData color_image_data(color_image);
+  ASSERT_EQ(color_image_data.GetNumChannels(), 3);
+  EXPECT_TRUE(color_image_data.IsContiguous());
+  for (int channel = 0; channel < 3; ++channel) {
+    cv::Mat expected_channel;
+    color_channels[channel].convertTo(expected_channel, CV_64F, 1.0 / 255.0);
+    EXPECT_TRUE(AreMatricesEqual(
+        color_image_data.GetChannelImage(channel), expected_channel));
+  }
 
   /* Verify the functionality of the manual normalization constructor. */
 
+  cv::Mat multichannel_image(4, 3, CV_16UC(5));
+  cv::randu(multichannel_image, 0, 1000);
+  std::vector<cv::Mat> multichannel_channels;
+  cv::split(multichannel_image, multichannel_channels);
+  const ImageData multichannel_image_data(
+      multichannel_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  ASSERT_EQ(multichannel_image_data.GetNumChannels(), 5);
+  for (int channel = 0; channel < 5; ++channel) {
+    cv::Mat expected_channel;
+    multichannel_channels[channel].convertTo(expected_channel, CV_64F);
+    EXPECT_TRUE(AreMatricesEqual(
+        multichannel_image_data.GetChannelImage(channel), expected_channel));
+  }
+
   const cv::Mat invalid_image = (cv::Mat_<double>(3, 3)
       << 0.5, 1.5,  100,
          -25, 0.0,  -30,
@@ -398,6 +472,55 @@ TEST(ImageData, ResizeImage) {
   EXPECT_TRUE(AreMatricesEqual(
       image_3.GetChannelImage(0),
       expected_additive_downsampled));
+
+  // Additive upsampling followed by additive downsampling recovers the
+  // original image for any number of channels and either precision, and the
+  // resized channels are stored contiguously. Scales 2 to 4 use specialized
+  // kernels and scale 5 uses the generic one.
+  for (const auto precision : {
+      super_resolution::DOUBLE_PRECISION,
+      super_resolution::SINGLE_PRECISION}) {
+    for (const int scale : {2, 3, 4, 5}) {
+      ImageData image_4;
+      for (int channel = 0; channel < 3; ++channel) {
+        cv::Mat channel_pixels(5, 7, CV_64FC1);
+        cv::randu(channel_pixels, 0.0, 1.0);
+        image_4.AddChannel(
+            channel_pixels, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+      }
+      image_4.SetPrecision(precision);
+      const ImageData original_image = image_4;
+      image_4.ResizeImage(scale, super_resolution::INTERPOLATE_ADDITIVE);
+      EXPECT_EQ(image_4.GetImageSize(), cv::Size(7 * scale, 5 * scale));
+      EXPECT_TRUE(image_4.IsContiguous());
+      EXPECT_EQ(cv::countNonZero(image_4.GetChannelImage(1)),
+                cv::countNonZero(original_image.GetChannelImage(1)));
+      image_4.ResizeImage(
+          cv::Size(7, 5), super_resolution::INTERPOLATE_ADDITIVE);
+      for (int channel = 0; channel < 3; ++channel) {
+        EXPECT_TRUE(AreMatricesEqual(
+            image_4.GetChannelImage(channel),
+            original_image.GetChannelImage(channel)));
+      }
+    }
+  }
+
+  // Resizing into a destination image leaves the source unchanged, and
+  // reuses the channels of a destination that already has the new size.
+  ImageData upsampled_image;
+  image.ResizeImageAdditive(cv::Size(8, 8), &upsampled_image);
+  EXPECT_EQ(image.GetImageSize(), cv::Size(4, 4));
+  EXPECT_EQ(upsampled_image.GetNumChannels(), num_channels);
+  EXPECT_TRUE(upsampled_image.IsContiguous());
+  const double* upsampled_data = upsampled_image.GetContiguousData();
+  image *= 2.0;
+  image.ResizeImageAdditive(cv::Size(8, 8), &upsampled_image);
+  EXPECT_EQ(upsampled_image.GetContiguousData(), upsampled_data);
+  for (int channel_index = 0; channel_index < num_channels; ++channel_index) {
+    EXPECT_TRUE(AreMatricesEqual(
+        upsampled_image.GetChannelImage(channel_index),
+        expected_additive_upsampled * 2.0));
+  }
 }
 
 // Tests the ChangeColorSpace method to see that the image is in fact being
@@ -603,6 +726,61 @@ TEST(ImageData, InterpolateColorFrom) {
   }
 }
 
+// Tests that the hidden chroma channels of a luminance-only image match a
+// full color space conversion, also for copies and after arithmetic, and that
+// modifying an image does not modify the hidden channels shared by its copy.
+TEST(ImageData, LuminanceOnlyHiddenChannels) {
+  cv::Mat input_image;
+  cv::merge(kTestColorChannels, input_image);
+  ImageData color_image(input_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  color_image.ChangeColorSpace(super_resolution::SPECTRAL_MODE_COLOR_YCRCB);
+
+  ImageData luminance_image(
+      input_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  luminance_image.ChangeColorSpace(
+      super_resolution::SPECTRAL_MODE_COLOR_YCRCB, true);
+  const ImageData luminance_image_copy = luminance_image;
+  EXPECT_EQ(luminance_image_copy.GetNumChannels(), 1);
+  EXPECT_EQ(luminance_image_copy.GetImageDataReport().num_channels, 3);
+
+  // The hidden channels are interpolated into a solved luminance channel.
+  ImageData solved_image(
+      luminance_image.GetChannelImage(0),
+      super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  solved_image.InterpolateColorFrom(luminance_image_copy);
+  EXPECT_EQ(solved_image.GetNumChannels(), 3);
+  for (int channel_index = 0; channel_index < 3; ++channel_index) {
+    EXPECT_TRUE(AreMatricesEqual(
+        solved_image.GetChannelImage(channel_index),
+        color_image.GetChannelImage(channel_index),
+        kPixelErrorTolerance));
+  }
+
+  // Arithmetic modifies the hidden channels too, as before.
+  luminance_image *= 0.5;
+  luminance_image.ChangeColorSpace(super_resolution::SPECTRAL_MODE_COLOR_BGR);
+  color_image *= 0.5;
+  color_image.ChangeColorSpace(super_resolution::SPECTRAL_MODE_COLOR_BGR);
+  EXPECT_EQ(luminance_image.GetNumChannels(), 3);
+  for (int channel_index = 0; channel_index < 3; ++channel_index) {
+    EXPECT_TRUE(AreMatricesEqual(
+        luminance_image.GetChannelImage(channel_index),
+        color_image.GetChannelImage(channel_index),
+        kPixelErrorTolerance));
+  }
+
+  ImageData solved_image_2(
+      solved_image.GetChannelImage(0),
+      super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  solved_image_2.InterpolateColorFrom(luminance_image_copy);
+  for (int channel_index = 1; channel_index < 3; ++channel_index) {
+    EXPECT_TRUE(AreMatricesEqual(
+        solved_image_2.GetChannelImage(channel_index),
+        solved_image.GetChannelImage(channel_index),
+        kPixelErrorTolerance));
+  }
+}
+
 // Tests the multiplication and addition methods for the ImageData object,
 // including the overloaded operators.
 TEST(ImageData, AddMultiplyDivideImage) {
@@ -636,6 +814,229 @@ TEST(ImageData, AddMultiplyDivideImage) {
   EXPECT_DOUBLE_EQ(test_image_4.GetPixelValue(2, 2), 0.35);  // 0.3 + 0.05.
 }
 
+// Tests the in-place arithmetic methods, which modify the image without
+// allocating new channels.
+TEST(ImageData, InPlaceArithmetic) {
+  cv::Mat image_matrix;
+  cv::merge(kTestColorChannels, image_matrix);
+  const ImageData image(
+      image_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+
+  ImageData test_image = image;
+  const double* channel_data = test_image.GetChannelData(0);
+  test_image.AddScaled(image, 2.0);
+  EXPECT_EQ(test_image.GetChannelData(0), channel_data);
+  EXPECT_DOUBLE_EQ(test_image.GetPixelValue(0, 0), 0.3);  // 0.1 + 2 * 0.1.
+  EXPECT_DOUBLE_EQ(test_image.GetPixelValue(1, 1), 0.9);  // 0.3 + 2 * 0.3.
+  EXPECT_DOUBLE_EQ(test_image.GetPixelValue(2, 2), 0.3);  // 0.1 + 2 * 0.1.
+
+  test_image += image;
+  test_image *= 0.5;
+  EXPECT_EQ(test_image.GetChannelData(0), channel_data);
+  EXPECT_DOUBLE_EQ(test_image.GetPixelValue(0, 0), 0.2);  // (0.3 + 0.1) / 2.
+  EXPECT_DOUBLE_EQ(test_image.GetPixelValue(1, 1), 0.6);  // (0.9 + 0.3) / 2.
+
+  const ImageData zero_image(cv::Size(4, 4), 3);
+  EXPECT_EQ(zero_image.GetNumChannels(), 3);
+  EXPECT_EQ(zero_image.GetImageSize(), cv::Size(4, 4));
+  EXPECT_TRUE(zero_image.IsContiguous());
+  test_image.AddScaled(zero_image, 100.0);
+  EXPECT_DOUBLE_EQ(test_image.GetPixelValue(0, 0), 0.2);
+}
+
+// Tests that arithmetic expressions are computed in a single pass into the
+// destination image, reusing its channels if they have the right layout.
+TEST(ImageData, ArithmeticExpressions) {
+  cv::Mat image_matrix;
+  cv::merge(kTestColorChannels, image_matrix);
+  const ImageData image(
+      image_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  const ImageData doubled_image = image * 2.0;
+
+  // A new image is allocated for an expression with no destination.
+  ImageData blended_image = image * 0.5 + doubled_image * 0.25;
+  EXPECT_EQ(blended_image.GetNumChannels(), 3);
+  EXPECT_EQ(blended_image.GetImageSize(), image.GetImageSize());
+  EXPECT_TRUE(blended_image.IsContiguous());
+  EXPECT_DOUBLE_EQ(blended_image.GetPixelValue(0, 0), 0.1);  // 0.05 + 0.05.
+  EXPECT_DOUBLE_EQ(blended_image.GetPixelValue(1, 1), 0.3);  // 0.15 + 0.15.
+
+  // Assigning to an image of the same layout writes into its channels, even
+  // if the image is a term of the expression.
+  const double* channel_data = blended_image.GetChannelData(0);
+  blended_image = 0.5 * (image + doubled_image) + blended_image / 2.0;
+  EXPECT_EQ(blended_image.GetChannelData(0), channel_data);
+  EXPECT_DOUBLE_EQ(blended_image.GetPixelValue(0, 0), 0.2);  // 0.15 + 0.05.
+  EXPECT_DOUBLE_EQ(blended_image.GetPixelValue(1, 1), 0.6);  // 0.45 + 0.15.
+
+  blended_image += image * -2.0 + doubled_image;
+  EXPECT_EQ(blended_image.GetChannelData(0), channel_data);
+  EXPECT_DOUBLE_EQ(blended_image.GetPixelValue(0, 0), 0.2);
+  EXPECT_DOUBLE_EQ(blended_image.GetPixelValue(2, 2), 0.2);
+
+  // An image of a different layout gets new channels.
+  ImageData single_precision_image = image;
+  single_precision_image.SetPrecision(super_resolution::SINGLE_PRECISION);
+  ImageData destination_image(cv::Size(2, 2), 1);
+  destination_image =
+      single_precision_image * 3.0 + single_precision_image;
+  EXPECT_EQ(destination_image.GetNumChannels(), 3);
+  EXPECT_EQ(destination_image.GetImageSize(), image.GetImageSize());
+  EXPECT_EQ(
+      destination_image.GetPrecision(), super_resolution::SINGLE_PRECISION);
+  EXPECT_FLOAT_EQ(destination_image.GetPixelValue(1, 1), 1.2);  // 4 * 0.3.
+}
+
+// Tests that moving an image transfers its channels without copying them, and
+// that copy assignment does not share any pixel data.
+TEST(ImageData, MoveAndCopyAssignment) {
+  // Vectors of images only move them on reallocation if the moves are
+  // noexcept.
+  EXPECT_TRUE(std::is_nothrow_move_constructible<ImageData>::value);
+  EXPECT_TRUE(std::is_nothrow_move_assignable<ImageData>::value);
+
+  ImageData image;
+  image.AddChannel(kTestChannelB);
+  image.AddChannel(kTestChannelG);
+  const double* channel_data = image.GetChannelData(1);
+
+  ImageData moved_image(std::move(image));
+  EXPECT_EQ(moved_image.GetNumChannels(), 2);
+  EXPECT_EQ(moved_image.GetChannelData(1), channel_data);
+  EXPECT_EQ(image.GetNumChannels(), 0);  // NOLINT
+  EXPECT_EQ(image.GetImageSize(), cv::Size(0, 0));  // NOLINT
+
+  ImageData move_assigned_image;
+  move_assigned_image = std::move(moved_image);
+  EXPECT_EQ(move_assigned_image.GetChannelData(1), channel_data);
+  EXPECT_EQ(moved_image.GetNumChannels(), 0);  // NOLINT
+
+  ImageData copy_assigned_image;
+  copy_assigned_image = move_assigned_image;
+  EXPECT_NE(copy_assigned_image.GetChannelData(1), channel_data);
+  EXPECT_TRUE(AreImagesEqual(copy_assigned_image, move_assigned_image));
+  copy_assigned_image.GetMutableChannelData(1)[0] = -1.0;
+  EXPECT_EQ(move_assigned_image.GetPixelValue(1, 0),
+            kTestChannelG.at<double>(0, 0));
+}
+
+// Checks that wrapped pixel arrays are shared with the ImageData, and that
+// copies and pixel-array images keep every channel in one contiguous block.
+TEST(ImageData, ContiguousStorage) {
+  double pixel_values[(3 * 2) * 2] = {
+    // Channel 1:
+    0.1, 0.2, 0.3,
+    0.4, 0.5, 0.6,
+    // Channel 2:
+    1.1, 1.2, 1.3,
+    1.4, 1.5, 1.6
+  };
+  const cv::Size size(3, 2);
+
+  // Wrapped data is not copied, so changes are visible in the array.
+  ImageData wrapped_image(
+      pixel_values, size, 2, super_resolution::WRAP_PIXEL_DATA);
+  EXPECT_EQ(wrapped_image.GetNumChannels(), 2);
+  EXPECT_EQ(wrapped_image.GetNumPixels(), 6);
+  EXPECT_TRUE(wrapped_image.IsContiguous());
+  EXPECT_EQ(wrapped_image.GetContiguousData(), pixel_values);
+  wrapped_image.GetMutableChannelData(1)[2] = -1.0;
+  EXPECT_EQ(pixel_values[8], -1.0);
+
+  // Copied data is contiguous but independent of the array.
+  ImageData copied_image(
+      pixel_values, size, 2, super_resolution::COPY_PIXEL_DATA);
+  EXPECT_TRUE(copied_image.IsContiguous());
+  copied_image.GetMutableChannelData(0)[0] = 5.0;
+  EXPECT_EQ(pixel_values[0], 0.1);
+  const double* copied_data = copied_image.GetContiguousData();
+  EXPECT_EQ(copied_data[0], 5.0);
+  for (int i = 1; i < 12; ++i) {
+    EXPECT_EQ(copied_data[i], pixel_values[i]);
+  }
+
+  // Copies of an image are contiguous, even if the original is not.
+  ImageData image;
+  image.AddChannel(kTestChannelB);
+  image.AddChannel(kTestChannelG);
+  image.AddChannel(kTestChannelR);
+  const ImageData image_copy = image;
+  EXPECT_TRUE(image_copy.IsContiguous());
+  EXPECT_TRUE(AreImagesEqual(image_copy, image));
+
+  image.MakeContiguous();
+  EXPECT_TRUE(image.IsContiguous());
+  EXPECT_TRUE(AreImagesEqual(image_copy, image));
+  const double* image_data = image.GetContiguousData();
+  EXPECT_EQ(image_data[0], kTestChannelB.at<double>(0, 0));
+  EXPECT_EQ(image_data[16], kTestChannelG.at<double>(0, 0));
+  EXPECT_EQ(image_data[32], kTestChannelR.at<double>(0, 0));
+
+  // Resizing allocates new channels, which breaks contiguity.
+  image.ResizeImage(2.0);
+  EXPECT_FALSE(image.IsContiguous());
+}
+
+// Checks that convolving the channels of a contiguous image treats the pixels
+// outside of every channel as the border, and not as the rows of the
+// neighboring channels in the same allocation.
+TEST(ImageData, ContiguousChannelConvolution) {
+  const cv::Size size(5, 4);
+  ImageData image(size, 3);
+  ASSERT_TRUE(image.IsContiguous());
+  image.GetChannelImage(1).setTo(1.0);
+  const cv::Mat kernel = cv::Mat::ones(3, 3, CV_64FC1) / 9.0;
+  super_resolution::util::ApplyConvolutionToImage(&image, kernel);
+
+  // The zero channels around the middle one stay zero, and the middle channel
+  // is padded with zeros at its first and last rows.
+  EXPECT_EQ(cv::sum(image.GetChannelImage(0))[0], 0.0);
+  EXPECT_EQ(cv::sum(image.GetChannelImage(2))[0], 0.0);
+  EXPECT_NEAR(image.GetPixelValue(1, 0), 4.0 / 9.0, 1.0e-12);
+  EXPECT_NEAR(image.GetPixelValue(1, 1), 6.0 / 9.0, 1.0e-12);
+  EXPECT_NEAR(image.GetPixelValue(1, 6), 1.0, 1.0e-12);
+  EXPECT_NEAR(
+      image.GetPixelValue(1, size.area() - 1), 4.0 / 9.0, 1.0e-12);
+}
+
+// Tests that every structure image mode combines all channels correctly, for
+// both double and single precision images.
+TEST(ImageData, GetStructureImage) {
+  // The channels are b, 2b + 0.1 and 2b - 0.2 for the base image b, so the
+  // first principal component has loadings (1, 2, 2) / 3.
+  const double pixel_values[4 * 3] = {
+      0.1, 0.2, 0.3, 0.4,
+      0.3, 0.5, 0.7, 0.9,
+      0.0, 0.2, 0.4, 0.6
+  };
+  ImageData image(pixel_values, cv::Size(2, 2), 3);
+  const cv::Mat expected_mean = (cv::Mat_<double>(2, 2)
+      << 0.4 / 3.0, 0.9 / 3.0, 1.4 / 3.0, 1.9 / 3.0);
+  const cv::Mat expected_max = (cv::Mat_<double>(2, 2)
+      << 0.3, 0.5, 0.7, 0.9);
+  const cv::Mat expected_principal_component = (cv::Mat_<double>(2, 2)
+      << -0.45, -0.15, 0.15, 0.45);
+
+  for (const super_resolution::ImagePrecision precision : {
+      super_resolution::DOUBLE_PRECISION,
+      super_resolution::SINGLE_PRECISION}) {
+    image.SetPrecision(precision);
+    EXPECT_TRUE(AreMatricesEqual(
+        image.GetStructureImage(super_resolution::STRUCTURE_IMAGE_MEAN),
+        expected_mean,
+        1.0e-6));
+    EXPECT_TRUE(AreMatricesEqual(
+        image.GetStructureImage(super_resolution::STRUCTURE_IMAGE_MAX),
+        expected_max,
+        1.0e-6));
+    EXPECT_TRUE(AreMatricesEqual(
+        image.GetStructureImage(
+            super_resolution::STRUCTURE_IMAGE_FIRST_PRINCIPAL_COMPONENT),
+        expected_principal_component,
+        1.0e-6));
+  }
+}
+
 // Tests that the report for analyzing images is correctly generated.
 TEST(ImageData, GetImageDataReport) {
   const double pixel_values[(5 * 3) * 2] = {
@@ -662,6 +1063,62 @@ TEST(ImageData, GetImageDataReport) {
   EXPECT_EQ(report.largest_pixel_value, 9.23);
 }
 
+// Tests the report and the arithmetic on an image that is large enough to be
+// processed in parallel blocks, in both precisions and with one and several
+// threads.
+TEST(ImageData, ParallelReportAndArithmetic) {
+  const cv::Size size(301, 157);
+  const int num_channels = 3;
+  const int num_pixels = size.width * size.height;
+  std::vector<double> pixel_values(num_pixels * num_channels);
+  for (int i = 0; i < pixel_values.size(); ++i) {
+    pixel_values[i] = 0.5 + 0.7 * std::sin(0.013 * i);
+  }
+  pixel_values[5] = -3.0;  // The smallest value, in the first block.
+  pixel_values[2 * num_pixels - 7] = 4.5;  // The largest, in the last block.
+
+  for (const int num_threads : {1, 4}) {
+    ImageData::SetNumThreads(num_threads);
+    for (const auto precision : {
+        super_resolution::DOUBLE_PRECISION,
+        super_resolution::SINGLE_PRECISION}) {
+      const ImageData image(
+          pixel_values.data(), size, num_channels, precision);
+      const super_resolution::ImageDataReport report =
+          image.GetImageDataReport();
+      int64_t num_negative_pixels = 0;
+      int64_t num_over_one_pixels = 0;
+      for (int channel = 0; channel < num_channels; ++channel) {
+        for (int index = 0; index < num_pixels; ++index) {
+          const double value = image.GetPixelValue(channel, index);
+          num_negative_pixels += (value < 0.0);
+          num_over_one_pixels += (value > 1.0);
+        }
+      }
+      EXPECT_EQ(report.num_negative_pixels, num_negative_pixels);
+      EXPECT_EQ(report.num_over_one_pixels, num_over_one_pixels);
+      EXPECT_FLOAT_EQ(report.smallest_pixel_value, -3.0);
+      EXPECT_FLOAT_EQ(report.largest_pixel_value, 4.5);
+
+      const ImageData sum = image + image * 2.0;
+      ImageData in_place_sum = image;
+      in_place_sum.AddScaled(image, 2.0);
+      in_place_sum *= 0.5;
+      EXPECT_EQ(sum.GetPrecision(), precision);
+      EXPECT_TRUE(sum.IsContiguous());
+      for (int channel = 0; channel < num_channels; ++channel) {
+        for (const int index : {0, 4321, num_pixels - 1}) {
+          const double value = image.GetPixelValue(channel, index);
+          EXPECT_NEAR(sum.GetPixelValue(channel, index), 3.0 * value, 1e-5);
+          EXPECT_NEAR(
+              in_place_sum.GetPixelValue(channel, index), 1.5 * value, 1e-5);
+        }
+      }
+    }
+  }
+  ImageData::SetNumThreads(1);
+}
+
 // This test verifies that the correct visualization image is returned for
 // different numbers of channels.
 TEST(ImageData, GetVisualizationImage) {
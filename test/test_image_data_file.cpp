@@ -0,0 +1,150 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hyperspectral/hyperspectral_data_loader.h"
+#include "image/image_data.h"
+#include "image/image_data_file.h"
+#include "util/data_loader.h"
+#include "util/util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::HyperspectralDataLoader;
+using super_resolution::ImageData;
+using super_resolution::ImageDataFileInfo;
+using super_resolution::util::GetAbsoluteCodePath;
+
+static const std::string kTestImageDataFilePath =
+    GetAbsoluteCodePath("test_data/test_tmp_dir/image_data_file_test.srimg");
+
+namespace {
+
+// Returns an image of the given size and number of channels in which every
+// pixel value is distinct and not exactly representable in 8 bits.
+ImageData MakeTestImage(
+    const cv::Size& size,
+    const int num_channels,
+    const super_resolution::ImagePrecision precision) {
+
+  std::vector<double> pixels(size.width * size.height * num_channels);
+  for (int i = 0; i < pixels.size(); ++i) {
+    pixels[i] = 0.001 * i - 0.25;
+  }
+  return ImageData(pixels.data(), size, num_channels, precision);
+}
+
+// Expects the two images to have the same size, channels and pixel values.
+void ExpectImagesEqual(const ImageData& image, const ImageData& other) {
+  ASSERT_EQ(image.GetNumChannels(), other.GetNumChannels());
+  ASSERT_EQ(image.GetImageSize(), other.GetImageSize());
+  EXPECT_EQ(image.GetPrecision(), other.GetPrecision());
+  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+    EXPECT_EQ(cv::norm(image.GetChannelImage(channel),
+                       other.GetChannelImage(channel),
+                       cv::NORM_INF), 0.0);
+  }
+}
+
+}  // namespace
+
+// Verifies that images are saved and loaded exactly in both precisions, with
+// their spectral mode, and that the loaded channels are aligned.
+TEST(ImageDataFile, SaveAndLoad) {
+  for (const auto precision : {
+      super_resolution::DOUBLE_PRECISION,
+      super_resolution::SINGLE_PRECISION}) {
+    // The plane size (13 * 7 values) is not a multiple of the alignment.
+    ImageData image = MakeTestImage(cv::Size(13, 7), 5, precision);
+    image.SetSpectralMode(super_resolution::SPECTRAL_MODE_HYPERSPECTRAL_PCA);
+    super_resolution::SaveImageDataFile(image, kTestImageDataFilePath);
+
+    ImageDataFileInfo info;
+    ASSERT_TRUE(super_resolution::ReadImageDataFileInfo(
+        kTestImageDataFilePath, &info));
+    EXPECT_EQ(info.image_size, cv::Size(13, 7));
+    EXPECT_EQ(info.num_channels, 5);
+    EXPECT_EQ(info.precision, precision);
+    EXPECT_EQ(info.spectral_mode,
+              super_resolution::SPECTRAL_MODE_HYPERSPECTRAL_PCA);
+
+    const ImageData loaded_image =
+        super_resolution::LoadImageDataFile(kTestImageDataFilePath);
+    ExpectImagesEqual(loaded_image, image);
+    EXPECT_EQ(loaded_image.GetSpectralMode(),
+              super_resolution::SPECTRAL_MODE_HYPERSPECTRAL_PCA);
+    for (int channel = 0; channel < 5; ++channel) {
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(
+          loaded_image.GetChannelImage(channel).data) % 64, 0);
+    }
+
+    // A range of channels only maps those channels.
+    const ImageData loaded_channels =
+        super_resolution::LoadImageDataFile(kTestImageDataFilePath, 2, 2);
+    ASSERT_EQ(loaded_channels.GetNumChannels(), 2);
+    for (int channel = 0; channel < 2; ++channel) {
+      EXPECT_EQ(cv::norm(loaded_channels.GetChannelImage(channel),
+                         image.GetChannelImage(channel + 2),
+                         cv::NORM_INF), 0.0);
+    }
+  }
+}
+
+// Verifies that the loaded channels remain valid after the loaded image is
+// destroyed, and that modifying them does not modify the file.
+TEST(ImageDataFile, LoadedImageOwnsMapping) {
+  const ImageData image = MakeTestImage(
+      cv::Size(8, 8), 2, super_resolution::DOUBLE_PRECISION);
+  super_resolution::SaveImageDataFile(image, kTestImageDataFilePath);
+
+  cv::Mat channel_view;
+  {
+    ImageData loaded_image =
+        super_resolution::LoadImageDataFile(kTestImageDataFilePath);
+    channel_view = loaded_image.GetChannelImage(1);
+    loaded_image.MultiplyByScalar(2.0);
+  }
+  EXPECT_EQ(cv::norm(channel_view, image.GetChannelImage(1) * 2.0,
+                     cv::NORM_INF), 0.0);
+
+  const ImageData reloaded_image =
+      super_resolution::LoadImageDataFile(kTestImageDataFilePath);
+  ExpectImagesEqual(reloaded_image, image);
+}
+
+// Verifies that the loaders recognize image data files.
+TEST(ImageDataFile, LoadersRecognizeImageDataFiles) {
+  const ImageData image = MakeTestImage(
+      cv::Size(6, 4), 7, super_resolution::SINGLE_PRECISION);
+  super_resolution::util::SaveImage(image, kTestImageDataFilePath);
+  ExpectImagesEqual(
+      super_resolution::util::LoadImage(kTestImageDataFilePath), image);
+
+  // Three-channel images are saved losslessly too, instead of as 8-bit
+  // OpenCV images.
+  const ImageData color_image = MakeTestImage(
+      cv::Size(6, 4), 3, super_resolution::DOUBLE_PRECISION);
+  super_resolution::util::SaveImage(color_image, kTestImageDataFilePath);
+  ExpectImagesEqual(
+      super_resolution::util::LoadImage(kTestImageDataFilePath), color_image);
+
+  HyperspectralDataLoader hs_data_loader(kTestImageDataFilePath);
+  hs_data_loader.SaveImage(image, super_resolution::HSIBinaryDataFormat());
+  EXPECT_EQ(hs_data_loader.GetNumBands(), 7);
+  hs_data_loader.LoadBandsFromENVIFile(3, 4);
+  const ImageData loaded_bands = hs_data_loader.GetImage();
+  ASSERT_EQ(loaded_bands.GetNumChannels(), 4);
+  EXPECT_EQ(cv::norm(loaded_bands.GetChannelImage(0),
+                     image.GetChannelImage(3),
+                     cv::NORM_INF), 0.0);
+  hs_data_loader.LoadImageFromENVIFile();
+  ExpectImagesEqual(hs_data_loader.GetImage(), image);
+
+  // Files of other formats are not image data files.
+  ImageDataFileInfo info;
+  EXPECT_FALSE(super_resolution::ReadImageDataFileInfo(
+      GetAbsoluteCodePath("test_data/goat.jpg"), &info));
+}
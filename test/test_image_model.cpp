@@ -1,21 +1,31 @@
+#include <cmath>
 #include <memory>
 #include <vector>
 
 #include "image_model/additive_noise_module.h"
+#include "image_model/area_downsampling_module.h"
 #include "image_model/blur_module.h"
+#include "image_model/compiled_image_model.h"
 #include "image_model/downsampling_module.h"
+#include "image_model/fourier_blur_module.h"
 #include "image_model/image_model.h"
 #include "image_model/motion_module.h"
+#include "image_model/spectral_blur_module.h"
+#include "image_model/warp_module.h"
 #include "motion/motion_shift.h"
+#include "motion/warp_field.h"
 #include "util/matrix_util.h"
+#include "util/sparse_matrix.h"
 #include "util/test_util.h"
 
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
 
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 
+using super_resolution::test::AreImagesEqual;
 using super_resolution::test::AreMatricesEqual;
 using testing::_;
 using testing::Return;
@@ -77,11 +87,35 @@ TEST(ImageModel, DegradationOperator) {
       operator_matrix * test_image_vector, expected_result));
 }
 
+// Verifies that the noise of every image index and channel is reproducible,
+// independent of the other indices, and has the requested deviation.
 TEST(ImageModel, AdditiveNoiseModule) {
-  // Patch radius for single pixel degradation should be 0 since it only needs
-  // the pixel value itself.
-  const super_resolution::AdditiveNoiseModule additive_noise_module(5);
-  // TODO: implement tests.
+  const super_resolution::AdditiveNoiseModule additive_noise_module(5, 7);
+  const auto get_noisy_image = [](
+      const super_resolution::AdditiveNoiseModule& noise_module,
+      const int index) {
+    super_resolution::ImageData image(cv::Size(64, 48), 2);
+    noise_module.ApplyToImage(&image, index);
+    return image;
+  };
+
+  const super_resolution::ImageData noisy_image =
+      get_noisy_image(additive_noise_module, 3);
+  EXPECT_TRUE(AreImagesEqual(
+      get_noisy_image(additive_noise_module, 3), noisy_image));
+  EXPECT_FALSE(AreImagesEqual(
+      get_noisy_image(additive_noise_module, 4), noisy_image));
+  const super_resolution::AdditiveNoiseModule other_seed_module(5, 8);
+  EXPECT_FALSE(AreImagesEqual(
+      get_noisy_image(other_seed_module, 3), noisy_image));
+  EXPECT_GT(cv::norm(noisy_image.GetChannelImage(0),
+                     noisy_image.GetChannelImage(1), cv::NORM_INF), 0.0);
+
+  cv::Scalar mean;
+  cv::Scalar standard_deviation;
+  cv::meanStdDev(noisy_image.GetChannelImage(0), mean, standard_deviation);
+  EXPECT_NEAR(mean[0], 0.0, 0.2 * 5.0 / 255.0);
+  EXPECT_NEAR(standard_deviation[0], 5.0 / 255.0, 0.1 * 5.0 / 255.0);
 }
 
 TEST(ImageModel, DownsamplingModule) {
@@ -225,6 +259,93 @@ TEST(ImageModel, DownsamplingModule) {
       upsampled_image.GetChannelImage(0), expected_upsampled_image));
 }
 
+// Tests the AreaDownsamplingModule against its operator matrices, and that
+// its transpose is the adjoint of the downsampling.
+TEST(ImageModel, AreaDownsamplingModule) {
+  const super_resolution::AreaDownsamplingModule downsampling_module(2);
+
+  // Each LR pixel is the mean of its 2x2 patch.
+  const cv::Mat expected_downsampled_image = (cv::Mat_<double>(2, 3)
+      << 4.5, 4.0, 3.5,
+         5.5, 5.75, 1.0);
+  super_resolution::ImageData downsampled_image(
+      kSmallTestImage, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  downsampling_module.ApplyToImage(&downsampled_image, 0);
+  EXPECT_TRUE(AreMatricesEqual(
+      downsampled_image.GetChannelImage(0), expected_downsampled_image));
+
+  const cv::Mat downsampling_matrix =
+      downsampling_module.GetOperatorMatrix(kSmallTestImageSize, 0);
+  EXPECT_EQ(downsampling_matrix.size(), cv::Size(24, 6));  // cols, rows
+  EXPECT_TRUE(AreMatricesEqual(
+      downsampling_matrix * kSmallTestImage.reshape(1, 24),
+      expected_downsampled_image.reshape(1, 6)));
+  EXPECT_TRUE(AreMatricesEqual(
+      downsampling_module.GetSparseOperatorMatrix(
+          kSmallTestImageSize, 0).ToDense(),
+      downsampling_matrix));
+
+  // The transpose spreads each LR pixel over its patch.
+  const cv::Mat low_res_image = (cv::Mat_<double>(2, 3)
+      << 4, 8, -4,
+         1, 2, 0);
+  const cv::Mat expected_upsampled_image = (cv::Mat_<double>(4, 6)
+      << 1, 1, 2, 2, -1, -1,
+         1, 1, 2, 2, -1, -1,
+         0.25, 0.25, 0.5, 0.5, 0, 0,
+         0.25, 0.25, 0.5, 0.5, 0, 0);
+  super_resolution::ImageData upsampled_image(
+      low_res_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  downsampling_module.ApplyTransposeToImage(&upsampled_image, 0);
+  EXPECT_TRUE(AreMatricesEqual(
+      upsampled_image.GetChannelImage(0), expected_upsampled_image));
+  cv::Mat matrix_upsampled =
+      downsampling_matrix.t() * low_res_image.reshape(1, 6);
+  EXPECT_TRUE(AreMatricesEqual(
+      matrix_upsampled.reshape(1, 4), expected_upsampled_image));
+
+  // <Ax, y> = <x, A'y> at a large scale, where the image size is not a
+  // multiple of the scale, in both precisions.
+  const super_resolution::AreaDownsamplingModule large_module(8);
+  cv::Mat x(cv::Size(67, 45), CV_64FC1);
+  cv::randu(x, -1.0, 1.0);
+  cv::Mat y(cv::Size(8, 5), CV_64FC1);
+  cv::randu(y, -1.0, 1.0);
+  for (const super_resolution::ImagePrecision precision :
+       {super_resolution::DOUBLE_PRECISION,
+        super_resolution::SINGLE_PRECISION}) {
+    super_resolution::ImageData ax(
+        x, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+    ax.SetPrecision(precision);
+    large_module.ApplyToImage(&ax, 0);
+    super_resolution::ImageData aty(
+        y, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+    aty.SetPrecision(precision);
+    large_module.ApplyTransposeToImage(&aty, 0);
+    ASSERT_EQ(ax.GetImageSize(), y.size());
+    ASSERT_EQ(aty.GetImageSize(), cv::Size(64, 40));
+    ax.SetPrecision(super_resolution::DOUBLE_PRECISION);
+    aty.SetPrecision(super_resolution::DOUBLE_PRECISION);
+    const double tolerance =
+        (precision == super_resolution::SINGLE_PRECISION) ? 1.0e-4 : 1.0e-12;
+    EXPECT_NEAR(
+        ax.GetChannelImage(0).dot(y),
+        aty.GetChannelImage(0).dot(x(cv::Rect(0, 0, 64, 40))),
+        tolerance);
+  }
+
+  // The image model uses it instead of the DownsamplingModule if requested.
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.use_area_downsampling = true;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  EXPECT_TRUE(image_model.IsCompilable());
+  EXPECT_TRUE(AreMatricesEqual(
+      image_model.GetModelMatrix(kSmallTestImageSize, 0),
+      downsampling_matrix));
+}
+
 // Tests the implemented functionality of the MotionModule.
 TEST(ImageModel, MotionModule) {
   /* Verify that the returned patch radius is correct. */
@@ -407,6 +528,177 @@ TEST(ImageModel, BlurModule) {
       image_data2.GetChannelImage(0), expected_blurred_image, diff_tolerance));
 }
 
+// Tests that the separable (and multithreaded) blur gives the same result as
+// a dense 2D convolution with the full Gaussian kernel.
+TEST(ImageModel, SeparableBlurModule) {
+  const int blur_radius = 7;
+  const double sigma = 1.5;
+  super_resolution::BlurModule blur_module(blur_radius, sigma);
+  EXPECT_TRUE(blur_module.IsSeparable());
+
+  const cv::Mat kernel_1d = cv::getGaussianKernel(blur_radius, sigma);
+  const cv::Mat kernel_2d = kernel_1d * kernel_1d.t();
+
+  super_resolution::ImageData image;
+  std::vector<cv::Mat> expected_channels;
+  for (int channel = 0; channel < 3; ++channel) {
+    cv::Mat channel_image(16, 20, CV_64FC1);
+    cv::randu(channel_image, 0.0, 1.0);
+    image.AddChannel(channel_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+    cv::Mat expected_channel;
+    cv::filter2D(
+        channel_image, expected_channel, -1, kernel_2d, cv::Point(-1, -1), 0,
+        cv::BORDER_CONSTANT);
+    expected_channels.push_back(expected_channel);
+  }
+
+  for (const int num_threads : {1, 3}) {
+    blur_module.SetNumThreads(num_threads);
+    super_resolution::ImageData blurred_image = image;
+    blur_module.ApplyToImage(&blurred_image, 0);
+    super_resolution::ImageData transpose_blurred_image = image;
+    blur_module.ApplyTransposeToImage(&transpose_blurred_image, 0);
+    for (int channel = 0; channel < 3; ++channel) {
+      EXPECT_TRUE(AreMatricesEqual(
+          blurred_image.GetChannelImage(channel),
+          expected_channels[channel],
+          1.0e-12));
+      EXPECT_TRUE(AreMatricesEqual(
+          transpose_blurred_image.GetChannelImage(channel),
+          expected_channels[channel],
+          1.0e-12));
+    }
+  }
+}
+
+// Tests that the SpectralBlurModule blurs every band with the kernel of its
+// band group, both for Gaussian PSFs and for a PSF table.
+TEST(ImageModel, SpectralBlurModule) {
+  const int blur_radius = 5;
+  super_resolution::SpectralBlurModule gaussian_module(
+      blur_radius, 0.5, 0.25, 2);
+  EXPECT_FALSE(gaussian_module.IsBandIndependent());
+  EXPECT_EQ(gaussian_module.GetBandGroup(0), 0);
+  EXPECT_EQ(gaussian_module.GetBandGroup(1), 0);
+  EXPECT_EQ(gaussian_module.GetBandGroup(4), 2);
+
+  // Bands 0 and 1 share the sigma of their center, 0.5 + 0.25 * 0.5.
+  const cv::Mat group_kernel_1d = cv::getGaussianKernel(blur_radius, 0.625);
+  EXPECT_TRUE(AreMatricesEqual(
+      gaussian_module.GetBandKernel(1),
+      group_kernel_1d * group_kernel_1d.t(),
+      1.0e-12));
+
+  const int num_channels = 5;
+  super_resolution::ImageData image;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    cv::Mat channel_image(12, 15, CV_64FC1);
+    cv::randu(channel_image, 0.0, 1.0);
+    image.AddChannel(channel_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  }
+
+  // The blur of every band matches a BlurModule with the sigma of its group.
+  for (const int num_threads : {1, 3}) {
+    gaussian_module.SetNumThreads(num_threads);
+    super_resolution::ImageData blurred_image = image;
+    gaussian_module.ApplyToImage(&blurred_image, 0);
+    super_resolution::ImageData output_image = image;
+    gaussian_module.ApplyToImageOutOfPlace(image, 0, &output_image);
+    for (int channel = 0; channel < num_channels; ++channel) {
+      const double sigma = 0.5 + 0.25 * (2 * (channel / 2) + 0.5);
+      const super_resolution::BlurModule blur_module(blur_radius, sigma);
+      super_resolution::ImageData expected_image;
+      expected_image.AddChannel(
+          image.GetChannelImage(channel),
+          super_resolution::DO_NOT_NORMALIZE_IMAGE);
+      blur_module.ApplyToImage(&expected_image, 0);
+      EXPECT_TRUE(AreMatricesEqual(
+          blurred_image.GetChannelImage(channel),
+          expected_image.GetChannelImage(0),
+          1.0e-12));
+      EXPECT_TRUE(AreMatricesEqual(
+          output_image.GetChannelImage(channel),
+          expected_image.GetChannelImage(0),
+          1.0e-12));
+    }
+  }
+
+  // A table of a non-separable kernel and a box kernel. The box kernel is
+  // also used for the bands after its group.
+  const cv::Mat cross_kernel = (cv::Mat_<double>(3, 3)
+      << 0, 1, 0,
+         1, 2, 1,
+         0, 1, 0) / 6.0;
+  const cv::Mat box_kernel = cv::Mat::ones(3, 3, CV_64FC1) / 9.0;
+  const super_resolution::SpectralBlurModule table_module(
+      {cross_kernel, box_kernel}, 2);
+  EXPECT_EQ(table_module.GetBandGroup(4), 1);
+  super_resolution::ImageData transpose_blurred_image = image;
+  table_module.ApplyTransposeToImage(&transpose_blurred_image, 0);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    const cv::Mat& kernel = (channel < 2) ? cross_kernel : box_kernel;
+    cv::Mat expected_channel;
+    cv::filter2D(
+        image.GetChannelImage(channel), expected_channel, -1, kernel.t(),
+        cv::Point(-1, -1), 0, cv::BORDER_CONSTANT);
+    EXPECT_TRUE(AreMatricesEqual(
+        transpose_blurred_image.GetChannelImage(channel),
+        expected_channel,
+        1.0e-12));
+  }
+
+  // A single kernel has an operator matrix like the BlurModule.
+  const super_resolution::SpectralBlurModule single_module(
+      {box_kernel}, 1);
+  EXPECT_TRUE(single_module.IsBandIndependent());
+  EXPECT_TRUE(AreMatricesEqual(
+      single_module.GetOperatorMatrix(kSmallTestImageSize, 0),
+      super_resolution::DegradationOperator::ConvertKernelToOperatorMatrix(
+          box_kernel, kSmallTestImageSize)));
+}
+
+// Tests that an image model offset to a range of bands (e.g. a channel split)
+// blurs each channel with the kernel of its band, not of its channel index.
+TEST(ImageModel, SpectralBlurModuleBandOffset) {
+  const int blur_radius = 5;
+  std::shared_ptr<super_resolution::SpectralBlurModule> blur_module(
+      new super_resolution::SpectralBlurModule(blur_radius, 0.5, 0.25, 1));
+  super_resolution::ImageModel image_model(1);
+  image_model.AddDegradationOperator(blur_module);
+
+  const int num_channels = 5;
+  super_resolution::ImageData image;
+  for (int channel = 0; channel < num_channels; ++channel) {
+    cv::Mat channel_image(12, 15, CV_64FC1);
+    cv::randu(channel_image, 0.0, 1.0);
+    image.AddChannel(channel_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  }
+  const super_resolution::ImageData blurred_image =
+      image_model.ApplyToImage(image, 0);
+
+  // Channels 0 and 1 of the split hold bands 3 and 4. Offsetting the offset
+  // model again adds up the offsets.
+  const int first_band = 3;
+  const super_resolution::ImageModel offset_image_model =
+      image_model.CreateBandOffsetImageModel(1)
+          .CreateBandOffsetImageModel(first_band - 1);
+  EXPECT_EQ(offset_image_model.GetBandOffset(), first_band);
+  EXPECT_EQ(blur_module->GetFirstBand(), 0);
+  super_resolution::ImageData split_image;
+  for (int band = first_band; band < num_channels; ++band) {
+    split_image.AddChannel(
+        image.GetChannelImage(band), super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  }
+  const super_resolution::ImageData blurred_split_image =
+      offset_image_model.ApplyToImage(split_image, 0);
+  for (int channel = 0; channel < split_image.GetNumChannels(); ++channel) {
+    EXPECT_TRUE(AreMatricesEqual(
+        blurred_split_image.GetChannelImage(channel),
+        blurred_image.GetChannelImage(first_band + channel),
+        1.0e-12));
+  }
+}
+
 // Tests that both the ApplyToImage and the ApplyToPixel methods correctly
 // return the right values of the degraded image. This does not test the
 // method's efficiency, but verifies its correctness and compares the two
@@ -486,3 +778,560 @@ TEST(ImageModel, GetModelMatrix) {
   cv::Mat returned_operator_matrix = image_model.GetModelMatrix(image_size, 0);
   EXPECT_TRUE(AreMatricesEqual(returned_operator_matrix, expected_result));
 }
+
+// Tests that applying the model into a separate output image gives the same
+// result as degrading a copy, without modifying the (borrowed) input image.
+TEST(ImageModel, ApplyToImageWithOutput) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, -1)
+  });
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+
+  // Two channels of the small test image, stored one after the other.
+  const int num_pixels = kSmallTestImageSize.area();
+  const double* test_image_data = kSmallTestImage.ptr<double>();
+  std::vector<double> pixel_values;
+  for (int channel = 0; channel < 2; ++channel) {
+    pixel_values.insert(
+        pixel_values.end(), test_image_data, test_image_data + num_pixels);
+  }
+  const std::vector<double> original_pixel_values = pixel_values;
+  const super_resolution::ImageData input_image(
+      static_cast<const double*>(pixel_values.data()),
+      kSmallTestImageSize,
+      2,
+      super_resolution::WRAP_PIXEL_DATA);
+
+  for (const int index : {0, 1}) {
+    const super_resolution::ImageData expected_image =
+        image_model.ApplyToImage(input_image, index);
+
+    std::vector<double> output_values(pixel_values.size());
+    super_resolution::ImageData degraded_image(
+        output_values.data(),
+        kSmallTestImageSize,
+        2,
+        super_resolution::WRAP_PIXEL_DATA);
+    image_model.ApplyToImage(input_image, index, &degraded_image);
+
+    EXPECT_EQ(degraded_image.GetImageSize(), cv::Size(3, 2));
+    ASSERT_EQ(degraded_image.GetNumChannels(), 2);
+    for (int channel = 0; channel < 2; ++channel) {
+      EXPECT_TRUE(AreMatricesEqual(
+          degraded_image.GetChannelImage(channel),
+          expected_image.GetChannelImage(channel),
+          1.0e-12));
+    }
+    EXPECT_EQ(pixel_values, original_pixel_values);
+  }
+}
+
+// Tests that the FourierBlurModule matches the spatial blur and integer motion
+// operators, and that its transpose is the adjoint of the forward operator.
+TEST(ImageModel, FourierBlurModule) {
+  const int blur_radius = 5;
+  const double sigma = 1.2;
+  const cv::Mat kernel_1d = cv::getGaussianKernel(blur_radius, sigma);
+  const super_resolution::MotionShiftSequence motion_shift_sequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(2, -1)
+  });
+  const super_resolution::FourierBlurModule fourier_blur_module(
+      kernel_1d * kernel_1d.t(), motion_shift_sequence);
+  const super_resolution::BlurModule blur_module(blur_radius, sigma);
+  const super_resolution::MotionModule motion_module(motion_shift_sequence);
+
+  cv::Mat image_matrix(11, 14, CV_64FC1);
+  cv::randu(image_matrix, 0.0, 1.0);
+  const super_resolution::ImageData image(
+      image_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+
+  // Blur and integer motion match the spatial operators with zero borders.
+  for (const int index : {0, 1}) {
+    super_resolution::ImageData expected_image = image;
+    motion_module.ApplyToImage(&expected_image, index);
+    blur_module.ApplyToImage(&expected_image, index);
+
+    super_resolution::ImageData fourier_image = image;
+    fourier_blur_module.ApplyToImage(&fourier_image, index);
+    EXPECT_TRUE(AreMatricesEqual(
+        fourier_image.GetChannelImage(0),
+        expected_image.GetChannelImage(0),
+        1.0e-10));
+  }
+
+  // With sub-pixel motion, <Ax, y> = <x, A'y>.
+  const super_resolution::FourierBlurModule subpixel_blur_module(
+      kernel_1d * kernel_1d.t(),
+      super_resolution::MotionShiftSequence({
+        super_resolution::MotionShift(0.5, -1.25)
+      }));
+  cv::Mat other_image_matrix(11, 14, CV_64FC1);
+  cv::randu(other_image_matrix, 0.0, 1.0);
+  super_resolution::ImageData forward_image = image;
+  subpixel_blur_module.ApplyToImage(&forward_image, 0);
+  super_resolution::ImageData transpose_image(
+      other_image_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  subpixel_blur_module.ApplyTransposeToImage(&transpose_image, 0);
+  EXPECT_NEAR(
+      forward_image.GetChannelImage(0).dot(other_image_matrix),
+      image_matrix.dot(transpose_image.GetChannelImage(0)),
+      1.0e-10);
+
+  // The operator matrix matches the operator applied to the image.
+  const cv::Mat operator_matrix =
+      fourier_blur_module.GetOperatorMatrix(kSmallTestImageSize, 1);
+  super_resolution::ImageData small_image(
+      kSmallTestImage, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  fourier_blur_module.ApplyToImage(&small_image, 1);
+  const cv::Mat matrix_result =
+      (operator_matrix * kSmallTestImage.reshape(1, 24)).reshape(1, 4);
+  EXPECT_TRUE(AreMatricesEqual(
+      matrix_result, small_image.GetChannelImage(0), 1.0e-10));
+}
+
+// Tests that the sparse operator and model matrices match the dense ones on a
+// small image, and that the sparse model matrix matches the image model on a
+// realistic image size where the dense matrix could not be built.
+TEST(ImageModel, GetSparseModelMatrix) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, -2),
+    super_resolution::MotionShift(0.5, 0.25)
+  });
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+
+  for (const int index : {0, 1, 2}) {
+    const cv::Mat dense_matrix =
+        image_model.GetModelMatrix(kSmallTestImageSize, index);
+    const cv::Mat sparse_matrix =
+        image_model.GetSparseModelMatrix(kSmallTestImageSize, index).ToDense();
+    if (index < 2) {
+      EXPECT_TRUE(AreMatricesEqual(sparse_matrix, dense_matrix, 1.0e-12));
+    }
+    // The dense motion matrix only supports integer shifts.
+    EXPECT_EQ(sparse_matrix.size(), dense_matrix.size());
+  }
+
+  const cv::Size image_size(512, 512);
+  cv::Mat image_matrix(image_size, CV_64FC1);
+  cv::randu(image_matrix, 0.0, 1.0);
+  const super_resolution::ImageData image(
+      image_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  const super_resolution::util::SparseMatrix model_matrix =
+      image_model.GetSparseModelMatrix(image_size, 1);
+  EXPECT_EQ(model_matrix.GetNumRows(), 256 * 256);
+  EXPECT_EQ(model_matrix.GetNumCols(), 512 * 512);
+  EXPECT_LE(model_matrix.GetNumNonZeros(), 256 * 256 * 9);
+
+  const super_resolution::ImageData degraded_image =
+      image_model.ApplyToImage(image, 1);
+  cv::Mat matrix_result(256, 256, CV_64FC1);
+  model_matrix.MultiplyVector(
+      image_matrix.ptr<double>(), matrix_result.ptr<double>());
+  EXPECT_TRUE(AreMatricesEqual(
+      matrix_result, degraded_image.GetChannelImage(0), 1.0e-10));
+}
+
+TEST(ImageModel, Compile) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, -2)
+  });
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  ASSERT_TRUE(image_model.IsCompilable());
+
+  const cv::Size image_size(64, 48);
+  const super_resolution::CompiledImageModel compiled_image_model =
+      image_model.Compile(image_size, 2);
+  EXPECT_EQ(compiled_image_model.GetNumFrames(), 2);
+  EXPECT_EQ(compiled_image_model.GetImageSize(), image_size);
+  EXPECT_EQ(compiled_image_model.GetLowResImageSize(), cv::Size(32, 24));
+
+  cv::Mat image_matrix(image_size, CV_64FC1);
+  cv::randu(image_matrix, 0.0, 1.0);
+  const super_resolution::ImageData image(
+      image_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  cv::Mat residual_matrix(24, 32, CV_64FC1);
+  cv::randu(residual_matrix, 0.0, 1.0);
+  for (const int index : {0, 1}) {
+    // The compiled model replays the whole operator chain.
+    const super_resolution::ImageData degraded_image =
+        image_model.ApplyToImage(image, index);
+    cv::Mat compiled_result(24, 32, CV_64FC1);
+    compiled_image_model.ApplyToChannel(
+        image_matrix.ptr<double>(), index, compiled_result.ptr<double>());
+    EXPECT_TRUE(AreMatricesEqual(
+        compiled_result, degraded_image.GetChannelImage(0), 1.0e-10));
+
+    // The transpose is added to the output as the exact adjoint: for random
+    // x and r, <Ax, r> = <x, A'r>.
+    cv::Mat transpose_result = cv::Mat::ones(image_size, CV_64FC1);
+    compiled_image_model.AddTransposeToChannel(
+        residual_matrix.ptr<double>(), index, transpose_result.ptr<double>());
+    transpose_result -= 1.0;
+    EXPECT_NEAR(
+        compiled_result.dot(residual_matrix),
+        image_matrix.dot(transpose_result),
+        1.0e-9);
+  }
+
+  // The batched frames give the same results as the frames on their own.
+  ASSERT_EQ(residual_matrix.size(), cv::Size(32, 24));
+  std::vector<cv::Mat> batch_results = {
+    cv::Mat(24, 32, CV_64FC1), cv::Mat(24, 32, CV_64FC1)
+  };
+  compiled_image_model.ApplyToChannelBatch(
+      image_matrix.ptr<double>(),
+      0,
+      {batch_results[0].ptr<double>(), batch_results[1].ptr<double>()});
+  cv::Mat batch_transpose_result = cv::Mat::zeros(image_size, CV_64FC1);
+  compiled_image_model.AddTransposeToChannelBatch(
+      {residual_matrix.ptr<double>(), residual_matrix.ptr<double>()},
+      0,
+      batch_transpose_result.ptr<double>());
+  cv::Mat expected_transpose_result = cv::Mat::zeros(image_size, CV_64FC1);
+  for (const int index : {0, 1}) {
+    cv::Mat compiled_result(24, 32, CV_64FC1);
+    compiled_image_model.ApplyToChannel(
+        image_matrix.ptr<double>(), index, compiled_result.ptr<double>());
+    EXPECT_TRUE(AreMatricesEqual(
+        batch_results[index], compiled_result, 1.0e-12));
+    compiled_image_model.AddTransposeToChannel(
+        residual_matrix.ptr<double>(),
+        index,
+        expected_transpose_result.ptr<double>());
+  }
+  EXPECT_TRUE(AreMatricesEqual(
+      batch_transpose_result, expected_transpose_result, 1.0e-12));
+
+  // The Fourier blur has no direct sparse matrix, so it cannot be compiled.
+  model_parameters.use_fourier_blur = true;
+  EXPECT_FALSE(super_resolution::ImageModel::CreateImageModel(
+      model_parameters).IsCompilable());
+}
+
+// Verifies that a model extended by the motion of a new frame, and its
+// compiled form extended by the frame's matrix, match the model and the
+// compiled form created with the motion of all frames, and that the original
+// model and compiled form are not changed.
+TEST(ImageModel, CreateWithMotionShift) {
+  const super_resolution::MotionShift new_motion_shift(0.5, -2);
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    new_motion_shift
+  });
+  const super_resolution::ImageModel expected_image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0)
+  });
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  const cv::Size image_size(12, 10);
+  const super_resolution::CompiledImageModel one_frame_compiled_image_model =
+      image_model.Compile(image_size, 1, true);
+  EXPECT_TRUE(image_model.CanAddFrames());
+  const super_resolution::ImageModel extended_image_model =
+      image_model.CreateWithMotionShift(new_motion_shift);
+  super_resolution::CompiledImageModel compiled_image_model =
+      one_frame_compiled_image_model;
+  compiled_image_model.AddFrame(
+      extended_image_model.GetSparseModelMatrix(image_size, 1));
+  EXPECT_EQ(one_frame_compiled_image_model.GetNumFrames(), 1);
+  EXPECT_EQ(
+      &compiled_image_model.GetFrameMatrix(0),
+      &one_frame_compiled_image_model.GetFrameMatrix(0));
+
+  cv::Mat image_matrix(image_size, CV_64FC1);
+  cv::randu(image_matrix, 0.0, 1.0);
+  const super_resolution::ImageData image(
+      image_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  EXPECT_TRUE(AreImagesEqual(
+      extended_image_model.ApplyToImage(image, 1),
+      expected_image_model.ApplyToImage(image, 1),
+      1.0e-12));
+  EXPECT_TRUE(AreImagesEqual(
+      extended_image_model.ApplyToImage(image, 0),
+      image_model.ApplyToImage(image, 0),
+      0.0));
+
+  const super_resolution::CompiledImageModel expected_compiled_image_model =
+      expected_image_model.Compile(image_size, 2, true);
+  ASSERT_EQ(compiled_image_model.GetNumFrames(), 2);
+  EXPECT_TRUE(AreMatricesEqual(
+      compiled_image_model.GetNormalMatrix().ToDense(),
+      expected_compiled_image_model.GetNormalMatrix().ToDense(),
+      1.0e-12));
+
+  // A model without motion applies the same operators to the new frame.
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence();
+  const super_resolution::ImageModel static_image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters)
+          .CreateWithMotionShift(super_resolution::MotionShift(0, 0));
+  EXPECT_TRUE(AreImagesEqual(
+      static_image_model.ApplyToImage(image, 1),
+      static_image_model.ApplyToImage(image, 0),
+      0.0));
+
+  // Observation weights are only given for the existing frames.
+  model_parameters.observation_weights = {1.0};
+  EXPECT_FALSE(super_resolution::ImageModel::CreateImageModel(
+      model_parameters).CanAddFrames());
+}
+
+// Verifies that the coarse image model halves the downsampling scale, the blur
+// and the motion, and that models that cannot be scaled down have no coarse
+// model.
+TEST(ImageModel, CreateCoarseImageModel) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 4;
+  model_parameters.blur_radius = 5;
+  model_parameters.blur_sigma = 2.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(2, -4),
+    super_resolution::MotionShift(1, 0.5)
+  });
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  const std::unique_ptr<super_resolution::ImageModel> coarse_image_model =
+      image_model.CreateCoarseImageModel();
+  ASSERT_NE(coarse_image_model, nullptr);
+  EXPECT_EQ(coarse_image_model->GetDownsamplingScale(), 2);
+
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(1, -2),
+    super_resolution::MotionShift(0.5, 0.25)
+  });
+  const super_resolution::ImageModel expected_image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  cv::Mat image_matrix(cv::Size(12, 10), CV_64FC1);
+  cv::randu(image_matrix, 0.0, 1.0);
+  const super_resolution::ImageData image(
+      image_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  for (int index = 0; index < 2; ++index) {
+    EXPECT_TRUE(AreImagesEqual(
+        coarse_image_model->ApplyToImage(image, index),
+        expected_image_model.ApplyToImage(image, index),
+        1.0e-12));
+  }
+
+  // An odd scale cannot be halved.
+  model_parameters.scale = 3;
+  EXPECT_EQ(super_resolution::ImageModel::CreateImageModel(model_parameters)
+                .CreateCoarseImageModel(),
+            nullptr);
+}
+
+// Verifies that integral shifts, which are applied by moving memory, match the
+// bilinear warp, and that a motion followed by downsampling gives the same
+// result whether the two are fused or applied one after the other.
+TEST(ImageModel, IntegralMotionFastPath) {
+  const super_resolution::MotionShiftSequence motion_shift_sequence({
+    super_resolution::MotionShift(1, -2),
+    super_resolution::MotionShift(-3, 0),
+    super_resolution::MotionShift(0.5, 0.25),
+    super_resolution::MotionShift(20, 1)
+  });
+  std::shared_ptr<super_resolution::MotionModule> motion_module(
+      new super_resolution::MotionModule(motion_shift_sequence));
+  std::shared_ptr<super_resolution::DownsamplingModule> downsampling_module(
+      new super_resolution::DownsamplingModule(2));
+  super_resolution::ImageModel image_model(2);
+  image_model.AddDegradationOperator(motion_module);
+  image_model.AddDegradationOperator(downsampling_module);
+
+  cv::Mat image_matrix(8, 12, CV_64FC1);
+  cv::randu(image_matrix, 0.0, 1.0);
+  const super_resolution::ImageData image(
+      image_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+
+  for (const int index : {0, 1, 2, 3}) {
+    const super_resolution::MotionShift motion_shift =
+        motion_shift_sequence[index];
+    const cv::Mat shift_kernel = (cv::Mat_<double>(2, 3)
+        << 1, 0, motion_shift.dx,
+           0, 1, motion_shift.dy);
+    cv::Mat expected_shift;
+    cv::warpAffine(
+        image_matrix, expected_shift, shift_kernel, image_matrix.size());
+
+    super_resolution::ImageData shifted_image = image;
+    motion_module->ApplyToImage(&shifted_image, index);
+    EXPECT_TRUE(AreMatricesEqual(
+        shifted_image.GetChannelImage(0), expected_shift, 1.0e-12));
+
+    super_resolution::ImageData expected_degraded_image = shifted_image;
+    downsampling_module->ApplyToImage(&expected_degraded_image, index);
+    const super_resolution::ImageData degraded_image =
+        image_model.ApplyToImage(image, index);
+    EXPECT_EQ(degraded_image.GetImageSize(), cv::Size(6, 4));
+    EXPECT_TRUE(AreMatricesEqual(
+        degraded_image.GetChannelImage(0),
+        expected_degraded_image.GetChannelImage(0),
+        1.0e-12));
+
+    super_resolution::ImageData output_image(
+        image.GetImageSize(), 1, super_resolution::DOUBLE_PRECISION);
+    image_model.ApplyToImage(image, index, &output_image);
+    EXPECT_TRUE(AreMatricesEqual(
+        output_image.GetChannelImage(0),
+        expected_degraded_image.GetChannelImage(0),
+        1.0e-12));
+  }
+}
+
+TEST(ImageModel, SubPixelMotionAdjoint) {
+  const super_resolution::MotionShiftSequence motion_shift_sequence({
+    super_resolution::MotionShift(0.3, -0.7),
+    super_resolution::MotionShift(-1.45, 2.2)
+  });
+  super_resolution::MotionModule motion_module(motion_shift_sequence);
+
+  const cv::Size image_size(9, 7);
+  const int num_pixels = image_size.area();
+  cv::Mat x_matrix(image_size, CV_64FC1);
+  cv::Mat y_matrix(image_size, CV_64FC1);
+  cv::randu(x_matrix, -1.0, 1.0);
+  cv::randu(y_matrix, -1.0, 1.0);
+  const super_resolution::ImageData x(
+      x_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  const super_resolution::ImageData y(
+      y_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+
+  for (const int num_threads : {1, 3}) {
+    motion_module.SetNumThreads(num_threads);
+    for (const int index : {0, 1}) {
+      const super_resolution::util::SparseMatrix motion_matrix =
+          motion_module.GetSparseOperatorMatrix(image_size, index);
+
+      // The forward shift and its transpose match the sparse operator.
+      super_resolution::ImageData shifted_x = x;
+      motion_module.ApplyToImage(&shifted_x, index);
+      cv::Mat expected_shift(image_size, CV_64FC1);
+      motion_matrix.MultiplyVector(
+          x_matrix.ptr<double>(), expected_shift.ptr<double>());
+      EXPECT_TRUE(AreMatricesEqual(
+          shifted_x.GetChannelImage(0), expected_shift, 1.0e-12));
+
+      super_resolution::ImageData transposed_y = y;
+      motion_module.ApplyTransposeToImage(&transposed_y, index);
+      cv::Mat expected_transpose(image_size, CV_64FC1);
+      motion_matrix.MultiplyTransposeVector(
+          y_matrix.ptr<double>(), expected_transpose.ptr<double>());
+      EXPECT_TRUE(AreMatricesEqual(
+          transposed_y.GetChannelImage(0), expected_transpose, 1.0e-12));
+
+      // <Mx, y> = <x, M'y>.
+      EXPECT_NEAR(
+          shifted_x.GetChannelImage(0).dot(y_matrix),
+          x_matrix.dot(transposed_y.GetChannelImage(0)),
+          1.0e-12 * num_pixels);
+
+      // The out-of-place shift gives the same result.
+      super_resolution::ImageData out_of_place_x(
+          image_size, 1, super_resolution::DOUBLE_PRECISION);
+      motion_module.ApplyToImageOutOfPlace(x, index, &out_of_place_x);
+      EXPECT_TRUE(AreMatricesEqual(
+          out_of_place_x.GetChannelImage(0), expected_shift, 1.0e-12));
+    }
+  }
+}
+
+TEST(ImageModel, WarpModule) {
+  const cv::Size image_size(8, 6);
+  const int num_pixels = image_size.area();
+
+  // A rotation by a few degrees about the image center, an affine warp given
+  // as a 2x3 matrix, a translation, and a dense flow field.
+  const double angle = 0.1;
+  const cv::Mat rotation = (cv::Mat_<double>(3, 3)
+      << std::cos(angle), -std::sin(angle), 0.5,
+         std::sin(angle),  std::cos(angle), -0.3,
+         0.0, 0.0, 1.0);
+  const cv::Mat affine = (cv::Mat_<double>(2, 3)
+      << 1.1, 0.05, -0.4,
+         0.0, 0.95, 0.7);
+  cv::Mat flow(image_size, CV_32FC2);
+  cv::randu(flow, -1.5, 1.5);
+  const super_resolution::MotionShift translation(0.3, -1.25);
+  const super_resolution::WarpFieldSequence warp_sequence({
+    super_resolution::WarpField::FromHomography(rotation),
+    super_resolution::WarpField::FromHomography(affine),
+    super_resolution::WarpField::FromMotionShift(translation),
+    super_resolution::WarpField::FromFlow(flow)
+  });
+  super_resolution::WarpModule warp_module(warp_sequence);
+
+  // A translation warp is the same operator as the MotionModule.
+  const super_resolution::MotionModule motion_module(
+      super_resolution::MotionShiftSequence({translation}));
+  EXPECT_TRUE(AreMatricesEqual(
+      warp_module.GetSparseOperatorMatrix(image_size, 2).ToDense(),
+      motion_module.GetSparseOperatorMatrix(image_size, 0).ToDense(),
+      1.0e-12));
+
+  cv::Mat x_matrix(image_size, CV_64FC1);
+  cv::Mat y_matrix(image_size, CV_64FC1);
+  cv::randu(x_matrix, -1.0, 1.0);
+  cv::randu(y_matrix, -1.0, 1.0);
+  const super_resolution::ImageData x(
+      x_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  const super_resolution::ImageData y(
+      y_matrix, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+
+  for (const int num_threads : {1, 3}) {
+    warp_module.SetNumThreads(num_threads);
+    for (const int index : {0, 1, 2, 3}) {
+      const super_resolution::util::SparseMatrix warp_matrix =
+          warp_module.GetSparseOperatorMatrix(image_size, index);
+      EXPECT_GT(warp_matrix.GetNumNonZeros(), 0);
+
+      super_resolution::ImageData warped_x = x;
+      warp_module.ApplyToImage(&warped_x, index);
+      cv::Mat expected_warp(image_size, CV_64FC1);
+      warp_matrix.MultiplyVector(
+          x_matrix.ptr<double>(), expected_warp.ptr<double>());
+      EXPECT_TRUE(AreMatricesEqual(
+          warped_x.GetChannelImage(0), expected_warp, 1.0e-12));
+
+      super_resolution::ImageData transposed_y = y;
+      warp_module.ApplyTransposeToImage(&transposed_y, index);
+      EXPECT_NEAR(
+          warped_x.GetChannelImage(0).dot(y_matrix),
+          x_matrix.dot(transposed_y.GetChannelImage(0)),
+          1.0e-12 * num_pixels);
+    }
+  }
+
+  // The pixels of the flow warp sample the image at p - flow(p).
+  cv::Mat map_x, map_y;
+  warp_sequence[3].ComputeSampleMaps(image_size, &map_x, &map_y);
+  const cv::Vec2f pixel_flow = flow.at<cv::Vec2f>(2, 5);
+  EXPECT_NEAR(map_x.at<double>(2, 5), 5.0 - pixel_flow[0], 1.0e-6);
+  EXPECT_NEAR(map_y.at<double>(2, 5), 2.0 - pixel_flow[1], 1.0e-6);
+}
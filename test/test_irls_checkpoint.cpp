@@ -0,0 +1,96 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "optimization/irls_checkpoint.h"
+#include "util/util.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::IRLSCheckpoint;
+using super_resolution::ReadIRLSCheckpoint;
+using super_resolution::WriteIRLSCheckpoint;
+using super_resolution::util::GetAbsoluteCodePath;
+using testing::ElementsAre;
+
+static const std::string kTestCheckpointPath =
+    GetAbsoluteCodePath("test_data/test_tmp_dir/irls_checkpoint_test");
+
+// Verifies that a written checkpoint is read back exactly, and that missing
+// or truncated checkpoints are rejected.
+TEST(IRLSCheckpoint, WriteAndRead) {
+  IRLSCheckpoint checkpoint;
+  checkpoint.problem_hash = 0x0123456789abcdefULL;
+  checkpoint.channel_start = 3;
+  checkpoint.channel_end = 5;
+  checkpoint.num_completed_iterations = 7;
+  checkpoint.is_converged = true;
+  checkpoint.previous_cost = 0.25;
+  checkpoint.cost_difference = -1.5e-3;
+  checkpoint.estimate = {0.1, 0.2, 0.3, 0.4};
+  checkpoint.irls_weights = {{1.0, 2.0, 3.0, 4.0}, {5.0, 6.0, 7.0, 8.0}};
+  ASSERT_TRUE(WriteIRLSCheckpoint(kTestCheckpointPath, checkpoint));
+
+  IRLSCheckpoint read_checkpoint;
+  ASSERT_TRUE(ReadIRLSCheckpoint(kTestCheckpointPath, &read_checkpoint));
+  EXPECT_EQ(read_checkpoint.problem_hash, checkpoint.problem_hash);
+  EXPECT_EQ(read_checkpoint.channel_start, 3);
+  EXPECT_EQ(read_checkpoint.channel_end, 5);
+  EXPECT_EQ(read_checkpoint.num_completed_iterations, 7);
+  EXPECT_TRUE(read_checkpoint.is_converged);
+  EXPECT_EQ(read_checkpoint.previous_cost, 0.25);
+  EXPECT_EQ(read_checkpoint.cost_difference, -1.5e-3);
+  EXPECT_THAT(read_checkpoint.estimate, ElementsAre(0.1, 0.2, 0.3, 0.4));
+  ASSERT_EQ(read_checkpoint.irls_weights.size(), 2);
+  EXPECT_THAT(read_checkpoint.irls_weights[1], ElementsAre(5, 6, 7, 8));
+
+  // Drop the last weight from the file.
+  std::string contents;
+  {
+    std::ifstream file(kTestCheckpointPath, std::ios::binary);
+    contents.assign(
+        (std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+  }
+  {
+    std::ofstream file(kTestCheckpointPath, std::ios::binary);
+    file.write(contents.data(), contents.size() - sizeof(double));
+  }
+  EXPECT_FALSE(ReadIRLSCheckpoint(kTestCheckpointPath, &read_checkpoint));
+
+  std::remove(kTestCheckpointPath.c_str());
+  EXPECT_FALSE(ReadIRLSCheckpoint(kTestCheckpointPath, &read_checkpoint));
+}
+
+// The hash identifies the initial estimate that a checkpoint was made for.
+TEST(IRLSCheckpoint, HashIRLSInitialEstimate) {
+  const std::vector<double> estimate = {0.5, 0.25, 1.0};
+  std::vector<double> other_estimate = estimate;
+  other_estimate[2] = 0.75;
+  EXPECT_EQ(
+      super_resolution::HashIRLSInitialEstimate(estimate.data(), 3),
+      super_resolution::HashIRLSInitialEstimate(estimate.data(), 3));
+  EXPECT_NE(
+      super_resolution::HashIRLSInitialEstimate(estimate.data(), 3),
+      super_resolution::HashIRLSInitialEstimate(other_estimate.data(), 3));
+}
+
+// The problem values extend the hash, so problems that only differ in them
+// (e.g. in a regularization parameter) have different hashes.
+TEST(IRLSCheckpoint, HashIRLSProblemValues) {
+  const std::vector<double> estimate = {0.5, 0.25, 1.0};
+  const uint64_t estimate_hash =
+      super_resolution::HashIRLSInitialEstimate(estimate.data(), 3);
+  EXPECT_EQ(
+      super_resolution::HashIRLSProblemValues(estimate_hash, {0.01, 1.0}),
+      super_resolution::HashIRLSProblemValues(estimate_hash, {0.01, 1.0}));
+  EXPECT_NE(
+      super_resolution::HashIRLSProblemValues(estimate_hash, {0.01, 1.0}),
+      super_resolution::HashIRLSProblemValues(estimate_hash, {0.02, 1.0}));
+  EXPECT_NE(
+      super_resolution::HashIRLSProblemValues(estimate_hash, {0.01, 1.0}),
+      estimate_hash);
+}
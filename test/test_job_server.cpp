@@ -0,0 +1,149 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "util/job_server.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::util::JobServer;
+using super_resolution::util::ServerJob;
+
+namespace {
+
+// The socket lives in the test temporary directory and is unique to the test
+// process, so concurrent test runs do not share it.
+const std::string kTestSocketPath =
+    testing::TempDir() + "super_resolution_job_server_" +
+    std::to_string(getpid());
+
+// Connects to the server, and returns the connection or -1 if it failed.
+int ConnectToServer() {
+  const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  std::strncpy(
+      address.sun_path, kTestSocketPath.c_str(), sizeof(address.sun_path) - 1);
+  if (connect(connection,
+              reinterpret_cast<const sockaddr*>(&address),
+              sizeof(address)) != 0) {
+    close(connection);
+    return -1;
+  }
+  return connection;
+}
+
+// Sends the rest of the request on the connection and returns the response
+// line of the server. Closes the connection.
+std::string FinishRequest(const int connection, const std::string& request) {
+  send(connection, request.data(), request.size(), 0);
+  shutdown(connection, SHUT_WR);
+  std::string response;
+  char buffer[256];
+  ssize_t num_read;
+  while ((num_read = recv(connection, buffer, sizeof(buffer), 0)) > 0) {
+    response.append(buffer, num_read);
+  }
+  close(connection);
+  return response;
+}
+
+// Sends the request to the server and returns its response line.
+std::string SendRequest(const std::string& request) {
+  const int connection = ConnectToServer();
+  if (connection < 0) {
+    return "";
+  }
+  return FinishRequest(connection, request);
+}
+
+// Waits until the server has queued the given number of jobs.
+void WaitForQueuedJobs(const JobServer& job_server, const int num_jobs) {
+  while (job_server.GetNumQueuedJobs() < num_jobs) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+}  // namespace
+
+// Verifies that jobs are handed out by priority, that the clients receive the
+// responses, and that a shutdown request stops the server.
+TEST(JobServer, PriorityQueue) {
+  JobServer job_server(kTestSocketPath);
+
+  std::string low_priority_response;
+  std::thread low_priority_client([&low_priority_response]() {
+    low_priority_response = SendRequest("data_path low\n");
+  });
+  WaitForQueuedJobs(job_server, 1);
+  std::string high_priority_response;
+  std::thread high_priority_client([&high_priority_response]() {
+    high_priority_response = SendRequest("data_path high\npriority 3\n\n");
+  });
+  WaitForQueuedJobs(job_server, 2);
+
+  ServerJob job;
+  ASSERT_TRUE(job_server.GetNextJob(&job));
+  EXPECT_EQ(job.config.GetValue("data_path"), "high");
+  EXPECT_EQ(job.priority, 3);
+  EXPECT_EQ(job.id, 1);
+  job_server.FinishJob(job, "ok 2.5");
+  high_priority_client.join();
+  EXPECT_EQ(high_priority_response, "ok 2.5\n");
+
+  ASSERT_TRUE(job_server.GetNextJob(&job));
+  EXPECT_EQ(job.config.GetValue("data_path"), "low");
+  EXPECT_EQ(job.priority, 0);
+  EXPECT_EQ(job.id, 0);
+  job_server.FinishJob(job, "error missing result_path");
+  low_priority_client.join();
+  EXPECT_EQ(low_priority_response, "error missing result_path\n");
+
+  // Empty jobs are rejected without being queued.
+  EXPECT_EQ(SendRequest("\n"), "error empty job\n");
+  EXPECT_EQ(job_server.GetNumQueuedJobs(), 0);
+
+  EXPECT_EQ(SendRequest("shutdown\n"), "ok\n");
+  EXPECT_FALSE(job_server.GetNextJob(&job));
+}
+
+// Verifies that a client that is slow to send its request does not hold up
+// the jobs of other clients.
+TEST(JobServer, ConcurrentRequests) {
+  JobServer job_server(kTestSocketPath);
+
+  const int slow_connection = ConnectToServer();
+  ASSERT_GE(slow_connection, 0);
+  const std::string partial_request = "data_path slow\n";
+  send(slow_connection, partial_request.data(), partial_request.size(), 0);
+
+  std::string fast_response;
+  std::thread fast_client([&fast_response]() {
+    fast_response = SendRequest("data_path fast\n\n");
+  });
+  WaitForQueuedJobs(job_server, 1);
+  ServerJob job;
+  ASSERT_TRUE(job_server.GetNextJob(&job));
+  EXPECT_EQ(job.config.GetValue("data_path"), "fast");
+  job_server.FinishJob(job, "ok");
+  fast_client.join();
+  EXPECT_EQ(fast_response, "ok\n");
+
+  std::string slow_response;
+  std::thread slow_client([&slow_response, slow_connection]() {
+    slow_response = FinishRequest(slow_connection, "\n");
+  });
+  WaitForQueuedJobs(job_server, 1);
+  ASSERT_TRUE(job_server.GetNextJob(&job));
+  EXPECT_EQ(job.config.GetValue("data_path"), "slow");
+  job_server.FinishJob(job, "ok");
+  slow_client.join();
+  EXPECT_EQ(slow_response, "ok\n");
+}
@@ -1,3 +1,5 @@
+#include <atomic>
+#include <cstdio>
 #include <memory>
 #include <string>
 #include <utility>
@@ -12,7 +14,13 @@
 #include "image_model/motion_module.h"
 #include "motion/motion_shift.h"
 #include "optimization/btv_regularizer.h"
+#include "optimization/irls_checkpoint.h"
 #include "optimization/irls_map_solver.h"
+#include "optimization/numerical_gradient.h"
+#include "optimization/objective_data_term.h"
+#include "optimization/objective_function.h"
+#include "optimization/objective_irls_regularization_term.h"
+#include "optimization/solver_deadline.h"
 #include "optimization/tv_regularizer.h"
 #include "util/test_util.h"
 #include "util/util.h"
@@ -29,12 +37,14 @@ using super_resolution::BlurModule;
 using super_resolution::DownsamplingModule;
 using super_resolution::ImageData;
 using super_resolution::MotionModule;
+using super_resolution::SolverDeadline;
 using super_resolution::test::AreImagesEqual;
 using super_resolution::test::AreMatricesEqual;
 using super_resolution::util::GetAbsoluteCodePath;
 
 using testing::_;
 using testing::ContainerEq;
+using testing::Contains;
 using testing::DoubleEq;
 using testing::ElementsAre;
 using testing::Matcher;
@@ -58,6 +68,11 @@ static const std::string kTestIconPath =
 static const std::string kTestImagePath =
     GetAbsoluteCodePath("test_data/goat.jpg");
 
+// Checkpoint files are written here (one per channel split, with the index
+// appended).
+static const std::string kTestCheckpointPath =
+    GetAbsoluteCodePath("test_data/test_tmp_dir/irls_checkpoint");
+
 class MockRegularizer : public super_resolution::Regularizer {
  public:
   // Handle super constructor, since we don't need the image_size_ field.
@@ -139,6 +154,22 @@ TEST(MapSolver, SmallDataTest) {
       ground_truth_matrix,
       kSolverResultErrorTolerance));
 
+  // The native solvers should find the same solution.
+  for (const auto least_squares_solver : {
+      super_resolution::NATIVE_CG_SOLVER,
+      super_resolution::NATIVE_LBFGS_SOLVER}) {
+    super_resolution::IRLSMapSolverOptions native_solver_options =
+        kDefaultSolverOptions;
+    native_solver_options.least_squares_solver = least_squares_solver;
+    super_resolution::IRLSMapSolver native_solver(
+        native_solver_options, image_model, low_res_images, kPrintSolverOutput);
+    const ImageData native_result = native_solver.Solve(initial_estimate);
+    EXPECT_TRUE(AreMatricesEqual(
+        native_result.GetChannelImage(0),
+        ground_truth_matrix,
+        kSolverResultErrorTolerance));
+  }
+
   /* Repeat the same tests, but this time with multiple channels. */
 
   // Simply replicate the channels for each image.
@@ -196,6 +227,74 @@ TEST(MapSolver, SmallDataTest) {
         ground_truth_matrix,
         kSolverResultErrorTolerance));
   }
+
+  // Solving the channel splits concurrently should give exactly the same
+  // results, assembled in the same channel order.
+  super_resolution::IRLSMapSolverOptions options_with_concurrent_split =
+      options_with_split;
+  options_with_concurrent_split.num_split_solver_workers = 2;
+  super_resolution::IRLSMapSolver solver_multichannel_concurrent_split(
+      options_with_concurrent_split,
+      image_model,
+      low_res_images_multichannel,
+      kPrintSolverOutput);
+  const ImageData result_multichannel_concurrent_split =
+      solver_multichannel_concurrent_split.Solve(
+          initial_estimate_multichannel);
+  EXPECT_TRUE(AreImagesEqual(
+      result_multichannel_concurrent_split, result_multichannel_split, 0.0));
+
+  // Solve in splits of multiple channels which overlap. The number of
+  // channels is not a multiple of the split size, so the last split is
+  // smaller. The overlapping channels should be discarded, so every channel
+  // appears in the result exactly once.
+  super_resolution::IRLSMapSolverOptions options_with_channel_blocks =
+      options_with_concurrent_split;
+  options_with_channel_blocks.num_channels_per_split = 4;
+  options_with_channel_blocks.num_split_overlap_channels = 1;
+  super_resolution::IRLSMapSolver solver_multichannel_blocks(
+      options_with_channel_blocks,
+      image_model,
+      low_res_images_multichannel,
+      kPrintSolverOutput);
+  const ImageData result_multichannel_blocks =
+      solver_multichannel_blocks.Solve(initial_estimate_multichannel);
+
+  EXPECT_EQ(result_multichannel_blocks.GetNumChannels(), num_channels);
+  for (int channel_index = 0; channel_index < num_channels; ++channel_index) {
+    EXPECT_TRUE(AreMatricesEqual(
+        result_multichannel_blocks.GetChannelImage(channel_index),
+        ground_truth_matrix,
+        kSolverResultErrorTolerance));
+  }
+
+  // Budget the splits by channel importance. The splits with full importance
+  // get the full budget and are solved as before, and the unimportant last
+  // channel keeps the initial estimate.
+  super_resolution::IRLSMapSolverOptions options_with_budgets =
+      options_with_concurrent_split;
+  options_with_budgets.channel_importances.assign(num_channels, 0.2);
+  options_with_budgets.channel_importances.back() = 0.001;
+  options_with_budgets.min_split_importance = 0.01;
+  super_resolution::IRLSMapSolver solver_multichannel_budgets(
+      options_with_budgets,
+      image_model,
+      low_res_images_multichannel,
+      kPrintSolverOutput);
+  const ImageData result_multichannel_budgets =
+      solver_multichannel_budgets.Solve(initial_estimate_multichannel);
+  EXPECT_EQ(result_multichannel_budgets.GetNumChannels(), num_channels);
+  for (int channel_index = 0; channel_index < num_channels - 1;
+       ++channel_index) {
+    EXPECT_TRUE(AreMatricesEqual(
+        result_multichannel_budgets.GetChannelImage(channel_index),
+        result_multichannel_split.GetChannelImage(channel_index),
+        0.0));
+  }
+  EXPECT_TRUE(AreMatricesEqual(
+      result_multichannel_budgets.GetChannelImage(num_channels - 1),
+      initial_estimate_matrix,
+      0.0));
 }
 
 // Tests on a small icon (real image) and compares the solver result to the
@@ -468,6 +567,43 @@ TEST(MapSolver, RegularizationTest) {
   EXPECT_GT(psnr_with_tv_regularization, psnr_without_regularization);
   EXPECT_GT(psnr_with_btv_regularization, psnr_with_tv_regularization);
 
+  // Computing the data term in single precision should give nearly the same
+  // quality as the default double precision.
+  super_resolution::IRLSMapSolverOptions options_with_single_precision =
+      kDefaultSolverOptions;
+  options_with_single_precision.use_single_precision = true;
+  super_resolution::IRLSMapSolver solver_with_single_precision(
+      options_with_single_precision,
+      image_model,
+      low_res_images,
+      kPrintSolverOutput);
+  solver_with_single_precision.AddRegularizer(tv_regularizer, 0.01);
+  const ImageData solver_result_with_single_precision =
+      solver_with_single_precision.Solve(initial_estimate);
+  const double psnr_with_single_precision =
+      psnr_evaluator.Evaluate(solver_result_with_single_precision);
+  EXPECT_NEAR(psnr_with_single_precision, psnr_with_tv_regularization, 0.1);
+
+  // Mixed precision refines the single precision solves in double precision
+  // and returns an estimate of the same size.
+  super_resolution::IRLSMapSolverOptions options_with_mixed_precision =
+      kDefaultSolverOptions;
+  options_with_mixed_precision.use_mixed_precision = true;
+  super_resolution::IRLSMapSolver solver_with_mixed_precision(
+      options_with_mixed_precision,
+      image_model,
+      low_res_images,
+      kPrintSolverOutput);
+  solver_with_mixed_precision.AddRegularizer(tv_regularizer, 0.01);
+  const ImageData solver_result_with_mixed_precision =
+      solver_with_mixed_precision.Solve(initial_estimate);
+  EXPECT_EQ(
+      solver_result_with_mixed_precision.GetImageSize(),
+      solver_result_with_tv_regularization.GetImageSize());
+  EXPECT_EQ(
+      solver_result_with_mixed_precision.GetNumChannels(),
+      solver_result_with_tv_regularization.GetNumChannels());
+
   if (kDisplaySolverResults) {
     super_resolution::util::DisplayImagesSideBySide({
         ground_truth,
@@ -479,3 +615,581 @@ TEST(MapSolver, RegularizationTest) {
         "Ground Truth, Upsampled, Unregualrzed, TV, TV Split, BTV");
   }
 }
+
+// Verifies that a solve which is resumed from its checkpoints continues where
+// it stopped, and gives the same result as a solve that was never stopped.
+TEST(MapSolver, CheckpointTest) {
+  const cv::Mat image = cv::imread(kTestIconPath, CV_LOAD_IMAGE_COLOR);
+  ImageData ground_truth(image);
+  ground_truth.ResizeImage(cv::Size(16, 16));
+  const cv::Size image_size = ground_truth.GetImageSize();
+
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(0, 1),
+    super_resolution::MotionShift(1, 0),
+    super_resolution::MotionShift(1, 1)
+  });
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  std::vector<ImageData> low_res_images;
+  for (int i = 0; i < 4; ++i) {
+    low_res_images.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+  ImageData initial_estimate = low_res_images[0];
+  initial_estimate.ResizeImage(2, super_resolution::INTERPOLATE_LINEAR);
+  const std::shared_ptr<super_resolution::Regularizer> tv_regularizer(
+      new super_resolution::TotalVariationRegularizer(image_size));
+
+  // Every channel is its own split, so each has its own checkpoint.
+  super_resolution::IRLSMapSolverOptions solver_options =
+      kDefaultSolverOptions;
+  solver_options.least_squares_solver = super_resolution::NATIVE_CG_SOLVER;
+  solver_options.split_channels = true;
+  solver_options.max_num_irls_iterations = 4;
+  const auto solve = [&](
+      const super_resolution::IRLSMapSolverOptions& options) {
+    super_resolution::IRLSMapSolver solver(
+        options, image_model, low_res_images, kPrintSolverOutput);
+    solver.AddRegularizer(tv_regularizer, 0.01);
+    return solver.Solve(initial_estimate);
+  };
+  const int num_channels = initial_estimate.GetNumChannels();
+  const auto remove_checkpoints = [num_channels]() {
+    for (int i = 0; i < num_channels; ++i) {
+      std::remove(super_resolution::GetIRLSCheckpointPath(
+          kTestCheckpointPath, i).c_str());
+    }
+  };
+  const ImageData uninterrupted_result = solve(solver_options);
+
+  // Stop after two IRLS iterations, then resume with the full limit.
+  remove_checkpoints();
+  super_resolution::IRLSMapSolverOptions checkpoint_options = solver_options;
+  checkpoint_options.checkpoint_path = kTestCheckpointPath;
+  checkpoint_options.max_num_irls_iterations = 2;
+  solve(checkpoint_options);
+  super_resolution::IRLSCheckpoint checkpoint;
+  ASSERT_TRUE(super_resolution::ReadIRLSCheckpoint(
+      super_resolution::GetIRLSCheckpointPath(kTestCheckpointPath, 0),
+      &checkpoint));
+  EXPECT_EQ(checkpoint.channel_start, 0);
+  EXPECT_EQ(checkpoint.channel_end, 1);
+  EXPECT_LE(checkpoint.num_completed_iterations, 2);
+  EXPECT_EQ(checkpoint.estimate.size(), initial_estimate.GetNumPixels());
+  EXPECT_EQ(checkpoint.irls_weights.size(), 1);
+
+  checkpoint_options.max_num_irls_iterations = 4;
+  const ImageData resumed_result = solve(checkpoint_options);
+  EXPECT_TRUE(AreImagesEqual(resumed_result, uninterrupted_result, 1.0e-9));
+
+  // A different initial estimate is a different problem, so its solve must
+  // not resume from the checkpoints.
+  ImageData other_initial_estimate = initial_estimate;
+  other_initial_estimate.GetChannelImage(0) *= 0.5;
+  super_resolution::IRLSMapSolver other_solver(
+      checkpoint_options, image_model, low_res_images, kPrintSolverOutput);
+  other_solver.AddRegularizer(tv_regularizer, 0.01);
+  super_resolution::IRLSMapSolver reference_solver(
+      solver_options, image_model, low_res_images, kPrintSolverOutput);
+  reference_solver.AddRegularizer(tv_regularizer, 0.01);
+  EXPECT_TRUE(AreImagesEqual(
+      other_solver.Solve(other_initial_estimate),
+      reference_solver.Solve(other_initial_estimate),
+      1.0e-9));
+
+  // So is a different regularization parameter.
+  solve(checkpoint_options);
+  super_resolution::IRLSMapSolver stronger_solver(
+      checkpoint_options, image_model, low_res_images, kPrintSolverOutput);
+  stronger_solver.AddRegularizer(tv_regularizer, 0.02);
+  super_resolution::IRLSMapSolver stronger_reference_solver(
+      solver_options, image_model, low_res_images, kPrintSolverOutput);
+  stronger_reference_solver.AddRegularizer(tv_regularizer, 0.02);
+  EXPECT_TRUE(AreImagesEqual(
+      stronger_solver.Solve(initial_estimate),
+      stronger_reference_solver.Solve(initial_estimate),
+      1.0e-9));
+  remove_checkpoints();
+}
+
+// Verifies that a resumed solve skips the continuation stages, which ran
+// before its checkpoint was saved, and still gives the uninterrupted result.
+TEST(MapSolver, CheckpointSkipsContinuation) {
+  const cv::Mat image = cv::imread(kTestIconPath, CV_LOAD_IMAGE_GRAYSCALE);
+  ImageData ground_truth(image);
+  ground_truth.ResizeImage(cv::Size(16, 16));
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  const std::vector<ImageData> low_res_images = {
+    image_model.ApplyToImage(ground_truth, 0)
+  };
+  ImageData initial_estimate = low_res_images[0];
+  initial_estimate.ResizeImage(2, super_resolution::INTERPOLATE_LINEAR);
+  const std::shared_ptr<super_resolution::Regularizer> tv_regularizer(
+      new super_resolution::TotalVariationRegularizer(
+          ground_truth.GetImageSize()));
+
+  super_resolution::IRLSMapSolverOptions solver_options =
+      kDefaultSolverOptions;
+  solver_options.least_squares_solver = super_resolution::NATIVE_CG_SOLVER;
+  solver_options.max_num_irls_iterations = 3;
+  solver_options.continuation_parameter_scales = {10.0};
+  solver_options.continuation_iterations_per_stage = 1;
+  const auto solve = [&](
+      const super_resolution::IRLSMapSolverOptions& options,
+      const std::shared_ptr<super_resolution::SolverTelemetry>& telemetry) {
+    super_resolution::IRLSMapSolver solver(
+        options, image_model, low_res_images, kPrintSolverOutput);
+    solver.AddRegularizer(tv_regularizer, 0.01);
+    solver.SetTelemetry(telemetry);
+    return solver.Solve(initial_estimate);
+  };
+  const std::string checkpoint_path =
+      super_resolution::GetIRLSCheckpointPath(kTestCheckpointPath, 0);
+  std::remove(checkpoint_path.c_str());
+  const ImageData uninterrupted_result = solve(solver_options, nullptr);
+
+  // Stop after two IRLS iterations of the final stage, then resume.
+  super_resolution::IRLSMapSolverOptions checkpoint_options = solver_options;
+  checkpoint_options.checkpoint_path = kTestCheckpointPath;
+  checkpoint_options.max_num_irls_iterations = 2;
+  const std::shared_ptr<super_resolution::SolverTelemetry> telemetry =
+      std::make_shared<super_resolution::SolverTelemetry>();
+  solve(checkpoint_options, telemetry);
+  EXPECT_EQ(telemetry->GetSolves().size(), 2);
+
+  checkpoint_options.max_num_irls_iterations = 3;
+  const std::shared_ptr<super_resolution::SolverTelemetry> resume_telemetry =
+      std::make_shared<super_resolution::SolverTelemetry>();
+  const ImageData resumed_result =
+      solve(checkpoint_options, resume_telemetry);
+  EXPECT_EQ(resume_telemetry->GetSolves().size(), 1);
+  EXPECT_TRUE(AreImagesEqual(resumed_result, uninterrupted_result, 1.0e-9));
+  std::remove(checkpoint_path.c_str());
+}
+
+// Verifies that the IRLS loop stops once the quality metric plateaus.
+TEST(MapSolver, QualityStoppingRule) {
+  const cv::Mat image = cv::imread(kTestIconPath, CV_LOAD_IMAGE_GRAYSCALE);
+  ImageData ground_truth(image);
+  ground_truth.ResizeImage(cv::Size(16, 16));
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  const std::vector<ImageData> low_res_images = {
+    image_model.ApplyToImage(ground_truth, 0)
+  };
+  ImageData initial_estimate = low_res_images[0];
+  initial_estimate.ResizeImage(2, super_resolution::INTERPOLATE_LINEAR);
+
+  // The cost threshold never stops the loop, so only the iteration limit or
+  // the quality metric does. The metric never improves after its first
+  // evaluation.
+  super_resolution::IRLSMapSolverOptions solver_options =
+      kDefaultSolverOptions;
+  solver_options.irls_cost_difference_threshold = 0.0;
+  solver_options.max_num_irls_iterations = 10;
+  std::atomic<int> num_metric_evaluations(0);
+  solver_options.quality_metric = [&num_metric_evaluations](
+      const double* estimate_data,
+      const int channel_start,
+      const int channel_end) {
+    EXPECT_EQ(channel_start, 0);
+    EXPECT_EQ(channel_end, 1);
+    num_metric_evaluations++;
+    return 30.0;
+  };
+  solver_options.quality_evaluation_interval = 2;
+  solver_options.min_quality_improvement = 0.1;
+
+  super_resolution::IRLSMapSolver solver(
+      solver_options, image_model, low_res_images, kPrintSolverOutput);
+  solver.AddRegularizer(
+      std::shared_ptr<super_resolution::Regularizer>(
+          new super_resolution::TotalVariationRegularizer(
+              initial_estimate.GetImageSize())),
+      0.01);
+  solver.Solve(initial_estimate);
+  // Evaluated after iterations 2 and 4, and stopped at the second.
+  EXPECT_EQ(num_metric_evaluations, 2);
+}
+
+// Verifies that the IRLS solver streams its estimates while solving.
+TEST(MapSolver, ProgressiveResults) {
+  const cv::Mat image = cv::imread(kTestIconPath, CV_LOAD_IMAGE_GRAYSCALE);
+  ImageData ground_truth(image);
+  ground_truth.ResizeImage(cv::Size(16, 16));
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  const std::vector<ImageData> low_res_images = {
+    image_model.ApplyToImage(ground_truth, 0)
+  };
+  ImageData initial_estimate = low_res_images[0];
+  initial_estimate.ResizeImage(2, super_resolution::INTERPOLATE_LINEAR);
+
+  // The callback runs on the background thread, but only one snapshot at a
+  // time.
+  std::vector<int> snapshot_iterations;
+  super_resolution::IRLSMapSolverOptions solver_options =
+      kDefaultSolverOptions;
+  solver_options.max_num_irls_iterations = 3;
+  solver_options.progressive_results.reset(
+      new super_resolution::ProgressiveResults(
+          1,
+          0.0,
+          [&](const ImageData& estimate,
+              const super_resolution::ProgressiveSnapshot& snapshot) {
+            EXPECT_EQ(estimate.GetImageSize(), initial_estimate.GetImageSize());
+            EXPECT_EQ(estimate.GetNumChannels(), 1);
+            EXPECT_EQ(snapshot.index, snapshot_iterations.size());
+            snapshot_iterations.push_back(snapshot.num_iterations);
+          }));
+
+  super_resolution::IRLSMapSolver solver(
+      solver_options, image_model, low_res_images, kPrintSolverOutput);
+  solver.AddRegularizer(
+      std::shared_ptr<super_resolution::Regularizer>(
+          new super_resolution::TotalVariationRegularizer(
+              initial_estimate.GetImageSize())),
+      0.01);
+  solver.Solve(initial_estimate);
+
+  // Solve() finished the stream, so every snapshot was delivered. Snapshots
+  // may be skipped, but they arrive in order.
+  ASSERT_FALSE(snapshot_iterations.empty());
+  for (int i = 1; i < snapshot_iterations.size(); ++i) {
+    EXPECT_GT(snapshot_iterations[i], snapshot_iterations[i - 1]);
+  }
+  EXPECT_EQ(
+      solver_options.progressive_results->GetNumDeliveredSnapshots(),
+      snapshot_iterations.size());
+}
+
+// Verifies that an expired deadline keeps the initial estimate, and that a
+// generous one does not change the result but records the solver stages.
+TEST(MapSolver, Deadline) {
+  const cv::Mat image = cv::imread(kTestIconPath, CV_LOAD_IMAGE_GRAYSCALE);
+  ImageData ground_truth(image);
+  ground_truth.ResizeImage(cv::Size(16, 16));
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  const std::vector<ImageData> low_res_images = {
+    image_model.ApplyToImage(ground_truth, 0)
+  };
+  ImageData initial_estimate = low_res_images[0];
+  initial_estimate.ResizeImage(2, super_resolution::INTERPOLATE_LINEAR);
+
+  const auto solve = [&](const std::shared_ptr<SolverDeadline>& deadline) {
+    super_resolution::IRLSMapSolverOptions solver_options =
+        kDefaultSolverOptions;
+    solver_options.max_num_irls_iterations = 3;
+    solver_options.deadline = deadline;
+    super_resolution::IRLSMapSolver solver(
+        solver_options, image_model, low_res_images, kPrintSolverOutput);
+    solver.AddRegularizer(
+        std::shared_ptr<super_resolution::Regularizer>(
+            new super_resolution::TotalVariationRegularizer(
+                initial_estimate.GetImageSize())),
+        0.01);
+    return solver.Solve(initial_estimate);
+  };
+
+  const ImageData expected_result = solve(nullptr);
+  const std::shared_ptr<SolverDeadline> generous_deadline(
+      new SolverDeadline(1000.0));
+  const ImageData result = solve(generous_deadline);
+  for (int pixel = 0; pixel < result.GetNumPixels(); ++pixel) {
+    EXPECT_DOUBLE_EQ(
+        result.GetPixelValue(0, pixel),
+        expected_result.GetPixelValue(0, pixel));
+  }
+  std::vector<std::string> stage_names;
+  for (const auto& stage : generous_deadline->GetStages()) {
+    stage_names.push_back(stage.name);
+  }
+  EXPECT_THAT(stage_names, Contains("least squares solve"));
+  EXPECT_THAT(stage_names, Contains("IRLS reweighting"));
+
+  const ImageData out_of_time_result =
+      solve(std::shared_ptr<SolverDeadline>(new SolverDeadline(0.0)));
+  for (int pixel = 0; pixel < result.GetNumPixels(); ++pixel) {
+    EXPECT_EQ(
+        out_of_time_result.GetPixelValue(0, pixel),
+        initial_estimate.GetPixelValue(0, pixel));
+  }
+}
+
+// Verifies that the continuation stages run before the final stage, which is
+// the only one that the quality metric sees.
+TEST(MapSolver, ContinuationTest) {
+  const cv::Mat image = cv::imread(kTestIconPath, CV_LOAD_IMAGE_GRAYSCALE);
+  ImageData ground_truth(image);
+  ground_truth.ResizeImage(cv::Size(16, 16));
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  const std::vector<ImageData> low_res_images = {
+    image_model.ApplyToImage(ground_truth, 0)
+  };
+  ImageData initial_estimate = low_res_images[0];
+  initial_estimate.ResizeImage(2, super_resolution::INTERPOLATE_LINEAR);
+
+  std::atomic<int> num_metric_evaluations(0);
+  const auto solve = [&](const std::vector<double>& parameter_scales) {
+    super_resolution::IRLSMapSolverOptions solver_options =
+        kDefaultSolverOptions;
+    solver_options.irls_cost_difference_threshold = 0.0;
+    solver_options.max_num_irls_iterations = 3;
+    solver_options.continuation_parameter_scales = parameter_scales;
+    solver_options.continuation_iterations_per_stage = 2;
+    solver_options.quality_metric = [&num_metric_evaluations](
+        const double* estimate_data,
+        const int channel_start,
+        const int channel_end) {
+      num_metric_evaluations++;
+      return static_cast<double>(num_metric_evaluations);
+    };
+    super_resolution::IRLSMapSolver solver(
+        solver_options, image_model, low_res_images, kPrintSolverOutput);
+    solver.AddRegularizer(
+        std::shared_ptr<super_resolution::Regularizer>(
+            new super_resolution::TotalVariationRegularizer(
+                initial_estimate.GetImageSize())),
+        0.01);
+    return solver.Solve(initial_estimate);
+  };
+
+  const ImageData cold_result = solve({});
+  EXPECT_EQ(num_metric_evaluations, 3);
+  num_metric_evaluations = 0;
+  const ImageData continuation_result = solve({100.0, 10.0});
+  EXPECT_EQ(num_metric_evaluations, 3);
+
+  // The final stage started from the result of the stronger regularization.
+  EXPECT_FALSE(AreImagesEqual(cold_result, continuation_result, 1.0e-9));
+}
+
+// Verifies that the active-set mode solves exactly as usual while every tile
+// is active, and stops once all tiles are frozen.
+TEST(MapSolver, ActiveSet) {
+  const cv::Mat image = cv::imread(kTestIconPath, CV_LOAD_IMAGE_GRAYSCALE);
+  ImageData ground_truth(image);
+  ground_truth.ResizeImage(cv::Size(16, 16));
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  const std::vector<ImageData> low_res_images = {
+    image_model.ApplyToImage(ground_truth, 0)
+  };
+  ImageData initial_estimate = low_res_images[0];
+  initial_estimate.ResizeImage(2, super_resolution::INTERPOLATE_LINEAR);
+
+  const auto solve = [&](
+      const int max_num_irls_iterations,
+      const int active_set_tile_size,
+      const double active_set_change_threshold) {
+    super_resolution::IRLSMapSolverOptions solver_options =
+        kDefaultSolverOptions;
+    solver_options.least_squares_solver = super_resolution::NATIVE_CG_SOLVER;
+    solver_options.irls_cost_difference_threshold = 0.0;
+    solver_options.max_num_irls_iterations = max_num_irls_iterations;
+    solver_options.active_set_tile_size = active_set_tile_size;
+    solver_options.active_set_change_threshold = active_set_change_threshold;
+    super_resolution::IRLSMapSolver solver(
+        solver_options, image_model, low_res_images, kPrintSolverOutput);
+    solver.AddRegularizer(
+        std::shared_ptr<super_resolution::Regularizer>(
+            new super_resolution::TotalVariationRegularizer(
+                initial_estimate.GetImageSize())),
+        0.01);
+    return solver.Solve(initial_estimate);
+  };
+
+  // With a zero threshold, every tile counts as changing.
+  const ImageData result = solve(4, 0, 0.0);
+  EXPECT_TRUE(AreImagesEqual(solve(4, 5, 0.0), result, 1.0e-12));
+
+  // No pixel changes by this much, so all tiles are frozen after the first
+  // iteration.
+  EXPECT_TRUE(AreImagesEqual(solve(4, 5, 1.0e6), solve(1, 0, 0.0), 1.0e-12));
+}
+
+// Verifies that solvers created from the same shared inputs use one copy of
+// the observations, and that the image model is only compiled once for them.
+TEST(MapSolver, SharedSolverInputs) {
+  const cv::Mat image = cv::imread(kTestIconPath, CV_LOAD_IMAGE_GRAYSCALE);
+  ImageData ground_truth(image);
+  ground_truth.ResizeImage(cv::Size(16, 16));
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  const std::shared_ptr<const super_resolution::SharedSolverInputs> inputs =
+      std::make_shared<const super_resolution::SharedSolverInputs>(
+          std::vector<ImageData>({image_model.ApplyToImage(ground_truth, 0)}));
+
+  const super_resolution::IRLSMapSolver first_solver(
+      kDefaultSolverOptions, image_model, inputs, kPrintSolverOutput);
+  const super_resolution::IRLSMapSolver second_solver(
+      kDefaultSolverOptions, image_model, inputs, kPrintSolverOutput);
+  EXPECT_EQ(first_solver.GetSharedInputs(), second_solver.GetSharedInputs());
+  EXPECT_EQ(&first_solver.GetObservations(), &inputs->GetObservations());
+  EXPECT_EQ(&second_solver.GetObservations(), &inputs->GetObservations());
+  EXPECT_EQ(first_solver.GetNumImages(), 1);
+
+  const auto compiled_image_model = inputs->GetCompiledImageModel(
+      image_model, cv::Size(16, 16), false);
+  EXPECT_EQ(
+      inputs->GetCompiledImageModel(image_model, cv::Size(16, 16), false),
+      compiled_image_model);
+}
+
+// Verifies that a solver continues from its last solve after an observation
+// is added, and that the added frame is used: three frames of the small data
+// test do not determine the HR image, but all four frames do.
+TEST(MapSolver, AddObservation) {
+  const std::vector<cv::Mat> lr_image_matrices = {
+    cv::Mat(2, 2, CV_64FC1, cv::Scalar(0.4)),
+    cv::Mat(2, 2, CV_64FC1, cv::Scalar(0.2)),
+    cv::Mat(2, 2, CV_64FC1, cv::Scalar(0.0)),
+    cv::Mat(2, 2, CV_64FC1, cv::Scalar(1.0))
+  };
+  const std::vector<super_resolution::MotionShift> motion_shifts = {
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(-1, 0),
+    super_resolution::MotionShift(0, -1),
+    super_resolution::MotionShift(-1, -1)
+  };
+  const cv::Mat ground_truth_matrix = (cv::Mat_<double>(4, 4)
+    << 0.4, 0.2, 0.4, 0.2,
+       0.0, 1.0, 0.0, 1.0,
+       0.4, 0.2, 0.4, 0.2,
+       0.0, 1.0, 0.0, 1.0);
+
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence(
+      {motion_shifts[0], motion_shifts[1], motion_shifts[2]});
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  std::vector<ImageData> low_res_images;
+  for (int i = 0; i < 3; ++i) {
+    low_res_images.push_back(ImageData(lr_image_matrices[i]));
+  }
+
+  super_resolution::IRLSMapSolverOptions solver_options = kDefaultSolverOptions;
+  solver_options.use_compiled_image_model = true;
+  solver_options.keep_solver_state = true;
+  super_resolution::IRLSMapSolver solver(
+      solver_options, image_model, low_res_images, kPrintSolverOutput);
+  const ImageData initial_estimate(cv::Mat(4, 4, CV_64FC1, cv::Scalar(0.0)));
+  const ImageData three_frame_result = solver.Solve(initial_estimate);
+  EXPECT_FALSE(AreMatricesEqual(
+      three_frame_result.GetChannelImage(0),
+      ground_truth_matrix,
+      kSolverResultErrorTolerance));
+
+  // The inputs that the solver was created with keep their observations.
+  const std::shared_ptr<const super_resolution::SharedSolverInputs>
+      three_frame_inputs = solver.GetSharedInputs();
+  solver.AddObservation(ImageData(lr_image_matrices[3]), motion_shifts[3]);
+  EXPECT_EQ(solver.GetNumImages(), 4);
+  EXPECT_EQ(three_frame_inputs->GetObservations().size(), 3);
+
+  const ImageData four_frame_result = solver.ContinueSolve(0);
+  EXPECT_TRUE(AreMatricesEqual(
+      four_frame_result.GetChannelImage(0),
+      ground_truth_matrix,
+      kSolverResultErrorTolerance));
+}
+
+// Verifies the analytical gradient of the MAP objective (the data term and a
+// TV regularization term) against colored numerical differentiation, which
+// is fast enough for images well beyond the size that differentiating one
+// pixel at a time allows.
+TEST(MapSolver, ColoredNumericalGradient) {
+  const cv::Mat image = cv::imread(kTestIconPath, CV_LOAD_IMAGE_GRAYSCALE);
+  ImageData ground_truth(image);
+  ground_truth.ResizeImage(cv::Size(64, 64));
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  const std::vector<ImageData> low_res_images = {
+    image_model.ApplyToImage(ground_truth, 0)
+  };
+  ImageData estimate = low_res_images[0];
+  estimate.ResizeImage(2, super_resolution::INTERPOLATE_LINEAR);
+  const cv::Size image_size = estimate.GetImageSize();
+  const int num_parameters = estimate.GetNumPixels();
+
+  const std::vector<double> irls_weights(num_parameters, 0.5);
+  super_resolution::ObjectiveFunction objective_function(num_parameters);
+  objective_function.AddTerm(
+      std::shared_ptr<super_resolution::ObjectiveTerm>(
+          new super_resolution::ObjectiveDataTerm(
+              image_model, low_res_images, 0, 1, image_size)));
+  objective_function.AddTerm(
+      std::shared_ptr<super_resolution::ObjectiveTerm>(
+          new super_resolution::ObjectiveIRLSRegularizationTerm(
+              std::shared_ptr<super_resolution::Regularizer>(
+                  new super_resolution::TotalVariationRegularizer(
+                      image_size)),
+              0.01,
+              irls_weights,
+              1,
+              image_size)));
+
+  std::vector<double> gradient(num_parameters);
+  objective_function.ComputeAllTerms(
+      estimate.GetChannelData(0), gradient.data());
+
+  // Each LR residual depends on the HR pixels within the downsampling scale
+  // and the blur radius of the top left corner of its LR pixel.
+  super_resolution::ColoredDifferentiationOptions options;
+  options.spatial_radius =
+      model_parameters.scale + model_parameters.blur_radius;
+  options.num_threads = 0;
+  std::vector<double> numerical_gradient;
+  EXPECT_TRUE(super_resolution::ComputeColoredNumericalGradient(
+      objective_function,
+      estimate.GetChannelData(0),
+      image_size,
+      1,
+      options,
+      &numerical_gradient));
+  ASSERT_EQ(numerical_gradient.size(), num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    EXPECT_NEAR(numerical_gradient[i], gradient[i], 1e-5);
+  }
+}
@@ -0,0 +1,152 @@
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "util/memory_accounting.h"
+#include "util/thread_pool.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::util::GetBufferBytes;
+using super_resolution::util::GetCurrentMemoryTag;
+using super_resolution::util::GetMemoryReport;
+using super_resolution::util::GetMemoryUsage;
+using super_resolution::util::GetTotalMemoryUsage;
+using super_resolution::util::MEMORY_TAG_ESTIMATE;
+using super_resolution::util::MEMORY_TAG_GRADIENTS;
+using super_resolution::util::MEMORY_TAG_OTHER;
+using super_resolution::util::MEMORY_TAG_PCA;
+using super_resolution::util::MemoryAccount;
+using super_resolution::util::MemoryTag;
+using super_resolution::util::MemoryUsage;
+using super_resolution::util::ResetMemoryPeaks;
+using super_resolution::util::ScopedMemoryTag;
+using super_resolution::util::SetMaxNumThreads;
+using super_resolution::util::ThreadPool;
+using testing::Contains;
+using testing::Each;
+using testing::HasSubstr;
+using testing::Ne;
+
+// Verifies that accounts record their bytes while they exist, across threads,
+// and that the peaks are kept until they are reset.
+TEST(MemoryAccounting, MemoryAccount) {
+  ResetMemoryPeaks();
+  const MemoryUsage initial_usage = GetMemoryUsage(MEMORY_TAG_GRADIENTS);
+  const int64_t initial_total_bytes = GetTotalMemoryUsage().current_bytes;
+  {
+    MemoryAccount account(MEMORY_TAG_GRADIENTS);
+    account.SetBytes(1000);
+    account.SetBytes(400);
+    EXPECT_EQ(account.GetNumBytes(), 400);
+    MemoryUsage usage = GetMemoryUsage(MEMORY_TAG_GRADIENTS);
+    EXPECT_EQ(usage.current_bytes, initial_usage.current_bytes + 400);
+    EXPECT_GE(usage.peak_bytes, initial_usage.current_bytes + 1000);
+    EXPECT_EQ(usage.num_allocations, initial_usage.num_allocations + 1);
+
+    ThreadPool thread_pool(4);
+    thread_pool.ParallelFor(100, [](const int task_index) {
+      MemoryAccount task_account(MEMORY_TAG_GRADIENTS);
+      task_account.SetBytes(10);
+    });
+    EXPECT_EQ(GetMemoryUsage(MEMORY_TAG_GRADIENTS).current_bytes,
+              initial_usage.current_bytes + 400);
+
+    // Moving an account moves its bytes.
+    MemoryAccount moved_account(std::move(account));
+    EXPECT_EQ(moved_account.GetNumBytes(), 400);
+    EXPECT_EQ(GetTotalMemoryUsage().current_bytes, initial_total_bytes + 400);
+
+    // Changing the tag moves the bytes to the new tag.
+    const int64_t initial_pca_bytes =
+        GetMemoryUsage(MEMORY_TAG_PCA).current_bytes;
+    moved_account.Set(MEMORY_TAG_PCA, 500);
+    EXPECT_EQ(GetMemoryUsage(MEMORY_TAG_GRADIENTS).current_bytes,
+              initial_usage.current_bytes);
+    EXPECT_EQ(GetMemoryUsage(MEMORY_TAG_PCA).current_bytes,
+              initial_pca_bytes + 500);
+
+    // Moving the bytes back only changes the tags, not the total or its peak.
+    ResetMemoryPeaks();
+    const MemoryUsage total_usage = GetTotalMemoryUsage();
+    moved_account.Set(MEMORY_TAG_GRADIENTS, 500);
+    EXPECT_EQ(GetMemoryUsage(MEMORY_TAG_PCA).current_bytes, initial_pca_bytes);
+    EXPECT_EQ(GetMemoryUsage(MEMORY_TAG_GRADIENTS).current_bytes,
+              initial_usage.current_bytes + 500);
+    EXPECT_EQ(GetTotalMemoryUsage().current_bytes, total_usage.current_bytes);
+    EXPECT_EQ(GetTotalMemoryUsage().peak_bytes, total_usage.peak_bytes);
+    EXPECT_EQ(GetTotalMemoryUsage().num_allocations,
+              total_usage.num_allocations);
+  }
+  EXPECT_EQ(GetTotalMemoryUsage().current_bytes, initial_total_bytes);
+
+  ResetMemoryPeaks();
+  EXPECT_EQ(GetMemoryUsage(MEMORY_TAG_GRADIENTS).peak_bytes,
+            GetMemoryUsage(MEMORY_TAG_GRADIENTS).current_bytes);
+}
+
+TEST(MemoryAccounting, GetBufferBytes) {
+  std::vector<double> buffer;
+  buffer.reserve(100);
+  buffer.resize(10);
+  EXPECT_EQ(GetBufferBytes(buffer), 800);
+  EXPECT_EQ(GetBufferBytes(std::vector<float>()), 0);
+}
+
+TEST(MemoryAccounting, ScopedMemoryTag) {
+  EXPECT_EQ(GetCurrentMemoryTag(), MEMORY_TAG_OTHER);
+  {
+    const ScopedMemoryTag outer_tag(MEMORY_TAG_ESTIMATE);
+    EXPECT_EQ(GetCurrentMemoryTag(), MEMORY_TAG_ESTIMATE);
+    {
+      const ScopedMemoryTag inner_tag(MEMORY_TAG_PCA);
+      EXPECT_EQ(GetCurrentMemoryTag(), MEMORY_TAG_PCA);
+    }
+    EXPECT_EQ(GetCurrentMemoryTag(), MEMORY_TAG_ESTIMATE);
+
+  }
+  EXPECT_EQ(GetCurrentMemoryTag(), MEMORY_TAG_OTHER);
+}
+
+// Verifies that the tasks of a parallel loop run with the tag of the caller,
+// also on the worker threads, and that the workers do not keep it.
+TEST(MemoryAccounting, ScopedMemoryTagInParallelFor) {
+  SetMaxNumThreads(4);
+  ThreadPool thread_pool(4);
+  const int num_tasks = 100;
+  std::vector<MemoryTag> task_tags(num_tasks, MEMORY_TAG_OTHER);
+  std::vector<std::thread::id> task_threads(num_tasks);
+  {
+    const ScopedMemoryTag memory_tag(MEMORY_TAG_ESTIMATE);
+    thread_pool.ParallelFor(num_tasks, [&](const int task_index) {
+      task_tags[task_index] = GetCurrentMemoryTag();
+      task_threads[task_index] = std::this_thread::get_id();
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    });
+  }
+  EXPECT_THAT(task_tags, Each(MEMORY_TAG_ESTIMATE));
+  EXPECT_THAT(task_threads, Contains(Ne(std::this_thread::get_id())));
+
+  thread_pool.ParallelFor(num_tasks, [&](const int task_index) {
+    task_tags[task_index] = GetCurrentMemoryTag();
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  });
+  EXPECT_THAT(task_tags, Each(MEMORY_TAG_OTHER));
+
+  // Restore the default of one thread per hardware thread.
+  SetMaxNumThreads(0);
+}
+
+TEST(MemoryAccounting, GetMemoryReport) {
+  MemoryAccount account(MEMORY_TAG_ESTIMATE);
+  account.SetBytes(3 * 1024 * 1024);
+  const std::string report = GetMemoryReport();
+  EXPECT_THAT(report, HasSubstr("Memory by subsystem"));
+  EXPECT_THAT(report, HasSubstr("estimate"));
+  EXPECT_THAT(report, HasSubstr("3.000"));
+  EXPECT_THAT(report, HasSubstr("total"));
+}
@@ -0,0 +1,163 @@
+#include "image_model/image_model.h"
+#include "optimization/map_solver.h"
+#include "optimization/memory_planner.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageModelParameters;
+using super_resolution::MapSolverOptions;
+using super_resolution::SolverMemoryEstimate;
+using super_resolution::SolverMemoryPlan;
+using super_resolution::SolverMemoryProblem;
+
+constexpr double kBytesPerMegabyte = 1024.0 * 1024.0;
+
+// A 512x512 HR image with 8 channels and 4 frames at scale 2.
+SolverMemoryProblem GetTestProblem() {
+  SolverMemoryProblem problem;
+  problem.high_res_size = cv::Size(512, 512);
+  problem.num_channels = 8;
+  problem.num_observations = 4;
+  return problem;
+}
+
+// Verifies that the estimate grows with the problem size and shrinks with
+// channel splits and single precision.
+TEST(MemoryPlanner, EstimateSolverMemory) {
+  ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  const MapSolverOptions solver_options;
+  const SolverMemoryProblem problem = GetTestProblem();
+
+  const SolverMemoryEstimate estimate = super_resolution::EstimateSolverMemory(
+      model_parameters, solver_options, problem);
+  // The observations, the initial estimate and the result.
+  EXPECT_DOUBLE_EQ(estimate.image_bytes, 8.0 * 512 * 512 * 8 * 3);
+  // At least the solver buffers of all channels.
+  EXPECT_GE(estimate.solver_bytes,
+            8.0 * super_resolution::kNumSolverImageBuffers * 512 * 512 * 8);
+  EXPECT_EQ(estimate.compiled_model_bytes, 0.0);
+  EXPECT_EQ(estimate.num_concurrent_solves, 1);
+
+  SolverMemoryProblem more_frames_problem = problem;
+  more_frames_problem.num_observations = 16;
+  EXPECT_GT(super_resolution::EstimateSolverMemory(
+                model_parameters, solver_options, more_frames_problem)
+                .GetTotalBytes(),
+            estimate.GetTotalBytes());
+
+  MapSolverOptions split_options = solver_options;
+  split_options.split_channels = true;
+  split_options.num_channels_per_split = 2;
+  EXPECT_LT(super_resolution::EstimateSolverMemory(
+                model_parameters, split_options, problem).solver_bytes,
+            estimate.solver_bytes / 2);
+  // Concurrent splits need their own solvers.
+  split_options.num_split_solver_workers = 4;
+  const SolverMemoryEstimate concurrent_estimate =
+      super_resolution::EstimateSolverMemory(
+          model_parameters, split_options, problem);
+  EXPECT_EQ(concurrent_estimate.num_concurrent_solves, 4);
+
+  MapSolverOptions single_precision_options = solver_options;
+  single_precision_options.use_single_precision = true;
+  EXPECT_LT(super_resolution::EstimateSolverMemory(
+                model_parameters, single_precision_options, problem)
+                .solver_bytes,
+            estimate.solver_bytes);
+
+  MapSolverOptions compiled_options = solver_options;
+  compiled_options.use_compiled_image_model = true;
+  EXPECT_GT(super_resolution::EstimateSolverMemory(
+                model_parameters, compiled_options, problem)
+                .compiled_model_bytes,
+            0.0);
+}
+
+// Verifies that the planner keeps a layout that fits, and otherwise splits
+// channels before it tiles the image.
+TEST(MemoryPlanner, PlanSolverMemory) {
+  ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  const MapSolverOptions solver_options;
+  const SolverMemoryProblem problem = GetTestProblem();
+  const double full_bytes = super_resolution::EstimateSolverMemory(
+      model_parameters, solver_options, problem).GetTotalBytes();
+
+  const SolverMemoryPlan unchanged_plan = super_resolution::PlanSolverMemory(
+      model_parameters, solver_options, problem, full_bytes);
+  EXPECT_TRUE(unchanged_plan.fits_budget);
+  EXPECT_FALSE(unchanged_plan.split_channels);
+  EXPECT_FALSE(unchanged_plan.use_single_precision);
+  EXPECT_EQ(unchanged_plan.tile_size, 0);
+
+  // One channel at a time needs less than 100 MB.
+  const SolverMemoryPlan split_plan = super_resolution::PlanSolverMemory(
+      model_parameters, solver_options, problem, 100.0 * kBytesPerMegabyte);
+  EXPECT_TRUE(split_plan.fits_budget);
+  EXPECT_TRUE(split_plan.split_channels);
+  EXPECT_LT(split_plan.num_channels_per_split, 8);
+  EXPECT_EQ(split_plan.tile_size, 0);
+  EXPECT_LE(split_plan.estimate.GetTotalBytes(), 100.0 * kBytesPerMegabyte);
+
+  // The images alone take 48 MB, so the solver needs tiles to fit in 60 MB.
+  const SolverMemoryPlan tiled_plan = super_resolution::PlanSolverMemory(
+      model_parameters, solver_options, problem, 60.0 * kBytesPerMegabyte);
+  EXPECT_TRUE(tiled_plan.fits_budget);
+  EXPECT_GT(tiled_plan.tile_size, 0);
+  EXPECT_LT(tiled_plan.tile_size, 512);
+  EXPECT_LE(tiled_plan.estimate.GetTotalBytes(), 60.0 * kBytesPerMegabyte);
+
+  // Tiles are not used if the minimum tile size is 0.
+  const SolverMemoryPlan untiled_plan = super_resolution::PlanSolverMemory(
+      model_parameters, solver_options, problem, 60.0 * kBytesPerMegabyte, 0);
+  EXPECT_FALSE(untiled_plan.fits_budget);
+  EXPECT_EQ(untiled_plan.tile_size, 0);
+  EXPECT_EQ(untiled_plan.num_channels_per_split, 1);
+
+  // Nothing fits if the images alone exceed the budget.
+  const SolverMemoryPlan smallest_plan = super_resolution::PlanSolverMemory(
+      model_parameters, solver_options, problem, 10.0 * kBytesPerMegabyte);
+  EXPECT_FALSE(smallest_plan.fits_budget);
+  EXPECT_EQ(smallest_plan.num_channels_per_split, 1);
+  EXPECT_TRUE(smallest_plan.use_single_precision);
+}
+
+// Verifies that if the regularizer couples channels, the planner switches to
+// single precision before it splits the channels, and that the splits
+// overlap.
+TEST(MemoryPlanner, PlanCoupledChannels) {
+  ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  const MapSolverOptions solver_options;
+  SolverMemoryProblem problem = GetTestProblem();
+  problem.regularizer_couples_channels = true;
+  const double full_bytes = super_resolution::EstimateSolverMemory(
+      model_parameters, solver_options, problem).GetTotalBytes();
+  MapSolverOptions single_precision_options = solver_options;
+  single_precision_options.use_single_precision = true;
+  const double single_precision_bytes = super_resolution::EstimateSolverMemory(
+      model_parameters, single_precision_options, problem).GetTotalBytes();
+  ASSERT_LT(single_precision_bytes, full_bytes);
+
+  const SolverMemoryPlan single_precision_plan =
+      super_resolution::PlanSolverMemory(
+          model_parameters, solver_options, problem, single_precision_bytes);
+  EXPECT_TRUE(single_precision_plan.fits_budget);
+  EXPECT_TRUE(single_precision_plan.use_single_precision);
+  EXPECT_FALSE(single_precision_plan.split_channels);
+
+  // Blocks of 4 channels solve 6 channels with the overlap, which needs more
+  // than 240 MB even in single precision, but blocks of 2 fit.
+  const SolverMemoryPlan split_plan = super_resolution::PlanSolverMemory(
+      model_parameters, solver_options, problem, 240.0 * kBytesPerMegabyte);
+  EXPECT_TRUE(split_plan.fits_budget);
+  EXPECT_TRUE(split_plan.split_channels);
+  EXPECT_EQ(split_plan.num_channels_per_split, 2);
+  EXPECT_EQ(split_plan.num_split_overlap_channels, 1);
+  EXPECT_FALSE(split_plan.use_single_precision);
+  EXPECT_EQ(split_plan.tile_size, 0);
+}
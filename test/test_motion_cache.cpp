@@ -0,0 +1,60 @@
+#include "motion/motion_shift.h"
+#include "video/motion_cache.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::MotionCache;
+using super_resolution::MotionShift;
+using super_resolution::MotionShiftSequence;
+
+constexpr double kShiftTolerance = 1.0e-12;
+
+// Verifies that shifts between any two frames are composed from the
+// consecutive shifts, in both directions, and cached.
+TEST(MotionCache, ComposesConsecutiveShifts) {
+  MotionCache motion_cache;
+  motion_cache.AddShift(0, 1, MotionShift(1.0, -0.5));
+  motion_cache.AddShift(1, 2, MotionShift(0.25, 2.0));
+  motion_cache.AddShift(2, 3, MotionShift(-3.0, 0.0));
+  EXPECT_EQ(motion_cache.GetNumCachedShifts(), 3);
+
+  EXPECT_TRUE(motion_cache.HasShift(0, 3));
+  EXPECT_TRUE(motion_cache.HasShift(3, 1));
+  EXPECT_FALSE(motion_cache.HasShift(0, 4));
+
+  const MotionShift shift_0_3 = motion_cache.GetShift(0, 3);
+  EXPECT_NEAR(shift_0_3.dx, -1.75, kShiftTolerance);
+  EXPECT_NEAR(shift_0_3.dy, 1.5, kShiftTolerance);
+  EXPECT_EQ(motion_cache.GetNumCachedShifts(), 4);
+
+  const MotionShift shift_3_1 = motion_cache.GetShift(3, 1);
+  EXPECT_NEAR(shift_3_1.dx, 2.75, kShiftTolerance);
+  EXPECT_NEAR(shift_3_1.dy, -2.0, kShiftTolerance);
+
+  const MotionShift shift_2_2 = motion_cache.GetShift(2, 2);
+  EXPECT_EQ(shift_2_2.dx, 0.0);
+  EXPECT_EQ(shift_2_2.dy, 0.0);
+}
+
+// Verifies that window sequences are relative to the reference frame and
+// scaled, and that old frames are dropped.
+TEST(MotionCache, WindowSequencesAndDropping) {
+  MotionCache motion_cache;
+  for (int frame = 0; frame < 5; ++frame) {
+    motion_cache.AddShift(frame, frame + 1, MotionShift(1.0, 0.5));
+  }
+
+  const MotionShiftSequence sequence =
+      motion_cache.GetMotionSequence(2, 1, 5, 2.0);
+  ASSERT_EQ(sequence.GetNumMotionShifts(), 4);
+  const double expected_dx[] = {-2.0, 0.0, 2.0, 4.0};
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_NEAR(sequence[i].dx, expected_dx[i], kShiftTolerance);
+    EXPECT_NEAR(sequence[i].dy, expected_dx[i] / 2.0, kShiftTolerance);
+  }
+
+  motion_cache.DropFramesBefore(2);
+  EXPECT_FALSE(motion_cache.HasShift(1, 2));
+  EXPECT_TRUE(motion_cache.HasShift(2, 5));
+}
@@ -0,0 +1,117 @@
+#include <cmath>
+#include <vector>
+
+#include "optimization/multigrid.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::AverageImage;
+using super_resolution::GetMultigridLevelSizes;
+using super_resolution::ProlongateImage;
+using super_resolution::RestrictImage;
+
+TEST(Multigrid, GetMultigridLevelSizes) {
+  const std::vector<cv::Size> level_sizes =
+      GetMultigridLevelSizes(cv::Size(100, 41), 10, 8);
+  ASSERT_EQ(level_sizes.size(), 3);
+  EXPECT_EQ(level_sizes[0], cv::Size(100, 41));
+  EXPECT_EQ(level_sizes[1], cv::Size(50, 21));
+  EXPECT_EQ(level_sizes[2], cv::Size(25, 11));
+
+  // Limited by the number of levels.
+  EXPECT_EQ(GetMultigridLevelSizes(cv::Size(100, 41), 2, 8).size(), 2);
+
+  // The full resolution level is always there.
+  EXPECT_EQ(GetMultigridLevelSizes(cv::Size(5, 5), 4, 8).size(), 1);
+  EXPECT_EQ(GetMultigridLevelSizes(cv::Size(1, 1), 4, 1).size(), 1);
+}
+
+// Verifies that a constant image stays constant, and that a linear ramp is
+// interpolated exactly away from the borders.
+TEST(Multigrid, ProlongateImage) {
+  const cv::Size coarse_size(3, 2);
+  const cv::Size fine_size(6, 4);
+  const std::vector<double> constant(2 * 6, 5.0);
+  std::vector<double> fine(2 * 24);
+  ProlongateImage(constant.data(), coarse_size, fine_size, 2, fine.data());
+  for (const double value : fine) {
+    EXPECT_DOUBLE_EQ(value, 5.0);
+  }
+
+  // A ramp along the columns, x = 2 * coarse col + 0.5 in fine cell units.
+  const std::vector<double> ramp = {0, 2, 4, 0, 2, 4};
+  ProlongateImage(ramp.data(), coarse_size, fine_size, 1, fine.data());
+  for (int row = 0; row < fine_size.height; ++row) {
+    for (int col = 1; col < fine_size.width - 1; ++col) {
+      EXPECT_DOUBLE_EQ(fine[row * fine_size.width + col], col - 0.5);
+    }
+  }
+}
+
+// Verifies that restriction is the transpose of prolongation, also for odd
+// image sizes, i.e. <P c, f> = <c, R f> for any c and f.
+TEST(Multigrid, RestrictionIsTransposeOfProlongation) {
+  const int num_channels = 2;
+  for (const cv::Size& fine_size :
+       {cv::Size(8, 6), cv::Size(7, 5), cv::Size(1, 3)}) {
+    const cv::Size coarse_size(
+        (fine_size.width + 1) / 2, (fine_size.height + 1) / 2);
+    const int num_fine_values = fine_size.area() * num_channels;
+    const int num_coarse_values = coarse_size.area() * num_channels;
+    std::vector<double> coarse(num_coarse_values);
+    std::vector<double> fine(num_fine_values);
+    for (int i = 0; i < num_coarse_values; ++i) {
+      coarse[i] = std::sin(1.3 * i + 0.2);
+    }
+    for (int i = 0; i < num_fine_values; ++i) {
+      fine[i] = std::cos(0.7 * i);
+    }
+
+    std::vector<double> prolongated(num_fine_values);
+    ProlongateImage(
+        coarse.data(), coarse_size, fine_size, num_channels,
+        prolongated.data());
+    std::vector<double> restricted(num_coarse_values);
+    RestrictImage(
+        fine.data(), fine_size, coarse_size, num_channels, restricted.data());
+
+    double prolongated_product = 0.0;
+    for (int i = 0; i < num_fine_values; ++i) {
+      prolongated_product += prolongated[i] * fine[i];
+    }
+    double restricted_product = 0.0;
+    for (int i = 0; i < num_coarse_values; ++i) {
+      restricted_product += coarse[i] * restricted[i];
+    }
+    EXPECT_NEAR(prolongated_product, restricted_product, 1.0e-12);
+  }
+}
+
+// Verifies that averaging keeps a constant image constant, also for odd image
+// sizes, and that the averages of any image stay within its range.
+TEST(Multigrid, AverageImage) {
+  for (const cv::Size& fine_size : {cv::Size(8, 6), cv::Size(7, 5)}) {
+    const cv::Size coarse_size(
+        (fine_size.width + 1) / 2, (fine_size.height + 1) / 2);
+    const std::vector<double> constant(2 * fine_size.area(), 3.0);
+    std::vector<double> coarse(2 * coarse_size.area());
+    AverageImage(
+        constant.data(), fine_size, coarse_size, 2, coarse.data());
+    for (const double value : coarse) {
+      EXPECT_DOUBLE_EQ(value, 3.0);
+    }
+
+    std::vector<double> fine(fine_size.area());
+    for (int i = 0; i < fine.size(); ++i) {
+      fine[i] = std::cos(0.7 * i);
+    }
+    AverageImage(fine.data(), fine_size, coarse_size, 1, coarse.data());
+    for (int i = 0; i < coarse_size.area(); ++i) {
+      EXPECT_GE(coarse[i], -1.0);
+      EXPECT_LE(coarse[i], 1.0);
+    }
+  }
+}
@@ -0,0 +1,332 @@
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "optimization/map_solver.h"
+#include "optimization/native_solver.h"
+#include "optimization/objective_function.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::MapSolverOptions;
+using super_resolution::NativeSolver;
+using super_resolution::ObjectiveFunction;
+using super_resolution::ObjectiveTerm;
+
+// An ill-conditioned quadratic term sum_i c_i * (x_i - t_i)^2, with a target
+// t that can be changed between solves.
+class WeightedQuadraticTerm : public ObjectiveTerm {
+ public:
+  explicit WeightedQuadraticTerm(const std::vector<double>& target)
+      : target_(target) {}
+
+  virtual double Compute(
+      const double* estimated_image_data, double* gradient) const {
+
+    double cost = 0.0;
+    for (int i = 0; i < target_.size(); ++i) {
+      const double weight = 1.0 + (i % 10);
+      const double difference = estimated_image_data[i] - target_[i];
+      cost += weight * difference * difference;
+      if (gradient != nullptr) {
+        gradient[i] += 2.0 * weight * difference;
+      }
+    }
+    return cost;
+  }
+
+ private:
+  const std::vector<double>& target_;
+};
+
+// The two-dimensional Rosenbrock function, which is not quadratic and has its
+// minimum of 0 at (1, 1).
+class RosenbrockTerm : public ObjectiveTerm {
+ public:
+  virtual double Compute(
+      const double* estimated_image_data, double* gradient) const {
+
+    const double x = estimated_image_data[0];
+    const double y = estimated_image_data[1];
+    if (gradient != nullptr) {
+      gradient[0] += -2.0 * (1.0 - x) - 400.0 * x * (y - x * x);
+      gradient[1] += 200.0 * (y - x * x);
+    }
+    return (1.0 - x) * (1.0 - x) + 100.0 * (y - x * x) * (y - x * x);
+  }
+};
+
+// A smoothing problem on an image grid, like the inner problems of IRLS:
+// c sum_i (x_i - t_i)^2 + lambda * sum_(i, j neighbors) (x_i - x_j)^2. The
+// strong smoothness term makes it badly conditioned, increasingly so with the
+// image size. The term counts its evaluations.
+class GridSmoothingTerm : public ObjectiveTerm {
+ public:
+  GridSmoothingTerm(
+      const cv::Size& image_size,
+      const std::vector<double>& target,
+      const double lambda,
+      const double data_weight = 1.0)
+      : image_size_(image_size),
+        target_(target),
+        lambda_(lambda),
+        data_weight_(data_weight) {}
+
+  virtual double Compute(
+      const double* estimated_image_data, double* gradient) const {
+
+    num_evaluations_++;
+    double cost = 0.0;
+    const int width = image_size_.width;
+    for (int row = 0; row < image_size_.height; ++row) {
+      for (int col = 0; col < width; ++col) {
+        const int i = row * width + col;
+        const double difference = estimated_image_data[i] - target_[i];
+        cost += data_weight_ * difference * difference;
+        if (gradient != nullptr) {
+          gradient[i] += 2.0 * data_weight_ * difference;
+        }
+        for (const int j : {(col + 1 < width) ? i + 1 : -1,
+                            (row + 1 < image_size_.height) ? i + width : -1}) {
+          if (j < 0) {
+            continue;
+          }
+          const double neighbor_difference =
+              estimated_image_data[i] - estimated_image_data[j];
+          cost += lambda_ * neighbor_difference * neighbor_difference;
+          if (gradient != nullptr) {
+            gradient[i] += 2.0 * lambda_ * neighbor_difference;
+            gradient[j] -= 2.0 * lambda_ * neighbor_difference;
+          }
+        }
+      }
+    }
+    return cost;
+  }
+
+  // Returns the number of pixels evaluated by all evaluations so far.
+  int64_t GetNumEvaluatedPixels() const {
+    return num_evaluations_ * image_size_.area();
+  }
+
+ private:
+  const cv::Size image_size_;
+  const std::vector<double>& target_;
+  const double lambda_;
+  const double data_weight_;
+  mutable int64_t num_evaluations_ = 0;
+};
+
+MapSolverOptions GetSolverOptions(
+    const super_resolution::LeastSquaresSolver least_squares_solver) {
+
+  MapSolverOptions solver_options;
+  solver_options.least_squares_solver = least_squares_solver;
+  solver_options.max_num_solver_iterations = 1000;
+  solver_options.gradient_norm_threshold = 1.0e-10;
+  solver_options.cost_decrease_threshold = 0.0;
+  solver_options.parameter_variation_threshold = 0.0;
+  return solver_options;
+}
+
+// Verifies that both native solvers minimize a quadratic repeatedly with an
+// objective that changes between solves. The problem is large enough that the
+// vector operations are split across threads.
+TEST(NativeSolver, RepeatedQuadraticSolves) {
+  const int num_parameters = 50000;
+  for (const auto solver : {
+      super_resolution::NATIVE_CG_SOLVER,
+      super_resolution::NATIVE_LBFGS_SOLVER}) {
+    for (const int num_threads : {1, 4}) {
+      MapSolverOptions solver_options = GetSolverOptions(solver);
+      solver_options.num_threads = num_threads;
+
+      std::vector<double> target(num_parameters);
+      for (int i = 0; i < num_parameters; ++i) {
+        target[i] = std::sin(0.01 * i);
+      }
+      ObjectiveFunction objective_function(num_parameters);
+      objective_function.AddTerm(
+          std::shared_ptr<ObjectiveTerm>(new WeightedQuadraticTerm(target)));
+      NativeSolver native_solver(
+          solver_options, objective_function, num_parameters);
+
+      std::vector<double> solver_data(num_parameters, 0.0);
+      for (int solve = 0; solve < 3; ++solve) {
+        const double final_cost = native_solver.Solve(solver_data.data());
+        EXPECT_NEAR(final_cost, 0.0, 1.0e-8);
+        for (int i = 0; i < num_parameters; ++i) {
+          ASSERT_NEAR(solver_data[i], target[i], 1.0e-5);
+        }
+        // Change the objective in place for the next solve.
+        for (int i = 0; i < num_parameters; ++i) {
+          target[i] = target[i] * 0.5 + std::cos(0.02 * i);
+        }
+      }
+      EXPECT_EQ(native_solver.GetNumSolves(), 3);
+      EXPECT_GT(objective_function.GetNumCompletedIterations(), 0);
+    }
+  }
+}
+
+// Verifies that both native solvers converge in fewer iterations with a
+// diagonal preconditioner, which is exact for the weighted quadratic.
+TEST(NativeSolver, DiagonalPreconditioner) {
+  const int num_parameters = 1000;
+  std::vector<double> target(num_parameters);
+  std::vector<double> hessian_diagonal(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    target[i] = std::sin(0.01 * i);
+    hessian_diagonal[i] = 2.0 * (1.0 + (i % 10));
+  }
+  for (const auto solver : {
+      super_resolution::NATIVE_CG_SOLVER,
+      super_resolution::NATIVE_LBFGS_SOLVER}) {
+    int num_iterations[2];
+    for (const bool use_preconditioner : {false, true}) {
+      const MapSolverOptions solver_options = GetSolverOptions(solver);
+      ObjectiveFunction objective_function(num_parameters);
+      objective_function.AddTerm(
+          std::shared_ptr<ObjectiveTerm>(new WeightedQuadraticTerm(target)));
+      NativeSolver native_solver(
+          solver_options, objective_function, num_parameters);
+      if (use_preconditioner) {
+        native_solver.SetDiagonalPreconditioner(hessian_diagonal);
+      }
+
+      std::vector<double> solver_data(num_parameters, 0.0);
+      const double final_cost = native_solver.Solve(solver_data.data());
+      EXPECT_NEAR(final_cost, 0.0, 1.0e-8);
+      for (int i = 0; i < num_parameters; ++i) {
+        ASSERT_NEAR(solver_data[i], target[i], 1.0e-5);
+      }
+      num_iterations[use_preconditioner ? 1 : 0] =
+          objective_function.GetNumCompletedIterations();
+    }
+    EXPECT_LT(num_iterations[1], num_iterations[0]);
+  }
+}
+
+// Verifies that both native solvers handle a non-quadratic objective, which
+// requires a working line search.
+TEST(NativeSolver, Rosenbrock) {
+  for (const auto solver : {
+      super_resolution::NATIVE_CG_SOLVER,
+      super_resolution::NATIVE_LBFGS_SOLVER}) {
+    const MapSolverOptions solver_options = GetSolverOptions(solver);
+    ObjectiveFunction objective_function(2);
+    objective_function.AddTerm(
+        std::shared_ptr<ObjectiveTerm>(new RosenbrockTerm()));
+    NativeSolver native_solver(solver_options, objective_function, 2);
+
+    std::vector<double> solver_data = {-1.2, 1.0};
+    const double final_cost = native_solver.Solve(solver_data.data());
+    EXPECT_NEAR(final_cost, 0.0, 1.0e-8);
+    EXPECT_NEAR(solver_data[0], 1.0, 1.0e-4);
+    EXPECT_NEAR(solver_data[1], 1.0, 1.0e-4);
+  }
+}
+
+// Verifies that the solver stops after the maximum number of iterations.
+TEST(NativeSolver, MaxNumIterations) {
+  MapSolverOptions solver_options =
+      GetSolverOptions(super_resolution::NATIVE_CG_SOLVER);
+  solver_options.max_num_solver_iterations = 3;
+  ObjectiveFunction objective_function(2);
+  objective_function.AddTerm(
+      std::shared_ptr<ObjectiveTerm>(new RosenbrockTerm()));
+  NativeSolver native_solver(solver_options, objective_function, 2);
+
+  std::vector<double> solver_data = {-1.2, 1.0};
+  native_solver.Solve(solver_data.data());
+  EXPECT_EQ(objective_function.GetNumCompletedIterations(), 3);
+}
+
+// Verifies that the multigrid solver minimizes a badly conditioned grid
+// problem with less work than CG, counted as the number of pixels that
+// all objective evaluations went through, and that its work per pixel hardly
+// grows with the image size. Rediscretizing the problem on the coarse grids
+// replaces the full resolution Galerkin products by coarse evaluations, which
+// cuts the work again.
+TEST(NativeSolver, Multigrid) {
+  enum SolverVariant { CG, GALERKIN_MULTIGRID, REDISCRETIZED_MULTIGRID };
+  const double lambda = 100.0;
+  double work_per_pixel[2][3];
+  const cv::Size image_sizes[2] = {cv::Size(32, 24), cv::Size(128, 96)};
+  for (int size_index = 0; size_index < 2; ++size_index) {
+    const cv::Size& image_size = image_sizes[size_index];
+    const int num_parameters = image_size.area();
+    std::vector<double> target(num_parameters);
+    for (int i = 0; i < num_parameters; ++i) {
+      target[i] = std::sin(0.05 * (i % image_size.width)) + (i % 7) * 0.1;
+    }
+    for (const SolverVariant variant :
+         {CG, GALERKIN_MULTIGRID, REDISCRETIZED_MULTIGRID}) {
+      MapSolverOptions solver_options = GetSolverOptions(
+          (variant == CG) ? super_resolution::NATIVE_CG_SOLVER :
+              super_resolution::MULTIGRID_SOLVER);
+      solver_options.gradient_norm_threshold = 1.0e-3;
+      solver_options.max_num_solver_iterations = 10000;
+      std::vector<std::shared_ptr<GridSmoothingTerm>> terms = {
+        std::make_shared<GridSmoothingTerm>(image_size, target, lambda)
+      };
+      ObjectiveFunction objective_function(num_parameters);
+      objective_function.AddTerm(terms[0]);
+      NativeSolver native_solver(
+          solver_options, objective_function, num_parameters, image_size);
+
+      // On a grid with twice the spacing, every pixel stands in for four
+      // fine ones in the data cost, and the neighbor differences keep their
+      // weight. The target does not change the Hessian.
+      const std::vector<cv::Size> level_sizes =
+          NativeSolver::GetMultigridLevelImageSizes(
+              solver_options, image_size);
+      std::vector<std::vector<double>> level_targets(level_sizes.size());
+      std::vector<std::unique_ptr<ObjectiveFunction>> level_objectives;
+      if (variant == REDISCRETIZED_MULTIGRID) {
+        ASSERT_GT(level_sizes.size(), 2);
+        double data_weight = 1.0;
+        for (int level = 1; level < level_sizes.size(); ++level) {
+          data_weight *= 4.0;
+          level_targets[level].assign(level_sizes[level].area(), 0.0);
+          terms.push_back(std::make_shared<GridSmoothingTerm>(
+              level_sizes[level], level_targets[level], lambda, data_weight));
+          level_objectives.emplace_back(
+              new ObjectiveFunction(level_sizes[level].area()));
+          level_objectives.back()->AddTerm(terms.back());
+          native_solver.SetLevelObjectiveFunction(
+              level, level_objectives.back().get());
+        }
+      }
+
+      std::vector<double> solver_data(num_parameters, 0.0);
+      native_solver.Solve(solver_data.data());
+      std::vector<double> gradient(num_parameters);
+      objective_function.ComputeAllTerms(solver_data.data(), gradient.data());
+      double gradient_squared_norm = 0.0;
+      for (const double value : gradient) {
+        gradient_squared_norm += value * value;
+      }
+      EXPECT_LE(std::sqrt(gradient_squared_norm), 1.0e-3);
+
+      int64_t num_evaluated_pixels = 0;
+      for (const auto& term : terms) {
+        num_evaluated_pixels += term->GetNumEvaluatedPixels();
+      }
+      work_per_pixel[size_index][variant] =
+          static_cast<double>(num_evaluated_pixels) / num_parameters;
+    }
+    EXPECT_LT(2.0 * work_per_pixel[size_index][GALERKIN_MULTIGRID],
+              work_per_pixel[size_index][CG]);
+    EXPECT_LT(1.5 * work_per_pixel[size_index][REDISCRETIZED_MULTIGRID],
+              work_per_pixel[size_index][GALERKIN_MULTIGRID]);
+  }
+  for (const SolverVariant variant :
+       {GALERKIN_MULTIGRID, REDISCRETIZED_MULTIGRID}) {
+    EXPECT_LE(work_per_pixel[1][variant], 2.0 * work_per_pixel[0][variant]);
+  }
+}
@@ -0,0 +1,63 @@
+#include <vector>
+
+#include "util/numa.h"
+#include "util/thread_pool.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::util::GetBlockNumaNode;
+using super_resolution::util::GetNumNumaNodes;
+using testing::Each;
+
+// Verifies that blocks are assigned to the nodes in contiguous runs that
+// cover every node.
+TEST(Numa, GetBlockNumaNode) {
+  const int num_nodes = GetNumNumaNodes();
+  EXPECT_GE(num_nodes, 1);
+
+  const int num_blocks = 3 * num_nodes + 1;
+  EXPECT_EQ(GetBlockNumaNode(0, num_blocks), 0);
+  EXPECT_EQ(GetBlockNumaNode(num_blocks - 1, num_blocks), num_nodes - 1);
+  for (int block_index = 1; block_index < num_blocks; ++block_index) {
+    const int node_index = GetBlockNumaNode(block_index, num_blocks);
+    const int previous_node_index =
+        GetBlockNumaNode(block_index - 1, num_blocks);
+    EXPECT_GE(node_index, previous_node_index);
+    EXPECT_LE(node_index, previous_node_index + 1);
+  }
+
+  // With fewer blocks than nodes, every block still gets a valid node.
+  EXPECT_EQ(GetBlockNumaNode(0, 1), 0);
+}
+
+// Verifies that placing buffers and pinning threads does not change any
+// values or skip any tasks, whether or not the host has several NUMA nodes.
+TEST(Numa, PlacementKeepsResults) {
+  super_resolution::util::SetNumaPlacement(true);
+
+  const int num_values = 1000000;
+  const int num_blocks = 5;
+  std::vector<double> values(num_values);
+  for (int i = 0; i < num_values; ++i) {
+    values[i] = i * 0.5;
+  }
+  super_resolution::util::DistributeOverNumaNodes(
+      values.data(), num_values, num_blocks);
+  for (int i = 0; i < num_values; ++i) {
+    ASSERT_EQ(values[i], i * 0.5);
+  }
+
+  super_resolution::util::ThreadPool thread_pool(num_blocks - 1);
+  std::vector<int> num_times_run(num_blocks, 0);
+  thread_pool.ParallelForOnNumaNodes(num_blocks, [&](const int block_index) {
+    num_times_run[block_index]++;
+  });
+  EXPECT_THAT(num_times_run, Each(1));
+
+  // Only the workers are pinned, so the calling thread keeps its affinity.
+  EXPECT_EQ(super_resolution::util::GetThreadNumaNode(), -1);
+
+  super_resolution::util::SetNumaPlacement(false);
+  EXPECT_FALSE(super_resolution::util::IsNumaPlacementEnabled());
+}
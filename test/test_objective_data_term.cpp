@@ -0,0 +1,758 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "image/encoded_observations.h"
+#include "image/image_data.h"
+#include "image_model/compiled_image_model.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
+#include "optimization/objective_data_term.h"
+#include "util/test_util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::ImageModel;
+using super_resolution::ObjectiveDataTerm;
+using super_resolution::test::ComputeDirectionalGradientError;
+
+constexpr double kCostErrorTolerance = 1e-9;
+
+// A small two-channel HR image. Each channel is 6x4 so that the model matrix
+// can be computed explicitly.
+const cv::Mat kHighResChannel1 = (cv::Mat_<double>(4, 6)
+    << 0.1, 0.2, 0.3, 0.4, 0.5, 0.6,
+       0.7, 0.8, 0.9, 0.0, 0.1, 0.2,
+       0.9, 0.7, 0.5, 0.4, 0.2, 0.1,
+       0.2, 0.4, 0.6, 0.8, 0.0, 0.1);
+const cv::Mat kHighResChannel2 = (cv::Mat_<double>(4, 6)
+    << 0.5, 0.5, 0.1, 0.9, 0.3, 0.2,
+       0.4, 0.6, 0.2, 0.8, 0.3, 0.3,
+       0.0, 1.0, 0.7, 0.1, 0.6, 0.9,
+       0.3, 0.2, 0.8, 0.4, 0.5, 0.7);
+const cv::Size kHighResImageSize(6, 4);
+
+// Returns the stacked channel data of the given image as a single vector.
+std::vector<double> GetImageDataVector(const ImageData& image) {
+  std::vector<double> data;
+  for (int channel = 0; channel < image.GetNumChannels(); ++channel) {
+    const double* channel_data = image.GetChannelData(channel);
+    data.insert(data.end(), channel_data, channel_data + image.GetNumPixels());
+  }
+  return data;
+}
+
+// Verifies that the cost and gradient computed on the LR grid match the
+// explicit matrix formulation of the data term evaluated on the HR grid, where
+// every LR residual is replicated over its scale^2 HR pixels.
+TEST(ObjectiveDataTerm, MatchesModelMatrixFormulation) {
+  const int scale = 2;
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = scale;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, 0),
+    super_resolution::MotionShift(0, -1)
+  });
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+  const int num_observations = 3;
+
+  ImageData ground_truth;
+  ground_truth.AddChannel(kHighResChannel1);
+  ground_truth.AddChannel(kHighResChannel2);
+
+  // Observations are given at the LR size, as stored by the MapSolver.
+  std::vector<ImageData> observations;
+  for (int i = 0; i < num_observations; ++i) {
+    observations.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+
+  // Evaluate the term at an estimate that differs from the ground truth.
+  ImageData estimate = ground_truth * 0.5;
+  const std::vector<double> estimate_data = GetImageDataVector(estimate);
+  const int num_pixels = kHighResImageSize.area();
+
+  // Run the test for the full channel range and for each individual channel.
+  const std::vector<std::pair<int, int>> channel_ranges = {
+    {0, 2}, {0, 1}, {1, 2}
+  };
+  for (const std::pair<int, int>& channel_range : channel_ranges) {
+    const int channel_start = channel_range.first;
+    const int channel_end = channel_range.second;
+    const int num_channels = channel_end - channel_start;
+    const ObjectiveDataTerm data_term(
+        image_model,
+        observations,
+        channel_start,
+        channel_end,
+        kHighResImageSize);
+
+    const double* channel_range_data =
+        estimate_data.data() + channel_start * num_pixels;
+    std::vector<double> gradient(num_channels * num_pixels, 0.0);
+    const double cost = data_term.Compute(channel_range_data, gradient.data());
+
+    // Compute the expected cost and gradient: s^2 * ||A_kx - y_k||^2 and
+    // 2 * s^2 * A_k'(A_kx - y_k), summed over all observations k.
+    double expected_cost = 0.0;
+    std::vector<double> expected_gradient(num_channels * num_pixels, 0.0);
+    for (int i = 0; i < num_observations; ++i) {
+      const cv::Mat model_matrix =
+          image_model.GetModelMatrix(kHighResImageSize, i);
+      const ImageData low_res_observation =
+          image_model.ApplyToImage(ground_truth, i);
+      for (int channel = 0; channel < num_channels; ++channel) {
+        const cv::Mat x = estimate.GetChannelImage(
+            channel + channel_start).clone().reshape(1, num_pixels);
+        const cv::Mat y = low_res_observation.GetChannelImage(
+            channel + channel_start).clone().reshape(1, model_matrix.rows);
+        const cv::Mat residual = model_matrix * x - y;
+        expected_cost += scale * scale * residual.dot(residual);
+        const cv::Mat channel_gradient =
+            2 * scale * scale * model_matrix.t() * residual;
+        for (int pixel = 0; pixel < num_pixels; ++pixel) {
+          expected_gradient[channel * num_pixels + pixel] +=
+              channel_gradient.at<double>(pixel);
+        }
+      }
+    }
+
+    EXPECT_NEAR(cost, expected_cost, kCostErrorTolerance);
+    for (int i = 0; i < expected_gradient.size(); ++i) {
+      EXPECT_NEAR(gradient[i], expected_gradient[i], kCostErrorTolerance);
+    }
+
+    // The cost without a gradient must be unchanged.
+    EXPECT_NEAR(
+        data_term.Compute(channel_range_data, nullptr),
+        expected_cost,
+        kCostErrorTolerance);
+  }
+}
+
+// Verifies that evaluating the observations in parallel gives the same result
+// as the serial evaluation, and that parallel results are reproducible.
+TEST(ObjectiveDataTerm, ParallelEvaluation) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  std::vector<super_resolution::MotionShift> motion_shifts;
+  for (int i = 0; i < 7; ++i) {
+    motion_shifts.push_back(super_resolution::MotionShift(i % 3, i % 2));
+  }
+  model_parameters.motion_sequence =
+      super_resolution::MotionShiftSequence(motion_shifts);
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+
+  ImageData ground_truth;
+  ground_truth.AddChannel(kHighResChannel1);
+  ground_truth.AddChannel(kHighResChannel2);
+  std::vector<ImageData> observations;
+  for (int i = 0; i < motion_shifts.size(); ++i) {
+    observations.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+
+  const ImageData estimate = ground_truth * 0.5;
+  const std::vector<double> estimate_data = GetImageDataVector(estimate);
+  const int num_parameters = estimate_data.size();
+
+  const ObjectiveDataTerm serial_data_term(
+      image_model, observations, 0, 2, kHighResImageSize, 1);
+  std::vector<double> serial_gradient(num_parameters, 0.0);
+  const double serial_cost =
+      serial_data_term.Compute(estimate_data.data(), serial_gradient.data());
+
+  for (const int num_threads : {2, 3, 0}) {
+    const ObjectiveDataTerm parallel_data_term(
+        image_model, observations, 0, 2, kHighResImageSize, num_threads);
+    std::vector<double> gradient_1(num_parameters, 0.0);
+    std::vector<double> gradient_2(num_parameters, 0.0);
+    const double cost_1 =
+        parallel_data_term.Compute(estimate_data.data(), gradient_1.data());
+    const double cost_2 =
+        parallel_data_term.Compute(estimate_data.data(), gradient_2.data());
+
+    EXPECT_NEAR(cost_1, serial_cost, kCostErrorTolerance);
+    for (int i = 0; i < num_parameters; ++i) {
+      EXPECT_NEAR(gradient_1[i], serial_gradient[i], kCostErrorTolerance);
+    }
+
+    // Repeated parallel evaluations must be bit-identical.
+    EXPECT_EQ(cost_1, cost_2);
+    EXPECT_EQ(gradient_1, gradient_2);
+  }
+}
+
+// Verifies that the line search cache gives the same costs and gradients as
+// the direct evaluation, both for points along the cached lines and for
+// points that start new lines.
+TEST(ObjectiveDataTerm, LineSearchCacheEvaluation) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, 0),
+    super_resolution::MotionShift(0, 1)
+  });
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+
+  ImageData ground_truth;
+  ground_truth.AddChannel(kHighResChannel1);
+  ground_truth.AddChannel(kHighResChannel2);
+  std::vector<ImageData> observations;
+  for (int i = 0; i < 3; ++i) {
+    observations.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+
+  const ObjectiveDataTerm data_term(
+      image_model, observations, 0, 2, kHighResImageSize);
+  ObjectiveDataTerm cached_data_term(
+      image_model, observations, 0, 2, kHighResImageSize);
+  cached_data_term.SetUseLineSearchCache(true);
+
+  const std::vector<double> start_point =
+      GetImageDataVector(ground_truth * 0.5);
+  const int num_parameters = start_point.size();
+  std::vector<double> first_direction(num_parameters);
+  std::vector<double> second_direction(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    first_direction[i] = std::sin(0.9 * i);
+    second_direction[i] = std::cos(1.7 * i);
+  }
+
+  // Two line searches, the second one starting from the last point of the
+  // first, followed by a point that is on neither line.
+  std::vector<std::vector<double>> points;
+  for (const double step : {0.0, 1.0, 0.25, 0.6}) {
+    std::vector<double> point = start_point;
+    for (int i = 0; i < num_parameters; ++i) {
+      point[i] += step * first_direction[i];
+    }
+    points.push_back(point);
+  }
+  const std::vector<double> second_start_point = points.back();
+  for (const double step : {0.5, -0.2, 0.1}) {
+    std::vector<double> point = second_start_point;
+    for (int i = 0; i < num_parameters; ++i) {
+      point[i] += step * second_direction[i];
+    }
+    points.push_back(point);
+  }
+  points.push_back(GetImageDataVector(ground_truth * 0.8));
+
+  for (const std::vector<double>& point : points) {
+    std::vector<double> expected_gradient(num_parameters, 0.0);
+    const double expected_cost =
+        data_term.Compute(point.data(), expected_gradient.data());
+    std::vector<double> gradient(num_parameters, 0.0);
+    const double cost = cached_data_term.Compute(point.data(), gradient.data());
+    EXPECT_NEAR(cost, expected_cost, kCostErrorTolerance);
+    for (int i = 0; i < num_parameters; ++i) {
+      EXPECT_NEAR(gradient[i], expected_gradient[i], kCostErrorTolerance);
+    }
+    EXPECT_NEAR(
+        cached_data_term.Compute(point.data(), nullptr),
+        expected_cost,
+        kCostErrorTolerance);
+  }
+}
+
+// Verifies that evaluating the data term in single precision gives nearly the
+// same cost and gradient as the default double precision evaluation.
+TEST(ObjectiveDataTerm, SinglePrecisionEvaluation) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, 0),
+    super_resolution::MotionShift(0, 1)
+  });
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+
+  ImageData ground_truth;
+  ground_truth.AddChannel(kHighResChannel1);
+  ground_truth.AddChannel(kHighResChannel2);
+  std::vector<ImageData> observations;
+  for (int i = 0; i < 3; ++i) {
+    observations.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+
+  const ImageData estimate = ground_truth * 0.5;
+  const std::vector<double> estimate_data = GetImageDataVector(estimate);
+  const int num_parameters = estimate_data.size();
+
+  const ObjectiveDataTerm double_data_term(
+      image_model, observations, 0, 2, kHighResImageSize);
+  std::vector<double> double_gradient(num_parameters, 0.0);
+  const double double_cost =
+      double_data_term.Compute(estimate_data.data(), double_gradient.data());
+
+  const ObjectiveDataTerm single_data_term(
+      image_model,
+      observations,
+      0, 2,
+      kHighResImageSize,
+      1,
+      super_resolution::SINGLE_PRECISION);
+  std::vector<double> single_gradient(num_parameters, 0.0);
+  const double single_cost =
+      single_data_term.Compute(estimate_data.data(), single_gradient.data());
+
+  // Single precision has about 7 significant digits.
+  constexpr double kSinglePrecisionTolerance = 1e-5;
+  EXPECT_NEAR(single_cost, double_cost, kSinglePrecisionTolerance);
+  for (int i = 0; i < num_parameters; ++i) {
+    EXPECT_NEAR(
+        single_gradient[i], double_gradient[i], kSinglePrecisionTolerance);
+  }
+}
+
+// Verifies that evaluating the data term with the compiled image model gives
+// the same cost and gradient as applying the model operators directly, both
+// serially and in parallel.
+TEST(ObjectiveDataTerm, CompiledImageModelEvaluation) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, 0),
+    super_resolution::MotionShift(-1, 2)
+  });
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+  ASSERT_TRUE(image_model.IsCompilable());
+
+  ImageData ground_truth;
+  ground_truth.AddChannel(kHighResChannel1);
+  ground_truth.AddChannel(kHighResChannel2);
+  std::vector<ImageData> observations;
+  for (int i = 0; i < 3; ++i) {
+    observations.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+
+  const ImageData estimate = ground_truth * 0.5;
+  const std::vector<double> estimate_data = GetImageDataVector(estimate);
+  const int num_parameters = estimate_data.size();
+
+  const ObjectiveDataTerm data_term(
+      image_model, observations, 0, 2, kHighResImageSize);
+  std::vector<double> gradient(num_parameters, 0.0);
+  const double cost = data_term.Compute(estimate_data.data(), gradient.data());
+
+  const std::shared_ptr<const super_resolution::CompiledImageModel>
+      compiled_image_model(new super_resolution::CompiledImageModel(
+          image_model.Compile(kHighResImageSize, 3)));
+  for (const int num_threads : {1, 2}) {
+    const ObjectiveDataTerm compiled_data_term(
+        image_model,
+        observations,
+        0, 2,
+        kHighResImageSize,
+        num_threads,
+        super_resolution::DOUBLE_PRECISION,
+        compiled_image_model);
+    std::vector<double> compiled_gradient(num_parameters, 0.0);
+    const double compiled_cost = compiled_data_term.Compute(
+        estimate_data.data(), compiled_gradient.data());
+
+    EXPECT_NEAR(compiled_cost, cost, kCostErrorTolerance);
+    for (int i = 0; i < num_parameters; ++i) {
+      EXPECT_NEAR(compiled_gradient[i], gradient[i], kCostErrorTolerance);
+    }
+  }
+}
+
+// Verifies that evaluating the data term from the precomputed normal
+// equations gives the same cost and gradient as applying the model to every
+// observation.
+TEST(ObjectiveDataTerm, NormalEquationsEvaluation) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, 0),
+    super_resolution::MotionShift(0, 1),
+    super_resolution::MotionShift(1, 1)
+  });
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+
+  ImageData ground_truth;
+  ground_truth.AddChannel(kHighResChannel1);
+  ground_truth.AddChannel(kHighResChannel2);
+  std::vector<ImageData> observations;
+  for (int i = 0; i < 4; ++i) {
+    observations.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+
+  const ImageData estimate = ground_truth * 0.5;
+  const std::vector<double> estimate_data = GetImageDataVector(estimate);
+  const int num_parameters = estimate_data.size();
+
+  const std::shared_ptr<const super_resolution::CompiledImageModel>
+      compiled_image_model(new super_resolution::CompiledImageModel(
+          image_model.Compile(kHighResImageSize, 4, true)));
+  ASSERT_TRUE(compiled_image_model->HasNormalMatrix());
+  for (const int channel_start : {0, 1}) {
+    const ObjectiveDataTerm normal_data_term(
+        image_model,
+        observations,
+        channel_start, 2,
+        kHighResImageSize,
+        1,
+        super_resolution::DOUBLE_PRECISION,
+        compiled_image_model);
+    const ObjectiveDataTerm channel_data_term(
+        image_model, observations, channel_start, 2, kHighResImageSize);
+    const int num_channel_parameters =
+        num_parameters - channel_start * kHighResImageSize.area();
+    const double* channel_estimate_data =
+        estimate_data.data() + channel_start * kHighResImageSize.area();
+
+    std::vector<double> expected_gradient(num_channel_parameters, 0.0);
+    const double expected_cost = channel_data_term.Compute(
+        channel_estimate_data, expected_gradient.data());
+    std::vector<double> normal_gradient(num_channel_parameters, 0.0);
+    const double normal_cost = normal_data_term.Compute(
+        channel_estimate_data, normal_gradient.data());
+
+    EXPECT_NEAR(normal_cost, expected_cost, kCostErrorTolerance);
+    for (int i = 0; i < num_channel_parameters; ++i) {
+      EXPECT_NEAR(
+          normal_gradient[i], expected_gradient[i], kCostErrorTolerance);
+    }
+
+    // At a zero estimate, the cost is w y'y and the gradient is -2w b, so
+    // this checks the reduced observations on their own.
+    const std::vector<double> zero_estimate(num_channel_parameters, 0.0);
+    std::fill(expected_gradient.begin(), expected_gradient.end(), 0.0);
+    const double expected_zero_cost = channel_data_term.Compute(
+        zero_estimate.data(), expected_gradient.data());
+    std::fill(normal_gradient.begin(), normal_gradient.end(), 0.0);
+    const double normal_zero_cost = normal_data_term.Compute(
+        zero_estimate.data(), normal_gradient.data());
+    EXPECT_GT(expected_zero_cost, 0.0);
+    EXPECT_NEAR(normal_zero_cost, expected_zero_cost, kCostErrorTolerance);
+    for (int i = 0; i < num_channel_parameters; ++i) {
+      EXPECT_NEAR(
+          normal_gradient[i], expected_gradient[i], kCostErrorTolerance);
+    }
+  }
+}
+
+// Verifies that a data term with encoded observations gives the same cost and
+// gradient as one that uses the decoded observations directly, serially and
+// in parallel, and with single precision.
+TEST(ObjectiveDataTerm, EncodedObservationsEvaluation) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, 0),
+    super_resolution::MotionShift(0, 1)
+  });
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+
+  ImageData ground_truth;
+  ground_truth.AddChannel(kHighResChannel1);
+  ground_truth.AddChannel(kHighResChannel2);
+  std::vector<ImageData> observations;
+  for (int i = 0; i < 3; ++i) {
+    observations.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+
+  const ImageData estimate = ground_truth * 0.5;
+  const std::vector<double> estimate_data = GetImageDataVector(estimate);
+  const int num_parameters = estimate_data.size();
+
+  for (const auto encoding : {
+      super_resolution::OBSERVATION_ENCODING_HALF,
+      super_resolution::OBSERVATION_ENCODING_UINT16}) {
+    const super_resolution::EncodedObservations encoded_observations(
+        observations, 0, 2, encoding);
+    std::vector<ImageData> decoded_observations;
+    for (int image_index = 0; image_index < 3; ++image_index) {
+      ImageData decoded_observation;
+      for (int channel = 0; channel < 2; ++channel) {
+        cv::Mat decoded_channel(
+            encoded_observations.GetImageSize(), CV_64FC1);
+        for (int pixel_index = 0;
+             pixel_index < decoded_channel.total();
+             ++pixel_index) {
+          decoded_channel.at<double>(pixel_index) =
+              encoded_observations.GetPixelValue(
+                  image_index, channel, pixel_index);
+          EXPECT_NEAR(
+              decoded_channel.at<double>(pixel_index),
+              observations[image_index].GetPixelValue(channel, pixel_index),
+              1e-3);
+        }
+        decoded_observation.AddChannel(
+            decoded_channel, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+      }
+      decoded_observations.push_back(decoded_observation);
+    }
+
+    for (const auto precision : {
+        super_resolution::DOUBLE_PRECISION,
+        super_resolution::SINGLE_PRECISION}) {
+      const ObjectiveDataTerm decoded_data_term(
+          image_model,
+          decoded_observations,
+          0, 2,
+          kHighResImageSize,
+          1,
+          precision);
+      std::vector<double> decoded_gradient(num_parameters, 0.0);
+      const double decoded_cost = decoded_data_term.Compute(
+          estimate_data.data(), decoded_gradient.data());
+
+      // In single precision, the decoded observations are rounded to single
+      // precision, whereas encoded observations are decoded in double
+      // precision.
+      const double tolerance =
+          (precision == super_resolution::SINGLE_PRECISION) ?
+          1e-5 : kCostErrorTolerance;
+
+      for (const int num_threads : {1, 3}) {
+        const ObjectiveDataTerm encoded_data_term(
+            image_model,
+            observations,
+            0, 2,
+            kHighResImageSize,
+            num_threads,
+            precision,
+            nullptr,
+            encoding);
+        std::vector<double> encoded_gradient(num_parameters, 0.0);
+        const double encoded_cost = encoded_data_term.Compute(
+            estimate_data.data(), encoded_gradient.data());
+        EXPECT_NEAR(encoded_cost, decoded_cost, tolerance);
+        for (int i = 0; i < num_parameters; ++i) {
+          EXPECT_NEAR(encoded_gradient[i], decoded_gradient[i], tolerance);
+        }
+      }
+    }
+  }
+}
+
+// Verifies that a data term extended with a new observation gives the same
+// cost and gradient as a term created with all of the observations, for
+// every way that the term holds its observations: as given, as copies of
+// their channels, encoded, evaluated with a compiled image model, and
+// reduced to the normal equations.
+TEST(ObjectiveDataTerm, AddObservations) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, 0),
+    super_resolution::MotionShift(0, 1)
+  });
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+  const ImageModel extended_image_model =
+      image_model.CreateWithMotionShift(super_resolution::MotionShift(1, 1));
+
+  ImageData ground_truth;
+  ground_truth.AddChannel(kHighResChannel1);
+  ground_truth.AddChannel(kHighResChannel2);
+  std::vector<ImageData> observations;
+  for (int i = 0; i < 3; ++i) {
+    observations.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+
+  // The new observation is brighter than the others, so it does not fit the
+  // uint16 encoding of the first three.
+  std::vector<ImageData> extended_observations = observations;
+  extended_observations.push_back(
+      extended_image_model.ApplyToImage(ground_truth * 1.5, 3));
+
+  const ImageData estimate = ground_truth * 0.5;
+  const std::vector<double> estimate_data = GetImageDataVector(estimate);
+
+  std::vector<std::shared_ptr<const super_resolution::CompiledImageModel>>
+      compiled_image_models;
+  std::vector<std::shared_ptr<const super_resolution::CompiledImageModel>>
+      extended_compiled_image_models;
+  for (const bool with_normal_matrix : {false, true}) {
+    compiled_image_models.emplace_back(
+        new super_resolution::CompiledImageModel(
+            image_model.Compile(kHighResImageSize, 3, with_normal_matrix)));
+    std::shared_ptr<super_resolution::CompiledImageModel>
+        extended_compiled_image_model(
+            new super_resolution::CompiledImageModel(
+                *compiled_image_models.back()));
+    extended_compiled_image_model->AddFrame(
+        extended_image_model.GetSparseModelMatrix(kHighResImageSize, 3));
+    extended_compiled_image_models.push_back(extended_compiled_image_model);
+  }
+
+  const auto expect_extended_term_matches = [&](
+      const int channel_start,
+      const int compiled_image_model_index,
+      const super_resolution::ObservationEncoding encoding) {
+    const auto compiled_image_model = (compiled_image_model_index >= 0) ?
+        compiled_image_models[compiled_image_model_index] : nullptr;
+    const auto extended_compiled_image_model =
+        (compiled_image_model_index >= 0) ?
+        extended_compiled_image_models[compiled_image_model_index] : nullptr;
+
+    // The term of three observations uses three threads, so adding one also
+    // grows its thread pool.
+    ObjectiveDataTerm extended_data_term(
+        image_model,
+        observations,
+        channel_start, 2,
+        kHighResImageSize,
+        4,
+        super_resolution::DOUBLE_PRECISION,
+        compiled_image_model,
+        encoding);
+    extended_data_term.AddObservations(
+        extended_image_model,
+        extended_observations,
+        extended_compiled_image_model);
+    EXPECT_EQ(extended_data_term.GetNumObservations(), 4);
+    const ObjectiveDataTerm data_term(
+        extended_image_model,
+        extended_observations,
+        channel_start, 2,
+        kHighResImageSize,
+        4,
+        super_resolution::DOUBLE_PRECISION,
+        extended_compiled_image_model,
+        encoding);
+
+    const int channel_offset = channel_start * kHighResImageSize.area();
+    const int num_parameters = estimate_data.size() - channel_offset;
+    std::vector<double> expected_gradient(num_parameters, 0.0);
+    const double expected_cost = data_term.Compute(
+        estimate_data.data() + channel_offset, expected_gradient.data());
+    std::vector<double> extended_gradient(num_parameters, 0.0);
+    const double extended_cost = extended_data_term.Compute(
+        estimate_data.data() + channel_offset, extended_gradient.data());
+    EXPECT_NEAR(extended_cost, expected_cost, kCostErrorTolerance);
+    for (int i = 0; i < num_parameters; ++i) {
+      EXPECT_NEAR(
+          extended_gradient[i], expected_gradient[i], kCostErrorTolerance);
+    }
+  };
+
+  expect_extended_term_matches(
+      0, -1, super_resolution::OBSERVATION_ENCODING_NONE);
+  expect_extended_term_matches(
+      1, -1, super_resolution::OBSERVATION_ENCODING_NONE);
+  expect_extended_term_matches(
+      0, -1, super_resolution::OBSERVATION_ENCODING_HALF);
+  expect_extended_term_matches(
+      0, -1, super_resolution::OBSERVATION_ENCODING_UINT16);
+  expect_extended_term_matches(
+      0, 0, super_resolution::OBSERVATION_ENCODING_NONE);
+  expect_extended_term_matches(
+      1, 1, super_resolution::OBSERVATION_ENCODING_NONE);
+}
+
+// Checks the gradients of every evaluation strategy of the data term along
+// random directions on an image that is too large to differentiate one pixel
+// at a time. The term is quadratic, so central differences are exact for any
+// step, and a large step keeps the rounding of the costs out of the check.
+TEST(ObjectiveDataTerm, DirectionalGradientCheck) {
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, 0),
+    super_resolution::MotionShift(-1, 2)
+  });
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+
+  const cv::Size image_size(96, 64);
+  cv::Mat channel(image_size, CV_64FC1);
+  for (int row = 0; row < image_size.height; ++row) {
+    for (int col = 0; col < image_size.width; ++col) {
+      channel.at<double>(row, col) =
+          0.5 + 0.5 * std::sin(0.3 * row + 0.7 * col);
+    }
+  }
+  ImageData ground_truth;
+  ground_truth.AddChannel(channel);
+  ground_truth.AddChannel(1.0 - channel);
+  std::vector<ImageData> observations;
+  for (int i = 0; i < 3; ++i) {
+    observations.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+  const std::vector<double> estimate_data =
+      GetImageDataVector(ground_truth * 0.5);
+  const int num_parameters = estimate_data.size();
+
+  constexpr double kStep = 0.1;
+  constexpr double kDirectionalErrorTolerance = 1e-6;
+  const ObjectiveDataTerm data_term(
+      image_model, observations, 0, 2, image_size, 2);
+  EXPECT_LT(
+      ComputeDirectionalGradientError(
+          data_term, estimate_data.data(), num_parameters, 3, kStep),
+      kDirectionalErrorTolerance);
+
+  const ObjectiveDataTerm single_precision_data_term(
+      image_model,
+      observations,
+      0, 2,
+      image_size,
+      1,
+      super_resolution::SINGLE_PRECISION);
+  EXPECT_LT(
+      ComputeDirectionalGradientError(
+          single_precision_data_term,
+          estimate_data.data(),
+          num_parameters,
+          3,
+          kStep),
+      1e-4);
+
+  const std::shared_ptr<const super_resolution::CompiledImageModel>
+      compiled_image_model(new super_resolution::CompiledImageModel(
+          image_model.Compile(image_size, 3)));
+  const ObjectiveDataTerm compiled_data_term(
+      image_model,
+      observations,
+      0, 2,
+      image_size,
+      1,
+      super_resolution::DOUBLE_PRECISION,
+      compiled_image_model);
+  EXPECT_LT(
+      ComputeDirectionalGradientError(
+          compiled_data_term, estimate_data.data(), num_parameters, 3, kStep),
+      kDirectionalErrorTolerance);
+}
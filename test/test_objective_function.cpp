@@ -0,0 +1,538 @@
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "optimization/objective_function.h"
+#include "optimization/objective_irls_regularization_term.h"
+#include "optimization/numerical_gradient.h"
+#include "optimization/objective_workspace.h"
+#include "optimization/tv_regularizer.h"
+#include "util/memory_accounting.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ColoredDifferentiationOptions;
+using super_resolution::ObjectiveFunction;
+using super_resolution::ObjectiveIRLSRegularizationTerm;
+using super_resolution::ObjectiveWorkspace;
+using super_resolution::TotalVariationRegularizer;
+using super_resolution::util::GetMemoryUsage;
+using super_resolution::util::MEMORY_TAG_DATA_TERM;
+using super_resolution::util::MEMORY_TAG_REGULARIZER;
+using testing::DoubleNear;
+using testing::Pointwise;
+
+// Tolerance for gradients that are summed in a different order.
+constexpr double kGradientTolerance = 1.0e-12;
+
+// A TV regularizer that counts how many times the gradient is computed.
+class CountingRegularizer : public TotalVariationRegularizer {
+ public:
+  explicit CountingRegularizer(const cv::Size& image_size)
+      : TotalVariationRegularizer(image_size),
+        num_differentiation_calls(0) {}
+
+  using TotalVariationRegularizer::ApplyToImageWithDifferentiation;
+
+  virtual void ApplyToImageWithDifferentiation(
+      const double* image_data,
+      const std::vector<double>& gradient_constants,
+      const int num_channels,
+      std::vector<double>* residuals,
+      std::vector<double>* gradient) const {
+
+    num_differentiation_calls++;
+    TotalVariationRegularizer::ApplyToImageWithDifferentiation(
+        image_data, gradient_constants, num_channels, residuals, gradient);
+  }
+
+  virtual double AccumulateWeightedGradient(
+      const double* image_data,
+      const int num_channels,
+      const double regularization_parameter,
+      const double* weights,
+      double* gradient,
+      double* residuals) const {
+
+    num_differentiation_calls++;
+    return TotalVariationRegularizer::AccumulateWeightedGradient(
+        image_data,
+        num_channels,
+        regularization_parameter,
+        weights,
+        gradient,
+        residuals);
+  }
+
+  virtual double AccumulateWeightedGradientInRows(
+      const double* image_data,
+      const int num_channels,
+      const double regularization_parameter,
+      const double* weights,
+      const std::vector<uint8_t>* active_rows,
+      double* gradient,
+      double* residuals,
+      double* row_costs) const {
+
+    if (gradient != nullptr) {
+      num_differentiation_calls++;
+    }
+    return TotalVariationRegularizer::AccumulateWeightedGradientInRows(
+        image_data,
+        num_channels,
+        regularization_parameter,
+        weights,
+        active_rows,
+        gradient,
+        residuals,
+        row_costs);
+  }
+
+  mutable int num_differentiation_calls;
+};
+
+// Verifies that buffers returned to the workspace are reused.
+TEST(ObjectiveWorkspace, ReusesBuffers) {
+  ObjectiveWorkspace workspace;
+  EXPECT_EQ(workspace.GetNumAllocations(), 0);
+
+  {
+    ObjectiveWorkspace::ScratchBuffer buffer = workspace.GetScratchBuffer(10);
+    EXPECT_EQ(buffer.GetVector()->size(), 10);
+  }
+  EXPECT_EQ(workspace.GetNumAllocations(), 1);
+
+  // A smaller buffer fits in the returned one.
+  {
+    ObjectiveWorkspace::ScratchBuffer buffer = workspace.GetScratchBuffer(5);
+    EXPECT_EQ(buffer.GetVector()->size(), 5);
+  }
+  EXPECT_EQ(workspace.GetNumAllocations(), 1);
+
+  // Two buffers at the same time need a second allocation, but only once.
+  for (int i = 0; i < 3; ++i) {
+    ObjectiveWorkspace::ScratchBuffer buffer_1 = workspace.GetScratchBuffer(10);
+    ObjectiveWorkspace::ScratchBuffer buffer_2 = workspace.GetScratchBuffer(8);
+    EXPECT_NE(buffer_1.GetData(), buffer_2.GetData());
+  }
+  EXPECT_EQ(workspace.GetNumAllocations(), 2);
+
+  // Growing past the largest capacity is an allocation.
+  {
+    ObjectiveWorkspace::ScratchBuffer buffer = workspace.GetScratchBuffer(20);
+  }
+  EXPECT_EQ(workspace.GetNumAllocations(), 3);
+}
+
+// Verifies that the memory of the buffers is recorded under the tag of their
+// last borrower until the workspace is destroyed.
+TEST(ObjectiveWorkspace, RecordsMemoryUsage) {
+  const int64_t initial_data_term_bytes =
+      GetMemoryUsage(MEMORY_TAG_DATA_TERM).current_bytes;
+  const int64_t initial_regularizer_bytes =
+      GetMemoryUsage(MEMORY_TAG_REGULARIZER).current_bytes;
+  {
+    ObjectiveWorkspace workspace;
+    {
+      ObjectiveWorkspace::ScratchBuffer buffer =
+          workspace.GetScratchBuffer(100, MEMORY_TAG_DATA_TERM);
+    }
+    EXPECT_GE(GetMemoryUsage(MEMORY_TAG_DATA_TERM).current_bytes,
+              initial_data_term_bytes + 800);
+
+    // The regularizer reuses the buffer.
+    {
+      ObjectiveWorkspace::ScratchBuffer buffer =
+          workspace.GetScratchBuffer(50, MEMORY_TAG_REGULARIZER);
+    }
+    EXPECT_EQ(GetMemoryUsage(MEMORY_TAG_DATA_TERM).current_bytes,
+              initial_data_term_bytes);
+    EXPECT_GE(GetMemoryUsage(MEMORY_TAG_REGULARIZER).current_bytes,
+              initial_regularizer_bytes + 800);
+  }
+  EXPECT_EQ(GetMemoryUsage(MEMORY_TAG_REGULARIZER).current_bytes,
+            initial_regularizer_bytes);
+}
+
+// Verifies that repeated evaluations of an objective function do not allocate
+// any new scratch buffers after the first evaluation.
+TEST(ObjectiveFunction, SteadyStateEvaluationsDoNotAllocate) {
+  const cv::Size image_size(8, 6);
+  const int num_channels = 2;
+  const int num_parameters = image_size.area() * num_channels;
+
+  std::vector<double> image_data(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = static_cast<double>((i * 7) % 11) / 10.0;
+  }
+  const std::vector<double> irls_weights(num_parameters, 0.5);
+
+  std::shared_ptr<TotalVariationRegularizer> regularizer(
+      new TotalVariationRegularizer(image_size));
+  ObjectiveFunction objective_function(num_parameters);
+  objective_function.AddTerm(std::shared_ptr<ObjectiveIRLSRegularizationTerm>(
+      new ObjectiveIRLSRegularizationTerm(
+          regularizer, 0.1, irls_weights, num_channels, image_size)));
+
+  std::vector<double> gradient(num_parameters);
+  const double cost = objective_function.ComputeAllTerms(
+      image_data.data(), gradient.data());
+  const int num_allocations =
+      objective_function.GetWorkspace().GetNumAllocations();
+  EXPECT_GT(num_allocations, 0);
+
+  for (int i = 0; i < 5; ++i) {
+    std::vector<double> repeated_gradient(num_parameters);
+    EXPECT_EQ(
+        objective_function.ComputeAllTerms(
+            image_data.data(), repeated_gradient.data()),
+        cost);
+    EXPECT_EQ(repeated_gradient, gradient);
+    objective_function.ComputeAllTerms(image_data.data());
+  }
+  EXPECT_EQ(
+      objective_function.GetWorkspace().GetNumAllocations(), num_allocations);
+
+  // Copies of the objective function share the same workspace.
+  const ObjectiveFunction objective_function_copy = objective_function;
+  objective_function_copy.ComputeAllTerms(image_data.data(), gradient.data());
+  EXPECT_EQ(
+      objective_function_copy.GetWorkspace().GetNumAllocations(),
+      num_allocations);
+}
+
+// Verifies that cost-only evaluations of the IRLS regularization term skip
+// the gradient computation but return the same cost.
+TEST(ObjectiveIRLSRegularizationTerm, CostOnlyEvaluation) {
+  const cv::Size image_size(5, 7);
+  const int num_channels = 3;
+  const int num_parameters = image_size.area() * num_channels;
+
+  std::vector<double> image_data(num_parameters);
+  std::vector<double> irls_weights(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = static_cast<double>((i * 5) % 13) / 12.0;
+    irls_weights[i] = 1.0 / (1.0 + (i % 4));
+  }
+
+  std::shared_ptr<CountingRegularizer> regularizer(
+      new CountingRegularizer(image_size));
+  regularizer->SetUse3dTotalVariation(true);
+  const ObjectiveIRLSRegularizationTerm regularization_term(
+      regularizer, 0.25, irls_weights, num_channels, image_size);
+
+  std::vector<double> gradient(num_parameters, 0.0);
+  const double cost_with_gradient =
+      regularization_term.Compute(image_data.data(), gradient.data());
+  EXPECT_EQ(regularizer->num_differentiation_calls, 1);
+
+  const double cost_only = regularization_term.Compute(
+      image_data.data(), nullptr);
+  EXPECT_EQ(regularizer->num_differentiation_calls, 1);
+  EXPECT_DOUBLE_EQ(cost_only, cost_with_gradient);
+}
+
+// Verifies that updating the IRLS weights in place is reflected by an
+// existing term, the same as if the term was created with the new weights.
+TEST(ObjectiveIRLSRegularizationTerm, WeightsUpdatedInPlace) {
+  const cv::Size image_size(6, 4);
+  const int num_channels = 2;
+  const int num_parameters = image_size.area() * num_channels;
+
+  std::vector<double> image_data(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = static_cast<double>((i * 3) % 7) / 6.0;
+  }
+  std::vector<double> irls_weights(num_parameters, 1.0);
+
+  std::shared_ptr<TotalVariationRegularizer> regularizer(
+      new TotalVariationRegularizer(image_size));
+  const ObjectiveIRLSRegularizationTerm regularization_term(
+      regularizer, 0.5, irls_weights, num_channels, image_size);
+  regularization_term.Compute(image_data.data(), nullptr);
+
+  for (int i = 0; i < num_parameters; ++i) {
+    irls_weights[i] = 1.0 / (2.0 + (i % 3));
+  }
+  const std::vector<double> updated_weights = irls_weights;
+  const ObjectiveIRLSRegularizationTerm new_regularization_term(
+      regularizer, 0.5, updated_weights, num_channels, image_size);
+
+  std::vector<double> gradient(num_parameters, 0.0);
+  std::vector<double> expected_gradient(num_parameters, 0.0);
+  EXPECT_EQ(
+      regularization_term.Compute(image_data.data(), gradient.data()),
+      new_regularization_term.Compute(
+          image_data.data(), expected_gradient.data()));
+  EXPECT_EQ(gradient, expected_gradient);
+}
+
+// Verifies that the term keeps the regularizer values of its last evaluation
+// if enabled, which are the values of the regularizer at that estimate.
+TEST(ObjectiveIRLSRegularizationTerm, KeepLastResiduals) {
+  const cv::Size image_size(6, 5);
+  const int num_channels = 2;
+  const int num_parameters = image_size.area() * num_channels;
+
+  std::vector<double> image_data(num_parameters);
+  std::vector<double> other_image_data(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = static_cast<double>((i * 5) % 9) / 8.0;
+    other_image_data[i] = static_cast<double>((i * 2) % 7) / 6.0;
+  }
+  const std::vector<double> irls_weights(num_parameters, 0.5);
+
+  std::shared_ptr<TotalVariationRegularizer> regularizer(
+      new TotalVariationRegularizer(image_size));
+  ObjectiveIRLSRegularizationTerm regularization_term(
+      regularizer, 0.1, irls_weights, num_channels, image_size);
+  regularization_term.Compute(image_data.data(), nullptr);
+  EXPECT_EQ(regularization_term.GetLastResiduals(), nullptr);
+
+  regularization_term.SetKeepLastResiduals(true);
+  EXPECT_EQ(regularization_term.GetLastResiduals(), nullptr);
+
+  // The values of the latest evaluation are kept, with or without gradient.
+  std::vector<double> gradient(num_parameters, 0.0);
+  regularization_term.Compute(other_image_data.data(), gradient.data());
+  regularization_term.Compute(image_data.data(), gradient.data());
+  ASSERT_NE(regularization_term.GetLastResiduals(), nullptr);
+  EXPECT_EQ(
+      *regularization_term.GetLastResiduals(),
+      regularizer->ApplyToImage(image_data.data(), num_channels));
+
+  regularization_term.Compute(other_image_data.data(), nullptr);
+  ASSERT_NE(regularization_term.GetLastResiduals(), nullptr);
+  EXPECT_EQ(
+      *regularization_term.GetLastResiduals(),
+      regularizer->ApplyToImage(other_image_data.data(), num_channels));
+}
+
+// Verifies that evaluating the terms concurrently gives exactly the same cost
+// and gradient as evaluating them one after another.
+TEST(ObjectiveFunction, ConcurrentTermEvaluation) {
+  const cv::Size image_size(9, 7);
+  const int num_channels = 2;
+  const int num_parameters = image_size.area() * num_channels;
+
+  std::vector<double> image_data(num_parameters);
+  std::vector<double> irls_weights(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = static_cast<double>((i * 7) % 13) / 12.0;
+    irls_weights[i] = 1.0 / (1.0 + (i % 5));
+  }
+
+  std::shared_ptr<TotalVariationRegularizer> regularizer(
+      new TotalVariationRegularizer(image_size));
+  std::shared_ptr<TotalVariationRegularizer> regularizer_3d(
+      new TotalVariationRegularizer(image_size));
+  regularizer_3d->SetUse3dTotalVariation(true);
+  ObjectiveFunction objective_function(num_parameters);
+  objective_function.AddTerm(std::shared_ptr<ObjectiveIRLSRegularizationTerm>(
+      new ObjectiveIRLSRegularizationTerm(
+          regularizer, 0.1, irls_weights, num_channels, image_size)));
+  objective_function.AddTerm(std::shared_ptr<ObjectiveIRLSRegularizationTerm>(
+      new ObjectiveIRLSRegularizationTerm(
+          regularizer_3d, 0.3, irls_weights, num_channels, image_size)));
+  objective_function.AddTerm(std::shared_ptr<ObjectiveIRLSRegularizationTerm>(
+      new ObjectiveIRLSRegularizationTerm(
+          regularizer, 0.05, irls_weights, num_channels, image_size)));
+  EXPECT_EQ(objective_function.GetNumTerms(), 3);
+
+  std::vector<double> gradient(num_parameters);
+  const double cost = objective_function.ComputeAllTerms(
+      image_data.data(), gradient.data());
+  const double cost_only = objective_function.ComputeAllTerms(
+      image_data.data());
+
+  for (const int num_threads : {2, 3, 8}) {
+    objective_function.SetNumThreads(num_threads);
+    std::vector<double> concurrent_gradient(num_parameters, 1.0);
+    EXPECT_EQ(
+        objective_function.ComputeAllTerms(
+            image_data.data(), concurrent_gradient.data()),
+        cost);
+    // The regularizers add their partial derivatives directly into the
+    // gradient they are given, so the sums are rounded in a different order
+    // than when the term gradients are summed after a concurrent evaluation.
+    EXPECT_THAT(
+        concurrent_gradient,
+        Pointwise(DoubleNear(kGradientTolerance), gradient));
+    EXPECT_EQ(objective_function.ComputeAllTerms(image_data.data()), cost_only);
+  }
+}
+
+// Verifies that the gradient of frozen parameters is zero, both when the terms
+// are evaluated one after another and concurrently, and that the cost and the
+// other gradient values do not change.
+TEST(ObjectiveFunction, FrozenParameters) {
+  const cv::Size image_size(6, 5);
+  const int num_parameters = image_size.area();
+
+  std::vector<double> image_data(num_parameters);
+  std::vector<double> irls_weights(num_parameters, 1.0);
+  std::vector<uint8_t> frozen_parameters(num_parameters, 0);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = static_cast<double>((i * 5) % 11) / 10.0;
+    frozen_parameters[i] = (i % 3 == 0);
+  }
+
+  std::shared_ptr<TotalVariationRegularizer> regularizer(
+      new TotalVariationRegularizer(image_size));
+  ObjectiveFunction objective_function(num_parameters);
+  for (const double regularization_parameter : {0.1, 0.2}) {
+    objective_function.AddTerm(
+        std::shared_ptr<ObjectiveIRLSRegularizationTerm>(
+            new ObjectiveIRLSRegularizationTerm(
+                regularizer, regularization_parameter, irls_weights, 1,
+                image_size)));
+  }
+  std::vector<double> gradient(num_parameters);
+  const double cost = objective_function.ComputeAllTerms(
+      image_data.data(), gradient.data());
+
+  objective_function.SetFrozenParameters(&frozen_parameters);
+  for (const int num_threads : {1, 2}) {
+    objective_function.SetNumThreads(num_threads);
+    std::vector<double> frozen_gradient(num_parameters);
+    EXPECT_EQ(
+        objective_function.ComputeAllTerms(
+            image_data.data(), frozen_gradient.data()),
+        cost);
+    for (int i = 0; i < num_parameters; ++i) {
+      if (frozen_parameters[i]) {
+        EXPECT_EQ(frozen_gradient[i], 0.0);
+      } else {
+        EXPECT_NEAR(frozen_gradient[i], gradient[i], kGradientTolerance);
+      }
+    }
+  }
+}
+
+// Verifies that the IRLS regularization terms only evaluate the rows next to
+// parameters that are not frozen, and that the cached values of the other rows
+// give the cost and gradient of a full evaluation until the mask is set again.
+TEST(ObjectiveFunction, FrozenRowsAreCached) {
+  const cv::Size image_size(6, 8);
+  const int num_parameters = image_size.area();
+  const int first_active_row = 5;
+
+  std::vector<double> image_data(num_parameters);
+  std::vector<double> irls_weights(num_parameters);
+  std::vector<uint8_t> frozen_parameters(num_parameters, 0);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = static_cast<double>((i * 5) % 11) / 10.0;
+    irls_weights[i] = 1.0 + static_cast<double>(i % 4) / 4.0;
+    frozen_parameters[i] = (i < first_active_row * image_size.width);
+  }
+
+  std::shared_ptr<TotalVariationRegularizer> regularizer(
+      new TotalVariationRegularizer(image_size));
+  const std::shared_ptr<ObjectiveIRLSRegularizationTerm> term(
+      new ObjectiveIRLSRegularizationTerm(
+          regularizer, 0.1, irls_weights, 1, image_size));
+  ObjectiveFunction objective_function(num_parameters);
+  objective_function.AddTerm(term);
+  objective_function.SetFrozenParameters(&frozen_parameters);
+  std::vector<double> gradient(num_parameters);
+  objective_function.ComputeAllTerms(image_data.data(), gradient.data());
+
+  // Only move the active parameters, as the solvers do.
+  for (int i = first_active_row * image_size.width; i < num_parameters; ++i) {
+    image_data[i] += 0.05 * (i % 3);
+  }
+  ObjectiveFunction full_objective_function(num_parameters);
+  full_objective_function.AddTerm(
+      std::shared_ptr<ObjectiveIRLSRegularizationTerm>(
+          new ObjectiveIRLSRegularizationTerm(
+              regularizer, 0.1, irls_weights, 1, image_size)));
+  std::vector<double> expected_gradient(num_parameters);
+  const double expected_cost = full_objective_function.ComputeAllTerms(
+      image_data.data(), expected_gradient.data());
+  EXPECT_NEAR(
+      objective_function.ComputeAllTerms(image_data.data(), gradient.data()),
+      expected_cost,
+      kGradientTolerance);
+  EXPECT_NEAR(
+      objective_function.ComputeAllTerms(image_data.data()),
+      expected_cost,
+      kGradientTolerance);
+  for (int i = 0; i < num_parameters; ++i) {
+    if (frozen_parameters[i]) {
+      EXPECT_EQ(gradient[i], 0.0);
+    } else {
+      EXPECT_NEAR(gradient[i], expected_gradient[i], kGradientTolerance);
+    }
+  }
+
+  // Changing the weights of frozen rows requires setting the mask again.
+  irls_weights[0] = 5.0;
+  const double reweighted_cost =
+      full_objective_function.ComputeAllTerms(image_data.data());
+  objective_function.SetFrozenParameters(&frozen_parameters);
+  EXPECT_NEAR(
+      objective_function.ComputeAllTerms(image_data.data()),
+      reweighted_cost,
+      kGradientTolerance);
+}
+
+// Verifies that the colored numerical gradient matches the analytical
+// gradient of 2D and 3D TV terms, and that the local costs of the terms add
+// up to the cost.
+TEST(ObjectiveFunction, ColoredNumericalGradient) {
+  const cv::Size image_size(23, 17);
+  const int num_channels = 3;
+  const int num_parameters = image_size.area() * num_channels;
+
+  std::vector<double> image_data(num_parameters);
+  std::vector<double> irls_weights(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = std::sin(1.3 * i) + 0.01 * (i % 17);
+    irls_weights[i] = 1.0 / (1.0 + (i % 5));
+  }
+
+  std::shared_ptr<TotalVariationRegularizer> regularizer(
+      new TotalVariationRegularizer(image_size));
+  std::shared_ptr<TotalVariationRegularizer> regularizer_3d(
+      new TotalVariationRegularizer(image_size));
+  regularizer_3d->SetUse3dTotalVariation(true);
+  ObjectiveFunction objective_function(num_parameters);
+  objective_function.AddTerm(std::shared_ptr<ObjectiveIRLSRegularizationTerm>(
+      new ObjectiveIRLSRegularizationTerm(
+          regularizer, 0.1, irls_weights, num_channels, image_size)));
+  objective_function.AddTerm(std::shared_ptr<ObjectiveIRLSRegularizationTerm>(
+      new ObjectiveIRLSRegularizationTerm(
+          regularizer_3d, 0.3, irls_weights, num_channels, image_size)));
+
+  std::vector<double> gradient(num_parameters);
+  const double cost = objective_function.ComputeAllTerms(
+      image_data.data(), gradient.data());
+  std::vector<double> local_costs(num_parameters);
+  EXPECT_TRUE(objective_function.ComputeLocalCosts(
+      image_data.data(), local_costs.data()));
+  double local_cost_sum = 0.0;
+  for (const double local_cost : local_costs) {
+    local_cost_sum += local_cost;
+  }
+  EXPECT_NEAR(local_cost_sum, cost, 1e-9);
+
+  ColoredDifferentiationOptions options;
+  options.spatial_radius = 1;
+  options.channel_radius = 1;
+  for (const int num_threads : {1, 4}) {
+    options.num_threads = num_threads;
+    std::vector<double> numerical_gradient;
+    EXPECT_TRUE(super_resolution::ComputeColoredNumericalGradient(
+        objective_function,
+        image_data.data(),
+        image_size,
+        num_channels,
+        options,
+        &numerical_gradient));
+    EXPECT_THAT(numerical_gradient, Pointwise(DoubleNear(1e-6), gradient));
+  }
+}
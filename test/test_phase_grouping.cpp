@@ -0,0 +1,154 @@
+#include <cmath>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
+#include "motion/phase_grouping.h"
+#include "optimization/objective_data_term.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::ImageModel;
+using super_resolution::MotionShift;
+using super_resolution::MotionShiftSequence;
+using super_resolution::ObjectiveDataTerm;
+using super_resolution::PhaseGroupedObservations;
+
+using testing::ElementsAre;
+
+constexpr double kErrorTolerance = 1e-9;
+
+// Returns a single-channel LR test image of the given size whose pixel values
+// depend on the seed.
+ImageData GetTestImage(const cv::Size& image_size, const int seed) {
+  cv::Mat channel(image_size, CV_64FC1);
+  for (int row = 0; row < image_size.height; ++row) {
+    for (int col = 0; col < image_size.width; ++col) {
+      channel.at<double>(row, col) =
+          0.5 + 0.4 * std::sin(seed + 0.7 * row + 1.3 * col);
+    }
+  }
+  ImageData image;
+  image.AddChannel(channel, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  return image;
+}
+
+// Verifies that frames are grouped by their sub-pixel phase modulo the scale,
+// and that the merged observations are the aligned averages scaled by the
+// square roots of their weights.
+TEST(PhaseGrouping, GroupObservationsByPhase) {
+  const cv::Size image_size(4, 3);
+  const MotionShiftSequence motion_sequence({
+    MotionShift(0, 0),
+    MotionShift(0, 0),
+    MotionShift(1, 0),
+    MotionShift(0.5, 0.5),
+    MotionShift(2.5, 0.5)  // Same phase as (0.5, 0.5), one LR pixel right.
+  });
+  std::vector<ImageData> frames;
+  for (int i = 0; i < motion_sequence.GetNumMotionShifts(); ++i) {
+    frames.push_back(GetTestImage(image_size, i));
+  }
+
+  const PhaseGroupedObservations grouped =
+      super_resolution::GroupObservationsByPhase(
+          frames, motion_sequence, 2, 4);
+  ASSERT_EQ(grouped.observations.size(), 3);
+  EXPECT_THAT(grouped.weights, ElementsAre(2.0, 1.0, 2.0));
+  EXPECT_THAT(grouped.frame_groups, ElementsAre(0, 0, 1, 2, 2));
+  ASSERT_EQ(grouped.motion_sequence.GetNumMotionShifts(), 3);
+  EXPECT_EQ(grouped.motion_sequence[2].dx, 0.5);
+  EXPECT_EQ(grouped.motion_sequence[2].dy, 0.5);
+
+  const cv::Mat first_group = grouped.observations[0].GetChannelImage(0);
+  const cv::Mat second_group = grouped.observations[1].GetChannelImage(0);
+  const cv::Mat third_group = grouped.observations[2].GetChannelImage(0);
+  for (int row = 0; row < image_size.height; ++row) {
+    for (int col = 0; col < image_size.width; ++col) {
+      const auto get_frame_value = [&](const int frame, const int frame_col) {
+        return frames[frame].GetChannelImage(0).at<double>(row, frame_col);
+      };
+      EXPECT_NEAR(
+          first_group.at<double>(row, col),
+          std::sqrt(2.0) * 0.5 *
+              (get_frame_value(0, col) + get_frame_value(1, col)),
+          kErrorTolerance);
+      EXPECT_NEAR(
+          second_group.at<double>(row, col),
+          get_frame_value(2, col),
+          kErrorTolerance);
+      // The last column is only covered by the first frame of the group.
+      const double expected_third_value = (col + 1 < image_size.width) ?
+          std::sqrt(2.0) * 0.5 *
+              (get_frame_value(3, col) + get_frame_value(4, col + 1)) :
+          std::sqrt(2.0) * get_frame_value(3, col);
+      EXPECT_NEAR(
+          third_group.at<double>(row, col),
+          expected_third_value,
+          kErrorTolerance);
+    }
+  }
+}
+
+// Verifies that merging frames with identical shifts leaves the gradient of
+// the data term unchanged, and the cost unchanged up to a constant.
+TEST(PhaseGrouping, WeightedDataTermMatchesFrames) {
+  const cv::Size low_res_size(3, 2);
+  const cv::Size high_res_size(6, 4);
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.blur_radius = 3;
+  model_parameters.blur_sigma = 1.0;
+  model_parameters.motion_sequence = MotionShiftSequence({
+    MotionShift(0, 0),
+    MotionShift(1, 1),
+    MotionShift(0, 0)
+  });
+  const ImageModel image_model =
+      ImageModel::CreateImageModel(model_parameters);
+  std::vector<ImageData> frames;
+  for (int i = 0; i < 3; ++i) {
+    frames.push_back(GetTestImage(low_res_size, i));
+  }
+
+  const PhaseGroupedObservations grouped =
+      super_resolution::GroupObservationsByPhase(
+          frames, model_parameters.motion_sequence, 2, 4);
+  ASSERT_EQ(grouped.observations.size(), 2);
+  super_resolution::ImageModelParameters grouped_model_parameters =
+      model_parameters;
+  grouped_model_parameters.motion_sequence = grouped.motion_sequence;
+  grouped_model_parameters.observation_weights = grouped.weights;
+  const ImageModel grouped_image_model =
+      ImageModel::CreateImageModel(grouped_model_parameters);
+
+  const ObjectiveDataTerm data_term(
+      image_model, frames, 0, 1, high_res_size);
+  const ObjectiveDataTerm grouped_data_term(
+      grouped_image_model, grouped.observations, 0, 1, high_res_size);
+
+  const int num_parameters = high_res_size.area();
+  std::vector<double> cost_differences;
+  for (const double estimate_scale : {0.5, 1.5}) {
+    std::vector<double> estimate(num_parameters);
+    for (int i = 0; i < num_parameters; ++i) {
+      estimate[i] = estimate_scale * std::cos(0.4 * i);
+    }
+    std::vector<double> gradient(num_parameters, 0.0);
+    std::vector<double> grouped_gradient(num_parameters, 0.0);
+    const double cost = data_term.Compute(estimate.data(), gradient.data());
+    const double grouped_cost = grouped_data_term.Compute(
+        estimate.data(), grouped_gradient.data());
+    for (int i = 0; i < num_parameters; ++i) {
+      EXPECT_NEAR(grouped_gradient[i], gradient[i], kErrorTolerance);
+    }
+    cost_differences.push_back(cost - grouped_cost);
+  }
+  EXPECT_GT(cost_differences[0], 0.0);
+  EXPECT_NEAR(cost_differences[0], cost_differences[1], kErrorTolerance);
+}
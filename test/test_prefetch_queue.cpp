@@ -0,0 +1,88 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "util/prefetch_queue.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::util::PrefetchQueue;
+
+// Verifies that the items are returned in order, even when they are loaded
+// concurrently and finish out of order.
+TEST(PrefetchQueue, ReturnsItemsInOrder) {
+  const int num_items = 50;
+  PrefetchQueue<std::vector<int>> queue(
+      num_items,
+      [](const int item_index) {
+        // Make later items (of every group of 3) finish earlier.
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(100 * (3 - item_index % 3)));
+        return std::vector<int>(3, item_index);
+      },
+      4,   // Threads.
+      4);  // Prefetched items.
+
+  for (int item_index = 0; item_index < num_items; ++item_index) {
+    ASSERT_TRUE(queue.HasNext());
+    EXPECT_EQ(queue.GetNext(), std::vector<int>(3, item_index));
+  }
+  EXPECT_FALSE(queue.HasNext());
+}
+
+// Verifies that the loaders never get more than the allowed number of items
+// ahead of the consumer.
+TEST(PrefetchQueue, BoundsPrefetchedItems) {
+  const int num_items = 20;
+  const int max_num_prefetched = 2;
+  std::atomic<int> num_items_consumed(0);
+  std::atomic<int> max_num_ahead(0);
+  PrefetchQueue<int> queue(
+      num_items,
+      [&num_items_consumed, &max_num_ahead](const int item_index) {
+        // The consumed count below is only updated after GetNext() returns,
+        // so it may lag behind the queue by one item.
+        const int num_ahead = item_index - num_items_consumed.load();
+        int previous_max = max_num_ahead.load();
+        while (num_ahead > previous_max &&
+               !max_num_ahead.compare_exchange_weak(previous_max, num_ahead)) {
+        }
+        return item_index;
+      },
+      3,
+      max_num_prefetched);
+
+  while (queue.HasNext()) {
+    // Give the loaders time to run ahead as far as they can.
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(queue.GetNext(), num_items_consumed.load());
+    num_items_consumed++;
+  }
+  EXPECT_LE(max_num_ahead.load(), max_num_prefetched);
+}
+
+// Verifies that a queue can be destroyed before all items are consumed, and
+// that an empty queue works.
+TEST(PrefetchQueue, EarlyDestructionAndEmptyQueue) {
+  std::atomic<int> num_items_loaded(0);
+  {
+    PrefetchQueue<int> queue(
+        1000,
+        [&num_items_loaded](const int item_index) {
+          num_items_loaded++;
+          return item_index;
+        },
+        2,
+        2);
+    EXPECT_EQ(queue.GetNext(), 0);
+  }
+  EXPECT_LT(num_items_loaded.load(), 1000);
+
+  PrefetchQueue<int> empty_queue(0, [](const int item_index) {
+    ADD_FAILURE() << "No item should be loaded.";
+    return item_index;
+  });
+  EXPECT_FALSE(empty_queue.HasNext());
+}
@@ -0,0 +1,92 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "image/image_data.h"
+#include "util/preprocessing_cache.h"
+#include "util/util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::util::GetAbsoluteCodePath;
+using super_resolution::util::PreprocessingCache;
+using super_resolution::util::PreprocessingCacheKey;
+
+static const std::string kTestCacheDirectory =
+    GetAbsoluteCodePath("test_data/test_tmp_dir/preprocessing_cache_test");
+static const std::string kTestInputFilePath =
+    GetAbsoluteCodePath("test_data/test_tmp_dir/preprocessing_cache_input");
+
+// Writes the given text into the test input file.
+void WriteTestInputFile(const std::string& contents) {
+  std::ofstream file(kTestInputFilePath, std::ios::trunc);
+  file << contents;
+}
+
+// Returns the entry name of a key for the test input file and the value.
+std::string GetTestEntryName(const double value) {
+  PreprocessingCacheKey key("stage");
+  key.AddFileContents(kTestInputFilePath);
+  key.AddValue("value", value);
+  return key.GetEntryName();
+}
+
+// Verifies that keys change with the stage, the file contents and the values,
+// and only with them.
+TEST(PreprocessingCache, KeysDependOnContentsAndValues) {
+  WriteTestInputFile("first contents");
+  const std::string entry_name = GetTestEntryName(0.1);
+  EXPECT_EQ(entry_name.find("stage-"), 0);
+  EXPECT_EQ(GetTestEntryName(0.1), entry_name);
+  EXPECT_NE(GetTestEntryName(0.1 + 1e-12), entry_name);
+
+  PreprocessingCacheKey other_stage_key("other_stage");
+  other_stage_key.AddFileContents(kTestInputFilePath);
+  other_stage_key.AddValue("value", 0.1);
+  EXPECT_NE(other_stage_key.GetEntryName().substr(12), entry_name.substr(6));
+
+  WriteTestInputFile("second contents");
+  EXPECT_NE(GetTestEntryName(0.1), entry_name);
+  WriteTestInputFile("first contents");
+  EXPECT_EQ(GetTestEntryName(0.1), entry_name);
+}
+
+// Verifies that cached images are loaded exactly, and that missing entries
+// are not found.
+TEST(PreprocessingCache, SaveAndLoad) {
+  const PreprocessingCache cache(kTestCacheDirectory);
+  PreprocessingCacheKey key("images");
+  key.AddValue("test", "SaveAndLoad");
+
+  std::vector<ImageData> images;
+  for (int i = 0; i < 3; ++i) {
+    std::vector<double> pixels(4 * 3 * 5);
+    for (int j = 0; j < pixels.size(); ++j) {
+      pixels[j] = 0.01 * j + i;
+    }
+    images.emplace_back(pixels.data(), cv::Size(4, 3), 5);
+  }
+  EXPECT_TRUE(cache.Save(key, images));
+  // Saving an existing entry keeps it.
+  EXPECT_TRUE(cache.Save(key, images));
+
+  std::vector<ImageData> loaded_images;
+  ASSERT_TRUE(cache.Load(key, &loaded_images));
+  ASSERT_EQ(loaded_images.size(), images.size());
+  for (int i = 0; i < images.size(); ++i) {
+    ASSERT_EQ(loaded_images[i].GetNumChannels(), 5);
+    for (int channel = 0; channel < 5; ++channel) {
+      EXPECT_EQ(cv::norm(loaded_images[i].GetChannelImage(channel),
+                         images[i].GetChannelImage(channel),
+                         cv::NORM_INF), 0.0);
+    }
+  }
+
+  PreprocessingCacheKey missing_key("images");
+  missing_key.AddValue("test", "Missing");
+  EXPECT_FALSE(cache.Load(missing_key, &loaded_images));
+}
@@ -0,0 +1,120 @@
+#include <vector>
+
+#include "image/image_data.h"
+#include "util/preview_pyramid.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::util::BandStatistics;
+using super_resolution::util::PreviewPyramid;
+using super_resolution::util::PreviewPyramidOptions;
+
+// Returns a hyperspectral test image whose values range from offset to
+// offset + range, including values outside of [0, 1] if requested.
+ImageData MakeTestImage(
+    const cv::Size& size,
+    const int num_bands,
+    const double offset,
+    const double range) {
+
+  std::vector<double> pixels(size.area() * num_bands);
+  cv::RNG random_number_generator(7);
+  for (double& pixel : pixels) {
+    pixel = offset + random_number_generator.uniform(0.0, range);
+  }
+  return ImageData(pixels.data(), size, num_bands);
+}
+
+// Verifies that the full resolution rendering is the visualization image, and
+// that coarser renderings are area averages of it.
+TEST(PreviewPyramid, RendersVisualizationImage) {
+  const cv::Size size(100, 80);
+  const ImageData image = MakeTestImage(size, 5, -0.2, 1.4);
+  PreviewPyramidOptions options;
+  options.tile_size = 16;
+  PreviewPyramid pyramid(image, options);
+  EXPECT_EQ(pyramid.GetNumLevels(), 4);  // 100, 50, 25 and 13 pixels wide.
+
+  const cv::Mat visualization_image = image.GetVisualizationImage();
+  const cv::Rect full_region(cv::Point(0, 0), size);
+  EXPECT_EQ(cv::norm(pyramid.Render(full_region, size), visualization_image,
+                     cv::NORM_INF), 0.0);
+
+  const cv::Size half_size(50, 40);
+  cv::Mat expected_half_image;
+  cv::resize(visualization_image, expected_half_image, half_size, 0, 0,
+             cv::INTER_AREA);
+  EXPECT_LE(cv::norm(pyramid.Render(full_region, half_size),
+                     expected_half_image, cv::NORM_INF), 1.0);
+
+  const cv::Rect region(30, 20, 40, 30);
+  EXPECT_EQ(cv::norm(pyramid.Render(region, region.size()),
+                     visualization_image(region), cv::NORM_INF), 0.0);
+}
+
+// Verifies that only the tiles of the rendered region are decoded, and that
+// decoded tiles are reused until they are evicted.
+TEST(PreviewPyramid, DecodesOnlyRenderedTiles) {
+  const cv::Size size(100, 80);
+  const ImageData image = MakeTestImage(size, 5, 0.0, 1.0);
+  PreviewPyramidOptions options;
+  options.tile_size = 16;
+  PreviewPyramid pyramid(image, options);
+
+  const cv::Rect region(20, 20, 10, 10);  // Inside of a single tile.
+  pyramid.Render(region, region.size());
+  EXPECT_EQ(pyramid.GetNumDecodedTiles(), 1);
+  pyramid.Render(region, cv::Size(40, 40));
+  EXPECT_EQ(pyramid.GetNumDecodedTiles(), 1);
+
+  // The overview at a quarter of the size needs every tile once.
+  pyramid.Render(cv::Rect(cv::Point(0, 0), size), cv::Size(25, 20));
+  EXPECT_EQ(pyramid.GetNumDecodedTiles(), 7 * 5);
+  pyramid.Render(cv::Rect(cv::Point(0, 0), size), cv::Size(25, 20));
+  EXPECT_EQ(pyramid.GetNumDecodedTiles(), 7 * 5);
+
+  // Without room in the cache, tiles are decoded again.
+  options.max_cache_bytes = 1;
+  PreviewPyramid uncached_pyramid(image, options);
+  uncached_pyramid.Render(region, region.size());
+  uncached_pyramid.Render(cv::Rect(0, 0, 10, 10), region.size());
+  uncached_pyramid.Render(region, region.size());
+  EXPECT_EQ(uncached_pyramid.GetNumDecodedTiles(), 3);
+}
+
+// Verifies the band statistics, and that stretched bands span the full
+// display range.
+TEST(PreviewPyramid, StretchesBands) {
+  const cv::Size size(40, 30);
+  const ImageData image = MakeTestImage(size, 5, 100.0, 400.0);
+  PreviewPyramidOptions options;
+  options.stretch_bands = true;
+  PreviewPyramid pyramid(image, options);
+
+  for (int band = 0; band < 5; ++band) {
+    double min_value;
+    double max_value;
+    cv::minMaxLoc(image.GetChannelImage(band), &min_value, &max_value);
+    const BandStatistics statistics = pyramid.GetBandStatistics(band);
+    EXPECT_EQ(statistics.min_value, min_value);
+    EXPECT_EQ(statistics.max_value, max_value);
+  }
+
+  const cv::Mat rendered_image =
+      pyramid.Render(cv::Rect(cv::Point(0, 0), size), size);
+  std::vector<cv::Mat> rendered_channels;
+  cv::split(rendered_image, rendered_channels);
+  ASSERT_EQ(rendered_channels.size(), 3);
+  for (const cv::Mat& rendered_channel : rendered_channels) {
+    double min_value;
+    double max_value;
+    cv::minMaxLoc(rendered_channel, &min_value, &max_value);
+    EXPECT_EQ(min_value, 0.0);
+    EXPECT_EQ(max_value, 255.0);
+  }
+}
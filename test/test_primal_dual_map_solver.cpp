@@ -0,0 +1,117 @@
+#include <memory>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
+#include "optimization/primal_dual_map_solver.h"
+#include "optimization/btv_regularizer.h"
+#include "optimization/tv_regularizer.h"
+#include "util/test_util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::test::AreMatricesEqual;
+
+constexpr bool kPrintSolverOutput = false;
+constexpr double kSolverResultErrorTolerance = 0.001;
+constexpr double kRegularizedResultErrorTolerance = 0.01;
+
+namespace {
+
+// Returns the low-res images of the same small, "perfect" data set that is
+// used in the MapSolver tests. The ground truth is given by
+// GetSmallDataGroundTruth() below.
+std::vector<ImageData> GetSmallDataLowResImages() {
+  const std::vector<double> lr_values = {0.4, 0.2, 0.0, 1.0};
+  std::vector<ImageData> low_res_images;
+  for (const double value : lr_values) {
+    const cv::Mat lr_image_matrix =
+        cv::Mat::ones(2, 2, CV_64FC1) * value;
+    low_res_images.push_back(ImageData(lr_image_matrix));
+  }
+  return low_res_images;
+}
+
+cv::Mat GetSmallDataGroundTruth() {
+  return (cv::Mat_<double>(4, 4)
+    << 0.4, 0.2, 0.4, 0.2,
+       0.0, 1.0, 0.0, 1.0,
+       0.4, 0.2, 0.4, 0.2,
+       0.0, 1.0, 0.0, 1.0);
+}
+
+super_resolution::ImageModel GetSmallDataImageModel() {
+  super_resolution::MotionShiftSequence motion_shift_sequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(-1, 0),
+    super_resolution::MotionShift(0, -1),
+    super_resolution::MotionShift(-1, -1)
+  });
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.motion_sequence = motion_shift_sequence;
+  return super_resolution::ImageModel::CreateImageModel(model_parameters);
+}
+
+}  // namespace
+
+// Without regularization, the primal-dual solver is just gradient descent on
+// the least squares objective and should find the exact solution.
+TEST(PrimalDualMapSolver, SmallDataTest) {
+  const super_resolution::ImageModel image_model = GetSmallDataImageModel();
+  const ImageData initial_estimate(cv::Mat::zeros(4, 4, CV_64FC1));
+
+  super_resolution::PrimalDualMapSolverOptions solver_options;
+  solver_options.max_num_primal_dual_iterations = 2000;
+  solver_options.relative_change_threshold = 1.0e-8;
+  super_resolution::PrimalDualMapSolver solver(
+      solver_options,
+      image_model,
+      GetSmallDataLowResImages(),
+      kPrintSolverOutput);
+  const ImageData result = solver.Solve(initial_estimate);
+
+  EXPECT_EQ(result.GetNumChannels(), 1);
+  EXPECT_TRUE(AreMatricesEqual(
+      result.GetChannelImage(0),
+      GetSmallDataGroundTruth(),
+      kSolverResultErrorTolerance));
+}
+
+// With a weak regularizer, the solution should stay close to the exact
+// solution with either supported regularizer type.
+TEST(PrimalDualMapSolver, SmallDataTestWithRegularization) {
+  const super_resolution::ImageModel image_model = GetSmallDataImageModel();
+  const ImageData initial_estimate(cv::Mat::zeros(4, 4, CV_64FC1));
+  const cv::Size image_size(4, 4);
+
+  const std::vector<std::shared_ptr<super_resolution::Regularizer>>
+  regularizers = {
+    std::shared_ptr<super_resolution::Regularizer>(
+        new super_resolution::TotalVariationRegularizer(image_size)),
+    std::shared_ptr<super_resolution::Regularizer>(
+        new super_resolution::BilateralTotalVariationRegularizer(
+            image_size, 1, 0.5))
+  };
+  for (const auto& regularizer : regularizers) {
+    super_resolution::PrimalDualMapSolverOptions solver_options;
+    solver_options.max_num_primal_dual_iterations = 2000;
+    super_resolution::PrimalDualMapSolver solver(
+        solver_options,
+        image_model,
+        GetSmallDataLowResImages(),
+        kPrintSolverOutput);
+    solver.AddRegularizer(regularizer, 0.0001);
+    const ImageData result = solver.Solve(initial_estimate);
+
+    EXPECT_TRUE(AreMatricesEqual(
+        result.GetChannelImage(0),
+        GetSmallDataGroundTruth(),
+        kRegularizedResultErrorTolerance));
+  }
+}
@@ -0,0 +1,66 @@
+#include <cstdlib>
+
+#include "util/process_rank.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::util::GetProcessRank;
+using super_resolution::util::ProcessRank;
+
+// Clears the launcher variables that GetProcessRank() reads.
+void ClearRankVariables() {
+  for (const char* name : {
+      "OMPI_COMM_WORLD_RANK", "OMPI_COMM_WORLD_SIZE",
+      "PMI_RANK", "PMI_SIZE",
+      "SLURM_PROCID", "SLURM_NTASKS"}) {
+    unsetenv(name);
+  }
+}
+
+// Verifies that the rank is only read from the launcher variables on
+// request, and that requested values take precedence over them.
+TEST(ProcessRank, GetProcessRank) {
+  ClearRankVariables();
+  ProcessRank process_rank = GetProcessRank();
+  EXPECT_EQ(process_rank.rank, 0);
+  EXPECT_EQ(process_rank.num_ranks, 1);
+
+  setenv("SLURM_PROCID", "2", 1);
+  setenv("SLURM_NTASKS", "4", 1);
+  process_rank = GetProcessRank();
+  EXPECT_EQ(process_rank.rank, 0);
+  EXPECT_EQ(process_rank.num_ranks, 1);
+  process_rank = GetProcessRank(-1, 0, true);
+  EXPECT_EQ(process_rank.rank, 2);
+  EXPECT_EQ(process_rank.num_ranks, 4);
+
+  // Open MPI variables are preferred over the ones of the batch scheduler.
+  setenv("OMPI_COMM_WORLD_RANK", "1", 1);
+  setenv("OMPI_COMM_WORLD_SIZE", "3", 1);
+  process_rank = GetProcessRank(-1, 0, true);
+  EXPECT_EQ(process_rank.rank, 1);
+  EXPECT_EQ(process_rank.num_ranks, 3);
+
+  process_rank = GetProcessRank(0, 2, true);
+  EXPECT_EQ(process_rank.rank, 0);
+  EXPECT_EQ(process_rank.num_ranks, 2);
+  process_rank = GetProcessRank(1, 2);
+  EXPECT_EQ(process_rank.rank, 1);
+  EXPECT_EQ(process_rank.num_ranks, 2);
+  ClearRankVariables();
+}
+
+// Verifies that every work item is owned by exactly one rank.
+TEST(ProcessRank, OwnsItem) {
+  ProcessRank process_rank;
+  process_rank.num_ranks = 3;
+  for (int item_index = 0; item_index < 10; ++item_index) {
+    int num_owners = 0;
+    for (int rank = 0; rank < 3; ++rank) {
+      process_rank.rank = rank;
+      num_owners += process_rank.OwnsItem(item_index) ? 1 : 0;
+    }
+    EXPECT_EQ(num_owners, 1) << "item " << item_index;
+  }
+}
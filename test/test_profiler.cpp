@@ -0,0 +1,76 @@
+#include <string>
+
+#include "util/profiler.h"
+#include "util/thread_pool.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::util::GetProfileReport;
+using super_resolution::util::IsProfilingEnabled;
+using super_resolution::util::ProfileEntry;
+using super_resolution::util::ResetProfileEntries;
+using super_resolution::util::ScopedProfileTimer;
+using super_resolution::util::ThreadPool;
+using testing::HasSubstr;
+using testing::Not;
+
+namespace {
+
+void ProfiledFunction() {
+  PROFILE_SCOPE("test_profiler ProfiledFunction");
+  PROFILE_COUNT("test_profiler ProfiledFunction counter", 2);
+}
+
+}  // namespace
+
+// Verifies that the timers and counters accumulate across threads and that the
+// entries show up in the report.
+TEST(Profiler, ProfileEntry) {
+  static ProfileEntry timed_entry("test_profiler timed entry");
+  static ProfileEntry counted_entry("test_profiler counted entry");
+  timed_entry.Reset();
+  counted_entry.Reset();
+
+  ThreadPool thread_pool(4);
+  thread_pool.ParallelFor(100, [](const int task_index) {
+    const ScopedProfileTimer timer(&timed_entry);
+    counted_entry.AddCount(3);
+  });
+  EXPECT_EQ(timed_entry.GetNumCalls(), 100);
+  EXPECT_GE(timed_entry.GetTotalNanoseconds(), 0);
+  EXPECT_EQ(timed_entry.GetCount(), 0);
+  EXPECT_EQ(counted_entry.GetNumCalls(), 100);
+  EXPECT_EQ(counted_entry.GetCount(), 300);
+
+  const std::string report = GetProfileReport();
+  EXPECT_THAT(report, HasSubstr("test_profiler timed entry"));
+  EXPECT_THAT(report, HasSubstr("test_profiler counted entry"));
+
+  // Entries with the same name are merged.
+  static ProfileEntry duplicate_entry("test_profiler counted entry");
+  duplicate_entry.AddCount(1);
+  EXPECT_THAT(GetProfileReport(), HasSubstr("301"));
+
+  // Entries that were not called since the reset are left out.
+  ResetProfileEntries();
+  EXPECT_EQ(timed_entry.GetNumCalls(), 0);
+  EXPECT_EQ(counted_entry.GetCount(), 0);
+  EXPECT_THAT(
+      GetProfileReport(), Not(HasSubstr("test_profiler timed entry")));
+}
+
+// Verifies that the macros only do anything if profiling is compiled in.
+TEST(Profiler, Macros) {
+  ResetProfileEntries();
+  ProfiledFunction();
+  ProfiledFunction();
+
+  const std::string report = GetProfileReport();
+  if (IsProfilingEnabled()) {
+    EXPECT_THAT(report, HasSubstr("test_profiler ProfiledFunction"));
+    EXPECT_THAT(report, HasSubstr("test_profiler ProfiledFunction counter"));
+  } else {
+    EXPECT_THAT(report, Not(HasSubstr("test_profiler ProfiledFunction")));
+  }
+}
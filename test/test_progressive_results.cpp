@@ -0,0 +1,169 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "image/image_data.h"
+#include "optimization/progressive_results.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::ProgressiveResults;
+using super_resolution::ProgressiveSnapshot;
+using testing::ElementsAre;
+
+namespace {
+
+// A delivered snapshot: its description and the first pixel of every
+// channel.
+struct DeliveredSnapshot {
+  ProgressiveSnapshot snapshot;
+  std::vector<double> first_pixels;
+};
+
+// Returns a callback that records every snapshot into the given vector.
+ProgressiveResults::Callback RecordSnapshots(
+    std::vector<DeliveredSnapshot>* delivered_snapshots) {
+
+  return [delivered_snapshots](
+      const ImageData& estimate, const ProgressiveSnapshot& snapshot) {
+    DeliveredSnapshot delivered_snapshot;
+    delivered_snapshot.snapshot = snapshot;
+    for (int channel = 0; channel < estimate.GetNumChannels(); ++channel) {
+      delivered_snapshot.first_pixels.push_back(
+          estimate.GetPixelValue(channel, 0, 0));
+    }
+    delivered_snapshots->push_back(delivered_snapshot);
+  };
+}
+
+}  // namespace
+
+// Verifies that a snapshot is taken every given number of iterations, and
+// that it contains the reported channels of the estimate on top of the
+// initial estimate.
+TEST(ProgressiveResults, IterationInterval) {
+  const cv::Size image_size(4, 3);
+  const std::vector<double> initial_values(3 * 12, 1.0);
+  const ImageData initial_estimate(initial_values.data(), image_size, 3);
+
+  std::vector<DeliveredSnapshot> delivered_snapshots;
+  ProgressiveResults progressive_results(
+      3, 0.0, RecordSnapshots(&delivered_snapshots));
+  progressive_results.Start(initial_estimate);
+  // Updated channels are included without taking a snapshot.
+  const std::vector<double> last_channel(12, -1.0);
+  progressive_results.UpdateChannels(last_channel.data(), 2, 3);
+  // The second channel is reported, and the snapshot is due at the third
+  // iteration. Nothing is taken in the two iterations after that.
+  for (int iteration = 1; iteration <= 5; ++iteration) {
+    const std::vector<double> estimate(12, 10.0 * iteration);
+    progressive_results.ReportIteration(estimate.data(), 1, 2);
+  }
+  progressive_results.Finish();
+
+  ASSERT_EQ(delivered_snapshots.size(), 1);
+  EXPECT_EQ(delivered_snapshots[0].snapshot.index, 0);
+  EXPECT_EQ(delivered_snapshots[0].snapshot.num_iterations, 3);
+  EXPECT_GE(delivered_snapshots[0].snapshot.elapsed_seconds, 0.0);
+  EXPECT_THAT(delivered_snapshots[0].first_pixels, ElementsAre(1, 30, -1));
+
+  // A new stream starts from its own initial estimate, and continues the
+  // snapshot indices.
+  progressive_results.Start(initial_estimate);
+  for (int iteration = 1; iteration <= 3; ++iteration) {
+    const std::vector<double> estimate(2 * 12, 5.0);
+    progressive_results.ReportIteration(estimate.data(), 0, 2);
+  }
+  progressive_results.Finish();
+  ASSERT_EQ(delivered_snapshots.size(), 2);
+  EXPECT_EQ(delivered_snapshots[1].snapshot.index, 1);
+  EXPECT_EQ(delivered_snapshots[1].snapshot.num_iterations, 3);
+  EXPECT_THAT(delivered_snapshots[1].first_pixels, ElementsAre(5, 5, 1));
+  EXPECT_EQ(progressive_results.GetNumDeliveredSnapshots(), 2);
+
+  // Nothing is reported after the stream is finished.
+  const std::vector<double> estimate(12, 0.0);
+  progressive_results.ReportIteration(estimate.data(), 0, 1);
+  EXPECT_EQ(progressive_results.GetNumDeliveredSnapshots(), 2);
+}
+
+// Verifies that a snapshot is taken once the time interval passed.
+TEST(ProgressiveResults, TimeInterval) {
+  const cv::Size image_size(2, 2);
+  const std::vector<double> initial_values(4, 0.0);
+  const ImageData initial_estimate(initial_values.data(), image_size, 1);
+
+  std::vector<DeliveredSnapshot> delivered_snapshots;
+  ProgressiveResults progressive_results(
+      0, 0.05, RecordSnapshots(&delivered_snapshots));
+  progressive_results.Start(initial_estimate);
+  const std::vector<double> estimate(4, 1.0);
+  progressive_results.ReportIteration(estimate.data(), 0, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  progressive_results.ReportIteration(estimate.data(), 0, 1);
+  progressive_results.Finish();
+
+  ASSERT_EQ(delivered_snapshots.size(), 1);
+  EXPECT_EQ(delivered_snapshots[0].snapshot.num_iterations, 2);
+  EXPECT_GE(delivered_snapshots[0].snapshot.elapsed_seconds, 0.05);
+}
+
+// Verifies that the solver does not wait for a slow callback: the snapshots
+// taken while the callback is busy replace each other, and only the latest
+// one is delivered after it.
+TEST(ProgressiveResults, SkipsSnapshotsWhileCallbackIsBusy) {
+  const cv::Size image_size(3, 3);
+  const std::vector<double> initial_values(9, 0.0);
+  const ImageData initial_estimate(initial_values.data(), image_size, 1);
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool is_callback_started = false;
+  bool is_callback_released = false;
+  std::vector<DeliveredSnapshot> delivered_snapshots;
+  const ProgressiveResults::Callback record_snapshot =
+      RecordSnapshots(&delivered_snapshots);
+  ProgressiveResults progressive_results(
+      1,
+      0.0,
+      [&](const ImageData& estimate, const ProgressiveSnapshot& snapshot) {
+        std::unique_lock<std::mutex> lock(mutex);
+        is_callback_started = true;
+        condition.notify_all();
+        condition.wait(lock, [&]() { return is_callback_released; });
+        record_snapshot(estimate, snapshot);
+      });
+  progressive_results.Start(initial_estimate);
+
+  std::vector<double> estimate(9, 1.0);
+  progressive_results.ReportIteration(estimate.data(), 0, 1);
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [&]() { return is_callback_started; });
+  }
+  // The callback is blocked, but every iteration still returns.
+  for (int iteration = 2; iteration <= 5; ++iteration) {
+    estimate.assign(9, iteration);
+    progressive_results.ReportIteration(estimate.data(), 0, 1);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    is_callback_released = true;
+  }
+  condition.notify_all();
+  progressive_results.Finish();
+
+  ASSERT_EQ(delivered_snapshots.size(), 2);
+  EXPECT_EQ(delivered_snapshots[0].snapshot.num_iterations, 1);
+  EXPECT_THAT(delivered_snapshots[0].first_pixels, ElementsAre(1));
+  EXPECT_EQ(delivered_snapshots[1].snapshot.index, 1);
+  EXPECT_EQ(delivered_snapshots[1].snapshot.num_iterations, 5);
+  EXPECT_THAT(delivered_snapshots[1].first_pixels, ElementsAre(5));
+}
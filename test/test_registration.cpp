@@ -18,6 +18,7 @@ using super_resolution::MotionShiftSequence;
 // The maximum number error allowed for the registration algorithm (distance in
 // number of pixels).
 constexpr double kTranslationEstimateErrorTolerance = 0.01;
+constexpr double kPhaseCorrelationErrorTolerance = 0.05;
 
 // Path to the test image for testing registration.
 static const std::string kTestImagePath =
@@ -47,20 +48,101 @@ TEST(Registration, TranslationalRegistration) {
   }
 
   // Try to register it and test that the registered results are close to the
-  // ground truth.
+  // ground truth, with both methods, serially and concurrently.
+  for (const super_resolution::registration::RegistrationMethod method : {
+      super_resolution::registration::REGISTRATION_FEATURE_MATCHING,
+      super_resolution::registration::REGISTRATION_PHASE_CORRELATION}) {
+    for (const int num_threads : {1, 3}) {
+      super_resolution::registration::TranslationalRegistrationOptions options;
+      options.method = method;
+      options.num_threads = num_threads;
+      const MotionShiftSequence registered_sequence =
+          super_resolution::registration::TranslationalRegistration(
+              shifted_images, options);
+      // The window and the zero-filled borders of the shifted images slightly
+      // perturb the phase correlation peak.
+      const double tolerance = (method ==
+          super_resolution::registration::REGISTRATION_PHASE_CORRELATION) ?
+          kPhaseCorrelationErrorTolerance : kTranslationEstimateErrorTolerance;
+      EXPECT_EQ(registered_sequence.GetNumMotionShifts(), num_motion_shifts);
+      for (int i = 0; i < num_motion_shifts; ++i) {
+        const MotionShift ground_truth_shift = ground_truth_sequence[i];
+        const MotionShift estimated_shift = registered_sequence[i];
+        EXPECT_NEAR(ground_truth_shift.dx, estimated_shift.dx, tolerance);
+        EXPECT_NEAR(ground_truth_shift.dy, estimated_shift.dy, tolerance);
+      }
+    }
+  }
+}
+
+// Tests that phase correlation finds sub-pixel shifts, using every channel.
+TEST(Registration, PhaseCorrelationSubPixelShifts) {
+  const MotionShiftSequence ground_truth_sequence({
+    MotionShift(0, 0),
+    MotionShift(0.5, 0),
+    MotionShift(-1.5, 2.5),
+    MotionShift(3, -0.5)
+  });
+  const ImageData original_image =
+      super_resolution::util::LoadImage(kTestImagePath);
+  const super_resolution::MotionModule motion_module(ground_truth_sequence);
+  std::vector<ImageData> shifted_images;
+  const int num_motion_shifts = ground_truth_sequence.GetNumMotionShifts();
+  for (int i = 0; i < num_motion_shifts; ++i) {
+    ImageData shifted_image = original_image;
+    motion_module.ApplyToImage(&shifted_image, i);
+    shifted_images.push_back(shifted_image);
+  }
+
+  super_resolution::registration::TranslationalRegistrationOptions options;
+  options.method =
+      super_resolution::registration::REGISTRATION_PHASE_CORRELATION;
+  options.num_threads = 2;
+  const MotionShiftSequence registered_sequence =
+      super_resolution::registration::TranslationalRegistration(
+          shifted_images, options);
+  // The half pixel shifts are interpolated, which blurs the shifted images,
+  // so they are only found approximately.
+  for (int i = 0; i < num_motion_shifts; ++i) {
+    EXPECT_NEAR(ground_truth_sequence[i].dx, registered_sequence[i].dx, 0.1);
+    EXPECT_NEAR(ground_truth_sequence[i].dy, registered_sequence[i].dy, 0.1);
+  }
+}
+
+// Tests that feature matching seeded by a coarse (downscaled) estimate finds
+// the same shifts as matching at full resolution only.
+TEST(Registration, PyramidFeatureMatching) {
+  const MotionShiftSequence ground_truth_sequence({
+    MotionShift(0, 0),
+    MotionShift(4, -3),
+    MotionShift(-6, 2)
+  });
+  const ImageData original_image =
+      super_resolution::util::LoadImage(kTestImagePath);
+  const super_resolution::MotionModule motion_module(ground_truth_sequence);
+  std::vector<ImageData> shifted_images;
+  const int num_motion_shifts = ground_truth_sequence.GetNumMotionShifts();
+  for (int i = 0; i < num_motion_shifts; ++i) {
+    ImageData shifted_image = original_image;
+    motion_module.ApplyToImage(&shifted_image, i);
+    shifted_images.push_back(shifted_image);
+  }
+
+  super_resolution::registration::TranslationalRegistrationOptions options;
+  options.num_pyramid_levels = 1;
+  options.num_threads = 2;
   const MotionShiftSequence registered_sequence =
-      super_resolution::registration::TranslationalRegistration(shifted_images);
+      super_resolution::registration::TranslationalRegistration(
+          shifted_images, options);
   EXPECT_EQ(registered_sequence.GetNumMotionShifts(), num_motion_shifts);
   for (int i = 0; i < num_motion_shifts; ++i) {
-    const MotionShift ground_truth_shift = ground_truth_sequence[i];
-    const MotionShift estimated_shift = registered_sequence[i];
     EXPECT_NEAR(
-        ground_truth_shift.dx,
-        estimated_shift.dx,
+        ground_truth_sequence[i].dx,
+        registered_sequence[i].dx,
         kTranslationEstimateErrorTolerance);
     EXPECT_NEAR(
-        ground_truth_shift.dy,
-        estimated_shift.dy,
+        ground_truth_sequence[i].dy,
+        registered_sequence[i].dy,
         kTranslationEstimateErrorTolerance);
   }
 }
@@ -0,0 +1,137 @@
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "image_model/shift_add_fusion.h"
+#include "motion/motion_shift.h"
+#include "util/test_util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::MotionShift;
+using super_resolution::MotionShiftSequence;
+using super_resolution::ShiftAddFusion;
+using super_resolution::test::AreMatricesEqualCroppedBorder;
+
+// Returns the images of the given HR image under the image model with the
+// given motion and no blur.
+std::vector<ImageData> GetLowResImages(
+    const ImageData& high_res_image,
+    const MotionShiftSequence& motion_shift_sequence,
+    const int scale) {
+
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = scale;
+  model_parameters.blur_radius = 0;
+  model_parameters.motion_sequence = motion_shift_sequence;
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  std::vector<ImageData> low_res_images;
+  for (int i = 0; i < motion_shift_sequence.GetNumMotionShifts(); ++i) {
+    low_res_images.push_back(image_model.ApplyToImage(high_res_image, i));
+  }
+  return low_res_images;
+}
+
+// Verifies that frames which together sample every HR pixel are fused back
+// into the HR image, for every channel.
+TEST(ShiftAddFusion, RecoversImageFromIntegralShifts) {
+  cv::Mat high_res_mat(16, 12, CV_64FC2);
+  cv::randu(high_res_mat, 0.0, 1.0);
+  const ImageData high_res_image(high_res_mat);
+  const MotionShiftSequence motion_shift_sequence({
+    MotionShift(0, 0),
+    MotionShift(1, 0),
+    MotionShift(0, 1),
+    MotionShift(1, 1)
+  });
+  const std::vector<ImageData> low_res_images =
+      GetLowResImages(high_res_image, motion_shift_sequence, 2);
+
+  super_resolution::ShiftAddFusionOptions options;
+  options.scale = 2;
+  const ImageData fused_image =
+      ShiftAddFusion(low_res_images, motion_shift_sequence, options);
+  EXPECT_EQ(fused_image.GetImageSize(), high_res_image.GetImageSize());
+  ASSERT_EQ(fused_image.GetNumChannels(), 2);
+  // The last row and column get no samples, since the shifted frames only
+  // see the image on one side.
+  for (int channel = 0; channel < 2; ++channel) {
+    EXPECT_TRUE(AreMatricesEqualCroppedBorder(
+        fused_image.GetChannelImage(channel),
+        high_res_image.GetChannelImage(channel),
+        1,
+        1.0e-12));
+  }
+}
+
+// Verifies that sub-pixel samples are normalized by their weights, and that
+// the result does not depend on the number of threads (up to rounding).
+TEST(ShiftAddFusion, SubPixelShiftsWithThreads) {
+  const cv::Mat constant_mat(20, 20, CV_64FC1, cv::Scalar(0.5));
+  const MotionShiftSequence motion_shift_sequence({
+    MotionShift(0, 0),
+    MotionShift(0.5, 0.25),
+    MotionShift(-0.3, 1.7),
+    MotionShift(1.2, -0.6),
+    MotionShift(0.8, 0.9)
+  });
+  const std::vector<ImageData> low_res_images = GetLowResImages(
+      ImageData(constant_mat), motion_shift_sequence, 2);
+
+  super_resolution::ShiftAddFusionOptions options;
+  options.scale = 2;
+  const ImageData fused_image =
+      ShiftAddFusion(low_res_images, motion_shift_sequence, options);
+  // Pixels near the border also get samples of the zero padding.
+  EXPECT_TRUE(AreMatricesEqualCroppedBorder(
+      fused_image.GetChannelImage(0), constant_mat, 3, 1.0e-12));
+
+  options.num_threads = 3;
+  const ImageData threaded_fused_image =
+      ShiftAddFusion(low_res_images, motion_shift_sequence, options);
+  EXPECT_TRUE(super_resolution::test::AreImagesEqual(
+      threaded_fused_image, fused_image, 1.0e-12));
+}
+
+// Verifies that the median and trimmed mean are not affected by outlier
+// frames, and that streaming the frames gives the same result.
+TEST(ShiftAddFusion, RobustModesRejectOutliers) {
+  cv::Mat image_mat(10, 8, CV_64FC1);
+  cv::randu(image_mat, 0.2, 0.8);
+  const ImageData image(image_mat);
+  std::vector<ImageData> frames(5, image);
+  frames[1] = ImageData(cv::Mat(10, 8, CV_64FC1, cv::Scalar(1.0)));
+  frames[3] = ImageData(cv::Mat(10, 8, CV_64FC1, cv::Scalar(0.0)));
+
+  super_resolution::ShiftAddFusionOptions options;
+  options.scale = 1;
+  const ImageData mean_image =
+      ShiftAddFusion(frames, MotionShiftSequence(), options);
+  EXPECT_FALSE(super_resolution::test::AreImagesEqual(
+      mean_image, image, 1.0e-3));
+
+  // The outliers fall into other histogram bins than the true values, so
+  // the bin means are exact up to single precision.
+  options.mode = super_resolution::SHIFT_ADD_MEDIAN;
+  options.num_threads = 2;
+  const ImageData median_image =
+      ShiftAddFusion(frames, MotionShiftSequence(), options);
+  EXPECT_TRUE(super_resolution::test::AreImagesEqual(
+      median_image, image, 1.0e-6));
+
+  options.mode = super_resolution::SHIFT_ADD_TRIMMED_MEAN;
+  options.trim_fraction = 0.2;
+  super_resolution::StreamingShiftAddFusion streaming_fusion(
+      image.GetImageSize(), 1, options);
+  for (const ImageData& frame : frames) {
+    streaming_fusion.AddFrame(frame, MotionShift(0, 0));
+  }
+  EXPECT_EQ(streaming_fusion.GetNumFrames(), 5);
+  EXPECT_TRUE(super_resolution::test::AreImagesEqual(
+      streaming_fusion.GetFusedImage(), image, 1.0e-6));
+}
@@ -0,0 +1,98 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "optimization/solver_deadline.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::GetNumAffordableIterations;
+using super_resolution::SolverDeadline;
+using super_resolution::SolverDeadlineStage;
+using testing::HasSubstr;
+
+TEST(SolverDeadline, GetNumAffordableIterations) {
+  EXPECT_EQ(GetNumAffordableIterations(10.0, 3.0, 100), 3);
+  EXPECT_EQ(GetNumAffordableIterations(10.0, 3.0, 2), 2);
+  // No limit on the number of iterations.
+  EXPECT_EQ(GetNumAffordableIterations(10.0, 3.0, 0), 3);
+  // Not even a single iteration fits.
+  EXPECT_EQ(GetNumAffordableIterations(2.0, 3.0, 100), 0);
+  EXPECT_EQ(GetNumAffordableIterations(0.0, 3.0, 100), 0);
+  EXPECT_EQ(GetNumAffordableIterations(-1.0, 3.0, 100), 0);
+  // Without a timing, only the iteration limit applies.
+  EXPECT_EQ(GetNumAffordableIterations(10.0, 0.0, 100), 100);
+  // Huge numbers of iterations do not overflow.
+  EXPECT_GT(GetNumAffordableIterations(1.0e9, 1.0e-9, 0), 0);
+}
+
+TEST(SolverDeadline, Budget) {
+  const SolverDeadline deadline(1000.0);
+  EXPECT_EQ(deadline.GetBudgetSeconds(), 1000.0);
+  EXPECT_FALSE(deadline.IsExpired());
+  EXPECT_LE(deadline.GetRemainingSeconds(), 1000.0);
+  EXPECT_GT(deadline.GetRemainingSeconds(), 900.0);
+  EXPECT_GE(deadline.GetElapsedSeconds(), 0.0);
+
+  const SolverDeadline expired_deadline(0.0);
+  EXPECT_TRUE(expired_deadline.IsExpired());
+  EXPECT_EQ(expired_deadline.GetRemainingSeconds(), 0.0);
+
+  const SolverDeadline short_deadline(0.01);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_TRUE(short_deadline.IsExpired());
+  EXPECT_EQ(short_deadline.GetRemainingSeconds(), 0.0);
+}
+
+// Verifies that shares get their part of the remaining time, never end after
+// the deadline that they were created from, and record their stages there.
+TEST(SolverDeadline, CreateShare) {
+  const SolverDeadline deadline(1000.0);
+  const std::shared_ptr<SolverDeadline> half = deadline.CreateShare(0.5);
+  EXPECT_LE(half->GetBudgetSeconds(), 500.0);
+  EXPECT_GT(half->GetBudgetSeconds(), 450.0);
+  const std::shared_ptr<SolverDeadline> quarter = half->CreateShare(0.5);
+  EXPECT_LE(quarter->GetBudgetSeconds(), 250.0);
+  EXPECT_LE(deadline.CreateShare(1.0)->GetRemainingSeconds(),
+            deadline.GetRemainingSeconds());
+  EXPECT_TRUE(deadline.CreateShare(0.0)->IsExpired());
+
+  quarter->RecordStage("solve", SolverDeadline::Clock::now());
+  const std::vector<SolverDeadlineStage> stages = deadline.GetStages();
+  ASSERT_EQ(stages.size(), 1);
+  EXPECT_EQ(stages[0].name, "solve");
+}
+
+// Verifies that the time of a stage is added up over all of its records,
+// also from concurrent threads, and that the stages keep their order.
+TEST(SolverDeadline, RecordStage) {
+  SolverDeadline deadline(10.0);
+  const SolverDeadline::Clock::time_point start_time =
+      SolverDeadline::Clock::now() - std::chrono::milliseconds(100);
+  deadline.RecordStage("setup", start_time);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&deadline, start_time]() {
+      deadline.RecordStage("solve", start_time);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  deadline.RecordStage("setup", start_time);
+
+  const std::vector<SolverDeadlineStage> stages = deadline.GetStages();
+  ASSERT_EQ(stages.size(), 2);
+  EXPECT_EQ(stages[0].name, "setup");
+  EXPECT_GE(stages[0].seconds, 0.2);
+  EXPECT_EQ(stages[1].name, "solve");
+  EXPECT_GE(stages[1].seconds, 0.4);
+
+  const std::string report = deadline.GetReport();
+  EXPECT_THAT(report, HasSubstr("setup"));
+  EXPECT_THAT(report, HasSubstr("solve"));
+  EXPECT_THAT(report, HasSubstr("% of the budget"));
+}
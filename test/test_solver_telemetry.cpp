@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
+#include "optimization/irls_map_solver.h"
+#include "optimization/solver_telemetry.h"
+#include "optimization/tv_regularizer.h"
+#include "util/test_util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::SolveTelemetry;
+using super_resolution::SolverTelemetry;
+using super_resolution::test::AreImagesEqual;
+
+using testing::HasSubstr;
+
+namespace {
+
+// Solves a small two-channel problem with TV regularization, one channel per
+// split, and reports to the given telemetry if it is not null.
+ImageData SolveSmallProblem(
+    const std::shared_ptr<SolverTelemetry> telemetry) {
+
+  cv::setRNGSeed(7);
+  ImageData ground_truth;
+  for (int channel = 0; channel < 2; ++channel) {
+    cv::Mat channel_image(12, 12, CV_64FC1);
+    cv::randu(channel_image, cv::Scalar(0.0), cv::Scalar(1.0));
+    ground_truth.AddChannel(
+        channel_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  }
+
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.motion_sequence = super_resolution::MotionShiftSequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1, 0),
+    super_resolution::MotionShift(0, 1)
+  });
+  const super_resolution::ImageModel image_model =
+      super_resolution::ImageModel::CreateImageModel(model_parameters);
+  std::vector<ImageData> low_res_images;
+  for (int i = 0; i < 3; ++i) {
+    low_res_images.push_back(image_model.ApplyToImage(ground_truth, i));
+  }
+  ImageData initial_estimate = low_res_images[0];
+  initial_estimate.ResizeImage(2, super_resolution::INTERPOLATE_LINEAR);
+
+  super_resolution::IRLSMapSolverOptions solver_options;
+  solver_options.least_squares_solver = super_resolution::NATIVE_CG_SOLVER;
+  solver_options.max_num_irls_iterations = 3;
+  solver_options.max_num_solver_iterations = 10;
+  solver_options.split_channels = true;
+  super_resolution::IRLSMapSolver solver(
+      solver_options, image_model, low_res_images, false);
+  solver.AddRegularizer(
+      std::shared_ptr<super_resolution::Regularizer>(
+          new super_resolution::TotalVariationRegularizer(
+              ground_truth.GetImageSize())),
+      0.01);
+  solver.SetTelemetry(telemetry);
+  return solver.Solve(initial_estimate);
+}
+
+}  // namespace
+
+// Verifies that an IRLS solve reports consistent per-iteration statistics for
+// every channel split, and that recording them does not change the result.
+TEST(SolverTelemetry, RecordsIRLSSolve) {
+  const std::shared_ptr<SolverTelemetry> telemetry(new SolverTelemetry());
+  const ImageData result = SolveSmallProblem(telemetry);
+  EXPECT_TRUE(AreImagesEqual(result, SolveSmallProblem(nullptr), 0.0));
+
+  const std::vector<SolveTelemetry> solves = telemetry->GetSolves();
+  ASSERT_EQ(solves.size(), 2);
+  for (int i = 0; i < solves.size(); ++i) {
+    const SolveTelemetry& solve = solves[i];
+    EXPECT_EQ(solve.channel_start, i);
+    EXPECT_EQ(solve.channel_end, i + 1);
+
+    // The solver iterations are assigned to their IRLS iterations.
+    ASSERT_FALSE(solve.irls_iterations.empty());
+    EXPECT_LE(solve.irls_iterations.size(), 3);
+    int num_solver_iterations = 0;
+    for (const auto& irls_iteration : solve.irls_iterations) {
+      num_solver_iterations += irls_iteration.num_solver_iterations;
+    }
+    EXPECT_EQ(num_solver_iterations, solve.iterations.size());
+    for (int j = 0; j < solve.iterations.size(); ++j) {
+      EXPECT_EQ(solve.iterations[j].iteration, j + 1);
+      // The native solvers report the gradient norm of every iteration.
+      EXPECT_GE(solve.iterations[j].gradient_norm, 0.0);
+      // At least the solver buffers are recorded while it runs.
+      EXPECT_GT(solve.iterations[j].memory_bytes, 0);
+    }
+
+    // Every evaluation times both terms, within the solver runs.
+    ASSERT_EQ(solve.term_timings.size(), 2);
+    EXPECT_EQ(solve.term_timings[0].name, "data term");
+    EXPECT_EQ(solve.term_timings[1].name, "regularizer 0");
+    EXPECT_GT(solve.num_objective_evaluations, 0);
+    for (const auto& term_timing : solve.term_timings) {
+      EXPECT_EQ(term_timing.num_evaluations, solve.num_objective_evaluations);
+    }
+    EXPECT_GE(solve.solver_seconds, solve.objective_seconds);
+  }
+}
+
+// Verifies the exported formats.
+TEST(SolverTelemetry, Exports) {
+  const std::shared_ptr<SolverTelemetry> telemetry(new SolverTelemetry(true));
+  SolveSmallProblem(telemetry);
+  const std::vector<SolveTelemetry> solves = telemetry->GetSolves();
+
+  // One CSV line per iteration, after the header.
+  const std::string csv = telemetry->IterationsToCsv();
+  EXPECT_EQ(csv.find("solve,channel_start,channel_end,"), 0);
+  const int num_lines = std::count(csv.begin(), csv.end(), '\n');
+  EXPECT_EQ(
+      num_lines,
+      1 + solves[0].iterations.size() + solves[1].iterations.size());
+
+  const std::string json = telemetry->ToJson();
+  EXPECT_EQ(json.find("{\"solves\": ["), 0);
+  EXPECT_THAT(json, HasSubstr("\"name\": \"data term\""));
+  EXPECT_THAT(json, HasSubstr("\"optimizer_overhead_seconds\": "));
+  // The first IRLS iteration has no previous cost.
+  EXPECT_THAT(json, HasSubstr("\"cost_difference\": null"));
+  EXPECT_THAT(json, HasSubstr("\"memory\": {\"tags\": [{\"tag\": \"other\""));
+  EXPECT_THAT(json, HasSubstr("\"tag\": \"gradients\", \"current_bytes\": "));
+
+  const std::string trace = telemetry->ToChromeTrace();
+  EXPECT_THAT(trace, HasSubstr("\"name\": \"least squares solver\""));
+  EXPECT_THAT(trace, HasSubstr("\"name\": \"IRLS reweighting\""));
+  EXPECT_THAT(trace, HasSubstr("\"tid\": 1"));
+
+  // Trace events are only kept if requested.
+  const SolverTelemetry telemetry_without_trace;
+  EXPECT_EQ(
+      telemetry_without_trace.ToChromeTrace(), "{\"traceEvents\": [\n]}\n");
+}
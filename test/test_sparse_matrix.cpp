@@ -0,0 +1,81 @@
+#include <cstdint>
+#include <vector>
+
+#include "util/sparse_matrix.h"
+#include "util/test_util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::test::AreMatricesEqual;
+using super_resolution::util::SparseMatrix;
+using super_resolution::util::SparseMatrixEntry;
+using testing::ElementsAre;
+
+// Tests that entries are sorted into CSR order and duplicates are summed.
+TEST(SparseMatrix, BuildFromEntries) {
+  const SparseMatrix matrix(3, 4, {
+    SparseMatrixEntry(2, 1, 5.0),
+    SparseMatrixEntry(0, 3, 1.0),
+    SparseMatrixEntry(0, 0, 2.0),
+    SparseMatrixEntry(2, 1, -1.0),
+    SparseMatrixEntry(1, 2, 3.0)
+  });
+  EXPECT_EQ(matrix.GetNumRows(), 3);
+  EXPECT_EQ(matrix.GetNumCols(), 4);
+  EXPECT_EQ(matrix.GetNumNonZeros(), 4);
+  EXPECT_THAT(matrix.GetRowOffsets(), ElementsAre(0, 2, 3, 4));
+  EXPECT_THAT(matrix.GetColumnIndices(), ElementsAre(0, 3, 2, 1));
+  EXPECT_THAT(matrix.GetValues(), ElementsAre(2.0, 1.0, 3.0, 4.0));
+
+  const cv::Mat expected_matrix = (cv::Mat_<double>(3, 4)
+      << 2, 0, 0, 1,
+         0, 0, 3, 0,
+         0, 4, 0, 0);
+  EXPECT_TRUE(AreMatricesEqual(matrix.ToDense(), expected_matrix));
+  EXPECT_TRUE(AreMatricesEqual(
+      SparseMatrix::FromDense(expected_matrix).ToDense(), expected_matrix));
+  EXPECT_TRUE(AreMatricesEqual(
+      SparseMatrix::Identity(3).ToDense(), cv::Mat::eye(3, 3, CV_64FC1)));
+}
+
+// Tests the matrix products and the transpose against the dense versions.
+TEST(SparseMatrix, MultiplyAndTranspose) {
+  const cv::Mat dense_a = (cv::Mat_<double>(3, 4)
+      << 1, 0, 0, 2,
+         0, 0, 0, 0,
+         0, -1, 3, 0);
+  const cv::Mat dense_b = (cv::Mat_<double>(4, 2)
+      << 0, 1,
+         2, 0,
+         0, 0,
+         4, -2);
+  const SparseMatrix a = SparseMatrix::FromDense(dense_a);
+  const SparseMatrix b = SparseMatrix::FromDense(dense_b);
+
+  const cv::Mat expected_product = dense_a * dense_b;
+  EXPECT_TRUE(AreMatricesEqual(a.Multiply(b).ToDense(), expected_product));
+  EXPECT_TRUE(AreMatricesEqual(a.Transpose().ToDense(), dense_a.t()));
+
+  const std::vector<double> x = {1.0, -2.0, 0.5, 3.0};
+  std::vector<double> y(3);
+  a.MultiplyVector(x.data(), y.data());
+  EXPECT_THAT(y, ElementsAre(7.0, 0.0, 3.5));
+
+  std::vector<double> transpose_y(4);
+  a.MultiplyTransposeVector(y.data(), transpose_y.data());
+  EXPECT_THAT(transpose_y, ElementsAre(7.0, -3.5, 10.5, 14.0));
+  a.AddMultiplyTransposeVector(y.data(), transpose_y.data());
+  EXPECT_THAT(transpose_y, ElementsAre(14.0, -7.0, 21.0, 28.0));
+
+  const cv::Mat dense_c = (cv::Mat_<double>(3, 4)
+      << 0, 1, 0, -2,
+         5, 0, 0, 0,
+         0, 1, -3, 0);
+  const SparseMatrix sum = a.Add(SparseMatrix::FromDense(dense_c));
+  EXPECT_TRUE(AreMatricesEqual(sum.ToDense(), dense_a + dense_c));
+  // Entries that cancel out are kept as explicit zeros.
+  EXPECT_EQ(sum.GetNumNonZeros(), 6);
+}
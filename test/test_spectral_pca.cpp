@@ -1,3 +1,4 @@
+#include <cmath>
 #include <vector>
 
 #include "hyperspectral/spectral_pca.h"
@@ -61,6 +62,29 @@ TEST(SpectralPCA, Decomposition) {
   EXPECT_TRUE(AreImagesEqual(
       small_image_reconstructed, small_image, kReconstructionErrorTolerance));
 
+  // All bands are kept, so the explained variance adds up to 1, and the data
+  // lies almost entirely along the first band. A decomposition restored with
+  // its eigenvalues explains the same variance, and one without does not
+  // know it.
+  const std::vector<double> explained_variance_ratios =
+      spectral_pca_small.GetExplainedVarianceRatios();
+  ASSERT_EQ(explained_variance_ratios.size(), 2);
+  EXPECT_GT(explained_variance_ratios[0], 0.99);
+  EXPECT_NEAR(
+      explained_variance_ratios[0] + explained_variance_ratios[1], 1.0, 1e-9);
+  const super_resolution::SpectralPCA restored_spectral_pca_small(
+      spectral_pca_small.GetEigenvectors(),
+      spectral_pca_small.GetMean(),
+      super_resolution::SpectralPCAOptions(),
+      spectral_pca_small.GetEigenvalues(),
+      spectral_pca_small.GetTotalVariance());
+  EXPECT_EQ(
+      restored_spectral_pca_small.GetExplainedVarianceRatios(),
+      explained_variance_ratios);
+  EXPECT_TRUE(super_resolution::SpectralPCA(
+      spectral_pca_small.GetEigenvectors(),
+      spectral_pca_small.GetMean()).GetExplainedVarianceRatios().empty());
+
   /* Run with a bigger image that has controlled strong correlations. */
 
   ImageData hyperspectral_image;
@@ -124,3 +148,139 @@ TEST(SpectralPCA, Decomposition) {
       hyperspectral_image,
       0.05));
 }
+
+// Verifies that the basis fitted from random pixel samples does not depend on
+// the number of threads and still gives an (almost) exact reconstruction when
+// all bands are kept.
+TEST(SpectralPCA, PixelSamplingAndThreads) {
+  const int num_channels = 20;
+  const cv::Size image_size(100, 90);  // More than one pixel block.
+  cv::Mat base(image_size, super_resolution::util::kOpenCvMatrixType);
+  cv::randu(base, 0.0, 1.0);
+  std::vector<ImageData> images(2);
+  for (ImageData& image : images) {
+    cv::Mat noise(image_size, super_resolution::util::kOpenCvMatrixType);
+    for (int i = 0; i < num_channels; ++i) {
+      cv::randn(noise, cv::Scalar(0.0), cv::Scalar(0.01));
+      image.AddChannel(
+          base * (1.0 + 0.1 * i) + noise,
+          super_resolution::DO_NOT_NORMALIZE_IMAGE);
+    }
+  }
+
+  super_resolution::SpectralPCAOptions options;
+  options.pixel_sampling_ratio = 0.5;
+  options.random_seed = 7;
+  options.num_threads = 1;
+  const super_resolution::SpectralPCA spectral_pca_serial(images, 0, options);
+  options.num_threads = 4;
+  const super_resolution::SpectralPCA spectral_pca_parallel(
+      images, 0, options);
+
+  const ImageData pca_image_serial = spectral_pca_serial.GetPCAImage(images[0]);
+  const ImageData pca_image_parallel =
+      spectral_pca_parallel.GetPCAImage(images[0]);
+  EXPECT_EQ(pca_image_serial.GetNumChannels(), num_channels);
+  // The trailing bands only hold (nearly degenerate) noise, so only the
+  // dominant band is compared directly. Summing in a different order may
+  // rotate the noise bands slightly.
+  EXPECT_TRUE(AreMatricesEqual(
+      pca_image_serial.GetChannelImage(0),
+      pca_image_parallel.GetChannelImage(0),
+      1.0e-9));
+  EXPECT_TRUE(AreImagesEqual(
+      spectral_pca_parallel.ReconstructImage(pca_image_parallel),
+      images[0],
+      kReconstructionErrorTolerance));
+
+  // Most of the variance is in the first band, which is found from the
+  // samples as well.
+  const super_resolution::SpectralPCA spectral_pca_approx_var(
+      images, 0.9, options);
+  EXPECT_EQ(spectral_pca_approx_var.GetPCAImage(images[1]).GetNumChannels(), 1);
+}
+
+// Verifies that images spanning several projection blocks are converted the
+// same way with multiple threads, and that single precision images are
+// projected like their double precision originals.
+TEST(SpectralPCA, BatchedProjection) {
+  const int num_channels = 5;
+  const cv::Size image_size(200, 100);  // More than one projection block.
+  ImageData image;
+  for (int i = 0; i < num_channels; ++i) {
+    // Bands with clearly different variances give a well-conditioned basis,
+    // which does not depend on the order of the covariance sums.
+    cv::Mat channel(image_size, super_resolution::util::kOpenCvMatrixType);
+    cv::randu(channel, 0.0, 1.0 + i);
+    image.AddChannel(channel, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  }
+  ImageData single_precision_image = image;
+  single_precision_image.SetPrecision(super_resolution::SINGLE_PRECISION);
+
+  super_resolution::SpectralPCAOptions options;
+  options.num_threads = 1;
+  const super_resolution::SpectralPCA spectral_pca_serial({image}, 0, options);
+  options.num_threads = 3;
+  const super_resolution::SpectralPCA spectral_pca_parallel(
+      {image}, 0, options);
+
+  const ImageData pca_image_serial = spectral_pca_serial.GetPCAImage(image);
+  const ImageData pca_image_parallel = spectral_pca_parallel.GetPCAImage(image);
+  EXPECT_TRUE(AreImagesEqual(pca_image_serial, pca_image_parallel, 1.0e-9));
+  EXPECT_TRUE(AreImagesEqual(
+      spectral_pca_parallel.GetPCAImage(single_precision_image),
+      pca_image_parallel,
+      1.0e-5));
+  EXPECT_TRUE(AreImagesEqual(
+      spectral_pca_parallel.ReconstructImage(pca_image_parallel),
+      image,
+      kReconstructionErrorTolerance));
+}
+
+// Verifies that the randomized decomposition finds (almost) the same top PCA
+// bands as the full decomposition when the spectra are mostly low-rank.
+TEST(SpectralPCA, RandomizedDecomposition) {
+  const int num_channels = 40;
+  const int num_pca_bands = 3;
+  const cv::Size image_size(30, 30);
+  std::vector<cv::Mat> components(num_pca_bands);
+  for (int i = 0; i < num_pca_bands; ++i) {
+    components[i] =
+        cv::Mat(image_size, super_resolution::util::kOpenCvMatrixType);
+    cv::randu(components[i], 0.0, 1.0 / (i + 1));
+  }
+  ImageData image;
+  cv::Mat noise(image_size, super_resolution::util::kOpenCvMatrixType);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    cv::Mat channel_image = cv::Mat::zeros(
+        image_size, super_resolution::util::kOpenCvMatrixType);
+    for (int i = 0; i < num_pca_bands; ++i) {
+      channel_image += components[i] * std::cos(0.1 * (i + 1) * channel);
+    }
+    cv::randn(noise, cv::Scalar(0.0), cv::Scalar(0.001));
+    image.AddChannel(
+        channel_image + noise, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  }
+
+  super_resolution::SpectralPCAOptions options;
+  options.pixel_sampling_ratio = 1.0;
+  const super_resolution::SpectralPCA spectral_pca_full(
+      {image}, num_pca_bands, options);
+  options.use_randomized_decomposition = true;
+  options.randomized_oversampling = 5;
+  options.randomized_power_iterations = 2;
+  const super_resolution::SpectralPCA spectral_pca_randomized(
+      {image}, num_pca_bands, options);
+
+  const ImageData pca_image = spectral_pca_randomized.GetPCAImage(image);
+  EXPECT_EQ(pca_image.GetNumChannels(), num_pca_bands);
+  // The eigenvectors are only defined up to their sign, so the
+  // reconstructions are compared instead of the PCA bands.
+  const ImageData reconstruction_full =
+      spectral_pca_full.ReconstructImage(spectral_pca_full.GetPCAImage(image));
+  EXPECT_TRUE(AreImagesEqual(
+      spectral_pca_randomized.ReconstructImage(pca_image),
+      reconstruction_full,
+      0.001));
+  EXPECT_TRUE(AreImagesEqual(reconstruction_full, image, 0.01));
+}
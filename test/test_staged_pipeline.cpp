@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util/staged_pipeline.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::util::PipelineStage;
+using super_resolution::util::PipelineStageStatistics;
+using super_resolution::util::StagedPipeline;
+using testing::ElementsAreArray;
+
+// Verifies that every item passes through all stages with its state, and
+// that a single-thread stage gets the items in order even if the previous
+// stage finishes them out of order.
+TEST(StagedPipeline, PassesItemsThroughStagesInOrder) {
+  const int num_items = 30;
+  std::vector<int> finished_items;
+  std::vector<PipelineStage<std::vector<int>>> stages(3);
+  stages[0].name = "create";
+  stages[0].num_threads = 4;
+  stages[0].function = [](const int item_index, std::vector<int>* item) {
+    // Make later items (of every group of 3) finish earlier.
+    std::this_thread::sleep_for(
+        std::chrono::microseconds(100 * (3 - item_index % 3)));
+    item->push_back(item_index);
+  };
+  stages[1].name = "double";
+  stages[1].num_threads = 2;
+  stages[1].function = [](const int item_index, std::vector<int>* item) {
+    item->push_back(2 * item->back());
+  };
+  stages[2].name = "finish";
+  stages[2].function = [&finished_items](
+      const int item_index, std::vector<int>* item) {
+    ASSERT_EQ(item->size(), 2);
+    EXPECT_EQ((*item)[0], item_index);
+    EXPECT_EQ((*item)[1], 2 * item_index);
+    finished_items.push_back(item_index);
+  };
+
+  StagedPipeline<std::vector<int>> pipeline(stages, 2);
+  pipeline.Run(num_items);
+  std::vector<int> expected_items(num_items);
+  for (int i = 0; i < num_items; ++i) {
+    expected_items[i] = i;
+  }
+  EXPECT_THAT(finished_items, ElementsAreArray(expected_items));
+
+  const std::vector<PipelineStageStatistics> statistics =
+      pipeline.GetStageStatistics();
+  ASSERT_EQ(statistics.size(), 3);
+  EXPECT_EQ(statistics[0].name, "create");
+  EXPECT_GT(statistics[0].busy_seconds, 0.0);
+
+  // Running again processes the items again, and an empty run does nothing.
+  finished_items.clear();
+  pipeline.Run(5);
+  EXPECT_THAT(finished_items, ElementsAreArray({0, 1, 2, 3, 4}));
+  finished_items.clear();
+  pipeline.Run(0);
+  EXPECT_TRUE(finished_items.empty());
+}
+
+// Verifies that the stages run concurrently on different items, and that the
+// queues bound how far a fast stage runs ahead, from the order of the stage
+// start and end times. The solve of each item waits until the load of the
+// next one has started, which only happens if the stages overlap (otherwise
+// the wait times out and the overlap checks fail).
+TEST(StagedPipeline, OverlapsStagesWithBoundedQueues) {
+  typedef std::chrono::steady_clock::time_point TimePoint;
+  const int num_items = 6;
+  const int queue_capacity = 1;
+  std::mutex mutex;
+  std::condition_variable load_started;
+  std::vector<TimePoint> load_start_times(num_items);
+  std::vector<bool> has_load_started(num_items, false);
+  std::vector<TimePoint> solve_end_times(num_items);
+  std::vector<PipelineStage<int>> stages(2);
+  stages[0].name = "load";
+  stages[0].function = [&](const int item_index, int* item) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      load_start_times[item_index] = std::chrono::steady_clock::now();
+      has_load_started[item_index] = true;
+    }
+    load_started.notify_all();
+    *item = item_index;
+  };
+  stages[1].name = "solve";
+  stages[1].function = [&](const int item_index, int* item) {
+    EXPECT_EQ(*item, item_index);
+    std::unique_lock<std::mutex> lock(mutex);
+    if (item_index + 1 < num_items) {
+      load_started.wait_for(lock, std::chrono::seconds(10), [&]() {
+        return has_load_started[item_index + 1];
+      });
+    }
+    solve_end_times[item_index] = std::chrono::steady_clock::now();
+  };
+
+  StagedPipeline<int> pipeline(stages, queue_capacity);
+  pipeline.Run(num_items);
+
+  for (int i = 0; i + 1 < num_items; ++i) {
+    // The next item is loaded while this one is solved.
+    EXPECT_LT(load_start_times[i + 1], solve_end_times[i]) << "Item " << i;
+
+    // While this item is solved, the next one can wait in the queue and the
+    // one after it can be loaded (it is queued once the solve stage takes
+    // the next item). Later items only start once this one was solved.
+    const int first_blocked_item = i + queue_capacity + 2;
+    if (first_blocked_item < num_items) {
+      EXPECT_GE(load_start_times[first_blocked_item], solve_end_times[i])
+          << "Item " << i;
+    }
+  }
+}
+
+// Verifies that the number of items in the pipeline, from the start of the
+// first stage to the end of the last one, never exceeds the limit, even
+// though the queues would allow more.
+TEST(StagedPipeline, BoundsItemsInFlight) {
+  const int num_items = 20;
+  const int max_num_items_in_flight = 3;
+  std::mutex mutex;
+  int num_items_in_flight = 0;
+  int max_num_items_seen = 0;
+  std::vector<PipelineStage<int>> stages(3);
+  stages[0].name = "load";
+  stages[0].num_threads = 4;
+  stages[0].function = [&](const int item_index, int* item) {
+    std::lock_guard<std::mutex> lock(mutex);
+    num_items_in_flight++;
+    max_num_items_seen = std::max(max_num_items_seen, num_items_in_flight);
+  };
+  stages[1].name = "solve";
+  stages[1].function = [&](const int item_index, int* item) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  };
+  stages[2].name = "save";
+  stages[2].function = [&](const int item_index, int* item) {
+    std::lock_guard<std::mutex> lock(mutex);
+    num_items_in_flight--;
+  };
+
+  StagedPipeline<int> pipeline(stages, 4, max_num_items_in_flight);
+  pipeline.Run(num_items);
+  EXPECT_EQ(num_items_in_flight, 0);
+  EXPECT_LE(max_num_items_seen, max_num_items_in_flight);
+  EXPECT_GE(max_num_items_seen, 2);
+}
@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "optimization/stencil_regularizer.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::StencilPenalty;
+using super_resolution::StencilRegularizer;
+using super_resolution::StencilTerm;
+
+namespace {
+
+// Returns a deterministic pseudo-random image in [-1, 1].
+std::vector<double> GetTestImage(const int num_values) {
+  std::vector<double> image(num_values);
+  unsigned int seed = 17;
+  for (int i = 0; i < num_values; ++i) {
+    seed = seed * 1103515245 + 12345;
+    image[i] = static_cast<double>((seed >> 8) % 2000001) / 1e6 - 1.0;
+  }
+  return image;
+}
+
+// Returns the cost sum_p c_p r_p^2 of the regularizer.
+double GetCost(
+    const StencilRegularizer& regularizer,
+    const std::vector<double>& image,
+    const std::vector<double>& gradient_constants,
+    const int num_channels) {
+
+  const std::vector<double> residuals =
+      regularizer.ApplyToImage(image.data(), num_channels);
+  double cost = 0.0;
+  for (int i = 0; i < residuals.size(); ++i) {
+    cost += gradient_constants[i] * residuals[i] * residuals[i];
+  }
+  return cost;
+}
+
+// Checks the analytical gradient of the regularizer against central
+// differences of its cost.
+void ExpectGradientMatchesNumericalGradient(
+    const StencilRegularizer& regularizer,
+    const std::vector<double>& image,
+    const std::vector<double>& gradient_constants,
+    const int num_channels) {
+
+  const std::vector<double> gradient =
+      regularizer.ApplyToImageWithDifferentiation(
+          image.data(), gradient_constants, num_channels).second;
+  ASSERT_EQ(gradient.size(), image.size());
+  const double step = 1e-6;
+  for (int i = 0; i < image.size(); ++i) {
+    std::vector<double> image_plus = image;
+    std::vector<double> image_minus = image;
+    image_plus[i] += step;
+    image_minus[i] -= step;
+    const double numerical_gradient = (
+        GetCost(regularizer, image_plus, gradient_constants, num_channels) -
+        GetCost(regularizer, image_minus, gradient_constants, num_channels)) /
+        (2.0 * step);
+    EXPECT_NEAR(gradient[i], numerical_gradient, 1e-4) << "at index " << i;
+  }
+}
+
+}  // namespace
+
+// Verifies the residuals of a single pixel under each penalty.
+TEST(StencilRegularizer, Penalties) {
+  const cv::Size image_size(2, 2);
+  const std::vector<StencilTerm> stencil = {
+    StencilTerm(0, 1, 0, 1.0),
+    StencilTerm(1, 0, 0, 0.5)
+  };
+  // Differences at pixel (0, 0): 1 * (0.5 - 0) = 0.5 and 0.5 * (-4 - 0) = -2.
+  const std::vector<double> image = {0.0, 0.5, -4.0, 0.0};
+
+  const StencilRegularizer l1_regularizer(image_size, stencil);
+  EXPECT_DOUBLE_EQ(l1_regularizer.ApplyToImage(image.data(), 1)[0], 2.5);
+
+  // Huber with delta 1: 0.5^2 / 2 = 0.125 and 2 - 0.5 = 1.5.
+  const StencilRegularizer huber_regularizer(
+      image_size,
+      stencil,
+      StencilPenalty(super_resolution::STENCIL_PENALTY_HUBER, 1.0));
+  EXPECT_DOUBLE_EQ(huber_regularizer.ApplyToImage(image.data(), 1)[0], 1.625);
+
+  // Lp with p = 2: 0.25 + 4.
+  const StencilRegularizer lp_regularizer(
+      image_size,
+      stencil,
+      StencilPenalty(super_resolution::STENCIL_PENALTY_LP, 2.0));
+  EXPECT_DOUBLE_EQ(lp_regularizer.ApplyToImage(image.data(), 1)[0], 4.25);
+
+  // Only the 1-norm stencil has difference operators.
+  EXPECT_EQ(l1_regularizer.GetNumDifferenceOperators(), 2);
+  EXPECT_EQ(huber_regularizer.GetNumDifferenceOperators(), 0);
+  EXPECT_EQ(lp_regularizer.GetNumDifferenceOperators(), 0);
+}
+
+// Verifies the gradients of smooth penalties and of a stencil with negative
+// and channel offsets (a 3D BTV-like window) against numerical gradients.
+TEST(StencilRegularizer, GradientMatchesNumericalGradient) {
+  const cv::Size image_size(5, 4);
+  const int num_channels = 3;
+  const std::vector<double> image =
+      GetTestImage(image_size.area() * num_channels);
+  std::vector<double> gradient_constants(image.size());
+  for (int i = 0; i < gradient_constants.size(); ++i) {
+    gradient_constants[i] = 0.5 + (i % 7) * 0.1;
+  }
+
+  const StencilRegularizer huber_regularizer(
+      image_size,
+      super_resolution::GetTotalVariationStencil(true),
+      StencilPenalty(super_resolution::STENCIL_PENALTY_HUBER, 0.3));
+  ExpectGradientMatchesNumericalGradient(
+      huber_regularizer, image, gradient_constants, num_channels);
+
+  const std::vector<StencilTerm> window = {
+    StencilTerm(0, 1, 0, 1.0),
+    StencilTerm(1, -1, 0, 0.5),
+    StencilTerm(2, 1, 0, 0.25),
+    StencilTerm(0, 0, 1, 0.5),
+    StencilTerm(1, 0, 2, 0.25),
+    StencilTerm(-1, 1, 1, 0.125)
+  };
+  const StencilRegularizer lp_regularizer(
+      image_size,
+      window,
+      StencilPenalty(super_resolution::STENCIL_PENALTY_LP, 1.5));
+  ExpectGradientMatchesNumericalGradient(
+      lp_regularizer, image, gradient_constants, num_channels);
+
+  // Away from zero differences, the 1-norm gradient is also exact.
+  const StencilRegularizer l1_regularizer(image_size, window);
+  ExpectGradientMatchesNumericalGradient(
+      l1_regularizer, image, gradient_constants, num_channels);
+}
+
+// Verifies that splitting the rows between threads (which gathers the
+// gradient per row instead of scattering it) gives the same results as the
+// serial sweep, and that the tiled traversal of a stencil with channel
+// offsets covers every row.
+TEST(StencilRegularizer, ThreadedMatchesSerial) {
+  const cv::Size image_size(37, 29);
+  const int num_channels = 4;
+  const std::vector<double> image =
+      GetTestImage(image_size.area() * num_channels);
+  const std::vector<double> weights = GetTestImage(image.size());
+  const std::vector<StencilTerm> window = {
+    StencilTerm(0, 2, 0, 0.5),
+    StencilTerm(3, -2, 0, 0.125),
+    StencilTerm(1, 1, 1, 0.25),
+    StencilTerm(0, 0, 2, 1.0)
+  };
+  for (const StencilPenalty& penalty : {
+      StencilPenalty(),
+      StencilPenalty(super_resolution::STENCIL_PENALTY_HUBER, 0.1)}) {
+    const StencilRegularizer serial_regularizer(image_size, window, penalty);
+    StencilRegularizer threaded_regularizer(image_size, window, penalty);
+    threaded_regularizer.SetNumThreads(4);
+
+    std::vector<double> serial_gradient(image.size(), 1.0);
+    std::vector<double> serial_residuals(image.size());
+    const double serial_cost = serial_regularizer.AccumulateWeightedGradient(
+        image.data(), num_channels, 0.5, weights.data(),
+        serial_gradient.data(), serial_residuals.data());
+    std::vector<double> threaded_gradient(image.size(), 1.0);
+    std::vector<double> threaded_residuals(image.size());
+    const double threaded_cost =
+        threaded_regularizer.AccumulateWeightedGradient(
+            image.data(), num_channels, 0.5, weights.data(),
+            threaded_gradient.data(), threaded_residuals.data());
+
+    EXPECT_EQ(threaded_cost, serial_cost);
+    EXPECT_EQ(threaded_residuals, serial_residuals);
+    for (int i = 0; i < image.size(); ++i) {
+      EXPECT_NEAR(threaded_gradient[i], serial_gradient[i], 1e-12);
+    }
+
+    // The residuals are the same without a gradient, and without writing
+    // them out the cost and gradient do not change.
+    EXPECT_EQ(
+        threaded_regularizer.ApplyToImage(image.data(), num_channels),
+        serial_residuals);
+    std::vector<double> gradient(image.size(), 1.0);
+    EXPECT_EQ(
+        threaded_regularizer.AccumulateWeightedGradient(
+            image.data(), num_channels, 0.5, weights.data(),
+            gradient.data(), nullptr),
+        serial_cost);
+    EXPECT_EQ(gradient, threaded_gradient);
+  }
+}
+
+// Verifies that the fused total variation kernel of the serial sweep gives
+// the same results as the generic kernels, which are used for the same terms
+// in a different order.
+TEST(StencilRegularizer, TotalVariationKernelMatchesGeneric) {
+  const cv::Size image_size(23, 17);
+  const int num_channels = 3;
+  const std::vector<double> image =
+      GetTestImage(image_size.area() * num_channels);
+  const std::vector<double> weights = GetTestImage(image.size());
+  for (const bool use_3d_total_variation : {false, true}) {
+    const std::vector<StencilTerm> stencil =
+        super_resolution::GetTotalVariationStencil(use_3d_total_variation);
+    const std::vector<StencilTerm> reordered_stencil(
+        stencil.rbegin(), stencil.rend());
+    const StencilRegularizer fused_regularizer(image_size, stencil);
+    const StencilRegularizer generic_regularizer(
+        image_size, reordered_stencil);
+
+    std::vector<double> fused_gradient(image.size(), 1.0);
+    std::vector<double> fused_residuals(image.size());
+    const double fused_cost = fused_regularizer.AccumulateWeightedGradient(
+        image.data(), num_channels, 0.5, weights.data(),
+        fused_gradient.data(), fused_residuals.data());
+    std::vector<double> generic_gradient(image.size(), 1.0);
+    std::vector<double> generic_residuals(image.size());
+    const double generic_cost = generic_regularizer.AccumulateWeightedGradient(
+        image.data(), num_channels, 0.5, weights.data(),
+        generic_gradient.data(), generic_residuals.data());
+
+    EXPECT_NEAR(fused_cost, generic_cost, 1e-12 * std::abs(generic_cost));
+    for (int i = 0; i < image.size(); ++i) {
+      EXPECT_NEAR(fused_residuals[i], generic_residuals[i], 1e-12);
+      EXPECT_NEAR(fused_gradient[i], generic_gradient[i], 1e-12);
+    }
+  }
+}
+
+// Verifies that evaluating only the rows that reach the changed rows, with
+// the other rows cached from an earlier evaluation, gives the cost, values,
+// and gradient of the changed rows of a full evaluation.
+TEST(StencilRegularizer, ActiveRowsMatchWholeImage) {
+  const cv::Size image_size(23, 31);
+  const int num_channels = 2;
+  const std::vector<double> image =
+      GetTestImage(image_size.area() * num_channels);
+  const std::vector<double> weights = GetTestImage(image.size());
+  const std::vector<StencilTerm> window = {
+    StencilTerm(0, 1, 0, 1.0),
+    StencilTerm(2, -1, 0, 0.5),
+    StencilTerm(-1, 0, 1, 0.25)
+  };
+  const int first_active_row = 12;
+  const int last_active_row = 14;
+  std::vector<uint8_t> active_rows(image_size.height, 0);
+  std::vector<double> changed_image = image;
+  for (int row = first_active_row; row <= last_active_row; ++row) {
+    active_rows[row] = 1;
+    for (int channel = 0; channel < num_channels; ++channel) {
+      for (int col = 0; col < image_size.width; ++col) {
+        changed_image[channel * image_size.area() + row * image_size.width +
+                      col] += 0.1 * (col % 3);
+      }
+    }
+  }
+  for (const int num_threads : {1, 4}) {
+    StencilRegularizer regularizer(image_size, window);
+    regularizer.SetNumThreads(num_threads);
+    ASSERT_TRUE(regularizer.CanEvaluateRows());
+
+    std::vector<double> residuals(image.size());
+    std::vector<double> row_costs(image_size.height);
+    std::vector<double> gradient(image.size(), 0.0);
+    const double cost = regularizer.AccumulateWeightedGradientInRows(
+        image.data(), num_channels, 0.5, weights.data(), nullptr,
+        gradient.data(), residuals.data(), row_costs.data());
+    std::vector<double> expected_gradient(image.size(), 0.0);
+    EXPECT_EQ(
+        regularizer.AccumulateWeightedGradient(
+            image.data(), num_channels, 0.5, weights.data(),
+            expected_gradient.data(), nullptr),
+        cost);
+    EXPECT_EQ(gradient, expected_gradient);
+
+    std::vector<double> changed_gradient(image.size(), 0.0);
+    const double changed_cost = regularizer.AccumulateWeightedGradientInRows(
+        changed_image.data(), num_channels, 0.5, weights.data(), &active_rows,
+        changed_gradient.data(), residuals.data(), row_costs.data());
+    std::vector<double> expected_residuals(image.size());
+    std::fill(expected_gradient.begin(), expected_gradient.end(), 0.0);
+    EXPECT_NEAR(
+        regularizer.AccumulateWeightedGradient(
+            changed_image.data(), num_channels, 0.5, weights.data(),
+            expected_gradient.data(), expected_residuals.data()),
+        changed_cost,
+        1e-12);
+    EXPECT_EQ(residuals, expected_residuals);
+    for (int channel = 0; channel < num_channels; ++channel) {
+      for (int row = first_active_row; row <= last_active_row; ++row) {
+        for (int col = 0; col < image_size.width; ++col) {
+          const int index = channel * image_size.area() +
+              row * image_size.width + col;
+          EXPECT_NEAR(changed_gradient[index], expected_gradient[index], 1e-12);
+        }
+      }
+    }
+  }
+}
+
+// Verifies that the transpose of the difference operators is the adjoint of
+// the operators: <D x, y> = <x, D^T y>.
+TEST(StencilRegularizer, DifferenceOperatorsTranspose) {
+  const cv::Size image_size(6, 5);
+  const int num_channels = 2;
+  const int num_values = image_size.area() * num_channels;
+  const std::vector<StencilTerm> window = {
+    StencilTerm(0, 1, 0, 1.0),
+    StencilTerm(2, -1, 0, -0.5),
+    StencilTerm(0, 0, 1, 0.25)
+  };
+  const StencilRegularizer regularizer(image_size, window);
+  ASSERT_EQ(regularizer.GetNumDifferenceOperators(), 3);
+
+  const std::vector<double> image = GetTestImage(num_values);
+  std::vector<double> differences(3 * num_values);
+  regularizer.ApplyDifferenceOperators(
+      image.data(), num_channels, differences.data());
+  // Pixel (0, 0) of the first channel: 0.25 * (channel 1 - channel 0).
+  EXPECT_DOUBLE_EQ(
+      differences[2 * num_values],
+      0.25 * (image[image_size.area()] - image[0]));
+  // The last row has no neighbors two rows below.
+  EXPECT_EQ(differences[num_values + 4 * 6 + 1], 0.0);
+
+  const std::vector<double> dual = GetTestImage(3 * num_values + 1);
+  std::vector<double> transposed(num_values);
+  regularizer.ApplyDifferenceOperatorsTranspose(
+      dual.data() + 1, num_channels, transposed.data());
+  double forward_product = 0.0;
+  for (int i = 0; i < differences.size(); ++i) {
+    forward_product += differences[i] * dual[i + 1];
+  }
+  double transpose_product = 0.0;
+  for (int i = 0; i < num_values; ++i) {
+    transpose_product += image[i] * transposed[i];
+  }
+  EXPECT_NEAR(forward_product, transpose_product, 1e-10);
+}
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/motion_module.h"
+#include "motion/motion_shift.h"
+#include "video/super_resolver.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::MotionShift;
+
+// Verifies that every streamed frame is super-resolved exactly once, in
+// order, at the high-resolution size, and that only the window is kept.
+TEST(SuperResolver, StreamsFramesInOrder) {
+  const int num_frames = 6;
+  cv::Mat base_image(24, 32, CV_64FC1);
+  cv::randu(base_image, 0.0, 1.0);
+  const ImageData base_frame(base_image);
+
+  super_resolution::SuperResolutionOptions options;
+  options.scale = 2;
+  options.temporal_radius = 2;
+  options.num_iterations = 1;
+  options.num_threads = 2;
+
+  std::vector<int> emitted_frame_indices;
+  super_resolution::SuperResolver super_resolver(
+      options,
+      [&emitted_frame_indices](
+          const int frame_index, const ImageData& high_res_frame) {
+        emitted_frame_indices.push_back(frame_index);
+        EXPECT_EQ(high_res_frame.GetImageSize(), cv::Size(64, 48));
+        EXPECT_EQ(high_res_frame.GetNumChannels(), 1);
+      });
+
+  for (int i = 0; i < num_frames; ++i) {
+    ImageData frame = base_frame;
+    const super_resolution::MotionModule motion_module(
+        super_resolution::MotionShiftSequence({MotionShift(i % 2, i % 3)}));
+    motion_module.ApplyToImage(&frame, 0);
+    super_resolver.AddFrame(frame);
+    // A frame is emitted once the temporal_radius frames after it arrived.
+    EXPECT_EQ(super_resolver.GetNumFramesEmitted(),
+              std::max(0, i + 1 - options.temporal_radius));
+  }
+  super_resolver.Finish();
+
+  EXPECT_EQ(super_resolver.GetNumFramesEmitted(), num_frames);
+  EXPECT_THAT(emitted_frame_indices, ::testing::ElementsAre(0, 1, 2, 3, 4, 5));
+}
+
+// Verifies that the recursive mode emits every frame as soon as it is added,
+// independent of the temporal radius, and that the results stay close to the
+// true high-resolution frames of a moving scene.
+TEST(SuperResolver, RecursiveModeEmitsEveryFrame) {
+  const int num_frames = 5;
+  const int scale = 2;
+  cv::Mat high_res_image(48, 64, CV_64FC1);
+  for (int row = 0; row < high_res_image.rows; ++row) {
+    for (int col = 0; col < high_res_image.cols; ++col) {
+      high_res_image.at<double>(row, col) =
+          0.5 + 0.2 * std::sin(0.3 * col + 0.2 * row) +
+          0.2 * std::cos(0.25 * col - 0.35 * row);
+    }
+  }
+
+  super_resolution::SuperResolutionOptions options;
+  options.scale = scale;
+  options.temporal_radius = 10;  // Ignored in recursive mode.
+  options.recursive = true;
+  options.blur_radius = 0;
+  options.num_iterations = 2;
+  options.num_threads = 2;
+
+  std::vector<int> emitted_frame_indices;
+  std::vector<double> errors;
+  std::vector<ImageData> true_frames;
+  super_resolution::SuperResolver super_resolver(
+      options,
+      [&](const int frame_index, const ImageData& high_res_frame) {
+        emitted_frame_indices.push_back(frame_index);
+        ASSERT_EQ(high_res_frame.GetImageSize(), cv::Size(64, 48));
+        // Leave out the borders that moved in from outside the frame.
+        const cv::Rect interior(8, 8, 48, 32);
+        errors.push_back(cv::norm(
+            high_res_frame.GetChannelImage(0)(interior),
+            true_frames[frame_index].GetChannelImage(0)(interior),
+            cv::NORM_INF));
+      });
+
+  for (int i = 0; i < num_frames; ++i) {
+    // The scene moves by one HR pixel per frame, so every other frame is at a
+    // new sub-pixel phase of the LR grid.
+    ImageData true_frame;
+    true_frame.AddChannel(
+        high_res_image, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+    const super_resolution::MotionModule motion_module(
+        super_resolution::MotionShiftSequence({MotionShift(i, 0)}));
+    motion_module.ApplyToImage(&true_frame, 0);
+    true_frames.push_back(true_frame);
+
+    ImageData frame = true_frame;
+    frame.ResizeImage(1.0 / scale, super_resolution::INTERPOLATE_NEAREST);
+    super_resolver.AddFrame(frame);
+    EXPECT_EQ(super_resolver.GetNumFramesEmitted(), i + 1);
+  }
+  super_resolver.Finish();
+
+  EXPECT_THAT(emitted_frame_indices, ::testing::ElementsAre(0, 1, 2, 3, 4));
+  ASSERT_EQ(errors.size(), num_frames);
+  for (const double error : errors) {
+    EXPECT_LT(error, 0.25);
+  }
+}
@@ -0,0 +1,75 @@
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "image/image_data.h"
+#include "optimization/temporal_prior_regularizer.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using testing::SizeIs;
+
+// A 2-channel 3x2 prior and a confidence that is 0 on the left column.
+ImageData GetTestPrior() {
+  const cv::Mat channel_1 = (cv::Mat_<double>(2, 3) <<
+      0.1, 0.2, 0.3,
+      0.4, 0.5, 0.6);
+  ImageData prior;
+  prior.AddChannel(channel_1, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  prior.AddChannel(1.0 - channel_1, super_resolution::DO_NOT_NORMALIZE_IMAGE);
+  return prior;
+}
+
+const cv::Mat test_confidence = (cv::Mat_<double>(2, 3) <<
+    0.0, 1.0, 0.5,
+    0.0, 0.25, 1.0);
+
+// Verifies the values, the gradient and the Hessian diagonal against the
+// definition r_i = c_i |x_i - p_i|.
+TEST(TemporalPriorRegularizer, ValuesAndDerivatives) {
+  const ImageData prior = GetTestPrior();
+  const super_resolution::TemporalPriorRegularizer regularizer(
+      prior, test_confidence);
+
+  std::vector<double> image(12);
+  for (int i = 0; i < 12; ++i) {
+    image[i] = 0.05 * i;
+  }
+  std::vector<double> prior_values;
+  for (int channel = 0; channel < 2; ++channel) {
+    const cv::Mat prior_channel = prior.GetChannelImage(channel);
+    for (int i = 0; i < 6; ++i) {
+      prior_values.push_back(prior_channel.at<double>(i / 3, i % 3));
+    }
+  }
+
+  const std::vector<double> gradient_constants(12, 0.5);
+  const std::pair<std::vector<double>, std::vector<double>> result =
+      regularizer.ApplyToImageWithDifferentiation(
+          image.data(), gradient_constants, 2);
+  EXPECT_THAT(result.first, SizeIs(12));
+  EXPECT_THAT(result.second, SizeIs(12));
+  const std::vector<double> values = regularizer.ApplyToImage(image.data(), 2);
+  std::vector<double> diagonal(12, 1.0);
+  regularizer.AddWeightedHessianDiagonal(
+      gradient_constants, 2, diagonal.data());
+  for (int i = 0; i < 12; ++i) {
+    const double confidence = test_confidence.at<double>((i % 6) / 3, i % 3);
+    const double difference = image[i] - prior_values[i];
+    EXPECT_NEAR(values[i], confidence * std::abs(difference), 1e-12);
+    EXPECT_NEAR(result.first[i], values[i], 1e-12);
+    EXPECT_NEAR(
+        result.second[i],
+        2.0 * 0.5 * confidence * confidence * difference,
+        1e-12);
+    EXPECT_NEAR(diagonal[i], 1.0 + confidence * confidence, 1e-12);
+  }
+
+  // Pixels without confidence are not regularized.
+  EXPECT_EQ(values[0], 0.0);
+  EXPECT_EQ(values[6 + 3], 0.0);
+}
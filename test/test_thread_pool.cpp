@@ -0,0 +1,95 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "util/thread_pool.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::util::ThreadPool;
+using testing::Each;
+
+// Verifies that every task is run exactly once.
+TEST(ThreadPool, ParallelFor) {
+  ThreadPool thread_pool(4);
+  EXPECT_EQ(thread_pool.GetNumThreads(), 4);
+
+  const int num_tasks = 1000;
+  std::vector<int> num_times_run(num_tasks, 0);
+  thread_pool.ParallelFor(num_tasks, [&num_times_run](const int task_index) {
+    num_times_run[task_index]++;
+  });
+  EXPECT_THAT(num_times_run, Each(1));
+
+  // Zero or one task should also work.
+  thread_pool.ParallelFor(0, [](const int task_index) {
+    FAIL() << "No task should be run.";
+  });
+  int single_task_index = -1;
+  thread_pool.ParallelFor(1, [&single_task_index](const int task_index) {
+    single_task_index = task_index;
+  });
+  EXPECT_EQ(single_task_index, 0);
+}
+
+// Verifies that nested calls to ParallelFor do not deadlock, even when there
+// are more outer tasks than worker threads.
+TEST(ThreadPool, NestedParallelFor) {
+  ThreadPool thread_pool(2);
+  const int num_outer_tasks = 8;
+  const int num_inner_tasks = 50;
+  std::atomic<int> num_inner_tasks_run(0);
+  thread_pool.ParallelFor(num_outer_tasks, [&](const int outer_index) {
+    thread_pool.ParallelFor(num_inner_tasks, [&](const int inner_index) {
+      num_inner_tasks_run++;
+    });
+  });
+  EXPECT_EQ(num_inner_tasks_run, num_outer_tasks * num_inner_tasks);
+}
+
+// Verifies that all work is still done when the library-wide thread cap is
+// changed, including when it is lowered to a single thread, and that no more
+// tasks than the cap run at the same time.
+TEST(ThreadPool, MaxNumThreads) {
+  using super_resolution::util::GetMaxNumThreads;
+  using super_resolution::util::GetNumThreadsToUse;
+  using super_resolution::util::SetMaxNumThreads;
+
+  SetMaxNumThreads(3);
+  EXPECT_EQ(GetMaxNumThreads(), 3);
+  EXPECT_EQ(GetNumThreadsToUse(0), 3);
+  EXPECT_EQ(GetNumThreadsToUse(5), 5);
+
+  ThreadPool thread_pool(8);
+  const int num_tasks = 200;
+  std::atomic<int> num_tasks_run(0);
+  std::atomic<int> num_running_tasks(0);
+  std::atomic<int> max_num_running_tasks(0);
+  thread_pool.ParallelFor(num_tasks, [&](const int task_index) {
+    thread_pool.ParallelFor(4, [&](const int inner_index) {
+      const int num_running = ++num_running_tasks;
+      int max_num_running = max_num_running_tasks;
+      while (num_running > max_num_running &&
+             !max_num_running_tasks.compare_exchange_weak(
+                 max_num_running, num_running)) {}
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      num_tasks_run++;
+      num_running_tasks--;
+    });
+  });
+  EXPECT_EQ(num_tasks_run, num_tasks * 4);
+  EXPECT_LE(max_num_running_tasks, 3);
+
+  SetMaxNumThreads(1);
+  num_tasks_run = 0;
+  thread_pool.ParallelFor(num_tasks, [&](const int task_index) {
+    num_tasks_run++;
+  });
+  EXPECT_EQ(num_tasks_run, num_tasks);
+
+  // Restore the default of one thread per hardware thread.
+  SetMaxNumThreads(0);
+  EXPECT_GE(GetMaxNumThreads(), 1);
+}
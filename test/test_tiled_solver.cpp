@@ -0,0 +1,248 @@
+#include <atomic>
+#include <vector>
+
+#include "image/image_data.h"
+#include "image_model/image_model.h"
+#include "motion/motion_shift.h"
+#include "optimization/irls_map_solver.h"
+#include "optimization/tiled_solver.h"
+#include "util/test_util.h"
+
+#include "opencv2/core/core.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::ImageData;
+using super_resolution::test::AreMatricesEqual;
+
+constexpr bool kPrintSolverOutput = false;
+constexpr double kSolverResultErrorTolerance = 0.001;
+
+namespace {
+
+// Returns the image model of the small, "perfect" data set used in the
+// MapSolver tests: each of the four LR images sees a different pixel of every
+// 2x2 HR block.
+super_resolution::ImageModel GetSmallDataImageModel() {
+  super_resolution::MotionShiftSequence motion_shift_sequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(-1, 0),
+    super_resolution::MotionShift(0, -1),
+    super_resolution::MotionShift(-1, -1)
+  });
+  super_resolution::ImageModelParameters model_parameters;
+  model_parameters.scale = 2;
+  model_parameters.motion_sequence = motion_shift_sequence;
+  return super_resolution::ImageModel::CreateImageModel(model_parameters);
+}
+
+// Returns constant LR images of the given size, which are consistent with the
+// repeated 2x2 pattern given by GetSmallDataGroundTruth().
+std::vector<ImageData> GetSmallDataLowResImages(const cv::Size& size) {
+  const std::vector<double> lr_values = {0.4, 0.2, 0.0, 1.0};
+  std::vector<ImageData> low_res_images;
+  for (const double value : lr_values) {
+    low_res_images.push_back(ImageData(cv::Mat::ones(size, CV_64FC1) * value));
+  }
+  return low_res_images;
+}
+
+cv::Mat GetSmallDataGroundTruth(const cv::Size& size) {
+  cv::Mat ground_truth(size, CV_64FC1);
+  for (int row = 0; row < size.height; ++row) {
+    for (int col = 0; col < size.width; ++col) {
+      if (row % 2 == 0) {
+        ground_truth.at<double>(row, col) = (col % 2 == 0) ? 0.4 : 0.2;
+      } else {
+        ground_truth.at<double>(row, col) = (col % 2 == 0) ? 0.0 : 1.0;
+      }
+    }
+  }
+  return ground_truth;
+}
+
+}  // namespace
+
+TEST(TiledSolver, GetTileHaloSize) {
+  const super_resolution::MotionShiftSequence motion_shift_sequence({
+    super_resolution::MotionShift(0, 0),
+    super_resolution::MotionShift(1.5, -2.5)
+  });
+  // 2 * (5 / 2 + 3) + 2 + 1 = 13, rounded up to a multiple of 2.
+  EXPECT_EQ(super_resolution::GetTileHaloSize(2, 5, motion_shift_sequence, 1),
+            14);
+  // Without blur, motion or regularization, only the downsampling grid
+  // contributes to the halo.
+  EXPECT_EQ(super_resolution::GetTileHaloSize(
+      3, 0, super_resolution::MotionShiftSequence(), 0), 3);
+}
+
+// Tiles that return their initial estimate unchanged must blend back into the
+// initial estimate exactly, for both serial and concurrent tile solves.
+TEST(TiledSolver, IdentityTilesReproduceInitialEstimate) {
+  const super_resolution::ImageModel image_model = GetSmallDataImageModel();
+  const cv::Size low_res_size(6, 10);
+  const std::vector<ImageData> low_res_images =
+      GetSmallDataLowResImages(low_res_size);
+  cv::Mat initial_estimate_matrix(20, 12, CV_64FC1);
+  cv::randu(initial_estimate_matrix, 0.0, 1.0);
+  const ImageData initial_estimate(initial_estimate_matrix);
+
+  for (const int num_tile_workers : {1, 3}) {
+    super_resolution::TiledSolverOptions solver_options;
+    solver_options.tile_size = 7;  // Rounded up to 8.
+    solver_options.halo_size = 4;
+    solver_options.num_tile_workers = num_tile_workers;
+
+    std::atomic<int> num_tiles_solved(0);
+    super_resolution::TiledSolver solver(
+        solver_options,
+        image_model,
+        low_res_images,
+        [&num_tiles_solved](
+            const std::vector<ImageData>& tile_low_res_images,
+            const ImageData& tile_initial_estimate,
+            const super_resolution::TiledSolverTile& tile) {
+          const cv::Size tile_size = tile_initial_estimate.GetImageSize();
+          EXPECT_EQ(tile_size, tile.padded_region.size());
+          EXPECT_EQ(tile.interior & tile.padded_region, tile.interior);
+          const cv::Size tile_low_res_size =
+              tile_low_res_images[0].GetImageSize();
+          EXPECT_EQ(tile_low_res_images.size(), 4);
+          EXPECT_EQ(tile_size.width, tile_low_res_size.width * 2);
+          EXPECT_EQ(tile_size.height, tile_low_res_size.height * 2);
+          num_tiles_solved++;
+          return tile_initial_estimate;
+        },
+        kPrintSolverOutput);
+    const ImageData result = solver.Solve(initial_estimate);
+
+    // The 12x20 image is split into 2x3 tiles.
+    EXPECT_EQ(num_tiles_solved.load(), 6);
+    EXPECT_EQ(result.GetNumChannels(), 1);
+    EXPECT_TRUE(AreMatricesEqual(
+        result.GetChannelImage(0), initial_estimate_matrix, 1.0e-12));
+  }
+}
+
+// Solving a region of interest must only solve tiles around the region (padded
+// by the halo), and return the region of the blended result, even if the
+// region is not aligned with the LR grid.
+TEST(TiledSolver, RegionOfInterest) {
+  const super_resolution::ImageModel image_model = GetSmallDataImageModel();
+  const std::vector<ImageData> low_res_images =
+      GetSmallDataLowResImages(cv::Size(16, 16));
+  cv::Mat initial_estimate_matrix(32, 32, CV_64FC1);
+  cv::randu(initial_estimate_matrix, 0.0, 1.0);
+  const ImageData initial_estimate(initial_estimate_matrix);
+
+  const cv::Rect region_of_interest(3, 5, 5, 6);
+  for (const int tile_size : {16, 4}) {
+    super_resolution::TiledSolverOptions solver_options;
+    solver_options.tile_size = tile_size;
+    solver_options.halo_size = 4;
+    solver_options.region_of_interest = region_of_interest;
+
+    int num_tiles_solved = 0;
+    super_resolution::TiledSolver solver(
+        solver_options,
+        image_model,
+        low_res_images,
+        [&num_tiles_solved](
+            const std::vector<ImageData>& tile_low_res_images,
+            const ImageData& tile_initial_estimate,
+            const super_resolution::TiledSolverTile& tile) {
+          // The region is solved as (2, 4, 6, 8), and the halo is cropped at
+          // the top and left image borders.
+          const cv::Size tile_size = tile_initial_estimate.GetImageSize();
+          EXPECT_LE(tile_size.width, 12);
+          EXPECT_LE(tile_size.height, 16);
+          num_tiles_solved++;
+          return tile_initial_estimate;
+        },
+        kPrintSolverOutput);
+    const ImageData result = solver.Solve(initial_estimate);
+
+    // The aligned 6x8 region is one tile of size 16, or 2x2 tiles of size 4.
+    EXPECT_EQ(num_tiles_solved, (tile_size == 16) ? 1 : 4);
+    EXPECT_EQ(result.GetImageSize(), region_of_interest.size());
+    EXPECT_TRUE(AreMatricesEqual(
+        result.GetChannelImage(0),
+        initial_estimate_matrix(region_of_interest),
+        1.0e-12));
+  }
+}
+
+// The tile with the most detail must be solved first, and the other tiles in
+// row-major order.
+TEST(TiledSolver, DetailedTilesAreSolvedFirst) {
+  const super_resolution::ImageModel image_model = GetSmallDataImageModel();
+  const std::vector<ImageData> low_res_images =
+      GetSmallDataLowResImages(cv::Size(8, 8));
+  cv::Mat initial_estimate_matrix = cv::Mat::zeros(16, 16, CV_64FC1);
+  cv::randu(initial_estimate_matrix(cv::Rect(8, 8, 8, 8)), 0.0, 1.0);
+  const ImageData initial_estimate(initial_estimate_matrix);
+
+  super_resolution::TiledSolverOptions solver_options;
+  solver_options.tile_size = 8;
+  solver_options.halo_size = 0;
+
+  std::vector<int> solved_tile_indices;
+  super_resolution::TiledSolver solver(
+      solver_options,
+      image_model,
+      low_res_images,
+      [&solved_tile_indices](
+          const std::vector<ImageData>& tile_low_res_images,
+          const ImageData& tile_initial_estimate,
+          const super_resolution::TiledSolverTile& tile) {
+        solved_tile_indices.push_back(tile.index);
+        return tile_initial_estimate;
+      },
+      kPrintSolverOutput);
+  const ImageData result = solver.Solve(initial_estimate);
+
+  EXPECT_THAT(solved_tile_indices, testing::ElementsAre(3, 0, 1, 2));
+  EXPECT_TRUE(AreMatricesEqual(
+      result.GetChannelImage(0), initial_estimate_matrix, 1.0e-12));
+}
+
+// Solving the small data set in tiles should find the same exact solution as
+// solving the whole image at once.
+TEST(TiledSolver, SmallDataTest) {
+  const super_resolution::ImageModel image_model = GetSmallDataImageModel();
+  const cv::Size low_res_size(8, 8);
+  const std::vector<ImageData> low_res_images =
+      GetSmallDataLowResImages(low_res_size);
+  const ImageData initial_estimate(cv::Mat::zeros(16, 16, CV_64FC1));
+
+  super_resolution::TiledSolverOptions solver_options;
+  solver_options.tile_size = 8;
+  solver_options.halo_size = 2;
+  solver_options.num_tile_workers = 2;
+
+  const super_resolution::IRLSMapSolverOptions irls_solver_options;
+  super_resolution::TiledSolver solver(
+      solver_options,
+      image_model,
+      low_res_images,
+      [&image_model, &irls_solver_options](
+          const std::vector<ImageData>& tile_low_res_images,
+          const ImageData& tile_initial_estimate,
+          const super_resolution::TiledSolverTile& tile) {
+        super_resolution::IRLSMapSolver tile_solver(
+            irls_solver_options,
+            image_model,
+            tile_low_res_images,
+            kPrintSolverOutput);
+        return tile_solver.Solve(tile_initial_estimate);
+      },
+      kPrintSolverOutput);
+  const ImageData result = solver.Solve(initial_estimate);
+
+  EXPECT_TRUE(AreMatricesEqual(
+      result.GetChannelImage(0),
+      GetSmallDataGroundTruth(cv::Size(16, 16)),
+      kSolverResultErrorTolerance));
+}
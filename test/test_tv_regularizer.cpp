@@ -144,8 +144,6 @@ TEST(TotalVariationRegularizer, ApplyToImage3d) {
   EXPECT_THAT(returned_residuals, ContainerEq(expected_residuals));
 }
 
-// TODO: test 3D TV once it is implemented.
-
 // Verifies that the derivatives are also being computed correctly.
 TEST(TotalVariationRegularizer, ApplyToImageWithDifferentiation) {
   const super_resolution::TotalVariationRegularizer tv_regularizer(
@@ -196,3 +194,347 @@ TEST(TotalVariationRegularizer, ApplyToImageWithDifferentiation) {
     EXPECT_NEAR(numerical_gradient_at_i, gradient[i], gradient_error_tolerance);
   }
 }
+
+// Verifies the derivatives of 3D total variation with non-uniform gradient
+// constants on a multi-channel, non-square image.
+TEST(TotalVariationRegularizer, ApplyToImageWithDifferentiation3d) {
+  const cv::Size image_size(4, 3);
+  const int num_channels = 3;
+  const int num_parameters = image_size.area() * num_channels;
+
+  // Use distinct values so that no two neighboring pixels are equal, since
+  // the absolute value is not differentiable there.
+  std::vector<double> image_data(num_parameters);
+  std::vector<double> gradient_constants(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = std::sin(1.7 * i) + 0.01 * i;
+    gradient_constants[i] = 0.5 + (i % 3) * 0.25;
+  }
+
+  super_resolution::TotalVariationRegularizer tv_regularizer(image_size);
+  tv_regularizer.SetUse3dTotalVariation(true);
+  const auto& residuals_and_gradient =
+      tv_regularizer.ApplyToImageWithDifferentiation(
+          image_data.data(), gradient_constants, num_channels);
+  const std::vector<double> expected_residuals =
+      tv_regularizer.ApplyToImage(image_data.data(), num_channels);
+  EXPECT_THAT(residuals_and_gradient.first, ContainerEq(expected_residuals));
+  const std::vector<double>& gradient = residuals_and_gradient.second;
+  ASSERT_THAT(gradient, SizeIs(num_parameters));
+
+  // Returns the weighted residual sum c * r^2 for the given data.
+  const auto get_weighted_residual_sum =
+      [&](const std::vector<double>& data) {
+    const std::vector<double> residuals =
+        tv_regularizer.ApplyToImage(data.data(), num_channels);
+    double residual_sum = 0.0;
+    for (int i = 0; i < num_parameters; ++i) {
+      residual_sum += gradient_constants[i] * residuals[i] * residuals[i];
+    }
+    return residual_sum;
+  };
+
+  const double finite_difference = 1e-6;
+  const double gradient_error_tolerance = 0.0001;
+  for (int i = 0; i < num_parameters; ++i) {
+    std::vector<double> pos_diff_image_data = image_data;
+    pos_diff_image_data[i] += finite_difference;
+    std::vector<double> neg_diff_image_data = image_data;
+    neg_diff_image_data[i] -= finite_difference;
+    const double numerical_gradient_at_i =
+        (get_weighted_residual_sum(pos_diff_image_data) -
+         get_weighted_residual_sum(neg_diff_image_data)) /
+        (2 * finite_difference);
+    EXPECT_NEAR(numerical_gradient_at_i, gradient[i], gradient_error_tolerance);
+  }
+}
+
+// Verifies that the difference operators reproduce the regularizer values and
+// that the transpose operators are the adjoints of the operators.
+TEST(TotalVariationRegularizer, DifferenceOperators) {
+  const cv::Size image_size(4, 3);
+  const int num_channels = 3;
+  const int num_data_points = image_size.area() * num_channels;
+  std::vector<double> image_data(num_data_points);
+  for (int i = 0; i < num_data_points; ++i) {
+    image_data[i] = std::sin(1.3 * i) * 2.0;
+  }
+
+  for (const bool use_3d_total_variation : {false, true}) {
+    super_resolution::TotalVariationRegularizer tv_regularizer(image_size);
+    tv_regularizer.SetUse3dTotalVariation(use_3d_total_variation);
+    const int num_operators = tv_regularizer.GetNumDifferenceOperators();
+    EXPECT_EQ(num_operators, use_3d_total_variation ? 3 : 2);
+
+    // r_i = sum_k |(G_k x)_i|.
+    std::vector<double> differences(num_operators * num_data_points);
+    tv_regularizer.ApplyDifferenceOperators(
+        image_data.data(), num_channels, differences.data());
+    const std::vector<double> residuals =
+        tv_regularizer.ApplyToImage(image_data.data(), num_channels);
+    for (int i = 0; i < num_data_points; ++i) {
+      double residual = 0.0;
+      for (int k = 0; k < num_operators; ++k) {
+        residual += std::abs(differences[k * num_data_points + i]);
+      }
+      EXPECT_NEAR(residuals[i], residual, 1e-12);
+    }
+
+    // <Gx, d> = <x, G^T d>.
+    std::vector<double> test_differences(num_operators * num_data_points);
+    for (int i = 0; i < test_differences.size(); ++i) {
+      test_differences[i] = std::cos(0.7 * i);
+    }
+    std::vector<double> transpose(num_data_points);
+    tv_regularizer.ApplyDifferenceOperatorsTranspose(
+        test_differences.data(), num_channels, transpose.data());
+    double differences_dot_product = 0.0;
+    for (int i = 0; i < differences.size(); ++i) {
+      differences_dot_product += differences[i] * test_differences[i];
+    }
+    double image_dot_product = 0.0;
+    for (int i = 0; i < num_data_points; ++i) {
+      image_dot_product += image_data[i] * transpose[i];
+    }
+    EXPECT_NEAR(differences_dot_product, image_dot_product, 1e-9);
+  }
+}
+
+// Verifies that the weighted Hessian diagonal matches the squared columns of
+// the difference operators, 2 sum_i c_i sum_k (G_k)_ij^2.
+TEST(TotalVariationRegularizer, WeightedHessianDiagonal) {
+  const cv::Size image_size(4, 3);
+  const int num_channels = 2;
+  const int num_data_points = image_size.area() * num_channels;
+  std::vector<double> gradient_constants(num_data_points);
+  for (int i = 0; i < num_data_points; ++i) {
+    gradient_constants[i] = 1.0 + 0.5 * (i % 5);
+  }
+
+  for (const bool use_3d_total_variation : {false, true}) {
+    super_resolution::TotalVariationRegularizer tv_regularizer(image_size);
+    tv_regularizer.SetUse3dTotalVariation(use_3d_total_variation);
+    const int num_operators = tv_regularizer.GetNumDifferenceOperators();
+
+    std::vector<double> diagonal(num_data_points, 0.0);
+    tv_regularizer.AddWeightedHessianDiagonal(
+        gradient_constants, num_channels, diagonal.data());
+
+    // Column j of the operators is the result of applying them to e_j.
+    std::vector<double> unit_vector(num_data_points, 0.0);
+    std::vector<double> differences(num_operators * num_data_points);
+    for (int j = 0; j < num_data_points; ++j) {
+      unit_vector[j] = 1.0;
+      tv_regularizer.ApplyDifferenceOperators(
+          unit_vector.data(), num_channels, differences.data());
+      unit_vector[j] = 0.0;
+      double expected_value = 0.0;
+      for (int k = 0; k < num_operators; ++k) {
+        for (int i = 0; i < num_data_points; ++i) {
+          const double difference = differences[k * num_data_points + i];
+          expected_value +=
+              2.0 * gradient_constants[i] * difference * difference;
+        }
+      }
+      EXPECT_NEAR(diagonal[j], expected_value, 1e-12);
+    }
+  }
+}
+
+// Computes the expected total variation residuals and the gradient of the
+// weighted squared residuals directly from the definition, with 3D TV if
+// requested.
+void ComputeExpectedTotalVariation(
+    const std::vector<double>& image_data,
+    const std::vector<double>& gradient_constants,
+    const cv::Size& image_size,
+    const int num_channels,
+    const bool use_3d_total_variation,
+    std::vector<double>* expected_residuals,
+    std::vector<double>* expected_gradient) {
+
+  const int num_pixels = image_size.area();
+  expected_residuals->assign(num_pixels * num_channels, 0.0);
+  expected_gradient->assign(num_pixels * num_channels, 0.0);
+  for (int channel = 0; channel < num_channels; ++channel) {
+    for (int row = 0; row < image_size.height; ++row) {
+      for (int col = 0; col < image_size.width; ++col) {
+        const int index = channel * num_pixels + row * image_size.width + col;
+        std::vector<int> neighbors;
+        if (col + 1 < image_size.width) {
+          neighbors.push_back(index + 1);
+        }
+        if (row + 1 < image_size.height) {
+          neighbors.push_back(index + image_size.width);
+        }
+        if (use_3d_total_variation && channel + 1 < num_channels) {
+          neighbors.push_back(index + num_pixels);
+        }
+        double residual = 0.0;
+        for (const int neighbor : neighbors) {
+          residual += std::abs(image_data[neighbor] - image_data[index]);
+        }
+        (*expected_residuals)[index] = residual;
+        const double weight = 2.0 * gradient_constants[index] * residual;
+        for (const int neighbor : neighbors) {
+          const double sign =
+              (image_data[neighbor] > image_data[index]) ? 1.0 : -1.0;
+          (*expected_gradient)[index] -= weight * sign;
+          (*expected_gradient)[neighbor] += weight * sign;
+        }
+      }
+    }
+  }
+}
+
+// Verifies 3D total variation on wide images, whose rows are traversed in
+// several cache tiles across the channels, against a direct computation.
+TEST(TotalVariationRegularizer, TiledTraversal3d) {
+  const cv::Size image_size(4096, 5);
+  const int num_channels = 3;
+  const int num_pixels = image_size.area();
+  const int num_parameters = num_pixels * num_channels;
+  std::vector<double> image_data(num_parameters);
+  std::vector<double> gradient_constants(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = std::sin(1.7 * i) + 0.01 * (i % 101);
+    gradient_constants[i] = 0.5 + (i % 3) * 0.25;
+  }
+
+  std::vector<double> expected_residuals;
+  std::vector<double> expected_gradient;
+  ComputeExpectedTotalVariation(
+      image_data, gradient_constants, image_size, num_channels, true,
+      &expected_residuals, &expected_gradient);
+
+  super_resolution::TotalVariationRegularizer tv_regularizer(image_size);
+  tv_regularizer.SetUse3dTotalVariation(true);
+  const std::vector<double> residuals =
+      tv_regularizer.ApplyToImage(image_data.data(), num_channels);
+  const auto& residuals_and_gradient =
+      tv_regularizer.ApplyToImageWithDifferentiation(
+          image_data.data(), gradient_constants, num_channels);
+  for (int i = 0; i < num_parameters; ++i) {
+    ASSERT_NEAR(residuals[i], expected_residuals[i], 1e-12);
+    ASSERT_NEAR(residuals_and_gradient.first[i], expected_residuals[i], 1e-12);
+    ASSERT_NEAR(residuals_and_gradient.second[i], expected_gradient[i], 1e-9);
+  }
+
+  // The transpose operators must still be the adjoints of the operators.
+  const int num_operators = tv_regularizer.GetNumDifferenceOperators();
+  std::vector<double> differences(num_operators * num_parameters);
+  tv_regularizer.ApplyDifferenceOperators(
+      image_data.data(), num_channels, differences.data());
+  std::vector<double> test_differences(differences.size());
+  for (int i = 0; i < test_differences.size(); ++i) {
+    test_differences[i] = std::cos(0.7 * i);
+  }
+  std::vector<double> transpose(num_parameters);
+  tv_regularizer.ApplyDifferenceOperatorsTranspose(
+      test_differences.data(), num_channels, transpose.data());
+  double differences_dot_product = 0.0;
+  for (int i = 0; i < differences.size(); ++i) {
+    differences_dot_product += differences[i] * test_differences[i];
+  }
+  double image_dot_product = 0.0;
+  for (int i = 0; i < num_parameters; ++i) {
+    image_dot_product += image_data[i] * transpose[i];
+  }
+  EXPECT_NEAR(differences_dot_product, image_dot_product, 1e-6);
+}
+
+// Verifies that the fused weighted gradient matches differentiating with the
+// equivalent gradient constants, and that it adds to the existing gradient.
+TEST(TotalVariationRegularizer, AccumulateWeightedGradient) {
+  const cv::Size image_size(7, 5);
+  const int num_channels = 3;
+  const int num_parameters = image_size.area() * num_channels;
+  const double regularization_parameter = 0.3;
+  std::vector<double> image_data(num_parameters);
+  std::vector<double> weights(num_parameters);
+  std::vector<double> gradient_constants(num_parameters);
+  for (int i = 0; i < num_parameters; ++i) {
+    image_data[i] = std::sin(0.9 * i) * 2.0;
+    weights[i] = 1.0 / (1.0 + (i % 4));
+    gradient_constants[i] = regularization_parameter * weights[i];
+  }
+
+  for (const bool use_3d_total_variation : {false, true}) {
+    super_resolution::TotalVariationRegularizer tv_regularizer(image_size);
+    tv_regularizer.SetUse3dTotalVariation(use_3d_total_variation);
+    const auto& residuals_and_gradient =
+        tv_regularizer.ApplyToImageWithDifferentiation(
+            image_data.data(), gradient_constants, num_channels);
+    double expected_cost = 0.0;
+    for (int i = 0; i < num_parameters; ++i) {
+      const double residual = residuals_and_gradient.first[i];
+      expected_cost += gradient_constants[i] * residual * residual;
+    }
+
+    std::vector<double> gradient(num_parameters, 1.0);
+    std::vector<double> residuals(num_parameters);
+    const double cost = tv_regularizer.AccumulateWeightedGradient(
+        image_data.data(),
+        num_channels,
+        regularization_parameter,
+        weights.data(),
+        gradient.data(),
+        residuals.data());
+    EXPECT_NEAR(cost, expected_cost, 1e-9);
+    EXPECT_THAT(residuals, ContainerEq(residuals_and_gradient.first));
+    for (int i = 0; i < num_parameters; ++i) {
+      EXPECT_NEAR(gradient[i], residuals_and_gradient.second[i] + 1.0, 1e-9);
+    }
+
+    // The residuals are optional.
+    std::vector<double> gradient_without_residuals(num_parameters, 1.0);
+    EXPECT_EQ(
+        tv_regularizer.AccumulateWeightedGradient(
+            image_data.data(),
+            num_channels,
+            regularization_parameter,
+            weights.data(),
+            gradient_without_residuals.data(),
+            nullptr),
+        cost);
+    EXPECT_THAT(gradient_without_residuals, ContainerEq(gradient));
+  }
+}
+
+// Verifies the residuals and the gradient of images with 1 to 5 channels,
+// with and without 3D TV, against the direct computation.
+TEST(TotalVariationRegularizer, ChannelCounts) {
+  const cv::Size image_size(9, 6);
+  for (int num_channels = 1; num_channels <= 5; ++num_channels) {
+    const int num_parameters = image_size.area() * num_channels;
+    std::vector<double> image_data(num_parameters);
+    std::vector<double> gradient_constants(num_parameters);
+    for (int i = 0; i < num_parameters; ++i) {
+      image_data[i] = std::sin(1.3 * i) + 0.02 * (i % 7);
+      gradient_constants[i] = 0.25 + (i % 5) * 0.1;
+    }
+    for (const bool use_3d_total_variation : {false, true}) {
+      std::vector<double> expected_residuals;
+      std::vector<double> expected_gradient;
+      ComputeExpectedTotalVariation(
+          image_data, gradient_constants, image_size, num_channels,
+          use_3d_total_variation, &expected_residuals, &expected_gradient);
+
+      super_resolution::TotalVariationRegularizer tv_regularizer(image_size);
+      tv_regularizer.SetUse3dTotalVariation(use_3d_total_variation);
+      const std::vector<double> residuals =
+          tv_regularizer.ApplyToImage(image_data.data(), num_channels);
+      const auto& residuals_and_gradient =
+          tv_regularizer.ApplyToImageWithDifferentiation(
+              image_data.data(), gradient_constants, num_channels);
+      for (int i = 0; i < num_parameters; ++i) {
+        ASSERT_NEAR(residuals[i], expected_residuals[i], 1e-12)
+            << num_channels << " channels, index " << i;
+        ASSERT_NEAR(residuals_and_gradient.first[i], expected_residuals[i],
+                    1e-12);
+        ASSERT_NEAR(residuals_and_gradient.second[i], expected_gradient[i],
+                    1e-9) << num_channels << " channels, index " << i;
+      }
+    }
+  }
+}
@@ -1,3 +1,4 @@
+#include <cstdint>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -6,6 +7,8 @@
 #include "util/string_util.h"
 #include "util/util.h"
 
+#include "opencv2/core/core.hpp"
+
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 
@@ -80,6 +83,12 @@ TEST(Util, ReadConfigurationFile) {
   EXPECT_EQ(config_reader.GetValue("end_col"), "3");
   EXPECT_EQ(config_reader.GetValue("start_band"), "5");
   EXPECT_EQ(config_reader.GetValue("end_band"), "10");
+
+  // The keys are sorted.
+  const std::vector<std::string> keys = config_reader.GetKeys();
+  EXPECT_EQ(keys.size(), 15);
+  EXPECT_EQ(keys.front(), "big_endian");
+  EXPECT_EQ(keys.back(), "start_row");
 }
 
 TEST(Util, GetFileExtension) {
@@ -90,3 +99,16 @@ TEST(Util, GetFileExtension) {
   EXPECT_EQ(super_resolution::util::GetFileExtension("one.two.three"), "three");
   EXPECT_EQ(super_resolution::util::GetFileExtension("........dots"), "dots");
 }
+
+TEST(Util, GetPixelIndex) {
+  const cv::Size image_size(4, 3);
+  EXPECT_EQ(super_resolution::util::GetPixelIndex(image_size, 0, 0, 0), 0);
+  EXPECT_EQ(super_resolution::util::GetPixelIndex(image_size, 0, 1, 2), 6);
+  EXPECT_EQ(super_resolution::util::GetPixelIndex(image_size, 2, 1, 2), 30);
+
+  // Indices into large hyperspectral cubes must not overflow.
+  const cv::Size large_image_size(2048, 2048);
+  EXPECT_EQ(
+      super_resolution::util::GetPixelIndex(large_image_size, 255, 2047, 2047),
+      static_cast<int64_t>(2048) * 2048 * 256 - 1);
+}
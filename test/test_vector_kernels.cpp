@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "util/vector_kernels.h"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::util::SimdLevel;
+
+// Verifies that level names round trip and unknown names are rejected.
+TEST(VectorKernels, SimdLevelNames) {
+  for (const SimdLevel level : {
+      super_resolution::util::SIMD_LEVEL_BASELINE,
+      super_resolution::util::SIMD_LEVEL_SSE4,
+      super_resolution::util::SIMD_LEVEL_AVX2,
+      super_resolution::util::SIMD_LEVEL_AVX512}) {
+    SimdLevel parsed_level;
+    EXPECT_TRUE(super_resolution::util::ParseSimdLevel(
+        super_resolution::util::GetSimdLevelName(level), &parsed_level));
+    EXPECT_EQ(parsed_level, level);
+  }
+  SimdLevel parsed_level;
+  EXPECT_FALSE(super_resolution::util::ParseSimdLevel("mmx", &parsed_level));
+}
+
+// Verifies every kernel against a scalar computation at every level the CPU
+// supports. The lengths are not multiples of the vector widths, so the
+// remainder loops are also run.
+TEST(VectorKernels, MatchScalarComputation) {
+  const SimdLevel supported_level =
+      super_resolution::util::GetSupportedSimdLevel();
+  const int64_t num_values = 1027;
+  std::vector<double> x(num_values);
+  std::vector<double> y(num_values);
+  for (int64_t i = 0; i < num_values; ++i) {
+    x[i] = std::sin(0.3 * i);
+    y[i] = std::cos(1.1 * i) * 2.0;
+  }
+
+  for (int level = 0; level <= supported_level; ++level) {
+    super_resolution::util::SetSimdLevel(static_cast<SimdLevel>(level));
+    EXPECT_EQ(super_resolution::util::GetSimdLevel(), level);
+
+    std::vector<double> combination(num_values);
+    super_resolution::util::LinearCombination(
+        num_values, 0.5, x.data(), -2.0, y.data(), combination.data());
+    double expected_dot_product = 0.0;
+    for (int64_t i = 0; i < num_values; ++i) {
+      EXPECT_NEAR(combination[i], 0.5 * x[i] - 2.0 * y[i], 1e-12);
+      expected_dot_product += x[i] * y[i];
+    }
+    EXPECT_NEAR(
+        super_resolution::util::DotProduct(num_values, x.data(), y.data()),
+        expected_dot_product,
+        1e-9);
+
+    // Residuals against an observation, and against zero.
+    std::vector<double> degraded = x;
+    const double residual_sum =
+        super_resolution::util::ComputeWeightedResiduals(
+            num_values, y.data(), 3.0, degraded.data());
+    double expected_residual_sum = 0.0;
+    for (int64_t i = 0; i < num_values; ++i) {
+      const double residual = x[i] - y[i];
+      expected_residual_sum += residual * residual;
+      EXPECT_NEAR(degraded[i], 3.0 * residual, 1e-12);
+    }
+    EXPECT_NEAR(residual_sum, expected_residual_sum, 1e-9);
+
+    std::vector<float> degraded_float(x.begin(), x.end());
+    const float* no_observation = nullptr;
+    const double float_residual_sum =
+        super_resolution::util::ComputeWeightedResiduals(
+            num_values, no_observation, 2.0, degraded_float.data());
+    double expected_float_residual_sum = 0.0;
+    for (int64_t i = 0; i < num_values; ++i) {
+      const double residual = static_cast<float>(x[i]);
+      expected_float_residual_sum += residual * residual;
+      EXPECT_FLOAT_EQ(degraded_float[i], 2.0 * residual);
+    }
+    EXPECT_NEAR(float_residual_sum, expected_float_residual_sum, 1e-6);
+
+    // Residuals against observations encoded as half precision values and
+    // as quantized codes.
+    std::vector<uint16_t> codes(num_values);
+    for (int64_t i = 0; i < num_values; ++i) {
+      codes[i] = super_resolution::util::EncodeHalf(y[i]);
+    }
+    degraded = x;
+    const double half_residual_sum =
+        super_resolution::util::ComputeWeightedResidualsHalf(
+            num_values, codes.data(), 3.0, degraded.data());
+    double expected_half_residual_sum = 0.0;
+    for (int64_t i = 0; i < num_values; ++i) {
+      const double residual =
+          x[i] - super_resolution::util::DecodeHalf(codes[i]);
+      expected_half_residual_sum += residual * residual;
+      EXPECT_NEAR(degraded[i], 3.0 * residual, 1e-12);
+    }
+    EXPECT_NEAR(half_residual_sum, expected_half_residual_sum, 1e-9);
+
+    for (int64_t i = 0; i < num_values; ++i) {
+      codes[i] = static_cast<uint16_t>(i * 61);
+    }
+    degraded_float.assign(x.begin(), x.end());
+    const double quantized_residual_sum =
+        super_resolution::util::ComputeWeightedResidualsQuantized(
+            num_values, codes.data(), 1e-5, -0.5, 2.0, degraded_float.data());
+    double expected_quantized_residual_sum = 0.0;
+    for (int64_t i = 0; i < num_values; ++i) {
+      const double residual =
+          static_cast<float>(x[i]) - (1e-5 * codes[i] - 0.5);
+      expected_quantized_residual_sum += residual * residual;
+      EXPECT_FLOAT_EQ(degraded_float[i], 2.0 * residual);
+    }
+    EXPECT_NEAR(
+        quantized_residual_sum, expected_quantized_residual_sum, 1e-6);
+
+    // Summaries accumulate over several arrays.
+    super_resolution::util::ValueSummary summary;
+    super_resolution::util::SummarizeValues(num_values, y.data(), &summary);
+    super_resolution::util::SummarizeValues(
+        num_values, degraded_float.data(), &summary);
+    int64_t expected_num_negative_values = 0;
+    int64_t expected_num_over_one_values = 0;
+    double expected_min_value = y[0];
+    double expected_max_value = y[0];
+    for (int64_t i = 0; i < num_values; ++i) {
+      for (const double value : {y[i], double(degraded_float[i])}) {
+        expected_num_negative_values += (value < 0.0);
+        expected_num_over_one_values += (value > 1.0);
+        expected_min_value = std::min(expected_min_value, value);
+        expected_max_value = std::max(expected_max_value, value);
+      }
+    }
+    EXPECT_EQ(summary.num_negative_values, expected_num_negative_values);
+    EXPECT_EQ(summary.num_over_one_values, expected_num_over_one_values);
+    EXPECT_EQ(summary.min_value, expected_min_value);
+    EXPECT_EQ(summary.max_value, expected_max_value);
+  }
+
+  // Levels above the supported one are lowered to it.
+  super_resolution::util::SetSimdLevel(
+      super_resolution::util::SIMD_LEVEL_AVX512);
+  EXPECT_EQ(super_resolution::util::GetSimdLevel(), supported_level);
+}
+
+// Verifies the conversions between single and half precision, including
+// rounding, subnormal values, and values beyond the half range.
+TEST(VectorKernels, HalfPrecisionConversion) {
+  using super_resolution::util::DecodeHalf;
+  using super_resolution::util::EncodeHalf;
+
+  for (const float value : {0.0f, 1.0f, -2.5f, 0.125f, 65504.0f, -1024.0f}) {
+    EXPECT_EQ(DecodeHalf(EncodeHalf(value)), value);
+  }
+  EXPECT_EQ(EncodeHalf(1.0f), 0x3c00);
+  EXPECT_EQ(EncodeHalf(-0.0f), 0x8000);
+
+  // 1 + 2^-11 is halfway between two half values, and rounds to even.
+  EXPECT_EQ(EncodeHalf(1.0f + std::pow(2.0f, -11.0f)), 0x3c00);
+  EXPECT_EQ(EncodeHalf(1.0f + 3.0f * std::pow(2.0f, -11.0f)), 0x3c02);
+
+  // The smallest subnormal half value is 2^-24.
+  EXPECT_EQ(EncodeHalf(std::pow(2.0f, -24.0f)), 0x0001);
+  EXPECT_EQ(DecodeHalf(0x0001), std::pow(2.0f, -24.0f));
+  EXPECT_EQ(DecodeHalf(0x03ff), 1023.0f * std::pow(2.0f, -24.0f));
+
+  // Infinities and NaNs are compared by their bit patterns, since
+  // std::isinf() and std::isnan() may be folded to false under -ffast-math.
+  const auto float_bits = [](const float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  };
+  const auto bits_float = [](const uint32_t bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  };
+  EXPECT_EQ(EncodeHalf(1e6f), 0x7c00);
+  EXPECT_EQ(float_bits(DecodeHalf(0xfc00)), 0xff800000u);
+  const uint16_t nan_half = EncodeHalf(bits_float(0x7fc00000u));
+  EXPECT_EQ(nan_half & 0x7c00, 0x7c00);
+  EXPECT_NE(nan_half & 0x03ff, 0);
+
+  // Every half value survives a round trip.
+  for (int half = 0; half < 0x10000; ++half) {
+    if ((half & 0x7c00) == 0x7c00 && (half & 0x03ff) != 0) {
+      continue;
+    }
+    EXPECT_EQ(EncodeHalf(DecodeHalf(half)), half);
+  }
+}
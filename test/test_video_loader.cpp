@@ -0,0 +1,104 @@
+#include <string>
+#include <vector>
+
+#include "util/test_util.h"
+#include "util/util.h"
+#include "video/video_loader.h"
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+
+using super_resolution::VideoLoader;
+using super_resolution::test::AreMatricesEqual;
+using super_resolution::util::GetAbsoluteCodePath;
+
+// The test data directory contains both images and other files, which load as
+// empty frames.
+static const std::string kTestFrameDirectory =
+    GetAbsoluteCodePath("test_data");
+
+// Verifies that the frames of a directory are only counted as decoded when
+// accessed, and that they match the image files, with one and several
+// decoding threads.
+TEST(VideoLoader, LoadsDirectoryFramesLazily) {
+  const std::vector<std::string> file_names =
+      super_resolution::util::ListFilesInDirectory(kTestFrameDirectory);
+  ASSERT_FALSE(file_names.empty());
+
+  for (const int num_threads : {1, 3}) {
+    VideoLoader video_loader(
+        super_resolution::kDefaultMaxNumCachedFrames, num_threads);
+    video_loader.LoadFramesFromDirectory(kTestFrameDirectory);
+    EXPECT_EQ(video_loader.GetNumFrames(), file_names.size());
+    EXPECT_EQ(video_loader.GetNumFramesDecoded(), 0);
+
+    int frame_index = 0;
+    int num_valid_frames = 0;
+    for (const cv::Mat& frame : video_loader) {
+      const cv::Mat expected_frame = cv::imread(
+          kTestFrameDirectory + "/" + file_names[frame_index],
+          CV_LOAD_IMAGE_COLOR);
+      EXPECT_EQ(frame.empty(), expected_frame.empty());
+      if (!frame.empty()) {
+        EXPECT_TRUE(AreMatricesEqual(
+            frame.reshape(1), expected_frame.reshape(1)));
+        num_valid_frames++;
+      }
+      frame_index++;
+    }
+    EXPECT_EQ(frame_index, file_names.size());
+    EXPECT_GT(num_valid_frames, 0);
+    EXPECT_EQ(video_loader.GetNumFramesDecoded(), file_names.size());
+  }
+}
+
+// Verifies that frames accessed out of order are decoded when accessed, and
+// that the prefetched frames in order are still returned afterwards.
+TEST(VideoLoader, OutOfOrderAccess) {
+  VideoLoader video_loader(
+      super_resolution::GetNumCachedFramesForTemporalRadius(1), 2);
+  video_loader.LoadFramesFromDirectory(kTestFrameDirectory);
+  ASSERT_GE(video_loader.GetNumFrames(), 3);
+  const std::vector<std::string> file_names =
+      super_resolution::util::ListFilesInDirectory(kTestFrameDirectory);
+  for (const int frame_index : {2, 0, 1, 2}) {
+    const cv::Mat frame = video_loader.GetFrame(frame_index);
+    const cv::Mat expected_frame = cv::imread(
+        kTestFrameDirectory + "/" + file_names[frame_index],
+        CV_LOAD_IMAGE_COLOR);
+    EXPECT_EQ(frame.empty(), expected_frame.empty());
+    if (!frame.empty()) {
+      EXPECT_TRUE(AreMatricesEqual(
+          frame.reshape(1), expected_frame.reshape(1)));
+    }
+  }
+  // The cache holds all three frames, so frame 2 was not decoded again.
+  EXPECT_EQ(video_loader.GetNumFramesDecoded(), 3);
+}
+
+// Verifies that only the most recently used frames are cached.
+TEST(VideoLoader, CachesRecentFrames) {
+  VideoLoader video_loader(2);
+  video_loader.LoadFramesFromDirectory(kTestFrameDirectory);
+  ASSERT_GE(video_loader.GetNumFrames(), 3);
+
+  video_loader.GetFrame(0);
+  video_loader.GetFrame(1);
+  video_loader.GetFrame(0);
+  EXPECT_EQ(video_loader.GetNumFramesDecoded(), 2);
+
+  // Frame 1 is the least recently used, so it is evicted by frame 2.
+  video_loader.GetFrame(2);
+  video_loader.GetFrame(0);
+  EXPECT_EQ(video_loader.GetNumFramesDecoded(), 3);
+  video_loader.GetFrame(1);
+  EXPECT_EQ(video_loader.GetNumFramesDecoded(), 4);
+
+  // Reopening clears the cache.
+  video_loader.LoadFramesFromDirectory(kTestFrameDirectory);
+  video_loader.GetFrame(1);
+  EXPECT_EQ(video_loader.GetNumFramesDecoded(), 5);
+}
@@ -1,4 +1,5 @@
 #include <string>
+#include <vector>
 
 #include "image/image_data.h"
 #include "util/data_loader.h"
@@ -11,7 +12,9 @@
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 
+using super_resolution::ImageData;
 using super_resolution::util::GetAbsoluteCodePath;
+using super_resolution::wavelet::GetSubbandRegion;
 
 static const std::string kTestImagePath =
     GetAbsoluteCodePath("test_data/dallas.jpg");
@@ -42,3 +45,103 @@ TEST(WaveletTransform, WaveletTransform) {
   //     coefficients.GetCoefficientsImage()
   // });
 }
+
+// Verifies the single level Haar coefficients of a 2x2 image.
+TEST(WaveletTransform, HaarCoefficients) {
+  const cv::Mat image = (cv::Mat_<double>(2, 2) << 1.0, 2.0, 3.0, 5.0);
+  const super_resolution::wavelet::WaveletCoefficients coefficients =
+      super_resolution::wavelet::WaveletTransform(ImageData(image));
+  EXPECT_NEAR(coefficients.ll.GetPixelValue(0, 0, 0), 5.5, 1.0e-12);
+  EXPECT_NEAR(coefficients.lh.GetPixelValue(0, 0, 0), -1.5, 1.0e-12);
+  EXPECT_NEAR(coefficients.hl.GetPixelValue(0, 0, 0), -2.5, 1.0e-12);
+  EXPECT_NEAR(coefficients.hh.GetPixelValue(0, 0, 0), 0.5, 1.0e-12);
+}
+
+// Verifies that the subbands are views of one transformed image instead of
+// copies, and that a copy of a subband image has continuous channels.
+TEST(WaveletTransform, SubbandViews) {
+  const cv::Mat image = (cv::Mat_<double>(5, 4) <<
+      1.0, 2.0, 3.0, 4.0,
+      5.0, 6.0, 7.0, 8.0,
+      9.0, 10.0, 11.0, 12.0,
+      13.0, 14.0, 15.0, 16.0,
+      17.0, 18.0, 19.0, 20.0);
+  const super_resolution::wavelet::WaveletCoefficients coefficients =
+      super_resolution::wavelet::WaveletTransform(ImageData(image));
+  const cv::Mat ll = coefficients.ll.GetChannelImage(0);
+  const cv::Mat lh = coefficients.lh.GetChannelImage(0);
+  const cv::Mat hl = coefficients.hl.GetChannelImage(0);
+  const cv::Mat hh = coefficients.hh.GetChannelImage(0);
+  EXPECT_EQ(ll.size(), cv::Size(2, 2));
+  EXPECT_EQ(ll.datastart, lh.datastart);
+  EXPECT_EQ(ll.datastart, hl.datastart);
+  EXPECT_EQ(ll.datastart, hh.datastart);
+  EXPECT_FALSE(hh.isContinuous());
+
+  const ImageData hh_copy = coefficients.hh;
+  EXPECT_TRUE(hh_copy.GetChannelImage(0).isContinuous());
+  EXPECT_EQ(hh_copy.GetPixelValue(0, 1, 1),
+            coefficients.hh.GetPixelValue(0, 1, 1));
+}
+
+// Verifies that the multilevel lifting transform is inverted exactly for all
+// filters and odd image sizes, and that constant images have no details.
+TEST(WaveletTransform, LiftingWaveletTransform) {
+  const std::vector<super_resolution::wavelet::WaveletFilter> filters = {
+    super_resolution::wavelet::WAVELET_FILTER_HAAR,
+    super_resolution::wavelet::WAVELET_FILTER_CDF_5_3,
+    super_resolution::wavelet::WAVELET_FILTER_CDF_9_7
+  };
+  const int num_levels = 3;
+  cv::Mat random_image(23, 37, CV_64FC1);
+  cv::randu(random_image, 0.0, 1.0);
+  ImageData original_image(random_image);
+  original_image.AddChannel(cv::Mat(23, 37, CV_64FC1, cv::Scalar(0.5)));
+
+  for (const auto filter : filters) {
+    ImageData image = original_image;
+    super_resolution::wavelet::LiftingWaveletTransform(
+        filter, num_levels, &image, 2);
+    EXPECT_FALSE(super_resolution::test::AreImagesEqual(
+        image, original_image, 1.0e-3));
+
+    // The constant channel only has coefficients in the coarsest LL subband.
+    const cv::Mat constant_channel = image.GetChannelImage(1);
+    for (int level = 1; level <= num_levels; ++level) {
+      for (const auto subband : {
+               super_resolution::wavelet::WAVELET_SUBBAND_LH,
+               super_resolution::wavelet::WAVELET_SUBBAND_HL,
+               super_resolution::wavelet::WAVELET_SUBBAND_HH}) {
+        const cv::Mat details = constant_channel(
+            GetSubbandRegion(image.GetImageSize(), level, subband));
+        EXPECT_LT(cv::norm(details, cv::NORM_INF), 1.0e-12);
+      }
+    }
+
+    super_resolution::wavelet::InverseLiftingWaveletTransform(
+        filter, num_levels, &image, 2);
+    EXPECT_TRUE(super_resolution::test::AreImagesEqual(
+        image, original_image, 1.0e-10));
+  }
+}
+
+// Verifies the subband regions of an odd-sized image.
+TEST(WaveletTransform, GetSubbandRegion) {
+  const cv::Size image_size(7, 5);
+  EXPECT_EQ(
+      GetSubbandRegion(
+          image_size, 1, super_resolution::wavelet::WAVELET_SUBBAND_LL),
+      cv::Rect(0, 0, 4, 3));
+  EXPECT_EQ(
+      GetSubbandRegion(
+          image_size, 1, super_resolution::wavelet::WAVELET_SUBBAND_LH),
+      cv::Rect(4, 0, 3, 3));
+  EXPECT_EQ(
+      GetSubbandRegion(
+          image_size, 1, super_resolution::wavelet::WAVELET_SUBBAND_HL),
+      cv::Rect(0, 3, 4, 2));
+  EXPECT_EQ(
+      GetSubbandRegion(
+          image_size, 2, super_resolution::wavelet::WAVELET_SUBBAND_HH),
+      cv::Rect(2, 2, 2, 1));
+}